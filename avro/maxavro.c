@@ -163,6 +163,47 @@ bool maxavro_skip_string(MAXAVRO_FILE* file)
     return false;
 }
 
+/**
+ * @brief Read an Avro fixed value
+ *
+ * The fixed values are stored without a length as the length is defined in
+ * the schema.
+ * @param file File to read from
+ * @param size Size of the value
+ * @return Pointer to newly allocated value or NULL if an error occurred
+ *
+ * @see maxavro_get_error
+ */
+char* maxavro_read_fixed(MAXAVRO_FILE* file, size_t size)
+{
+    char *rval = malloc(size + 1);
+
+    if (rval)
+    {
+        size_t nread = fread(rval, 1, size, file->file);
+
+        if (nread == size)
+        {
+            rval[size] = '\0';
+        }
+        else
+        {
+            if (nread != 0)
+            {
+                file->last_error = MAXAVRO_ERR_IO;
+            }
+            free(rval);
+            rval = NULL;
+        }
+    }
+    else
+    {
+        file->last_error = MAXAVRO_ERR_MEMORY;
+    }
+
+    return rval;
+}
+
 /**
  * @brief Calculate the length of an Avro string
  * @param val Vale to calculate
@@ -39,14 +39,17 @@ enum maxavro_value_type
     MAXAVRO_TYPE_BYTES,
     MAXAVRO_TYPE_ENUM,
     MAXAVRO_TYPE_NULL,
+    MAXAVRO_TYPE_UNION,
+    MAXAVRO_TYPE_FIXED,
     MAXAVRO_TYPE_MAX
 };
 
 typedef struct
 {
     char *name;
-    void *extra;
+    void *extra; /*< Symbols of an enum, branches of a union as a MAXAVRO_SCHEMA */
     enum maxavro_value_type type;
+    size_t size; /*< Size of a fixed value */
 } MAXAVRO_SCHEMA_FIELD;
 
 typedef struct
@@ -88,6 +91,14 @@ typedef struct
     uint8_t sync[SYNC_MARKER_SIZE];
 } MAXAVRO_FILE;
 
+/** Text into which records are written as JSON */
+typedef struct
+{
+    char *data; /*< The text, not null-terminated */
+    size_t length; /*< Length of the text */
+    size_t size; /*< Size of the allocated memory */
+} MAXAVRO_JSON_BUFFER;
+
 /** A record field value */
 typedef union
 {
@@ -141,6 +152,7 @@ bool maxavro_datablock_add_double(MAXAVRO_DATABLOCK *file, double val);
 bool maxavro_read_integer(MAXAVRO_FILE *file, uint64_t *val);
 char* maxavro_read_string(MAXAVRO_FILE *file, size_t *size);
 bool maxavro_skip_string(MAXAVRO_FILE* file);
+char* maxavro_read_fixed(MAXAVRO_FILE *file, size_t size);
 bool maxavro_read_float(MAXAVRO_FILE *file, float *dest);
 bool maxavro_read_double(MAXAVRO_FILE *file, double *dest);
 
@@ -154,6 +166,10 @@ GWBUF* maxavro_record_read_binary(MAXAVRO_FILE *file);
 bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset);
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos);
 bool maxavro_next_block(MAXAVRO_FILE *file);
+void maxavro_record_skip_block(MAXAVRO_FILE *file);
+bool maxavro_read_datablock_start(MAXAVRO_FILE *file);
+bool maxavro_record_write_json(MAXAVRO_FILE *file, MAXAVRO_JSON_BUFFER *buf, uint64_t *integers);
+void maxavro_json_buffer_free(MAXAVRO_JSON_BUFFER *buf);
 
 /** File operations */
 MAXAVRO_FILE* maxavro_file_open(const char* filename);
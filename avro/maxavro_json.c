@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxavro_json.c - Conversion of Avro records straight into JSON text
+ *
+ * The records are written into a text buffer as they are read, without
+ * building a JSON object for each record. The text is the same that
+ * json_dumps() with JSON_PRESERVE_ORDER produces for the object returned
+ * by maxavro_record_read_json(), and the same records are rejected.
+ */
+
+#include "maxavro.h"
+#include <math.h>
+#include <string.h>
+#include <maxscale/debug.h>
+#include <maxscale/log_manager.h>
+
+const char* type_to_string(enum maxavro_value_type type);
+
+/**
+ * @brief Make room for more text
+ *
+ * @param buf Buffer to grow
+ * @param len Number of bytes that are about to be added
+ * @return True if there is room for @c len more bytes
+ */
+static bool reserve(MAXAVRO_JSON_BUFFER *buf, size_t len)
+{
+    if (buf->length + len > buf->size)
+    {
+        size_t size = buf->size ? buf->size : 1024;
+
+        while (size < buf->length + len)
+        {
+            size *= 2;
+        }
+
+        char *data = realloc(buf->data, size);
+
+        if (data == NULL)
+        {
+            return false;
+        }
+
+        buf->data = data;
+        buf->size = size;
+    }
+
+    return true;
+}
+
+static bool append(MAXAVRO_JSON_BUFFER *buf, const char *str, size_t len)
+{
+    if (reserve(buf, len))
+    {
+        memcpy(buf->data + buf->length, str, len);
+        buf->length += len;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check that a string is valid UTF-8, as jansson requires of strings
+ *
+ * @param str String to check
+ * @param len Length of the string
+ * @return True if the string is valid UTF-8
+ */
+static bool is_valid_utf8(const uint8_t *str, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len)
+    {
+        uint8_t c = str[i];
+        size_t n;
+        uint32_t value;
+
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        else if (c >= 0xc2 && c <= 0xdf)
+        {
+            n = 2;
+            value = c & 0x1f;
+        }
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            n = 3;
+            value = c & 0x0f;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            n = 4;
+            value = c & 0x07;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (i + n > len)
+        {
+            return false;
+        }
+
+        for (size_t j = 1; j < n; j++)
+        {
+            if ((str[i + j] & 0xc0) != 0x80)
+            {
+                return false;
+            }
+            value = (value << 6) | (str[i + j] & 0x3f);
+        }
+
+        /** Overlong encodings, values past the last code point and surrogates */
+        if ((n == 3 && value < 0x800) || (n == 4 && value < 0x10000) ||
+            value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff))
+        {
+            return false;
+        }
+
+        i += n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Append a quoted and escaped JSON string
+ *
+ * @param buf Buffer to append to
+ * @param str The string
+ * @param len Length of the string
+ * @return True if the string was valid UTF-8 and it was appended
+ */
+static bool append_string(MAXAVRO_JSON_BUFFER *buf, const char *str, size_t len)
+{
+    if (!is_valid_utf8((const uint8_t*)str, len) || !append(buf, "\"", 1))
+    {
+        return false;
+    }
+
+    size_t start = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t c = str[i];
+
+        if (c == '"' || c == '\\' || c < 0x20)
+        {
+            char seq[7];
+            const char *esc = seq;
+
+            switch (c)
+            {
+            case '"':
+                esc = "\\\"";
+                break;
+            case '\\':
+                esc = "\\\\";
+                break;
+            case '\b':
+                esc = "\\b";
+                break;
+            case '\f':
+                esc = "\\f";
+                break;
+            case '\n':
+                esc = "\\n";
+                break;
+            case '\r':
+                esc = "\\r";
+                break;
+            case '\t':
+                esc = "\\t";
+                break;
+            default:
+                snprintf(seq, sizeof(seq), "\\u%04X", c);
+                break;
+            }
+
+            if (!append(buf, str + start, i - start) || !append(buf, esc, strlen(esc)))
+            {
+                return false;
+            }
+
+            start = i + 1;
+        }
+    }
+
+    return append(buf, str + start, len - start) && append(buf, "\"", 1);
+}
+
+/**
+ * @brief Append a floating point number the way jansson formats it
+ *
+ * @param buf Buffer to append to
+ * @param d   The number
+ * @return True if the number was finite and it was appended
+ */
+static bool append_real(MAXAVRO_JSON_BUFFER *buf, double d)
+{
+    if (!isfinite(d))
+    {
+        return false;
+    }
+
+    char str[64];
+    int len = snprintf(str, sizeof(str) - 2, "%.17g", d);
+
+    if (len < 0 || len >= (int)sizeof(str) - 2)
+    {
+        return false;
+    }
+
+    if (strspn(str, "0123456789-") == (size_t)len)
+    {
+        /** Make sure the number is read back as a real number */
+        memcpy(str + len, ".0", 3);
+        len += 2;
+    }
+
+    char *exp = strchr(str, 'e');
+
+    if (exp)
+    {
+        /** Remove the plus sign and the leading zeros of the exponent */
+        char *start = exp + 1;
+
+        if (*start == '-')
+        {
+            start++;
+        }
+
+        char *end = start;
+
+        while (*end == '+' || *end == '0')
+        {
+            end++;
+        }
+
+        if (end != start)
+        {
+            memmove(start, end, str + len + 1 - end);
+            len -= end - start;
+        }
+    }
+
+    return append(buf, str, len);
+}
+
+/**
+ * @brief Read a single value and append it as JSON
+ *
+ * @param file  File to read from
+ * @param field The field of the value
+ * @param buf   Buffer to append to
+ * @param integer If the value is an integer, it is stored here
+ * @return True if the value was read and appended
+ */
+static bool write_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *field,
+                        MAXAVRO_JSON_BUFFER *buf, uint64_t *integer)
+{
+    char str[32];
+    bool rval = false;
+
+    switch (field->type)
+    {
+    case MAXAVRO_TYPE_BOOL:
+        {
+            int i = 0;
+            if (fread(&i, 1, 1, file->file) == 1)
+            {
+                rval = i ? append(buf, "true", 4) : append(buf, "false", 5);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_INT:
+    case MAXAVRO_TYPE_LONG:
+        {
+            uint64_t val = 0;
+            if (maxavro_read_integer(file, &val))
+            {
+                *integer = val;
+                int len = snprintf(str, sizeof(str), "%lld", (long long)val);
+                rval = append(buf, str, len);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_ENUM:
+        {
+            uint64_t val = 0;
+            maxavro_read_integer(file, &val);
+
+            json_t *arr = field->extra;
+            ss_dassert(arr);
+            ss_dassert(json_is_array(arr));
+
+            if (val < json_array_size(arr))
+            {
+                json_t *symbol = json_array_get(arr, val);
+                ss_dassert(json_is_string(symbol));
+                const char *value = json_string_value(symbol);
+                rval = value && append_string(buf, value, strlen(value));
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_FLOAT:
+        {
+            float f = 0;
+            if (maxavro_read_float(file, &f))
+            {
+                rval = append_real(buf, f);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_DOUBLE:
+        {
+            double d = 0;
+            if (maxavro_read_double(file, &d))
+            {
+                rval = append_real(buf, d);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_BYTES:
+    case MAXAVRO_TYPE_STRING:
+        {
+            size_t len;
+            char *value = maxavro_read_string(file, &len);
+            if (value)
+            {
+                rval = append_string(buf, value, len);
+                free(value);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_FIXED:
+        {
+            char *value = maxavro_read_fixed(file, field->size);
+            if (value)
+            {
+                rval = append_string(buf, value, field->size);
+                free(value);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_UNION:
+        {
+            uint64_t val = 0;
+            MAXAVRO_SCHEMA *branches = field->extra;
+
+            if (maxavro_read_integer(file, &val) && val < branches->num_fields)
+            {
+                rval = write_value(file, &branches->fields[val], buf, integer);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_NULL:
+        rval = append(buf, "null", 4);
+        break;
+
+    default:
+        MXS_ERROR("Unimplemented type: %d", field->type);
+        break;
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Read a record and append it as a line of JSON
+ *
+ * The record is followed by a newline. Nothing is appended if the record
+ * cannot be read or converted.
+ *
+ * @param file     File to read from
+ * @param buf      Buffer to append to
+ * @param integers If not NULL, the values of the integer fields are stored
+ *                 here by the index of the field in the schema
+ * @return True if a record was appended. False at the end of the data block
+ *         or if an error occurred.
+ */
+bool maxavro_record_write_json(MAXAVRO_FILE *file, MAXAVRO_JSON_BUFFER *buf, uint64_t *integers)
+{
+    if ((!file->metadata_read && !maxavro_read_datablock_start(file)) ||
+        file->records_read_from_block >= file->records_in_block)
+    {
+        return false;
+    }
+
+    size_t start = buf->length;
+    bool ok = append(buf, "{", 1);
+
+    for (size_t i = 0; ok && i < file->schema->num_fields; i++)
+    {
+        MAXAVRO_SCHEMA_FIELD *field = &file->schema->fields[i];
+        uint64_t integer = 0;
+
+        ok = (i == 0 || append(buf, ", ", 2)) &&
+             append_string(buf, field->name, strlen(field->name)) &&
+             append(buf, ": ", 2);
+
+        if (ok && !(ok = write_value(file, field, buf, &integer)))
+        {
+            long pos = ftell(file->file);
+            MXS_ERROR("Failed to read field value '%s', type '%s' at "
+                      "file offset %ld, record number %lu.",
+                      field->name, type_to_string(field->type),
+                      pos, file->records_read);
+        }
+
+        if (integers)
+        {
+            integers[i] = integer;
+        }
+    }
+
+    if (ok && append(buf, "}\n", 2))
+    {
+        file->records_read_from_block++;
+        file->records_read++;
+        return true;
+    }
+
+    buf->length = start;
+    return false;
+}
+
+/**
+ * @brief Free the memory of a JSON buffer
+ *
+ * @param buf Buffer to free, it can be used again afterwards
+ */
+void maxavro_json_buffer_free(MAXAVRO_JSON_BUFFER *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->length = 0;
+    buf->size = 0;
+}
@@ -66,7 +66,7 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
             ss_dassert(arr);
             ss_dassert(json_is_array(arr));
 
-            if (json_array_size(arr) >= val)
+            if (json_array_size(arr) > val)
             {
                 json_t * symbol = json_array_get(arr, val);
                 ss_dassert(json_is_string(symbol));
@@ -109,6 +109,34 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
         }
         break;
 
+    case MAXAVRO_TYPE_FIXED:
+        {
+            char *str = maxavro_read_fixed(file, field->size);
+            if (str)
+            {
+                value = json_stringn(str, field->size);
+                free(str);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_UNION:
+        {
+            /** Only the value of the branch is stored, not the branch itself */
+            uint64_t val = 0;
+            MAXAVRO_SCHEMA *branches = field->extra;
+
+            if (maxavro_read_integer(file, &val) && val < branches->num_fields)
+            {
+                value = read_and_pack_value(file, &branches->fields[val]);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_NULL:
+        value = json_null();
+        break;
+
     default:
         MXS_ERROR("Unimplemented type: %d", field->type);
         break;
@@ -116,9 +144,9 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
     return value;
 }
 
-static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
+static void skip_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *field)
 {
-    switch (type)
+    switch (field->type)
     {
     case MAXAVRO_TYPE_INT:
     case MAXAVRO_TYPE_LONG:
@@ -129,7 +157,17 @@ static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
         }
         break;
 
+    case MAXAVRO_TYPE_BOOL:
+        fseek(file->file, 1, SEEK_CUR);
+        break;
+
     case MAXAVRO_TYPE_FLOAT:
+        {
+            float f = 0;
+            maxavro_read_float(file, &f);
+        }
+        break;
+
     case MAXAVRO_TYPE_DOUBLE:
         {
             double d = 0;
@@ -144,8 +182,27 @@ static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
         }
         break;
 
+    case MAXAVRO_TYPE_FIXED:
+        fseek(file->file, field->size, SEEK_CUR);
+        break;
+
+    case MAXAVRO_TYPE_UNION:
+        {
+            uint64_t val = 0;
+            MAXAVRO_SCHEMA *branches = field->extra;
+
+            if (maxavro_read_integer(file, &val) && val < branches->num_fields)
+            {
+                skip_value(file, &branches->fields[val]);
+            }
+        }
+        break;
+
+    case MAXAVRO_TYPE_NULL:
+        break;
+
     default:
-        MXS_ERROR("Unimplemented type: %d - %s", type, type_to_string(type));
+        MXS_ERROR("Unimplemented type: %d - %s", field->type, type_to_string(field->type));
         break;
     }
 }
@@ -204,7 +261,7 @@ static void skip_record(MAXAVRO_FILE *file)
 {
     for (size_t i = 0; i < file->schema->num_fields; i++)
     {
-        skip_value(file, file->schema->fields[i].type);
+        skip_value(file, &file->schema->fields[i]);
     }
     file->records_read_from_block++;
     file->records_read++;
@@ -238,6 +295,24 @@ bool maxavro_next_block(MAXAVRO_FILE *file)
     return false;
 }
 
+/**
+ * @brief Skip the unread records of the current data block
+ *
+ * The file is left at the end of the block as if all of its records had been
+ * read. This is used when the records of the block are available elsewhere.
+ *
+ * @param file File to skip the records of
+ */
+void maxavro_record_skip_block(MAXAVRO_FILE *file)
+{
+    if (file->records_read_from_block < file->records_in_block)
+    {
+        file->records_read += file->records_in_block - file->records_read_from_block;
+        file->records_read_from_block = file->records_in_block;
+        fseek(file->file, file->data_start_pos + file->block_size, SEEK_SET);
+    }
+}
+
 /**
  * @brief Seek to a position in the Avro file
  *
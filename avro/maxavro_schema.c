@@ -17,17 +17,20 @@
 #include <maxscale/debug.h>
 #include <maxscale/log_manager.h>
 
-static const MAXAVRO_SCHEMA_FIELD types[MAXAVRO_TYPE_MAX] =
+static const MAXAVRO_SCHEMA_FIELD types[] =
 {
     {"int", NULL, MAXAVRO_TYPE_INT},
     {"long", NULL, MAXAVRO_TYPE_LONG},
     {"float", NULL, MAXAVRO_TYPE_FLOAT},
     {"double", NULL, MAXAVRO_TYPE_DOUBLE},
     {"bool", NULL, MAXAVRO_TYPE_BOOL},
+    {"boolean", NULL, MAXAVRO_TYPE_BOOL},
     {"bytes", NULL, MAXAVRO_TYPE_BYTES},
     {"string", NULL, MAXAVRO_TYPE_STRING},
     {"enum", NULL, MAXAVRO_TYPE_ENUM},
     {"null", NULL, MAXAVRO_TYPE_NULL},
+    {"union", NULL, MAXAVRO_TYPE_UNION},
+    {"fixed", NULL, MAXAVRO_TYPE_FIXED},
     {NULL, NULL, MAXAVRO_TYPE_UNKNOWN}
 };
 /**
@@ -66,9 +69,16 @@ const char* type_to_string(enum maxavro_value_type type)
     return "unknown type";
 }
 
+static MAXAVRO_SCHEMA* unpack_union(json_t *array);
+static void maxavro_schema_field_free(MAXAVRO_SCHEMA_FIELD *field);
+
 /**
  * @brief extract the type definition from a JSON schema
- * @param object JSON object containing the schema
+ *
+ * The type is either the name of a type, an object that defines the type or
+ * an array of types that make up a union.
+ *
+ * @param object JSON value containing the schema
  * @param field The associated field
  * @return Type of the field
  */
@@ -84,11 +94,14 @@ static enum maxavro_value_type unpack_to_type(json_t *object,
         json_unpack(object, "{s:o}", "type", &tmp);
         type = tmp;
     }
-
-    if (json_is_array(object))
+    else if (json_is_array(object))
     {
-        json_t *tmp = json_array_get(object, 0);
-        type = tmp;
+        field->extra = unpack_union(object);
+        return field->extra ? MAXAVRO_TYPE_UNION : MAXAVRO_TYPE_UNKNOWN;
+    }
+    else
+    {
+        type = object;
     }
 
     if (type && json_is_string(type))
@@ -99,16 +112,85 @@ static enum maxavro_value_type unpack_to_type(json_t *object,
         if (rval == MAXAVRO_TYPE_ENUM)
         {
             json_t *tmp = NULL;
-            json_unpack(object, "{s:o}", "symbols", &tmp);
-            ss_dassert(json_is_array(tmp));
-            json_incref(tmp);
-            field->extra = tmp;
+
+            if (json_is_object(object) &&
+                json_unpack(object, "{s:o}", "symbols", &tmp) == 0 &&
+                json_is_array(tmp))
+            {
+                json_incref(tmp);
+                field->extra = tmp;
+            }
+            else
+            {
+                rval = MAXAVRO_TYPE_UNKNOWN;
+            }
+        }
+        else if (rval == MAXAVRO_TYPE_FIXED)
+        {
+            json_int_t size = 0;
+
+            if (json_is_object(object) &&
+                json_unpack(object, "{s:I}", "size", &size) == 0 && size >= 0)
+            {
+                field->size = size;
+            }
+            else
+            {
+                rval = MAXAVRO_TYPE_UNKNOWN;
+            }
+        }
+        else if (rval == MAXAVRO_TYPE_UNION)
+        {
+            /** Unions are arrays of types, they have no name */
+            rval = MAXAVRO_TYPE_UNKNOWN;
         }
     }
 
     return rval;
 }
 
+/**
+ * @brief Create the branches of a union
+ *
+ * The branches are stored as the fields of a schema. Each value of the union
+ * is preceded by the index of its branch.
+ *
+ * @param array JSON array of the types in the union
+ * @return The branches or NULL if a type is not supported
+ */
+static MAXAVRO_SCHEMA* unpack_union(json_t *array)
+{
+    MAXAVRO_SCHEMA* rval = malloc(sizeof(MAXAVRO_SCHEMA));
+    size_t arr_size = json_array_size(array);
+
+    if (rval && (rval->fields = calloc(arr_size ? arr_size : 1, sizeof(MAXAVRO_SCHEMA_FIELD))))
+    {
+        rval->num_fields = arr_size;
+
+        for (size_t i = 0; i < arr_size; i++)
+        {
+            MAXAVRO_SCHEMA_FIELD *branch = &rval->fields[i];
+            branch->type = unpack_to_type(json_array_get(array, i), branch);
+
+            /** Unions cannot contain other unions */
+            if (branch->type == MAXAVRO_TYPE_UNKNOWN || branch->type == MAXAVRO_TYPE_UNION)
+            {
+                MXS_ERROR("Unsupported type in union at position %lu.", i);
+                maxavro_schema_free(rval);
+                return NULL;
+            }
+        }
+    }
+    else
+    {
+        free(rval);
+        rval = NULL;
+        MXS_ERROR("Memory allocation failed.");
+    }
+
+    return rval;
+}
+
 /**
  * @brief Create a new Avro schema from JSON
  * @param json JSON from which the schema is created from
@@ -131,7 +213,7 @@ MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
             if (json_unpack(schema, "{s:o}", "fields", &field_arr) == 0)
             {
                 size_t arr_size = json_array_size(field_arr);
-                rval->fields = malloc(sizeof(MAXAVRO_SCHEMA_FIELD) * arr_size);
+                rval->fields = calloc(arr_size, sizeof(MAXAVRO_SCHEMA_FIELD));
                 rval->num_fields = arr_size;
 
                 for (int i = 0; i < arr_size; i++)
@@ -152,8 +234,9 @@ MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
 
                         for (int j = 0; j < i; j++)
                         {
-                            free(rval->fields[j].name);
+                            maxavro_schema_field_free(&rval->fields[j]);
                         }
+                        free(rval->fields);
                         break;
                     }
                 }
@@ -195,6 +278,10 @@ static void maxavro_schema_field_free(MAXAVRO_SCHEMA_FIELD *field)
         {
             json_decref((json_t*)field->extra);
         }
+        else if (field->type == MAXAVRO_TYPE_UNION)
+        {
+            maxavro_schema_free((MAXAVRO_SCHEMA*)field->extra);
+        }
     }
 }
 
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Compare the conversion of Avro records into JSON with jansson to the direct
+ * conversion into text.
+ *
+ * Without arguments, test files are written and converted both ways and the
+ * results are checked to be the same. The records cover every type that
+ * maxavro reads: integers, strings with escaping and UTF-8, bytes and fixed
+ * values, doubles, floats, booleans, enums, nulls and nullable unions. Records
+ * with invalid UTF-8, non-finite numbers or unknown union branches must be
+ * rejected by both.
+ *
+ * With a file as the argument, the records of the file are converted both
+ * ways, the results are checked and the time taken by each way is printed.
+ *
+ * Usage: test_json [FILE [ROUNDS]]
+ */
+
+#include <maxavro.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *testfile = "test_json.avro";
+
+static const char *testschema =
+    "{\"type\": \"record\", \"name\": \"test_json\", \"fields\": ["
+    "{\"name\": \"domain\", \"type\": \"int\"},"
+    "{\"name\": \"sequence\", \"type\": \"long\"},"
+    "{\"name\": \"text\", \"type\": \"string\"},"
+    "{\"name\": \"data\", \"type\": \"bytes\"},"
+    "{\"name\": \"real\", \"type\": \"double\"},"
+    "{\"name\": \"small\", \"type\": \"float\"},"
+    "{\"name\": \"flag\", \"type\": \"boolean\"},"
+    "{\"name\": \"event_type\", \"type\": {\"type\": \"enum\", \"name\": \"EVENT_TYPES\","
+    " \"symbols\": [\"insert\", \"update_before\", \"update_after\", \"delete\"]}},"
+    "{\"name\": \"nothing\", \"type\": \"null\"},"
+    "{\"name\": \"maybe\", \"type\": [\"null\", \"long\"]},"
+    "{\"name\": \"label\", \"type\": [\"string\", \"null\"]},"
+    "{\"name\": \"digest\", \"type\": {\"type\": \"fixed\", \"name\": \"DIGEST\", \"size\": 4}}"
+    "]}";
+
+#define DIGEST_SIZE 4
+
+/** The values of a test record */
+typedef struct
+{
+    int32_t     domain;
+    int64_t     sequence;
+    const char *text;
+    const char *data;
+    double      real;
+    float       small;
+    bool        flag;
+    int         event_type;
+    int         maybe_branch; /*< 0 for null, 1 for the value of maybe */
+    int64_t     maybe;
+    const char *label;        /*< NULL for null */
+    const char *digest;       /*< DIGEST_SIZE bytes */
+} TEST_RECORD;
+
+/** Records that both conversions must accept */
+static const TEST_RECORD valid_records[] =
+{
+    {0, 1, "", "", 0.0, 0.0f, false, 0, 0, 0, NULL, "\0\0\0\0"},
+    {1, -1, "plain text", "plain bytes", 1.0, 1.0f, true, 1, 1, 0, "", "abcd"},
+    {2, INT64_MAX, "quote \" backslash \\ slash /", "tab\tnewline\n", 0.1, 0.1f, false, 2, 1, INT64_MIN, "\"\\", "\"\\\n\t"},
+    {3, INT64_MIN, "\b\f\n\r\t\x01\x1f\x7f", "\x02\x1e", -2.5, -2.5f, true, 3, 1, INT64_MAX, "\x01\x7f", "\x01\x1f\x7f\x20"},
+    {4, 42, "\xc3\xa4\xc3\xb6 \xe2\x82\xac \xf0\x9d\x84\x9e", "\xe2\x82\xac", 1e300, 3.4e38f, false, 0, 0, 0, "\xe2\x82\xac", "\xe2\x82\xac!"},
+    {5, 43, "\xef\xbb\xbf BOM and \xf4\x8f\xbf\xbf", "", 1e-300, 1e-38f, true, 1, 1, -1, NULL, "\xc3\xa4\xc3\xb6"},
+    {6, 44, "numbers 123", "0", 123456789.125, 16777216.0f, false, 2, 1, 1, "label", "1234"},
+    {7, 45, "x", "y", -0.0, -0.0f, true, 3, 0, 0, NULL, "\0a\0b"},
+    {8, 46, "exponent", "", 1.5e17, 1e10f, false, 0, 1, 4294967296, "x", "wxyz"},
+    {9, 47, "pi", "", 3.141592653589793, 3.1415927f, true, 1, 1, 42, "pi", "3.14"},
+    {-10, 48, "denormals", "", 4.9e-324, 1.4e-45f, false, 2, 0, 0, NULL, "    "},
+    {INT32_MIN, 49, "limits", "", 1.7976931348623157e308, -3.4028235e38f, true, 3, 1, 0, "", "\x7f\x7f\x7f\x7f"}
+};
+
+/** Records that both conversions must reject */
+static const TEST_RECORD invalid_records[] =
+{
+    {0, 1, "truncated \xc3", "", 1.0, 1.0f, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "overlong \xc0\xaf", "", 1.0, 1.0f, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "surrogate \xed\xa0\x80", "", 1.0, 1.0f, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "", "invalid \xff", 1.0, 1.0f, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "", "", NAN, 1.0f, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "", "", INFINITY, 1.0f, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "", "", 1.0, -INFINITY, false, 0, 0, 0, NULL, "abcd"},
+    {0, 1, "", "", 1.0, 1.0f, false, 4, 0, 0, NULL, "abcd"},
+    {0, 1, "", "", 1.0, 1.0f, false, 0, 2, 0, NULL, "abcd"},
+    {0, 1, "", "", 1.0, 1.0f, false, 0, 0, 0, "invalid \xc3\x28", "abcd"},
+    {0, 1, "", "", 1.0, 1.0f, false, 0, 0, 0, NULL, "ab\xff\xfe"}
+};
+
+#define N_VALID (sizeof(valid_records) / sizeof(valid_records[0]))
+#define N_INVALID (sizeof(invalid_records) / sizeof(invalid_records[0]))
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/** Avro encoded data */
+typedef struct
+{
+    uint8_t *data;
+    size_t   length;
+    size_t   size;
+} ENCODED;
+
+static void put(ENCODED *enc, const void *data, size_t len)
+{
+    if (enc->length + len > enc->size)
+    {
+        enc->size = (enc->length + len) * 2;
+        enc->data = realloc(enc->data, enc->size);
+    }
+
+    memcpy(enc->data + enc->length, data, len);
+    enc->length += len;
+}
+
+/** Encode a long as a zigzag encoded variable length integer */
+static void put_long(ENCODED *enc, int64_t value)
+{
+    uint64_t n = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+
+    do
+    {
+        uint8_t byte = n & 0x7f;
+        n >>= 7;
+
+        if (n)
+        {
+            byte |= 0x80;
+        }
+
+        put(enc, &byte, 1);
+    }
+    while (n);
+}
+
+/** Encode strings and bytes as the length followed by the data */
+static void put_bytes(ENCODED *enc, const char *data, size_t len)
+{
+    put_long(enc, len);
+    put(enc, data, len);
+}
+
+static void put_record(ENCODED *enc, const TEST_RECORD *record)
+{
+    uint8_t flag = record->flag;
+
+    put_long(enc, record->domain);
+    put_long(enc, record->sequence);
+    put_bytes(enc, record->text, strlen(record->text));
+    put_bytes(enc, record->data, strlen(record->data));
+    put(enc, &record->real, sizeof(record->real));
+    put(enc, &record->small, sizeof(record->small));
+    put(enc, &flag, 1);
+    put_long(enc, record->event_type);
+    put_long(enc, record->maybe_branch);
+
+    if (record->maybe_branch == 1)
+    {
+        put_long(enc, record->maybe);
+    }
+
+    if (record->label)
+    {
+        put_long(enc, 0);
+        put_bytes(enc, record->label, strlen(record->label));
+    }
+    else
+    {
+        put_long(enc, 1);
+    }
+
+    put(enc, record->digest, DIGEST_SIZE);
+}
+
+/**
+ * Write records into an Avro file with one data block
+ *
+ * @param filename The file to write
+ * @param records  The records
+ * @param n        Number of records
+ * @return True if the file was written
+ */
+static bool write_test_file(const char *filename, const TEST_RECORD *records, size_t n)
+{
+    static const char magic[] = {'O', 'b', 'j', 1};
+    static const char sync[16] = "maxavro testsync";
+    ENCODED block = {};
+    ENCODED enc = {};
+
+    for (size_t i = 0; i < n; i++)
+    {
+        put_record(&block, &records[i]);
+    }
+
+    put(&enc, magic, sizeof(magic));
+    put_long(&enc, 2);
+    put_bytes(&enc, "avro.schema", strlen("avro.schema"));
+    put_bytes(&enc, testschema, strlen(testschema));
+    put_bytes(&enc, "avro.codec", strlen("avro.codec"));
+    put_bytes(&enc, "null", strlen("null"));
+    put_long(&enc, 0);
+    put(&enc, sync, sizeof(sync));
+    put_long(&enc, n);
+    put_long(&enc, block.length);
+    put(&enc, block.data, block.length);
+    put(&enc, sync, sizeof(sync));
+
+    FILE *file = fopen(filename, "wb");
+    bool rval = file && fwrite(enc.data, 1, enc.length, file) == enc.length;
+
+    if (file && fclose(file) != 0)
+    {
+        rval = false;
+    }
+
+    if (!rval)
+    {
+        printf("Failed to write file '%s'\n", filename);
+    }
+
+    free(block.data);
+    free(enc.data);
+    return rval;
+}
+
+/** Convert with jansson, as the rows used to be sent */
+static bool read_with_jansson(const char *filename, MAXAVRO_JSON_BUFFER *dest, uint64_t *records)
+{
+    MAXAVRO_FILE *file = maxavro_file_open(filename);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    dest->length = 0;
+
+    do
+    {
+        json_t *row;
+
+        while ((row = maxavro_record_read_json(file)))
+        {
+            char *json = json_dumps(row, JSON_PRESERVE_ORDER);
+            size_t len = json ? strlen(json) : 0;
+
+            if (dest->length + len + 1 > dest->size)
+            {
+                dest->size = (dest->length + len + 1) * 2;
+                dest->data = realloc(dest->data, dest->size);
+            }
+
+            memcpy(dest->data + dest->length, json, len);
+            dest->data[dest->length + len] = '\n';
+            dest->length += len + 1;
+            (*records)++;
+            free(json);
+            json_decref(row);
+        }
+    }
+    while (maxavro_next_block(file));
+
+    maxavro_file_close(file);
+    return true;
+}
+
+/** Convert straight into text */
+static bool read_direct(const char *filename, MAXAVRO_JSON_BUFFER *dest, uint64_t *records)
+{
+    MAXAVRO_FILE *file = maxavro_file_open(filename);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    dest->length = 0;
+
+    do
+    {
+        while (maxavro_record_write_json(file, dest, NULL))
+        {
+            (*records)++;
+        }
+    }
+    while (maxavro_next_block(file));
+
+    maxavro_file_close(file);
+    return true;
+}
+
+/**
+ * Convert a file both ways and compare the results
+ *
+ * @param filename The file
+ * @param rounds   How many times the file is converted
+ * @param records  The number of records converted in each round
+ * @param verbose  Print the times
+ * @return True if the conversions produced the same text
+ */
+static bool compare_conversions(const char *filename, int rounds, uint64_t *records, bool verbose)
+{
+    MAXAVRO_JSON_BUFFER jansson = {};
+    MAXAVRO_JSON_BUFFER direct = {};
+    uint64_t jansson_records = 0;
+    uint64_t direct_records = 0;
+    double jansson_time = 0;
+    double direct_time = 0;
+    bool rval = true;
+
+    for (int i = 0; rval && i < rounds; i++)
+    {
+        double start = now();
+        rval = read_with_jansson(filename, &jansson, &jansson_records);
+        double middle = now();
+        rval = rval && read_direct(filename, &direct, &direct_records);
+        direct_time += now() - middle;
+        jansson_time += middle - start;
+    }
+
+    if (!rval)
+    {
+        printf("Failed to read file '%s'\n", filename);
+    }
+    else if (jansson_records != direct_records || jansson.length != direct.length ||
+             (direct.length && memcmp(jansson.data, direct.data, direct.length) != 0))
+    {
+        printf("The results differ for '%s'\njansson:\n%.*s\ndirect:\n%.*s\n", filename,
+               (int)jansson.length, jansson.data, (int)direct.length, direct.data);
+        rval = false;
+    }
+    else
+    {
+        *records = jansson_records / rounds;
+
+        if (verbose)
+        {
+            printf("%lu records, %lu bytes of JSON\n", *records, direct.length);
+            printf("jansson: %.3f seconds, %.0f records/s\n", jansson_time, jansson_records / jansson_time);
+            printf("direct:  %.3f seconds, %.0f records/s\n", direct_time, direct_records / direct_time);
+        }
+    }
+
+    maxavro_json_buffer_free(&jansson);
+    maxavro_json_buffer_free(&direct);
+    return rval;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t records = 0;
+
+    if (argc > 1)
+    {
+        int rounds = argc > 2 ? atoi(argv[2]) : 10;
+        return compare_conversions(argv[1], rounds > 0 ? rounds : 1, &records, true) ? 0 : 1;
+    }
+
+    int rval = 0;
+
+    if (!write_test_file(testfile, valid_records, N_VALID) ||
+        !compare_conversions(testfile, 1, &records, false))
+    {
+        rval = 1;
+    }
+    else if (records != N_VALID)
+    {
+        printf("Expected %lu records, got %lu\n", N_VALID, records);
+        rval = 1;
+    }
+
+    for (size_t i = 0; i < N_INVALID; i++)
+    {
+        if (!write_test_file(testfile, &invalid_records[i], 1) ||
+            !compare_conversions(testfile, 1, &records, false))
+        {
+            rval = 1;
+        }
+        else if (records != 0)
+        {
+            printf("Invalid record %lu was not rejected\n", i);
+            rval = 1;
+        }
+    }
+
+    unlink(testfile);
+    return rval;
+}
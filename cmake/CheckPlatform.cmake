@@ -42,6 +42,12 @@ check_include_files(sys/types.h HAVE_SYS_TYPES)
 check_include_files(sys/un.h HAVE_SYS_UN)
 check_include_files(time.h HAVE_TIME)
 check_include_files(unistd.h HAVE_UNISTD)
+check_include_files(linux/io_uring.h HAVE_LINUX_IO_URING)
+
+# The io_uring poll engine is built when the kernel headers define it
+if(HAVE_LINUX_IO_URING)
+  add_definitions(-DHAVE_IO_URING)
+endif()
 
 # Check for libraries MaxScale depends on
 find_library(HAVE_LIBSSL NAMES ssl)
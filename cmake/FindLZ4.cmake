@@ -0,0 +1,16 @@
+# This CMake file locates the LZ4 library and headers
+#
+# The following variables are set:
+# LZ4_FOUND - If the LZ4 library was found
+# LZ4_LIBRARIES - Path to the library
+# LZ4_INCLUDE_DIR - Path to LZ4 headers
+
+find_path(LZ4_INCLUDE_DIR lz4.h)
+find_library(LZ4_LIBRARIES NAMES liblz4.so liblz4.a)
+
+if (LZ4_INCLUDE_DIR AND LZ4_LIBRARIES)
+  message(STATUS "Found LZ4: ${LZ4_LIBRARIES}")
+  set(LZ4_FOUND TRUE)
+else()
+  message(STATUS "Could not find LZ4, the cache will not support compression")
+endif()
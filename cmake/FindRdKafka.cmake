@@ -0,0 +1,17 @@
+# This CMake file tries to find the the librdkafka Kafka client library
+# The following variables are set:
+# RDKAFKA_FOUND - System has librdkafka
+# RDKAFKA_LIBRARIES - The librdkafka library
+# RDKAFKA_HEADERS - The directory of the librdkafka headers
+
+find_library(RDKAFKA_LIBRARIES NAMES rdkafka)
+find_path(RDKAFKA_HEADERS librdkafka/rdkafka.h)
+
+if(${RDKAFKA_LIBRARIES} MATCHES "NOTFOUND" OR ${RDKAFKA_HEADERS} MATCHES "NOTFOUND")
+  set(RDKAFKA_FOUND FALSE CACHE INTERNAL "")
+  message(STATUS "librdkafka not found.")
+  unset(RDKAFKA_LIBRARIES)
+else()
+  set(RDKAFKA_FOUND TRUE CACHE INTERNAL "")
+  message(STATUS "Found librdkafka: ${RDKAFKA_LIBRARIES}")
+endif()
@@ -36,6 +36,119 @@ int      atomic_add(int *variable, int value);
 int64_t  atomic_add_int64(int64_t *variable, int64_t value);
 uint64_t atomic_add_uint64(uint64_t *variable, int64_t value);
 
+/**
+ * Atomically read the value of a variable with acquire semantics.
+ *
+ * The read is not a read-modify-write operation, which makes it considerably
+ * cheaper than atomic_add with a zero value.
+ *
+ * @param variable      Pointer to the variable to read
+ * @return              The value of the variable
+ */
+static inline int atomic_load_int32(const int *variable)
+{
+#if defined(__ATOMIC_ACQUIRE)
+    return __atomic_load_n(variable, __ATOMIC_ACQUIRE);
+#elif defined(__GNUC__)
+    int rval = *(volatile const int*)variable;
+    __sync_synchronize();
+    return rval;
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Atomically write the value of a variable with release semantics.
+ *
+ * @param variable      Pointer to the variable to write
+ * @param value         The value to write
+ */
+static inline void atomic_store_int32(int *variable, int value)
+{
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(variable, value, __ATOMIC_RELEASE);
+#elif defined(__GNUC__)
+    __sync_synchronize();
+    *(volatile int*)variable = value;
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Atomically read the value of a pointer with acquire semantics.
+ *
+ * @param variable      Pointer to the pointer to read
+ * @return              The value of the pointer
+ */
+static inline void* atomic_load_ptr(void * const *variable)
+{
+#if defined(__ATOMIC_ACQUIRE)
+    return __atomic_load_n(variable, __ATOMIC_ACQUIRE);
+#elif defined(__GNUC__)
+    void *rval = *(void * volatile const*)variable;
+    __sync_synchronize();
+    return rval;
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Atomically write the value of a pointer with release semantics.
+ *
+ * @param variable      Pointer to the pointer to write
+ * @param value         The value to write
+ */
+static inline void atomic_store_ptr(void **variable, void *value)
+{
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(variable, value, __ATOMIC_RELEASE);
+#elif defined(__GNUC__)
+    __sync_synchronize();
+    *(void * volatile*)variable = value;
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Atomically read a 64-bit value with acquire semantics.
+ *
+ * @param variable      Pointer to the variable to read
+ * @return              The value of the variable
+ */
+static inline uint64_t atomic_load_uint64(const uint64_t *variable)
+{
+#if defined(__ATOMIC_ACQUIRE)
+    return __atomic_load_n(variable, __ATOMIC_ACQUIRE);
+#elif defined(__GNUC__)
+    return __sync_fetch_and_add((uint64_t*)variable, 0);
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
+/**
+ * Atomically write a 64-bit value with release semantics.
+ *
+ * @param variable      Pointer to the variable to write
+ * @param value         The value to write
+ */
+static inline void atomic_store_uint64(uint64_t *variable, uint64_t value)
+{
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(variable, value, __ATOMIC_RELEASE);
+#elif defined(__GNUC__)
+    __sync_synchronize();
+    *(volatile uint64_t*)variable = value;
+    __sync_synchronize();
+#else
+#error "No GNUC atomics available."
+#endif
+}
+
 /**
  * @brief Impose a full memory barrier
  *
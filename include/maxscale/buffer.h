@@ -58,7 +58,10 @@ typedef enum
     GWBUF_TYPE_SESCMD_RESPONSE = 0x08,
     GWBUF_TYPE_RESPONSE_END    = 0x10,
     GWBUF_TYPE_SESCMD          = 0x20,
-    GWBUF_TYPE_HTTP            = 0x40
+    GWBUF_TYPE_HTTP            = 0x40,
+    GWBUF_TYPE_PIPELINED       = 0x80, /*< More complete statements follow in the same read */
+    GWBUF_TYPE_CONTINUATION    = 0x100, /*< Continues a command that did not fit in one packet */
+    GWBUF_TYPE_NO_PENDING      = 0x200 /*< No replies to earlier commands are expected from the target */
 } gwbuf_type_t;
 
 #define GWBUF_IS_TYPE_UNDEFINED(b)       (b->gwbuf_type == 0)
@@ -68,6 +71,9 @@ typedef enum
 #define GWBUF_IS_TYPE_SESCMD_RESPONSE(b) (b->gwbuf_type & GWBUF_TYPE_SESCMD_RESPONSE)
 #define GWBUF_IS_TYPE_RESPONSE_END(b)    (b->gwbuf_type & GWBUF_TYPE_RESPONSE_END)
 #define GWBUF_IS_TYPE_SESCMD(b)          (b->gwbuf_type & GWBUF_TYPE_SESCMD)
+#define GWBUF_IS_TYPE_PIPELINED(b)       (b->gwbuf_type & GWBUF_TYPE_PIPELINED)
+#define GWBUF_IS_TYPE_CONTINUATION(b)    (b->gwbuf_type & GWBUF_TYPE_CONTINUATION)
+#define GWBUF_IS_TYPE_NO_PENDING(b)      (b->gwbuf_type & GWBUF_TYPE_NO_PENDING)
 
 /**
  * A structure to encapsulate the data in a form that the data itself can be
@@ -78,6 +84,8 @@ typedef struct
 {
     unsigned char   *data;                  /*< Physical memory that was allocated */
     int             refcount;               /*< Reference count on the buffer */
+    int             size_class;             /*< Buffer cache size class or -1 if the data
+                                             *  was allocated separately */
 } SHARED_BUF;
 
 typedef enum
@@ -89,26 +97,29 @@ typedef enum
 #define GWBUF_IS_PARSED(b)      (b->gwbuf_info & GWBUF_INFO_PARSED)
 
 /**
- * A structure for cleaning up memory allocations of structures which are
- * referred to by GWBUF and deallocated in gwbuf_free but GWBUF doesn't
- * know what they are.
- * All functions on the list are executed before freeing memory of GWBUF struct.
+ * The IDs of the objects that can be attached to a GWBUF, e.g. the result of
+ * parsing its contents. Each ID has its own slot in the buffer objects.
  */
 typedef enum
 {
-    GWBUF_PARSING_INFO
+    GWBUF_PARSING_INFO,
+    GWBUF_STMT_INFO,
+    GWBUF_N_OBJECTS /*< The number of IDs, not an ID */
 } bufobj_id_t;
 
-typedef struct buffer_object_st buffer_object_t;
-
-struct buffer_object_st
+/**
+ * The objects attached to a GWBUF, one slot for each ID
+ *
+ * The objects describe the data of the buffer, so they are shared with the
+ * clones of the buffer. They are freed with their clean-up functions when
+ * the last buffer that refers to them is freed.
+ */
+typedef struct buffer_objects_st
 {
-    bufobj_id_t      bo_id;
-    void*            bo_data;
-    void            (*bo_donefun_fp)(void *);
-    buffer_object_t* bo_next;
-};
-
+    int    refcount;                               /*< Number of buffers that share the objects */
+    void*  bo_data[GWBUF_N_OBJECTS];               /*< The objects, NULL if not attached */
+    void (*bo_donefun_fp[GWBUF_N_OBJECTS])(void*); /*< The clean-up functions of the objects */
+} buffer_objects_t;
 
 /**
  * The buffer structure used by the descriptor control blocks.
@@ -117,16 +128,20 @@ struct buffer_object_st
  * or written to a descriptor. The use of linked lists of buffers with
  * flexible data pointers is designed to minimise the need for data to
  * be copied within the gateway.
+ *
+ * A GWBUF is owned by the thread that is processing it, which is why the
+ * properties, hints and buffer objects are not protected by a lock. Only
+ * the reference count of the shared buffer is modified by several threads
+ * and it is always accessed with atomic operations.
  */
 typedef struct gwbuf
 {
-    SPINLOCK        gwbuf_lock;
     struct gwbuf    *next;  /*< Next buffer in a linked chain of buffers */
     struct gwbuf    *tail;  /*< Last buffer in a linked chain of buffers */
     void            *start; /*< Start of the valid data */
     void            *end;   /*< First byte after the valid data */
     SHARED_BUF      *sbuf;  /*< The shared buffer with the real data */
-    buffer_object_t *gwbuf_bufobj; /*< List of objects referred to by GWBUF */
+    buffer_objects_t *gwbuf_bufobj; /*< Objects referred to by GWBUF, shared with its clones */
     gwbuf_info_t    gwbuf_info; /*< Info bits */
     gwbuf_type_t    gwbuf_type; /*< buffer's data type information */
     HINT            *hint;  /*< Hint data for this buffer */
@@ -365,6 +380,25 @@ extern char *gwbuf_get_property(GWBUF *buf, char *name);
  */
 extern GWBUF *gwbuf_make_contiguous(GWBUF *buf);
 
+/**
+ * Make sure the data of a chain of GWBUF structures can be modified
+ *
+ * The data of a buffer is shared with its clones, e.g. the cache returns
+ * clones of the buffers it stores, and must not be modified in place if
+ * there are any. A component that needs to modify such a buffer gets a
+ * copy of its own with this function.
+ *
+ * @param buf  The chain
+ *
+ * @return NULL if @c buf is NULL or if a memory allocation fails,
+ *         @c buf if none of its data is shared, and otherwise a
+ *         contiguous copy of @c buf.
+ *
+ * @attention If a non-NULL value is returned, the @c buf should no
+ *            longer be used as it may have been freed.
+ */
+extern GWBUF *gwbuf_make_writable(GWBUF *buf);
+
 /**
  * Add hint to a buffer.
  *
@@ -377,6 +411,9 @@ extern void gwbuf_add_hint(GWBUF *buf, HINT *hint);
 /**
  * Add a buffer object to GWBUF buffer.
  *
+ * An object with the same ID that the buffer already has is freed. The
+ * object is also seen by the clones of the buffer that share its objects.
+ *
  * @param buf         GWBUF where object is added
  * @param id          Type identifier for object
  * @param data        Object data
@@ -388,12 +425,12 @@ void gwbuf_add_buffer_object(GWBUF* buf,
                              void (*donefun_fp)(void *));
 
 /**
- * Search buffer object which matches with the id.
+ * Get the buffer object with an ID.
  *
- * @param buf  GWBUF to be searched
+ * @param buf  The buffer
  * @param id   Identifier for the object
  *
- * @return Searched buffer object or NULL if not found
+ * @return The object or NULL if the buffer has none with the ID
  */
 void *gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id);
 #if defined(BUFFER_TRACE)
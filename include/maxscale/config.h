@@ -51,6 +51,25 @@ typedef struct config_context
     struct config_context *next;       /**< Next pointer in the linked list */
 } CONFIG_CONTEXT;
 
+/**
+ * How the worker threads wait for events
+ */
+typedef enum
+{
+    MXS_POLL_BLOCKING, /**< Always do a blocking epoll_wait */
+    MXS_POLL_ADAPTIVE, /**< Spin non_blocking_polls times, then block with a growing timeout */
+    MXS_POLL_SPIN      /**< Spin until poll_spin_budget has passed without events, then block */
+} mxs_poll_mode_t;
+
+/**
+ * The mechanism the worker threads use to wait for events
+ */
+typedef enum
+{
+    MXS_POLL_ENGINE_EPOLL,   /**< epoll_wait and epoll_ctl */
+    MXS_POLL_ENGINE_IO_URING /**< Multishot poll requests submitted in batches to an io_uring */
+} mxs_poll_engine_t;
+
 /**
  * The gateway global configuration data
  */
@@ -58,6 +77,8 @@ typedef struct
 {
     bool          config_check;                        /**< Only check config */
     int           n_threads;                           /**< Number of polling threads */
+    int           n_threads_max;                       /**< Number of polling threads that can be
+                                                        *   activated at runtime */
     char          *version_string;                     /**< The version string of embedded db library */
     char          release_string[_RELEASE_STR_LENGTH]; /**< The release name string of the system */
     char          sysname[_UTSNAME_SYSNAME_LENGTH];    /**< The OS name of the system */
@@ -65,6 +86,9 @@ typedef struct
     unsigned long id;                                  /**< MaxScale ID */
     unsigned int  n_nbpoll;                            /**< Tune number of non-blocking polls */
     unsigned int  pollsleep;                           /**< Wait time in blocking polls */
+    mxs_poll_mode_t poll_mode;                         /**< How the threads wait for events */
+    unsigned int  poll_spin_budget;                    /**< Microseconds to spin in MXS_POLL_SPIN mode */
+    mxs_poll_engine_t poll_engine;                     /**< How the threads wait for events */
     int           syslog;                              /**< Log to syslog */
     int           maxlog;                              /**< Log to MaxScale's own logs */
     int           log_to_shm;                          /**< Write log-file to shared memory */
@@ -72,6 +96,28 @@ typedef struct
     unsigned int  auth_read_timeout;                   /**< Read timeout for the user authentication */
     unsigned int  auth_write_timeout;                  /**< Write timeout for the user authentication */
     bool          skip_permission_checks;              /**< Skip service and monitor permission checks */
+    bool          listener_reuseport;                  /**< One SO_REUSEPORT listener socket per thread */
+    unsigned int  accept_batch_size;                   /**< Connections a thread accepts in one poll
+                                                        *   cycle, 0 for no limit */
+    int*          thread_cpus;                         /**< The CPUs the worker threads are pinned to */
+    int           n_thread_cpus;                       /**< Number of CPUs in thread_cpus, 0 if the
+                                                        *   threads are not pinned */
+    bool          session_rebalancing;                 /**< Move idle sessions from busy threads */
+    unsigned int  writeq_high_water;                   /**< Client write queue size where the
+                                                        * backends of the session are no longer read */
+    unsigned int  writeq_low_water;                    /**< Client write queue size where reading
+                                                        * the backends is resumed */
+    double        session_trace_sample;                /**< Fraction of the sessions that are traced */
+    char*         session_trace_user;                  /**< The sessions of this user are traced */
+    char*         session_trace_host;                  /**< The sessions from this host are traced */
+    unsigned int  session_trace_threshold;             /**< Traced requests slower than this many
+                                                        * milliseconds are logged */
+    bool          profile_callbacks;                   /**< Measure the time of the module callbacks */
+    unsigned int  slow_callback_threshold;             /**< Profiled callbacks slower than this many
+                                                        * milliseconds are logged */
+    bool          memory_accounting;                   /**< Account the allocations of each module */
+    unsigned long memory_sample_interval;              /**< Bytes allocated by a thread between
+                                                        * sampled allocation stacks, 0 for none */
     char          qc_name[PATH_MAX];                   /**< The name of the query classifier to load */
     char*         qc_args;                             /**< Arguments for the query classifier */
 } MXS_CONFIG;
@@ -241,6 +287,17 @@ int config_truth_value(const char *value);
  */
 int config_threadcount(void);
 
+/**
+ * @brief Get the CPU a worker thread is pinned to
+ *
+ * The threads are given the CPUs of the `thread_affinity` parameter in order.
+ * If there are more threads than CPUs, the CPUs are reused from the start.
+ *
+ * @param thread_id The worker thread ID
+ * @return The CPU or -1 if the worker threads are not pinned
+ */
+int config_thread_cpu(int thread_id);
+
 /**
  * @brief Get number of non-blocking polls
  *
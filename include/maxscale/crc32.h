@@ -0,0 +1,49 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file crc32.h  The CRC32 of binlog events
+ *
+ * The checksum is the same as the one computed by zlib's crc32(), that is,
+ * the one MariaDB uses for binlog events. When the CPU supports carry-less
+ * multiplication (PCLMULQDQ), the checksum of large enough buffers is
+ * computed with it, otherwise zlib is used.
+ *
+ * Note that the CRC32 instruction of SSE4.2 uses the Castagnoli polynomial
+ * and thus can not be used for this checksum.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Update a CRC32 checksum
+ *
+ * @param crc  The checksum so far, 0 for the first buffer.
+ * @param buf  The data.
+ * @param len  The length of the data.
+ *
+ * @return The checksum, as crc32(crc, buf, len) of zlib would return it.
+ */
+uint32_t mxs_crc32(uint32_t crc, const uint8_t* buf, size_t len);
+
+/**
+ * @brief Check whether the checksum is computed with CPU instructions
+ *
+ * @return True, if PCLMULQDQ is used.
+ */
+bool mxs_crc32_is_accelerated();
+
+MXS_END_DECLS
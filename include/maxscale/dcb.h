@@ -23,6 +23,7 @@
 #include <maxscale/authenticator.h>
 #include <maxscale/ssl.h>
 #include <maxscale/modinfo.h>
+#include <maxscale/timer.h>
 #include <netinet/in.h>
 
 MXS_BEGIN_DECLS
@@ -71,11 +72,16 @@ typedef struct
 typedef struct dcbstats
 {
     int     n_reads;        /*< Number of reads on this descriptor */
-    int     n_writes;       /*< Number of writes on this descriptor */
+    int     n_writes;       /*< Number of write system calls on this descriptor */
+    int     n_write_bufs;   /*< Number of buffers passed to the write system calls */
     int     n_accepts;      /*< Number of accepts on this descriptor */
     int     n_buffered;     /*< Number of buffered writes */
     int     n_high_water;   /*< Number of crosses of high water mark */
     int     n_low_water;    /*< Number of crosses of low water mark */
+    uint64_t n_compressed_in;  /*< Compressed bytes read */
+    uint64_t n_plain_in;       /*< Bytes the compressed reads decompressed to */
+    uint64_t n_compressed_out; /*< Compressed bytes written */
+    uint64_t n_plain_out;      /*< Bytes that were compressed for writing */
 } DCBSTATS;
 
 #define DCBSTATS_INIT {0}
@@ -105,6 +111,16 @@ typedef struct
 
 #define DCBMM_INIT { NULL }
 
+/**
+ * The place of a DCB in one of the lists of a persistent pool
+ */
+typedef struct dcb_pool_link
+{
+    struct dcb           *next;  /**< Next DCB in the list */
+    struct dcb           *prev;  /**< Previous DCB in the list */
+    struct persist_entry *entry; /**< The list, NULL if the DCB is not in one */
+} DCB_POOL_LINK;
+
 /* DCB states */
 typedef enum
 {
@@ -213,14 +229,18 @@ typedef struct dcb
     GWBUF           *dcb_fakequeue; /**< Fake event queue for generated events */
 
     DCBSTATS        stats;          /**< DCB related statistics */
-    struct dcb      *nextpersistent;   /**< Next DCB in the persistent pool for SERVER */
+    DCB_POOL_LINK   pool_links[2];     /**< The lists of the persistent pool the DCB is in */
     time_t          persistentstart;   /**< Time when DCB placed in persistent pool */
+    time_t          persistalive;      /**< When a pooled DCB was last known to be alive */
+    time_t          persistping;       /**< When a pooled DCB was pinged, 0 if no reply is due */
+    char            *persistkey;    /**< Default database and charset of the connection */
     struct service  *service;       /**< The related service */
     void            *data;          /**< Specific client data, shared between DCBs of this session */
     void            *authenticator_data; /**< The authenticator data for this DCB */
     DCBMM           memdata;        /**< The data related to DCB memory management */
     DCB_CALLBACK    *callbacks;     /**< The list of callbacks for the DCB */
     long            last_read;      /*< Last time the DCB received data */
+    int             read_size;      /**< Size of the next read, adapted to the amount of data read */
     int             high_water;     /**< High water mark */
     int             low_water;      /**< Low water mark */
     struct server   *server;        /**< The associated backend server */
@@ -229,12 +249,26 @@ typedef struct dcb
     bool            ssl_read_want_write;    /*< Flag */
     bool            ssl_write_want_read;    /*< Flag */
     bool            ssl_write_want_write;    /*< Flag */
+    int             ssl_write_retry_len; /*< Length of the SSL_write that must be retried */
+    int             *listener_fds;  /**< Per-thread listener sockets, NULL if not sharded */
     bool            was_persistent;  /**< Whether this DCB was in the persistent pool */
+    MXS_TIMER       timer;          /**< Idle timeout of a client or expiry in the persistent pool */
+    bool            corked;         /**< Writes are only queued until dcb_uncork is called */
+    bool            write_more;     /**< More data of the current response will follow */
+    MXS_TIMER       cork_timer;     /**< Pushes out data held back by write_more */
+    bool            read_paused;    /**< A read was skipped because the client of the session
+                                     * is above its high water mark */
+    int             poll_deferred;  /**< Position plus one of the event that waits for the
+                                     * priority class of the DCB to get its turn, 0 if none */
     struct
     {
         int id; /**< The owning thread's ID */
         struct dcb *next; /**< Next DCB in owning thread's list */
         struct dcb *tail; /**< Last DCB in owning thread's list */
+        struct dcb *server_next; /**< Next backend DCB of the same server in the owning thread */
+        struct dcb *server_prev; /**< Previous backend DCB of the same server in the owning thread */
+        struct dcb *session_next; /**< Next DCB in the same bucket of the owning thread's session index */
+        size_t session_id; /**< ID of the session the DCB is indexed by, 0 if not indexed */
     } thread;
     skygw_chk_t     dcb_chk_tail;
 } DCB;
@@ -244,7 +278,7 @@ typedef struct dcb
     .stats = {0}, .memdata = DCBMM_INIT, \
     .fd = DCBFD_CLOSED, .stats = DCBSTATS_INIT, .ssl_state = SSL_HANDSHAKE_UNKNOWN, \
     .state = DCB_STATE_ALLOC, .dcb_chk_tail = CHK_NUM_DCB, \
-    .authenticator_data = NULL, .thread = {0}}
+    .authenticator_data = NULL, .timer = MXS_TIMER_INIT, .cork_timer = MXS_TIMER_INIT, .thread = {0}}
 
 /**
  * The DCB usage filer used for returning DCB's in use for a certain reason
@@ -271,6 +305,12 @@ typedef enum
 
 #define DCB_POLL_BUSY(x)                ((x)->evq.next != NULL)
 
+/** The number of bytes a corked DCB queues before it starts writing */
+#define DCB_CORK_MAX_BYTES              65536
+
+/** The number of heartbeats the kernel may hold back a partial response */
+#define DCB_CORK_MAX_TICKS              1
+
 /**
  * @brief DCB system initialization function
  *
@@ -287,6 +327,45 @@ DCB *dcb_connect(struct server *, struct session *, const char *);
 DCB *dcb_clone(DCB *);
 int dcb_read(DCB *, GWBUF **, int);
 int dcb_drain_writeq(DCB *);
+
+/**
+ * @brief Start coalescing writes
+ *
+ * Data written to a corked DCB is queued and sent with as few system calls
+ * as possible once the DCB is uncorked. The data is sent earlier if more than
+ * DCB_CORK_MAX_BYTES is queued.
+ *
+ * @param dcb DCB to cork
+ */
+void dcb_cork(DCB *dcb);
+
+/**
+ * @brief Send the data queued while the DCB was corked
+ *
+ * If @c more is true, the current response is known to continue and the
+ * kernel is allowed to hold back the last partial TCP segment until the rest
+ * of the response is written. The held back data is pushed out after
+ * DCB_CORK_MAX_TICKS heartbeats at the latest.
+ *
+ * @param dcb  DCB to uncork
+ * @param more True if more data of the same response will follow
+ */
+void dcb_uncork(DCB *dcb, bool more);
+
+/**
+ * @brief Move all readable data from one DCB to another
+ *
+ * The data is moved with splice() through a pipe owned by the calling thread
+ * without copying it into buffers. If the destination can't take all of the
+ * data, the rest is added to its write queue. Neither DCB may use SSL and the
+ * read queue of the source must be empty.
+ *
+ * @param from DCB to read from
+ * @param to   DCB to write to
+ *
+ * @return -1 on error, otherwise the number of bytes moved
+ */
+int dcb_splice(DCB *from, DCB *to);
 void dcb_close(DCB *);
 
 /**
@@ -306,6 +385,24 @@ void dcb_process_zombies(int threadid);
  */
 void dcb_add_to_list(DCB *dcb);
 
+/**
+ * Add the client DCB of a new session to the session index of its thread
+ *
+ * The DCBs that are added to the list with a session are indexed by
+ * @c dcb_add_to_list, this is for the sessions that are created later.
+ *
+ * @param dcb The client DCB of the session, in the list of its thread
+ */
+void dcb_index_session(DCB *dcb);
+
+/**
+ * Find a session by its ID
+ *
+ * @param id The session ID
+ * @return The session with a new reference or NULL if no session has the ID
+ */
+struct session* dcb_get_session_by_id(size_t id);
+
 void printAllDCBs();                         /* Debug to print all DCB in the system */
 void printDCB(DCB *);                        /* Debug print routine */
 void dprintDCBList(DCB *);                 /* Debug print DCB list statistics */
@@ -321,7 +418,8 @@ int dcb_add_callback(DCB *, DCB_REASON, int (*)(struct dcb *, DCB_REASON, void *
 int dcb_remove_callback(DCB *, DCB_REASON, int (*)(struct dcb *, DCB_REASON, void *), void *);
 int dcb_isvalid(DCB *);                     /* Check the DCB is in the linked list */
 int dcb_count_by_usage(DCB_USAGE);          /* Return counts of DCBs */
-int dcb_persistent_clean_count(DCB *, int, bool);      /* Clean persistent and return count */
+int dcb_persistent_clean(struct server *, int, bool);  /* Clean persistent and return count */
+void dcb_persistent_discard(DCB *dcb);      /* Close a DCB removed from the persistent pool */
 void dcb_hangup_foreach (struct server* server);
 size_t dcb_get_session_id(DCB* dcb);
 char *dcb_role_name(DCB *);                  /* Return the name of a role */
@@ -329,8 +427,50 @@ int dcb_accept_SSL(DCB* dcb);
 int dcb_connect_SSL(DCB* dcb);
 int dcb_listen(DCB *listener, const char *config, const char *protocol_name);
 void dcb_append_readqueue(DCB *dcb, GWBUF *buffer);
-void dcb_enable_session_timeouts();
-void dcb_process_idle_sessions(int thr);
+void dcb_start_idle_timer(DCB *dcb);
+
+/**
+ * @brief Stop reading the backends when the client is slow to read
+ *
+ * When the write queue of the client DCB grows above @c high_water bytes, the
+ * backend DCBs of its session are no longer read. The replies stay in the
+ * socket buffers of the backend connections until the write queue has drained
+ * below @c low_water bytes.
+ *
+ * @param dcb        Client DCB
+ * @param high_water High water mark of the write queue
+ * @param low_water  Low water mark of the write queue
+ * @return True if the callbacks were added
+ */
+bool dcb_set_backpressure(DCB *dcb, int high_water, int low_water);
+
+/**
+ * @brief Check whether a read of a backend DCB must wait for its client
+ *
+ * This is called before the EPOLLIN event of the DCB is processed. A skipped
+ * read is done with a fake read event once the client has drained its
+ * write queue.
+ *
+ * @param dcb DCB that is readable
+ * @return True if the read was skipped
+ */
+bool dcb_pause_read(DCB *dcb);
+
+/**
+ * @brief Move an idle session to another thread
+ *
+ * The client DCB of the session and all of its backend DCBs are moved from
+ * the epoll instance of this thread to that of @c to. A session is idle if
+ * none of its DCBs has pending data, none of them has read anything for at
+ * least a second and neither the protocols nor the router wait for replies.
+ * This must only be called by the owning thread while it is not processing
+ * events.
+ *
+ * @param from The calling thread, the current owner of the session
+ * @param to   The thread where the session is moved
+ * @return True if a session was moved, false if no session was idle
+ */
+bool dcb_migrate_idle_session(int from, int to);
 
 /**
  * @brief Call a function for each connected DCB
@@ -357,6 +497,7 @@ int dcb_get_port(const DCB *dcb);
 #define DCBF_CLONE              0x0001  /*< DCB is a clone */
 #define DCBF_HUNG               0x0002  /*< Hangup has been dispatched */
 #define DCBF_REPLIED    0x0004  /*< DCB was written to */
+#define DCBF_POOLED_PROTOCOL 0x0008 /*< The protocol data was allocated with mxs_pool_alloc */
 
 #define DCB_IS_CLONE(d) ((d)->flags & DCBF_CLONE)
 #define DCB_REPLIED(d) ((d)->flags & DCBF_REPLIED)
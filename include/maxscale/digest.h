@@ -0,0 +1,94 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file digest.h  Fingerprints of statements
+ *
+ * The digest of a statement is a 128-bit hash of its canonical form, where
+ * string and numeric literals are replaced with question marks, comments are
+ * removed and whitespace is squeezed. Statements that differ only by their
+ * literals, comments or whitespace have the same digest.
+ *
+ * The digest of a GWBUF is computed once and stored in the buffer, so that all
+ * filters and routers that need it can use it without canonicalizing the
+ * statement again.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+/** The length of the hexadecimal representation of a digest, including the NUL */
+#define MXS_DIGEST_STR_LEN 33
+
+typedef struct mxs_digest
+{
+    uint64_t hi;
+    uint64_t lo;
+} MXS_DIGEST;
+
+/**
+ * @brief Get the digest of a statement
+ *
+ * The digest is computed the first time it is asked for and then stored
+ * in the statement information of the GWBUF, see stmtinfo.h.
+ *
+ * @param query  A contiguous COM_QUERY or COM_STMT_PREPARE packet.
+ * @param digest On return, the digest of the statement.
+ *
+ * @return True, if the buffer contained a statement whose digest could be
+ *         computed, false otherwise.
+ */
+bool mxs_digest_get(GWBUF* query, MXS_DIGEST* digest);
+
+/**
+ * @brief Create the canonical form of a statement
+ *
+ * The canonical form is the one whose hash is the digest of the statement.
+ * Literals with a prefix, as in X'1F' or _utf8'a', quoted identifiers,
+ * double quoted strings and executable comments are left as they are.
+ *
+ * @param sql The statement.
+ * @param len The length of the statement.
+ * @param out Buffer of at least @c len bytes, on return the canonical form,
+ *            which is not NUL terminated.
+ *
+ * @return The length of the canonical form.
+ */
+size_t mxs_digest_canonicalize(const char* sql, size_t len, char* out);
+
+/**
+ * @brief Compute a 128-bit hash of arbitrary data
+ *
+ * The hash is not cryptographic. It is the hash used for the digests, so
+ * that data related to a statement can be hashed the same way.
+ *
+ * @param data   The data to hash.
+ * @param len    The length of the data.
+ * @param seed   The seed of the hash, a previous hash can be used for
+ *               chaining several pieces of data.
+ * @param digest On return, the hash.
+ */
+void mxs_digest_hash(const void* data, size_t len, uint64_t seed, MXS_DIGEST* digest);
+
+/**
+ * @brief Convert a digest to a hexadecimal string
+ *
+ * @param digest The digest.
+ * @param str    Buffer of at least MXS_DIGEST_STR_LEN bytes.
+ */
+void mxs_digest_to_string(const MXS_DIGEST* digest, char* str);
+
+MXS_END_DECLS
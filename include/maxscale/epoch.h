@@ -0,0 +1,67 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file epoch.h - Deferred freeing of objects read without locks
+ *
+ * Every worker thread announces a quiescent state at the end of each poll
+ * loop iteration, at which point it holds no pointers to shared objects that
+ * it has read without a lock. An object that has been made unreachable is
+ * given to mxs_epoch_defer and freed once every worker thread has passed
+ * through a quiescent state.
+ *
+ * As a result, a worker thread can read a structure that is modified with
+ * this in mind without taking any locks, as long as it does not keep the
+ * pointers it read beyond the current event. Other threads must keep using
+ * locks to read such structures, but they can modify them and defer frees.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdbool.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * The function that frees a deferred object
+ */
+typedef void (*mxs_epoch_free_fn)(void *data);
+
+/**
+ * @brief Free an object once no worker thread can be reading it
+ *
+ * The object must already be unreachable for new readers. Can be called by
+ * any thread.
+ *
+ * @param freefn The function that frees the object
+ * @param data   The object
+ */
+void mxs_epoch_defer(mxs_epoch_free_fn freefn, void *data);
+
+/**
+ * @brief Wait until no worker thread can be reading an unreachable object
+ *
+ * When this returns, every worker thread has passed a quiescent state after
+ * the call was made. The objects deferred before the call by the calling
+ * thread, or by threads that are not worker threads, have been freed.
+ */
+void mxs_epoch_synchronize(void);
+
+/**
+ * @brief Check if the calling thread can read without locks
+ *
+ * @return True if the calling thread is a worker thread
+ */
+bool mxs_epoch_is_worker(void);
+
+MXS_END_DECLS
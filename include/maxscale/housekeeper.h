@@ -73,4 +73,39 @@ extern int  hktask_oneshot(const char *name, void (*task)(void *), void *data, i
 extern int  hktask_remove(const char *name);
 extern void hkshow_tasks(DCB *pdcb);
 
+/**
+ * @brief Add a task that a worker thread runs periodically
+ *
+ * The task is run by the event loop of the worker thread, so it needs no
+ * locking to access data that only that thread uses, and it does not delay
+ * or get delayed by the tasks of the housekeeper thread or other workers.
+ *
+ * When called by the worker thread itself, the task is added immediately.
+ * Otherwise the worker thread adds it the next time it polls for events.
+ * Task names must be unique within a thread.
+ *
+ * @param thread_id The worker thread ID
+ * @param name      The name of the task
+ * @param task      The function to call
+ * @param data      Data to pass to the function
+ * @param frequency How often to run the task, expressed in seconds
+ *
+ * @return 1 if the task was added or scheduled for addition, otherwise 0
+ */
+extern int  hktask_add_worker(int thread_id, const char *name, void (*task)(void *), void *data,
+                              int frequency);
+
+/**
+ * @brief Remove a task of a worker thread
+ *
+ * When called by another thread than the worker thread, the task can still
+ * be run once while the removal is pending.
+ *
+ * @param thread_id The worker thread ID
+ * @param name      The name of the task
+ *
+ * @return 1 if the task was removed or scheduled for removal, otherwise 0
+ */
+extern int  hktask_remove_worker(int thread_id, const char *name);
+
 MXS_END_DECLS
@@ -0,0 +1,175 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file lfhash.h A hashtable with lock-free reads
+ *
+ * The functions mirror the ones of hashtable.h and take the same hash,
+ * comparison, copy and free functions. Writers are serialized by a spinlock.
+ * Worker threads read the table without locking and the memory that the
+ * writers release is freed with mxs_epoch_defer once no worker thread can be
+ * reading it. As with other structures read this way, other threads take the
+ * lock of the table to read it.
+ *
+ * This makes the table a good choice for data that the worker threads read
+ * much more often than it is modified, such as user tables.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/spinlock.h>
+
+MXS_BEGIN_DECLS
+
+/** The entry array of a table, replaced when the table is resized */
+typedef struct lfhash_array LFHASH_ARRAY;
+
+/**
+ * The hashtable
+ */
+typedef struct lfhash
+{
+    LFHASH_ARRAY   *array;      /**< The current entries */
+    HASHHASHFN      hashfn;     /**< The hash function */
+    HASHCMPFN       cmpfn;      /**< The key comparison function */
+    HASHCOPYFN      kcopyfn;    /**< Optional key copy function */
+    HASHCOPYFN      vcopyfn;    /**< Optional value copy function */
+    HASHFREEFN      kfreefn;    /**< Optional key free function */
+    HASHFREEFN      vfreefn;    /**< Optional value free function */
+    SPINLOCK        lock;       /**< Serializes the writers and the readers that are not workers */
+    int             min_size;   /**< The array is never made smaller than this */
+    int             n_elements; /**< Number of elements */
+    int             n_used;     /**< Number of entries used by elements or deleted ones */
+} LFHASH;
+
+/**
+ * The iterator of a table
+ */
+typedef struct lfhash_iterator
+{
+    LFHASH *table; /**< The table the iterator refers to */
+    int     index; /**< The next entry to look at */
+} LFHASHITERATOR;
+
+/**
+ * @brief Allocate a hashtable
+ *
+ * @param size   The initial number of elements to reserve room for
+ * @param hashfn The hash function
+ * @param cmpfn  The key comparison function
+ *
+ * @return The new table or NULL on memory allocation failure
+ */
+LFHASH* lfhash_alloc(int size, HASHHASHFN hashfn, HASHCMPFN cmpfn);
+
+/**
+ * @brief Set the key and value memory management functions
+ *
+ * Any of the functions can be NULL in which case the previous one is kept.
+ *
+ * @param table   The table
+ * @param kcopyfn Copies the key when an element is added
+ * @param vcopyfn Copies the value when an element is added
+ * @param kfreefn Frees the key when the element is deleted or the table freed
+ * @param vfreefn Frees the value when the element is deleted or the table freed
+ */
+void lfhash_memory_fns(LFHASH *table, HASHCOPYFN kcopyfn, HASHCOPYFN vcopyfn,
+                       HASHFREEFN kfreefn, HASHFREEFN vfreefn);
+
+/**
+ * @brief Free a hashtable
+ *
+ * No other thread may be using the table.
+ *
+ * @param table The table to free
+ */
+void lfhash_free(LFHASH *table);
+
+/**
+ * @brief Add an element
+ *
+ * @param table The table
+ * @param key   The key of the element
+ * @param value The value of the element
+ *
+ * @return 1 if the element was added, 0 if the key already exists or on error
+ */
+int lfhash_add(LFHASH *table, void *key, void *value);
+
+/**
+ * @brief Delete an element
+ *
+ * The key and the value are freed once no worker thread can be reading them.
+ *
+ * @param table The table
+ * @param key   The key of the element
+ *
+ * @return 1 if the element was deleted, 0 if it was not found
+ */
+int lfhash_delete(LFHASH *table, void *key);
+
+/**
+ * @brief Fetch the value of an element
+ *
+ * On a worker thread, the value stays valid until the end of the current
+ * event even if the element is deleted. On other threads, as with
+ * hashtable_fetch, the value can be freed by a delete as soon as this
+ * function returns.
+ *
+ * @param table The table
+ * @param key   The key of the element
+ *
+ * @return The value or NULL if the key was not found
+ */
+void* lfhash_fetch(LFHASH *table, void *key);
+
+/**
+ * @brief Get the number of elements
+ *
+ * @param table The table
+ *
+ * @return The number of elements
+ */
+int lfhash_size(LFHASH *table);
+
+/**
+ * @brief Create an iterator
+ *
+ * @param table The table to iterate over
+ *
+ * @return The iterator or NULL on memory allocation failure
+ */
+LFHASHITERATOR* lfhash_iterator(LFHASH *table);
+
+/**
+ * @brief Get the next key of an iterator
+ *
+ * Elements added or deleted during the iteration may or may not be returned.
+ * If the table is resized during the iteration, elements can be returned
+ * twice or not at all.
+ *
+ * @param iter The iterator
+ *
+ * @return The next key or NULL when all keys have been returned
+ */
+void* lfhash_next(LFHASHITERATOR *iter);
+
+/**
+ * @brief Free an iterator
+ *
+ * @param iter The iterator to free
+ */
+void lfhash_iterator_free(LFHASHITERATOR *iter);
+
+MXS_END_DECLS
@@ -42,6 +42,11 @@ typedef struct servlistener
     char *auth_options;         /**< Authenticator options */
     void *auth_instance;        /**< Authenticator instance created in MXS_AUTHENTICATOR::initialize() */
     SSL_LISTENER *ssl;          /**< Structure of SSL data or NULL */
+    bool compression;           /**< Whether clients may compress the protocol packets */
+    int max_connection_rate;    /**< Connections accepted per second, 0 for no limit */
+    double accept_tokens;       /**< Connections that can be accepted before the rate is exceeded */
+    int64_t accept_refill;      /**< When accept_tokens was last refilled, in microseconds */
+    uint64_t n_throttled;       /**< Accepts deferred because of max_connection_rate */
     struct dcb *listener;       /**< The DCB for the listener */
     struct users *users;        /**< The user data for this listener */
     struct service* service;    /**< The service which used by this listener */
@@ -69,4 +74,23 @@ int listener_set_ssl_version(SSL_LISTENER *ssl_listener, char* version);
 void listener_set_certificates(SSL_LISTENER *ssl_listener, char* cert, char* key, char* ca_cert);
 int listener_init_SSL(SSL_LISTENER *ssl_listener);
 
+/**
+ * @brief Check whether a connection can be accepted within the connection rate
+ *
+ * The connection rate is a token bucket that fills at max_connection_rate
+ * tokens per second and holds at most one second's worth of them.
+ *
+ * @param listener The listener
+ * @return 0 if a connection can be accepted now, otherwise the number of
+ *         microseconds until one can be accepted
+ */
+int64_t listener_accept_delay(SERV_LISTENER *listener);
+
+/**
+ * @brief Count an accepted connection against the connection rate
+ *
+ * @param listener The listener
+ */
+void listener_count_accept(SERV_LISTENER *listener);
+
 MXS_END_DECLS
@@ -15,6 +15,7 @@
 #include <maxscale/cdefs.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <syslog.h>
 #include <unistd.h>
 
@@ -90,6 +91,15 @@ typedef struct mxs_log_throttling
     size_t suppress_ms; // If exceeded, suppress such messages for this many ms.
 } MXS_LOG_THROTTLING;
 
+/**
+ * The format of the lines in the MaxScale log.
+ */
+typedef enum
+{
+    MXS_LOG_FORMAT_TEXT, // Timestamp, priority and message
+    MXS_LOG_FORMAT_JSON  // One JSON object per line
+} mxs_log_format_t;
+
 bool mxs_log_init(const char* ident, const char* logdir, mxs_log_target_t target);
 void mxs_log_finish(void);
 
@@ -103,9 +113,19 @@ void mxs_log_set_maxlog_enabled(bool enabled);
 void mxs_log_set_highprecision_enabled(bool enabled);
 void mxs_log_set_augmentation(int bits);
 void mxs_log_set_throttling(const MXS_LOG_THROTTLING* throttling);
+void mxs_log_set_format(mxs_log_format_t format);
+void mxs_log_set_deferred_enabled(bool enabled);
 
 void mxs_log_get_throttling(MXS_LOG_THROTTLING* throttling);
 
+/**
+ * Get the number of info and debug messages that were dropped because the
+ * log buffer of the thread that logged them was full.
+ *
+ * @return Number of dropped messages
+ */
+uint64_t mxs_log_get_dropped(void);
+
 static inline bool mxs_log_priority_is_enabled(int priority)
 {
     assert((priority & ~LOG_PRIMASK) == 0);
@@ -116,6 +136,25 @@ int mxs_log_message(int priority,
                     const char* modname,
                     const char* file, int line, const char* function,
                     const char* format, ...) __attribute__((format(printf, 6, 7)));
+
+/**
+ * Log a message whose format is a string literal. The formatting of info and
+ * debug messages can then be left to the log writer thread.
+ *
+ * NOTE: Should not be called directly, the MXS_ERROR, MXS_WARNING, etc.
+ *       macros call this when the format is a string literal.
+ */
+int mxs_log_message_literal(int priority,
+                            const char* modname,
+                            const char* file, int line, const char* function,
+                            const char* format, ...) __attribute__((format(printf, 6, 7)));
+
+#if defined(__GNUC__)
+#define MXS_LOG_FORMAT_IS_LITERAL(format) __builtin_constant_p(format)
+#else
+#define MXS_LOG_FORMAT_IS_LITERAL(format) 0
+#endif
+
 /**
  * Log an error, warning, notice, info, or debug  message.
  *
@@ -128,7 +167,9 @@ int mxs_log_message(int priority,
  */
 #define MXS_LOG_MESSAGE(priority, format, ...)\
     (mxs_log_priority_is_enabled(priority) ? \
-     mxs_log_message(priority, MXS_MODULE_NAME, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__) :\
+     (MXS_LOG_FORMAT_IS_LITERAL(format) ? \
+      mxs_log_message_literal(priority, MXS_MODULE_NAME, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__) :\
+      mxs_log_message(priority, MXS_MODULE_NAME, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__)) :\
      0)
 
 /**
@@ -0,0 +1,128 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics.h - A registry of metrics in the text exposition format
+ *
+ * The core and the modules register the counters, gauges and histograms that
+ * they want to expose. The values are kept in per-thread statistics, so
+ * updating a metric takes no locks, and the registry is read without locks
+ * so that the metrics can be scraped as often as once a second.
+ *
+ * All metrics with the same name form a family and must be of the same type.
+ * The members of a family are told apart by a label, e.g. service="RW".
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdint.h>
+#include <maxscale/dcb.h>
+#include <maxscale/statistics.h>
+
+MXS_BEGIN_DECLS
+
+typedef enum
+{
+    MXS_METRIC_COUNTER,   /**< A value that only increases */
+    MXS_METRIC_GAUGE,     /**< A value that can go up and down */
+    MXS_METRIC_HISTOGRAM  /**< Observations counted in buckets */
+} mxs_metric_type_t;
+
+typedef struct mxs_metric MXS_METRIC;
+
+/**
+ * @brief Create and register a counter or a gauge
+ *
+ * @param name  Name of the metric, e.g. maxscale_service_sessions_total
+ * @param help  Description of the metric
+ * @param type  MXS_METRIC_COUNTER or MXS_METRIC_GAUGE
+ * @param label Name of the label or NULL for no label
+ * @param value Value of the label
+ *
+ * @return The metric or NULL if memory allocation failed
+ */
+MXS_METRIC* mxs_metric_create(const char *name, const char *help, mxs_metric_type_t type,
+                              const char *label, const char *value);
+
+/**
+ * @brief Register existing statistics as a counter or a gauge
+ *
+ * The statistics are not owned by the metric and they must not be freed
+ * before the metric is destroyed.
+ *
+ * @param name      Name of the metric
+ * @param help      Description of the metric
+ * @param type      MXS_METRIC_COUNTER or MXS_METRIC_GAUGE
+ * @param label     Name of the label or NULL for no label
+ * @param value     Value of the label
+ * @param stats     The statistics
+ * @param aggregate How the values of the threads are combined
+ *
+ * @return The metric or NULL if memory allocation failed
+ */
+MXS_METRIC* mxs_metric_create_stats(const char *name, const char *help, mxs_metric_type_t type,
+                                    const char *label, const char *value, ts_stats_t stats,
+                                    enum ts_stats_type aggregate);
+
+/**
+ * @brief Create and register a histogram
+ *
+ * @param name     Name of the metric
+ * @param help     Description of the metric
+ * @param label    Name of the label or NULL for no label
+ * @param value    Value of the label
+ * @param bounds   Upper bounds of the buckets in ascending order
+ * @param n_bounds Number of bounds, a bucket for larger values is always added
+ *
+ * @return The metric or NULL if memory allocation failed
+ */
+MXS_METRIC* mxs_metric_create_histogram(const char *name, const char *help,
+                                        const char *label, const char *value,
+                                        const int64_t *bounds, int n_bounds);
+
+/**
+ * @brief Add to a counter or a gauge
+ *
+ * @param metric Metric created with mxs_metric_create
+ * @param value  Value to add, only gauges can be decremented
+ */
+void mxs_metric_add(MXS_METRIC *metric, int64_t value);
+
+/**
+ * @brief Add an observation to a histogram
+ *
+ * @param metric Histogram
+ * @param value  Observed value
+ */
+void mxs_metric_observe(MXS_METRIC *metric, int64_t value);
+
+/**
+ * @brief Unregister and free a metric
+ *
+ * The metric is freed once no worker thread can be writing it out.
+ *
+ * @param metric Metric to destroy, can be NULL
+ */
+void mxs_metric_destroy(MXS_METRIC *metric);
+
+/**
+ * @brief Write all metrics in the text exposition format
+ *
+ * The registry is read without locks, so this must be called by a worker
+ * thread while it is processing an event.
+ *
+ * @param dcb DCB to write to
+ */
+void mxs_metrics_write(DCB *dcb);
+
+MXS_END_DECLS
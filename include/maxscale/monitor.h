@@ -138,12 +138,27 @@ typedef struct monitor_servers
     int mon_err_count;
     unsigned int mon_prev_status;
     unsigned int pending_status;  /**< Pending Status flag bitmap */
+    bool was_usable;              /**< Whether the server was usable in the previous round */
+    uint64_t warmup_start;        /**< When the server started to warm up in milliseconds,
+                                   * 0 if it is not warming up */
     struct monitor_servers *next; /**< The next server in the list */
 } MXS_MONITOR_SERVERS;
 
 /**
  * Representation of the running monitor.
  */
+/**
+ * Statistics of the scripts that a monitor has launched
+ */
+typedef struct mxs_monitor_script_stats
+{
+    uint64_t executed;    /**< Number of scripts that have finished */
+    uint64_t timeouts;    /**< Number of scripts killed for running too long */
+    uint64_t dropped;     /**< Number of scripts not run because the queue was full */
+    uint64_t last_ms;     /**< How long the last script ran in milliseconds */
+    uint64_t max_ms;      /**< How long the longest script ran in milliseconds */
+} MXS_MONITOR_SCRIPT_STATS;
+
 struct mxs_monitor
 {
     char *name;                   /**< The name of the monitor module */
@@ -170,6 +185,12 @@ struct mxs_monitor
     volatile bool server_pending_changes;
     /**< Are there any pending changes to a server?
        * If yes, the next monitor loop starts early.  */
+    struct mxs_monitor_probe_pool *probe_pool; /**< Threads that probe the servers */
+    int script_timeout;           /**< Seconds a script may run before it is killed */
+    bool collect_metrics;         /**< Whether the load of the servers is sampled */
+    int warmup_time;              /**< Seconds over which the weight of a server that
+                                   * became usable is raised to the full weight */
+    MXS_MONITOR_SCRIPT_STATS script_stats; /**< Statistics of the launched scripts */
     struct mxs_monitor *next;     /**< Next monitor in the linked list */
 };
 
@@ -216,6 +237,30 @@ void servers_status_current_to_pending(MXS_MONITOR *monitor);
 bool mon_status_changed(MXS_MONITOR_SERVERS* mon_srv);
 bool mon_print_fail_status(MXS_MONITOR_SERVERS* mon_srv);
 
+/**
+ * Function that probes a single server of a monitor
+ *
+ * @param monitor  Monitor object
+ * @param database The server to probe
+ */
+typedef void (*mxs_monitor_probe_t)(MXS_MONITOR *monitor, MXS_MONITOR_SERVERS *database);
+
+/**
+ * @brief Probe all servers of a monitor concurrently
+ *
+ * The servers are probed by a pool of threads owned by the monitor and
+ * the calling thread, so one slow server does not delay the probing of the
+ * others. The function returns once all servers have been probed. The probe
+ * function must only modify the server it is given and it must be safe to
+ * call from several threads at the same time.
+ *
+ * The caller must hold the lock of the monitor servers.
+ *
+ * @param monitor Monitor object
+ * @param probe   Function that probes one server
+ */
+void mon_probe_servers(MXS_MONITOR *monitor, mxs_monitor_probe_t probe);
+
 mxs_connect_result_t mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database);
 void mon_log_connect_error(MXS_MONITOR_SERVERS* database, mxs_connect_result_t rval);
 
@@ -29,6 +29,23 @@ uint64_t mxs_leint_consume(uint8_t ** c);
 char* mxs_lestr_consume_dup(uint8_t** c);
 char* mxs_lestr_consume(uint8_t** c, size_t *size);
 
+/**
+ * @brief Get the value of a tracked system variable from an OK packet
+ *
+ * When the connection has the CLIENT_SESSION_TRACK capability, the server
+ * reports the changed system variables that are listed in the variable
+ * session_track_system_variables in the OK packets. GTIDs reported with
+ * session_track_gtids are returned with the name "gtid".
+ *
+ * @param packet A complete OK packet, including the header.
+ * @param len    The length of the packet.
+ * @param name   The name of the variable.
+ *
+ * @return The value of the variable, which the caller must free, or NULL if
+ *         the packet does not report a change of the variable.
+ */
+char* mxs_mysql_get_tracked_variable(const uint8_t* packet, size_t len, const char* name);
+
 MYSQL *mxs_mysql_real_connect(MYSQL *mysql, SERVER *server, const char *user, const char *passwd);
 
 /**
@@ -91,4 +91,14 @@ int poll_remove_dcb(DCB *);
  */
 void poll_add_epollin_event_to_dcb(DCB* dcb, GWBUF* buf);
 
+/**
+ * @brief Get the ID of the calling worker thread
+ *
+ * The IDs of the worker threads are below config_threadcount(), which makes
+ * them usable as indexes of arrays with an element for each worker.
+ *
+ * @return The ID of the worker thread or -1 if the caller is not a worker
+ */
+int poll_current_worker(void);
+
 MXS_END_DECLS
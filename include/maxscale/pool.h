@@ -0,0 +1,98 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file pool.h - Per-thread pools of fixed size objects
+ *
+ * A pool keeps a free list of objects for each worker thread. Objects freed
+ * by a worker thread are kept for reuse by the same thread instead of being
+ * returned to the allocator, which makes the allocation of objects that are
+ * created for each connection cheap. Threads that are not worker threads
+ * always use the allocator directly.
+ *
+ * Pools are usually defined statically with MXS_POOL_INIT and need no other
+ * initialization.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/limits.h>
+
+MXS_BEGIN_DECLS
+
+struct mxs_pool_object;
+
+/**
+ * The free list and statistics of one thread. The values are only modified
+ * by the owning thread.
+ */
+typedef struct mxs_pool_thread
+{
+    struct mxs_pool_object *free; /*< Free objects */
+    int      n_free;              /*< Number of free objects */
+    uint64_t n_hits;              /*< Allocations served from the free list */
+    uint64_t n_misses;            /*< Allocations that had to use the allocator */
+    uint64_t n_recycled;          /*< Objects returned to the free list */
+    uint64_t n_released;          /*< Objects released because the free list was full */
+} __attribute__((aligned(64))) MXS_POOL_THREAD;
+
+typedef struct mxs_pool
+{
+    const char      *name;     /*< Name shown in the diagnostics */
+    size_t           size;     /*< Size of the objects */
+    int              max_free; /*< The maximum number of free objects a thread keeps */
+    bool             registered; /*< Whether the pool is in the list of all pools */
+    struct mxs_pool *next;     /*< Next pool in the list of all pools */
+    MXS_POOL_THREAD  threads[MXS_MAX_THREADS]; /*< The free lists of the threads */
+} MXS_POOL;
+
+/**
+ * Static initializer for a pool
+ *
+ * @param n Name of the pool
+ * @param s Size of the objects
+ * @param m The maximum number of free objects kept by each thread
+ */
+#define MXS_POOL_INIT(n, s, m) {.name = n, .size = s, .max_free = m}
+
+/**
+ * @brief Allocate an object from a pool
+ *
+ * The content of the object is undefined.
+ *
+ * @param pool The pool
+ *
+ * @return The object or NULL if memory allocation failed
+ */
+void* mxs_pool_alloc(MXS_POOL *pool);
+
+/**
+ * @brief Allocate a zeroed object from a pool
+ *
+ * @param pool The pool
+ *
+ * @return The object or NULL if memory allocation failed
+ */
+void* mxs_pool_calloc(MXS_POOL *pool);
+
+/**
+ * @brief Free an object allocated from a pool
+ *
+ * The object can be freed by a different thread than the one that
+ * allocated it.
+ *
+ * @param object Object allocated with mxs_pool_alloc or mxs_pool_calloc, or NULL
+ */
+void mxs_pool_free(void *object);
+
+MXS_END_DECLS
@@ -44,6 +44,10 @@ struct session;
  *      listen          Create a listener for the protocol
  *      auth            Authentication entry point
  *  session         Session handling entry point
+ *      ping            Check that an idle pooled backend connection is alive,
+ *                      the reply is read by the read entry point
+ *      idle            Check that no reply is outstanding on the connection, 1 if
+ *                      the DCB can be moved to another thread
  * @endverbatim
  *
  * This forms the "module object" for protocol modules within the gateway.
@@ -65,6 +69,8 @@ typedef struct mxs_protocol
     int32_t (*session)(struct dcb *, void *);
     char   *(*auth_default)();
     int32_t (*connlimit)(struct dcb *, int limit);
+    int32_t (*ping)(struct dcb *);
+    int32_t (*idle)(struct dcb *);
 } MXS_PROTOCOL;
 
 /**
@@ -72,6 +78,6 @@ typedef struct mxs_protocol
  * the MXS_PROTOCOL structure is changed. See the rules defined in modinfo.h
  * that define how these numbers should change.
  */
-#define MXS_PROTOCOL_VERSION      {1, 1, 0}
+#define MXS_PROTOCOL_VERSION      {1, 3, 0}
 
 MXS_END_DECLS
@@ -129,6 +129,14 @@ typedef enum
     MYSQL_PROTOCOL_DONE
 } mysql_protocol_state_t;
 
+/** How far the reply to the current command has been routed to the client */
+typedef enum
+{
+    MYSQL_REPLY_STATE_START,  /*< Waiting for the first packet of a reply */
+    MYSQL_REPLY_STATE_COLDEF, /*< Routing the column definitions of a result set */
+    MYSQL_REPLY_STATE_ROWS    /*< Routing the rows of a result set */
+} mysql_reply_state_t;
+
 
 /*
  * MySQL session specific data
@@ -288,6 +296,20 @@ typedef struct server_command_st
  * Protocol carries information from client side to backend side, such as
  * MySQL session command information and history of earlier session commands.
  */
+/**
+ * A prepared statement kept open on a server connection after its client
+ * closed it, so that the next PREPARE of the same SQL can use it again
+ */
+typedef struct mysql_ps_cache_entry
+{
+    char*                        sql;    /*< The SQL of the statement */
+    size_t                       len;    /*< Length of the SQL */
+    uint32_t                     id;     /*< ID of the statement on the server */
+    GWBUF*                       reply;  /*< The reply to the COM_STMT_PREPARE */
+    bool                         in_use; /*< Whether a client has the statement open */
+    struct mysql_ps_cache_entry* next;   /*< The next entry, the oldest is the first */
+} mysql_ps_cache_entry_t;
+
 typedef struct
 {
 #if defined(SS_DEBUG)
@@ -308,11 +330,30 @@ typedef struct
     unsigned int           charset;                      /*< MySQL character set at connect time */
     bool                   ignore_reply;                 /*< If the reply should be discarded */
     GWBUF*                 stored_query;                 /*< Temporarily stored queries */
+    mysql_reply_state_t    reply_state;                  /*< State of the reply being routed */
+    bool                   compress;                     /*< Whether packets after the authentication are compressed */
+    uint8_t                compress_seq;                 /*< Sequence number of the next compressed packet */
+    uint32_t               compress_left;                /*< Bytes left of the packet being compressed */
+    GWBUF*                 compress_readqueue;           /*< Incomplete compressed packet */
+    bool                   large_query;                  /*< The next packet continues a large command */
+    uint32_t               stream_left;                  /*< Bytes left of the continuation packet being streamed */
+    bool                   stream_last;                  /*< The streamed packet is the last one of the command */
+    mysql_ps_cache_entry_t* ps_cache;                    /*< Prepared statements kept for reuse */
+    int                    ps_cache_count;               /*< Number of entries in ps_cache */
+    GWBUF*                 ps_pending;                   /*< COM_STMT_PREPARE whose reply is cached */
+    uint32_t               ps_last_id;                   /*< ID of the last statement served from ps_cache */
+    bool                   ps_last_cached;               /*< The last COM_STMT_PREPARE was served from ps_cache */
 #if defined(SS_DEBUG)
     skygw_chk_t            protocol_chk_tail;
 #endif
 } MySQLProtocol;
 
+/** Length of the header of a compressed packet */
+#define MYSQL_COMPRESSED_HEADER_LEN 7
+
+/** Packets shorter than this are sent uncompressed */
+#define MYSQL_COMPRESS_MIN_LEN 50
+
 /** Defines for response codes */
 #define MYSQL_REPLY_ERR               0xff
 #define MYSQL_REPLY_OK                0x00
@@ -433,4 +474,122 @@ bool mxs_mysql_is_ok_packet(GWBUF *buffer);
 /** Check for result set */
 bool mxs_mysql_is_result_set(GWBUF *buffer);
 
+/**
+ * @brief Read data from a connection
+ *
+ * If the connection uses compression, the complete compressed packets are
+ * decompressed and the rest is kept until the next read.
+ *
+ * @param dcb      DCB to read from
+ * @param head     The data that was read is appended to this buffer
+ * @param maxbytes Maximum number of bytes to read, 0 for no limit
+ *
+ * @return -1 on error, otherwise the return value of dcb_read()
+ */
+int mxs_mysql_read(DCB *dcb, GWBUF **head, int maxbytes);
+
+/**
+ * @brief Write data to a connection
+ *
+ * If the connection uses compression, the data is compressed before it is
+ * written.
+ *
+ * @param dcb   DCB to write to
+ * @param queue Data to write, freed by the function
+ *
+ * @return The return value of dcb_write()
+ */
+int mxs_mysql_write(DCB *dcb, GWBUF *queue);
+
+/** Free the compression state of the calling thread */
+void mxs_mysql_compress_thread_finish(void);
+
+/**
+ * @brief Reply to a COM_STMT_PREPARE from the statement cache of a connection
+ *
+ * The cache of a server connection keeps the statements that the clients have
+ * closed open on the server. If a statement with the same SQL is not in use,
+ * it is marked as used and a copy of its reply is returned.
+ *
+ * @param dcb     Server connection
+ * @param prepare The COM_STMT_PREPARE
+ *
+ * @return Copy of the reply or NULL if the statement must be prepared
+ */
+GWBUF* mxs_mysql_ps_cache_get(DCB *dcb, GWBUF *prepare);
+
+/**
+ * @brief Expect the reply to a COM_STMT_PREPARE that is written to a server
+ *
+ * @param dcb     Server connection
+ * @param prepare The COM_STMT_PREPARE, the data is cloned
+ */
+void mxs_mysql_ps_cache_expect(DCB *dcb, GWBUF *prepare);
+
+/**
+ * @brief Store the reply to the expected COM_STMT_PREPARE
+ *
+ * If the cache is full, the oldest statement that is not in use is closed on
+ * the server to make room. The statement is not stored if another statement
+ * with the same SQL is in the cache.
+ *
+ * @param dcb   Server connection
+ * @param reply The complete reply, it is copied
+ */
+void mxs_mysql_ps_cache_store(DCB *dcb, GWBUF *reply);
+
+/**
+ * @brief Handle the closing of a statement by a client
+ *
+ * @param dcb Server connection
+ * @param id  ID of the closed statement
+ *
+ * @return True if the statement is in the cache and the COM_STMT_CLOSE must
+ *         not be sent to the server
+ */
+bool mxs_mysql_ps_cache_close(DCB *dcb, uint32_t id);
+
+/**
+ * @brief Mark all statements of a connection as unused
+ *
+ * Called when a pooled connection is given to a new client as-is.
+ *
+ * @param proto Server protocol
+ */
+void mxs_mysql_ps_cache_release(MySQLProtocol *proto);
+
+/**
+ * @brief Forget the statements of a connection
+ *
+ * Called when the server closes the statements or when the default database
+ * changes.
+ *
+ * @param proto Server protocol
+ * @param close Close the statements that are not in use on the server
+ */
+void mxs_mysql_ps_cache_clear(MySQLProtocol *proto, bool close);
+
+/**
+ * @brief Change the statement ID of a binary protocol command
+ *
+ * @param buf Pointer to COM_STMT_EXECUTE, COM_STMT_SEND_LONG_DATA,
+ *            COM_STMT_CLOSE, COM_STMT_RESET or COM_STMT_FETCH, replaced with
+ *            a writable copy if the data is shared
+ * @param id  The new ID
+ *
+ * @return False if memory allocation failed, @c buf is then unchanged
+ */
+bool mxs_mysql_set_ps_id(GWBUF **buf, uint32_t id);
+
+/**
+ * @brief Connect to the fake backend
+ *
+ * The fake backend answers the queries of the connections to servers with
+ * fake_backend=true without a database. It is used to measure the throughput
+ * and the latency of MaxScale itself.
+ *
+ * @return The file descriptor of a connected socket or -1 on error
+ */
+int mxs_mysql_loopback_connect(void);
+
 MXS_END_DECLS
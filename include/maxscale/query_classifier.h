@@ -17,7 +17,7 @@
 
 MXS_BEGIN_DECLS
 
-#define QUERY_CLASSIFIER_VERSION {1, 1, 0}
+#define QUERY_CLASSIFIER_VERSION {1, 2, 0}
 
 /**
  * qc_init_kind_t specifies what kind of initialization should be performed.
@@ -160,6 +160,16 @@ typedef enum qc_result
     QC_RESULT_ERROR
 } qc_result_t;
 
+/**
+ * The statistics of the classification cache of a query classifier.
+ */
+typedef struct qc_cache_stats
+{
+    int64_t size;   /** The number of cached classifications in all threads. */
+    int64_t hits;   /** The number of statements classified from the cache. */
+    int64_t misses; /** The number of statements that had to be parsed. */
+} QC_CACHE_STATS;
+
 /**
  * QUERY_CLASSIFIER defines the object a query classifier plugin must
  * implement and return.
@@ -373,6 +383,31 @@ typedef struct query_classifier
      *         exhaustion or equivalent.
      */
     int32_t (*qc_get_preparable_stmt)(GWBUF* stmt, GWBUF** preparable_stmt);
+
+    /**
+     * Reports the statistics of the classification cache. Optional, may be NULL
+     * if the query classifier does not cache classifications.
+     *
+     * @param stats  On return, the statistics if @c QC_RESULT_OK is returned.
+     *
+     * @return QC_RESULT_OK, if the cache is enabled.
+     */
+    int32_t (*qc_get_cache_stats)(QC_CACHE_STATS* stats);
+
+    /**
+     * Reports the types of all statements of a COM_QUERY packet that contains
+     * several statements separated by semicolons. Optional, may be NULL if the
+     * query classifier only classifies the first statement.
+     *
+     * @param stmt        A COM_QUERY packet.
+     * @param type_masks  On return, an array with the type mask of each statement,
+     *                    if @c QC_RESULT_OK is returned. Must be freed by the caller.
+     * @param n_stmts     On return, the number of elements in @c type_masks.
+     *
+     * @return QC_RESULT_OK, if the parsing was not aborted due to resource
+     *         exhaustion or equivalent.
+     */
+    int32_t (*qc_get_statement_types)(GWBUF* stmt, uint32_t** type_masks, int32_t* n_stmts);
 } QUERY_CLASSIFIER;
 
 /**
@@ -638,6 +673,15 @@ char* qc_get_prepare_name(GWBUF* stmt);
  */
 GWBUF* qc_get_preparable_stmt(GWBUF* stmt);
 
+/**
+ * Returns the statistics of the classification cache.
+ *
+ * @param stats  On return, the statistics if true is returned.
+ *
+ * @return True, if the query classifier caches classifications.
+ */
+bool qc_get_cache_stats(QC_CACHE_STATS* stats);
+
 /**
  * Returns the tables accessed by the statement.
  *
@@ -659,6 +703,12 @@ char** qc_get_table_names(GWBUF* stmt, int* size, bool fullnames);
  * should be tested against specific qc_query_type_t values* using the
  * bitwise & operator, never using the == operator.
  *
+ * If the statement has not been parsed yet, common simple statements such as
+ * BEGIN, COMMIT, USE and plain SELECTs are classified without invoking the
+ * query classifier. If it has been parsed, e.g. by calling qc_parse() with
+ * the @c qc_collect_info_t flags needed later on, the type is taken from the
+ * result of that parsing.
+ *
  * @param stmt  A buffer containing a COM_QUERY or COM_STMT_PREPARE packet.
  *
  * @return A bitmask with the type(s) the query.
@@ -667,6 +717,22 @@ char** qc_get_table_names(GWBUF* stmt, int* size, bool fullnames);
  */
 uint32_t qc_get_type_mask(GWBUF* stmt);
 
+/**
+ * Classifies every statement of a COM_QUERY packet containing several
+ * statements, or of a chain of queued packets, in one go. The statements
+ * of a single-statement packet are classified exactly as by qc_get_type_mask().
+ * Packets that are neither COM_QUERY nor COM_STMT_PREPARE are skipped.
+ *
+ * @param queue       One or more complete packets.
+ * @param type_masks  If non-NULL, on return an array with the type mask of each
+ *                    statement, in order, or NULL if there were none. Must be
+ *                    freed by the caller with MXS_FREE.
+ * @param n_stmts     On return, the number of statements.
+ *
+ * @return The union of the type masks of all statements.
+ */
+uint32_t qc_parse_batch(GWBUF* queue, uint32_t** type_masks, size_t* n_stmts);
+
 /**
  * Returns the type bitmask of transaction related statements.
  *
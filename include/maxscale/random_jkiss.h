@@ -32,4 +32,29 @@ void random_jkiss_init(void);
  */
 unsigned int random_jkiss(void);
 
+/**
+ * @brief Return a pseudo-random number from the generator of the calling thread
+ *
+ * Each thread has its own generator, seeded from /dev/urandom when the thread
+ * first uses it, so the threads share no state. It needs no initialization.
+ *
+ * @return A random number
+ */
+unsigned int random_jkiss_thread(void);
+
+/**
+ * @brief Return a pseudo-random number smaller than a limit
+ *
+ * Uses the generator of the calling thread. The number is scaled with a
+ * multiplication instead of a division, the bias is at most n / 2^32.
+ *
+ * @param n The limit, must be greater than zero
+ *
+ * @return A random number from 0 to n - 1
+ */
+static inline unsigned int random_jkiss_range(unsigned int n)
+{
+    return (unsigned int)(((unsigned long long)random_jkiss_thread() * n) >> 32);
+}
+
 MXS_END_DECLS
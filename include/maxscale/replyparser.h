@@ -0,0 +1,137 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file replyparser.h  A streaming parser of MySQL replies
+ *
+ * The parser follows the packets of the reply to a COM_QUERY or a
+ * COM_STMT_EXECUTE and calls a callback for each part of the reply: the
+ * OK or ERR of a statement that returns no rows, the number of columns,
+ * each column definition, each row and the end of each result set.
+ *
+ * The parser does not buffer the reply. The caller gives it the data it has
+ * received so far and the offset of the first byte that has not been parsed.
+ * Every complete packet after the offset is parsed and the offset is moved to
+ * the start of the first incomplete packet. Packets that are in one buffer of
+ * a chain are passed to the callbacks without copying.
+ *
+ * Multiple result sets and the CLIENT_DEPRECATE_EOF capability are supported.
+ * A packet larger than 16MB is split by the protocol into several packets.
+ * Only the first of them is given to the callbacks and the rest are skipped.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+typedef enum mxs_reply_state
+{
+    MXS_REPLY_EXPECTING_RESPONSE,  /*< The first packet of a result */
+    MXS_REPLY_EXPECTING_FIELDS,    /*< Column definitions */
+    MXS_REPLY_EXPECTING_FIELD_EOF, /*< The EOF after the column definitions */
+    MXS_REPLY_EXPECTING_ROWS,      /*< Rows or the end of the result set */
+    MXS_REPLY_DONE,                /*< The whole reply has been parsed */
+    MXS_REPLY_ERROR                /*< The reply is malformed */
+} mxs_reply_state_t;
+
+/**
+ * The callbacks of the parser. Any of them may be NULL. The packets include
+ * the header and are only valid during the call.
+ *
+ * If a callback returns false, the parser stops after the packet. The next
+ * call to mxs_reply_parser_process() continues from the next packet.
+ */
+typedef struct mxs_reply_cb
+{
+    /** An OK packet, or the OK of a statement of a multi-statement */
+    bool (*ok)(void *data, const uint8_t *packet, size_t len);
+
+    /** An ERR packet, either instead of a result set or in the middle of one */
+    bool (*err)(void *data, const uint8_t *packet, size_t len);
+
+    /** A LOCAL INFILE request, the reply ends with it */
+    bool (*local_infile)(void *data, const uint8_t *packet, size_t len);
+
+    /** The start of a result set */
+    bool (*columns)(void *data, uint64_t n_columns);
+
+    /** A column definition, the first one has index 0 */
+    bool (*field)(void *data, const uint8_t *packet, size_t len, uint64_t index);
+
+    /** A row, the first one of each result set has index 0 */
+    bool (*row)(void *data, const uint8_t *packet, size_t len, uint64_t index);
+
+    /**
+     * The EOF, or the OK with CLIENT_DEPRECATE_EOF, that ends the rows.
+     * If @c more_results is true, another result follows.
+     */
+    bool (*end)(void *data, const uint8_t *packet, size_t len, bool more_results);
+} MXS_REPLY_CB;
+
+typedef struct mxs_reply_parser
+{
+    const MXS_REPLY_CB *cb;            /*< The callbacks */
+    void               *data;          /*< Data passed to the callbacks */
+    bool                deprecate_eof; /*< Whether the client uses CLIENT_DEPRECATE_EOF */
+    mxs_reply_state_t   state;         /*< The current state */
+    uint64_t            n_columns;     /*< Columns in the current result set */
+    uint64_t            n_fields;      /*< Column definitions parsed so far */
+    uint64_t            n_rows;        /*< Rows in the current result set */
+    uint64_t            n_results;     /*< Results parsed so far */
+    bool                large;         /*< The previous packet continues in the next one */
+    uint8_t            *scratch;       /*< Space for packets that span buffers */
+    size_t              scratch_size;  /*< Size of the scratch space */
+} MXS_REPLY_PARSER;
+
+/**
+ * @brief Initialize a parser
+ *
+ * @param parser        The parser.
+ * @param cb            The callbacks, must stay valid while the parser is used.
+ * @param data          Data passed to the callbacks.
+ * @param deprecate_eof Whether the client has CLIENT_DEPRECATE_EOF enabled.
+ */
+void mxs_reply_parser_init(MXS_REPLY_PARSER *parser, const MXS_REPLY_CB *cb,
+                           void *data, bool deprecate_eof);
+
+/**
+ * @brief Prepare the parser for the reply to the next statement
+ *
+ * @param parser The parser.
+ */
+void mxs_reply_parser_reset(MXS_REPLY_PARSER *parser);
+
+/**
+ * @brief Free the resources of a parser
+ *
+ * @param parser The parser, it has to be initialized again before using it.
+ */
+void mxs_reply_parser_free(MXS_REPLY_PARSER *parser);
+
+/**
+ * @brief Parse the complete packets of a reply
+ *
+ * @param parser The parser.
+ * @param buffer The data of the reply, may be a chain of buffers.
+ * @param offset The offset of the first packet to parse. On return, the
+ *               offset of the first packet that was not parsed.
+ *
+ * @return The state of the parser. Once the state is MXS_REPLY_DONE or
+ *         MXS_REPLY_ERROR, no more packets are parsed until the parser
+ *         is reset.
+ */
+mxs_reply_state_t mxs_reply_parser_process(MXS_REPLY_PARSER *parser, GWBUF *buffer, size_t *offset);
+
+MXS_END_DECLS
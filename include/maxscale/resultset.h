@@ -49,15 +49,24 @@ typedef struct resultrow
 {
     int n_cols; /*< No. of columns in row */
     char **cols; /*< The columns themselves */
+    char *data; /*< Storage of the values of the columns */
+    size_t data_len; /*< Bytes used in data */
+    size_t data_size; /*< Size of data */
 } RESULT_ROW;
 
 struct resultset;
+struct resultset_stream;
 
 /**
  * Type of callback function used to supply each row
  */
 typedef RESULT_ROW * (*RESULT_ROW_CB)(struct resultset *, void *);
 
+/**
+ * Type of callback function used to push all rows with resultset_stream_row
+ */
+typedef void (*RESULT_ROWS_CB)(struct resultset *, void *);
+
 /**
  * The representation of the result set itself.
  */
@@ -66,16 +75,23 @@ typedef struct resultset
     int n_cols;             /*< No. of columns */
     RESULT_COLUMN *column;  /*< Linked list of column definitions */
     RESULT_ROW_CB fetchrow; /*< Fetch a row for the result set */
+    RESULT_ROWS_CB streamrows; /*< Push all rows, used instead of fetchrow if set */
     void *userdata;         /*< User data for the fetch row call */
+    int offset;             /*< Number of rows to skip */
+    int limit;              /*< Maximum number of rows to stream, -1 for all */
+    struct resultset_stream *stream; /*< The encoder while the set is streamed */
 } RESULTSET;
 
 extern RESULTSET *resultset_create(RESULT_ROW_CB, void *);
+extern RESULTSET *resultset_create_streaming(RESULT_ROWS_CB, void *);
 extern void resultset_free(RESULTSET *);
+extern void resultset_set_page(RESULTSET *, int, int);
 extern int resultset_add_column(RESULTSET *, const char *, int, RESULT_COL_TYPE);
 extern void resultset_column_free(RESULT_COLUMN *);
 extern RESULT_ROW *resultset_make_row(RESULTSET *);
 extern void resultset_free_row(RESULT_ROW *);
 extern int resultset_row_set(RESULT_ROW *, int, const char *);
+extern bool resultset_stream_row(RESULTSET *, const char **);
 extern void resultset_stream_mysql(RESULTSET *, DCB *);
 extern void resultset_stream_json(RESULTSET *, DCB *);
 
@@ -197,6 +197,20 @@ typedef struct mxs_router_object
      * @param instance Router instance
      */
     void     (*destroyInstance)(MXS_ROUTER *instance);
+
+    /**
+     * @brief Called to check whether a session can be moved to another thread
+     *
+     * The session is idle if it waits for no replies and none of its state is
+     * bound to the thread that owns it. This entry point is optional, without
+     * it only the DCBs of the session are checked.
+     *
+     * @param instance       Router instance
+     * @param router_session Router session
+     *
+     * @return True if the session is idle
+     */
+    bool     (*isIdle)(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session);
 } MXS_ROUTER_OBJECT;
 
 /**
@@ -204,7 +218,7 @@ typedef struct mxs_router_object
  * must update these versions numbers in accordance with the rules in
  * modinfo.h.
  */
-#define MXS_ROUTER_VERSION  { 2, 0, 0 }
+#define MXS_ROUTER_VERSION  { 2, 1, 0 }
 
 /**
  * Specifies capabilities specific for routers. Common capabilities
@@ -220,6 +234,12 @@ typedef enum router_capability
     RCAP_TYPE_NO_RSESSION   = 0x00010000, /**< Router does not use router sessions */
     RCAP_TYPE_NO_USERS_INIT = 0x00020000, /**< Prevent the loading of authenticator
                                              users when the service is started */
+    RCAP_TYPE_REPLY_PASSTHROUGH = 0x00040000, /**< Router does not need to see the replies,
+                                                 they can be sent directly to the client */
+    RCAP_TYPE_SESSION_STATE_TRACKING = 0x00080000, /**< The backends report the changes of the
+                                                      session state in the OK packets */
+    RCAP_TYPE_PACKET_STREAMING = 0x00100000, /**< The packets that continue a large command
+                                                are routed in parts as they arrive */
 } mxs_router_capability_t;
 
 typedef enum
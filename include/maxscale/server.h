@@ -20,7 +20,9 @@
 
 #include <maxscale/cdefs.h>
 #include <maxscale/dcb.h>
+#include <maxscale/hashtable.h>
 #include <maxscale/resultset.h>
+#include <maxscale/statistics.h>
 
 MXS_BEGIN_DECLS
 
@@ -40,17 +42,72 @@ typedef struct server_params
     struct server_params *next; /**< Next Paramter in the linked list */
 } SERVER_PARAM;
 
+/** The number of server statistics that are registered as metrics */
+#define SERVER_N_METRICS 7
+
 /**
- * The server statistics structure
+ * The server statistics structure. The values are updated by every session
+ * that uses the server which is why they are kept per thread.
  */
 typedef struct
 {
-    int n_connections; /**< Number of connections */
-    int n_current;     /**< Current connections */
-    int n_current_ops; /**< Current active operations */
-    int n_persistent;  /**< Current persistent pool */
+    ts_stats_t n_connections; /**< Number of connections */
+    ts_stats_t n_current;     /**< Current connections */
+    ts_stats_t n_current_ops; /**< Current active operations */
+    ts_stats_t n_persistent;  /**< Current persistent pool */
+    ts_stats_t n_ps_cache_hits; /**< Prepared statements taken from the cache of a connection */
+    ts_stats_t n_persistent_pings; /**< Pings sent to idle pooled connections */
+    ts_stats_t n_persistent_dead;  /**< Pooled connections that failed a ping */
+    struct mxs_metric *metrics[SERVER_N_METRICS]; /**< The statistics registered as metrics */
 } SERVER_STATS;
 
+/**
+ * The state of a server that the routers use to select the servers. The
+ * monitors publish it at the end of each monitoring cycle, so it never shows
+ * the intermediate states of a cycle. The status macros below can be used
+ * with it.
+ */
+typedef struct server_state
+{
+    unsigned int  status;  /**< Status flag bitmap for the server */
+    int           rlag;    /**< Replication Lag */
+    int64_t       rlag_us; /**< Replication lag in microseconds, negative if not available */
+    int           depth;   /**< Replication level in the tree */
+    long          node_id; /**< Node id */
+    unsigned long node_ts; /**< Last timestamp set from M/S monitor module */
+    int           load_weight; /**< Share of the configured weight in percent */
+} SERVER_STATE;
+
+/** The number of backend load samples kept for each server */
+#define SERVER_METRICS_SAMPLES 60
+
+/**
+ * A sample of the load of a backend server, collected by the monitor
+ */
+typedef struct server_metrics_sample
+{
+    time_t   time;            /**< When the sample was taken */
+    uint32_t interval_ms;     /**< Time since the previous sample, 0 for the first one */
+    uint32_t rtt_us;          /**< Round trip time of the monitor query in microseconds */
+    uint32_t threads_running; /**< Value of Threads_running */
+    uint64_t questions;       /**< Increase of Questions since the previous sample */
+    uint64_t rows_read;       /**< Increase of Innodb_rows_read since the previous sample */
+} SERVER_METRICS_SAMPLE;
+
+/**
+ * The backend load samples of a server
+ */
+typedef struct server_metrics
+{
+    SPINLOCK              lock;
+    SERVER_METRICS_SAMPLE samples[SERVER_METRICS_SAMPLES]; /**< The samples, oldest first from next */
+    int                   next;      /**< Where the next sample is stored */
+    int                   count;     /**< Number of stored samples */
+    uint64_t              questions; /**< Questions of the previous sample */
+    uint64_t              rows_read; /**< Innodb_rows_read of the previous sample */
+    uint64_t              taken_ms;  /**< When the previous sample was taken */
+} SERVER_METRICS;
+
 /**
  * The SERVER structure defines a backend server. Each server has a name
  * or IP address for the server, a port that the server listens on and
@@ -81,19 +138,36 @@ typedef struct server
     char           *server_string; /**< Server version string, i.e. MySQL server version */
     long           node_id;        /**< Node id, server_id for M/S or local_index for Galera */
     int            rlag;           /**< Replication Lag for Master / Slave replication */
+    int64_t        rlag_us;        /**< Replication lag in microseconds, negative if not available */
     unsigned long  node_ts;        /**< Last timestamp set from M/S monitor module */
+    int            load_weight;    /**< Share of the configured weight in percent that
+                                    * the monitor gives to the server, 100 by default */
+    int            warmup_weight;  /**< Share of the weight in percent while the server
+                                    * warms up after it became usable, 100 by default */
     SERVER_PARAM   *parameters;    /**< Parameters of a server that may be used to weight routing decisions */
     long           master_id;      /**< Master server id of this node */
     int            depth;          /**< Replication level in the tree */
     long           slaves[MAX_NUM_SLAVES]; /**< Slaves of this node */
     bool           master_err_is_logged; /*< If node failed, this indicates whether it is logged */
-    DCB            **persistent;    /**< List of unused persistent connections to the server */
+    struct persist_pool *persistent; /**< The unused persistent connections of each thread */
+    struct dcb     **dcbs;         /**< The backend DCBs of each thread, linked through
+                                    * DCB::thread.server_next */
     long           persistpoolmax; /**< Maximum size of persistent connections pool */
     long           persistmaxtime; /**< Maximum number of seconds connection can live */
+    long           persistpingtime; /**< Seconds a pooled connection is idle before it is pinged */
     int            persistmax;     /**< Maximum pool size actually achieved since startup */
+    bool           persistreuse;   /**< Reuse pooled connections with a matching key as-is */
+    bool           compression;    /**< Request compression of the protocol packets */
+    long           ps_cache_size;  /**< Prepared statements kept by each connection for reuse */
+    bool           fake_backend;   /**< Connect to the fake backend instead of the address */
+    HASHTABLE      *persisthits;   /**< Pool hits per connection key */
+    SPINLOCK       persisthits_lock; /**< Protects persisthits */
     uint8_t        charset;        /**< Default server character set */
     bool           is_active;      /**< Server is active and has not been "destroyed" */
     bool           created_online; /**< Whether this server was created after startup */
+    uint64_t       state_version;  /**< Version of the published state, odd while it is written */
+    SERVER_STATE   state;          /**< The published state, read with server_get_state() */
+    SERVER_METRICS *metrics;       /**< Load samples from the monitor, NULL if not collected */
 #if defined(SS_DEBUG)
     skygw_chk_t    server_chk_tail;
 #endif
@@ -273,12 +347,15 @@ extern void server_transfer_status(SERVER *dest_server, const SERVER *source_ser
 extern void server_add_mon_user(SERVER *server, const char *user, const char *passwd);
 extern const char *server_get_parameter(const SERVER *server, char *name);
 extern void server_update_credentials(SERVER *server, const char *user, const char *passwd);
-extern DCB  *server_get_persistent(SERVER *server, const char *user, const char *protocol, int id);
+extern DCB  *server_get_persistent(SERVER *server, const char *user, const char *protocol,
+                                   const char *key, int id);
 extern void server_update_address(SERVER *server, const char *address);
 extern void server_update_port(SERVER *server,  unsigned short port);
 extern unsigned int server_map_status(const char *str);
 extern bool server_set_version_string(SERVER* server, const char* string);
 extern void server_set_status(SERVER *server, int bit);
+extern void server_publish_state(SERVER *server);
+extern void server_get_state(const SERVER *server, SERVER_STATE *state);
 extern void server_clear_status(SERVER *server, int bit);
 
 extern void printServer(const SERVER *);
@@ -289,5 +366,9 @@ extern void dprintServer(DCB *, const SERVER *);
 extern void dprintPersistentDCBs(DCB *, const SERVER *);
 extern void dListServers(DCB *);
 extern RESULTSET *serverGetList();
+extern void server_add_metrics_sample(SERVER *server, uint32_t rtt_us, uint64_t questions,
+                                      uint32_t threads_running, uint64_t rows_read);
+extern bool server_get_metrics_sample(const SERVER *server, SERVER_METRICS_SAMPLE *sample);
+extern RESULTSET *serverGetMetrics();
 
 MXS_END_DECLS
@@ -30,6 +30,7 @@
 #include <maxscale/resultset.h>
 #include <maxscale/config.h>
 #include <maxscale/queuemanager.h>
+#include <maxscale/statistics.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -42,6 +43,40 @@ struct router;
 struct mxs_router_object;
 struct users;
 
+/** The number of buckets in the query latency histograms of a service */
+#define SERVICE_LATENCY_BUCKETS 28
+
+/**
+ * The phases of a query that are measured for the latency histograms
+ */
+typedef enum
+{
+    SERVICE_LATENCY_QUEUE,      /**< From the read of the query to the start of routing */
+    SERVICE_LATENCY_PROCESSING, /**< Filters and router, until the query is written to a server */
+    SERVICE_LATENCY_BACKEND,    /**< From the write to a server to the first reply */
+    SERVICE_LATENCY_WRITE,      /**< From the first reply to the last write to the client */
+    SERVICE_LATENCY_N
+} service_latency_t;
+
+/**
+ * Query latency histograms of one thread. Bucket 0 counts the values below
+ * one microsecond and bucket N the values from 2^(N-1) up to 2^N
+ * microseconds. The last bucket counts all larger values.
+ */
+typedef struct
+{
+    uint64_t histogram[SERVICE_LATENCY_N][SERVICE_LATENCY_BUCKETS];
+} SERVICE_LATENCY;
+
+/** The number of service statistics that are registered as metrics */
+#define SERVICE_N_METRICS 4
+
+/** The default zlib compression level of the client connections */
+#define SERVICE_DEFAULT_COMPRESSION_LEVEL 6
+
+/** The default size below which the packets to the clients are not compressed */
+#define SERVICE_DEFAULT_COMPRESSION_THRESHOLD 50
+
 /**
  * The service statistics structure
  */
@@ -49,8 +84,13 @@ typedef struct
 {
     time_t started;         /**< The time when the service was started */
     int    n_failed_starts; /**< Number of times this service has failed to start */
-    int    n_sessions;      /**< Number of sessions created on service since start */
-    int    n_current;       /**< Current number of sessions */
+    ts_stats_t n_sessions;  /**< Number of sessions created on service since start */
+    ts_stats_t n_current;   /**< Current number of sessions */
+    ts_stats_t n_plain_out;      /**< Bytes compressed for the clients */
+    ts_stats_t n_compressed_out; /**< Compressed bytes written to the clients */
+    SERVICE_LATENCY *latency; /**< Query latency histograms of each thread */
+    int n_latency;          /**< Number of threads in @c latency */
+    struct mxs_metric *metrics[SERVICE_N_METRICS]; /**< The statistics registered as metrics */
 } SERVICE_STATS;
 
 /**
@@ -81,12 +121,33 @@ typedef struct server_ref_t
     SERVER* server;            /**< The actual server */
     int weight;                /**< Weight of this server */
     int connections;           /**< Number of connections created through this reference */
+    int response_time;         /**< Average response time in microseconds, 0 if not measured */
     bool active;               /**< Whether this reference is valid and in use*/
 } SERVER_REF;
 
 /** Macro to check whether a SERVER_REF is active */
 #define SERVER_REF_IS_ACTIVE(ref) (ref->active && SERVER_IS_ACTIVE(ref->server))
 
+/**
+ * @brief Get the routing weight of a server reference
+ *
+ * The configured weight is scaled by the load weight that the monitor
+ * has published for the server. A server with a non-zero weight always
+ * keeps a weight of at least one.
+ *
+ * @param ref Server reference
+ *
+ * @return The weight to use for routing
+ */
+static inline int server_ref_weight(const SERVER_REF *ref)
+{
+    SERVER_STATE state;
+    server_get_state(ref->server, &state);
+    int weight = ref->weight * state.load_weight / 100;
+
+    return weight == 0 && ref->weight > 0 ? 1 : weight;
+}
+
 #define SERVICE_MAX_RETRY_INTERVAL 3600 /*< The maximum interval between service start retries */
 
 /** Value of service timeout if timeout checks are disabled */
@@ -107,6 +168,17 @@ typedef struct server_ref_t
 #define DEFAULT_AUTH_READ_TIMEOUT    1
 #define DEFAULT_AUTH_WRITE_TIMEOUT   2
 
+/**
+ * A user whose sessions get another priority class than the other sessions
+ * of the service
+ */
+typedef struct service_priority_user
+{
+    char                         *user;     /**< The user name */
+    session_priority_t           priority; /**< The class of the sessions of the user */
+    struct service_priority_user *next;     /**< The next user */
+} SERVICE_PRIORITY_USER;
+
 /**
  * Defines a service within the gateway.
  *
@@ -151,6 +223,11 @@ typedef struct service
     bool retry_start;                  /**< If starting of the service should be retried later */
     bool log_auth_warnings;            /**< Log authentication failures and warnings */
     uint64_t capabilities;             /**< The capabilities of the service. */
+    session_priority_t priority;       /**< The priority class of the sessions */
+    SERVICE_PRIORITY_USER *priority_users; /**< Users with their own priority class */
+    bool client_compression;           /**< Compress the packets of the clients that support it */
+    int client_compression_level;      /**< The zlib compression level of the client packets */
+    unsigned int client_compression_threshold; /**< Packets shorter than this are not compressed */
 } SERVICE;
 
 typedef enum count_spec_t
@@ -261,8 +338,20 @@ char* serviceGetWeightingParameter(SERVICE *service);
 int   serviceEnableLocalhostMatchWildcardHost(SERVICE *service, int action);
 int   serviceStripDbEsc(SERVICE* service, int action);
 int   serviceAuthAllServers(SERVICE *service, int action);
+bool  serviceSetPriority(SERVICE *service, const char *priority);
+bool  serviceSetPriorityUsers(SERVICE *service, const char *users);
 int   service_refresh_users(SERVICE *service);
 
+/**
+ * @brief Get the priority class of a new session
+ *
+ * @param service The service of the session
+ * @param user    The user of the session, NULL if it is not known
+ * @return The class of the user if the service has one for it, otherwise
+ * the class of the service
+ */
+session_priority_t service_get_priority(const SERVICE *service, const char *user);
+
 /**
  * Diagnostics
  */
@@ -123,6 +123,36 @@ typedef struct mxs_upstream
  * Note that the first few fields (up to and including "entry_is_ready") must
  * precisely match the LIST_ENTRY structure defined in the list manager.
  */
+/**
+ * The points in the processing of a request that are recorded for the
+ * latency histograms of the service and for the sessions that are traced
+ */
+typedef enum
+{
+    SESSION_TRACE_READ,          /**< The request was read from the client */
+    SESSION_TRACE_ROUTE,         /**< The request was passed to the filters and the router */
+    SESSION_TRACE_CLASSIFY,      /**< The router classified the request */
+    SESSION_TRACE_BACKEND_WRITE, /**< The request was written to a server */
+    SESSION_TRACE_RESPONSE,      /**< A server replied */
+    SESSION_TRACE_CLIENT_WRITE   /**< The reply was written to the client */
+} session_trace_point_t;
+
+/**
+ * The priority classes of the sessions. When sessions of several classes have
+ * events to process, a worker thread shares its time between the classes by
+ * their weights.
+ */
+typedef enum
+{
+    SESSION_PRIORITY_HIGH,   /**< Interactive clients, weight 4 */
+    SESSION_PRIORITY_NORMAL, /**< The default, weight 2 */
+    SESSION_PRIORITY_LOW,    /**< Batch and reporting clients, weight 1 */
+    SESSION_PRIORITY_N
+} session_priority_t;
+
+struct session_trace;
+struct profile_hop;
+
 typedef struct session
 {
     skygw_chk_t             ses_chk_top;
@@ -140,22 +170,50 @@ typedef struct session
     bool                    ses_is_child;     /*< this is a child session */
     mxs_session_trx_state_t trx_state;        /*< The current transaction state. */
     bool                    autocommit;       /*< Whether autocommit is on. */
+    bool                    backend_reads_paused; /*< The client is above its high water mark
+                                                   * and the backends are not read */
+    int                     n_paused_reads;   /*< Number of backend DCBs with a skipped read */
     struct
     {
         GWBUF *buffer; /**< Buffer containing the statement */
         const struct server *target; /**< Where the statement was sent */
     } stmt;  /**< Current statement being executed */
+    struct session_trace    *trace;           /*< Events of the current request or NULL if
+                                               * the session is not traced */
+    struct
+    {
+        uint64_t read;       /**< When the request was read */
+        uint64_t routed;     /**< When the routing started */
+        uint64_t dispatched; /**< When the request was first written to a server */
+        uint64_t response;   /**< When the first reply arrived */
+        uint64_t written;    /**< When the reply was last written to the client */
+    } latency;  /**< Times of the current request in microseconds, 0 if not reached */
+    struct profile_hop      *profile_hops;    /*< The profiling elements of the filter chain */
+    session_priority_t      priority;         /*< The class the events are processed in */
+    session_priority_t      base_priority;    /*< The class given by the service and the user */
     skygw_chk_t     ses_chk_tail;
 } MXS_SESSION;
 
+/**
+ * Record that a session reached a point in the processing of a request.
+ * Does nothing for the dummy session.
+ *
+ * @param sess   The session
+ * @param point  A session_trace_point_t
+ * @param server The name of the server or NULL if the point is not about a server
+ */
+#define MXS_SESSION_TRACE(sess, point, server)                          \
+    ((sess) && (sess)->service ? session_trace_record((sess), (point), (server)) : (void)0)
+
 /**
  * A convenience macro that can be used by the protocol modules to route
  * the incoming data to the first element in the pipeline of filters and
  * routers.
  */
 #define MXS_SESSION_ROUTE_QUERY(sess, buf)                          \
-    ((sess)->head.routeQuery)((sess)->head.instance,            \
-                              (sess)->head.session, (buf))
+    (MXS_SESSION_TRACE((sess), SESSION_TRACE_ROUTE, NULL),      \
+     ((sess)->head.routeQuery)((sess)->head.instance,           \
+                               (sess)->head.session, (buf)))
 /**
  * A convenience macro that can be used by the router modules to route
  * the replies to the first element in the pipeline of filters and
@@ -297,6 +355,38 @@ static inline bool session_trx_is_active(const MXS_SESSION* ses)
     return !session_is_autocommit(ses) || (ses->trx_state & SESSION_TRX_ACTIVE_BIT);
 }
 
+/**
+ * @brief Change the priority class of a session
+ *
+ * The events of the session are processed in the new class from now on. A
+ * module that changes the class for one statement must change it back to
+ * the base_priority of the session afterwards.
+ *
+ * @param ses      The session
+ * @param priority The new class
+ */
+static inline void session_set_priority(MXS_SESSION* ses, session_priority_t priority)
+{
+    ses->priority = priority;
+}
+
+/**
+ * @brief Get the name of a priority class
+ *
+ * @param priority The class
+ * @return "high", "normal" or "low"
+ */
+const char* session_priority_to_string(session_priority_t priority);
+
+/**
+ * @brief Find a priority class by its name
+ *
+ * @param name     "high", "normal" or "low", case insensitive
+ * @param priority Where the class is stored
+ * @return True if the name is valid
+ */
+bool session_priority_from_string(const char *name, session_priority_t *priority);
+
 /**
  * Sets the autocommit state of the session.
  *
@@ -325,9 +415,20 @@ static inline bool session_set_autocommit(MXS_SESSION* ses, bool autocommit)
 MXS_SESSION* session_get_by_id(int id);
 
 /**
- * @brief Release a session reference
+ * @brief Get a session reference
+ *
+ * This creates an additional reference to a session which allows it to live
+ * as long as it is needed, for example until a timer of a module expires.
  *
- * This function is public only because the tee-filter uses it.
+ * @param session Session reference to get
+ * @return Reference to a MXS_SESSION
+ *
+ * @note The caller must free the session reference by calling session_put_ref
+ */
+MXS_SESSION* session_get_ref(MXS_SESSION *session);
+
+/**
+ * @brief Release a session reference
  *
  * @param session Session reference to release
  */
@@ -365,4 +466,19 @@ bool session_take_stmt(MXS_SESSION *session, GWBUF **buffer, const struct server
  */
 void session_clear_stmt(MXS_SESSION *session);
 
+/**
+ * @brief Record an event of a session
+ *
+ * Use the MXS_SESSION_TRACE macro instead of calling this directly. A request
+ * starts when the client is read after a reply. When the next request starts
+ * or the session is closed, the durations of its phases are added to the
+ * latency histograms of the service and, if the session is traced, its
+ * events are logged if it took longer than @c session_trace_threshold.
+ *
+ * @param session A session
+ * @param point   The point that was reached
+ * @param server  The name of the server or NULL
+ */
+void session_trace_record(MXS_SESSION *session, session_trace_point_t point, const char *server);
+
 MXS_END_DECLS
@@ -21,6 +21,14 @@
  * generally wasteful as any blocked threads will spin, consuming CPU cycles, waiting
  * for the lock to be released. However they are useful in that they do not involve
  * system calls and are light weight when the expected wait time for a lock is low.
+ *
+ * A thread that finds a lock taken spins with an exponentially growing pause
+ * between the attempts. If the lock is still taken after SPINLOCK_SPIN_LIMIT
+ * attempts, the thread sleeps on a futex until the lock is released.
+ *
+ * Every contended acquisition is recorded for the source line that made it,
+ * which allows the most contended locks to be found with spinlock_site_stats.
+ * Uncontended acquisitions cost nothing extra.
  */
 
 #include <maxscale/cdefs.h>
@@ -31,11 +39,18 @@ MXS_BEGIN_DECLS
 
 #define SPINLOCK_PROFILE 0
 
+/** Number of attempts to take a contended lock before sleeping */
+#define SPINLOCK_SPIN_LIMIT 1000
+
+/** The maximum number of pause instructions between two attempts */
+#define SPINLOCK_MAX_BACKOFF 64
+
 /**
  * The spinlock structure.
  *
  * In normal builds the structure merely contains a lock value which
- * is 0 if the spinlock is not taken and greater than zero if it is held.
+ * is 0 if the spinlock is not taken, 1 if it is held and 2 if it is held
+ * and other threads may be sleeping on it.
  *
  * In builds with the SPINLOCK_PROFILE option set this structure also holds
  * a number of profile related fields that count the number of spins, number
@@ -75,12 +90,35 @@ typedef struct spinlock
  */
 extern void spinlock_init(SPINLOCK *lock);
 
+/**
+ * The contention of the acquisitions made on one source line
+ */
+typedef struct spinlock_site
+{
+    const char *file;      /*< The source file */
+    int         line;      /*< The line in the file */
+    uint64_t    contended; /*< No. of times the lock was found taken */
+    uint64_t    spins;     /*< No. of attempts made while the lock was taken */
+    uint64_t    sleeps;    /*< No. of times the thread slept on the lock */
+} SPINLOCK_SITE;
+
 /**
  * Acquire a spinlock.
  *
+ * Use spinlock_acquire which records the calling source line.
+ *
  * @param lock The spinlock to acquire
+ * @param file The source file of the caller
+ * @param line The line of the caller
  */
-extern void spinlock_acquire(const SPINLOCK *lock);
+extern void spinlock_acquire_at(const SPINLOCK *lock, const char *file, int line);
+
+/**
+ * Acquire a spinlock.
+ *
+ * @param lock The spinlock to acquire
+ */
+#define spinlock_acquire(lock) spinlock_acquire_at(lock, __FILE__, __LINE__)
 
 /**
  * Acquire a spinlock if it is not already locked.
@@ -112,4 +150,16 @@ extern void spinlock_release(const SPINLOCK *lock);
  */
 extern void spinlock_stats(const SPINLOCK *lock, void (*reporter)(void *, char *, int), void *hdl);
 
+/**
+ * Report the source lines where locks were most often contended.
+ *
+ * The sites are reported in the order of their contention, most contended
+ * first.
+ *
+ * @param max_sites     The maximum number of sites to report
+ * @param reporter      The callback function to pass the sites to
+ * @param hdl           A handle that is passed to the reporter function
+ */
+extern void spinlock_site_stats(int max_sites, void (*reporter)(void *, const SPINLOCK_SITE *), void *hdl);
+
 MXS_END_DECLS
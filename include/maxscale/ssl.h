@@ -20,6 +20,7 @@
 
 #include <maxscale/cdefs.h>
 #include <maxscale/protocol.h>
+#include <maxscale/spinlock.h>
 #include <openssl/crypto.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -63,6 +64,12 @@ typedef struct ssl_listener
     char *ssl_key;                      /*< SSL private key */
     char *ssl_ca_cert;                  /*< SSL CA certificate */
     bool ssl_init_done;                 /*< If SSL has already been initialized for this service */
+    bool ssl_session_cache;             /*< Whether TLS sessions are resumed */
+    bool ssl_ktls;                      /*< Whether the kernel does the encryption after the handshake */
+    SSL_SESSION *session;               /*< The latest session received from the server, reused by
+                                         * the next connection to it */
+    SPINLOCK session_lock;              /*< Protects the session */
+    int n_resumed;                      /*< Number of connections that resumed a session */
     struct ssl_listener
         *next;          /*< Next SSL configuration, currently used to store obsolete configurations */
 } SSL_LISTENER;
@@ -57,6 +57,25 @@ void ts_stats_free(ts_stats_t stats);
  */
 int64_t ts_stats_get(ts_stats_t stats, enum ts_stats_type type);
 
+/**
+ * @brief Get the sum of all values
+ *
+ * @param stats Statistics to read
+ * @return Sum of the values of all threads
+ */
+int64_t ts_stats_sum(ts_stats_t stats);
+
+/**
+ * @brief Add to the statistics of the calling thread
+ *
+ * Worker threads update a value of their own without atomic operations.
+ * Other threads atomically update a value they share.
+ *
+ * @param stats Statistics to add to
+ * @param value Value to add, can be negative
+ */
+void ts_stats_add(ts_stats_t stats, int64_t value);
+
 /**
  * @brief Increment thread statistics by one
  *
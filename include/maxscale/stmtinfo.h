@@ -0,0 +1,75 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file stmtinfo.h  Shared information about a statement
+ *
+ * The filters and the router of a service often need the same information
+ * about a statement: the SQL, its digest, its canonical form and its type.
+ * The information is collected into one object that is stored in the GWBUF
+ * of the statement. Each part is computed when it is first asked for and
+ * every later user of the same buffer gets it without computing it again.
+ *
+ * The digest and the canonical form are produced by the same pass over the
+ * statement, so asking for both costs the same as asking for one.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+#include <maxscale/digest.h>
+#include <maxscale/query_classifier.h>
+
+MXS_BEGIN_DECLS
+
+/** The parts of the information that are computed when first needed */
+typedef enum mxs_stmt_info_part
+{
+    MXS_STMT_INFO_DIGEST    = (1 << 0), /*< digest */
+    MXS_STMT_INFO_CANONICAL = (1 << 1), /*< canonical and canonical_len */
+    MXS_STMT_INFO_TYPE      = (1 << 2), /*< type_mask and operation */
+} mxs_stmt_info_part_t;
+
+typedef struct mxs_stmt_info
+{
+    uint8_t       command;       /*< COM_QUERY or COM_STMT_PREPARE */
+    const char   *sql;           /*< The SQL in the buffer, not NUL terminated */
+    size_t        sql_len;       /*< Length of the SQL */
+    uint32_t      parts;         /*< The parts that have been computed */
+    MXS_DIGEST    digest;        /*< The digest of the statement */
+    char         *canonical;     /*< The canonical form, not NUL terminated */
+    size_t        canonical_len; /*< Length of the canonical form */
+    uint32_t      type_mask;     /*< The query type mask */
+    qc_query_op_t operation;     /*< The operation of the statement */
+} MXS_STMT_INFO;
+
+/**
+ * @brief Get the information about a statement
+ *
+ * The first call for a buffer creates the information and stores it in the
+ * buffer. The parts that are asked for, and that have not been computed yet,
+ * are computed. The SQL and the command are always available.
+ *
+ * The information refers to the data of the buffer, so it is only valid as
+ * long as the buffer is not modified or freed.
+ *
+ * @param query A contiguous COM_QUERY or COM_STMT_PREPARE packet.
+ * @param parts The mxs_stmt_info_part_t values of the parts that are needed.
+ *
+ * @return The information or NULL if the buffer does not contain a complete
+ *         statement or if memory could not be allocated. If a part could not
+ *         be computed, its bit is not set in the @c parts of the result.
+ */
+const MXS_STMT_INFO* mxs_stmt_info_get(GWBUF* query, uint32_t parts);
+
+MXS_END_DECLS
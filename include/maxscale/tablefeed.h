@@ -0,0 +1,75 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file tablefeed.h  A feed of modified tables
+ *
+ * Modules that learn that a table has been modified, for instance from a
+ * replication stream, publish the name of the table to the feed and modules
+ * that keep data derived from tables, for instance a cache, subscribe to it.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * A subscriber of the feed. The function is called in the thread that
+ * publishes the table, so it must be thread-safe and quick.
+ *
+ * @param db    The database of the table.
+ * @param table The name of the table.
+ * @param data  The data given when subscribing.
+ */
+typedef void (*mxs_table_feed_cb_t)(const char *db, const char *table, void *data);
+
+/**
+ * @brief Subscribe to the feed
+ *
+ * @param cb   The function to call for each modified table.
+ * @param data Data passed to the function.
+ *
+ * @return True, if the subscription was made.
+ */
+bool mxs_table_feed_subscribe(mxs_table_feed_cb_t cb, void *data);
+
+/**
+ * @brief Cancel a subscription
+ *
+ * When the function returns, the subscriber is not being called and will
+ * not be called again.
+ *
+ * @param cb   The function given when subscribing.
+ * @param data The data given when subscribing.
+ */
+void mxs_table_feed_unsubscribe(mxs_table_feed_cb_t cb, void *data);
+
+/**
+ * @brief Check whether the feed has subscribers
+ *
+ * A publisher can use this to avoid extracting table names for nobody.
+ *
+ * @return True, if there is at least one subscriber.
+ */
+bool mxs_table_feed_has_subscribers(void);
+
+/**
+ * @brief Publish a modified table to all subscribers
+ *
+ * @param db    The database of the table.
+ * @param table The name of the table.
+ */
+void mxs_table_feed_publish(const char *db, const char *table);
+
+MXS_END_DECLS
@@ -36,4 +36,14 @@ extern THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg);
 extern void thread_wait(THREAD thd);
 extern void thread_millisleep(int ms);
 
+/**
+ * @brief Pin the calling thread to one CPU
+ *
+ * The threads that the pinned thread starts with thread_start are not pinned.
+ *
+ * @param cpu The CPU
+ * @return True if the thread was pinned
+ */
+extern bool thread_set_cpu(int cpu);
+
 MXS_END_DECLS
@@ -0,0 +1,115 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file timer.h - Per-thread timers
+ *
+ * Each worker thread has a hierarchical timer wheel that is advanced once
+ * per poll loop. The resolution of the timers is one housekeeper heartbeat,
+ * that is, 100 milliseconds. Adding and cancelling a timer are constant time
+ * operations, which makes the timers suitable for per-connection timeouts.
+ *
+ * A timer belongs to the thread whose wheel it was added to and the callback
+ * is called by that thread. The timer must only be cancelled or added again
+ * by the same thread.
+ */
+
+#include <maxscale/cdefs.h>
+
+MXS_BEGIN_DECLS
+
+struct mxs_timer;
+
+/**
+ * The function called when a timer expires
+ *
+ * The timer is no longer active when the function is called and it can be
+ * added again from the callback.
+ *
+ * @param timer The timer that expired
+ * @param data  The data given to mxs_timer_init
+ */
+typedef void (*mxs_timer_cb_t)(struct mxs_timer *timer, void *data);
+
+/**
+ * A timer, usually embedded in the object that it is used for
+ */
+typedef struct mxs_timer
+{
+    struct mxs_timer  *next;    /*< Next timer in the same slot */
+    struct mxs_timer **pprev;   /*< The pointer that points to this timer */
+    int64_t            expires; /*< The heartbeat when the timer expires */
+    int                thread;  /*< The thread of the timer, -1 if it is not active */
+    bool               pending; /*< Added from another thread but not yet in the wheel */
+    mxs_timer_cb_t     cb;      /*< The callback */
+    void              *data;    /*< Data given to the callback */
+} MXS_TIMER;
+
+#define MXS_TIMER_INIT {NULL, NULL, 0, -1, false, NULL, NULL}
+
+/**
+ * @brief Initialize a timer
+ *
+ * @param timer The timer to initialize
+ * @param cb    The function called when the timer expires
+ * @param data  Data given to the callback
+ */
+void mxs_timer_init(MXS_TIMER *timer, mxs_timer_cb_t cb, void *data);
+
+/**
+ * @brief Add a timer to the wheel of the calling worker thread
+ *
+ * If the timer is already active in this thread, its expiration time is changed.
+ *
+ * @param timer The timer
+ * @param ticks The number of heartbeats after which the timer expires, at least 1
+ */
+void mxs_timer_add(MXS_TIMER *timer, int64_t ticks);
+
+/**
+ * @brief Add a timer to the wheel of a worker thread
+ *
+ * This can be called from any thread for a timer that is not active. The
+ * timer becomes active in @c thread_id the next time that thread processes
+ * its timers.
+ *
+ * @param thread_id The worker thread ID
+ * @param timer     The timer
+ * @param ticks     The number of heartbeats after which the timer expires, at least 1
+ */
+void mxs_timer_add_to(int thread_id, MXS_TIMER *timer, int64_t ticks);
+
+/**
+ * @brief Cancel a timer
+ *
+ * This must be called by the thread of the timer. A timer added with
+ * mxs_timer_add_to that has not yet been taken into the wheel of its thread
+ * can be cancelled by any thread. Nothing is done if the timer is not active.
+ *
+ * @param timer The timer
+ */
+void mxs_timer_cancel(MXS_TIMER *timer);
+
+/**
+ * @brief Check whether a timer is active
+ *
+ * @param timer The timer
+ * @return True if the timer has been added and it has not expired or been cancelled
+ */
+static inline bool mxs_timer_is_active(const MXS_TIMER *timer)
+{
+    return timer->thread != -1;
+}
+
+MXS_END_DECLS
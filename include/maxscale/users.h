@@ -19,6 +19,7 @@
 
 #include <maxscale/cdefs.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/lfhash.h>
 #include <maxscale/dcb.h>
 #include <maxscale/listener.h>
 #include <maxscale/service.h>
@@ -44,7 +45,7 @@ typedef struct
  */
 typedef struct users
 {
-    HASHTABLE *data;                        /**< The hashtable containing the actual data */
+    LFHASH *data;                           /**< The hashtable containing the actual data */
     USERS_STATS stats;                      /**< The statistics for the users table */
 } USERS;
 
@@ -85,6 +86,9 @@ int users_delete(USERS *, const char *);
 /**
  * Fetch the authentication data for a particular user from the users table
  *
+ * On a worker thread, the data stays valid until the end of the current
+ * event even if the user is deleted.
+ *
  * @param users         The users table
  * @param user          The user name
  * @return      The authentication data or NULL on error
@@ -0,0 +1,418 @@
+/**
+ * @file perf_regression.cpp Compare the performance of MaxScale with stored baselines
+ *
+ * The workload is selected by the name of the test:
+ *
+ * - perf_point_select: SELECT of one row by primary key
+ * - perf_mixed_rw: 80% point selects and 20% single row updates
+ * - perf_large_result: SELECT of all 10000 rows of the table
+ * - perf_connection_churn: connect, SELECT 1 and disconnect
+ * - perf_prepared_stmt: point select executed as a prepared statement
+ *
+ * Each workload is run through RWSplit by a fixed number of threads for a fixed
+ * time. The queries per second, the 99th percentile latency and the CPU time of
+ * MaxScale per query are compared with the baseline of the workload in
+ * perf/baseline. The test fails if any of them is worse than the baseline by
+ * more than perf_threshold percent, 10 by default. A workload without a baseline
+ * only reports its results.
+ *
+ * With perf_update_baseline=yes the results are written to perf/baseline
+ * instead. The baselines are only comparable on the same test environment.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "testconnections.h"
+
+using namespace std;
+
+#define PERF_ROWS        10000
+#define PERF_THREADS     16
+#define PERF_BASELINE    "perf/baseline"
+
+enum perf_workload
+{
+    POINT_SELECT,
+    MIXED_RW,
+    LARGE_RESULT,
+    CONNECTION_CHURN,
+    PREPARED_STMT
+};
+
+struct perf_result
+{
+    double qps;
+    double p99_us;
+    double cpu_us;   /**< CPU time of MaxScale per query */
+};
+
+typedef struct
+{
+    TestConnections *Test;
+    perf_workload    workload;
+    volatile int    *exit_flag;
+    unsigned int     seed;
+    long             errors;
+    vector<long>     latency;
+} perf_thread_data;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int query_and_discard(MYSQL *conn, const char *sql)
+{
+    if (mysql_query(conn, sql) != 0)
+    {
+        return 1;
+    }
+
+    MYSQL_RES *res = mysql_store_result(conn);
+    mysql_free_result(res);
+    return 0;
+}
+
+static MYSQL_STMT* prepare_point_select(MYSQL *conn)
+{
+    const char sql[] = "SELECT id, val FROM perf.t1 WHERE id = ?";
+    MYSQL_STMT *stmt = mysql_stmt_init(conn);
+
+    if (stmt && mysql_stmt_prepare(stmt, sql, sizeof(sql) - 1) != 0)
+    {
+        mysql_stmt_close(stmt);
+        stmt = NULL;
+    }
+
+    return stmt;
+}
+
+static int execute_point_select(MYSQL_STMT *stmt, int id)
+{
+    MYSQL_BIND param;
+    memset(&param, 0, sizeof(param));
+    param.buffer_type = MYSQL_TYPE_LONG;
+    param.buffer = &id;
+
+    if (mysql_stmt_bind_param(stmt, &param) != 0 ||
+        mysql_stmt_execute(stmt) != 0 ||
+        mysql_stmt_store_result(stmt) != 0)
+    {
+        return 1;
+    }
+
+    mysql_stmt_free_result(stmt);
+    return 0;
+}
+
+/** Execute one request of the workload */
+static int run_request(perf_thread_data *data, MYSQL *conn, MYSQL_STMT *stmt)
+{
+    char sql[256];
+    int id = rand_r(&data->seed) % PERF_ROWS;
+
+    switch (data->workload)
+    {
+    case POINT_SELECT:
+        sprintf(sql, "SELECT id, val FROM perf.t1 WHERE id = %d", id);
+        return query_and_discard(conn, sql);
+
+    case MIXED_RW:
+        if (rand_r(&data->seed) % 5 == 0)
+        {
+            sprintf(sql, "UPDATE perf.t1 SET val = 'updated %d' WHERE id = %d", data->seed % 1000, id);
+        }
+        else
+        {
+            sprintf(sql, "SELECT id, val FROM perf.t1 WHERE id = %d", id);
+        }
+        return query_and_discard(conn, sql);
+
+    case LARGE_RESULT:
+        return query_and_discard(conn, "SELECT id, val FROM perf.t1");
+
+    case CONNECTION_CHURN:
+        {
+            MYSQL *churn = data->Test->open_rwsplit_connection();
+            int rval = mysql_errno(churn) || query_and_discard(churn, "SELECT 1");
+            mysql_close(churn);
+            return rval;
+        }
+
+    case PREPARED_STMT:
+        return stmt ? execute_point_select(stmt, id) : 1;
+    }
+
+    return 1;
+}
+
+static void *perf_thread(void *ptr)
+{
+    perf_thread_data *data = (perf_thread_data*)ptr;
+    MYSQL *conn = NULL;
+    MYSQL_STMT *stmt = NULL;
+
+    if (data->workload != CONNECTION_CHURN)
+    {
+        conn = data->Test->open_rwsplit_connection();
+
+        if (mysql_errno(conn))
+        {
+            data->errors++;
+            mysql_close(conn);
+            return NULL;
+        }
+
+        if (data->workload == PREPARED_STMT)
+        {
+            stmt = prepare_point_select(conn);
+        }
+    }
+
+    while (*data->exit_flag == 0)
+    {
+        double start = now();
+
+        if (run_request(data, conn, stmt) == 0)
+        {
+            data->latency.push_back((now() - start) * 1e6);
+        }
+        else
+        {
+            data->errors++;
+        }
+    }
+
+    if (stmt)
+    {
+        mysql_stmt_close(stmt);
+    }
+
+    mysql_close(conn);
+    return NULL;
+}
+
+/** CPU time used by MaxScale so far in microseconds */
+static double maxscale_cpu_time(TestConnections *Test)
+{
+    char *ticks = Test->ssh_maxscale_output(false, "cat /proc/$(pidof maxscale)/stat | awk '{print $14 + $15}'");
+    char *hz = Test->ssh_maxscale_output(false, "getconf CLK_TCK");
+    double rval = 0;
+
+    if (ticks && hz && atol(hz) > 0)
+    {
+        rval = atof(ticks) * 1e6 / atol(hz);
+    }
+
+    free(ticks);
+    free(hz);
+    return rval;
+}
+
+static void create_table(TestConnections *Test)
+{
+    Test->try_query(Test->conn_rwsplit, "DROP DATABASE IF EXISTS perf");
+    Test->try_query(Test->conn_rwsplit, "CREATE DATABASE perf");
+    Test->try_query(Test->conn_rwsplit, "CREATE TABLE perf.t1 (id INT PRIMARY KEY, val VARCHAR(64))");
+
+    for (int i = 0; i < PERF_ROWS; i += 1000)
+    {
+        stringstream ss;
+        ss << "INSERT INTO perf.t1 VALUES ";
+
+        for (int j = i; j < i + 1000; j++)
+        {
+            ss << (j > i ? "," : "") << "(" << j << ", 'value of row " << j << "')";
+        }
+
+        Test->try_query(Test->conn_rwsplit, ss.str().c_str());
+    }
+
+    Test->repl->sync_slaves();
+}
+
+static perf_result run_workload(TestConnections *Test, perf_workload workload, int run_time)
+{
+    volatile int exit_flag = 0;
+    perf_thread_data data[PERF_THREADS];
+    pthread_t threads[PERF_THREADS];
+
+    for (int i = 0; i < PERF_THREADS; i++)
+    {
+        data[i].Test = Test;
+        data[i].workload = workload;
+        data[i].exit_flag = &exit_flag;
+        data[i].seed = i;
+        data[i].errors = 0;
+    }
+
+    double cpu_start = maxscale_cpu_time(Test);
+    double start = now();
+
+    for (int i = 0; i < PERF_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, perf_thread, &data[i]);
+    }
+
+    sleep(run_time);
+    exit_flag = 1;
+
+    vector<long> latency;
+    long errors = 0;
+
+    for (int i = 0; i < PERF_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        latency.insert(latency.end(), data[i].latency.begin(), data[i].latency.end());
+        errors += data[i].errors;
+    }
+
+    double seconds = now() - start;
+    double cpu = maxscale_cpu_time(Test) - cpu_start;
+
+    Test->add_result(errors > 0, "%ld requests failed\n", errors);
+    Test->add_result(latency.empty(), "No requests were completed\n");
+
+    perf_result res = {0, 0, 0};
+
+    if (!latency.empty())
+    {
+        sort(latency.begin(), latency.end());
+        res.qps = latency.size() / seconds;
+        res.p99_us = latency[latency.size() * 99 / 100];
+        res.cpu_us = cpu / latency.size();
+    }
+
+    return res;
+}
+
+static map<string, perf_result> read_baselines()
+{
+    map<string, perf_result> rval;
+    ifstream file(PERF_BASELINE);
+    string line;
+
+    while (getline(file, line))
+    {
+        stringstream ss(line);
+        string name;
+        perf_result res;
+
+        if (line[0] != '#' && ss >> name >> res.qps >> res.p99_us >> res.cpu_us)
+        {
+            rval[name] = res;
+        }
+    }
+
+    return rval;
+}
+
+static void write_baselines(TestConnections *Test, const map<string, perf_result>& baselines)
+{
+    ofstream file(PERF_BASELINE);
+
+    file << "# name qps p99_us cpu_us_per_query\n";
+
+    for (map<string, perf_result>::const_iterator it = baselines.begin(); it != baselines.end(); it++)
+    {
+        file << it->first << " " << (long)it->second.qps << " " << (long)it->second.p99_us << " "
+             << it->second.cpu_us << "\n";
+    }
+
+    Test->add_result(!file.good(), "Failed to write %s\n", PERF_BASELINE);
+}
+
+static void check_regression(TestConnections *Test, const char *what, double value, double base,
+                             bool higher_is_better, double threshold)
+{
+    double change = base > 0 ? (value - base) * 100 / base : 0;
+
+    if (higher_is_better)
+    {
+        change = -change;
+    }
+
+    Test->tprintf("%s: %.2f, baseline %.2f\n", what, value, base);
+    Test->add_result(change > threshold, "%s is %.1f%% worse than the baseline\n", what, change);
+}
+
+int main(int argc, char *argv[])
+{
+    TestConnections *Test = new TestConnections(argc, argv);
+    int run_time = Test->smoke ? 10 : 60;
+    const char *env = getenv("perf_threshold");
+    double threshold = env ? atof(env) : 10;
+    bool update = (env = getenv("perf_update_baseline")) && strcasecmp(env, "yes") == 0;
+
+    const char *workloads[] =
+    {
+        "perf_point_select", "perf_mixed_rw", "perf_large_result", "perf_connection_churn",
+        "perf_prepared_stmt"
+    };
+    int workload = -1;
+
+    for (int i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++)
+    {
+        if (strcmp(Test->test_name, workloads[i]) == 0)
+        {
+            workload = i;
+        }
+    }
+
+    if (workload == -1)
+    {
+        Test->add_result(1, "Unknown workload: %s\n", Test->test_name);
+        int rval = Test->global_result;
+        delete Test;
+        return rval;
+    }
+
+    Test->set_timeout(300);
+    Test->repl->execute_query_all_nodes("SET GLOBAL max_connections = 10000");
+    Test->connect_maxscale();
+    create_table(Test);
+    Test->stop_timeout();
+
+    Test->tprintf("Running %s with %d threads for %d seconds\n", Test->test_name, PERF_THREADS, run_time);
+    Test->set_timeout(run_time + 300);
+    perf_result res = run_workload(Test, (perf_workload)workload, run_time);
+    Test->stop_timeout();
+
+    Test->tprintf("%s: %.0f QPS, p99 %.0fus, %.2fus of MaxScale CPU time per query\n",
+                  Test->test_name, res.qps, res.p99_us, res.cpu_us);
+
+    map<string, perf_result> baselines = read_baselines();
+
+    if (update)
+    {
+        baselines[Test->test_name] = res;
+        write_baselines(Test, baselines);
+        Test->tprintf("Updated the baseline in %s\n", PERF_BASELINE);
+    }
+    else if (baselines.count(Test->test_name))
+    {
+        const perf_result& base = baselines[Test->test_name];
+        check_regression(Test, "QPS", res.qps, base.qps, true, threshold);
+        check_regression(Test, "p99 latency", res.p99_us, base.p99_us, false, threshold);
+        check_regression(Test, "CPU time per query", res.cpu_us, base.cpu_us, false, threshold);
+    }
+    else
+    {
+        Test->tprintf("No baseline for %s in %s\n", Test->test_name, PERF_BASELINE);
+    }
+
+    Test->set_timeout(60);
+    Test->try_query(Test->conn_rwsplit, "DROP DATABASE perf");
+    Test->close_maxscale_connections();
+    Test->check_maxscale_alive();
+
+    int rval = Test->global_result;
+    delete Test;
+    return rval;
+}
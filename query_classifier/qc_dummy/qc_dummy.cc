@@ -139,6 +139,7 @@ extern "C"
             qc_dummy_get_field_info,
             qc_dummy_get_function_info,
             qc_dummy_get_preparable_stmt,
+            NULL,
         };
 
         static MXS_MODULE info =
@@ -1164,9 +1164,9 @@ char* qc_get_stmtname(GWBUF* buf)
     MYSQL* mysql;
 
     if (buf == NULL ||
-        buf->gwbuf_bufobj == NULL ||
-        buf->gwbuf_bufobj->bo_data == NULL ||
-        (mysql = (MYSQL *) ((parsing_info_t *) buf->gwbuf_bufobj->bo_data)->pi_handle) == NULL ||
+        gwbuf_get_buffer_object_data(buf, GWBUF_PARSING_INFO) == NULL ||
+        (mysql = (MYSQL *) ((parsing_info_t *)
+                            gwbuf_get_buffer_object_data(buf, GWBUF_PARSING_INFO))->pi_handle) == NULL ||
         mysql->thd == NULL ||
         (THD *) (mysql->thd))->lex == NULL ||
         (THD *) (mysql->thd))->lex->prepared_stmt_name == NULL)
@@ -2743,6 +2743,7 @@ extern "C"
             qc_mysql_get_field_info,
             qc_mysql_get_function_info,
             qc_mysql_get_preparable_stmt,
+            NULL,
         };
 
         static MXS_MODULE info =
@@ -14,15 +14,18 @@
 #define MXS_MODULE_NAME "qc_sqlite"
 #include <sqliteInt.h>
 
+#include <ctype.h>
 #include <signal.h>
 #include <string.h>
 #include <maxscale/alloc.h>
+#include <maxscale/digest.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/platform.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/statistics.h>
 #include "builtin_functions.h"
 
 //#define QC_TRACE_ENABLED
@@ -49,6 +52,56 @@ static inline bool qc_info_was_parsed(qc_parse_result_t status)
     return status == QC_QUERY_PARSED;
 }
 
+/**
+ * The kind of statement part retained for later collection.
+ */
+typedef enum qc_retained_kind
+{
+    QC_RETAINED_SELECT,
+    QC_RETAINED_INSERT,
+    QC_RETAINED_UPDATE,
+    QC_RETAINED_DELETE,
+} qc_retained_kind_t;
+
+/**
+ * A copy of the parts of a statement that are walked for collecting table,
+ * database, field and function information. Which members are used depends
+ * upon the kind.
+ */
+typedef struct qc_retained
+{
+    qc_retained_kind_t kind;  // The kind of part.
+    uint32_t usage;           // SELECT: The usage of the selected fields.
+    Select* pSelect;          // SELECT, INSERT: The select.
+    SrcList* pTabList;        // INSERT, UPDATE, DELETE: The tables.
+    SrcList* pUsing;          // DELETE: The USING clause.
+    IdList* pColumns;         // INSERT: The columns.
+    ExprList* pList;          // INSERT: The SET list, UPDATE: The changes.
+    Expr* pWhere;             // UPDATE, DELETE: The WHERE clause.
+    struct qc_retained* next; // The next part.
+} QC_RETAINED;
+
+/**
+ * A block of memory allocated for an arena. The memory handed out follows
+ * the header.
+ */
+typedef struct qc_arena_block
+{
+    struct qc_arena_block* next; // The previously allocated block.
+} QC_ARENA_BLOCK;
+
+/**
+ * A bump allocator for the classification output of a statement. Nothing
+ * allocated from an arena is freed individually, but everything at once
+ * when the arena is freed.
+ */
+typedef struct qc_arena
+{
+    char* pos;              // The first free byte of the current block.
+    char* end;              // The end of the current block.
+    QC_ARENA_BLOCK* blocks; // The allocated blocks.
+} QC_ARENA;
+
 /**
  * Contains information about a particular query.
  */
@@ -85,6 +138,13 @@ typedef struct qc_sqlite_info
     size_t function_infos_len;       // The used entries in function_infos.
     size_t function_infos_capacity;  // The capacity of the function_infos array.
     bool initializing;               // Whether we are initializing sqlite3.
+    bool multiple;                   // Whether the query contains more than one statement.
+    bool retain;                     // Whether all that was not collected can be collected
+                                     // from the retained parts.
+    bool retaining;                  // Whether a retained part is being walked.
+    QC_RETAINED* retained;           // The retained parts of the statement.
+    QC_RETAINED* retained_last;      // The last retained part.
+    QC_ARENA arena;                  // The memory of the names and infos above.
 } QC_SQLITE_INFO;
 
 typedef enum qc_log_level
@@ -96,6 +156,72 @@ typedef enum qc_log_level
 } qc_log_level_t;
 
 
+/**
+ * The default number of classifications cached by each thread.
+ */
+#define QC_CACHE_DEFAULT_SIZE 1000
+
+/**
+ * Statements longer than this are not cached, as long statements are
+ * typically bulk inserts that rarely repeat exactly.
+ */
+#define QC_CACHE_MAX_STMT_LEN 4096
+
+/**
+ * The parts of statements longer than this are not retained when not all
+ * information is collected, but the statements are parsed again if more
+ * information is needed.
+ */
+#define QC_RETAIN_MAX_STMT_LEN 4096
+
+/**
+ * The size of the arena memory allocated together with a QC_SQLITE_INFO,
+ * which suffices for the names and infos of most statements.
+ */
+#define QC_ARENA_INLINE_SIZE 512
+
+/**
+ * The size of the blocks an arena allocates when the memory allocated
+ * together with a QC_SQLITE_INFO does not suffice.
+ */
+#define QC_ARENA_BLOCK_SIZE 2048
+
+/**
+ * The size and number of the lookaside slots of the sqlite3 connection of
+ * each thread. The lookaside memory is allocated once per thread and the
+ * parse tree of a typical statement fits in it, so that classifying it does
+ * not go to malloc for the nodes of the tree.
+ */
+#define QC_LOOKASIDE_SLOT_SIZE 512
+#define QC_LOOKASIDE_SLOTS     512
+
+/**
+ * A cached classification.
+ */
+typedef struct qc_cache_entry
+{
+    char* key;                   // The command byte followed by the digest of the statement.
+    size_t key_len;              // The length of the key.
+    uint32_t hash;               // The hash of the key.
+    QC_SQLITE_INFO* info;        // The classification.
+    struct qc_cache_entry* hnext;// The next entry in the same bucket.
+    struct qc_cache_entry* prev; // The more recently used entry.
+    struct qc_cache_entry* next; // The less recently used entry.
+} QC_CACHE_ENTRY;
+
+/**
+ * The classification cache of a thread. The entries are kept in a hashtable
+ * and in a list ordered by the time of last use.
+ */
+typedef struct qc_cache
+{
+    QC_CACHE_ENTRY** buckets; // The hashtable.
+    size_t n_buckets;         // The number of buckets, a power of two.
+    size_t n_entries;         // The number of cached classifications.
+    QC_CACHE_ENTRY* head;     // The most recently used entry.
+    QC_CACHE_ENTRY* tail;     // The least recently used entry.
+} QC_CACHE;
+
 /**
  * The state of qc_sqlite.
  */
@@ -104,6 +230,10 @@ static struct
     bool initialized;
     bool setup;
     qc_log_level_t log_level;
+    size_t cache_size;        // The number of classifications cached by each thread.
+    ts_stats_t cache_entries; // The number of cached classifications.
+    ts_stats_t cache_hits;    // The number of classifications found in the cache.
+    ts_stats_t cache_misses;  // The number of classifications not found in the cache.
 } this_unit;
 
 /**
@@ -114,6 +244,7 @@ static thread_local struct
     bool initialized;
     sqlite3* db;      // Thread specific database handle.
     QC_SQLITE_INFO* info;
+    QC_CACHE cache;   // Thread specific classification cache.
 } this_thread;
 
 /**
@@ -127,20 +258,41 @@ typedef enum qc_token_position
     QC_TOKEN_RIGHT,  // To the right, e.g: "b" in "a = b".
 } qc_token_position_t;
 
+static void* arena_alloc(QC_ARENA* arena, size_t size);
+static void arena_free(QC_ARENA* arena);
+static void arena_init(QC_ARENA* arena, char* memory, size_t size);
+static char* arena_strdup(QC_ARENA* arena, const char* s);
+static char* arena_strndup(QC_ARENA* arena, const char* s, size_t len);
 static void buffer_object_free(void* data);
+static void cache_finish(QC_CACHE* cache);
+static bool cache_init(QC_CACHE* cache, size_t size);
+static QC_SQLITE_INFO* cache_lookup(QC_CACHE* cache, const char* key, size_t key_len, uint32_t collect);
+static void cache_store(QC_CACHE* cache, char* key, size_t key_len, const QC_SQLITE_INFO* info);
+static char* create_cache_key(uint8_t command, GWBUF* query, size_t* pkey_len);
 static char** copy_string_array(char** strings, int* pn);
-static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity);
+static void enlarge_string_array(QC_ARENA* arena, size_t n, size_t len,
+                                 char*** ppzStrings, size_t* pCapacity);
 static bool ensure_query_is_parsed(GWBUF* query, uint32_t collect);
-static void free_field_infos(QC_FIELD_INFO* infos, size_t n_infos);
-static void free_string_array(char** sa);
 static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect);
 static QC_SQLITE_INFO* info_alloc(uint32_t collect);
+static QC_SQLITE_INFO* info_copy(const QC_SQLITE_INFO* info);
 static void info_finish(QC_SQLITE_INFO* info);
 static void info_free(QC_SQLITE_INFO* info);
 static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info, uint32_t collect);
 static void log_invalid_data(GWBUF* query, const char* message);
 static bool parse_query(GWBUF* query, uint32_t collect);
-static void parse_query_string(const char* query, size_t len);
+static const char* parse_query_string(const char* query, size_t len);
+static void retain(QC_SQLITE_INFO* info,
+                   qc_retained_kind_t kind,
+                   uint32_t usage,
+                   Select* pSelect,
+                   SrcList* pTabList,
+                   SrcList* pUsing,
+                   IdList* pColumns,
+                   ExprList* pList,
+                   Expr* pWhere);
+static void retained_free(QC_SQLITE_INFO* info);
+static bool query_is_cacheable(const QC_SQLITE_INFO* info);
 static bool query_is_parsed(GWBUF* query, uint32_t collect);
 static bool should_exclude(const char* zName, const ExprList* pExclude);
 static void update_field_info(QC_SQLITE_INFO* info,
@@ -171,6 +323,20 @@ static void update_field_infos_from_select(QC_SQLITE_INFO* info,
                                            const Select* pSelect,
                                            uint32_t usage,
                                            const ExprList* pExclude);
+static void update_info_from_delete(QC_SQLITE_INFO* info,
+                                    const SrcList* pTabList,
+                                    const Expr* pWhere,
+                                    const SrcList* pUsing);
+static void update_info_from_insert(QC_SQLITE_INFO* info,
+                                    const SrcList* pTabList,
+                                    const Select* pSelect,
+                                    const IdList* pColumns,
+                                    const ExprList* pSet);
+static void update_info_from_retained(QC_SQLITE_INFO* info);
+static void update_info_from_update(QC_SQLITE_INFO* info,
+                                    const SrcList* pTabList,
+                                    const ExprList* pChanges,
+                                    const Expr* pWhere);
 static void update_function_info(QC_SQLITE_INFO* info,
                                  const char* name,
                                  uint32_t usage);
@@ -184,6 +350,11 @@ extern void exposed_sqlite3ExprListDelete(sqlite3 *db, ExprList *pList);
 extern void exposed_sqlite3IdListDelete(sqlite3 *db, IdList *pList);
 extern void exposed_sqlite3SrcListDelete(sqlite3 *db, SrcList *pList);
 extern void exposed_sqlite3SelectDelete(sqlite3 *db, Select *p);
+extern Expr* exposed_sqlite3ExprDup(sqlite3 *db, Expr *pExpr);
+extern ExprList* exposed_sqlite3ExprListDup(sqlite3 *db, ExprList *pList);
+extern IdList* exposed_sqlite3IdListDup(sqlite3 *db, IdList *pList);
+extern Select* exposed_sqlite3SelectDup(sqlite3 *db, Select *p);
+extern SrcList* exposed_sqlite3SrcListDup(sqlite3 *db, SrcList *pList);
 
 extern void exposed_sqlite3BeginTrigger(Parse *pParse,
                                         Token *pName1,
@@ -212,6 +383,82 @@ extern void maxscaleCollectInfoFromSelect(Parse*, Select*, int);
 
 extern void maxscale_update_function_info(const char* name, uint32_t usage);
 
+/**
+ * Allocates memory from an arena. The memory is aligned for any of the
+ * types stored in a QC_SQLITE_INFO.
+ *
+ * @param arena  The arena.
+ * @param size   The number of bytes needed.
+ *
+ * @return The memory, which is valid until the arena is freed.
+ */
+static void* arena_alloc(QC_ARENA* arena, size_t size)
+{
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+    if (size > (size_t)(arena->end - arena->pos))
+    {
+        size_t block_size = size > QC_ARENA_BLOCK_SIZE ? size : QC_ARENA_BLOCK_SIZE;
+        QC_ARENA_BLOCK* block = MXS_MALLOC(sizeof(QC_ARENA_BLOCK) + block_size);
+        MXS_ABORT_IF_NULL(block);
+
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->pos = (char*)(block + 1);
+        arena->end = arena->pos + block_size;
+    }
+
+    void* rv = arena->pos;
+    arena->pos += size;
+
+    return rv;
+}
+
+static void arena_free(QC_ARENA* arena)
+{
+    QC_ARENA_BLOCK* block = arena->blocks;
+
+    while (block)
+    {
+        QC_ARENA_BLOCK* next = block->next;
+        MXS_FREE(block);
+        block = next;
+    }
+
+    arena->pos = NULL;
+    arena->end = NULL;
+    arena->blocks = NULL;
+}
+
+/**
+ * Initializes an arena.
+ *
+ * @param arena   The arena.
+ * @param memory  Memory to allocate from before any blocks are allocated, or NULL.
+ * @param size    The size of @c memory.
+ */
+static void arena_init(QC_ARENA* arena, char* memory, size_t size)
+{
+    arena->pos = memory;
+    arena->end = memory + size;
+    arena->blocks = NULL;
+}
+
+static char* arena_strndup(QC_ARENA* arena, const char* s, size_t len)
+{
+    char* copy = arena_alloc(arena, len + 1);
+
+    memcpy(copy, s, len);
+    copy[len] = 0;
+
+    return copy;
+}
+
+static char* arena_strdup(QC_ARENA* arena, const char* s)
+{
+    return arena_strndup(arena, s, strlen(s));
+}
+
 /**
  * Used for freeing a QC_SQLITE_INFO object added to a GWBUF.
  *
@@ -222,6 +469,223 @@ static void buffer_object_free(void* data)
     info_free((QC_SQLITE_INFO*) data);
 }
 
+static uint32_t cache_hash(const char* key, size_t key_len)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (size_t i = 0; i < key_len; ++i)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void cache_unlink(QC_CACHE* cache, QC_CACHE_ENTRY* entry)
+{
+    if (entry->prev)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        cache->head = entry->next;
+    }
+
+    if (entry->next)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        cache->tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void cache_push_front(QC_CACHE* cache, QC_CACHE_ENTRY* entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if (cache->head)
+    {
+        cache->head->prev = entry;
+    }
+    else
+    {
+        cache->tail = entry;
+    }
+
+    cache->head = entry;
+}
+
+static QC_CACHE_ENTRY** cache_find(QC_CACHE* cache, const char* key, size_t key_len, uint32_t hash)
+{
+    QC_CACHE_ENTRY** pentry = &cache->buckets[hash & (cache->n_buckets - 1)];
+
+    while (*pentry && ((*pentry)->hash != hash ||
+                       (*pentry)->key_len != key_len ||
+                       memcmp((*pentry)->key, key, key_len) != 0))
+    {
+        pentry = &(*pentry)->hnext;
+    }
+
+    return pentry;
+}
+
+static void cache_remove(QC_CACHE* cache, QC_CACHE_ENTRY** pentry)
+{
+    QC_CACHE_ENTRY* entry = *pentry;
+
+    *pentry = entry->hnext;
+    cache_unlink(cache, entry);
+    --cache->n_entries;
+    ts_stats_add(this_unit.cache_entries, -1);
+
+    info_free(entry->info);
+    MXS_FREE(entry->key);
+    MXS_FREE(entry);
+}
+
+static void cache_finish(QC_CACHE* cache)
+{
+    while (cache->tail)
+    {
+        QC_CACHE_ENTRY* entry = cache->tail;
+        cache_remove(cache, cache_find(cache, entry->key, entry->key_len, entry->hash));
+    }
+
+    MXS_FREE(cache->buckets);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static bool cache_init(QC_CACHE* cache, size_t size)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    if (size != 0)
+    {
+        cache->n_buckets = 16;
+
+        while (cache->n_buckets < size)
+        {
+            cache->n_buckets *= 2;
+        }
+
+        cache->buckets = (QC_CACHE_ENTRY**) MXS_CALLOC(cache->n_buckets, sizeof(QC_CACHE_ENTRY*));
+
+        if (!cache->buckets)
+        {
+            cache->n_buckets = 0;
+        }
+    }
+
+    return cache->buckets != NULL;
+}
+
+/**
+ * Finds a cached classification.
+ *
+ * @param cache    The cache.
+ * @param key      The key created with create_cache_key.
+ * @param key_len  The length of the key.
+ * @param collect  What information is needed.
+ *
+ * @return A copy of the classification or NULL if it was not found or does
+ *         not contain all the needed information.
+ */
+static QC_SQLITE_INFO* cache_lookup(QC_CACHE* cache, const char* key, size_t key_len, uint32_t collect)
+{
+    QC_SQLITE_INFO* info = NULL;
+    QC_CACHE_ENTRY* entry = *cache_find(cache, key, key_len, cache_hash(key, key_len));
+
+    if (entry && (~entry->info->collected & collect) == 0)
+    {
+        cache_unlink(cache, entry);
+        cache_push_front(cache, entry);
+        info = info_copy(entry->info);
+    }
+
+    return info;
+}
+
+/**
+ * Stores a classification, replacing any earlier one of the same statement
+ * and evicting the least recently used one if the cache is full.
+ *
+ * @param cache    The cache.
+ * @param key      The key, owned by the cache after the call.
+ * @param key_len  The length of the key.
+ * @param info     The classification, which is copied.
+ */
+static void cache_store(QC_CACHE* cache, char* key, size_t key_len, const QC_SQLITE_INFO* info)
+{
+    uint32_t hash = cache_hash(key, key_len);
+    QC_CACHE_ENTRY** pentry = cache_find(cache, key, key_len, hash);
+
+    if (*pentry)
+    {
+        cache_remove(cache, pentry);
+    }
+    else if (cache->n_entries >= this_unit.cache_size)
+    {
+        QC_CACHE_ENTRY* lru = cache->tail;
+        cache_remove(cache, cache_find(cache, lru->key, lru->key_len, lru->hash));
+    }
+
+    QC_CACHE_ENTRY* entry = (QC_CACHE_ENTRY*) MXS_MALLOC(sizeof(QC_CACHE_ENTRY));
+
+    if (entry)
+    {
+        entry->key = key;
+        entry->key_len = key_len;
+        entry->hash = hash;
+        entry->info = info_copy(info);
+        entry->hnext = cache->buckets[hash & (cache->n_buckets - 1)];
+        cache->buckets[hash & (cache->n_buckets - 1)] = entry;
+        cache_push_front(cache, entry);
+        ++cache->n_entries;
+        ts_stats_add(this_unit.cache_entries, 1);
+    }
+    else
+    {
+        MXS_FREE(key);
+    }
+}
+
+/**
+ * Creates the cache key of a statement. The key is the command byte followed
+ * by the digest of the statement, so statements that differ only by their
+ * literals, comments or whitespace share a classification.
+ *
+ * @param command   The command byte of the packet.
+ * @param query     The packet.
+ * @param pkey_len  On return, the length of the key.
+ *
+ * @return The key or NULL if the digest of the statement is not available.
+ */
+static char* create_cache_key(uint8_t command, GWBUF* query, size_t* pkey_len)
+{
+    char* key = NULL;
+    MXS_DIGEST digest;
+
+    if (mxs_digest_get(query, &digest))
+    {
+        key = (char*) MXS_MALLOC(1 + sizeof(digest));
+        MXS_ABORT_IF_NULL(key);
+
+        key[0] = command;
+        memcpy(key + 1, &digest, sizeof(digest));
+        *pkey_len = 1 + sizeof(digest);
+    }
+
+    return key;
+}
+
 static char** copy_string_array(char** strings, int* pn)
 {
     size_t n = 0;
@@ -249,14 +713,21 @@ static char** copy_string_array(char** strings, int* pn)
     return ss;
 }
 
-static void enlarge_string_array(size_t n, size_t len, char*** ppzStrings, size_t* pCapacity)
+static void enlarge_string_array(QC_ARENA* arena, size_t n, size_t len,
+                                 char*** ppzStrings, size_t* pCapacity)
 {
     if (len + n >= *pCapacity)
     {
-        int capacity = *pCapacity ? *pCapacity * 2 : 4;
+        size_t capacity = *pCapacity ? *pCapacity * 2 : 4;
 
-        *ppzStrings = (char**) MXS_REALLOC(*ppzStrings, capacity * sizeof(char**));
-        MXS_ABORT_IF_NULL(*ppzStrings);
+        char** pzStrings = (char**) arena_alloc(arena, capacity * sizeof(char*));
+
+        if (len)
+        {
+            memcpy(pzStrings, *ppzStrings, len * sizeof(char*));
+        }
+
+        *ppzStrings = pzStrings;
         *pCapacity = capacity;
     }
 }
@@ -273,83 +744,136 @@ static bool ensure_query_is_parsed(GWBUF* query, uint32_t collect)
     return parsed;
 }
 
-static void free_field_infos(QC_FIELD_INFO* infos, size_t n_infos)
+static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect)
 {
-    if (infos)
-    {
-        for (int i = 0; i < n_infos; ++i)
-        {
-            MXS_FREE(infos[i].database);
-            MXS_FREE(infos[i].table);
-            MXS_FREE(infos[i].column);
-        }
+    QC_SQLITE_INFO* info = NULL;
 
-        MXS_FREE(infos);
+    if (ensure_query_is_parsed(query, collect))
+    {
+        info = (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
+        ss_dassert(info);
     }
+
+    return info;
 }
 
-static void free_function_infos(QC_FUNCTION_INFO* infos, size_t n_infos)
+/**
+ * Allocates a QC_SQLITE_INFO together with the first memory of its arena.
+ *
+ * @param collect  What information should be collected.
+ *
+ * @return The info.
+ */
+static QC_SQLITE_INFO* info_alloc(uint32_t collect)
 {
-    if (infos)
-    {
-        for (int i = 0; i < n_infos; ++i)
-        {
-            MXS_FREE(infos[i].name);
-        }
+    QC_SQLITE_INFO* info = MXS_MALLOC(sizeof(*info) + QC_ARENA_INLINE_SIZE);
+    MXS_ABORT_IF_NULL(info);
 
-        MXS_FREE(infos);
-    }
+    info_init(info, collect);
+    arena_init(&info->arena, (char*)(info + 1), QC_ARENA_INLINE_SIZE);
+
+    return info;
 }
 
-static void free_string_array(char** sa)
+static char** info_copy_string_array(QC_ARENA* arena, char** strings, size_t len, size_t* pCapacity)
 {
-    if (sa)
+    char** copy = NULL;
+    *pCapacity = 0;
+
+    if (strings)
     {
-        char** s = sa;
+        copy = (char**) arena_alloc(arena, (len + 1) * sizeof(char*));
 
-        while (*s)
+        for (size_t i = 0; i < len; ++i)
         {
-            free(*s);
-            ++s;
+            copy[i] = arena_strdup(arena, strings[i]);
         }
 
-        free(sa);
+        copy[len] = NULL;
+        *pCapacity = len + 1;
     }
+
+    return copy;
 }
 
-static QC_SQLITE_INFO* get_query_info(GWBUF* query, uint32_t collect)
+static char* info_copy_string(QC_ARENA* arena, const char* s)
 {
-    QC_SQLITE_INFO* info = NULL;
+    return s ? arena_strdup(arena, s) : NULL;
+}
 
-    if (ensure_query_is_parsed(query, collect))
+/**
+ * Copies the classification of a statement. The statement must not have
+ * a preparable statement.
+ *
+ * @param info  The classification to copy.
+ *
+ * @return The copy.
+ */
+static QC_SQLITE_INFO* info_copy(const QC_SQLITE_INFO* info)
+{
+    ss_dassert(!info->preparable_stmt);
+    QC_SQLITE_INFO* copy = info_alloc(info->collect);
+    QC_ARENA* arena = &copy->arena;
+    QC_ARENA copy_arena = *arena;
+
+    *copy = *info;
+    copy->arena = copy_arena;
+    copy->query = NULL;
+    copy->query_len = 0;
+    copy->table_names = info_copy_string_array(arena, info->table_names, info->table_names_len,
+                                               &copy->table_names_capacity);
+    copy->table_fullnames = info_copy_string_array(arena, info->table_fullnames,
+                                                   info->table_fullnames_len,
+                                                   &copy->table_fullnames_capacity);
+    copy->created_table_name = info_copy_string(arena, info->created_table_name);
+    copy->database_names = info_copy_string_array(arena, info->database_names,
+                                                  info->database_names_len,
+                                                  &copy->database_names_capacity);
+    copy->prepare_name = info_copy_string(arena, info->prepare_name);
+    copy->field_infos = NULL;
+    copy->field_infos_capacity = 0;
+    copy->function_infos = NULL;
+    copy->function_infos_capacity = 0;
+    copy->retain = false;
+    copy->retaining = false;
+    copy->retained = NULL;
+    copy->retained_last = NULL;
+
+    if (info->field_infos_len)
     {
-        info = (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
-        ss_dassert(info);
-    }
+        copy->field_infos = arena_alloc(arena, info->field_infos_len * sizeof(QC_FIELD_INFO));
+        copy->field_infos_capacity = info->field_infos_len;
 
-    return info;
-}
+        for (size_t i = 0; i < info->field_infos_len; ++i)
+        {
+            copy->field_infos[i].database = info_copy_string(arena, info->field_infos[i].database);
+            copy->field_infos[i].table = info_copy_string(arena, info->field_infos[i].table);
+            copy->field_infos[i].column = info_copy_string(arena, info->field_infos[i].column);
+            copy->field_infos[i].usage = info->field_infos[i].usage;
+        }
+    }
 
-static QC_SQLITE_INFO* info_alloc(uint32_t collect)
-{
-    QC_SQLITE_INFO* info = MXS_MALLOC(sizeof(*info));
-    MXS_ABORT_IF_NULL(info);
+    if (info->function_infos_len)
+    {
+        copy->function_infos = arena_alloc(arena, info->function_infos_len * sizeof(QC_FUNCTION_INFO));
+        copy->function_infos_capacity = info->function_infos_len;
 
-    info_init(info, collect);
+        for (size_t i = 0; i < info->function_infos_len; ++i)
+        {
+            copy->function_infos[i].name = info_copy_string(arena, info->function_infos[i].name);
+            copy->function_infos[i].usage = info->function_infos[i].usage;
+        }
+    }
 
-    return info;
+    return copy;
 }
 
 static void info_finish(QC_SQLITE_INFO* info)
 {
-    free_string_array(info->table_names);
-    free_string_array(info->table_fullnames);
-    free(info->created_table_name);
-    free_string_array(info->database_names);
-    free(info->prepare_name);
     gwbuf_free(info->preparable_stmt);
-    free_field_infos(info->field_infos, info->field_infos_len);
-    free_function_infos(info->function_infos, info->function_infos_len);
+    retained_free(info);
+    // The names and infos are in the arena.
+    arena_free(&info->arena);
 }
 
 static void info_free(QC_SQLITE_INFO* info)
@@ -394,11 +918,24 @@ static QC_SQLITE_INFO* info_init(QC_SQLITE_INFO* info, uint32_t collect)
     info->function_infos_len = 0;
     info->function_infos_capacity = 0;
     info->initializing = false;
+    info->multiple = false;
+    info->retain = false;
+    info->retaining = false;
+    info->retained = NULL;
+    info->retained_last = NULL;
 
     return info;
 }
 
-static void parse_query_string(const char* query, size_t len)
+/**
+ * Parses the first statement of a string.
+ *
+ * @param query  The string.
+ * @param len    The length of the string.
+ *
+ * @return The end of the parsed statement.
+ */
+static const char* parse_query_string(const char* query, size_t len)
 {
     sqlite3_stmt* stmt = NULL;
     const char* tail = NULL;
@@ -497,6 +1034,60 @@ static void parse_query_string(const char* query, size_t len)
     {
         sqlite3_finalize(stmt);
     }
+
+    if (!tail || tail < query || tail > query + len)
+    {
+        tail = query + len;
+    }
+
+    return tail;
+}
+
+/**
+ * Checks whether anything but white space, semicolons and comments follows
+ * a statement. Executable comments, i.e. comments starting with "/*!", are
+ * not skipped.
+ *
+ * @param tail  The end of the statement.
+ * @param end   The end of the query.
+ *
+ * @return True, if another statement follows.
+ */
+static bool more_statements(const char* tail, const char* end)
+{
+    while (tail < end)
+    {
+        if (isspace((unsigned char)*tail) || *tail == ';')
+        {
+            ++tail;
+        }
+        else if (*tail == '/' && tail + 2 < end && tail[1] == '*' && tail[2] != '!')
+        {
+            tail += 2;
+
+            while (tail + 1 < end && !(tail[0] == '*' && tail[1] == '/'))
+            {
+                ++tail;
+            }
+
+            tail += 2;
+        }
+        else if (*tail == '#' ||
+                 (*tail == '-' && tail + 1 < end && tail[1] == '-' &&
+                  (tail + 2 == end || isspace((unsigned char)tail[2]))))
+        {
+            while (tail < end && *tail != '\n')
+            {
+                ++tail;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return tail < end;
 }
 
 static bool parse_query(GWBUF* query, uint32_t collect)
@@ -518,15 +1109,42 @@ static bool parse_query(GWBUF* query, uint32_t collect)
                 QC_SQLITE_INFO* info =
                     (QC_SQLITE_INFO*) gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO);
 
-                if (info)
+                size_t len = MYSQL_GET_PAYLOAD_LEN(data) - 1; // Subtract 1 for packet type byte.
+                const char* s = (const char*) &data[MYSQL_HEADER_LEN + 1];
+                char* key = NULL;
+                size_t key_len = 0;
+                QC_SQLITE_INFO* cached = NULL;
+                bool replay = false;
+
+                if (this_thread.cache.buckets && len <= QC_CACHE_MAX_STMT_LEN)
+                {
+                    key = create_cache_key(command, query, &key_len);
+
+                    if (key && !info)
+                    {
+                        cached = cache_lookup(&this_thread.cache, key, key_len, collect);
+                        ts_stats_add(cached ? this_unit.cache_hits : this_unit.cache_misses, 1);
+                    }
+                }
+
+                if (cached)
+                {
+                    // The statement differs from a classified one only by its literals.
+                    gwbuf_add_buffer_object(query, GWBUF_PARSING_INFO, cached, buffer_object_free);
+                    parsed = true;
+                }
+                else if (info)
                 {
                     ss_dassert((~info->collect & collect) != 0);
                     ss_dassert((~info->collected & collect) != 0);
 
                     // If we get here, then the statement has been parsed once, but
                     // not all needed was collected. Now we turn on all blinkelichts to
-                    // ensure that a statement is parsed at most twice.
+                    // ensure that a statement is parsed at most twice. If the parts
+                    // walked for collecting were retained, they are walked instead.
                     info->collect = QC_COLLECT_ALL;
+                    replay = info->retain;
+                    info->retain = false;
                 }
                 else
                 {
@@ -534,6 +1152,8 @@ static bool parse_query(GWBUF* query, uint32_t collect)
 
                     if (info)
                     {
+                        info->retain = (collect != QC_COLLECT_ALL) && (len <= QC_RETAIN_MAX_STMT_LEN);
+
                         // TODO: Add return value to gwbuf_add_buffer_object.
                         gwbuf_add_buffer_object(query, GWBUF_PARSING_INFO, info, buffer_object_free);
                     }
@@ -543,15 +1163,24 @@ static bool parse_query(GWBUF* query, uint32_t collect)
                 {
                     this_thread.info = info;
 
-                    size_t len = MYSQL_GET_PAYLOAD_LEN(data) - 1; // Subtract 1 for packet type byte.
-
-                    const char* s = (const char*) &data[MYSQL_HEADER_LEN + 1];
+                    if (replay)
+                    {
+                        update_info_from_retained(info);
+                    }
+                    else
+                    {
+                        this_thread.info->query = s;
+                        this_thread.info->query_len = len;
+                        const char* tail = parse_query_string(s, len);
+                        this_thread.info->multiple = more_statements(tail, s + len);
+                        this_thread.info->query = NULL;
+                        this_thread.info->query_len = 0;
+                    }
 
-                    this_thread.info->query = s;
-                    this_thread.info->query_len = len;
-                    parse_query_string(s, len);
-                    this_thread.info->query = NULL;
-                    this_thread.info->query_len = 0;
+                    if (!info->retain)
+                    {
+                        retained_free(info);
+                    }
 
                     if (command == MYSQL_COM_STMT_PREPARE)
                     {
@@ -563,11 +1192,19 @@ static bool parse_query(GWBUF* query, uint32_t collect)
                     parsed = true;
 
                     this_thread.info = NULL;
+
+                    if (key && query_is_cacheable(info))
+                    {
+                        cache_store(&this_thread.cache, key, key_len, info);
+                        key = NULL;
+                    }
                 }
-                else
+                else if (!cached)
                 {
                     MXS_ERROR("Could not allocate structure for containing parse data.");
                 }
+
+                MXS_FREE(key);
             }
             else
             {
@@ -590,6 +1227,30 @@ static bool parse_query(GWBUF* query, uint32_t collect)
     return parsed;
 }
 
+/**
+ * Checks whether the classification of a statement can be used for all
+ * statements that differ from it only by their literals.
+ *
+ * @param info  The classification.
+ *
+ * @return True, if the classification can be cached.
+ */
+static bool query_is_cacheable(const QC_SQLITE_INFO* info)
+{
+    // The values assigned to variables and the statements of PREPARE are
+    // taken into account in the classification.
+    const uint32_t literal_types =
+        QUERY_TYPE_SESSION_WRITE |
+        QUERY_TYPE_GSYSVAR_WRITE |
+        QUERY_TYPE_ENABLE_AUTOCOMMIT |
+        QUERY_TYPE_DISABLE_AUTOCOMMIT |
+        QUERY_TYPE_PREPARE_NAMED_STMT;
+
+    return info->status == QC_QUERY_PARSED &&
+           (info->type_mask & literal_types) == 0 &&
+           info->preparable_stmt == NULL;
+}
+
 static bool query_is_parsed(GWBUF* query, uint32_t collect)
 {
     bool rc = query && GWBUF_IS_PARSED(query);
@@ -610,6 +1271,101 @@ static bool query_is_parsed(GWBUF* query, uint32_t collect)
     return rc;
 }
 
+/**
+ * Retains copies of the parts of a statement that are walked for collecting
+ * information, so that what is not collected now can be collected later
+ * without parsing the statement again. If copying fails, nothing is retained.
+ *
+ * @param info      The info of the statement being parsed.
+ * @param kind      The kind of part.
+ * @param usage     SELECT: The usage of the selected fields.
+ * @param pSelect   SELECT, INSERT: The select, or NULL.
+ * @param pTabList  INSERT, UPDATE, DELETE: The tables.
+ * @param pUsing    DELETE: The USING clause, or NULL.
+ * @param pColumns  INSERT: The columns, or NULL.
+ * @param pList     INSERT: The SET list, UPDATE: The changes, or NULL.
+ * @param pWhere    UPDATE, DELETE: The WHERE clause, or NULL.
+ */
+static void retain(QC_SQLITE_INFO* info,
+                   qc_retained_kind_t kind,
+                   uint32_t usage,
+                   Select* pSelect,
+                   SrcList* pTabList,
+                   SrcList* pUsing,
+                   IdList* pColumns,
+                   ExprList* pList,
+                   Expr* pWhere)
+{
+    ss_dassert(info->retain);
+
+    QC_RETAINED* retained = MXS_CALLOC(1, sizeof(*retained));
+
+    if (retained)
+    {
+        sqlite3* db = this_thread.db;
+
+        retained->kind = kind;
+        retained->usage = usage;
+        retained->pSelect = exposed_sqlite3SelectDup(db, pSelect);
+        retained->pTabList = exposed_sqlite3SrcListDup(db, pTabList);
+        retained->pUsing = exposed_sqlite3SrcListDup(db, pUsing);
+        retained->pColumns = exposed_sqlite3IdListDup(db, pColumns);
+        retained->pList = exposed_sqlite3ExprListDup(db, pList);
+        retained->pWhere = exposed_sqlite3ExprDup(db, pWhere);
+
+        if (info->retained_last)
+        {
+            info->retained_last->next = retained;
+        }
+        else
+        {
+            info->retained = retained;
+        }
+
+        info->retained_last = retained;
+
+        if (db->mallocFailed)
+        {
+            // Some copy may be partial.
+            info->retain = false;
+        }
+    }
+    else
+    {
+        info->retain = false;
+    }
+}
+
+/**
+ * Frees the retained parts of a statement.
+ *
+ * @param info  The info of the statement.
+ */
+static void retained_free(QC_SQLITE_INFO* info)
+{
+    QC_RETAINED* retained = info->retained;
+
+    while (retained)
+    {
+        QC_RETAINED* next = retained->next;
+
+        // The copies are not allocated from the lookaside of the thread
+        // specific database handle, so they can be freed in any thread.
+        exposed_sqlite3SelectDelete(NULL, retained->pSelect);
+        exposed_sqlite3SrcListDelete(NULL, retained->pTabList);
+        exposed_sqlite3SrcListDelete(NULL, retained->pUsing);
+        exposed_sqlite3IdListDelete(NULL, retained->pColumns);
+        exposed_sqlite3ExprListDelete(NULL, retained->pList);
+        exposed_sqlite3ExprDelete(NULL, retained->pWhere);
+        MXS_FREE(retained);
+
+        retained = next;
+    }
+
+    info->retained = NULL;
+    info->retained_last = NULL;
+}
+
 /**
  * Logs information about invalid data.
  *
@@ -694,7 +1450,9 @@ static void update_field_info(QC_SQLITE_INFO* info,
     if (!(info->collect & QC_COLLECT_FIELDS) || (info->collected & QC_COLLECT_FIELDS))
     {
         // If field information should not be collected, or if field information
-        // has already been collected, we just return.
+        // has already been collected, we just return. Unless the information is walked
+        // from a retained part, it cannot be collected without parsing again.
+        info->retain = info->retain && info->retaining;
         return;
     }
 
@@ -745,13 +1503,15 @@ static void update_field_info(QC_SQLITE_INFO* info,
             else
             {
                 size_t capacity = info->field_infos_capacity ? 2 * info->field_infos_capacity : 8;
-                field_infos = MXS_REALLOC(info->field_infos, capacity * sizeof(QC_FIELD_INFO));
+                field_infos = arena_alloc(&info->arena, capacity * sizeof(QC_FIELD_INFO));
 
-                if (field_infos)
+                if (info->field_infos_len)
                 {
-                    info->field_infos = field_infos;
-                    info->field_infos_capacity = capacity;
+                    memcpy(field_infos, info->field_infos, info->field_infos_len * sizeof(QC_FIELD_INFO));
                 }
+
+                info->field_infos = field_infos;
+                info->field_infos_capacity = capacity;
             }
         }
     }
@@ -763,17 +1523,12 @@ static void update_field_info(QC_SQLITE_INFO* info,
     // If field_infos is NULL, then the field was found and has already been noted.
     if (field_infos)
     {
-        item.database = item.database ? MXS_STRDUP(item.database) : NULL;
-        item.table = item.table ? MXS_STRDUP(item.table) : NULL;
+        item.database = item.database ? arena_strdup(&info->arena, item.database) : NULL;
+        item.table = item.table ? arena_strdup(&info->arena, item.table) : NULL;
         ss_dassert(item.column);
-        item.column = MXS_STRDUP(item.column);
-
-        // We are happy if we at least could dup the column.
+        item.column = arena_strdup(&info->arena, item.column);
 
-        if (item.column)
-        {
-            field_infos[info->field_infos_len++] = item;
-        }
+        field_infos[info->field_infos_len++] = item;
     }
 }
 
@@ -786,7 +1541,9 @@ static void update_function_info(QC_SQLITE_INFO* info,
     if (!(info->collect & QC_COLLECT_FUNCTIONS) || (info->collected & QC_COLLECT_FUNCTIONS))
     {
         // If function information should not be collected, or if function information
-        // has already been collected, we just return.
+        // has already been collected, we just return. Unless the information is walked
+        // from a retained part, it cannot be collected without parsing again.
+        info->retain = info->retain && info->retaining;
         return;
     }
 
@@ -814,13 +1571,16 @@ static void update_function_info(QC_SQLITE_INFO* info,
         else
         {
             size_t capacity = info->function_infos_capacity ? 2 * info->function_infos_capacity : 8;
-            function_infos = MXS_REALLOC(info->function_infos, capacity * sizeof(QC_FUNCTION_INFO));
+            function_infos = arena_alloc(&info->arena, capacity * sizeof(QC_FUNCTION_INFO));
 
-            if (function_infos)
+            if (info->function_infos_len)
             {
-                info->function_infos = function_infos;
-                info->function_infos_capacity = capacity;
+                memcpy(function_infos, info->function_infos,
+                       info->function_infos_len * sizeof(QC_FUNCTION_INFO));
             }
+
+            info->function_infos = function_infos;
+            info->function_infos_capacity = capacity;
         }
     }
     else
@@ -832,12 +1592,9 @@ static void update_function_info(QC_SQLITE_INFO* info,
     if (function_infos)
     {
         ss_dassert(item.name);
-        item.name = MXS_STRDUP(item.name);
+        item.name = arena_strdup(&info->arena, item.name);
 
-        if (item.name)
-        {
-            function_infos[info->function_infos_len++] = item;
-        }
+        function_infos[info->function_infos_len++] = item;
     }
 }
 
@@ -1259,76 +2016,238 @@ static void update_field_infos_from_select(QC_SQLITE_INFO* info,
     }
 }
 
-static void update_database_names(QC_SQLITE_INFO* info, const char* zDatabase)
+static void update_database_names(QC_SQLITE_INFO* info, const char* zDatabase)
+{
+    char* zCopy = arena_strdup(&info->arena, zDatabase);
+    exposed_sqlite3Dequote(zCopy);
+
+    enlarge_string_array(&info->arena, 1, info->database_names_len,
+                         &info->database_names, &info->database_names_capacity);
+    info->database_names[info->database_names_len++] = zCopy;
+    info->database_names[info->database_names_len] = NULL;
+}
+
+static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char* zTable)
+{
+    if (!(info->collect & QC_COLLECT_TABLES) || !(info->collect & QC_COLLECT_DATABASES))
+    {
+        // Unless the names are walked from a retained part, they cannot be
+        // collected without parsing again.
+        info->retain = info->retain && info->retaining;
+    }
+
+    if ((info->collect & QC_COLLECT_TABLES) && !(info->collected & QC_COLLECT_TABLES))
+    {
+        char* zCopy = arena_strdup(&info->arena, zTable);
+        // TODO: Is this call really needed. Check also sqlite3Dequote.
+        exposed_sqlite3Dequote(zCopy);
+
+        enlarge_string_array(&info->arena, 1, info->table_names_len,
+                             &info->table_names, &info->table_names_capacity);
+        info->table_names[info->table_names_len++] = zCopy;
+        info->table_names[info->table_names_len] = NULL;
+
+        if (zDatabase)
+        {
+            zCopy = arena_alloc(&info->arena, strlen(zDatabase) + 1 + strlen(zTable) + 1);
+
+            strcpy(zCopy, zDatabase);
+            strcat(zCopy, ".");
+            strcat(zCopy, zTable);
+            exposed_sqlite3Dequote(zCopy);
+        }
+        else
+        {
+            zCopy = arena_strdup(&info->arena, zCopy);
+        }
+
+        enlarge_string_array(&info->arena, 1, info->table_fullnames_len,
+                             &info->table_fullnames, &info->table_fullnames_capacity);
+        info->table_fullnames[info->table_fullnames_len++] = zCopy;
+        info->table_fullnames[info->table_fullnames_len] = NULL;
+    }
+
+    if ((info->collect & QC_COLLECT_DATABASES) && !(info->collected & QC_COLLECT_DATABASES))
+    {
+        if (zDatabase)
+        {
+            update_database_names(info, zDatabase);
+        }
+    }
+}
+
+static void update_names_from_srclist(QC_SQLITE_INFO* info, const SrcList* pSrc)
+{
+    for (int i = 0; i < pSrc->nSrc; ++i)
+    {
+        if (pSrc->a[i].zName)
+        {
+            update_names(info, pSrc->a[i].zDatabase, pSrc->a[i].zName);
+        }
+
+        if (pSrc->a[i].pSelect && pSrc->a[i].pSelect->pSrc)
+        {
+            update_names_from_srclist(info, pSrc->a[i].pSelect->pSrc);
+        }
+    }
+}
+
+static void update_info_from_delete(QC_SQLITE_INFO* info,
+                                    const SrcList* pTabList,
+                                    const Expr* pWhere,
+                                    const SrcList* pUsing)
+{
+    if (pUsing)
+    {
+        // Walk through the using declaration and update
+        // table and database names.
+        for (int i = 0; i < pUsing->nSrc; ++i)
+        {
+            const struct SrcList_item* pItem = &pUsing->a[i];
+
+            update_names(info, pItem->zDatabase, pItem->zName);
+        }
+
+        // Walk through the tablenames while excluding alias
+        // names from the using declaration.
+        for (int i = 0; i < pTabList->nSrc; ++i)
+        {
+            const struct SrcList_item* pTable = &pTabList->a[i];
+            ss_dassert(pTable->zName);
+            int j = 0;
+            bool isSame = false;
+
+            do
+            {
+                const struct SrcList_item* pItem = &pUsing->a[j++];
+
+                if (strcasecmp(pTable->zName, pItem->zName) == 0)
+                {
+                    isSame = true;
+                }
+                else if (pItem->zAlias && (strcasecmp(pTable->zName, pItem->zAlias) == 0))
+                {
+                    isSame = true;
+                }
+            }
+            while (!isSame && (j < pUsing->nSrc));
+
+            if (!isSame)
+            {
+                // No alias name, update the table name.
+                update_names(info, pTable->zDatabase, pTable->zName);
+            }
+        }
+    }
+    else
+    {
+        update_names_from_srclist(info, pTabList);
+    }
+
+    if (pWhere)
+    {
+        update_field_infos(info, 0, pWhere, QC_USED_IN_WHERE, QC_TOKEN_MIDDLE, 0);
+    }
+}
+
+static void update_info_from_insert(QC_SQLITE_INFO* info,
+                                    const SrcList* pTabList,
+                                    const Select* pSelect,
+                                    const IdList* pColumns,
+                                    const ExprList* pSet)
 {
-    char* zCopy = MXS_STRDUP(zDatabase);
-    MXS_ABORT_IF_NULL(zCopy);
-    exposed_sqlite3Dequote(zCopy);
-
-    enlarge_string_array(1, info->database_names_len,
-                         &info->database_names, &info->database_names_capacity);
-    info->database_names[info->database_names_len++] = zCopy;
-    info->database_names[info->database_names_len] = NULL;
-}
+    update_names_from_srclist(info, pTabList);
 
-static void update_names(QC_SQLITE_INFO* info, const char* zDatabase, const char* zTable)
-{
-    if ((info->collect & QC_COLLECT_TABLES) && !(info->collected & QC_COLLECT_TABLES))
+    if (pColumns)
     {
-        char* zCopy = MXS_STRDUP(zTable);
-        MXS_ABORT_IF_NULL(zCopy);
-        // TODO: Is this call really needed. Check also sqlite3Dequote.
-        exposed_sqlite3Dequote(zCopy);
+        update_field_infos_from_idlist(info, pColumns, 0, NULL);
+    }
 
-        enlarge_string_array(1, info->table_names_len, &info->table_names, &info->table_names_capacity);
-        info->table_names[info->table_names_len++] = zCopy;
-        info->table_names[info->table_names_len] = NULL;
+    if (pSelect)
+    {
+        uint32_t usage;
 
-        if (zDatabase)
+        if (pSelect->selFlags & SF_Values) // Synthesized from VALUES clause
         {
-            zCopy = MXS_MALLOC(strlen(zDatabase) + 1 + strlen(zTable) + 1);
-            MXS_ABORT_IF_NULL(zCopy);
-
-            strcpy(zCopy, zDatabase);
-            strcat(zCopy, ".");
-            strcat(zCopy, zTable);
-            exposed_sqlite3Dequote(zCopy);
+            usage = 0;
         }
         else
         {
-            zCopy = MXS_STRDUP(zCopy);
-            MXS_ABORT_IF_NULL(zCopy);
+            usage = QC_USED_IN_SELECT;
         }
 
-        enlarge_string_array(1, info->table_fullnames_len,
-                             &info->table_fullnames, &info->table_fullnames_capacity);
-        info->table_fullnames[info->table_fullnames_len++] = zCopy;
-        info->table_fullnames[info->table_fullnames_len] = NULL;
+        update_field_infos_from_select(info, pSelect, usage, NULL);
     }
 
-    if ((info->collect & QC_COLLECT_DATABASES) && !(info->collected & QC_COLLECT_DATABASES))
+    if (pSet)
     {
-        if (zDatabase)
-        {
-            update_database_names(info, zDatabase);
-        }
+        update_field_infos_from_exprlist(info, pSet, 0, NULL);
     }
 }
 
-static void update_names_from_srclist(QC_SQLITE_INFO* info, const SrcList* pSrc)
+/**
+ * Collects the information that was not collected when the statement was
+ * parsed from the retained parts of the statement. The type mask was fully
+ * determined already, so it is not affected.
+ *
+ * @param info  The info of the statement, with all information to be collected.
+ */
+static void update_info_from_retained(QC_SQLITE_INFO* info)
 {
-    for (int i = 0; i < pSrc->nSrc; ++i)
+    uint32_t type_mask = info->type_mask;
+    bool has_clause = info->has_clause;
+
+    for (const QC_RETAINED* retained = info->retained; retained; retained = retained->next)
     {
-        if (pSrc->a[i].zName)
+        switch (retained->kind)
         {
-            update_names(info, pSrc->a[i].zDatabase, pSrc->a[i].zName);
+        case QC_RETAINED_SELECT:
+            update_field_infos_from_select(info, retained->pSelect, retained->usage, NULL);
+            break;
+
+        case QC_RETAINED_INSERT:
+            update_info_from_insert(info, retained->pTabList, retained->pSelect,
+                                    retained->pColumns, retained->pList);
+            break;
+
+        case QC_RETAINED_UPDATE:
+            update_info_from_update(info, retained->pTabList, retained->pList, retained->pWhere);
+            break;
+
+        case QC_RETAINED_DELETE:
+            update_info_from_delete(info, retained->pTabList, retained->pWhere, retained->pUsing);
+            break;
+
+        default:
+            ss_dassert(!true);
         }
+    }
 
-        if (pSrc->a[i].pSelect && pSrc->a[i].pSelect->pSrc)
+    info->type_mask = type_mask;
+    info->has_clause = has_clause;
+}
+
+static void update_info_from_update(QC_SQLITE_INFO* info,
+                                    const SrcList* pTabList,
+                                    const ExprList* pChanges,
+                                    const Expr* pWhere)
+{
+    update_names_from_srclist(info, pTabList);
+
+    if (pChanges)
+    {
+        for (int i = 0; i < pChanges->nExpr; ++i)
         {
-            update_names_from_srclist(info, pSrc->a[i].pSelect->pSrc);
+            const struct ExprList_item* pItem = &pChanges->a[i];
+
+            update_field_infos(info, 0, pItem->pExpr, QC_USED_IN_SET, QC_TOKEN_MIDDLE, NULL);
         }
     }
+
+    if (pWhere)
+    {
+        update_field_infos(info, 0, pWhere, QC_USED_IN_WHERE, QC_TOKEN_MIDDLE, pChanges);
+    }
 }
 
 /**
@@ -1528,57 +2447,14 @@ void mxs_sqlite3DeleteFrom(Parse* pParse, SrcList* pTabList, Expr* pWhere, SrcLi
     info->operation = QUERY_OP_DELETE;
     info->has_clause = pWhere ? true : false;
 
-    if (pUsing)
-    {
-        // Walk through the using declaration and update
-        // table and database names.
-        for (int i = 0; i < pUsing->nSrc; ++i)
-        {
-            struct SrcList_item* pItem = &pUsing->a[i];
-
-            update_names(info, pItem->zDatabase, pItem->zName);
-        }
-
-        // Walk through the tablenames while excluding alias
-        // names from the using declaration.
-        for (int i = 0; i < pTabList->nSrc; ++i)
-        {
-            const struct SrcList_item* pTable = &pTabList->a[i];
-            ss_dassert(pTable->zName);
-            int j = 0;
-            bool isSame = false;
-
-            do
-            {
-                struct SrcList_item* pItem = &pUsing->a[j++];
-
-                if (strcasecmp(pTable->zName, pItem->zName) == 0)
-                {
-                    isSame = true;
-                }
-                else if (pItem->zAlias && (strcasecmp(pTable->zName, pItem->zAlias) == 0))
-                {
-                    isSame = true;
-                }
-            }
-            while (!isSame && (j < pUsing->nSrc));
-
-            if (!isSame)
-            {
-                // No alias name, update the table name.
-                update_names(info, pTable->zDatabase, pTable->zName);
-            }
-        }
-    }
-    else
+    if (info->retain)
     {
-        update_names_from_srclist(info, pTabList);
+        retain(info, QC_RETAINED_DELETE, 0, NULL, pTabList, pUsing, NULL, NULL, pWhere);
     }
 
-    if (pWhere)
-    {
-        update_field_infos(info, 0, pWhere, QC_USED_IN_WHERE, QC_TOKEN_MIDDLE, 0);
-    }
+    info->retaining = true;
+    update_info_from_delete(info, pTabList, pWhere, pUsing);
+    info->retaining = false;
 
     exposed_sqlite3ExprDelete(pParse->db, pWhere);
     exposed_sqlite3SrcListDelete(pParse->db, pTabList);
@@ -1681,33 +2557,15 @@ void mxs_sqlite3Insert(Parse* pParse,
     info->operation = QUERY_OP_INSERT;
     ss_dassert(pTabList);
     ss_dassert(pTabList->nSrc >= 1);
-    update_names_from_srclist(info, pTabList);
-
-    if (pColumns)
-    {
-        update_field_infos_from_idlist(info, pColumns, 0, NULL);
-    }
 
-    if (pSelect)
+    if (info->retain)
     {
-        uint32_t usage;
-
-        if (pSelect->selFlags & SF_Values) // Synthesized from VALUES clause
-        {
-            usage = 0;
-        }
-        else
-        {
-            usage = QC_USED_IN_SELECT;
-        }
-
-        update_field_infos_from_select(info, pSelect, usage, NULL);
+        retain(info, QC_RETAINED_INSERT, 0, pSelect, pTabList, NULL, pColumns, pSet, NULL);
     }
 
-    if (pSet)
-    {
-        update_field_infos_from_exprlist(info, pSet, 0, NULL);
-    }
+    info->retaining = true;
+    update_info_from_insert(info, pTabList, pSelect, pColumns, pSet);
+    info->retaining = false;
 
     exposed_sqlite3SrcListDelete(pParse->db, pTabList);
     exposed_sqlite3IdListDelete(pParse->db, pColumns);
@@ -1804,8 +2662,7 @@ void mxs_sqlite3StartTable(Parse *pParse,   /* Parser context */
             // this information already.
             if (!info->created_table_name)
             {
-                info->created_table_name = MXS_STRDUP(info->table_names[0]);
-                MXS_ABORT_IF_NULL(info->created_table_name);
+                info->created_table_name = arena_strdup(&info->arena, info->table_names[0]);
             }
             else
             {
@@ -1830,23 +2687,16 @@ void mxs_sqlite3Update(Parse* pParse, SrcList* pTabList, ExprList* pChanges, Exp
     info->status = QC_QUERY_PARSED;
     info->type_mask = QUERY_TYPE_WRITE;
     info->operation = QUERY_OP_UPDATE;
-    update_names_from_srclist(info, pTabList);
     info->has_clause = (pWhere ? true : false);
 
-    if (pChanges)
+    if (info->retain)
     {
-        for (int i = 0; i < pChanges->nExpr; ++i)
-        {
-            struct ExprList_item* pItem = &pChanges->a[i];
-
-            update_field_infos(info, 0, pItem->pExpr, QC_USED_IN_SET, QC_TOKEN_MIDDLE, NULL);
-        }
+        retain(info, QC_RETAINED_UPDATE, 0, NULL, pTabList, NULL, NULL, pChanges, pWhere);
     }
 
-    if (pWhere)
-    {
-        update_field_infos(info, 0, pWhere, QC_USED_IN_WHERE, QC_TOKEN_MIDDLE, pChanges);
-    }
+    info->retaining = true;
+    update_info_from_update(info, pTabList, pChanges, pWhere);
+    info->retaining = false;
 
     exposed_sqlite3SrcListDelete(pParse->db, pTabList);
     exposed_sqlite3ExprListDelete(pParse->db, pChanges);
@@ -1884,7 +2734,14 @@ void maxscaleCollectInfoFromSelect(Parse* pParse, Select* pSelect, int sub_selec
 
     uint32_t usage = sub_select ? QC_USED_IN_SUBSELECT : QC_USED_IN_SELECT;
 
+    if (info->retain)
+    {
+        retain(info, QC_RETAINED_SELECT, usage, pSelect, NULL, NULL, NULL, NULL, NULL);
+    }
+
+    info->retaining = true;
     update_field_infos_from_select(info, pSelect, usage, NULL);
+    info->retaining = false;
 }
 
 void maxscaleAlterTable(Parse *pParse,            /* Parser context. */
@@ -1978,12 +2835,7 @@ void maxscaleDeallocate(Parse* pParse, Token* pName)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
-        if (info->prepare_name)
-        {
-            memcpy(info->prepare_name, pName->z, pName->n);
-            info->prepare_name[pName->n] = 0;
-        }
+        info->prepare_name = arena_strndup(&info->arena, pName->z, pName->n);
     }
     else
     {
@@ -2031,12 +2883,7 @@ void maxscaleExecute(Parse* pParse, Token* pName)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
-        if (info->prepare_name)
-        {
-            memcpy(info->prepare_name, pName->z, pName->n);
-            info->prepare_name[pName->n] = 0;
-        }
+        info->prepare_name = arena_strndup(&info->arena, pName->z, pName->n);
     }
     else
     {
@@ -2411,12 +3258,7 @@ void maxscalePrepare(Parse* pParse, Token* pName, Token* pStmt)
     // this information already.
     if (!info->prepare_name)
     {
-        info->prepare_name = MXS_MALLOC(pName->n + 1);
-        if (info->prepare_name)
-        {
-            memcpy(info->prepare_name, pName->z, pName->n);
-            info->prepare_name[pName->n] = 0;
-        }
+        info->prepare_name = arena_strndup(&info->arena, pName->z, pName->n);
 
         size_t preparable_stmt_len = pStmt->n - 2;
         size_t payload_len = 1 + preparable_stmt_len;
@@ -2907,6 +3749,8 @@ static int32_t qc_sqlite_get_canonical(GWBUF* query, char** canonical);
 static int32_t qc_sqlite_query_has_clause(GWBUF* query, int32_t* has_clause);
 static int32_t qc_sqlite_get_database_names(GWBUF* query, char*** names, int* sizep);
 static int32_t qc_sqlite_get_preparable_stmt(GWBUF* stmt, GWBUF** preparable_stmt);
+static int32_t qc_sqlite_get_cache_stats(QC_CACHE_STATS* stats);
+static int32_t qc_sqlite_get_statement_types(GWBUF* query, uint32_t** type_masks, int32_t* n_stmts);
 
 static bool get_key_and_value(char* arg, const char** pkey, const char** pvalue)
 {
@@ -2924,6 +3768,7 @@ static bool get_key_and_value(char* arg, const char** pkey, const char** pvalue)
 }
 
 static char ARG_LOG_UNRECOGNIZED_STATEMENTS[] = "log_unrecognized_statements";
+static char ARG_CACHE_SIZE[] = "cache_size";
 
 static int32_t qc_sqlite_setup(const char* args)
 {
@@ -2931,46 +3776,64 @@ static int32_t qc_sqlite_setup(const char* args)
     assert(!this_unit.setup);
 
     qc_log_level_t log_level = QC_LOG_NOTHING;
+    long cache_size = QC_CACHE_DEFAULT_SIZE;
 
     if (args)
     {
-        char arg[strlen(args) + 1];
-        strcpy(arg, args);
+        char arg_list[strlen(args) + 1];
+        strcpy(arg_list, args);
 
-        const char* key;
-        const char* value;
+        char* saveptr;
 
-        if (get_key_and_value(arg, &key, &value))
+        for (char* arg = strtok_r(arg_list, ",", &saveptr); arg; arg = strtok_r(NULL, ",", &saveptr))
         {
-            if (strcmp(key, ARG_LOG_UNRECOGNIZED_STATEMENTS) == 0)
+            const char* key;
+            const char* value;
+
+            if (get_key_and_value(arg, &key, &value))
             {
                 char *end;
 
                 long l = strtol(value, &end, 0);
 
-                if ((*end == 0) && (l >= QC_LOG_NOTHING) && (l <= QC_LOG_NON_TOKENIZED))
+                if (strcmp(key, ARG_LOG_UNRECOGNIZED_STATEMENTS) == 0)
+                {
+                    if ((*end == 0) && (l >= QC_LOG_NOTHING) && (l <= QC_LOG_NON_TOKENIZED))
+                    {
+                        log_level = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("'%s' is not a number between %d and %d.",
+                                    value, QC_LOG_NOTHING, QC_LOG_NON_TOKENIZED);
+                    }
+                }
+                else if (strcmp(key, ARG_CACHE_SIZE) == 0)
                 {
-                    log_level = l;
+                    if ((*end == 0) && (l >= 0))
+                    {
+                        cache_size = l;
+                    }
+                    else
+                    {
+                        MXS_WARNING("'%s' is not a non-negative number.", value);
+                    }
                 }
                 else
                 {
-                    MXS_WARNING("'%s' is not a number between %d and %d.",
-                                value, QC_LOG_NOTHING, QC_LOG_NON_TOKENIZED);
+                    MXS_WARNING("'%s' is not a recognized argument.", key);
                 }
             }
             else
             {
-                MXS_WARNING("'%s' is not a recognized argument.", key);
+                MXS_WARNING("'%s' is not a recognized argument string.", arg);
             }
         }
-        else
-        {
-            MXS_WARNING("'%s' is not a recognized argument string.", args);
-        }
     }
 
     this_unit.setup = true;
     this_unit.log_level = log_level;
+    this_unit.cache_size = cache_size;
 
     return this_unit.setup ? QC_RESULT_OK : QC_RESULT_ERROR;
 }
@@ -2981,6 +3844,23 @@ static int32_t qc_sqlite_process_init(void)
     assert(this_unit.setup);
     assert(!this_unit.initialized);
 
+    if (this_unit.cache_size != 0 &&
+        ((this_unit.cache_entries = ts_stats_alloc()) == NULL ||
+         (this_unit.cache_hits = ts_stats_alloc()) == NULL ||
+         (this_unit.cache_misses = ts_stats_alloc()) == NULL))
+    {
+        MXS_WARNING("Could not allocate the statistics of the classification cache, "
+                    "the cache is disabled.");
+        ts_stats_free(this_unit.cache_entries);
+        ts_stats_free(this_unit.cache_hits);
+        this_unit.cache_size = 0;
+    }
+
+    if (sqlite3_config(SQLITE_CONFIG_LOOKASIDE, QC_LOOKASIDE_SLOT_SIZE, QC_LOOKASIDE_SLOTS) != SQLITE_OK)
+    {
+        MXS_WARNING("Could not configure the lookaside memory of sqlite, the default is used.");
+    }
+
     if (sqlite3_initialize() == 0)
     {
         init_builtin_functions();
@@ -3040,6 +3920,16 @@ static void qc_sqlite_process_end(void)
 
     sqlite3_shutdown();
     this_unit.initialized = false;
+
+    if (this_unit.cache_size != 0)
+    {
+        ts_stats_free(this_unit.cache_entries);
+        ts_stats_free(this_unit.cache_hits);
+        ts_stats_free(this_unit.cache_misses);
+        this_unit.cache_entries = NULL;
+        this_unit.cache_hits = NULL;
+        this_unit.cache_misses = NULL;
+    }
 }
 
 static int32_t qc_sqlite_thread_init(void)
@@ -3080,6 +3970,12 @@ static int32_t qc_sqlite_thread_init(void)
             this_thread.info = NULL;
 
             this_thread.initialized = true;
+
+            if (this_unit.cache_size != 0 && !cache_init(&this_thread.cache, this_unit.cache_size))
+            {
+                MXS_WARNING("Could not allocate the classification cache of thread %lu.",
+                            (unsigned long) pthread_self());
+            }
         }
         else
         {
@@ -3113,6 +4009,8 @@ static void qc_sqlite_thread_end(void)
 
     this_thread.db = NULL;
     this_thread.initialized = false;
+
+    cache_finish(&this_thread.cache);
 }
 
 static int32_t qc_sqlite_parse(GWBUF* query, uint32_t collect, int32_t* result)
@@ -3522,6 +4420,119 @@ int32_t qc_sqlite_get_preparable_stmt(GWBUF* stmt, GWBUF** preparable_stmt)
     return rv;
 }
 
+/**
+ * Classifies the statements of a query containing several statements one
+ * after the other, continuing parsing from where the previous statement ended.
+ *
+ * @param query          The query.
+ * @param len            The length of the query.
+ * @param ppType_masks   On return, the type masks of the statements.
+ * @param pn_type_masks  On return, the number of statements.
+ */
+static void classify_statements(const char* query, size_t len,
+                                uint32_t** ppType_masks, int32_t* pn_type_masks)
+{
+    const char* end = query + len;
+    uint32_t* type_masks = NULL;
+    size_t capacity = 0;
+    int32_t n = 0;
+
+    while (more_statements(query, end))
+    {
+        QC_SQLITE_INFO info;
+        info_init(&info, QC_COLLECT_ESSENTIALS);
+        arena_init(&info.arena, NULL, 0);
+
+        this_thread.info = &info;
+        info.query = query;
+        info.query_len = end - query;
+        const char* tail = parse_query_string(query, end - query);
+        this_thread.info = NULL;
+
+        if ((size_t)n == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 4;
+            type_masks = MXS_REALLOC(type_masks, capacity * sizeof(uint32_t));
+            MXS_ABORT_IF_NULL(type_masks);
+        }
+
+        type_masks[n++] = info.type_mask;
+
+        info_finish(&info);
+
+        if (tail <= query)
+        {
+            // Sqlite3 gave up before the end of the statement, so we continue
+            // after the next semicolon.
+            tail = strnchr_esc_mysql((char*)query, ';', end - query);
+            tail = tail ? tail + 1 : end;
+        }
+
+        query = tail;
+    }
+
+    *ppType_masks = type_masks;
+    *pn_type_masks = n;
+}
+
+static int32_t qc_sqlite_get_statement_types(GWBUF* query, uint32_t** type_masks, int32_t* n_stmts)
+{
+    QC_TRACE();
+    int32_t rv = QC_RESULT_ERROR;
+    ss_dassert(this_unit.initialized);
+    ss_dassert(this_thread.initialized);
+
+    *type_masks = NULL;
+    *n_stmts = 0;
+    QC_SQLITE_INFO* info = get_query_info(query, QC_COLLECT_ESSENTIALS);
+
+    if (info)
+    {
+        if (!info->multiple)
+        {
+            // The classification of the first statement is that of the query.
+            *type_masks = MXS_MALLOC(sizeof(uint32_t));
+            MXS_ABORT_IF_NULL(*type_masks);
+            **type_masks = info->type_mask;
+            *n_stmts = 1;
+        }
+        else
+        {
+            const uint8_t* data = GWBUF_DATA(query);
+            size_t len = MYSQL_GET_PAYLOAD_LEN(data) - 1;
+            const char* s = (const char*) &data[MYSQL_HEADER_LEN + 1];
+
+            classify_statements(s, len, type_masks, n_stmts);
+        }
+
+        rv = QC_RESULT_OK;
+    }
+    else
+    {
+        MXS_ERROR("The query could not be parsed. Response not valid.");
+    }
+
+    return rv;
+}
+
+static int32_t qc_sqlite_get_cache_stats(QC_CACHE_STATS* stats)
+{
+    QC_TRACE();
+    ss_dassert(this_unit.initialized);
+
+    int32_t rv = QC_RESULT_ERROR;
+
+    if (this_unit.cache_size != 0)
+    {
+        stats->size = ts_stats_sum(this_unit.cache_entries);
+        stats->hits = ts_stats_sum(this_unit.cache_hits);
+        stats->misses = ts_stats_sum(this_unit.cache_misses);
+        rv = QC_RESULT_OK;
+    }
+
+    return rv;
+}
+
 /**
  * EXPORTS
  */
@@ -3548,6 +4559,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         qc_sqlite_get_field_info,
         qc_sqlite_get_function_info,
         qc_sqlite_get_preparable_stmt,
+        qc_sqlite_get_cache_stats,
+        qc_sqlite_get_statement_types,
     };
 
     static MXS_MODULE info =
@@ -1199,6 +1199,9 @@ void sqlite3LeaveMutexAndCloseZombie(sqlite3 *db){
   if( db->lookaside.bMalloced ){
     sqlite3_free(db->lookaside.pStart);
   }
+#ifdef MAXSCALE
+  sqlite3_free(db->pParser);
+#endif
   sqlite3_free(db);
 }
 
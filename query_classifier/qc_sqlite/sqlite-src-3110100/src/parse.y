@@ -154,6 +154,55 @@ void exposed_sqlite3SrcListDelete(sqlite3 *db, SrcList *pList)
   sqlite3SrcListDelete(db, pList);
 }
 
+/*
+** The copies are made with lookaside disabled so that they are allocated
+** from the heap and can later be deleted using a NULL database handle.
+*/
+Expr* exposed_sqlite3ExprDup(sqlite3 *db, Expr *pExpr)
+{
+  Expr *pNew;
+  db->lookaside.bDisable++;
+  pNew = sqlite3ExprDup(db, pExpr, 0);
+  db->lookaside.bDisable--;
+  return pNew;
+}
+
+ExprList* exposed_sqlite3ExprListDup(sqlite3 *db, ExprList *pList)
+{
+  ExprList *pNew;
+  db->lookaside.bDisable++;
+  pNew = sqlite3ExprListDup(db, pList, 0);
+  db->lookaside.bDisable--;
+  return pNew;
+}
+
+IdList* exposed_sqlite3IdListDup(sqlite3 *db, IdList *pList)
+{
+  IdList *pNew;
+  db->lookaside.bDisable++;
+  pNew = sqlite3IdListDup(db, pList);
+  db->lookaside.bDisable--;
+  return pNew;
+}
+
+Select* exposed_sqlite3SelectDup(sqlite3 *db, Select *p)
+{
+  Select *pNew;
+  db->lookaside.bDisable++;
+  pNew = sqlite3SelectDup(db, p, 0);
+  db->lookaside.bDisable--;
+  return pNew;
+}
+
+SrcList* exposed_sqlite3SrcListDup(sqlite3 *db, SrcList *pList)
+{
+  SrcList *pNew;
+  db->lookaside.bDisable++;
+  pNew = sqlite3SrcListDup(db, pList, 0);
+  db->lookaside.bDisable--;
+  return pNew;
+}
+
 
 // Exposed SQL functions.
 void exposed_sqlite3BeginTrigger(Parse *pParse,      /* The parse context of the CREATE TRIGGER statement */
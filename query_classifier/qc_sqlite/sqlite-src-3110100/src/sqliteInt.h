@@ -1274,6 +1274,9 @@ struct sqlite3 {
 #ifdef SQLITE_USER_AUTHENTICATION
   sqlite3_userauth auth;        /* User authentication information */
 #endif
+#ifdef MAXSCALE
+  void *pParser;                /* The parser engine kept for the next statement */
+#endif
 };
 
 /*
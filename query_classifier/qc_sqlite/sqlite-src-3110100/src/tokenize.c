@@ -594,6 +594,15 @@ int sqlite3GetToken(const unsigned char *z, int *tokenType){
   return i;
 }
 
+#ifdef MAXSCALE
+/*
+** The free function of a parser engine that is kept for reuse.
+*/
+static void mxsNoopFree(void *p){
+  UNUSED_PARAMETER(p);
+}
+
+#endif
 /*
 ** Run the parser on the given SQL string.  The parser structure is
 ** passed in.  An SQLITE_ status code is returned.  If an error occurs
@@ -620,7 +629,17 @@ int sqlite3RunParser(Parse *pParse, const char *zSql, char **pzErrMsg){
   i = 0;
   assert( pzErrMsg!=0 );
   /* sqlite3ParserTrace(stdout, "parser: "); */
+#ifdef MAXSCALE
+  /* The engine of the previous statement is reused. It is not there
+  ** for the first statement of the connection or for a nested parse. */
+  pEngine = db->pParser;
+  db->pParser = 0;
+  if( pEngine==0 ){
+    pEngine = sqlite3ParserAlloc(sqlite3Malloc);
+  }
+#else
   pEngine = sqlite3ParserAlloc(sqlite3Malloc);
+#endif
   if( pEngine==0 ){
     sqlite3OomFault(db);
     return SQLITE_NOMEM;
@@ -679,7 +698,17 @@ int sqlite3RunParser(Parse *pParse, const char *zSql, char **pzErrMsg){
   );
   sqlite3_mutex_leave(sqlite3MallocMutex());
 #endif /* YYDEBUG */
+#ifdef MAXSCALE
+  if( db->pParser==0 ){
+    /* Popping the stack leaves the engine as a new one. */
+    sqlite3ParserFree(pEngine, mxsNoopFree);
+    db->pParser = pEngine;
+  }else{
+    sqlite3ParserFree(pEngine, sqlite3_free);
+  }
+#else
   sqlite3ParserFree(pEngine, sqlite3_free);
+#endif
   if( db->mallocFailed ){
     pParse->rc = SQLITE_NOMEM;
   }
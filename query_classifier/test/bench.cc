@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <unistd.h>
+#include <time.h>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <maxscale/paths.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include "testreader.hh"
+using std::cerr;
+using std::cin;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::istream;
+using std::string;
+using std::vector;
+
+/**
+ * The allocations are counted by interposing the allocation functions of the
+ * C library. The classifier plugins are shared objects, so their allocations
+ * end up here as well. Only the allocations made while a statement is being
+ * classified are counted, and only by the thread that classifies it.
+ */
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nmemb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+static __thread bool   this_thread_counting = false;
+static __thread size_t this_thread_allocations = 0;
+
+void* malloc(size_t size)
+{
+    if (this_thread_counting)
+    {
+        ++this_thread_allocations;
+    }
+
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    if (this_thread_counting)
+    {
+        ++this_thread_allocations;
+    }
+
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (this_thread_counting)
+    {
+        ++this_thread_allocations;
+    }
+
+    return __libc_realloc(ptr, size);
+}
+}
+
+namespace
+{
+
+char USAGE[] =
+    "usage: bench [-c classifier[:args]]... [-t threads] [-r rounds] [-a] "
+        "[-q fields] [-s statement]|[file]\n\n"
+    "-c    a classifier to benchmark, can be given several times, default qc_sqlite\n"
+    "-t    the number of threads classifying the statements, default 1\n"
+    "-r    how many times each thread classifies every statement, default 1\n"
+    "-a    collect all information and not only the essentials\n"
+    "-q    the file is a qlafilter log whose lines have the specified number of\n"
+    "      fields before the query; the default log format has two\n"
+    "-s    benchmark a single statement\n\n"
+    "If no file is given, the statements are read from stdin. The file is read\n"
+    "as a MySQL test file unless -q is given.\n";
+
+struct Statistics
+{
+    Statistics()
+        : n_statements(0)
+        , n_allocations(0)
+    {
+    }
+
+    size_t           n_statements;
+    size_t           n_allocations;
+    vector<uint64_t> latencies; /*< Nanoseconds per classified statement. */
+};
+
+GWBUF* create_gwbuf(const string& s)
+{
+    size_t len = s.length();
+    size_t payload_len = len + 1;
+    size_t gwbuf_len = MYSQL_HEADER_LEN + payload_len;
+
+    GWBUF* gwbuf = gwbuf_alloc(gwbuf_len);
+
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf))) = payload_len;
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 1)) = (payload_len >> 8);
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 2)) = (payload_len >> 16);
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 3)) = 0x00;
+    *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 4)) = 0x03;
+    memcpy((char*)GWBUF_DATA(gwbuf) + 5, s.c_str(), len);
+
+    return gwbuf;
+}
+
+inline uint64_t now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Read the statements of a MySQL test file.
+ */
+void read_test_file(istream& in, vector<string>* pStatements)
+{
+    maxscale::TestReader reader(in);
+
+    string stmt;
+
+    while (reader.get_statement(stmt) == maxscale::TestReader::RESULT_STMT)
+    {
+        pStatements->push_back(stmt);
+        stmt.clear();
+    }
+}
+
+/**
+ * Read the statements of a qlafilter log. The statements are the last
+ * field of each line and may themselves contain commas.
+ */
+void read_qla_log(istream& in, size_t n_fields, vector<string>* pStatements)
+{
+    string line;
+
+    while (std::getline(in, line))
+    {
+        size_t pos = 0;
+
+        for (size_t i = 0; (i < n_fields) && (pos != string::npos); ++i)
+        {
+            pos = line.find(',', pos);
+
+            if (pos != string::npos)
+            {
+                ++pos;
+            }
+        }
+
+        if ((pos != string::npos) && (pos < line.length()))
+        {
+            pStatements->push_back(line.substr(pos));
+        }
+    }
+}
+
+QUERY_CLASSIFIER* get_classifier(const string& name, const char* zArgs)
+{
+    string libdir = "../" + name;
+
+    set_libdir(strdup(libdir.c_str()));
+
+    QUERY_CLASSIFIER* pClassifier = qc_load(name.c_str());
+
+    if (pClassifier)
+    {
+        if ((pClassifier->qc_setup(zArgs) != QC_RESULT_OK) ||
+            ((pClassifier->qc_process_init() != QC_RESULT_OK)))
+        {
+            cerr << "error: Could not setup or init classifier " << name << "." << endl;
+            qc_unload(pClassifier);
+            pClassifier = 0;
+        }
+    }
+    else
+    {
+        cerr << "error: Could not load classifier " << name << "." << endl;
+    }
+
+    return pClassifier;
+}
+
+void put_classifier(QUERY_CLASSIFIER* pClassifier)
+{
+    pClassifier->qc_process_end();
+    qc_unload(pClassifier);
+}
+
+/**
+ * Classify every statement a number of times in a thread of its own.
+ */
+void classify(QUERY_CLASSIFIER* pClassifier,
+              const vector<string>* pStatements,
+              size_t rounds,
+              uint32_t collect,
+              Statistics* pStats)
+{
+    if (pClassifier->qc_thread_init() != QC_RESULT_OK)
+    {
+        cerr << "error: Could not initialize classifier thread." << endl;
+        return;
+    }
+
+    pStats->latencies.reserve(rounds * pStatements->size());
+
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        for (vector<string>::const_iterator i = pStatements->begin(); i != pStatements->end(); ++i)
+        {
+            GWBUF* pStmt = create_gwbuf(*i);
+            int32_t result;
+            uint32_t type_mask;
+
+            this_thread_allocations = 0;
+            this_thread_counting = true;
+            uint64_t start = now();
+
+            pClassifier->qc_parse(pStmt, collect, &result);
+            pClassifier->qc_get_type_mask(pStmt, &type_mask);
+
+            uint64_t end = now();
+            this_thread_counting = false;
+
+            pStats->latencies.push_back(end - start);
+            pStats->n_allocations += this_thread_allocations;
+            ++pStats->n_statements;
+
+            gwbuf_free(pStmt);
+        }
+    }
+
+    pClassifier->qc_thread_end();
+}
+
+uint64_t percentile(const vector<uint64_t>& sorted, size_t p)
+{
+    size_t i = std::min(sorted.size() * p / 100, sorted.size() - 1);
+
+    return sorted[i];
+}
+
+int run(const string& name, const char* zArgs,
+        const vector<string>& statements,
+        size_t n_threads, size_t rounds, uint32_t collect)
+{
+    QUERY_CLASSIFIER* pClassifier = get_classifier(name, zArgs);
+
+    if (!pClassifier)
+    {
+        return EXIT_FAILURE;
+    }
+
+    vector<Statistics> stats(n_threads);
+    vector<std::thread> threads;
+
+    uint64_t start = now();
+
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        threads.push_back(std::thread(classify, pClassifier, &statements, rounds, collect, &stats[i]));
+    }
+
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        threads[i].join();
+    }
+
+    uint64_t duration = now() - start;
+
+    put_classifier(pClassifier);
+
+    Statistics total;
+
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        total.n_statements += stats[i].n_statements;
+        total.n_allocations += stats[i].n_allocations;
+        total.latencies.insert(total.latencies.end(),
+                               stats[i].latencies.begin(), stats[i].latencies.end());
+    }
+
+    if (total.n_statements != n_threads * rounds * statements.size())
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::sort(total.latencies.begin(), total.latencies.end());
+
+    double seconds = (double)duration / 1000000000;
+
+    cout << name << ": " << total.n_statements << " statements, "
+         << n_threads << " threads, " << std::fixed << std::setprecision(3)
+         << seconds << "s" << endl;
+    cout << "  Statements/s      : " << std::setprecision(0)
+         << total.n_statements / seconds << endl;
+    cout << "  Allocations/stmt  : " << std::setprecision(2)
+         << (double)total.n_allocations / total.n_statements << endl;
+    cout << "  p50 latency (us)  : " << std::setprecision(2)
+         << (double)percentile(total.latencies, 50) / 1000 << endl;
+    cout << "  p99 latency (us)  : " << std::setprecision(2)
+         << (double)percentile(total.latencies, 99) / 1000 << endl;
+
+    return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    vector<string> classifiers;
+    const char* zStatement = NULL;
+    size_t n_threads = 1;
+    size_t rounds = 1;
+    uint32_t collect = QC_COLLECT_ESSENTIALS;
+    bool qla_log = false;
+    size_t n_qla_fields = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:t:r:aq:s:")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            classifiers.push_back(optarg);
+            break;
+
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+
+        case 'a':
+            collect = QC_COLLECT_ALL;
+            break;
+
+        case 'q':
+            qla_log = true;
+            n_qla_fields = atoi(optarg);
+            break;
+
+        case 's':
+            zStatement = optarg;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+            break;
+        };
+    }
+
+    int n = argc - optind;
+
+    if ((rc == EXIT_SUCCESS) && (n <= 1) && (n_threads > 0) && (rounds > 0))
+    {
+        vector<string> statements;
+
+        if (zStatement)
+        {
+            statements.push_back(zStatement);
+        }
+        else if (n == 0)
+        {
+            qla_log ? read_qla_log(cin, n_qla_fields, &statements) : read_test_file(cin, &statements);
+        }
+        else
+        {
+            ifstream in(argv[optind]);
+
+            if (in)
+            {
+                qla_log ? read_qla_log(in, n_qla_fields, &statements) : read_test_file(in, &statements);
+            }
+            else
+            {
+                cerr << "error: Could not open " << argv[optind] << "." << endl;
+                rc = EXIT_FAILURE;
+            }
+        }
+
+        if (rc == EXIT_SUCCESS && statements.empty())
+        {
+            cerr << "error: No statements to classify." << endl;
+            rc = EXIT_FAILURE;
+        }
+
+        if (classifiers.empty())
+        {
+            classifiers.push_back("qc_sqlite");
+        }
+
+        if (rc == EXIT_SUCCESS)
+        {
+            set_datadir(strdup("/tmp"));
+            set_langdir(strdup("."));
+            set_process_datadir(strdup("/tmp"));
+
+            if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+            {
+                for (vector<string>::iterator i = classifiers.begin(); i != classifiers.end(); ++i)
+                {
+                    string name = *i;
+                    string args;
+                    size_t colon = name.find(':');
+
+                    if (colon != string::npos)
+                    {
+                        args = name.substr(colon + 1);
+                        name = name.substr(0, colon);
+                    }
+
+                    if (run(name, args.empty() ? NULL : args.c_str(),
+                            statements, n_threads, rounds, collect) != EXIT_SUCCESS)
+                    {
+                        rc = EXIT_FAILURE;
+                    }
+                }
+
+                mxs_log_finish();
+            }
+            else
+            {
+                cerr << "error: Could not initialize log." << endl;
+                rc = EXIT_FAILURE;
+            }
+        }
+    }
+    else
+    {
+        cout << USAGE << endl;
+        rc = EXIT_FAILURE;
+    }
+
+    return rc;
+}
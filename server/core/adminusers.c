@@ -325,20 +325,20 @@ void dcb_print_users(DCB *dcb, const char* heading, USERS *users)
 
     if (users)
     {
-        HASHITERATOR *iter = hashtable_iterator(users->data);
+        LFHASHITERATOR *iter = lfhash_iterator(users->data);
 
         if (iter)
         {
             char *sep = "";
             const char *user;
 
-            while ((user = hashtable_next(iter)) != NULL)
+            while ((user = lfhash_next(iter)) != NULL)
             {
                 dcb_printf(dcb, "%s%s", sep, user);
                 sep = ", ";
             }
 
-            hashtable_iterator_free(iter);
+            lfhash_iterator_free(iter);
         }
     }
 
@@ -11,9 +11,497 @@
  * Public License.
  */
 
-#include <maxscale/alloc.h>
+#include "maxscale/alloc.h"
+
+#include <execinfo.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+#include <maxscale/spinlock.h>
+
+#include "maxscale/config.h"
+
+/** The most modules the allocations are accounted to, the rest are accounted to the core */
+#define ALLOC_MAX_MODULES 128
+
+/** Size of the per-thread cache of module slots, a power of 2 */
+#define ALLOC_CACHE_SIZE  64
+
+/** The most stacks that are recorded, the samples of other stacks are dropped */
+#define ALLOC_MAX_STACKS  256
+
+/** The most frames recorded for a stack */
+#define ALLOC_STACK_DEPTH 16
+
+/** The number of sampled stacks that are printed */
+#define ALLOC_PRINT_STACKS 10
+
+/**
+ * The allocations of one thread. The blocks of exited threads are reused by
+ * new threads so the counts are not lost.
+ */
+typedef struct alloc_thread
+{
+    struct alloc_thread *next;                          /**< The next block in alloc_threads */
+    bool                 in_use;                        /**< Whether a thread uses the block */
+    const char          *cache_names[ALLOC_CACHE_SIZE]; /**< Module names seen by the thread */
+    int                  cache_slots[ALLOC_CACHE_SIZE]; /**< The slots of cache_names */
+    uint64_t             unsampled;                     /**< Bytes allocated since the last sample */
+    ALLOC_STATS          stats[ALLOC_MAX_MODULES];      /**< The allocations of each module */
+} ALLOC_THREAD;
+
+/**
+ * A sampled allocation stack
+ */
+typedef struct alloc_stack
+{
+    uint32_t hash;                       /**< Hash of the frames, 0 if the entry is unused */
+    int      slot;                       /**< The module of the allocation */
+    int      depth;                      /**< Number of frames */
+    void    *frames[ALLOC_STACK_DEPTH];  /**< The return addresses */
+    uint64_t samples;                    /**< Number of sampled allocations */
+    uint64_t bytes;                      /**< Bytes of the sampled allocations */
+} ALLOC_STACK;
+
+/**
+ * The allocations of a module summed over all threads
+ */
+typedef struct alloc_sum
+{
+    const char *module;
+    ALLOC_STATS stats;
+} ALLOC_SUM;
+
+bool alloc_accounting_active = false;
+
+static uint64_t sample_interval = 0;
+static SPINLOCK alloc_lock = SPINLOCK_INIT;
+static const char *module_names[ALLOC_MAX_MODULES] = {"core"};
+static int n_modules = 1;
+static ALLOC_THREAD *alloc_threads = NULL;
+static pthread_key_t alloc_thread_key;
+static ALLOC_STACK alloc_stacks[ALLOC_MAX_STACKS];
+static uint64_t dropped_samples = 0;
+static thread_local ALLOC_THREAD *alloc_thread = NULL;
+
+/**
+ * Release the block of an exiting thread for reuse
+ */
+static void alloc_thread_release(void *data)
+{
+    ALLOC_THREAD *thr = (ALLOC_THREAD*)data;
+    spinlock_acquire(&alloc_lock);
+    thr->in_use = false;
+    spinlock_release(&alloc_lock);
+    alloc_thread = NULL;
+}
+
+/**
+ * Get the block of the calling thread
+ *
+ * The blocks are allocated with calloc as they must not be accounted.
+ *
+ * @return The block or NULL if memory allocation failed
+ */
+static ALLOC_THREAD* alloc_thread_get()
+{
+    if (alloc_thread == NULL)
+    {
+        ALLOC_THREAD *thr;
+        spinlock_acquire(&alloc_lock);
+
+        for (thr = alloc_threads; thr && thr->in_use; thr = thr->next)
+        {
+            ;
+        }
+
+        if (thr == NULL && (thr = (ALLOC_THREAD*)calloc(1, sizeof(ALLOC_THREAD))))
+        {
+            thr->next = alloc_threads;
+            alloc_threads = thr;
+        }
+
+        if (thr)
+        {
+            thr->in_use = true;
+        }
+
+        spinlock_release(&alloc_lock);
+
+        if (thr)
+        {
+            alloc_thread = thr;
+            pthread_setspecific(alloc_thread_key, thr);
+        }
+    }
+
+    return alloc_thread;
+}
+
+/**
+ * Find the slot of a module or add the module to the table
+ *
+ * The caller must hold alloc_lock.
+ *
+ * @return The slot, 0 for the core or if the table is full
+ */
+static int alloc_find_slot(const char *module, bool add)
+{
+    if (module == NULL)
+    {
+        return 0;
+    }
+
+    for (int i = 1; i < n_modules; i++)
+    {
+        if (strcmp(module_names[i], module) == 0)
+        {
+            return i;
+        }
+    }
+
+    if (add && n_modules < ALLOC_MAX_MODULES && (module_names[n_modules] = strdup(module)))
+    {
+        return n_modules++;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the slot of a module
+ *
+ * The names are string literals, so the slot of a name is cached by the
+ * address of the name.
+ */
+static inline int alloc_slot(ALLOC_THREAD *thr, const char *module)
+{
+    if (module == NULL)
+    {
+        return 0;
+    }
+
+    int i = ((uintptr_t)module >> 3) & (ALLOC_CACHE_SIZE - 1);
+
+    if (thr->cache_names[i] != module)
+    {
+        spinlock_acquire(&alloc_lock);
+        thr->cache_slots[i] = alloc_find_slot(module, true);
+        spinlock_release(&alloc_lock);
+        thr->cache_names[i] = module;
+    }
+
+    return thr->cache_slots[i];
+}
+
+/**
+ * Record the stack of an allocation
+ *
+ * Not inlined, so that the first frame of the stack is always this function.
+ */
+static void __attribute__((noinline)) alloc_sample(int slot, size_t size)
+{
+    void *frames[ALLOC_STACK_DEPTH + 1];
+    int depth = backtrace(frames, ALLOC_STACK_DEPTH + 1) - 1;
+
+    if (depth <= 0)
+    {
+        return;
+    }
+
+    uint32_t hash = 2166136261u ^ slot;
+
+    for (int i = 0; i < depth; i++)
+    {
+        hash = (hash ^ (uint32_t)((uintptr_t)frames[i + 1] >> 2)) * 16777619u;
+    }
+
+    hash = hash ? hash : 1;
+    spinlock_acquire(&alloc_lock);
+
+    for (int n = 0, i = hash % ALLOC_MAX_STACKS; n < ALLOC_MAX_STACKS; n++, i = (i + 1) % ALLOC_MAX_STACKS)
+    {
+        ALLOC_STACK *entry = &alloc_stacks[i];
+
+        if (entry->hash == 0)
+        {
+            entry->hash = hash;
+            entry->slot = slot;
+            entry->depth = depth;
+            memcpy(entry->frames, frames + 1, depth * sizeof(void*));
+        }
+        else if (entry->hash != hash || entry->slot != slot || entry->depth != depth ||
+                 memcmp(entry->frames, frames + 1, depth * sizeof(void*)) != 0)
+        {
+            continue;
+        }
+
+        entry->samples++;
+        entry->bytes += size;
+        spinlock_release(&alloc_lock);
+        return;
+    }
+
+    dropped_samples++;
+    spinlock_release(&alloc_lock);
+}
+
+/**
+ * Account an allocated or a freed block of memory
+ */
+static void alloc_count(const char *module, size_t size, bool allocated)
+{
+    ALLOC_THREAD *thr = alloc_thread_get();
+
+    if (thr)
+    {
+        int slot = alloc_slot(thr, module);
+        ALLOC_STATS *stats = &thr->stats[slot];
+
+        if (allocated)
+        {
+            stats->allocs++;
+            stats->allocated += size;
+
+            if (sample_interval && (thr->unsampled += size) >= sample_interval)
+            {
+                thr->unsampled = 0;
+                alloc_sample(slot, size);
+            }
+        }
+        else
+        {
+            stats->frees++;
+            stats->freed += size;
+        }
+    }
+}
+
+static inline void alloc_account(const char *module, void *ptr, bool allocated)
+{
+    alloc_count(module, malloc_usable_size(ptr), allocated);
+}
+
+void alloc_accounting_init()
+{
+    MXS_CONFIG *config = config_get_global_options();
+
+    if (config->memory_accounting && !alloc_accounting_active &&
+        pthread_key_create(&alloc_thread_key, alloc_thread_release) == 0)
+    {
+        sample_interval = config->memory_sample_interval;
+        alloc_accounting_active = true;
+    }
+}
+
+bool alloc_accounting_get(const char *module, ALLOC_STATS *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    spinlock_acquire(&alloc_lock);
+    int slot = alloc_find_slot(module, false);
+    bool found = slot != 0 || module == NULL;
+
+    for (ALLOC_THREAD *thr = alloc_threads; found && thr; thr = thr->next)
+    {
+        stats->allocs += thr->stats[slot].allocs;
+        stats->frees += thr->stats[slot].frees;
+        stats->allocated += thr->stats[slot].allocated;
+        stats->freed += thr->stats[slot].freed;
+    }
+
+    spinlock_release(&alloc_lock);
+    return found;
+}
+
+static int64_t alloc_in_use(const ALLOC_STATS *stats)
+{
+    return (int64_t)(stats->allocated - stats->freed);
+}
+
+static int compare_sums(const void *a, const void *b)
+{
+    int64_t in_use_a = alloc_in_use(&((const ALLOC_SUM*)a)->stats);
+    int64_t in_use_b = alloc_in_use(&((const ALLOC_SUM*)b)->stats);
+    return in_use_a < in_use_b ? 1 : in_use_a > in_use_b ? -1 : 0;
+}
+
+/**
+ * Sum the allocations of the modules over all threads
+ *
+ * @param n_sums Number of modules is stored here
+ *
+ * @return The sums, the module that uses the most memory first, or NULL if
+ *         memory allocation failed
+ */
+static ALLOC_SUM* alloc_sum(int *n_sums)
+{
+    ALLOC_SUM *sums = (ALLOC_SUM*)MXS_CALLOC(ALLOC_MAX_MODULES, sizeof(ALLOC_SUM));
+    int n = 0;
+
+    if (sums)
+    {
+        spinlock_acquire(&alloc_lock);
+        n = n_modules;
+
+        for (int i = 0; i < n; i++)
+        {
+            sums[i].module = module_names[i];
+
+            for (ALLOC_THREAD *thr = alloc_threads; thr; thr = thr->next)
+            {
+                sums[i].stats.allocs += thr->stats[i].allocs;
+                sums[i].stats.frees += thr->stats[i].frees;
+                sums[i].stats.allocated += thr->stats[i].allocated;
+                sums[i].stats.freed += thr->stats[i].freed;
+            }
+        }
+
+        spinlock_release(&alloc_lock);
+        qsort(sums, n, sizeof(ALLOC_SUM), compare_sums);
+    }
+
+    *n_sums = n;
+    return sums;
+}
+
+static int compare_stacks(const void *a, const void *b)
+{
+    uint64_t bytes_a = ((const ALLOC_STACK*)a)->bytes;
+    uint64_t bytes_b = ((const ALLOC_STACK*)b)->bytes;
+    return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+/**
+ * Print the sampled stacks that allocated the most
+ */
+static void dprintStacks(DCB *dcb)
+{
+    ALLOC_STACK *stacks = (ALLOC_STACK*)MXS_MALLOC(sizeof(alloc_stacks));
+
+    if (stacks == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&alloc_lock);
+    memcpy(stacks, alloc_stacks, sizeof(alloc_stacks));
+    uint64_t dropped = dropped_samples;
+    spinlock_release(&alloc_lock);
+
+    qsort(stacks, ALLOC_MAX_STACKS, sizeof(ALLOC_STACK), compare_stacks);
+
+    dcb_printf(dcb, "\nSampled allocation stacks, one sample per %" PRIu64 " bytes allocated by a thread:\n",
+               sample_interval);
+
+    for (int i = 0; i < ALLOC_PRINT_STACKS && stacks[i].hash; i++)
+    {
+        ALLOC_STACK *stack = &stacks[i];
+        dcb_printf(dcb, "\n%s: %" PRIu64 " samples, %" PRIu64 " bytes\n",
+                   module_names[stack->slot], stack->samples, stack->bytes);
+
+        char **symbols = backtrace_symbols(stack->frames, stack->depth);
+
+        for (int j = 0; j < stack->depth; j++)
+        {
+            dcb_printf(dcb, "    %s\n", symbols ? symbols[j] : "?");
+        }
+
+        free(symbols);
+    }
+
+    if (dropped)
+    {
+        dcb_printf(dcb, "\n%" PRIu64 " samples were dropped as the stack table was full.\n", dropped);
+    }
+
+    MXS_FREE(stacks);
+}
+
+void dprintMemory(DCB *dcb)
+{
+    if (!alloc_accounting_active)
+    {
+        dcb_printf(dcb, "Memory accounting is not enabled, see memory_accounting.\n");
+        return;
+    }
+
+    int n;
+    ALLOC_SUM *sums = alloc_sum(&n);
+
+    if (sums == NULL)
+    {
+        return;
+    }
+
+    dcb_printf(dcb, "%-20s | %-12s | %-12s | %-16s | %-16s | %-16s\n",
+               "Module", "Allocations", "Frees", "Allocated bytes", "Freed bytes", "In use bytes");
+    dcb_printf(dcb, "---------------------+--------------+--------------+------------------"
+               "+------------------+-----------------\n");
+
+    for (int i = 0; i < n; i++)
+    {
+        ALLOC_STATS *stats = &sums[i].stats;
+        dcb_printf(dcb, "%-20s | %-12" PRIu64 " | %-12" PRIu64 " | %-16" PRIu64 " | %-16" PRIu64
+                   " | %-16" PRId64 "\n", sums[i].module, stats->allocs, stats->frees,
+                   stats->allocated, stats->freed, alloc_in_use(stats));
+    }
+
+    MXS_FREE(sums);
+
+    if (sample_interval)
+    {
+        dprintStacks(dcb);
+    }
+}
+
+static void memoryStreamRows(RESULTSET *set, void *data)
+{
+    int n;
+    ALLOC_SUM *sums = alloc_sum(&n);
+
+    for (int i = 0; sums && i < n; i++)
+    {
+        ALLOC_STATS *stats = &sums[i].stats;
+        char allocs[24], frees[24], allocated[24], freed[24], in_use[24];
+
+        snprintf(allocs, sizeof(allocs), "%" PRIu64, stats->allocs);
+        snprintf(frees, sizeof(frees), "%" PRIu64, stats->frees);
+        snprintf(allocated, sizeof(allocated), "%" PRIu64, stats->allocated);
+        snprintf(freed, sizeof(freed), "%" PRIu64, stats->freed);
+        snprintf(in_use, sizeof(in_use), "%" PRId64, alloc_in_use(stats));
+
+        const char *values[] = {sums[i].module, allocs, frees, allocated, freed, in_use};
+
+        if (!resultset_stream_row(set, values))
+        {
+            break;
+        }
+    }
+
+    MXS_FREE(sums);
+}
+
+RESULTSET* memoryGetList()
+{
+    RESULTSET *set;
+
+    if ((set = resultset_create_streaming(memoryStreamRows, NULL)) == NULL)
+    {
+        return NULL;
+    }
+
+    resultset_add_column(set, "Module", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Allocations", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Frees", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Allocated bytes", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Freed bytes", 16, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "In use bytes", 16, COL_TYPE_VARCHAR);
+
+    return set;
+}
 
 /**
  * @brief Allocates memory; behaves exactly like `malloc`.
@@ -24,18 +512,21 @@
  *       and `mxs_free`.
  *
  * @param size The amount of memory to allocate.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A pointer to the allocated memory.
  */
-void *mxs_malloc(size_t size/*, const char *caller*/)
+void *mxs_malloc(size_t size, const char *module)
 {
     void *ptr = malloc(size);
 
     if (!ptr)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting_active)
+    {
+        alloc_account(module, ptr, true);
+    }
 
     return ptr;
 }
@@ -50,18 +541,21 @@ void *mxs_malloc(size_t size/*, const char *caller*/)
  *
  * @param nmemb The number of elements.
  * @param size The size of each element.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A pointer to the allocated memory.
  */
-void *mxs_calloc(size_t nmemb, size_t size/*, const char *caller*/)
+void *mxs_calloc(size_t nmemb, size_t size, const char *module)
 {
     void *ptr = calloc(nmemb, size);
 
     if (!ptr)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting_active)
+    {
+        alloc_account(module, ptr, true);
+    }
 
     return ptr;
 }
@@ -78,20 +572,29 @@ void *mxs_calloc(size_t nmemb, size_t size/*, const char *caller*/)
  *            `mxs_calloc`, `mxs_realloc`, `mxs_strdup`, `mxs_strndup`
               or or their `_a` equivalents.
  * @param size What size the memory block should be changed to.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A pointer to the allocated memory.
  */
-void *mxs_realloc(void *ptr, size_t size/*, const char *caller*/)
+void *mxs_realloc(void *ptr, size_t size, const char *module)
 {
-    ptr = realloc(ptr, size);
+    size_t old_size = alloc_accounting_active && ptr ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = realloc(ptr, size);
 
-    if (!ptr)
+    if (!new_ptr)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting_active)
+    {
+        if (ptr)
+        {
+            alloc_count(module, old_size, false);
+        }
 
-    return ptr;
+        alloc_account(module, new_ptr, true);
+    }
+
+    return new_ptr;
 }
 
 /**
@@ -102,18 +605,21 @@ void *mxs_realloc(void *ptr, size_t size/*, const char *caller*/)
  * @note The returned pointer can be passed to `mxs_realloc` and `mxs_free`.
  *
  * @param s1 The string to be duplicated.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A copy of the string.
  */
-char *mxs_strdup(const char *s1/*, const char *caller*/)
+char *mxs_strdup(const char *s1, const char *module)
 {
     char *s2 = strdup(s1);
 
     if (!s2)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting_active)
+    {
+        alloc_account(module, s2, true);
+    }
 
     return s2;
 }
@@ -127,18 +633,21 @@ char *mxs_strdup(const char *s1/*, const char *caller*/)
  *
  * @param s1 The string to be duplicated.
  * @param n At most n bytes should be copied.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A copy of the string.
  */
-char *mxs_strndup(const char *s1, size_t n/*, const char *caller*/)
+char *mxs_strndup(const char *s1, size_t n, const char *module)
 {
     char *s2 = strndup(s1, n);
 
     if (!s2)
     {
-        //MXS_OOM_MESSAGE(caller);
         MXS_OOM();
     }
+    else if (alloc_accounting_active)
+    {
+        alloc_account(module, s2, true);
+    }
 
     return s2;
 }
@@ -153,10 +662,15 @@ char *mxs_strndup(const char *s1, size_t n/*, const char *caller*/)
  *       their `_a` equivalents.
  *
  * @param ptr Pointer to the memory to be freed.
- * @param caller The name of the function calling this function.
+ * @param module The module the free is accounted to.
  */
-void mxs_free(void *ptr/*, const char *caller*/)
+void mxs_free(void *ptr, const char *module)
 {
+    if (alloc_accounting_active && ptr)
+    {
+        alloc_account(module, ptr, false);
+    }
+
     free(ptr);
 }
 
@@ -173,12 +687,12 @@ void mxs_free(void *ptr/*, const char *caller*/)
  * @note The returned pointer can be passed to `mxs_realloc` and `mxs_free`.
  *
  * @param s1 The string to be duplicated.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A copy of the string.
  */
-char *mxs_strdup_a(const char *s1/*, const char *caller*/)
+char *mxs_strdup_a(const char *s1, const char *module)
 {
-    char *s2 = mxs_strdup(s1/*, caller*/);
+    char *s2 = mxs_strdup(s1, module);
 
     if (!s2)
     {
@@ -202,12 +716,12 @@ char *mxs_strdup_a(const char *s1/*, const char *caller*/)
  *
  * @param s1 The string to be duplicated.
  * @param n At most n bytes should be copied.
- * @param caller The name of the function calling this function.
+ * @param module The module the allocation is accounted to.
  * @return A copy of the string.
  */
-char *mxs_strndup_a(const char *s1, size_t n/*, const char *caller*/)
+char *mxs_strndup_a(const char *s1, size_t n, const char *module)
 {
-    char *s2 = mxs_strndup(s1, n/*, caller*/);
+    char *s2 = mxs_strndup(s1, n, module);
 
     if (!s2)
     {
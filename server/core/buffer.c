@@ -13,6 +13,7 @@
 
 #include <maxscale/buffer.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
@@ -20,6 +21,9 @@
 #include <maxscale/spinlock.h>
 #include <maxscale/hint.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+
+#include "maxscale/buffer.h"
 
 #if defined(BUFFER_TRACE)
 #include <maxscale/hashtable.h>
@@ -29,8 +33,7 @@ static HASHTABLE *buffer_hashtable = NULL;
 #endif
 
 static void gwbuf_free_one(GWBUF *buf);
-static buffer_object_t* gwbuf_remove_buffer_object(GWBUF*           buf,
-                                                   buffer_object_t* bufobj);
+static void gwbuf_release_buffer_objects(buffer_objects_t *bufobj);
 
 #if defined(BUFFER_TRACE)
 static void gwbuf_add_to_hashtable(GWBUF *buf);
@@ -39,12 +42,390 @@ static int bcmpfn (void *key1, void *key2);
 static void gwbuf_remove_from_hashtable(GWBUF *buf);
 #endif
 
+/**
+ * The size classes of the per-thread buffer cache. A buffer whose data fits
+ * into one of the classes is allocated as a single block that contains the
+ * GWBUF, the SHARED_BUF and the data. Larger buffers use separate allocations.
+ */
+#define GWBUF_CACHE_N_CLASSES 4
+
+static const unsigned int cache_class_size[GWBUF_CACHE_N_CLASSES] = { 128, 512, 2048, 8192 };
+
+/** The maximum number of free blocks of each class a thread keeps */
+static const int cache_class_max_free[GWBUF_CACHE_N_CLASSES] = { 1024, 512, 128, 32 };
+
+/** The maximum number of free GWBUF headers a thread keeps */
+#define GWBUF_CACHE_MAX_HEADERS 1024
+
+/** The alignment of buffers allocated as one block, the size of a cache line */
+#define GWBUF_BLOCK_ALIGNMENT 64
+
+/** The largest payload allocated in the same block as its GWBUF */
+static unsigned int gwbuf_inline_size = GWBUF_DEFAULT_INLINE_SIZE;
+
+/**
+ * The layout of a buffer allocated as one block
+ */
+typedef struct gwbuf_block
+{
+    GWBUF         header; /*< The GWBUF returned by gwbuf_alloc */
+    SHARED_BUF    sbuf;   /*< The shared buffer */
+    unsigned char data[]; /*< The data area */
+} GWBUF_BLOCK;
+
+/** A free block or header kept in the cache */
+typedef struct free_block
+{
+    struct free_block *next;
+} FREE_BLOCK;
+
+/**
+ * The buffer cache of one worker thread. Only the owning thread touches the
+ * free lists, which means that no locking is needed. A block can be freed by
+ * a different thread than the one that allocated it, in which case it simply
+ * ends up in the cache of the freeing thread.
+ */
+typedef struct gwbuf_cache
+{
+    FREE_BLOCK        *blocks[GWBUF_CACHE_N_CLASSES];   /*< Free blocks of each class */
+    int                n_blocks[GWBUF_CACHE_N_CLASSES]; /*< Number of free blocks */
+    FREE_BLOCK        *headers;                         /*< Free GWBUF headers */
+    int                n_headers;                       /*< Number of free headers */
+    GWBUF_CACHE_STATS  stats;                           /*< Cache statistics */
+} GWBUF_CACHE;
+
+static GWBUF_CACHE *gwbuf_caches = NULL; /*< The caches of all worker threads */
+static int n_gwbuf_caches = 0;           /*< Number of caches */
+static thread_local GWBUF_CACHE *this_cache = NULL; /*< The cache of this thread */
+
+bool gwbuf_cache_init(int n_threads)
+{
+    ss_dassert(gwbuf_caches == NULL);
+
+    if ((gwbuf_caches = (GWBUF_CACHE*)MXS_CALLOC(n_threads, sizeof(GWBUF_CACHE))))
+    {
+        n_gwbuf_caches = n_threads;
+    }
+
+    return gwbuf_caches != NULL;
+}
+
+bool gwbuf_set_inline_size(unsigned int size)
+{
+    bool rval = false;
+
+    if (size <= GWBUF_MAX_INLINE_SIZE)
+    {
+        gwbuf_inline_size = size;
+        rval = true;
+    }
+
+    return rval;
+}
+
+void gwbuf_thread_init(int thread_id)
+{
+    if (thread_id >= 0 && thread_id < n_gwbuf_caches)
+    {
+        this_cache = &gwbuf_caches[thread_id];
+    }
+}
+
+void gwbuf_thread_finish()
+{
+    GWBUF_CACHE *cache = this_cache;
+
+    if (cache)
+    {
+        this_cache = NULL;
+
+        for (int i = 0; i < GWBUF_CACHE_N_CLASSES; i++)
+        {
+            while (cache->blocks[i])
+            {
+                FREE_BLOCK *block = cache->blocks[i];
+                cache->blocks[i] = block->next;
+                MXS_FREE(block);
+            }
+            cache->n_blocks[i] = 0;
+        }
+
+        while (cache->headers)
+        {
+            FREE_BLOCK *header = cache->headers;
+            cache->headers = header->next;
+            MXS_FREE(header);
+        }
+        cache->n_headers = 0;
+    }
+}
+
+bool gwbuf_get_cache_stats(int thread_id, GWBUF_CACHE_STATS *stats)
+{
+    bool rval = false;
+
+    if (thread_id >= 0 && thread_id < n_gwbuf_caches)
+    {
+        *stats = gwbuf_caches[thread_id].stats;
+        rval = true;
+    }
+
+    return rval;
+}
+
+int64_t gwbuf_get_stat(GWBUF_STAT stat)
+{
+    int64_t rval = 0;
+
+    for (int i = 0; i < n_gwbuf_caches; i++)
+    {
+        GWBUF_CACHE_STATS *stats = &gwbuf_caches[i].stats;
+
+        switch (stat)
+        {
+        case GWBUF_STAT_CACHED:
+            rval += stats->n_cached;
+            break;
+        case GWBUF_STAT_MALLOC:
+            rval += stats->n_malloc;
+            break;
+        case GWBUF_STAT_LARGE:
+            rval += stats->n_large;
+            break;
+        case GWBUF_STAT_RECYCLED:
+            rval += stats->n_recycled;
+            break;
+        case GWBUF_STAT_RELEASED:
+            rval += stats->n_released;
+            break;
+        default:
+            ss_dassert(false);
+            break;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Find the smallest size class that fits @c size bytes of data
+ *
+ * @param size Size of the data area
+ *
+ * @return The size class or -1 if the data does not fit any class
+ */
+static inline int gwbuf_size_class(unsigned int size)
+{
+    if (gwbuf_inline_size > 0 && size <= gwbuf_inline_size)
+    {
+        for (int i = 0; i < GWBUF_CACHE_N_CLASSES; i++)
+        {
+            if (size <= cache_class_size[i])
+            {
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Allocate a block of a size class, preferably from the cache of this thread
+ *
+ * @param size_class The size class of the block
+ *
+ * @return The block or NULL if memory allocation failed
+ */
+static inline GWBUF_BLOCK* gwbuf_cache_get_block(int size_class)
+{
+    GWBUF_CACHE *cache = this_cache;
+    GWBUF_BLOCK *block;
+
+    if (cache && cache->blocks[size_class])
+    {
+        FREE_BLOCK *free_block = cache->blocks[size_class];
+        cache->blocks[size_class] = free_block->next;
+        cache->n_blocks[size_class]--;
+        cache->stats.n_cached++;
+        block = (GWBUF_BLOCK*)free_block;
+    }
+    else
+    {
+        if (cache)
+        {
+            cache->stats.n_malloc++;
+        }
+
+        void *ptr;
+
+        /** Aligning the block to a cache line makes sure the header, the
+         * reference count and a small payload share as few lines as possible */
+        if (posix_memalign(&ptr, GWBUF_BLOCK_ALIGNMENT,
+                           sizeof(GWBUF_BLOCK) + cache_class_size[size_class]) == 0)
+        {
+            block = (GWBUF_BLOCK*)ptr;
+        }
+        else
+        {
+            block = NULL;
+        }
+    }
+
+    return block;
+}
+
+/**
+ * Return a block to the cache of this thread or free it if the cache is full
+ *
+ * @param block      The block to free
+ * @param size_class The size class of the block
+ */
+static inline void gwbuf_cache_put_block(GWBUF_BLOCK *block, int size_class)
+{
+    GWBUF_CACHE *cache = this_cache;
+
+    if (cache && cache->n_blocks[size_class] < cache_class_max_free[size_class])
+    {
+        FREE_BLOCK *free_block = (FREE_BLOCK*)block;
+        free_block->next = cache->blocks[size_class];
+        cache->blocks[size_class] = free_block;
+        cache->n_blocks[size_class]++;
+        cache->stats.n_recycled++;
+    }
+    else
+    {
+        if (cache)
+        {
+            cache->stats.n_released++;
+        }
+
+        MXS_FREE(block);
+    }
+}
+
+/**
+ * Initialize all fields of a GWBUF except the data pointers and the shared buffer
+ *
+ * @param buf Buffer to initialize
+ */
+static inline void gwbuf_init_header(GWBUF *buf)
+{
+    buf->next = NULL;
+    buf->tail = buf;
+    buf->hint = NULL;
+    buf->properties = NULL;
+    buf->server = NULL;
+    buf->gwbuf_type = GWBUF_TYPE_UNDEFINED;
+    buf->gwbuf_info = GWBUF_INFO_NONE;
+    buf->gwbuf_bufobj = NULL;
+}
+
+/**
+ * Add a reference to the buffer objects of a buffer that is cloned
+ *
+ * @param bufobj The buffer objects or NULL
+ * @return @c bufobj
+ */
+static inline buffer_objects_t* gwbuf_share_buffer_objects(buffer_objects_t *bufobj)
+{
+    if (bufobj)
+    {
+        atomic_add(&bufobj->refcount, 1);
+    }
+
+    return bufobj;
+}
+
+/**
+ * Allocate a GWBUF header that is not a part of the block of its SHARED_BUF
+ *
+ * @return The initialized header or NULL if memory allocation failed
+ */
+static inline GWBUF* gwbuf_alloc_header()
+{
+    GWBUF_CACHE *cache = this_cache;
+    GWBUF *rval;
+
+    if (cache && cache->headers)
+    {
+        FREE_BLOCK *header = cache->headers;
+        cache->headers = header->next;
+        cache->n_headers--;
+        rval = (GWBUF*)header;
+    }
+    else if ((rval = (GWBUF*)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    {
+        return NULL;
+    }
+
+    gwbuf_init_header(rval);
+
+    return rval;
+}
+
+/**
+ * Free a GWBUF header allocated with gwbuf_alloc_header
+ *
+ * @param buf The header to free
+ */
+static inline void gwbuf_free_header(GWBUF *buf)
+{
+    GWBUF_CACHE *cache = this_cache;
+
+    if (cache && cache->n_headers < GWBUF_CACHE_MAX_HEADERS)
+    {
+        FREE_BLOCK *header = (FREE_BLOCK*)buf;
+        header->next = cache->headers;
+        cache->headers = header;
+        cache->n_headers++;
+    }
+    else
+    {
+        MXS_FREE(buf);
+    }
+}
+
+/**
+ * Check whether a GWBUF is the header that was allocated in the same block
+ * as its shared buffer
+ *
+ * @param buf Buffer to check
+ *
+ * @return True if @c buf is a part of the block of its shared buffer
+ */
+static inline bool gwbuf_is_block_header(const GWBUF *buf)
+{
+    return buf->sbuf->size_class != -1 &&
+           buf == &((GWBUF_BLOCK*)((char*)buf->sbuf - offsetof(GWBUF_BLOCK, sbuf)))->header;
+}
+
+/**
+ * Release a shared buffer once its last reference is gone
+ *
+ * @param sbuf The shared buffer to release
+ */
+static inline void gwbuf_free_sbuf(SHARED_BUF *sbuf)
+{
+    if (sbuf->size_class != -1)
+    {
+        GWBUF_BLOCK *block = (GWBUF_BLOCK*)((char*)sbuf - offsetof(GWBUF_BLOCK, sbuf));
+        gwbuf_cache_put_block(block, sbuf->size_class);
+    }
+    else
+    {
+        MXS_FREE(sbuf->data);
+        MXS_FREE(sbuf);
+    }
+}
+
 /**
  * Allocate a new gateway buffer structure of size bytes.
  *
- * For now we allocate memory directly from malloc for buffer the management
- * structure and the actual data buffer itself. We may swap at a future date
- * to a more efficient mechanism.
+ * Buffers whose payload is at most the configured inline size are allocated
+ * as one cache line aligned block, preferably from the cache of the calling
+ * thread. Larger buffers allocate the management structures and the data
+ * separately.
  *
  * @param       size The size in bytes of the data area required
  * @return      Pointer to the buffer structure or NULL if memory could not
@@ -55,41 +436,60 @@ gwbuf_alloc(unsigned int size)
 {
     GWBUF      *rval;
     SHARED_BUF *sbuf;
+    int         size_class = gwbuf_size_class(size);
 
-    /* Allocate the buffer header */
-    if ((rval = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    if (size_class != -1)
     {
-        goto retblock;
-    }
+        GWBUF_BLOCK *block = gwbuf_cache_get_block(size_class);
 
-    /* Allocate the shared data buffer */
-    if ((sbuf = (SHARED_BUF *)MXS_MALLOC(sizeof(SHARED_BUF))) == NULL)
-    {
-        MXS_FREE(rval);
-        rval = NULL;
-        goto retblock;
-    }
+        if (block == NULL)
+        {
+            rval = NULL;
+            goto retblock;
+        }
 
-    /* Allocate the space for the actual data */
-    if ((sbuf->data = (unsigned char *)MXS_MALLOC(size)) == NULL)
+        rval = &block->header;
+        sbuf = &block->sbuf;
+        sbuf->data = block->data;
+        sbuf->size_class = size_class;
+        gwbuf_init_header(rval);
+    }
+    else
     {
-        MXS_FREE(rval);
-        MXS_FREE(sbuf);
-        rval = NULL;
-        goto retblock;
+        if (this_cache)
+        {
+            this_cache->stats.n_large++;
+        }
+
+        /* Allocate the buffer header */
+        if ((rval = gwbuf_alloc_header()) == NULL)
+        {
+            goto retblock;
+        }
+
+        /* Allocate the shared data buffer */
+        if ((sbuf = (SHARED_BUF *)MXS_MALLOC(sizeof(SHARED_BUF))) == NULL)
+        {
+            gwbuf_free_header(rval);
+            rval = NULL;
+            goto retblock;
+        }
+
+        /* Allocate the space for the actual data */
+        if ((sbuf->data = (unsigned char *)MXS_MALLOC(size)) == NULL)
+        {
+            gwbuf_free_header(rval);
+            MXS_FREE(sbuf);
+            rval = NULL;
+            goto retblock;
+        }
+        sbuf->size_class = -1;
     }
-    spinlock_init(&rval->gwbuf_lock);
+
     rval->start = sbuf->data;
     rval->end = (void *)((char *)rval->start + size);
     sbuf->refcount = 1;
     rval->sbuf = sbuf;
-    rval->next = NULL;
-    rval->tail = rval;
-    rval->hint = NULL;
-    rval->properties = NULL;
-    rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
-    rval->gwbuf_info = GWBUF_INFO_NONE;
-    rval->gwbuf_bufobj = NULL;
     CHK_GWBUF(rval);
 retblock:
     if (rval == NULL)
@@ -231,8 +631,6 @@ void
 gwbuf_free(GWBUF *buf)
 {
     GWBUF *nextbuf;
-    BUF_PROPERTY    *prop;
-    buffer_object_t *bo;
 
     while (buf)
     {
@@ -252,20 +650,8 @@ static void
 gwbuf_free_one(GWBUF *buf)
 {
     BUF_PROPERTY    *prop;
-    buffer_object_t *bo;
+    SHARED_BUF      *sbuf = buf->sbuf;
 
-    if (atomic_add(&buf->sbuf->refcount, -1) == 1)
-    {
-        MXS_FREE(buf->sbuf->data);
-        MXS_FREE(buf->sbuf);
-        bo = buf->gwbuf_bufobj;
-
-        while (bo != NULL)
-        {
-            bo = gwbuf_remove_buffer_object(buf, bo);
-        }
-
-    }
     while (buf->properties)
     {
         prop = buf->properties;
@@ -284,7 +670,25 @@ gwbuf_free_one(GWBUF *buf)
 #if defined(BUFFER_TRACE)
     gwbuf_remove_from_hashtable(buf);
 #endif
-    MXS_FREE(buf);
+
+    /** A header that is a part of the block of its shared buffer is
+     * released together with the shared buffer */
+    bool block_header = gwbuf_is_block_header(buf);
+
+    gwbuf_release_buffer_objects(buf->gwbuf_bufobj);
+
+    /** If this is the only reference, no other thread can be cloning the
+     * buffer at the same time and the atomic decrement can be skipped. */
+    if (atomic_load_int32(&sbuf->refcount) == 1 ||
+        atomic_add(&sbuf->refcount, -1) == 1)
+    {
+        gwbuf_free_sbuf(sbuf);
+    }
+
+    if (!block_header)
+    {
+        gwbuf_free_header(buf);
+    }
 }
 
 /**
@@ -302,7 +706,7 @@ gwbuf_clone_one(GWBUF *buf)
 {
     GWBUF *rval;
 
-    if ((rval = (GWBUF *)MXS_CALLOC(1, sizeof(GWBUF))) == NULL)
+    if ((rval = gwbuf_alloc_header()) == NULL)
     {
         return NULL;
     }
@@ -313,9 +717,7 @@ gwbuf_clone_one(GWBUF *buf)
     rval->end = buf->end;
     rval->gwbuf_type = buf->gwbuf_type;
     rval->gwbuf_info = buf->gwbuf_info;
-    rval->gwbuf_bufobj = buf->gwbuf_bufobj;
-    rval->tail = rval;
-    rval->next = NULL;
+    rval->gwbuf_bufobj = gwbuf_share_buffer_objects(buf->gwbuf_bufobj);
     CHK_GWBUF(rval);
 #if defined(BUFFER_TRACE)
     gwbuf_add_to_hashtable(rval);
@@ -364,22 +766,17 @@ static GWBUF *gwbuf_clone_portion(GWBUF *buf,
     CHK_GWBUF(buf);
     ss_dassert(start_offset + length <= GWBUF_LENGTH(buf));
 
-    if ((clonebuf = (GWBUF *)MXS_MALLOC(sizeof(GWBUF))) == NULL)
+    if ((clonebuf = gwbuf_alloc_header()) == NULL)
     {
         return NULL;
     }
     atomic_add(&buf->sbuf->refcount, 1);
     clonebuf->sbuf = buf->sbuf;
-    clonebuf->gwbuf_type = buf->gwbuf_type; /*< clone info bits too */
+    clonebuf->gwbuf_type = buf->gwbuf_type; /*< clone the type for now */
     clonebuf->start = (void *)((char*)buf->start + start_offset);
     clonebuf->end = (void *)((char *)clonebuf->start + length);
-    clonebuf->gwbuf_type = buf->gwbuf_type; /*< clone the type for now */
-    clonebuf->properties = NULL;
-    clonebuf->hint = NULL;
     clonebuf->gwbuf_info = buf->gwbuf_info;
-    clonebuf->gwbuf_bufobj = buf->gwbuf_bufobj;
-    clonebuf->next = NULL;
-    clonebuf->tail = clonebuf;
+    clonebuf->gwbuf_bufobj = gwbuf_share_buffer_objects(buf->gwbuf_bufobj);
     CHK_GWBUF(clonebuf);
 #if defined(BUFFER_TRACE)
     gwbuf_add_to_hashtable(clonebuf);
@@ -661,66 +1058,58 @@ void gwbuf_add_buffer_object(GWBUF* buf,
                              void*  data,
                              void (*donefun_fp)(void *))
 {
-    buffer_object_t** p_b;
-    buffer_object_t*  newb;
-
     CHK_GWBUF(buf);
-    newb = (buffer_object_t *)MXS_MALLOC(sizeof(buffer_object_t));
-    MXS_ABORT_IF_NULL(newb);
-
-    newb->bo_id = id;
-    newb->bo_data = data;
-    newb->bo_donefun_fp = donefun_fp;
-    newb->bo_next = NULL;
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
-    p_b = &buf->gwbuf_bufobj;
-    /** Search the end of the list and add there */
-    while (*p_b != NULL)
-    {
-        p_b = &(*p_b)->bo_next;
-    }
-    *p_b = newb;
+    ss_dassert(id >= 0 && id < GWBUF_N_OBJECTS);
+
+    if (buf->gwbuf_bufobj == NULL)
+    {
+        buf->gwbuf_bufobj = (buffer_objects_t *)MXS_CALLOC(1, sizeof(buffer_objects_t));
+        MXS_ABORT_IF_NULL(buf->gwbuf_bufobj);
+        buf->gwbuf_bufobj->refcount = 1;
+    }
+
+    buffer_objects_t *bo = buf->gwbuf_bufobj;
+
+    if (bo->bo_data[id])
+    {
+        bo->bo_donefun_fp[id](bo->bo_data[id]);
+    }
+
+    bo->bo_data[id] = data;
+    bo->bo_donefun_fp[id] = donefun_fp;
     /** Set flag */
     buf->gwbuf_info |= GWBUF_INFO_PARSED;
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
 }
 
 void* gwbuf_get_buffer_object_data(GWBUF* buf, bufobj_id_t id)
 {
-    buffer_object_t* bo;
-
     CHK_GWBUF(buf);
-    /** Lock */
-    spinlock_acquire(&buf->gwbuf_lock);
-    bo = buf->gwbuf_bufobj;
+    ss_dassert(id >= 0 && id < GWBUF_N_OBJECTS);
 
-    while (bo != NULL && bo->bo_id != id)
-    {
-        bo = bo->bo_next;
-    }
-    /** Unlock */
-    spinlock_release(&buf->gwbuf_lock);
-    if (bo)
-    {
-        return bo->bo_data;
-    }
-    return NULL;
+    return buf->gwbuf_bufobj ? buf->gwbuf_bufobj->bo_data[id] : NULL;
 }
 
 /**
- * @return pointer to next buffer object or NULL
+ * Free the buffer objects if this was the last buffer that referred to them
+ *
+ * @param bufobj The buffer objects or NULL
  */
-static buffer_object_t* gwbuf_remove_buffer_object(GWBUF* buf, buffer_object_t* bufobj)
+static void gwbuf_release_buffer_objects(buffer_objects_t *bufobj)
 {
-    buffer_object_t* next;
+    /** The clones of a buffer can be freed by different threads */
+    if (bufobj && atomic_add(&bufobj->refcount, -1) == 1)
+    {
+        for (int i = 0; i < GWBUF_N_OBJECTS; i++)
+        {
+            if (bufobj->bo_data[i])
+            {
+                /** Call corresponding clean-up function to clean buffer object's data */
+                bufobj->bo_donefun_fp[i](bufobj->bo_data[i]);
+            }
+        }
 
-    next = bufobj->bo_next;
-    /** Call corresponding clean-up function to clean buffer object's data */
-    bufobj->bo_donefun_fp(bufobj->bo_data);
-    MXS_FREE(bufobj);
-    return next;
+        MXS_FREE(bufobj);
+    }
 }
 
 bool
@@ -741,10 +1130,8 @@ gwbuf_add_property(GWBUF *buf, char *name, char *value)
 
     prop->name = name;
     prop->value = value;
-    spinlock_acquire(&buf->gwbuf_lock);
     prop->next = buf->properties;
     buf->properties = prop;
-    spinlock_release(&buf->gwbuf_lock);
     return true;
 }
 
@@ -753,13 +1140,11 @@ gwbuf_get_property(GWBUF *buf, char *name)
 {
     BUF_PROPERTY *prop;
 
-    spinlock_acquire(&buf->gwbuf_lock);
     prop = buf->properties;
     while (prop && strcmp(prop->name, name) != 0)
     {
         prop = prop->next;
     }
-    spinlock_release(&buf->gwbuf_lock);
     if (prop)
     {
         return prop->value;
@@ -800,12 +1185,39 @@ gwbuf_make_contiguous(GWBUF *orig)
     return newbuf;
 }
 
+GWBUF *
+gwbuf_make_writable(GWBUF *orig)
+{
+    bool shared = false;
+
+    for (GWBUF *buf = orig; buf && !shared; buf = buf->next)
+    {
+        shared = atomic_load_int32(&buf->sbuf->refcount) > 1;
+    }
+
+    if (!shared)
+    {
+        return orig;
+    }
+
+    GWBUF *newbuf = gwbuf_alloc(gwbuf_length(orig));
+
+    if (newbuf)
+    {
+        newbuf->gwbuf_type = orig->gwbuf_type;
+        newbuf->hint = hint_dup(orig->hint);
+        gwbuf_copy_data(orig, 0, gwbuf_length(orig), GWBUF_DATA(newbuf));
+        gwbuf_free(orig);
+    }
+
+    return newbuf;
+}
+
 void
 gwbuf_add_hint(GWBUF *buf, HINT *hint)
 {
     HINT *ptr;
 
-    spinlock_acquire(&buf->gwbuf_lock);
     if (buf->hint)
     {
         ptr = buf->hint;
@@ -819,7 +1231,6 @@ gwbuf_add_hint(GWBUF *buf, HINT *hint)
     {
         buf->hint = hint;
     }
-    spinlock_release(&buf->gwbuf_lock);
 }
 
 size_t gwbuf_copy_data(const GWBUF *buffer, size_t offset, size_t bytes, uint8_t* dest)
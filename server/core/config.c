@@ -55,6 +55,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sched.h>
 #include <ini.h>
 
 #include <maxscale/alloc.h>
@@ -67,7 +68,9 @@
 #include <maxscale/utils.h>
 #include <maxscale/paths.h>
 
+#include "maxscale/buffer.h"
 #include "maxscale/config.h"
+#include "maxscale/config_runtime.h"
 #include "maxscale/filter.h"
 #include "maxscale/service.h"
 #include "maxscale/monitor.h"
@@ -104,6 +107,7 @@ int create_new_server(CONFIG_CONTEXT *obj);
 int create_new_monitor(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj, HASHTABLE* monitorhash);
 int create_new_listener(CONFIG_CONTEXT *obj);
 int create_new_filter(CONFIG_CONTEXT *obj);
+bool is_normal_server_parameter(const char *param);
 int configure_new_service(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj);
 
 static const char *config_file = NULL;
@@ -135,6 +139,11 @@ static const char *service_params[] =
     "weightby",
     "log_auth_warnings",
     "retry_on_failure",
+    "priority",
+    "priority_users",
+    "client_compression",
+    "client_compression_level",
+    "client_compression_threshold",
     NULL
 };
 
@@ -154,6 +163,10 @@ static const char *listener_params[] =
     "ssl_key",
     "ssl_version",
     "ssl_cert_verify_depth",
+    "ssl_session_cache",
+    "ssl_ktls",
+    "compression",
+    "max_connection_rate",
     NULL
 };
 
@@ -171,6 +184,9 @@ static const char *monitor_params[] =
     "backend_connect_timeout",
     "backend_read_timeout",
     "backend_write_timeout",
+    "script_timeout",
+    "collect_metrics",
+    "warmup_time",
     NULL
 };
 
@@ -193,12 +209,19 @@ static const char *server_params[] =
     "monitorpw",
     "persistpoolmax",
     "persistmaxtime",
+    "persistpingtime",
+    "persistreuse",
+    "compression",
+    "ps_cache_size",
+    "fake_backend",
     "ssl_cert",
     "ssl_ca_cert",
     "ssl",
     "ssl_key",
     "ssl_version",
     "ssl_cert_verify_depth",
+    "ssl_session_cache",
+    "ssl_ktls",
     NULL
 };
 
@@ -1119,14 +1142,23 @@ void config_context_free(CONFIG_CONTEXT *context)
 }
 
 /**
- * Return the number of configured threads
+ * Return the number of polling threads
+ *
+ * This includes the threads that are only used after the number of active
+ * threads is increased at runtime.
  *
  * @return The number of threads configured in the config file
  */
 int
 config_threadcount()
 {
-    return gateway.n_threads;
+    return MXS_MAX(gateway.n_threads, gateway.n_threads_max);
+}
+
+int
+config_thread_cpu(int thread_id)
+{
+    return gateway.n_thread_cpus > 0 ? gateway.thread_cpus[thread_id % gateway.n_thread_cpus] : -1;
 }
 
 /**
@@ -1180,6 +1212,92 @@ static struct
     { NULL, 0 }
 };
 
+/**
+ * Parse the value of thread_affinity
+ *
+ * The value is `none`, `auto` for the CPUs that the process may run on or a
+ * comma-separated list of CPUs and ranges of CPUs, e.g. `0-7,16-23`.
+ *
+ * @param value The value of the parameter
+ * @return True if the value is valid
+ */
+static bool
+config_parse_thread_affinity(const char *value)
+{
+    int *cpus = NULL;
+    int n_cpus = 0;
+
+    if (strcmp(value, "auto") == 0)
+    {
+        cpu_set_t set;
+
+        if (sched_getaffinity(0, sizeof(set), &set) != 0 ||
+            (cpus = MXS_MALLOC(CPU_COUNT(&set) * sizeof(int))) == NULL)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < CPU_SETSIZE; i++)
+        {
+            if (CPU_ISSET(i, &set))
+            {
+                cpus[n_cpus++] = i;
+            }
+        }
+    }
+    else if (strcmp(value, "none") != 0)
+    {
+        const char *ptr = value;
+
+        while (*ptr)
+        {
+            char *end;
+            long first = strtol(ptr, &end, 10);
+            long last = first;
+
+            if (end != ptr && *end == '-')
+            {
+                ptr = end + 1;
+                last = strtol(ptr, &end, 10);
+            }
+
+            if (end == ptr || (*end != ',' && *end != '\0') || first < 0 ||
+                last < first || last >= CPU_SETSIZE)
+            {
+                MXS_FREE(cpus);
+                return false;
+            }
+
+            int *tmp = MXS_REALLOC(cpus, (n_cpus + last - first + 1) * sizeof(int));
+
+            if (tmp == NULL)
+            {
+                MXS_FREE(cpus);
+                return false;
+            }
+
+            cpus = tmp;
+
+            for (long cpu = first; cpu <= last; cpu++)
+            {
+                cpus[n_cpus++] = cpu;
+            }
+
+            ptr = *end == ',' ? end + 1 : end;
+        }
+
+        if (n_cpus == 0)
+        {
+            return false;
+        }
+    }
+
+    MXS_FREE(gateway.thread_cpus);
+    gateway.thread_cpus = cpus;
+    gateway.n_thread_cpus = n_cpus;
+    return true;
+}
+
 /**
  * Configuration handler for items in the global [MaxScale] section
  *
@@ -1230,6 +1348,27 @@ handle_global_item(const char *name, const char *value)
             gateway.n_threads = MXS_MAX_THREADS;
         }
     }
+    else if (strcmp(name, "thread_affinity") == 0)
+    {
+        if (!config_parse_thread_affinity(value))
+        {
+            MXS_ERROR("Invalid value for 'thread_affinity': %s. The value must be 'none', "
+                      "'auto' or a list of CPUs, e.g. '0-7,16-23'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "threads_max") == 0)
+    {
+        int thrcount = atoi(value);
+
+        if (thrcount <= 0)
+        {
+            MXS_WARNING("Invalid value for 'threads_max': %s.", value);
+            return 0;
+        }
+
+        gateway.n_threads_max = MXS_MIN(thrcount, MXS_MAX_THREADS);
+    }
     else if (strcmp(name, "non_blocking_polls") == 0)
     {
         gateway.n_nbpoll = atoi(value);
@@ -1238,6 +1377,69 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.pollsleep = atoi(value);
     }
+    else if (strcmp(name, "poll_mode") == 0)
+    {
+        if (strcmp(value, "blocking") == 0)
+        {
+            gateway.poll_mode = MXS_POLL_BLOCKING;
+        }
+        else if (strcmp(value, "adaptive") == 0)
+        {
+            gateway.poll_mode = MXS_POLL_ADAPTIVE;
+        }
+        else if (strcmp(value, "spin") == 0)
+        {
+            gateway.poll_mode = MXS_POLL_SPIN;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'poll_mode': %s. Allowed values are "
+                      "'blocking', 'adaptive' and 'spin'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "poll_engine") == 0)
+    {
+        if (strcmp(value, "epoll") == 0)
+        {
+            gateway.poll_engine = MXS_POLL_ENGINE_EPOLL;
+        }
+        else if (strcmp(value, "io_uring") == 0)
+        {
+            gateway.poll_engine = MXS_POLL_ENGINE_IO_URING;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'poll_engine': %s. Allowed values are "
+                      "'epoll' and 'io_uring'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "poll_spin_budget") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+
+        if (*endptr != '\0' || intval < 0)
+        {
+            MXS_ERROR("Invalid value for 'poll_spin_budget': %s", value);
+            return 0;
+        }
+
+        gateway.poll_spin_budget = intval;
+    }
+    else if (strcmp(name, "buffer_inline_size") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+
+        if (*endptr != '\0' || intval < 0 || !gwbuf_set_inline_size(intval))
+        {
+            MXS_ERROR("Invalid value for 'buffer_inline_size': %s. The value must be "
+                      "between 0 and %d.", value, GWBUF_MAX_INLINE_SIZE);
+            return 0;
+        }
+    }
     else if (strcmp(name, "ms_timestamp") == 0)
     {
         mxs_log_set_highprecision_enabled(config_truth_value((char*)value));
@@ -1246,6 +1448,120 @@ handle_global_item(const char *name, const char *value)
     {
         gateway.skip_permission_checks = config_truth_value((char*)value);
     }
+    else if (strcmp(name, "session_rebalancing") == 0)
+    {
+        gateway.session_rebalancing = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "writeq_high_water") == 0 || strcmp(name, "writeq_low_water") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+
+        if (*endptr != '\0' || intval < 0 || intval > INT_MAX)
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+
+        if (strcmp(name, "writeq_high_water") == 0)
+        {
+            gateway.writeq_high_water = intval;
+        }
+        else
+        {
+            gateway.writeq_low_water = intval;
+        }
+    }
+    else if (strcmp(name, "session_trace_sample") == 0)
+    {
+        char* endptr;
+        double sample = strtod(value, &endptr);
+
+        if (*endptr != '\0' || sample < 0 || sample > 1)
+        {
+            MXS_ERROR("Invalid value for '%s': %s. The value must be between 0 and 1.", name, value);
+            return 0;
+        }
+
+        gateway.session_trace_sample = sample;
+    }
+    else if (strcmp(name, "session_trace_user") == 0)
+    {
+        MXS_FREE(gateway.session_trace_user);
+        gateway.session_trace_user = *value ? MXS_STRDUP_A(value) : NULL;
+    }
+    else if (strcmp(name, "session_trace_host") == 0)
+    {
+        MXS_FREE(gateway.session_trace_host);
+        gateway.session_trace_host = *value ? MXS_STRDUP_A(value) : NULL;
+    }
+    else if (strcmp(name, "session_trace_threshold") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+
+        if (*endptr != '\0' || intval < 0 || intval > INT_MAX)
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+
+        gateway.session_trace_threshold = intval;
+    }
+    else if (strcmp(name, "profile_callbacks") == 0)
+    {
+        gateway.profile_callbacks = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "slow_callback_threshold") == 0)
+    {
+        char* endptr;
+        long intval = strtol(value, &endptr, 0);
+
+        if (*endptr != '\0' || intval < 0 || intval > INT_MAX)
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+
+        gateway.slow_callback_threshold = intval;
+    }
+    else if (strcmp(name, "memory_accounting") == 0)
+    {
+        gateway.memory_accounting = config_truth_value((char*)value);
+    }
+    else if (strcmp(name, "memory_sample_interval") == 0)
+    {
+        char* endptr;
+        long long intval = strtoll(value, &endptr, 0);
+
+        if (*endptr != '\0' || intval < 0)
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+
+        gateway.memory_sample_interval = intval;
+    }
+    else if (strcmp(name, "accept_batch_size") == 0)
+    {
+        char* endptr;
+        long int intval = strtol(value, &endptr, 0);
+        if (*endptr != '\0' || intval < 0 || intval > INT_MAX)
+        {
+            MXS_ERROR("Invalid value for '%s': %s", name, value);
+            return 0;
+        }
+
+        gateway.accept_batch_size = intval;
+    }
+    else if (strcmp(name, "listener_reuseport") == 0)
+    {
+#ifdef SO_REUSEPORT
+        gateway.listener_reuseport = config_truth_value((char*)value);
+#else
+        MXS_WARNING("'listener_reuseport' is not supported on this platform, ignoring it.");
+#endif
+    }
     else if (strcmp(name, "auth_connect_timeout") == 0)
     {
         char* endptr;
@@ -1371,6 +1687,26 @@ handle_global_item(const char *name, const char *value)
             MXS_FREE(v);
         }
     }
+    else if (strcmp(name, "log_format") == 0)
+    {
+        if (strcmp(value, "json") == 0)
+        {
+            mxs_log_set_format(MXS_LOG_FORMAT_JSON);
+        }
+        else if (strcmp(value, "text") == 0)
+        {
+            mxs_log_set_format(MXS_LOG_FORMAT_TEXT);
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'log_format': %s. Valid values are 'text' and 'json'.", value);
+            return 0;
+        }
+    }
+    else if (strcmp(name, "log_deferred") == 0)
+    {
+        mxs_log_set_deferred_enabled(config_truth_value((char*)value));
+    }
     else
     {
         for (i = 0; lognames[i].name; i++)
@@ -1405,6 +1741,7 @@ free_ssl_structure(SSL_LISTENER *ssl)
         MXS_FREE(ssl->ssl_key);
         MXS_FREE(ssl->ssl_cert);
         MXS_FREE(ssl->ssl_ca_cert);
+        SSL_SESSION_free(ssl->session);
         MXS_FREE(ssl);
     }
 }
@@ -1440,6 +1777,43 @@ SSL_LISTENER* make_ssl_structure (CONFIG_CONTEXT *obj, bool require_cert, int *e
             ssl_version = config_get_value(obj->parameters, "ssl_version");
             ssl_cert_verify_depth = config_get_value(obj->parameters, "ssl_cert_verify_depth");
             new_ssl->ssl_init_done = false;
+            new_ssl->ssl_session_cache = true;
+            new_ssl->ssl_ktls = false;
+            spinlock_init(&new_ssl->session_lock);
+
+            const char *session_cache = config_get_value(obj->parameters, "ssl_session_cache");
+            const char *ktls = config_get_value(obj->parameters, "ssl_ktls");
+
+            if (session_cache)
+            {
+                int truth = config_truth_value(session_cache);
+
+                if (truth == -1)
+                {
+                    MXS_ERROR("Invalid value for 'ssl_session_cache' for '%s': %s",
+                              obj->object, session_cache);
+                    local_errors++;
+                }
+                else
+                {
+                    new_ssl->ssl_session_cache = truth;
+                }
+            }
+
+            if (ktls)
+            {
+                int truth = config_truth_value(ktls);
+
+                if (truth == -1)
+                {
+                    MXS_ERROR("Invalid value for 'ssl_ktls' for '%s': %s", obj->object, ktls);
+                    local_errors++;
+                }
+                else
+                {
+                    new_ssl->ssl_ktls = truth;
+                }
+            }
 
             if (ssl_version)
             {
@@ -1585,12 +1959,31 @@ global_defaults()
     struct utsname uname_data;
     gateway.config_check = false;
     gateway.n_threads = DEFAULT_NTHREADS;
+    gateway.n_threads_max = 0;
+    gateway.thread_cpus = NULL;
+    gateway.n_thread_cpus = 0;
     gateway.n_nbpoll = DEFAULT_NBPOLLS;
     gateway.pollsleep = DEFAULT_POLLSLEEP;
+    gateway.poll_mode = MXS_POLL_ADAPTIVE;
+    gateway.poll_spin_budget = DEFAULT_POLL_SPIN_BUDGET;
+    gateway.poll_engine = MXS_POLL_ENGINE_EPOLL;
     gateway.auth_conn_timeout = DEFAULT_AUTH_CONNECT_TIMEOUT;
     gateway.auth_read_timeout = DEFAULT_AUTH_READ_TIMEOUT;
     gateway.auth_write_timeout = DEFAULT_AUTH_WRITE_TIMEOUT;
     gateway.skip_permission_checks = false;
+    gateway.listener_reuseport = false;
+    gateway.accept_batch_size = DEFAULT_ACCEPT_BATCH_SIZE;
+    gateway.session_rebalancing = false;
+    gateway.writeq_high_water = 0;
+    gateway.writeq_low_water = 0;
+    gateway.session_trace_sample = 0;
+    gateway.session_trace_user = NULL;
+    gateway.session_trace_host = NULL;
+    gateway.session_trace_threshold = DEFAULT_SESSION_TRACE_THRESHOLD;
+    gateway.profile_callbacks = false;
+    gateway.slow_callback_threshold = DEFAULT_SLOW_CALLBACK_THRESHOLD;
+    gateway.memory_accounting = false;
+    gateway.memory_sample_interval = 0;
     if (version_string != NULL)
     {
         gateway.version_string = MXS_STRDUP_A(version_string);
@@ -1618,43 +2011,550 @@ global_defaults()
         memcpy(gateway.mac_sha1, "MAC-undef", 9);
     }
 
-    /* get uname info */
-    if (uname(&uname_data))
-    {
-        strcpy(gateway.sysname, "undefined");
-    }
-    else
+    /* get uname info */
+    if (uname(&uname_data))
+    {
+        strcpy(gateway.sysname, "undefined");
+    }
+    else
+    {
+        strcpy(gateway.sysname, uname_data.sysname);
+    }
+
+    /* query_classifier */
+    memset(gateway.qc_name, 0, sizeof(gateway.qc_name));
+}
+
+/**
+ * Set the defaults for the feedback configuration options
+ */
+static void
+feedback_defaults()
+{
+    feedback.feedback_enable = 0;
+    feedback.feedback_user_info = NULL;
+    feedback.feedback_last_action = _NOTIFICATION_SEND_PENDING;
+    feedback.feedback_timeout = _NOTIFICATION_OPERATION_TIMEOUT;
+    feedback.feedback_connect_timeout = _NOTIFICATION_CONNECT_TIMEOUT;
+    feedback.feedback_url = NULL;
+    feedback.feedback_frequency = 1800;
+    feedback.release_info = gateway.release_string;
+    feedback.sysname = gateway.sysname;
+    feedback.mac_sha1 = gateway.mac_sha1;
+}
+
+/**
+ * @brief Check if a comma separated list contains a name
+ *
+ * @param list The list, may be NULL
+ * @param name The name to look for
+ * @return True if @c name is in the list
+ */
+static bool config_list_contains(const char *list, const char *name)
+{
+    bool rval = false;
+
+    if (list)
+    {
+        char copy[strlen(list) + 1];
+        strcpy(copy, list);
+        char *lasts;
+
+        for (char *s = strtok_r(copy, ",", &lasts); s && !rval; s = strtok_r(NULL, ",", &lasts))
+        {
+            rval = strcmp(trim(s), name) == 0;
+        }
+    }
+
+    return rval;
+}
+
+static bool config_name_ignored(const char *name, const char **ignored)
+{
+    for (int i = 0; ignored[i]; i++)
+    {
+        if (strcmp(name, ignored[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check if the parameters of a live object differ from the configured ones
+ *
+ * @param live    The parameters of the live object
+ * @param params  The parameters in the configuration
+ * @param ignored NULL terminated list of parameters that are not compared
+ * @return True if a parameter was added, removed or changed
+ */
+static bool config_params_differ(const MXS_CONFIG_PARAMETER *live,
+                                 const MXS_CONFIG_PARAMETER *params,
+                                 const char **ignored)
+{
+    for (const MXS_CONFIG_PARAMETER *p = params; p; p = p->next)
+    {
+        if (!config_name_ignored(p->name, ignored) &&
+            strcmp(config_get_value_string(live, p->name), p->value) != 0)
+        {
+            return true;
+        }
+    }
+
+    for (const MXS_CONFIG_PARAMETER *p = live; p; p = p->next)
+    {
+        if (!config_name_ignored(p->name, ignored) &&
+            config_get_param((MXS_CONFIG_PARAMETER*)params, p->name) == NULL)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check if a list of values differs from a NULL terminated array
+ *
+ * @param live   The values of the live object, may be NULL
+ * @param list   The configured list
+ * @param delim  The separator of the values in @c list
+ * @return True if the values or their order differ
+ */
+static bool config_values_differ(char **live, const char *list, const char *delim)
+{
+    char copy[strlen(list) + 1];
+    strcpy(copy, list);
+    char *lasts;
+    int i = 0;
+
+    for (char *s = strtok_r(copy, delim, &lasts); s; s = strtok_r(NULL, delim, &lasts), i++)
+    {
+        if (live == NULL || live[i] == NULL || strcmp(live[i], trim(s)) != 0)
+        {
+            return true;
+        }
+    }
+
+    return live && live[i];
+}
+
+/**
+ * @brief Update a numeric setting of a live object
+ *
+ * @return True if the value was valid and differed from the live one
+ */
+static bool update_long_value(const char *value, long *field)
+{
+    char *endptr;
+    long ival = strtol(value, &endptr, 0);
+
+    if (*value && *endptr == '\0' && ival >= 0 && ival != *field)
+    {
+        *field = ival;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Update a boolean setting of a live object
+ *
+ * @return True if the value was valid and differed from the live one
+ */
+static bool update_bool_value(const char *value, bool *field)
+{
+    int truth = config_truth_value((char*)value);
+
+    if (*value && truth != -1 && (bool)truth != *field)
+    {
+        *field = truth;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Apply the changed parameters of a server
+ *
+ * @param server The live server
+ * @param obj    The configuration of the server
+ * @return True if the server was changed
+ */
+static bool update_server(SERVER *server, CONFIG_CONTEXT *obj)
+{
+    bool changed = false;
+    char *address = config_get_value(obj->parameters, "address");
+    char *port = config_get_value(obj->parameters, "port");
+    char *protocol = config_get_value(obj->parameters, "protocol");
+    char *monuser = config_get_value(obj->parameters, "monitoruser");
+    char *monpw = config_get_value(obj->parameters, "monitorpw");
+
+    if (protocol && strcmp(protocol, server->protocol) != 0)
+    {
+        MXS_WARNING("The protocol of server '%s' can only be changed by "
+                    "restarting MaxScale.", server->unique_name);
+    }
+
+    if (address && strcmp(address, server->name) != 0)
+    {
+        changed = runtime_alter_server(server, "address", address);
+    }
+
+    if (port && atoi(port) != server->port)
+    {
+        changed = runtime_alter_server(server, "port", port);
+    }
+
+    if (monuser == NULL)
+    {
+        /** The old names of the monitor credentials */
+        monuser = config_get_value(obj->parameters, "monuser");
+        monpw = config_get_value(obj->parameters, "monpw");
+    }
+
+    if (monuser && monpw && (strcmp(monuser, server->monuser) != 0 ||
+                             strcmp(monpw, server->monpw) != 0))
+    {
+        server_update_credentials(server, monuser, monpw);
+        MXS_NOTICE("Updated the monitor credentials of server '%s'.", server->unique_name);
+        changed = true;
+    }
+
+    /** Not short-circuited, all of the settings are updated */
+    if (update_long_value(config_get_value_string(obj->parameters, "persistpoolmax"),
+                          &server->persistpoolmax) |
+        update_long_value(config_get_value_string(obj->parameters, "persistmaxtime"),
+                          &server->persistmaxtime) |
+        update_long_value(config_get_value_string(obj->parameters, "persistpingtime"),
+                          &server->persistpingtime) |
+        update_bool_value(config_get_value_string(obj->parameters, "persistreuse"),
+                          &server->persistreuse) |
+        update_bool_value(config_get_value_string(obj->parameters, "compression"),
+                          &server->compression) |
+        update_long_value(config_get_value_string(obj->parameters, "ps_cache_size"),
+                          &server->ps_cache_size) |
+        update_bool_value(config_get_value_string(obj->parameters, "fake_backend"),
+                          &server->fake_backend))
+    {
+        MXS_NOTICE("Updated the connection settings of server '%s'.", server->unique_name);
+        changed = true;
+    }
+
+    for (MXS_CONFIG_PARAMETER *p = obj->parameters; p; p = p->next)
+    {
+        const char *value;
+
+        if (!is_normal_server_parameter(p->name) &&
+            ((value = server_get_parameter(server, p->name)) == NULL ||
+             strcmp(value, p->value) != 0))
+        {
+            changed = runtime_alter_server(server, p->name, p->value);
+        }
+    }
+
+    SERVER_PARAM *param = server->parameters;
+
+    while (param)
+    {
+        char name[strlen(param->name) + 1];
+        strcpy(name, param->name);
+        param = param->next;
+
+        if (config_get_param(obj->parameters, name) == NULL)
+        {
+            /** Removes the parameter from the server */
+            changed = runtime_alter_server(server, name, "");
+        }
+    }
+
+    return changed;
+}
+
+/** The monitor settings that are changed without restarting the monitor */
+static const char *monitor_settings[] =
+{
+    "monitor_interval",
+    "backend_connect_timeout",
+    "backend_read_timeout",
+    "backend_write_timeout",
+    "script_timeout",
+    "warmup_time",
+    "collect_metrics",
+    NULL
+};
+
+/** The monitor parameters that are not compared, the servers are linked separately */
+static const char *monitor_ignored_params[] =
+{
+    "type",
+    "module",
+    "servers",
+    NULL
+};
+
+/**
+ * @brief Apply the changed parameters of a monitor
+ *
+ * The monitor is restarted with the new parameters if any of them changed.
+ *
+ * @param monitor The live monitor
+ * @param obj     The configuration of the monitor
+ * @return True if the monitor was changed
+ */
+static bool update_monitor(MXS_MONITOR *monitor, CONFIG_CONTEXT *obj)
+{
+    char *module = config_get_value(obj->parameters, "module");
+    const MXS_MODULE *mod;
+
+    if (module && strcmp(module, monitor->module_name) != 0)
+    {
+        MXS_WARNING("The module of monitor '%s' can only be changed by "
+                    "restarting MaxScale.", monitor->name);
+        return false;
+    }
+
+    if ((mod = get_module(monitor->module_name, MODULE_MONITOR)))
+    {
+        config_add_defaults(obj, mod->parameters);
+    }
+
+    if (!config_params_differ(monitor->parameters, obj->parameters, monitor_ignored_params))
+    {
+        return false;
+    }
+
+    bool settings_changed[sizeof(monitor_settings) / sizeof(monitor_settings[0])];
+
+    for (int i = 0; monitor_settings[i]; i++)
+    {
+        settings_changed[i] = strcmp(config_get_value_string(monitor->parameters, monitor_settings[i]),
+                                     config_get_value_string(obj->parameters, monitor_settings[i])) != 0;
+    }
+
+    monitor_state_t old_state = monitor->state;
+    monitorStop(monitor);
+
+    config_parameter_free(monitor->parameters);
+    monitor->parameters = NULL;
+    monitorAddParameters(monitor, obj->parameters);
+
+    for (int i = 0; monitor_settings[i]; i++)
+    {
+        char *value = config_get_value(obj->parameters, monitor_settings[i]);
+
+        if (settings_changed[i] && value)
+        {
+            runtime_alter_monitor(monitor, (char*)monitor_settings[i], value);
+        }
+    }
+
+    char *user = config_get_value(obj->parameters, "user");
+    char *passwd = config_get_password(obj->parameters);
+
+    if (user && passwd)
+    {
+        monitorAddUser(monitor, user, passwd);
+    }
+
+    if (old_state == MONITOR_STATE_RUNNING)
+    {
+        monitorStart(monitor, monitor->parameters);
+    }
+
+    MXS_NOTICE("Updated the parameters of monitor '%s'.", monitor->name);
+    return true;
+}
+
+/** The filter parameters that are not compared */
+static const char *filter_ignored_params[] =
+{
+    "type",
+    "module",
+    "options",
+    NULL
+};
+
+/**
+ * @brief Apply the changed parameters of a filter
+ *
+ * The new sessions use a new instance of the filter, the existing sessions
+ * keep using the old one.
+ *
+ * @param filter The live filter
+ * @param obj    The configuration of the filter
+ * @return True if the filter was changed
+ */
+static bool update_filter(MXS_FILTER_DEF *filter, CONFIG_CONTEXT *obj)
+{
+    char *module = config_get_value(obj->parameters, "module");
+    const char *options = config_get_value_string(obj->parameters, "options");
+    const MXS_MODULE *mod;
+
+    if (module && strcmp(module, filter->module) != 0)
+    {
+        MXS_WARNING("The module of filter '%s' can only be changed by "
+                    "restarting MaxScale.", filter->name);
+        return false;
+    }
+
+    if ((mod = get_module(filter->module, MODULE_FILTER)))
+    {
+        config_add_defaults(obj, mod->parameters);
+    }
+
+    return (config_params_differ(filter->parameters, obj->parameters, filter_ignored_params) ||
+            config_values_differ(filter->options, options, ",")) &&
+           filter_reload(filter, options, obj->parameters);
+}
+
+/**
+ * @brief Check if the configured filters of a service differ from the live ones
+ */
+static bool service_filters_differ(SERVICE *service, const char *filters)
+{
+    char *names[service->n_filters + 1];
+
+    for (int i = 0; i < service->n_filters; i++)
+    {
+        names[i] = service->filters[i]->name;
+    }
+
+    names[service->n_filters] = NULL;
+
+    return config_values_differ(names, filters, "|");
+}
+
+/**
+ * @brief Remove the servers that are no longer in the configuration of a
+ * service or a monitor
+ *
+ * @param obj The configuration of the service or the monitor
+ * @return True if servers were removed
+ */
+static bool unlink_removed_servers(CONFIG_CONTEXT *obj)
+{
+    char *servers = config_get_value(obj->parameters, "servers");
+    SERVICE *service = service_find(obj->object);
+    MXS_MONITOR *monitor = service ? NULL : monitor_find(obj->object);
+    bool rval = false;
+
+    if (service)
+    {
+        for (SERVER_REF *ref = service->dbref; ref; ref = ref->next)
+        {
+            if (ref->active && !config_list_contains(servers, ref->server->unique_name))
+            {
+                serviceRemoveBackend(service, ref->server);
+                MXS_NOTICE("Removed server '%s' from service '%s'",
+                           ref->server->unique_name, service->name);
+                rval = true;
+            }
+        }
+    }
+    else if (monitor)
+    {
+        MXS_MONITOR_SERVERS *db = monitor->databases;
+
+        while (db)
+        {
+            SERVER *server = db->server;
+            db = db->next;
+
+            if (!config_list_contains(servers, server->unique_name))
+            {
+                monitorRemoveServer(monitor, server);
+                MXS_NOTICE("Removed server '%s' from monitor '%s'",
+                           server->unique_name, monitor->name);
+                rval = true;
+            }
+        }
+    }
+
+    return rval;
+}
+
+static bool monitor_has_server(MXS_MONITOR *monitor, SERVER *server)
+{
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
     {
-        strcpy(gateway.sysname, uname_data.sysname);
+        if (db->server == server)
+        {
+            return true;
+        }
     }
 
-    /* query_classifier */
-    memset(gateway.qc_name, 0, sizeof(gateway.qc_name));
+    return false;
 }
 
 /**
- * Set the defaults for the feedback configuration options
+ * @brief Add the servers that were added to the configuration of a service
+ * or a monitor
+ *
+ * @param obj The configuration of the service or the monitor
+ * @return True if servers were added
  */
-static void
-feedback_defaults()
+static bool link_added_servers(CONFIG_CONTEXT *obj)
 {
-    feedback.feedback_enable = 0;
-    feedback.feedback_user_info = NULL;
-    feedback.feedback_last_action = _NOTIFICATION_SEND_PENDING;
-    feedback.feedback_timeout = _NOTIFICATION_OPERATION_TIMEOUT;
-    feedback.feedback_connect_timeout = _NOTIFICATION_CONNECT_TIMEOUT;
-    feedback.feedback_url = NULL;
-    feedback.feedback_frequency = 1800;
-    feedback.release_info = gateway.release_string;
-    feedback.sysname = gateway.sysname;
-    feedback.mac_sha1 = gateway.mac_sha1;
+    char *servers = config_get_value(obj->parameters, "servers");
+    SERVICE *service = service_find(obj->object);
+    MXS_MONITOR *monitor = service ? NULL : monitor_find(obj->object);
+    bool rval = false;
+
+    if (servers && (service || monitor))
+    {
+        char copy[strlen(servers) + 1];
+        strcpy(copy, servers);
+        char *lasts;
+
+        for (char *s = strtok_r(copy, ",", &lasts); s; s = strtok_r(NULL, ",", &lasts))
+        {
+            SERVER *server = server_find_by_unique_name(trim(s));
+
+            if (server == NULL)
+            {
+                MXS_ERROR("Unable to find server '%s' that is configured in '%s'.",
+                          s, obj->object);
+            }
+            else if (service && !serviceHasBackend(service, server))
+            {
+                if (serviceAddBackend(service, server))
+                {
+                    MXS_NOTICE("Added server '%s' to service '%s'", s, service->name);
+                    rval = true;
+                }
+            }
+            else if (monitor && !monitor_has_server(monitor, server))
+            {
+                if (monitorAddServer(monitor, server))
+                {
+                    MXS_NOTICE("Added server '%s' to monitor '%s'", s, monitor->name);
+                    rval = true;
+                }
+            }
+        }
+    }
+
+    return rval;
 }
 
 /**
  * Process a configuration context update and turn it into the set of object
  * we need.
  *
- * @param context       The configuration data
+ * The configuration is compared to the live objects and only the changes are
+ * applied. The services and their listeners are not restarted, so the
+ * established sessions are not affected. The changed monitors are restarted
+ * and the changed filters get a new instance that is used by the new sessions.
+ * New servers, filters and monitors are created but changes that require the
+ * objects to be recreated, such as new services or another router, only take
+ * effect when MaxScale is restarted.
+ *
+ * @param       context       The configuration data
  */
 static bool
 process_config_update(CONFIG_CONTEXT *context)
@@ -1662,6 +2562,10 @@ process_config_update(CONFIG_CONTEXT *context)
     CONFIG_CONTEXT *obj;
     SERVICE        *service;
     SERVER         *server;
+    MXS_FILTER_DEF *filter;
+    MXS_MONITOR    *monitor;
+    int            n_changed = 0;
+    int            n_unchanged = 0;
 
     /**
      * Process the data and create the services and servers defined
@@ -1720,7 +2624,9 @@ process_config_update(CONFIG_CONTEXT *context)
                         service->log_auth_warnings = (bool)truthval;
                     }
 
-                    if (version_string)
+                    if (version_string &&
+                        (service->version_string == NULL ||
+                         strcmp(service->version_string, version_string) != 0))
                     {
                         if (service->version_string)
                         {
@@ -1729,6 +2635,20 @@ process_config_update(CONFIG_CONTEXT *context)
                         service->version_string = MXS_STRDUP_A(version_string);
                     }
 
+                    if (config_values_differ(service->routerOptions,
+                                             config_get_value_string(obj->parameters, "router_options"),
+                                             ","))
+                    {
+                        MXS_WARNING("The router options of service '%s' can only be changed by "
+                                    "restarting MaxScale.", service->name);
+                    }
+
+                    if (service_filters_differ(service, config_get_value_string(obj->parameters, "filters")))
+                    {
+                        MXS_WARNING("The filters of service '%s' can only be changed by "
+                                    "restarting MaxScale.", service->name);
+                    }
+
                     if (user && auth)
                     {
                         service_update(service, router, user, auth);
@@ -1771,6 +2691,11 @@ process_config_update(CONFIG_CONTEXT *context)
 
                     obj->element = service;
                 }
+                else
+                {
+                    MXS_WARNING("Service '%s' is created when MaxScale is restarted.",
+                                obj->object);
+                }
             }
             else
             {
@@ -1780,25 +2705,118 @@ process_config_update(CONFIG_CONTEXT *context)
         }
         else if (!strcmp(type, "server"))
         {
-            char *address = config_get_value(obj->parameters, "address");
-            char *port = config_get_value(obj->parameters, "port");
-
-            if (address && port &&
-                (server = server_find(address, atoi(port))) != NULL)
+            if ((server = server_find_by_unique_name(obj->object)) != NULL)
             {
-                char *monuser = config_get_value(obj->parameters, "monuser");
-                char *monpw = config_get_value(obj->parameters, "monpw");
-                server_update_credentials(server, monuser, monpw);
+                if (update_server(server, obj))
+                {
+                    n_changed++;
+                }
+                else
+                {
+                    n_unchanged++;
+                }
+
                 obj->element = server;
             }
-            else
+            else if (create_new_server(obj) == 0)
+            {
+                MXS_NOTICE("Created server '%s'.", obj->object);
+                n_changed++;
+            }
+        }
+        else if (!strcmp(type, "filter"))
+        {
+            if ((filter = filter_def_find(obj->object)) != NULL)
+            {
+                if (update_filter(filter, obj))
+                {
+                    n_changed++;
+                }
+                else
+                {
+                    n_unchanged++;
+                }
+
+                obj->element = filter;
+            }
+            else if (create_new_filter(obj) == 0)
+            {
+                MXS_NOTICE("Created filter '%s'.", obj->object);
+                n_changed++;
+            }
+        }
+        else if (!strcmp(type, "monitor"))
+        {
+            if ((monitor = monitor_find(obj->object)) != NULL)
             {
-                create_new_server(obj);
+                if (update_monitor(monitor, obj))
+                {
+                    n_changed++;
+                }
+                else
+                {
+                    n_unchanged++;
+                }
+
+                obj->element = monitor;
             }
         }
         obj = obj->next;
     }
 
+    /**
+     * The servers are removed from the services and the monitors before any
+     * are added so that a server can be moved from one monitor to another.
+     */
+    bool linked = false;
+
+    for (obj = context; obj; obj = obj->next)
+    {
+        char *type = config_get_value(obj->parameters, "type");
+
+        if (type && obj->element && (!strcmp(type, "service") || !strcmp(type, "monitor")))
+        {
+            linked |= unlink_removed_servers(obj);
+        }
+    }
+
+    HASHTABLE *monitorhash = hashtable_alloc(5, hashtable_item_strhash, hashtable_item_strcmp);
+
+    if (monitorhash)
+    {
+        hashtable_memory_fns(monitorhash, hashtable_item_strdup, NULL, hashtable_item_free, NULL);
+    }
+
+    for (obj = context; obj; obj = obj->next)
+    {
+        char *type = config_get_value(obj->parameters, "type");
+
+        if (type && (!strcmp(type, "service") || !strcmp(type, "monitor")))
+        {
+            if (obj->element)
+            {
+                linked |= link_added_servers(obj);
+            }
+            else if (!strcmp(type, "monitor") && monitorhash &&
+                     create_new_monitor(context, obj, monitorhash) == 0)
+            {
+                monitorStart(obj->element, obj->parameters);
+                MXS_NOTICE("Created monitor '%s'.", obj->object);
+                n_changed++;
+            }
+        }
+    }
+
+    hashtable_free(monitorhash);
+
+    if (linked)
+    {
+        service_update_weights();
+    }
+
+    MXS_NOTICE("Reloaded the configuration: %d servers, filters and monitors were "
+               "changed and %d were unchanged.", n_changed, n_unchanged);
+
     return true;
 }
 
@@ -2595,6 +3613,20 @@ int create_new_service(CONFIG_CONTEXT *obj)
         serviceEnableLocalhostMatchWildcardHost(obj->element, config_truth_value(wildcard));
     }
 
+    char *priority = config_get_value(obj->parameters, "priority");
+    if (priority && !serviceSetPriority(obj->element, priority))
+    {
+        MXS_ERROR("Invalid value for 'priority' of service '%s': %s, expected high, normal or low.",
+                  obj->object, priority);
+        error_count++;
+    }
+
+    char *priority_users = config_get_value(obj->parameters, "priority_users");
+    if (priority_users && !serviceSetPriorityUsers(obj->element, priority_users))
+    {
+        error_count++;
+    }
+
     char *user = config_get_value(obj->parameters, "user");
     char *auth = config_get_password(obj->parameters);
 
@@ -2626,6 +3658,56 @@ int create_new_service(CONFIG_CONTEXT *obj)
         }
     }
 
+    char *client_compression = config_get_value(obj->parameters, "client_compression");
+    if (client_compression)
+    {
+        int truthval = config_truth_value(client_compression);
+        if (truthval != -1)
+        {
+            service->client_compression = (bool) truthval;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'client_compression': %s", client_compression);
+            error_count++;
+        }
+    }
+
+    char *compression_level = config_get_value(obj->parameters, "client_compression_level");
+    if (compression_level)
+    {
+        char *endptr;
+        long level = strtol(compression_level, &endptr, 0);
+
+        if (*endptr == '\0' && level >= 1 && level <= 9)
+        {
+            service->client_compression_level = level;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'client_compression_level', expected a number "
+                      "from 1 to 9: %s", compression_level);
+            error_count++;
+        }
+    }
+
+    char *compression_threshold = config_get_value(obj->parameters, "client_compression_threshold");
+    if (compression_threshold)
+    {
+        char *endptr;
+        long threshold = strtol(compression_threshold, &endptr, 0);
+
+        if (*endptr == '\0' && threshold >= 0 && threshold <= INT_MAX)
+        {
+            service->client_compression_threshold = threshold;
+        }
+        else
+        {
+            MXS_ERROR("Invalid value for 'client_compression_threshold': %s", compression_threshold);
+            error_count++;
+        }
+    }
+
     char *version_string = config_get_value(obj->parameters, "version_string");
     if (version_string)
     {
@@ -2767,6 +3849,86 @@ int create_new_server(CONFIG_CONTEXT *obj)
             }
         }
 
+        const char *persistping = config_get_value_string(obj->parameters, "persistpingtime");
+        if (persistping)
+        {
+            long int persistpingtime = strtol(persistping, &endptr, 0);
+            if (*endptr != '\0' || persistpingtime < 0)
+            {
+                MXS_ERROR("Invalid value for 'persistpingtime' for server %s: %s",
+                          server->unique_name, persistping);
+                error_count++;
+            }
+            else
+            {
+                server->persistpingtime = persistpingtime;
+            }
+        }
+
+        const char *persistreuse = config_get_value_string(obj->parameters, "persistreuse");
+        if (persistreuse)
+        {
+            int truth = config_truth_value(persistreuse);
+            if (truth == -1)
+            {
+                MXS_ERROR("Invalid value for 'persistreuse' for server %s: %s",
+                          server->unique_name, persistreuse);
+                error_count++;
+            }
+            else
+            {
+                server->persistreuse = truth;
+            }
+        }
+
+        const char *compression = config_get_value_string(obj->parameters, "compression");
+        if (compression)
+        {
+            int truth = config_truth_value(compression);
+            if (truth == -1)
+            {
+                MXS_ERROR("Invalid value for 'compression' for server %s: %s",
+                          server->unique_name, compression);
+                error_count++;
+            }
+            else
+            {
+                server->compression = truth;
+            }
+        }
+
+        const char *fake_backend = config_get_value_string(obj->parameters, "fake_backend");
+        if (fake_backend)
+        {
+            int truth = config_truth_value(fake_backend);
+            if (truth == -1)
+            {
+                MXS_ERROR("Invalid value for 'fake_backend' for server %s: %s",
+                          server->unique_name, fake_backend);
+                error_count++;
+            }
+            else
+            {
+                server->fake_backend = truth;
+            }
+        }
+
+        const char *ps_cache = config_get_value_string(obj->parameters, "ps_cache_size");
+        if (ps_cache)
+        {
+            long int ps_cache_size = strtol(ps_cache, &endptr, 0);
+            if (*endptr != '\0' || ps_cache_size < 0)
+            {
+                MXS_ERROR("Invalid value for 'ps_cache_size' for server %s: %s",
+                          server->unique_name, ps_cache);
+                error_count++;
+            }
+            else
+            {
+                server->ps_cache_size = ps_cache_size;
+            }
+        }
+
         MXS_CONFIG_PARAMETER *params = obj->parameters;
 
         server->server_ssl = make_ssl_structure(obj, false, &error_count);
@@ -2992,6 +4154,43 @@ int create_new_monitor(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj, HASHTABLE*
             }
         }
 
+        char *script_timeout = config_get_value(obj->parameters, "script_timeout");
+        if (script_timeout)
+        {
+            if (!monitorSetNetworkTimeout(obj->element, MONITOR_SCRIPT_TIMEOUT, atoi(script_timeout)))
+            {
+                MXS_ERROR("Failed to set script_timeout");
+                error_count++;
+            }
+        }
+
+        char *warmup_time = config_get_value(obj->parameters, "warmup_time");
+        if (warmup_time)
+        {
+            if (!monitorSetNetworkTimeout(obj->element, MONITOR_WARMUP_TIME, atoi(warmup_time)))
+            {
+                MXS_ERROR("Failed to set warmup_time");
+                error_count++;
+            }
+        }
+
+        char *collect_metrics = config_get_value(obj->parameters, "collect_metrics");
+        if (collect_metrics)
+        {
+            int truth = config_truth_value(collect_metrics);
+
+            if (truth == -1)
+            {
+                MXS_ERROR("Invalid value for 'collect_metrics' for monitor '%s': %s",
+                          obj->object, collect_metrics);
+                error_count++;
+            }
+            else
+            {
+                monitorSetCollectMetrics(obj->element, truth);
+            }
+        }
+
         if (servers)
         {
             /* get the servers to monitor */
@@ -3067,6 +4266,44 @@ int create_new_listener(CONFIG_CONTEXT *obj)
         if (service)
         {
             SSL_LISTENER *ssl_info = make_ssl_structure(obj, true, &error_count);
+            bool compression = false;
+            char *compression_value = config_get_value(obj->parameters, "compression");
+
+            if (compression_value)
+            {
+                int truth = config_truth_value(compression_value);
+                if (truth == -1)
+                {
+                    MXS_ERROR("Invalid value for 'compression' for listener '%s': %s",
+                              obj->object, compression_value);
+                    error_count++;
+                }
+                else
+                {
+                    compression = truth;
+                }
+            }
+
+            int max_connection_rate = 0;
+            char *rate_value = config_get_value(obj->parameters, "max_connection_rate");
+
+            if (rate_value)
+            {
+                char *endptr;
+                long rate = strtol(rate_value, &endptr, 0);
+
+                if (*endptr != '\0' || rate < 0 || rate > INT_MAX)
+                {
+                    MXS_ERROR("Invalid value for 'max_connection_rate' for listener '%s': %s",
+                              obj->object, rate_value);
+                    error_count++;
+                }
+                else
+                {
+                    max_connection_rate = rate;
+                }
+            }
+
             if (socket)
             {
                 if (serviceHasListener(service, protocol, address, 0))
@@ -3077,8 +4314,14 @@ int create_new_listener(CONFIG_CONTEXT *obj)
                 }
                 else
                 {
-                    serviceCreateListener(service, obj->object, protocol, socket, 0,
-                                          authenticator, authenticator_options, ssl_info);
+                    SERV_LISTENER *listener = serviceCreateListener(service, obj->object, protocol,
+                                                                    socket, 0, authenticator,
+                                                                    authenticator_options, ssl_info);
+                    if (listener)
+                    {
+                        listener->compression = compression;
+                        listener->max_connection_rate = max_connection_rate;
+                    }
                 }
             }
 
@@ -3094,8 +4337,14 @@ int create_new_listener(CONFIG_CONTEXT *obj)
                 }
                 else
                 {
-                    serviceCreateListener(service, obj->object, protocol, address, atoi(port),
-                                          authenticator, authenticator_options, ssl_info);
+                    SERV_LISTENER *listener = serviceCreateListener(service, obj->object, protocol,
+                                                                    address, atoi(port), authenticator,
+                                                                    authenticator_options, ssl_info);
+                    if (listener)
+                    {
+                        listener->compression = compression;
+                        listener->max_connection_rate = max_connection_rate;
+                    }
                 }
             }
 
@@ -3200,6 +4449,8 @@ bool config_is_ssl_parameter(const char *key)
         "ssl_key",
         "ssl_version",
         "ssl_cert_verify_depth",
+        "ssl_session_cache",
+        "ssl_ktls",
         NULL
     };
 
@@ -21,6 +21,7 @@
 #include "maxscale/config.h"
 #include "maxscale/monitor.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/service.h"
 
 static SPINLOCK crt_lock = SPINLOCK_INIT;
@@ -426,6 +427,34 @@ bool runtime_alter_monitor(MXS_MONITOR *monitor, char *key, char *value)
             monitorSetNetworkTimeout(monitor, MONITOR_READ_TIMEOUT, ival);
         }
     }
+    else if (strcmp(key, "script_timeout") == 0)
+    {
+        long ival = get_positive_int(value);
+        if (ival)
+        {
+            valid = true;
+            monitorSetNetworkTimeout(monitor, MONITOR_SCRIPT_TIMEOUT, ival);
+        }
+    }
+    else if (strcmp(key, "warmup_time") == 0)
+    {
+        char *endptr;
+        long ival = strtol(value, &endptr, 10);
+        if (*value && *endptr == '\0' && ival >= 0)
+        {
+            valid = true;
+            monitorSetNetworkTimeout(monitor, MONITOR_WARMUP_TIME, ival);
+        }
+    }
+    else if (strcmp(key, "collect_metrics") == 0)
+    {
+        int truth = config_truth_value(value);
+        if (truth != -1)
+        {
+            valid = true;
+            monitorSetCollectMetrics(monitor, truth);
+        }
+    }
     else
     {
         /** We're modifying module specific parameters and we need to stop the monitor */
@@ -462,6 +491,26 @@ bool runtime_alter_monitor(MXS_MONITOR *monitor, char *key, char *value)
     return valid;
 }
 
+bool runtime_alter_maxscale(char *key, char *value)
+{
+    spinlock_acquire(&crt_lock);
+    bool valid = false;
+
+    if (strcmp(key, "threads") == 0)
+    {
+        long ival = get_positive_int(value);
+
+        if (ival && poll_set_active_threads(ival))
+        {
+            MXS_NOTICE("Updated MaxScale: %s=%s", key, value);
+            valid = true;
+        }
+    }
+
+    spinlock_release(&crt_lock);
+    return valid;
+}
+
 bool runtime_create_listener(SERVICE *service, const char *name, const char *addr,
                              const char *port, const char *proto, const char *auth,
                              const char *auth_opt, const char *ssl_key,
@@ -66,6 +66,8 @@
 #include <maxscale/dcb.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -86,31 +88,78 @@
 #include <maxscale/hk_heartbeat.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <limits.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <maxscale/alloc.h>
 #include <maxscale/utils.h>
 #include <maxscale/platform.h>
 
+#include "maxscale/persistpool.h"
+#include "maxscale/poll.h"
+#include "maxscale/pool.h"
 #include "maxscale/session.h"
 #include "maxscale/modules.h"
 #include "maxscale/queuemanager.h"
 
 /* A DCB with null values, used for initialization */
+/** The maximum number of buffers gathered into one writev call */
+#define DCB_MAX_IOV IOV_MAX
+
+/** Buffers smaller than this are coalesced into one SSL record, the maximum record size */
+#define DCB_SSL_COALESCE_SIZE 16384
+
 static DCB dcb_initialized = DCB_INIT;
 
+/** The buffer into which the worker thread reads data from sockets */
+static thread_local uint8_t dcb_read_buffer[MXS_MAX_NW_READ_BUFFER_SIZE];
+
+/** The largest read, reads larger than the read buffer go straight into a GWBUF */
+#define DCB_MAX_READ_SIZE (256 * 1024)
+
+/** The maximum number of bytes moved by one splice call, the default pipe size */
+#define DCB_SPLICE_SIZE 65536
+
+/** The pipe through which the worker thread splices data between sockets */
+static thread_local int dcb_splice_pipe[2] = {-1, -1};
+
 static  DCB           **all_dcbs;
 static  SPINLOCK       *all_dcbs_lock;
+
+/**
+ * The client DCBs of the sessions of a thread by session ID, linked through
+ * DCB::thread.session_next and protected by the lock of the thread's list
+ */
+typedef struct dcb_session_index
+{
+    DCB **buckets;   /*< The hash table */
+    int   n_buckets; /*< Size of the hash table */
+    int   n_dcbs;    /*< Number of DCBs in the hash table */
+} DCB_SESSION_INDEX;
+
+/** The initial size of the hash table of a session index */
+#define DCB_SESSION_INDEX_BUCKETS 256
+
+static  DCB_SESSION_INDEX *session_index;
 static  DCB           **zombies;
 static  int            *nzombies;
 static  int             maxzombies = 0;
 static  SPINLOCK        zombiespin = SPINLOCK_INIT;
 
-/** Variables for session timeout checks */
-bool check_timeouts = false;
-thread_local long next_timeout_check = 0;
+/** How often, in heartbeats, the idle timer of a client is checked when the
+ * service has no idle timeout. This allows the timeout to be enabled at runtime. */
+#define DCB_IDLE_RECHECK_TICKS 600
+
+static void dcb_timer_cb(MXS_TIMER *timer, void *data);
+static void dcb_cork_timer_cb(MXS_TIMER *timer, void *data);
+
+/** The maximum number of free DCBs each thread keeps for reuse */
+#define DCB_POOL_MAX_FREE 512
+
+static MXS_POOL dcb_pool = MXS_POOL_INIT("DCB", sizeof(DCB), DCB_POOL_MAX_FREE);
 
 void dcb_global_init()
 {
@@ -119,6 +168,7 @@ void dcb_global_init()
     if ((zombies = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
         (all_dcbs = MXS_CALLOC(nthreads, sizeof(DCB*))) == NULL ||
         (all_dcbs_lock = MXS_CALLOC(nthreads, sizeof(SPINLOCK))) == NULL ||
+        (session_index = MXS_CALLOC(nthreads, sizeof(DCB_SESSION_INDEX))) == NULL ||
         (nzombies = MXS_CALLOC(nthreads, sizeof(int))) == NULL)
     {
         MXS_OOM();
@@ -140,12 +190,12 @@ static inline DCB * dcb_find_in_list(DCB *dcb);
 static inline void dcb_process_victim_queue(int threadid);
 static void dcb_stop_polling_and_shutdown (DCB *dcb);
 static bool dcb_maybe_add_persistent(DCB *);
+static bool dcb_start_queued(SERVICE *service);
+static void dcb_persistent_schedule(DCB *dcb);
 static inline bool dcb_write_parameter_check(DCB *dcb, GWBUF *queue);
-static int dcb_bytes_readable(DCB *dcb);
-static int dcb_read_no_bytes_available(DCB *dcb, int nreadtotal);
 static int dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl);
 static int dcb_read_SSL(DCB *dcb, GWBUF **head);
-static GWBUF *dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *nsingleread);
+static GWBUF *dcb_basic_read(DCB *dcb, int bufsize, int *nsingleread, int *eno);
 static GWBUF *dcb_basic_read_SSL(DCB *dcb, int *nsingleread);
 static void dcb_log_write_failure(DCB *dcb, GWBUF *queue, int eno);
 static inline void dcb_write_tidy_up(DCB *dcb, bool below_water);
@@ -153,7 +203,9 @@ static int gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing);
 static int dcb_log_errors_SSL (DCB *dcb, const char *called_by, int ret);
 static int dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn);
-static int dcb_listen_create_socket_inet(const char *host, uint16_t port);
+static bool dcb_accept_allowed(DCB *listener);
+static int dcb_listen_create_socket_inet(const char *host, uint16_t port, bool reuseport);
+static bool dcb_listen_create_shards(DCB *listener, const char *host, uint16_t port);
 static int dcb_listen_create_socket_unix(const char *path);
 static int dcb_set_socket_option(int sockfd, int level, int optname, void *optval, socklen_t optlen);
 static void dcb_add_to_all_list(DCB *dcb);
@@ -184,6 +236,8 @@ static void
 dcb_initialize(void *dcb)
 {
     *(DCB *)dcb = dcb_initialized;
+    mxs_timer_init(&((DCB *)dcb)->timer, dcb_timer_cb, dcb);
+    mxs_timer_init(&((DCB *)dcb)->cork_timer, dcb_cork_timer_cb, dcb);
 }
 
 /**
@@ -206,7 +260,7 @@ dcb_alloc(dcb_role_t role, SERV_LISTENER *listener)
 {
     DCB *newdcb;
 
-    if ((newdcb = (DCB *)MXS_MALLOC(sizeof(*newdcb))) == NULL)
+    if ((newdcb = (DCB *)mxs_pool_alloc(&dcb_pool)) == NULL)
     {
         return NULL;
     }
@@ -315,6 +369,9 @@ dcb_final_free(DCB *dcb)
         MXS_ERROR("dcb_final_free: DCB %p has outstanding events.", dcb);
     }
 
+    mxs_timer_cancel(&dcb->timer);
+    mxs_timer_cancel(&dcb->cork_timer);
+
     if (dcb->session)
     {
         /*<
@@ -358,7 +415,14 @@ dcb_free_all_memory(DCB *dcb)
 
     if (dcb->protocol && (!DCB_IS_CLONE(dcb)))
     {
-        MXS_FREE(dcb->protocol);
+        if (dcb->flags & DCBF_POOLED_PROTOCOL)
+        {
+            mxs_pool_free(dcb->protocol);
+        }
+        else
+        {
+            MXS_FREE(dcb->protocol);
+        }
     }
     if (dcb->data && dcb->authfunc.free && !DCB_IS_CLONE(dcb))
     {
@@ -374,6 +438,7 @@ dcb_free_all_memory(DCB *dcb)
     {
         MXS_FREE(dcb->protoname);
     }
+    MXS_FREE(dcb->persistkey);
     if (dcb->remote)
     {
         MXS_FREE(dcb->remote);
@@ -416,8 +481,8 @@ dcb_free_all_memory(DCB *dcb)
         SSL_free(dcb->ssl);
     }
 
-    /* We never free the actual DCB, it is available for reuse*/
-    MXS_FREE(dcb);
+    /* The DCB is kept in the pool of this thread for reuse */
+    mxs_pool_free(dcb);
 
 }
 
@@ -508,14 +573,8 @@ dcb_process_victim_queue(int threadid)
             {
                 if (dcb->protocol)
                 {
-                    QUEUE_ENTRY conn_waiting;
-                    if (mxs_dequeue(dcb->service->queued_connections, &conn_waiting))
-                    {
-                        DCB *waiting_dcb = (DCB *)conn_waiting.queued_object;
-                        waiting_dcb->state = DCB_STATE_WAITING;
-                        poll_fake_read_event(waiting_dcb);
-                    }
-                    else
+                    /** The slot of the client goes to the next queued client */
+                    if (!dcb_start_queued(dcb->service))
                     {
                         atomic_add(&dcb->service->client_count, -1);
                     }
@@ -528,7 +587,19 @@ dcb_process_victim_queue(int threadid)
         }
         if (dcb->server && 0 == dcb->persistentstart)
         {
-            atomic_add(&dcb->server->stats.n_current, -1);
+            ts_stats_add(dcb->server->stats.n_current, -1);
+        }
+
+        if (dcb->listener_fds)
+        {
+            /** The first socket is the one in dcb->fd, closed below */
+            for (int i = 1; i < config_threadcount(); i++)
+            {
+                close(dcb->listener_fds[i]);
+            }
+
+            MXS_FREE(dcb->listener_fds);
+            dcb->listener_fds = NULL;
         }
 
         if (dcb->fd > 0)
@@ -617,7 +688,8 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
     {
         MXS_DEBUG("%lu [dcb_connect] Looking for persistent connection DCB "
                   "user %s protocol %s\n", pthread_self(), user, protocol);
-        dcb = server_get_persistent(server, user, protocol, session->client_dcb->thread.id);
+        dcb = server_get_persistent(server, user, protocol, session->client_dcb->persistkey,
+                                    session->client_dcb->thread.id);
         if (dcb)
         {
             /**
@@ -633,8 +705,10 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
             }
             MXS_DEBUG("%lu [dcb_connect] Reusing a persistent connection, dcb %p\n",
                       pthread_self(), dcb);
+            mxs_timer_cancel(&dcb->timer);
             dcb->persistentstart = 0;
             dcb->was_persistent = true;
+            dcb->corked = false;
             dcb->last_read = hkheartbeat;
             return dcb;
         }
@@ -729,6 +803,13 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
 
     dcb->was_persistent = false;
 
+    /** A new connection is opened with the default database and the
+     * character set of the client */
+    if (session->client_dcb->persistkey)
+    {
+        dcb->persistkey = MXS_STRDUP_A(session->client_dcb->persistkey);
+    }
+
     /**
      * backend_dcb is connected to backend server, and once backend_dcb
      * is added to poll set, authentication takes place as part of
@@ -760,8 +841,8 @@ dcb_connect(SERVER *server, MXS_SESSION *session, const char *protocol)
     /**
      * The dcb will be addded into poll set by dcb->func.connect
      */
-    atomic_add(&server->stats.n_connections, 1);
-    atomic_add(&server->stats.n_current, 1);
+    ts_stats_add(server->stats.n_connections, 1);
+    ts_stats_add(server->stats.n_current, 1);
 
     return dcb;
 }
@@ -817,42 +898,59 @@ int dcb_read(DCB   *dcb,
 
     while (0 == maxbytes || nreadtotal < maxbytes)
     {
-        int bytes_available;
+        GWBUF *buffer;
+        int bufsize = MXS_MAX(dcb->read_size, (int)sizeof(dcb_read_buffer));
+        int eno = 0;
 
-        bytes_available = dcb_bytes_readable(dcb);
-        if (bytes_available <= 0)
+        if (maxbytes)
         {
-            return bytes_available < 0 ? -1 :
-                   /** Handle closed client socket */
-                   dcb_read_no_bytes_available(dcb, nreadtotal);
+            bufsize = MXS_MIN(bufsize, maxbytes - nreadtotal);
         }
-        else
+
+        buffer = dcb_basic_read(dcb, bufsize, &nsingleread, &eno);
+
+        if (buffer)
         {
-            GWBUF *buffer;
             dcb->last_read = hkheartbeat;
+            nreadtotal += nsingleread;
+            /* <editor-fold defaultstate="collapsed" desc=" Debug Logging "> */
+            MXS_DEBUG("%lu [dcb_read] Read %d bytes from dcb %p in state %s "
+                      "fd %d.",
+                      pthread_self(),
+                      nsingleread,
+                      dcb,
+                      STRDCBSTATE(dcb->state),
+                      dcb->fd);
+            /* </editor-fold> */
+            /*< Assign the target server for the gwbuf */
+            buffer->server = dcb->server;
+            /*< Append read data to the gwbuf */
+            *head = gwbuf_append(*head, buffer);
 
-            buffer = dcb_basic_read(dcb, bytes_available, maxbytes, nreadtotal, &nsingleread);
-            if (buffer)
+            if (nsingleread < bufsize)
             {
-                nreadtotal += nsingleread;
-                /* <editor-fold defaultstate="collapsed" desc=" Debug Logging "> */
-                MXS_DEBUG("%lu [dcb_read] Read %d bytes from dcb %p in state %s "
-                          "fd %d.",
-                          pthread_self(),
-                          nsingleread,
-                          dcb,
-                          STRDCBSTATE(dcb->state),
-                          dcb->fd);
-                /* </editor-fold> */
-                /*< Assign the target server for the gwbuf */
-                buffer->server = dcb->server;
-                /*< Append read data to the gwbuf */
-                *head = gwbuf_append(*head, buffer);
+                /**
+                 * A short read means that the socket was drained. Data that
+                 * arrives later will generate a new edge-triggered event, so
+                 * only a full read is followed by another one, until EAGAIN.
+                 */
+                break;
             }
-            else
+        }
+        else
+        {
+            if (nsingleread == 0 && nreadtotal == 0 &&
+                DCB_ROLE_CLIENT_HANDLER == dcb->dcb_role)
             {
-                break;
+                /** Handle closed client socket */
+                return -1;
+            }
+            else if (eno != 0)
+            {
+                /** A failed read or allocation, the data read so far is left in *head */
+                return -1;
             }
+            break;
         }
     } /*< while (0 == maxbytes || nreadtotal < maxbytes) */
 
@@ -860,134 +958,244 @@ int dcb_read(DCB   *dcb,
 }
 
 /**
- * Find the number of bytes available for the DCB's socket
+ * Basic read function to carry out a single read operation on the DCB socket.
  *
- * @param dcb       The DCB to read from
- * @return          -1 on error, otherwise the total number of bytes available
+ * Reads that fit into the thread's read buffer are done into it and only the
+ * bytes that were actually read are copied into the returned buffer. This way
+ * the amount of readable data does not need to be queried before the read.
+ * When the reads of the DCB fill the read buffer, the read size of the DCB is
+ * doubled and the larger reads go straight into the returned buffer. The read
+ * size is halved again when a read fills less than a quarter of it, and such
+ * a read is copied into a buffer of its own size so that small amounts of
+ * data do not keep large buffers alive.
+ *
+ * @param dcb               The DCB to read from
+ * @param bufsize           Maximum number of bytes to read
+ * @param nsingleread       Set to the number of bytes read, 0 if the peer closed
+ *                          the connection and -1 if there was no data or an error
+ * @param eno               Set to the error number of a failed read or allocation,
+ *                          0 otherwise
+ * @return                  GWBUF* buffer containing new data, or null.
  */
-static int
-dcb_bytes_readable(DCB *dcb)
+static GWBUF *
+dcb_basic_read(DCB *dcb, int bufsize, int *nsingleread, int *eno)
 {
-    int bytesavailable;
+    GWBUF *buffer = NULL;
+    uint8_t *data = dcb_read_buffer;
+    int read_size = MXS_MAX(dcb->read_size, (int)sizeof(dcb_read_buffer));
 
-    if (-1 == ioctl(dcb->fd, FIONREAD, &bytesavailable))
+    ss_dassert(bufsize > 0 && bufsize <= read_size);
+    *eno = 0;
+
+    if (bufsize > (int)sizeof(dcb_read_buffer))
     {
-        char errbuf[MXS_STRERROR_BUFLEN];
-        /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-        MXS_ERROR("%lu [dcb_read] Error : ioctl FIONREAD for dcb %p in "
-                  "state %s fd %d failed due error %d, %s.",
-                  pthread_self(),
-                  dcb,
-                  STRDCBSTATE(dcb->state),
-                  dcb->fd,
-                  errno,
-                  strerror_r(errno, errbuf, sizeof(errbuf)));
-        /* </editor-fold> */
-        return -1;
+        if ((buffer = gwbuf_alloc(bufsize)) == NULL)
+        {
+            MXS_ERROR("Failed to allocate a read buffer of %d bytes for dcb %p fd %d.",
+                      bufsize, dcb, dcb->fd);
+            *nsingleread = -1;
+            *eno = ENOMEM;
+            return NULL;
+        }
+
+        data = GWBUF_DATA(buffer);
+    }
+
+    *nsingleread = read(dcb->fd, data, bufsize);
+    int read_errno = errno;
+    dcb->stats.n_reads++;
+
+    if (*nsingleread > 0)
+    {
+        if (*nsingleread == bufsize && bufsize == read_size)
+        {
+            dcb->read_size = MXS_MIN(read_size * 2, DCB_MAX_READ_SIZE);
+        }
+        else if (*nsingleread < read_size / 4)
+        {
+            dcb->read_size = MXS_MAX(read_size / 2, (int)sizeof(dcb_read_buffer));
+        }
+
+        if (buffer && *nsingleread >= bufsize / 4)
+        {
+            if (*nsingleread < bufsize)
+            {
+                buffer = gwbuf_rtrim(buffer, bufsize - *nsingleread);
+            }
+        }
+        else
+        {
+            GWBUF *read_buffer = buffer;
+
+            if ((buffer = gwbuf_alloc_and_load(*nsingleread, data)) == NULL)
+            {
+                /*<
+                 * This is a fatal error which should cause shutdown.
+                 * Todo shutdown if memory allocation fails.
+                 */
+                /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
+                MXS_ERROR("%lu [dcb_read] Error : Failed to allocate read buffer "
+                          "for dcb %p fd %d.",
+                          pthread_self(),
+                          dcb,
+                          dcb->fd);
+                /* </editor-fold> */
+                *nsingleread = -1;
+                *eno = ENOMEM;
+            }
+
+            gwbuf_free(read_buffer);
+        }
     }
     else
     {
-        return bytesavailable;
+        gwbuf_free(buffer);
+        buffer = NULL;
+
+        if (*nsingleread < 0 && read_errno != EAGAIN && read_errno != EWOULDBLOCK)
+        {
+            char errbuf[MXS_STRERROR_BUFLEN];
+            /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
+            MXS_ERROR("%lu [dcb_read] Error : Read failed, dcb %p in state "
+                      "%s fd %d, due %d, %s.",
+                      pthread_self(),
+                      dcb,
+                      STRDCBSTATE(dcb->state),
+                      dcb->fd,
+                      read_errno,
+                      strerror_r(read_errno, errbuf, sizeof(errbuf)));
+            /* </editor-fold> */
+            *eno = read_errno;
+        }
     }
+
+    return buffer;
 }
 
 /**
- * Determine the return code needed when read has run out of data
+ * Move the contents of the splice pipe into the write queue of a DCB
  *
- * @param dcb           The DCB to read from
- * @param nreadtotal    Number of bytes that have been read
- * @return              -1 on error, 0 for conditions not treated as error
+ * @param dcb   The DCB to write to
+ * @param len   Number of bytes in the pipe
+ * @return      True if the data was queued
  */
-static int
-dcb_read_no_bytes_available(DCB *dcb, int nreadtotal)
+static bool dcb_splice_queue(DCB *dcb, int len)
 {
-    /** Handle closed client socket */
-    if (nreadtotal == 0 && DCB_ROLE_CLIENT_HANDLER == dcb->dcb_role)
-    {
-        char c;
-        int l_errno = 0;
-        long r = -1;
+    GWBUF *buffer = gwbuf_alloc(len);
+    int n = 0;
 
-        /* try to read 1 byte, without consuming the socket buffer */
-        r = recv(dcb->fd, &c, sizeof(char), MSG_PEEK);
-        l_errno = errno;
+    while (buffer && n < len)
+    {
+        int rc = read(dcb_splice_pipe[0], (uint8_t*)GWBUF_DATA(buffer) + n, len - n);
 
-        if (r <= 0 &&
-            l_errno != EAGAIN &&
-            l_errno != EWOULDBLOCK &&
-            l_errno != 0)
+        if (rc <= 0)
         {
-            return -1;
+            gwbuf_free(buffer);
+            buffer = NULL;
+        }
+        else
+        {
+            n += rc;
         }
     }
-    return nreadtotal;
+
+    if (buffer == NULL)
+    {
+        /** The pipe could contain stale data, start over with a new one */
+        close(dcb_splice_pipe[0]);
+        close(dcb_splice_pipe[1]);
+        dcb_splice_pipe[0] = dcb_splice_pipe[1] = -1;
+        return false;
+    }
+
+    return dcb_write(dcb, buffer) != 0;
 }
 
-/**
- * Basic read function to carry out a single read operation on the DCB socket.
- *
- * @param dcb               The DCB to read from
- * @param bytesavailable    Pointer to linked list to append data to
- * @param maxbytes          Maximum bytes to read (0 = no limit)
- * @param nreadtotal        Total number of bytes already read
- * @param nsingleread       To be set as the number of bytes read this time
- * @return                  GWBUF* buffer containing new data, or null.
- */
-static GWBUF *
-dcb_basic_read(DCB *dcb, int bytesavailable, int maxbytes, int nreadtotal, int *nsingleread)
+int dcb_splice(DCB *from, DCB *to)
 {
-    GWBUF *buffer;
+    int total = 0;
+    bool queued = to->writeq != NULL;
 
-    int bufsize = MXS_MIN(bytesavailable, MXS_MAX_NW_READ_BUFFER_SIZE);
-    if (maxbytes)
-    {
-        bufsize = MXS_MIN(bufsize, maxbytes - nreadtotal);
-    }
+    CHK_DCB(from);
+    CHK_DCB(to);
+    ss_dassert(from->dcb_readqueue == NULL && from->dcb_fakequeue == NULL);
+    ss_dassert(from->ssl == NULL && to->ssl == NULL);
 
-    if ((buffer = gwbuf_alloc(bufsize)) == NULL)
+    if (dcb_splice_pipe[0] == -1 && pipe2(dcb_splice_pipe, O_NONBLOCK | O_CLOEXEC) == -1)
     {
-        /*<
-         * This is a fatal error which should cause shutdown.
-         * Todo shutdown if memory allocation fails.
-         */
-        char errbuf[MXS_STRERROR_BUFLEN];
-        /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-        MXS_ERROR("%lu [dcb_read] Error : Failed to allocate read buffer "
-                  "for dcb %p fd %d, due %d, %s.",
-                  pthread_self(),
-                  dcb,
-                  dcb->fd,
-                  errno,
-                  strerror_r(errno, errbuf, sizeof(errbuf)));
-        /* </editor-fold> */
-        *nsingleread = -1;
+        /** Pipes are not available, copy the data instead */
+        GWBUF *buffer = NULL;
+        dcb_splice_pipe[0] = dcb_splice_pipe[1] = -1;
+        total = dcb_read(from, &buffer, 0);
+
+        if (buffer && !dcb_write(to, buffer))
+        {
+            total = -1;
+        }
+
+        return total;
     }
-    else
+
+    while (true)
     {
-        *nsingleread = read(dcb->fd, GWBUF_DATA(buffer), bufsize);
-        dcb->stats.n_reads++;
+        errno = 0;
+        int nread = splice(from->fd, NULL, dcb_splice_pipe[1], NULL, DCB_SPLICE_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        from->stats.n_reads++;
 
-        if (*nsingleread <= 0)
+        if (nread <= 0)
         {
-            if (errno != 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            if (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
             {
                 char errbuf[MXS_STRERROR_BUFLEN];
-                /* <editor-fold defaultstate="collapsed" desc=" Error Logging "> */
-                MXS_ERROR("%lu [dcb_read] Error : Read failed, dcb %p in state "
-                          "%s fd %d, due %d, %s.",
-                          pthread_self(),
-                          dcb,
-                          STRDCBSTATE(dcb->state),
-                          dcb->fd,
-                          errno,
+                MXS_ERROR("Splicing from dcb %p fd %d to dcb %p fd %d failed: %d, %s",
+                          from, from->fd, to, to->fd, errno,
                           strerror_r(errno, errbuf, sizeof(errbuf)));
-                /* </editor-fold> */
+                total = -1;
             }
-            gwbuf_free(buffer);
-            buffer = NULL;
+            break;
+        }
+
+        from->last_read = hkheartbeat;
+        total += nread;
+
+        int left = nread;
+
+        /** Data already waiting in the write queue must be sent first */
+        while (!queued && left > 0)
+        {
+            int nwritten = splice(dcb_splice_pipe[0], NULL, to->fd, NULL, left,
+                                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (nwritten > 0)
+            {
+                to->stats.n_writes++;
+                left -= nwritten;
+            }
+            else
+            {
+                /**
+                 * The client can't take any more data. The rest is written
+                 * through the write queue which also handles any errors.
+                 */
+                queued = true;
+            }
+        }
+
+        if (left > 0 && !dcb_splice_queue(to, left))
+        {
+            total = -1;
+            break;
+        }
+
+        if (nread < DCB_SPLICE_SIZE)
+        {
+            /** A short read means that the socket was drained */
+            break;
         }
     }
-    return buffer;
+
+    return total;
 }
 
 /**
@@ -1233,7 +1441,7 @@ dcb_write(DCB *dcb, GWBUF *queue)
               dcb,
               STRDCBSTATE(dcb->state),
               dcb->fd);
-    if (empty_queue)
+    if (dcb->corked ? dcb->writeqlen >= DCB_CORK_MAX_BYTES : empty_queue)
     {
         dcb_drain_writeq(dcb);
     }
@@ -1242,6 +1450,60 @@ dcb_write(DCB *dcb, GWBUF *queue)
     return 1;
 }
 
+void dcb_cork(DCB *dcb)
+{
+    dcb->corked = true;
+}
+
+void dcb_uncork(DCB *dcb, bool more)
+{
+    dcb->corked = false;
+    dcb->write_more = more && dcb->ssl == NULL && dcb->state == DCB_STATE_POLLING;
+
+    /** Data queued for a DCB that has since been closed is not sent */
+    if (dcb->writeq && dcb->state != DCB_STATE_ZOMBIE && dcb->state != DCB_STATE_DISCONNECTED)
+    {
+        dcb_drain_writeq(dcb);
+    }
+
+    if (dcb->write_more)
+    {
+        if (!mxs_timer_is_active(&dcb->cork_timer))
+        {
+            mxs_timer_add(&dcb->cork_timer, DCB_CORK_MAX_TICKS);
+        }
+    }
+    else if (mxs_timer_is_active(&dcb->cork_timer))
+    {
+        /** The last write was done without MSG_MORE which sent everything */
+        mxs_timer_cancel(&dcb->cork_timer);
+    }
+}
+
+/**
+ * Push out the data the kernel is holding back because of MSG_MORE, called
+ * by the cork timer when the rest of the response didn't arrive in time
+ *
+ * @param timer The cork timer of the DCB
+ * @param data  The DCB
+ */
+static void dcb_cork_timer_cb(MXS_TIMER *timer, void *data)
+{
+    DCB *dcb = (DCB*)data;
+    int one = 1;
+
+    dcb->write_more = false;
+
+    /** Setting TCP_NODELAY sends any pending partial segments */
+    if (dcb->fd > 0 && setsockopt(dcb->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0 &&
+        errno != ENOTSUP && errno != EOPNOTSUPP)
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to push pending data of dcb %p fd %d: %d, %s",
+                  dcb, dcb->fd, errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+}
+
 /**
  * Check the parameters for dcb_write
  *
@@ -1443,6 +1705,12 @@ dcb_drain_writeq(DCB *dcb)
             {
                 written = gw_write(dcb, local_writeq, &stop_writing);
             }
+            /*
+             * Consume the bytes we have written from the list of buffers,
+             * and increment the total bytes written.
+             */
+            local_writeq = gwbuf_consume(local_writeq, written);
+            total_written += written;
             /*
              * If the stop_writing boolean is set, writing has become blocked,
              * so the remaining data is put back at the front of the write
@@ -1470,12 +1738,6 @@ dcb_drain_writeq(DCB *dcb)
                     goto wrap_up;
                 }
             }
-            /*
-             * Consume the bytes we have written from the list of buffers,
-             * and increment the total bytes written.
-             */
-            local_writeq = gwbuf_consume(local_writeq, written);
-            total_written += written;
         }
     }
     while ((local_writeq = dcb_grab_writeq(dcb, false)) != NULL);
@@ -1647,6 +1909,31 @@ dcb_close(DCB *dcb)
     }
 }
 
+/**
+ * Start the next client that is waiting for a free connection slot
+ *
+ * The client is started by the thread that accepted it. The slot is handed
+ * over with a fake event, so the client does not wait for any timer.
+ *
+ * @param service The service
+ * @return True if a queued client was started
+ */
+static bool
+dcb_start_queued(SERVICE *service)
+{
+    QUEUE_ENTRY conn_waiting;
+
+    if (mxs_dequeue(service->queued_connections, &conn_waiting))
+    {
+        DCB *waiting_dcb = (DCB *)conn_waiting.queued_object;
+        waiting_dcb->state = DCB_STATE_WAITING;
+        poll_fake_read_event(waiting_dcb);
+        return true;
+    }
+
+    return false;
+}
+
 /**
  * Add DCB to persistent pool if it qualifies, close otherwise
  *
@@ -1664,8 +1951,11 @@ dcb_maybe_add_persistent(DCB *dcb)
         && (dcb->server->status & SERVER_RUNNING)
         && !dcb->dcb_errhandle_called
         && !(dcb->flags & DCBF_HUNG)
-        && dcb_persistent_clean_count(dcb, dcb->thread.id, false) < dcb->server->persistpoolmax
-        && dcb->server->stats.n_persistent < dcb->server->persistpoolmax)
+        && !dcb->read_paused
+        && dcb->protoname
+        && persistpool_count(&dcb->server->persistent[dcb->thread.id]) < dcb->server->persistpoolmax
+        && ts_stats_sum(dcb->server->stats.n_persistent) < dcb->server->persistpoolmax
+        && persistpool_add(&dcb->server->persistent[dcb->thread.id], dcb))
     {
         DCB_CALLBACK *loopcallback;
         MXS_DEBUG("%lu [dcb_maybe_add_persistent] Adding DCB to persistent pool, user %s.\n",
@@ -1674,6 +1964,9 @@ dcb_maybe_add_persistent(DCB *dcb)
         dcb->was_persistent = false;
         dcb->dcb_is_zombie = false;
         dcb->persistentstart = time(NULL);
+        dcb->persistalive = dcb->persistentstart;
+        dcb->persistping = 0;
+        dcb_persistent_schedule(dcb);
         if (dcb->session)
             /*<
              * Terminate client session.
@@ -1694,17 +1987,17 @@ dcb_maybe_add_persistent(DCB *dcb)
             MXS_FREE(loopcallback);
         }
 
-        dcb->nextpersistent = dcb->server->persistent[dcb->thread.id];
-        dcb->server->persistent[dcb->thread.id] = dcb;
-        atomic_add(&dcb->server->stats.n_persistent, 1);
-        atomic_add(&dcb->server->stats.n_current, -1);
+        ts_stats_add(dcb->server->stats.n_persistent, 1);
+        dcb->server->persistmax = MXS_MAX(dcb->server->persistmax,
+                                          persistpool_count(&dcb->server->persistent[dcb->thread.id]));
+        ts_stats_add(dcb->server->stats.n_current, -1);
         return true;
     }
     else if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->server)
     {
         MXS_DEBUG("%lu [dcb_maybe_add_persistent] Not adding DCB %p to persistent pool, "
                   "user %s, max for pool %ld, error handle called %s, hung flag %s, "
-                  "server status %d, pool count %d.\n",
+                  "server status %d, pool count %" PRId64 ".\n",
                   pthread_self(),
                   dcb,
                   dcb->user ? dcb->user : "",
@@ -1712,7 +2005,7 @@ dcb_maybe_add_persistent(DCB *dcb)
                   dcb->dcb_errhandle_called ? "true" : "false",
                   (dcb->flags & DCBF_HUNG) ? "true" : "false",
                   dcb->server->status,
-                  dcb->server->stats.n_persistent);
+                  ts_stats_sum(dcb->server->stats.n_persistent));
     }
     return false;
 }
@@ -1761,6 +2054,8 @@ printDCB(DCB *dcb)
            dcb->stats.n_reads);
     printf("\t\tNo. of Writes:                      %d\n",
            dcb->stats.n_writes);
+    printf("\t\tNo. of Buffers Written:             %d\n",
+           dcb->stats.n_write_bufs);
     printf("\t\tNo. of Buffered Writes:             %d\n",
            dcb->stats.n_buffered);
     printf("\t\tNo. of Accepts:                     %d\n",
@@ -1799,10 +2094,32 @@ void printAllDCBs()
 }
 
 /**
- * Diagnostic to print one DCB in the system
+ * Print the compression statistics of a DCB
  *
- * @param       pdcb    DCB to print results to
- * @param       dcb     DCB to be printed
+ * Nothing is printed if the connection does not use compression.
+ *
+ * @param pdcb  DCB to print results to
+ * @param dcb   DCB to be printed
+ */
+static void dcb_print_compression(DCB *pdcb, DCB *dcb)
+{
+    if (dcb->stats.n_plain_in || dcb->stats.n_plain_out)
+    {
+        dcb_printf(pdcb, "\t\tCompressed bytes read:    %" PRIu64 " (%" PRIu64 " uncompressed)\n",
+                   dcb->stats.n_compressed_in, dcb->stats.n_plain_in);
+        dcb_printf(pdcb, "\t\tCompressed bytes written: %" PRIu64 " (%" PRIu64 " uncompressed)\n",
+                   dcb->stats.n_compressed_out, dcb->stats.n_plain_out);
+        dcb_printf(pdcb, "\t\tCompression ratio:        %.2f\n",
+                   (double)(dcb->stats.n_plain_in + dcb->stats.n_plain_out) /
+                   MXS_MAX(dcb->stats.n_compressed_in + dcb->stats.n_compressed_out, 1));
+    }
+}
+
+/**
+ * Diagnostic to print one DCB in the system
+ *
+ * @param       pdcb    DCB to print results to
+ * @param       dcb     DCB to be printed
  */
 void
 dprintOneDCB(DCB *pdcb, DCB *dcb)
@@ -1863,10 +2180,12 @@ dprintOneDCB(DCB *pdcb, DCB *dcb)
     dcb_printf(pdcb, "\tStatistics:\n");
     dcb_printf(pdcb, "\t\tNo. of Reads:             %d\n", dcb->stats.n_reads);
     dcb_printf(pdcb, "\t\tNo. of Writes:            %d\n", dcb->stats.n_writes);
+    dcb_printf(pdcb, "\t\tNo. of Buffers Written:   %d\n", dcb->stats.n_write_bufs);
     dcb_printf(pdcb, "\t\tNo. of Buffered Writes:   %d\n", dcb->stats.n_buffered);
     dcb_printf(pdcb, "\t\tNo. of Accepts:           %d\n", dcb->stats.n_accepts);
     dcb_printf(pdcb, "\t\tNo. of High Water Events: %d\n", dcb->stats.n_high_water);
     dcb_printf(pdcb, "\t\tNo. of Low Water Events:  %d\n", dcb->stats.n_low_water);
+    dcb_print_compression(pdcb, dcb);
     if (dcb->flags & DCBF_CLONE)
     {
         dcb_printf(pdcb, "\t\tDCB is a clone.\n");
@@ -2019,6 +2338,8 @@ dprintDCB(DCB *pdcb, DCB *dcb)
                dcb->stats.n_reads);
     dcb_printf(pdcb, "\t\tNo. of Writes:                    %d\n",
                dcb->stats.n_writes);
+    dcb_printf(pdcb, "\t\tNo. of Buffers Written:           %d\n",
+               dcb->stats.n_write_bufs);
     dcb_printf(pdcb, "\t\tNo. of Buffered Writes:           %d\n",
                dcb->stats.n_buffered);
     dcb_printf(pdcb, "\t\tNo. of Accepts:                   %d\n",
@@ -2027,6 +2348,7 @@ dprintDCB(DCB *pdcb, DCB *dcb)
                dcb->stats.n_high_water);
     dcb_printf(pdcb, "\t\tNo. of Low Water Events:  %d\n",
                dcb->stats.n_low_water);
+    dcb_print_compression(pdcb, dcb);
     if (DCB_POLL_BUSY(dcb))
     {
         dcb_printf(pdcb, "\t\tPending events in the queue:      %x %s\n",
@@ -2149,8 +2471,43 @@ static int
 gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
     int written;
+    uint8_t coalesced[DCB_SSL_COALESCE_SIZE];
+    void *data = GWBUF_DATA(writeq);
+    int len = GWBUF_LENGTH(writeq);
+    int nbufs = 1;
 
-    written = SSL_write(dcb->ssl, GWBUF_DATA(writeq), GWBUF_LENGTH(writeq));
+    if (dcb->ssl_write_retry_len)
+    {
+        /**
+         * A failed SSL_write must be retried with the same data. As nothing
+         * from the write queue was consumed, the data is still at its head.
+         */
+        len = dcb->ssl_write_retry_len;
+    }
+    else if (len < DCB_SSL_COALESCE_SIZE && writeq->next)
+    {
+        /** Coalesce small buffers so that they are sent as one SSL record */
+        len = 0;
+        nbufs = 0;
+
+        for (GWBUF *buf = writeq; buf && len < DCB_SSL_COALESCE_SIZE; buf = buf->next)
+        {
+            len += MXS_MIN(GWBUF_LENGTH(buf), DCB_SSL_COALESCE_SIZE - len);
+            nbufs++;
+        }
+    }
+
+    if (len > GWBUF_LENGTH(writeq))
+    {
+        ss_debug(size_t copied = ) gwbuf_copy_data(writeq, 0, len, coalesced);
+        ss_dassert(copied == (size_t)len);
+        data = coalesced;
+    }
+
+    written = SSL_write(dcb->ssl, data, len);
+    dcb->stats.n_writes++;
+    dcb->stats.n_write_bufs += nbufs;
+    dcb->ssl_write_retry_len = 0;
 
     *stop_writing = false;
     switch ((SSL_get_error(dcb->ssl, written)))
@@ -2172,6 +2529,7 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
         *stop_writing = true;
         dcb->ssl_write_want_read = true;
         dcb->ssl_write_want_write = false;
+        dcb->ssl_write_retry_len = len;
         break;
 
     case SSL_ERROR_WANT_WRITE:
@@ -2179,6 +2537,7 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
         *stop_writing = true;
         dcb->ssl_write_want_read = false;
         dcb->ssl_write_want_write = true;
+        dcb->ssl_write_retry_len = len;
         break;
 
     case SSL_ERROR_SYSCALL:
@@ -2205,6 +2564,10 @@ gw_write_SSL(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 /**
  * Write data to a DCB. The data is taken from the DCB's write queue.
  *
+ * Up to DCB_MAX_IOV buffers of the write queue are gathered into one writev
+ * call. A partial write means that the socket buffer is full and the caller
+ * is told to stop writing until the next EPOLLOUT event.
+ *
  * @param dcb           The DCB to write buffer
  * @param writeq        A buffer list containing the data to be written
  * @param stop_writing  Set to true if the caller should stop writing, false otherwise
@@ -2215,15 +2578,35 @@ gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
 {
     int written = 0;
     int fd = dcb->fd;
-    size_t nbytes = GWBUF_LENGTH(writeq);
-    void *buf = GWBUF_DATA(writeq);
+    struct iovec iov[DCB_MAX_IOV];
+    int iovcnt = 0;
+    size_t nbytes = 0;
     int saved_errno;
 
+    for (GWBUF *buf = writeq; buf && iovcnt < DCB_MAX_IOV; buf = buf->next)
+    {
+        iov[iovcnt].iov_base = GWBUF_DATA(buf);
+        iov[iovcnt].iov_len = GWBUF_LENGTH(buf);
+        nbytes += iov[iovcnt].iov_len;
+        iovcnt++;
+    }
+
     errno = 0;
 
     if (fd > 0)
     {
-        written = write(fd, buf, nbytes);
+        if (dcb->write_more)
+        {
+            /** Let the kernel merge the last partial segment with the rest of the response */
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+            written = sendmsg(fd, &msg, MSG_MORE);
+        }
+        else
+        {
+            written = iovcnt == 1 ? write(fd, iov[0].iov_base, iov[0].iov_len) : writev(fd, iov, iovcnt);
+        }
+        dcb->stats.n_writes++;
+        dcb->stats.n_write_bufs += iovcnt;
     }
 
     saved_errno = errno;
@@ -2253,7 +2636,8 @@ gw_write(DCB *dcb, GWBUF *writeq, bool *stop_writing)
     }
     else
     {
-        *stop_writing = false;
+        /** A partial write means that the socket buffer is full */
+        *stop_writing = (size_t)written < nbytes;
     }
 
     return written > 0 ? written : 0;
@@ -2416,9 +2800,11 @@ dcb_isvalid(DCB *dcb)
 }
 
 /**
- * Call all the callbacks on all DCB's that match the server and the reason given
+ * Fake a hangup of the backend DCBs of a server
  *
- * @param reason        The DCB_REASON that triggers the callback
+ * Only the DCBs of the server are visited, not all DCBs of the threads.
+ *
+ * @param server The server whose connections are hung up
  */
 void
 dcb_hangup_foreach(struct server* server)
@@ -2430,10 +2816,9 @@ dcb_hangup_foreach(struct server* server)
     {
         spinlock_acquire(&all_dcbs_lock[i]);
 
-        for (DCB *dcb = all_dcbs[i]; dcb; dcb = dcb->thread.next)
+        for (DCB *dcb = server->dcbs[i]; dcb; dcb = dcb->thread.server_next)
         {
-            if (dcb->state == DCB_STATE_POLLING && dcb->server &&
-                dcb->server == server)
+            if (dcb->state == DCB_STATE_POLLING)
             {
                 poll_fake_hangup_event(dcb);
             }
@@ -2443,6 +2828,94 @@ dcb_hangup_foreach(struct server* server)
     }
 }
 
+/**
+ * Resume the skipped reads of the backend DCBs of a session
+ *
+ * @param session The session whose client has drained its write queue
+ */
+static void dcb_resume_reads(MXS_SESSION *session)
+{
+    int thr = session->client_dcb->thread.id;
+
+    session->backend_reads_paused = false;
+
+    if (session->n_paused_reads == 0)
+    {
+        return;
+    }
+
+    spinlock_acquire(&all_dcbs_lock[thr]);
+
+    for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+    {
+        if (dcb->read_paused && dcb->session == session)
+        {
+            dcb->read_paused = false;
+            poll_fake_read_event(dcb);
+        }
+    }
+
+    spinlock_release(&all_dcbs_lock[thr]);
+
+    session->n_paused_reads = 0;
+}
+
+/**
+ * The high and low water callback of a client DCB with backpressure
+ */
+static int dcb_backpressure_cb(DCB *dcb, DCB_REASON reason, void *userdata)
+{
+    MXS_SESSION *session = dcb->session;
+
+    if (session && session->state == SESSION_STATE_ROUTER_READY && session->client_dcb == dcb)
+    {
+        if (reason == DCB_REASON_HIGH_WATER)
+        {
+            MXS_DEBUG("Client of session %lu is above its high water mark, "
+                      "pausing backend reads.", session->ses_id);
+            session->backend_reads_paused = true;
+        }
+        else if (reason == DCB_REASON_LOW_WATER && session->backend_reads_paused)
+        {
+            MXS_DEBUG("Client of session %lu is below its low water mark, "
+                      "resuming backend reads.", session->ses_id);
+            dcb_resume_reads(session);
+        }
+    }
+
+    return 0;
+}
+
+bool dcb_set_backpressure(DCB *dcb, int high_water, int low_water)
+{
+    ss_dassert(dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER);
+    ss_dassert(low_water < high_water);
+    dcb->high_water = high_water;
+    dcb->low_water = low_water;
+
+    return dcb_add_callback(dcb, DCB_REASON_HIGH_WATER, dcb_backpressure_cb, NULL) &&
+           dcb_add_callback(dcb, DCB_REASON_LOW_WATER, dcb_backpressure_cb, NULL);
+}
+
+bool dcb_pause_read(DCB *dcb)
+{
+    MXS_SESSION *session = dcb->session;
+
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->dcb_fakequeue == NULL &&
+        session && session->backend_reads_paused)
+    {
+        if (!dcb->read_paused)
+        {
+            dcb->read_paused = true;
+            session->n_paused_reads++;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
 /**
  * Null protocol write routine used for cloned dcb's. It merely consumes
  * buffers written on the cloned DCB and sets the DCB_REPLIED flag.
@@ -2478,76 +2951,82 @@ dcb_null_auth(DCB *dcb, SERVER *server, MXS_SESSION *session, GWBUF *buf)
     return 0;
 }
 
+/** The state of dcb_persistent_clean */
+struct persistent_clean
+{
+    SERVER *server;   /**< The server of the pool */
+    bool    cleanall; /**< Whether all connections are removed */
+    int     count;    /**< Number of connections kept */
+};
+
+static bool dcb_persistent_should_clean(DCB *dcb, void *data)
+{
+    struct persistent_clean *clean = (struct persistent_clean*)data;
+    SERVER *server = clean->server;
+
+    CHK_DCB(dcb);
+
+    if (clean->cleanall
+        || dcb->dcb_errhandle_called
+        || clean->count >= server->persistpoolmax
+        || dcb->server == NULL
+        || !(dcb->server->status & SERVER_RUNNING)
+        || (time(NULL) - dcb->persistentstart) > server->persistmaxtime)
+    {
+        return true;
+    }
+
+    clean->count++;
+    return false;
+}
+
 /**
  * Check persistent pool for expiry or excess size and count
  *
- * @param dcb           The DCB being closed.
+ * This walks the whole pool, the expiry of single connections is done by
+ * their timers.
+ *
+ * @param server        The server of the pool
  * @param id            Thread ID
- * @param cleanall      Boolean, if true the whole pool is cleared for the
- *                      server related to the given DCB
+ * @param cleanall      Boolean, if true the whole pool is cleared
  * @return              A count of the DCBs remaining in the pool
  */
 int
-dcb_persistent_clean_count(DCB *dcb, int id, bool cleanall)
-{
-    int count = 0;
-    if (dcb && dcb->server)
-    {
-        SERVER *server = dcb->server;
-        DCB *previousdcb = NULL;
-        DCB *persistentdcb, *nextdcb;
-        DCB *disposals = NULL;
-
-        CHK_SERVER(server);
-        persistentdcb = server->persistent[id];
-        while (persistentdcb)
-        {
-            CHK_DCB(persistentdcb);
-            nextdcb = persistentdcb->nextpersistent;
-            if (cleanall
-                || persistentdcb-> dcb_errhandle_called
-                || count >= server->persistpoolmax
-                || persistentdcb->server == NULL
-                || !(persistentdcb->server->status & SERVER_RUNNING)
-                || (time(NULL) - persistentdcb->persistentstart) > server->persistmaxtime)
-            {
-                /* Remove from persistent pool */
-                if (previousdcb)
-                {
-                    previousdcb->nextpersistent = nextdcb;
-                }
-                else
-                {
-                    server->persistent[id] = nextdcb;
-                }
-                /* Add removed DCBs to disposal list for processing outside spinlock */
-                persistentdcb->nextpersistent = disposals;
-                disposals = persistentdcb;
-                atomic_add(&server->stats.n_persistent, -1);
-            }
-            else
-            {
-                count++;
-                previousdcb = persistentdcb;
-            }
-            persistentdcb = nextdcb;
-        }
-        server->persistmax = MXS_MAX(server->persistmax, count);
+dcb_persistent_clean(SERVER *server, int id, bool cleanall)
+{
+    struct persistent_clean clean = {server, cleanall, 0};
 
-        /** Call possible callback for this DCB in case of close */
-        while (disposals)
-        {
-            nextdcb = disposals->nextpersistent;
-            disposals->persistentstart = -1;
-            if (DCB_STATE_POLLING == disposals->state)
-            {
-                dcb_stop_polling_and_shutdown(disposals);
-            }
-            dcb_close(disposals);
-            disposals = nextdcb;
-        }
+    CHK_SERVER(server);
+    DCB *disposals = persistpool_extract(&server->persistent[id], dcb_persistent_should_clean, &clean);
+    server->persistmax = MXS_MAX(server->persistmax, clean.count);
+
+    while (disposals)
+    {
+        DCB *nextdcb = disposals->pool_links[0].next;
+        disposals->pool_links[0].next = NULL;
+        ts_stats_add(server->stats.n_persistent, -1);
+        dcb_persistent_discard(disposals);
+        disposals = nextdcb;
     }
-    return count;
+
+    return clean.count;
+}
+
+/**
+ * Close a DCB that was removed from the persistent pool
+ *
+ * @param dcb The DCB
+ */
+void
+dcb_persistent_discard(DCB *dcb)
+{
+    /** Call possible callback for this DCB in case of close */
+    dcb->persistentstart = -1;
+    if (DCB_STATE_POLLING == dcb->state)
+    {
+        dcb_stop_polling_and_shutdown(dcb);
+    }
+    dcb_close(dcb);
 }
 
 struct dcb_usage_count
@@ -2639,9 +3118,43 @@ dcb_create_SSL(DCB* dcb, SSL_LISTENER *ssl)
         return -1;
     }
 
+    /** Retries of coalesced writes are done from a different buffer */
+    SSL_set_mode(dcb->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    /** Used by the new session callback of the SSL context */
+    SSL_set_app_data(dcb->ssl, dcb);
+
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && ssl->ssl_session_cache)
+    {
+        /** Resume the session of the latest connection to the server */
+        spinlock_acquire(&ssl->session_lock);
+
+        if (ssl->session)
+        {
+            SSL_set_session(dcb->ssl, ssl->session);
+        }
+
+        spinlock_release(&ssl->session_lock);
+    }
+
     return 0;
 }
 
+/**
+ * Count the connection if its handshake resumed an earlier session
+ *
+ * @param dcb DCB that completed the SSL handshake
+ * @param ssl SSL configuration of the listener or the server
+ */
+static void
+dcb_count_resumed_SSL(DCB *dcb, SSL_LISTENER *ssl)
+{
+    if (SSL_session_reused(dcb->ssl))
+    {
+        atomic_add(&ssl->n_resumed, 1);
+    }
+}
+
 /**
  * Accept a SSL connection and do the SSL authentication handshake.
  * This function accepts a client connection to a DCB. It assumes that the SSL
@@ -2670,6 +3183,7 @@ int dcb_accept_SSL(DCB* dcb)
     {
     case SSL_ERROR_NONE:
         MXS_DEBUG("SSL_accept done for %s@%s", user, remote);
+        dcb_count_resumed_SSL(dcb, dcb->listener->ssl);
         dcb->ssl_state = SSL_ESTABLISHED;
         dcb->ssl_read_want_write = false;
         return 1;
@@ -2744,6 +3258,7 @@ int dcb_connect_SSL(DCB* dcb)
     {
     case SSL_ERROR_NONE:
         MXS_DEBUG("SSL_connect done for %s", dcb->remote);
+        dcb_count_resumed_SSL(dcb, dcb->server->server_ssl);
         dcb->ssl_state = SSL_ESTABLISHED;
         dcb->ssl_read_want_write = false;
         return_code = 1;
@@ -2809,6 +3324,10 @@ int dcb_connect_SSL(DCB* dcb)
  * are set before returning the new DCB to the caller, or returning NULL if
  * no new connection could be achieved.
  *
+ * NULL is also returned when the thread has accepted accept_batch_size
+ * connections in this poll cycle or when the listener has exceeded its
+ * max_connection_rate. The remaining connections are then accepted later.
+ *
  * @param dcb Listener DCB that has detected new connection request
  * @return DCB - The new client DCB for the new connection, or NULL if failed
  */
@@ -2823,9 +3342,16 @@ dcb_accept(DCB *listener)
     socklen_t optlen = sizeof(sendbuf);
     char errbuf[MXS_STRERROR_BUFLEN];
 
+    if (!dcb_accept_allowed(listener))
+    {
+        return NULL;
+    }
+
     if ((c_sock = dcb_accept_one_connection(listener, (struct sockaddr *)&client_conn)) >= 0)
     {
         listener->stats.n_accepts++;
+        poll_count_accept();
+        listener_count_accept(listener->listener);
         MXS_DEBUG("%lu [gw_MySQLAccept] Accepted fd %d.",
                   pthread_self(),
                   c_sock);
@@ -2929,14 +3455,29 @@ dcb_accept(DCB *listener)
             if (client_dcb->service->max_connections &&
                 client_dcb->service->client_count >= client_dcb->service->max_connections)
             {
-                if (!mxs_enqueue(client_dcb->service->queued_connections, client_dcb))
+                SERVICE *service = client_dcb->service;
+
+                if (!mxs_enqueue(service->queued_connections, client_dcb))
                 {
                     if (client_dcb->func.connlimit)
                     {
-                        client_dcb->func.connlimit(client_dcb, client_dcb->service->max_connections);
+                        client_dcb->func.connlimit(client_dcb, service->max_connections);
                     }
                     dcb_close(client_dcb);
                 }
+                else
+                {
+                    /** A client may have disconnected after the check but before the
+                     * queue had any entries, in which case nobody would start the
+                     * queued client until the next client disconnects */
+                    atomic_synchronize();
+
+                    if (atomic_load_int32(&service->client_count) < service->max_connections &&
+                        dcb_start_queued(service))
+                    {
+                        atomic_add(&service->client_count, 1);
+                    }
+                }
                 client_dcb = NULL;
             }
         }
@@ -2944,6 +3485,33 @@ dcb_accept(DCB *listener)
     return client_dcb;
 }
 
+/**
+ * @brief Check whether a listener may accept a connection now
+ *
+ * If it may not, the accept is deferred.
+ *
+ * @param listener Listener DCB
+ * @return True if a connection can be accepted
+ */
+static bool dcb_accept_allowed(DCB *listener)
+{
+    int64_t delay;
+
+    if (!poll_accept_budget_left())
+    {
+        /** The rest are accepted on the next poll cycle */
+        poll_defer_accept(listener, 0);
+        return false;
+    }
+    else if ((delay = listener_accept_delay(listener->listener)) > 0)
+    {
+        poll_defer_accept(listener, delay);
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Accept a new client connection, given listener, return file descriptor
  *
@@ -2958,6 +3526,8 @@ static int
 dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn)
 {
     int c_sock;
+    /** A sharded listener only accepts from the socket of this thread */
+    int l_sock = listener->listener_fds ? listener->listener_fds[current_thread_id] : listener->fd;
 
     /* Try up to 10 times to get a file descriptor by use of accept */
     for (int i = 0; i < 10; i++)
@@ -2966,7 +3536,7 @@ dcb_accept_one_connection(DCB *listener, struct sockaddr *client_conn)
         int eno = 0;
 
         /* new connection from client */
-        c_sock = accept(listener->fd,
+        c_sock = accept(l_sock,
                         client_conn,
                         &client_len);
         eno = errno;
@@ -3059,6 +3629,8 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
     }
 
     int listener_socket = -1;
+    /** Sharding is not done for UNIX domain sockets */
+    bool reuseport = false;
 
     if (strchr(host, '/'))
     {
@@ -3066,7 +3638,8 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
     }
     else if (port > 0)
     {
-        listener_socket = dcb_listen_create_socket_inet(host, port);
+        reuseport = config_get_global_options()->listener_reuseport && config_threadcount() > 1;
+        listener_socket = dcb_listen_create_socket_inet(host, port, reuseport);
 
         if (listener_socket == -1 && strcmp(host, "::") == 0)
         {
@@ -3074,7 +3647,7 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
             MXS_WARNING("Failed to bind on default IPv6 host '::', attempting "
                         "to bind on IPv4 version '0.0.0.0'");
             strcpy(host, "0.0.0.0");
-            listener_socket = dcb_listen_create_socket_inet(host, port);
+            listener_socket = dcb_listen_create_socket_inet(host, port, reuseport);
         }
     }
     else
@@ -3104,11 +3677,19 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
         return -1;
     }
 
-    MXS_NOTICE("Listening for connections at [%s]:%u with protocol %s", host, port, protocol_name);
-
     // assign listener_socket to dcb
     listener->fd = listener_socket;
 
+    if (reuseport && !dcb_listen_create_shards(listener, host, port))
+    {
+        close(listener_socket);
+        listener->fd = DCBFD_CLOSED;
+        return -1;
+    }
+
+    MXS_NOTICE("Listening for connections at [%s]:%u with protocol %s%s", host, port,
+               protocol_name, reuseport ? ", one socket per thread" : "");
+
     // add listening socket to poll structure
     if (poll_add_dcb(listener) != 0)
     {
@@ -3119,18 +3700,99 @@ int dcb_listen(DCB *listener, const char *config, const char *protocol_name)
     return 0;
 }
 
+/**
+ * @brief Create the per-thread listener sockets of a sharded listener
+ *
+ * The socket in @c listener->fd is used by the first thread and one new
+ * SO_REUSEPORT socket is opened for each of the other threads. The kernel
+ * then distributes the new connections between the sockets. If the threads
+ * are pinned to CPUs, the connections go to the thread on the CPU that
+ * receives their packets.
+ *
+ * @param listener Listener DCB whose first socket is already listening
+ * @param host     The network address to listen on
+ * @param port     The port to listen on
+ * @return         True if all sockets were created
+ */
+static bool dcb_listen_create_shards(DCB *listener, const char *host, uint16_t port)
+{
+    int n_threads = config_threadcount();
+    int *fds = MXS_MALLOC(n_threads * sizeof(int));
+
+    if (fds == NULL)
+    {
+        return false;
+    }
+
+    fds[0] = listener->fd;
+
+    for (int i = 1; i < n_threads; i++)
+    {
+        if ((fds[i] = dcb_listen_create_socket_inet(host, port, true)) == -1 ||
+            listen(fds[i], INT_MAX) != 0)
+        {
+            MXS_ERROR("Failed to create listener socket %d of %d for '[%s]:%u': %d, %s",
+                      i + 1, n_threads, host, port, errno, mxs_strerror(errno));
+
+            for (int j = 1; j <= i; j++)
+            {
+                if (fds[j] != -1)
+                {
+                    close(fds[j]);
+                }
+            }
+
+            MXS_FREE(fds);
+            return false;
+        }
+    }
+
+#ifdef SO_INCOMING_CPU
+    for (int i = 0; i < n_threads; i++)
+    {
+        int cpu = config_thread_cpu(i);
+
+        /** The kernel gives a connection to the socket of the thread that runs on
+         * the CPU where the packets of the connection are received */
+        if (cpu != -1 && setsockopt(fds[i], SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) != 0)
+        {
+            MXS_WARNING("Failed to set the CPU of listener socket %d of '[%s]:%u': %d, %s",
+                        i + 1, host, port, errno, mxs_strerror(errno));
+        }
+    }
+#endif
+
+    listener->listener_fds = fds;
+    return true;
+}
+
 /**
  * @brief Create a network listener socket
  *
- * @param host The network address to listen on
- * @param port The port to listen on
- * @return     The opened socket or -1 on error
+ * @param host      The network address to listen on
+ * @param port      The port to listen on
+ * @param reuseport Whether SO_REUSEPORT is set so that several sockets can
+ *                  listen on the same address
+ * @return          The opened socket or -1 on error
  */
-static int dcb_listen_create_socket_inet(const char *host, uint16_t port)
+static int dcb_listen_create_socket_inet(const char *host, uint16_t port, bool reuseport)
 {
     struct sockaddr_storage server_address = {};
     int listener_socket = open_network_socket(MXS_SOCKET_LISTENER, &server_address, host, port);
 
+#ifdef SO_REUSEPORT
+    if (listener_socket != -1 && reuseport)
+    {
+        int one = 1;
+
+        if (dcb_set_socket_option(listener_socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)
+        {
+            close(listener_socket);
+            listener_socket = -1;
+        }
+    }
+#endif
+
     if (listener_socket != -1)
     {
         if (bind(listener_socket, (struct sockaddr*)&server_address, sizeof(server_address)) < 0)
@@ -3294,6 +3956,184 @@ void dcb_append_readqueue(DCB *dcb, GWBUF *buffer)
     dcb->dcb_readqueue = gwbuf_append(dcb->dcb_readqueue, buffer);
 }
 
+/**
+ * @brief Double the size of a session index once it has twice as many DCBs as buckets
+ *
+ * A failure to grow only makes the hash chains longer. The lock of the thread
+ * must be held.
+ */
+static void dcb_session_index_grow(DCB_SESSION_INDEX *index)
+{
+    if (index->n_buckets && index->n_dcbs < index->n_buckets * 2)
+    {
+        return;
+    }
+
+    int n_buckets = index->n_buckets ? index->n_buckets * 2 : DCB_SESSION_INDEX_BUCKETS;
+    DCB **buckets = (DCB**)MXS_CALLOC(n_buckets, sizeof(*buckets));
+
+    if (buckets)
+    {
+        for (int i = 0; i < index->n_buckets; i++)
+        {
+            DCB *dcb = index->buckets[i];
+
+            while (dcb)
+            {
+                DCB *next = dcb->thread.session_next;
+                dcb->thread.session_next = buckets[dcb->thread.session_id % n_buckets];
+                buckets[dcb->thread.session_id % n_buckets] = dcb;
+                dcb = next;
+            }
+        }
+
+        MXS_FREE(index->buckets);
+        index->buckets = buckets;
+        index->n_buckets = n_buckets;
+    }
+}
+
+/**
+ * @brief Add the client DCB of a session to the session index of its thread
+ *
+ * The lock of the thread must be held.
+ */
+static void dcb_session_index_add(DCB *dcb)
+{
+    MXS_SESSION *session = dcb->session;
+
+    if (session && session->state != SESSION_STATE_DUMMY && session->ses_id &&
+        session->client_dcb == dcb && dcb->thread.session_id == 0)
+    {
+        DCB_SESSION_INDEX *index = &session_index[dcb->thread.id];
+        dcb_session_index_grow(index);
+
+        if (index->n_buckets)
+        {
+            DCB **bucket = &index->buckets[session->ses_id % index->n_buckets];
+            dcb->thread.session_id = session->ses_id;
+            dcb->thread.session_next = *bucket;
+            *bucket = dcb;
+            index->n_dcbs++;
+        }
+    }
+}
+
+/**
+ * @brief Remove a DCB from the session index of its thread
+ *
+ * The lock of the thread must be held.
+ */
+static void dcb_session_index_remove(DCB *dcb)
+{
+    if (dcb->thread.session_id)
+    {
+        DCB_SESSION_INDEX *index = &session_index[dcb->thread.id];
+        DCB **prev = &index->buckets[dcb->thread.session_id % index->n_buckets];
+
+        while (*prev != dcb)
+        {
+            prev = &(*prev)->thread.session_next;
+        }
+
+        *prev = dcb->thread.session_next;
+        index->n_dcbs--;
+        dcb->thread.session_next = NULL;
+        dcb->thread.session_id = 0;
+    }
+}
+
+/**
+ * @brief Add a backend DCB to the list of its server in its thread
+ *
+ * The lock of the thread must be held.
+ */
+static void dcb_server_list_add(DCB *dcb)
+{
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->server && dcb->server->dcbs)
+    {
+        DCB **head = &dcb->server->dcbs[dcb->thread.id];
+        dcb->thread.server_prev = NULL;
+        dcb->thread.server_next = *head;
+
+        if (*head)
+        {
+            (*head)->thread.server_prev = dcb;
+        }
+
+        *head = dcb;
+    }
+}
+
+/**
+ * @brief Remove a backend DCB from the list of its server in its thread
+ *
+ * The lock of the thread must be held.
+ */
+static void dcb_server_list_remove(DCB *dcb)
+{
+    if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->server && dcb->server->dcbs)
+    {
+        DCB **head = &dcb->server->dcbs[dcb->thread.id];
+
+        if (dcb->thread.server_prev)
+        {
+            dcb->thread.server_prev->thread.server_next = dcb->thread.server_next;
+        }
+        else if (*head == dcb)
+        {
+            *head = dcb->thread.server_next;
+        }
+
+        if (dcb->thread.server_next)
+        {
+            dcb->thread.server_next->thread.server_prev = dcb->thread.server_prev;
+        }
+
+        dcb->thread.server_next = NULL;
+        dcb->thread.server_prev = NULL;
+    }
+}
+
+void dcb_index_session(DCB *dcb)
+{
+    if (dcb->state == DCB_STATE_POLLING)
+    {
+        spinlock_acquire(&all_dcbs_lock[dcb->thread.id]);
+        dcb_session_index_add(dcb);
+        spinlock_release(&all_dcbs_lock[dcb->thread.id]);
+    }
+}
+
+MXS_SESSION* dcb_get_session_by_id(size_t id)
+{
+    int nthr = config_threadcount();
+    MXS_SESSION *session = NULL;
+
+    for (int i = 0; i < nthr && session == NULL; i++)
+    {
+        spinlock_acquire(&all_dcbs_lock[i]);
+
+        if (session_index[i].n_buckets)
+        {
+            for (DCB *dcb = session_index[i].buckets[id % session_index[i].n_buckets];
+                 dcb; dcb = dcb->thread.session_next)
+            {
+                if (dcb->thread.session_id == id)
+                {
+                    /** The DCB keeps the session alive while it is in the index */
+                    session = session_get_ref(dcb->session);
+                    break;
+                }
+            }
+        }
+
+        spinlock_release(&all_dcbs_lock[i]);
+    }
+
+    return session;
+}
+
 void dcb_add_to_list(DCB *dcb)
 {
     if (dcb->dcb_role != DCB_ROLE_SERVICE_LISTENER ||
@@ -3318,6 +4158,9 @@ void dcb_add_to_list(DCB *dcb)
             all_dcbs[dcb->thread.id]->thread.tail = dcb;
         }
 
+        dcb_server_list_add(dcb);
+        dcb_session_index_add(dcb);
+
         spinlock_release(&all_dcbs_lock[dcb->thread.id]);
     }
 }
@@ -3331,6 +4174,9 @@ static void dcb_remove_from_list(DCB *dcb)
 {
     spinlock_acquire(&all_dcbs_lock[dcb->thread.id]);
 
+    dcb_server_list_remove(dcb);
+    dcb_session_index_remove(dcb);
+
     if (dcb == all_dcbs[dcb->thread.id])
     {
         DCB *tail = all_dcbs[dcb->thread.id]->thread.tail;
@@ -3370,52 +4216,307 @@ static void dcb_remove_from_list(DCB *dcb)
     spinlock_release(&all_dcbs_lock[dcb->thread.id]);
 }
 
+/** The maximum number of backend DCBs a session can have for it to be moved */
+#define DCB_MIGRATE_MAX_BACKENDS 64
+
+/** How many heartbeats a DCB must have been idle before it can be moved */
+#define DCB_MIGRATE_IDLE_TIME 10
+
+/**
+ * Check whether a DCB is idle enough to be moved to another thread
+ *
+ * @param dcb DCB to check
+ * @return True if the DCB has no pending data, its protocol waits for no
+ *         replies and it has been idle for a while
+ */
+static bool dcb_is_idle(DCB *dcb)
+{
+    return dcb->state == DCB_STATE_POLLING && dcb->fd > 0 && !dcb->dcb_is_zombie &&
+           dcb->writeq == NULL && dcb->delayq == NULL && dcb->dcb_readqueue == NULL &&
+           dcb->dcb_fakequeue == NULL && !dcb->draining_flag &&
+           dcb->ssl_state != SSL_HANDSHAKE_REQUIRED &&
+           hkheartbeat - dcb->last_read >= DCB_MIGRATE_IDLE_TIME &&
+           (dcb->func.idle == NULL || dcb->func.idle(dcb));
+}
+
 /**
- * Enable the timing out of idle connections.
+ * Check whether the router of a session lets it be moved to another thread
+ *
+ * A query that has not been answered is not noticed by the DCBs if the server
+ * has taken a while to reply, so the router is asked whether it waits for one.
+ *
+ * @param session The session
+ * @return True if the router has no replies or thread bound state pending
  */
-void dcb_enable_session_timeouts()
+static bool dcb_session_is_idle(MXS_SESSION *session)
 {
-    check_timeouts = true;
+    SERVICE *service = session->service;
+
+    return service->router->isIdle == NULL ||
+           service->router->isIdle(service->router_instance, session->router_session);
 }
 
 /**
- * Close sessions that have been idle for too long.
+ * Find the backend DCBs of a session
  *
- * If the time since a session last sent data is greater than the set value in the
- * service, it is disconnected. The connection timeout is disabled by default.
+ * @param thr      The thread that owns the session
+ * @param session  The session
+ * @param backends Array of DCB_MIGRATE_MAX_BACKENDS elements where the DCBs are stored
+ * @return Number of backend DCBs or -1 if one of them is not idle or there are too many
  */
-void dcb_process_idle_sessions(int thr)
+static int dcb_find_idle_backends(int thr, MXS_SESSION *session, DCB **backends)
 {
-    if (check_timeouts && hkheartbeat >= next_timeout_check)
-    {
-        /** Because the resolution of the timeout is one second, we only need to
-         * check for it once per second. One heartbeat is 100 milliseconds. */
-        next_timeout_check = hkheartbeat + 10;
+    int n = 0;
 
-        for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+    for (DCB *dcb = all_dcbs[thr]; dcb; dcb = dcb->thread.next)
+    {
+        if (dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER && dcb->session == session)
         {
-            if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+            if (n == DCB_MIGRATE_MAX_BACKENDS || !dcb_is_idle(dcb))
             {
-                ss_dassert(dcb->listener);
-                SERVICE *service = dcb->listener->service;
+                return -1;
+            }
 
-                if (service->conn_idle_timeout && dcb->state == DCB_STATE_POLLING)
-                {
-                    int64_t idle = hkheartbeat - dcb->last_read;
-                    int64_t timeout = service->conn_idle_timeout * 10;
+            backends[n++] = dcb;
+        }
+    }
 
-                    if (idle > timeout)
-                    {
-                        MXS_WARNING("Timing out '%s'@%s, idle for %.1f seconds",
-                                    dcb->user ? dcb->user : "<unknown>",
-                                    dcb->remote ? dcb->remote : "<unknown>",
-                                    (float)idle / 10.f);
-                        poll_fake_hangup_event(dcb);
-                    }
-                }
-            }
+    return n;
+}
+
+/**
+ * Move a detached DCB to the list of another thread
+ *
+ * @param dcb DCB to move
+ * @param to  The new owner
+ */
+static void dcb_change_owner(DCB *dcb, int to)
+{
+    dcb_remove_from_list(dcb);
+    dcb->thread.id = to;
+    dcb_add_to_list(dcb);
+
+    if (mxs_timer_is_active(&dcb->cork_timer))
+    {
+        mxs_timer_cancel(&dcb->cork_timer);
+        dcb_cork_timer_cb(&dcb->cork_timer, dcb);
+    }
+
+    if (mxs_timer_is_active(&dcb->timer))
+    {
+        int64_t remaining = dcb->timer.expires - hkheartbeat;
+        mxs_timer_cancel(&dcb->timer);
+        mxs_timer_add_to(to, &dcb->timer, remaining);
+    }
+}
+
+bool dcb_migrate_idle_session(int from, int to)
+{
+    ss_dassert(from != to);
+    DCB *client = NULL;
+    DCB *backends[DCB_MIGRATE_MAX_BACKENDS];
+    int n_backends = -1;
+
+    for (DCB *dcb = all_dcbs[from]; dcb; dcb = dcb->thread.next)
+    {
+        if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && dcb->session &&
+            dcb->session->state == SESSION_STATE_ROUTER_READY && dcb_is_idle(dcb) &&
+            dcb_session_is_idle(dcb->session) &&
+            (n_backends = dcb_find_idle_backends(from, dcb->session, backends)) >= 0)
+        {
+            client = dcb;
+            break;
         }
     }
+
+    if (client == NULL)
+    {
+        return false;
+    }
+
+    /** No events can be processed for the DCBs while they are detached */
+    int n_detached = 0;
+    bool ok = poll_detach_dcb(client);
+
+    for (; ok && n_detached < n_backends; n_detached++)
+    {
+        ok = poll_detach_dcb(backends[n_detached]);
+    }
+
+    if (!ok)
+    {
+        /** Put the detached DCBs back where they were */
+        for (int i = 0; i < n_detached; i++)
+        {
+            poll_attach_dcb(backends[i]);
+        }
+        poll_attach_dcb(client);
+        return false;
+    }
+
+    /** The client DCB is moved last so that the new owner only starts to
+     * route the fake events of the session once the backends have moved */
+    for (int i = 0; i < n_backends; i++)
+    {
+        dcb_change_owner(backends[i], to);
+    }
+
+    dcb_change_owner(client, to);
+
+    for (int i = 0; i < n_backends; i++)
+    {
+        poll_attach_dcb(backends[i]);
+    }
+
+    poll_attach_dcb(client);
+
+    MXS_INFO("Moved session %lu with %d backend connections from thread %d to thread %d.",
+             client->session->ses_id, n_backends, from, to);
+
+    return true;
+}
+
+/**
+ * Close the client DCB if it has been idle for too long, called by the timer
+ * of the DCB in its owning thread.
+ *
+ * If the time since the client last sent data is greater than the idle timeout
+ * of the service, the client is disconnected. The connection timeout is
+ * disabled by default.
+ *
+ * @param dcb Client DCB
+ */
+static void dcb_check_idle_timeout(DCB *dcb)
+{
+    ss_dassert(dcb->listener);
+    SERVICE *service = dcb->listener->service;
+    int64_t timeout = service->conn_idle_timeout * 10;
+
+    if (timeout == 0)
+    {
+        mxs_timer_add(&dcb->timer, DCB_IDLE_RECHECK_TICKS);
+    }
+    else
+    {
+        int64_t idle = hkheartbeat - dcb->last_read;
+
+        if (idle > timeout)
+        {
+            MXS_WARNING("Timing out '%s'@%s, idle for %.1f seconds",
+                        dcb->user ? dcb->user : "<unknown>",
+                        dcb->remote ? dcb->remote : "<unknown>",
+                        (float)idle / 10.f);
+            poll_fake_hangup_event(dcb);
+        }
+        else
+        {
+            mxs_timer_add(&dcb->timer, timeout - idle + 1);
+        }
+    }
+}
+
+/**
+ * Start the timer of a pooled DCB
+ *
+ * The timer fires when the DCB expires or when it is due to be pinged. The
+ * clock of the pool has a resolution of one second, so the timer fires a
+ * second late to be sure that the DCB is old enough.
+ *
+ * @param dcb The pooled DCB
+ */
+static void dcb_persistent_schedule(DCB *dcb)
+{
+    SERVER *server = dcb->server;
+    time_t now = time(NULL);
+    time_t next = dcb->persistentstart + server->persistmaxtime;
+
+    if (server->persistpingtime && dcb->func.ping)
+    {
+        /** A reply that is not received before the next ping is due counts as a failure */
+        time_t last = dcb->persistping ? dcb->persistping : dcb->persistalive;
+        next = MXS_MIN(next, last + server->persistpingtime);
+    }
+
+    mxs_timer_add(&dcb->timer, MXS_MAX(next - now, 0) * 10 + 10);
+}
+
+/**
+ * Check a pooled DCB when its timer fires
+ *
+ * A DCB is removed from the pool if it has expired, it has failed or it
+ * did not reply to the previous ping in time. A DCB that has been idle for
+ * persistpingtime seconds is pinged and the protocol clears the pending
+ * ping once the reply is read.
+ *
+ * @param dcb The pooled DCB
+ */
+static void dcb_persistent_check(DCB *dcb)
+{
+    SERVER *server = dcb->server;
+    time_t now = time(NULL);
+    bool ping_failed = dcb->persistping && now - dcb->persistping >= server->persistpingtime;
+    bool ping_due = !dcb->persistping && server->persistpingtime && dcb->func.ping &&
+                    now - dcb->persistalive >= server->persistpingtime;
+
+    if (ping_failed)
+    {
+        MXS_INFO("Pooled connection to server '%s' did not reply to a ping in %ld seconds, "
+                 "closing it.", server->unique_name, (long)(now - dcb->persistping));
+        ts_stats_add(server->stats.n_persistent_dead, 1);
+    }
+
+    if (dcb->dcb_errhandle_called
+        || ping_failed
+        || !(server->status & SERVER_RUNNING)
+        || (now - dcb->persistentstart) > server->persistmaxtime
+        || (ping_due && dcb->func.ping(dcb) == 0))
+    {
+        persistpool_remove(dcb);
+        ts_stats_add(server->stats.n_persistent, -1);
+        dcb_persistent_discard(dcb);
+        return;
+    }
+
+    if (ping_due)
+    {
+        dcb->persistping = now;
+        ts_stats_add(server->stats.n_persistent_pings, 1);
+    }
+
+    dcb_persistent_schedule(dcb);
+}
+
+/**
+ * The timer callback of a DCB
+ *
+ * @param timer The timer of the DCB
+ * @param data  The DCB
+ */
+static void dcb_timer_cb(MXS_TIMER *timer, void *data)
+{
+    DCB *dcb = (DCB*)data;
+
+    if (dcb->persistentstart > 0)
+    {
+        dcb_persistent_check(dcb);
+    }
+    else if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && dcb->state == DCB_STATE_POLLING)
+    {
+        dcb_check_idle_timeout(dcb);
+    }
+}
+
+/**
+ * Start the idle timer of a client DCB in the thread that owns the DCB.
+ *
+ * @param dcb Client DCB
+ */
+void dcb_start_idle_timer(DCB *dcb)
+{
+    ss_dassert(dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER);
+    SERVICE *service = dcb->listener->service;
+    int64_t ticks = service->conn_idle_timeout ? service->conn_idle_timeout * 10 + 1 : DCB_IDLE_RECHECK_TICKS;
+    mxs_timer_add_to(dcb->thread.id, &dcb->timer, ticks);
 }
 
 bool dcb_foreach(bool(*func)(DCB *, void *), void *data)
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file digest.c  Fingerprints of statements
+ *
+ * The statement is canonicalized in a single pass and the canonical form
+ * is hashed with MurmurHash3 (x64, 128 bits), which is in the public domain.
+ */
+
+#include <maxscale/digest.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/stmtinfo.h>
+
+static inline bool is_identifier_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$' || c == '.' || (c & 0x80);
+}
+
+static inline bool is_executable_comment(const char* p, const char* end)
+{
+    return (p + 2 < end && p[2] == '!') || (p + 3 < end && p[2] == 'M' && p[3] == '!');
+}
+
+size_t mxs_digest_canonicalize(const char* sql, size_t len, char* out)
+{
+    const char* p = sql;
+    const char* end = sql + len;
+    char* o = out;
+    bool space = false; // Whitespace or a comment precedes p.
+
+    while (p < end)
+    {
+        const char* start = p;
+        char c = *p;
+
+        if (isspace((unsigned char)c))
+        {
+            do
+            {
+                ++p;
+            }
+            while (p < end && isspace((unsigned char)*p));
+
+            space = true;
+            continue;
+        }
+        else if (c == '/' && p + 1 < end && p[1] == '*' && !is_executable_comment(p, end))
+        {
+            p += 2;
+
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+            {
+                ++p;
+            }
+
+            p += 2;
+            space = true;
+            continue;
+        }
+        else if (c == '#' || (c == '-' && p + 2 < end && p[1] == '-' && isspace((unsigned char)p[2])))
+        {
+            while (p < end && *p != '\n')
+            {
+                ++p;
+            }
+
+            space = true;
+            continue;
+        }
+
+        if (space && o > out)
+        {
+            *o++ = ' ';
+        }
+
+        space = false;
+
+        if (c == '\'' && (p == sql || !is_identifier_char(p[-1])))
+        {
+            // Literals with a prefix, as in X'1F' or _utf8'a', are left as they
+            // are, as the validity of a hexadecimal or bit literal depends on
+            // its value. A doubled quote, as in 'it''s', continues the literal.
+            do
+            {
+                ++p;
+
+                while (p < end && *p != '\'')
+                {
+                    p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+                }
+
+                ++p;
+            }
+            while (p < end && *p == '\'');
+
+            *o++ = '?';
+            continue;
+        }
+        else if (c == '\'' || c == '"' || c == '`')
+        {
+            ++p;
+
+            while (p < end && *p != c)
+            {
+                p += (c != '`' && *p == '\\' && p + 1 < end) ? 2 : 1;
+            }
+
+            ++p;
+        }
+        else if (c == '/' && p + 1 < end && p[1] == '*')
+        {
+            // An executable comment, left as it is.
+            p += 2;
+
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+            {
+                ++p;
+            }
+
+            p += 2;
+        }
+        else if (isdigit((unsigned char)c) && (p == sql || !is_identifier_char(p[-1])))
+        {
+            while (p < end && isdigit((unsigned char)*p))
+            {
+                ++p;
+            }
+
+            if (p < end && *p == '.')
+            {
+                ++p;
+
+                while (p < end && isdigit((unsigned char)*p))
+                {
+                    ++p;
+                }
+            }
+
+            if (p + 1 < end && (*p == 'e' || *p == 'E') &&
+                (isdigit((unsigned char)p[1]) ||
+                 ((p[1] == '+' || p[1] == '-') && p + 2 < end && isdigit((unsigned char)p[2]))))
+            {
+                p += 2;
+
+                while (p < end && isdigit((unsigned char)*p))
+                {
+                    ++p;
+                }
+            }
+
+            if (p < end && is_identifier_char(*p))
+            {
+                // An identifier or a hexadecimal literal, left as it is.
+                while (p < end && is_identifier_char(*p))
+                {
+                    ++p;
+                }
+            }
+            else
+            {
+                *o++ = '?';
+                continue;
+            }
+        }
+        else if (is_identifier_char(c))
+        {
+            // Keywords and identifiers are the bulk of most statements, so
+            // they are copied a run at a time and not a character at a time.
+            do
+            {
+                ++p;
+            }
+            while (p < end && is_identifier_char(*p));
+        }
+        else
+        {
+            ++p;
+        }
+
+        if (p > end)
+        {
+            p = end;
+        }
+
+        memcpy(o, start, p - start);
+        o += p - start;
+    }
+
+    return o - out;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+void mxs_digest_hash(const void* data, size_t len, uint64_t seed, MXS_DIGEST* digest)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const uint8_t* bytes = (const uint8_t*)data;
+    const uint8_t* tail = bytes + (len & ~(size_t)15);
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    uint64_t k1;
+    uint64_t k2;
+
+    for (const uint8_t* p = bytes; p < tail; p += 16)
+    {
+        memcpy(&k1, p, sizeof(k1));
+        memcpy(&k2, p + sizeof(k1), sizeof(k2));
+
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    size_t rest = len & 15;
+    k1 = 0;
+    k2 = 0;
+
+    for (size_t i = rest; i > 8; --i)
+    {
+        k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    }
+
+    if (rest > 8)
+    {
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+
+    for (size_t i = rest < 8 ? rest : 8; i > 0; --i)
+    {
+        k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    }
+
+    if (rest > 0)
+    {
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    digest->hi = h1;
+    digest->lo = h2;
+}
+
+void mxs_digest_to_string(const MXS_DIGEST* digest, char* str)
+{
+    snprintf(str, MXS_DIGEST_STR_LEN, "%016" PRIx64 "%016" PRIx64, digest->hi, digest->lo);
+}
+
+bool mxs_digest_get(GWBUF* query, MXS_DIGEST* digest)
+{
+    const MXS_STMT_INFO* info = mxs_stmt_info_get(query, MXS_STMT_INFO_DIGEST);
+    bool rval = info && (info->parts & MXS_STMT_INFO_DIGEST);
+
+    if (rval)
+    {
+        *digest = info->digest;
+    }
+
+    return rval;
+}
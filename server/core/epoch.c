@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file epoch.c - Deferred freeing of objects read without locks
+ *
+ * Each worker thread stores the global epoch in a slot of its own whenever
+ * it is quiescent, or zero while it is offline. A deferred object is stamped
+ * with the global epoch, which is then incremented. Once every slot is zero
+ * or holds a newer epoch, every online worker has been quiescent after the
+ * object was made unreachable and the object can be freed.
+ *
+ * Worker threads keep the objects they defer in a list of their own and free
+ * them when they are quiescent. The objects deferred by other threads are
+ * kept in a shared list that the workers free opportunistically.
+ */
+
+#include "maxscale/epoch.h"
+
+#include <sched.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/debug.h>
+#include <maxscale/limits.h>
+#include <maxscale/platform.h>
+#include <maxscale/spinlock.h>
+
+typedef struct mxs_epoch_item
+{
+    mxs_epoch_free_fn      freefn; /*< The function that frees the object */
+    void                  *data;   /*< The object */
+    uint64_t               epoch;  /*< The epoch when the object was deferred */
+    struct mxs_epoch_item *next;
+} MXS_EPOCH_ITEM;
+
+typedef struct
+{
+    uint64_t epoch; /*< The epoch at the last quiescent state, 0 when offline */
+} __attribute__((aligned(64))) MXS_EPOCH_THREAD;
+
+static MXS_EPOCH_THREAD epoch_threads[MXS_MAX_THREADS];
+static int n_epoch_threads = 0;             /*< One more than the highest worker ID */
+static uint64_t global_epoch = 1;
+static MXS_EPOCH_ITEM *shared_items = NULL; /*< Objects deferred by other threads */
+static int n_shared_items = 0;
+static SPINLOCK shared_lock = SPINLOCK_INIT;
+static thread_local int epoch_thread_id = -1;
+static thread_local MXS_EPOCH_ITEM *local_items = NULL;
+static thread_local int n_local_items = 0;
+
+/**
+ * Get the oldest epoch of the online worker threads
+ *
+ * @return The oldest epoch or UINT64_MAX if no thread is online
+ */
+static uint64_t epoch_oldest()
+{
+    uint64_t rval = UINT64_MAX;
+    int n = atomic_load_int32(&n_epoch_threads);
+
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t epoch = atomic_load_uint64(&epoch_threads[i].epoch);
+
+        if (epoch && epoch < rval)
+        {
+            rval = epoch;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Remove the objects that were deferred before an epoch from a list
+ *
+ * @param items  The list
+ * @param oldest The epoch
+ * @param count  Decremented by the number of removed objects
+ *
+ * @return The removed objects
+ */
+static MXS_EPOCH_ITEM* epoch_take_expired(MXS_EPOCH_ITEM **items, uint64_t oldest, int *count)
+{
+    MXS_EPOCH_ITEM *rval = NULL;
+
+    while (*items)
+    {
+        MXS_EPOCH_ITEM *item = *items;
+
+        if (item->epoch < oldest)
+        {
+            *items = item->next;
+            item->next = rval;
+            rval = item;
+            (*count)--;
+        }
+        else
+        {
+            items = &item->next;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Free deferred objects
+ *
+ * @param items The objects to free
+ */
+static void epoch_free_items(MXS_EPOCH_ITEM *items)
+{
+    while (items)
+    {
+        MXS_EPOCH_ITEM *item = items;
+        items = item->next;
+        item->freefn(item->data);
+        MXS_FREE(item);
+    }
+}
+
+/**
+ * Free the objects in the shared list that were deferred before an epoch
+ *
+ * @param oldest The epoch
+ * @param wait   Wait for the lock instead of giving up if it is taken
+ */
+static void epoch_free_shared(uint64_t oldest, bool wait)
+{
+    if (wait)
+    {
+        spinlock_acquire(&shared_lock);
+    }
+    else if (!spinlock_acquire_nowait(&shared_lock))
+    {
+        return;
+    }
+
+    MXS_EPOCH_ITEM *expired = epoch_take_expired(&shared_items, oldest, &n_shared_items);
+    spinlock_release(&shared_lock);
+
+    epoch_free_items(expired);
+}
+
+void mxs_epoch_thread_init(int thread_id)
+{
+    ss_dassert(thread_id >= 0 && thread_id < MXS_MAX_THREADS);
+    epoch_thread_id = thread_id;
+
+    spinlock_acquire(&shared_lock);
+
+    if (thread_id >= n_epoch_threads)
+    {
+        atomic_store_int32(&n_epoch_threads, thread_id + 1);
+    }
+
+    spinlock_release(&shared_lock);
+
+    mxs_epoch_online();
+}
+
+void mxs_epoch_thread_finish()
+{
+    if (epoch_thread_id != -1)
+    {
+        mxs_epoch_synchronize();
+        ss_dassert(local_items == NULL);
+        mxs_epoch_offline();
+        epoch_thread_id = -1;
+    }
+}
+
+void mxs_epoch_quiescent()
+{
+    int id = epoch_thread_id;
+    ss_dassert(id != -1);
+
+    atomic_store_uint64(&epoch_threads[id].epoch, atomic_load_uint64(&global_epoch));
+
+    if (local_items || atomic_load_ptr((void**)&shared_items))
+    {
+        uint64_t oldest = epoch_oldest();
+
+        epoch_free_items(epoch_take_expired(&local_items, oldest, &n_local_items));
+
+        if (atomic_load_ptr((void**)&shared_items))
+        {
+            epoch_free_shared(oldest, false);
+        }
+    }
+}
+
+void mxs_epoch_offline()
+{
+    atomic_store_uint64(&epoch_threads[epoch_thread_id].epoch, 0);
+}
+
+void mxs_epoch_online()
+{
+    atomic_store_uint64(&epoch_threads[epoch_thread_id].epoch, atomic_load_uint64(&global_epoch));
+    /** The slot must be visible before any shared objects are read */
+    atomic_synchronize();
+}
+
+void mxs_epoch_defer(mxs_epoch_free_fn freefn, void *data)
+{
+    MXS_EPOCH_ITEM *item = (MXS_EPOCH_ITEM*)MXS_MALLOC(sizeof(MXS_EPOCH_ITEM));
+
+    if (item == NULL)
+    {
+        mxs_epoch_synchronize();
+        freefn(data);
+        return;
+    }
+
+    item->freefn = freefn;
+    item->data = data;
+    item->epoch = atomic_add_uint64(&global_epoch, 1);
+
+    if (epoch_thread_id != -1)
+    {
+        item->next = local_items;
+        local_items = item;
+        n_local_items++;
+    }
+    else
+    {
+        spinlock_acquire(&shared_lock);
+        item->next = shared_items;
+        atomic_store_ptr((void**)&shared_items, item);
+        n_shared_items++;
+        spinlock_release(&shared_lock);
+    }
+}
+
+void mxs_epoch_synchronize()
+{
+    bool worker = epoch_thread_id != -1;
+    uint64_t target = atomic_add_uint64(&global_epoch, 1);
+
+    if (worker)
+    {
+        /** Waiting counts as a quiescent state for this thread */
+        mxs_epoch_offline();
+    }
+
+    while (epoch_oldest() <= target)
+    {
+        sched_yield();
+    }
+
+    if (worker)
+    {
+        mxs_epoch_online();
+        epoch_free_items(epoch_take_expired(&local_items, target + 1, &n_local_items));
+    }
+
+    epoch_free_shared(target + 1, true);
+}
+
+bool mxs_epoch_is_worker()
+{
+    return epoch_thread_id != -1;
+}
+
+int mxs_epoch_pending()
+{
+    return n_local_items + atomic_load_int32(&n_shared_items);
+}
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <errno.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
@@ -39,6 +40,7 @@
 static SPINLOCK filter_spin = SPINLOCK_INIT;    /**< Protects the list of all filters */
 static MXS_FILTER_DEF *allFilters = NULL;           /**< The list of all filters */
 
+static void filter_free_options(char **options);
 static void filter_free_parameters(MXS_FILTER_DEF *filter);
 
 /**
@@ -120,15 +122,7 @@ filter_free(MXS_FILTER_DEF *filter)
         MXS_FREE(filter->name);
         MXS_FREE(filter->module);
 
-        if (filter->options)
-        {
-            for (int i = 0; filter->options[i]; i++)
-            {
-                MXS_FREE(filter->options[i]);
-            }
-            MXS_FREE(filter->options);
-        }
-
+        filter_free_options(filter->options);
         filter_free_parameters(filter);
 
         MXS_FREE(filter);
@@ -343,6 +337,22 @@ filter_add_parameter(MXS_FILTER_DEF *filter, const char *name, const char *value
     filter->parameters = ctx.parameters;
 }
 
+/**
+ * Free filter options
+ * @param options NULL terminated array of options
+ */
+static void filter_free_options(char **options)
+{
+    if (options)
+    {
+        for (int i = 0; options[i]; i++)
+        {
+            MXS_FREE(options[i]);
+        }
+        MXS_FREE(options);
+    }
+}
+
 /**
  * Free filter parameters
  * @param filter Filter whose parameters are to be freed
@@ -398,6 +408,78 @@ bool filter_load(MXS_FILTER_DEF* filter)
     return rval;
 }
 
+/**
+ * @brief Replace the options and parameters of a filter
+ *
+ * If the filter is in use, a new instance of it is created with the new
+ * configuration. The new sessions use the new instance and the existing
+ * sessions keep using the old one. The old instance may refer to its options
+ * and parameters, so they are not freed.
+ *
+ * @param filter  Filter definition
+ * @param options Comma separated list of options
+ * @param params  The new parameters
+ *
+ * @return True if the filter was updated, false if the new instance could not be created
+ */
+bool filter_reload(MXS_FILTER_DEF *filter, const char *options, const MXS_CONFIG_PARAMETER *params)
+{
+    MXS_FILTER_DEF def = {.name = filter->name};
+    spinlock_init(&def.spin);
+
+    if (options && *options)
+    {
+        char copy[strlen(options) + 1];
+        strcpy(copy, options);
+        char *lasts;
+
+        for (char *s = strtok_r(copy, ",", &lasts); s; s = strtok_r(NULL, ",", &lasts))
+        {
+            filter_add_option(&def, s);
+        }
+    }
+
+    for (const MXS_CONFIG_PARAMETER *p = params; p; p = p->next)
+    {
+        filter_add_parameter(&def, p->name, p->value);
+    }
+
+    MXS_FILTER *instance = NULL;
+
+    if (filter->filter &&
+        (instance = filter->obj->createInstance(filter->name, def.options, def.parameters)) == NULL)
+    {
+        MXS_ERROR("Failed to create a new instance of filter '%s', the old "
+                  "configuration is still used.", filter->name);
+        filter_free_options(def.options);
+        config_parameter_free(def.parameters);
+        return false;
+    }
+
+    spinlock_acquire(&filter->spin);
+    char **old_options = filter->options;
+    MXS_CONFIG_PARAMETER *old_params = filter->parameters;
+    filter->options = def.options;
+    filter->parameters = def.parameters;
+
+    if (instance)
+    {
+        atomic_synchronize();
+        filter->filter = instance;
+    }
+    spinlock_release(&filter->spin);
+
+    if (instance == NULL)
+    {
+        /** The filter was not in use */
+        filter_free_options(old_options);
+        config_parameter_free(old_params);
+    }
+
+    MXS_NOTICE("Updated the configuration of filter '%s'.", filter->name);
+    return true;
+}
+
 /**
  * Connect the downstream filter chain for a filter.
  *
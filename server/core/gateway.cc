@@ -69,11 +69,13 @@
 #include <maxscale/version.h>
 #include <maxscale/random_jkiss.h>
 
+#include "maxscale/alloc.h"
 #include "maxscale/config.h"
 #include "maxscale/maxscale.h"
 #include "maxscale/modules.h"
 #include "maxscale/monitor.h"
 #include "maxscale/poll.h"
+#include "maxscale/resolve.h"
 #include "maxscale/service.h"
 #include "maxscale/statistics.h"
 
@@ -185,6 +187,7 @@ static void log_exit_status();
 static bool daemonize();
 static bool sniff_configuration(const char* filepath);
 static bool modules_process_init();
+static double startup_phase(struct timespec *start);
 static void modules_process_finish();
 static bool modules_thread_init();
 static void modules_thread_finish();
@@ -1325,6 +1328,7 @@ int main(int argc, char **argv)
     void   (*exitfunp[4])(void) = { mxs_log_finish, cleanup_process_datadir, write_footer, NULL };
     MXS_CONFIG* cnf = NULL;
     int numlocks = 0;
+    struct timespec phase_start; /*< When the current phase of the startup started */
 
     *syslog_enabled = 1;
     *maxlog_enabled = 1;
@@ -1885,6 +1889,8 @@ int main(int argc, char **argv)
     MXS_NOTICE("Module directory: %s", get_libdir());
     MXS_NOTICE("Service cache: %s", get_cachedir());
 
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+
     if (!config_load(cnf_file_path))
     {
         const char* fprerr =
@@ -1901,6 +1907,10 @@ int main(int argc, char **argv)
     cnf = config_get_global_options();
     ss_dassert(cnf);
 
+    MXS_NOTICE("Loaded the configuration in %.3f seconds.", startup_phase(&phase_start));
+
+    alloc_accounting_init();
+
     if (!qc_setup(cnf->qc_name, cnf->qc_args))
     {
         const char* logerr = "Failed to initialise query classifier library.";
@@ -1957,9 +1967,13 @@ int main(int argc, char **argv)
         goto return_main;
     }
 
+    MXS_NOTICE("Initialized the modules in %.3f seconds.", startup_phase(&phase_start));
+
     /** Start all monitors */
     monitorStartAll();
 
+    MXS_NOTICE("Started the monitors in %.3f seconds.", startup_phase(&phase_start));
+
     /** Start the services that were created above */
     n_services = service_launch_all();
 
@@ -2002,6 +2016,8 @@ int main(int argc, char **argv)
         goto return_main;
     }
 
+    resolve_init();
+
     /*<
      * Start the polling threads, note this is one less than is
      * configured as the main thread will also poll.
@@ -2023,7 +2039,8 @@ int main(int argc, char **argv)
         }
     }
 
-    MXS_NOTICE("MaxScale started with %d server threads.", config_threadcount());
+    MXS_NOTICE("MaxScale started with %d server threads, %d of them active.",
+               config_threadcount(), poll_get_active_threads());
     /**
      * Successful start, notify the parent process that it can exit.
      */
@@ -2079,6 +2096,8 @@ int main(int argc, char **argv)
     cleanup_process_datadir();
     MXS_NOTICE("MaxScale shutdown completed.");
 
+    /* The deferred messages refer to the strings of the modules */
+    mxs_log_flush_sync();
     unload_all_modules();
     /* Remove Pidfile */
     unlock_pidfile();
@@ -2857,6 +2876,23 @@ static bool sniff_configuration(const char* filepath)
     return rv == 0;
 }
 
+/**
+ * Get the seconds since the start of a phase of the startup and start the next one
+ *
+ * @param start The start of the phase, set to the current time
+ * @return The duration of the phase in seconds
+ */
+static double startup_phase(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double rval = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+    *start = now;
+
+    return rval;
+}
+
 /**
  * Calls init on all loaded modules.
  *
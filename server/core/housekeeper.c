@@ -10,11 +10,16 @@
  * of this software will be governed by version 2 or later of the General
  * Public License.
  */
-#include <maxscale/housekeeper.h>
+#include "maxscale/housekeeper.h"
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
 #include <maxscale/semaphore.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/thread.h>
@@ -31,6 +36,12 @@
  * The housekeeper also maintains a global variable, hkheartbeat, that
  * is incremented every 100ms.
  *
+ * Tasks can also be run by the worker threads. Each worker has a list of
+ * tasks of its own and a timerfd in its poll set that is armed for the next
+ * due task. Only the worker uses its list, other threads pass their
+ * additions and removals to it through a pending list and wake it up by
+ * arming the timer to expire immediately.
+ *
  * @verbatim
  * Revision History
  *
@@ -57,6 +68,36 @@ static THREAD hk_thr_handle;
 
 static void hkthread(void *);
 
+/**
+ * A task of a worker thread
+ */
+typedef struct hk_worker_task
+{
+    char   *name;                /*< The task name */
+    void  (*task)(void *data);   /*< The task to call */
+    void   *data;                /*< Data to pass the task */
+    int     frequency;           /*< How often to call the task (seconds) */
+    int64_t nextdue;             /*< When the task is next run (monotonic milliseconds) */
+    bool    removed;             /*< Removed, or a removal request in the pending list */
+    struct hk_worker_task *next; /*< Next task in the list */
+} HK_WORKER_TASK;
+
+/**
+ * The tasks of a worker thread
+ */
+typedef struct
+{
+    int             timer_fd; /*< Armed for the next due task */
+    HK_WORKER_TASK *tasks;    /*< The tasks, only used by the worker */
+    HK_WORKER_TASK *pending;  /*< Additions and removals made by other threads */
+    SPINLOCK        lock;     /*< Protects the pending list */
+    bool            running;  /*< Whether the worker is running its tasks */
+} __attribute__((aligned(64))) HK_WORKER;
+
+static HK_WORKER *workers = NULL;
+static int n_workers = 0;
+static thread_local int hk_worker_id = -1;
+
 bool
 hkinit()
 {
@@ -350,3 +391,394 @@ hkshow_tasks(DCB *pdcb)
     }
     spinlock_release(&tasklock);
 }
+
+/**
+ * @return The monotonic time in milliseconds
+ */
+static int64_t hk_worker_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Allocate a worker task
+ *
+ * @param name      The task name
+ * @param taskfn    The function to call, NULL for a removal request
+ * @param data      Data to pass to the function
+ * @param frequency How often to run the task, expressed in seconds
+ *
+ * @return The task or NULL on memory allocation failure
+ */
+static HK_WORKER_TASK* hk_worker_task_alloc(const char *name, void (*taskfn)(void *), void *data,
+                                            int frequency)
+{
+    HK_WORKER_TASK *task = (HK_WORKER_TASK*)MXS_MALLOC(sizeof(HK_WORKER_TASK));
+
+    if (task && (task->name = MXS_STRDUP(name)) == NULL)
+    {
+        MXS_FREE(task);
+        task = NULL;
+    }
+
+    if (task)
+    {
+        task->task = taskfn;
+        task->data = data;
+        task->frequency = frequency;
+        task->nextdue = hk_worker_now() + frequency * 1000;
+        task->removed = taskfn == NULL;
+        task->next = NULL;
+    }
+
+    return task;
+}
+
+static void hk_worker_task_free(HK_WORKER_TASK *task)
+{
+    MXS_FREE(task->name);
+    MXS_FREE(task);
+}
+
+static void hk_worker_task_free_all(HK_WORKER_TASK *task)
+{
+    while (task)
+    {
+        HK_WORKER_TASK *next = task->next;
+        hk_worker_task_free(task);
+        task = next;
+    }
+}
+
+/**
+ * Find a task of the calling worker that has not been removed
+ *
+ * @param worker The worker
+ * @param name   The task name
+ *
+ * @return The task or NULL if not found
+ */
+static HK_WORKER_TASK* hk_worker_find(HK_WORKER *worker, const char *name)
+{
+    for (HK_WORKER_TASK *task = worker->tasks; task; task = task->next)
+    {
+        if (!task->removed && strcmp(task->name, name) == 0)
+        {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Add a task to the list of the calling worker
+ *
+ * @param worker The worker
+ * @param task   The task to add
+ *
+ * @return True if the task was added, false if the name is in use
+ */
+static bool hk_worker_add_local(HK_WORKER *worker, HK_WORKER_TASK *task)
+{
+    if (hk_worker_find(worker, task->name))
+    {
+        MXS_ERROR("Worker thread %d already has a task named '%s'.",
+                  (int)(worker - workers), task->name);
+        hk_worker_task_free(task);
+        return false;
+    }
+
+    task->next = worker->tasks;
+    worker->tasks = task;
+    return true;
+}
+
+/**
+ * Free the removed tasks of the calling worker
+ *
+ * @param worker The worker
+ */
+static void hk_worker_sweep(HK_WORKER *worker)
+{
+    HK_WORKER_TASK **prev = &worker->tasks;
+
+    while (*prev)
+    {
+        HK_WORKER_TASK *task = *prev;
+
+        if (task->removed)
+        {
+            *prev = task->next;
+            hk_worker_task_free(task);
+        }
+        else
+        {
+            prev = &task->next;
+        }
+    }
+}
+
+/**
+ * Arm the timer of a worker
+ *
+ * @param worker The worker
+ * @param when   The monotonic time in milliseconds, 0 to disarm and a negative
+ *               value to expire immediately
+ */
+static void hk_worker_arm(HK_WORKER *worker, int64_t when)
+{
+    struct itimerspec spec = {};
+    int flags = 0;
+
+    if (when < 0)
+    {
+        spec.it_value.tv_nsec = 1;
+    }
+    else if (when > 0)
+    {
+        spec.it_value.tv_sec = when / 1000;
+        spec.it_value.tv_nsec = (when % 1000) * 1000000;
+        flags = TFD_TIMER_ABSTIME;
+    }
+
+    if (timerfd_settime(worker->timer_fd, flags, &spec, NULL) == -1)
+    {
+        MXS_ERROR("Failed to arm the task timer of worker thread %d: %s",
+                  (int)(worker - workers), mxs_strerror(errno));
+    }
+}
+
+/**
+ * Pass an addition or a removal to another worker
+ *
+ * @param thread_id The worker thread ID
+ * @param task      The task to add or the removal request
+ */
+static void hk_worker_post(int thread_id, HK_WORKER_TASK *task)
+{
+    HK_WORKER *worker = &workers[thread_id];
+
+    spinlock_acquire(&worker->lock);
+    HK_WORKER_TASK **last = &worker->pending;
+
+    /** The requests are applied in the order they were made */
+    while (*last)
+    {
+        last = &(*last)->next;
+    }
+
+    *last = task;
+    spinlock_release(&worker->lock);
+
+    hk_worker_arm(worker, -1);
+}
+
+bool hk_worker_init(int n_threads)
+{
+    ss_dassert(workers == NULL);
+
+    if ((workers = (HK_WORKER*)MXS_CALLOC(n_threads, sizeof(HK_WORKER))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        spinlock_init(&workers[i].lock);
+
+        if ((workers[i].timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+        {
+            MXS_ERROR("Failed to create the task timer of worker thread %d: %s",
+                      i, mxs_strerror(errno));
+            return false;
+        }
+    }
+
+    n_workers = n_threads;
+    return true;
+}
+
+int hk_worker_fd(int thread_id)
+{
+    ss_dassert(thread_id >= 0 && thread_id < n_workers);
+    return workers[thread_id].timer_fd;
+}
+
+void hk_worker_thread_init(int thread_id)
+{
+    ss_dassert(thread_id >= 0 && thread_id < n_workers);
+    hk_worker_id = thread_id;
+}
+
+void hk_worker_thread_finish()
+{
+    if (hk_worker_id != -1)
+    {
+        HK_WORKER *worker = &workers[hk_worker_id];
+
+        spinlock_acquire(&worker->lock);
+        HK_WORKER_TASK *pending = worker->pending;
+        worker->pending = NULL;
+        spinlock_release(&worker->lock);
+
+        hk_worker_task_free_all(pending);
+        hk_worker_task_free_all(worker->tasks);
+        worker->tasks = NULL;
+        hk_worker_id = -1;
+    }
+}
+
+void hk_worker_process()
+{
+    ss_dassert(hk_worker_id != -1);
+    HK_WORKER *worker = &workers[hk_worker_id];
+    uint64_t expirations;
+
+    while (read(worker->timer_fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR)
+    {
+        ;
+    }
+
+    spinlock_acquire(&worker->lock);
+    HK_WORKER_TASK *pending = worker->pending;
+    worker->pending = NULL;
+    spinlock_release(&worker->lock);
+
+    while (pending)
+    {
+        HK_WORKER_TASK *task = pending;
+        pending = task->next;
+        task->next = NULL;
+
+        if (task->removed)
+        {
+            HK_WORKER_TASK *target = hk_worker_find(worker, task->name);
+
+            if (target)
+            {
+                target->removed = true;
+            }
+
+            hk_worker_task_free(task);
+        }
+        else
+        {
+            hk_worker_add_local(worker, task);
+        }
+    }
+
+    int64_t now = hk_worker_now();
+    worker->running = true;
+
+    /** The tasks may add and remove tasks, a removed task is only marked */
+    for (HK_WORKER_TASK *task = worker->tasks; task; task = task->next)
+    {
+        if (!task->removed && task->nextdue <= now)
+        {
+            task->nextdue = now + task->frequency * 1000;
+            task->task(task->data);
+        }
+    }
+
+    worker->running = false;
+    hk_worker_sweep(worker);
+
+    int64_t nextdue = 0;
+
+    for (HK_WORKER_TASK *task = worker->tasks; task; task = task->next)
+    {
+        if (nextdue == 0 || task->nextdue < nextdue)
+        {
+            nextdue = task->nextdue;
+        }
+    }
+
+    hk_worker_arm(worker, nextdue);
+
+    if (atomic_load_ptr((void**)&worker->pending))
+    {
+        /** Requests made while the timer was rearmed must not wait for it */
+        hk_worker_arm(worker, -1);
+    }
+}
+
+int hktask_add_worker(int thread_id, const char *name, void (*taskfn)(void *), void *data,
+                      int frequency)
+{
+    if (workers == NULL || thread_id < 0 || thread_id >= n_workers)
+    {
+        MXS_ERROR("Invalid worker thread ID %d for task '%s'.", thread_id, name);
+        return 0;
+    }
+
+    HK_WORKER_TASK *task = hk_worker_task_alloc(name, taskfn, data, frequency);
+
+    if (task == NULL)
+    {
+        return 0;
+    }
+
+    if (thread_id == hk_worker_id)
+    {
+        HK_WORKER *worker = &workers[thread_id];
+
+        if (!hk_worker_add_local(worker, task))
+        {
+            return 0;
+        }
+
+        if (!worker->running)
+        {
+            /** Let the timer be recalculated for the new task */
+            hk_worker_arm(worker, -1);
+        }
+    }
+    else
+    {
+        hk_worker_post(thread_id, task);
+    }
+
+    return 1;
+}
+
+int hktask_remove_worker(int thread_id, const char *name)
+{
+    if (workers == NULL || thread_id < 0 || thread_id >= n_workers)
+    {
+        return 0;
+    }
+
+    if (thread_id == hk_worker_id)
+    {
+        HK_WORKER *worker = &workers[thread_id];
+        HK_WORKER_TASK *task = hk_worker_find(worker, name);
+
+        if (task == NULL)
+        {
+            return 0;
+        }
+
+        task->removed = true;
+
+        if (!worker->running)
+        {
+            hk_worker_sweep(worker);
+        }
+    }
+    else
+    {
+        HK_WORKER_TASK *request = hk_worker_task_alloc(name, NULL, NULL, 0);
+
+        if (request == NULL)
+        {
+            return 0;
+        }
+
+        hk_worker_post(thread_id, request);
+    }
+
+    return 1;
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file lfhash.c A hashtable with lock-free reads
+ *
+ * The elements are stored in an open addressing array that is probed
+ * linearly. An entry goes from empty to used to deleted and never back,
+ * which means that a reader that has seen a key also sees the value that
+ * was stored with it. Deleted entries are dropped when the array fills up,
+ * at which point the live elements are copied to a new array that replaces
+ * the old one.
+ *
+ * The deleted keys and values and the replaced arrays are given to
+ * mxs_epoch_defer, which frees them once every worker thread has finished
+ * the event during which it could have read them.
+ */
+
+#include <maxscale/lfhash.h>
+
+#include <string.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/debug.h>
+#include <maxscale/epoch.h>
+
+/** The smallest size of an entry array */
+#define LFHASH_MIN_SIZE 16
+
+typedef struct lfhash_entry
+{
+    void *key;   /*< The key, NULL for an empty entry */
+    void *value; /*< The value */
+} LFHASH_ENTRY;
+
+struct lfhash_array
+{
+    int          size;      /*< Number of entries, a power of two */
+    LFHASH_ENTRY entries[]; /*< The entries */
+};
+
+/** The address of this marks deleted entries */
+static char deleted_key;
+#define LFHASH_DELETED ((void*)&deleted_key)
+
+/**
+ * Hash a key. The result of the hash function is mixed so that similar
+ * keys do not end up in neighbouring entries.
+ *
+ * @param table The table
+ * @param key   The key
+ *
+ * @return The hash of the key
+ */
+static inline uint32_t lfhash_hash(LFHASH *table, const void *key)
+{
+    uint32_t hash = (uint32_t)table->hashfn(key);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/**
+ * Find the entry of a key
+ *
+ * @param table The table
+ * @param array The entries to search, with at least one empty entry
+ * @param key   The key
+ * @param hash  The hash of the key
+ *
+ * @return Index of the entry or -1 if the key was not found
+ */
+static int lfhash_find(LFHASH *table, LFHASH_ARRAY *array, const void *key, uint32_t hash)
+{
+    int mask = array->size - 1;
+
+    for (int i = hash & mask; ; i = (i + 1) & mask)
+    {
+        void *entry_key = atomic_load_ptr(&array->entries[i].key);
+
+        if (entry_key == NULL)
+        {
+            return -1;
+        }
+        else if (entry_key != LFHASH_DELETED && table->cmpfn(key, entry_key) == 0)
+        {
+            return i;
+        }
+    }
+}
+
+/**
+ * Find the empty entry where a key is stored
+ *
+ * @param array The entries, with at least one empty entry
+ * @param hash  The hash of the key
+ *
+ * @return Index of the entry
+ */
+static int lfhash_find_empty(LFHASH_ARRAY *array, uint32_t hash)
+{
+    int mask = array->size - 1;
+    int i = hash & mask;
+
+    while (array->entries[i].key)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+/**
+ * Allocate an entry array with room for a number of elements
+ *
+ * @param n_elements Number of elements
+ *
+ * @return The array or NULL on memory allocation failure
+ */
+static LFHASH_ARRAY* lfhash_array_alloc(int n_elements)
+{
+    int size = LFHASH_MIN_SIZE;
+
+    while (size < n_elements * 2)
+    {
+        size *= 2;
+    }
+
+    LFHASH_ARRAY *array = (LFHASH_ARRAY*)MXS_CALLOC(1, sizeof(LFHASH_ARRAY) + size * sizeof(LFHASH_ENTRY));
+
+    if (array)
+    {
+        array->size = size;
+    }
+
+    return array;
+}
+
+/**
+ * Replace the entry array with one that only holds the live elements
+ *
+ * @param table      The table, locked by the caller
+ * @param n_elements Number of elements to make room for
+ *
+ * @return True if the array was replaced
+ */
+static bool lfhash_resize(LFHASH *table, int n_elements)
+{
+    LFHASH_ARRAY *old = table->array;
+    LFHASH_ARRAY *array = lfhash_array_alloc(MXS_MAX(n_elements, table->min_size));
+
+    if (array == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < old->size; i++)
+    {
+        LFHASH_ENTRY *entry = &old->entries[i];
+
+        if (entry->key && entry->key != LFHASH_DELETED)
+        {
+            array->entries[lfhash_find_empty(array, lfhash_hash(table, entry->key))] = *entry;
+        }
+    }
+
+    /** The atomic store makes the new entries visible before the array */
+    atomic_store_ptr((void**)&table->array, array);
+    table->n_used = table->n_elements;
+    mxs_epoch_defer(hashtable_item_free, old);
+
+    return true;
+}
+
+LFHASH* lfhash_alloc(int size, HASHHASHFN hashfn, HASHCMPFN cmpfn)
+{
+    LFHASH *table = (LFHASH*)MXS_CALLOC(1, sizeof(LFHASH));
+
+    if (table)
+    {
+        table->min_size = MXS_MAX(size, 1);
+
+        if ((table->array = lfhash_array_alloc(table->min_size)) == NULL)
+        {
+            MXS_FREE(table);
+            return NULL;
+        }
+
+        table->hashfn = hashfn;
+        table->cmpfn = cmpfn;
+        spinlock_init(&table->lock);
+    }
+
+    return table;
+}
+
+void lfhash_memory_fns(LFHASH *table, HASHCOPYFN kcopyfn, HASHCOPYFN vcopyfn,
+                       HASHFREEFN kfreefn, HASHFREEFN vfreefn)
+{
+    if (kcopyfn)
+    {
+        table->kcopyfn = kcopyfn;
+    }
+    if (vcopyfn)
+    {
+        table->vcopyfn = vcopyfn;
+    }
+    if (kfreefn)
+    {
+        table->kfreefn = kfreefn;
+    }
+    if (vfreefn)
+    {
+        table->vfreefn = vfreefn;
+    }
+}
+
+void lfhash_free(LFHASH *table)
+{
+    if (table)
+    {
+        LFHASH_ARRAY *array = table->array;
+
+        for (int i = 0; i < array->size; i++)
+        {
+            LFHASH_ENTRY *entry = &array->entries[i];
+
+            if (entry->key && entry->key != LFHASH_DELETED)
+            {
+                if (table->kfreefn)
+                {
+                    table->kfreefn(entry->key);
+                }
+                if (table->vfreefn)
+                {
+                    table->vfreefn(entry->value);
+                }
+            }
+        }
+
+        MXS_FREE(array);
+        MXS_FREE(table);
+    }
+}
+
+int lfhash_add(LFHASH *table, void *key, void *value)
+{
+    int rval = 0;
+
+    if (table && key && value)
+    {
+        uint32_t hash = lfhash_hash(table, key);
+        spinlock_acquire(&table->lock);
+
+        if (lfhash_find(table, table->array, key, hash) == -1)
+        {
+            /** Keep at least a quarter of the entries empty */
+            bool room = (table->n_used + 1) * 4 <= table->array->size * 3 ||
+                        lfhash_resize(table, table->n_elements + 1) ||
+                        table->n_used + 1 < table->array->size;
+            void *my_key = NULL;
+            void *my_value = NULL;
+
+            if (room && (my_key = table->kcopyfn ? table->kcopyfn(key) : key) &&
+                (my_value = table->vcopyfn ? table->vcopyfn(value) : value))
+            {
+                LFHASH_ENTRY *entry = &table->array->entries[lfhash_find_empty(table->array, hash)];
+                entry->value = my_value;
+                /** The value must be visible before the key */
+                atomic_store_ptr(&entry->key, my_key);
+                table->n_used++;
+                atomic_store_int32(&table->n_elements, table->n_elements + 1);
+                rval = 1;
+            }
+            else if (my_key && table->kfreefn)
+            {
+                table->kfreefn(my_key);
+            }
+        }
+
+        spinlock_release(&table->lock);
+    }
+
+    return rval;
+}
+
+int lfhash_delete(LFHASH *table, void *key)
+{
+    int rval = 0;
+
+    if (table && key)
+    {
+        uint32_t hash = lfhash_hash(table, key);
+        spinlock_acquire(&table->lock);
+
+        int i = lfhash_find(table, table->array, key, hash);
+
+        if (i != -1)
+        {
+            /** The value is left in place for the readers that found the key */
+            LFHASH_ENTRY *entry = &table->array->entries[i];
+            void *old_key = entry->key;
+            atomic_store_ptr(&entry->key, LFHASH_DELETED);
+            atomic_store_int32(&table->n_elements, table->n_elements - 1);
+            ss_dassert(table->n_elements >= 0);
+
+            if (table->kfreefn)
+            {
+                mxs_epoch_defer(table->kfreefn, old_key);
+            }
+            if (table->vfreefn)
+            {
+                mxs_epoch_defer(table->vfreefn, entry->value);
+            }
+
+            rval = 1;
+        }
+
+        spinlock_release(&table->lock);
+    }
+
+    return rval;
+}
+
+void* lfhash_fetch(LFHASH *table, void *key)
+{
+    void *rval = NULL;
+
+    if (table && key)
+    {
+        uint32_t hash = lfhash_hash(table, key);
+        bool worker = mxs_epoch_is_worker();
+
+        if (!worker)
+        {
+            spinlock_acquire(&table->lock);
+        }
+
+        LFHASH_ARRAY *array = (LFHASH_ARRAY*)atomic_load_ptr((void**)&table->array);
+        int i = lfhash_find(table, array, key, hash);
+
+        if (i != -1)
+        {
+            rval = array->entries[i].value;
+        }
+
+        if (!worker)
+        {
+            spinlock_release(&table->lock);
+        }
+    }
+
+    return rval;
+}
+
+int lfhash_size(LFHASH *table)
+{
+    ss_dassert(table);
+    return atomic_load_int32(&table->n_elements);
+}
+
+LFHASHITERATOR* lfhash_iterator(LFHASH *table)
+{
+    LFHASHITERATOR *iter = (LFHASHITERATOR*)MXS_MALLOC(sizeof(LFHASHITERATOR));
+
+    if (iter)
+    {
+        iter->table = table;
+        iter->index = 0;
+    }
+
+    return iter;
+}
+
+void* lfhash_next(LFHASHITERATOR *iter)
+{
+    void *rval = NULL;
+
+    if (iter)
+    {
+        LFHASH *table = iter->table;
+        bool worker = mxs_epoch_is_worker();
+
+        if (!worker)
+        {
+            spinlock_acquire(&table->lock);
+        }
+
+        LFHASH_ARRAY *array = (LFHASH_ARRAY*)atomic_load_ptr((void**)&table->array);
+
+        while (rval == NULL && iter->index < array->size)
+        {
+            void *key = atomic_load_ptr(&array->entries[iter->index++].key);
+
+            if (key && key != LFHASH_DELETED)
+            {
+                rval = key;
+            }
+        }
+
+        if (!worker)
+        {
+            spinlock_release(&table->lock);
+        }
+    }
+
+    return rval;
+}
+
+void lfhash_iterator_free(LFHASHITERATOR *iter)
+{
+    MXS_FREE(iter);
+}
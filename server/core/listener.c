@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <maxscale/listener.h>
 #include <maxscale/paths.h>
 #include <maxscale/ssl.h>
@@ -39,11 +40,27 @@
 #include <maxscale/alloc.h>
 #include <maxscale/users.h>
 #include <maxscale/service.h>
+#include <maxscale/dcb.h>
+#include <maxscale/server.h>
+
+/** The context of the sessions that clients resume */
+#define SSL_SESSION_ID_CONTEXT "MaxScale"
 
 static RSA *rsa_512 = NULL;
 static RSA *rsa_1024 = NULL;
 
 static RSA *tmp_rsa_callback(SSL *s, int is_export, int keylength);
+static int ssl_new_session_cb(SSL *ssl, SSL_SESSION *session);
+
+/**
+ * @return The monotonic time in microseconds
+ */
+static inline int64_t listener_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 /**
  * Create a new listener structure
@@ -128,6 +145,11 @@ listener_alloc(struct service* service, const char* name, const char *protocol,
     proto->authenticator = my_authenticator;
     proto->auth_options = my_auth_options;
     proto->ssl = ssl;
+    proto->compression = false;
+    proto->max_connection_rate = 0;
+    proto->accept_tokens = 0;
+    proto->accept_refill = 0;
+    proto->n_throttled = 0;
     proto->users = NULL;
     proto->next = NULL;
     proto->auth_instance = auth_instance;
@@ -335,6 +357,34 @@ listener_init_SSL(SSL_LISTENER *ssl_listener)
 
         /* Set the verification depth */
         SSL_CTX_set_verify_depth(ssl_listener->ctx, ssl_listener->ssl_cert_verify_depth);
+
+        if (ssl_listener->ssl_session_cache)
+        {
+            /** Clients can resume their sessions with session IDs or tickets. The
+             * connections to servers reuse the session of the latest connection,
+             * stored by ssl_new_session_cb(). */
+            SSL_CTX_set_session_id_context(ssl_listener->ctx, (const unsigned char*)SSL_SESSION_ID_CONTEXT,
+                                           sizeof(SSL_SESSION_ID_CONTEXT) - 1);
+            SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_BOTH);
+            SSL_CTX_sess_set_new_cb(ssl_listener->ctx, ssl_new_session_cb);
+        }
+        else
+        {
+            SSL_CTX_set_session_cache_mode(ssl_listener->ctx, SSL_SESS_CACHE_OFF);
+            SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_NO_TICKET);
+        }
+
+        if (ssl_listener->ssl_ktls)
+        {
+#ifdef SSL_OP_ENABLE_KTLS
+            /** OpenSSL hands the keys to the kernel after the handshake if the
+             * kernel supports the cipher and falls back to user space if not */
+            SSL_CTX_set_options(ssl_listener->ctx, SSL_OP_ENABLE_KTLS);
+#else
+            MXS_WARNING("The OpenSSL library does not support kernel TLS, "
+                        "'ssl_ktls' is ignored.");
+#endif
+        }
         ssl_listener->ssl_init_done = true;
     }
     return 0;
@@ -386,6 +436,44 @@ tmp_rsa_callback(SSL *s, int is_export, int keylength)
     return (rsa_tmp);
 }
 
+/**
+ * The new session callback function for OpenSSL.
+ *
+ * The sessions that servers give to MaxScale are stored so that the next
+ * connection to the same server can resume it instead of doing a full
+ * handshake. The sessions of the clients are left to the session cache of
+ * the listener.
+ *
+ * @param ssl     SSL structure of the connection
+ * @param session The new session
+ * @return 1 if the session was stored, 0 if OpenSSL should free it
+ */
+static int
+ssl_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    DCB *dcb = (DCB*)SSL_get_app_data(ssl);
+
+    if (dcb == NULL || dcb->dcb_role != DCB_ROLE_BACKEND_HANDLER ||
+        dcb->server == NULL || dcb->server->server_ssl == NULL)
+    {
+        return 0;
+    }
+
+    SSL_LISTENER *ssl_listener = dcb->server->server_ssl;
+
+    spinlock_acquire(&ssl_listener->session_lock);
+    SSL_SESSION *old_session = ssl_listener->session;
+    ssl_listener->session = session;
+    spinlock_release(&ssl_listener->session_lock);
+
+    if (old_session)
+    {
+        SSL_SESSION_free(old_session);
+    }
+
+    return 1;
+}
+
 /**
  * Creates a listener configuration at the location pointed by @c filename
  *
@@ -393,6 +481,66 @@ tmp_rsa_callback(SSL *s, int is_export, int keylength)
  * @param filename Filename where configuration is written
  * @return True on success, false on error
  */
+/**
+ * @brief Add the tokens that were earned since the last refill
+ *
+ * The caller must hold the lock of the listener.
+ *
+ * @param listener The listener
+ * @param now      The current time in microseconds
+ */
+static void listener_refill_tokens(SERV_LISTENER *listener, int64_t now)
+{
+    if (listener->accept_refill == 0)
+    {
+        /** A full bucket for the first connections */
+        listener->accept_tokens = listener->max_connection_rate;
+    }
+    else
+    {
+        listener->accept_tokens += (double)(now - listener->accept_refill) *
+                                   listener->max_connection_rate / 1000000;
+
+        if (listener->accept_tokens > listener->max_connection_rate)
+        {
+            listener->accept_tokens = listener->max_connection_rate;
+        }
+    }
+
+    listener->accept_refill = now;
+}
+
+int64_t listener_accept_delay(SERV_LISTENER *listener)
+{
+    int64_t delay = 0;
+
+    if (listener->max_connection_rate > 0)
+    {
+        spinlock_acquire(&listener->lock);
+        listener_refill_tokens(listener, listener_now_us());
+
+        if (listener->accept_tokens < 1)
+        {
+            delay = (int64_t)((1 - listener->accept_tokens) * 1000000 / listener->max_connection_rate) + 1;
+            listener->n_throttled++;
+        }
+
+        spinlock_release(&listener->lock);
+    }
+
+    return delay;
+}
+
+void listener_count_accept(SERV_LISTENER *listener)
+{
+    if (listener->max_connection_rate > 0)
+    {
+        spinlock_acquire(&listener->lock);
+        listener->accept_tokens -= 1;
+        spinlock_release(&listener->lock);
+    }
+}
+
 static bool create_listener_config(const SERV_LISTENER *listener, const char *filename)
 {
     int file = open(filename, O_EXCL | O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
@@ -419,6 +567,16 @@ static bool create_listener_config(const SERV_LISTENER *listener, const char *fi
         dprintf(file, "authenticator_options=%s\n", listener->auth_options);
     }
 
+    if (listener->compression)
+    {
+        dprintf(file, "compression=true\n");
+    }
+
+    if (listener->max_connection_rate)
+    {
+        dprintf(file, "max_connection_rate=%d\n", listener->max_connection_rate);
+    }
+
     if (listener->ssl)
     {
         dprintf(file, "ssl=required\n");
@@ -442,6 +600,9 @@ static bool create_listener_config(const SERV_LISTENER *listener, const char *fi
             dprintf(file, "ssl_cert_verify_depth=%d\n", listener->ssl->ssl_cert_verify_depth);
         }
 
+        dprintf(file, "ssl_session_cache=%s\n", listener->ssl->ssl_session_cache ? "true" : "false");
+        dprintf(file, "ssl_ktls=%s\n", listener->ssl->ssl_ktls ? "true" : "false");
+
         const char *version = NULL;
 
         switch (listener->ssl->ssl_method_type)
@@ -18,6 +18,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
@@ -110,6 +111,8 @@ static struct
     bool               do_maxlog;        // Can change during the lifetime of log_manager.
     MXS_LOG_THROTTLING throttling;       // Can change during the lifetime of log_manager.
     bool               use_stdout;       // Can NOT change during the lifetime of log_manager.
+    bool               do_deferred;      // Can change during the lifetime of log_manager.
+    mxs_log_format_t   format;           // Can change during the lifetime of log_manager.
 } log_config =
 {
     DEFAULT_LOG_AUGMENTATION, // augmentation
@@ -117,7 +120,9 @@ static struct
     true,                     // do_syslog
     true,                     // do_maxlog
     DEFAULT_LOG_THROTTLING,   // throttling
-    false                     // use_stdout
+    false,                    // use_stdout
+    false,                    // do_deferred
+    MXS_LOG_FORMAT_TEXT       // format
 };
 
 /**
@@ -340,6 +345,78 @@ typedef struct blockbuf
 #endif
 } blockbuf_t;
 
+/** Size of the log ring of a thread, a power of two */
+#define LOG_RING_SIZE (64 * 1024)
+
+/** Length of the header of a message in a log ring */
+#define LOG_RING_HEADER_LEN sizeof(uint32_t)
+
+/** Header that tells that the rest of the ring is unused */
+#define LOG_RING_SKIP 0xffffffff
+
+/** The maximum number of messages written with one writev() */
+#define LOG_RING_BATCH 64
+
+/** Flag in the header of a message that the file writer formats */
+#define LOG_RING_DEFERRED 0x80000000
+
+/** Length of the JSON around the timestamp of a line, {"timestamp": "...", */
+#define LOG_JSON_TIMESTAMP_EXTRA 15
+
+/** The maximum length of a line the file writer formats */
+#define LOG_LINE_MAX (MAX_LOGSTRLEN + 128)
+
+/**
+ * A message whose formatting is left to the file writer. Only the addresses
+ * of the format, the module name and the function are stored as they are
+ * string literals. The header is followed by the arguments in the order of
+ * the conversions in the format. Strings are copied with their terminating
+ * null, the other arguments are stored as they are printed.
+ */
+typedef struct log_deferred
+{
+    struct timeval ld_time;          /**< When the message was logged */
+    const char*    ld_format;
+    const char*    ld_modname;
+    const char*    ld_function;
+    int            ld_priority;
+    int            ld_augmentation;
+    bool           ld_highprecision;
+    bool           ld_json;
+} log_deferred_t;
+
+/** The lines of the deferred messages of one writev(), used by the file writer */
+static char log_deferred_lines[LOG_RING_BATCH * 1024];
+
+/**
+ * The messages of one thread. The thread appends the messages to the ring
+ * and the file writer thread removes them without locks. A message is stored
+ * in one piece after its length. If there isn't enough space at the end of
+ * the ring, the message is stored at the start and the end is skipped.
+ *
+ * The positions only grow, the offset in the buffer is the position modulo
+ * the size of the ring. A ring is given to another thread when its thread
+ * exits.
+ */
+typedef struct log_ring
+{
+    uint64_t         lr_head;     /**< Position after the last message, moved by the owner */
+    uint64_t         lr_tail;     /**< Position of the first message, moved by the writer */
+    uint64_t         lr_dropped;  /**< Messages dropped because the ring was full */
+    uint64_t         lr_reported; /**< Dropped messages reported in the log */
+    int              lr_in_use;   /**< Whether a thread owns the ring */
+    struct log_ring* lr_next;     /**< The next ring, set before the ring is published */
+    char             lr_buf[LOG_RING_SIZE];
+} log_ring_t;
+
+/** The rings of all threads, the writer reads the list without a lock */
+static log_ring_t* log_rings;
+static SPINLOCK log_rings_lock = SPINLOCK_INIT;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+static thread_local log_ring_t* this_log_ring;
+static thread_local bool this_log_ring_init;
+
 /**
  * logfile object corresponds to physical file(s) where
  * certain log is written.
@@ -450,7 +527,8 @@ static int logmanager_write_log(int            priority,
                                 enum log_flush flush,
                                 size_t         prefix_len,
                                 size_t         len,
-                                const char*    str);
+                                const char*    str,
+                                bool           json);
 
 static blockbuf_t* blockbuf_init();
 static void blockbuf_node_done(void* bb_data);
@@ -460,6 +538,13 @@ static char* blockbuf_get_writepos(blockbuf_t** p_bb,
 
 static void blockbuf_register(blockbuf_t* bb);
 static void blockbuf_unregister(blockbuf_t* bb);
+static log_ring_t* log_ring_get();
+static char* log_ring_reserve(log_ring_t* ring, size_t len, uint32_t flags, uint64_t* p_head);
+static void log_ring_commit(log_ring_t* ring, uint64_t head, bool flush);
+static int log_rings_drain(skygw_file_t* file, bool flush);
+static size_t log_deferred_format(const char* data, size_t len, char* line, size_t size);
+static void log_syslog(int priority, const char* message);
+static size_t log_json_timestamp(char* dest, size_t size, const struct timeval* tv, bool hp);
 static char* add_slash(char* str);
 
 static bool check_file_and_path(const char* filename, bool* writable);
@@ -749,7 +834,8 @@ static int logmanager_write_log(int            priority,
                                 enum log_flush flush,
                                 size_t         prefix_len,
                                 size_t         str_len,
-                                const char*    str)
+                                const char*    str,
+                                bool           json)
 {
     logfile_t*   lf;
     char*        wp;
@@ -786,6 +872,11 @@ static int logmanager_write_log(int            priority,
         timestamp_len = get_timestamp_len();
     }
 
+    if (json)
+    {
+        timestamp_len += LOG_JSON_TIMESTAMP_EXTRA;
+    }
+
     bool overflow = false;
     /** Find out how much can be safely written with current block size */
     if (timestamp_len - sizeof(char) + str_len > lf->lf_buf_size)
@@ -827,10 +918,38 @@ static int logmanager_write_log(int            priority,
     }
 #endif
     /** Book space for log string from buffer */
+    log_ring_t* ring = NULL;
+    uint64_t ring_head = 0;
+
     if (do_maxlog)
     {
-        // All messages are now logged to the error log file.
-        wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        /**
+         * Messages are appended to the ring of the thread without locking.
+         * The large ones, and the ones that do not fit in a full ring, go
+         * through the shared block buffers. Info and debug messages that do
+         * not fit are dropped instead.
+         */
+        if (safe_str_len <= LOG_RING_SIZE / 4 && (ring = log_ring_get()))
+        {
+            wp = log_ring_reserve(ring, safe_str_len, 0, &ring_head);
+
+            if (wp == NULL)
+            {
+                if (priority == LOG_INFO || priority == LOG_DEBUG)
+                {
+                    atomic_add_uint64(&ring->lr_dropped, 1);
+                    return 0;
+                }
+
+                ring = NULL;
+            }
+        }
+
+        if (ring == NULL)
+        {
+            // All messages are now logged to the error log file.
+            wp = blockbuf_get_writepos(&bb, safe_str_len, flush);
+        }
     }
     else
     {
@@ -854,7 +973,18 @@ static int logmanager_write_log(int            priority,
      * to wp.
      * Returned timestamp_len doesn't include terminating null.
      */
-    if (do_highprecision)
+    if (json)
+    {
+        struct timeval tv = {time(NULL), 0};
+
+        if (do_highprecision)
+        {
+            gettimeofday(&tv, NULL);
+        }
+
+        timestamp_len = log_json_timestamp(wp, timestamp_len, &tv, do_highprecision);
+    }
+    else if (do_highprecision)
     {
         timestamp_len = snprint_timestamp_hp(wp, timestamp_len);
     }
@@ -877,27 +1007,11 @@ static int logmanager_write_log(int            priority,
     {
         memset(wp + safe_str_len - 4, '.', 3);
     }
-    /** write to syslog */
-    if (do_syslog)
+    /** write to syslog, the caller writes the JSON messages */
+    if (do_syslog && !json)
     {
         // Strip away the timestamp and the prefix (e.g. "error : ").
-        const char *message = wp + timestamp_len + prefix_len;
-
-        switch (priority)
-        {
-        case LOG_EMERG:
-        case LOG_ALERT:
-        case LOG_CRIT:
-        case LOG_ERR:
-        case LOG_WARNING:
-        case LOG_NOTICE:
-            syslog(priority, "%s", message);
-            break;
-
-        default:
-            // LOG_INFO and LOG_DEBUG messages are never written to syslog.
-            break;
-        }
+        log_syslog(priority, wp + timestamp_len + prefix_len);
     }
     /** remove double line feed */
     if (wp[safe_str_len - 2] == '\n')
@@ -906,7 +1020,11 @@ static int logmanager_write_log(int            priority,
     }
     wp[safe_str_len - 1] = '\n';
 
-    if (do_maxlog)
+    if (ring)
+    {
+        log_ring_commit(ring, ring_head, flush);
+    }
+    else if (do_maxlog)
     {
         blockbuf_unregister(bb);
     }
@@ -1260,6 +1378,261 @@ static blockbuf_t* blockbuf_init()
     return bb;
 }
 
+static void log_ring_release(void* data)
+{
+    log_ring_t* ring = (log_ring_t*)data;
+    atomic_store_int32(&ring->lr_in_use, 0);
+}
+
+static void log_ring_key_init()
+{
+    pthread_key_create(&log_ring_key, log_ring_release);
+}
+
+/**
+ * Get the log ring of the calling thread. The ring of a thread that has exited
+ * is taken into use if there is one, otherwise a new ring is allocated.
+ *
+ * @return The ring or NULL if the thread has no ring
+ */
+static log_ring_t* log_ring_get()
+{
+    if (!this_log_ring_init)
+    {
+        /** Set first, the allocation may log an error */
+        this_log_ring_init = true;
+        pthread_once(&log_ring_once, log_ring_key_init);
+
+        log_ring_t* ring;
+
+        spinlock_acquire(&log_rings_lock);
+
+        for (ring = log_rings; ring && ring->lr_in_use; ring = ring->lr_next)
+        {
+            ;
+        }
+
+        if (ring)
+        {
+            ring->lr_in_use = 1;
+        }
+
+        spinlock_release(&log_rings_lock);
+
+        if (ring == NULL && (ring = (log_ring_t*)MXS_CALLOC(1, sizeof(log_ring_t))))
+        {
+            ring->lr_in_use = 1;
+
+            spinlock_acquire(&log_rings_lock);
+            ring->lr_next = log_rings;
+            atomic_store_ptr((void**)&log_rings, ring);
+            spinlock_release(&log_rings_lock);
+        }
+
+        if (ring)
+        {
+            pthread_setspecific(log_ring_key, ring);
+            this_log_ring = ring;
+        }
+    }
+
+    return this_log_ring;
+}
+
+/**
+ * Reserve space for a message from the log ring of the calling thread.
+ *
+ * @param ring   The ring of the calling thread
+ * @param len    Length of the message
+ * @param flags  LOG_RING_DEFERRED if the file writer formats the message
+ * @param p_head Set to the position after the message
+ *
+ * @return Where the message is written or NULL if the ring is full
+ */
+static char* log_ring_reserve(log_ring_t* ring, size_t len, uint32_t flags, uint64_t* p_head)
+{
+    size_t need = LOG_RING_HEADER_LEN + len;
+    uint64_t head = ring->lr_head;
+    uint64_t tail = atomic_load_uint64(&ring->lr_tail);
+    size_t offset = head & (LOG_RING_SIZE - 1);
+    size_t to_end = LOG_RING_SIZE - offset;
+    size_t skip = to_end < need ? to_end : 0;
+
+    if (head + skip + need - tail > LOG_RING_SIZE)
+    {
+        return NULL;
+    }
+
+    if (skip)
+    {
+        if (to_end >= LOG_RING_HEADER_LEN)
+        {
+            uint32_t marker = LOG_RING_SKIP;
+            memcpy(&ring->lr_buf[offset], &marker, LOG_RING_HEADER_LEN);
+        }
+
+        head += skip;
+        offset = 0;
+    }
+
+    uint32_t header = len | flags;
+    memcpy(&ring->lr_buf[offset], &header, LOG_RING_HEADER_LEN);
+    *p_head = head + need;
+
+    return &ring->lr_buf[offset + LOG_RING_HEADER_LEN];
+}
+
+/**
+ * Make a message that has been written in a log ring visible to the file
+ * writer. The writer is woken up if the message must be flushed or if the
+ * ring became half full.
+ *
+ * @param ring  The ring of the calling thread
+ * @param head  The position after the message
+ * @param flush Whether the message must be written right away
+ */
+static void log_ring_commit(log_ring_t* ring, uint64_t head, bool flush)
+{
+    uint64_t old_used = ring->lr_head - atomic_load_uint64(&ring->lr_tail);
+
+    atomic_store_uint64(&ring->lr_head, head);
+
+    uint64_t used = head - atomic_load_uint64(&ring->lr_tail);
+
+    if (flush || (old_used < LOG_RING_SIZE / 2 && used >= LOG_RING_SIZE / 2))
+    {
+        skygw_message_send(lm->lm_logfile.lf_logmes);
+    }
+}
+
+/**
+ * Write a note about the messages of a ring that were dropped.
+ */
+static int log_ring_report_dropped(skygw_file_t* file, log_ring_t* ring)
+{
+    uint64_t dropped = atomic_load_uint64(&ring->lr_dropped);
+    int err = 0;
+
+    if (dropped != ring->lr_reported)
+    {
+        char msg[MAX_LOGSTRLEN];
+        size_t len = snprint_timestamp(msg, get_timestamp_len());
+        len += snprintf(msg + len, sizeof(msg) - len,
+                        "warning: %" PRIu64 " info and debug messages of a thread were dropped "
+                        "because its log buffer was full.\n", dropped - ring->lr_reported);
+        ring->lr_reported = dropped;
+        err = skygw_file_write(file, msg, MXS_MIN(len, sizeof(msg) - 1), false);
+    }
+
+    return err;
+}
+
+/**
+ * Write the messages of all log rings to the log file. The messages of each
+ * ring are written in order with as few writev() calls as possible.
+ *
+ * @param file  The log file
+ * @param flush Whether the file is synced to disk
+ *
+ * @return 0 on success, errno on failure
+ */
+static int log_rings_drain(skygw_file_t* file, bool flush)
+{
+    int err = 0;
+
+    for (log_ring_t* ring = (log_ring_t*)atomic_load_ptr((void**)&log_rings);
+         ring && err == 0; ring = ring->lr_next)
+    {
+        uint64_t head = atomic_load_uint64(&ring->lr_head);
+        uint64_t tail = ring->lr_tail;
+
+        while (tail < head && err == 0)
+        {
+            struct iovec iov[LOG_RING_BATCH];
+            int n = 0;
+            size_t lines_used = 0;
+
+            while (tail < head && n < LOG_RING_BATCH)
+            {
+                size_t offset = tail & (LOG_RING_SIZE - 1);
+                size_t to_end = LOG_RING_SIZE - offset;
+                uint32_t len = LOG_RING_SKIP;
+
+                if (to_end >= LOG_RING_HEADER_LEN)
+                {
+                    memcpy(&len, &ring->lr_buf[offset], LOG_RING_HEADER_LEN);
+                }
+
+                if (len == LOG_RING_SKIP)
+                {
+                    tail += to_end;
+                    continue;
+                }
+
+                char* data = &ring->lr_buf[offset + LOG_RING_HEADER_LEN];
+
+                if (len & LOG_RING_DEFERRED)
+                {
+                    len &= ~LOG_RING_DEFERRED;
+
+                    if (sizeof(log_deferred_lines) - lines_used < LOG_LINE_MAX)
+                    {
+                        /** The rest is formatted for the next writev() */
+                        break;
+                    }
+
+                    char* line = &log_deferred_lines[lines_used];
+                    iov[n].iov_base = line;
+                    iov[n].iov_len = log_deferred_format(data, len, line, LOG_LINE_MAX);
+                    lines_used += iov[n].iov_len;
+                }
+                else
+                {
+                    iov[n].iov_base = data;
+                    iov[n].iov_len = len;
+                }
+
+                n++;
+                tail += LOG_RING_HEADER_LEN + len;
+            }
+
+            if (n > 0)
+            {
+                err = skygw_file_writev(file, iov, n, false);
+            }
+
+            /** The space is given back only after it has been written */
+            atomic_store_uint64(&ring->lr_tail, tail);
+        }
+
+        if (err == 0)
+        {
+            err = log_ring_report_dropped(file, ring);
+        }
+    }
+
+    if (err == 0 && flush)
+    {
+        fflush(file->sf_file);
+        fsync(fileno(file->sf_file));
+    }
+
+    return err;
+}
+
+uint64_t mxs_log_get_dropped(void)
+{
+    uint64_t dropped = 0;
+
+    for (log_ring_t* ring = (log_ring_t*)atomic_load_ptr((void**)&log_rings);
+         ring; ring = ring->lr_next)
+    {
+        dropped += atomic_load_uint64(&ring->lr_dropped);
+    }
+
+    return dropped;
+}
+
 /**
  * Set log augmentation.
  *
@@ -1270,6 +1643,27 @@ void mxs_log_set_augmentation(int bits)
     log_config.augmentation = bits & MXS_LOG_AUGMENTATION_MASK;
 }
 
+/**
+ * Set the format of the log lines.
+ *
+ * @param format MXS_LOG_FORMAT_TEXT or MXS_LOG_FORMAT_JSON
+ */
+void mxs_log_set_format(mxs_log_format_t format)
+{
+    log_config.format = format;
+}
+
+/**
+ * Enable/disable the formatting of info and debug messages in the log writer
+ * thread.
+ *
+ * @param enabled True, if the formatting should be deferred.
+ */
+void mxs_log_set_deferred_enabled(bool enabled)
+{
+    log_config.do_deferred = enabled;
+}
+
 /**
  * Helper for skygw_log_write and friends.
  *
@@ -1281,6 +1675,8 @@ void mxs_log_set_augmentation(int bits)
  * @param len        Length of str, including terminating NULL.
  * @param str        String
  * @param flush      Whether the message should be flushed.
+ * @param json       Whether str is the JSON object of the message without
+ *                   the timestamp. The caller writes it to syslog.
  *
  * @return 0 if the logging to at least one log succeeded.
  */
@@ -1292,7 +1688,8 @@ static int log_write(int            priority,
                      size_t         prefix_len,
                      size_t         len,
                      const char*    str,
-                     enum log_flush flush)
+                     enum log_flush flush,
+                     bool           json)
 {
     int rv = -1;
 
@@ -1300,7 +1697,7 @@ static int log_write(int            priority,
     {
         CHK_LOGMANAGER(lm);
 
-        rv = logmanager_write_log(priority, flush, prefix_len, len, str);
+        rv = logmanager_write_log(priority, flush, prefix_len, len, str, json);
 
         logmanager_unregister();
     }
@@ -2160,6 +2557,20 @@ static bool thr_flush_file(logmanager_t *lm, filewriter_t *fwr)
     }
 
     skygw_file_t *file = fwr->fwr_file;
+
+    /** The messages of the thread rings are written first */
+    int ring_err = log_rings_drain(file, flush_logfile || do_flushall);
+
+    if (ring_err)
+    {
+        char errbuf[MXS_STRERROR_BUFLEN];
+        LOG_ERROR("MaxScale Log: Error, writing to the log-file %s failed due to %d, %s. "
+                  "Disabling writing to the log.\n",
+                  lf->lf_full_file_name, ring_err, strerror_r(ring_err, errbuf, sizeof(errbuf)));
+
+        mxs_log_set_maxlog_enabled(false);
+    }
+
     /**
      * get logfile's block buffer list
      */
@@ -2746,47 +3157,832 @@ static enum log_flush priority_to_flush(int priority)
     }
 }
 
-typedef enum message_suppression
+/**
+ * Write a message to syslog. Info and debug messages are never written.
+ *
+ * @param priority The syslog priority
+ * @param message  The message without the timestamp and the priority
+ */
+static void log_syslog(int priority, const char* message)
 {
-    MESSAGE_NOT_SUPPRESSED,   // Message is not suppressed.
-    MESSAGE_SUPPRESSED,       // Message is suppressed for the first time (for this round)
-    MESSAGE_STILL_SUPPRESSED  // Message is still suppressed (for this round)
-} message_suppression_t;
+    switch (priority)
+    {
+    case LOG_EMERG:
+    case LOG_ALERT:
+    case LOG_CRIT:
+    case LOG_ERR:
+    case LOG_WARNING:
+    case LOG_NOTICE:
+        syslog(priority, "%s", message);
+        break;
 
-static message_suppression_t message_status(const char* file, int line)
+    default:
+        // LOG_INFO and LOG_DEBUG messages are never written to syslog.
+        break;
+    }
+}
+
+/**
+ * Write the start of the JSON object of a log line, up to the timestamp.
+ *
+ * @param dest Where the text is written, at least the length of the timestamp
+ *             plus LOG_JSON_TIMESTAMP_EXTRA bytes
+ * @param size Size of @c dest
+ * @param tv   The time of the message
+ * @param hp   Whether the timestamp has millisecond precision
+ *
+ * @return Length of the text
+ */
+static size_t log_json_timestamp(char* dest, size_t size, const struct timeval* tv, bool hp)
 {
-    message_suppression_t rv = MESSAGE_NOT_SUPPRESSED;
+    static const char START[] = "{\"timestamp\": \"";
+    static const char END[] = "\", ";
 
-    // Copy the config to prevent the values from changing while we are using
-    // them. It does not matter if they are changed just when we are copying
-    // them, but we want to use one set of values throughout the function.
-    MXS_LOG_THROTTLING t = log_config.throttling;
+    size_t len = sizeof(START) - 1;
+    memcpy(dest, START, len);
+    len += snprint_timestamp_tv(dest + len, size - len, tv, hp);
 
-    if ((t.count != 0) && (t.window_ms != 0) && (t.suppress_ms != 0))
+    /** The text timestamps end with spaces */
+    while (dest[len - 1] == ' ')
     {
-        LM_MESSAGE_KEY key = { file, line };
-        LM_MESSAGE_STATS *value;
+        len--;
+    }
 
-        errno = 0;
+    memcpy(dest + len, END, sizeof(END));
+    return len + sizeof(END) - 1;
+}
 
-        // Since the hashtable can not be externally locked, the lookup/creation
-        // must be done in a loop to ensure that everything works even if two
-        // threads logs the same message at the very same time.
-        do
+/**
+ * Copy a string as the contents of a JSON string.
+ *
+ * @return Position after the copy, at most @c end
+ */
+static char* log_json_escape(char* dest, const char* end, const char* str)
+{
+    for (; *str; str++)
+    {
+        unsigned char c = *str;
+        char esc = 0;
+
+        switch (c)
         {
-            value = (LM_MESSAGE_STATS*) hashtable_fetch(message_stats, &key);
+        case '"':
+        case '\\':
+            esc = c;
+            break;
 
-            if (!value)
-            {
-                LM_MESSAGE_STATS stats;
-                spinlock_init(&stats.lock);
-                stats.first_ms = time_monotonic_ms();
-                stats.last_ms = 0;
-                stats.count = 0;
+        case '\n':
+            esc = 'n';
+            break;
 
-                // hashtable_add may fail for two reasons; the key exists
-                // already or it runs out of memory. In the latter case
-                // errno is set.
+        case '\r':
+            esc = 'r';
+            break;
+
+        case '\t':
+            esc = 't';
+            break;
+
+        default:
+            break;
+        }
+
+        if (esc)
+        {
+            if (end - dest < 2)
+            {
+                break;
+            }
+
+            *dest++ = '\\';
+            *dest++ = esc;
+        }
+        else if (c < 0x20)
+        {
+            if (end - dest < 6)
+            {
+                break;
+            }
+
+            dest += sprintf(dest, "\\u%04x", c);
+        }
+        else
+        {
+            if (end - dest < 1)
+            {
+                break;
+            }
+
+            *dest++ = c;
+        }
+    }
+
+    return dest;
+}
+
+/**
+ * Write the fields of the JSON object of a log line after the timestamp.
+ * The message is truncated so that the object is always complete.
+ *
+ * @param dest     Where the text is written
+ * @param size     Size of @c dest, at least 128 bytes
+ * @param priority The syslog priority
+ * @param modname  The module or NULL
+ * @param function The function
+ * @param message  The message
+ *
+ * @return Length of the text, without the terminating null
+ */
+static size_t log_json_fields(char* dest, size_t size, int priority,
+                              const char* modname, const char* function, const char* message)
+{
+    log_prefix_t prefix = priority_to_prefix(priority);
+    int priority_len = strcspn(prefix.text, " :");
+    /** Room for the closing characters */
+    const char* end = dest + size - sizeof("\"}");
+    char* ptr = dest;
+
+    ptr += snprintf(ptr, end - ptr, "\"priority\": \"%.*s\", ", priority_len, prefix.text);
+
+    if (modname)
+    {
+        ptr = MXS_MIN(ptr + snprintf(ptr, end - ptr, "\"module\": \""), (char*)end);
+        ptr = log_json_escape(ptr, end, modname);
+        ptr = MXS_MIN(ptr + snprintf(ptr, end - ptr, "\", "), (char*)end);
+    }
+
+    ptr = MXS_MIN(ptr + snprintf(ptr, end - ptr, "\"function\": \""), (char*)end);
+    ptr = log_json_escape(ptr, end, function);
+    ptr = MXS_MIN(ptr + snprintf(ptr, end - ptr, "\", \"message\": \""), (char*)end);
+    ptr = log_json_escape(ptr, end, message);
+
+    strcpy(ptr, "\"}");
+    return ptr - dest + 2;
+}
+
+/** A conversion in a printf format */
+typedef struct log_conversion
+{
+    const char* lc_start;          /**< The '%' */
+    const char* lc_length;         /**< The length modifier or the conversion */
+    const char* lc_end;            /**< After the conversion */
+    bool        lc_star_width;     /**< Whether the width is an argument */
+    bool        lc_star_precision; /**< Whether the precision is an argument */
+    int         lc_precision;      /**< The precision or -1 if not given in the format */
+    char        lc_modifier;       /**< 'H' for hh, 'h', 'l', 'q' for ll, 'j', 'z', 't' or 0 */
+    char        lc_type;           /**< The conversion character */
+} log_conversion_t;
+
+/** The longest conversion that is deferred */
+#define LOG_CONVERSION_MAX 24
+
+/**
+ * Parse a conversion of a printf format.
+ *
+ * @param p    The '%' that starts the conversion, not followed by another '%'
+ * @param conv The parsed conversion
+ *
+ * @return True if the arguments of the conversion can be stored for the
+ *         file writer
+ */
+static bool log_parse_conversion(const char* p, log_conversion_t* conv)
+{
+    conv->lc_start = p++;
+    conv->lc_star_width = false;
+    conv->lc_star_precision = false;
+    conv->lc_precision = -1;
+    conv->lc_modifier = 0;
+
+    while (*p && strchr("-+ #0'", *p))
+    {
+        p++;
+    }
+
+    if (*p == '*')
+    {
+        conv->lc_star_width = true;
+        p++;
+    }
+
+    while (isdigit(*p))
+    {
+        p++;
+    }
+
+    if (*p == '.')
+    {
+        p++;
+
+        if (*p == '*')
+        {
+            conv->lc_star_precision = true;
+            p++;
+        }
+        else
+        {
+            conv->lc_precision = atoi(p);
+        }
+
+        while (isdigit(*p))
+        {
+            p++;
+        }
+    }
+
+    conv->lc_length = p;
+
+    if (*p == 'h' || *p == 'l')
+    {
+        conv->lc_modifier = *p++;
+
+        if (*p == conv->lc_modifier)
+        {
+            conv->lc_modifier = *p == 'h' ? 'H' : 'q';
+            p++;
+        }
+    }
+    else if (*p == 'j' || *p == 'z' || *p == 't')
+    {
+        conv->lc_modifier = *p++;
+    }
+
+    conv->lc_type = *p;
+    conv->lc_end = *p ? p + 1 : p;
+
+    if (conv->lc_end - conv->lc_start > LOG_CONVERSION_MAX)
+    {
+        return false;
+    }
+
+    switch (conv->lc_type)
+    {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'p':
+        return true;
+
+    case 'c':
+    case 's':
+        // Wide characters are not stored
+        return conv->lc_modifier == 0;
+
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return conv->lc_modifier == 0 || conv->lc_modifier == 'l';
+
+    default:
+        // %n, %m, long doubles and invalid conversions
+        return false;
+    }
+}
+
+static bool log_put(char* dest, size_t size, size_t* len, const void* value, size_t n)
+{
+    if (*len + n > size)
+    {
+        return false;
+    }
+
+    memcpy(dest + *len, value, n);
+    *len += n;
+    return true;
+}
+
+static bool log_get(const char* src, size_t size, size_t* offset, void* value, size_t n)
+{
+    if (*offset + n > size)
+    {
+        return false;
+    }
+
+    memcpy(value, src + *offset, n);
+    *offset += n;
+    return true;
+}
+
+/**
+ * Store the arguments of a message. The integers are stored as long long
+ * values and printed with the ll modifier.
+ *
+ * @param dest    Where the arguments are stored
+ * @param size    Size of @c dest
+ * @param len     Length of the data in @c dest, updated
+ * @param format  The format of the message
+ * @param valist  The arguments
+ *
+ * @return True if all arguments were stored
+ */
+static bool log_defer_args(char* dest, size_t size, size_t* len, const char* format, va_list valist)
+{
+    for (const char* p = strchr(format, '%'); p; p = strchr(p, '%'))
+    {
+        if (p[1] == '%')
+        {
+            p += 2;
+            continue;
+        }
+
+        log_conversion_t conv;
+
+        if (!log_parse_conversion(p, &conv))
+        {
+            return false;
+        }
+
+        p = conv.lc_end;
+        int precision = conv.lc_precision;
+
+        if (conv.lc_star_width)
+        {
+            int width = va_arg(valist, int);
+
+            if (!log_put(dest, size, len, &width, sizeof(width)))
+            {
+                return false;
+            }
+        }
+
+        if (conv.lc_star_precision)
+        {
+            precision = va_arg(valist, int);
+
+            if (!log_put(dest, size, len, &precision, sizeof(precision)))
+            {
+                return false;
+            }
+        }
+
+        bool ok;
+
+        switch (conv.lc_type)
+        {
+        case 'd':
+        case 'i':
+            {
+                long long value;
+
+                switch (conv.lc_modifier)
+                {
+                case 'H':
+                    value = (signed char)va_arg(valist, int);
+                    break;
+
+                case 'h':
+                    value = (short)va_arg(valist, int);
+                    break;
+
+                case 'l':
+                    value = va_arg(valist, long);
+                    break;
+
+                case 'q':
+                    value = va_arg(valist, long long);
+                    break;
+
+                case 'j':
+                    value = va_arg(valist, intmax_t);
+                    break;
+
+                case 'z':
+                    value = va_arg(valist, ssize_t);
+                    break;
+
+                case 't':
+                    value = va_arg(valist, ptrdiff_t);
+                    break;
+
+                default:
+                    value = va_arg(valist, int);
+                    break;
+                }
+
+                ok = log_put(dest, size, len, &value, sizeof(value));
+            }
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            {
+                unsigned long long value;
+
+                switch (conv.lc_modifier)
+                {
+                case 'H':
+                    value = (unsigned char)va_arg(valist, unsigned int);
+                    break;
+
+                case 'h':
+                    value = (unsigned short)va_arg(valist, unsigned int);
+                    break;
+
+                case 'l':
+                    value = va_arg(valist, unsigned long);
+                    break;
+
+                case 'q':
+                    value = va_arg(valist, unsigned long long);
+                    break;
+
+                case 'j':
+                    value = va_arg(valist, uintmax_t);
+                    break;
+
+                case 'z':
+                    value = va_arg(valist, size_t);
+                    break;
+
+                case 't':
+                    value = (size_t)va_arg(valist, ptrdiff_t);
+                    break;
+
+                default:
+                    value = va_arg(valist, unsigned int);
+                    break;
+                }
+
+                ok = log_put(dest, size, len, &value, sizeof(value));
+            }
+            break;
+
+        case 'c':
+            {
+                int value = va_arg(valist, int);
+                ok = log_put(dest, size, len, &value, sizeof(value));
+            }
+            break;
+
+        case 'p':
+            {
+                void* value = va_arg(valist, void*);
+                ok = log_put(dest, size, len, &value, sizeof(value));
+            }
+            break;
+
+        case 's':
+            {
+                const char* value = va_arg(valist, const char*);
+
+                if (value == NULL)
+                {
+                    value = "(null)";
+                }
+
+                size_t n = precision >= 0 ? strnlen(value, precision) : strlen(value);
+                char nul = '\0';
+                ok = log_put(dest, size, len, value, n) && log_put(dest, size, len, &nul, 1);
+            }
+            break;
+
+        default:
+            {
+                double value = va_arg(valist, double);
+                ok = log_put(dest, size, len, &value, sizeof(value));
+            }
+            break;
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Print one argument with the conversion of the format.
+ */
+#define LOG_PRINT_ARG(dest, size, spec, conv, width, precision, value)  \
+    ((conv).lc_star_width ?                                             \
+     ((conv).lc_star_precision ?                                        \
+      snprintf(dest, size, spec, width, precision, value) :             \
+      snprintf(dest, size, spec, width, value)) :                       \
+     ((conv).lc_star_precision ?                                        \
+      snprintf(dest, size, spec, precision, value) :                    \
+      snprintf(dest, size, spec, value)))
+
+/**
+ * Format a message with arguments stored by log_defer_args().
+ *
+ * @param dest   Where the message is written
+ * @param size   Size of @c dest
+ * @param format The format of the message
+ * @param args   The stored arguments
+ * @param len    Length of @c args
+ *
+ * @return Length of the message
+ */
+static size_t log_format_args(char* dest, size_t size, const char* format, const char* args, size_t len)
+{
+    size_t offset = 0;
+    size_t pos = 0;
+    const char* p = format;
+
+    while (*p && pos < size - 1)
+    {
+        if (*p != '%')
+        {
+            dest[pos++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%')
+        {
+            dest[pos++] = '%';
+            p += 2;
+            continue;
+        }
+
+        log_conversion_t conv;
+        log_parse_conversion(p, &conv);
+        p = conv.lc_end;
+
+        /** The length modifier is replaced, the integers are long longs */
+        char spec[LOG_CONVERSION_MAX + 3];
+        size_t spec_len = conv.lc_length - conv.lc_start;
+        memcpy(spec, conv.lc_start, spec_len);
+
+        if (strchr("diuoxX", conv.lc_type))
+        {
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+        }
+
+        spec[spec_len++] = conv.lc_type;
+        spec[spec_len] = '\0';
+
+        int width = 0;
+        int precision = 0;
+
+        if ((conv.lc_star_width && !log_get(args, len, &offset, &width, sizeof(width))) ||
+            (conv.lc_star_precision && !log_get(args, len, &offset, &precision, sizeof(precision))))
+        {
+            break;
+        }
+
+        char* out = dest + pos;
+        size_t left = size - pos;
+        int n = -1;
+
+        switch (conv.lc_type)
+        {
+        case 'd':
+        case 'i':
+            {
+                long long value;
+
+                if (log_get(args, len, &offset, &value, sizeof(value)))
+                {
+                    n = LOG_PRINT_ARG(out, left, spec, conv, width, precision, value);
+                }
+            }
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            {
+                unsigned long long value;
+
+                if (log_get(args, len, &offset, &value, sizeof(value)))
+                {
+                    n = LOG_PRINT_ARG(out, left, spec, conv, width, precision, value);
+                }
+            }
+            break;
+
+        case 'c':
+            {
+                int value;
+
+                if (log_get(args, len, &offset, &value, sizeof(value)))
+                {
+                    n = LOG_PRINT_ARG(out, left, spec, conv, width, precision, value);
+                }
+            }
+            break;
+
+        case 'p':
+            {
+                void* value;
+
+                if (log_get(args, len, &offset, &value, sizeof(value)))
+                {
+                    n = LOG_PRINT_ARG(out, left, spec, conv, width, precision, value);
+                }
+            }
+            break;
+
+        case 's':
+            {
+                const char* value = args + offset;
+                const char* nul = offset < len ? (const char*)memchr(value, '\0', len - offset) : NULL;
+
+                if (nul)
+                {
+                    offset += nul - value + 1;
+                    n = LOG_PRINT_ARG(out, left, spec, conv, width, precision, value);
+                }
+            }
+            break;
+
+        default:
+            {
+                double value;
+
+                if (log_get(args, len, &offset, &value, sizeof(value)))
+                {
+                    n = LOG_PRINT_ARG(out, left, spec, conv, width, precision, value);
+                }
+            }
+            break;
+        }
+
+        if (n < 0)
+        {
+            break;
+        }
+
+        pos = MXS_MIN(pos + n, size - 1);
+    }
+
+    dest[pos] = '\0';
+    return pos;
+}
+
+/**
+ * Format a deferred message. Called by the file writer.
+ *
+ * @param data The message in a log ring
+ * @param len  Length of the message
+ * @param line Where the line is written
+ * @param size Size of @c line, at least LOG_LINE_MAX
+ *
+ * @return Length of the line, including the line feed
+ */
+static size_t log_deferred_format(const char* data, size_t len, char* line, size_t size)
+{
+    log_deferred_t ld;
+    memcpy(&ld, data, sizeof(ld));
+
+    char message[MAX_LOGSTRLEN];
+    log_format_args(message, sizeof(message), ld.ld_format, data + sizeof(ld), len - sizeof(ld));
+
+    size_t pos;
+
+    if (ld.ld_json)
+    {
+        pos = log_json_timestamp(line, size, &ld.ld_time, ld.ld_highprecision);
+        pos += log_json_fields(line + pos, size - pos - 1, ld.ld_priority,
+                               ld.ld_modname, ld.ld_function, message);
+    }
+    else
+    {
+        log_prefix_t prefix = priority_to_prefix(ld.ld_priority);
+        bool function = ld.ld_augmentation & MXS_LOG_AUGMENT_WITH_FUNCTION;
+
+        pos = snprint_timestamp_tv(line, size, &ld.ld_time, ld.ld_highprecision);
+        pos += snprintf(line + pos, size - pos - 1, "%s%s%s%s%s%s%s%s",
+                        prefix.text,
+                        ld.ld_modname ? "[" : "",
+                        ld.ld_modname ? ld.ld_modname : "",
+                        ld.ld_modname ? "] " : "",
+                        function ? "(" : "",
+                        function ? ld.ld_function : "",
+                        function ? "): " : "",
+                        message);
+        pos = MXS_MIN(pos, size - 2);
+
+        /** remove double line feed */
+        if (line[pos - 1] == '\n')
+        {
+            line[pos - 1] = ' ';
+        }
+    }
+
+    line[pos++] = '\n';
+    return pos;
+}
+
+/**
+ * Store an info or debug message in the log ring of the calling thread with
+ * unformatted arguments. The file writer formats the message.
+ *
+ * @return True if the message was stored or dropped because the ring
+ *         was full, false if it must be formatted by the caller
+ */
+static bool log_defer(int priority, const char* modname, const char* function,
+                      const char* format, va_list valist)
+{
+    char data[LOG_RING_SIZE / 4];
+    log_deferred_t ld;
+    size_t len = sizeof(ld);
+    bool rval = false;
+
+    ld.ld_highprecision = log_config.do_highprecision;
+
+    if (ld.ld_highprecision)
+    {
+        gettimeofday(&ld.ld_time, NULL);
+    }
+    else
+    {
+        // The same clock as in the timestamps of the other messages
+        ld.ld_time.tv_sec = time(NULL);
+        ld.ld_time.tv_usec = 0;
+    }
+
+    ld.ld_format = format;
+    ld.ld_modname = modname;
+    ld.ld_function = function;
+    ld.ld_priority = priority;
+    ld.ld_augmentation = log_config.augmentation;
+    ld.ld_json = log_config.format == MXS_LOG_FORMAT_JSON;
+    memcpy(data, &ld, sizeof(ld));
+
+    if (log_defer_args(data, sizeof(data), &len, format, valist) && logmanager_register(true))
+    {
+        log_ring_t* ring = log_ring_get();
+
+        if (ring)
+        {
+            uint64_t head;
+            char* wp = log_ring_reserve(ring, len, LOG_RING_DEFERRED, &head);
+
+            if (wp)
+            {
+                memcpy(wp, data, len);
+                log_ring_commit(ring, head, false);
+            }
+            else
+            {
+                atomic_add_uint64(&ring->lr_dropped, 1);
+            }
+
+            rval = true;
+        }
+
+        logmanager_unregister();
+    }
+
+    return rval;
+}
+
+typedef enum message_suppression
+{
+    MESSAGE_NOT_SUPPRESSED,   // Message is not suppressed.
+    MESSAGE_SUPPRESSED,       // Message is suppressed for the first time (for this round)
+    MESSAGE_STILL_SUPPRESSED  // Message is still suppressed (for this round)
+} message_suppression_t;
+
+static message_suppression_t message_status(const char* file, int line)
+{
+    message_suppression_t rv = MESSAGE_NOT_SUPPRESSED;
+
+    // Copy the config to prevent the values from changing while we are using
+    // them. It does not matter if they are changed just when we are copying
+    // them, but we want to use one set of values throughout the function.
+    MXS_LOG_THROTTLING t = log_config.throttling;
+
+    if ((t.count != 0) && (t.window_ms != 0) && (t.suppress_ms != 0))
+    {
+        LM_MESSAGE_KEY key = { file, line };
+        LM_MESSAGE_STATS *value;
+
+        errno = 0;
+
+        // Since the hashtable can not be externally locked, the lookup/creation
+        // must be done in a loop to ensure that everything works even if two
+        // threads logs the same message at the very same time.
+        do
+        {
+            value = (LM_MESSAGE_STATS*) hashtable_fetch(message_stats, &key);
+
+            if (!value)
+            {
+                LM_MESSAGE_STATS stats;
+                spinlock_init(&stats.lock);
+                stats.first_ms = time_monotonic_ms();
+                stats.last_ms = 0;
+                stats.count = 0;
+
+                // hashtable_add may fail for two reasons; the key exists
+                // already or it runs out of memory. In the latter case
+                // errno is set.
                 hashtable_add(message_stats, &key, &stats);
             }
         }
@@ -2865,18 +4061,35 @@ static message_suppression_t message_status(const char* file, int line)
  * @param file     The name of the file where the message was logged.
  * @param line     The line where the message was logged.
  * @param function The function where the message was logged.
+ * @param literal  Whether the format is a string literal.
  * @param format   The printf format of the following arguments.
- * @param ...      Optional arguments according to the format.
+ * @param args     Arguments according to the format.
  */
-int mxs_log_message(int priority,
-                    const char* modname,
-                    const char* file, int line, const char* function,
-                    const char* format, ...)
+static int log_message(int priority,
+                       const char* modname,
+                       const char* file, int line, const char* function,
+                       bool literal, const char* format, va_list args)
 {
     int err = 0;
 
     assert((priority & ~LOG_PRIMASK) == 0);
 
+    // Info and debug messages are not throttled and never written to syslog,
+    // the file writer can format them if the format outlives the call.
+    if (literal && log_config.do_deferred && log_config.do_maxlog &&
+        (priority == LOG_INFO || priority == LOG_DEBUG))
+    {
+        va_list valist;
+        va_copy(valist, args);
+        bool deferred = log_defer(priority, modname, function, format, valist);
+        va_end(valist);
+
+        if (deferred)
+        {
+            return 0;
+        }
+    }
+
     if ((priority & ~LOG_PRIMASK) == 0) // Check that the priority is ok,
     {
         message_suppression_t status = MESSAGE_NOT_SUPPRESSED;
@@ -2912,7 +4125,7 @@ int mxs_log_message(int priority,
             /**
              * Find out the length of log string (to be formatted str).
              */
-            va_start(valist, format);
+            va_copy(valist, args);
             int message_len = vsnprintf(NULL, 0, format, valist);
             va_end(valist);
 
@@ -2990,7 +4203,7 @@ int mxs_log_message(int priority,
                     ss_dassert(len == augmentation_len);
                 }
 
-                va_start(valist, format);
+                va_copy(valist, args);
                 vsnprintf(message_text, message_len + 1, format, valist);
                 va_end(valist);
 
@@ -3001,7 +4214,25 @@ int mxs_log_message(int priority,
 
                 enum log_flush flush = priority_to_flush(priority);
 
-                err = log_write(priority, file, line, function, prefix.len, buffer_len, buffer, flush);
+                if (log_config.format == MXS_LOG_FORMAT_JSON)
+                {
+                    if (log_config.do_syslog)
+                    {
+                        log_syslog(priority, modname_text);
+                    }
+
+                    // The timestamp is added in front of the fields.
+                    char json[MAX_LOGSTRLEN - get_timestamp_len_hp() - LOG_JSON_TIMESTAMP_EXTRA];
+                    size_t json_len = log_json_fields(json, sizeof(json), priority,
+                                                      modname, function, message_text);
+
+                    err = log_write(priority, file, line, function, 0, json_len + 1, json, flush, true);
+                }
+                else
+                {
+                    err = log_write(priority, file, line, function, prefix.len, buffer_len, buffer,
+                                    flush, false);
+                }
             }
         }
     }
@@ -3013,6 +4244,32 @@ int mxs_log_message(int priority,
     return err;
 }
 
+int mxs_log_message(int priority,
+                    const char* modname,
+                    const char* file, int line, const char* function,
+                    const char* format, ...)
+{
+    va_list valist;
+    va_start(valist, format);
+    int err = log_message(priority, modname, file, line, function, false, format, valist);
+    va_end(valist);
+
+    return err;
+}
+
+int mxs_log_message_literal(int priority,
+                            const char* modname,
+                            const char* file, int line, const char* function,
+                            const char* format, ...)
+{
+    va_list valist;
+    va_start(valist, format);
+    int err = log_message(priority, modname, file, line, function, true, format, valist);
+    va_end(valist);
+
+    return err;
+}
+
 const char* mxs_strerror(int error)
 {
     static thread_local char errbuf[MXS_STRERROR_BUFLEN];
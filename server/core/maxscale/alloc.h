@@ -0,0 +1,84 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/alloc.h - Accounting of the memory allocations
+ *
+ * When memory_accounting is enabled, the allocation macros count the blocks
+ * and the bytes allocated and freed by each module. The module is the one in
+ * whose source file the macro is used, so a block that is allocated by one
+ * module and freed by another is accounted to both. Each thread updates its
+ * own counters and the counters of all threads are only summed when they are
+ * shown.
+ *
+ * With memory_sample_interval, the allocation that makes a thread exceed the
+ * interval is sampled and its stack is recorded, so that the code that
+ * allocates the most can be found.
+ */
+
+#include <maxscale/alloc.h>
+#include <maxscale/dcb.h>
+#include <maxscale/resultset.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * The allocations of a module
+ */
+typedef struct alloc_stats
+{
+    uint64_t allocs;    /**< Number of blocks allocated */
+    uint64_t frees;     /**< Number of blocks freed */
+    uint64_t allocated; /**< Bytes allocated */
+    uint64_t freed;     /**< Bytes freed */
+} ALLOC_STATS;
+
+/** Whether the allocations are accounted, do not modify */
+extern bool alloc_accounting_active;
+
+/**
+ * @brief Start accounting the allocations
+ *
+ * Does nothing if memory_accounting is not enabled. The memory allocated
+ * before this is not accounted, although it is accounted when it is freed.
+ */
+void alloc_accounting_init(void);
+
+/**
+ * @brief Get the allocations of a module, summed over all threads
+ *
+ * @param module Name of the module, NULL for the core
+ * @param stats  The allocations are stored here
+ *
+ * @return False if nothing has been accounted to the module
+ */
+bool alloc_accounting_get(const char *module, ALLOC_STATS *stats);
+
+/**
+ * @brief Print the allocations of the modules and the sampled stacks
+ *
+ * @param dcb DCB to print to
+ */
+void dprintMemory(DCB *dcb);
+
+/**
+ * @brief Get the allocations of the modules as a result set
+ *
+ * The module that uses the most memory is first.
+ *
+ * @return The result set or NULL if memory allocation failed
+ */
+RESULTSET* memoryGetList(void);
+
+MXS_END_DECLS
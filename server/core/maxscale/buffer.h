@@ -0,0 +1,113 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/buffer.h - The private buffer interface
+ */
+
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+/** The largest payload that can be allocated in the same block as its GWBUF */
+#define GWBUF_MAX_INLINE_SIZE     8192
+
+/** The default for the largest payload allocated in the same block as its GWBUF */
+#define GWBUF_DEFAULT_INLINE_SIZE GWBUF_MAX_INLINE_SIZE
+
+/**
+ * Statistics of the buffer cache of one worker thread. The values are only
+ * modified by the owning thread, other threads may only read them.
+ */
+typedef struct
+{
+    uint64_t n_cached;   /*< Allocations served from the cache */
+    uint64_t n_malloc;   /*< Allocations that fit a size class but the cache was empty */
+    uint64_t n_large;    /*< Allocations too large for any size class */
+    uint64_t n_recycled; /*< Blocks returned to the cache */
+    uint64_t n_released; /*< Blocks released with free because the cache was full */
+} GWBUF_CACHE_STATS;
+
+/**
+ * A statistic identifier that can be returned by gwbuf_get_stat
+ */
+typedef enum
+{
+    GWBUF_STAT_CACHED,
+    GWBUF_STAT_MALLOC,
+    GWBUF_STAT_LARGE,
+    GWBUF_STAT_RECYCLED,
+    GWBUF_STAT_RELEASED
+} GWBUF_STAT;
+
+/**
+ * @brief Initialize the per-thread buffer caches
+ *
+ * Must be called once before the worker threads are started.
+ *
+ * @param n_threads Number of worker threads
+ *
+ * @return True if the caches were allocated
+ */
+bool gwbuf_cache_init(int n_threads);
+
+/**
+ * @brief Set the largest payload that is allocated in the same block as its GWBUF
+ *
+ * Buffers with larger payloads allocate the GWBUF, the SHARED_BUF and the data
+ * separately. A value of 0 disables the single block allocations. This must
+ * be set before the worker threads are started.
+ *
+ * @param size The size in bytes, at most GWBUF_MAX_INLINE_SIZE
+ *
+ * @return True if the size was valid and it was set
+ */
+bool gwbuf_set_inline_size(unsigned int size);
+
+/**
+ * @brief Attach the calling thread to its buffer cache
+ *
+ * Threads that are not attached to a cache allocate all buffers with malloc.
+ *
+ * @param thread_id The worker thread ID
+ */
+void gwbuf_thread_init(int thread_id);
+
+/**
+ * @brief Detach the calling thread from its buffer cache
+ *
+ * All cached blocks of the thread are released.
+ */
+void gwbuf_thread_finish(void);
+
+/**
+ * @brief Get the buffer cache statistics of a thread
+ *
+ * @param thread_id The worker thread ID
+ * @param stats     Where the statistics are copied
+ *
+ * @return True if @c thread_id has a buffer cache
+ */
+bool gwbuf_get_cache_stats(int thread_id, GWBUF_CACHE_STATS *stats);
+
+/**
+ * @brief Get a buffer cache statistic summed over all threads
+ *
+ * @param stat The required statistic
+ *
+ * @return The value of that statistic
+ */
+int64_t gwbuf_get_stat(GWBUF_STAT stat);
+
+MXS_END_DECLS
@@ -24,7 +24,11 @@ MXS_BEGIN_DECLS
 
 #define DEFAULT_NBPOLLS         3       /**< Default number of non block polls before we block */
 #define DEFAULT_POLLSLEEP       1000    /**< Default poll wait time (milliseconds) */
+#define DEFAULT_POLL_SPIN_BUDGET 100    /**< Default time to spin in spin poll mode (microseconds) */
 #define DEFAULT_NTHREADS        1       /**< Default number of polling threads */
+#define DEFAULT_SESSION_TRACE_THRESHOLD 1000 /**< Default threshold for logging traced requests (milliseconds) */
+#define DEFAULT_SLOW_CALLBACK_THRESHOLD 100  /**< Default threshold for logging slow callbacks (milliseconds) */
+#define DEFAULT_ACCEPT_BATCH_SIZE 32     /**< Default number of connections accepted in one poll cycle */
 
 /**
  * Maximum length for configuration parameter value.
@@ -118,6 +118,18 @@ bool runtime_enable_server_ssl(SERVER *server, const char *key, const char *cert
  */
 bool runtime_alter_monitor(MXS_MONITOR *monitor, char *key, char *value);
 
+/**
+ * @brief Alter global parameters
+ *
+ * The only supported parameter is `threads`, the number of active polling
+ * threads. It can be set up to the value of `threads_max`.
+ *
+ * @param key Key to modify
+ * @param value New value
+ * @return True if @c key was one of the supported parameters and @c value was valid
+ */
+bool runtime_alter_maxscale(char *key, char *value);
+
 /**
  * @brief Create a new listener for a service
  *
@@ -0,0 +1,71 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/epoch.h - The private epoch interface
+ */
+
+#include <maxscale/epoch.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Register the calling thread as a worker thread
+ *
+ * The thread is online when this returns.
+ *
+ * @param thread_id The worker thread ID
+ */
+void mxs_epoch_thread_init(int thread_id);
+
+/**
+ * @brief Unregister the calling worker thread
+ *
+ * Waits for the other worker threads and frees the objects deferred by the
+ * calling thread.
+ */
+void mxs_epoch_thread_finish(void);
+
+/**
+ * @brief Announce a quiescent state
+ *
+ * Called by a worker thread when it holds no pointers to objects it has
+ * read without a lock. Frees the deferred objects that no worker thread
+ * can be reading anymore.
+ */
+void mxs_epoch_quiescent(void);
+
+/**
+ * @brief Stop taking part in the epochs
+ *
+ * Called by a worker thread before it blocks, so that it does not hold
+ * up the freeing of objects. Until mxs_epoch_online is called, the thread
+ * must not read any shared objects without locks.
+ */
+void mxs_epoch_offline(void);
+
+/**
+ * @brief Resume taking part in the epochs
+ */
+void mxs_epoch_online(void);
+
+/**
+ * @brief Get the number of deferred objects that have not been freed
+ *
+ * @return The number of objects deferred by the calling thread and by threads
+ *         that are not worker threads
+ */
+int mxs_epoch_pending(void);
+
+MXS_END_DECLS
@@ -0,0 +1,1101 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string.h>
+#include <maxscale/buffer.h>
+#include <maxscale/modutil.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
+#include "trxboundaryparser.hh"
+
+namespace maxscale
+{
+
+#define FC_KEYWORD(string_literal) string_literal, (sizeof(string_literal) - 1)
+
+/**
+ * @class FastClassifier
+ *
+ * FastClassifier resolves the type mask of the most common simple statements
+ * without invoking the query classifier. The recognized statements are
+ *
+ * - the statements recognized by @c TrxBoundaryParser,
+ * - SET [GLOBAL | SESSION] autocommit = value and its @@ variants,
+ * - USE db and
+ * - SELECT statements whose select list consists of columns and literals,
+ *   that read from a comma separated list of tables and that have at most
+ *   a WHERE clause of simple comparisons, an ORDER BY and a LIMIT clause.
+ *
+ * Anything else, e.g. function calls, variables, subqueries, joins, locking
+ * reads or unknown keywords, makes the classifier give up, in which case the
+ * statement must be classified by the query classifier. The type masks are
+ * the same as those the query classifier reports for the same statements.
+ *
+ * Like @c TrxBoundaryParser, the class is not thread-safe and is intended to
+ * be instantiated on the stack whenever a statement is to be classified.
+ *
+ * @code
+ *     uint32_t type_mask;
+ *     FastClassifier fc;
+ *
+ *     if (!fc.type_mask_of(pBuf, &type_mask))
+ *     {
+ *         type_mask = qc_get_type_mask(pBuf);
+ *     }
+ * @endcode
+ */
+class FastClassifier
+{
+public:
+    FastClassifier()
+        : m_pI(NULL)
+        , m_pEnd(NULL)
+        , m_pToken(NULL)
+        , m_token_len(0)
+    {
+    }
+
+    /**
+     * Return the type mask of a statement, provided the statement is simple
+     * enough for the type to be decided without a parser.
+     *
+     * @param pSql        SQL statement.
+     * @param len         Length of pSql.
+     * @param pType_mask  On success, the type mask of the statement.
+     *
+     * @return True, if the type of the statement could be decided.
+     */
+    bool type_mask_of(const char* pSql, size_t len, uint32_t* pType_mask)
+    {
+        bool rv = false;
+
+        // Executable comments may contain anything.
+        if (!has_executable_comment(pSql, len))
+        {
+            m_pI = pSql;
+            m_pEnd = pSql + len;
+
+            uint32_t type_mask = 0;
+
+            if (parse(pSql, len, &type_mask))
+            {
+                *pType_mask = type_mask;
+                rv = true;
+            }
+        }
+
+        return rv;
+    }
+
+    /**
+     * Return the type mask of a statement, provided the statement is simple
+     * enough for the type to be decided without a parser.
+     *
+     * @param pBuf        A COM_QUERY packet. Anything else, and packets that
+     *                    are not contiguous, are not classified.
+     * @param pType_mask  On success, the type mask of the statement.
+     *
+     * @return True, if the type of the statement could be decided.
+     */
+    bool type_mask_of(GWBUF* pBuf, uint32_t* pType_mask)
+    {
+        bool rv = false;
+        const uint8_t* pData = GWBUF_DATA(pBuf);
+        size_t len = GWBUF_LENGTH(pBuf);
+
+        if (GWBUF_IS_CONTIGUOUS(pBuf) &&
+            (len > MYSQL_HEADER_LEN) &&
+            (MYSQL_GET_PAYLOAD_LEN(pData) + MYSQL_HEADER_LEN == len) &&
+            (MYSQL_GET_COMMAND(pData) == MYSQL_COM_QUERY))
+        {
+            rv = type_mask_of((const char*)pData + MYSQL_HEADER_LEN + 1,
+                              len - MYSQL_HEADER_LEN - 1,
+                              pType_mask);
+        }
+
+        return rv;
+    }
+
+private:
+    enum token_t
+    {
+        TK_AND,
+        TK_AS,
+        TK_ASC,
+        TK_AUTOCOMMIT,
+        TK_BY,
+        TK_COMMA,
+        TK_DESC,
+        TK_DOT,
+        TK_EQ,
+        TK_FALSE,
+        TK_FROM,
+        TK_GLOBAL,
+        TK_IDENTIFIER,
+        TK_IN,
+        TK_IS,
+        TK_LIKE,
+        TK_LIMIT,
+        TK_LPAREN,
+        TK_MINUS,
+        TK_NOT,
+        TK_NULL,
+        TK_NUMBER,
+        TK_OFF,
+        TK_OFFSET,
+        TK_ON,
+        TK_OPERATOR,
+        TK_OR,
+        TK_ORDER,
+        TK_PLACEHOLDER,
+        TK_RPAREN,
+        TK_SELECT,
+        TK_SESSION,
+        TK_SET,
+        TK_STAR,
+        TK_STRING,
+        TK_SYSVAR,
+        TK_TRUE,
+        TK_USE,
+        TK_WHERE,
+
+        PARSER_UNKNOWN_TOKEN,
+        PARSER_EXHAUSTED,
+    };
+
+    struct keyword_t
+    {
+        const char* zWord;
+        size_t      len;
+        token_t     token;
+    };
+
+    static bool has_executable_comment(const char* pSql, size_t len)
+    {
+        const char* pEnd = pSql + len;
+        const char* pI = pSql;
+
+        while ((pI = (const char*)memchr(pI, '/', pEnd - pI)) != NULL)
+        {
+            ++pI;
+
+            if ((pEnd - pI >= 2) && (*pI == '*') &&
+                ((*(pI + 1) == '!') ||
+                 ((*(pI + 1) == 'M') && (pEnd - pI >= 3) && (*(pI + 2) == '!'))))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool parse(const char* pSql, size_t len, uint32_t* pType_mask)
+    {
+        bool rv = false;
+
+        switch (next_token())
+        {
+        case TK_SELECT:
+            *pType_mask = QUERY_TYPE_READ;
+            rv = parse_select();
+            break;
+
+        case TK_SET:
+            rv = parse_set(pType_mask);
+            break;
+
+        case TK_USE:
+            *pType_mask = QUERY_TYPE_SESSION_WRITE;
+            rv = parse_use();
+            break;
+
+        case TK_IDENTIFIER:
+            rv = parse_trx(pSql, len, pType_mask);
+            break;
+
+        default:
+            ;
+        }
+
+        return rv;
+    }
+
+    /**
+     * BEGIN, COMMIT, ROLLBACK and START TRANSACTION are left to the parser
+     * used for transaction tracking.
+     */
+    bool parse_trx(const char* pSql, size_t len, uint32_t* pType_mask)
+    {
+        bool rv = false;
+        const char* pEnd = pSql + len;
+        const char* pSemicolon = (const char*)memchr(pSql, ';', len);
+
+        // TrxBoundaryParser ignores anything following a semicolon.
+        if (!pSemicolon ||
+            modutil_MySQL_bypass_whitespace(const_cast<char*>(pSemicolon) + 1,
+                                            pEnd - pSemicolon - 1) == pEnd)
+        {
+            TrxBoundaryParser parser;
+            uint32_t type_mask = parser.type_mask_of(pSql, len);
+
+            if (type_mask != 0)
+            {
+                *pType_mask = type_mask;
+                rv = true;
+            }
+        }
+
+        return rv;
+    }
+
+    /**
+     * SET [GLOBAL | SESSION] autocommit = value
+     * SET @@[global. | session.]autocommit = value
+     */
+    bool parse_set(uint32_t* pType_mask)
+    {
+        token_t token = next_token();
+
+        if (token == TK_GLOBAL || token == TK_SESSION)
+        {
+            token = next_token();
+        }
+        else if (token == TK_SYSVAR)
+        {
+            token = next_token();
+
+            if (token == TK_GLOBAL || token == TK_SESSION)
+            {
+                if (next_token() != TK_DOT)
+                {
+                    return false;
+                }
+
+                token = next_token();
+            }
+        }
+
+        if (token != TK_AUTOCOMMIT || next_token() != TK_EQ)
+        {
+            return false;
+        }
+
+        token = next_token();
+
+        if (token == TK_NUMBER && m_token_len == 1 && (*m_pToken == '0' || *m_pToken == '1'))
+        {
+            token = (*m_pToken == '1') ? TK_TRUE : TK_FALSE;
+        }
+
+        uint32_t type_mask;
+
+        switch (token)
+        {
+        case TK_TRUE:
+        case TK_ON:
+            type_mask = QUERY_TYPE_COMMIT | QUERY_TYPE_ENABLE_AUTOCOMMIT;
+            break;
+
+        case TK_FALSE:
+        case TK_OFF:
+            type_mask = QUERY_TYPE_BEGIN_TRX | QUERY_TYPE_DISABLE_AUTOCOMMIT;
+            break;
+
+        default:
+            return false;
+        }
+
+        if (next_token() != PARSER_EXHAUSTED)
+        {
+            return false;
+        }
+
+        // The query classifier treats autocommit as a global variable.
+        *pType_mask = type_mask | QUERY_TYPE_GSYSVAR_WRITE;
+
+        return true;
+    }
+
+    /**
+     * USE db
+     */
+    bool parse_use()
+    {
+        return next_token() == TK_IDENTIFIER && next_token() == PARSER_EXHAUSTED;
+    }
+
+    /**
+     * SELECT select_list [FROM table [, table]...] [WHERE condition]
+     *        [ORDER BY column [ASC | DESC] [, column [ASC | DESC]]...]
+     *        [LIMIT {count | offset, count | count OFFSET offset}]
+     */
+    bool parse_select()
+    {
+        token_t token = next_token();
+
+        if (token == TK_STAR)
+        {
+            token = next_token();
+        }
+        else if (!parse_list(&FastClassifier::parse_select_item, &token))
+        {
+            return false;
+        }
+
+        if (token == TK_FROM)
+        {
+            token = next_token();
+
+            if (!parse_list(&FastClassifier::parse_table, &token))
+            {
+                return false;
+            }
+        }
+
+        if (token == TK_WHERE)
+        {
+            token = next_token();
+
+            if (!parse_condition(&token))
+            {
+                return false;
+            }
+        }
+
+        if (token == TK_ORDER)
+        {
+            if (next_token() != TK_BY)
+            {
+                return false;
+            }
+
+            token = next_token();
+
+            if (!parse_list(&FastClassifier::parse_order_item, &token))
+            {
+                return false;
+            }
+        }
+
+        if (token == TK_LIMIT)
+        {
+            if (next_token() != TK_NUMBER)
+            {
+                return false;
+            }
+
+            token = next_token();
+
+            if (token == TK_COMMA || token == TK_OFFSET)
+            {
+                if (next_token() != TK_NUMBER)
+                {
+                    return false;
+                }
+
+                token = next_token();
+            }
+        }
+
+        return token == PARSER_EXHAUSTED;
+    }
+
+    typedef bool (FastClassifier::*item_parser_t)(token_t* pToken);
+
+    /**
+     * Parse a comma separated list of items.
+     *
+     * @param parse_item  The function parsing an item. It is called with the
+     *                    first token of the item and leaves the token following
+     *                    the item in the variable it is given.
+     * @param pToken      The first token of the list. On return, the token
+     *                    following the list.
+     *
+     * @return True, if the list was valid.
+     */
+    bool parse_list(item_parser_t parse_item, token_t* pToken)
+    {
+        bool rv = (this->*parse_item)(pToken);
+
+        while (rv && *pToken == TK_COMMA)
+        {
+            *pToken = next_token();
+            rv = (this->*parse_item)(pToken);
+        }
+
+        return rv;
+    }
+
+    /**
+     * column [[AS] alias] | table.* | literal [[AS] alias]
+     */
+    bool parse_select_item(token_t* pToken)
+    {
+        bool rv;
+
+        if (*pToken == TK_IDENTIFIER)
+        {
+            *pToken = next_token();
+
+            if (*pToken == TK_DOT)
+            {
+                *pToken = next_token();
+
+                if (*pToken == TK_STAR)
+                {
+                    *pToken = next_token();
+                    return true;
+                }
+
+                rv = parse_qualified_name(pToken, 2);
+            }
+            else
+            {
+                rv = true;
+            }
+        }
+        else
+        {
+            rv = parse_literal(pToken);
+        }
+
+        return rv && parse_alias(pToken);
+    }
+
+    /**
+     * [db.]table [[AS] alias]
+     */
+    bool parse_table(token_t* pToken)
+    {
+        bool rv = false;
+
+        if (*pToken == TK_IDENTIFIER)
+        {
+            *pToken = next_token();
+
+            if (*pToken == TK_DOT)
+            {
+                *pToken = next_token();
+                rv = parse_qualified_name(pToken, 1);
+            }
+            else
+            {
+                rv = true;
+            }
+        }
+
+        return rv && parse_alias(pToken);
+    }
+
+    /**
+     * column [ASC | DESC]
+     */
+    bool parse_order_item(token_t* pToken)
+    {
+        bool rv = parse_column(pToken);
+
+        if (rv && (*pToken == TK_ASC || *pToken == TK_DESC))
+        {
+            *pToken = next_token();
+        }
+
+        return rv;
+    }
+
+    /**
+     * Parse the rest of a name of which the first part and the dot
+     * following it have already been consumed.
+     *
+     * @param pToken  The token following the dot. On return, the token
+     *                following the name.
+     * @param n_dots  The number of dots that still may follow.
+     */
+    bool parse_qualified_name(token_t* pToken, int n_dots)
+    {
+        bool rv = false;
+
+        while (*pToken == TK_IDENTIFIER)
+        {
+            *pToken = next_token();
+
+            if (*pToken == TK_DOT && --n_dots > 0)
+            {
+                *pToken = next_token();
+            }
+            else
+            {
+                rv = (*pToken != TK_DOT);
+                break;
+            }
+        }
+
+        return rv;
+    }
+
+    /**
+     * [AS] alias
+     */
+    bool parse_alias(token_t* pToken)
+    {
+        bool rv = true;
+
+        if (*pToken == TK_AS)
+        {
+            *pToken = next_token();
+            rv = (*pToken == TK_IDENTIFIER);
+        }
+
+        if (*pToken == TK_IDENTIFIER)
+        {
+            *pToken = next_token();
+        }
+
+        return rv;
+    }
+
+    /**
+     * [db.][table.]column
+     */
+    bool parse_column(token_t* pToken)
+    {
+        bool rv = false;
+
+        if (*pToken == TK_IDENTIFIER)
+        {
+            *pToken = next_token();
+
+            if (*pToken == TK_DOT)
+            {
+                *pToken = next_token();
+                rv = parse_qualified_name(pToken, 2);
+            }
+            else
+            {
+                rv = true;
+            }
+        }
+
+        return rv;
+    }
+
+    /**
+     * [-]number | string | ? | NULL | TRUE | FALSE
+     */
+    bool parse_literal(token_t* pToken)
+    {
+        bool rv = false;
+
+        if (*pToken == TK_MINUS)
+        {
+            *pToken = next_token();
+            rv = (*pToken == TK_NUMBER);
+        }
+        else
+        {
+            switch (*pToken)
+            {
+            case TK_NUMBER:
+            case TK_STRING:
+            case TK_PLACEHOLDER:
+            case TK_NULL:
+            case TK_TRUE:
+            case TK_FALSE:
+                rv = true;
+                break;
+
+            default:
+                ;
+            }
+        }
+
+        if (rv)
+        {
+            *pToken = next_token();
+        }
+
+        return rv;
+    }
+
+    /**
+     * column | literal
+     */
+    bool parse_operand(token_t* pToken)
+    {
+        return (*pToken == TK_IDENTIFIER) ? parse_column(pToken) : parse_literal(pToken);
+    }
+
+    /**
+     * predicate [{AND | OR} predicate]...
+     */
+    bool parse_condition(token_t* pToken)
+    {
+        bool rv = parse_predicate(pToken);
+
+        while (rv && (*pToken == TK_AND || *pToken == TK_OR))
+        {
+            *pToken = next_token();
+            rv = parse_predicate(pToken);
+        }
+
+        return rv;
+    }
+
+    /**
+     * [NOT] operand {comparison operand |
+     *                [NOT] LIKE operand |
+     *                [NOT] IN (literal [, literal]...) |
+     *                IS [NOT] {NULL | TRUE | FALSE}}
+     */
+    bool parse_predicate(token_t* pToken)
+    {
+        if (*pToken == TK_NOT)
+        {
+            *pToken = next_token();
+        }
+
+        if (!parse_operand(pToken))
+        {
+            return false;
+        }
+
+        bool rv = false;
+
+        switch (*pToken)
+        {
+        case TK_EQ:
+        case TK_OPERATOR:
+            *pToken = next_token();
+            rv = parse_operand(pToken);
+            break;
+
+        case TK_IS:
+            *pToken = next_token();
+
+            if (*pToken == TK_NOT)
+            {
+                *pToken = next_token();
+            }
+
+            if (*pToken == TK_NULL || *pToken == TK_TRUE || *pToken == TK_FALSE)
+            {
+                *pToken = next_token();
+                rv = true;
+            }
+            break;
+
+        case TK_NOT:
+        case TK_LIKE:
+        case TK_IN:
+            if (*pToken == TK_NOT)
+            {
+                *pToken = next_token();
+            }
+
+            if (*pToken == TK_LIKE)
+            {
+                *pToken = next_token();
+                rv = parse_operand(pToken);
+            }
+            else if (*pToken == TK_IN && next_token() == TK_LPAREN)
+            {
+                *pToken = next_token();
+
+                if (parse_list(&FastClassifier::parse_literal, pToken) && *pToken == TK_RPAREN)
+                {
+                    *pToken = next_token();
+                    rv = true;
+                }
+            }
+            break;
+
+        default:
+            ;
+        }
+
+        return rv;
+    }
+
+    static char toupper(char c)
+    {
+        return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+
+    static bool is_word_char(char c)
+    {
+        return isalnum(c) || c == '_' || c == '$';
+    }
+
+    /**
+     * Look up a word among the known keywords.
+     *
+     * @return The keyword token, TK_IDENTIFIER if the word is not reserved
+     *         or PARSER_UNKNOWN_TOKEN if it is a keyword that is not handled.
+     */
+    static token_t keyword_of(const char* pWord, size_t len)
+    {
+        static const keyword_t keywords[] =
+        {
+            { FC_KEYWORD("ALL"),           PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("AND"),           TK_AND },
+            { FC_KEYWORD("AS"),            TK_AS },
+            { FC_KEYWORD("ASC"),           TK_ASC },
+            { FC_KEYWORD("AUTOCOMMIT"),    TK_AUTOCOMMIT },
+            { FC_KEYWORD("BETWEEN"),       PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("BINARY"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("BY"),            TK_BY },
+            { FC_KEYWORD("CASE"),          PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("COLLATE"),       PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("CROSS"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("DATABASE"),      PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("DESC"),          TK_DESC },
+            { FC_KEYWORD("DISTINCT"),      PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("DISTINCTROW"),   PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("DIV"),           PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("EXISTS"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("FALSE"),         TK_FALSE },
+            { FC_KEYWORD("FOR"),           PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("FORCE"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("FROM"),          TK_FROM },
+            { FC_KEYWORD("GLOBAL"),        TK_GLOBAL },
+            { FC_KEYWORD("GROUP"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("HAVING"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("HIGH_PRIORITY"), PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("IGNORE"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("IN"),            TK_IN },
+            { FC_KEYWORD("INNER"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("INTERVAL"),      PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("INTO"),          PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("IS"),            TK_IS },
+            { FC_KEYWORD("JOIN"),          PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("KEY"),           PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("LEFT"),          PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("LIKE"),          TK_LIKE },
+            { FC_KEYWORD("LIMIT"),         TK_LIMIT },
+            { FC_KEYWORD("LOCK"),          PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("MOD"),           PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("NATURAL"),       PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("NOT"),           TK_NOT },
+            { FC_KEYWORD("NULL"),          TK_NULL },
+            { FC_KEYWORD("OFF"),           TK_OFF },
+            { FC_KEYWORD("OFFSET"),        TK_OFFSET },
+            { FC_KEYWORD("ON"),            TK_ON },
+            { FC_KEYWORD("OR"),            TK_OR },
+            { FC_KEYWORD("ORDER"),         TK_ORDER },
+            { FC_KEYWORD("OUTER"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("PARTITION"),     PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("PROCEDURE"),     PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("REGEXP"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("RIGHT"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("RLIKE"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("SCHEMA"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("SELECT"),        TK_SELECT },
+            { FC_KEYWORD("SESSION"),       TK_SESSION },
+            { FC_KEYWORD("SET"),           TK_SET },
+            { FC_KEYWORD("SOUNDS"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("STRAIGHT_JOIN"), PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("TRUE"),          TK_TRUE },
+            { FC_KEYWORD("UNION"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("USE"),           TK_USE },
+            { FC_KEYWORD("USING"),         PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("WHERE"),         TK_WHERE },
+            { FC_KEYWORD("WINDOW"),        PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("WITH"),          PARSER_UNKNOWN_TOKEN },
+            { FC_KEYWORD("XOR"),           PARSER_UNKNOWN_TOKEN },
+        };
+
+        const size_t n_keywords = sizeof(keywords) / sizeof(keywords[0]);
+        char first = toupper(*pWord);
+
+        // Options such as SQL_NO_CACHE, SQL_CALC_FOUND_ROWS etc.
+        if (len > 4 && first == 'S' && toupper(pWord[1]) == 'Q' &&
+            toupper(pWord[2]) == 'L' && pWord[3] == '_')
+        {
+            return PARSER_UNKNOWN_TOKEN;
+        }
+
+        for (size_t i = 0; i < n_keywords && *keywords[i].zWord <= first; ++i)
+        {
+            const keyword_t& keyword = keywords[i];
+
+            if (keyword.len == len && *keyword.zWord == first)
+            {
+                size_t j = 1;
+
+                while (j < len && toupper(pWord[j]) == keyword.zWord[j])
+                {
+                    ++j;
+                }
+
+                if (j == len)
+                {
+                    return keyword.token;
+                }
+            }
+        }
+
+        return TK_IDENTIFIER;
+    }
+
+    /**
+     * Consume a quoted string or identifier.
+     *
+     * @return True, if the closing quote was found.
+     */
+    bool bypass_quoted(char quote)
+    {
+        ++m_pI;
+
+        while (m_pI < m_pEnd)
+        {
+            char c = *m_pI++;
+
+            if (c == quote)
+            {
+                if (m_pI == m_pEnd || *m_pI != quote)
+                {
+                    return true;
+                }
+
+                ++m_pI;
+            }
+            else if (c == '\\' && quote != '`')
+            {
+                ++m_pI;
+            }
+        }
+
+        return false;
+    }
+
+    token_t next_number()
+    {
+        while (m_pI < m_pEnd && isdigit(*m_pI))
+        {
+            ++m_pI;
+        }
+
+        if (m_pI < m_pEnd && *m_pI == '.')
+        {
+            ++m_pI;
+
+            while (m_pI < m_pEnd && isdigit(*m_pI))
+            {
+                ++m_pI;
+            }
+        }
+
+        if (m_pI < m_pEnd && (*m_pI == 'e' || *m_pI == 'E'))
+        {
+            const char* pI = m_pI + 1;
+
+            if (pI < m_pEnd && (*pI == '+' || *pI == '-'))
+            {
+                ++pI;
+            }
+
+            if (pI < m_pEnd && isdigit(*pI))
+            {
+                m_pI = pI;
+
+                while (m_pI < m_pEnd && isdigit(*m_pI))
+                {
+                    ++m_pI;
+                }
+            }
+        }
+
+        // Hexadecimal numbers and identifiers starting with a digit.
+        return (m_pI < m_pEnd && is_word_char(*m_pI)) ? PARSER_UNKNOWN_TOKEN : TK_NUMBER;
+    }
+
+    void bypass_whitespace()
+    {
+        m_pI = modutil_MySQL_bypass_whitespace(const_cast<char*>(m_pI), m_pEnd - m_pI);
+    }
+
+    token_t next_token()
+    {
+        token_t token = PARSER_UNKNOWN_TOKEN;
+
+        bypass_whitespace();
+
+        m_pToken = m_pI;
+
+        if (m_pI == m_pEnd)
+        {
+            token = PARSER_EXHAUSTED;
+        }
+        else if (*m_pI == ';')
+        {
+            ++m_pI;
+            bypass_whitespace();
+
+            // Several statements are left to the query classifier.
+            if (m_pI == m_pEnd)
+            {
+                token = PARSER_EXHAUSTED;
+            }
+        }
+        else
+        {
+            char c = *m_pI;
+
+            switch (c)
+            {
+            case '\'':
+            case '"':
+                if (bypass_quoted(c))
+                {
+                    token = TK_STRING;
+                }
+                break;
+
+            case '`':
+                if (bypass_quoted(c))
+                {
+                    token = TK_IDENTIFIER;
+                }
+                break;
+
+            case '@':
+                // Only @@ when immediately followed by a name, user
+                // variables are left to the query classifier.
+                if (m_pI + 2 < m_pEnd && *(m_pI + 1) == '@' && isalpha(*(m_pI + 2)))
+                {
+                    m_pI += 2;
+                    token = TK_SYSVAR;
+                }
+                break;
+
+            case ',':
+                ++m_pI;
+                token = TK_COMMA;
+                break;
+
+            case '.':
+                ++m_pI;
+                token = TK_DOT;
+                break;
+
+            case '*':
+                ++m_pI;
+                token = TK_STAR;
+                break;
+
+            case '(':
+                ++m_pI;
+                token = TK_LPAREN;
+                break;
+
+            case ')':
+                ++m_pI;
+                token = TK_RPAREN;
+                break;
+
+            case '-':
+                ++m_pI;
+                token = TK_MINUS;
+                break;
+
+            case '?':
+                ++m_pI;
+                token = TK_PLACEHOLDER;
+                break;
+
+            case '=':
+                ++m_pI;
+                token = TK_EQ;
+                break;
+
+            case '!':
+                if (m_pI + 1 < m_pEnd && *(m_pI + 1) == '=')
+                {
+                    m_pI += 2;
+                    token = TK_OPERATOR;
+                }
+                break;
+
+            case '<':
+                ++m_pI;
+
+                if (m_pI < m_pEnd && *m_pI == '=')
+                {
+                    ++m_pI;
+
+                    if (m_pI < m_pEnd && *m_pI == '>')
+                    {
+                        ++m_pI;
+                    }
+                }
+                else if (m_pI < m_pEnd && *m_pI == '>')
+                {
+                    ++m_pI;
+                }
+
+                token = TK_OPERATOR;
+                break;
+
+            case '>':
+                ++m_pI;
+
+                if (m_pI < m_pEnd && *m_pI == '=')
+                {
+                    ++m_pI;
+                }
+
+                token = TK_OPERATOR;
+                break;
+
+            default:
+                if (isdigit(c))
+                {
+                    token = next_number();
+                }
+                else if (isalpha(c) || c == '_' || c == '$')
+                {
+                    while (m_pI < m_pEnd && is_word_char(*m_pI))
+                    {
+                        ++m_pI;
+                    }
+
+                    token = keyword_of(m_pToken, m_pI - m_pToken);
+
+                    // Function calls are left to the query classifier.
+                    if (token == TK_IDENTIFIER && m_pI < m_pEnd && *m_pI == '(')
+                    {
+                        token = PARSER_UNKNOWN_TOKEN;
+                    }
+                }
+            }
+        }
+
+        m_token_len = m_pI - m_pToken;
+
+        return token;
+    }
+
+private:
+    FastClassifier(const FastClassifier&);
+    FastClassifier& operator = (const FastClassifier&);
+
+private:
+    const char* m_pI;
+    const char* m_pEnd;
+    const char* m_pToken;
+    size_t      m_token_len;
+};
+
+}
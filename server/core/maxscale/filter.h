@@ -43,6 +43,7 @@ MXS_FILTER_DEF *filter_alloc(const char *name, const char *module_name);
 MXS_DOWNSTREAM *filter_apply(MXS_FILTER_DEF *filter_def, MXS_SESSION *session, MXS_DOWNSTREAM *downstream);
 void filter_free(MXS_FILTER_DEF *filter_def);
 bool filter_load(MXS_FILTER_DEF *filter_def);
+bool filter_reload(MXS_FILTER_DEF *filter_def, const char *options, const MXS_CONFIG_PARAMETER *params);
 int filter_standard_parameter(const char *name);
 MXS_UPSTREAM *filter_upstream(MXS_FILTER_DEF *filter_def, void *fsession, MXS_UPSTREAM *upstream);
 
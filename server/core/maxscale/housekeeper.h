@@ -0,0 +1,67 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/housekeeper.h - The private housekeeper interface
+ */
+
+#include <maxscale/housekeeper.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Create the timers of the worker thread tasks
+ *
+ * Must be called once before the worker threads are started.
+ *
+ * @param n_threads Number of worker threads
+ *
+ * @return True if the timers were created
+ */
+bool hk_worker_init(int n_threads);
+
+/**
+ * @brief Get the timer descriptor of a worker thread
+ *
+ * The descriptor becomes readable when a task of the thread is due or when
+ * another thread has added or removed tasks of the thread. It must be in the
+ * poll set of the thread and hk_worker_process must then be called.
+ *
+ * @param thread_id The worker thread ID
+ *
+ * @return The timerfd of the thread
+ */
+int hk_worker_fd(int thread_id);
+
+/**
+ * @brief Attach the calling thread to its task list
+ *
+ * @param thread_id The worker thread ID
+ */
+void hk_worker_thread_init(int thread_id);
+
+/**
+ * @brief Free the tasks of the calling thread
+ */
+void hk_worker_thread_finish();
+
+/**
+ * @brief Run the due tasks of the calling thread
+ *
+ * Also applies the additions and removals made by other threads and rearms
+ * the timer for the next due task.
+ */
+void hk_worker_process();
+
+MXS_END_DECLS
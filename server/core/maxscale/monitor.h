@@ -25,17 +25,20 @@ MXS_BEGIN_DECLS
 #define DEFAULT_CONNECT_TIMEOUT 3
 #define DEFAULT_READ_TIMEOUT 1
 #define DEFAULT_WRITE_TIMEOUT 2
+#define DEFAULT_SCRIPT_TIMEOUT 90
 
 #define MONITOR_DEFAULT_INTERVAL 10000 // in milliseconds
 
 /**
- * Monitor network timeout types
+ * Monitor network and script timeout types
  */
 typedef enum
 {
     MONITOR_CONNECT_TIMEOUT = 0,
     MONITOR_READ_TIMEOUT    = 1,
-    MONITOR_WRITE_TIMEOUT   = 2
+    MONITOR_WRITE_TIMEOUT   = 2,
+    MONITOR_SCRIPT_TIMEOUT  = 3,
+    MONITOR_WARMUP_TIME     = 4
 } monitor_timeouts_t;
 
 MXS_MONITOR *monitor_alloc(char *, char *);
@@ -61,6 +64,7 @@ void monitorAddParameters(MXS_MONITOR *monitor, MXS_CONFIG_PARAMETER *params);
 bool monitorRemoveParameter(MXS_MONITOR *monitor, const char *key);
 
 void monitorSetInterval (MXS_MONITOR *, unsigned long);
+void monitorSetCollectMetrics(MXS_MONITOR *, bool);
 bool monitorSetNetworkTimeout(MXS_MONITOR *, int, int);
 
 /**
@@ -0,0 +1,115 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/persistpool.h - The persistent connection pools
+ *
+ * Each worker thread has a pool of unused connections for each server. The
+ * pools are only used by the thread that owns them, so they have no locks.
+ * A pooled connection is in the list of its user and protocol and, if it has
+ * a reuse key, also in the list of its user, protocol and key. The lists are
+ * found with a hash table, so a connection is taken, returned and removed in
+ * constant time regardless of the size of the pool.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/dcb.h>
+
+MXS_BEGIN_DECLS
+
+struct persist_entry;
+
+/**
+ * The persistent connection pool of one server in one thread
+ */
+typedef struct persist_pool
+{
+    struct persist_entry **buckets; /**< The hash table of the lists */
+    int n_buckets;                  /**< Size of the hash table */
+    int n_entries;                  /**< Number of lists in the hash table */
+    int n_dcbs;                     /**< Number of connections in the pool */
+} PERSIST_POOL;
+
+/**
+ * @brief Allocate the pools of a server
+ *
+ * @param n_threads Number of worker threads
+ * @return The pools, one for each thread, or NULL if memory allocation failed
+ */
+PERSIST_POOL* persistpool_alloc(int n_threads);
+
+/**
+ * @brief Free the pools of a server
+ *
+ * The pools must be empty.
+ *
+ * @param pools     The pools
+ * @param n_threads Number of worker threads
+ */
+void persistpool_free(PERSIST_POOL *pools, int n_threads);
+
+/**
+ * @brief Add a connection to a pool
+ *
+ * The user and the protocol of the connection must be set.
+ *
+ * @param pool The pool
+ * @param dcb  The connection
+ * @return False if memory allocation failed
+ */
+bool persistpool_add(PERSIST_POOL *pool, DCB *dcb);
+
+/**
+ * @brief Take a connection from a pool
+ *
+ * The most recently added connection with the same reuse key is preferred.
+ * If there is none, the most recently added connection of the user is taken.
+ *
+ * @param pool     The pool
+ * @param user     The user of the connection
+ * @param protocol The protocol of the connection
+ * @param key      The reuse key or NULL to ignore the keys of the connections
+ * @return The connection or NULL if the pool has none for the user
+ */
+DCB* persistpool_take(PERSIST_POOL *pool, const char *user, const char *protocol, const char *key);
+
+/**
+ * @brief Remove a connection from the pool it is in
+ *
+ * @param dcb The connection
+ */
+void persistpool_remove(DCB *dcb);
+
+/**
+ * @brief Remove the connections that match a condition
+ *
+ * @param pool  The pool
+ * @param match Returns true for the connections that are removed
+ * @param data  Passed to @c match
+ * @return The removed connections, linked through @c pool_links[0].next
+ */
+DCB* persistpool_extract(PERSIST_POOL *pool, bool (*match)(DCB *dcb, void *data), void *data);
+
+/**
+ * @brief Get the number of connections in a pool
+ *
+ * @param pool The pool
+ * @return The number of connections
+ */
+static inline int persistpool_count(const PERSIST_POOL *pool)
+{
+    return pool->n_dcbs;
+}
+
+MXS_END_DECLS
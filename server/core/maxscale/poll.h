@@ -18,12 +18,19 @@
 
 #include <maxscale/poll.h>
 
+#include <maxscale/platform.h>
 #include <maxscale/resultset.h>
 
 MXS_BEGIN_DECLS
 
 #define MAX_EVENTS 1000
 
+/** The number of buckets in the poll latency histograms */
+#define N_LATENCY_BUCKETS 24
+
+/** The ID of the calling worker thread, 0 in non-worker threads */
+extern thread_local int current_thread_id;
+
 /**
  * A statistic identifier that can be returned by poll_get_stat
  */
@@ -37,12 +44,17 @@ typedef enum
     POLL_STAT_EVQ_LEN,
     POLL_STAT_EVQ_MAX,
     POLL_STAT_MAX_QTIME,
-    POLL_STAT_MAX_EXECTIME
+    POLL_STAT_MAX_EXECTIME,
+    POLL_STAT_WAKEUP_P50,   /**< Median eventfd wakeup latency in microseconds */
+    POLL_STAT_WAKEUP_P99,   /**< 99th percentile of the eventfd wakeup latency */
+    POLL_STAT_DISPATCH_P50, /**< Median delay from epoll_wait return to dispatch */
+    POLL_STAT_DISPATCH_P99  /**< 99th percentile of the dispatch delay */
 } POLL_STAT;
 
 enum poll_message
 {
-    POLL_MSG_CLEAN_PERSISTENT = 0x01
+    POLL_MSG_CLEAN_PERSISTENT = 0x01,
+    POLL_MSG_FLUSH_PERSISTENT = 0x02  /**< Close all pooled connections of a server */
 };
 
 void            poll_init();
@@ -58,8 +70,76 @@ void            dShowEventQ(DCB *dcb);
 void            dShowEventStats(DCB *dcb);
 
 int64_t         poll_get_stat(POLL_STAT stat);
+
+/**
+ * @brief Remove a DCB from the epoll instance of its thread
+ *
+ * Unlike poll_remove_dcb, this does not change the state of the DCB. It is
+ * used to move a DCB to another thread with poll_attach_dcb.
+ *
+ * @param dcb DCB to remove, must not be a listener
+ * @return True if the DCB was removed
+ */
+bool            poll_detach_dcb(DCB *dcb);
+
+/**
+ * @brief Add a detached DCB to the epoll instance of its thread
+ *
+ * @param dcb DCB to add, its thread ID must already be set to the new owner
+ * @return True if the DCB was added
+ */
+bool            poll_attach_dcb(DCB *dcb);
+
+/**
+ * @brief Get the number of threads that new sessions are given to
+ *
+ * @return The number of active threads
+ */
+int             poll_get_active_threads();
+
+/**
+ * @brief Change the number of threads that new sessions are given to
+ *
+ * The threads from zero up to @c n are active. The listeners are added to
+ * the threads that become active. The threads that are retired get no new
+ * sessions and move their sessions to the active threads once the sessions
+ * are idle.
+ *
+ * @param n Number of active threads, at most config_threadcount()
+ * @return True if the number of active threads was changed
+ */
+bool            poll_set_active_threads(int n);
+
 RESULTSET       *eventTimesGetList();
 
+/**
+ * @brief Check whether the calling thread may accept more connections in this poll cycle
+ *
+ * A worker thread accepts at most accept_batch_size connections in one poll
+ * cycle so that a burst of new connections does not hold up the sessions the
+ * thread already has.
+ *
+ * @return True if a connection can be accepted
+ */
+bool            poll_accept_budget_left();
+
+/**
+ * @brief Count a connection accepted by the calling thread
+ */
+void            poll_count_accept();
+
+/**
+ * @brief Accept the connections of a listener later
+ *
+ * The listener sockets are edge-triggered, so the connections that were not
+ * accepted must be accepted from the deferred list. Does nothing outside of
+ * the worker threads.
+ *
+ * @param listener The listener
+ * @param delay    Microseconds to wait, 0 for the next poll cycle
+ */
+void            poll_defer_accept(DCB *listener, int64_t delay);
+
 void            poll_send_message(enum poll_message msg, void *data);
 
 MXS_END_DECLS
@@ -0,0 +1,74 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/pool.h - The private object pool interface
+ */
+
+#include <maxscale/pool.h>
+#include <maxscale/dcb.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * A statistic identifier that can be returned by mxs_pool_get_stat
+ */
+typedef enum
+{
+    MXS_POOL_STAT_HITS,
+    MXS_POOL_STAT_MISSES,
+    MXS_POOL_STAT_FREE
+} MXS_POOL_STAT;
+
+/**
+ * @brief Attach the calling thread to the free lists of the pools
+ *
+ * @param thread_id The worker thread ID
+ */
+void mxs_pool_thread_init(int thread_id);
+
+/**
+ * @brief Detach the calling thread from the pools
+ *
+ * All free objects of the thread are released.
+ */
+void mxs_pool_thread_finish(void);
+
+/**
+ * @brief Get a statistic of a pool summed over all threads
+ *
+ * @param pool The pool
+ * @param stat The required statistic
+ *
+ * @return The value of that statistic
+ */
+int64_t mxs_pool_get_stat(const MXS_POOL *pool, MXS_POOL_STAT stat);
+
+/**
+ * @brief Get a statistic summed over all pools that have been used
+ *
+ * @param stat The required statistic
+ *
+ * @return The value of that statistic
+ */
+int64_t mxs_pool_get_total_stat(MXS_POOL_STAT stat);
+
+/**
+ * @brief Print the statistics of all pools that have been used
+ *
+ * @param dcb DCB to print to
+ */
+void mxs_pool_print_stats(DCB *dcb);
+
+MXS_END_DECLS
@@ -0,0 +1,128 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/profiler.h - Profiling of the module callbacks
+ *
+ * When profile_callbacks is enabled, the worker threads measure the time
+ * spent in each entry point of the protocol, filter and router modules. The
+ * time of a callback does not include the time of the callbacks it makes, so
+ * a filter is not blamed for the router behind it. Callbacks that take longer
+ * than slow_callback_threshold are logged with the chain of callbacks that
+ * led to them.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/dcb.h>
+#include <maxscale/resultset.h>
+#include <maxscale/session.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * The profiled entry points
+ */
+typedef enum
+{
+    PROFILE_ACCEPT,       /**< Protocol accept */
+    PROFILE_READ,         /**< Protocol read */
+    PROFILE_WRITE_READY,  /**< Protocol write_ready */
+    PROFILE_ERROR,        /**< Protocol error */
+    PROFILE_HANGUP,       /**< Protocol hangup */
+    PROFILE_ROUTE_QUERY,  /**< Filter or router routeQuery */
+    PROFILE_CLIENT_REPLY, /**< Filter clientReply or the write to the client */
+    PROFILE_N
+} profile_callback_t;
+
+/** Whether the callbacks are profiled, do not modify */
+extern bool profiler_active;
+
+/**
+ * @brief Initialize the profiler
+ *
+ * @param n_threads Number of worker threads
+ */
+void profiler_init(int n_threads);
+
+/**
+ * @brief Start profiling the callbacks of a worker thread
+ *
+ * @param thread_id ID of the worker thread
+ */
+void profiler_thread_init(int thread_id);
+
+/**
+ * @brief Start the profiling of a callback
+ *
+ * Must be followed by profiler_leave after the callback returns. Does nothing
+ * if the calling thread is not a worker thread.
+ *
+ * @param callback The entry point
+ * @param module   Name of the module that implements it
+ * @param ses_id   ID of the session, 0 if there is none
+ */
+void profiler_enter(profile_callback_t callback, const char *module, size_t ses_id);
+
+/**
+ * @brief End the profiling of the latest callback
+ */
+void profiler_leave(void);
+
+/**
+ * @brief Profile the routeQuery calls into a filter or a router
+ *
+ * Replaces the downstream with one that measures the calls. Does nothing if
+ * the downstream is already profiled.
+ *
+ * @param session The session that owns the filter chain
+ * @param down    The downstream
+ * @param module  Name of the module the downstream calls
+ *
+ * @return False if memory allocation failed
+ */
+bool profiler_wrap_downstream(MXS_SESSION *session, MXS_DOWNSTREAM *down, const char *module);
+
+/**
+ * @brief Profile the clientReply calls into a filter or the client protocol
+ *
+ * @param session The session that owns the filter chain
+ * @param up      The upstream
+ * @param module  Name of the module the upstream calls
+ *
+ * @return False if memory allocation failed
+ */
+bool profiler_wrap_upstream(MXS_SESSION *session, MXS_UPSTREAM *up, const char *module);
+
+/**
+ * @brief Free the profiling data of a session
+ *
+ * @param session The session
+ */
+void profiler_session_free(MXS_SESSION *session);
+
+/**
+ * @brief Print the callbacks that took the most time
+ *
+ * @param dcb DCB to print to
+ */
+void dprintProfile(DCB *dcb);
+
+/**
+ * @brief Get the callbacks as a result set, the slowest first
+ *
+ * @return The result set or NULL if memory allocation failed
+ */
+RESULTSET* profilerGetList(void);
+
+MXS_END_DECLS
@@ -18,7 +18,7 @@
 
 #include <maxscale/queuemanager.h>
 
-#include <maxscale/spinlock.h>
+#include <stddef.h>
 
 MXS_BEGIN_DECLS
 
@@ -27,22 +27,36 @@ typedef struct queue_entry
     void            *queued_object;
     long            heartbeat;
 #if defined(SS_DEBUG)
-    long            sequence_check;
+    size_t          sequence_check;
 #endif /* SS_DEBUG */
 } QUEUE_ENTRY;
 
+/**
+ * A slot of the ring buffer of a queue
+ *
+ * The sequence number of a slot tells whose turn it is to use the slot. A
+ * producer may write to it when it equals the enqueue position and a consumer
+ * may read it when it equals the dequeue position plus one.
+ */
+typedef struct queue_slot
+{
+    size_t          seq;
+    QUEUE_ENTRY     entry;
+} QUEUE_SLOT;
+
+/**
+ * A bounded FIFO queue with any number of producers and consumers
+ *
+ * The queue has no locks, the producers and the consumers reserve the slots
+ * by advancing the positions with compare-and-swap operations.
+ */
 struct queue_config
 {
     int             queue_limit;
-    int             start;
-    int             end;
     int             timeout;
-    bool            has_entries;
-    SPINLOCK        queue_lock;
-    QUEUE_ENTRY     *queue_array;
-#if defined(SS_DEBUG)
-    long            sequence_number;
-#endif /* SS_DEBUG */
+    size_t          enqueue_pos;
+    size_t          dequeue_pos;
+    QUEUE_SLOT      *queue_array;
 };
 
 QUEUE_CONFIG *mxs_queue_alloc(int limit, int timeout);
@@ -0,0 +1,63 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/resolve.h - Cache of the resolved addresses of hosts
+ *
+ * The addresses of the hosts that outbound connections are made to are
+ * cached so that the worker threads do not block on name resolution each
+ * time a backend connection is created. The cached addresses are refreshed
+ * by the housekeeper thread.
+ */
+
+#include <maxscale/cdefs.h>
+#include <sys/socket.h>
+
+MXS_BEGIN_DECLS
+
+/** How often the cached addresses are resolved again, in seconds */
+#define RESOLVE_REFRESH_INTERVAL 30
+
+/**
+ * @brief Start refreshing the cached addresses
+ *
+ * Must be called after the housekeeper has been started.
+ */
+void resolve_init(void);
+
+/**
+ * @brief Resolve the address of a host
+ *
+ * The port of the address is not set.
+ *
+ * @param host   The host name or address
+ * @param addr   The address is stored here
+ * @param cached Whether to use the cache, the host is resolved and added to
+ *               the cache if it is not in it
+ *
+ * @return True if the address was resolved
+ */
+bool resolve_address(const char *host, struct sockaddr_storage *addr, bool cached);
+
+/**
+ * @brief Resolve the addresses in the cache again
+ *
+ * Run periodically by the housekeeper. An address is only replaced if the
+ * host could be resolved.
+ *
+ * @param data Not used
+ */
+void resolve_refresh(void *data);
+
+MXS_END_DECLS
@@ -129,6 +129,29 @@ void  service_update(SERVICE *service, char *router, char *user, char *auth);
  */
 void service_add_parameters(SERVICE *service, const MXS_CONFIG_PARAMETER *param);
 
+/**
+ * @brief Add the duration of a phase of a query to the latency histograms
+ *
+ * Called by the thread of the session of the query.
+ *
+ * @param service The service of the session
+ * @param phase   The phase of the query
+ * @param usecs   The duration of the phase in microseconds
+ */
+void service_add_latency(SERVICE *service, service_latency_t phase, uint64_t usecs);
+
+/**
+ * @brief Estimate a percentile of the latency of a phase of the queries
+ *
+ * @param service    The service
+ * @param phase      The phase of the queries
+ * @param percentile The percentile, from 0 to 100
+ *
+ * @return The upper bound of the histogram bucket that contains the
+ *         percentile in microseconds, or 0 if no queries have been measured
+ */
+int64_t service_latency_percentile(const SERVICE *service, service_latency_t phase, int percentile);
+
 /**
  * Internal debugging diagnostics
  */
@@ -27,7 +27,8 @@ MXS_BEGIN_DECLS
 
 #define SESSION_INIT {.ses_chk_top = CHK_NUM_SESSION, \
     .stats = SESSION_STATS_INIT, .head = MXS_DOWNSTREAM_INIT, .tail = MXS_UPSTREAM_INIT, \
-    .state = SESSION_STATE_ALLOC, .ses_chk_tail = CHK_NUM_SESSION}
+    .state = SESSION_STATE_ALLOC, .priority = SESSION_PRIORITY_NORMAL, \
+    .base_priority = SESSION_PRIORITY_NORMAL, .ses_chk_tail = CHK_NUM_SESSION}
 
 #define SESSION_PROTOCOL(x, type)       DCB_PROTOCOL((x)->client_dcb, type)
 
@@ -56,16 +57,27 @@ void dprintSession(struct dcb *, MXS_SESSION *);
 void dListSessions(struct dcb *);
 
 /**
- * @brief Get a session reference
+ * Start tracing a new session if it is one of the sampled sessions or if its
+ * user or host are traced.
  *
- * This creates an additional reference to a session which allows it to live
- * as long as it is needed.
+ * @param session The new session
+ */
+void session_trace_start(MXS_SESSION *session);
+
+/**
+ * End the current request of a closed session. Its latency is added to the
+ * histograms of the service and, if the session is traced, the request is
+ * logged if it took longer than the threshold.
  *
- * @param session Session reference to get
- * @return Reference to a MXS_SESSION
+ * @param session The session
  *
- * @note The caller must free the session reference by calling session_put_ref
+ * @return True if the request was logged
+ */
+bool session_trace_end(MXS_SESSION *session);
+
+/**
+ * Get the number of events recorded for the current request of a session.
  */
-MXS_SESSION* session_get_ref(MXS_SESSION *sessoin);
+int session_trace_n_events(const MXS_SESSION *session);
 
 MXS_END_DECLS
@@ -15,6 +15,8 @@
  */
 
 #include <maxscale/cdefs.h>
+#include <sys/uio.h>
+#include <sys/time.h>
 
 MXS_BEGIN_DECLS
 
@@ -110,6 +112,7 @@ size_t get_timestamp_len(void);
 size_t get_timestamp_len_hp(void);
 size_t snprint_timestamp(char* p_ts, size_t tslen);
 size_t snprint_timestamp_hp(char* p_ts, size_t tslen);
+size_t snprint_timestamp_tv(char* p_ts, size_t tslen, const struct timeval* tv, bool hp);
 
 void skygw_thread_set_state(skygw_thread_t* thr,
                             skygw_thr_state_t state);
@@ -138,6 +141,10 @@ int skygw_file_write(skygw_file_t* file,
                      void*         data,
                      size_t        nbytes,
                      bool          flush);
+int skygw_file_writev(skygw_file_t* file,
+                      struct iovec* iov,
+                      int           iovcnt,
+                      bool          flush);
 /** Skygw file routines */
 
 void acquire_lock(int* l);
@@ -34,4 +34,13 @@ void ts_stats_init();
  */
 void ts_stats_end();
 
+/**
+ * @brief Initialize the statistics of a worker thread
+ *
+ * After this, ts_stats_add updates the values of this thread.
+ *
+ * @param thread_id ID of the worker thread
+ */
+void ts_stats_thread_init(int thread_id);
+
 MXS_END_DECLS
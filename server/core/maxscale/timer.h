@@ -0,0 +1,58 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/timer.h - The private timer interface
+ */
+
+#include <maxscale/timer.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * @brief Initialize the timer wheels
+ *
+ * Must be called once before the worker threads are started.
+ *
+ * @param n_threads Number of worker threads
+ * @param now       The current heartbeat
+ *
+ * @return True if the wheels were allocated
+ */
+bool timer_wheel_init(int n_threads, int64_t now);
+
+/**
+ * @brief Attach the calling thread to its timer wheel
+ *
+ * @param thread_id The worker thread ID
+ */
+void timer_wheel_thread_init(int thread_id);
+
+/**
+ * @brief Call the callbacks of the expired timers of the calling thread
+ *
+ * @param now The current heartbeat
+ */
+void timer_wheel_process(int64_t now);
+
+/**
+ * @brief Get the number of active timers of a thread
+ *
+ * @param thread_id The worker thread ID
+ *
+ * @return Number of timers in the wheel of the thread
+ */
+int timer_wheel_count(int thread_id);
+
+MXS_END_DECLS
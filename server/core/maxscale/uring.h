@@ -0,0 +1,109 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file core/maxscale/uring.h - An io_uring based event engine
+ *
+ * The functions mirror epoll_ctl and epoll_wait. A file descriptor is watched
+ * with a multishot poll request whose completions are returned as epoll
+ * events, which allows the poll loop to process them unchanged. Requests
+ * made by the owning thread are queued and submitted by the next wait, which
+ * means that waiting without blocking costs no system call at all when
+ * nothing was queued.
+ */
+
+#include <maxscale/cdefs.h>
+#include <sys/epoll.h>
+
+MXS_BEGIN_DECLS
+
+typedef struct mxs_uring MXS_URING;
+
+/**
+ * Called when a multishot poll request has ended without being removed,
+ * for example because the completion queue overflowed.
+ *
+ * @param data   The data given to uring_add
+ * @param fd     Set to the file descriptor to watch again
+ * @param events Set to the events to watch for
+ *
+ * @return True if the file descriptor should be watched again
+ */
+typedef bool (*uring_rearm_cb_t)(void *data, int *fd, uint32_t *events);
+
+/**
+ * @brief Check whether io_uring can be used
+ *
+ * The kernel must support multishot poll requests and waiting with a timeout.
+ *
+ * @return True if the engine is available
+ */
+bool uring_supported(void);
+
+/**
+ * @brief Create a ring
+ *
+ * @param entries The size of the submission queue
+ * @param rearm   Called for poll requests that need to be submitted again
+ *
+ * @return The new ring or NULL on error
+ */
+MXS_URING* uring_create(unsigned int entries, uring_rearm_cb_t rearm);
+
+/**
+ * @brief Start watching a file descriptor
+ *
+ * Can be called by any thread. Requests from other threads than the owner
+ * of the ring are submitted immediately.
+ *
+ * @param ring   The ring
+ * @param fd     File descriptor to watch
+ * @param events The epoll events to watch for
+ * @param data   Returned in the data.ptr of the events
+ * @param owner  True if the calling thread is the one that waits on the ring
+ *
+ * @return 0 on success, -1 with errno set on error
+ */
+int uring_add(MXS_URING *ring, int fd, uint32_t events, void *data, bool owner);
+
+/**
+ * @brief Stop watching a file descriptor
+ *
+ * The removal is submitted immediately and no events for @c data are
+ * returned by later waits, whichever thread calls this. As with epoll, the
+ * events that a wait has already returned are not affected.
+ *
+ * @param ring  The ring
+ * @param data  The data given to uring_add
+ * @param owner True if the calling thread is the one that waits on the ring
+ *
+ * @return 0 on success, -1 with errno set on error
+ */
+int uring_remove(MXS_URING *ring, void *data, bool owner);
+
+/**
+ * @brief Submit queued requests and wait for events
+ *
+ * Must only be called by the owner of the ring.
+ *
+ * @param ring      The ring
+ * @param events    Where the events are stored
+ * @param maxevents Size of @c events
+ * @param timeout   Timeout in milliseconds, 0 for no wait and -1 for no timeout
+ *
+ * @return Number of events, or -1 with errno set on error
+ */
+int uring_wait(MXS_URING *ring, struct epoll_event *events, int maxevents, int timeout);
+
+MXS_END_DECLS
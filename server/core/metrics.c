@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file metrics.c - A registry of metrics in the text exposition format
+ *
+ * The metrics are kept in a singly linked list in which the members of a
+ * family are next to each other. The list is modified under a spinlock and a
+ * new metric is only linked into the list once it has been fully initialized,
+ * so the list can be read without locks. Unlinked metrics are freed with
+ * mxs_epoch_defer once no worker thread can be writing them out.
+ */
+
+#include <maxscale/metrics.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/buffer.h>
+#include <maxscale/debug.h>
+#include <maxscale/epoch.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+/** The size of the buffers the metrics are written in */
+#define METRICS_BATCH_SIZE (64 * 1024)
+
+struct mxs_metric
+{
+    char                *name;
+    char                *help;
+    char                *labels;    /**< Formatted labels without the braces, can be empty */
+    mxs_metric_type_t   type;
+    ts_stats_t          stats;      /**< The value of a counter or a gauge */
+    enum ts_stats_type  aggregate;  /**< How the values of the threads are combined */
+    bool                owned;      /**< Whether the metric allocated @c stats */
+    int                 n_bounds;
+    int64_t             *bounds;    /**< Upper bounds of the buckets of a histogram */
+    ts_stats_t          *buckets;   /**< Observations in each bucket, n_bounds + 1 of them */
+    ts_stats_t          sum;        /**< Sum of the observations */
+    struct mxs_metric   *next;
+};
+
+static MXS_METRIC *all_metrics = NULL;
+static SPINLOCK metrics_lock = SPINLOCK_INIT;
+
+typedef struct
+{
+    DCB     *dcb;
+    GWBUF   *batch;
+    size_t  used;
+} METRICS_WRITER;
+
+static void metric_free(void *data)
+{
+    MXS_METRIC *metric = (MXS_METRIC*)data;
+
+    if (metric->owned)
+    {
+        ts_stats_free(metric->stats);
+    }
+
+    if (metric->buckets)
+    {
+        for (int i = 0; i <= metric->n_bounds; i++)
+        {
+            ts_stats_free(metric->buckets[i]);
+        }
+    }
+
+    ts_stats_free(metric->sum);
+    MXS_FREE(metric->buckets);
+    MXS_FREE(metric->bounds);
+    MXS_FREE(metric->labels);
+    MXS_FREE(metric->help);
+    MXS_FREE(metric->name);
+    MXS_FREE(metric);
+}
+
+/**
+ * Format a label as name="value" with the value escaped
+ *
+ * @param label Name of the label or NULL
+ * @param value Value of the label
+ * @return The formatted label, an empty string for no label
+ */
+static char* format_labels(const char *label, const char *value)
+{
+    if (label == NULL)
+    {
+        return MXS_STRDUP("");
+    }
+
+    if (value == NULL)
+    {
+        value = "";
+    }
+
+    char *rval = (char*)MXS_MALLOC(strlen(label) + 2 * strlen(value) + 4);
+
+    if (rval)
+    {
+        char *ptr = rval + sprintf(rval, "%s=\"", label);
+
+        for (const char *c = value; *c; c++)
+        {
+            if (*c == '\n')
+            {
+                *ptr++ = '\\';
+                *ptr++ = 'n';
+            }
+            else
+            {
+                if (*c == '\\' || *c == '"')
+                {
+                    *ptr++ = '\\';
+                }
+                *ptr++ = *c;
+            }
+        }
+
+        *ptr++ = '"';
+        *ptr = '\0';
+    }
+
+    return rval;
+}
+
+static MXS_METRIC* metric_alloc(const char *name, const char *help, mxs_metric_type_t type,
+                                const char *label, const char *value)
+{
+    MXS_METRIC *metric = (MXS_METRIC*)MXS_CALLOC(1, sizeof(MXS_METRIC));
+
+    if (metric)
+    {
+        metric->name = MXS_STRDUP(name);
+        metric->help = MXS_STRDUP(help);
+        metric->labels = format_labels(label, value);
+        metric->type = type;
+        metric->aggregate = TS_STATS_SUM;
+
+        if (!metric->name || !metric->help || !metric->labels)
+        {
+            metric_free(metric);
+            metric = NULL;
+        }
+    }
+
+    return metric;
+}
+
+/**
+ * Link a metric into the registry after the other members of its family
+ *
+ * @param metric Fully initialized metric
+ * @return The metric or NULL if the family is of a different type
+ */
+static MXS_METRIC* metric_register(MXS_METRIC *metric)
+{
+    spinlock_acquire(&metrics_lock);
+
+    MXS_METRIC *prev = NULL;
+    MXS_METRIC *family = NULL;
+
+    for (MXS_METRIC *ptr = all_metrics; ptr; ptr = ptr->next)
+    {
+        if (strcmp(ptr->name, metric->name) == 0)
+        {
+            family = ptr;
+        }
+        else if (family)
+        {
+            break;
+        }
+        prev = ptr;
+    }
+
+    if (family && family->type != metric->type)
+    {
+        spinlock_release(&metrics_lock);
+        MXS_ERROR("Metric '%s' is already registered with a different type.", metric->name);
+        metric_free(metric);
+        return NULL;
+    }
+
+    if (family)
+    {
+        prev = family;
+    }
+
+    /** The metric must be complete before readers can see it */
+    metric->next = prev ? prev->next : NULL;
+    atomic_synchronize();
+    atomic_store_ptr(prev ? (void**)&prev->next : (void**)&all_metrics, metric);
+
+    spinlock_release(&metrics_lock);
+    return metric;
+}
+
+MXS_METRIC* mxs_metric_create(const char *name, const char *help, mxs_metric_type_t type,
+                              const char *label, const char *value)
+{
+    ss_dassert(type != MXS_METRIC_HISTOGRAM);
+    MXS_METRIC *metric = metric_alloc(name, help, type, label, value);
+
+    if (metric)
+    {
+        metric->owned = true;
+
+        if ((metric->stats = ts_stats_alloc()) == NULL)
+        {
+            metric_free(metric);
+            return NULL;
+        }
+
+        metric = metric_register(metric);
+    }
+
+    return metric;
+}
+
+MXS_METRIC* mxs_metric_create_stats(const char *name, const char *help, mxs_metric_type_t type,
+                                    const char *label, const char *value, ts_stats_t stats,
+                                    enum ts_stats_type aggregate)
+{
+    ss_dassert(type != MXS_METRIC_HISTOGRAM);
+    MXS_METRIC *metric = metric_alloc(name, help, type, label, value);
+
+    if (metric)
+    {
+        metric->stats = stats;
+        metric->aggregate = aggregate;
+        metric = metric_register(metric);
+    }
+
+    return metric;
+}
+
+MXS_METRIC* mxs_metric_create_histogram(const char *name, const char *help,
+                                        const char *label, const char *value,
+                                        const int64_t *bounds, int n_bounds)
+{
+    MXS_METRIC *metric = metric_alloc(name, help, MXS_METRIC_HISTOGRAM, label, value);
+
+    if (metric)
+    {
+        metric->n_bounds = n_bounds;
+        metric->bounds = (int64_t*)MXS_MALLOC((n_bounds ? n_bounds : 1) * sizeof(int64_t));
+        metric->buckets = (ts_stats_t*)MXS_CALLOC(n_bounds + 1, sizeof(ts_stats_t));
+        metric->sum = ts_stats_alloc();
+        bool ok = metric->bounds && metric->buckets && metric->sum;
+
+        for (int i = 0; ok && i <= n_bounds; i++)
+        {
+            ok = (metric->buckets[i] = ts_stats_alloc()) != NULL;
+        }
+
+        if (!ok)
+        {
+            metric_free(metric);
+            return NULL;
+        }
+
+        memcpy(metric->bounds, bounds, n_bounds * sizeof(int64_t));
+        metric = metric_register(metric);
+    }
+
+    return metric;
+}
+
+void mxs_metric_add(MXS_METRIC *metric, int64_t value)
+{
+    ss_dassert(metric->owned);
+    ss_dassert(metric->type == MXS_METRIC_GAUGE || value >= 0);
+    ts_stats_add(metric->stats, value);
+}
+
+void mxs_metric_observe(MXS_METRIC *metric, int64_t value)
+{
+    ss_dassert(metric->type == MXS_METRIC_HISTOGRAM);
+    int i = 0;
+
+    while (i < metric->n_bounds && value > metric->bounds[i])
+    {
+        i++;
+    }
+
+    ts_stats_add(metric->buckets[i], 1);
+    ts_stats_add(metric->sum, value);
+}
+
+void mxs_metric_destroy(MXS_METRIC *metric)
+{
+    if (metric == NULL)
+    {
+        return;
+    }
+
+    spinlock_acquire(&metrics_lock);
+
+    MXS_METRIC **ptr = &all_metrics;
+
+    while (*ptr && *ptr != metric)
+    {
+        ptr = &(*ptr)->next;
+    }
+
+    ss_dassert(*ptr == metric);
+
+    if (*ptr)
+    {
+        /** Readers that are at the metric can still follow its next pointer */
+        atomic_store_ptr((void**)ptr, metric->next);
+    }
+
+    spinlock_release(&metrics_lock);
+
+    mxs_epoch_defer(metric_free, metric);
+}
+
+static void writer_flush(METRICS_WRITER *writer)
+{
+    if (writer->batch)
+    {
+        GWBUF *batch = writer->batch;
+        batch->end = (char*)batch->start + writer->used;
+        writer->batch = NULL;
+        writer->used = 0;
+        writer->dcb->func.write(writer->dcb, batch);
+    }
+}
+
+static void writer_printf(METRICS_WRITER *writer, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (writer->batch && writer->used + len + 1 > GWBUF_LENGTH(writer->batch))
+    {
+        writer_flush(writer);
+    }
+
+    if (writer->batch == NULL)
+    {
+        size_t size = len + 1 > METRICS_BATCH_SIZE ? len + 1 : METRICS_BATCH_SIZE;
+
+        if ((writer->batch = gwbuf_alloc(size)) == NULL)
+        {
+            return;
+        }
+    }
+
+    va_start(args, fmt);
+    vsprintf((char*)GWBUF_DATA(writer->batch) + writer->used, fmt, args);
+    va_end(args);
+    writer->used += len;
+}
+
+static const char* metric_type_name(mxs_metric_type_t type)
+{
+    switch (type)
+    {
+    case MXS_METRIC_COUNTER:
+        return "counter";
+
+    case MXS_METRIC_GAUGE:
+        return "gauge";
+
+    default:
+        return "histogram";
+    }
+}
+
+static void write_histogram(METRICS_WRITER *writer, MXS_METRIC *metric)
+{
+    const char *sep = *metric->labels ? "," : "";
+    int64_t count = 0;
+
+    for (int i = 0; i < metric->n_bounds; i++)
+    {
+        count += ts_stats_sum(metric->buckets[i]);
+        writer_printf(writer, "%s_bucket{%s%sle=\"%" PRId64 "\"} %" PRId64 "\n",
+                      metric->name, metric->labels, sep, metric->bounds[i], count);
+    }
+
+    count += ts_stats_sum(metric->buckets[metric->n_bounds]);
+    writer_printf(writer, "%s_bucket{%s%sle=\"+Inf\"} %" PRId64 "\n",
+                  metric->name, metric->labels, sep, count);
+
+    if (*metric->labels)
+    {
+        writer_printf(writer, "%s_sum{%s} %" PRId64 "\n%s_count{%s} %" PRId64 "\n",
+                      metric->name, metric->labels, ts_stats_sum(metric->sum),
+                      metric->name, metric->labels, count);
+    }
+    else
+    {
+        writer_printf(writer, "%s_sum %" PRId64 "\n%s_count %" PRId64 "\n",
+                      metric->name, ts_stats_sum(metric->sum), metric->name, count);
+    }
+}
+
+void mxs_metrics_write(DCB *dcb)
+{
+    METRICS_WRITER writer = {dcb, NULL, 0};
+    MXS_METRIC *prev = NULL;
+
+    for (MXS_METRIC *metric = (MXS_METRIC*)atomic_load_ptr((void**)&all_metrics); metric;
+         metric = (MXS_METRIC*)atomic_load_ptr((void**)&metric->next))
+    {
+        if (prev == NULL || strcmp(prev->name, metric->name) != 0)
+        {
+            writer_printf(&writer, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help,
+                          metric->name, metric_type_name(metric->type));
+        }
+
+        if (metric->type == MXS_METRIC_HISTOGRAM)
+        {
+            write_histogram(&writer, metric);
+        }
+        else if (*metric->labels)
+        {
+            writer_printf(&writer, "%s{%s} %" PRId64 "\n", metric->name, metric->labels,
+                          ts_stats_get(metric->stats, metric->aggregate));
+        }
+        else
+        {
+            writer_printf(&writer, "%s %" PRId64 "\n", metric->name,
+                          ts_stats_get(metric->stats, metric->aggregate));
+        }
+
+        prev = metric;
+    }
+
+    writer_flush(&writer);
+}
@@ -25,6 +25,7 @@
  * @endverbatim
  */
 #include <maxscale/buffer.h>
+#include <ctype.h>
 #include <string.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
@@ -1162,10 +1163,296 @@ mxs_pcre2_result_t modutil_mysql_wildcard_match(const char* pattern, const char*
     return rval;
 }
 
+static inline bool canonical_is_special(char c)
+{
+    return c == '\'' || c == '"' || c == '`' || c == '/' || c == '#' || c == '-';
+}
+
+/**
+ * Find the end of a quoted string. As in the regular expression that was
+ * used earlier, a quote preceded by a backslash ends the string only if no
+ * other quote does.
+ *
+ * @param start The character after the opening quote
+ * @param end   The end of the statement
+ * @param quote The quote character
+ *
+ * @return The closing quote or NULL if the string does not end
+ */
+static const char* canonical_find_quote(const char* start, const char* end, char quote)
+{
+    const char* p = start;
+    const char* escaped = NULL;
+
+    while (p < end && (p = memchr(p, quote, end - p)))
+    {
+        if (p == start || p[-1] != '\\')
+        {
+            return p;
+        }
+
+        escaped = p++;
+    }
+
+    return escaped;
+}
+
+/**
+ * Replace the contents of strings with question marks and remove comments
+ * other than executable comments. Comments that do not end on the line where
+ * they start and strings that do not end are left as they are.
+ *
+ * @param sql  The statement
+ * @param len  Its length
+ * @param dest Buffer of at least len + len / 2 bytes
+ *
+ * @return The length of the result
+ */
+static size_t canonical_strip(const char* sql, size_t len, char* dest)
+{
+    const char* p = sql;
+    const char* end = sql + len;
+    char* d = dest;
+
+    while (p < end)
+    {
+        const char* q;
+        char c = *p;
+
+        if ((c == '\'' || c == '"') && (q = canonical_find_quote(p + 1, end, c)))
+        {
+            *d++ = c;
+            *d++ = '?';
+            *d++ = c;
+            p = q + 1;
+        }
+        else if (c == '`' && (q = memchr(p + 1, '`', end - p - 1)))
+        {
+            memcpy(d, p, q + 1 - p);
+            d += q + 1 - p;
+            p = q + 1;
+        }
+        else if (c == '/' && end - p > 1 && p[1] == '*' &&
+                 !(end - p > 2 && (p[2] == '!' || (p[2] == 'M' && end - p > 3 && p[3] == '!'))))
+        {
+            const char* eol = memchr(p + 2, '\n', end - p - 2);
+            const char* star = p + 2;
+
+            if (!eol)
+            {
+                eol = end;
+            }
+
+            while ((star = memchr(star, '*', eol - star)) && (star + 1 == eol || star[1] != '/'))
+            {
+                ++star;
+            }
+
+            if (star)
+            {
+                p = star + 2;
+            }
+            else
+            {
+                *d++ = *p++;
+            }
+        }
+        else if (c == '#' || (c == '-' && end - p > 2 && p[1] == '-' && isspace((unsigned char)p[2])))
+        {
+            p = (q = memchr(p, '\n', end - p)) ? q : end;
+        }
+        else
+        {
+            // Copy everything up to the next character that can start a
+            // string or a comment in one go.
+            const char* start = p++;
+
+            while (p < end && !canonical_is_special(*p))
+            {
+                ++p;
+            }
+
+            memcpy(d, start, p - start);
+            d += p - start;
+        }
+    }
+
+    return d - dest;
+}
+
+static inline bool canonical_is_word(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/** The characters that can precede a replaced value */
+static inline bool canonical_is_prefix(char c)
+{
+    return (c && strchr("-=,+*/(", c)) || isspace((unsigned char)c);
+}
+
+/** The characters that can follow a replaced value */
+static inline bool canonical_is_suffix(char c)
+{
+    return (c && strchr("-=,+*/);", c)) || isspace((unsigned char)c);
+}
+
+static inline bool canonical_is_number(char c)
+{
+    return isdigit((unsigned char)c) || c == '.' || c == '-';
+}
+
+/**
+ * Find the end of a value that starts at a given position. This mirrors the
+ * regular expression that was used earlier; numbers may contain dots and
+ * dashes and the names of variables are values as well.
+ *
+ * @param before The character before the value
+ * @param start  Where the value would start
+ * @param end    The end of the statement
+ *
+ * @return The end of the value, where its suffix is, or NULL if there is
+ *         no value at the position
+ */
+static const char* canonical_value_end(char before, const char* start, const char* end)
+{
+    const char* p = start;
+
+    while (p < end && canonical_is_number(*p))
+    {
+        ++p;
+    }
+
+    if (p > start)
+    {
+        if (p == end || canonical_is_suffix(*p))
+        {
+            return p;
+        }
+
+        // A dash in the number is a suffix as well.
+        while (--p > start)
+        {
+            if (*p == '-')
+            {
+                return p;
+            }
+        }
+    }
+
+    if (before == '@')
+    {
+        p = start;
+
+        while (p < end && canonical_is_word(*p))
+        {
+            ++p;
+        }
+
+        if (p > start && (p == end || canonical_is_suffix(*p)))
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Replace numbers and variables with question marks and squeeze whitespace.
+ * The replacement is done in place.
+ *
+ * @param sql The statement
+ * @param len Its length
+ *
+ * @return The length of the result
+ */
+static size_t canonical_replace_values(char* sql, size_t len)
+{
+    const char* p = sql;
+    const char* end = sql + len;
+    char* d = sql;
+    char prev = ' '; // The character before p; not a word character at the start.
+    bool space = false;
+
+    while (p < end)
+    {
+        char c = *p;
+        const char* value = NULL;
+        const char* value_end = NULL;
+
+        if (canonical_is_prefix(c) && (value_end = canonical_value_end(c, p + 1, end)))
+        {
+            value = p + 1;
+        }
+        else if (canonical_is_word(prev) != canonical_is_word(c) &&
+                 (value_end = canonical_value_end(prev, p, end)))
+        {
+            value = p;
+        }
+        else if (c == '@' && (value_end = canonical_value_end(c, p + 1, end)))
+        {
+            value = p + 1;
+        }
+
+        // The region is the prefix, a question mark and the suffix, if any.
+        char region[3];
+        size_t n = 0;
+        const char* next = p + 1;
+
+        if (value)
+        {
+            if (value > p)
+            {
+                region[n++] = c;
+            }
+
+            region[n++] = '?';
+            next = value_end;
+
+            if (value_end < end)
+            {
+                region[n++] = *value_end;
+                ++next;
+            }
+        }
+        else
+        {
+            region[n++] = c;
+        }
+
+        prev = next[-1];
+        p = next;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (isspace((unsigned char)region[i]))
+            {
+                space = true;
+            }
+            else
+            {
+                if (space && d > sql)
+                {
+                    *d++ = ' ';
+                }
+
+                space = false;
+                *d++ = region[i];
+            }
+        }
+    }
+
+    return d - sql;
+}
+
 /*
  * Replace user-provided literals with question marks.
  *
- * TODO: Make the canonicalization allocate only one buffer of memory
+ * The statement is canonicalized with two linear passes over a single buffer.
+ * The result is the same as what replacing the quoted strings, removing the
+ * comments, replacing the values and squeezing the whitespace with the
+ * functions in utils.c produces.
  *
  * @param querybuf GWBUF with a COM_QUERY statement
  * @return A copy of the query in its canonical form or NULL if an error occurred.
@@ -1177,38 +1464,14 @@ char* modutil_get_canonical(GWBUF* querybuf)
     if (GWBUF_LENGTH(querybuf) > MYSQL_HEADER_LEN + 1 && GWBUF_IS_SQL(querybuf))
     {
         size_t srcsize = GWBUF_LENGTH(querybuf) - MYSQL_HEADER_LEN - 1;
-        char *src = (char*)GWBUF_DATA(querybuf) + MYSQL_HEADER_LEN + 1;
-        size_t destsize = 0;
-        char *dest = NULL;
+        const char *src = (char*)GWBUF_DATA(querybuf) + MYSQL_HEADER_LEN + 1;
 
-        if (replace_quoted((const char**)&src, &srcsize, &dest, &destsize))
+        /** An empty string grows by one character when it is replaced */
+        if ((querystr = (char*)MXS_MALLOC(srcsize + srcsize / 2 + 1)))
         {
-            /** Reset the buffers so that the old result is reused and a new
-             * result is created.*/
-            src = dest;
-            srcsize = destsize;
-            dest = NULL;
-            destsize = 0;
-
-            if (remove_mysql_comments((const char**)&src, &srcsize, &dest, &destsize))
-            {
-                /** Both buffers now contain allocated memory so all we need
-                 * to do is to swap them */
-                if (replace_values((const char**)&dest, &destsize, &src, &srcsize))
-                {
-                    querystr = squeeze_whitespace(src);
-                    MXS_FREE(dest);
-                }
-                else
-                {
-                    MXS_FREE(src);
-                    MXS_FREE(dest);
-                }
-            }
-            else
-            {
-                MXS_FREE(src);
-            }
+            size_t len = canonical_strip(src, srcsize, querystr);
+            len = canonical_replace_values(querystr, len);
+            querystr[len] = '\0';
         }
     }
 
@@ -30,9 +30,12 @@
 #include <maxscale/monitor.h>
 
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <time.h>
 
 #include <maxscale/alloc.h>
 #include <mysqld_error.h>
@@ -42,16 +45,53 @@
 #include <maxscale/pcre2.h>
 #include <maxscale/secrets.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 
 #include "maxscale/config.h"
 #include "maxscale/externcmd.h"
 #include "maxscale/monitor.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 
 static MXS_MONITOR  *allMonitors = NULL;
 static SPINLOCK monLock = SPINLOCK_INIT;
 
 static void monitor_server_free_all(MXS_MONITOR_SERVERS *servers);
+static void probe_pool_free(MXS_MONITOR *monitor);
+static void script_forget_monitor(MXS_MONITOR *monitor);
+static void script_get_stats(MXS_MONITOR *monitor, MXS_MONITOR_SCRIPT_STATS *stats);
+
+/** The maximum number of threads that probe the servers of a monitor */
+#define MXS_MON_MAX_PROBE_THREADS 16
+
+/** The maximum number of monitor scripts that run at the same time */
+#define MXS_MON_MAX_RUNNING_SCRIPTS 4
+
+/** The maximum number of monitor scripts that wait to be run */
+#define MXS_MON_MAX_QUEUED_SCRIPTS 64
+
+/** How long a script may run after its timeout before it is killed */
+#define MXS_MON_SCRIPT_KILL_DELAY_MS 5000
+
+/** How often the running scripts are checked */
+#define MXS_MON_SCRIPT_POLL_MS 100
+
+/**
+ * The threads that probe the servers of a monitor
+ */
+struct mxs_monitor_probe_pool
+{
+    pthread_mutex_t      lock;
+    pthread_cond_t       work;      /**< Signaled when there are servers to probe */
+    pthread_cond_t       done;      /**< Signaled when a server has been probed */
+    THREAD               threads[MXS_MON_MAX_PROBE_THREADS];
+    int                  n_threads; /**< Number of started threads */
+    bool                 shutdown;  /**< Whether the threads should stop */
+    MXS_MONITOR         *monitor;   /**< The monitor of the pool */
+    mxs_monitor_probe_t  probe;     /**< The probe function of the current round */
+    MXS_MONITOR_SERVERS *next;      /**< The next server to probe */
+    int                  active;    /**< Number of servers being probed */
+};
 
 /** Server type specific bits */
 static unsigned int server_type_bits = SERVER_MASTER | SERVER_SLAVE |
@@ -107,6 +147,11 @@ monitor_alloc(char *name, char *module)
     mon->parameters = NULL;
     mon->created_online = false;
     mon->server_pending_changes = false;
+    mon->probe_pool = NULL;
+    mon->script_timeout = DEFAULT_SCRIPT_TIMEOUT;
+    mon->collect_metrics = false;
+    mon->warmup_time = 0;
+    memset(&mon->script_stats, 0, sizeof(mon->script_stats));
     spinlock_init(&mon->lock);
     spinlock_acquire(&monLock);
     mon->next = allMonitors;
@@ -128,6 +173,8 @@ monitor_free(MXS_MONITOR *mon)
     MXS_MONITOR *ptr;
 
     mon->module->stopMonitor(mon);
+    probe_pool_free(mon);
+    script_forget_monitor(mon);
     mon->state = MONITOR_STATE_FREED;
     spinlock_acquire(&monLock);
     if (allMonitors == mon)
@@ -209,6 +256,7 @@ monitorStop(MXS_MONITOR *monitor)
     {
         monitor->state = MONITOR_STATE_STOPPING;
         monitor->module->stopMonitor(monitor);
+        probe_pool_free(monitor);
         monitor->state = MONITOR_STATE_STOPPED;
 
         MXS_MONITOR_SERVERS* db = monitor->databases;
@@ -272,6 +320,8 @@ bool monitorAddServer(MXS_MONITOR *mon, SERVER *server)
         db->mon_prev_status = -1;
         /* pending status is updated by get_replication_tree */
         db->pending_status = 0;
+        db->was_usable = true;
+        db->warmup_start = 0;
 
         monitor_state_t old_state = mon->state;
 
@@ -461,6 +511,20 @@ monitorShow(DCB *dcb, MXS_MONITOR *monitor)
     dcb_printf(dcb, "Connect Timeout:   %i seconds\n", monitor->connect_timeout);
     dcb_printf(dcb, "Read Timeout:      %i seconds\n", monitor->read_timeout);
     dcb_printf(dcb, "Write Timeout:     %i seconds\n", monitor->write_timeout);
+    dcb_printf(dcb, "Script Timeout:    %i seconds\n", monitor->script_timeout);
+    dcb_printf(dcb, "Collect Metrics:   %s\n", monitor->collect_metrics ? "Yes" : "No");
+    dcb_printf(dcb, "Warm-up Time:      %i seconds\n", monitor->warmup_time);
+
+    MXS_MONITOR_SCRIPT_STATS stats;
+    script_get_stats(monitor, &stats);
+
+    if (stats.executed || stats.dropped)
+    {
+        dcb_printf(dcb, "Scripts executed:  %lu (%lu timed out, %lu dropped)\n",
+                   stats.executed, stats.timeouts, stats.dropped);
+        dcb_printf(dcb, "Script duration:   %lu ms last, %lu ms longest\n",
+                   stats.last_ms, stats.max_ms);
+    }
     dcb_printf(dcb, "Monitored servers: ");
 
     const char *sep = "";
@@ -554,6 +618,18 @@ monitorSetInterval(MXS_MONITOR *mon, unsigned long interval)
     mon->interval = interval;
 }
 
+/**
+ * Set whether the monitor samples the load of the servers
+ *
+ * @param mon           The monitor instance
+ * @param enable        Whether to collect the samples
+ */
+void
+monitorSetCollectMetrics(MXS_MONITOR *mon, bool enable)
+{
+    mon->collect_metrics = enable;
+}
+
 /**
  * Set Monitor timeouts for connect/read/write
  *
@@ -582,12 +658,24 @@ monitorSetNetworkTimeout(MXS_MONITOR *mon, int type, int value)
             mon->write_timeout = value;
             break;
 
+        case MONITOR_SCRIPT_TIMEOUT:
+            mon->script_timeout = value;
+            break;
+
+        case MONITOR_WARMUP_TIME:
+            mon->warmup_time = value;
+            break;
+
         default:
             MXS_ERROR("Monitor setNetworkTimeout received an unsupported action type %i", type);
             rval = false;
             break;
         }
     }
+    else if (value == 0 && type == MONITOR_WARMUP_TIME)
+    {
+        mon->warmup_time = 0;
+    }
     else
     {
         MXS_ERROR("Negative value for monitor timeout.");
@@ -1025,8 +1113,314 @@ mon_print_fail_status(MXS_MONITOR_SERVERS* mon_srv)
     return (SERVER_IS_DOWN(mon_srv->server) && mon_srv->mon_err_count == 0);
 }
 
+/**
+ * A monitor script that is waiting to be run or running
+ */
+typedef struct monitor_script
+{
+    MXS_MONITOR           *monitor;     /**< The monitor, NULL if it has been freed */
+    EXTERNCMD             *cmd;         /**< The command to run */
+    char                  *description; /**< The command and its arguments for the log */
+    const char            *event;       /**< Name of the event */
+    int                    timeout;     /**< Timeout in seconds */
+    uint64_t               started;     /**< When the script was started, in milliseconds */
+    bool                   terminated;  /**< Whether the script has been told to stop */
+    struct monitor_script *next;        /**< Next script in the queue */
+} MONITOR_SCRIPT;
+
+/**
+ * The monitor scripts are run by one thread so that the monitors never wait
+ * for them. The scripts of one monitor are run one at a time in the order of
+ * the events, the scripts of different monitors can run at the same time.
+ */
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;      /**< Signaled when a script is queued */
+    MONITOR_SCRIPT *queue;     /**< Scripts waiting to be run, oldest first */
+    int             n_queued;  /**< Number of queued scripts */
+    MONITOR_SCRIPT *running[MXS_MON_MAX_RUNNING_SCRIPTS];
+    int             n_running; /**< Number of running scripts */
+    bool            started;   /**< Whether the thread has been started */
+    THREAD          thread;
+} script_runner = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static uint64_t mon_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void script_free(MONITOR_SCRIPT *script)
+{
+    externcmd_free(script->cmd);
+    MXS_FREE(script->description);
+    MXS_FREE(script);
+}
+
+/** Check if a script of a monitor is running, the caller must hold the lock */
+static bool script_monitor_busy(MXS_MONITOR *monitor)
+{
+    for (int i = 0; i < script_runner.n_running; i++)
+    {
+        if (script_runner.running[i]->monitor == monitor)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** Start the queued scripts that can be started, the caller must hold the lock */
+static void script_start_queued(uint64_t now)
+{
+    MONITOR_SCRIPT **prev = &script_runner.queue;
+
+    while (*prev && script_runner.n_running < MXS_MON_MAX_RUNNING_SCRIPTS)
+    {
+        MONITOR_SCRIPT *script = *prev;
+
+        if (script_monitor_busy(script->monitor))
+        {
+            prev = &script->next;
+            continue;
+        }
+
+        *prev = script->next;
+        script->next = NULL;
+        script_runner.n_queued--;
+
+        if (externcmd_execute(script->cmd))
+        {
+            MXS_ERROR("Failed to execute script '%s' on server state change event '%s'.",
+                      script->cmd->argv[0], script->event);
+            script_free(script);
+        }
+        else
+        {
+            MXS_NOTICE("Executed monitor script '%s' on event '%s'.",
+                       script->description, script->event);
+            script->started = now;
+            script_runner.running[script_runner.n_running++] = script;
+        }
+    }
+}
+
+/** Record a finished script, the caller must hold the lock */
+static void script_finish(MONITOR_SCRIPT *script, int status, uint64_t now)
+{
+    uint64_t duration = now - script->started;
+
+    if (WIFEXITED(status))
+    {
+        MXS_NOTICE("Monitor script '%s' on event '%s' finished in %lu ms with exit code %d.",
+                   script->cmd->argv[0], script->event, duration, WEXITSTATUS(status));
+    }
+    else
+    {
+        MXS_WARNING("Monitor script '%s' on event '%s' was stopped by signal %d after %lu ms.",
+                    script->cmd->argv[0], script->event,
+                    WIFSIGNALED(status) ? WTERMSIG(status) : 0, duration);
+    }
+
+    if (script->monitor)
+    {
+        MXS_MONITOR_SCRIPT_STATS *stats = &script->monitor->script_stats;
+        stats->executed++;
+        stats->last_ms = duration;
+        stats->max_ms = MXS_MAX(stats->max_ms, duration);
+    }
+
+    script_free(script);
+}
+
+/**
+ * @brief Reap the finished scripts and stop the ones that run for too long
+ *
+ * A script is first sent SIGTERM when it exceeds its timeout and SIGKILL if
+ * it is still running MXS_MON_SCRIPT_KILL_DELAY_MS later. The caller must hold
+ * the lock.
+ *
+ * @param now The current time in milliseconds
+ */
+static void script_check_running(uint64_t now)
+{
+    int i = 0;
+
+    while (i < script_runner.n_running)
+    {
+        MONITOR_SCRIPT *script = script_runner.running[i];
+        uint64_t limit = (uint64_t)script->timeout * 1000;
+        int status = 0;
+        pid_t pid = waitpid(script->cmd->child, &status, WNOHANG);
+
+        if (pid == script->cmd->child || (pid == -1 && errno == ECHILD))
+        {
+            script_finish(script, status, now);
+            script_runner.running[i] = script_runner.running[--script_runner.n_running];
+            continue;
+        }
+
+        if (!script->terminated && now - script->started >= limit)
+        {
+            MXS_WARNING("Monitor script '%s' on event '%s' has run for over %d seconds, "
+                        "stopping it.", script->cmd->argv[0], script->event, script->timeout);
+            kill(script->cmd->child, SIGTERM);
+            script->terminated = true;
+
+            if (script->monitor)
+            {
+                script->monitor->script_stats.timeouts++;
+            }
+        }
+        else if (script->terminated && now - script->started >= limit + MXS_MON_SCRIPT_KILL_DELAY_MS)
+        {
+            kill(script->cmd->child, SIGKILL);
+        }
+
+        i++;
+    }
+}
+
+static void script_runner_main(void *data)
+{
+    pthread_mutex_lock(&script_runner.lock);
+
+    while (true)
+    {
+        uint64_t now = mon_clock_ms();
+        script_check_running(now);
+        script_start_queued(now);
+
+        if (script_runner.n_running == 0)
+        {
+            pthread_cond_wait(&script_runner.cond, &script_runner.lock);
+        }
+        else
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += MXS_MON_SCRIPT_POLL_MS * 1000000;
+            ts.tv_sec += ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&script_runner.cond, &script_runner.lock, &ts);
+        }
+    }
+}
+
+/**
+ * @brief Queue a script to be run by the script thread
+ *
+ * The script is not run if the queue is full.
+ *
+ * @param monitor     The monitor that launches the script
+ * @param cmd         The command, freed by this function
+ * @param description The command and its arguments, freed by this function
+ * @param event       Name of the event
+ */
+static void script_submit(MXS_MONITOR *monitor, EXTERNCMD *cmd, char *description, const char *event)
+{
+    MONITOR_SCRIPT *script = MXS_CALLOC(1, sizeof(MONITOR_SCRIPT));
+
+    if (script == NULL)
+    {
+        externcmd_free(cmd);
+        MXS_FREE(description);
+        return;
+    }
+
+    script->monitor = monitor;
+    script->cmd = cmd;
+    script->description = description;
+    script->event = event;
+    script->timeout = monitor->script_timeout;
+
+    pthread_mutex_lock(&script_runner.lock);
+
+    if (!script_runner.started)
+    {
+        script_runner.started = thread_start(&script_runner.thread, script_runner_main, NULL) != NULL;
+    }
+
+    if (!script_runner.started || script_runner.n_queued >= MXS_MON_MAX_QUEUED_SCRIPTS)
+    {
+        MXS_ERROR("Failed to execute script '%s' on server state change event '%s', %s.",
+                  cmd->argv[0], event, script_runner.started ?
+                  "too many scripts are waiting to be run" : "the script thread could not be started");
+        monitor->script_stats.dropped++;
+        script_free(script);
+    }
+    else
+    {
+        MONITOR_SCRIPT **tail = &script_runner.queue;
+
+        while (*tail)
+        {
+            tail = &(*tail)->next;
+        }
+
+        *tail = script;
+        script_runner.n_queued++;
+        pthread_cond_signal(&script_runner.cond);
+    }
+
+    pthread_mutex_unlock(&script_runner.lock);
+}
+
+/**
+ * @brief Drop the queued scripts of a monitor that is freed
+ *
+ * The scripts that are already running are left to finish.
+ *
+ * @param monitor The monitor
+ */
+static void script_forget_monitor(MXS_MONITOR *monitor)
+{
+    pthread_mutex_lock(&script_runner.lock);
+
+    MONITOR_SCRIPT **prev = &script_runner.queue;
+
+    while (*prev)
+    {
+        MONITOR_SCRIPT *script = *prev;
+
+        if (script->monitor == monitor)
+        {
+            *prev = script->next;
+            script_runner.n_queued--;
+            script_free(script);
+        }
+        else
+        {
+            prev = &script->next;
+        }
+    }
+
+    for (int i = 0; i < script_runner.n_running; i++)
+    {
+        if (script_runner.running[i]->monitor == monitor)
+        {
+            script_runner.running[i]->monitor = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&script_runner.lock);
+}
+
+static void script_get_stats(MXS_MONITOR *monitor, MXS_MONITOR_SCRIPT_STATS *stats)
+{
+    pthread_mutex_lock(&script_runner.lock);
+    *stats = monitor->script_stats;
+    pthread_mutex_unlock(&script_runner.lock);
+}
+
 /**
  * Launch a script
+ *
+ * The script is run by a separate thread, this function only queues it.
+ *
  * @param mon Owning monitor
  * @param ptr The server which has changed state
  * @param script Script to execute
@@ -1090,58 +1484,49 @@ monitor_launch_script(MXS_MONITOR* mon, MXS_MONITOR_SERVERS* ptr, const char* sc
         externcmd_substitute_arg(cmd, "[$]SYNCEDLIST", nodelist);
     }
 
-    if (externcmd_execute(cmd))
+    ss_dassert(cmd->argv != NULL && cmd->argv[0] != NULL);
+    // Construct a string with the script + arguments
+    char *scriptStr = NULL;
+    int totalStrLen = 0;
+    for (int i = 0; cmd->argv[i]; i++)
     {
-        MXS_ERROR("Failed to execute script '%s' on server state change event '%s'.",
-                  script, mon_get_event_name(ptr));
+        totalStrLen += strlen(cmd->argv[i]) + 1; // +1 for space and one \0
     }
-    else
+    int spaceRemaining = totalStrLen;
+    if ((scriptStr = MXS_CALLOC(totalStrLen, sizeof(char))) != NULL)
     {
-        ss_dassert(cmd->argv != NULL && cmd->argv[0] != NULL);
-        // Construct a string with the script + arguments
-        char *scriptStr = NULL;
-        int totalStrLen = 0;
-        bool memError = false;
-        for (int i = 0; cmd->argv[i]; i++)
-        {
-            totalStrLen += strlen(cmd->argv[i]) + 1; // +1 for space and one \0
-        }
-        int spaceRemaining = totalStrLen;
-        if ((scriptStr = MXS_CALLOC(totalStrLen, sizeof(char))) != NULL)
-        {
-            char *currentPos = scriptStr;
-            // The script name should not begin with a space
-            int len = snprintf(currentPos, spaceRemaining, "%s", cmd->argv[0]);
-            currentPos += len;
-            spaceRemaining -= len;
+        char *currentPos = scriptStr;
+        // The script name should not begin with a space
+        int len = snprintf(currentPos, spaceRemaining, "%s", cmd->argv[0]);
+        currentPos += len;
+        spaceRemaining -= len;
 
-            for (int i = 1; cmd->argv[i]; i++)
+        for (int i = 1; cmd->argv[i]; i++)
+        {
+            if ((cmd->argv[i])[0] == '\0')
             {
-                if ((cmd->argv[i])[0] == '\0')
-                {
-                    continue; // Empty argument, print nothing
-                }
-                len = snprintf(currentPos, spaceRemaining, " %s", cmd->argv[i]);
-                currentPos += len;
-                spaceRemaining -= len;
+                continue; // Empty argument, print nothing
             }
-            ss_dassert(spaceRemaining > 0);
-            *currentPos = '\0';
-        }
-        else
-        {
-            memError = true;
-            scriptStr = cmd->argv[0]; // print at least something
-        }
-        MXS_NOTICE("Executed monitor script '%s' on event '%s'.",
-                   scriptStr, mon_get_event_name(ptr));
-        if (!memError)
-        {
-            MXS_FREE(scriptStr);
+            len = snprintf(currentPos, spaceRemaining, " %s", cmd->argv[i]);
+            currentPos += len;
+            spaceRemaining -= len;
         }
+        ss_dassert(spaceRemaining > 0);
+        *currentPos = '\0';
+    }
+    else
+    {
+        scriptStr = MXS_STRDUP(cmd->argv[0]); // print at least something
     }
 
-    externcmd_free(cmd);
+    if (scriptStr)
+    {
+        script_submit(mon, cmd, scriptStr, mon_get_event_name(ptr));
+    }
+    else
+    {
+        externcmd_free(cmd);
+    }
 }
 
 /**
@@ -1163,6 +1548,10 @@ mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
         return rval;
     }
 
+    /** The server was running when the monitor last saw it */
+    bool reconnect = database->con && (database->mon_prev_status & SERVER_RUNNING) &&
+                     database->mon_prev_status != (unsigned int)-1;
+
     if (database->con)
     {
         mysql_close(database->con);
@@ -1189,6 +1578,18 @@ mon_connect_to_db(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
         bool result = (mxs_mysql_real_connect(database->con, database->server, uname, dpwd) != NULL);
         time_t end = time(NULL);
 
+        if (result && reconnect && database->server->persistpoolmax)
+        {
+            /**
+             * The monitor lost its connection to a server that is still
+             * running. The server was most likely restarted or the network
+             * dropped idle connections, so the pooled connections are gone too.
+             */
+            MXS_NOTICE("[%s] Lost the connection to server '%s', closing its pooled connections.",
+                       mon->name, database->server->unique_name);
+            poll_send_message(POLL_MSG_FLUSH_PERSISTENT, database->server);
+        }
+
         if (!result)
         {
             if ((int) difftime(end, start) >= mon->connect_timeout)
@@ -1339,6 +1740,9 @@ static bool create_monitor_config(const MXS_MONITOR *monitor, const char *filena
     dprintf(file, "backend_connect_timeout=%d\n", monitor->connect_timeout);
     dprintf(file, "backend_write_timeout=%d\n", monitor->write_timeout);
     dprintf(file, "backend_read_timeout=%d\n", monitor->read_timeout);
+    dprintf(file, "script_timeout=%d\n", monitor->script_timeout);
+    dprintf(file, "collect_metrics=%s\n", monitor->collect_metrics ? "true" : "false");
+    dprintf(file, "warmup_time=%d\n", monitor->warmup_time);
     close(file);
 
     return true;
@@ -1486,12 +1890,58 @@ void servers_status_current_to_pending(MXS_MONITOR *monitor)
     while (ptr)
     {
         ptr->server->status_pending = ptr->server->status;
+        server_publish_state(ptr->server);
         ptr = ptr->next;
     }
 }
 
+/**
+ * @brief Raise the weight of the servers that have recently become usable
+ *
+ * When a server starts running or comes out of maintenance, the new sessions
+ * would all open their connections to it at once. The weight that the routers
+ * use for the server is raised linearly from one percent to the full weight
+ * over the warm-up time of the monitor so that the connections are opened
+ * gradually.
+ *
+ * @param monitor Monitor object
+ */
+static void mon_update_warmup(MXS_MONITOR *monitor)
+{
+    uint64_t now = mon_clock_ms();
+    uint64_t warmup_ms = (uint64_t)monitor->warmup_time * 1000;
+
+    for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
+    {
+        bool usable = SERVER_IS_RUNNING(ptr->server);
+
+        if (usable && !ptr->was_usable && warmup_ms > 0)
+        {
+            ptr->warmup_start = now;
+        }
+        else if (!usable)
+        {
+            ptr->warmup_start = 0;
+        }
+
+        ptr->was_usable = usable;
+
+        if (ptr->warmup_start && now - ptr->warmup_start < warmup_ms)
+        {
+            ptr->server->warmup_weight = MXS_MAX(100 * (now - ptr->warmup_start) / warmup_ms, 1);
+        }
+        else
+        {
+            ptr->warmup_start = 0;
+            ptr->server->warmup_weight = 100;
+        }
+    }
+}
+
 void mon_process_state_changes(MXS_MONITOR *monitor, const char *script, uint64_t events)
 {
+    mon_update_warmup(monitor);
+
     for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
     {
         if (mon_status_changed(ptr))
@@ -1505,3 +1955,236 @@ void mon_process_state_changes(MXS_MONITOR *monitor, const char *script, uint64_
         }
     }
 }
+
+/**
+ * @brief Sample the load of a server
+ *
+ * The round trip time of the status query is measured from the monitor.
+ *
+ * @param database The probed server
+ */
+static void collect_server_metrics(MXS_MONITOR_SERVERS *database)
+{
+    if (database->con == NULL ||
+        !(SERVER_IS_RUNNING(database->server) || (database->pending_status & SERVER_RUNNING)))
+    {
+        return;
+    }
+
+    struct timespec start, end;
+    MYSQL_RES *result;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (mysql_query(database->con, "SHOW GLOBAL STATUS WHERE Variable_name IN "
+                    "('Questions', 'Threads_running', 'Innodb_rows_read')") == 0 &&
+        (result = mysql_store_result(database->con)))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        uint64_t questions = 0;
+        uint64_t threads_running = 0;
+        uint64_t rows_read = 0;
+        MYSQL_ROW row;
+
+        while ((row = mysql_fetch_row(result)) && mysql_num_fields(result) >= 2)
+        {
+            uint64_t value = strtoull(row[1], NULL, 10);
+
+            if (strcasecmp(row[0], "Questions") == 0)
+            {
+                questions = value;
+            }
+            else if (strcasecmp(row[0], "Threads_running") == 0)
+            {
+                threads_running = value;
+            }
+            else if (strcasecmp(row[0], "Innodb_rows_read") == 0)
+            {
+                rows_read = value;
+            }
+        }
+
+        mysql_free_result(result);
+
+        int64_t rtt_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+        server_add_metrics_sample(database->server, rtt_us, questions, threads_running, rows_read);
+    }
+}
+
+/**
+ * @brief Probe a server and sample its load if it is enabled
+ *
+ * @param monitor  Monitor object
+ * @param probe    The probe function of the monitor
+ * @param database The server to probe
+ */
+static void probe_server(MXS_MONITOR *monitor, mxs_monitor_probe_t probe, MXS_MONITOR_SERVERS *database)
+{
+    probe(monitor, database);
+
+    if (monitor->collect_metrics)
+    {
+        collect_server_metrics(database);
+    }
+}
+
+/**
+ * @brief Take the next server to probe and probe it
+ *
+ * The caller must hold the lock of the pool, it is released while the
+ * server is probed.
+ *
+ * @param pool The probe pool
+ */
+static void probe_next_server(struct mxs_monitor_probe_pool *pool)
+{
+    MXS_MONITOR_SERVERS *database = pool->next;
+    pool->next = database->next;
+    pool->active++;
+    pthread_mutex_unlock(&pool->lock);
+
+    probe_server(pool->monitor, pool->probe, database);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->active--;
+    pthread_cond_signal(&pool->done);
+}
+
+static void probe_main(void *data)
+{
+    struct mxs_monitor_probe_pool *pool = (struct mxs_monitor_probe_pool*)data;
+
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed in a probe thread of monitor '%s'.",
+                  pool->monitor->name);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (!pool->shutdown)
+    {
+        if (pool->next)
+        {
+            probe_next_server(pool);
+        }
+        else
+        {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    mysql_thread_end();
+}
+
+/**
+ * @brief Start probe threads until there is one for each server
+ *
+ * The calling thread also probes servers so one thread less is needed.
+ * The pool is allocated when it is first needed.
+ *
+ * @param monitor Monitor object
+ * @return The pool or NULL if it could not be allocated
+ */
+static struct mxs_monitor_probe_pool* probe_pool_grow(MXS_MONITOR *monitor)
+{
+    struct mxs_monitor_probe_pool *pool = monitor->probe_pool;
+
+    if (pool == NULL)
+    {
+        if ((pool = MXS_CALLOC(1, sizeof(*pool))) == NULL)
+        {
+            return NULL;
+        }
+
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->work, NULL);
+        pthread_cond_init(&pool->done, NULL);
+        pool->monitor = monitor;
+        monitor->probe_pool = pool;
+    }
+
+    int wanted = -1;
+
+    for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        wanted++;
+    }
+
+    while (pool->n_threads < wanted && pool->n_threads < MXS_MON_MAX_PROBE_THREADS)
+    {
+        if (thread_start(&pool->threads[pool->n_threads], probe_main, pool) == NULL)
+        {
+            MXS_ERROR("Failed to start a probe thread for monitor '%s', %d threads "
+                      "probe the servers.", monitor->name, pool->n_threads + 1);
+            break;
+        }
+
+        pool->n_threads++;
+    }
+
+    return pool;
+}
+
+/**
+ * @brief Stop the probe threads of a monitor
+ *
+ * @param monitor Monitor object whose monitoring thread has stopped
+ */
+static void probe_pool_free(MXS_MONITOR *monitor)
+{
+    struct mxs_monitor_probe_pool *pool = monitor->probe_pool;
+
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->n_threads; i++)
+        {
+            thread_wait(pool->threads[i]);
+        }
+
+        pthread_cond_destroy(&pool->done);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        MXS_FREE(pool);
+        monitor->probe_pool = NULL;
+    }
+}
+
+void mon_probe_servers(MXS_MONITOR *monitor, mxs_monitor_probe_t probe)
+{
+    struct mxs_monitor_probe_pool *pool = probe_pool_grow(monitor);
+
+    if (pool == NULL)
+    {
+        for (MXS_MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+        {
+            probe_server(monitor, probe, db);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->probe = probe;
+    pool->next = monitor->databases;
+    pthread_cond_broadcast(&pool->work);
+
+    while (pool->next)
+    {
+        probe_next_server(pool);
+    }
+
+    while (pool->active > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -27,6 +27,7 @@
 #include <maxscale/log_manager.h>
 #include <maxscale/debug.h>
 #include <maxscale/config.h>
+#include <maxscale/protocol/mysql.h>
 
 /**
  * @brief Calculate the length of a length-encoded integer in bytes
@@ -147,7 +148,129 @@ char* mxs_lestr_consume(uint8_t** c, size_t *size)
     return start;
 }
 
+/** The status flag of an OK packet that reports session state changes */
+#define MXS_SERVER_SESSION_STATE_CHANGED 0x4000
 
+/** The types of the session state changes */
+#define MXS_SESSION_TRACK_SYSTEM_VARIABLES 0
+#define MXS_SESSION_TRACK_GTIDS            3
+
+/**
+ * @brief Consume a length-encoded integer that must fit in a buffer
+ *
+ * @param c   Pointer to the integer, advanced past it on success.
+ * @param end End of the buffer.
+ * @param val On return, the value of the integer.
+ *
+ * @return True, if the integer fits in the buffer.
+ */
+static bool leint_consume_bounded(const uint8_t** c, const uint8_t* end, uint64_t* val)
+{
+    bool rval = false;
+
+    if (*c < end && **c != 0xff && **c != 0xfb && *c + mxs_leint_bytes(*c) <= end)
+    {
+        *val = mxs_leint_value(*c);
+        *c += mxs_leint_bytes(*c);
+        rval = true;
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Consume a length-encoded string that must fit in a buffer
+ *
+ * @param c    Pointer to the string, advanced past it on success.
+ * @param end  End of the buffer.
+ * @param str  On return, the start of the string.
+ * @param size On return, the length of the string.
+ *
+ * @return True, if the string fits in the buffer.
+ */
+static bool lestr_consume_bounded(const uint8_t** c, const uint8_t* end, const char** str, size_t* size)
+{
+    uint64_t slen;
+    bool rval = false;
+
+    if (leint_consume_bounded(c, end, &slen) && slen <= (uint64_t)(end - *c))
+    {
+        *str = (const char*)*c;
+        *size = slen;
+        *c += slen;
+        rval = true;
+    }
+
+    return rval;
+}
+
+char* mxs_mysql_get_tracked_variable(const uint8_t* packet, size_t len, const char* name)
+{
+    const uint8_t* end = packet + len;
+    const uint8_t* c = packet + MYSQL_HEADER_LEN + 1;
+    size_t name_len = strlen(name);
+    uint64_t dummy;
+    const char* str;
+    size_t size;
+    char* rval = NULL;
+
+    if (len < MYSQL_HEADER_LEN + 1 || packet[MYSQL_HEADER_LEN] != MYSQL_REPLY_OK ||
+        !leint_consume_bounded(&c, end, &dummy) ||  // Affected rows
+        !leint_consume_bounded(&c, end, &dummy) ||  // Last insert ID
+        end - c < 4)
+    {
+        return NULL;
+    }
+
+    uint16_t status = c[0] | (c[1] << 8);
+    c += 4; // The status and the number of warnings
+
+    if ((status & MXS_SERVER_SESSION_STATE_CHANGED) == 0 ||
+        !lestr_consume_bounded(&c, end, &str, &size) ||  // The info string
+        !leint_consume_bounded(&c, end, &dummy) ||       // Length of the changes
+        dummy != (uint64_t)(end - c))                    // The changes end the packet
+    {
+        return NULL;
+    }
+
+    while (c < end)
+    {
+        uint8_t type = *c++;
+        const uint8_t* data;
+        const uint8_t* data_end;
+
+        if (!lestr_consume_bounded(&c, end, (const char**)&data, &size))
+        {
+            break;
+        }
+
+        data_end = data + size;
+
+        if (type == MXS_SESSION_TRACK_SYSTEM_VARIABLES)
+        {
+            if (lestr_consume_bounded(&data, data_end, &str, &size) &&
+                size == name_len && strncasecmp(str, name, size) == 0 &&
+                lestr_consume_bounded(&data, data_end, &str, &size))
+            {
+                MXS_FREE(rval);
+                rval = MXS_STRNDUP(str, size);
+            }
+        }
+        else if (type == MXS_SESSION_TRACK_GTIDS && strcasecmp(name, "gtid") == 0)
+        {
+            // The first byte is the encoding specification of the GTIDs
+            data++;
+
+            if (data < data_end && lestr_consume_bounded(&data, data_end, &str, &size))
+            {
+                MXS_FREE(rval);
+                rval = MXS_STRNDUP(str, size);
+            }
+        }
+    }
+
+    return rval;
+}
 
 /**
  * Creates a connection to a MySQL database engine. If necessary, initializes SSL.
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file persistpool.c  The persistent connection pools
+ */
+
+#include "maxscale/persistpool.h"
+
+#include <string.h>
+#include <maxscale/alloc.h>
+
+/** The lists a pooled connection is in, the indexes of DCB::pool_links */
+enum
+{
+    PERSIST_BY_USER, /*< All connections of a user and protocol */
+    PERSIST_BY_KEY   /*< The connections of a user and protocol with the same reuse key */
+};
+
+/** The initial size of the hash table of a pool */
+#define PERSIST_INITIAL_BUCKETS 16
+
+/**
+ * A list of pooled connections
+ */
+typedef struct persist_entry
+{
+    PERSIST_POOL         *pool;     /*< The pool of the list */
+    struct persist_entry *next;     /*< Next list in the same hash bucket */
+    uint32_t              hash;     /*< Hash of the user, protocol and key */
+    int                   type;     /*< PERSIST_BY_USER or PERSIST_BY_KEY */
+    DCB                  *first;    /*< The most recently added connection */
+    const char           *user;     /*< The user, points to @c data */
+    const char           *protocol; /*< The protocol, points to @c data */
+    const char           *key;      /*< The key, points to @c data, NULL for PERSIST_BY_USER */
+    char                  data[];   /*< The strings */
+} PERSIST_ENTRY;
+
+/**
+ * @brief Hash the identity of a list
+ *
+ * This is the 32-bit FNV-1a hash of the strings and their terminators.
+ */
+static uint32_t persist_hash(int type, const char *user, const char *protocol, const char *key)
+{
+    const char *parts[] = {user, protocol, type == PERSIST_BY_KEY ? key : ""};
+    uint32_t hash = 2166136261u ^ type;
+
+    for (int i = 0; i < 3; i++)
+    {
+        const char *p = parts[i];
+
+        do
+        {
+            hash = (hash ^ (uint8_t)*p) * 16777619u;
+        }
+        while (*p++);
+    }
+
+    return hash;
+}
+
+PERSIST_POOL* persistpool_alloc(int n_threads)
+{
+    return (PERSIST_POOL*)MXS_CALLOC(n_threads, sizeof(PERSIST_POOL));
+}
+
+void persistpool_free(PERSIST_POOL *pools, int n_threads)
+{
+    if (pools)
+    {
+        for (int i = 0; i < n_threads; i++)
+        {
+            ss_dassert(pools[i].n_entries == 0);
+            MXS_FREE(pools[i].buckets);
+        }
+
+        MXS_FREE(pools);
+    }
+}
+
+/**
+ * @brief Find a list
+ *
+ * @return The list or NULL if the pool has no connections for it
+ */
+static PERSIST_ENTRY* persist_find(PERSIST_POOL *pool, int type, const char *user,
+                                   const char *protocol, const char *key)
+{
+    if (pool->n_buckets == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t hash = persist_hash(type, user, protocol, key);
+
+    for (PERSIST_ENTRY *entry = pool->buckets[hash % pool->n_buckets]; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->type == type && strcmp(entry->user, user) == 0 &&
+            strcmp(entry->protocol, protocol) == 0 &&
+            (type == PERSIST_BY_USER || strcmp(entry->key, key) == 0))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Double the size of the hash table once it has twice as many lists as buckets
+ *
+ * A failure to grow only makes the hash chains longer.
+ */
+static void persist_grow(PERSIST_POOL *pool)
+{
+    if (pool->n_buckets && pool->n_entries < pool->n_buckets * 2)
+    {
+        return;
+    }
+
+    int n_buckets = pool->n_buckets ? pool->n_buckets * 2 : PERSIST_INITIAL_BUCKETS;
+    PERSIST_ENTRY **buckets = (PERSIST_ENTRY**)MXS_CALLOC(n_buckets, sizeof(*buckets));
+
+    if (buckets)
+    {
+        for (int i = 0; i < pool->n_buckets; i++)
+        {
+            PERSIST_ENTRY *entry = pool->buckets[i];
+
+            while (entry)
+            {
+                PERSIST_ENTRY *next = entry->next;
+                entry->next = buckets[entry->hash % n_buckets];
+                buckets[entry->hash % n_buckets] = entry;
+                entry = next;
+            }
+        }
+
+        MXS_FREE(pool->buckets);
+        pool->buckets = buckets;
+        pool->n_buckets = n_buckets;
+    }
+}
+
+/**
+ * @brief Find a list or create it if the pool has none
+ *
+ * @return The list or NULL if memory allocation failed
+ */
+static PERSIST_ENTRY* persist_get(PERSIST_POOL *pool, int type, const char *user,
+                                  const char *protocol, const char *key)
+{
+    PERSIST_ENTRY *entry = persist_find(pool, type, user, protocol, key);
+
+    if (entry == NULL)
+    {
+        persist_grow(pool);
+
+        if (pool->n_buckets == 0)
+        {
+            return NULL;
+        }
+
+        size_t user_len = strlen(user) + 1;
+        size_t protocol_len = strlen(protocol) + 1;
+        size_t key_len = type == PERSIST_BY_KEY ? strlen(key) + 1 : 0;
+
+        if ((entry = (PERSIST_ENTRY*)MXS_MALLOC(sizeof(*entry) + user_len + protocol_len + key_len)))
+        {
+            entry->pool = pool;
+            entry->hash = persist_hash(type, user, protocol, key);
+            entry->type = type;
+            entry->first = NULL;
+            memcpy(entry->data, user, user_len);
+            memcpy(entry->data + user_len, protocol, protocol_len);
+            entry->user = entry->data;
+            entry->protocol = entry->data + user_len;
+            entry->key = NULL;
+
+            if (key_len)
+            {
+                memcpy(entry->data + user_len + protocol_len, key, key_len);
+                entry->key = entry->data + user_len + protocol_len;
+            }
+
+            PERSIST_ENTRY **bucket = &pool->buckets[entry->hash % pool->n_buckets];
+            entry->next = *bucket;
+            *bucket = entry;
+            pool->n_entries++;
+        }
+    }
+
+    return entry;
+}
+
+/**
+ * @brief Free a list that has no more connections
+ */
+static void persist_free_entry(PERSIST_ENTRY *entry)
+{
+    PERSIST_POOL *pool = entry->pool;
+    PERSIST_ENTRY **prev = &pool->buckets[entry->hash % pool->n_buckets];
+
+    while (*prev != entry)
+    {
+        prev = &(*prev)->next;
+    }
+
+    *prev = entry->next;
+    pool->n_entries--;
+    MXS_FREE(entry);
+}
+
+/**
+ * @brief Add a connection to the front of a list
+ */
+static void persist_link(PERSIST_ENTRY *entry, DCB *dcb, int type)
+{
+    DCB_POOL_LINK *link = &dcb->pool_links[type];
+    link->entry = entry;
+    link->prev = NULL;
+    link->next = entry->first;
+
+    if (entry->first)
+    {
+        entry->first->pool_links[type].prev = dcb;
+    }
+
+    entry->first = dcb;
+}
+
+/**
+ * @brief Remove a connection from a list, the list is freed when it becomes empty
+ */
+static void persist_unlink(DCB *dcb, int type)
+{
+    DCB_POOL_LINK *link = &dcb->pool_links[type];
+    PERSIST_ENTRY *entry = link->entry;
+
+    if (entry)
+    {
+        if (link->prev)
+        {
+            link->prev->pool_links[type].next = link->next;
+        }
+        else
+        {
+            entry->first = link->next;
+        }
+
+        if (link->next)
+        {
+            link->next->pool_links[type].prev = link->prev;
+        }
+
+        link->next = NULL;
+        link->prev = NULL;
+        link->entry = NULL;
+
+        if (entry->first == NULL)
+        {
+            persist_free_entry(entry);
+        }
+    }
+}
+
+bool persistpool_add(PERSIST_POOL *pool, DCB *dcb)
+{
+    ss_dassert(dcb->user && dcb->protoname);
+    PERSIST_ENTRY *by_user = persist_get(pool, PERSIST_BY_USER, dcb->user, dcb->protoname, NULL);
+
+    if (by_user == NULL)
+    {
+        return false;
+    }
+
+    PERSIST_ENTRY *by_key = NULL;
+
+    if (dcb->persistkey &&
+        (by_key = persist_get(pool, PERSIST_BY_KEY, dcb->user, dcb->protoname, dcb->persistkey)) == NULL)
+    {
+        if (by_user->first == NULL)
+        {
+            persist_free_entry(by_user);
+        }
+
+        return false;
+    }
+
+    persist_link(by_user, dcb, PERSIST_BY_USER);
+
+    if (by_key)
+    {
+        persist_link(by_key, dcb, PERSIST_BY_KEY);
+    }
+
+    pool->n_dcbs++;
+    return true;
+}
+
+void persistpool_remove(DCB *dcb)
+{
+    PERSIST_ENTRY *entry = dcb->pool_links[PERSIST_BY_USER].entry;
+
+    if (entry)
+    {
+        entry->pool->n_dcbs--;
+        persist_unlink(dcb, PERSIST_BY_KEY);
+        persist_unlink(dcb, PERSIST_BY_USER);
+    }
+}
+
+DCB* persistpool_take(PERSIST_POOL *pool, const char *user, const char *protocol, const char *key)
+{
+    PERSIST_ENTRY *entry = key ? persist_find(pool, PERSIST_BY_KEY, user, protocol, key) : NULL;
+
+    if (entry == NULL)
+    {
+        entry = persist_find(pool, PERSIST_BY_USER, user, protocol, NULL);
+    }
+
+    DCB *dcb = entry ? entry->first : NULL;
+
+    if (dcb)
+    {
+        persistpool_remove(dcb);
+    }
+
+    return dcb;
+}
+
+DCB* persistpool_extract(PERSIST_POOL *pool, bool (*match)(DCB *dcb, void *data), void *data)
+{
+    /** The connections are removed after the walk as removing them frees the lists */
+    DCB *matched[pool->n_dcbs + 1];
+    int n_matched = 0;
+
+    for (int i = 0; i < pool->n_buckets; i++)
+    {
+        for (PERSIST_ENTRY *entry = pool->buckets[i]; entry; entry = entry->next)
+        {
+            if (entry->type == PERSIST_BY_USER)
+            {
+                for (DCB *dcb = entry->first; dcb; dcb = dcb->pool_links[PERSIST_BY_USER].next)
+                {
+                    if (match(dcb, data))
+                    {
+                        matched[n_matched++] = dcb;
+                    }
+                }
+            }
+        }
+    }
+
+    DCB *removed = NULL;
+
+    for (int i = 0; i < n_matched; i++)
+    {
+        persistpool_remove(matched[i]);
+        matched[i]->pool_links[PERSIST_BY_USER].next = removed;
+        removed = matched[i];
+    }
+
+    return removed;
+}
@@ -13,6 +13,9 @@
 
 #include <maxscale/poll.h>
 
+#include <sys/eventfd.h>
+#include <time.h>
+
 #include <errno.h>
 #include <inttypes.h>
 #include <signal.h>
@@ -28,8 +31,11 @@
 #include <maxscale/atomic.h>
 #include <maxscale/config.h>
 #include <maxscale/dcb.h>
+#include <maxscale/hk_heartbeat.h>
 #include <maxscale/housekeeper.h>
+#include <maxscale/listener.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/metrics.h>
 #include <maxscale/platform.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/resultset.h>
@@ -39,7 +45,15 @@
 #include <maxscale/thread.h>
 #include <maxscale/utils.h>
 
+#include "maxscale/buffer.h"
+#include "maxscale/epoch.h"
+#include "maxscale/housekeeper.h"
 #include "maxscale/poll.h"
+#include "maxscale/pool.h"
+#include "maxscale/profiler.h"
+#include "maxscale/statistics.h"
+#include "maxscale/timer.h"
+#include "maxscale/uring.h"
 
 #define         PROFILE_POLL    0
 
@@ -84,22 +98,54 @@ int max_poll_sleep;
  */
 #define MUTEX_EPOLL     0
 
+/** The number of fake events that fit into the queue of one thread, a power of two */
+#define FAKE_EVENT_QUEUE_SIZE 4096
+
 /** Fake epoll event struct */
 typedef struct fake_event
 {
+    size_t             seq;   /*< Slot sequence number, only used in the ring */
     DCB               *dcb;   /*< The DCB where this event was generated */
     GWBUF             *data;  /*< Fake data, placed in the DCB's read queue */
     uint32_t           event; /*< The EPOLL event type */
-    struct fake_event *tail;  /*< The last event */
-    struct fake_event *next;  /*< The next event */
+    struct fake_event *tail;  /*< The last event, only used in the overflow list */
+    struct fake_event *next;  /*< The next event, only used in the overflow list */
 } fake_event_t;
 
+/**
+ * The fake event queue of one thread
+ *
+ * The events are stored in a bounded ring buffer with multiple producers and
+ * the owning thread as the only consumer. If the ring is full, the events
+ * are stored in an allocated overflow list. While the overflow list is in
+ * use, all new events go to it so that the events are processed in the order
+ * they were added. The eventfd wakes up the owning thread if it is blocked in
+ * epoll_wait.
+ */
+typedef struct fake_event_queue
+{
+    fake_event_t  ring[FAKE_EVENT_QUEUE_SIZE]; /*< The ring buffer */
+    size_t        enqueue_pos;                 /*< Next position to write to */
+    size_t        dequeue_pos;                 /*< Next position to read from */
+    int           overflowing;                 /*< Whether the overflow list is in use */
+    fake_event_t *overflow;                    /*< The overflow list */
+    SPINLOCK      overflow_lock;               /*< Protects the overflow list */
+    int           wakeup_fd;                   /*< The eventfd of the thread */
+    int           wakeup_pending;              /*< Whether the eventfd has been signaled */
+    int64_t       wakeup_time;                 /*< When the eventfd was signaled, in microseconds */
+} fake_event_queue_t;
+
 thread_local int current_thread_id; /**< This thread's ID */
+static thread_local bool is_worker_thread = false; /**< Whether this is a polling thread */
 static int *epoll_fd;    /*< The epoll file descriptor */
+static MXS_URING **rings = NULL; /*< The io_uring instances if the io_uring engine is used */
+
+/** The size of the submission queue of each io_uring instance */
+#define POLL_URING_ENTRIES 1024
 static int next_epoll_fd = 0; /*< Which thread handles the next DCB */
-static fake_event_t **fake_events; /*< Thread-specific fake event queue */
-static SPINLOCK      *fake_event_lock;
+static fake_event_queue_t *fake_events; /*< Thread-specific fake event queue */
 static int do_shutdown = 0;  /*< Flag the shutdown of the poll subsystem */
+static int worker_task_marker; /*< The epoll data of the worker task timers */
 
 /** Poll cross-thread messaging variables */
 static volatile int     *poll_msg;
@@ -112,9 +158,15 @@ static simple_mutex_t epoll_wait_mutex; /*< serializes calls to epoll_wait */
 static int n_waiting = 0;    /*< No. of threads in epoll_wait */
 
 static int process_pollq(int thread_id, struct epoll_event *event);
+static void poll_process_fake_events(int thread_id);
 static void poll_add_event_to_dcb(DCB* dcb, GWBUF* buf, uint32_t ev);
 static bool poll_dcb_session_check(DCB *dcb, const char *);
 static void poll_check_message(void);
+static void poll_schedule_events(int thread_id, struct epoll_event *events, int nfds,
+                                 int64_t poll_return_time);
+static void poll_purge_deferred(int thread_id);
+static void poll_process_accepts(int thread_id);
+static int64_t poll_accept_delay(int thread_id);
 
 DCB *eventq = NULL;
 SPINLOCK pollqlock = SPINLOCK_INIT;
@@ -134,6 +186,13 @@ static int n_avg_samples;
 
 /* Thread statistics data */
 static int n_threads;      /*< No. of threads */
+static int n_active_threads; /*< No. of threads that new sessions are given to */
+
+/**
+ * Serializes the changes of the active threads with the adding and removing
+ * of listeners to the poll sets of the active threads
+ */
+static SPINLOCK active_lock = SPINLOCK_INIT;
 
 /**
  * Internal MaxScale thread states
@@ -158,10 +217,73 @@ typedef struct
     DCB *cur_dcb;       /*< Current DCB being processed */
     uint32_t event;     /*< Current event being processed */
     uint64_t cycle_start; /*< The time when the poll loop was started */
+    uint64_t n_events;  /*< No. of events this thread has processed */
+    uint64_t n_prev_events; /*< The value of n_events at the last load calculation */
+    uint64_t load;      /*< Events processed during the last POLL_LOAD_FREQ seconds */
+    int migrate_to;     /*< The thread where idle sessions are moved */
+    int migrate_count;  /*< How many idle sessions are still moved */
+    uint64_t n_migrated; /*< No. of sessions moved away from this thread */
 } THREAD_DATA;
 
 static THREAD_DATA *thread_data = NULL;    /*< Status of each thread */
 
+/**
+ * Latency histograms of one thread. Bucket 0 counts the values below one
+ * microsecond and bucket N the values from 2^(N-1) up to 2^N microseconds.
+ * The last bucket counts all larger values.
+ */
+typedef struct
+{
+    uint64_t wakeup[N_LATENCY_BUCKETS];   /*< From eventfd signal to epoll_wait return */
+    uint64_t dispatch[N_LATENCY_BUCKETS]; /*< From epoll_wait return to event dispatch */
+} POLL_LATENCY;
+
+static POLL_LATENCY *latency_stats = NULL; /*< Latency histograms of each thread */
+
+/**
+ * The share of the time of a thread that each priority class gets when the
+ * sessions of several classes have events to process
+ */
+static const int priority_weights[SESSION_PRIORITY_N] = {4, 2, 1};
+
+/** The time a class of weight one may use in one poll cycle, in microseconds */
+#define PRIORITY_QUANTUM_US 1000
+
+/**
+ * A listener whose connections are accepted later
+ */
+typedef struct
+{
+    DCB     *listener;            /*< The listener */
+    int64_t  due;                 /*< When to accept, in microseconds */
+} POLL_DEFERRED_ACCEPT;
+
+/**
+ * The priority scheduling of the events of one thread. The events of a class
+ * that has used up its share of the cycle are deferred to the next cycle.
+ */
+typedef struct
+{
+    struct epoll_event *work;     /*< The deferred events followed by the new ones */
+    int      n_work;              /*< No. of events in work */
+    int      n_deferred;          /*< No. of events deferred from the previous cycle */
+    int      size;                /*< Allocated size of work */
+    int64_t  deficit[SESSION_PRIORITY_N];     /*< Time the class may still use, in microseconds */
+    uint64_t n_processed[SESSION_PRIORITY_N]; /*< Events processed while classes competed */
+    uint64_t n_delayed[SESSION_PRIORITY_N];   /*< Events deferred to the next cycle */
+    POLL_DEFERRED_ACCEPT *accepts; /*< The listeners with deferred accepts */
+    int      n_accepts;           /*< No. of listeners in accepts */
+    int      accepts_size;        /*< Allocated size of accepts */
+    unsigned int n_accepted;      /*< Connections accepted in this cycle */
+    uint64_t n_accept_deferrals;  /*< Times the accepts of a cycle were cut short */
+} POLL_SCHEDULE;
+
+static POLL_SCHEDULE *schedules = NULL; /*< Priority scheduling of each thread */
+static mxs_poll_mode_t poll_mode = MXS_POLL_ADAPTIVE; /*< How the threads wait for events */
+static bool session_rebalancing = false;     /*< Whether idle sessions are moved between threads */
+static int64_t poll_spin_budget = 0;        /*< Microseconds to spin in MXS_POLL_SPIN mode */
+static unsigned int accept_batch_size = 0;  /*< Connections accepted in one cycle, 0 for no limit */
+
 /**
  * The number of buckets used to gather statistics about how many
  * descriptors where processed on each epoll completion.
@@ -210,6 +332,18 @@ static struct
  * average of the poll subsystem.
  */
 #define POLL_LOAD_FREQ 10
+
+/**
+ * The minimum number of events a thread must process in POLL_LOAD_FREQ seconds
+ * before its sessions are moved to other threads
+ */
+#define POLL_REBALANCE_MIN_LOAD 1000
+
+/**
+ * The maximum number of idle sessions moved away from a thread after each
+ * load calculation
+ */
+#define POLL_REBALANCE_BATCH 10
 /**
  * Periodic function to collect load data for average calculations
  */
@@ -219,6 +353,56 @@ static void poll_loadav(void *);
  * Function to analyse error return from epoll_ctl
  */
 static int poll_resolve_error(DCB *, int, bool);
+static int poll_ctl_add(int thread_id, int fd, struct epoll_event *ev);
+static bool poll_uring_rearm(void *data, int *fd, uint32_t *events);
+
+/** Profile a protocol callback of a DCB that has a session */
+#define POLL_PROFILE_ENTER(callback, dcb)                                          \
+    do                                                                             \
+    {                                                                              \
+        if (profiler_active)                                                       \
+        {                                                                          \
+            profiler_enter((callback), (dcb)->protoname, (dcb)->session->ses_id);  \
+        }                                                                          \
+    } while (0)
+
+#define POLL_PROFILE_LEAVE()                                                       \
+    do                                                                             \
+    {                                                                              \
+        if (profiler_active)                                                       \
+        {                                                                          \
+            profiler_leave();                                                      \
+        }                                                                          \
+    } while (0)
+
+/**
+ * Register the polling statistics as metrics
+ */
+static void
+poll_register_metrics()
+{
+    static const char events[] = "maxscale_events_total";
+    static const char events_help[] = "Number of events processed by the worker threads";
+
+    mxs_metric_create_stats(events, events_help, MXS_METRIC_COUNTER, "type", "read",
+                            pollStats.n_read, TS_STATS_SUM);
+    mxs_metric_create_stats(events, events_help, MXS_METRIC_COUNTER, "type", "write",
+                            pollStats.n_write, TS_STATS_SUM);
+    mxs_metric_create_stats(events, events_help, MXS_METRIC_COUNTER, "type", "error",
+                            pollStats.n_error, TS_STATS_SUM);
+    mxs_metric_create_stats(events, events_help, MXS_METRIC_COUNTER, "type", "hangup",
+                            pollStats.n_hup, TS_STATS_SUM);
+    mxs_metric_create_stats(events, events_help, MXS_METRIC_COUNTER, "type", "accept",
+                            pollStats.n_accept, TS_STATS_SUM);
+    mxs_metric_create_stats("maxscale_polls_total", "Number of epoll cycles",
+                            MXS_METRIC_COUNTER, NULL, NULL, pollStats.n_polls, TS_STATS_SUM);
+    mxs_metric_create_stats("maxscale_polls_with_events_total",
+                            "Number of epoll cycles that returned events",
+                            MXS_METRIC_COUNTER, NULL, NULL, pollStats.n_pollev, TS_STATS_SUM);
+    mxs_metric_create_stats("maxscale_event_queue_length_max",
+                            "Largest number of events returned by one epoll cycle",
+                            MXS_METRIC_GAUGE, NULL, NULL, pollStats.evq_max, TS_STATS_MAX);
+}
 
 /**
  * Initialise the polling system we are using for the gateway.
@@ -229,13 +413,41 @@ void
 poll_init()
 {
     n_threads = config_threadcount();
+    n_active_threads = MXS_MIN(config_get_global_options()->n_threads, n_threads);
+
+    if (config_get_global_options()->poll_engine == MXS_POLL_ENGINE_IO_URING)
+    {
+        if (uring_supported())
+        {
+            if ((rings = MXS_CALLOC(n_threads, sizeof(MXS_URING*))) == NULL)
+            {
+                exit(-1);
+            }
+
+            for (int i = 0; i < n_threads; i++)
+            {
+                if ((rings[i] = uring_create(POLL_URING_ENTRIES, poll_uring_rearm)) == NULL)
+                {
+                    MXS_ERROR("FATAL: Could not create the io_uring instance of thread %d.", i);
+                    exit(-1);
+                }
+            }
+
+            MXS_NOTICE("Using the io_uring poll engine.");
+        }
+        else
+        {
+            MXS_WARNING("The io_uring poll engine is not supported by this system, "
+                        "using epoll instead.");
+        }
+    }
 
     if (!(epoll_fd = MXS_MALLOC(sizeof(int) * n_threads)))
     {
         return;
     }
 
-    for (int i = 0; i < n_threads; i++)
+    for (int i = 0; i < n_threads && rings == NULL; i++)
     {
         if ((epoll_fd[i] = epoll_create(MAX_EVENTS)) == -1)
         {
@@ -245,24 +457,77 @@ poll_init()
         }
     }
 
-    if ((fake_events = MXS_CALLOC(n_threads, sizeof(fake_event_t*))) == NULL)
+    if ((fake_events = MXS_CALLOC(n_threads, sizeof(fake_event_queue_t))) == NULL)
     {
         exit(-1);
     }
 
-    if ((fake_event_lock = MXS_CALLOC(n_threads, sizeof(SPINLOCK))) == NULL)
+    if ((poll_msg = MXS_CALLOC(n_threads, sizeof(int))) == NULL)
     {
         exit(-1);
     }
 
-    if ((poll_msg = MXS_CALLOC(n_threads, sizeof(int))) == NULL)
+    if (!gwbuf_cache_init(n_threads))
+    {
+        exit(-1);
+    }
+
+    if (!timer_wheel_init(n_threads, hkheartbeat))
+    {
+        exit(-1);
+    }
+
+    if ((latency_stats = MXS_CALLOC(n_threads, sizeof(POLL_LATENCY))) == NULL)
+    {
+        exit(-1);
+    }
+
+    if ((schedules = MXS_CALLOC(n_threads, sizeof(POLL_SCHEDULE))) == NULL)
     {
         exit(-1);
     }
 
     for (int i = 0; i < n_threads; i++)
     {
-        spinlock_init(&fake_event_lock[i]);
+        fake_event_queue_t *queue = &fake_events[i];
+        struct epoll_event ev;
+
+        for (size_t j = 0; j < FAKE_EVENT_QUEUE_SIZE; j++)
+        {
+            queue->ring[j].seq = j;
+        }
+
+        spinlock_init(&queue->overflow_lock);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = queue;
+
+        if ((queue->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+            poll_ctl_add(i, queue->wakeup_fd, &ev) == -1)
+        {
+            MXS_ERROR("FATAL: Could not create the event queue of thread %d: %s",
+                      i, mxs_strerror(errno));
+            exit(-1);
+        }
+    }
+
+    if (!hk_worker_init(n_threads))
+    {
+        exit(-1);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &worker_task_marker;
+
+        if (poll_ctl_add(i, hk_worker_fd(i), &ev) == -1)
+        {
+            MXS_ERROR("FATAL: Could not add the task timer of thread %d: %s",
+                      i, mxs_strerror(errno));
+            exit(-1);
+        }
     }
 
     memset(&pollStats, 0, sizeof(pollStats));
@@ -273,6 +538,12 @@ poll_init()
         for (int i = 0; i < n_threads; i++)
         {
             thread_data[i].state = THREAD_STOPPED;
+            thread_data[i].n_events = 0;
+            thread_data[i].n_prev_events = 0;
+            thread_data[i].load = 0;
+            thread_data[i].migrate_to = 0;
+            thread_data[i].migrate_count = 0;
+            thread_data[i].n_migrated = 0;
         }
     }
 
@@ -295,6 +566,9 @@ poll_init()
         exit(-1);
     }
 
+    poll_register_metrics();
+    profiler_init(n_threads);
+
 #if MUTEX_EPOLL
     simple_mutex_init(&epoll_wait_mutex, "epoll_wait_mutex");
 #endif
@@ -316,6 +590,212 @@ poll_init()
 
     number_poll_spins = config_nbpolls();
     max_poll_sleep = config_pollsleep();
+    poll_mode = config_get_global_options()->poll_mode;
+    poll_spin_budget = config_get_global_options()->poll_spin_budget;
+    session_rebalancing = config_get_global_options()->session_rebalancing;
+    accept_batch_size = config_get_global_options()->accept_batch_size;
+}
+
+/**
+ * @return The monotonic time in microseconds
+ */
+static inline int64_t poll_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Add a value to a latency histogram
+ *
+ * @param histogram The histogram with N_LATENCY_BUCKETS buckets
+ * @param usecs     The latency in microseconds
+ */
+static inline void poll_add_latency(uint64_t *histogram, int64_t usecs)
+{
+    int bucket = usecs > 0 ? 64 - __builtin_clzll(usecs) : 0;
+    histogram[MXS_MIN(bucket, N_LATENCY_BUCKETS - 1)]++;
+}
+
+/**
+ * Check whether a thread has fake events waiting
+ *
+ * The events that a thread adds for itself do not signal its wakeup eventfd,
+ * so the thread must not block while any of them are queued.
+ *
+ * @param thread_id The thread ID
+ * @return True if the fake event ring or the overflow list is not empty
+ */
+static inline bool poll_fake_events_pending(int thread_id)
+{
+    fake_event_queue_t *queue = &fake_events[thread_id];
+    return queue->dequeue_pos != __atomic_load_n(&queue->enqueue_pos, __ATOMIC_ACQUIRE) ||
+           atomic_load_int32(&queue->overflowing);
+}
+
+/**
+ * Check whether the thread should do a blocking epoll_wait
+ *
+ * @param poll_spins      Number of non-blocking polls without events
+ * @param last_event_time When the thread last had events to process
+ * @return True if the next call should block
+ */
+static inline bool poll_should_block(int poll_spins, int64_t last_event_time)
+{
+    switch (poll_mode)
+    {
+    case MXS_POLL_BLOCKING:
+        return true;
+
+    case MXS_POLL_SPIN:
+        return poll_now_us() - last_event_time >= poll_spin_budget;
+
+    default:
+        return poll_spins > number_poll_spins;
+    }
+}
+
+/**
+ * Get the listener socket that is added to the epoll instance of a thread
+ *
+ * @param dcb       Listener DCB
+ * @param thread_id The thread ID
+ * @return The per-thread socket of a sharded listener, otherwise the only socket
+ */
+static inline int poll_listener_fd(DCB *dcb, int thread_id)
+{
+    return dcb->listener_fds ? dcb->listener_fds[thread_id] : dcb->fd;
+}
+
+/**
+ * @return The number of threads that new sessions are given to
+ */
+static inline int poll_active_threads()
+{
+    return atomic_load_int32(&n_active_threads);
+}
+
+/**
+ * Get the thread that handles the next new DCB
+ *
+ * @return The ID of an active thread
+ */
+static inline int poll_next_owner()
+{
+    return (unsigned int)atomic_add(&next_epoll_fd, 1) % poll_active_threads();
+}
+
+/**
+ * Get the number of threads whose poll sets contain a listener
+ *
+ * The per-thread sockets of a sharded listener are in the poll sets of all
+ * threads as the kernel gives connections to every socket. A thread that is
+ * not active gives the connections it accepts to the active ones.
+ *
+ * @param dcb Listener DCB
+ * @return The listener is in the poll sets of the threads below this
+ */
+static inline int poll_listener_threads(DCB *dcb)
+{
+    return dcb->listener_fds ? n_threads : n_active_threads;
+}
+
+/**
+ * @return The events that DCBs are registered for
+ */
+static inline uint32_t poll_dcb_events()
+{
+#ifdef EPOLLRDHUP
+    return EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
+#else
+    return EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
+#endif
+}
+
+/**
+ * Start watching a file descriptor in the poll set of a thread
+ *
+ * @param thread_id The thread ID
+ * @param fd        File descriptor
+ * @param ev        The events to watch for and the data returned with them
+ * @return 0 on success, -1 with errno set on error
+ */
+static int poll_ctl_add(int thread_id, int fd, struct epoll_event *ev)
+{
+    if (rings)
+    {
+        bool owner = is_worker_thread && thread_id == current_thread_id;
+        return uring_add(rings[thread_id], fd, ev->events, ev->data.ptr, owner);
+    }
+
+    return epoll_ctl(epoll_fd[thread_id], EPOLL_CTL_ADD, fd, ev);
+}
+
+/**
+ * Stop watching a file descriptor in the poll set of a thread
+ *
+ * @param thread_id The thread ID
+ * @param fd        File descriptor
+ * @param data      The data given to poll_ctl_add
+ * @return 0 on success, -1 with errno set on error
+ */
+static int poll_ctl_del(int thread_id, int fd, void *data)
+{
+    if (rings)
+    {
+        bool owner = is_worker_thread && thread_id == current_thread_id;
+        return uring_remove(rings[thread_id], data, owner);
+    }
+
+    struct epoll_event ev;
+    return epoll_ctl(epoll_fd[thread_id], EPOLL_CTL_DEL, fd, &ev);
+}
+
+/**
+ * Wait for events in the poll set of the calling thread
+ *
+ * @param thread_id The thread ID of the caller
+ * @param events    Where the events are stored
+ * @param timeout   Timeout in milliseconds, 0 for no wait
+ * @return Number of events or -1 on error
+ */
+static inline int poll_wait(int thread_id, struct epoll_event *events, int timeout)
+{
+    if (rings)
+    {
+        return uring_wait(rings[thread_id], events, MAX_EVENTS, timeout);
+    }
+
+    return epoll_wait(epoll_fd[thread_id], events, MAX_EVENTS, timeout);
+}
+
+/**
+ * Find what an ended io_uring poll request watched, so that it can be
+ * submitted again. Called by the thread that owns the ring.
+ */
+static bool poll_uring_rearm(void *data, int *fd, uint32_t *events)
+{
+    int thread_id = current_thread_id;
+
+    if (data == &fake_events[thread_id])
+    {
+        *fd = fake_events[thread_id].wakeup_fd;
+        *events = EPOLLIN;
+    }
+    else if (data == &worker_task_marker)
+    {
+        *fd = hk_worker_fd(thread_id);
+        *events = EPOLLIN;
+    }
+    else
+    {
+        DCB *dcb = (DCB*)data;
+        *fd = dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER ? poll_listener_fd(dcb, thread_id) : dcb->fd;
+        *events = poll_dcb_events();
+    }
+
+    return true;
 }
 
 int poll_add_dcb(DCB *dcb)
@@ -327,11 +807,7 @@ int poll_add_dcb(DCB *dcb)
 
     CHK_DCB(dcb);
 
-#ifdef EPOLLRDHUP
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
-#else
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLET;
-#endif
+    ev.events = poll_dcb_events();
     ev.data.ptr = dcb;
 
     /*<
@@ -381,39 +857,59 @@ int poll_add_dcb(DCB *dcb)
     {
         owner = dcb->session->client_dcb->thread.id;
     }
+    else if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER && dcb->listener &&
+             dcb->listener->listener && dcb->listener->listener->listener_fds &&
+             current_thread_id < poll_active_threads())
+    {
+        /** Connections accepted from a per-thread listener socket stay in the accepting thread */
+        owner = current_thread_id;
+    }
     else
     {
-        owner = (unsigned int)atomic_add(&next_epoll_fd, 1) % n_threads;
+        owner = poll_next_owner();
     }
 
     dcb->thread.id = owner;
 
+    if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER)
+    {
+        /** The active threads must not change before the listener is in their poll sets */
+        spinlock_acquire(&active_lock);
+    }
+
     dcb_add_to_list(dcb);
 
+    if (dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    {
+        dcb_start_idle_timer(dcb);
+    }
+
     int error_num = 0;
 
     if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER)
     {
-        /** Listeners are added to all epoll instances */
-        int nthr = config_threadcount();
+        /** Listeners are added to the epoll instances of the active threads */
+        int nthr = poll_listener_threads(dcb);
 
         for (int i = 0; i < nthr; i++)
         {
-            if ((rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_ADD, dcb->fd, &ev)))
+            if ((rc = poll_ctl_add(i, poll_listener_fd(dcb, i), &ev)))
             {
                 error_num = errno;
                 /** Remove the listener from the previous epoll instances */
                 for (int j = 0; j < i; j++)
                 {
-                    epoll_ctl(epoll_fd[j], EPOLL_CTL_DEL, dcb->fd, &ev);
+                    poll_ctl_del(j, poll_listener_fd(dcb, j), dcb);
                 }
                 break;
             }
         }
+
+        spinlock_release(&active_lock);
     }
     else
     {
-        if ((rc = epoll_ctl(epoll_fd[owner], EPOLL_CTL_ADD, dcb->fd, &ev)))
+        if ((rc = poll_ctl_add(owner, dcb->fd, &ev)))
         {
             error_num = errno;
         }
@@ -441,7 +937,6 @@ int poll_add_dcb(DCB *dcb)
 int poll_remove_dcb(DCB *dcb)
 {
     int dcbfd, rc = 0;
-    struct  epoll_event ev;
     CHK_DCB(dcb);
 
     /*< It is possible that dcb has already been removed from the set */
@@ -479,12 +974,13 @@ int poll_remove_dcb(DCB *dcb)
 
         if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER)
         {
-            /** Listeners are added to all epoll instances */
-            int nthr = config_threadcount();
+            /** Listeners are in the epoll instances of the active threads */
+            spinlock_acquire(&active_lock);
+            int nthr = poll_listener_threads(dcb);
 
             for (int i = 0; i < nthr; i++)
             {
-                int tmp_rc = epoll_ctl(epoll_fd[i], EPOLL_CTL_DEL, dcb->fd, &ev);
+                int tmp_rc = poll_ctl_del(i, poll_listener_fd(dcb, i), dcb);
                 if (tmp_rc && rc == 0)
                 {
                     /** Even if one of the instances failed to remove it, try
@@ -494,10 +990,12 @@ int poll_remove_dcb(DCB *dcb)
                     ss_dassert(error_num);
                 }
             }
+
+            spinlock_release(&active_lock);
         }
         else
         {
-            if ((rc = epoll_ctl(epoll_fd[dcb->thread.id], EPOLL_CTL_DEL, dcbfd, &ev)))
+            if ((rc = poll_ctl_del(dcb->thread.id, dcbfd, dcb)))
             {
                 error_num = errno;
             }
@@ -519,6 +1017,68 @@ int poll_remove_dcb(DCB *dcb)
     return rc;
 }
 
+bool poll_detach_dcb(DCB *dcb)
+{
+    ss_dassert(dcb->dcb_role != DCB_ROLE_SERVICE_LISTENER);
+
+    if (poll_ctl_del(dcb->thread.id, dcb->fd, dcb) != 0)
+    {
+        MXS_ERROR("Failed to remove DCB %p from the epoll instance of thread %d: %d, %s",
+                  dcb, dcb->thread.id, errno, mxs_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool poll_attach_dcb(DCB *dcb)
+{
+    struct epoll_event ev;
+    ev.events = poll_dcb_events();
+    ev.data.ptr = dcb;
+
+    if (poll_ctl_add(dcb->thread.id, dcb->fd, &ev) != 0)
+    {
+        MXS_ERROR("Failed to add DCB %p to the epoll instance of thread %d: %d, %s",
+                  dcb, dcb->thread.id, errno, mxs_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Move idle sessions away from this thread if the housekeeper has asked for it
+ *
+ * A thread that is no longer active moves all of its sessions to the active
+ * threads as soon as they are idle.
+ *
+ * @param thread_id The thread ID
+ */
+static void poll_migrate_sessions(int thread_id)
+{
+    if (atomic_load_int32(&thread_data[thread_id].migrate_count) > 0)
+    {
+        bool retired = thread_id >= poll_active_threads();
+        int to = retired ? poll_next_owner() : atomic_load_int32(&thread_data[thread_id].migrate_to);
+
+        if (dcb_migrate_idle_session(thread_id, to))
+        {
+            thread_data[thread_id].n_migrated++;
+
+            if (!retired)
+            {
+                atomic_add(&thread_data[thread_id].migrate_count, -1);
+            }
+        }
+        else
+        {
+            /** No idle sessions, try again after the next load calculation */
+            atomic_store_int32(&thread_data[thread_id].migrate_count, 0);
+        }
+    }
+}
+
 /**
  * Check error returns from epoll_ctl. Most result in a crash since they
  * are "impossible". Adding when already present is assumed non-fatal.
@@ -655,8 +1215,28 @@ poll_waitevents(void *arg)
     int i, nfds, timeout_bias = 1;
     current_thread_id = (intptr_t)arg;
     int poll_spins = 0;
+    int64_t last_event_time = 0;
 
     int thread_id = current_thread_id;
+    is_worker_thread = true;
+    profiler_thread_init(thread_id);
+
+    int cpu = config_thread_cpu(thread_id);
+
+    /** The thread is pinned before it allocates anything so that the memory
+     * of its buffers and pools is allocated from the NUMA node of its CPU */
+    if (cpu != -1 && !thread_set_cpu(cpu))
+    {
+        MXS_ERROR("Failed to pin thread %d to CPU %d: %d, %s",
+                  thread_id, cpu, errno, mxs_strerror(errno));
+    }
+
+    gwbuf_thread_init(thread_id);
+    mxs_pool_thread_init(thread_id);
+    timer_wheel_thread_init(thread_id);
+    ts_stats_thread_init(thread_id);
+    mxs_epoch_thread_init(thread_id);
+    hk_worker_thread_init(thread_id);
 
     if (thread_data)
     {
@@ -665,6 +1245,7 @@ poll_waitevents(void *arg)
 
     while (1)
     {
+        int64_t accept_delay = poll_accept_delay(thread_id);
         atomic_add(&n_waiting, 1);
 #if BLOCKINGPOLL
         nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
@@ -679,7 +1260,9 @@ poll_waitevents(void *arg)
         }
 
         ts_stats_increment(pollStats.n_polls, thread_id);
-        if ((nfds = epoll_wait(epoll_fd[thread_id], events, MAX_EVENTS, 0)) == -1)
+
+        /** The blocking mode skips the non-blocking call */
+        if ((nfds = poll_mode == MXS_POLL_BLOCKING ? 0 : poll_wait(thread_id, events, 0)) == -1)
         {
             atomic_add(&n_waiting, -1);
             int eno = errno;
@@ -699,17 +1282,29 @@ poll_waitevents(void *arg)
          * We calculate a timeout bias to alter the length of the blocking
          * call based on the time since we last received an event to process
          */
-        else if (nfds == 0 && poll_spins++ > number_poll_spins)
+        else if (nfds == 0 && schedules[thread_id].n_deferred == 0 && accept_delay != 0 &&
+                 !poll_fake_events_pending(thread_id) &&
+                 poll_should_block(poll_spins++, last_event_time))
         {
+            int timeout = poll_mode == MXS_POLL_ADAPTIVE ?
+                          (max_poll_sleep * timeout_bias) / 10 : max_poll_sleep;
+
+            if (accept_delay > 0 && accept_delay < (int64_t)timeout * 1000)
+            {
+                /** Wake up when the deferred connections can be accepted */
+                timeout = (accept_delay + 999) / 1000;
+            }
+
             if (timeout_bias < 10)
             {
                 timeout_bias++;
             }
             ts_stats_increment(pollStats.blockingpolls, thread_id);
-            nfds = epoll_wait(epoll_fd[thread_id],
-                              events,
-                              MAX_EVENTS,
-                              (max_poll_sleep * timeout_bias) / 10);
+            /** A blocked thread must not hold up the freeing of objects */
+            mxs_epoch_offline();
+            /** Only the adaptive mode grows the timeout gradually */
+            nfds = poll_wait(thread_id, events, timeout);
+            mxs_epoch_online();
             if (nfds == 0)
             {
                 poll_spins = 0;
@@ -771,71 +1366,450 @@ poll_waitevents(void *arg)
 
         thread_data[thread_id].cycle_start = hkheartbeat;
 
-        /* Process of the queue of waiting requests */
-        for (int i = 0; i < nfds; i++)
+        int64_t poll_return_time = nfds > 0 ? poll_now_us() : 0;
+
+        if (nfds > 0)
         {
-            process_pollq(thread_id, &events[i]);
+            last_event_time = poll_return_time;
         }
 
-        fake_event_t *event = NULL;
+        thread_data[thread_id].n_events += nfds;
 
-        /** It is very likely that the queue is empty so to avoid hitting the
-         * spinlock every time we receive events, we only do a dirty read. Currently,
-         * only the monitors inject fake events from external threads. */
-        if (fake_events[thread_id])
-        {
-            spinlock_acquire(&fake_event_lock[thread_id]);
-            event = fake_events[thread_id];
-            fake_events[thread_id] = NULL;
-            spinlock_release(&fake_event_lock[thread_id]);
-        }
+        /** The connections left over from earlier cycles are accepted first */
+        poll_process_accepts(thread_id);
 
-        while (event)
-        {
-            struct epoll_event ev;
-            event->dcb->dcb_fakequeue = event->data;
-            ev.data.ptr = event->dcb;
-            ev.events = event->event;
-            process_pollq(thread_id, &ev);
-            fake_event_t *tmp = event;
-            event = event->next;
-            MXS_FREE(tmp);
-        }
+        /* Process of the queue of waiting requests */
+        poll_schedule_events(thread_id, events, nfds, poll_return_time);
+
+        poll_process_fake_events(thread_id);
 
-        dcb_process_idle_sessions(thread_id);
+        timer_wheel_process(hkheartbeat);
 
         if (thread_data)
         {
             thread_data[thread_id].state = THREAD_ZPROCESSING;
         }
 
-        /** Process closed DCBs */
+        /** Process closed DCBs, the deferred events must not refer to them */
+        poll_purge_deferred(thread_id);
         dcb_process_zombies(thread_id);
 
+        poll_migrate_sessions(thread_id);
+
         poll_check_message();
 
+        /** Nothing read without locks is referenced beyond this point */
+        mxs_epoch_quiescent();
+
         if (thread_data)
         {
             thread_data[thread_id].state = THREAD_IDLE;
         }
 
-        if (do_shutdown)
+        if (do_shutdown)
+        {
+            /*<
+             * Remove the thread from the bitmask of running
+             * polling threads.
+             */
+            if (thread_data)
+            {
+                thread_data[thread_id].state = THREAD_STOPPED;
+            }
+            gwbuf_thread_finish();
+            mxs_pool_thread_finish();
+            hk_worker_thread_finish();
+            mxs_epoch_thread_finish();
+            return;
+        }
+        if (thread_data)
+        {
+            thread_data[thread_id].state = THREAD_IDLE;
+        }
+    } /*< while(1) */
+}
+
+/**
+ * @brief Get the priority class of the event of a DCB
+ *
+ * The listeners and the DCBs without a real session are never held back.
+ *
+ * @param dcb The DCB
+ * @return The class of the session of the DCB
+ */
+static inline session_priority_t poll_dcb_priority(DCB *dcb)
+{
+    return dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER || dcb->session == NULL ?
+           SESSION_PRIORITY_HIGH : dcb->session->priority;
+}
+
+/**
+ * @brief Make room for the events of one cycle
+ *
+ * @param sched The schedule of the thread
+ * @param n     No. of new events
+ * @return False if memory allocation failed
+ */
+static bool poll_schedule_reserve(POLL_SCHEDULE *sched, int n)
+{
+    if (sched->n_deferred + n > sched->size)
+    {
+        int size = sched->n_deferred + n + MAX_EVENTS;
+        struct epoll_event *work = MXS_REALLOC(sched->work, size * sizeof(*work));
+
+        if (work == NULL)
+        {
+            return false;
+        }
+
+        sched->work = work;
+        sched->size = size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Process one event of the priority scheduling
+ *
+ * @param thread_id The thread ID
+ * @param event     The event, its DCB is no longer deferred
+ */
+static void poll_schedule_process(int thread_id, struct epoll_event *event)
+{
+    DCB *dcb = event->data.ptr;
+    dcb->poll_deferred = 0;
+
+    if (dcb->thread.id != thread_id && dcb->dcb_role != DCB_ROLE_SERVICE_LISTENER)
+    {
+        /** The session was moved to another thread while the event waited */
+        poll_add_event_to_dcb(dcb, NULL, event->events);
+    }
+    else
+    {
+        process_pollq(thread_id, event);
+    }
+}
+
+/**
+ * @brief Process the events of one poll cycle
+ *
+ * When the events are all of the same priority class, they are processed in
+ * the order they arrived. Otherwise the classes are processed from the
+ * highest to the lowest and each class gets a share of the cycle by its
+ * weight, measured by the time its events take. This is deficit round robin:
+ * a class that takes more than its share has less time in the next cycles
+ * for as long as the other classes have events. The events that did not fit
+ * in the share of their class are processed in the next cycle before the new
+ * events of the class.
+ *
+ * @param thread_id        The thread ID
+ * @param events           The new events
+ * @param nfds             No. of new events
+ * @param poll_return_time When the events were received
+ */
+static void poll_schedule_events(int thread_id, struct epoll_event *events, int nfds,
+                                 int64_t poll_return_time)
+{
+    POLL_SCHEDULE *sched = &schedules[thread_id];
+    int first = -1;
+    bool single_class = sched->n_deferred == 0;
+
+    for (int i = 0; i < nfds; i++)
+    {
+        if (events[i].data.ptr == &fake_events[thread_id])
+        {
+            /** The fake events are processed later */
+            uint64_t count;
+            ss_debug(ssize_t rc = ) read(fake_events[thread_id].wakeup_fd, &count, sizeof(count));
+            ss_dassert(rc == sizeof(count) || errno == EAGAIN);
+            poll_add_latency(latency_stats[thread_id].wakeup,
+                             poll_return_time - fake_events[thread_id].wakeup_time);
+            atomic_store_int32(&fake_events[thread_id].wakeup_pending, 0);
+            events[i].data.ptr = NULL;
+        }
+        else if (events[i].data.ptr == &worker_task_marker)
+        {
+            hk_worker_process();
+            events[i].data.ptr = NULL;
+        }
+        else if (((DCB*)events[i].data.ptr)->dcb_role == DCB_ROLE_SERVICE_LISTENER)
+        {
+            /**
+             * The listeners are in the poll sets of several threads, so they are
+             * never deferred by the scheduling. The accept batching limits the
+             * time they take instead.
+             */
+            poll_add_latency(latency_stats[thread_id].dispatch, poll_now_us() - poll_return_time);
+            process_pollq(thread_id, &events[i]);
+            events[i].data.ptr = NULL;
+        }
+        else if (single_class)
+        {
+            int priority = poll_dcb_priority((DCB*)events[i].data.ptr);
+
+            if (first == -1)
+            {
+                first = priority;
+            }
+            else if (first != priority)
+            {
+                single_class = false;
+            }
+        }
+    }
+
+    if (single_class || !poll_schedule_reserve(sched, nfds))
+    {
+        /** Nothing competes with the events, no class is held back */
+        memset(sched->deficit, 0, sizeof(sched->deficit));
+
+        for (int i = 0; i < nfds; i++)
+        {
+            if (events[i].data.ptr)
+            {
+                poll_add_latency(latency_stats[thread_id].dispatch, poll_now_us() - poll_return_time);
+                process_pollq(thread_id, &events[i]);
+            }
+        }
+
+        return;
+    }
+
+    /** The new events of the deferred DCBs are merged with the deferred events */
+    sched->n_work = sched->n_deferred;
+
+    for (int i = 0; i < nfds; i++)
+    {
+        DCB *dcb = events[i].data.ptr;
+
+        if (dcb && dcb->poll_deferred)
+        {
+            sched->work[dcb->poll_deferred - 1].events |= events[i].events;
+        }
+        else if (dcb)
+        {
+            sched->work[sched->n_work] = events[i];
+            dcb->poll_deferred = ++sched->n_work;
+        }
+    }
+
+    int n_class[SESSION_PRIORITY_N] = {0};
+
+    for (int i = 0; i < sched->n_work; i++)
+    {
+        n_class[poll_dcb_priority((DCB*)sched->work[i].data.ptr)]++;
+    }
+
+    for (int c = 0; c < SESSION_PRIORITY_N; c++)
+    {
+        if (n_class[c] == 0)
+        {
+            sched->deficit[c] = 0;
+            continue;
+        }
+
+        sched->deficit[c] += priority_weights[c] * PRIORITY_QUANTUM_US;
+
+        for (int i = 0; i < sched->n_work && sched->deficit[c] > 0; i++)
+        {
+            DCB *dcb = sched->work[i].data.ptr;
+
+            /** A DCB whose session changed its class is processed in the new class */
+            if (dcb && poll_dcb_priority(dcb) == c)
+            {
+                int64_t start = poll_now_us();
+                poll_add_latency(latency_stats[thread_id].dispatch, start - poll_return_time);
+                struct epoll_event event = sched->work[i];
+                sched->work[i].data.ptr = NULL;
+                poll_schedule_process(thread_id, &event);
+                sched->deficit[c] -= MXS_MAX(poll_now_us() - start, 1);
+                sched->n_processed[c]++;
+            }
+        }
+    }
+
+    /** The rest wait for the next cycle */
+    sched->n_deferred = 0;
+
+    for (int i = 0; i < sched->n_work; i++)
+    {
+        DCB *dcb = sched->work[i].data.ptr;
+
+        if (dcb)
+        {
+            sched->n_delayed[poll_dcb_priority(dcb)]++;
+            sched->work[sched->n_deferred] = sched->work[i];
+            dcb->poll_deferred = ++sched->n_deferred;
+        }
+    }
+}
+
+bool poll_accept_budget_left()
+{
+    return !is_worker_thread || accept_batch_size == 0 ||
+           schedules[current_thread_id].n_accepted < accept_batch_size;
+}
+
+void poll_count_accept()
+{
+    if (is_worker_thread)
+    {
+        schedules[current_thread_id].n_accepted++;
+    }
+}
+
+void poll_defer_accept(DCB *listener, int64_t delay)
+{
+    if (!is_worker_thread)
+    {
+        return;
+    }
+
+    POLL_SCHEDULE *sched = &schedules[current_thread_id];
+    int64_t due = poll_now_us() + delay;
+
+    if (delay == 0)
+    {
+        sched->n_accept_deferrals++;
+    }
+
+    for (int i = 0; i < sched->n_accepts; i++)
+    {
+        if (sched->accepts[i].listener == listener)
+        {
+            sched->accepts[i].due = MXS_MIN(sched->accepts[i].due, due);
+            return;
+        }
+    }
+
+    if (sched->n_accepts == sched->accepts_size)
+    {
+        int size = sched->accepts_size + 8;
+        POLL_DEFERRED_ACCEPT *accepts = MXS_REALLOC(sched->accepts, size * sizeof(*accepts));
+
+        if (accepts == NULL)
+        {
+            /** The connections are accepted when the next one arrives */
+            return;
+        }
+
+        sched->accepts = accepts;
+        sched->accepts_size = size;
+    }
+
+    sched->accepts[sched->n_accepts].listener = listener;
+    sched->accepts[sched->n_accepts].due = due;
+    sched->n_accepts++;
+}
+
+/**
+ * @brief Get the time until the deferred connections can be accepted
+ *
+ * @param thread_id The thread ID
+ * @return -1 if there are no deferred connections, otherwise the number of
+ *         microseconds until the first ones can be accepted
+ */
+static int64_t poll_accept_delay(int thread_id)
+{
+    POLL_SCHEDULE *sched = &schedules[thread_id];
+    int64_t delay = -1;
+
+    if (sched->n_accepts)
+    {
+        int64_t now = poll_now_us();
+
+        for (int i = 0; i < sched->n_accepts; i++)
+        {
+            int64_t wait = MXS_MAX(sched->accepts[i].due - now, 0);
+
+            if (delay == -1 || wait < delay)
+            {
+                delay = wait;
+            }
+        }
+    }
+
+    return delay;
+}
+
+/**
+ * @brief Start a new accept batch and accept the deferred connections that are due
+ *
+ * The listeners that still have connections left over defer themselves again.
+ *
+ * @param thread_id The thread ID
+ */
+static void poll_process_accepts(int thread_id)
+{
+    POLL_SCHEDULE *sched = &schedules[thread_id];
+    sched->n_accepted = 0;
+
+    if (sched->n_accepts == 0)
+    {
+        return;
+    }
+
+    int64_t now = poll_now_us();
+    DCB *due[sched->n_accepts];
+    int n_due = 0;
+    int n = 0;
+
+    for (int i = 0; i < sched->n_accepts; i++)
+    {
+        if (sched->accepts[i].due <= now)
+        {
+            due[n_due++] = sched->accepts[i].listener;
+        }
+        else
+        {
+            sched->accepts[n++] = sched->accepts[i];
+        }
+    }
+
+    sched->n_accepts = n;
+
+    for (int i = 0; i < n_due; i++)
+    {
+        /** A stopped listener is restarted with a new socket */
+        if (due[i]->state == DCB_STATE_LISTENING)
+        {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = due[i];
+            process_pollq(thread_id, &ev);
+        }
+    }
+}
+
+/**
+ * @brief Drop the deferred events of the DCBs that are no longer polled
+ *
+ * This is called before the closed DCBs are freed.
+ *
+ * @param thread_id The thread ID
+ */
+static void poll_purge_deferred(int thread_id)
+{
+    POLL_SCHEDULE *sched = &schedules[thread_id];
+    int n = 0;
+
+    for (int i = 0; i < sched->n_deferred; i++)
+    {
+        DCB *dcb = sched->work[i].data.ptr;
+
+        if (dcb->state == DCB_STATE_POLLING || dcb->state == DCB_STATE_LISTENING)
         {
-            /*<
-             * Remove the thread from the bitmask of running
-             * polling threads.
-             */
-            if (thread_data)
-            {
-                thread_data[thread_id].state = THREAD_STOPPED;
-            }
-            return;
+            sched->work[n] = sched->work[i];
+            dcb->poll_deferred = ++n;
         }
-        if (thread_data)
+        else
         {
-            thread_data[thread_id].state = THREAD_IDLE;
+            dcb->poll_deferred = 0;
         }
-    } /*< while(1) */
+    }
+
+    sched->n_deferred = n;
 }
 
 /**
@@ -943,7 +1917,9 @@ process_pollq(int thread_id, struct epoll_event *event)
 
             if (poll_dcb_session_check(dcb, "write_ready"))
             {
+                POLL_PROFILE_ENTER(PROFILE_WRITE_READY, dcb);
                 dcb->func.write_ready(dcb);
+                POLL_PROFILE_LEAVE();
             }
         }
         else
@@ -971,7 +1947,9 @@ process_pollq(int thread_id, struct epoll_event *event)
 
             if (poll_dcb_session_check(dcb, "accept"))
             {
+                POLL_PROFILE_ENTER(PROFILE_ACCEPT, dcb);
                 dcb->func.accept(dcb);
+                POLL_PROFILE_LEAVE();
             }
         }
         else
@@ -994,9 +1972,11 @@ process_pollq(int thread_id, struct epoll_event *event)
                                   dcb_accept_SSL(dcb) :
                                   dcb_connect_SSL(dcb);
                 }
-                if (1 == return_code)
+                if (1 == return_code && !dcb_pause_read(dcb))
                 {
+                    POLL_PROFILE_ENTER(PROFILE_READ, dcb);
                     dcb->func.read(dcb);
+                    POLL_PROFILE_LEAVE();
                 }
             }
         }
@@ -1017,7 +1997,9 @@ process_pollq(int thread_id, struct epoll_event *event)
 
         if (poll_dcb_session_check(dcb, "error"))
         {
+            POLL_PROFILE_ENTER(PROFILE_ERROR, dcb);
             dcb->func.error(dcb);
+            POLL_PROFILE_LEAVE();
         }
     }
 
@@ -1040,7 +2022,9 @@ process_pollq(int thread_id, struct epoll_event *event)
 
             if (poll_dcb_session_check(dcb, "hangup EPOLLHUP"))
             {
+                POLL_PROFILE_ENTER(PROFILE_HANGUP, dcb);
                 dcb->func.hangup(dcb);
+                POLL_PROFILE_LEAVE();
             }
         }
     }
@@ -1066,7 +2050,9 @@ process_pollq(int thread_id, struct epoll_event *event)
 
             if (poll_dcb_session_check(dcb, "hangup EPOLLRDHUP"))
             {
+                POLL_PROFILE_ENTER(PROFILE_HANGUP, dcb);
                 dcb->func.hangup(dcb);
+                POLL_PROFILE_LEAVE();
             }
         }
     }
@@ -1124,6 +2110,14 @@ void
 poll_shutdown()
 {
     do_shutdown = 1;
+
+    /** Wake up the threads blocked in epoll_wait */
+    for (int i = 0; i < n_threads; i++)
+    {
+        uint64_t one = 1;
+        ss_debug(ssize_t rc = ) write(fake_events[i].wakeup_fd, &one, sizeof(one));
+        ss_dassert(rc == sizeof(one));
+    }
 }
 
 /**
@@ -1373,6 +2367,32 @@ dShowThreads(DCB *dcb)
             }
         }
     }
+
+    dcb_printf(dcb, "\nActive threads: %d of %d\n", poll_active_threads(), n_threads);
+    dcb_printf(dcb, "\nThread Load.\n\n");
+    dcb_printf(dcb, " ID | Events in %2ds | Sessions moved away\n", POLL_LOAD_FREQ);
+    dcb_printf(dcb, "----+---------------+--------------------\n");
+    for (i = 0; i < n_threads; i++)
+    {
+        dcb_printf(dcb, " %2d | %13" PRIu64 " | %" PRIu64 "\n",
+                   i, thread_data[i].load, thread_data[i].n_migrated);
+    }
+
+    dcb_printf(dcb, "\nBuffer Cache.\n\n");
+    dcb_printf(dcb, " ID | Cached       | Malloc       | Large        | Recycled     | Released\n");
+    dcb_printf(dcb, "----+--------------+--------------+--------------+--------------+-------------\n");
+    for (i = 0; i < n_threads; i++)
+    {
+        GWBUF_CACHE_STATS stats;
+
+        if (gwbuf_get_cache_stats(i, &stats))
+        {
+            dcb_printf(dcb, " %2d | %12" PRIu64 " | %12" PRIu64 " | %12" PRIu64 " | %12" PRIu64 " | %12" PRIu64 "\n",
+                       i, stats.n_cached, stats.n_malloc, stats.n_large, stats.n_recycled, stats.n_released);
+        }
+    }
+
+    mxs_pool_print_stats(dcb);
 }
 
 /**
@@ -1407,6 +2427,46 @@ poll_loadav(void *data)
     {
         next_sample = 0;
     }
+
+    if (thread_data)
+    {
+        int busiest = 0;
+        int idlest = 0;
+        int n_active = poll_active_threads();
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            uint64_t n_events = thread_data[i].n_events;
+            thread_data[i].load = n_events - thread_data[i].n_prev_events;
+            thread_data[i].n_prev_events = n_events;
+
+            if (i >= n_active)
+            {
+                /** Retry moving the sessions that were busy the last time */
+                atomic_store_int32(&thread_data[i].migrate_count, 1);
+                continue;
+            }
+
+            if (thread_data[i].load > thread_data[busiest].load)
+            {
+                busiest = i;
+            }
+            if (thread_data[i].load < thread_data[idlest].load)
+            {
+                idlest = i;
+            }
+        }
+
+        /** Move sessions from the busiest thread if it has twice the
+         * load of the least loaded one */
+        if (session_rebalancing && busiest != idlest &&
+            thread_data[busiest].load >= POLL_REBALANCE_MIN_LOAD &&
+            thread_data[busiest].load > 2 * thread_data[idlest].load)
+        {
+            atomic_store_int32(&thread_data[busiest].migrate_to, idlest);
+            atomic_store_int32(&thread_data[busiest].migrate_count, POLL_REBALANCE_BATCH);
+        }
+    }
 }
 
 void poll_add_epollin_event_to_dcb(DCB*   dcb,
@@ -1419,39 +2479,194 @@ void poll_add_epollin_event_to_dcb(DCB*   dcb,
     poll_add_event_to_dcb(dcb, buf, ev);
 }
 
+int poll_current_worker()
+{
+    return is_worker_thread ? current_thread_id : -1;
+}
+
+
+/**
+ * Add an event to the ring buffer of a fake event queue
+ *
+ * @param queue The queue
+ * @param dcb   The DCB of the event
+ * @param buf   Fake data of the event
+ * @param ev    The event type
+ * @return True if the event was added, false if the ring is full
+ */
+static bool fake_event_ring_push(fake_event_queue_t *queue, DCB *dcb, GWBUF *buf, uint32_t ev)
+{
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    fake_event_t *slot;
+
+    while (true)
+    {
+        slot = &queue->ring[pos % FAKE_EVENT_QUEUE_SIZE];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            /** The slot is free, try to reserve it */
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /** The slot has not been consumed yet, the ring is full */
+            return false;
+        }
+        else
+        {
+            /** Another producer reserved the slot */
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->dcb = dcb;
+    slot->data = buf;
+    slot->event = ev;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
 
 static void poll_add_event_to_dcb(DCB*       dcb,
                                   GWBUF*     buf,
                                   uint32_t ev)
 {
-    fake_event_t *event = MXS_MALLOC(sizeof(*event));
+    int thr = dcb->thread.id;
+    fake_event_queue_t *queue = &fake_events[thr];
 
-    if (event)
+    if (atomic_load_int32(&queue->overflowing) || !fake_event_ring_push(queue, dcb, buf, ev))
     {
+        fake_event_t *event = MXS_MALLOC(sizeof(*event));
+
+        if (event == NULL)
+        {
+            return;
+        }
+
         event->data = buf;
         event->dcb = dcb;
         event->event = ev;
         event->next = NULL;
         event->tail = event;
 
-        int thr = dcb->thread.id;
-
-        /** It is possible that a housekeeper or a monitor thread inserts a fake
-         * event into the thread's event queue which is why the operation needs
-         * to be protected by a spinlock */
-        spinlock_acquire(&fake_event_lock[thr]);
+        /** The ring is full, the event is added to the overflow list which
+         * is used until the owning thread has emptied the ring */
+        spinlock_acquire(&queue->overflow_lock);
 
-        if (fake_events[thr])
+        if (queue->overflow)
         {
-            fake_events[thr]->tail->next = event;
-            fake_events[thr]->tail = event;
+            queue->overflow->tail->next = event;
+            queue->overflow->tail = event;
         }
         else
         {
-            fake_events[thr] = event;
+            queue->overflow = event;
+        }
+
+        queue->overflowing = 1;
+        spinlock_release(&queue->overflow_lock);
+    }
+
+    /** The owning thread processes the queue before it polls again */
+    if (!(is_worker_thread && thr == current_thread_id) &&
+        atomic_add(&queue->wakeup_pending, 1) == 0)
+    {
+        uint64_t one = 1;
+        queue->wakeup_time = poll_now_us();
+        ss_debug(ssize_t rc = ) write(queue->wakeup_fd, &one, sizeof(one));
+        ss_dassert(rc == sizeof(one));
+    }
+}
+
+/**
+ * Process one fake event
+ *
+ * @param thread_id The thread ID
+ * @param dcb       The DCB of the event
+ * @param buf       Fake data of the event
+ * @param events    The event type
+ */
+static void process_fake_event(int thread_id, DCB *dcb, GWBUF *buf, uint32_t events)
+{
+    if (dcb->thread.id != thread_id)
+    {
+        /** The DCB was moved to another thread after the event was added */
+        poll_add_event_to_dcb(dcb, buf, events);
+        return;
+    }
+
+    struct epoll_event ev;
+    dcb->dcb_fakequeue = buf;
+    ev.data.ptr = dcb;
+    ev.events = events;
+    process_pollq(thread_id, &ev);
+}
+
+/**
+ * Process the fake events of this thread
+ *
+ * Only the events that were queued when the processing started are processed,
+ * the events that they add are processed on the next round.
+ *
+ * @param thread_id The thread ID
+ */
+static void poll_process_fake_events(int thread_id)
+{
+    fake_event_queue_t *queue = &fake_events[thread_id];
+    fake_event_t *event = NULL;
+    size_t end = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_ACQUIRE);
+
+    /** The overflow list only has events that are newer than the ones in the
+     * ring. It is processed once the ring is empty and the new events are
+     * again added to the ring after that. */
+    if (atomic_load_int32(&queue->overflowing) && queue->dequeue_pos == end)
+    {
+        spinlock_acquire(&queue->overflow_lock);
+
+        if (queue->dequeue_pos == __atomic_load_n(&queue->enqueue_pos, __ATOMIC_ACQUIRE))
+        {
+            event = queue->overflow;
+            queue->overflow = NULL;
+            queue->overflowing = 0;
+        }
+
+        spinlock_release(&queue->overflow_lock);
+    }
+
+    while (event)
+    {
+        process_fake_event(thread_id, event->dcb, event->data, event->event);
+        fake_event_t *tmp = event;
+        event = event->next;
+        MXS_FREE(tmp);
+    }
+
+    while (queue->dequeue_pos != end)
+    {
+        fake_event_t *slot = &queue->ring[queue->dequeue_pos % FAKE_EVENT_QUEUE_SIZE];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != queue->dequeue_pos + 1)
+        {
+            /** The producer has reserved the slot but not yet stored the event */
+            break;
         }
 
-        spinlock_release(&fake_event_lock[thr]);
+        DCB *dcb = slot->dcb;
+        GWBUF *buf = slot->data;
+        uint32_t ev = slot->event;
+
+        /** Release the slot before processing so that the event can add new events */
+        __atomic_store_n(&slot->seq, queue->dequeue_pos + FAKE_EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+        queue->dequeue_pos++;
+
+        process_fake_event(thread_id, dcb, buf, ev);
     }
 }
 
@@ -1475,6 +2690,77 @@ void poll_fake_hangup_event(DCB *dcb)
     poll_add_event_to_dcb(dcb, NULL, ev);
 }
 
+/**
+ * @param mode A poll mode
+ * @return The configuration value of the poll mode
+ */
+static const char* poll_mode_name(mxs_poll_mode_t mode)
+{
+    switch (mode)
+    {
+    case MXS_POLL_BLOCKING:
+        return "blocking";
+
+    case MXS_POLL_SPIN:
+        return "spin";
+
+    default:
+        return "adaptive";
+    }
+}
+
+/**
+ * Sum the latency histograms of all threads
+ *
+ * @param total Where the sums are stored
+ */
+static void poll_sum_latency(POLL_LATENCY *total)
+{
+    memset(total, 0, sizeof(*total));
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        for (int j = 0; j < N_LATENCY_BUCKETS; j++)
+        {
+            total->wakeup[j] += latency_stats[i].wakeup[j];
+            total->dispatch[j] += latency_stats[i].dispatch[j];
+        }
+    }
+}
+
+/**
+ * Estimate a percentile of a latency histogram
+ *
+ * @param histogram  The histogram with N_LATENCY_BUCKETS buckets
+ * @param percentile The percentile, from 0 to 100
+ * @return The upper bound of the bucket that contains the percentile, in
+ *         microseconds, or 0 if the histogram is empty
+ */
+static int64_t latency_percentile(const uint64_t *histogram, int percentile)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < N_LATENCY_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+
+    uint64_t limit = (total * percentile + 99) / 100;
+    uint64_t sum = 0;
+
+    for (int i = 0; i < N_LATENCY_BUCKETS && total > 0; i++)
+    {
+        sum += histogram[i];
+
+        if (sum >= limit)
+        {
+            return i == 0 ? 1 : 1L << i;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Print the event queue statistics
  *
@@ -1509,6 +2795,65 @@ dShowEventStats(DCB *pdcb)
     }
     dcb_printf(pdcb, " > %2d00ms      | %-10d | %-10d\n", N_QUEUE_TIMES,
                queueStats.qtimes[N_QUEUE_TIMES], queueStats.exectimes[N_QUEUE_TIMES]);
+
+    POLL_LATENCY total;
+    poll_sum_latency(&total);
+
+    dcb_printf(pdcb, "\nPoll latency, poll engine %s, poll mode %s.\n",
+               rings ? "io_uring" : "epoll", poll_mode_name(poll_mode));
+    dcb_printf(pdcb, "                   |    Number of events\n");
+    dcb_printf(pdcb, "Latency            | Wakeup     | Dispatch\n");
+    dcb_printf(pdcb, "-------------------+------------+-----------\n");
+    dcb_printf(pdcb, " < 1us             | %-10" PRIu64 " | %-10" PRIu64 "\n",
+               total.wakeup[0], total.dispatch[0]);
+    for (i = 1; i < N_LATENCY_BUCKETS - 1; i++)
+    {
+        dcb_printf(pdcb, " %7ld - %7ldus | %-10" PRIu64 " | %-10" PRIu64 "\n", 1L << (i - 1), 1L << i,
+                   total.wakeup[i], total.dispatch[i]);
+    }
+    dcb_printf(pdcb, " > %7ldus        | %-10" PRIu64 " | %-10" PRIu64 "\n", 1L << (N_LATENCY_BUCKETS - 2),
+               total.wakeup[N_LATENCY_BUCKETS - 1], total.dispatch[N_LATENCY_BUCKETS - 1]);
+
+    uint64_t processed[SESSION_PRIORITY_N] = {0};
+    uint64_t delayed[SESSION_PRIORITY_N] = {0};
+
+    for (i = 0; i < n_threads; i++)
+    {
+        for (int c = 0; c < SESSION_PRIORITY_N; c++)
+        {
+            processed[c] += schedules[i].n_processed[c];
+            delayed[c] += schedules[i].n_delayed[c];
+        }
+    }
+
+    dcb_printf(pdcb, "\nPriority  | Weight | Competing events | Delayed events\n");
+    dcb_printf(pdcb, "----------+--------+------------------+---------------\n");
+    for (int c = 0; c < SESSION_PRIORITY_N; c++)
+    {
+        dcb_printf(pdcb, " %-8s | %6d | %-16" PRIu64 " | %" PRIu64 "\n",
+                   session_priority_to_string((session_priority_t)c), priority_weights[c],
+                   processed[c], delayed[c]);
+    }
+
+    uint64_t accept_deferrals = 0;
+
+    for (i = 0; i < n_threads; i++)
+    {
+        accept_deferrals += schedules[i].n_accept_deferrals;
+    }
+
+    dcb_printf(pdcb, "\nAccept batches cut short by accept_batch_size: %" PRIu64 "\n", accept_deferrals);
+
+    dcb_printf(pdcb, "\n Thread | Wakeup p50 | Wakeup p99 | Dispatch p50 | Dispatch p99\n");
+    dcb_printf(pdcb, "--------+------------+------------+--------------+-------------\n");
+    for (i = 0; i < n_threads; i++)
+    {
+        dcb_printf(pdcb, " %6d | %8ldus | %8ldus | %10ldus | %10ldus\n", i,
+                   latency_percentile(latency_stats[i].wakeup, 50),
+                   latency_percentile(latency_stats[i].wakeup, 99),
+                   latency_percentile(latency_stats[i].dispatch, 50),
+                   latency_percentile(latency_stats[i].dispatch, 99));
+    }
 }
 
 /**
@@ -1539,6 +2884,17 @@ int64_t poll_get_stat(POLL_STAT stat)
         return ts_stats_get(queueStats.maxqtime, TS_STATS_MAX);
     case POLL_STAT_MAX_EXECTIME:
         return ts_stats_get(queueStats.maxexectime, TS_STATS_MAX);
+    case POLL_STAT_WAKEUP_P50:
+    case POLL_STAT_WAKEUP_P99:
+    case POLL_STAT_DISPATCH_P50:
+    case POLL_STAT_DISPATCH_P99:
+        {
+            POLL_LATENCY total;
+            poll_sum_latency(&total);
+            bool wakeup = stat == POLL_STAT_WAKEUP_P50 || stat == POLL_STAT_WAKEUP_P99;
+            int percentile = stat == POLL_STAT_WAKEUP_P50 || stat == POLL_STAT_DISPATCH_P50 ? 50 : 99;
+            return latency_percentile(wakeup ? total.wakeup : total.dispatch, percentile);
+        }
     default:
         ss_dassert(false);
         break;
@@ -1631,17 +2987,24 @@ void poll_send_message(enum poll_message msg, void *data)
         poll_msg[i] |= msg;
     }
 
-    /** Handle this thread's message */
-    poll_check_message();
+    /** Handle this thread's message, other threads such as the monitors
+     * wait for all of the workers */
+    if (is_worker_thread)
+    {
+        poll_check_message();
+    }
 
     for (int i = 0; i < nthr; i++)
     {
-        if (i != current_thread_id)
+        if (!is_worker_thread || i != current_thread_id)
         {
-            while (poll_msg[i] & msg)
+            /** The workers stop handling messages once they have been told to stop */
+            while ((poll_msg[i] & msg) && !do_shutdown)
             {
                 thread_millisleep(1);
             }
+
+            poll_msg[i] &= ~msg;
         }
     }
 
@@ -1656,8 +3019,115 @@ static void poll_check_message()
     if (poll_msg[thread_id] & POLL_MSG_CLEAN_PERSISTENT)
     {
         SERVER *server = (SERVER*)poll_msg_data;
-        dcb_persistent_clean_count(server->persistent[thread_id], thread_id, false);
+        dcb_persistent_clean(server, thread_id, false);
         atomic_synchronize();
         poll_msg[thread_id] &= ~POLL_MSG_CLEAN_PERSISTENT;
     }
+
+    if (poll_msg[thread_id] & POLL_MSG_FLUSH_PERSISTENT)
+    {
+        SERVER *server = (SERVER*)poll_msg_data;
+        dcb_persistent_clean(server, thread_id, true);
+        atomic_synchronize();
+        poll_msg[thread_id] &= ~POLL_MSG_FLUSH_PERSISTENT;
+    }
+}
+
+/**
+ * The change of the active threads that is applied to each listener
+ */
+typedef struct
+{
+    int  from;  /*< The first thread that is added or removed */
+    int  to;    /*< One past the last thread that is added or removed */
+    bool add;   /*< Whether the listeners are added to or removed from the threads */
+} ACTIVE_THREADS_CHANGE;
+
+/**
+ * Add or remove a listener to the poll sets of the threads that are
+ * activated or retired, called with active_lock held
+ */
+static bool poll_update_listener_cb(DCB *dcb, void *data)
+{
+    ACTIVE_THREADS_CHANGE *change = (ACTIVE_THREADS_CHANGE*)data;
+
+    if (dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER && dcb->state == DCB_STATE_LISTENING &&
+        dcb->listener_fds == NULL)
+    {
+        struct epoll_event ev;
+        ev.events = poll_dcb_events();
+        ev.data.ptr = dcb;
+
+        for (int i = change->from; i < change->to; i++)
+        {
+            int rc = change->add ? poll_ctl_add(i, dcb->fd, &ev) : poll_ctl_del(i, dcb->fd, dcb);
+
+            if (rc != 0)
+            {
+                MXS_ERROR("Failed to %s listener %p %s the epoll instance of thread %d: %d, %s",
+                          change->add ? "add" : "remove", dcb, change->add ? "to" : "from",
+                          i, errno, mxs_strerror(errno));
+            }
+        }
+    }
+
+    return true;
+}
+
+int poll_get_active_threads()
+{
+    return poll_active_threads();
+}
+
+bool poll_set_active_threads(int n)
+{
+    if (n < 1 || n > n_threads || thread_data == NULL)
+    {
+        MXS_ERROR("Invalid number of active threads: %d. The value must be between 1 and %d, "
+                  "the 'threads_max' parameter sets the maximum.", n, n_threads);
+        return false;
+    }
+
+    spinlock_acquire(&active_lock);
+    int old = n_active_threads;
+    ACTIVE_THREADS_CHANGE change;
+
+    if (n > old)
+    {
+        /** The new threads accept connections before they are given any */
+        change.from = old;
+        change.to = n;
+        change.add = true;
+        dcb_foreach(poll_update_listener_cb, &change);
+
+        for (int i = old; i < n; i++)
+        {
+            atomic_store_int32(&thread_data[i].migrate_count, 0);
+        }
+
+        atomic_store_int32(&n_active_threads, n);
+    }
+    else if (n < old)
+    {
+        /** The retired threads get no new sessions and move their sessions away */
+        atomic_store_int32(&n_active_threads, n);
+        change.from = n;
+        change.to = old;
+        change.add = false;
+        dcb_foreach(poll_update_listener_cb, &change);
+
+        for (int i = n; i < old; i++)
+        {
+            atomic_store_int32(&thread_data[i].migrate_count, 1);
+        }
+    }
+
+    spinlock_release(&active_lock);
+
+    if (n != old)
+    {
+        MXS_NOTICE("Changed the number of active threads from %d to %d.", old, n);
+    }
+
+    return true;
 }
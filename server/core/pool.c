@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file pool.c - Per-thread pools of fixed size objects
+ *
+ * Each object is preceded by a header that points to its pool. This allows
+ * an object to be freed without knowing which pool it came from. Only the
+ * owning thread touches its free list, which means that no locking is needed.
+ * An object freed by a different thread than the one that allocated it ends
+ * up in the free list of the freeing thread.
+ */
+
+#include <maxscale/pool.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/debug.h>
+#include <maxscale/platform.h>
+#include <maxscale/spinlock.h>
+
+#include "maxscale/pool.h"
+
+/** The header in front of each object */
+typedef union mxs_pool_header
+{
+    MXS_POOL *pool;     /*< The pool of the object */
+    uint64_t  align[2]; /*< Keeps the object aligned */
+} MXS_POOL_HEADER;
+
+/** A free object kept in the free list of a thread */
+typedef struct mxs_pool_object
+{
+    MXS_POOL_HEADER         header;
+    struct mxs_pool_object *next;
+} MXS_POOL_OBJECT;
+
+static MXS_POOL *all_pools = NULL;          /*< All pools that have been used */
+static SPINLOCK  all_pools_lock = SPINLOCK_INIT;
+static thread_local int pool_thread_id = -1; /*< The thread ID of a worker thread */
+
+/**
+ * Add a pool to the list of all pools when it is used for the first time
+ *
+ * @param pool The pool
+ */
+static void pool_register(MXS_POOL *pool)
+{
+    spinlock_acquire(&all_pools_lock);
+
+    if (!pool->registered)
+    {
+        pool->next = all_pools;
+        all_pools = pool;
+        pool->registered = true;
+    }
+
+    spinlock_release(&all_pools_lock);
+}
+
+void mxs_pool_thread_init(int thread_id)
+{
+    if (thread_id >= 0 && thread_id < MXS_MAX_THREADS)
+    {
+        pool_thread_id = thread_id;
+    }
+}
+
+void mxs_pool_thread_finish()
+{
+    int id = pool_thread_id;
+
+    if (id != -1)
+    {
+        pool_thread_id = -1;
+        spinlock_acquire(&all_pools_lock);
+
+        for (MXS_POOL *pool = all_pools; pool; pool = pool->next)
+        {
+            MXS_POOL_THREAD *thr = &pool->threads[id];
+
+            while (thr->free)
+            {
+                MXS_POOL_OBJECT *obj = thr->free;
+                thr->free = obj->next;
+                MXS_FREE(obj);
+            }
+            thr->n_free = 0;
+        }
+
+        spinlock_release(&all_pools_lock);
+    }
+}
+
+void* mxs_pool_alloc(MXS_POOL *pool)
+{
+    int id = pool_thread_id;
+    MXS_POOL_HEADER *header = NULL;
+
+    if (!pool->registered)
+    {
+        pool_register(pool);
+    }
+
+    if (id != -1)
+    {
+        MXS_POOL_THREAD *thr = &pool->threads[id];
+
+        if (thr->free)
+        {
+            MXS_POOL_OBJECT *obj = thr->free;
+            thr->free = obj->next;
+            thr->n_free--;
+            thr->n_hits++;
+            header = &obj->header;
+        }
+        else
+        {
+            thr->n_misses++;
+        }
+    }
+
+    if (header == NULL)
+    {
+        /** The object must also have room for the free list link */
+        size_t size = MXS_MAX(pool->size, sizeof(MXS_POOL_OBJECT) - sizeof(MXS_POOL_HEADER));
+
+        if ((header = (MXS_POOL_HEADER*)MXS_MALLOC(sizeof(MXS_POOL_HEADER) + size)) == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    header->pool = pool;
+
+    return header + 1;
+}
+
+void* mxs_pool_calloc(MXS_POOL *pool)
+{
+    void *rval = mxs_pool_alloc(pool);
+
+    if (rval)
+    {
+        memset(rval, 0, pool->size);
+    }
+
+    return rval;
+}
+
+void mxs_pool_free(void *object)
+{
+    if (object)
+    {
+        MXS_POOL_OBJECT *obj = (MXS_POOL_OBJECT*)((MXS_POOL_HEADER*)object - 1);
+        MXS_POOL *pool = obj->header.pool;
+        int id = pool_thread_id;
+
+        if (id != -1 && pool->threads[id].n_free < pool->max_free)
+        {
+            MXS_POOL_THREAD *thr = &pool->threads[id];
+            obj->next = thr->free;
+            thr->free = obj;
+            thr->n_free++;
+            thr->n_recycled++;
+        }
+        else
+        {
+            if (id != -1)
+            {
+                pool->threads[id].n_released++;
+            }
+
+            MXS_FREE(obj);
+        }
+    }
+}
+
+int64_t mxs_pool_get_stat(const MXS_POOL *pool, MXS_POOL_STAT stat)
+{
+    int64_t rval = 0;
+    int n_threads = MXS_MIN(config_threadcount(), MXS_MAX_THREADS);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        const MXS_POOL_THREAD *thr = &pool->threads[i];
+
+        switch (stat)
+        {
+        case MXS_POOL_STAT_HITS:
+            rval += thr->n_hits;
+            break;
+        case MXS_POOL_STAT_MISSES:
+            rval += thr->n_misses;
+            break;
+        case MXS_POOL_STAT_FREE:
+            rval += thr->n_free;
+            break;
+        default:
+            ss_dassert(false);
+            break;
+        }
+    }
+
+    return rval;
+}
+
+int64_t mxs_pool_get_total_stat(MXS_POOL_STAT stat)
+{
+    int64_t rval = 0;
+    spinlock_acquire(&all_pools_lock);
+
+    for (MXS_POOL *pool = all_pools; pool; pool = pool->next)
+    {
+        rval += mxs_pool_get_stat(pool, stat);
+    }
+
+    spinlock_release(&all_pools_lock);
+
+    return rval;
+}
+
+void mxs_pool_print_stats(DCB *dcb)
+{
+    dcb_printf(dcb, "\nObject Pools.\n\n");
+    dcb_printf(dcb, " Name                 | Free     | Hits         | Misses       | Hit rate\n");
+    dcb_printf(dcb, "----------------------+----------+--------------+--------------+---------\n");
+
+    spinlock_acquire(&all_pools_lock);
+
+    for (MXS_POOL *pool = all_pools; pool; pool = pool->next)
+    {
+        int64_t hits = mxs_pool_get_stat(pool, MXS_POOL_STAT_HITS);
+        int64_t misses = mxs_pool_get_stat(pool, MXS_POOL_STAT_MISSES);
+        int64_t total = hits + misses;
+
+        dcb_printf(dcb, " %-20s | %8" PRId64 " | %12" PRId64 " | %12" PRId64 " | %6.2f%%\n",
+                   pool->name, mxs_pool_get_stat(pool, MXS_POOL_STAT_FREE), hits, misses,
+                   total ? 100.0 * hits / total : 0.0);
+    }
+
+    spinlock_release(&all_pools_lock);
+}
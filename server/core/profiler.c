@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file profiler.c - Profiling of the module callbacks
+ *
+ * Each worker thread keeps a table of the callbacks it has made and a stack
+ * of the callbacks that are in progress. Only the thread itself writes them,
+ * so the measurements take no locks. The tables are summed up when they are
+ * shown, which can see slightly stale values.
+ *
+ * The protocol callbacks are measured by the polling system. The routeQuery
+ * and clientReply calls are measured by inserting a profiling element in
+ * front of each filter and router in the filter chain of a session.
+ */
+
+#include "maxscale/profiler.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+
+/** The number of different callbacks a thread can keep apart */
+#define PROFILE_MAX_ENTRIES 128
+/** The deepest chain of nested callbacks that is measured */
+#define PROFILE_MAX_DEPTH   16
+/** The longest module name that is kept */
+#define PROFILE_NAME_LEN    64
+
+typedef struct
+{
+    char               module[PROFILE_NAME_LEN];
+    profile_callback_t callback;
+    uint64_t           calls;
+    uint64_t           self_ns;  /**< Time spent in the callback without its nested callbacks */
+    uint64_t           max_ns;   /**< The longest call including nested callbacks */
+    uint64_t           slow;     /**< Calls that took longer than the threshold */
+} PROFILE_ENTRY;
+
+typedef struct
+{
+    PROFILE_ENTRY *entry;
+    uint64_t      start;
+    uint64_t      nested_ns; /**< Time of the nested callbacks */
+    size_t        ses_id;
+    bool          reported;  /**< Whether a slow nested callback was already logged */
+} PROFILE_FRAME;
+
+typedef struct
+{
+    PROFILE_ENTRY entries[PROFILE_MAX_ENTRIES];
+    int           n_entries;
+    PROFILE_FRAME frames[PROFILE_MAX_DEPTH];
+    int           depth;     /**< Number of callbacks in progress, can exceed PROFILE_MAX_DEPTH */
+} PROFILE_THREAD;
+
+/**
+ * A profiling element in the filter chain. The calls go through it to the
+ * real downstream or upstream.
+ */
+typedef struct profile_hop
+{
+    MXS_DOWNSTREAM     down;
+    MXS_UPSTREAM       up;
+    const char         *module;
+    size_t             ses_id;
+    struct profile_hop *next;
+} PROFILE_HOP;
+
+bool profiler_active = false;
+static uint64_t slow_threshold_ns = 0;
+static PROFILE_THREAD *profile_threads = NULL;
+static int n_profile_threads = 0;
+static thread_local PROFILE_THREAD *profile_thread = NULL;
+
+static const char *callback_names[] =
+{
+    "accept",
+    "read",
+    "write_ready",
+    "error",
+    "hangup",
+    "routeQuery",
+    "clientReply"
+};
+
+static inline uint64_t profile_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profiler_init(int n_threads)
+{
+    MXS_CONFIG *config = config_get_global_options();
+    slow_threshold_ns = (uint64_t)config->slow_callback_threshold * 1000000;
+
+    if (config->profile_callbacks &&
+        (profile_threads = (PROFILE_THREAD*)MXS_CALLOC(n_threads, sizeof(PROFILE_THREAD))))
+    {
+        n_profile_threads = n_threads;
+        profiler_active = true;
+    }
+}
+
+void profiler_thread_init(int thread_id)
+{
+    if (profiler_active && thread_id < n_profile_threads)
+    {
+        profile_thread = &profile_threads[thread_id];
+    }
+}
+
+/**
+ * Find the entry of a callback, or add it if it is not in the table
+ *
+ * @return The entry, the last entry if the table is full
+ */
+static PROFILE_ENTRY* profile_entry(PROFILE_THREAD *thr, profile_callback_t callback, const char *module)
+{
+    for (int i = 0; i < thr->n_entries; i++)
+    {
+        PROFILE_ENTRY *entry = &thr->entries[i];
+
+        if (entry->callback == callback && strcmp(entry->module, module) == 0)
+        {
+            return entry;
+        }
+    }
+
+    if (thr->n_entries == PROFILE_MAX_ENTRIES)
+    {
+        return &thr->entries[PROFILE_MAX_ENTRIES - 1];
+    }
+
+    PROFILE_ENTRY *entry = &thr->entries[thr->n_entries];
+    snprintf(entry->module, sizeof(entry->module), "%s", module);
+    entry->callback = callback;
+
+    /** Other threads read the table, so the entry is only counted when it is ready */
+    atomic_synchronize();
+    atomic_store_int32(&thr->n_entries, thr->n_entries + 1);
+
+    return entry;
+}
+
+void profiler_enter(profile_callback_t callback, const char *module, size_t ses_id)
+{
+    PROFILE_THREAD *thr = profile_thread;
+
+    if (thr)
+    {
+        if (thr->depth < PROFILE_MAX_DEPTH)
+        {
+            PROFILE_FRAME *frame = &thr->frames[thr->depth];
+            frame->entry = profile_entry(thr, callback, module ? module : "unknown");
+            frame->nested_ns = 0;
+            frame->ses_id = ses_id;
+            frame->reported = false;
+            frame->start = profile_now();
+        }
+
+        thr->depth++;
+    }
+}
+
+/**
+ * Log a slow callback with the chain of callbacks that led to it
+ */
+static void profile_log_slow(PROFILE_THREAD *thr, uint64_t elapsed, uint64_t self)
+{
+    char stack[PROFILE_MAX_DEPTH * (PROFILE_NAME_LEN + 16)] = "";
+    size_t len = 0;
+
+    for (int i = 0; i <= thr->depth && len < sizeof(stack); i++)
+    {
+        PROFILE_ENTRY *entry = thr->frames[i].entry;
+        len += snprintf(stack + len, sizeof(stack) - len, "%s%s %s", i ? " -> " : "",
+                        entry->module, callback_names[entry->callback]);
+    }
+
+    PROFILE_FRAME *frame = &thr->frames[thr->depth];
+    MXS_WARNING("Slow callback in session %lu took %.3fms, %.3fms of it in %s %s: %s",
+                frame->ses_id, elapsed / 1000000.0, self / 1000000.0, frame->entry->module,
+                callback_names[frame->entry->callback], stack);
+
+    for (int i = 0; i <= thr->depth; i++)
+    {
+        thr->frames[i].reported = true;
+    }
+}
+
+void profiler_leave()
+{
+    PROFILE_THREAD *thr = profile_thread;
+
+    if (thr == NULL || thr->depth == 0)
+    {
+        return;
+    }
+
+    if (--thr->depth >= PROFILE_MAX_DEPTH)
+    {
+        return;
+    }
+
+    PROFILE_FRAME *frame = &thr->frames[thr->depth];
+    PROFILE_ENTRY *entry = frame->entry;
+    uint64_t elapsed = profile_now() - frame->start;
+    uint64_t self = elapsed > frame->nested_ns ? elapsed - frame->nested_ns : 0;
+
+    entry->calls++;
+    entry->self_ns += self;
+
+    if (elapsed > entry->max_ns)
+    {
+        entry->max_ns = elapsed;
+    }
+
+    if (thr->depth > 0)
+    {
+        thr->frames[thr->depth - 1].nested_ns += elapsed;
+    }
+
+    if (slow_threshold_ns && elapsed > slow_threshold_ns)
+    {
+        entry->slow++;
+
+        /** Only the innermost slow callback is logged */
+        if (!frame->reported)
+        {
+            profile_log_slow(thr, elapsed, self);
+        }
+    }
+}
+
+static int32_t profile_route_query(void *instance, void *session, GWBUF *request)
+{
+    PROFILE_HOP *hop = (PROFILE_HOP*)instance;
+    profiler_enter(PROFILE_ROUTE_QUERY, hop->module, hop->ses_id);
+    int32_t rval = hop->down.routeQuery(hop->down.instance, hop->down.session, request);
+    profiler_leave();
+    return rval;
+}
+
+static int32_t profile_client_reply(void *instance, void *session, GWBUF *response)
+{
+    PROFILE_HOP *hop = (PROFILE_HOP*)instance;
+    profiler_enter(PROFILE_CLIENT_REPLY, hop->module, hop->ses_id);
+    int32_t rval = hop->up.clientReply(hop->up.instance, hop->up.session, response);
+    profiler_leave();
+    return rval;
+}
+
+static int32_t profile_error(void *instance, void *session, void *data)
+{
+    PROFILE_HOP *hop = (PROFILE_HOP*)instance;
+    return hop->up.error(hop->up.instance, hop->up.session, data);
+}
+
+static PROFILE_HOP* profile_hop_alloc(MXS_SESSION *session, const char *module)
+{
+    PROFILE_HOP *hop = (PROFILE_HOP*)MXS_CALLOC(1, sizeof(PROFILE_HOP));
+
+    if (hop)
+    {
+        hop->module = module ? module : "unknown";
+        hop->ses_id = session->ses_id;
+        hop->next = session->profile_hops;
+        session->profile_hops = hop;
+    }
+
+    return hop;
+}
+
+bool profiler_wrap_downstream(MXS_SESSION *session, MXS_DOWNSTREAM *down, const char *module)
+{
+    if (!profiler_active || down->routeQuery == profile_route_query)
+    {
+        return true;
+    }
+
+    PROFILE_HOP *hop = profile_hop_alloc(session, module);
+
+    if (hop == NULL)
+    {
+        return false;
+    }
+
+    hop->down = *down;
+    down->instance = hop;
+    down->session = hop;
+    down->routeQuery = profile_route_query;
+    return true;
+}
+
+bool profiler_wrap_upstream(MXS_SESSION *session, MXS_UPSTREAM *up, const char *module)
+{
+    if (!profiler_active || up->clientReply == profile_client_reply)
+    {
+        return true;
+    }
+
+    PROFILE_HOP *hop = profile_hop_alloc(session, module);
+
+    if (hop == NULL)
+    {
+        return false;
+    }
+
+    hop->up = *up;
+    up->instance = hop;
+    up->session = hop;
+    up->clientReply = profile_client_reply;
+    up->error = hop->up.error ? profile_error : NULL;
+    return true;
+}
+
+void profiler_session_free(MXS_SESSION *session)
+{
+    while (session->profile_hops)
+    {
+        PROFILE_HOP *hop = session->profile_hops;
+        session->profile_hops = hop->next;
+        MXS_FREE(hop);
+    }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const PROFILE_ENTRY *x = (const PROFILE_ENTRY*)a;
+    const PROFILE_ENTRY *y = (const PROFILE_ENTRY*)b;
+    return x->self_ns > y->self_ns ? -1 : x->self_ns < y->self_ns;
+}
+
+/**
+ * Sum up the tables of all threads
+ *
+ * @param n_entries Set to the number of returned entries
+ * @return The entries sorted by the time spent in them or NULL
+ */
+static PROFILE_ENTRY* profile_sum(int *n_entries)
+{
+    PROFILE_ENTRY *rval = (PROFILE_ENTRY*)MXS_CALLOC(n_profile_threads * PROFILE_MAX_ENTRIES + 1,
+                                                     sizeof(PROFILE_ENTRY));
+    int n = 0;
+
+    for (int i = 0; rval && i < n_profile_threads; i++)
+    {
+        PROFILE_THREAD *thr = &profile_threads[i];
+        int count = atomic_load_int32(&thr->n_entries);
+
+        for (int j = 0; j < count; j++)
+        {
+            PROFILE_ENTRY *entry = &thr->entries[j];
+            int k = 0;
+
+            while (k < n && (rval[k].callback != entry->callback ||
+                             strcmp(rval[k].module, entry->module) != 0))
+            {
+                k++;
+            }
+
+            if (k == n)
+            {
+                strcpy(rval[k].module, entry->module);
+                rval[k].callback = entry->callback;
+                n++;
+            }
+
+            rval[k].calls += entry->calls;
+            rval[k].self_ns += entry->self_ns;
+            rval[k].slow += entry->slow;
+
+            if (entry->max_ns > rval[k].max_ns)
+            {
+                rval[k].max_ns = entry->max_ns;
+            }
+        }
+    }
+
+    if (rval)
+    {
+        qsort(rval, n, sizeof(PROFILE_ENTRY), compare_entries);
+    }
+
+    *n_entries = n;
+    return rval;
+}
+
+void dprintProfile(DCB *dcb)
+{
+    if (!profiler_active)
+    {
+        dcb_printf(dcb, "Callback profiling is not enabled, see profile_callbacks.\n");
+        return;
+    }
+
+    int n;
+    PROFILE_ENTRY *entries = profile_sum(&n);
+
+    if (entries == NULL)
+    {
+        return;
+    }
+
+    dcb_printf(dcb, "%-20s | %-12s | %-12s | %-14s | %-10s | %-12s | %-10s\n",
+               "Module", "Callback", "Calls", "Total time ms", "Average us", "Max time us", "Slow calls");
+    dcb_printf(dcb, "---------------------+--------------+--------------+----------------"
+               "+------------+--------------+-----------\n");
+
+    for (int i = 0; i < n; i++)
+    {
+        PROFILE_ENTRY *entry = &entries[i];
+        dcb_printf(dcb, "%-20s | %-12s | %-12" PRIu64 " | %-14.3f | %-10.3f | %-12.3f | %-10" PRIu64 "\n",
+                   entry->module, callback_names[entry->callback], entry->calls,
+                   entry->self_ns / 1000000.0,
+                   entry->calls ? entry->self_ns / 1000.0 / entry->calls : 0,
+                   entry->max_ns / 1000.0, entry->slow);
+    }
+
+    MXS_FREE(entries);
+}
+
+static void profileStreamRows(RESULTSET *set, void *data)
+{
+    int n;
+    PROFILE_ENTRY *entries = profile_sum(&n);
+
+    for (int i = 0; entries && i < n; i++)
+    {
+        PROFILE_ENTRY *entry = &entries[i];
+        char calls[24], total[24], avg[24], max[24], slow[24];
+
+        snprintf(calls, sizeof(calls), "%" PRIu64, entry->calls);
+        snprintf(total, sizeof(total), "%.3f", entry->self_ns / 1000000.0);
+        snprintf(avg, sizeof(avg), "%.3f", entry->calls ? entry->self_ns / 1000.0 / entry->calls : 0);
+        snprintf(max, sizeof(max), "%.3f", entry->max_ns / 1000.0);
+        snprintf(slow, sizeof(slow), "%" PRIu64, entry->slow);
+
+        const char *values[] = {entry->module, callback_names[entry->callback], calls, total, avg, max, slow};
+
+        if (!resultset_stream_row(set, values))
+        {
+            break;
+        }
+    }
+
+    MXS_FREE(entries);
+}
+
+RESULTSET* profilerGetList()
+{
+    RESULTSET *set;
+
+    if ((set = resultset_create_streaming(profileStreamRows, NULL)) == NULL)
+    {
+        return NULL;
+    }
+
+    resultset_add_column(set, "Module", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Callback", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Calls", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Total time ms", 14, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Average us", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Max time us", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Slow calls", 12, COL_TYPE_VARCHAR);
+
+    return set;
+}
@@ -18,6 +18,7 @@
 #include <maxscale/platform.h>
 #include <maxscale/pcre2.h>
 #include <maxscale/utils.h>
+#include "maxscale/fastclassifier.hh"
 #include "maxscale/trxboundaryparser.hh"
 
 #include "../core/maxscale/modules.h"
@@ -197,7 +198,137 @@ uint32_t qc_get_type_mask(GWBUF* query)
 
     uint32_t type_mask = QUERY_TYPE_UNKNOWN;
 
-    classifier->qc_get_type_mask(query, &type_mask);
+    // If the statement has already been parsed, e.g. because qc_parse() was
+    // called with more than QC_COLLECT_ESSENTIALS, the classifier already has
+    // the type mask. Otherwise simple statements are classified without it.
+    if (gwbuf_get_buffer_object_data(query, GWBUF_PARSING_INFO) != NULL)
+    {
+        classifier->qc_get_type_mask(query, &type_mask);
+    }
+    else
+    {
+        maxscale::FastClassifier fc;
+
+        if (!fc.type_mask_of(query, &type_mask))
+        {
+            classifier->qc_get_type_mask(query, &type_mask);
+        }
+    }
+
+    return type_mask;
+}
+
+/**
+ * Appends the type masks of the statements of a single packet.
+ *
+ * @param packet      A complete, contiguous packet.
+ * @param type_masks  The array to append to, may be reallocated.
+ * @param n_stmts     The number of elements in @c type_masks.
+ * @param capacity    The capacity of @c type_masks.
+ *
+ * @return The union of the type masks of the statements of the packet.
+ */
+static uint32_t qc_parse_packet(GWBUF* packet, uint32_t** type_masks, size_t* n_stmts, size_t* capacity)
+{
+    uint32_t* masks = NULL;
+    int32_t n_masks = 0;
+    uint32_t type_mask = QUERY_TYPE_UNKNOWN;
+
+    if (modutil_is_SQL(packet) && classifier->qc_get_statement_types)
+    {
+        maxscale::FastClassifier fc;
+
+        // The statements the fast classifier decides on are single statements.
+        if (gwbuf_get_buffer_object_data(packet, GWBUF_PARSING_INFO) == NULL &&
+            fc.type_mask_of(packet, &type_mask))
+        {
+            n_masks = 1;
+        }
+        else if (classifier->qc_get_statement_types(packet, &masks, &n_masks) != QC_RESULT_OK)
+        {
+            n_masks = 0;
+        }
+    }
+    else if (modutil_is_SQL(packet) || modutil_is_SQL_prepare(packet))
+    {
+        type_mask = qc_get_type_mask(packet);
+        n_masks = 1;
+    }
+
+    if (n_masks > 0 && *n_stmts + n_masks > *capacity)
+    {
+        size_t new_capacity = (*capacity ? 2 * *capacity : 4) + n_masks;
+        uint32_t* new_masks = (uint32_t*)MXS_REALLOC(*type_masks, new_capacity * sizeof(uint32_t));
+        MXS_ABORT_IF_NULL(new_masks);
+        *type_masks = new_masks;
+        *capacity = new_capacity;
+    }
+
+    uint32_t rval = QUERY_TYPE_UNKNOWN;
+
+    for (int32_t i = 0; i < n_masks; ++i)
+    {
+        uint32_t mask = masks ? masks[i] : type_mask;
+        (*type_masks)[(*n_stmts)++] = mask;
+        rval |= mask;
+    }
+
+    MXS_FREE(masks);
+
+    return rval;
+}
+
+uint32_t qc_parse_batch(GWBUF* queue, uint32_t** type_masks, size_t* n_stmts)
+{
+    QC_TRACE();
+    ss_dassert(classifier);
+
+    uint32_t type_mask = QUERY_TYPE_UNKNOWN;
+    uint32_t* masks = NULL;
+    size_t capacity = 0;
+    size_t total = gwbuf_length(queue);
+    size_t offset = 0;
+
+    *n_stmts = 0;
+
+    while (offset + MYSQL_HEADER_LEN < total)
+    {
+        uint8_t header[MYSQL_HEADER_LEN];
+        gwbuf_copy_data(queue, offset, MYSQL_HEADER_LEN, header);
+        size_t len = MYSQL_HEADER_LEN + MYSQL_GET_PAYLOAD_LEN(header);
+
+        if (offset + len > total)
+        {
+            break;
+        }
+
+        if (offset == 0 && len == total && (size_t)GWBUF_LENGTH(queue) == total)
+        {
+            // A single contiguous packet, its parsing info is kept for later.
+            type_mask |= qc_parse_packet(queue, &masks, n_stmts, &capacity);
+        }
+        else
+        {
+            GWBUF* packet = gwbuf_alloc(len);
+            MXS_ABORT_IF_NULL(packet);
+            gwbuf_copy_data(queue, offset, len, GWBUF_DATA(packet));
+
+            type_mask |= qc_parse_packet(packet, &masks, n_stmts, &capacity);
+
+            gwbuf_free(packet);
+        }
+
+        offset += len;
+    }
+
+    if (type_masks)
+    {
+        *type_masks = masks;
+    }
+    else
+    {
+        MXS_FREE(masks);
+    }
 
     return type_mask;
 }
@@ -352,6 +483,15 @@ GWBUF* qc_get_preparable_stmt(GWBUF* stmt)
     return preparable_stmt;
 }
 
+bool qc_get_cache_stats(QC_CACHE_STATS* stats)
+{
+    QC_TRACE();
+    ss_dassert(classifier);
+
+    return classifier->qc_get_cache_stats &&
+           classifier->qc_get_cache_stats(stats) == QC_RESULT_OK;
+}
+
 struct type_name_info field_usage_to_type_name_info(qc_field_usage_t usage)
 {
     struct type_name_info info;
@@ -837,7 +977,10 @@ char* qc_typemask_to_string(uint32_t types)
 
 static uint32_t qc_get_trx_type_mask_using_qc(GWBUF* stmt)
 {
-    uint32_t type_mask = qc_get_type_mask(stmt);
+    uint32_t type_mask = QUERY_TYPE_UNKNOWN;
+
+    // Not qc_get_type_mask(), that could use TrxBoundaryParser.
+    classifier->qc_get_type_mask(stmt, &type_mask);
 
     if (qc_query_is_type(type_mask, QUERY_TYPE_WRITE) &&
         qc_query_is_type(type_mask, QUERY_TYPE_COMMIT))
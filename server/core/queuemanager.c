@@ -15,7 +15,8 @@
  * @file queuemanager.c  -  Logic for FIFO queue handling
  *
  * MaxScale contains a number of FIFO queues. This code attempts to provide
- * standard functions for handling them.
+ * standard functions for handling them. The queues are bounded ring buffers
+ * that can be used from any number of threads without locks.
  *
  * @verbatim
  * Revision History
@@ -27,6 +28,7 @@
  */
 #include <maxscale/queuemanager.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -34,7 +36,6 @@
 #include <maxscale/debug.h>
 #include <maxscale/hk_heartbeat.h>
 #include <maxscale/log_manager.h>
-#include <maxscale/spinlock.h>
 
 #include "maxscale/queuemanager.h"
 
@@ -42,8 +43,6 @@
 int debug_check_fail = 0;
 #endif /* SS_DEBUG */
 
-static inline int mxs_queue_count(QUEUE_CONFIG*);
-
 /**
  * @brief Allocate a new queue
  *
@@ -57,18 +56,25 @@ static inline int mxs_queue_count(QUEUE_CONFIG*);
 QUEUE_CONFIG
 *mxs_queue_alloc(int limit, int timeout)
 {
+    if (limit < 1)
+    {
+        return NULL;
+    }
+
     QUEUE_CONFIG *new_queue = (QUEUE_CONFIG *)MXS_CALLOC(1, sizeof(QUEUE_CONFIG));
     if (new_queue)
     {
-        new_queue->queue_array = MXS_CALLOC(limit + 1, sizeof(QUEUE_ENTRY));
+        new_queue->queue_array = MXS_CALLOC(limit, sizeof(QUEUE_SLOT));
         if (new_queue->queue_array)
         {
             new_queue->queue_limit = limit;
             new_queue->timeout = timeout;
-            spinlock_init(&new_queue->queue_lock);
-#if defined(SS_DEBUG)
-            new_queue->sequence_number = 0;
-#endif /* SS_DEBUG */
+
+            for (int i = 0; i < limit; i++)
+            {
+                new_queue->queue_array[i].seq = i;
+            }
+
             return new_queue;
         }
         MXS_FREE(new_queue);
@@ -105,74 +111,123 @@ void mxs_queue_free(QUEUE_CONFIG *queue_config)
  */
 bool mxs_enqueue(QUEUE_CONFIG *queue_config, void *new_entry)
 {
-    bool result = false;
+    if (queue_config == NULL)
+    {
+        return false;
+    }
 
-    if (queue_config)
+    size_t pos = __atomic_load_n(&queue_config->enqueue_pos, __ATOMIC_RELAXED);
+    QUEUE_SLOT *slot;
+
+    while (true)
     {
-        spinlock_acquire(&queue_config->queue_lock);
-        if (mxs_queue_count(queue_config) < queue_config->queue_limit)
+        slot = &queue_config->queue_array[pos % queue_config->queue_limit];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0)
         {
-            queue_config->queue_array[queue_config->end].queued_object = new_entry;
-            queue_config->queue_array[queue_config->end].heartbeat = hkheartbeat;
-#if defined(SS_DEBUG)
-            queue_config->queue_array[queue_config->end].sequence_check = queue_config->sequence_number;
-            queue_config->sequence_number++;
-#endif /* SS_DEBUG */
-            queue_config->end++;
-            if (queue_config->end > queue_config->queue_limit)
+            /** The slot is free, try to reserve it */
+            if (__atomic_compare_exchange_n(&queue_config->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
             {
-                queue_config->end = 0;
+                break;
             }
-            queue_config->has_entries = true;
-            result = true;
+        }
+        else if (diff < 0)
+        {
+            /** The slot has not been consumed yet, the queue is full */
+            return false;
         }
         else
         {
-            result = false;
+            /** Another producer reserved the slot */
+            pos = __atomic_load_n(&queue_config->enqueue_pos, __ATOMIC_RELAXED);
         }
-        spinlock_release(&queue_config->queue_lock);
     }
-    return result;
+
+    slot->entry.queued_object = new_entry;
+    slot->entry.heartbeat = hkheartbeat;
+#if defined(SS_DEBUG)
+    slot->entry.sequence_check = pos;
+#endif /* SS_DEBUG */
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
 }
 
 /**
- * @brief Remove an item from a queue
- *
- * Remove an item from a FIFO queue. If the queue config is NULL, the function
- * will behave as if for an empty queue.
+ * @brief Remove the first item of a queue
  *
  * @param queue_config  The configuration and anchor structure for the queue
  * @param result        A queue entry structure that will receive the result
+ * @param expired_only  Only remove the item if it has passed the timeout limit
  * @return bool indicating whether an item was successfully dequeued
  */
-bool mxs_dequeue(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result)
+static bool queue_pop(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result, bool expired_only)
 {
-    QUEUE_ENTRY *found = NULL;
+    size_t pos = __atomic_load_n(&queue_config->dequeue_pos, __ATOMIC_RELAXED);
+    QUEUE_SLOT *slot;
 
-    if (queue_config && queue_config->has_entries)
+    while (true)
     {
-        spinlock_acquire(&queue_config->queue_lock);
-        if (mxs_queue_count(queue_config) > 0)
+        slot = &queue_config->queue_array[pos % queue_config->queue_limit];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0)
         {
-            found = &(queue_config->queue_array[queue_config->start]);
-#if defined(SS_DEBUG)
-            ss_dassert((queue_config->sequence_number) == (found->sequence_check + mxs_queue_count(queue_config)));
-            if ((queue_config->sequence_number) != (found->sequence_check + mxs_queue_count(queue_config)))
+            /** The entries are in FIFO order, if the first one has not
+             * expired, none of them have */
+            if (expired_only && slot->entry.heartbeat > hkheartbeat - queue_config->timeout)
             {
-                debug_check_fail++;
+                return false;
             }
-#endif /* SS_DEBUG */
-            result->heartbeat = found->heartbeat;
-            result->queued_object = found->queued_object;
-            if (++queue_config->start > queue_config->queue_limit)
+
+            if (__atomic_compare_exchange_n(&queue_config->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
             {
-                queue_config->start = 0;
+                break;
             }
-            queue_config->has_entries = (mxs_queue_count(queue_config) > 0);
         }
-        spinlock_release(&queue_config->queue_lock);
+        else if (diff < 0)
+        {
+            /** The slot has not been filled yet, the queue is empty */
+            return false;
+        }
+        else
+        {
+            /** Another consumer took the entry */
+            pos = __atomic_load_n(&queue_config->dequeue_pos, __ATOMIC_RELAXED);
+        }
     }
-    return (found != NULL);
+
+#if defined(SS_DEBUG)
+    ss_dassert(slot->entry.sequence_check == pos);
+    if (slot->entry.sequence_check != pos)
+    {
+        debug_check_fail++;
+    }
+#endif /* SS_DEBUG */
+    *result = slot->entry;
+    __atomic_store_n(&slot->seq, pos + queue_config->queue_limit, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * @brief Remove an item from a queue
+ *
+ * Remove an item from a FIFO queue. If the queue config is NULL, the function
+ * will behave as if for an empty queue.
+ *
+ * @param queue_config  The configuration and anchor structure for the queue
+ * @param result        A queue entry structure that will receive the result
+ * @return bool indicating whether an item was successfully dequeued
+ */
+bool mxs_dequeue(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result)
+{
+    return queue_config && queue_pop(queue_config, result, false);
 }
 
 /**
@@ -187,43 +242,5 @@ bool mxs_dequeue(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result)
  */
 bool mxs_dequeue_if_expired(QUEUE_CONFIG *queue_config, QUEUE_ENTRY *result)
 {
-    QUEUE_ENTRY *found = NULL;
-
-    if (queue_config && queue_config->has_entries)
-    {
-        spinlock_acquire(&queue_config->queue_lock);
-        if (mxs_queue_count(queue_config) > 0)
-        {
-            found = &(queue_config->queue_array[queue_config->start]);
-            if (found->heartbeat > hkheartbeat - queue_config->timeout)
-            {
-                found = NULL;
-            }
-            else
-            {
-#if defined(SS_DEBUG)
-                ss_dassert((queue_config->sequence_number) == (found->sequence_check + mxs_queue_count(queue_config)));
-                if ((queue_config->sequence_number) != (found->sequence_check + mxs_queue_count(queue_config)))
-                {
-                    debug_check_fail++;
-                }
-#endif /* SS_DEBUG */
-                result->heartbeat = found->heartbeat;
-                result->queued_object = found->queued_object;
-                if (++queue_config->start > queue_config->queue_limit)
-                {
-                    queue_config->start = 0;
-                }
-                queue_config->has_entries = (mxs_queue_count(queue_config) > 0);
-            }
-        }
-        spinlock_release(&queue_config->queue_lock);
-    }
-    return (found != NULL);
+    return queue_config && queue_pop(queue_config, result, true);
 }
-
-static inline int mxs_queue_count(QUEUE_CONFIG *queue_config)
-{
-    int count = queue_config->end - queue_config->start;
-    return count < 0 ? (count + queue_config->queue_limit + 1) : count;
-}
\ No newline at end of file
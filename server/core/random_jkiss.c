@@ -23,8 +23,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 #include <maxscale/random_jkiss.h>
 #include <maxscale/debug.h>
+#include <maxscale/platform.h>
 
 /* Public domain code for JKISS RNG - Comment header added */
 
@@ -34,6 +36,79 @@
 static unsigned int x = 123456789, y = 987654321, z = 43219876, c = 6543217; /* Seed variables */
 static bool init = false;
 
+/**
+ * The state of the generator of a thread
+ */
+typedef struct
+{
+    unsigned int x, y, z, c;
+    bool seeded;
+} JKISS_STATE;
+
+static thread_local JKISS_STATE thread_state;
+
+static unsigned int random_jkiss_devrand(void);
+
+/**
+ * Step a generator, the same algorithm as random_jkiss
+ */
+static inline unsigned int jkiss_next(JKISS_STATE *s)
+{
+    unsigned long long t;
+
+    s->x = 314527869 * s->x + 1234567;
+    s->y ^= s->y << 5;
+    s->y ^= s->y >> 7;
+    s->y ^= s->y << 22;
+    t = 4294584393ULL * s->z + s->c;
+    s->c = t >> 32;
+    s->z = t;
+    return s->x + s->y + s->z;
+}
+
+/**
+ * Seed the generator of the calling thread
+ *
+ * If /dev/urandom can not be read, the default seeds are mixed with the
+ * address of the state and the time so that the threads still differ.
+ */
+static void jkiss_seed(JKISS_STATE *s)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned int mix = (unsigned int)(uintptr_t)s ^ (unsigned int)ts.tv_nsec;
+
+    s->x = random_jkiss_devrand();
+    s->y = random_jkiss_devrand();
+    s->z = random_jkiss_devrand();
+    s->c = random_jkiss_devrand();
+
+    s->x = s->x ? s->x : 123456789 ^ mix;
+    s->y = s->y ? s->y : 987654321 ^ mix;
+    s->z = s->z ? s->z : 43219876 ^ mix;
+    s->c = (s->c ? s->c : 6543217 ^ mix) % 698769068 + 1; /* Should be less than 698769069 */
+
+    if (s->y == 0)
+    {
+        /** The xorshift part would only produce zeros */
+        s->y = 987654321;
+    }
+
+    s->seeded = true;
+}
+
+unsigned int random_jkiss_thread(void)
+{
+    JKISS_STATE *s = &thread_state;
+
+    if (!s->seeded)
+    {
+        jkiss_seed(s);
+    }
+
+    return jkiss_next(s);
+}
+
 unsigned int random_jkiss(void)
 {
     unsigned long long t;
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file replyparser.c  A streaming parser of MySQL replies
+ */
+
+#include <maxscale/replyparser.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/protocol/mysql.h>
+
+#define REPLY_OK_HEADER          0x00
+#define REPLY_ERR_HEADER         0xff
+#define REPLY_EOF_HEADER         0xfe
+#define REPLY_LOCAL_INFILE       0xfb
+
+void mxs_reply_parser_init(MXS_REPLY_PARSER *parser, const MXS_REPLY_CB *cb,
+                           void *data, bool deprecate_eof)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->cb = cb;
+    parser->data = data;
+    parser->deprecate_eof = deprecate_eof;
+    parser->state = MXS_REPLY_EXPECTING_RESPONSE;
+}
+
+void mxs_reply_parser_reset(MXS_REPLY_PARSER *parser)
+{
+    parser->state = MXS_REPLY_EXPECTING_RESPONSE;
+    parser->n_columns = 0;
+    parser->n_fields = 0;
+    parser->n_rows = 0;
+    parser->n_results = 0;
+    parser->large = false;
+}
+
+void mxs_reply_parser_free(MXS_REPLY_PARSER *parser)
+{
+    MXS_FREE(parser->scratch);
+    parser->scratch = NULL;
+    parser->scratch_size = 0;
+}
+
+/**
+ * Get the status flags of an OK packet
+ *
+ * @param payload The payload
+ * @param len     Length of the payload
+ * @return The status flags or 0 if the packet is too short to have them
+ */
+static uint16_t ok_status(const uint8_t *payload, size_t len)
+{
+    size_t pos = 1;
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (pos >= len)
+        {
+            return 0;
+        }
+
+        /** Skip the affected rows and the last insert id */
+        pos += mxs_leint_bytes(payload + pos);
+    }
+
+    return pos + 2 <= len ? gw_mysql_get_byte2(payload + pos) : 0;
+}
+
+/**
+ * Check if a packet in the rows ends the result set
+ *
+ * A text row can start with 0xfe only if its first value is longer than
+ * 2^24 bytes, in which case the packet is a full 16MB one. An EOF packet is
+ * always shorter than 9 bytes.
+ */
+static bool is_result_end(MXS_REPLY_PARSER *parser, const uint8_t *payload, size_t len)
+{
+    return len > 0 && payload[0] == REPLY_EOF_HEADER &&
+           (parser->deprecate_eof ? len < GW_MYSQL_MAX_PACKET_LEN : len < MYSQL_EOF_PACKET_LEN);
+}
+
+/**
+ * Get the status flags of the packet that ends the rows
+ */
+static uint16_t result_end_status(MXS_REPLY_PARSER *parser, const uint8_t *payload, size_t len)
+{
+    if (parser->deprecate_eof)
+    {
+        return ok_status(payload, len);
+    }
+
+    /** EOF: header, warnings and status */
+    return len >= 5 ? gw_mysql_get_byte2(payload + 3) : 0;
+}
+
+/**
+ * Handle one complete packet
+ *
+ * @param parser The parser
+ * @param packet The packet, including the header
+ * @param len    Length of the packet
+ * @return The return value of the callback or true if none was called
+ */
+static bool handle_packet(MXS_REPLY_PARSER *parser, const uint8_t *packet, size_t len)
+{
+    const MXS_REPLY_CB *cb = parser->cb;
+    const uint8_t *payload = packet + MYSQL_HEADER_LEN;
+    size_t payload_len = len - MYSQL_HEADER_LEN;
+    bool large = payload_len == GW_MYSQL_MAX_PACKET_LEN;
+    bool rval = true;
+
+    if (parser->large)
+    {
+        /** A continuation of the previous packet */
+        parser->large = large;
+        return true;
+    }
+
+    if (payload_len == 0)
+    {
+        parser->state = MXS_REPLY_ERROR;
+        return true;
+    }
+
+    switch (parser->state)
+    {
+    case MXS_REPLY_EXPECTING_RESPONSE:
+        switch (payload[0])
+        {
+        case REPLY_OK_HEADER:
+            parser->n_results++;
+            parser->state = ok_status(payload, payload_len) & SERVER_MORE_RESULTS_EXIST ?
+                            MXS_REPLY_EXPECTING_RESPONSE : MXS_REPLY_DONE;
+            rval = cb->ok ? cb->ok(parser->data, packet, len) : true;
+            break;
+
+        case REPLY_ERR_HEADER:
+            parser->n_results++;
+            parser->state = MXS_REPLY_DONE;
+            rval = cb->err ? cb->err(parser->data, packet, len) : true;
+            break;
+
+        case REPLY_LOCAL_INFILE:
+            parser->state = MXS_REPLY_DONE;
+            rval = cb->local_infile ? cb->local_infile(parser->data, packet, len) : true;
+            break;
+
+        default:
+            if (mxs_leint_bytes(payload) > payload_len)
+            {
+                parser->state = MXS_REPLY_ERROR;
+            }
+            else
+            {
+                parser->n_columns = mxs_leint_value(payload);
+                parser->n_fields = 0;
+                parser->n_rows = 0;
+                parser->state = parser->n_columns > 0 ? MXS_REPLY_EXPECTING_FIELDS : MXS_REPLY_ERROR;
+
+                if (parser->state == MXS_REPLY_EXPECTING_FIELDS && cb->columns)
+                {
+                    rval = cb->columns(parser->data, parser->n_columns);
+                }
+            }
+            break;
+        }
+        break;
+
+    case MXS_REPLY_EXPECTING_FIELDS:
+        if (++parser->n_fields == parser->n_columns)
+        {
+            parser->state = parser->deprecate_eof ?
+                            MXS_REPLY_EXPECTING_ROWS : MXS_REPLY_EXPECTING_FIELD_EOF;
+        }
+        rval = cb->field ? cb->field(parser->data, packet, len, parser->n_fields - 1) : true;
+        break;
+
+    case MXS_REPLY_EXPECTING_FIELD_EOF:
+        parser->state = payload[0] == REPLY_EOF_HEADER && payload_len < MYSQL_EOF_PACKET_LEN ?
+                        MXS_REPLY_EXPECTING_ROWS : MXS_REPLY_ERROR;
+        break;
+
+    case MXS_REPLY_EXPECTING_ROWS:
+        if (payload[0] == REPLY_ERR_HEADER && !large)
+        {
+            /** Neither text nor binary rows can start with 0xff */
+            parser->n_results++;
+            parser->state = MXS_REPLY_DONE;
+            rval = cb->err ? cb->err(parser->data, packet, len) : true;
+        }
+        else if (is_result_end(parser, payload, payload_len))
+        {
+            bool more = result_end_status(parser, payload, payload_len) & SERVER_MORE_RESULTS_EXIST;
+            parser->n_results++;
+            parser->state = more ? MXS_REPLY_EXPECTING_RESPONSE : MXS_REPLY_DONE;
+            rval = cb->end ? cb->end(parser->data, packet, len, more) : true;
+        }
+        else
+        {
+            parser->n_rows++;
+            rval = cb->row ? cb->row(parser->data, packet, len, parser->n_rows - 1) : true;
+        }
+        break;
+
+    case MXS_REPLY_DONE:
+    case MXS_REPLY_ERROR:
+        ss_dassert(!true);
+        break;
+    }
+
+    parser->large = large;
+    return rval;
+}
+
+mxs_reply_state_t mxs_reply_parser_process(MXS_REPLY_PARSER *parser, GWBUF *buffer, size_t *offset)
+{
+    GWBUF *seg = buffer;
+    size_t seg_offset = *offset;
+    bool proceed = true;
+
+    while (seg && seg_offset >= GWBUF_LENGTH(seg))
+    {
+        seg_offset -= GWBUF_LENGTH(seg);
+        seg = seg->next;
+    }
+
+    while (proceed && seg && parser->state != MXS_REPLY_DONE && parser->state != MXS_REPLY_ERROR)
+    {
+        const uint8_t *ptr = (const uint8_t*)GWBUF_DATA(seg) + seg_offset;
+        size_t available = GWBUF_LENGTH(seg) - seg_offset;
+        uint8_t header[MYSQL_HEADER_LEN];
+        const uint8_t *packet = ptr;
+
+        if (available < MYSQL_HEADER_LEN)
+        {
+            if (gwbuf_copy_data(seg, seg_offset, MYSQL_HEADER_LEN, header) != MYSQL_HEADER_LEN)
+            {
+                break;
+            }
+            ptr = header;
+        }
+
+        size_t len = MYSQL_HEADER_LEN + gw_mysql_get_byte3(ptr);
+
+        if (available < len)
+        {
+            /** The packet spans several buffers */
+            if (gwbuf_length(seg) - seg_offset < len)
+            {
+                break;
+            }
+
+            if (parser->scratch_size < len)
+            {
+                uint8_t *scratch = MXS_REALLOC(parser->scratch, len);
+
+                if (scratch == NULL)
+                {
+                    break;
+                }
+
+                parser->scratch = scratch;
+                parser->scratch_size = len;
+            }
+
+            gwbuf_copy_data(seg, seg_offset, len, parser->scratch);
+            packet = parser->scratch;
+        }
+
+        proceed = handle_packet(parser, packet, len);
+        *offset += len;
+        seg_offset += len;
+
+        while (seg && seg_offset >= GWBUF_LENGTH(seg))
+        {
+            seg_offset -= GWBUF_LENGTH(seg);
+            seg = seg->next;
+        }
+    }
+
+    return parser->state;
+}
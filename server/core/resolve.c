@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file resolve.c - Cache of the resolved addresses of hosts
+ *
+ * The cache is a list that only grows, as the hosts are those of the
+ * configured servers. The host of an entry and its link to the next entry
+ * never change once the entry is in the list, so the list can be walked
+ * after its head has been read under the lock. Only the address itself is
+ * modified, under the lock, when the housekeeper resolves it again.
+ */
+
+#include "maxscale/resolve.h"
+
+#include <netdb.h>
+#include <string.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+typedef struct resolve_entry
+{
+    char                    *host; /*< The host name or address */
+    struct sockaddr_storage  addr; /*< The resolved address, protected by resolve_lock */
+    struct resolve_entry    *next;
+} RESOLVE_ENTRY;
+
+static RESOLVE_ENTRY *resolve_entries = NULL;
+static SPINLOCK resolve_lock = SPINLOCK_INIT;
+
+/**
+ * Resolve a host with getaddrinfo and take its first address
+ *
+ * @param host The host
+ * @param addr The address is stored here
+ *
+ * @return True if the host was resolved
+ */
+static bool resolve_host(const char *host, struct sockaddr_storage *addr)
+{
+    struct addrinfo *ai = NULL, hint = {};
+    hint.ai_socktype = SOCK_STREAM;
+    hint.ai_family = AF_UNSPEC;
+    hint.ai_flags = AI_ALL;
+    int rc = getaddrinfo(host, NULL, &hint, &ai);
+    bool rval = false;
+
+    if (rc != 0)
+    {
+        MXS_ERROR("Failed to obtain address for host %s: %s", host, gai_strerror(rc));
+    }
+    else if (ai)
+    {
+        /* Take the first one */
+        memset(addr, 0, sizeof(*addr));
+        memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+        freeaddrinfo(ai);
+        rval = true;
+    }
+
+    return rval;
+}
+
+static RESOLVE_ENTRY* resolve_head()
+{
+    spinlock_acquire(&resolve_lock);
+    RESOLVE_ENTRY *entry = resolve_entries;
+    spinlock_release(&resolve_lock);
+    return entry;
+}
+
+/**
+ * Copy the cached address of a host
+ *
+ * @param host The host
+ * @param addr The address is stored here
+ *
+ * @return True if the host was in the cache
+ */
+static bool resolve_lookup(const char *host, struct sockaddr_storage *addr)
+{
+    for (RESOLVE_ENTRY *entry = resolve_head(); entry; entry = entry->next)
+    {
+        if (strcmp(entry->host, host) == 0)
+        {
+            spinlock_acquire(&resolve_lock);
+            *addr = entry->addr;
+            spinlock_release(&resolve_lock);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Add the address of a host to the cache
+ *
+ * If another thread added the host first, the address is not added again.
+ *
+ * @param host The host
+ * @param addr Its address
+ */
+static void resolve_add(const char *host, const struct sockaddr_storage *addr)
+{
+    RESOLVE_ENTRY *entry = (RESOLVE_ENTRY*)MXS_MALLOC(sizeof(*entry));
+    char *name = MXS_STRDUP(host);
+
+    if (entry && name)
+    {
+        entry->host = name;
+        entry->addr = *addr;
+
+        spinlock_acquire(&resolve_lock);
+
+        for (RESOLVE_ENTRY *e = resolve_entries; e; e = e->next)
+        {
+            if (strcmp(e->host, host) == 0)
+            {
+                spinlock_release(&resolve_lock);
+                MXS_FREE(name);
+                MXS_FREE(entry);
+                return;
+            }
+        }
+
+        entry->next = resolve_entries;
+        resolve_entries = entry;
+        spinlock_release(&resolve_lock);
+    }
+    else
+    {
+        MXS_FREE(name);
+        MXS_FREE(entry);
+    }
+}
+
+bool resolve_address(const char *host, struct sockaddr_storage *addr, bool cached)
+{
+    if (cached && resolve_lookup(host, addr))
+    {
+        return true;
+    }
+
+    bool rval = resolve_host(host, addr);
+
+    if (rval && cached)
+    {
+        resolve_add(host, addr);
+    }
+
+    return rval;
+}
+
+void resolve_refresh(void *data)
+{
+    for (RESOLVE_ENTRY *entry = resolve_head(); entry; entry = entry->next)
+    {
+        struct sockaddr_storage addr;
+
+        if (resolve_host(entry->host, &addr))
+        {
+            spinlock_acquire(&resolve_lock);
+            entry->addr = addr;
+            spinlock_release(&resolve_lock);
+        }
+    }
+}
+
+void resolve_init(void)
+{
+    hktask_add("Address resolution", resolve_refresh, NULL, RESOLVE_REFRESH_INTERVAL);
+}
@@ -21,6 +21,13 @@
  * 17/02/15     Mark Riddoch    Initial implementation
  *
  * @endverbatim
+ *
+ * The rows are encoded into buffers of RESULTSET_BATCH_SIZE bytes that are
+ * written to the DCB when they are full, a large result set is written with
+ * a few writes instead of several writes per row. The rows are either fetched
+ * one by one with the RESULT_ROW_CB of the set or pushed to the encoder with
+ * resultset_stream_row() by the RESULT_ROWS_CB of the set, which needs no
+ * allocations per row.
  */
 
 #include <string.h>
@@ -30,11 +37,32 @@
 #include <maxscale/buffer.h>
 #include <maxscale/dcb.h>
 
+/** The size of the buffers the result set is encoded into */
+#define RESULTSET_BATCH_SIZE (64 * 1024)
 
-static int mysql_send_fieldcount(DCB *, int);
-static int mysql_send_columndef(DCB *, const char *, int, int, uint8_t);
-static int mysql_send_eof(DCB *, int);
-static int mysql_send_row(DCB *, RESULT_ROW *, int);
+/** The initial size of the storage of the values of a row */
+#define RESULTSET_ROW_DATA_SIZE 256
+
+/**
+ * The state of a result set that is being streamed
+ */
+typedef struct resultset_stream
+{
+    DCB     *dcb;       /*< The DCB the result set is written to */
+    bool    json;       /*< Encode as JSON instead of the MySQL protocol */
+    GWBUF   *batch;     /*< The buffer that is being filled */
+    size_t  used;       /*< Bytes used in the batch */
+    uint8_t seqno;      /*< The sequence number of the next packet */
+    int     skipped;    /*< Rows skipped because of the offset */
+    int     sent;       /*< Rows encoded */
+    bool    ok;         /*< False after an allocation failure */
+} RESULT_STREAM;
+
+static void mysql_send_fieldcount(RESULT_STREAM *, int);
+static void mysql_send_columndef(RESULT_STREAM *, const char *, int, int);
+static void mysql_send_eof(RESULT_STREAM *);
+static void mysql_send_row(RESULT_STREAM *, const char **, int);
+static void json_send_row(RESULT_STREAM *, RESULT_COLUMN *, const char **);
 
 
 /**
@@ -55,6 +83,32 @@ resultset_create(RESULT_ROW_CB func, void *data)
         rval->column = NULL;
         rval->userdata = data;
         rval->fetchrow = func;
+        rval->streamrows = NULL;
+        rval->offset = 0;
+        rval->limit = -1;
+        rval->stream = NULL;
+    }
+    return rval;
+}
+
+/**
+ * Create a result set whose rows are pushed to the encoder
+ *
+ * The function is called once when the result set is streamed and it calls
+ * resultset_stream_row() for each row until it returns false.
+ *
+ * @param func  Function that streams all the rows
+ * @param data  Data to pass to the function
+ * @return      An empty resultset or NULL on error
+ */
+RESULTSET *
+resultset_create_streaming(RESULT_ROWS_CB func, void *data)
+{
+    RESULTSET *rval = resultset_create(NULL, data);
+
+    if (rval)
+    {
+        rval->streamrows = func;
     }
     return rval;
 }
@@ -84,6 +138,20 @@ resultset_free(RESULTSET *resultset)
     }
 }
 
+/**
+ * Only stream a part of the rows of a result set
+ *
+ * @param set       The result set
+ * @param offset    The number of rows to skip
+ * @param limit     The maximum number of rows to stream, -1 for all
+ */
+void
+resultset_set_page(RESULTSET *set, int offset, int limit)
+{
+    set->offset = offset > 0 ? offset : 0;
+    set->limit = limit >= 0 ? limit : -1;
+}
+
 /**
  * Add a new column to a result set. Columns are added to the right
  * of the result set, i.e. the existing order is maintained.
@@ -154,16 +222,16 @@ resultset_make_row(RESULTSET *set)
     RESULT_ROW *row;
     int i;
 
-    if ((row = (RESULT_ROW *)MXS_MALLOC(sizeof(RESULT_ROW))) == NULL)
+    /** The column pointers are allocated with the row */
+    if ((row = (RESULT_ROW *)MXS_MALLOC(sizeof(RESULT_ROW) + set->n_cols * sizeof(char *))) == NULL)
     {
         return NULL;
     }
     row->n_cols = set->n_cols;
-    if ((row->cols = (char **)MXS_MALLOC(row->n_cols * sizeof(char *))) == NULL)
-    {
-        MXS_FREE(row);
-        return NULL;
-    }
+    row->cols = (char **)(row + 1);
+    row->data = NULL;
+    row->data_len = 0;
+    row->data_size = 0;
 
     for (i = 0; i < set->n_cols; i++)
     {
@@ -173,33 +241,63 @@ resultset_make_row(RESULTSET *set)
 }
 
 /**
- * Free a result set row. If a column in the row has a non-null values
- * then the data is assumed to be a malloc'd pointer and will be free'd.
- * If any value is not a malloc'd pointer it should be removed before
- * making this call.
+ * Free a result set row and the values in it.
  *
  * @param row   The row to free
  */
 void
 resultset_free_row(RESULT_ROW *row)
 {
-    int i;
+    MXS_FREE(row->data);
+    MXS_FREE(row);
+}
 
-    for (i = 0; i < row->n_cols; i++)
+/**
+ * Make room for more values in the storage of a row
+ *
+ * @param row   The row
+ * @param len   The number of bytes needed
+ * @return      True on success
+ */
+static bool
+row_reserve(RESULT_ROW *row, size_t len)
+{
+    if (row->data_len + len > row->data_size)
     {
-        if (row->cols[i])
+        size_t size = row->data_size ? row->data_size : RESULTSET_ROW_DATA_SIZE;
+
+        while (size < row->data_len + len)
+        {
+            size *= 2;
+        }
+
+        char *data = (char *)MXS_REALLOC(row->data, size);
+
+        if (data == NULL)
+        {
+            return false;
+        }
+
+        /** Move the values that were already set */
+        for (int i = 0; i < row->n_cols; i++)
         {
-            MXS_FREE(row->cols[i]);
+            if (row->cols[i])
+            {
+                row->cols[i] = data + (row->cols[i] - row->data);
+            }
         }
+
+        row->data = data;
+        row->data_size = size;
     }
-    MXS_FREE(row->cols);
-    MXS_FREE(row);
+
+    return true;
 }
 
 /**
  * Add a value in a particular column of the row . The value is
- * a NULL terminated string and will be copied into malloc'd
- * storage by this routine.
+ * a NULL terminated string and will be copied into the storage of
+ * the row by this routine.
  *
  * @param row   The row ro add the column into
  * @param col   The column number (0 to n_cols - 1)
@@ -215,20 +313,150 @@ resultset_row_set(RESULT_ROW *row, int col, const char *value)
     }
     if (value)
     {
-        if ((row->cols[col] = MXS_STRDUP(value)) == NULL)
+        size_t len = strlen(value) + 1;
+
+        if (!row_reserve(row, len))
         {
             return 0;
         }
+        row->cols[col] = row->data + row->data_len;
+        memcpy(row->cols[col], value, len);
+        row->data_len += len;
         return 1;
     }
-    else if (row->cols[col])
-    {
-        MXS_FREE(row->cols[col]);
-    }
     row->cols[col] = NULL;
     return 1;
 }
 
+/**
+ * Write the filled part of the current batch to the DCB
+ *
+ * @param stream    The stream
+ */
+static void
+stream_flush(RESULT_STREAM *stream)
+{
+    if (stream->batch)
+    {
+        GWBUF *batch = stream->batch;
+        batch->end = (char *)batch->start + stream->used;
+        stream->batch = NULL;
+        stream->used = 0;
+        stream->dcb->func.write(stream->dcb, batch);
+    }
+}
+
+/**
+ * Get room for the next bytes of the result set. The current batch is
+ * written if it does not have enough room.
+ *
+ * @param stream    The stream
+ * @param len       The number of bytes needed
+ * @return          Pointer to the room or NULL if memory allocation failed
+ */
+static uint8_t *
+stream_reserve(RESULT_STREAM *stream, size_t len)
+{
+    if (stream->batch && stream->used + len > GWBUF_LENGTH(stream->batch))
+    {
+        stream_flush(stream);
+    }
+
+    if (stream->batch == NULL)
+    {
+        stream->batch = gwbuf_alloc(len > RESULTSET_BATCH_SIZE ? len : RESULTSET_BATCH_SIZE);
+
+        if (stream->batch == NULL)
+        {
+            stream->ok = false;
+            return NULL;
+        }
+    }
+
+    uint8_t *ptr = GWBUF_DATA(stream->batch) + stream->used;
+    stream->used += len;
+    return ptr;
+}
+
+static void
+stream_append(RESULT_STREAM *stream, const char *data, size_t len)
+{
+    uint8_t *ptr = stream_reserve(stream, len);
+
+    if (ptr)
+    {
+        memcpy(ptr, data, len);
+    }
+}
+
+/**
+ * Encode the rows of the result set
+ *
+ * @param set   The result set being streamed
+ */
+static void
+stream_rows(RESULTSET *set)
+{
+    if (set->streamrows)
+    {
+        set->streamrows(set, set->userdata);
+    }
+    else
+    {
+        RESULT_ROW *row;
+        bool more = true;
+
+        while (more && (row = (*set->fetchrow)(set, set->userdata)) != NULL)
+        {
+            more = resultset_stream_row(set, (const char **)row->cols);
+            resultset_free_row(row);
+        }
+    }
+}
+
+/**
+ * Add a row to a result set that is being streamed. The values are encoded
+ * directly, they are not needed after the call.
+ *
+ * @param set       The result set
+ * @param values    The values of the columns, NULL for a NULL value
+ * @return          True if more rows should be streamed, false if the
+ *                  limit of the set was reached or there was an error
+ */
+bool
+resultset_stream_row(RESULTSET *set, const char **values)
+{
+    RESULT_STREAM *stream = set->stream;
+
+    if (stream == NULL || !stream->ok)
+    {
+        return false;
+    }
+
+    if (stream->skipped < set->offset)
+    {
+        stream->skipped++;
+        return true;
+    }
+
+    if (set->limit >= 0 && stream->sent >= set->limit)
+    {
+        return false;
+    }
+
+    if (stream->json)
+    {
+        json_send_row(stream, set->column, values);
+    }
+    else
+    {
+        mysql_send_row(stream, values, set->n_cols);
+    }
+    stream->sent++;
+
+    return stream->ok && (set->limit < 0 || stream->sent < set->limit);
+}
+
 /**
  * Stream a result set using the MySQL protocol for encodign the result
  * set. Each row is retrieved by calling the function passed in the
@@ -240,81 +468,83 @@ resultset_row_set(RESULT_ROW *row, int col, const char *value)
 void
 resultset_stream_mysql(RESULTSET *set, DCB *dcb)
 {
+    RESULT_STREAM stream = {dcb, false, NULL, 0, 1, 0, 0, true};
     RESULT_COLUMN *col;
-    RESULT_ROW *row;
-    uint8_t seqno = 2;
 
-    mysql_send_fieldcount(dcb, set->n_cols);
+    set->stream = &stream;
+    mysql_send_fieldcount(&stream, set->n_cols);
 
     col = set->column;
     while (col)
     {
-        mysql_send_columndef(dcb, col->name, col->type, col->len, seqno++);
+        mysql_send_columndef(&stream, col->name, col->type, col->len);
         col = col->next;
     }
-    mysql_send_eof(dcb, seqno++);
-    while ((row = (*set->fetchrow)(set, set->userdata)) != NULL)
+    mysql_send_eof(&stream);
+    stream_rows(set);
+    mysql_send_eof(&stream);
+    stream_flush(&stream);
+    set->stream = NULL;
+}
+
+/**
+ * Get room for a MySQL protocol packet and fill in its header
+ *
+ * @param stream    The stream
+ * @param len       The payload length
+ * @return          Pointer to the payload or NULL on error
+ */
+static uint8_t *
+mysql_packet(RESULT_STREAM *stream, size_t len)
+{
+    uint8_t *ptr = stream_reserve(stream, len + 4);
+
+    if (ptr)
     {
-        mysql_send_row(dcb, row, seqno++);
-        resultset_free_row(row);
+        *ptr++ = len & 0xff;
+        *ptr++ = (len >> 8) & 0xff;
+        *ptr++ = (len >> 16) & 0xff;
+        *ptr++ = stream->seqno;
     }
-    mysql_send_eof(dcb, seqno);
+    stream->seqno++;
+    return ptr;
 }
 
 /**
  * Send the field count packet in a response packet sequence.
  *
- * @param dcb           DCB of connection to send result set to
+ * @param stream        The stream
  * @param count         Number of columns in the result set
- * @return              Non-zero on success
  */
-static int
-mysql_send_fieldcount(DCB *dcb, int count)
+static void
+mysql_send_fieldcount(RESULT_STREAM *stream, int count)
 {
-    GWBUF *pkt;
     uint8_t *ptr;
 
-    if ((pkt = gwbuf_alloc(5)) == NULL)
+    if ((ptr = mysql_packet(stream, 1)))
     {
-        return 0;
+        *ptr = count;                       // Length of result string
     }
-    ptr = GWBUF_DATA(pkt);
-    *ptr++ = 0x01;                  // Payload length
-    *ptr++ = 0x00;
-    *ptr++ = 0x00;
-    *ptr++ = 0x01;                  // Sequence number in response
-    *ptr++ = count;                 // Length of result string
-    return dcb->func.write(dcb, pkt);
 }
 
 
 /**
  * Send the column definition packet in a response packet sequence.
  *
- * @param dcb           The DCB of the connection
+ * @param stream        The stream
  * @param name          Name of the column
  * @param type          Column type
  * @param len           Column length
- * @param seqno         Packet sequence number
- * @return              Non-zero on success
  */
-static int
-mysql_send_columndef(DCB *dcb, const char *name, int type, int len, uint8_t seqno)
+static void
+mysql_send_columndef(RESULT_STREAM *stream, const char *name, int type, int len)
 {
-    GWBUF *pkt;
     uint8_t *ptr;
-    int plen;
 
-    if ((pkt = gwbuf_alloc(26 + strlen(name))) == NULL)
+    if ((ptr = mysql_packet(stream, 22 + strlen(name))) == NULL)
     {
-        return 0;
+        return;
     }
-    ptr = GWBUF_DATA(pkt);
-    plen = 22 + strlen(name);
-    *ptr++ = plen & 0xff;
-    *ptr++ = (plen >> 8) & 0xff;
-    *ptr++ = (plen >> 16) & 0xff;
-    *ptr++ = seqno;                         // Sequence number in response
     *ptr++ = 3;                             // Catalog is always def
     *ptr++ = 'd';
     *ptr++ = 'e';
@@ -348,92 +578,110 @@ mysql_send_columndef(DCB *dcb, const char *name, int type, int len, uint8_t seqn
     *ptr++ = 0;
     *ptr++ = 0;
     *ptr++ = 0;
-    return dcb->func.write(dcb, pkt);
 }
 
 
+/** The payload of an EOF packet with no warnings and autocommit enabled */
+static const uint8_t eof_packet_template[] =
+{
+    0xfe,             // EOF header
+    0x00, 0x00,       // No Errors
+    0x02, 0x00        // Autocommit enabled
+};
+
 /**
  * Send an EOF packet in a response packet sequence.
  *
- * @param dcb           The client connection
- * @param seqno         The sequence number of the EOF packet
- * @return              Non-zero on success
+ * @param stream        The stream
  */
-static int
-mysql_send_eof(DCB *dcb, int seqno)
+static void
+mysql_send_eof(RESULT_STREAM *stream)
 {
-    GWBUF   *pkt;
     uint8_t *ptr;
 
-    if ((pkt = gwbuf_alloc(9)) == NULL)
+    if ((ptr = mysql_packet(stream, sizeof(eof_packet_template))))
     {
-        return 0;
+        memcpy(ptr, eof_packet_template, sizeof(eof_packet_template));
     }
-    ptr = GWBUF_DATA(pkt);
-    *ptr++ = 0x05;
-    *ptr++ = 0x00;
-    *ptr++ = 0x00;
-    *ptr++ = seqno;                         // Sequence number in response
-    *ptr++ = 0xfe;                          // Length of result string
-    *ptr++ = 0x00;                          // No Errors
-    *ptr++ = 0x00;
-    *ptr++ = 0x02;                          // Autocommit enabled
-    *ptr++ = 0x00;
-    return dcb->func.write(dcb, pkt);
 }
 
+/**
+ * The length of a length-encoded integer
+ */
+static size_t
+lenenc_length(size_t len)
+{
+    return len < 251 ? 1 : len < 0x10000 ? 3 : len < 0x1000000 ? 4 : 9;
+}
+
+static uint8_t *
+lenenc_encode(uint8_t *ptr, size_t len)
+{
+    size_t bytes = lenenc_length(len) - 1;
+
+    if (bytes == 0)
+    {
+        *ptr++ = len;
+    }
+    else
+    {
+        *ptr++ = bytes == 2 ? 0xfc : bytes == 3 ? 0xfd : 0xfe;
+
+        for (size_t i = 0; i < bytes; i++)
+        {
+            *ptr++ = (len >> (8 * i)) & 0xff;
+        }
+    }
 
+    return ptr;
+}
 
 /**
  * Send a row packet in a response packet sequence.
  *
- * @param dcb           The client connection
- * @param row           The row to send
- * @param seqno         The sequence number of the EOF packet
- * @return              Non-zero on success
+ * @param stream        The stream
+ * @param values        The values of the row
+ * @param n_cols        The number of values
  */
-static int
-mysql_send_row(DCB *dcb, RESULT_ROW *row, int seqno)
+static void
+mysql_send_row(RESULT_STREAM *stream, const char **values, int n_cols)
 {
-    GWBUF *pkt;
-    int i, len = 4;
+    size_t len = 0;
     uint8_t *ptr;
+    int i;
 
-    for (i = 0; i < row->n_cols; i++)
+    for (i = 0; i < n_cols; i++)
     {
-        if (row->cols[i])
+        if (values[i])
         {
-            len += strlen(row->cols[i]);
+            size_t vlen = strlen(values[i]);
+            len += lenenc_length(vlen) + vlen;
+        }
+        else
+        {
+            len++;
         }
-        len++;
     }
 
-    if ((pkt = gwbuf_alloc(len)) == NULL)
+    if ((ptr = mysql_packet(stream, len)) == NULL)
     {
-        return 0;
+        return;
     }
-    ptr = GWBUF_DATA(pkt);
-    len -= 4;
-    *ptr++ = len & 0xff;
-    *ptr++ = (len >> 8) & 0xff;
-    *ptr++ = (len >> 16) & 0xff;
-    *ptr++ = seqno;
-    for (i = 0; i < row->n_cols; i++)
+
+    for (i = 0; i < n_cols; i++)
     {
-        if (row->cols[i])
+        if (values[i])
         {
-            len = strlen(row->cols[i]);
-            *ptr++ = len;
-            memcpy(ptr, row->cols[i], len);
+            len = strlen(values[i]);
+            ptr = lenenc_encode(ptr, len);
+            memcpy(ptr, values[i], len);
             ptr += len;
         }
         else
         {
-            *ptr++ = 0;     // NULL column
+            *ptr++ = 0xfb;  // NULL column
         }
     }
-
-    return dcb->func.write(dcb, pkt);
 }
 
 /**
@@ -464,57 +712,102 @@ value_is_numeric(const char *value)
 }
 
 /**
- * Stream a result set encoding it as a JSON object
- * Each row is retrieved by calling the function passed in the
- * argument list.
+ * Append a quoted JSON string
  *
- * @param set   The result set to stream
- * @param dcb   The connection to stream the result set to
+ * @param stream    The stream
+ * @param value     The string
  */
-void
-resultset_stream_json(RESULTSET *set, DCB *dcb)
+static void
+json_send_string(RESULT_STREAM *stream, const char *value)
 {
-    RESULT_COLUMN *col;
-    RESULT_ROW *row;
-    int rowno = 0;
+    const char *start = value;
+
+    stream_append(stream, "\"", 1);
 
-    dcb_printf(dcb, "[ ");
-    while ((row = (*set->fetchrow)(set, set->userdata)) != NULL)
+    for (; *value; value++)
     {
-        int i = 0;
-        if (rowno++ > 0)
+        unsigned char c = *value;
+
+        if (c == '"' || c == '\\' || c < 0x20)
         {
-            dcb_printf(dcb, ",\n");
+            char esc[8];
+
+            stream_append(stream, start, value - start);
+            snprintf(esc, sizeof(esc), c == '"' || c == '\\' ? "\\%c" : "\\u%04x", c);
+            stream_append(stream, esc, strlen(esc));
+            start = value + 1;
         }
-        dcb_printf(dcb, "{ ");
-        col = set->column;
-        while (col)
+    }
+
+    stream_append(stream, start, value - start);
+    stream_append(stream, "\"", 1);
+}
+
+/**
+ * Append a row as a JSON object
+ *
+ * @param stream    The stream
+ * @param col       The columns of the result set
+ * @param values    The values of the row
+ */
+static void
+json_send_row(RESULT_STREAM *stream, RESULT_COLUMN *col, const char **values)
+{
+    int i = 0;
+
+    if (stream->sent > 0)
+    {
+        stream_append(stream, ",\n", 2);
+    }
+    stream_append(stream, "{ ", 2);
+
+    while (col)
+    {
+        json_send_string(stream, col->name);
+        stream_append(stream, " : ", 3);
+
+        if (values[i])
         {
-            dcb_printf(dcb, "\"%s\" : ", col->name);
-            if (row->cols[i])
+            if (value_is_numeric(values[i]))
             {
-                if (value_is_numeric(row->cols[i]))
-                {
-                    dcb_printf(dcb, "%s", row->cols[i]);
-                }
-                else
-                {
-                    dcb_printf(dcb, "\"%s\"", row->cols[i]);
-                }
+                stream_append(stream, values[i], strlen(values[i]));
             }
             else
             {
-                dcb_printf(dcb, "null");
-            }
-            i++;
-            col = col->next;
-            if (col)
-            {
-                dcb_printf(dcb, ", ");
+                json_send_string(stream, values[i]);
             }
         }
-        resultset_free_row(row);
-        dcb_printf(dcb, "}");
+        else
+        {
+            stream_append(stream, "null", 4);
+        }
+        i++;
+        col = col->next;
+        if (col)
+        {
+            stream_append(stream, ", ", 2);
+        }
     }
-    dcb_printf(dcb, "]\n");
+    stream_append(stream, "}", 1);
+}
+
+/**
+ * Stream a result set encoding it as a JSON object
+ * Each row is retrieved by calling the function passed in the
+ * argument list.
+ *
+ * @param set   The result set to stream
+ * @param dcb   The connection to stream the result set to
+ */
+void
+resultset_stream_json(RESULTSET *set, DCB *dcb)
+{
+    RESULT_STREAM stream = {dcb, true, NULL, 0, 0, 0, 0, true};
+
+    set->stream = &stream;
+    stream_append(&stream, "[ ", 2);
+    stream_rows(set);
+    stream_append(&stream, "]\n", 2);
+    stream_flush(&stream);
+    set->stream = NULL;
 }
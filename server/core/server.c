@@ -32,11 +32,14 @@
  *
  * @endverbatim
  */
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <fcntl.h>
 #include <maxscale/service.h>
 #include <maxscale/session.h>
@@ -47,9 +50,13 @@
 #include <maxscale/log_manager.h>
 #include <maxscale/ssl.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/epoch.h>
+#include <maxscale/metrics.h>
 #include <maxscale/paths.h>
 
 #include "maxscale/monitor.h"
+#include "maxscale/persistpool.h"
 #include "maxscale/poll.h"
 
 /** The latin1 charset */
@@ -58,6 +65,98 @@
 static SPINLOCK server_spin = SPINLOCK_INIT;
 static SERVER *allServers = NULL;
 
+/** The server statistics that are registered as metrics */
+static const struct
+{
+    const char        *name;
+    const char        *help;
+    mxs_metric_type_t type;
+    size_t            offset; /**< Offset of the statistics in SERVER_STATS */
+} server_metrics[SERVER_N_METRICS] =
+{
+    {
+        "maxscale_server_connections_total", "Number of connections created to the server",
+        MXS_METRIC_COUNTER, offsetof(SERVER_STATS, n_connections)
+    },
+    {
+        "maxscale_server_connections", "Current number of connections to the server",
+        MXS_METRIC_GAUGE, offsetof(SERVER_STATS, n_current)
+    },
+    {
+        "maxscale_server_operations", "Current number of active operations on the server",
+        MXS_METRIC_GAUGE, offsetof(SERVER_STATS, n_current_ops)
+    },
+    {
+        "maxscale_server_persistent_connections", "Current number of pooled connections to the server",
+        MXS_METRIC_GAUGE, offsetof(SERVER_STATS, n_persistent)
+    },
+    {
+        "maxscale_server_ps_cache_hits_total", "Prepared statements taken from the cache of a connection",
+        MXS_METRIC_COUNTER, offsetof(SERVER_STATS, n_ps_cache_hits)
+    },
+    {
+        "maxscale_server_persistent_pings_total", "Pings sent to idle pooled connections",
+        MXS_METRIC_COUNTER, offsetof(SERVER_STATS, n_persistent_pings)
+    },
+    {
+        "maxscale_server_persistent_failed_pings_total", "Pooled connections that failed a ping",
+        MXS_METRIC_COUNTER, offsetof(SERVER_STATS, n_persistent_dead)
+    }
+};
+
+/**
+ * Register the statistics of a server as metrics
+ *
+ * @param stats The statistics
+ * @param name  The unique name of the server
+ */
+static void server_stats_register(SERVER_STATS *stats, const char *name)
+{
+    for (int i = 0; i < SERVER_N_METRICS; i++)
+    {
+        ts_stats_t value = *(ts_stats_t*)((char*)stats + server_metrics[i].offset);
+        stats->metrics[i] = mxs_metric_create_stats(server_metrics[i].name, server_metrics[i].help,
+                                                    server_metrics[i].type, "server", name,
+                                                    value, TS_STATS_SUM);
+    }
+}
+
+/**
+ * Free the statistics of a server
+ *
+ * Statistics that have been registered as metrics are only freed once no
+ * worker thread can be reading them.
+ *
+ * @param stats The statistics, any of which can be NULL
+ */
+static void server_stats_free(SERVER_STATS *stats)
+{
+    bool registered = false;
+
+    for (int i = 0; i < SERVER_N_METRICS; i++)
+    {
+        if (stats->metrics[i])
+        {
+            mxs_metric_destroy(stats->metrics[i]);
+            registered = true;
+        }
+    }
+
+    for (int i = 0; i < SERVER_N_METRICS; i++)
+    {
+        ts_stats_t value = *(ts_stats_t*)((char*)stats + server_metrics[i].offset);
+
+        if (registered)
+        {
+            mxs_epoch_defer(ts_stats_free, value);
+        }
+        else
+        {
+            ts_stats_free(value);
+        }
+    }
+}
+
 static void spin_reporter(void *, char *, int);
 static void server_parameter_free(SERVER_PARAM *tofree);
 
@@ -93,15 +192,29 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     char *my_name = MXS_STRDUP(name);
     char *my_protocol = MXS_STRDUP(protocol);
     char *my_authenticator = MXS_STRDUP(authenticator);
-    DCB **persistent = MXS_CALLOC(nthr, sizeof(*persistent));
-
-    if (!server || !my_name || !my_protocol || !my_authenticator || !persistent)
+    PERSIST_POOL *persistent = persistpool_alloc(nthr);
+    DCB **dcbs = (DCB**)MXS_CALLOC(nthr, sizeof(DCB*));
+    SERVER_STATS stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.n_connections = ts_stats_alloc();
+    stats.n_current = ts_stats_alloc();
+    stats.n_current_ops = ts_stats_alloc();
+    stats.n_persistent = ts_stats_alloc();
+    stats.n_ps_cache_hits = ts_stats_alloc();
+    stats.n_persistent_pings = ts_stats_alloc();
+    stats.n_persistent_dead = ts_stats_alloc();
+
+    if (!server || !my_name || !my_protocol || !my_authenticator || !persistent || !dcbs ||
+        !stats.n_connections || !stats.n_current || !stats.n_current_ops || !stats.n_persistent ||
+        !stats.n_ps_cache_hits || !stats.n_persistent_pings || !stats.n_persistent_dead)
     {
         MXS_FREE(server);
         MXS_FREE(my_name);
-        MXS_FREE(persistent);
+        persistpool_free(persistent, nthr);
+        MXS_FREE(dcbs);
         MXS_FREE(my_protocol);
         MXS_FREE(my_authenticator);
+        server_stats_free(&stats);
         return NULL;
     }
 
@@ -125,20 +238,36 @@ SERVER* server_alloc(const char *name, const char *address, unsigned short port,
     server->status_pending = SERVER_RUNNING;
     server->node_id = -1;
     server->rlag = MAX_RLAG_UNDEFINED;
+    server->rlag_us = -1;
+    server->load_weight = 100;
+    server->warmup_weight = 100;
+    server->metrics = NULL;
     server->master_id = -1;
     server->depth = -1;
     server->parameters = NULL;
     server->server_string = NULL;
     spinlock_init(&server->lock);
     server->persistent = persistent;
+    server->dcbs = dcbs;
     server->persistmax = 0;
     server->persistmaxtime = 0;
+    server->persistpingtime = 0;
     server->persistpoolmax = 0;
+    server->persistreuse = false;
+    server->compression = false;
+    server->ps_cache_size = 0;
+    server->fake_backend = false;
+    server->persisthits = NULL;
+    spinlock_init(&server->persisthits_lock);
     server->monuser[0] = '\0';
     server->monpw[0] = '\0';
     server->is_active = true;
     server->created_online = false;
     server->charset = SERVER_DEFAULT_CHARSET;
+    server_stats_register(&stats, my_name);
+    server->stats = stats;
+    server->state_version = 0;
+    server_publish_state(server);
 
     spinlock_acquire(&server_spin);
     server->next = allServers;
@@ -192,72 +321,118 @@ server_free(SERVER *tofreeserver)
 
         for (int i = 0; i < nthr; i++)
         {
-            dcb_persistent_clean_count(tofreeserver->persistent[i], i, true);
+            dcb_persistent_clean(tofreeserver, i, true);
         }
+
+        persistpool_free(tofreeserver->persistent, nthr);
     }
+    hashtable_free(tofreeserver->persisthits);
+    MXS_FREE(tofreeserver->dcbs);
+    MXS_FREE(tofreeserver->metrics);
+    server_stats_free(&tofreeserver->stats);
     MXS_FREE(tofreeserver);
     return 1;
 }
 
+/**
+ * Count a pool hit for a connection key
+ *
+ * @param server The server the connection was taken from
+ * @param user   The user of the connection
+ * @param key    The key of the connection
+ */
+static void server_count_persistent_hit(SERVER *server, const char *user, const char *key)
+{
+    char hitkey[strlen(user) + strlen(key) + 2];
+    sprintf(hitkey, "%s %s", user, key);
+
+    spinlock_acquire(&server->persisthits_lock);
+
+    if (server->persisthits == NULL &&
+        (server->persisthits = hashtable_alloc(100, hashtable_item_strhash, hashtable_item_strcmp)))
+    {
+        hashtable_memory_fns(server->persisthits, hashtable_item_strdup, NULL,
+                             hashtable_item_free, hashtable_item_free);
+    }
+
+    if (server->persisthits)
+    {
+        int64_t *hits = hashtable_fetch(server->persisthits, hitkey);
+
+        if (hits)
+        {
+            (*hits)++;
+        }
+        else if ((hits = MXS_MALLOC(sizeof(*hits))))
+        {
+            *hits = 1;
+
+            if (!hashtable_add(server->persisthits, hitkey, hits))
+            {
+                MXS_FREE(hits);
+            }
+        }
+    }
+
+    spinlock_release(&server->persisthits_lock);
+}
+
 /**
  * Get a DCB from the persistent connection pool, if possible
  *
+ * If the server reuses pooled connections as-is, a connection with the
+ * same key is preferred over any other connection of the user.
+ *
  * @param       server      The server to set the name on
  * @param       user        The name of the user needing the connection
  * @param       protocol    The name of the protocol needed for the connection
+ * @param       key         The key of the client, or NULL if the client has none
+ * @param       id          The thread ID of the caller
  */
 DCB *
-server_get_persistent(SERVER *server, const char *user, const char *protocol, int id)
+server_get_persistent(SERVER *server, const char *user, const char *protocol,
+                      const char *key, int id)
 {
-    DCB *dcb, *previous = NULL;
+    if (!(server->status & SERVER_RUNNING))
+    {
+        return NULL;
+    }
 
-    if (server->persistent[id]
-        && dcb_persistent_clean_count(server->persistent[id], id, false)
-        && server->persistent[id] // Check after cleaning
-        && (server->status & SERVER_RUNNING))
+    const char *reuse_key = server->persistreuse ? key : NULL;
+    DCB *dcb;
+
+    while ((dcb = persistpool_take(&server->persistent[id], user, protocol, reuse_key)))
     {
-        dcb = server->persistent[id];
-        while (dcb)
+        ts_stats_add(server->stats.n_persistent, -1);
+
+        /** The reply to a pending ping would be mistaken for the reply to
+         * the first query, the connection is closed instead of waiting */
+        if (dcb->dcb_errhandle_called || (dcb->flags & DCBF_HUNG) || dcb->persistping ||
+            time(NULL) - dcb->persistentstart > server->persistmaxtime)
         {
-            if (dcb->user
-                && dcb->protoname
-                && !dcb-> dcb_errhandle_called
-                && !(dcb->flags & DCBF_HUNG)
-                && 0 == strcmp(dcb->user, user)
-                && 0 == strcmp(dcb->protoname, protocol))
-            {
-                if (NULL == previous)
-                {
-                    server->persistent[id] = dcb->nextpersistent;
-                }
-                else
-                {
-                    previous->nextpersistent = dcb->nextpersistent;
-                }
-                MXS_FREE(dcb->user);
-                dcb->user = NULL;
-                atomic_add(&server->stats.n_persistent, -1);
-                atomic_add(&server->stats.n_current, 1);
-                return dcb;
-            }
-            else
-            {
-                MXS_DEBUG("%lu [server_get_persistent] Rejected dcb "
-                          "%p from pool, user %s looking for %s, protocol %s "
-                          "looking for %s, hung flag %s, error handle called %s.",
-                          pthread_self(),
-                          dcb,
-                          dcb->user ? dcb->user : "NULL",
-                          user,
-                          dcb->protoname ? dcb->protoname : "NULL",
-                          protocol,
-                          (dcb->flags & DCBF_HUNG) ? "true" : "false",
-                          dcb-> dcb_errhandle_called ? "true" : "false");
-            }
-            previous = dcb;
-            dcb = dcb->nextpersistent;
+            MXS_DEBUG("%lu [server_get_persistent] Rejected dcb %p from pool, "
+                      "hung flag %s, error handle called %s, ping pending %s, added %ld seconds ago.",
+                      pthread_self(),
+                      dcb,
+                      (dcb->flags & DCBF_HUNG) ? "true" : "false",
+                      dcb->dcb_errhandle_called ? "true" : "false",
+                      dcb->persistping ? "true" : "false",
+                      (long)(time(NULL) - dcb->persistentstart));
+            dcb_persistent_discard(dcb);
+            continue;
         }
+
+        if (reuse_key && dcb->persistkey && strcmp(dcb->persistkey, reuse_key) == 0)
+        {
+            server_count_persistent_hit(server, user, reuse_key);
+        }
+
+        MXS_FREE(dcb->user);
+        dcb->user = NULL;
+        ts_stats_add(server->stats.n_current, 1);
+        return dcb;
     }
+
     return NULL;
 }
 
@@ -335,9 +510,9 @@ printServer(const SERVER *server)
     printf("\tServer:                       %s\n", server->name);
     printf("\tProtocol:             %s\n", server->protocol);
     printf("\tPort:                 %d\n", server->port);
-    printf("\tTotal connections:    %d\n", server->stats.n_connections);
-    printf("\tCurrent connections:  %d\n", server->stats.n_current);
-    printf("\tPersistent connections:       %d\n", server->stats.n_persistent);
+    printf("\tTotal connections:    %" PRId64 "\n", ts_stats_sum(server->stats.n_connections));
+    printf("\tCurrent connections:  %" PRId64 "\n", ts_stats_sum(server->stats.n_current));
+    printf("\tPersistent connections:       %" PRId64 "\n", ts_stats_sum(server->stats.n_persistent));
     printf("\tPersistent actual max:        %d\n", server->persistmax);
 }
 
@@ -458,12 +633,12 @@ dprintAllServersJson(DCB *dcb)
         {
             dcb_printf(dcb, "    \"lastReplHeartbeat\": \"%lu\",\n", server->node_ts);
         }
-        dcb_printf(dcb, "    \"totalConnections\": \"%d\",\n",
-                   server->stats.n_connections);
-        dcb_printf(dcb, "    \"currentConnections\": \"%d\",\n",
-                   server->stats.n_current);
-        dcb_printf(dcb, "    \"currentOps\": \"%d\"\n",
-                   server->stats.n_current_ops);
+        dcb_printf(dcb, "    \"totalConnections\": \"%" PRId64 "\",\n",
+                   ts_stats_sum(server->stats.n_connections));
+        dcb_printf(dcb, "    \"currentConnections\": \"%" PRId64 "\",\n",
+                   ts_stats_sum(server->stats.n_current));
+        dcb_printf(dcb, "    \"currentOps\": \"%" PRId64 "\"\n",
+                   ts_stats_sum(server->stats.n_current_ops));
         if (el < len)
         {
             dcb_printf(dcb, "  },\n");
@@ -532,6 +707,32 @@ dprintServer(DCB *dcb, const SERVER *server)
         {
             dcb_printf(dcb, "\tSlave delay:                         %d\n", server->rlag);
         }
+        if (server->rlag_us >= 0)
+        {
+            dcb_printf(dcb, "\tSlave delay (ms):                    %.3f\n", server->rlag_us / 1000.0);
+        }
+    }
+    if (server->load_weight != 100)
+    {
+        dcb_printf(dcb, "\tLoad weight:                         %d%%\n", server->load_weight);
+    }
+    if (server->warmup_weight != 100)
+    {
+        dcb_printf(dcb, "\tWarm-up weight:                      %d%%\n", server->warmup_weight);
+    }
+    if (server->compression)
+    {
+        dcb_printf(dcb, "\tCompression:                         yes\n");
+    }
+    if (server->ps_cache_size)
+    {
+        dcb_printf(dcb, "\tPrepared statement cache size:       %ld\n", server->ps_cache_size);
+        dcb_printf(dcb, "\tPrepared statement cache hits:       %" PRId64 "\n",
+                   ts_stats_sum(server->stats.n_ps_cache_hits));
+    }
+    if (server->fake_backend)
+    {
+        dcb_printf(dcb, "\tFake backend:                        yes\n");
     }
     if (server->node_ts > 0)
     {
@@ -554,17 +755,40 @@ dprintServer(DCB *dcb, const SERVER *server)
             param = param->next;
         }
     }
-    dcb_printf(dcb, "\tNumber of connections:               %d\n", server->stats.n_connections);
-    dcb_printf(dcb, "\tCurrent no. of conns:                %d\n", server->stats.n_current);
-    dcb_printf(dcb, "\tCurrent no. of operations:           %d\n", server->stats.n_current_ops);
+    dcb_printf(dcb, "\tNumber of connections:               %" PRId64 "\n", ts_stats_sum(server->stats.n_connections));
+    dcb_printf(dcb, "\tCurrent no. of conns:                %" PRId64 "\n", ts_stats_sum(server->stats.n_current));
+    dcb_printf(dcb, "\tCurrent no. of operations:           %" PRId64 "\n", ts_stats_sum(server->stats.n_current_ops));
     if (server->persistpoolmax)
     {
-        dcb_printf(dcb, "\tPersistent pool size:                %d\n", server->stats.n_persistent);
+        dcb_printf(dcb, "\tPersistent pool size:                %" PRId64 "\n", ts_stats_sum(server->stats.n_persistent));
         poll_send_message(POLL_MSG_CLEAN_PERSISTENT, (void*)server);
-        dcb_printf(dcb, "\tPersistent measured pool size:       %d\n", server->stats.n_persistent);
+        dcb_printf(dcb, "\tPersistent measured pool size:       %" PRId64 "\n", ts_stats_sum(server->stats.n_persistent));
         dcb_printf(dcb, "\tPersistent actual size max:          %d\n", server->persistmax);
         dcb_printf(dcb, "\tPersistent pool size limit:          %ld\n", server->persistpoolmax);
         dcb_printf(dcb, "\tPersistent max time (secs):          %ld\n", server->persistmaxtime);
+        dcb_printf(dcb, "\tPersistent ping time (secs):         %ld\n", server->persistpingtime);
+        dcb_printf(dcb, "\tPersistent pings sent:               %" PRId64 "\n",
+                   ts_stats_sum(server->stats.n_persistent_pings));
+        dcb_printf(dcb, "\tPersistent pings failed:             %" PRId64 "\n",
+                   ts_stats_sum(server->stats.n_persistent_dead));
+        dcb_printf(dcb, "\tPersistent connection reuse:         %s\n",
+                   server->persistreuse ? "yes" : "no");
+
+        spinlock_acquire(&server->persisthits_lock);
+        if (server->persisthits)
+        {
+            HASHITERATOR *iter = hashtable_iterator(server->persisthits);
+            char *key;
+
+            while (iter && (key = hashtable_next(iter)))
+            {
+                int64_t *hits = hashtable_fetch(server->persisthits, key);
+                dcb_printf(dcb, "\tPersistent pool hits for %s: %" PRId64 "\n", key, *hits);
+            }
+
+            hashtable_iterator_free(iter);
+        }
+        spinlock_release(&server->persisthits_lock);
     }
     if (server->server_ssl)
     {
@@ -580,6 +804,10 @@ dprintServer(DCB *dcb, const SERVER *server)
                    l->ssl_key ? l->ssl_key : "null");
         dcb_printf(dcb, "\tSSL CA certificate:                  %s\n",
                    l->ssl_ca_cert ? l->ssl_ca_cert : "null");
+        dcb_printf(dcb, "\tSSL session cache:                   %s\n",
+                   l->ssl_session_cache ? "yes" : "no");
+        dcb_printf(dcb, "\tSSL sessions resumed:                %d\n", l->n_resumed);
+        dcb_printf(dcb, "\tKernel TLS:                          %s\n", l->ssl_ktls ? "yes" : "no");
     }
 }
 
@@ -605,7 +833,7 @@ spin_reporter(void *dcb, char *desc, int value)
 void
 dprintPersistentDCBs(DCB *pdcb, const SERVER *server)
 {
-    dcb_printf(pdcb, "Number of persistent DCBs: %d\n", server->stats.n_persistent);
+    dcb_printf(pdcb, "Number of persistent DCBs: %" PRId64 "\n", ts_stats_sum(server->stats.n_persistent));
 }
 
 /**
@@ -632,10 +860,10 @@ dListServers(DCB *dcb)
     while (server)
     {
         char *stat = server_status(server);
-        dcb_printf(dcb, "%-18s | %-15s | %5d | %11d | %s\n",
+        dcb_printf(dcb, "%-18s | %-15s | %5d | %11" PRId64 " | %s\n",
                    server->unique_name, server->name,
                    server->port,
-                   server->stats.n_current, stat);
+                   ts_stats_sum(server->stats.n_current), stat);
         MXS_FREE(stat);
         server = next_active_server(server->next);
     }
@@ -966,7 +1194,7 @@ serverRowCallback(RESULTSET *set, void *data)
         resultset_row_set(row, 1, server->name);
         sprintf(buf, "%d", server->port);
         resultset_row_set(row, 2, buf);
-        sprintf(buf, "%d", server->stats.n_current);
+        sprintf(buf, "%" PRId64, ts_stats_sum(server->stats.n_current));
         resultset_row_set(row, 3, buf);
         stat = server_status(server);
         resultset_row_set(row, 4, stat);
@@ -1006,6 +1234,219 @@ serverGetList()
     return set;
 }
 
+static uint64_t metrics_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Add a backend load sample of a server
+ *
+ * The counters are given as the server reports them and the sample stores
+ * how much they have increased since the previous sample. This is called by
+ * the monitor that probes the server, only one thread adds samples to a
+ * server at a time.
+ *
+ * @param server          The server
+ * @param rtt_us          Round trip time of the query in microseconds
+ * @param questions       Value of Questions
+ * @param threads_running Value of Threads_running
+ * @param rows_read       Value of Innodb_rows_read
+ */
+void server_add_metrics_sample(SERVER *server, uint32_t rtt_us, uint64_t questions,
+                               uint32_t threads_running, uint64_t rows_read)
+{
+    if (server->metrics == NULL)
+    {
+        SERVER_METRICS *metrics = MXS_CALLOC(1, sizeof(SERVER_METRICS));
+
+        if (metrics == NULL)
+        {
+            return;
+        }
+
+        spinlock_init(&metrics->lock);
+        atomic_synchronize();
+        server->metrics = metrics;
+    }
+
+    SERVER_METRICS *metrics = server->metrics;
+    uint64_t now = metrics_clock_ms();
+
+    spinlock_acquire(&metrics->lock);
+
+    SERVER_METRICS_SAMPLE *sample = &metrics->samples[metrics->next];
+    bool first = metrics->taken_ms == 0;
+
+    sample->time = time(NULL);
+    sample->interval_ms = first ? 0 : now - metrics->taken_ms;
+    sample->rtt_us = rtt_us;
+    sample->threads_running = threads_running;
+    /** The counters start from zero when the server is restarted */
+    sample->questions = first ? 0 : questions >= metrics->questions ?
+                        questions - metrics->questions : questions;
+    sample->rows_read = first ? 0 : rows_read >= metrics->rows_read ?
+                        rows_read - metrics->rows_read : rows_read;
+
+    metrics->questions = questions;
+    metrics->rows_read = rows_read;
+    metrics->taken_ms = now;
+    metrics->next = (metrics->next + 1) % SERVER_METRICS_SAMPLES;
+    metrics->count = MXS_MIN(metrics->count + 1, SERVER_METRICS_SAMPLES);
+
+    spinlock_release(&metrics->lock);
+}
+
+/**
+ * @brief Get the latest backend load sample of a server
+ *
+ * @param server The server
+ * @param sample The sample is copied here
+ * @return True if the server has a sample
+ */
+bool server_get_metrics_sample(const SERVER *server, SERVER_METRICS_SAMPLE *sample)
+{
+    SERVER_METRICS *metrics = server->metrics;
+    bool rval = false;
+
+    if (metrics)
+    {
+        spinlock_acquire(&metrics->lock);
+
+        if (metrics->count > 0)
+        {
+            *sample = metrics->samples[(metrics->next + SERVER_METRICS_SAMPLES - 1) % SERVER_METRICS_SAMPLES];
+            rval = true;
+        }
+
+        spinlock_release(&metrics->lock);
+    }
+
+    return rval;
+}
+
+/** The position of the metrics resultset */
+typedef struct
+{
+    int server; /**< Index of the server in the list of servers */
+    int sample; /**< Index of the sample of the server, oldest first */
+} METRICS_ROW_POS;
+
+static uint64_t per_second(uint64_t value, uint32_t interval_ms)
+{
+    return interval_ms ? value * 1000 / interval_ms : 0;
+}
+
+/**
+ * Provide a row to the result set that defines the backend load samples
+ *
+ * @param set   The result set
+ * @param data  The position of the next row
+ * @return      The next row or NULL
+ */
+static RESULT_ROW *
+serverMetricsRowCallback(RESULTSET *set, void *data)
+{
+    METRICS_ROW_POS *pos = (METRICS_ROW_POS*)data;
+    RESULT_ROW *row = NULL;
+
+    spinlock_acquire(&server_spin);
+
+    SERVER *server = allServers;
+
+    for (int i = 0; i < pos->server && server; i++)
+    {
+        server = server->next;
+    }
+
+    while (server && row == NULL)
+    {
+        SERVER_METRICS *metrics = server->metrics;
+        SERVER_METRICS_SAMPLE sample;
+        bool found = false;
+
+        if (metrics && SERVER_IS_ACTIVE(server))
+        {
+            spinlock_acquire(&metrics->lock);
+
+            if (pos->sample < metrics->count)
+            {
+                int oldest = (metrics->next + SERVER_METRICS_SAMPLES - metrics->count) % SERVER_METRICS_SAMPLES;
+                sample = metrics->samples[(oldest + pos->sample) % SERVER_METRICS_SAMPLES];
+                found = true;
+            }
+
+            spinlock_release(&metrics->lock);
+        }
+
+        if (found)
+        {
+            char buf[40];
+
+            pos->sample++;
+            row = resultset_make_row(set);
+            resultset_row_set(row, 0, server->unique_name);
+            sprintf(buf, "%ld", (long)sample.time);
+            resultset_row_set(row, 1, buf);
+            sprintf(buf, "%u", sample.rtt_us);
+            resultset_row_set(row, 2, buf);
+            sprintf(buf, "%" PRIu64, per_second(sample.questions, sample.interval_ms));
+            resultset_row_set(row, 3, buf);
+            sprintf(buf, "%u", sample.threads_running);
+            resultset_row_set(row, 4, buf);
+            sprintf(buf, "%" PRIu64, per_second(sample.rows_read, sample.interval_ms));
+            resultset_row_set(row, 5, buf);
+        }
+        else
+        {
+            pos->server++;
+            pos->sample = 0;
+            server = server->next;
+        }
+    }
+
+    spinlock_release(&server_spin);
+
+    if (row == NULL)
+    {
+        MXS_FREE(data);
+    }
+
+    return row;
+}
+
+/**
+ * Return a resultset that has the backend load samples of the servers
+ *
+ * @return A Result set
+ */
+RESULTSET *
+serverGetMetrics()
+{
+    RESULTSET *set;
+    METRICS_ROW_POS *data;
+
+    if ((data = (METRICS_ROW_POS *)MXS_CALLOC(1, sizeof(METRICS_ROW_POS))) == NULL)
+    {
+        return NULL;
+    }
+    if ((set = resultset_create(serverMetricsRowCallback, data)) == NULL)
+    {
+        MXS_FREE(data);
+        return NULL;
+    }
+    resultset_add_column(set, "Server", 20, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Time", 12, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "RTT_us", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Questions_per_sec", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Threads_running", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Innodb_rows_read_per_sec", 10, COL_TYPE_VARCHAR);
+
+    return set;
+}
+
 /*
  * Update the address value of a specific server
  *
@@ -1154,6 +1595,31 @@ static bool create_server_config(const SERVER *server, const char *filename)
         dprintf(file, "persistmaxtime=%ld\n", server->persistmaxtime);
     }
 
+    if (server->persistpingtime)
+    {
+        dprintf(file, "persistpingtime=%ld\n", server->persistpingtime);
+    }
+
+    if (server->persistreuse)
+    {
+        dprintf(file, "persistreuse=true\n");
+    }
+
+    if (server->compression)
+    {
+        dprintf(file, "compression=true\n");
+    }
+
+    if (server->ps_cache_size)
+    {
+        dprintf(file, "ps_cache_size=%ld\n", server->ps_cache_size);
+    }
+
+    if (server->fake_backend)
+    {
+        dprintf(file, "fake_backend=true\n");
+    }
+
     for (SERVER_PARAM *p = server->parameters; p; p = p->next)
     {
         if (p->active)
@@ -1185,6 +1651,9 @@ static bool create_server_config(const SERVER *server, const char *filename)
             dprintf(file, "ssl_cert_verify_depth=%d\n", server->server_ssl->ssl_cert_verify_depth);
         }
 
+        dprintf(file, "ssl_session_cache=%s\n", server->server_ssl->ssl_session_cache ? "true" : "false");
+        dprintf(file, "ssl_ktls=%s\n", server->server_ssl->ssl_ktls ? "true" : "false");
+
         const char *version = NULL;
 
         switch (server->server_ssl->ssl_method_type)
@@ -1311,6 +1780,7 @@ void server_set_status(SERVER *server, int bit)
     {
         /* Set the bit directly */
         server_set_status_nolock(server, bit);
+        server_publish_state(server);
     }
     spinlock_release(&server->lock);
 }
@@ -1338,10 +1808,63 @@ void server_clear_status(SERVER *server, int bit)
     {
         /* Clear bit directly */
         server_clear_status_nolock(server, bit);
+        server_publish_state(server);
     }
     spinlock_release(&server->lock);
 }
 
+/**
+ * @brief Publish the current state of a server to the routers
+ *
+ * The state is written between two increments of the version, so a reader
+ * that sees the same even version before and after reading the state has
+ * read all of it from one publication.
+ *
+ * @attention The caller must hold the lock of the server, the monitors
+ * publish the states while they hold the locks of their servers
+ *
+ * @param server Server whose state is published
+ */
+void server_publish_state(SERVER *server)
+{
+    uint64_t version = server->state_version;
+    atomic_store_uint64(&server->state_version, version + 1);
+    atomic_synchronize();
+
+    server->state.status = server->status;
+    server->state.rlag = server->rlag;
+    server->state.rlag_us = server->rlag_us;
+    server->state.depth = server->depth;
+    server->state.node_id = server->node_id;
+    server->state.node_ts = server->node_ts;
+    server->state.load_weight = server->load_weight * server->warmup_weight / 100;
+
+    atomic_store_uint64(&server->state_version, version + 2);
+}
+
+/**
+ * @brief Read the published state of a server
+ *
+ * This never takes a lock. If the state is being published, the read is
+ * retried until a complete state is read.
+ *
+ * @param server Server to read
+ * @param state  The state is copied here
+ */
+void server_get_state(const SERVER *server, SERVER_STATE *state)
+{
+    uint64_t before, after;
+
+    do
+    {
+        before = atomic_load_uint64(&server->state_version);
+        *state = *(volatile const SERVER_STATE*)&server->state;
+        atomic_synchronize();
+        after = atomic_load_uint64(&server->state_version);
+    }
+    while ((before & 1) || before != after);
+}
+
 bool server_is_mxs_service(const SERVER *server)
 {
     bool rval = false;
@@ -39,6 +39,7 @@
  * @endverbatim
  */
 #include <maxscale/service.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,12 +49,17 @@
 #include <sys/types.h>
 #include <math.h>
 #include <fcntl.h>
+#include <time.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/dcb.h>
+#include <maxscale/epoch.h>
+#include <maxscale/metrics.h>
 #include <maxscale/paths.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/listener.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/mysql_utils.h>
 #include <maxscale/poll.h>
 #include <maxscale/protocol.h>
 #include <maxscale/queuemanager.h>
@@ -62,6 +68,7 @@
 #include <maxscale/server.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 #include <maxscale/users.h>
 #include <maxscale/utils.h>
 #include <maxscale/version.h>
@@ -69,9 +76,13 @@
 #include "maxscale/config.h"
 #include "maxscale/filter.h"
 #include "maxscale/modules.h"
+#include "maxscale/poll.h"
 #include "maxscale/queuemanager.h"
 #include "maxscale/service.h"
 
+/** The maximum number of threads that load the users of the listeners at startup */
+#define SERVICE_STARTUP_THREADS 16
+
 /** Base value for server weights */
 #define SERVICE_BASE_SERVER_WEIGHT 1000
 
@@ -106,21 +117,42 @@ static void service_add_qualified_param(SERVICE*          svc,
 static void service_internal_restart(void *data);
 static void service_queue_check(void *data);
 static void service_calculate_weights(SERVICE *service);
+static int service_ports_started(SERVICE *service, int listeners);
+static void service_free_priority_users(SERVICE_PRIORITY_USER *users);
 
 SERVICE* service_alloc(const char *name, const char *router)
 {
     char *my_name = MXS_STRDUP(name);
     char *my_router = MXS_STRDUP(router);
     SERVICE *service = (SERVICE *)MXS_CALLOC(1, sizeof(*service));
+    ts_stats_t n_sessions = ts_stats_alloc();
+    ts_stats_t n_current = ts_stats_alloc();
+    ts_stats_t n_plain_out = ts_stats_alloc();
+    ts_stats_t n_compressed_out = ts_stats_alloc();
+    int n_latency = config_threadcount();
+    SERVICE_LATENCY *latency = (SERVICE_LATENCY*)MXS_CALLOC(n_latency, sizeof(SERVICE_LATENCY));
 
-    if (!my_name || !my_router || !service)
+    if (!my_name || !my_router || !service || !n_sessions || !n_current ||
+        !n_plain_out || !n_compressed_out || !latency)
     {
         MXS_FREE(my_name);
         MXS_FREE(my_router);
         MXS_FREE(service);
+        ts_stats_free(n_sessions);
+        ts_stats_free(n_current);
+        ts_stats_free(n_plain_out);
+        ts_stats_free(n_compressed_out);
+        MXS_FREE(latency);
         return NULL;
     }
 
+    service->stats.n_sessions = n_sessions;
+    service->stats.n_current = n_current;
+    service->stats.n_plain_out = n_plain_out;
+    service->stats.n_compressed_out = n_compressed_out;
+    service->stats.latency = latency;
+    service->stats.n_latency = n_latency;
+
     if ((service->router = load_module(my_router, MODULE_ROUTER)) == NULL)
     {
         char* home = get_libdir();
@@ -139,6 +171,11 @@ SERVICE* service_alloc(const char *name, const char *router)
         MXS_FREE(my_name);
         MXS_FREE(my_router);
         MXS_FREE(service);
+        ts_stats_free(n_sessions);
+        ts_stats_free(n_current);
+        ts_stats_free(n_plain_out);
+        ts_stats_free(n_compressed_out);
+        MXS_FREE(latency);
         return NULL;
     }
 
@@ -160,6 +197,11 @@ SERVICE* service_alloc(const char *name, const char *router)
     service->routerOptions = NULL;
     service->log_auth_warnings = true;
     service->strip_db_esc = true;
+    service->priority = SESSION_PRIORITY_NORMAL;
+    service->priority_users = NULL;
+    service->client_compression = false;
+    service->client_compression_level = SERVICE_DEFAULT_COMPRESSION_LEVEL;
+    service->client_compression_threshold = SERVICE_DEFAULT_COMPRESSION_THRESHOLD;
     if (service->name == NULL || service->routerModule == NULL)
     {
         if (service->name)
@@ -167,6 +209,11 @@ SERVICE* service_alloc(const char *name, const char *router)
             MXS_FREE(service->name);
         }
         MXS_FREE(service);
+        ts_stats_free(n_sessions);
+        ts_stats_free(n_current);
+        ts_stats_free(n_plain_out);
+        ts_stats_free(n_compressed_out);
+        MXS_FREE(latency);
         return NULL;
     }
     service->stats.started = time(0);
@@ -174,6 +221,23 @@ SERVICE* service_alloc(const char *name, const char *router)
     service->state = SERVICE_STATE_ALLOC;
     spinlock_init(&service->spin);
 
+    service->stats.metrics[0] = mxs_metric_create_stats("maxscale_service_sessions_total",
+                                                        "Number of sessions created on the service",
+                                                        MXS_METRIC_COUNTER, "service", service->name,
+                                                        n_sessions, TS_STATS_SUM);
+    service->stats.metrics[1] = mxs_metric_create_stats("maxscale_service_sessions",
+                                                        "Current number of sessions on the service",
+                                                        MXS_METRIC_GAUGE, "service", service->name,
+                                                        n_current, TS_STATS_SUM);
+    service->stats.metrics[2] = mxs_metric_create_stats("maxscale_service_client_uncompressed_bytes_total",
+                                                        "Bytes compressed for the clients of the service",
+                                                        MXS_METRIC_COUNTER, "service", service->name,
+                                                        n_plain_out, TS_STATS_SUM);
+    service->stats.metrics[3] = mxs_metric_create_stats("maxscale_service_client_compressed_bytes_total",
+                                                        "Compressed bytes sent to the clients of the service",
+                                                        MXS_METRIC_COUNTER, "service", service->name,
+                                                        n_compressed_out, TS_STATS_SUM);
+
     spinlock_acquire(&service_spin);
     service->next = allServices;
     allServices = service;
@@ -225,21 +289,14 @@ static inline void close_port(SERV_LISTENER *port)
 }
 
 /**
- * Start an individual port/protocol pair
+ * Create the listener DCB of a port and load its protocol and authenticator
  *
  * @param service       The service
- * @param port          The port to start
- * @return              The number of listeners started
+ * @param port          The port to prepare
+ * @return              True on success, false if the port was closed
  */
-static int
-serviceStartPort(SERVICE *service, SERV_LISTENER *port)
+static bool service_prepare_port(SERVICE *service, SERV_LISTENER *port)
 {
-    const size_t ANY_IPV4_ADDRESS_LEN = 7; // strlen("0:0:0:0");
-
-    int listeners = 0;
-    size_t config_bind_len =
-        (port->address ? strlen(port->address) : ANY_IPV4_ADDRESS_LEN) + 1 + UINTLEN(port->port);
-    char config_bind[config_bind_len + 1]; // +1 for NULL
     MXS_PROTOCOL *funcs;
 
     if (service == NULL || service->router == NULL || service->router_instance == NULL)
@@ -248,7 +305,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
         MXS_ERROR("Attempt to start port with null or incomplete service");
         close_port(port);
         ss_dassert(false);
-        return 0;
+        return false;
     }
 
     port->listener = dcb_alloc(DCB_ROLE_SERVICE_LISTENER, port);
@@ -257,7 +314,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
     {
         MXS_ERROR("Failed to create listener for service %s.", service->name);
         close_port(port);
-        return 0;
+        return false;
     }
 
     port->listener->service = service;
@@ -272,7 +329,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
         MXS_ERROR("Unable to load protocol module %s. Listener for service %s not started.",
                   port->protocol, service->name);
         close_port(port);
-        return 0;
+        return false;
     }
 
     memcpy(&(port->listener->func), funcs, sizeof(MXS_PROTOCOL));
@@ -295,7 +352,7 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
         MXS_ERROR("Failed to load authenticator module '%s' for listener '%s'",
                   authenticator_name, port->name);
         close_port(port);
-        return 0;
+        return false;
     }
 
     memcpy(&port->listener->authfunc, authfuncs, sizeof(MXS_AUTHENTICATOR));
@@ -305,6 +362,46 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
      * listeners aren't normal DCBs, we can skip that.
      */
 
+    return true;
+}
+
+/**
+ * Load the authentication users of a prepared port
+ *
+ * The users of different ports can be loaded at the same time.
+ *
+ * @param port The port
+ * @return The return value of the loadusers entry point of the authenticator
+ */
+static int service_load_port_users(SERV_LISTENER *port)
+{
+    int rc = MXS_AUTH_LOADUSERS_OK;
+
+    if (port->listener->authfunc.loadusers)
+    {
+        rc = port->listener->authfunc.loadusers(port);
+    }
+
+    return rc;
+}
+
+/**
+ * Start listening on a prepared port
+ *
+ * @param service  The service
+ * @param port     The port to start
+ * @param users_rc The result of loading the users of the port
+ * @return The number of listeners started
+ */
+static int service_listen_port(SERVICE *service, SERV_LISTENER *port, int users_rc)
+{
+    const size_t ANY_IPV4_ADDRESS_LEN = 7; // strlen("0:0:0:0");
+
+    int listeners = 0;
+    size_t config_bind_len =
+        (port->address ? strlen(port->address) : ANY_IPV4_ADDRESS_LEN) + 1 + UINTLEN(port->port);
+    char config_bind[config_bind_len + 1]; // +1 for NULL
+
     if (port->address)
     {
         sprintf(config_bind, "%s|%d", port->address, port->port);
@@ -314,25 +411,21 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
         sprintf(config_bind, "::|%d", port->port);
     }
 
-    /** Load the authentication users before before starting the listener */
-    if (port->listener->authfunc.loadusers)
+    switch (users_rc)
     {
-        switch (port->listener->authfunc.loadusers(port))
-        {
-        case MXS_AUTH_LOADUSERS_FATAL:
-            MXS_ERROR("[%s] Fatal error when loading users for listener '%s', "
-                      "service is not started.", service->name, port->name);
-            close_port(port);
-            return 0;
+    case MXS_AUTH_LOADUSERS_FATAL:
+        MXS_ERROR("[%s] Fatal error when loading users for listener '%s', "
+                  "service is not started.", service->name, port->name);
+        close_port(port);
+        return 0;
 
-        case MXS_AUTH_LOADUSERS_ERROR:
-            MXS_WARNING("[%s] Failed to load users for listener '%s', authentication"
-                        " might not work.", service->name, port->name);
-            break;
+    case MXS_AUTH_LOADUSERS_ERROR:
+        MXS_WARNING("[%s] Failed to load users for listener '%s', authentication"
+                    " might not work.", service->name, port->name);
+        break;
 
-        default:
-            break;
-        }
+    default:
+        break;
     }
 
     /**
@@ -366,6 +459,20 @@ serviceStartPort(SERVICE *service, SERV_LISTENER *port)
     return listeners;
 }
 
+/**
+ * Start an individual port/protocol pair
+ *
+ * @param service       The service
+ * @param port          The port to start
+ * @return              The number of listeners started
+ */
+static int
+serviceStartPort(SERVICE *service, SERV_LISTENER *port)
+{
+    return service_prepare_port(service, port) ?
+           service_listen_port(service, port, service_load_port_users(port)) : 0;
+}
+
 /**
  * Start all ports for a service.
  * serviceStartAllPorts will try to start all listeners associated with the service.
@@ -387,32 +494,7 @@ int serviceStartAllPorts(SERVICE* service)
             port = port->next;
         }
 
-        if (service->state == SERVICE_STATE_FAILED)
-        {
-            listeners = 0;
-        }
-        else if (listeners)
-        {
-            service->state = SERVICE_STATE_STARTED;
-            service->stats.started = time(0);
-        }
-        else if (service->retry_start)
-        {
-            /** Service failed to start any ports. Try again later. */
-            service->stats.n_failed_starts++;
-            char taskname[strlen(service->name) + strlen("_start_retry_") +
-                          (int) ceil(log10(INT_MAX)) + 1];
-            int retry_after = MXS_MIN(service->stats.n_failed_starts * 10, SERVICE_MAX_RETRY_INTERVAL);
-            snprintf(taskname, sizeof(taskname), "%s_start_retry_%d",
-                     service->name, service->stats.n_failed_starts);
-            hktask_oneshot(taskname, service_internal_restart,
-                           (void*) service, retry_after);
-            MXS_NOTICE("Failed to start service %s, retrying in %d seconds.",
-                       service->name, retry_after);
-
-            /** This will prevent MaxScale from shutting down if service start is retried later */
-            listeners = 1;
-        }
+        listeners = service_ports_started(service, listeners);
     }
     else
     {
@@ -423,6 +505,45 @@ int serviceStartAllPorts(SERVICE* service)
     return listeners;
 }
 
+/**
+ * Update the state of a service after its ports have been started
+ *
+ * @param service   The service, which has ports
+ * @param listeners The number of listeners that were started
+ * @return The number of started listeners or 1 if the start is retried later
+ */
+static int service_ports_started(SERVICE *service, int listeners)
+{
+    if (service->state == SERVICE_STATE_FAILED)
+    {
+        listeners = 0;
+    }
+    else if (listeners)
+    {
+        service->state = SERVICE_STATE_STARTED;
+        service->stats.started = time(0);
+    }
+    else if (service->retry_start)
+    {
+        /** Service failed to start any ports. Try again later. */
+        service->stats.n_failed_starts++;
+        char taskname[strlen(service->name) + strlen("_start_retry_") +
+                      (int) ceil(log10(INT_MAX)) + 1];
+        int retry_after = MXS_MIN(service->stats.n_failed_starts * 10, SERVICE_MAX_RETRY_INTERVAL);
+        snprintf(taskname, sizeof(taskname), "%s_start_retry_%d",
+                 service->name, service->stats.n_failed_starts);
+        hktask_oneshot(taskname, service_internal_restart,
+                       (void*) service, retry_after);
+        MXS_NOTICE("Failed to start service %s, retrying in %d seconds.",
+                   service->name, retry_after);
+
+        /** This will prevent MaxScale from shutting down if service start is retried later */
+        listeners = 1;
+    }
+
+    return listeners;
+}
+
 /** Helper function for copying an array of strings */
 static char** copy_string_array(char** original)
 {
@@ -465,37 +586,21 @@ static void free_string_array(char** array)
 }
 
 /**
- * Start a service
- *
- * This function loads the protocol modules for each port on which the
- * service listens and starts the listener on that port
- *
- * Also create the router_instance for the service.
+ * Create the router_instance of a service
  *
  * @param service       The Service that should be started
- * @return      Returns the number of listeners created
+ * @return      True if the router instance was created
  */
-int serviceInitialize(SERVICE *service)
+static bool service_create_instance(SERVICE *service)
 {
     /** Calculate the server weights */
     service_calculate_weights(service);
 
-    int listeners = 0;
     char **router_options = copy_string_array(service->routerOptions);
 
     if ((service->router_instance = service->router->createInstance(service, router_options)))
     {
         service->capabilities |= service->router->getCapabilities(service->router_instance);
-
-        if (!config_get_global_options()->config_check)
-        {
-            listeners = serviceStartAllPorts(service);
-        }
-        else
-        {
-            /** We're only checking that the configuration is valid */
-            listeners++;
-        }
     }
     else
     {
@@ -505,7 +610,7 @@ int serviceInitialize(SERVICE *service)
 
     free_string_array(router_options);
 
-    return listeners;
+    return service->router_instance != NULL;
 }
 
 /**
@@ -612,27 +717,206 @@ bool serviceStartListener(SERVICE *service, const char *name)
     return rval;
 }
 
+/**
+ * The ports whose users are loaded at the same time at startup
+ */
+typedef struct service_users_job
+{
+    SERV_LISTENER **ports;   /**< The prepared ports */
+    int            *rc;      /**< The result of loading the users of each port */
+    int             n_ports; /**< Number of ports */
+    int             next;    /**< The next port to take, incremented atomically */
+} SERVICE_USERS_JOB;
+
+/**
+ * Load the users of ports until all of them have been taken
+ *
+ * @param job The ports
+ */
+static void service_load_users(SERVICE_USERS_JOB *job)
+{
+    int i;
+
+    while ((i = atomic_add(&job->next, 1)) < job->n_ports)
+    {
+        job->rc[i] = service_load_port_users(job->ports[i]);
+    }
+}
+
+static void service_users_main(void *data)
+{
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed in a startup thread, the users "
+                  "are loaded by the other threads.");
+        return;
+    }
+
+    service_load_users((SERVICE_USERS_JOB*)data);
+    mysql_thread_end();
+}
+
+/**
+ * Load the users of all ports with up to SERVICE_STARTUP_THREADS threads
+ *
+ * @param job The ports
+ * @return Number of threads that loaded the users
+ */
+static int service_load_all_users(SERVICE_USERS_JOB *job)
+{
+    THREAD threads[SERVICE_STARTUP_THREADS];
+    int n_threads = 0;
+
+    /** The calling thread loads users as well */
+    while (n_threads < job->n_ports - 1 && n_threads < SERVICE_STARTUP_THREADS - 1 &&
+           thread_start(&threads[n_threads], service_users_main, job))
+    {
+        n_threads++;
+    }
+
+    service_load_users(job);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        thread_wait(threads[i]);
+    }
+
+    return n_threads + 1;
+}
+
+/**
+ * Get the seconds since the start of a phase of the startup and start the next one
+ *
+ * @param start The start of the phase, set to the current time
+ * @return The duration of the phase in seconds
+ */
+static double service_startup_phase(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double rval = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+    *start = now;
+
+    return rval;
+}
+
+/**
+ * Start all services
+ *
+ * The router instances are created and the protocol modules of the ports are
+ * loaded one service at a time. The users of all ports are then loaded in
+ * parallel, as that requires queries to the servers of each service. Finally
+ * the listeners are started in the order of the services.
+ *
+ * @return The number of started listeners or 0 if a service failed to start
+ */
 int service_launch_all()
 {
     SERVICE *ptr;
     int n = 0, i;
     bool error = false;
+    bool config_check = config_get_global_options()->config_check;
+    int n_ports = 0;
+    struct timespec start;
 
     config_enable_feedback_task();
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    ptr = allServices;
-    while (ptr && !ptr->svc_do_shutdown)
+    for (ptr = allServices; ptr && !ptr->svc_do_shutdown; ptr = ptr->next)
+    {
+        if (!service_create_instance(ptr))
+        {
+            MXS_ERROR("Failed to start service '%s'.", ptr->name);
+            error = true;
+        }
+        else if (config_check)
+        {
+            /** We're only checking that the configuration is valid */
+            n++;
+        }
+        else
+        {
+            for (SERV_LISTENER *port = ptr->ports; port; port = port->next)
+            {
+                n_ports++;
+            }
+        }
+    }
+
+    MXS_NOTICE("Created the router instances of the services in %.3f seconds.",
+               service_startup_phase(&start));
+
+    if (config_check || error)
+    {
+        return error ? 0 : n;
+    }
+
+    SERVICE_USERS_JOB job = { 0 };
+    job.ports = (SERV_LISTENER**)MXS_CALLOC(n_ports + 1, sizeof(SERV_LISTENER*));
+    job.rc = (int*)MXS_CALLOC(n_ports + 1, sizeof(int));
+
+    if (job.ports == NULL || job.rc == NULL)
+    {
+        MXS_FREE(job.ports);
+        MXS_FREE(job.rc);
+        return 0;
+    }
+
+    for (ptr = allServices; ptr && !ptr->svc_do_shutdown; ptr = ptr->next)
+    {
+        for (SERV_LISTENER *port = ptr->ports; port; port = port->next)
+        {
+            if (service_prepare_port(ptr, port))
+            {
+                job.ports[job.n_ports++] = port;
+            }
+        }
+    }
+
+    MXS_NOTICE("Loaded the protocol modules of %d listeners in %.3f seconds.",
+               job.n_ports, service_startup_phase(&start));
+
+    int n_threads = service_load_all_users(&job);
+
+    MXS_NOTICE("Loaded the users of %d listeners with %d threads in %.3f seconds.",
+               job.n_ports, n_threads, service_startup_phase(&start));
+
+    int pos = 0;
+
+    for (ptr = allServices; ptr && !ptr->svc_do_shutdown; ptr = ptr->next)
     {
-        n += (i = serviceInitialize(ptr));
+        if (ptr->ports == NULL)
+        {
+            MXS_WARNING("Service '%s' has no listeners defined.", ptr->name);
+            n++;
+            continue;
+        }
+
+        int listeners = 0;
+
+        for (SERV_LISTENER *port = ptr->ports; port; port = port->next)
+        {
+            if (pos < job.n_ports && job.ports[pos] == port)
+            {
+                listeners += service_listen_port(ptr, port, job.rc[pos++]);
+            }
+        }
+
+        n += (i = service_ports_started(ptr, listeners));
 
         if (i == 0)
         {
             MXS_ERROR("Failed to start service '%s'.", ptr->name);
             error = true;
         }
-
-        ptr = ptr->next;
     }
+
+    MXS_NOTICE("Started the listeners in %.3f seconds.", service_startup_phase(&start));
+
+    MXS_FREE(job.ports);
+    MXS_FREE(job.rc);
+
     return error ? 0 : n;
 }
 
@@ -693,7 +977,7 @@ void service_free(SERVICE *service)
 {
     SERVICE *ptr;
     SERVER_REF *srv;
-    if (service->stats.n_current)
+    if (ts_stats_sum(service->stats.n_current))
     {
         return;
     }
@@ -729,12 +1013,24 @@ void service_free(SERVICE *service)
     MXS_FREE(service->routerModule);
     MXS_FREE(service->weightby);
     MXS_FREE(service->version_string);
+    service_free_priority_users(service->priority_users);
     MXS_FREE(service->credentials.name);
     MXS_FREE(service->credentials.authdata);
 
     config_parameter_free(service->svc_config_param);
     serviceClearRouterOptions(service);
 
+    for (int i = 0; i < SERVICE_N_METRICS; i++)
+    {
+        mxs_metric_destroy(service->stats.metrics[i]);
+    }
+
+    /** The metrics may still be read by a worker thread */
+    mxs_epoch_defer(ts_stats_free, service->stats.n_sessions);
+    mxs_epoch_defer(ts_stats_free, service->stats.n_current);
+    mxs_epoch_defer(ts_stats_free, service->stats.n_plain_out);
+    mxs_epoch_defer(ts_stats_free, service->stats.n_compressed_out);
+    MXS_FREE(service->stats.latency);
     MXS_FREE(service);
 }
 
@@ -815,6 +1111,7 @@ static SERVER_REF* server_ref_create(SERVER *server)
         sref->server = server;
         sref->weight = SERVICE_BASE_SERVER_WEIGHT;
         sref->connections = 0;
+        sref->response_time = 0;
         sref->active = true;
     }
 
@@ -1119,12 +1416,7 @@ serviceSetTimeout(SERVICE *service, int val)
         return 0;
     }
 
-    /** Enable the session timeout checks if and only if at least one service is
-     * configured with a idle timeout. */
-    if ((service->conn_idle_timeout = val))
-    {
-        dcb_enable_session_timeouts();
-    }
+    service->conn_idle_timeout = val;
 
     return 1;
 }
@@ -1333,8 +1625,8 @@ printService(SERVICE *service)
         printf("\n");
     }
 
-    printf("\tTotal connections:    %d\n", service->stats.n_sessions);
-    printf("\tCurrently connected:  %d\n", service->stats.n_current);
+    printf("\tTotal connections:    %" PRId64 "\n", ts_stats_sum(service->stats.n_sessions));
+    printf("\tCurrently connected:  %" PRId64 "\n", ts_stats_sum(service->stats.n_current));
 }
 
 /**
@@ -1379,6 +1671,53 @@ dprintAllServices(DCB *dcb)
     spinlock_release(&service_spin);
 }
 
+static const char *latency_names[] =
+{
+    "queue",
+    "processing",
+    "backend",
+    "write"
+};
+
+void service_add_latency(SERVICE *service, service_latency_t phase, uint64_t usecs)
+{
+    SERVICE_LATENCY *latency = &service->stats.latency[current_thread_id % service->stats.n_latency];
+    int bucket = usecs > 0 ? 64 - __builtin_clzll(usecs) : 0;
+    latency->histogram[phase][MXS_MIN(bucket, SERVICE_LATENCY_BUCKETS - 1)]++;
+}
+
+int64_t service_latency_percentile(const SERVICE *service, service_latency_t phase, int percentile)
+{
+    uint64_t histogram[SERVICE_LATENCY_BUCKETS] = { 0 };
+    uint64_t total = 0;
+
+    /** The buckets of the other threads may change while they are read */
+    for (int i = 0; i < service->stats.n_latency; i++)
+    {
+        for (int j = 0; j < SERVICE_LATENCY_BUCKETS; j++)
+        {
+            uint64_t value = service->stats.latency[i].histogram[phase][j];
+            histogram[j] += value;
+            total += value;
+        }
+    }
+
+    uint64_t limit = (total * percentile + 99) / 100;
+    uint64_t sum = 0;
+
+    for (int i = 0; i < SERVICE_LATENCY_BUCKETS && total > 0; i++)
+    {
+        sum += histogram[i];
+
+        if (sum >= limit)
+        {
+            return i == 0 ? 1 : 1L << i;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Print details of a single service.
  *
@@ -1444,10 +1783,39 @@ void dprintService(DCB *dcb, SERVICE *service)
                    service->weightby);
     }
 
-    dcb_printf(dcb, "\tTotal connections:                   %d\n",
-               service->stats.n_sessions);
-    dcb_printf(dcb, "\tCurrently connected:                 %d\n",
-               service->stats.n_current);
+    dcb_printf(dcb, "\tTotal connections:                   %" PRId64 "\n",
+               ts_stats_sum(service->stats.n_sessions));
+    dcb_printf(dcb, "\tCurrently connected:                 %" PRId64 "\n",
+               ts_stats_sum(service->stats.n_current));
+
+    int64_t plain_out = ts_stats_sum(service->stats.n_plain_out);
+
+    if (plain_out)
+    {
+        int64_t compressed_out = ts_stats_sum(service->stats.n_compressed_out);
+        dcb_printf(dcb, "\tClient compression:                  %" PRId64 " bytes sent as %" PRId64
+                   " bytes (%.1f%%)\n", plain_out, compressed_out, 100.0 * compressed_out / plain_out);
+    }
+
+    for (SERV_LISTENER *port = service->ports; port; port = port->next)
+    {
+        if (port->max_connection_rate)
+        {
+            dcb_printf(dcb, "\tListener %s: at most %d connections per second, %" PRIu64 " accepts deferred\n",
+                       port->name, port->max_connection_rate, port->n_throttled);
+        }
+    }
+
+    dcb_printf(dcb, "\tQuery latency:          p50        p90        p99\n");
+
+    for (int i = 0; i < SERVICE_LATENCY_N; i++)
+    {
+        dcb_printf(dcb, "\t\t%-14s %8" PRId64 "us %8" PRId64 "us %8" PRId64 "us\n",
+                   latency_names[i],
+                   service_latency_percentile(service, (service_latency_t)i, 50),
+                   service_latency_percentile(service, (service_latency_t)i, 90),
+                   service_latency_percentile(service, (service_latency_t)i, 99));
+    }
 }
 
 /**
@@ -1473,10 +1841,10 @@ dListServices(DCB *dcb)
     }
     while (service)
     {
-        ss_dassert(service->stats.n_current >= 0);
-        dcb_printf(dcb, "%-25s | %-17s | %6d | %14d | ",
+        ss_dassert(ts_stats_sum(service->stats.n_current) >= 0);
+        dcb_printf(dcb, "%-25s | %-17s | %6" PRId64 " | %14" PRId64 " | ",
                    service->name, service->routerModule,
-                   service->stats.n_current, service->stats.n_sessions);
+                   ts_stats_sum(service->stats.n_current), ts_stats_sum(service->stats.n_sessions));
 
         SERVER_REF* server_ref = service->dbref;
         bool first = true;
@@ -1566,27 +1934,13 @@ dListListeners(DCB *dcb)
 void
 service_update(SERVICE *service, char *router, char *user, char *auth)
 {
-    void *router_obj;
-
-    if (!strcmp(service->routerModule, router))
+    if (strcmp(service->routerModule, router) != 0)
     {
-        if ((router_obj = load_module(router, MODULE_ROUTER)) == NULL)
-        {
-            MXS_ERROR("Failed to update router "
-                      "for service %s to %s.",
-                      service->name,
-                      router);
-        }
-        else
-        {
-            MXS_NOTICE("Update router for service %s to %s.",
-                       service->name,
-                       router);
-            MXS_FREE(service->routerModule);
-            service->routerModule = MXS_STRDUP_A(router);
-            service->router = router_obj;
-        }
+        /** The router instance was created by the old module */
+        MXS_WARNING("The router of service '%s' can only be changed by "
+                    "restarting MaxScale.", service->name);
     }
+
     if (user &&
         (strcmp(service->credentials.name, user) != 0 ||
          strcmp(service->credentials.authdata, auth) != 0))
@@ -1808,6 +2162,120 @@ serviceGetWeightingParameter(SERVICE *service)
     return service->weightby;
 }
 
+/**
+ * @brief Set the priority class of the sessions of a service
+ *
+ * @param service  The service
+ * @param priority "high", "normal" or "low"
+ * @return False if the class is not valid
+ */
+bool serviceSetPriority(SERVICE *service, const char *priority)
+{
+    return session_priority_from_string(priority, &service->priority);
+}
+
+/**
+ * @brief Free a list of users with their own priority class
+ *
+ * @param users The first user
+ */
+static void service_free_priority_users(SERVICE_PRIORITY_USER *users)
+{
+    while (users)
+    {
+        SERVICE_PRIORITY_USER *next = users->next;
+        MXS_FREE(users->user);
+        MXS_FREE(users);
+        users = next;
+    }
+}
+
+/**
+ * @brief Set the users whose sessions get their own priority class
+ *
+ * This can only be done before the service is started as the list is read
+ * without locks when sessions are created.
+ *
+ * @param service The service
+ * @param users   Comma separated list of user:class pairs
+ * @return False if the list is not valid or if memory allocation failed
+ */
+bool serviceSetPriorityUsers(SERVICE *service, const char *users)
+{
+    char *copy = MXS_STRDUP(users);
+    SERVICE_PRIORITY_USER *list = NULL;
+    bool rval = copy != NULL;
+    char *saveptr;
+
+    for (char *tok = copy ? strtok_r(copy, ",", &saveptr) : NULL; tok && rval;
+         tok = strtok_r(NULL, ",", &saveptr))
+    {
+        char *sep = strrchr(tok, ':');
+        SERVICE_PRIORITY_USER *entry;
+
+        if (sep == NULL)
+        {
+            MXS_ERROR("Invalid priority user '%s' for service '%s', expected user:class.",
+                      trim(tok), service->name);
+            rval = false;
+            break;
+        }
+
+        *sep = '\0';
+        char *user = trim(tok);
+        char *priority = trim(sep + 1);
+
+        if ((entry = MXS_CALLOC(1, sizeof(*entry))) == NULL ||
+            (entry->user = MXS_STRDUP(user)) == NULL)
+        {
+            MXS_FREE(entry);
+            rval = false;
+        }
+        else
+        {
+            entry->next = list;
+            list = entry;
+
+            if (!session_priority_from_string(priority, &entry->priority))
+            {
+                MXS_ERROR("Invalid priority class '%s' for user '%s' of service '%s', "
+                          "expected high, normal or low.", priority, user, service->name);
+                rval = false;
+            }
+        }
+    }
+
+    MXS_FREE(copy);
+
+    if (rval)
+    {
+        service_free_priority_users(service->priority_users);
+        service->priority_users = list;
+    }
+    else
+    {
+        service_free_priority_users(list);
+    }
+
+    return rval;
+}
+
+session_priority_t service_get_priority(const SERVICE *service, const char *user)
+{
+    if (user)
+    {
+        for (SERVICE_PRIORITY_USER *entry = service->priority_users; entry; entry = entry->next)
+        {
+            if (strcmp(entry->user, user) == 0)
+            {
+                return entry->priority;
+            }
+        }
+    }
+
+    return service->priority;
+}
+
 /**
  * Enable/Disable localhost authentication match criteria
  * associated with this service.
@@ -1887,7 +2355,7 @@ serviceSessionCountAll()
     service = allServices;
     while (service)
     {
-        rval += service->stats.n_current;
+        rval += ts_stats_sum(service->stats.n_current);
         service = service->next;
     }
     spinlock_release(&service_spin);
@@ -2021,10 +2489,19 @@ serviceRowCallback(RESULTSET *set, void *data)
     row = resultset_make_row(set);
     resultset_row_set(row, 0, service->name);
     resultset_row_set(row, 1, service->routerModule);
-    sprintf(buf, "%d", service->stats.n_current);
+    sprintf(buf, "%" PRId64, ts_stats_sum(service->stats.n_current));
     resultset_row_set(row, 2, buf);
-    sprintf(buf, "%d", service->stats.n_sessions);
+    sprintf(buf, "%" PRId64, ts_stats_sum(service->stats.n_sessions));
     resultset_row_set(row, 3, buf);
+
+    for (int i = 0; i < SERVICE_LATENCY_N; i++)
+    {
+        sprintf(buf, "%" PRId64, service_latency_percentile(service, (service_latency_t)i, 50));
+        resultset_row_set(row, 4 + 2 * i, buf);
+        sprintf(buf, "%" PRId64, service_latency_percentile(service, (service_latency_t)i, 99));
+        resultset_row_set(row, 5 + 2 * i, buf);
+    }
+
     spinlock_release(&service_spin);
     return row;
 }
@@ -2054,6 +2531,14 @@ serviceGetList()
     resultset_add_column(set, "Router Module", 20, COL_TYPE_VARCHAR);
     resultset_add_column(set, "No. Sessions", 10, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Total Sessions", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Queue p50 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Queue p99 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Processing p50 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Processing p99 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Backend p50 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Backend p99 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Write p50 (us)", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "Write p99 (us)", 10, COL_TYPE_VARCHAR);
 
     return set;
 }
@@ -33,10 +33,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 
 #include <maxscale/alloc.h>
 #include <maxscale/atomic.h>
+#include <maxscale/config.h>
 #include <maxscale/dcb.h>
 #include <maxscale/housekeeper.h>
 #include <maxscale/log_manager.h>
@@ -47,10 +49,17 @@
 
 #include "maxscale/session.h"
 #include "maxscale/filter.h"
+#include "maxscale/pool.h"
+#include "maxscale/profiler.h"
 
 /* A session with null values, used for initialization */
 static MXS_SESSION session_initialized = SESSION_INIT;
 
+/** The maximum number of free sessions each thread keeps for reuse */
+#define SESSION_POOL_MAX_FREE 256
+
+static MXS_POOL session_pool = MXS_POOL_INIT("Session", sizeof(MXS_SESSION), SESSION_POOL_MAX_FREE);
+
 /** Global session id; updated safely by use of atomic_add */
 static int session_id;
 
@@ -62,6 +71,7 @@ static void session_simple_free(MXS_SESSION *session, DCB *dcb);
 static void session_add_to_all_list(MXS_SESSION *session);
 static MXS_SESSION *session_find_free();
 static void session_final_free(MXS_SESSION *session);
+static void session_setup_backpressure(MXS_SESSION *session);
 
 /**
  * @brief Initialize a session
@@ -96,7 +106,7 @@ session_initialize(void *session)
 MXS_SESSION *
 session_alloc(SERVICE *service, DCB *client_dcb)
 {
-    MXS_SESSION *session = (MXS_SESSION *)(MXS_MALLOC(sizeof(*session)));
+    MXS_SESSION *session = (MXS_SESSION *)mxs_pool_alloc(&session_pool);
 
     if (NULL == session)
     {
@@ -128,6 +138,8 @@ session_alloc(SERVICE *service, DCB *client_dcb)
 
     session->trx_state = SESSION_TRX_INACTIVE;
     session->autocommit = true;
+    session->base_priority = service_get_priority(service, client_dcb->user);
+    session->priority = session->base_priority;
     /*
      * Only create a router session if we are not the listening
      * DCB or an internal DCB. Creating a router session may create a connection to a
@@ -166,6 +178,12 @@ session_alloc(SERVICE *service, DCB *client_dcb)
         session->tail.session = session;
         session->tail.clientReply = session_reply;
 
+        if (!profiler_wrap_downstream(session, &session->head, service->routerModule) ||
+            !profiler_wrap_upstream(session, &session->tail, client_dcb->protoname))
+        {
+            session->state = SESSION_STATE_TO_BE_FREED;
+        }
+
         if (SESSION_STATE_TO_BE_FREED != session->state
             && service->n_filters > 0
             && !session_setup_filters(session))
@@ -180,6 +198,8 @@ session_alloc(SERVICE *service, DCB *client_dcb)
     if (SESSION_STATE_TO_BE_FREED != session->state)
     {
         session->state = SESSION_STATE_ROUTER_READY;
+        session_setup_backpressure(session);
+        session_trace_start(session);
 
         if (session->client_dcb->user == NULL)
         {
@@ -205,12 +225,72 @@ session_alloc(SERVICE *service, DCB *client_dcb)
                  session->client_dcb->user,
                  session->client_dcb->remote);
     }
-    atomic_add(&service->stats.n_sessions, 1);
-    atomic_add(&service->stats.n_current, 1);
+    ts_stats_add(service->stats.n_sessions, 1);
+    ts_stats_add(service->stats.n_current, 1);
     CHK_SESSION(session);
 
     client_dcb->session = session;
-    return SESSION_STATE_TO_BE_FREED == session->state ? NULL : session;
+
+    if (SESSION_STATE_TO_BE_FREED == session->state)
+    {
+        return NULL;
+    }
+
+    /** The session can now be found by its ID */
+    dcb_index_session(client_dcb);
+    return session;
+}
+
+/**
+ * Stop reading the backends of the session when its client is slow to read
+ *
+ * The low water mark defaults to half of the high water mark.
+ *
+ * @param session The new session
+ */
+static void session_setup_backpressure(MXS_SESSION *session)
+{
+    MXS_CONFIG *cnf = config_get_global_options();
+    DCB *client_dcb = session->client_dcb;
+    int high_water = cnf->writeq_high_water;
+    int low_water = cnf->writeq_low_water;
+
+    if (high_water > 0 && client_dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER &&
+        !session->ses_is_child)
+    {
+        if (low_water <= 0 || low_water >= high_water)
+        {
+            low_water = high_water / 2;
+        }
+
+        if (!dcb_set_backpressure(client_dcb, high_water, low_water))
+        {
+            MXS_ERROR("Failed to add the write queue callbacks of session %lu, "
+                      "the backends are read regardless of the client.", session->ses_id);
+        }
+    }
+}
+
+/** The names of the priority classes */
+static const char *priority_names[SESSION_PRIORITY_N] = {"high", "normal", "low"};
+
+const char* session_priority_to_string(session_priority_t priority)
+{
+    return priority_names[priority];
+}
+
+bool session_priority_from_string(const char *name, session_priority_t *priority)
+{
+    for (int i = 0; i < SESSION_PRIORITY_N; i++)
+    {
+        if (strcasecmp(name, priority_names[i]) == 0)
+        {
+            *priority = (session_priority_t)i;
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /**
@@ -314,7 +394,8 @@ static void session_free(MXS_SESSION *session)
     ss_dassert(session->refcount == 0);
 
     session->state = SESSION_STATE_TO_BE_FREED;
-    atomic_add(&session->service->stats.n_current, -1);
+    ts_stats_add(session->service->stats.n_current, -1);
+    session_trace_end(session);
 
     if (session->client_dcb)
     {
@@ -365,7 +446,9 @@ static void
 session_final_free(MXS_SESSION *session)
 {
     gwbuf_free(session->stmt.buffer);
-    MXS_FREE(session);
+    MXS_FREE(session->trace);
+    profiler_session_free(session);
+    mxs_pool_free(session);
 }
 
 /**
@@ -614,6 +697,12 @@ session_setup_filters(MXS_SESSION *session)
         session->filters[i].instance = head->instance;
         session->head = *head;
         MXS_FREE(head);
+
+        if (!profiler_wrap_downstream(session, &session->head,
+                                      filter_def_get_module_name(service->filters[i])))
+        {
+            return 0;
+        }
     }
 
     for (i = 0; i < service->n_filters; i++)
@@ -637,6 +726,12 @@ session_setup_filters(MXS_SESSION *session)
         {
             session->tail = *tail;
             MXS_FREE(tail);
+
+            if (!profiler_wrap_upstream(session, &session->tail,
+                                        filter_def_get_module_name(service->filters[i])))
+            {
+                return 0;
+            }
         }
     }
 
@@ -713,72 +808,52 @@ session_get_user(const MXS_SESSION *session)
 }
 
 /**
- * Callback structure for the session list extraction
+ * Stream the row of a session to the result set
+ *
+ * @param dcb   A DCB
+ * @param data  The result set
+ * @return True if the iteration should continue
  */
-typedef struct
+static bool session_list_cb(DCB *dcb, void *data)
 {
-    int index;
-    int current;
-    SESSIONLISTFILTER filter;
-    RESULT_ROW *row;
-    RESULTSET *set;
-} SESSIONFILTER;
+    RESULTSET *set = (RESULTSET*)data;
+    SESSIONLISTFILTER filter = (SESSIONLISTFILTER)(intptr_t)set->userdata;
+    MXS_SESSION *list_session = dcb->session;
 
-bool dcb_iter_cb(DCB *dcb, void *data)
-{
-    SESSIONFILTER *cbdata = (SESSIONFILTER*)data;
-
-    if (cbdata->current < cbdata->index)
+    /** Each session is listed once, with its client DCB or listener */
+    if (list_session == NULL || dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER ||
+        (filter == SESSION_LIST_CONNECTION && list_session->state == SESSION_STATE_LISTENER))
     {
-        if (cbdata->filter == SESSION_LIST_ALL ||
-            (cbdata->filter == SESSION_LIST_CONNECTION &&
-             (dcb->session->state != SESSION_STATE_LISTENER)))
-        {
-            cbdata->current++;
-        }
+        return true;
     }
-    else
-    {
-        char buf[20];
-        MXS_SESSION *list_session = dcb->session;
-
-        cbdata->index++;
-        cbdata->row = resultset_make_row(cbdata->set);
-        snprintf(buf, sizeof(buf), "%p", list_session);
-        resultset_row_set(cbdata->row, 0, buf);
-        resultset_row_set(cbdata->row, 1, ((list_session->client_dcb && list_session->client_dcb->remote)
-                                           ? list_session->client_dcb->remote : ""));
-        resultset_row_set(cbdata->row, 2, (list_session->service && list_session->service->name
-                                           ? list_session->service->name : ""));
-        resultset_row_set(cbdata->row, 3, session_state(list_session->state));
-        return false;
-    }
-    return true;
+
+    char buf[20];
+    const char *values[4];
+
+    snprintf(buf, sizeof(buf), "%p", list_session);
+    values[0] = buf;
+    values[1] = list_session->client_dcb && list_session->client_dcb->remote ?
+                list_session->client_dcb->remote : "";
+    values[2] = list_session->service && list_session->service->name ?
+                list_session->service->name : "";
+    values[3] = session_state(list_session->state);
+
+    return resultset_stream_row(set, values);
 }
 
 /**
- * Provide a row to the result set that defines the set of sessions
+ * Stream the sessions to the result set
+ *
+ * The rows are encoded while the DCBs are iterated, a listing of all sessions
+ * iterates over the DCBs once.
  *
  * @param set   The result set
- * @param data  The index of the row to send
- * @return The next row or NULL
+ * @param data  The SESSIONLISTFILTER
  */
-static RESULT_ROW *
-sessionRowCallback(RESULTSET *set, void *data)
+static void
+sessionStreamRows(RESULTSET *set, void *data)
 {
-    SESSIONFILTER *cbdata = (SESSIONFILTER*)data;
-    RESULT_ROW *row = NULL;
-
-    cbdata->current = 0;
-    dcb_foreach(dcb_iter_cb, cbdata);
-
-    if (cbdata->row)
-    {
-        row = cbdata->row;
-        cbdata->row = NULL;
-    }
-
-    return row;
+    dcb_foreach(session_list_cb, set);
 }
 
 /**
@@ -786,35 +861,16 @@ sessionRowCallback(RESULTSET *set, void *data)
  *
  * @return A Result set
  */
-/* Lint is not convinced that the new memory for data is always tracked
- * because it does not see what happens within the resultset_create function,
- * so we suppress the warning. In fact, the function call results in return
- * of the set structure which includes a pointer to data
- */
-
-/*lint -e429 */
 RESULTSET *
 sessionGetList(SESSIONLISTFILTER filter)
 {
     RESULTSET *set;
-    SESSIONFILTER *data;
 
-    if ((data = (SESSIONFILTER *)MXS_MALLOC(sizeof(SESSIONFILTER))) == NULL)
+    if ((set = resultset_create_streaming(sessionStreamRows, (void*)(intptr_t)filter)) == NULL)
     {
         return NULL;
     }
-    data->index = 0;
-    data->filter = filter;
-    data->current = 0;
-    data->row = NULL;
 
-    if ((set = resultset_create(sessionRowCallback, data)) == NULL)
-    {
-        MXS_FREE(data);
-        return NULL;
-    }
-
-    data->set = set;
     resultset_add_column(set, "Session", 16, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Client", 15, COL_TYPE_VARCHAR);
     resultset_add_column(set, "Service", 15, COL_TYPE_VARCHAR);
@@ -822,7 +878,6 @@ sessionGetList(SESSIONLISTFILTER filter)
 
     return set;
 }
-/*lint +e429 */
 
 mxs_session_trx_state_t session_get_trx_state(const MXS_SESSION* ses)
 {
@@ -860,30 +915,9 @@ const char* session_trx_state_to_string(mxs_session_trx_state_t state)
     return "UNKNOWN";
 }
 
-static bool ses_find_id(DCB *dcb, void *data)
-{
-    void **params = (void**)data;
-    MXS_SESSION **ses = (MXS_SESSION**)params[0];
-    int *id = (int*)params[1];
-    bool rval = true;
-
-    if (dcb->session->ses_id == *id)
-    {
-        *ses = session_get_ref(dcb->session);
-        rval = false;
-    }
-
-    return rval;
-}
-
 MXS_SESSION* session_get_by_id(int id)
 {
-    MXS_SESSION *session = NULL;
-    void *params[] = {&session, &id};
-
-    dcb_foreach(ses_find_id, params);
-
-    return session;
+    return dcb_get_session_by_id(id);
 }
 
 MXS_SESSION* session_get_ref(MXS_SESSION *session)
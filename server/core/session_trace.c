@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file session_trace.c  Query latency and tracing of sampled sessions
+ *
+ * Every session records when the current request was read, routed, written
+ * to a server, first answered and last written to the client. When the
+ * request ends, the durations between these points are added to the latency
+ * histograms of the service.
+ *
+ * A traced session also records the time when each request reaches the points of
+ * session_trace_point_t. Consecutive events of the same point and server,
+ * such as the reads of a large result, are recorded as one event with the
+ * time of the first and the last one. The events are kept in a ring, so a
+ * request with many events keeps only the latest ones.
+ *
+ * The events of a request are logged when the next request starts or the
+ * session is closed, if the request took longer than the threshold. The
+ * events of a session are only recorded by the thread of the session.
+ */
+
+#include <maxscale/session.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/random_jkiss.h>
+
+#include "maxscale/service.h"
+#include "maxscale/session.h"
+
+/** The number of events kept of a request */
+#define SESSION_TRACE_EVENTS 32
+
+typedef struct session_trace_event
+{
+    uint64_t              start;  /**< When the point was reached, in microseconds */
+    uint64_t              end;    /**< When it was reached the last time in a row */
+    uint32_t              count;  /**< How many times it was reached in a row */
+    session_trace_point_t point;
+    const char            *server;
+} SESSION_TRACE_EVENT;
+
+struct session_trace
+{
+    uint64_t            threshold; /**< Requests slower than this are logged, in microseconds */
+    int                 first;     /**< The oldest event */
+    int                 n_events;  /**< Number of events in the ring */
+    int                 n_lost;    /**< Events of the request that were overwritten */
+    SESSION_TRACE_EVENT events[SESSION_TRACE_EVENTS];
+};
+
+static const char *point_names[] =
+{
+    "read",
+    "route",
+    "classify",
+    "backend write",
+    "response",
+    "client write"
+};
+
+static uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static SESSION_TRACE_EVENT* trace_event(struct session_trace *trace, int i)
+{
+    return &trace->events[(trace->first + i) % SESSION_TRACE_EVENTS];
+}
+
+static void latency_add(MXS_SESSION *session, service_latency_t phase, uint64_t start, uint64_t end)
+{
+    if (start && end >= start)
+    {
+        service_add_latency(session->service, phase, end - start);
+    }
+}
+
+/**
+ * Add the phases of the current request to the histograms of the service and
+ * start a new request.
+ */
+static void latency_flush(MXS_SESSION *session)
+{
+    if (session->latency.read)
+    {
+        latency_add(session, SERVICE_LATENCY_QUEUE, session->latency.read, session->latency.routed);
+        latency_add(session, SERVICE_LATENCY_PROCESSING, session->latency.routed,
+                    session->latency.dispatched);
+        latency_add(session, SERVICE_LATENCY_BACKEND, session->latency.dispatched,
+                    session->latency.response);
+        latency_add(session, SERVICE_LATENCY_WRITE, session->latency.response,
+                    session->latency.written);
+    }
+
+    memset(&session->latency, 0, sizeof(session->latency));
+}
+
+/**
+ * Record the time of the first occurrence of a point in the current request.
+ * Only the last write to the client is recorded.
+ */
+static void latency_record(MXS_SESSION *session, session_trace_point_t point, uint64_t now)
+{
+    switch (point)
+    {
+    case SESSION_TRACE_READ:
+        if (session->latency.response || session->latency.written)
+        {
+            /** The client sent the next request */
+            latency_flush(session);
+        }
+
+        if (!session->latency.read)
+        {
+            session->latency.read = now;
+        }
+        break;
+
+    case SESSION_TRACE_ROUTE:
+        if (!session->latency.routed)
+        {
+            session->latency.routed = now;
+        }
+        break;
+
+    case SESSION_TRACE_BACKEND_WRITE:
+        if (session->latency.routed && !session->latency.dispatched)
+        {
+            session->latency.dispatched = now;
+        }
+        break;
+
+    case SESSION_TRACE_RESPONSE:
+        if (session->latency.dispatched && !session->latency.response)
+        {
+            session->latency.response = now;
+        }
+        break;
+
+    case SESSION_TRACE_CLIENT_WRITE:
+        if (session->latency.read)
+        {
+            session->latency.written = now;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static bool trace_selected(const MXS_SESSION *session, const MXS_CONFIG *cnf)
+{
+    const DCB *dcb = session->client_dcb;
+
+    if (cnf->session_trace_user && dcb->user && strcmp(dcb->user, cnf->session_trace_user) == 0)
+    {
+        return true;
+    }
+
+    if (cnf->session_trace_host && dcb->remote && strcmp(dcb->remote, cnf->session_trace_host) == 0)
+    {
+        return true;
+    }
+
+    return cnf->session_trace_sample > 0 &&
+           random_jkiss_thread() <= cnf->session_trace_sample * UINT_MAX;
+}
+
+/**
+ * Log the events of the current request if it was slow and start a new one.
+ *
+ * @return True if the request was logged
+ */
+static bool trace_flush(MXS_SESSION *session)
+{
+    struct session_trace *trace = session->trace;
+    bool rval = false;
+
+    if (trace->n_events > 0)
+    {
+        uint64_t start = trace_event(trace, 0)->start;
+        uint64_t duration = trace_event(trace, trace->n_events - 1)->end - start;
+
+        if (duration >= trace->threshold)
+        {
+            char events[2048] = "";
+            size_t len = 0;
+
+            for (int i = 0; i < trace->n_events && len < sizeof(events); i++)
+            {
+                SESSION_TRACE_EVENT *ev = trace_event(trace, i);
+
+                len += snprintf(events + len, sizeof(events) - len, "%s%s%s%s +%.3fms",
+                                i > 0 ? ", " : "", point_names[ev->point],
+                                ev->server ? " " : "", ev->server ? ev->server : "",
+                                (ev->start - start) / 1000.0);
+
+                if (ev->count > 1 && len < sizeof(events))
+                {
+                    len += snprintf(events + len, sizeof(events) - len, "..%.3fms (%u times)",
+                                    (ev->end - start) / 1000.0, ev->count);
+                }
+            }
+
+            MXS_NOTICE("Request of session %lu of '%s'@'%s' took %.3fms%s: %s",
+                       session->ses_id,
+                       session->client_dcb->user ? session->client_dcb->user : "",
+                       session->client_dcb->remote ? session->client_dcb->remote : "",
+                       duration / 1000.0,
+                       trace->n_lost ? " (the first events were not kept)" : "",
+                       events);
+            rval = true;
+        }
+
+        trace->first = 0;
+        trace->n_events = 0;
+        trace->n_lost = 0;
+    }
+
+    return rval;
+}
+
+void session_trace_start(MXS_SESSION *session)
+{
+    MXS_CONFIG *cnf = config_get_global_options();
+
+    if (session->client_dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER &&
+        !session->ses_is_child && trace_selected(session, cnf) &&
+        (session->trace = MXS_CALLOC(1, sizeof(struct session_trace))))
+    {
+        session->trace->threshold = (uint64_t)cnf->session_trace_threshold * 1000;
+        MXS_INFO("Tracing session %lu.", session->ses_id);
+    }
+}
+
+void session_trace_record(MXS_SESSION *session, session_trace_point_t point, const char *server)
+{
+    struct session_trace *trace = session->trace;
+    uint64_t now = trace_now();
+
+    latency_record(session, point, now);
+
+    if (trace == NULL)
+    {
+        return;
+    }
+
+    if (trace->n_events > 0)
+    {
+        SESSION_TRACE_EVENT *last = trace_event(trace, trace->n_events - 1);
+
+        if (point == SESSION_TRACE_READ &&
+            (last->point == SESSION_TRACE_RESPONSE || last->point == SESSION_TRACE_CLIENT_WRITE))
+        {
+            /** The client sent the next request */
+            trace_flush(session);
+        }
+        else if (last->point == point && last->server == server)
+        {
+            last->end = now;
+            last->count++;
+            return;
+        }
+    }
+
+    SESSION_TRACE_EVENT *ev;
+
+    if (trace->n_events < SESSION_TRACE_EVENTS)
+    {
+        ev = trace_event(trace, trace->n_events++);
+    }
+    else
+    {
+        ev = trace_event(trace, 0);
+        trace->first = (trace->first + 1) % SESSION_TRACE_EVENTS;
+        trace->n_lost++;
+    }
+
+    ev->start = now;
+    ev->end = now;
+    ev->count = 1;
+    ev->point = point;
+    ev->server = server;
+}
+
+bool session_trace_end(MXS_SESSION *session)
+{
+    bool rval = false;
+
+    latency_flush(session);
+
+    if (session->trace)
+    {
+        rval = trace_flush(session);
+        MXS_FREE(session->trace);
+        session->trace = NULL;
+    }
+
+    return rval;
+}
+
+int session_trace_n_events(const MXS_SESSION *session)
+{
+    return session->trace ? session->trace->n_events : 0;
+}
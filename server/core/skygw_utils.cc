@@ -251,6 +251,39 @@ retblock:
     return rval;
 }
 
+/**
+ * Write the timestamp of a given time.
+ *
+ * @param p_ts  Write position in memory
+ * @param tslen The maximum length of the timestamp
+ * @param tv    The time
+ * @param hp    Whether the timestamp has millisecond precision
+ *
+ * @return Length of string written to p_ts
+ */
+size_t snprint_timestamp_tv(char* p_ts, size_t tslen, const struct timeval* tv, bool hp)
+{
+    struct tm tm;
+    time_t t = tv->tv_sec;
+
+    localtime_r(&t, &tm);
+
+    if (hp)
+    {
+        snprintf(p_ts, MXS_MIN(tslen, timestamp_len_hp), timestamp_formatstr_hp,
+                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                 tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(tv->tv_usec / 1000));
+    }
+    else
+    {
+        snprintf(p_ts, MXS_MIN(tslen, timestamp_len), timestamp_formatstr,
+                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                 tm.tm_min, tm.tm_sec);
+    }
+
+    return strlen(p_ts);
+}
+
 /**
  * @node Initialize thread data structure
  *
@@ -885,6 +918,66 @@ return_rc:
     return rc;
 }
 
+/**
+ * @brief Write a batch of buffers to a file with one system call
+ *
+ * The buffered data of the file stream is written first so that the data
+ * stays in the order it was written in.
+ *
+ * @param file   The file
+ * @param iov    The buffers, modified if the write is partial
+ * @param iovcnt Number of buffers, at most IOV_MAX
+ * @param flush  Whether the file is synced to disk after the write
+ *
+ * @return 0 on success, errno on failure
+ */
+int skygw_file_writev(skygw_file_t* file, struct iovec* iov, int iovcnt, bool flush)
+{
+    CHK_FILE(file);
+
+    int fd = fileno(file->sf_file);
+    int rc = 0;
+
+    fflush(file->sf_file);
+
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            rc = errno;
+            perror("Logfile write.\n");
+            break;
+        }
+
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    if (rc == 0 && flush)
+    {
+        fsync(fd);
+    }
+
+    return rc;
+}
+
 skygw_file_t* skygw_file_alloc(const char* fname)
 {
     skygw_file_t* file;
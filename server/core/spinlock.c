@@ -11,11 +11,193 @@
  * Public License.
  */
 
+/**
+ * @file spinlock.c - Spinlocks with backoff and contention recording
+ *
+ * The lock value follows the futex based mutex design of Ulrich Drepper's
+ * "Futexes Are Tricky": 0 is free, 1 is held and 2 is held with possible
+ * sleepers. Only a release that replaces the value 2 needs to wake anyone up.
+ *
+ * The contended acquisitions are recorded in a fixed size table of call
+ * sites. An entry is claimed the first time its site is contended and never
+ * released, so the counters can be updated with plain atomic additions.
+ */
+
 #include <maxscale/spinlock.h>
-#include <maxscale/atomic.h>
+
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <maxscale/atomic.h>
 #include <maxscale/debug.h>
 
+/** The number of call sites that can be recorded, a power of two */
+#define SPINLOCK_MAX_SITES 1024
+
+/** The states of a site entry */
+#define SITE_FREE     0
+#define SITE_CLAIMED  1
+#define SITE_READY    2
+
+typedef struct
+{
+    int           state; /*< SITE_FREE, SITE_CLAIMED or SITE_READY */
+    SPINLOCK_SITE site;  /*< The recorded contention */
+} SPINLOCK_SITE_ENTRY;
+
+static SPINLOCK_SITE_ENTRY sites[SPINLOCK_MAX_SITES];
+
+/**
+ * Pause the CPU for a moment while spinning
+ */
+static inline void spinlock_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    __sync_synchronize();
+#endif
+}
+
+static inline int spinlock_cmpxchg(int *lock, int old_value, int new_value)
+{
+    return __sync_val_compare_and_swap(lock, old_value, new_value);
+}
+
+static inline int spinlock_xchg(int *lock, int value)
+{
+    return __atomic_exchange_n(lock, value, __ATOMIC_ACQ_REL);
+}
+
+static inline void spinlock_futex_wait(int *lock, int value)
+{
+    syscall(SYS_futex, lock, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static inline void spinlock_futex_wake(int *lock)
+{
+    syscall(SYS_futex, lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Find the entry of a call site, claiming a free one if needed
+ *
+ * @param file The source file
+ * @param line The line in the file
+ *
+ * @return The entry or NULL if the table is full
+ */
+static SPINLOCK_SITE* spinlock_find_site(const char *file, int line)
+{
+    unsigned int hash = line;
+
+    for (const char *c = file; *c; c++)
+    {
+        hash = hash * 31 + *c;
+    }
+
+    for (int n = 0; n < SPINLOCK_MAX_SITES; n++)
+    {
+        SPINLOCK_SITE_ENTRY *entry = &sites[(hash + n) & (SPINLOCK_MAX_SITES - 1)];
+        int state = atomic_load_int32(&entry->state);
+
+        if (state == SITE_FREE)
+        {
+            if (spinlock_cmpxchg(&entry->state, SITE_FREE, SITE_CLAIMED) == SITE_FREE)
+            {
+                entry->site.file = file;
+                entry->site.line = line;
+                atomic_store_int32(&entry->state, SITE_READY);
+                return &entry->site;
+            }
+
+            state = atomic_load_int32(&entry->state);
+        }
+
+        while (state == SITE_CLAIMED)
+        {
+            state = atomic_load_int32(&entry->state);
+        }
+
+        if (entry->site.line == line &&
+            (entry->site.file == file || strcmp(entry->site.file, file) == 0))
+        {
+            return &entry->site;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Acquire a lock that was found taken
+ *
+ * @param lock The lock
+ * @param file The source file of the caller
+ * @param line The line of the caller
+ */
+static void spinlock_acquire_slow(SPINLOCK *lock, const char *file, int line)
+{
+    uint64_t spins = 0;
+    uint64_t sleeps = 0;
+    int backoff = 1;
+    int value = 1;
+
+    while (spins < SPINLOCK_SPIN_LIMIT)
+    {
+        for (int i = 0; i < backoff; i++)
+        {
+            spinlock_pause();
+        }
+
+        if (backoff < SPINLOCK_MAX_BACKOFF)
+        {
+            backoff *= 2;
+        }
+
+        spins++;
+
+        if (atomic_load_int32(&lock->lock) == 0 &&
+            (value = spinlock_cmpxchg(&lock->lock, 0, 1)) == 0)
+        {
+            break;
+        }
+    }
+
+    if (value != 0)
+    {
+        /** Announce a sleeper and sleep until the lock is released */
+        while ((value = spinlock_xchg(&lock->lock, 2)) != 0)
+        {
+            spinlock_futex_wait(&lock->lock, 2);
+            sleeps++;
+        }
+    }
+
+    SPINLOCK_SITE *site = spinlock_find_site(file, line);
+
+    if (site)
+    {
+        atomic_add_uint64(&site->contended, 1);
+        atomic_add_uint64(&site->spins, spins);
+        atomic_add_uint64(&site->sleeps, sleeps);
+    }
+
+#if SPINLOCK_PROFILE
+    atomic_add_uint64(&lock->spins, spins);
+    lock->contended++;
+    if (lock->maxspins < spins)
+    {
+        lock->maxspins = spins;
+    }
+#endif
+}
 
 void spinlock_init(SPINLOCK *lock)
 {
@@ -31,35 +213,22 @@ void spinlock_init(SPINLOCK *lock)
 #endif
 }
 
-void spinlock_acquire(const SPINLOCK *const_lock)
+void spinlock_acquire_at(const SPINLOCK *const_lock, const char *file, int line)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
 #if SPINLOCK_PROFILE
-    int spins = 0;
-
-    atomic_add(&(lock->waiting), 1);
+    atomic_add_uint64(&lock->waiting, 1);
 #endif
 
-    while (__sync_lock_test_and_set(&(lock->lock), 1))
+    if (spinlock_cmpxchg(&lock->lock, 0, 1) != 0)
     {
-#if SPINLOCK_PROFILE
-        atomic_add(&(lock->spins), 1);
-        spins++;
-#endif
+        spinlock_acquire_slow(lock, file, line);
     }
 
 #if SPINLOCK_PROFILE
-    if (spins)
-    {
-        lock->contended++;
-        if (lock->maxspins < spins)
-        {
-            lock->maxspins = spins;
-        }
-    }
     lock->acquired++;
     lock->owner = thread_self();
-    atomic_add(&(lock->waiting), -1);
+    atomic_add_uint64(&lock->waiting, -1);
 #endif
 }
 
@@ -67,7 +236,7 @@ bool
 spinlock_acquire_nowait(const SPINLOCK *const_lock)
 {
     SPINLOCK *lock = (SPINLOCK*)const_lock;
-    if (__sync_lock_test_and_set(&(lock->lock), 1))
+    if (spinlock_cmpxchg(&lock->lock, 0, 1) != 0)
     {
         return false;
     }
@@ -91,7 +260,10 @@ void spinlock_release(const SPINLOCK *const_lock)
     }
 #endif
 
-    __sync_lock_release(&lock->lock);
+    if (spinlock_xchg(&lock->lock, 0) == 2)
+    {
+        spinlock_futex_wake(&lock->lock);
+    }
 }
 
 void spinlock_stats(const SPINLOCK *lock, void (*reporter)(void *, char *, int), void *hdl)
@@ -119,3 +291,38 @@ void spinlock_stats(const SPINLOCK *lock, void (*reporter)(void *, char *, int),
     }
 #endif
 }
+
+static int site_cmp(const void *a, const void *b)
+{
+    const SPINLOCK_SITE *s1 = (const SPINLOCK_SITE*)a;
+    const SPINLOCK_SITE *s2 = (const SPINLOCK_SITE*)b;
+
+    return s1->contended < s2->contended ? 1 : (s1->contended > s2->contended ? -1 : 0);
+}
+
+void spinlock_site_stats(int max_sites, void (*reporter)(void *, const SPINLOCK_SITE *), void *hdl)
+{
+    SPINLOCK_SITE *copies = (SPINLOCK_SITE*)malloc(SPINLOCK_MAX_SITES * sizeof(SPINLOCK_SITE));
+
+    if (copies)
+    {
+        int n = 0;
+
+        for (int i = 0; i < SPINLOCK_MAX_SITES; i++)
+        {
+            if (atomic_load_int32(&sites[i].state) == SITE_READY)
+            {
+                copies[n++] = sites[i].site;
+            }
+        }
+
+        qsort(copies, n, sizeof(SPINLOCK_SITE), site_cmp);
+
+        for (int i = 0; i < n && i < max_sites; i++)
+        {
+            reporter(hdl, &copies[i]);
+        }
+
+        free(copies);
+    }
+}
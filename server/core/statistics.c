@@ -26,15 +26,28 @@
 #include <maxscale/statistics.h>
 #include <string.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/config.h>
 #include <maxscale/debug.h>
 #include <maxscale/platform.h>
 #include <maxscale/utils.h>
 
+#include "maxscale/statistics.h"
+
 static int thread_count = 0;
 static size_t cache_linesize = 0;
-static size_t stats_size = 0;
 static bool stats_initialized = false;
+static thread_local int stats_thread_id = -1; /*< The slot of a worker thread */
+
+/**
+ * The first cache line of a statistics object holds this header. It is
+ * followed by one cache line for each worker thread and one that is shared
+ * by all other threads.
+ */
+typedef struct
+{
+    int n_threads; /*< Number of worker thread slots */
+} TS_STATS_HEADER;
 
 static size_t get_cache_line_size()
 {
@@ -55,6 +68,23 @@ static size_t get_cache_line_size()
     return rval;
 }
 
+/**
+ * @brief Get the value slot of a thread
+ *
+ * @param stats     Statistics object
+ * @param thread_id ID of the thread, the number of threads for the shared slot
+ * @return Pointer to the value
+ */
+static inline int64_t* ts_stats_slot(ts_stats_t stats, int thread_id)
+{
+    return (int64_t*)MXS_PTR(stats, (thread_id + 1) * cache_linesize);
+}
+
+static inline int ts_stats_threads(ts_stats_t stats)
+{
+    return ((TS_STATS_HEADER*)stats)->n_threads;
+}
+
 /**
  * @brief Initialize the statistics gathering
  */
@@ -62,8 +92,12 @@ void ts_stats_init()
 {
     ss_dassert(!stats_initialized);
     thread_count = config_threadcount();
-    cache_linesize = get_cache_line_size();
-    stats_size = thread_count * cache_linesize;
+
+    if (cache_linesize == 0)
+    {
+        cache_linesize = get_cache_line_size();
+    }
+
     stats_initialized = true;
 }
 
@@ -75,15 +109,37 @@ void ts_stats_end()
     ss_dassert(stats_initialized);
 }
 
+void ts_stats_thread_init(int thread_id)
+{
+    stats_thread_id = thread_id;
+}
+
 /**
  * @brief Create a new statistics object
  *
+ * Objects created before the statistics gathering is initialized, for example
+ * the servers and services created while the configuration is loaded, use the
+ * thread count of the configuration.
+ *
  * @return New stats_t object or NULL if memory allocation failed
  */
 ts_stats_t ts_stats_alloc()
 {
-    ss_dassert(stats_initialized);
-    return MXS_CALLOC(thread_count, cache_linesize);
+    int n_threads = stats_initialized ? thread_count : config_threadcount();
+
+    if (cache_linesize == 0)
+    {
+        cache_linesize = get_cache_line_size();
+    }
+
+    TS_STATS_HEADER *header = (TS_STATS_HEADER*)MXS_CALLOC(n_threads + 2, cache_linesize);
+
+    if (header)
+    {
+        header->n_threads = n_threads;
+    }
+
+    return header;
 }
 
 /**
@@ -93,7 +149,6 @@ ts_stats_t ts_stats_alloc()
  */
 void ts_stats_free(ts_stats_t stats)
 {
-    ss_dassert(stats_initialized);
     MXS_FREE(stats);
 }
 
@@ -107,12 +162,12 @@ void ts_stats_free(ts_stats_t stats)
  */
 int64_t ts_stats_sum(ts_stats_t stats)
 {
-    ss_dassert(stats_initialized);
-    int64_t sum = 0;
+    int n_threads = ts_stats_threads(stats);
+    int64_t sum = *ts_stats_slot(stats, n_threads);
 
-    for (size_t i = 0; i < stats_size; i += cache_linesize)
+    for (int i = 0; i < n_threads; i++)
     {
-        sum += *((int64_t*)MXS_PTR(stats, i));
+        sum += *ts_stats_slot(stats, i);
     }
 
     return sum;
@@ -129,12 +184,17 @@ int64_t ts_stats_sum(ts_stats_t stats)
  */
 int64_t ts_stats_get(ts_stats_t stats, enum ts_stats_type type)
 {
-    ss_dassert(stats_initialized);
+    int n_threads = ts_stats_threads(stats);
     int64_t best = type == TS_STATS_MAX ? LONG_MIN : (type == TS_STATS_MIX ? LONG_MAX : 0);
 
-    for (size_t i = 0; i < stats_size; i += cache_linesize)
+    if (type == TS_STATS_SUM)
     {
-        int64_t value = *((int64_t*)MXS_PTR(stats, i));
+        return ts_stats_sum(stats);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        int64_t value = *ts_stats_slot(stats, i);
 
         switch (type)
         {
@@ -159,27 +219,41 @@ int64_t ts_stats_get(ts_stats_t stats, enum ts_stats_type type)
         }
     }
 
-    return type == TS_STATS_AVG ? best / thread_count : best;
+    return type == TS_STATS_AVG && n_threads ? best / n_threads : best;
+}
+
+void ts_stats_add(ts_stats_t stats, int64_t value)
+{
+    int id = stats_thread_id;
+
+    if (id >= 0 && id < ts_stats_threads(stats))
+    {
+        *ts_stats_slot(stats, id) += value;
+    }
+    else
+    {
+        atomic_add_int64(ts_stats_slot(stats, ts_stats_threads(stats)), value);
+    }
 }
 
 void ts_stats_increment(ts_stats_t stats, int thread_id)
 {
-    ss_dassert(thread_id < thread_count);
-    int64_t *item = (int64_t*)MXS_PTR(stats, thread_id * cache_linesize);
+    ss_dassert(thread_id < ts_stats_threads(stats));
+    int64_t *item = ts_stats_slot(stats, thread_id);
     *item += 1;
 }
 
 void ts_stats_set(ts_stats_t stats, int value, int thread_id)
 {
-    ss_dassert(thread_id < thread_count);
-    int64_t *item = (int64_t*)MXS_PTR(stats, thread_id * cache_linesize);
+    ss_dassert(thread_id < ts_stats_threads(stats));
+    int64_t *item = ts_stats_slot(stats, thread_id);
     *item = value;
 }
 
 void ts_stats_set_max(ts_stats_t stats, int value, int thread_id)
 {
-    ss_dassert(thread_id < thread_count);
-    int64_t *item = (int64_t*)MXS_PTR(stats, thread_id * cache_linesize);
+    ss_dassert(thread_id < ts_stats_threads(stats));
+    int64_t *item = ts_stats_slot(stats, thread_id);
 
     if (value > *item)
     {
@@ -189,8 +263,8 @@ void ts_stats_set_max(ts_stats_t stats, int value, int thread_id)
 
 void ts_stats_set_min(ts_stats_t stats, int value, int thread_id)
 {
-    ss_dassert(thread_id < thread_count);
-    int64_t *item = (int64_t*)MXS_PTR(stats, thread_id * cache_linesize);
+    ss_dassert(thread_id < ts_stats_threads(stats));
+    int64_t *item = ts_stats_slot(stats, thread_id);
 
     if (value < *item)
     {
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file stmtinfo.c  Shared information about a statement
+ */
+
+#include <maxscale/stmtinfo.h>
+#include <maxscale/alloc.h>
+#include <maxscale/protocol/mysql.h>
+
+/** Statements up to this length are canonicalized on the stack for the digest */
+#define STMT_INFO_STACK_BUFFER_SIZE 2048
+
+static void stmt_info_free(void* data)
+{
+    MXS_STMT_INFO* info = (MXS_STMT_INFO*)data;
+
+    MXS_FREE(info->canonical);
+    MXS_FREE(info);
+}
+
+/**
+ * Create the information of a statement and store it in the buffer.
+ *
+ * @param query The statement.
+ * @return The information or NULL if the buffer has no complete statement.
+ */
+static MXS_STMT_INFO* stmt_info_create(GWBUF* query)
+{
+    MXS_STMT_INFO* info = NULL;
+
+    if (GWBUF_IS_CONTIGUOUS(query) && GWBUF_LENGTH(query) >= MYSQL_HEADER_LEN + 1)
+    {
+        uint8_t* data = (uint8_t*)GWBUF_DATA(query);
+        uint8_t command = MYSQL_GET_COMMAND(data);
+        size_t payload_len = MYSQL_GET_PAYLOAD_LEN(data);
+
+        if ((command == MYSQL_COM_QUERY || command == MYSQL_COM_STMT_PREPARE) &&
+            payload_len >= 1 && GWBUF_LENGTH(query) >= MYSQL_HEADER_LEN + payload_len &&
+            (info = (MXS_STMT_INFO*)MXS_CALLOC(1, sizeof(MXS_STMT_INFO))))
+        {
+            info->command = command;
+            info->sql = (const char*)&data[MYSQL_HEADER_LEN + 1];
+            info->sql_len = payload_len - 1; // Subtract 1 for the command byte.
+            gwbuf_add_buffer_object(query, GWBUF_STMT_INFO, info, stmt_info_free);
+        }
+    }
+
+    return info;
+}
+
+/**
+ * Compute the digest and, if it is wanted, store the canonical form.
+ *
+ * @param info      The information of the statement.
+ * @param canonical Whether the canonical form is stored.
+ */
+static void stmt_info_canonicalize(MXS_STMT_INFO* info, bool canonical)
+{
+    char stack_buffer[STMT_INFO_STACK_BUFFER_SIZE];
+    char* buffer;
+
+    if (canonical)
+    {
+        /** The canonical form is never longer than the statement */
+        buffer = (char*)MXS_MALLOC(info->sql_len ? info->sql_len : 1);
+    }
+    else
+    {
+        buffer = info->sql_len <= sizeof(stack_buffer) ? stack_buffer : (char*)MXS_MALLOC(info->sql_len);
+    }
+
+    if (buffer)
+    {
+        size_t len = mxs_digest_canonicalize(info->sql, info->sql_len, buffer);
+
+        if (!(info->parts & MXS_STMT_INFO_DIGEST))
+        {
+            mxs_digest_hash(buffer, len, 0, &info->digest);
+            info->parts |= MXS_STMT_INFO_DIGEST;
+        }
+
+        if (canonical)
+        {
+            info->canonical = buffer;
+            info->canonical_len = len;
+            info->parts |= MXS_STMT_INFO_CANONICAL;
+        }
+        else if (buffer != stack_buffer)
+        {
+            MXS_FREE(buffer);
+        }
+    }
+}
+
+const MXS_STMT_INFO* mxs_stmt_info_get(GWBUF* query, uint32_t parts)
+{
+    MXS_STMT_INFO* info = (MXS_STMT_INFO*)gwbuf_get_buffer_object_data(query, GWBUF_STMT_INFO);
+
+    if (!info)
+    {
+        info = stmt_info_create(query);
+    }
+
+    if (info)
+    {
+        uint32_t missing = parts & ~info->parts;
+
+        if (missing & MXS_STMT_INFO_CANONICAL)
+        {
+            stmt_info_canonicalize(info, true);
+        }
+        else if (missing & MXS_STMT_INFO_DIGEST)
+        {
+            stmt_info_canonicalize(info, false);
+        }
+
+        if (missing & MXS_STMT_INFO_TYPE)
+        {
+            info->type_mask = qc_get_type_mask(query);
+            info->operation = qc_get_operation(query);
+            info->parts |= MXS_STMT_INFO_TYPE;
+        }
+    }
+
+    return info;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file tablefeed.c  A feed of modified tables
+ *
+ * The subscribers are called with the lock of the feed held, so that a
+ * subscriber that has been removed is never called. Publishing is rare
+ * compared to the work the subscribers do, so the lock is not contended.
+ */
+
+#include <maxscale/tablefeed.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/spinlock.h>
+
+typedef struct table_feed_subscriber
+{
+    mxs_table_feed_cb_t           cb;
+    void                         *data;
+    struct table_feed_subscriber *next;
+} TABLE_FEED_SUBSCRIBER;
+
+static SPINLOCK feed_lock = SPINLOCK_INIT;
+static TABLE_FEED_SUBSCRIBER *feed_subscribers = NULL;
+static int feed_n_subscribers = 0;
+
+bool mxs_table_feed_subscribe(mxs_table_feed_cb_t cb, void *data)
+{
+    TABLE_FEED_SUBSCRIBER *subscriber = MXS_MALLOC(sizeof(*subscriber));
+
+    if (subscriber)
+    {
+        subscriber->cb = cb;
+        subscriber->data = data;
+
+        spinlock_acquire(&feed_lock);
+        subscriber->next = feed_subscribers;
+        feed_subscribers = subscriber;
+        atomic_store_int32(&feed_n_subscribers, feed_n_subscribers + 1);
+        spinlock_release(&feed_lock);
+    }
+
+    return subscriber != NULL;
+}
+
+void mxs_table_feed_unsubscribe(mxs_table_feed_cb_t cb, void *data)
+{
+    TABLE_FEED_SUBSCRIBER *removed = NULL;
+
+    spinlock_acquire(&feed_lock);
+
+    for (TABLE_FEED_SUBSCRIBER **prev = &feed_subscribers; *prev; prev = &(*prev)->next)
+    {
+        if ((*prev)->cb == cb && (*prev)->data == data)
+        {
+            removed = *prev;
+            *prev = removed->next;
+            atomic_store_int32(&feed_n_subscribers, feed_n_subscribers - 1);
+            break;
+        }
+    }
+
+    spinlock_release(&feed_lock);
+
+    MXS_FREE(removed);
+}
+
+bool mxs_table_feed_has_subscribers(void)
+{
+    return atomic_load_int32(&feed_n_subscribers) > 0;
+}
+
+void mxs_table_feed_publish(const char *db, const char *table)
+{
+    spinlock_acquire(&feed_lock);
+
+    for (TABLE_FEED_SUBSCRIBER *subscriber = feed_subscribers; subscriber; subscriber = subscriber->next)
+    {
+        subscriber->cb(db, table, subscriber->data);
+    }
+
+    spinlock_release(&feed_lock);
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Measures the throughput of modutil_get_canonical() and, for comparison,
+ * of canonicalizing the same statement with the regular expression based
+ * functions of utils.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
+#include <maxscale/modutil.h>
+#include <maxscale/utils.h>
+
+static const char USAGE[] = "usage: canonical_profile -n count -s statement\n";
+
+static double seconds_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+    return (now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1000000000;
+}
+
+static char* get_canonical_with_regex(const char* sql, size_t len)
+{
+    size_t srcsize = len;
+    char *src = (char*)sql;
+    size_t destsize = 0;
+    char *dest = NULL;
+    char *querystr = NULL;
+
+    if (replace_quoted((const char**)&src, &srcsize, &dest, &destsize))
+    {
+        src = dest;
+        srcsize = destsize;
+        dest = NULL;
+        destsize = 0;
+
+        if (remove_mysql_comments((const char**)&src, &srcsize, &dest, &destsize))
+        {
+            if (replace_values((const char**)&dest, &destsize, &src, &srcsize))
+            {
+                querystr = squeeze_whitespace(src);
+                MXS_FREE(dest);
+            }
+            else
+            {
+                MXS_FREE(src);
+                MXS_FREE(dest);
+            }
+        }
+        else
+        {
+            MXS_FREE(src);
+        }
+    }
+
+    return querystr;
+}
+
+static void report(const char* name, double seconds, int count, size_t len)
+{
+    printf("%-7s: %.3fs, %.0f statements/s, %.1f MB/s\n", name, seconds,
+           count / seconds, (double)count * len / seconds / 1000000);
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+    int count = 0;
+    const char* statement = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:s:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            count = atoi(optarg);
+            break;
+
+        case 's':
+            statement = optarg;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    if (rc == EXIT_SUCCESS && statement && count > 0 && utils_init())
+    {
+        size_t len = strlen(statement);
+        GWBUF* query = modutil_create_query(statement);
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+        for (int i = 0; i < count; i++)
+        {
+            MXS_FREE(modutil_get_canonical(query));
+        }
+
+        report("Scanner", seconds_since(&start), count, len);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+        for (int i = 0; i < count; i++)
+        {
+            MXS_FREE(get_canonical_with_regex(statement, len));
+        }
+
+        report("Regex", seconds_since(&start), count, len);
+
+        gwbuf_free(query);
+        utils_end();
+    }
+    else
+    {
+        printf("%s", USAGE);
+        rc = EXIT_FAILURE;
+    }
+
+    return rc;
+}
@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Microbenchmarks of the core. Each benchmark does a fixed amount of work with
+ * fixed data and seeds so that the results of two builds can be compared. The
+ * results are written as one JSON object per line:
+ *
+ * {"benchmark": "buffer_clone", "threads": 1, "operations": 1000000,
+ *  "seconds": 0.042, "ops_per_second": 23809523}
+ *
+ * The benchmarks are run with `make benchmarks`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/buffer.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/listener.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/paths.h>
+#include <maxscale/query_classifier.h>
+#include <maxscale/spinlock.h>
+#include <maxscale/utils.h>
+
+#include "../maxscale/poll.h"
+
+static const char USAGE[] =
+    "usage: core_benchmark [-t threads] [-n operations] [-b benchmark[,benchmark...]]\n"
+    "                      [-c classifier]... [-L classifier directory] [-o output]\n";
+
+static int n_threads = 4;
+static int n_operations = 1000000;
+static const char *selected = NULL;
+static FILE *output;
+
+static const char *statements[] =
+{
+    "SELECT a, b, c FROM t1 WHERE id = 42 AND name = 'maxscale'",
+    "INSERT INTO t2 (a, b, c) VALUES (1, 'two', 3.0), (4, 'five', 6.0)",
+    "UPDATE t3 SET counter = counter + 1 /* comment */ WHERE id IN (1, 2, 3)",
+    "SELECT COUNT(*) FROM orders o JOIN customers c ON o.customer = c.id GROUP BY c.country",
+    "SET autocommit=0"
+};
+
+#define N_STATEMENTS (sizeof(statements) / sizeof(statements[0]))
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Check if a benchmark was selected with -b */
+static bool is_selected(const char *name)
+{
+    if (selected == NULL)
+    {
+        return true;
+    }
+
+    size_t len = strlen(name);
+
+    for (const char *s = selected; (s = strstr(s, name)); s += len)
+    {
+        if ((s == selected || s[-1] == ',') && (s[len] == ',' || s[len] == '\0'))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void report(const char *name, int threads, long operations, double seconds)
+{
+    fprintf(output, "{\"benchmark\": \"%s\", \"threads\": %d, \"operations\": %ld, "
+            "\"seconds\": %.6f, \"ops_per_second\": %.0f}\n",
+            name, threads, operations, seconds, seconds > 0 ? operations / seconds : 0);
+    fflush(output);
+}
+
+/**
+ * Run a function in @c threads threads and report the total throughput
+ *
+ * @param name    Name of the benchmark
+ * @param threads Number of threads
+ * @param func    Function that does @c n_operations operations
+ * @param data    Passed to @c func
+ */
+static void run_threads(const char *name, int threads, void* (*func)(void*), void *data)
+{
+    pthread_t tids[threads];
+    double start = now();
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&tids[i], NULL, func, data);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    report(name, threads, (long)threads * n_operations, now() - start);
+}
+
+static void bench_buffer()
+{
+    double start = now();
+
+    for (int i = 0; i < n_operations; i++)
+    {
+        gwbuf_free(gwbuf_alloc(1024));
+    }
+
+    report("buffer_alloc_free", 1, n_operations, now() - start);
+
+    GWBUF *buf = gwbuf_alloc(1024);
+    start = now();
+
+    for (int i = 0; i < n_operations; i++)
+    {
+        gwbuf_free(gwbuf_clone(buf));
+    }
+
+    report("buffer_clone", 1, n_operations, now() - start);
+    gwbuf_free(buf);
+
+    /** Each round splits a 16kB buffer into 16 parts */
+    int rounds = n_operations / 16;
+    start = now();
+
+    for (int i = 0; i < rounds; i++)
+    {
+        buf = gwbuf_alloc(16 * 1024);
+
+        while (buf)
+        {
+            gwbuf_free(gwbuf_split(&buf, 1024));
+        }
+    }
+
+    report("buffer_split", 1, (long)rounds * 16, now() - start);
+}
+
+#define HASH_KEYS 1000
+
+static char hash_keys[HASH_KEYS][32];
+static int hash_seed = 0;
+
+/** Fetches random keys, one operation in a hundred deletes and adds a key */
+static void* hashtable_thread(void *data)
+{
+    HASHTABLE *table = (HASHTABLE*)data;
+    unsigned int seed = atomic_add(&hash_seed, 1) + 1;
+
+    for (int i = 0; i < n_operations; i++)
+    {
+        char *key = hash_keys[rand_r(&seed) % HASH_KEYS];
+
+        if (rand_r(&seed) % 100 == 0)
+        {
+            hashtable_delete(table, key);
+            hashtable_add(table, key, key);
+        }
+        else
+        {
+            hashtable_fetch(table, key);
+        }
+    }
+
+    return NULL;
+}
+
+static void bench_hashtable()
+{
+    HASHTABLE *table = hashtable_alloc(HASH_KEYS, hashtable_item_strhash, hashtable_item_strcmp);
+
+    for (int i = 0; i < HASH_KEYS; i++)
+    {
+        sprintf(hash_keys[i], "user%d@host%d", i, i % 17);
+        hashtable_add(table, hash_keys[i], hash_keys[i]);
+    }
+
+    hash_seed = 0;
+    run_threads("hashtable_add_fetch", 1, hashtable_thread, table);
+    hash_seed = 0;
+    run_threads("hashtable_add_fetch", n_threads, hashtable_thread, table);
+    hashtable_free(table);
+}
+
+typedef struct
+{
+    SPINLOCK lock;
+    long     counter;
+} SPINLOCK_DATA;
+
+static void* spinlock_thread(void *data)
+{
+    SPINLOCK_DATA *sd = (SPINLOCK_DATA*)data;
+
+    for (int i = 0; i < n_operations; i++)
+    {
+        spinlock_acquire(&sd->lock);
+        sd->counter++;
+        spinlock_release(&sd->lock);
+    }
+
+    return NULL;
+}
+
+static void bench_spinlock()
+{
+    SPINLOCK_DATA data = {.counter = 0};
+    spinlock_init(&data.lock);
+
+    run_threads("spinlock", 1, spinlock_thread, &data);
+    run_threads("spinlock", n_threads, spinlock_thread, &data);
+}
+
+static void bench_canonical()
+{
+    GWBUF *queries[N_STATEMENTS];
+    int count = n_operations / 10;
+
+    for (size_t i = 0; i < N_STATEMENTS; i++)
+    {
+        queries[i] = modutil_create_query(statements[i]);
+    }
+
+    double start = now();
+
+    for (int i = 0; i < count; i++)
+    {
+        MXS_FREE(modutil_get_canonical(queries[i % N_STATEMENTS]));
+    }
+
+    report("modutil_get_canonical", 1, count, now() - start);
+
+    for (size_t i = 0; i < N_STATEMENTS; i++)
+    {
+        gwbuf_free(queries[i]);
+    }
+}
+
+static void bench_classifier(const char *name, const char *libdir)
+{
+    char dir[strlen(libdir) + strlen(name) + 2];
+    sprintf(dir, "%s/%s", libdir, name);
+    set_libdir(MXS_STRDUP_A(dir));
+
+    QUERY_CLASSIFIER *classifier = qc_load(name);
+
+    if (classifier == NULL ||
+        classifier->qc_setup(NULL) != QC_RESULT_OK ||
+        classifier->qc_process_init() != QC_RESULT_OK)
+    {
+        fprintf(stderr, "error: Could not load the classifier '%s' from '%s'.\n", name, dir);
+
+        if (classifier)
+        {
+            qc_unload(classifier);
+        }
+        return;
+    }
+
+    /** The result of the parsing is stored in the buffer, a new one is parsed every time */
+    int count = n_operations / 100;
+    double start = now();
+
+    for (int i = 0; i < count; i++)
+    {
+        GWBUF *query = modutil_create_query(statements[i % N_STATEMENTS]);
+        int32_t result;
+        classifier->qc_parse(query, QC_COLLECT_ALL, &result);
+        gwbuf_free(query);
+    }
+
+    char benchmark[strlen(name) + sizeof("qc_parse_")];
+    sprintf(benchmark, "qc_parse_%s", name);
+    report(benchmark, 1, count, now() - start);
+
+    classifier->qc_process_end();
+    qc_unload(classifier);
+}
+
+/** Writes packets to a socket and reads them from the other end */
+static void bench_dcb_write()
+{
+    SERV_LISTENER dummy;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0)
+    {
+        fprintf(stderr, "error: Could not create a socket pair.\n");
+        return;
+    }
+
+    DCB *dcb = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, &dummy);
+    dcb->fd = fds[0];
+
+    char data[1024];
+    char sink[64 * 1024];
+    memset(data, 'a', sizeof(data));
+
+    int count = n_operations / 10;
+    double start = now();
+
+    for (int i = 0; i < count; i++)
+    {
+        dcb_write(dcb, gwbuf_alloc_and_load(sizeof(data), data));
+
+        while (dcb->writeq)
+        {
+            /** The socket is full, empty it and write the rest */
+            while (read(fds[1], sink, sizeof(sink)) > 0)
+            {
+                ;
+            }
+
+            dcb_drain_writeq(dcb);
+        }
+
+        if (i % 32 == 31)
+        {
+            while (read(fds[1], sink, sizeof(sink)) > 0)
+            {
+                ;
+            }
+        }
+    }
+
+    report("dcb_write", 1, count, now() - start);
+
+    dcb->fd = DCBFD_CLOSED;
+    dcb_free_all_memory(dcb);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/** Logs messages and waits until they are written */
+static void bench_log()
+{
+    MXS_LOG_THROTTLING no_throttling = {0, 0, 0};
+    mxs_log_set_throttling(&no_throttling);
+
+    int count = n_operations / 10;
+    double start = now();
+
+    for (int i = 0; i < count; i++)
+    {
+        MXS_NOTICE("Benchmark message %d of %d.", i, count);
+    }
+
+    mxs_log_flush_sync();
+    report("log_notice", 1, count, now() - start);
+}
+
+int main(int argc, char **argv)
+{
+    const char *classifiers[10];
+    int n_classifiers = 0;
+    const char *libdir = "../../../query_classifier";
+    const char *filename = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:n:b:c:L:o:")) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'n':
+            n_operations = atoi(optarg);
+            break;
+
+        case 'b':
+            selected = optarg;
+            break;
+
+        case 'c':
+            if (n_classifiers < (int)(sizeof(classifiers) / sizeof(classifiers[0])))
+            {
+                classifiers[n_classifiers++] = optarg;
+            }
+            break;
+
+        case 'L':
+            libdir = optarg;
+            break;
+
+        case 'o':
+            filename = optarg;
+            break;
+
+        default:
+            fprintf(stderr, "%s", USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (n_threads <= 0 || n_operations < 100)
+    {
+        fprintf(stderr, "%s", USAGE);
+        return EXIT_FAILURE;
+    }
+
+    if ((output = filename ? fopen(filename, "w") : stdout) == NULL)
+    {
+        fprintf(stderr, "error: Could not open '%s'.\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    set_datadir(MXS_STRDUP_A("/tmp"));
+    set_langdir(MXS_STRDUP_A("."));
+    set_process_datadir(MXS_STRDUP_A("/tmp"));
+
+    config_get_global_options()->n_threads = 1;
+
+    if (!mxs_log_init(NULL, "/tmp", MXS_LOG_TARGET_FS) || !utils_init())
+    {
+        fprintf(stderr, "error: Could not initialize the log.\n");
+        return EXIT_FAILURE;
+    }
+
+    dcb_global_init();
+    poll_init();
+
+    if (is_selected("buffer"))
+    {
+        bench_buffer();
+    }
+
+    if (is_selected("hashtable"))
+    {
+        bench_hashtable();
+    }
+
+    if (is_selected("spinlock"))
+    {
+        bench_spinlock();
+    }
+
+    if (is_selected("canonical"))
+    {
+        bench_canonical();
+    }
+
+    if (is_selected("qc_parse"))
+    {
+        for (int i = 0; i < n_classifiers; i++)
+        {
+            bench_classifier(classifiers[i], libdir);
+        }
+    }
+
+    if (is_selected("dcb_write"))
+    {
+        bench_dcb_write();
+    }
+
+    if (is_selected("log"))
+    {
+        bench_log();
+    }
+
+    utils_end();
+    mxs_log_finish();
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Measures the per event cost of the checksum and the encryption of binlog
+ * events. The checksum of zlib is compared with mxs_crc32(), and the
+ * encryption with a new cipher context per event, as the binlogrouter used
+ * to do, with a context that keeps the key and only gets a new IV.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+
+#include <maxscale/crc32.h>
+#include <maxscale/encryption.h>
+
+static const char USAGE[] = "usage: crc32_profile [-s event size] [-n events]\n";
+
+static int event_size = 512;
+static int n_events = 1000000;
+
+static double seconds_since(const struct timespec* start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double profile_crc32(const uint8_t* data, bool accelerated, uint32_t* result)
+{
+    struct timespec start;
+    uint32_t crc = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < n_events; i++)
+    {
+        crc ^= accelerated ? mxs_crc32(0, data, event_size) : crc32(0, data, event_size);
+    }
+
+    *result = crc;
+    return n_events / seconds_since(&start);
+}
+
+static double profile_aes(const EVP_CIPHER* cipher, const uint8_t* data, uint8_t* out, bool reuse)
+{
+    uint8_t key[32] = "0123456789abcdef0123456789abcdef";
+    uint8_t iv[16] = "";
+    struct timespec start;
+    EVP_CIPHER_CTX* ctx = NULL;
+    int outlen;
+    int flen;
+
+    if (reuse)
+    {
+        ctx = mxs_evp_cipher_ctx_alloc();
+        EVP_CipherInit_ex(ctx, cipher, NULL, key, NULL, 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < n_events; i++)
+    {
+        /** The IV of an event is the nonce of the file and the position */
+        memcpy(iv + 12, &i, sizeof(i));
+
+        if (reuse)
+        {
+            EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, 1);
+        }
+        else
+        {
+            ctx = mxs_evp_cipher_ctx_alloc();
+            EVP_CipherInit_ex(ctx, cipher, NULL, key, iv, 1);
+        }
+
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+        EVP_CipherUpdate(ctx, out, &outlen, data, event_size & ~15);
+        EVP_CipherFinal_ex(ctx, out + outlen, &flen);
+
+        if (!reuse)
+        {
+            mxs_evp_cipher_ctx_free(ctx);
+        }
+    }
+
+    double rate = n_events / seconds_since(&start);
+
+    if (reuse)
+    {
+        mxs_evp_cipher_ctx_free(ctx);
+    }
+
+    return rate;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "s:n:")) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            event_size = atoi(optarg);
+            break;
+
+        case 'n':
+            n_events = atoi(optarg);
+            break;
+
+        default:
+            fprintf(stderr, "%s", USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (event_size <= 0 || n_events <= 0)
+    {
+        fprintf(stderr, "%s", USAGE);
+        return EXIT_FAILURE;
+    }
+
+    uint8_t* data = malloc(event_size);
+    uint8_t* out = malloc(event_size + 32);
+    unsigned int seed = 1;
+
+    for (int i = 0; i < event_size; i++)
+    {
+        data[i] = rand_r(&seed);
+    }
+
+    uint32_t zlib_crc;
+    uint32_t mxs_crc;
+
+    printf("%d events of %d bytes, PCLMULQDQ is %sused\n",
+           n_events, event_size, mxs_crc32_is_accelerated() ? "" : "not ");
+    printf("crc32 zlib:          %12.0f events/s\n", profile_crc32(data, false, &zlib_crc));
+    printf("crc32 mxs_crc32:     %12.0f events/s\n", profile_crc32(data, true, &mxs_crc));
+    printf("aes_ctr new context: %12.0f events/s\n", profile_aes(EVP_aes_256_ctr(), data, out, false));
+    printf("aes_ctr reused:      %12.0f events/s\n", profile_aes(EVP_aes_256_ctr(), data, out, true));
+    printf("aes_cbc new context: %12.0f events/s\n", profile_aes(EVP_aes_256_cbc(), data, out, false));
+    printf("aes_cbc reused:      %12.0f events/s\n", profile_aes(EVP_aes_256_cbc(), data, out, true));
+
+    free(data);
+    free(out);
+
+    if (zlib_crc != mxs_crc)
+    {
+        fprintf(stderr, "The checksums differ: %08x, %08x\n", zlib_crc, mxs_crc);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
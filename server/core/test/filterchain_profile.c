@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Measures the overhead that each filter of a chain adds to a statement when
+ * the filters need the SQL, the digest and the canonical form of it. With
+ * "Private", each filter extracts and canonicalizes the statement itself.
+ * With "Shared", the filters use the statement information of the buffer,
+ * so the work is done by the first filter only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <maxscale/alloc.h>
+#include <maxscale/digest.h>
+#include <maxscale/modutil.h>
+#include <maxscale/stmtinfo.h>
+
+static const char USAGE[] = "usage: filterchain_profile -n count -f filters -s statement\n";
+
+static double seconds_since(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+    return (now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1000000000;
+}
+
+/** A filter that computes what it needs by itself */
+static uint64_t private_filter(GWBUF* query)
+{
+    char* sql;
+    int len;
+    uint64_t rval = 0;
+
+    if (modutil_extract_SQL(query, &sql, &len))
+    {
+        char* canonical = MXS_MALLOC(len);
+
+        if (canonical)
+        {
+            MXS_DIGEST digest;
+            size_t canonical_len = mxs_digest_canonicalize(sql, len, canonical);
+            mxs_digest_hash(canonical, canonical_len, 0, &digest);
+            rval = digest.lo + canonical_len;
+            MXS_FREE(canonical);
+        }
+    }
+
+    return rval;
+}
+
+/** A filter that uses the statement information */
+static uint64_t shared_filter(GWBUF* query)
+{
+    const MXS_STMT_INFO* info = mxs_stmt_info_get(query, MXS_STMT_INFO_DIGEST | MXS_STMT_INFO_CANONICAL);
+
+    return info ? info->digest.lo + info->canonical_len : 0;
+}
+
+static double run(uint64_t (*filter)(GWBUF*), GWBUF* query, int count, int n_filters, uint64_t* sum)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    for (int i = 0; i < count; i++)
+    {
+        /** Each statement arrives in a new buffer */
+        GWBUF* copy = gwbuf_clone(query);
+
+        for (int j = 0; j < n_filters; j++)
+        {
+            *sum += filter(copy);
+        }
+
+        gwbuf_free(copy);
+    }
+
+    return seconds_since(&start);
+}
+
+static void report(const char* name, double seconds, double base, int count, int n_filters)
+{
+    printf("%-8s: %.3fs, %.0f ns/statement, %.0f ns/filter\n", name, seconds,
+           seconds * 1000000000 / count, (seconds - base) * 1000000000 / count / n_filters);
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+    int count = 0;
+    int n_filters = 0;
+    const char* statement = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:f:s:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            count = atoi(optarg);
+            break;
+
+        case 'f':
+            n_filters = atoi(optarg);
+            break;
+
+        case 's':
+            statement = optarg;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    if (rc == EXIT_SUCCESS && statement && count > 0 && n_filters > 0)
+    {
+        GWBUF* query = modutil_create_query(statement);
+        uint64_t sum = 0;
+
+        /** The cost of the buffers alone is subtracted from the cost per filter */
+        double base = run(shared_filter, query, count, 0, &sum);
+        report("Buffers", base, base, count, 1);
+        report("Private", run(private_filter, query, count, n_filters, &sum), base, count, n_filters);
+        report("Shared", run(shared_filter, query, count, n_filters, &sum), base, count, n_filters);
+
+        printf("Checksum: %lu\n", (unsigned long)sum);
+        gwbuf_free(query);
+    }
+    else
+    {
+        printf("%s", USAGE);
+        rc = EXIT_FAILURE;
+    }
+
+    return rc;
+}
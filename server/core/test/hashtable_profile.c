@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Compares the throughput of a read-mostly workload on HASHTABLE and LFHASH.
+ * Each thread fetches random keys and, at the given rate, deletes and adds
+ * a key back. The threads are registered as worker threads and every
+ * hundred operations count as one event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <maxscale/hashtable.h>
+#include <maxscale/lfhash.h>
+#include <maxscale/limits.h>
+
+#include "../maxscale/epoch.h"
+
+static const char USAGE[] = "usage: hashtable_profile [-t threads] [-n operations] [-k keys] [-w writes per 10000]\n";
+
+/** Number of operations in one event */
+#define EVENT_OPERATIONS 100
+
+static int n_threads = 4;
+static int n_operations = 1000000;
+static int n_keys = 1000;
+static int write_rate = 10;
+static char **keys;
+
+typedef struct
+{
+    void  *table;
+    bool   lockfree;
+    int    id;
+    unsigned int seed;
+} PROFILE_THREAD;
+
+static void* profile_thread(void *arg)
+{
+    PROFILE_THREAD *thr = (PROFILE_THREAD*)arg;
+    mxs_epoch_thread_init(thr->id);
+
+    for (int i = 0; i < n_operations; i++)
+    {
+        char *key = keys[rand_r(&thr->seed) % n_keys];
+
+        if (rand_r(&thr->seed) % 10000 < write_rate)
+        {
+            if (thr->lockfree)
+            {
+                lfhash_delete(thr->table, key);
+                lfhash_add(thr->table, key, key);
+            }
+            else
+            {
+                hashtable_delete(thr->table, key);
+                hashtable_add(thr->table, key, key);
+            }
+        }
+        else if (thr->lockfree)
+        {
+            lfhash_fetch(thr->table, key);
+        }
+        else
+        {
+            hashtable_fetch(thr->table, key);
+        }
+
+        if (i % EVENT_OPERATIONS == EVENT_OPERATIONS - 1)
+        {
+            mxs_epoch_quiescent();
+        }
+    }
+
+    mxs_epoch_thread_finish();
+    return NULL;
+}
+
+static double profile(void *table, bool lockfree)
+{
+    pthread_t threads[n_threads];
+    PROFILE_THREAD data[n_threads];
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        data[i].table = table;
+        data[i].lockfree = lockfree;
+        data[i].id = i;
+        data[i].seed = i + 1;
+        pthread_create(&threads[i], NULL, profile_thread, &data[i]);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return (double)n_threads * n_operations / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "t:n:k:w:")) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'n':
+            n_operations = atoi(optarg);
+            break;
+
+        case 'k':
+            n_keys = atoi(optarg);
+            break;
+
+        case 'w':
+            write_rate = atoi(optarg);
+            break;
+
+        default:
+            fprintf(stderr, "%s", USAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (n_threads <= 0 || n_threads > MXS_MAX_THREADS || n_operations <= 0 || n_keys <= 0)
+    {
+        fprintf(stderr, "%s", USAGE);
+        return EXIT_FAILURE;
+    }
+
+    keys = malloc(n_keys * sizeof(char*));
+    HASHTABLE *table = hashtable_alloc(n_keys, hashtable_item_strhash, hashtable_item_strcmp);
+    LFHASH *lftable = lfhash_alloc(n_keys, hashtable_item_strhash, hashtable_item_strcmp);
+
+    for (int i = 0; i < n_keys; i++)
+    {
+        char key[32];
+        sprintf(key, "user%d@host%d", i, i % 17);
+        keys[i] = strdup(key);
+        hashtable_add(table, keys[i], keys[i]);
+        lfhash_add(lftable, keys[i], keys[i]);
+    }
+
+    printf("%d threads, %d operations per thread, %d keys, %d writes per 10000\n",
+           n_threads, n_operations, n_keys, write_rate);
+    printf("HASHTABLE: %12.0f operations/s\n", profile(table, false));
+    printf("LFHASH:    %12.0f operations/s\n", profile(lftable, true));
+
+    hashtable_free(table);
+    lfhash_free(lftable);
+
+    for (int i = 0; i < n_keys; i++)
+    {
+        free(keys[i]);
+    }
+
+    free(keys);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * A load generator for measuring the throughput and the latency of a running
+ * MaxScale. Each thread opens its own connection and executes the query in a
+ * loop for the given time. Each port is measured separately and the results
+ * are written as one JSON object per line:
+ *
+ * {"port": 4006, "threads": 16, "queries": 1200000, "errors": 0, "seconds": 10.000,
+ *  "qps": 120000, "p50_us": 120, "p99_us": 410}
+ *
+ * With a listener per router and filter configuration in front of servers that
+ * use the fake backend, the results show the cost of each configuration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <mysql.h>
+
+static const char USAGE[] =
+    "usage: loadgen [-h host] [-u user] [-P password] [-t threads] [-d seconds]\n"
+    "               [-q query] [-o output] port [port...]\n";
+
+typedef struct loadgen_thread
+{
+    pthread_t thr;
+    long      queries;
+    long      errors;
+    long      *latency;  /**< Latency of each query in microseconds */
+    long      n_latency;
+    long      size;
+} LOADGEN_THREAD;
+
+static const char *host = "127.0.0.1";
+static const char *user = "maxuser";
+static const char *password = "maxpwd";
+static const char *query = "SELECT 1";
+static int port;
+static int n_threads = 16;
+static int duration = 10;
+static volatile int running;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_latency(LOADGEN_THREAD *thr, long usec)
+{
+    if (thr->n_latency == thr->size)
+    {
+        long size = thr->size ? thr->size * 2 : 65536;
+        long *tmp = realloc(thr->latency, size * sizeof(long));
+
+        if (tmp == NULL)
+        {
+            return;
+        }
+
+        thr->latency = tmp;
+        thr->size = size;
+    }
+
+    thr->latency[thr->n_latency++] = usec;
+}
+
+static void* run_queries(void *arg)
+{
+    LOADGEN_THREAD *thr = (LOADGEN_THREAD*)arg;
+    MYSQL *mysql = mysql_init(NULL);
+
+    if (mysql == NULL || mysql_real_connect(mysql, host, user, password, NULL, port, NULL, 0) == NULL)
+    {
+        fprintf(stderr, "Failed to connect to %s:%d: %s\n", host, port,
+                mysql ? mysql_error(mysql) : "out of memory");
+        thr->errors++;
+        mysql_close(mysql);
+        return NULL;
+    }
+
+    size_t len = strlen(query);
+
+    while (running)
+    {
+        double start = now();
+
+        if (mysql_real_query(mysql, query, len) == 0)
+        {
+            MYSQL_RES *res = mysql_store_result(mysql);
+            mysql_free_result(res);
+            thr->queries++;
+            add_latency(thr, (now() - start) * 1e6);
+        }
+        else
+        {
+            thr->errors++;
+        }
+    }
+
+    mysql_close(mysql);
+    return NULL;
+}
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return x < y ? -1 : x > y;
+}
+
+/** Run the threads against one port and write the results */
+static int measure(FILE *output)
+{
+    LOADGEN_THREAD threads[n_threads];
+    memset(threads, 0, sizeof(threads));
+    running = 1;
+
+    double start = now();
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_create(&threads[i].thr, NULL, run_queries, &threads[i]);
+    }
+
+    sleep(duration);
+    running = 0;
+
+    long queries = 0;
+    long errors = 0;
+    long n_latency = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i].thr, NULL);
+        queries += threads[i].queries;
+        errors += threads[i].errors;
+        n_latency += threads[i].n_latency;
+    }
+
+    double seconds = now() - start;
+    long *latency = malloc((n_latency ? n_latency : 1) * sizeof(long));
+    long n = 0;
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (latency)
+        {
+            memcpy(latency + n, threads[i].latency, threads[i].n_latency * sizeof(long));
+            n += threads[i].n_latency;
+        }
+
+        free(threads[i].latency);
+    }
+
+    qsort(latency, n, sizeof(long), compare_long);
+
+    fprintf(output, "{\"port\": %d, \"threads\": %d, \"queries\": %ld, \"errors\": %ld, "
+            "\"seconds\": %.3f, \"qps\": %.0f, \"p50_us\": %ld, \"p99_us\": %ld}\n",
+            port, n_threads, queries, errors, seconds, queries / seconds,
+            n ? latency[n / 2] : 0, n ? latency[n * 99 / 100] : 0);
+    fflush(output);
+    free(latency);
+
+    return errors > 0;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *output = stdout;
+    int c;
+
+    while ((c = getopt(argc, argv, "h:u:P:t:d:q:o:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h':
+            host = optarg;
+            break;
+
+        case 'u':
+            user = optarg;
+            break;
+
+        case 'P':
+            password = optarg;
+            break;
+
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'd':
+            duration = atoi(optarg);
+            break;
+
+        case 'q':
+            query = optarg;
+            break;
+
+        case 'o':
+            if ((output = fopen(optarg, "w")) == NULL)
+            {
+                perror(optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        default:
+            fputs(USAGE, stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc || n_threads <= 0 || duration <= 0)
+    {
+        fputs(USAGE, stderr);
+        return EXIT_FAILURE;
+    }
+
+    int rval = 0;
+
+    mysql_library_init(0, NULL, NULL);
+
+    for (int i = optind; i < argc; i++)
+    {
+        port = atoi(argv[i]);
+        rval += measure(output);
+    }
+
+    mysql_library_end();
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+
+    return rval == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "testalloc"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <maxscale/config.h>
+#include <maxscale/log_manager.h>
+#include "../maxscale/alloc.h"
+
+#define N_BLOCKS 100
+
+static void *allocating_thread(void *data)
+{
+    void *blocks[N_BLOCKS];
+
+    for (int i = 0; i < N_BLOCKS; i++)
+    {
+        blocks[i] = MXS_MALLOC(1000);
+    }
+
+    for (int i = 0; i < N_BLOCKS / 2; i++)
+    {
+        MXS_FREE(blocks[i]);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    MXS_CONFIG *cnf = config_get_global_options();
+    ALLOC_STATS stats;
+    int rval = 0;
+
+    mxs_log_init(NULL, "/tmp", MXS_LOG_TARGET_FS);
+    cnf->memory_accounting = true;
+    cnf->memory_sample_interval = 4096;
+    alloc_accounting_init();
+
+    if (!alloc_accounting_active)
+    {
+        fprintf(stderr, "Accounting was not started\n");
+        return 1;
+    }
+
+    if (alloc_accounting_get(MXS_MODULE_NAME, &stats))
+    {
+        fprintf(stderr, "The module was found before it allocated\n");
+        rval++;
+    }
+
+    char *str = MXS_STRDUP_A("0123456789");
+    void *ptr = MXS_CALLOC(10, 100);
+    ptr = MXS_REALLOC(ptr, 2000);
+
+    if (!alloc_accounting_get(MXS_MODULE_NAME, &stats) || stats.allocs != 3 || stats.frees != 1 ||
+        stats.allocated < 11 + 1000 + 2000 || stats.freed < 1000 || stats.allocated - stats.freed < 2011)
+    {
+        fprintf(stderr, "Wrong counts after allocating: %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                stats.allocs, stats.frees, stats.allocated, stats.freed);
+        rval++;
+    }
+
+    MXS_FREE(str);
+    MXS_FREE(ptr);
+    MXS_FREE(NULL);
+
+    if (!alloc_accounting_get(MXS_MODULE_NAME, &stats) || stats.allocs != 3 || stats.frees != 3 ||
+        stats.allocated != stats.freed)
+    {
+        fprintf(stderr, "Wrong counts after freeing: %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                stats.allocs, stats.frees, stats.allocated, stats.freed);
+        rval++;
+    }
+
+    /** The counts of the threads are summed and kept after the threads exit */
+    pthread_t threads[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_create(&threads[i], NULL, allocating_thread, NULL);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (!alloc_accounting_get(MXS_MODULE_NAME, &stats) || stats.allocs != 3 + 4 * N_BLOCKS ||
+        stats.frees != 3 + 4 * N_BLOCKS / 2 || stats.allocated - stats.freed < 4 * N_BLOCKS / 2 * 1000)
+    {
+        fprintf(stderr, "Wrong counts after the threads: %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                stats.allocs, stats.frees, stats.allocated, stats.freed);
+        rval++;
+    }
+
+    RESULTSET *set = memoryGetList();
+
+    if (set == NULL)
+    {
+        fprintf(stderr, "Failed to create the result set\n");
+        rval++;
+    }
+    else
+    {
+        resultset_free(set);
+    }
+
+    mxs_log_finish();
+    return rval;
+}
@@ -37,6 +37,8 @@
 #include <maxscale/buffer.h>
 #include <maxscale/hint.h>
 
+#include "../maxscale/buffer.h"
+
 /**
  * Generate predefined test data
  *
@@ -441,6 +443,129 @@ void test_clone()
     gwbuf_free(original);
 }
 
+void test_make_writable()
+{
+    GWBUF* original = gwbuf_alloc_and_load(10, "0123456789");
+
+    /** A buffer that is not shared is returned as it is */
+    ss_dassert(gwbuf_make_writable(original) == original);
+
+    /** A shared buffer is copied and the clone keeps the old data */
+    GWBUF* clone = gwbuf_clone(original);
+    GWBUF* writable = gwbuf_make_writable(original);
+    ss_dassert(writable && writable != clone);
+    ss_dassert(writable->sbuf != clone->sbuf);
+    GWBUF_DATA(writable)[0] = 'X';
+    ss_dassert(memcmp(GWBUF_DATA(clone), "0123456789", 10) == 0);
+    ss_dassert(memcmp(GWBUF_DATA(writable), "X123456789", 10) == 0);
+
+    /** The clone is no longer shared either */
+    ss_dassert(gwbuf_make_writable(clone) == clone);
+
+    gwbuf_free(writable);
+    gwbuf_free(clone);
+}
+
+static int n_objects_freed = 0;
+
+static void free_object(void *data)
+{
+    n_objects_freed++;
+}
+
+void test_buffer_objects()
+{
+    int parsed = 1;
+    int stmt = 2;
+    int reparsed = 3;
+    GWBUF* original = gwbuf_alloc_and_load(10, "0123456789");
+
+    ss_dassert(gwbuf_get_buffer_object_data(original, GWBUF_PARSING_INFO) == NULL);
+
+    /** Each ID has its own slot */
+    gwbuf_add_buffer_object(original, GWBUF_PARSING_INFO, &parsed, free_object);
+    gwbuf_add_buffer_object(original, GWBUF_STMT_INFO, &stmt, free_object);
+    ss_dassert(GWBUF_IS_PARSED(original));
+    ss_dassert(gwbuf_get_buffer_object_data(original, GWBUF_PARSING_INFO) == &parsed);
+    ss_dassert(gwbuf_get_buffer_object_data(original, GWBUF_STMT_INFO) == &stmt);
+
+    /** A clone shares the objects and they live as long as a buffer refers to them */
+    GWBUF* clone = gwbuf_clone(original);
+    ss_dassert(clone->gwbuf_bufobj == original->gwbuf_bufobj);
+    ss_dassert(gwbuf_get_buffer_object_data(clone, GWBUF_STMT_INFO) == &stmt);
+    gwbuf_free(original);
+    ss_dassert(n_objects_freed == 0);
+
+    /** Replacing an object frees the old one */
+    gwbuf_add_buffer_object(clone, GWBUF_PARSING_INFO, &reparsed, free_object);
+    ss_dassert(n_objects_freed == 1);
+    ss_dassert(gwbuf_get_buffer_object_data(clone, GWBUF_PARSING_INFO) == &reparsed);
+
+    gwbuf_free(clone);
+    ss_dassert(n_objects_freed == 3);
+}
+
+void test_cache()
+{
+    GWBUF_CACHE_STATS stats;
+
+    ss_dassert(!gwbuf_get_cache_stats(0, &stats));
+    ss_dassert(gwbuf_cache_init(1));
+    gwbuf_thread_init(0);
+
+    /** The first allocation of each class comes from malloc */
+    GWBUF* small = gwbuf_alloc_and_load(10, "0123456789");
+    ss_dassert(gwbuf_get_cache_stats(0, &stats));
+    ss_dassert(stats.n_malloc == 1 && stats.n_cached == 0);
+    ss_dassert(small->sbuf->size_class != -1);
+    ss_dassert(small->sbuf->data == GWBUF_DATA(small));
+
+    /** A clone shares the block and keeps it alive after the original is freed */
+    GWBUF* clone = gwbuf_clone(small);
+    gwbuf_free(small);
+    ss_dassert(gwbuf_get_cache_stats(0, &stats));
+    ss_dassert(stats.n_recycled == 0);
+    ss_dassert(memcmp(GWBUF_DATA(clone), "0123456789", 10) == 0);
+    gwbuf_free(clone);
+    ss_dassert(gwbuf_get_cache_stats(0, &stats));
+    ss_dassert(stats.n_recycled == 1);
+
+    /** The freed block is reused for the next buffer of the same class */
+    small = gwbuf_alloc(20);
+    ss_dassert(gwbuf_get_cache_stats(0, &stats));
+    ss_dassert(stats.n_cached == 1);
+
+    /** Splitting a cached buffer works as with separately allocated ones */
+    memcpy(GWBUF_DATA(small), "abcdefghijklmnopqrst", 20);
+    GWBUF* head = gwbuf_split(&small, 5);
+    ss_dassert(gwbuf_length(head) == 5 && gwbuf_length(small) == 15);
+    ss_dassert(memcmp(GWBUF_DATA(small), "fghijklmnopqrst", 15) == 0);
+    gwbuf_free(head);
+    gwbuf_free(small);
+
+    /** Large buffers are not served from the cache */
+    GWBUF* large = gwbuf_alloc(1024 * 1024);
+    ss_dassert(large->sbuf->size_class == -1);
+    ss_dassert(gwbuf_get_cache_stats(0, &stats));
+    ss_dassert(stats.n_large == 1);
+    ss_dassert(gwbuf_get_stat(GWBUF_STAT_LARGE) == 1);
+    gwbuf_free(large);
+
+    /** Payloads larger than the inline size are allocated separately */
+    ss_dassert(!gwbuf_set_inline_size(GWBUF_MAX_INLINE_SIZE + 1));
+    ss_dassert(gwbuf_set_inline_size(32));
+    small = gwbuf_alloc(32);
+    ss_dassert(small->sbuf->size_class != -1);
+    ss_dassert(((uintptr_t)small % 64) == 0);
+    large = gwbuf_alloc(33);
+    ss_dassert(large->sbuf->size_class == -1);
+    gwbuf_free(small);
+    gwbuf_free(large);
+    ss_dassert(gwbuf_set_inline_size(GWBUF_DEFAULT_INLINE_SIZE));
+
+    gwbuf_thread_finish();
+}
+
 /**
  * test1    Allocate a buffer and do lots of things
  *
@@ -562,6 +687,9 @@ test1()
     test_consume();
     test_compare();
     test_clone();
+    test_make_writable();
+    test_buffer_objects();
+    test_cache();
 
     return 0;
 }
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+#include <maxscale/crc32.h>
+
+#define TEST_BUFFER_LEN 4096
+
+/**
+ * Test that the checksum is that of zlib for all lengths and alignments
+ */
+static int test_lengths(const uint8_t* data)
+{
+    int rv = 0;
+
+    for (size_t offset = 0; offset < 16; offset++)
+    {
+        for (size_t len = 0; len + offset <= TEST_BUFFER_LEN; len++)
+        {
+            uint32_t expected = crc32(0, data + offset, len);
+            uint32_t crc = mxs_crc32(0, data + offset, len);
+
+            if (crc != expected)
+            {
+                printf("The checksum of %lu bytes at offset %lu is %08x, expected %08x.\n",
+                       (unsigned long)len, (unsigned long)offset, crc, expected);
+                rv = 1;
+            }
+        }
+    }
+
+    return rv;
+}
+
+/**
+ * Test that a checksum can be continued, as when a binlog event is
+ * checksummed in pieces
+ */
+static int test_continued(const uint8_t* data)
+{
+    int rv = 0;
+    uint32_t expected = crc32(0, data, TEST_BUFFER_LEN);
+
+    for (size_t split = 0; split <= TEST_BUFFER_LEN; split += 7)
+    {
+        uint32_t crc = mxs_crc32(0, data, split);
+        crc = mxs_crc32(crc, data + split, TEST_BUFFER_LEN - split);
+
+        if (crc != expected)
+        {
+            printf("The checksum continued at %lu is %08x, expected %08x.\n",
+                   (unsigned long)split, crc, expected);
+            rv = 1;
+        }
+    }
+
+    return rv;
+}
+
+int main(int argc, char* argv[])
+{
+    static uint8_t data[TEST_BUFFER_LEN];
+    unsigned int seed = 4711;
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = rand_r(&seed);
+    }
+
+    printf("The checksum is %scomputed with PCLMULQDQ.\n", mxs_crc32_is_accelerated() ? "" : "not ");
+
+    int rv = 0;
+
+    rv += test_lengths(data);
+    rv += test_continued(data);
+
+    return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -33,10 +33,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <maxscale/config.h>
 #include <maxscale/dcb.h>
 #include <maxscale/listener.h>
+#include <maxscale/server.h>
+#include <maxscale/session.h>
+
+#include "../maxscale/poll.h"
 
 /**
  * test1    Allocate a dcb and do lots of other things
@@ -81,14 +87,250 @@ test1()
     return 0;
 }
 
+/**
+ * test2    Splice data from one DCB to another
+ *
+ */
+static int
+test2()
+{
+    DCB *from, *to;
+    int from_fds[2], to_fds[2];
+    char data[10000], result[sizeof(data)];
+    SERV_LISTENER dummy;
+
+    ss_dfprintf(stderr, "testdcb : splicing data between DCBs");
+    ss_info_dassert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, from_fds) == 0 &&
+                    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, to_fds) == 0,
+                    "Creating the sockets must succeed");
+
+    from = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, &dummy);
+    to = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, &dummy);
+    from->fd = from_fds[0];
+    to->fd = to_fds[0];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = i % 251;
+    }
+
+    ss_info_dassert(dcb_splice(from, to) == 0, "Nothing must be moved from an empty socket");
+    ss_info_dassert(write(from_fds[1], data, sizeof(data)) == sizeof(data), "Write must succeed");
+    ss_info_dassert(dcb_splice(from, to) == sizeof(data), "All data must be moved");
+    ss_info_dassert(to->writeq == NULL, "Nothing must be queued");
+    ss_info_dassert(read(to_fds[1], result, sizeof(result)) == sizeof(result), "Read must succeed");
+    ss_info_dassert(memcmp(data, result, sizeof(data)) == 0, "Data must not change");
+
+    from->fd = DCBFD_CLOSED;
+    to->fd = DCBFD_CLOSED;
+    dcb_free_all_memory(from);
+    dcb_free_all_memory(to);
+    close(from_fds[0]);
+    close(from_fds[1]);
+    close(to_fds[0]);
+    close(to_fds[1]);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+/**
+ * test3    Coalesce writes to a corked DCB
+ *
+ */
+static int
+test3()
+{
+    DCB *dcb;
+    int fds[2];
+    char data[100], result[sizeof(data) * 2];
+    SERV_LISTENER dummy;
+
+    ss_dfprintf(stderr, "testdcb : coalescing writes of a corked DCB");
+    ss_info_dassert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0,
+                    "Creating the sockets must succeed");
+
+    dcb = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, &dummy);
+    dcb->fd = fds[0];
+    memset(data, 'a', sizeof(data));
+
+    dcb_cork(dcb);
+    ss_info_dassert(dcb_write(dcb, gwbuf_alloc_and_load(sizeof(data), data)), "Write must succeed");
+    ss_info_dassert(dcb_write(dcb, gwbuf_alloc_and_load(sizeof(data), data)), "Write must succeed");
+    ss_info_dassert(dcb->writeqlen == sizeof(data) * 2, "Data must be queued");
+    ss_info_dassert(dcb->stats.n_writes == 0, "Nothing must be written");
+
+    dcb_uncork(dcb, false);
+    ss_info_dassert(dcb->writeq == NULL && dcb->writeqlen == 0, "Queue must be empty");
+    ss_info_dassert(dcb->stats.n_writes == 1, "Data must be written at once");
+    ss_info_dassert(read(fds[1], result, sizeof(result)) == sizeof(result), "Read must succeed");
+
+    dcb->fd = DCBFD_CLOSED;
+    dcb_free_all_memory(dcb);
+    close(fds[0]);
+    close(fds[1]);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+/**
+ * test4    Pause the backend reads of a session while its client is slow to read
+ *
+ */
+static int
+test4()
+{
+    DCB *client, *backend;
+    MXS_SESSION session;
+    int fds[2];
+    int sndbuf = 4096;
+    size_t size = 1024 * 1024;
+    char *data = malloc(size);
+    char result[16384];
+    SERV_LISTENER dummy;
+
+    ss_dfprintf(stderr, "testdcb : pausing backend reads of a slow client");
+    ss_info_dassert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0,
+                    "Creating the sockets must succeed");
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    memset(&session, 0, sizeof(session));
+    session.state = SESSION_STATE_ROUTER_READY;
+    client = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, &dummy);
+    backend = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+    client->fd = fds[0];
+    client->session = &session;
+    backend->session = &session;
+    session.client_dcb = client;
+    dcb_add_to_list(backend);
+    memset(data, 'a', size);
+
+    ss_info_dassert(dcb_set_backpressure(client, 65536, 16384), "Adding the callbacks must succeed");
+    ss_info_dassert(!dcb_pause_read(backend), "Backend must be read when the client is fast");
+    ss_info_dassert(dcb_write(client, gwbuf_alloc_and_load(size, data)), "Write must succeed");
+    ss_info_dassert(client->writeqlen > 65536, "Data must be queued");
+    ss_info_dassert(session.backend_reads_paused, "Backend reads must be paused");
+    ss_info_dassert(dcb_pause_read(backend), "Backend read must be skipped");
+    ss_info_dassert(dcb_pause_read(backend), "Backend read must be skipped again");
+    ss_info_dassert(session.n_paused_reads == 1, "One DCB must have a skipped read");
+    ss_info_dassert(!dcb_pause_read(client), "Client must be read");
+
+    size_t total = 0;
+
+    while (client->writeq)
+    {
+        ssize_t rc;
+
+        while ((rc = read(fds[1], result, sizeof(result))) > 0)
+        {
+            total += rc;
+        }
+
+        dcb_drain_writeq(client);
+    }
+
+    while (total < size)
+    {
+        ssize_t rc = read(fds[1], result, sizeof(result));
+        ss_info_dassert(rc > 0, "Read must succeed");
+        total += rc;
+    }
+
+    ss_info_dassert(!session.backend_reads_paused, "Backend reads must be resumed");
+    ss_info_dassert(session.n_paused_reads == 0 && !backend->read_paused,
+                    "Skipped read must be done");
+
+    client->session = NULL;
+    backend->session = NULL;
+    client->fd = DCBFD_CLOSED;
+    dcb_free_all_memory(client);
+    backend->state = DCB_STATE_NOPOLLING;
+    dcb_close(backend);
+    dcb_process_zombies(0);
+    close(fds[0]);
+    close(fds[1]);
+    free(data);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
+/**
+ * test5    Find the sessions and the backend DCBs of a server through the indexes
+ */
+static int
+test5()
+{
+    MXS_SESSION session;
+    SERVER server;
+    DCB *server_dcbs[1] = {NULL};
+
+    ss_dfprintf(stderr, "testdcb : indexing DCBs by session and server");
+    memset(&session, 0, sizeof(session));
+    memset(&server, 0, sizeof(server));
+    session.state = SESSION_STATE_ROUTER_READY;
+    session.ses_id = 12345;
+    session.refcount = 1;
+    server.dcbs = server_dcbs;
+    server.stats.n_current = ts_stats_alloc();
+
+    DCB *client = dcb_alloc(DCB_ROLE_CLIENT_HANDLER, NULL);
+    DCB *backend = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+    DCB *other = dcb_alloc(DCB_ROLE_BACKEND_HANDLER, NULL);
+    session.client_dcb = client;
+    backend->server = &server;
+    other->server = &server;
+
+    client->state = DCB_STATE_POLLING;
+    dcb_add_to_list(client);
+    ss_info_dassert(session_get_by_id(12345) == NULL, "A DCB without a session must not be indexed");
+
+    client->session = &session;
+    dcb_index_session(client);
+    ss_info_dassert(session_get_by_id(12345) == &session, "Session must be found by its ID");
+    ss_info_dassert(session.refcount == 2, "Finding the session must add a reference");
+    session_put_ref(&session);
+    ss_info_dassert(session_get_by_id(54321) == NULL, "Unknown ID must not be found");
+
+    dcb_add_to_list(backend);
+    dcb_add_to_list(other);
+    ss_info_dassert(server_dcbs[0] == other && other->thread.server_next == backend &&
+                    backend->thread.server_next == NULL, "Backend DCBs must be in the server's list");
+
+    other->state = DCB_STATE_NOPOLLING;
+    dcb_close(other);
+    dcb_process_zombies(0);
+    ss_info_dassert(server_dcbs[0] == backend && backend->thread.server_prev == NULL,
+                    "Closed DCB must be removed from the server's list");
+
+    client->session = NULL;
+    client->state = DCB_STATE_NOPOLLING;
+    backend->state = DCB_STATE_NOPOLLING;
+    dcb_close(client);
+    dcb_close(backend);
+    dcb_process_zombies(0);
+    ss_info_dassert(session_get_by_id(12345) == NULL, "Closed DCB must be removed from the index");
+    ss_info_dassert(server_dcbs[0] == NULL, "Server's list must be empty");
+    ts_stats_free(server.stats.n_current);
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
     MXS_CONFIG* glob_conf = config_get_global_options();
     glob_conf->n_threads = 1;
     dcb_global_init();
+    poll_init();
 
     result += test1();
+    result += test2();
+    result += test3();
+    result += test4();
+    result += test5();
 
     exit(result);
 }
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/digest.h>
+#include <maxscale/protocol/mysql.h>
+
+typedef struct test_case
+{
+    const char* stmt;      // A statement.
+    const char* canonical; // Its canonical form.
+} TEST_CASE;
+
+static const TEST_CASE test_cases[] =
+{
+    { "SELECT 1", "SELECT ?" },
+    { "  SELECT\t*\nFROM t  WHERE a = 1 ", "SELECT * FROM t WHERE a = ?" },
+    { "SELECT a FROM t WHERE b = 'it''s' AND c = 'x\\'y'", "SELECT a FROM t WHERE b = ? AND c = ?" },
+    { "SELECT 1.5e-3, -2, .5", "SELECT ?, -?, .5" },
+    { "SELECT t1.a2 FROM t1", "SELECT t1.a2 FROM t1" },
+    { "SELECT X'1F', _utf8'a'", "SELECT X'1F', _utf8'a'" },
+    { "SELECT `a b`, \"c\" FROM t", "SELECT `a b`, \"c\" FROM t" },
+    { "SELECT /* comment */ 1 # comment", "SELECT ?" },
+    { "SELECT 1 -- comment\nFROM t", "SELECT ? FROM t" },
+    { "SELECT/**/a", "SELECT a" },
+    { "SELECT /*!40000 SQL_NO_CACHE */ a", "SELECT /*!40000 SQL_NO_CACHE */ a" },
+    { "SELECT 0x1F, 1abc", "SELECT 0x1F, 1abc" },
+};
+
+static GWBUF* create_gwbuf(const char* stmt)
+{
+    size_t len = strlen(stmt);
+    size_t payload_len = len + 1;
+    GWBUF* buf = gwbuf_alloc(MYSQL_HEADER_LEN + payload_len);
+    uint8_t* data = GWBUF_DATA(buf);
+
+    data[0] = payload_len;
+    data[1] = payload_len >> 8;
+    data[2] = payload_len >> 16;
+    data[3] = 0x00;
+    data[4] = MYSQL_COM_QUERY;
+    memcpy(data + MYSQL_HEADER_LEN + 1, stmt, len);
+
+    return buf;
+}
+
+static bool get_digest(const char* stmt, MXS_DIGEST* digest)
+{
+    GWBUF* buf = create_gwbuf(stmt);
+    bool rv = mxs_digest_get(buf, digest);
+    gwbuf_free(buf);
+
+    return rv;
+}
+
+static int test_canonical(const TEST_CASE* tc)
+{
+    int rv = 0;
+    size_t len = strlen(tc->stmt);
+    char canonical[len + 1];
+
+    canonical[mxs_digest_canonicalize(tc->stmt, len, canonical)] = 0;
+
+    if (strcmp(canonical, tc->canonical) != 0)
+    {
+        printf("\"%s\": expected \"%s\", got \"%s\".\n", tc->stmt, tc->canonical, canonical);
+        rv = 1;
+    }
+
+    return rv;
+}
+
+static int test_same(const char* stmt1, const char* stmt2, bool same)
+{
+    int rv = 0;
+    MXS_DIGEST d1;
+    MXS_DIGEST d2;
+
+    if (!get_digest(stmt1, &d1) || !get_digest(stmt2, &d2))
+    {
+        printf("Could not get the digest of \"%s\" or \"%s\".\n", stmt1, stmt2);
+        rv = 1;
+    }
+    else if ((memcmp(&d1, &d2, sizeof(d1)) == 0) != same)
+    {
+        printf("\"%s\" and \"%s\": expected %s digests.\n", stmt1, stmt2, same ? "same" : "different");
+        rv = 1;
+    }
+
+    return rv;
+}
+
+static int test_stored()
+{
+    int rv = 0;
+    GWBUF* buf = create_gwbuf("SELECT 1");
+    MXS_DIGEST d1;
+    MXS_DIGEST d2;
+
+    if (!mxs_digest_get(buf, &d1) ||
+        gwbuf_get_buffer_object_data(buf, GWBUF_STMT_INFO) == NULL ||
+        !mxs_digest_get(buf, &d2) ||
+        memcmp(&d1, &d2, sizeof(d1)) != 0)
+    {
+        printf("The digest is not stored in the buffer.\n");
+        rv = 1;
+    }
+
+    char str[MXS_DIGEST_STR_LEN];
+    mxs_digest_to_string(&d1, str);
+
+    if (strlen(str) != MXS_DIGEST_STR_LEN - 1)
+    {
+        printf("The string of a digest is %lu characters long.\n", (unsigned long)strlen(str));
+        rv = 1;
+    }
+
+    gwbuf_free(buf);
+
+    uint8_t ping[] = { 0x01, 0x00, 0x00, 0x00, MYSQL_COM_PING };
+    buf = gwbuf_alloc_and_load(sizeof(ping), ping);
+
+    if (mxs_digest_get(buf, &d1))
+    {
+        printf("A COM_PING has a digest.\n");
+        rv = 1;
+    }
+
+    gwbuf_free(buf);
+
+    return rv;
+}
+
+int main(int argc, char* argv[])
+{
+    int rv = 0;
+
+    for (size_t i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); ++i)
+    {
+        rv += test_canonical(&test_cases[i]);
+    }
+
+    rv += test_same("SELECT a FROM t WHERE b = 1", "select a from t where b = 1", false);
+    rv += test_same("SELECT a FROM t WHERE b = 1", "SELECT  a FROM t WHERE b = 'x' /* c */", true);
+    rv += test_same("SELECT a FROM t WHERE b = 1", "SELECT a FROM t WHERE c = 1", false);
+
+    rv += test_stored();
+
+    return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
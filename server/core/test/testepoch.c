@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <maxscale/atomic.h>
+#include <maxscale/debug.h>
+
+#include "../maxscale/epoch.h"
+
+static int n_freed = 0;
+static int worker_state = 0;
+
+static void test_free(void *data)
+{
+    atomic_add(&n_freed, 1);
+}
+
+/**
+ * Test that objects deferred by other threads than workers are freed when
+ * no worker is online
+ */
+static int test1()
+{
+    fprintf(stderr, "testepoch : deferring without workers. ");
+    mxs_epoch_defer(test_free, NULL);
+    ss_info_dassert(mxs_epoch_pending() == 1, "Object must be deferred");
+    mxs_epoch_synchronize();
+    ss_info_dassert(mxs_epoch_pending() == 0 && n_freed == 1, "Object must be freed");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/** A worker that is quiescent only when told to */
+static void* test_worker(void *arg)
+{
+    mxs_epoch_thread_init(1);
+    atomic_store_int32(&worker_state, 1);
+
+    while (atomic_load_int32(&worker_state) != 3)
+    {
+        if (atomic_load_int32(&worker_state) == 2)
+        {
+            mxs_epoch_quiescent();
+            atomic_store_int32(&worker_state, 1);
+        }
+    }
+
+    mxs_epoch_thread_finish();
+    return NULL;
+}
+
+/**
+ * Test that deferred objects are freed only after all workers are quiescent
+ */
+static int test2()
+{
+    pthread_t thr;
+
+    fprintf(stderr, "testepoch : freeing after quiescent states. ");
+    n_freed = 0;
+    mxs_epoch_thread_init(0);
+    pthread_create(&thr, NULL, test_worker, NULL);
+
+    while (atomic_load_int32(&worker_state) != 1)
+    {
+    }
+
+    mxs_epoch_defer(test_free, NULL);
+    mxs_epoch_quiescent();
+    ss_info_dassert(n_freed == 0, "Object must not be freed while a worker can read it");
+
+    atomic_store_int32(&worker_state, 2);
+
+    while (atomic_load_int32(&worker_state) != 1)
+    {
+    }
+
+    mxs_epoch_quiescent();
+    ss_info_dassert(n_freed == 1 && mxs_epoch_pending() == 0, "Object must be freed");
+
+    /** The other worker waits for this one when it finishes */
+    mxs_epoch_defer(test_free, NULL);
+    mxs_epoch_offline();
+    atomic_store_int32(&worker_state, 3);
+    pthread_join(thr, NULL);
+    mxs_epoch_online();
+    mxs_epoch_quiescent();
+    ss_info_dassert(n_freed == 2, "Object must be freed when the other worker is gone");
+
+    mxs_epoch_defer(test_free, NULL);
+    mxs_epoch_thread_finish();
+    ss_info_dassert(n_freed == 3, "Finishing must free the objects of the thread");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "../maxscale/fastclassifier.hh"
+#include "../maxscale/query_classifier.h"
+#include <maxscale/alloc.h>
+#include <maxscale/paths.h>
+#include <maxscale/protocol/mysql.h>
+#include "../../../query_classifier/test/testreader.hh"
+
+using namespace std;
+
+namespace
+{
+
+char USAGE[] =
+    "test_fastclassifier [-v] [file]\n"
+    "\n"
+    "Checks that the statements the fast classifier decides on get the same\n"
+    "type mask as they get from the query classifier.\n"
+    "\n"
+    "-v    print every statement the fast classifier decides on\n";
+
+/**
+ * Statements the fast classifier must decide on.
+ */
+const char* DECIDED[] =
+{
+    "BEGIN",
+    "COMMIT",
+    "ROLLBACK WORK",
+    "START TRANSACTION READ ONLY",
+    "SET autocommit=0",
+    "SET @@session.autocommit = ON",
+    "USE test",
+    "use `test`;",
+    "SELECT * FROM t",
+    "SELECT a, b FROM db.t WHERE id = 1",
+    "select a from t where id = ?",
+    "SELECT t.a AS x FROM t, u WHERE t.b = u.b AND x IS NOT NULL",
+    "SELECT a FROM t WHERE b IN (1, 2, 3) OR c NOT LIKE 'x%' ORDER BY a DESC LIMIT 10, 5",
+    "SELECT 1",
+    "SELECT a FROM t /* comment */ WHERE b = 'it''s'",
+};
+
+/**
+ * Statements the fast classifier must leave to the query classifier.
+ */
+const char* UNDECIDED[] =
+{
+    "BEGIN; SELECT 1",
+    "ROLLBACK TO SAVEPOINT sp",
+    "SET autocommit=1, @a = 2",
+    "SET NAMES utf8",
+    "SELECT @a",
+    "SELECT @@version",
+    "SELECT NOW()",
+    "SELECT LAST_INSERT_ID()",
+    "SELECT a FROM t FOR UPDATE",
+    "SELECT a FROM t WHERE b = 1 LOCK IN SHARE MODE",
+    "SELECT a INTO @a FROM t",
+    "SELECT a FROM t UNION SELECT b FROM u",
+    "SELECT a FROM t JOIN u ON t.b = u.b",
+    "SELECT a FROM t WHERE b IN (SELECT b FROM u)",
+    "SELECT SQL_CALC_FOUND_ROWS a FROM t",
+    "SELECT a FROM t WHERE b = 0x1F",
+    "SELECT a FROM t /*!50000 FOR UPDATE */",
+    "SELECT a FROM t WHERE b = 'unterminated",
+    "INSERT INTO t VALUES (1)",
+    "UPDATE t SET a = 1",
+};
+
+GWBUF* create_gwbuf(const char* zStmt)
+{
+    size_t len = strlen(zStmt);
+    size_t payload_len = len + 1;
+    size_t gwbuf_len = MYSQL_HEADER_LEN + payload_len;
+
+    GWBUF* pBuf = gwbuf_alloc(gwbuf_len);
+
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf))) = payload_len;
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 1)) = (payload_len >> 8);
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 2)) = (payload_len >> 16);
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 3)) = 0x00;
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 4)) = 0x03;
+    memcpy((char*)GWBUF_DATA(pBuf) + 5, zStmt, len);
+
+    return pBuf;
+}
+
+class Tester
+{
+public:
+    Tester(bool verbose)
+        : m_verbose(verbose)
+    {
+    }
+
+    /**
+     * Classify a statement.
+     *
+     * @param zStmt     The statement.
+     * @param pDecided  On return, whether the fast classifier decided on it.
+     *
+     * @return EXIT_FAILURE, if the fast classifier and the query classifier
+     *         disagreed, EXIT_SUCCESS otherwise.
+     */
+    int run(const char* zStmt, bool* pDecided)
+    {
+        int rc = EXIT_SUCCESS;
+
+        GWBUF* pStmt = create_gwbuf(zStmt);
+
+        uint32_t type_mask_fast;
+        maxscale::FastClassifier fc;
+
+        *pDecided = fc.type_mask_of(pStmt, &type_mask_fast);
+
+        if (*pDecided)
+        {
+            // Once parsed, qc_get_type_mask() returns what the classifier reports.
+            qc_parse(pStmt, QC_COLLECT_ESSENTIALS);
+            uint32_t type_mask_qc = qc_get_type_mask(pStmt);
+
+            if (type_mask_qc == type_mask_fast)
+            {
+                if (m_verbose)
+                {
+                    char* zType_mask = qc_typemask_to_string(type_mask_qc);
+                    cout << zStmt << ": " << zType_mask << endl;
+                    MXS_FREE(zType_mask);
+                }
+            }
+            else
+            {
+                char* zType_mask_qc = qc_typemask_to_string(type_mask_qc);
+                char* zType_mask_fast = qc_typemask_to_string(type_mask_fast);
+
+                cout << zStmt << "\n"
+                     << "  QC  : " << zType_mask_qc << "\n"
+                     << "  FAST: " << zType_mask_fast << endl;
+
+                MXS_FREE(zType_mask_qc);
+                MXS_FREE(zType_mask_fast);
+
+                rc = EXIT_FAILURE;
+            }
+        }
+
+        gwbuf_free(pStmt);
+
+        return rc;
+    }
+
+    int run(const char** pzStmts, size_t n_stmts, bool decided)
+    {
+        int rc = EXIT_SUCCESS;
+
+        for (size_t i = 0; i < n_stmts; ++i)
+        {
+            bool was_decided;
+
+            if (run(pzStmts[i], &was_decided) == EXIT_FAILURE)
+            {
+                rc = EXIT_FAILURE;
+            }
+            else if (was_decided != decided)
+            {
+                cout << pzStmts[i] << ": expected to be "
+                     << (decided ? "decided" : "left to the query classifier") << endl;
+                rc = EXIT_FAILURE;
+            }
+        }
+
+        return rc;
+    }
+
+    int run(istream& in)
+    {
+        int rc = EXIT_SUCCESS;
+
+        maxscale::TestReader reader(in);
+
+        string stmt;
+
+        while (reader.get_statement(stmt) == maxscale::TestReader::RESULT_STMT)
+        {
+            bool decided;
+
+            if (run(stmt.c_str(), &decided) == EXIT_FAILURE)
+            {
+                rc = EXIT_FAILURE;
+            }
+        }
+
+        return rc;
+    }
+
+private:
+    Tester(const Tester&);
+    Tester& operator = (const Tester&);
+
+private:
+    bool m_verbose;
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_SUCCESS;
+
+    bool verbose = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "v")) != -1)
+    {
+        switch (c)
+        {
+        case 'v':
+            verbose = true;
+            break;
+
+        default:
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    int n = argc - optind;
+
+    if ((rc == EXIT_SUCCESS) && (n <= 1))
+    {
+        rc = EXIT_FAILURE;
+
+        set_datadir(strdup("/tmp"));
+        set_langdir(strdup("."));
+        set_process_datadir(strdup("/tmp"));
+
+        if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+        {
+            if (qc_setup("qc_sqlite", NULL) && qc_process_init(QC_INIT_BOTH))
+            {
+                Tester tester(verbose);
+
+                if (n == 0)
+                {
+                    rc = tester.run(DECIDED, sizeof(DECIDED) / sizeof(DECIDED[0]), true);
+
+                    if (tester.run(UNDECIDED, sizeof(UNDECIDED) / sizeof(UNDECIDED[0]), false) ==
+                        EXIT_FAILURE)
+                    {
+                        rc = EXIT_FAILURE;
+                    }
+                }
+                else
+                {
+                    ifstream in(argv[optind]);
+
+                    if (in)
+                    {
+                        rc = tester.run(in);
+                    }
+                    else
+                    {
+                        cerr << "error: Could not open " << argv[optind] << "." << endl;
+                    }
+                }
+
+                qc_process_end(QC_INIT_BOTH);
+            }
+            else
+            {
+                cerr << "error: Could not initialize qc_sqlite." << endl;
+            }
+
+            mxs_log_finish();
+        }
+        else
+        {
+            cerr << "error: Could not initialize log." << endl;
+        }
+    }
+    else
+    {
+        cout << USAGE << endl;
+    }
+
+    return rc;
+}
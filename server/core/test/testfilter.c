@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <maxscale/config.h>
 #include "../maxscale/filter.h"
 
 
@@ -145,6 +146,53 @@ test3()
     return 0;
 }
 
+/**
+ * test4    Replacing the options and parameters of a filter that is not in use
+ *
+ */
+static int
+test4()
+{
+    MXS_FILTER_DEF  *f1;
+    MXS_CONFIG_PARAMETER p2 = {.name = "name2", .value = "value2"};
+    MXS_CONFIG_PARAMETER p1 = {.name = "name1", .value = "new", .next = &p2};
+    MXS_CONFIG_PARAMETER *param;
+    int rval = 0;
+
+    if ((f1 = filter_alloc("test4", "module")) == NULL)
+    {
+        fprintf(stderr, "filter_alloc: test 4 failed.\n");
+        return 1;
+    }
+    filter_add_option(f1, "option1");
+    filter_add_parameter(f1, "name1", "value1");
+    filter_add_parameter(f1, "name3", "value3");
+
+    if (!filter_reload(f1, "option2,option3", &p1))
+    {
+        fprintf(stderr, "filter_reload: test 4 failed.\n");
+        rval = 1;
+    }
+    else if (f1->options == NULL || strcmp(f1->options[0], "option2") != 0 ||
+             f1->options[1] == NULL || strcmp(f1->options[1], "option3") != 0 ||
+             f1->options[2] != NULL)
+    {
+        fprintf(stderr, "filter_reload: test 4 failed, wrong options.\n");
+        rval = 1;
+    }
+    else if ((param = config_get_param(f1->parameters, "name1")) == NULL ||
+             strcmp(param->value, "new") != 0 ||
+             config_get_param(f1->parameters, "name2") == NULL ||
+             config_get_param(f1->parameters, "name3") != NULL)
+    {
+        fprintf(stderr, "filter_reload: test 4 failed, wrong parameters.\n");
+        rval = 1;
+    }
+
+    filter_free(f1);
+    return rval;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -153,6 +201,7 @@ main(int argc, char **argv)
     result += test1();
     result += test2();
     result += test3();
+    result += test4();
 
     exit(result);
 }
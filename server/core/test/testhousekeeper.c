@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <maxscale/atomic.h>
+#include <maxscale/debug.h>
+#include <maxscale/platform.h>
+#include <maxscale/thread.h>
+
+#include "../maxscale/housekeeper.h"
+
+#define N_WORKERS 2
+
+static int stop = 0;
+static THREAD workers[N_WORKERS];
+static int n_runs[N_WORKERS];
+static int run_thread[N_WORKERS];
+static int added_locally = 0;
+
+static thread_local int worker_id = -1;
+
+/**
+ * A minimal worker event loop that only polls the task timer
+ */
+static void worker_main(void *data)
+{
+    int id = (intptr_t)data;
+    int epfd = epoll_create(1);
+    struct epoll_event ev = {.events = EPOLLIN};
+    ss_info_dassert(epoll_ctl(epfd, EPOLL_CTL_ADD, hk_worker_fd(id), &ev) == 0, "Adding must succeed");
+
+    worker_id = id;
+    hk_worker_thread_init(id);
+
+    while (!atomic_load_int32(&stop))
+    {
+        if (epoll_wait(epfd, &ev, 1, 50) == 1)
+        {
+            hk_worker_process();
+        }
+    }
+
+    hk_worker_thread_finish();
+    close(epfd);
+}
+
+static void count_task(void *data)
+{
+    int id = (intptr_t)data;
+    atomic_store_int32(&run_thread[id], worker_id);
+    atomic_add(&n_runs[id], 1);
+}
+
+static void self_removing_task(void *data)
+{
+    count_task(data);
+    ss_info_dassert(hktask_remove_worker(worker_id, "self") == 1, "Local removal must succeed");
+}
+
+static void adding_task(void *data)
+{
+    if (!added_locally)
+    {
+        ss_info_dassert(hktask_add_worker(worker_id, "local", count_task, data, 1) == 1,
+                        "Local addition must succeed");
+        ss_info_dassert(hktask_add_worker(worker_id, "local", count_task, data, 1) == 0,
+                        "Duplicate names must be rejected");
+        added_locally = 1;
+    }
+}
+
+static void wait_runs(int id, int count)
+{
+    for (int i = 0; i < 500 && atomic_load_int32(&n_runs[id]) < count; i++)
+    {
+        usleep(10000);
+    }
+}
+
+/**
+ * Test that the tasks are run by the thread they were added to
+ */
+static int test1()
+{
+    fprintf(stderr, "testhousekeeper : tasks added by other threads. ");
+
+    ss_info_dassert(hktask_add_worker(N_WORKERS, "bad", count_task, NULL, 1) == 0,
+                    "Invalid thread IDs must be rejected");
+    ss_info_dassert(hktask_add_worker(0, "count", count_task, (void*)0, 1) == 1, "Adding must succeed");
+    ss_info_dassert(hktask_add_worker(1, "count", count_task, (void*)1, 1) == 1,
+                    "The same name must be usable in another thread");
+
+    wait_runs(0, 2);
+    wait_runs(1, 2);
+    ss_info_dassert(n_runs[0] >= 2 && n_runs[1] >= 2, "The tasks must be run repeatedly");
+    ss_info_dassert(run_thread[0] == 0 && run_thread[1] == 1, "The tasks must run in their own thread");
+
+    ss_info_dassert(hktask_remove_worker(0, "count") == 1, "Removal must be scheduled");
+    ss_info_dassert(hktask_remove_worker(1, "count") == 1, "Removal must be scheduled");
+    usleep(100000);
+    int runs = n_runs[0];
+    usleep(1500000);
+    ss_info_dassert(n_runs[0] == runs, "A removed task must not be run");
+
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * Test that tasks can add and remove tasks of their own thread
+ */
+static int test2()
+{
+    fprintf(stderr, "testhousekeeper : tasks managed by the worker itself. ");
+    n_runs[0] = 0;
+    n_runs[1] = 0;
+
+    ss_info_dassert(hktask_add_worker(1, "self", self_removing_task, (void*)1, 1) == 1,
+                    "Adding must succeed");
+    ss_info_dassert(hktask_add_worker(0, "adder", adding_task, (void*)0, 1) == 1, "Adding must succeed");
+
+    wait_runs(0, 1);
+    wait_runs(1, 1);
+    usleep(1500000);
+    ss_info_dassert(n_runs[1] == 1, "A task that removes itself must run once");
+    ss_info_dassert(n_runs[0] >= 1 && run_thread[0] == 0, "A locally added task must be run");
+
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    ss_info_dassert(hk_worker_init(N_WORKERS), "Initialization must succeed");
+
+    for (intptr_t i = 0; i < N_WORKERS; i++)
+    {
+        thread_start(&workers[i], worker_main, (void*)i);
+    }
+
+    result += test1();
+    result += test2();
+
+    atomic_store_int32(&stop, 1);
+
+    for (int i = 0; i < N_WORKERS; i++)
+    {
+        thread_wait(workers[i]);
+    }
+
+    exit(result);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <maxscale/atomic.h>
+#include <maxscale/debug.h>
+#include <maxscale/lfhash.h>
+
+#include "../maxscale/epoch.h"
+
+#define TEST_KEYS    1000
+#define TEST_READERS 4
+
+static int n_freed = 0;
+
+static void count_free(void *data)
+{
+    atomic_add(&n_freed, 1);
+    hashtable_item_free(data);
+}
+
+/**
+ * Test adding, fetching and deleting elements and the growth of the table
+ */
+static int test1()
+{
+    char key[20];
+    char value[20];
+
+    fprintf(stderr, "testlfhash : add, fetch and delete. ");
+    LFHASH *table = lfhash_alloc(4, hashtable_item_strhash, hashtable_item_strcmp);
+    ss_info_dassert(table, "Allocation must succeed");
+    lfhash_memory_fns(table, hashtable_item_strdup, hashtable_item_strdup, count_free, count_free);
+
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        sprintf(key, "key%d", i);
+        sprintf(value, "value%d", i);
+        ss_info_dassert(lfhash_add(table, key, value) == 1, "Adding must succeed");
+    }
+
+    ss_info_dassert(lfhash_add(table, "key10", "other") == 0, "Duplicates must be rejected");
+    ss_info_dassert(lfhash_size(table) == TEST_KEYS, "All elements must be counted");
+
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        sprintf(key, "key%d", i);
+        sprintf(value, "value%d", i);
+        char *found = lfhash_fetch(table, key);
+        ss_info_dassert(found && strcmp(found, value) == 0, "Value must be found");
+    }
+
+    ss_info_dassert(lfhash_fetch(table, "nokey") == NULL, "Missing key must not be found");
+    ss_info_dassert(lfhash_delete(table, "nokey") == 0, "Missing key must not be deleted");
+
+    for (int i = 0; i < TEST_KEYS; i += 2)
+    {
+        sprintf(key, "key%d", i);
+        ss_info_dassert(lfhash_delete(table, key) == 1, "Deleting must succeed");
+        ss_info_dassert(lfhash_fetch(table, key) == NULL, "Deleted key must not be found");
+    }
+
+    ss_info_dassert(lfhash_size(table) == TEST_KEYS / 2, "Deleted elements must not be counted");
+    mxs_epoch_synchronize();
+    ss_info_dassert(n_freed == TEST_KEYS, "Deleted keys and values must be freed");
+
+    /** Deleted entries must be reusable after the table is rebuilt */
+    for (int i = 0; i < TEST_KEYS * 4; i++)
+    {
+        ss_info_dassert(lfhash_add(table, "again", "value") == 1, "Adding must succeed");
+        ss_info_dassert(lfhash_delete(table, "again") == 1, "Deleting must succeed");
+    }
+
+    int n_keys = 0;
+    LFHASHITERATOR *iter = lfhash_iterator(table);
+    char *next;
+
+    while ((next = lfhash_next(iter)))
+    {
+        ss_info_dassert(atoi(next + 3) % 2 == 1, "Only the remaining keys must be returned");
+        n_keys++;
+    }
+
+    lfhash_iterator_free(iter);
+    ss_info_dassert(n_keys == TEST_KEYS / 2, "All keys must be returned");
+
+    lfhash_free(table);
+    mxs_epoch_synchronize();
+    ss_info_dassert(n_freed == TEST_KEYS * 10, "All memory must be freed");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+static LFHASH *shared_table;
+static int shared_values[TEST_KEYS];
+static int stop_readers = 0;
+
+static int int_hash(const void *key)
+{
+    return *(const int*)key;
+}
+
+static int int_cmp(const void *key, const void *entry_key)
+{
+    ss_info_dassert(*(const int*)entry_key != -1, "Keys must not be freed while they are read");
+    return *(const int*)key - *(const int*)entry_key;
+}
+
+static void* int_copy(const void *data)
+{
+    int *rval = malloc(sizeof(int));
+    *rval = *(const int*)data;
+    return rval;
+}
+
+static void int_free(void *data)
+{
+    *(int*)data = -1;
+    free(data);
+}
+
+static void* test_reader(void *arg)
+{
+    mxs_epoch_thread_init(*(int*)arg);
+
+    while (atomic_load_int32(&stop_readers) == 0)
+    {
+        for (int i = 0; i < TEST_KEYS; i++)
+        {
+            int *value = lfhash_fetch(shared_table, &i);
+            ss_info_dassert(value == NULL || value == &shared_values[i], "Value must match the key");
+        }
+
+        /** One pass over the keys is one event of a worker */
+        mxs_epoch_quiescent();
+    }
+
+    mxs_epoch_thread_finish();
+    return NULL;
+}
+
+/**
+ * Test that worker threads see consistent elements and that deleted keys are
+ * not freed while a thread that is not a worker modifies the table
+ */
+static int test2()
+{
+    pthread_t threads[TEST_READERS];
+    int ids[TEST_READERS];
+
+    fprintf(stderr, "testlfhash : concurrent readers. ");
+    shared_table = lfhash_alloc(16, int_hash, int_cmp);
+    lfhash_memory_fns(shared_table, int_copy, NULL, int_free, NULL);
+
+    for (int i = 0; i < TEST_READERS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, test_reader, &ids[i]);
+    }
+
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < TEST_KEYS; i++)
+        {
+            ss_info_dassert(lfhash_add(shared_table, &i, &shared_values[i]) == 1, "Adding must succeed");
+        }
+
+        for (int i = 0; i < TEST_KEYS; i++)
+        {
+            ss_info_dassert(lfhash_delete(shared_table, &i) == 1, "Deleting must succeed");
+        }
+    }
+
+    atomic_store_int32(&stop_readers, 1);
+
+    for (int i = 0; i < TEST_READERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    ss_info_dassert(lfhash_size(shared_table) == 0, "Table must be empty");
+    lfhash_free(shared_table);
+    mxs_epoch_synchronize();
+    ss_info_dassert(mxs_epoch_pending() == 0, "All deleted keys must be freed");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
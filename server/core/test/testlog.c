@@ -271,6 +271,21 @@ int main(int argc, char* argv[])
                     (int)3);
     ss_dassert(err == 0);
 
+    mxs_log_set_priority_enabled(LOG_INFO, true);
+    mxs_log_set_deferred_enabled(true);
+    err = MXS_INFO("14.\tFormatted by the writer: %d %5.2f %s %.*s %zu %%", 3, 1.5, "foo", 2, "barbaz", (size_t)3);
+    ss_dassert(err == 0);
+    mxs_log_set_format(MXS_LOG_FORMAT_JSON);
+    err = MXS_INFO("15.\tJSON \"%s\"", "foo");
+    ss_dassert(err == 0);
+    err = MXS_ERROR("16.\tJSON %d", 3);
+    ss_dassert(err == 0);
+    mxs_log_set_format(MXS_LOG_FORMAT_TEXT);
+    mxs_log_set_deferred_enabled(false);
+
+    mxs_log_flush_sync();
+    ss_info_dassert(mxs_log_get_dropped() == 0, "No messages should have been dropped");
+
     mxs_log_finish();
 
     fprintf(stderr, ".. done.\n");
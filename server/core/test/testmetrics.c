@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/buffer.h>
+#include <maxscale/dcb.h>
+#include <maxscale/metrics.h>
+
+static GWBUF *written;
+
+static int capture_write(DCB *dcb, GWBUF *buf)
+{
+    written = gwbuf_append(written, buf);
+    return 1;
+}
+
+/** Return the written data as a string and reset the capture */
+static char* take_output()
+{
+    size_t len = gwbuf_length(written);
+    char *rval = calloc(1, len + 1);
+    gwbuf_copy_data(written, 0, len, (uint8_t*)rval);
+    gwbuf_free(written);
+    written = NULL;
+    return rval;
+}
+
+static int check_output(DCB *dcb, const char *expected)
+{
+    mxs_metrics_write(dcb);
+    char *output = take_output();
+    int rval = 0;
+
+    if (strcmp(output, expected) != 0)
+    {
+        printf("Unexpected metrics:\n%s\nExpected:\n%s\n", output, expected);
+        rval = 1;
+    }
+
+    free(output);
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    DCB dcb;
+    int rval = 0;
+
+    memset(&dcb, 0, sizeof(dcb));
+    dcb.func.write = capture_write;
+
+    MXS_METRIC *rw = mxs_metric_create("test_sessions_total", "Sessions", MXS_METRIC_COUNTER,
+                                       "service", "RW");
+    ts_stats_t stats = ts_stats_alloc();
+    MXS_METRIC *gauge = mxs_metric_create_stats("test_connections", "Connections", MXS_METRIC_GAUGE,
+                                                NULL, NULL, stats, TS_STATS_SUM);
+    int64_t bounds[] = {10, 100};
+    MXS_METRIC *hist = mxs_metric_create_histogram("test_latency", "Latency", "service", "a\"b",
+                                                   bounds, 2);
+    /** The new member must be written with the rest of its family */
+    MXS_METRIC *ro = mxs_metric_create("test_sessions_total", "Sessions", MXS_METRIC_COUNTER,
+                                       "service", "RO");
+
+    if (!rw || !gauge || !hist || !ro)
+    {
+        printf("Failed to create the metrics.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (mxs_metric_create("test_connections", "Connections", MXS_METRIC_COUNTER, NULL, NULL))
+    {
+        printf("A family with a different type was registered.\n");
+        rval++;
+    }
+
+    mxs_metric_add(rw, 3);
+    mxs_metric_add(ro, 1);
+    ts_stats_add(stats, 7);
+    mxs_metric_observe(hist, 5);
+    mxs_metric_observe(hist, 10);
+    mxs_metric_observe(hist, 50);
+    mxs_metric_observe(hist, 500);
+
+    rval += check_output(&dcb,
+                         "# HELP test_sessions_total Sessions\n"
+                         "# TYPE test_sessions_total counter\n"
+                         "test_sessions_total{service=\"RW\"} 3\n"
+                         "test_sessions_total{service=\"RO\"} 1\n"
+                         "# HELP test_connections Connections\n"
+                         "# TYPE test_connections gauge\n"
+                         "test_connections 7\n"
+                         "# HELP test_latency Latency\n"
+                         "# TYPE test_latency histogram\n"
+                         "test_latency_bucket{service=\"a\\\"b\",le=\"10\"} 2\n"
+                         "test_latency_bucket{service=\"a\\\"b\",le=\"100\"} 3\n"
+                         "test_latency_bucket{service=\"a\\\"b\",le=\"+Inf\"} 4\n"
+                         "test_latency_sum{service=\"a\\\"b\"} 565\n"
+                         "test_latency_count{service=\"a\\\"b\"} 4\n");
+
+    mxs_metric_destroy(rw);
+    mxs_metric_destroy(hist);
+
+    rval += check_output(&dcb,
+                         "# HELP test_sessions_total Sessions\n"
+                         "# TYPE test_sessions_total counter\n"
+                         "test_sessions_total{service=\"RO\"} 1\n"
+                         "# HELP test_connections Connections\n"
+                         "# TYPE test_connections gauge\n"
+                         "test_connections 7\n");
+
+    return rval == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -36,6 +36,7 @@
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/buffer.h>
+#include <maxscale/utils.h>
 
 /**
  * test1    Allocate a service and do lots of other things
@@ -628,10 +629,97 @@ void test_bypass_whitespace()
     ss_info_dassert(*sql == 'S', "9");
 }
 
+/**
+ * Canonicalize a statement the way modutil_get_canonical() used to, with
+ * the regular expression based functions of utils.c.
+ */
+char* get_canonical_with_regex(const char* sql)
+{
+    size_t srcsize = strlen(sql);
+    char *src = (char*)sql;
+    size_t destsize = 0;
+    char *dest = NULL;
+    char *querystr = NULL;
+
+    if (replace_quoted((const char**)&src, &srcsize, &dest, &destsize))
+    {
+        src = dest;
+        srcsize = destsize;
+        dest = NULL;
+        destsize = 0;
+
+        if (remove_mysql_comments((const char**)&src, &srcsize, &dest, &destsize))
+        {
+            if (replace_values((const char**)&dest, &destsize, &src, &srcsize))
+            {
+                querystr = squeeze_whitespace(src);
+                MXS_FREE(dest);
+            }
+            else
+            {
+                MXS_FREE(src);
+                MXS_FREE(dest);
+            }
+        }
+        else
+        {
+            MXS_FREE(src);
+        }
+    }
+
+    return querystr;
+}
+
+void test_canonical()
+{
+    const char* statements[] =
+    {
+        "select  md5(\"200000foo\") =10, sleep(2), rand(100);",
+        " select * from my1 where md5(  \"110\"      ) =10;",
+        "select * from tst where lname like '%e%' order by fname;",
+        "insert into tst values (\"John\",\"Doe\"),(\"Plato\",null),(\"Nietzsche\",\"\");",
+        "select count(1),   count(10),   count(100),      count(2),  count  (20),count(  200  ) from  tst  ;",
+        "select count(*) from t1 where x < -16;",
+        "select truncate(99999999999999999999999999999999999999,-31);",
+        "SELECT user(),current_user(),@@proxy_user;",
+        "select UpdateXML(@xml, '/a/@aa1', '');",
+        "ALTER DEFINER=root@localhost EVENT e1 ON SCHEDULE EVERY 1 HOUR;",
+        "ALTER DATABASE `#mysql50#../..` UPGRADE DATA DIRECTORY NAME; # a comment",
+        "ALTER TABLE t1 ADD PARTITION IF NOT EXISTS(PARTITION `p5` VALUES LESS THAN (2010)COMMENT 'APSTART \\' APEND');",
+        "SELECT * FROM t WHERE a LIKE 'ha\\%an' ESCAPE '\\\\'",
+        "select 1;-- comment after statement",
+        "select /* inline comment */ 1;",
+        "select /*!300000 1 + */ 1;",
+        "SELECT 2 /*M!50101 +1 */;",
+        "SELECT 'it''s', 1-2, 3e5, 0x1F, a-1, t1.c2 FROM t1\nWHERE b = 4 /* multiple\nlines */ AND c = .5",
+        "SELECT 'unterminated",
+    };
+
+    ss_dfprintf(stderr, "testmodutil : Canonical forms of statements.");
+
+    for (size_t i = 0; i < sizeof(statements) / sizeof(statements[0]); i++)
+    {
+        GWBUF* buffer = modutil_create_query(statements[i]);
+        char* canonical = modutil_get_canonical(buffer);
+        char* expected = get_canonical_with_regex(statements[i]);
+
+        ss_info_dassert(canonical && expected && strcmp(canonical, expected) == 0,
+                        "Canonical form should be the same as with regular expressions");
+
+        MXS_FREE(canonical);
+        MXS_FREE(expected);
+        gwbuf_free(buffer);
+    }
+
+    ss_dfprintf(stderr, "\t..done\n");
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
+    utils_init();
+
     result += test1();
     result += test2();
     test_single_sql_packet1();
@@ -642,5 +730,6 @@ int main(int argc, char **argv)
     test_strnchr_esc_mysql();
     test_large_packets();
     test_bypass_whitespace();
+    test_canonical();
     exit(result);
 }
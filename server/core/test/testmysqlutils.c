@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/protocol/mysql.h>
+
+/** An OK packet that reports last_gtid=0-1-42 and autocommit=ON */
+static const uint8_t ok_with_variables[] =
+{
+    0x2c, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x02, 0x40, 0x00, 0x00,
+    0x00,
+    0x23,
+    0x00, 0x11, 0x09, 'l', 'a', 's', 't', '_', 'g', 't', 'i', 'd', 0x06, '0', '-', '1', '-', '4', '2',
+    0x00, 0x0e, 0x0a, 'a', 'u', 't', 'o', 'c', 'o', 'm', 'm', 'i', 't', 0x02, 'O', 'N'
+};
+
+/** An OK packet that reports a GTID with session_track_gtids */
+static const uint8_t ok_with_gtid[] =
+{
+    0x18, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x02, 0x40, 0x00, 0x00,
+    0x00,
+    0x0f,
+    0x03, 0x0d, 0x00, 0x0b, '1', '-', '2', '-', '3', ',', '4', '-', '5', '-', '6'
+};
+
+/** An OK packet without session state changes */
+static const uint8_t ok_plain[] =
+{
+    0x07, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00
+};
+
+static int test_variable(const uint8_t* packet, size_t len, const char* name, const char* expected)
+{
+    int rv = 0;
+    char* value = mxs_mysql_get_tracked_variable(packet, len, name);
+
+    if ((value == NULL) != (expected == NULL) || (value && strcmp(value, expected) != 0))
+    {
+        printf("Variable %s: expected %s, got %s.\n", name,
+               expected ? expected : "NULL", value ? value : "NULL");
+        rv = 1;
+    }
+
+    MXS_FREE(value);
+
+    return rv;
+}
+
+int main(int argc, char* argv[])
+{
+    int rv = 0;
+
+    rv += test_variable(ok_with_variables, sizeof(ok_with_variables), "last_gtid", "0-1-42");
+    rv += test_variable(ok_with_variables, sizeof(ok_with_variables), "autocommit", "ON");
+    rv += test_variable(ok_with_variables, sizeof(ok_with_variables), "gtid", NULL);
+    rv += test_variable(ok_with_gtid, sizeof(ok_with_gtid), "gtid", "1-2-3,4-5-6");
+    rv += test_variable(ok_with_gtid, sizeof(ok_with_gtid), "last_gtid", NULL);
+    rv += test_variable(ok_plain, sizeof(ok_plain), "last_gtid", NULL);
+
+    /** Truncated packets must not be read past their end */
+    for (size_t i = 0; i < sizeof(ok_with_variables); i++)
+    {
+        char* value = mxs_mysql_get_tracked_variable(ok_with_variables, i, "autocommit");
+
+        if (value)
+        {
+            printf("A packet truncated to %lu bytes has a value.\n", (unsigned long)i);
+            MXS_FREE(value);
+            rv += 1;
+        }
+    }
+
+    return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
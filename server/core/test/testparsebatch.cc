@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <iostream>
+#include <string>
+#include "../maxscale/query_classifier.h"
+#include <maxscale/alloc.h>
+#include <maxscale/paths.h>
+#include <maxscale/protocol/mysql.h>
+
+using namespace std;
+
+namespace
+{
+
+struct TEST_CASE
+{
+    const char* zStmt;  // The statements of a COM_QUERY.
+    size_t      n_stmts;// The expected number of statements.
+};
+
+const TEST_CASE TEST_CASES[] =
+{
+    { "SELECT 1", 1 },
+    { "SELECT 1;", 1 },
+    { "SELECT 1; /* comment */", 1 },
+    { "SELECT 1; # comment", 1 },
+    { "SELECT 'a;b' FROM t", 1 },
+    { "BEGIN; SELECT 1; COMMIT", 3 },
+    { "SELECT a FROM t; INSERT INTO t VALUES (1);", 2 },
+    { "SET autocommit=0; SELECT 1", 2 },
+    { "SELECT 1;;; SELECT 2", 2 },
+    { "SELECT 1; /*!40000 SELECT 2 */", 2 },
+};
+
+GWBUF* create_gwbuf(const char* zStmt)
+{
+    size_t len = strlen(zStmt);
+    size_t payload_len = len + 1;
+    size_t gwbuf_len = MYSQL_HEADER_LEN + payload_len;
+
+    GWBUF* pBuf = gwbuf_alloc(gwbuf_len);
+
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf))) = payload_len;
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 1)) = (payload_len >> 8);
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 2)) = (payload_len >> 16);
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 3)) = 0x00;
+    *((unsigned char*)((char*)GWBUF_DATA(pBuf) + 4)) = 0x03;
+    memcpy((char*)GWBUF_DATA(pBuf) + 5, zStmt, len);
+
+    return pBuf;
+}
+
+/**
+ * Check that the statements of a query are counted right and that each
+ * of them gets the type mask it gets as a query of its own.
+ */
+int test_single(const TEST_CASE& tc)
+{
+    int rc = EXIT_SUCCESS;
+
+    GWBUF* pStmt = create_gwbuf(tc.zStmt);
+    uint32_t* pType_masks;
+    size_t n_stmts;
+
+    uint32_t type_mask = qc_parse_batch(pStmt, &pType_masks, &n_stmts);
+
+    if (n_stmts != tc.n_stmts)
+    {
+        cout << tc.zStmt << ": expected " << tc.n_stmts << " statements, got " << n_stmts << endl;
+        rc = EXIT_FAILURE;
+    }
+    else
+    {
+        uint32_t type_mask_union = 0;
+
+        for (size_t i = 0; i < n_stmts; ++i)
+        {
+            type_mask_union |= pType_masks[i];
+        }
+
+        if (type_mask_union != type_mask)
+        {
+            cout << tc.zStmt << ": the union of the type masks is wrong." << endl;
+            rc = EXIT_FAILURE;
+        }
+
+        if (n_stmts == 1 && pType_masks[0] != qc_get_type_mask(pStmt))
+        {
+            cout << tc.zStmt << ": the type mask differs from that of qc_get_type_mask()." << endl;
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    MXS_FREE(pType_masks);
+    gwbuf_free(pStmt);
+
+    return rc;
+}
+
+/**
+ * Check that the statements of a chain of packets are all classified.
+ */
+int test_chain()
+{
+    int rc = EXIT_SUCCESS;
+
+    GWBUF* pChain = NULL;
+    size_t n_expected = 0;
+
+    for (size_t i = 0; i < sizeof(TEST_CASES) / sizeof(TEST_CASES[0]); ++i)
+    {
+        pChain = gwbuf_append(pChain, create_gwbuf(TEST_CASES[i].zStmt));
+        n_expected += TEST_CASES[i].n_stmts;
+    }
+
+    size_t n_stmts;
+    qc_parse_batch(pChain, NULL, &n_stmts);
+
+    if (n_stmts != n_expected)
+    {
+        cout << "Chain: expected " << n_expected << " statements, got " << n_stmts << endl;
+        rc = EXIT_FAILURE;
+    }
+
+    gwbuf_free(pChain);
+
+    return rc;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rc = EXIT_FAILURE;
+
+    set_datadir(strdup("/tmp"));
+    set_langdir(strdup("."));
+    set_process_datadir(strdup("/tmp"));
+
+    if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+    {
+        if (qc_setup("qc_sqlite", NULL) && qc_process_init(QC_INIT_BOTH))
+        {
+            rc = EXIT_SUCCESS;
+
+            for (size_t i = 0; i < sizeof(TEST_CASES) / sizeof(TEST_CASES[0]); ++i)
+            {
+                if (test_single(TEST_CASES[i]) == EXIT_FAILURE)
+                {
+                    rc = EXIT_FAILURE;
+                }
+            }
+
+            if (test_chain() == EXIT_FAILURE)
+            {
+                rc = EXIT_FAILURE;
+            }
+
+            qc_process_end(QC_INIT_BOTH);
+        }
+        else
+        {
+            cerr << "error: Could not initialize qc_sqlite." << endl;
+        }
+
+        mxs_log_finish();
+    }
+    else
+    {
+        cerr << "error: Could not initialize log." << endl;
+    }
+
+    return rc;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/debug.h>
+
+#include "../maxscale/persistpool.h"
+
+#define N_DCBS 200
+
+static DCB dcbs[N_DCBS];
+static char users[N_DCBS][20];
+static char keys[N_DCBS][20];
+
+/** Connection i belongs to user i % 10, the even ones have the key i */
+static void init_dcbs()
+{
+    memset(dcbs, 0, sizeof(dcbs));
+
+    for (int i = 0; i < N_DCBS; i++)
+    {
+        sprintf(users[i], "user%d", i % 10);
+        sprintf(keys[i], "key%d", i);
+        dcbs[i].user = users[i];
+        dcbs[i].protoname = "MySQLBackend";
+        dcbs[i].persistkey = i % 2 == 0 ? keys[i] : NULL;
+    }
+}
+
+static bool match_user3(DCB *dcb, void *data)
+{
+    (*(int*)data)++;
+    return strcmp(dcb->user, "user3") == 0;
+}
+
+static bool match_all(DCB *dcb, void *data)
+{
+    return true;
+}
+
+/**
+ * Test taking connections by user and by key
+ */
+static int test1()
+{
+    PERSIST_POOL *pools = persistpool_alloc(1);
+    PERSIST_POOL *pool = &pools[0];
+
+    fprintf(stderr, "testpersistpool : take connections by user and key. ");
+    init_dcbs();
+
+    for (int i = 0; i < N_DCBS; i++)
+    {
+        ss_info_dassert(persistpool_add(pool, &dcbs[i]), "Adding must succeed");
+    }
+
+    ss_info_dassert(persistpool_count(pool) == N_DCBS, "All connections must be in the pool");
+
+    DCB *dcb = persistpool_take(pool, "user4", "MySQLBackend", "key44");
+    ss_info_dassert(dcb == &dcbs[44], "The connection with the key must be taken");
+    dcb = persistpool_take(pool, "user4", "MySQLBackend", "key44");
+    ss_info_dassert(dcb == &dcbs[194], "The latest connection of the user must be taken");
+    dcb = persistpool_take(pool, "user4", "MySQLBackend", NULL);
+    ss_info_dassert(dcb == &dcbs[184], "A key must not be required");
+    dcb = persistpool_take(pool, "user4", "MySQLClient", NULL);
+    ss_info_dassert(dcb == NULL, "The protocol must match");
+    dcb = persistpool_take(pool, "nobody", "MySQLBackend", "key44");
+    ss_info_dassert(dcb == NULL, "The user must match");
+    ss_info_dassert(persistpool_count(pool) == N_DCBS - 3, "Taken connections must leave the pool");
+
+    /** A removed connection is not taken again */
+    persistpool_remove(&dcbs[174]);
+    persistpool_remove(&dcbs[174]);
+    dcb = persistpool_take(pool, "user4", "MySQLBackend", "key174");
+    ss_info_dassert(dcb == &dcbs[164], "A removed connection must not be taken");
+    ss_info_dassert(persistpool_count(pool) == N_DCBS - 5, "Removed connections must leave the pool");
+
+    /** Returning a connection puts it first in line again */
+    ss_info_dassert(persistpool_add(pool, &dcbs[44]), "Adding must succeed");
+    dcb = persistpool_take(pool, "user4", "MySQLBackend", NULL);
+    ss_info_dassert(dcb == &dcbs[44], "The returned connection must be taken first");
+
+    while ((dcb = persistpool_take(pool, "user4", "MySQLBackend", NULL)))
+    {
+        ss_info_dassert(strcmp(dcb->user, "user4") == 0, "Only the connections of the user must be taken");
+    }
+
+    ss_info_dassert(persistpool_count(pool) == N_DCBS - N_DCBS / 10, "The other users must be left");
+
+    dcb = persistpool_extract(pool, match_all, NULL);
+    persistpool_free(pools, 1);
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * Test removing connections that match a condition
+ */
+static int test2()
+{
+    PERSIST_POOL *pools = persistpool_alloc(1);
+    PERSIST_POOL *pool = &pools[0];
+    int n_checked = 0;
+
+    fprintf(stderr, "testpersistpool : extract connections from the pool. ");
+    init_dcbs();
+
+    for (int i = 0; i < N_DCBS; i++)
+    {
+        persistpool_add(pool, &dcbs[i]);
+    }
+
+    int n_extracted = 0;
+
+    for (DCB *dcb = persistpool_extract(pool, match_user3, &n_checked); dcb; dcb = dcb->pool_links[0].next)
+    {
+        ss_info_dassert(strcmp(dcb->user, "user3") == 0, "Only the matching connections must be extracted");
+        n_extracted++;
+    }
+
+    ss_info_dassert(n_checked == N_DCBS, "Every connection must be checked once");
+    ss_info_dassert(n_extracted == N_DCBS / 10, "All matching connections must be extracted");
+    ss_info_dassert(persistpool_count(pool) == N_DCBS - N_DCBS / 10, "The rest must be left");
+    ss_info_dassert(persistpool_take(pool, "user3", "MySQLBackend", "key3") == NULL,
+                    "Extracted connections must not be taken");
+
+    int n_all = 0;
+
+    for (DCB *dcb = persistpool_extract(pool, match_all, NULL); dcb; dcb = dcb->pool_links[0].next)
+    {
+        n_all++;
+    }
+
+    ss_info_dassert(n_all == N_DCBS - N_DCBS / 10, "The rest must be extracted");
+    ss_info_dassert(persistpool_count(pool) == 0, "The pool must be empty");
+    ss_info_dassert(pool->n_entries == 0, "The lists of an empty pool must be freed");
+    persistpool_free(pools, 1);
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
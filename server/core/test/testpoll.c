@@ -104,11 +104,53 @@ test1()
 
 }
 
+/**
+ * test2    Change the number of active threads
+ */
+static int
+test2()
+{
+    ss_dfprintf(stderr, "testpoll : Change the number of active threads.");
+
+    if (poll_get_active_threads() != 1)
+    {
+        ss_dfprintf(stderr, "\nError: %d threads are active at start.\n", poll_get_active_threads());
+        return 1;
+    }
+
+    if (poll_set_active_threads(0) || poll_set_active_threads(config_threadcount() + 1))
+    {
+        ss_dfprintf(stderr, "\nError: an invalid number of active threads was accepted.\n");
+        return 1;
+    }
+
+    if (!poll_set_active_threads(config_threadcount()) ||
+        poll_get_active_threads() != config_threadcount())
+    {
+        ss_dfprintf(stderr, "\nError: failed to activate all threads.\n");
+        return 1;
+    }
+
+    if (!poll_set_active_threads(1) || poll_get_active_threads() != 1)
+    {
+        ss_dfprintf(stderr, "\nError: failed to retire the threads.\n");
+        return 1;
+    }
+
+    ss_dfprintf(stderr, "\t..done\n");
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
+    /** One thread is active and two can be activated */
+    config_get_global_options()->n_threads_max = 3;
+
     result += test1();
+    result += test2();
 
     exit(result);
 }
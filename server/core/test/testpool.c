@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/debug.h>
+
+#include "../maxscale/pool.h"
+
+#define TEST_MAX_FREE 4
+
+typedef struct
+{
+    char    name[40];
+    int64_t value;
+} TEST_OBJECT;
+
+static MXS_POOL test_pool = MXS_POOL_INIT("Test", sizeof(TEST_OBJECT), TEST_MAX_FREE);
+
+/**
+ * Test that threads without a free list use the allocator directly
+ */
+static int test1()
+{
+    fprintf(stderr, "testpool : allocation outside worker threads. ");
+
+    TEST_OBJECT *obj = (TEST_OBJECT*)mxs_pool_calloc(&test_pool);
+    ss_info_dassert(obj, "Allocation must succeed");
+    ss_info_dassert(obj->value == 0 && obj->name[0] == '\0', "Object must be zeroed");
+    ss_info_dassert(((uintptr_t)obj & 15) == 0, "Object must be aligned");
+    strcpy(obj->name, "test1");
+    mxs_pool_free(obj);
+    mxs_pool_free(NULL);
+
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_FREE) == 0, "Nothing must be kept");
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_HITS) == 0, "No hits expected");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * Test that the objects are recycled and that the free list is bounded
+ */
+static int test2()
+{
+    TEST_OBJECT *objs[TEST_MAX_FREE * 2];
+
+    fprintf(stderr, "testpool : objects are recycled. ");
+    mxs_pool_thread_init(0);
+
+    TEST_OBJECT *first = (TEST_OBJECT*)mxs_pool_alloc(&test_pool);
+    mxs_pool_free(first);
+    TEST_OBJECT *second = (TEST_OBJECT*)mxs_pool_calloc(&test_pool);
+    ss_info_dassert(first == second, "Freed object must be reused");
+    ss_info_dassert(second->value == 0, "Recycled object must be zeroed");
+    mxs_pool_free(second);
+
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_HITS) == 1, "One hit expected");
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_MISSES) == 1, "One miss expected");
+
+    for (int i = 0; i < TEST_MAX_FREE * 2; i++)
+    {
+        objs[i] = (TEST_OBJECT*)mxs_pool_alloc(&test_pool);
+        ss_info_dassert(objs[i], "Allocation must succeed");
+        objs[i]->value = i;
+    }
+
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_FREE) == 0, "Free list must be empty");
+
+    for (int i = 0; i < TEST_MAX_FREE * 2; i++)
+    {
+        ss_info_dassert(objs[i]->value == i, "Objects must not overlap");
+        mxs_pool_free(objs[i]);
+    }
+
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_FREE) == TEST_MAX_FREE,
+                    "Free list must be bounded");
+    ss_info_dassert(mxs_pool_get_total_stat(MXS_POOL_STAT_FREE) == TEST_MAX_FREE,
+                    "Pool must be registered");
+
+    mxs_pool_thread_finish();
+    ss_info_dassert(mxs_pool_get_stat(&test_pool, MXS_POOL_STAT_FREE) == 0,
+                    "Free list must be released");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    exit(result);
+}
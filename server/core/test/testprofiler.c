@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <maxscale/buffer.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/resultset.h>
+#include <maxscale/session.h>
+#include "../maxscale/profiler.h"
+
+static GWBUF *written;
+static MXS_DOWNSTREAM router;
+static int replies;
+
+static int capture_write(DCB *dcb, GWBUF *buf)
+{
+    written = gwbuf_append(written, buf);
+    return 1;
+}
+
+/** The router sleeps, the time must not be blamed on the filter */
+static int32_t router_route_query(void *instance, void *session, GWBUF *request)
+{
+    usleep(20000);
+    return 1;
+}
+
+static int32_t filter_route_query(void *instance, void *session, GWBUF *request)
+{
+    return router.routeQuery(router.instance, router.session, request);
+}
+
+static int32_t protocol_reply(void *instance, void *session, GWBUF *response)
+{
+    replies++;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    MXS_CONFIG *cnf = config_get_global_options();
+    MXS_SESSION session;
+    DCB dcb;
+    int rval = 0;
+
+    mxs_log_init(NULL, "/tmp", MXS_LOG_TARGET_FS);
+    memset(&session, 0, sizeof(session));
+    memset(&dcb, 0, sizeof(dcb));
+    dcb.func.write = capture_write;
+    session.ses_id = 1;
+
+    cnf->profile_callbacks = true;
+    cnf->slow_callback_threshold = 10;
+    profiler_init(1);
+    profiler_thread_init(0);
+
+    MXS_DOWNSTREAM head = {NULL, NULL, filter_route_query};
+    MXS_UPSTREAM tail = {NULL, NULL, protocol_reply, NULL};
+    router.routeQuery = router_route_query;
+
+    if (!profiler_wrap_downstream(&session, &router, "router") ||
+        !profiler_wrap_downstream(&session, &head, "filter") ||
+        !profiler_wrap_upstream(&session, &tail, "protocol") ||
+        !profiler_wrap_upstream(&session, &tail, "protocol"))
+    {
+        printf("Failed to wrap the filter chain.\n");
+        return EXIT_FAILURE;
+    }
+
+    profiler_enter(PROFILE_READ, "client", session.ses_id);
+    head.routeQuery(head.instance, head.session, NULL);
+    tail.clientReply(tail.instance, tail.session, NULL);
+    profiler_leave();
+
+    if (replies != 1)
+    {
+        printf("The reply went through %d times.\n", replies);
+        rval++;
+    }
+
+    RESULTSET *set = profilerGetList();
+    resultset_stream_json(set, &dcb);
+    resultset_free(set);
+
+    size_t len = gwbuf_length(written);
+    char output[len + 1];
+    gwbuf_copy_data(written, 0, len, (uint8_t*)output);
+    output[len] = '\0';
+    gwbuf_free(written);
+
+    /** The router took the most time and it was the only slow callback itself */
+    const char expected[] = "[ { \"Module\" : \"router\", \"Callback\" : \"routeQuery\", \"Calls\" : 1, ";
+
+    if (strncmp(output, expected, sizeof(expected) - 1) != 0)
+    {
+        printf("Unexpected callbacks:\n%s\n", output);
+        rval++;
+    }
+
+    if (strstr(output, "\"protocol\", \"Callback\" : \"clientReply\", \"Calls\" : 1,") == NULL)
+    {
+        printf("The reply was not profiled exactly once:\n%s\n", output);
+        rval++;
+    }
+
+    profiler_session_free(&session);
+
+    if (session.profile_hops)
+    {
+        printf("The profiling elements were not freed.\n");
+        rval++;
+    }
+
+    mxs_log_finish();
+    return rval == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
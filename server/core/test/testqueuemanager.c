@@ -37,9 +37,12 @@ extern int debug_check_fail;
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+#include <maxscale/atomic.h>
 #include <maxscale/random_jkiss.h>
 #include <maxscale/hk_heartbeat.h>
 #include <maxscale/alloc.h>
+#include <maxscale/debug.h>
 
 #include "../maxscale/queuemanager.h"
 #include "test_utils.h"
@@ -228,7 +231,7 @@ thread_test(void *arg)
 static int
 test2()
 {
-    pthread_t   tid[NUMBER_OF_THREADS - 1];
+    pthread_t   tid[NUMBER_OF_THREADS];
     int err, i, limit;
 
     thread_queue = mxs_queue_alloc(TEST_QUEUE_SIZE, HEARTBEATS_TO_EXPIRE);
@@ -248,12 +251,105 @@ test2()
     return debug_check_fail ? 1 : 0;
 }
 
+#define ORDER_TEST_COUNT 20000
+
+static int order_consumed[NUMBER_OF_THREADS];
+static int order_errors = 0;
+
+static void *
+order_producer(void *arg)
+{
+    intptr_t id = (intptr_t)arg;
+
+    for (intptr_t i = 0; i < ORDER_TEST_COUNT; i++)
+    {
+        /** The producer is in the low bits, the sequence number in the high bits */
+        while (!mxs_enqueue(thread_queue, (void *)((i << 8) | id)))
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void *
+order_consumer(void *arg)
+{
+    intptr_t last[NUMBER_OF_THREADS];
+    QUEUE_ENTRY entry;
+
+    for (int i = 0; i < NUMBER_OF_THREADS; i++)
+    {
+        last[i] = -1;
+    }
+
+    while (atomic_add(&order_consumed[0], 0) < NUMBER_OF_THREADS * ORDER_TEST_COUNT)
+    {
+        if (mxs_dequeue(thread_queue, &entry))
+        {
+            intptr_t value = (intptr_t)entry.queued_object;
+            intptr_t producer = value & 0xff;
+
+            /** The entries of one producer must come out in the order they went in */
+            if ((value >> 8) <= last[producer])
+            {
+                atomic_add(&order_errors, 1);
+            }
+
+            last[producer] = value >> 8;
+            atomic_add(&order_consumed[0], 1);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * test3    Check that concurrent producers and consumers lose no entries and
+ *          that the entries of each producer stay in FIFO order
+ */
+static int
+test3()
+{
+    pthread_t producers[NUMBER_OF_THREADS];
+    pthread_t consumers[NUMBER_OF_THREADS];
+
+    thread_queue = mxs_queue_alloc(TEST_QUEUE_SIZE, HEARTBEATS_TO_EXPIRE);
+
+    for (intptr_t i = 0; i < NUMBER_OF_THREADS; i++)
+    {
+        ss_info_dassert(pthread_create(&producers[i], NULL, order_producer, (void *)i) == 0,
+                        "Must create threads successfully");
+        ss_info_dassert(pthread_create(&consumers[i], NULL, order_consumer, NULL) == 0,
+                        "Must create threads successfully");
+    }
+
+    for (int i = 0; i < NUMBER_OF_THREADS; i++)
+    {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+
+    QUEUE_ENTRY entry;
+    ss_info_dassert(!mxs_dequeue(thread_queue, &entry), "Queue must be empty");
+    ss_dfprintf(stderr, "\nConsumed %d entries with %d ordering errors.\n",
+                order_consumed[0], order_errors);
+    mxs_queue_free(thread_queue);
+    return order_errors || order_consumed[0] != NUMBER_OF_THREADS * ORDER_TEST_COUNT ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
     result += (test1() ? 1 : 0);
     result += (test2() ? 1 : 0);
+    result += (test3() ? 1 : 0);
 
     exit(result);
 }
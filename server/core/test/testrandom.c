@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <maxscale/random_jkiss.h>
+
+#define N_BUCKETS 10
+#define N_DRAWS   100000
+#define N_THREADS 4
+
+static void *draw_first(void *data)
+{
+    *(unsigned int*)data = random_jkiss_thread();
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int counts[N_BUCKETS] = {0};
+    int rval = 0;
+
+    for (int i = 0; i < N_DRAWS; i++)
+    {
+        unsigned int r = random_jkiss_range(N_BUCKETS);
+
+        if (r >= N_BUCKETS)
+        {
+            fprintf(stderr, "Number %u is out of range\n", r);
+            return 1;
+        }
+
+        counts[r]++;
+    }
+
+    /** Each bucket should get close to a tenth of the draws */
+    for (int i = 0; i < N_BUCKETS; i++)
+    {
+        if (counts[i] < N_DRAWS / N_BUCKETS * 9 / 10 || counts[i] > N_DRAWS / N_BUCKETS * 11 / 10)
+        {
+            fprintf(stderr, "Bucket %d got %d draws of %d\n", i, counts[i], N_DRAWS);
+            rval++;
+        }
+    }
+
+    if (random_jkiss_range(1) != 0)
+    {
+        fprintf(stderr, "A range of one gave a number other than zero\n");
+        rval++;
+    }
+
+    /** The threads are seeded separately */
+    pthread_t threads[N_THREADS];
+    unsigned int first[N_THREADS];
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, draw_first, &first[i]);
+    }
+
+    for (int i = 0; i < N_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 1; i < N_THREADS; i++)
+    {
+        if (first[i] == first[0])
+        {
+            fprintf(stderr, "Threads 0 and %d got the same number\n", i);
+            rval++;
+        }
+    }
+
+    return rval;
+}
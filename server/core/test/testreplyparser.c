@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/replyparser.h>
+
+#define SERVER_MORE_RESULTS 0x0008
+
+typedef struct reply_counter
+{
+    int n_ok;
+    int n_err;
+    int n_columns;
+    int n_fields;
+    int n_rows;
+    int n_end;
+    int n_more;
+    int stop_at_row; // Stop the parser at this row, -1 for never
+} REPLY_COUNTER;
+
+static bool count_ok(void *data, const uint8_t *packet, size_t len)
+{
+    ((REPLY_COUNTER*)data)->n_ok++;
+    return true;
+}
+
+static bool count_err(void *data, const uint8_t *packet, size_t len)
+{
+    ((REPLY_COUNTER*)data)->n_err++;
+    return true;
+}
+
+static bool count_columns(void *data, uint64_t n_columns)
+{
+    ((REPLY_COUNTER*)data)->n_columns += n_columns;
+    return true;
+}
+
+static bool count_field(void *data, const uint8_t *packet, size_t len, uint64_t index)
+{
+    ((REPLY_COUNTER*)data)->n_fields++;
+    return true;
+}
+
+static bool count_row(void *data, const uint8_t *packet, size_t len, uint64_t index)
+{
+    REPLY_COUNTER *counter = (REPLY_COUNTER*)data;
+    counter->n_rows++;
+    return counter->stop_at_row != (int)index;
+}
+
+static bool count_end(void *data, const uint8_t *packet, size_t len, bool more_results)
+{
+    REPLY_COUNTER *counter = (REPLY_COUNTER*)data;
+    counter->n_end++;
+    counter->n_more += more_results;
+    return true;
+}
+
+static const MXS_REPLY_CB counter_cb =
+{
+    count_ok, count_err, NULL, count_columns, count_field, count_row, count_end
+};
+
+/** A reply under construction */
+typedef struct reply
+{
+    uint8_t data[1024];
+    size_t  len;
+    uint8_t seq;
+} REPLY;
+
+static void add_packet(REPLY *reply, const uint8_t *payload, size_t len)
+{
+    uint8_t *ptr = reply->data + reply->len;
+    ptr[0] = len;
+    ptr[1] = len >> 8;
+    ptr[2] = len >> 16;
+    ptr[3] = reply->seq++;
+    memcpy(ptr + 4, payload, len);
+    reply->len += len + 4;
+}
+
+static void add_ok(REPLY *reply, uint16_t status)
+{
+    uint8_t ok[] = { 0x00, 0x01, 0x00, status & 0xff, status >> 8, 0x00, 0x00 };
+    add_packet(reply, ok, sizeof(ok));
+}
+
+static void add_eof(REPLY *reply, uint16_t status)
+{
+    uint8_t eof[] = { 0xfe, 0x00, 0x00, status & 0xff, status >> 8 };
+    add_packet(reply, eof, sizeof(eof));
+}
+
+/** A result set with two columns and the given number of rows */
+static void add_result(REPLY *reply, int n_rows, bool deprecate_eof, uint16_t status)
+{
+    uint8_t count = 2;
+    uint8_t field[] = { 3, 'd', 'e', 'f', 0, 0, 0, 1, 'a', 0, 0x0c };
+    uint8_t row[] = { 1, 'x', 2, 'y', 'z' };
+
+    add_packet(reply, &count, 1);
+    add_packet(reply, field, sizeof(field));
+    add_packet(reply, field, sizeof(field));
+
+    if (!deprecate_eof)
+    {
+        add_eof(reply, 0);
+    }
+
+    for (int i = 0; i < n_rows; i++)
+    {
+        add_packet(reply, row, sizeof(row));
+    }
+
+    if (deprecate_eof)
+    {
+        uint8_t end[] = { 0xfe, 0x00, 0x00, status & 0xff, status >> 8, 0x00, 0x00 };
+        add_packet(reply, end, sizeof(end));
+    }
+    else
+    {
+        add_eof(reply, status);
+    }
+}
+
+/** Split the reply into a chain of buffers of the given size */
+static GWBUF* make_chain(const REPLY *reply, size_t len, size_t chunk)
+{
+    GWBUF *head = NULL;
+
+    for (size_t i = 0; i < len; i += chunk)
+    {
+        size_t n = len - i < chunk ? len - i : chunk;
+        head = gwbuf_append(head, gwbuf_alloc_and_load(n, reply->data + i));
+    }
+
+    return head;
+}
+
+static int check(const char *name, const REPLY_COUNTER *c, int ok, int err,
+                 int fields, int rows, int end, int more)
+{
+    if (c->n_ok != ok || c->n_err != err || c->n_fields != fields || c->n_columns != fields ||
+        c->n_rows != rows || c->n_end != end || c->n_more != more)
+    {
+        printf("%s: got ok=%d err=%d fields=%d columns=%d rows=%d end=%d more=%d\n", name,
+               c->n_ok, c->n_err, c->n_fields, c->n_columns, c->n_rows, c->n_end, c->n_more);
+        return 1;
+    }
+
+    return 0;
+}
+
+/** Parse a reply given in chunks of the given size, the data arrives piece by piece */
+static int test_incremental(const char *name, const REPLY *reply, bool deprecate_eof, size_t chunk,
+                            int ok, int err, int fields, int rows, int end, int more)
+{
+    int rv = 0;
+    REPLY_COUNTER counter = { 0 };
+    counter.stop_at_row = -1;
+    MXS_REPLY_PARSER parser;
+    mxs_reply_parser_init(&parser, &counter_cb, &counter, deprecate_eof);
+
+    size_t offset = 0;
+    mxs_reply_state_t state = MXS_REPLY_EXPECTING_RESPONSE;
+
+    for (size_t received = chunk; state != MXS_REPLY_DONE && state != MXS_REPLY_ERROR; received += chunk)
+    {
+        size_t len = received < reply->len ? received : reply->len;
+        GWBUF *buffer = make_chain(reply, len, chunk);
+        state = mxs_reply_parser_process(&parser, buffer, &offset);
+        gwbuf_free(buffer);
+
+        if (offset > len)
+        {
+            printf("%s: offset %lu is past the data %lu\n", name, offset, len);
+            rv++;
+            break;
+        }
+
+        if (len == reply->len)
+        {
+            break;
+        }
+    }
+
+    if (state != MXS_REPLY_DONE || offset != reply->len)
+    {
+        printf("%s (chunk %lu): parser ended in state %d at offset %lu of %lu\n",
+               name, chunk, state, offset, reply->len);
+        rv++;
+    }
+
+    rv += check(name, &counter, ok, err, fields, rows, end, more);
+    mxs_reply_parser_free(&parser);
+    return rv;
+}
+
+static int test_reply(const char *name, const REPLY *reply, bool deprecate_eof,
+                      int ok, int err, int fields, int rows, int end, int more)
+{
+    int rv = 0;
+    size_t chunks[] = { reply->len, 1, 3, 7, 16 };
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    {
+        rv += test_incremental(name, reply, deprecate_eof, chunks[i], ok, err, fields, rows, end, more);
+    }
+
+    return rv;
+}
+
+static int test_stop(void)
+{
+    int rv = 0;
+    REPLY reply = { { 0 } };
+    add_result(&reply, 5, false, 0);
+
+    REPLY_COUNTER counter = { 0 };
+    counter.stop_at_row = 1;
+    MXS_REPLY_PARSER parser;
+    mxs_reply_parser_init(&parser, &counter_cb, &counter, false);
+
+    GWBUF *buffer = make_chain(&reply, reply.len, reply.len);
+    size_t offset = 0;
+
+    if (mxs_reply_parser_process(&parser, buffer, &offset) != MXS_REPLY_EXPECTING_ROWS ||
+        counter.n_rows != 2)
+    {
+        printf("Parser did not stop at the second row.\n");
+        rv++;
+    }
+
+    if (mxs_reply_parser_process(&parser, buffer, &offset) != MXS_REPLY_DONE ||
+        counter.n_rows != 5 || offset != reply.len)
+    {
+        printf("Parser did not continue after stopping.\n");
+        rv++;
+    }
+
+    gwbuf_free(buffer);
+    mxs_reply_parser_free(&parser);
+    return rv;
+}
+
+int main(int argc, char* argv[])
+{
+    int rv = 0;
+    REPLY reply;
+
+    memset(&reply, 0, sizeof(reply));
+    add_ok(&reply, 0);
+    rv += test_reply("OK", &reply, false, 1, 0, 0, 0, 0, 0);
+
+    memset(&reply, 0, sizeof(reply));
+    uint8_t err[] = { 0xff, 0x15, 0x04, '#', '2', '8', '0', '0', '0', 'e' };
+    add_packet(&reply, err, sizeof(err));
+    rv += test_reply("ERR", &reply, false, 0, 1, 0, 0, 0, 0);
+
+    memset(&reply, 0, sizeof(reply));
+    add_result(&reply, 3, false, 0);
+    rv += test_reply("Result set", &reply, false, 0, 0, 2, 3, 1, 0);
+
+    memset(&reply, 0, sizeof(reply));
+    add_result(&reply, 0, false, 0);
+    rv += test_reply("Empty result set", &reply, false, 0, 0, 2, 0, 1, 0);
+
+    memset(&reply, 0, sizeof(reply));
+    add_result(&reply, 3, true, 0);
+    rv += test_reply("Result set with DEPRECATE_EOF", &reply, true, 0, 0, 2, 3, 1, 0);
+
+    memset(&reply, 0, sizeof(reply));
+    add_ok(&reply, SERVER_MORE_RESULTS);
+    add_result(&reply, 2, false, SERVER_MORE_RESULTS);
+    add_result(&reply, 4, false, SERVER_MORE_RESULTS);
+    add_ok(&reply, 0);
+    rv += test_reply("Multi-result", &reply, false, 2, 0, 4, 6, 2, 2);
+
+    memset(&reply, 0, sizeof(reply));
+    add_result(&reply, 1, true, SERVER_MORE_RESULTS);
+    add_result(&reply, 1, true, 0);
+    rv += test_reply("Multi-result with DEPRECATE_EOF", &reply, true, 0, 0, 4, 2, 2, 1);
+
+    memset(&reply, 0, sizeof(reply));
+    add_result(&reply, 2, false, 0);
+    reply.len -= 9; // Replace the final EOF with an ERR
+    reply.seq--;
+    add_packet(&reply, err, sizeof(err));
+    rv += test_reply("ERR in rows", &reply, false, 0, 1, 2, 2, 0, 0);
+
+    rv += test_stop();
+
+    return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <maxscale/log_manager.h>
+#include "../maxscale/resolve.h"
+
+static int test_address(const char *host, int family)
+{
+    struct sockaddr_storage addr, cached;
+    int rval = 0;
+
+    /** The first lookup adds the host to the cache and the second finds it there */
+    if (!resolve_address(host, &addr, true) || !resolve_address(host, &cached, true))
+    {
+        fprintf(stderr, "Failed to resolve %s\n", host);
+        return 1;
+    }
+
+    if (addr.ss_family != family || memcmp(&addr, &cached, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "The cached address of %s differs\n", host);
+        rval++;
+    }
+
+    resolve_refresh(NULL);
+
+    if (!resolve_address(host, &cached, true) || memcmp(&addr, &cached, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "The address of %s changed when it was refreshed\n", host);
+        rval++;
+    }
+
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    int rval = 0;
+
+    mxs_log_init(NULL, "/tmp", MXS_LOG_TARGET_FS);
+    rval += test_address("127.0.0.1", AF_INET);
+    rval += test_address("::1", AF_INET6);
+
+    struct sockaddr_storage addr;
+
+    if (!resolve_address("127.0.0.2", &addr, false) ||
+        ((struct sockaddr_in*)&addr)->sin_addr.s_addr != inet_addr("127.0.0.2"))
+    {
+        fprintf(stderr, "Failed to resolve an uncached address\n");
+        rval++;
+    }
+
+    mxs_log_finish();
+    return rval;
+}
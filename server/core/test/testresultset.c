@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/buffer.h>
+#include <maxscale/dcb.h>
+#include <maxscale/resultset.h>
+
+static GWBUF *written;
+static int n_writes;
+
+static int capture_write(DCB *dcb, GWBUF *buf)
+{
+    written = gwbuf_append(written, buf);
+    n_writes++;
+    return 1;
+}
+
+/** Return the written data as a string and reset the capture */
+static char* take_output(size_t *len)
+{
+    *len = gwbuf_length(written);
+    char *rval = calloc(1, *len + 1);
+    gwbuf_copy_data(written, 0, *len, (uint8_t*)rval);
+    gwbuf_free(written);
+    written = NULL;
+    return rval;
+}
+
+typedef struct
+{
+    int index;
+    int n_rows;
+    int calls;
+} ROWS;
+
+static RESULT_ROW* fetch_row(RESULTSET *set, void *data)
+{
+    ROWS *rows = (ROWS*)data;
+    RESULT_ROW *row = NULL;
+
+    if (rows->index < rows->n_rows && (row = resultset_make_row(set)))
+    {
+        char buf[20];
+        snprintf(buf, sizeof(buf), "%d", rows->index++);
+        resultset_row_set(row, 0, buf);
+        resultset_row_set(row, 1, "say \"hi\"");
+        resultset_row_set(row, 2, NULL);
+    }
+
+    return row;
+}
+
+static void push_rows(RESULTSET *set, void *data)
+{
+    ROWS *rows = (ROWS*)data;
+
+    for (int i = 0; i < rows->n_rows; i++)
+    {
+        char buf[20];
+        snprintf(buf, sizeof(buf), "%d", i);
+        const char *values[] = {buf, "value", NULL};
+
+        rows->calls++;
+
+        if (!resultset_stream_row(set, values))
+        {
+            break;
+        }
+    }
+}
+
+static RESULTSET* make_set(RESULTSET *set)
+{
+    resultset_add_column(set, "id", 10, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "text", 40, COL_TYPE_VARCHAR);
+    resultset_add_column(set, "none", 10, COL_TYPE_VARCHAR);
+    return set;
+}
+
+static int test_json(DCB *dcb)
+{
+    ROWS rows = {0, 2, 0};
+    RESULTSET *set = make_set(resultset_create(fetch_row, &rows));
+    const char expected[] =
+        "[ { \"id\" : 0, \"text\" : \"say \\\"hi\\\"\", \"none\" : null},\n"
+        "{ \"id\" : 1, \"text\" : \"say \\\"hi\\\"\", \"none\" : null}]\n";
+    size_t len;
+    int rval = 0;
+
+    n_writes = 0;
+    resultset_stream_json(set, dcb);
+    resultset_free(set);
+
+    char *output = take_output(&len);
+
+    if (strcmp(output, expected) != 0)
+    {
+        printf("Unexpected JSON:\n%s\n", output);
+        rval++;
+    }
+
+    if (n_writes != 1)
+    {
+        printf("Result set was written with %d writes instead of one.\n", n_writes);
+        rval++;
+    }
+
+    free(output);
+    return rval;
+}
+
+static int test_page(DCB *dcb)
+{
+    ROWS rows = {0, 1000, 0};
+    RESULTSET *set = make_set(resultset_create_streaming(push_rows, &rows));
+    const char expected[] =
+        "[ { \"id\" : 5, \"text\" : \"value\", \"none\" : null},\n"
+        "{ \"id\" : 6, \"text\" : \"value\", \"none\" : null}]\n";
+    size_t len;
+    int rval = 0;
+
+    resultset_set_page(set, 5, 2);
+    resultset_stream_json(set, dcb);
+    resultset_free(set);
+
+    char *output = take_output(&len);
+
+    if (strcmp(output, expected) != 0)
+    {
+        printf("Unexpected page:\n%s\n", output);
+        rval++;
+    }
+
+    if (rows.calls != 7)
+    {
+        printf("Producer was called %d times after the page was full.\n", rows.calls - 7);
+        rval++;
+    }
+
+    free(output);
+    return rval;
+}
+
+static int test_mysql(DCB *dcb)
+{
+    ROWS rows = {0, 5000, 0};
+    RESULTSET *set = make_set(resultset_create_streaming(push_rows, &rows));
+    size_t len;
+    int rval = 0;
+
+    n_writes = 0;
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+
+    uint8_t *output = (uint8_t*)take_output(&len);
+    int n_packets = 0;
+    uint8_t seqno = 1;
+    size_t offset = 0;
+
+    while (offset + 4 <= len)
+    {
+        size_t plen = output[offset] | (output[offset + 1] << 8) | (output[offset + 2] << 16);
+
+        if (output[offset + 3] != seqno++)
+        {
+            printf("Packet %d has sequence number %d.\n", n_packets, output[offset + 3]);
+            rval++;
+            break;
+        }
+
+        n_packets++;
+        offset += 4 + plen;
+    }
+
+    /** Field count, three columns, EOF, the rows and EOF */
+    if (offset != len || n_packets != 1 + 3 + 1 + 5000 + 1)
+    {
+        printf("Result has %d packets, expected %d.\n", n_packets, 1 + 3 + 1 + 5000 + 1);
+        rval++;
+    }
+
+    if (n_writes < 2 || n_writes > 10)
+    {
+        printf("Result of %lu bytes was written with %d writes.\n", len, n_writes);
+        rval++;
+    }
+
+    free(output);
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    DCB dcb;
+    int rval = 0;
+
+    memset(&dcb, 0, sizeof(dcb));
+    dcb.func.write = capture_write;
+
+    rval += test_json(&dcb);
+    rval += test_page(&dcb);
+    rval += test_mysql(&dcb);
+
+    return rval == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -70,12 +70,38 @@ test1()
     ss_info_dassert(0 == strcmp("MyService", service_get_name(service)), "Service must have given name");
     ss_dfprintf(stderr, "\t..done\nAdding protocol testprotocol.");
     set_libdir(MXS_STRDUP_A("../../modules/authenticator/MySQLAuth/"));
-    ss_info_dassert(serviceCreateListener(service, "TestProtocol", "testprotocol",
-                                          "localhost", 9876, "MySQLAuth", NULL, NULL),
-                    "Add Protocol should succeed");
+    SERV_LISTENER *port = serviceCreateListener(service, "TestProtocol", "testprotocol",
+                                                "localhost", 9876, "MySQLAuth", NULL, NULL);
+    ss_info_dassert(port, "Add Protocol should succeed");
     ss_info_dassert(0 != serviceHasListener(service, "testprotocol", "localhost", 9876),
                     "Service should have new protocol as requested");
 
+    ss_dfprintf(stderr, "\t..done\nLimiting the connection rate.");
+    ss_info_dassert(listener_accept_delay(port) == 0, "Unlimited listener should not defer accepts");
+    port->max_connection_rate = 2;
+    ss_info_dassert(listener_accept_delay(port) == 0, "First connection should be accepted");
+    listener_count_accept(port);
+    ss_info_dassert(listener_accept_delay(port) == 0, "Burst of connections should be accepted");
+    listener_count_accept(port);
+    int64_t delay = listener_accept_delay(port);
+    ss_info_dassert(delay > 0 && delay <= 500001, "Connection over the rate should wait for a token");
+    ss_info_dassert(port->n_throttled == 1, "Deferred accept should be counted");
+    ss_dfprintf(stderr, "\t..done\nSetting the priority classes.");
+    ss_info_dassert(!serviceSetPriority(service, "urgent"), "Unknown priority class should be rejected");
+    ss_info_dassert(serviceSetPriority(service, "low"), "Priority class should be accepted");
+    ss_info_dassert(!serviceSetPriorityUsers(service, "batch"), "User without a class should be rejected");
+    ss_info_dassert(serviceSetPriorityUsers(service, "dashboard:high, batch : normal"),
+                    "Priority users should be accepted");
+    ss_info_dassert(service_get_priority(service, "dashboard") == SESSION_PRIORITY_HIGH,
+                    "User should get the class it was given");
+    ss_info_dassert(service_get_priority(service, "batch") == SESSION_PRIORITY_NORMAL,
+                    "Whitespace around the class should be ignored");
+    ss_info_dassert(service_get_priority(service, "other") == SESSION_PRIORITY_LOW,
+                    "Other users should get the class of the service");
+    ss_info_dassert(service_get_priority(service, NULL) == SESSION_PRIORITY_LOW,
+                    "Sessions without a user should get the class of the service");
+    ss_dfprintf(stderr, "\t..done\n");
+
     return 0;
 
 }
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/config.h>
+#include <maxscale/dcb.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/service.h>
+#include <maxscale/session.h>
+#include "../maxscale/service.h"
+#include "../maxscale/session.h"
+
+static int check_events(MXS_SESSION *session, int expected, const char *what)
+{
+    int n = session_trace_n_events(session);
+
+    if (n != expected)
+    {
+        printf("%s: expected %d events, got %d.\n", what, expected, n);
+        return 1;
+    }
+
+    return 0;
+}
+
+/** Record the events of one request that reads a result in three parts */
+static void record_request(MXS_SESSION *session)
+{
+    MXS_SESSION_TRACE(session, SESSION_TRACE_READ, NULL);
+    MXS_SESSION_TRACE(session, SESSION_TRACE_ROUTE, NULL);
+    MXS_SESSION_TRACE(session, SESSION_TRACE_CLASSIFY, NULL);
+    MXS_SESSION_TRACE(session, SESSION_TRACE_BACKEND_WRITE, "server1");
+
+    for (int i = 0; i < 3; i++)
+    {
+        MXS_SESSION_TRACE(session, SESSION_TRACE_RESPONSE, "server1");
+        MXS_SESSION_TRACE(session, SESSION_TRACE_CLIENT_WRITE, NULL);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int rv = 0;
+    MXS_CONFIG *cnf = config_get_global_options();
+    DCB dcb;
+    MXS_SESSION session;
+    MXS_SESSION *sess = &session; /*< Passed to the trace macro which tests the pointer */
+    SERVICE service;
+    SERVICE_LATENCY latency;
+
+    mxs_log_init(NULL, "/tmp", MXS_LOG_TARGET_FS);
+
+    memset(&dcb, 0, sizeof(dcb));
+    memset(&session, 0, sizeof(session));
+    memset(&service, 0, sizeof(service));
+    memset(&latency, 0, sizeof(latency));
+    service.stats.latency = &latency;
+    service.stats.n_latency = 1;
+    dcb.dcb_role = DCB_ROLE_CLIENT_HANDLER;
+    dcb.user = "tracer";
+    dcb.remote = "127.0.0.1";
+    session.client_dcb = &dcb;
+    session.service = &service;
+    session.ses_id = 1;
+
+    cnf->session_trace_sample = 0;
+    cnf->session_trace_user = NULL;
+    cnf->session_trace_host = NULL;
+    cnf->session_trace_threshold = 0;
+
+    session_trace_start(&session);
+
+    if (session.trace)
+    {
+        printf("Session is traced with no sampling.\n");
+        rv++;
+    }
+
+    /** The events of a session that is not traced are not kept */
+    record_request(&session);
+    rv += check_events(&session, 0, "Untraced session");
+
+    /** The latency of all sessions is measured */
+    for (int i = 0; i < SERVICE_LATENCY_N; i++)
+    {
+        if (service_latency_percentile(&service, (service_latency_t)i, 99) != 0)
+        {
+            printf("Phase %d was measured before the request ended.\n", i);
+            rv++;
+        }
+    }
+
+    session_trace_end(&session);
+
+    for (int i = 0; i < SERVICE_LATENCY_N; i++)
+    {
+        if (service_latency_percentile(&service, (service_latency_t)i, 99) == 0)
+        {
+            printf("Phase %d was not measured.\n", i);
+            rv++;
+        }
+    }
+
+    cnf->session_trace_user = "tracer";
+    session_trace_start(&session);
+
+    if (session.trace == NULL)
+    {
+        printf("Session of the traced user is not traced.\n");
+        return EXIT_FAILURE;
+    }
+
+    /** Alternating responses and writes are not coalesced */
+    record_request(&session);
+    rv += check_events(&session, 10, "First request");
+
+    /** The next read starts a new request */
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_READ, NULL);
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_READ, NULL);
+    rv += check_events(&session, 1, "Start of second request");
+
+    /** Consecutive events of the same point and server are one event */
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_BACKEND_WRITE, "server1");
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_BACKEND_WRITE, "server2");
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_RESPONSE, "server1");
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_RESPONSE, "server1");
+    MXS_SESSION_TRACE(sess, SESSION_TRACE_RESPONSE, "server1");
+    rv += check_events(&session, 4, "Second request");
+
+    /** The ring keeps the latest events of a long request */
+    for (int i = 0; i < 100; i++)
+    {
+        MXS_SESSION_TRACE(sess, SESSION_TRACE_BACKEND_WRITE, "server1");
+        MXS_SESSION_TRACE(sess, SESSION_TRACE_BACKEND_WRITE, "server2");
+    }
+
+    rv += check_events(&session, 32, "Long request");
+
+    if (!session_trace_end(&session))
+    {
+        printf("Request was not logged with a zero threshold.\n");
+        rv++;
+    }
+
+    if (session.trace)
+    {
+        printf("Trace was not freed.\n");
+        rv++;
+    }
+
+    cnf->session_trace_user = NULL;
+    cnf->session_trace_host = "127.0.0.1";
+    cnf->session_trace_threshold = 60000;
+    session_trace_start(&session);
+    record_request(&session);
+
+    if (session_trace_end(&session))
+    {
+        printf("Fast request was logged.\n");
+        rv++;
+    }
+
+    cnf->session_trace_host = NULL;
+    cnf->session_trace_sample = 1;
+    session_trace_start(&session);
+
+    if (session.trace == NULL)
+    {
+        printf("Session is not traced when all sessions are sampled.\n");
+        rv++;
+    }
+
+    session_trace_end(&session);
+
+    mxs_log_finish();
+
+    return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -32,7 +32,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <maxscale/debug.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/thread.h>
 
@@ -245,6 +247,51 @@ test3()
     return 0 == failures ? 0 : 1;
 }
 
+static SPINLOCK test4_lck = SPINLOCK_INIT;
+static int test4_line = 0;
+
+static void test4_helper(void *data)
+{
+    /** The line of the acquisition must be on the same line as the macro */
+    test4_line = __LINE__; spinlock_acquire(&test4_lck);
+    spinlock_release(&test4_lck);
+}
+
+static void test4_reporter(void *hdl, const SPINLOCK_SITE *site)
+{
+    if (site->line == test4_line && strstr(site->file, "testspinlock.c"))
+    {
+        *(SPINLOCK_SITE*)hdl = *site;
+    }
+}
+
+/**
+ * test4    contention recording
+ *
+ * Test that a contended acquisition is recorded for its source line and that
+ * a thread that cannot take the lock by spinning goes to sleep.
+ */
+static int
+test4()
+{
+    THREAD handle;
+    SPINLOCK_SITE site = {};
+
+    spinlock_acquire(&test4_lck);
+    thread_start(&handle, test4_helper, NULL);
+    usleep(200000);
+    spinlock_release(&test4_lck);
+    thread_wait(handle);
+
+    spinlock_site_stats(INT32_MAX, test4_reporter, &site);
+    ss_info_dassert(site.contended == 1, "The contended acquisition must be recorded");
+    ss_info_dassert(site.spins == SPINLOCK_SPIN_LIMIT, "The thread must spin the whole limit");
+    ss_info_dassert(site.sleeps > 0, "The thread must sleep on the lock");
+    ss_info_dassert(test4_lck.lock == 0, "The lock must be free");
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
@@ -252,6 +299,7 @@ int main(int argc, char **argv)
     result += test1();
     result += test2();
     result += test3();
+    result += test4();
 
     exit(result);
 }
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <maxscale/config.h>
+#include <maxscale/debug.h>
+
+#include "../maxscale/statistics.h"
+
+#define TEST_THREADS 4
+#define TEST_ROUNDS  100000
+
+static ts_stats_t test_stats;
+
+static void* test_thread(void *arg)
+{
+    int id = (intptr_t)arg;
+
+    if (id < TEST_THREADS / 2)
+    {
+        ts_stats_thread_init(id);
+    }
+
+    for (int i = 0; i < TEST_ROUNDS; i++)
+    {
+        ts_stats_add(test_stats, 2);
+        ts_stats_add(test_stats, -1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Test that the values of worker threads and other threads are both summed
+ */
+static int test1()
+{
+    pthread_t threads[TEST_THREADS];
+
+    fprintf(stderr, "teststatistics : per-thread values. ");
+
+    /** Objects allocated before initialization must also work */
+    test_stats = ts_stats_alloc();
+    ts_stats_init();
+    ss_info_dassert(test_stats, "Allocation must succeed");
+    ss_info_dassert(ts_stats_sum(test_stats) == 0, "Values must start from zero");
+
+    ts_stats_add(test_stats, 5);
+    ss_info_dassert(ts_stats_sum(test_stats) == 5, "Value of a non-worker thread must be summed");
+
+    for (intptr_t i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, test_thread, (void*)i);
+    }
+
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    ss_info_dassert(ts_stats_sum(test_stats) == 5 + TEST_THREADS * TEST_ROUNDS,
+                    "Updates must not be lost");
+    ss_info_dassert(ts_stats_get(test_stats, TS_STATS_SUM) == ts_stats_sum(test_stats),
+                    "Sum must match");
+
+    ts_stats_free(test_stats);
+    ts_stats_end();
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    MXS_CONFIG* glob_conf = config_get_global_options();
+    glob_conf->n_threads = TEST_THREADS / 2;
+
+    result += test1();
+
+    exit(result);
+}
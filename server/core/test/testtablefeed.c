@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <maxscale/tablefeed.h>
+
+typedef struct feed_counter
+{
+    int  n_calls;   // How many times the subscriber has been called.
+    char last[256]; // The last table, as "db.table".
+} FEED_COUNTER;
+
+static void count_table(const char *db, const char *table, void *data)
+{
+    FEED_COUNTER *counter = (FEED_COUNTER*)data;
+
+    counter->n_calls++;
+    snprintf(counter->last, sizeof(counter->last), "%s.%s", db, table);
+}
+
+int main(int argc, char* argv[])
+{
+    int rv = 0;
+    FEED_COUNTER c1 = { 0 };
+    FEED_COUNTER c2 = { 0 };
+
+    if (mxs_table_feed_has_subscribers())
+    {
+        printf("Feed has subscribers before subscribing.\n");
+        rv++;
+    }
+
+    mxs_table_feed_publish("db", "t0");
+
+    if (!mxs_table_feed_subscribe(count_table, &c1) ||
+        !mxs_table_feed_subscribe(count_table, &c2))
+    {
+        printf("Could not subscribe.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!mxs_table_feed_has_subscribers())
+    {
+        printf("Feed has no subscribers after subscribing.\n");
+        rv++;
+    }
+
+    mxs_table_feed_publish("db", "t1");
+
+    if (c1.n_calls != 1 || c2.n_calls != 1 || strcmp(c1.last, "db.t1") != 0)
+    {
+        printf("Published table was not delivered to both subscribers.\n");
+        rv++;
+    }
+
+    mxs_table_feed_unsubscribe(count_table, &c1);
+    mxs_table_feed_publish("db", "t2");
+
+    if (c1.n_calls != 1 || c2.n_calls != 2 || strcmp(c2.last, "db.t2") != 0)
+    {
+        printf("Table was delivered to a removed subscriber or not to the remaining one.\n");
+        rv++;
+    }
+
+    mxs_table_feed_unsubscribe(count_table, &c2);
+
+    if (mxs_table_feed_has_subscribers())
+    {
+        printf("Feed has subscribers after all were removed.\n");
+        rv++;
+    }
+
+    return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
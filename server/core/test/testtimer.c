@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <maxscale/debug.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/thread.h>
+
+#include "../maxscale/timer.h"
+
+#define N_TIMERS 9
+
+typedef struct
+{
+    MXS_TIMER timer;
+    int64_t   fired;   /*< The heartbeat when the timer fired, -1 if not yet */
+    int       n_fired; /*< How many times the timer fired */
+    int       rearm;   /*< How many more times the timer adds itself again */
+} TEST_TIMER;
+
+static void test_cb(MXS_TIMER *timer, void *data)
+{
+    TEST_TIMER *t = (TEST_TIMER*)data;
+    ss_dassert(&t->timer == timer);
+    ss_dassert(!mxs_timer_is_active(timer));
+    t->fired = hkheartbeat;
+    t->n_fired++;
+
+    if (t->rearm > 0)
+    {
+        t->rearm--;
+        mxs_timer_add(timer, 1);
+    }
+}
+
+static void test_timer_init(TEST_TIMER *t)
+{
+    mxs_timer_init(&t->timer, test_cb, t);
+    t->fired = -1;
+    t->n_fired = 0;
+    t->rearm = 0;
+}
+
+static void advance(int64_t ticks)
+{
+    for (int64_t i = 0; i < ticks; i++)
+    {
+        hkheartbeat++;
+        timer_wheel_process(hkheartbeat);
+    }
+}
+
+/**
+ * Test that timers on all levels of the wheel fire at the right heartbeat
+ */
+static int test1()
+{
+    static const int64_t delays[N_TIMERS] = {1, 2, 63, 64, 65, 4095, 4096, 300000, 20000000};
+    TEST_TIMER timers[N_TIMERS];
+    int64_t start = hkheartbeat;
+
+    fprintf(stderr, "testtimer : timers expire at the right time. ");
+
+    for (int i = 0; i < N_TIMERS; i++)
+    {
+        test_timer_init(&timers[i]);
+        mxs_timer_add(&timers[i].timer, delays[i]);
+        ss_info_dassert(mxs_timer_is_active(&timers[i].timer), "Added timer must be active");
+    }
+
+    ss_info_dassert(timer_wheel_count(0) == N_TIMERS, "All timers must be in the wheel");
+
+    for (int i = 0; i < N_TIMERS; i++)
+    {
+        advance(start + delays[i] - hkheartbeat);
+        ss_info_dassert(timers[i].fired == start + delays[i], "Timer must fire when it expires");
+        ss_info_dassert(timers[i].n_fired == 1, "Timer must fire once");
+
+        for (int j = i + 1; j < N_TIMERS; j++)
+        {
+            ss_info_dassert(timers[j].fired == -1, "Later timers must not fire");
+        }
+    }
+
+    ss_info_dassert(timer_wheel_count(0) == 0, "Wheel must be empty");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * Test cancelling, re-adding and adding from the callback
+ */
+static int test2()
+{
+    TEST_TIMER a, b, c;
+
+    fprintf(stderr, "testtimer : cancel and re-add timers. ");
+    test_timer_init(&a);
+    test_timer_init(&b);
+    test_timer_init(&c);
+
+    mxs_timer_add(&a.timer, 10);
+    mxs_timer_add(&b.timer, 10);
+    mxs_timer_cancel(&a.timer);
+    ss_info_dassert(!mxs_timer_is_active(&a.timer), "Cancelled timer must not be active");
+    mxs_timer_cancel(&a.timer);
+
+    /** Moving the expiration time of a timer */
+    mxs_timer_add(&b.timer, 100);
+    advance(50);
+    ss_info_dassert(a.n_fired == 0 && b.n_fired == 0, "Timers must not fire");
+
+    c.rearm = 2;
+    mxs_timer_add(&c.timer, 1);
+    advance(50);
+    ss_info_dassert(a.n_fired == 0, "Cancelled timer must not fire");
+    ss_info_dassert(b.n_fired == 1, "Moved timer must fire once");
+    ss_info_dassert(c.n_fired == 3, "Timer added from its callback must fire again");
+    ss_info_dassert(timer_wheel_count(0) == 0, "Wheel must be empty");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+static TEST_TIMER remote_timer;
+
+static void add_remote(void *data)
+{
+    mxs_timer_add_to(0, &remote_timer.timer, 5);
+}
+
+/**
+ * Test adding a timer from a thread that does not own the wheel
+ */
+static int test3()
+{
+    THREAD thr;
+
+    fprintf(stderr, "testtimer : add timers from other threads. ");
+    test_timer_init(&remote_timer);
+    thread_start(&thr, add_remote, NULL);
+    thread_wait(thr);
+
+    ss_info_dassert(mxs_timer_is_active(&remote_timer.timer), "Timer must be active");
+    int64_t start = hkheartbeat;
+    advance(5);
+    ss_info_dassert(remote_timer.fired == start + 5, "Timer must fire when it expires");
+
+    /** A pending timer can be cancelled before it reaches the wheel */
+    test_timer_init(&remote_timer);
+    thread_start(&thr, add_remote, NULL);
+    thread_wait(thr);
+    mxs_timer_cancel(&remote_timer.timer);
+    advance(10);
+    ss_info_dassert(remote_timer.n_fired == 0, "Cancelled timer must not fire");
+    ss_info_dassert(timer_wheel_count(0) == 0, "Wheel must be empty");
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    hkheartbeat = 12345;
+    timer_wheel_init(1, hkheartbeat);
+    timer_wheel_thread_init(0);
+
+    result += test1();
+    result += test2();
+    result += test3();
+
+    exit(result);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+// To ensure that ss_info_assert asserts also when builing in non-debug mode.
+#if !defined(SS_DEBUG)
+#define SS_DEBUG
+#endif
+#if defined(NDEBUG)
+#undef NDEBUG
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <maxscale/debug.h>
+
+#include "../maxscale/uring.h"
+
+#define TEST_EVENTS 16
+
+static int n_rearms = 0;
+static int remove_fd = -1;
+
+static bool test_rearm(void *data, int *fd, uint32_t *events)
+{
+    n_rearms++;
+    *fd = *(int*)data;
+    *events = EPOLLIN;
+    return true;
+}
+
+static void signal_fd(int fd)
+{
+    uint64_t one = 1;
+    ss_info_dassert(write(fd, &one, sizeof(one)) == sizeof(one), "Write to eventfd must succeed");
+}
+
+static void drain_fd(int fd)
+{
+    uint64_t count;
+    ss_info_dassert(read(fd, &count, sizeof(count)) == sizeof(count), "Read from eventfd must succeed");
+}
+
+/**
+ * Test that events are returned while the file descriptor is watched
+ */
+static int test1()
+{
+    struct epoll_event events[TEST_EVENTS];
+    int fd = eventfd(0, EFD_NONBLOCK);
+    MXS_URING *ring = uring_create(8, test_rearm);
+
+    fprintf(stderr, "testuring : events of watched descriptors. ");
+    ss_info_dassert(fd != -1 && ring, "Creating the eventfd and the ring must succeed");
+
+    ss_info_dassert(uring_add(ring, fd, EPOLLIN | EPOLLET, &fd, true) == 0, "Adding must succeed");
+    ss_info_dassert(uring_wait(ring, events, TEST_EVENTS, 0) == 0, "Nothing must be readable");
+    ss_info_dassert(uring_wait(ring, events, TEST_EVENTS, 10) == 0, "Wait must time out");
+
+    for (int i = 0; i < 3; i++)
+    {
+        signal_fd(fd);
+        int n = uring_wait(ring, events, TEST_EVENTS, 1000);
+        ss_info_dassert(n == 1, "One event expected");
+        ss_info_dassert(events[0].data.ptr == &fd, "The data must be returned");
+        ss_info_dassert(events[0].events & EPOLLIN, "The descriptor must be readable");
+        drain_fd(fd);
+    }
+
+    ss_info_dassert(n_rearms == 0, "The multishot poll must stay armed");
+
+    /** Events that were posted before the removal must not be returned */
+    signal_fd(fd);
+    usleep(10000);
+    ss_info_dassert(uring_remove(ring, &fd, true) == 0, "Removing must succeed");
+    signal_fd(fd);
+    ss_info_dassert(uring_wait(ring, events, TEST_EVENTS, 10) == 0, "No events expected after removal");
+
+    close(fd);
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * Test that a request made by another thread than the owner is submitted
+ * immediately
+ */
+static int test2()
+{
+    struct epoll_event events[TEST_EVENTS];
+    int fd = eventfd(0, EFD_NONBLOCK);
+    MXS_URING *ring = uring_create(8, test_rearm);
+
+    fprintf(stderr, "testuring : requests from other threads. ");
+    ss_info_dassert(uring_add(ring, fd, EPOLLIN, &fd, false) == 0, "Adding must succeed");
+    signal_fd(fd);
+    usleep(10000);
+    ss_info_dassert(uring_wait(ring, events, TEST_EVENTS, 0) == 1, "Event must be available without waiting");
+
+    close(fd);
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+/**
+ * Test that a removal by another thread than the owner drops the events that
+ * were posted but not yet returned
+ */
+static void* remove_thread(void *data)
+{
+    MXS_URING *ring = (MXS_URING*)data;
+    ss_info_dassert(uring_remove(ring, &remove_fd, false) == 0, "Removing must succeed");
+    return NULL;
+}
+
+static int test3()
+{
+    struct epoll_event events[TEST_EVENTS];
+    pthread_t thr;
+    remove_fd = eventfd(0, EFD_NONBLOCK);
+    MXS_URING *ring = uring_create(8, test_rearm);
+
+    fprintf(stderr, "testuring : removal by other threads. ");
+    ss_info_dassert(uring_add(ring, remove_fd, EPOLLIN | EPOLLET, &remove_fd, true) == 0, "Adding must succeed");
+    ss_info_dassert(uring_wait(ring, events, TEST_EVENTS, 0) == 0, "Nothing must be readable");
+
+    signal_fd(remove_fd);
+    usleep(10000);
+    pthread_create(&thr, NULL, remove_thread, ring);
+    pthread_join(thr, NULL);
+    signal_fd(remove_fd);
+    ss_info_dassert(uring_wait(ring, events, TEST_EVENTS, 10) == 0, "No events expected after removal");
+
+    close(remove_fd);
+    fprintf(stderr, "\t..done\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    if (uring_supported())
+    {
+        result += test1();
+        result += test2();
+        result += test3();
+    }
+    else
+    {
+        fprintf(stderr, "testuring : io_uring is not supported, skipping.\n");
+    }
+
+    exit(result);
+}
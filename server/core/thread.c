@@ -11,6 +11,8 @@
  * Public License.
  */
 #include <maxscale/thread.h>
+#include <errno.h>
+#include <sched.h>
 
 /**
  * @file thread.c  - Implementation of thread related operations
@@ -25,9 +27,22 @@
  */
 
 
+/** The CPUs of the process before any thread was pinned */
+static cpu_set_t default_cpus;
+static bool default_cpus_ok = false;
+static pthread_once_t default_cpus_once = PTHREAD_ONCE_INIT;
+
+static void get_default_cpus()
+{
+    default_cpus_ok = sched_getaffinity(0, sizeof(default_cpus), &default_cpus) == 0;
+}
+
 /**
  * Start a polling thread
  *
+ * The thread may run on all the CPUs of the process even if the calling
+ * thread is pinned to one CPU.
+ *
  * @param thd       Pointer to the THREAD object
  * @param entry     The entry point to call
  * @param arg       The argument to pass the thread entry point
@@ -35,11 +50,44 @@
  */
 THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg)
 {
-    if (pthread_create(thd, NULL, (void *(*)(void *))entry, arg) != 0)
+    pthread_attr_t attr;
+    pthread_attr_t *attrp = NULL;
+
+    pthread_once(&default_cpus_once, get_default_cpus);
+
+    if (default_cpus_ok && pthread_attr_init(&attr) == 0)
+    {
+        attrp = &attr;
+        pthread_attr_setaffinity_np(attrp, sizeof(default_cpus), &default_cpus);
+    }
+
+    int rc = pthread_create(thd, attrp, (void *(*)(void *))entry, arg);
+
+    if (attrp)
     {
-        return NULL;
+        pthread_attr_destroy(attrp);
     }
-    return thd;
+
+    return rc == 0 ? thd : NULL;
+}
+
+bool thread_set_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    /** The CPUs of the process are read before the first thread is pinned */
+    pthread_once(&default_cpus_once, get_default_cpus);
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if (rc != 0)
+    {
+        errno = rc;
+    }
+
+    return rc == 0;
 }
 
 /**
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file timer.c - Hierarchical timer wheels of the worker threads
+ *
+ * Each wheel has TIMER_LEVELS levels of TIMER_SLOTS slots. A timer that
+ * expires within TIMER_SLOTS heartbeats is in the first level, in the slot of
+ * its expiration heartbeat. Timers further away are in the higher levels
+ * where each slot covers TIMER_SLOTS times the time of a slot of the level
+ * below it. When the first level wraps around, the next slot of the second
+ * level is cascaded into the first level, and so on.
+ */
+
+#include <maxscale/timer.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/debug.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/platform.h>
+#include <maxscale/spinlock.h>
+
+#include "maxscale/timer.h"
+
+#define TIMER_BITS   6
+#define TIMER_SLOTS  (1 << TIMER_BITS)
+#define TIMER_MASK   (TIMER_SLOTS - 1)
+#define TIMER_LEVELS 4
+
+/** The longest time a timer can be in the wheel before it is cascaded again */
+#define TIMER_MAX_DELTA ((INT64_C(1) << (TIMER_BITS * TIMER_LEVELS)) - 1)
+
+typedef struct timer_wheel
+{
+    MXS_TIMER *slots[TIMER_LEVELS][TIMER_SLOTS]; /*< The timers in each slot */
+    int64_t    tick;     /*< The next heartbeat to process */
+    int        count;    /*< Number of timers in the slots */
+    SPINLOCK   lock;     /*< Protects the incoming list */
+    MXS_TIMER *incoming; /*< Timers added by other threads */
+} TIMER_WHEEL;
+
+static TIMER_WHEEL *timer_wheels = NULL; /*< The wheels of all worker threads */
+static int n_timer_wheels = 0;           /*< Number of wheels */
+static thread_local TIMER_WHEEL *this_wheel = NULL; /*< The wheel of this thread */
+
+static void timer_link(MXS_TIMER **head, MXS_TIMER *timer)
+{
+    timer->next = *head;
+
+    if (*head)
+    {
+        (*head)->pprev = &timer->next;
+    }
+
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void timer_unlink(MXS_TIMER *timer)
+{
+    *timer->pprev = timer->next;
+
+    if (timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * Put a timer into the slot matching its expiration time
+ *
+ * @param wheel The wheel
+ * @param timer The timer
+ */
+static void timer_place(TIMER_WHEEL *wheel, MXS_TIMER *timer)
+{
+    int64_t expires = MXS_MAX(timer->expires, wheel->tick);
+    int64_t delta = MXS_MIN(expires - wheel->tick, TIMER_MAX_DELTA);
+    int level = 0;
+
+    /** A timer too far in the future is placed at the maximum distance and
+     * cascaded again when that slot is reached */
+    expires = wheel->tick + delta;
+
+    while (level < TIMER_LEVELS - 1 && delta >= (INT64_C(1) << (TIMER_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    int slot = (expires >> (TIMER_BITS * level)) & TIMER_MASK;
+    timer_link(&wheel->slots[level][slot], timer);
+}
+
+/**
+ * Move the timers of a slot to the lower levels
+ *
+ * @param wheel The wheel
+ * @param level The level of the slot
+ * @param slot  The slot
+ */
+static void timer_cascade(TIMER_WHEEL *wheel, int level, int slot)
+{
+    MXS_TIMER *timer;
+
+    while ((timer = wheel->slots[level][slot]))
+    {
+        timer_unlink(timer);
+        timer_place(wheel, timer);
+    }
+}
+
+/**
+ * Move the timers added by other threads into the wheel
+ *
+ * @param wheel The wheel
+ */
+static void timer_take_incoming(TIMER_WHEEL *wheel)
+{
+    if (wheel->incoming)
+    {
+        MXS_TIMER *timer;
+        spinlock_acquire(&wheel->lock);
+
+        while ((timer = wheel->incoming))
+        {
+            timer_unlink(timer);
+            timer->pending = false;
+            timer_place(wheel, timer);
+            wheel->count++;
+        }
+
+        spinlock_release(&wheel->lock);
+    }
+}
+
+bool timer_wheel_init(int n_threads, int64_t now)
+{
+    ss_dassert(timer_wheels == NULL);
+
+    if ((timer_wheels = (TIMER_WHEEL*)MXS_CALLOC(n_threads, sizeof(TIMER_WHEEL))))
+    {
+        n_timer_wheels = n_threads;
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            timer_wheels[i].tick = now;
+            spinlock_init(&timer_wheels[i].lock);
+        }
+    }
+
+    return timer_wheels != NULL;
+}
+
+void timer_wheel_thread_init(int thread_id)
+{
+    if (thread_id >= 0 && thread_id < n_timer_wheels)
+    {
+        this_wheel = &timer_wheels[thread_id];
+    }
+}
+
+void timer_wheel_process(int64_t now)
+{
+    TIMER_WHEEL *wheel = this_wheel;
+
+    if (wheel == NULL)
+    {
+        return;
+    }
+
+    timer_take_incoming(wheel);
+
+    while (wheel->tick <= now)
+    {
+        int64_t tick = wheel->tick;
+        int slot = tick & TIMER_MASK;
+
+        if (slot == 0)
+        {
+            /** Find the highest level that wraps around at this tick and
+             * cascade the levels from that one down */
+            int top = 1;
+
+            while (top < TIMER_LEVELS - 1 && ((tick >> (TIMER_BITS * top)) & TIMER_MASK) == 0)
+            {
+                top++;
+            }
+
+            for (int level = top; level > 0; level--)
+            {
+                timer_cascade(wheel, level, (tick >> (TIMER_BITS * level)) & TIMER_MASK);
+            }
+        }
+
+        MXS_TIMER *expired = wheel->slots[0][slot];
+        wheel->slots[0][slot] = NULL;
+
+        if (expired)
+        {
+            expired->pprev = &expired;
+        }
+
+        /** Timers added by the callbacks go to the following ticks */
+        wheel->tick = tick + 1;
+
+        MXS_TIMER *timer;
+
+        while ((timer = expired))
+        {
+            timer_unlink(timer);
+
+            if (timer->expires <= tick)
+            {
+                timer->thread = -1;
+                wheel->count--;
+                timer->cb(timer, timer->data);
+            }
+            else
+            {
+                /** A timer that was too far in the future to be placed exactly */
+                timer_place(wheel, timer);
+            }
+        }
+    }
+}
+
+int timer_wheel_count(int thread_id)
+{
+    return thread_id >= 0 && thread_id < n_timer_wheels ? timer_wheels[thread_id].count : 0;
+}
+
+void mxs_timer_init(MXS_TIMER *timer, mxs_timer_cb_t cb, void *data)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->thread = -1;
+    timer->pending = false;
+    timer->cb = cb;
+    timer->data = data;
+}
+
+void mxs_timer_add(MXS_TIMER *timer, int64_t ticks)
+{
+    TIMER_WHEEL *wheel = this_wheel;
+    ss_dassert(wheel);
+    ss_dassert(timer->cb);
+
+    if (wheel)
+    {
+        mxs_timer_cancel(timer);
+        timer->expires = hkheartbeat + MXS_MAX(ticks, 1);
+        timer->thread = wheel - timer_wheels;
+        timer_place(wheel, timer);
+        wheel->count++;
+    }
+}
+
+void mxs_timer_add_to(int thread_id, MXS_TIMER *timer, int64_t ticks)
+{
+    ss_dassert(thread_id >= 0 && thread_id < n_timer_wheels);
+    TIMER_WHEEL *wheel = &timer_wheels[thread_id];
+
+    if (wheel == this_wheel)
+    {
+        mxs_timer_add(timer, ticks);
+    }
+    else
+    {
+        ss_dassert(!mxs_timer_is_active(timer));
+        spinlock_acquire(&wheel->lock);
+        timer->expires = hkheartbeat + MXS_MAX(ticks, 1);
+        timer->thread = thread_id;
+        timer->pending = true;
+        timer_link(&wheel->incoming, timer);
+        spinlock_release(&wheel->lock);
+    }
+}
+
+void mxs_timer_cancel(MXS_TIMER *timer)
+{
+    if (mxs_timer_is_active(timer))
+    {
+        TIMER_WHEEL *wheel = &timer_wheels[timer->thread];
+        ss_dassert(timer->pending || wheel == this_wheel);
+
+        if (timer->pending)
+        {
+            spinlock_acquire(&wheel->lock);
+            timer_unlink(timer);
+            timer->pending = false;
+            spinlock_release(&wheel->lock);
+        }
+        else
+        {
+            timer_unlink(timer);
+            wheel->count--;
+        }
+
+        timer->thread = -1;
+    }
+}
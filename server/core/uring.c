@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file uring.c - An io_uring based event engine
+ *
+ * The rings are used directly through the system calls so that no library
+ * is needed. Each file descriptor is watched with a multishot poll request
+ * whose user data is the data pointer of the epoll event. The submission
+ * queue can be written by any thread and is protected by a spinlock. The
+ * completion queue is read by the owning thread, but a removal by any thread
+ * clears the completions of the removed request that have not been read yet.
+ * A second spinlock keeps the two apart.
+ */
+
+#include "maxscale/uring.h"
+
+#include <errno.h>
+
+#include <maxscale/alloc.h>
+#include <maxscale/debug.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/spinlock.h>
+
+#if defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_setup) && defined(IORING_POLL_ADD_MULTI) && \
+    defined(IORING_ENTER_EXT_ARG) && defined(IORING_FEAT_RSRC_TAGS)
+#define URING_ENABLED 1
+#endif
+
+#if defined(URING_ENABLED)
+
+#include <endian.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+struct mxs_uring
+{
+    int                  fd;         /*< The ring file descriptor */
+    SPINLOCK             lock;       /*< Protects the tail of the submission queue */
+    SPINLOCK             cq_lock;    /*< Serializes reading and clearing completions */
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_entries;
+    unsigned            *sq_flags;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;     /*< Mapping of the submission queue */
+    size_t               sq_size;
+    void                *cq_ptr;     /*< Mapping of the completion queue */
+    size_t               cq_size;
+    size_t               sqes_size;
+    uring_rearm_cb_t     rearm;      /*< Called for ended poll requests */
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                       unsigned int flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+bool uring_supported()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = uring_setup(2, &params);
+    bool rval = false;
+
+    if (fd != -1)
+    {
+        /** Multishot polls were added in the same release as resource tags */
+        rval = (params.features & IORING_FEAT_EXT_ARG) &&
+               (params.features & IORING_FEAT_RSRC_TAGS) &&
+               (params.features & IORING_FEAT_NODROP);
+        close(fd);
+    }
+
+    return rval;
+}
+
+static void uring_free(MXS_URING *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+    {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->fd != -1)
+    {
+        close(ring->fd);
+    }
+    MXS_FREE(ring);
+}
+
+MXS_URING* uring_create(unsigned int entries, uring_rearm_cb_t rearm)
+{
+    MXS_URING *ring = (MXS_URING*)MXS_CALLOC(1, sizeof(MXS_URING));
+
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    spinlock_init(&ring->lock);
+    spinlock_init(&ring->cq_lock);
+    ring->rearm = rearm;
+
+    if ((ring->fd = uring_setup(entries, &p)) == -1)
+    {
+        MXS_ERROR("Failed to create an io_uring instance: %d, %s", errno, mxs_strerror(errno));
+        uring_free(ring);
+        return NULL;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_size = ring->cq_size = MXS_MAX(ring->sq_size, ring->cq_size);
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ptr != MAP_FAILED)
+    {
+        ring->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ptr :
+                       mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+    }
+
+    if (ring->sq_ptr != MAP_FAILED && ring->cq_ptr != MAP_FAILED)
+    {
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring->fd, IORING_OFF_SQES);
+    }
+
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        MXS_ERROR("Failed to map the io_uring queues: %d, %s", errno, mxs_strerror(errno));
+        uring_free(ring);
+        return NULL;
+    }
+
+    char *sq = (char*)ring->sq_ptr;
+    char *cq = (char*)ring->cq_ptr;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = (unsigned*)(sq + p.sq_off.ring_entries);
+    ring->sq_flags = (unsigned*)(sq + p.sq_off.flags);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return ring;
+}
+
+/**
+ * Submit all queued requests without waiting
+ *
+ * @param ring The ring
+ *
+ * @return 0 on success, -1 on error
+ */
+static int uring_flush(MXS_URING *ring)
+{
+    int rc = 0;
+
+    while (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != *ring->sq_tail)
+    {
+        if ((rc = uring_enter(ring->fd, *ring->sq_entries, 0, 0, NULL, 0)) == -1 && errno != EINTR)
+        {
+            break;
+        }
+        rc = 0;
+    }
+
+    return rc;
+}
+
+/**
+ * Get the next free submission queue entry, the ring must be locked
+ *
+ * @param ring The ring
+ *
+ * @return The cleared entry or NULL if the queue is full and could not be submitted
+ */
+static struct io_uring_sqe* uring_get_sqe(MXS_URING *ring)
+{
+    unsigned tail = *ring->sq_tail;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_entries &&
+        uring_flush(ring) == -1)
+    {
+        return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+/**
+ * Make the last entry returned by uring_get_sqe visible to the kernel
+ *
+ * @param ring The ring
+ */
+static void uring_commit_sqe(MXS_URING *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int uring_add(MXS_URING *ring, int fd, uint32_t events, void *data, bool owner)
+{
+    /** Multishot polls are edge triggered by nature */
+    uint32_t mask = events & ~EPOLLET;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    mask = (mask << 16) | (mask >> 16);
+#endif
+    int rc = -1;
+
+    spinlock_acquire(&ring->lock);
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = mask;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = (uintptr_t)data;
+        uring_commit_sqe(ring);
+
+        /** The owner submits the request when it next waits for events */
+        rc = owner ? 0 : uring_flush(ring);
+    }
+
+    spinlock_release(&ring->lock);
+
+    return rc;
+}
+
+int uring_remove(MXS_URING *ring, void *data, bool owner)
+{
+    int rc = -1;
+
+    /** The owner can not reap, and thus rearm, the request while it is removed */
+    spinlock_acquire(&ring->cq_lock);
+    spinlock_acquire(&ring->lock);
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = (uintptr_t)data;
+        sqe->user_data = 0;
+        uring_commit_sqe(ring);
+        rc = uring_flush(ring);
+    }
+
+    spinlock_release(&ring->lock);
+
+    if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+    {
+        /** Move the overflowed completions to the queue so that they are cleared too */
+        uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+
+    /** Drop the completions that have been posted but not yet returned. Any
+     * completion posted after the removal reports the cancellation and is
+     * not an event. */
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (unsigned head = *ring->cq_head; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+        if (cqe->user_data == (uintptr_t)data)
+        {
+            cqe->user_data = 0;
+        }
+    }
+
+    spinlock_release(&ring->cq_lock);
+
+    return rc;
+}
+
+/**
+ * Convert the available completions into epoll events
+ *
+ * @param ring      The ring
+ * @param events    Where the events are stored
+ * @param maxevents Size of @c events
+ *
+ * @return Number of events
+ */
+static int uring_reap(MXS_URING *ring, struct epoll_event *events, int maxevents)
+{
+    spinlock_acquire(&ring->cq_lock);
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail && n < maxevents)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        void *data = (void*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        head++;
+
+        /** Removed requests and failed requests, e.g. a cancelled poll, are
+         * not events */
+        if (data && res >= 0)
+        {
+            events[n].events = res;
+            events[n].data.ptr = data;
+            n++;
+
+            int fd;
+            uint32_t ev;
+
+            if (!more && ring->rearm(data, &fd, &ev))
+            {
+                uring_add(ring, fd, ev, data, true);
+            }
+        }
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    spinlock_release(&ring->cq_lock);
+
+    return n;
+}
+
+int uring_wait(MXS_URING *ring, struct epoll_event *events, int maxevents, int timeout)
+{
+    int n = uring_reap(ring, events, maxevents);
+    int rc = 0;
+
+    if (n == 0 && timeout != 0)
+    {
+        /** Submit the queued requests and wait for events with one call */
+        struct __kernel_timespec ts = {timeout / 1000, (timeout % 1000) * 1000000};
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = timeout > 0 ? (uintptr_t)&ts : 0;
+
+        if ((rc = uring_enter(ring->fd, *ring->sq_entries, 1,
+                              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                              &arg, sizeof(arg))) == -1 && errno == ETIME)
+        {
+            rc = 0;
+        }
+
+        n = uring_reap(ring, events, maxevents);
+    }
+    else if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) != *ring->sq_tail ||
+             (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+    {
+        /** Overflowed completions are moved to the queue only when entering the kernel */
+        rc = uring_enter(ring->fd, *ring->sq_entries, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+
+    return n == 0 && rc == -1 ? -1 : n;
+}
+
+#else /* URING_ENABLED */
+
+bool uring_supported()
+{
+    return false;
+}
+
+MXS_URING* uring_create(unsigned int entries, uring_rearm_cb_t rearm)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+int uring_add(MXS_URING *ring, int fd, uint32_t events, void *data, bool owner)
+{
+    ss_dassert(false);
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_remove(MXS_URING *ring, void *data, bool owner)
+{
+    ss_dassert(false);
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_wait(MXS_URING *ring, struct epoll_event *events, int maxevents, int timeout)
+{
+    ss_dassert(false);
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* URING_ENABLED */
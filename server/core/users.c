@@ -42,17 +42,17 @@ USERS *users_alloc()
         return NULL;
     }
 
-    if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE,
-                                      hashtable_item_strhash, hashtable_item_strcmp)) == NULL)
+    if ((rval->data = lfhash_alloc(USERS_HASHTABLE_DEFAULT_SIZE,
+                                   hashtable_item_strhash, hashtable_item_strcmp)) == NULL)
     {
         MXS_ERROR("[%s:%d]: Memory allocation failed.", __FUNCTION__, __LINE__);
         MXS_FREE(rval);
         return NULL;
     }
 
-    hashtable_memory_fns(rval->data,
-                         hashtable_item_strdup, hashtable_item_strdup,
-                         hashtable_item_free, hashtable_item_free);
+    lfhash_memory_fns(rval->data,
+                      hashtable_item_strdup, hashtable_item_strdup,
+                      hashtable_item_free, hashtable_item_free);
 
     return rval;
 }
@@ -61,7 +61,7 @@ void users_free(USERS *users)
 {
     if (users)
     {
-        hashtable_free(users->data);
+        lfhash_free(users->data);
         MXS_FREE(users);
     }
 }
@@ -71,7 +71,7 @@ int users_add(USERS *users, const char *user, const char *auth)
     int add;
 
     atomic_add(&users->stats.n_adds, 1);
-    add = hashtable_add(users->data, (char*)user, (char*)auth);
+    add = lfhash_add(users->data, (char*)user, (char*)auth);
     atomic_add(&users->stats.n_entries, add);
     return add;
 }
@@ -81,7 +81,7 @@ int users_delete(USERS *users, const char *user)
     int del;
 
     atomic_add(&users->stats.n_deletes, 1);
-    del = hashtable_delete(users->data, (char*)user);
+    del = lfhash_delete(users->data, (char*)user);
     atomic_add(&users->stats.n_entries, -del);
     return del;
 }
@@ -89,31 +89,30 @@ int users_delete(USERS *users, const char *user)
 const char *users_fetch(USERS *users, const char *user)
 {
     atomic_add(&users->stats.n_fetches, 1);
-    // TODO: Returning data from the hashtable is not threadsafe.
-    return hashtable_fetch(users->data, (char*)user);
+    return lfhash_fetch(users->data, (char*)user);
 }
 
 int users_update(USERS *users, const char *user, const char *auth)
 {
-    if (hashtable_delete(users->data, (char*)user) == 0)
+    if (lfhash_delete(users->data, (char*)user) == 0)
     {
         return 0;
     }
-    return hashtable_add(users->data, (char*)user, (char*)auth);
+    return lfhash_add(users->data, (char*)user, (char*)auth);
 }
 
 
 void usersPrint(const USERS *users)
 {
     printf("Users table data\n");
-    hashtable_stats(users->data);
+    printf("\tNo. of entries:       %d\n", lfhash_size(users->data));
 }
 
 void users_default_diagnostic(DCB *dcb, SERV_LISTENER *port)
 {
     if (port->users && port->users->data)
     {
-        HASHITERATOR *iter = hashtable_iterator(port->users->data);
+        LFHASHITERATOR *iter = lfhash_iterator(port->users->data);
 
         if (iter)
         {
@@ -121,14 +120,14 @@ void users_default_diagnostic(DCB *dcb, SERV_LISTENER *port)
             char *sep = "";
             void *user;
 
-            while ((user = hashtable_next(iter)) != NULL)
+            while ((user = lfhash_next(iter)) != NULL)
             {
                 dcb_printf(dcb, "%s%s", sep, (char *)user);
                 sep = ", ";
             }
 
             dcb_printf(dcb, "\n");
-            hashtable_iterator_free(iter);
+            lfhash_iterator_free(iter);
         }
     }
     else
@@ -50,6 +50,8 @@
 #include <maxscale/secrets.h>
 #include <maxscale/session.h>
 
+#include "maxscale/resolve.h"
+
 #if !defined(PATH_MAX)
 # if defined(__USE_POSIX)
 #   define PATH_MAX _POSIX_PATH_MAX
@@ -138,7 +140,7 @@ char *gw_strend(register const char *s)
  *****************************************/
 static char gw_randomchar()
 {
-    return (char)((random_jkiss() % 78) + 30);
+    return (char)(random_jkiss_range(78) + 30);
 }
 
 /*****************************************
@@ -956,28 +958,18 @@ int open_network_socket(enum mxs_socket_type type, struct sockaddr_storage *addr
 {
     ss_dassert(type == MXS_SOCKET_NETWORK || type == MXS_SOCKET_LISTENER);
 #ifdef __USE_POSIX
-    struct addrinfo *ai = NULL, hint = {};
-    int so, rc;
-    hint.ai_socktype = SOCK_STREAM;
-    hint.ai_family = AF_UNSPEC;
-    hint.ai_flags = AI_ALL;
+    int so = -1;
 
-    if ((rc = getaddrinfo(host, NULL, &hint, &ai)) != 0)
+    /** Outbound connections are made to the same servers over and over again so
+     * their addresses are cached instead of resolving them for every connection */
+    if (resolve_address(host, addr, type == MXS_SOCKET_NETWORK))
     {
-        MXS_ERROR("Failed to obtain address for host %s: %s", host, gai_strerror(rc));
-        return -1;
-    }
-
-    /* Take the first one */
-    if (ai)
-    {
-        if ((so = socket(ai->ai_family, SOCK_STREAM, 0)) == -1)
+        if ((so = socket(addr->ss_family, SOCK_STREAM, 0)) == -1)
         {
             MXS_ERROR("Socket creation failed: %d, %s.", errno, mxs_strerror(errno));
         }
         else
         {
-            memcpy(addr, ai->ai_addr, ai->ai_addrlen);
             set_port(addr, port);
 
             if ((type == MXS_SOCKET_NETWORK && !configure_network_socket(so)) ||
@@ -987,8 +979,6 @@ int open_network_socket(enum mxs_socket_type type, struct sockaddr_storage *addr
                 so = -1;
             }
         }
-
-        freeaddrinfo(ai);
     }
 
 #else
@@ -21,9 +21,13 @@
 #include <ctype.h>
 #include <mysql.h>
 #include <netdb.h>
+#include <pthread.h>
 
+#include <maxscale/atomic.h>
 #include <maxscale/dcb.h>
+#include <maxscale/hk_heartbeat.h>
 #include <maxscale/service.h>
+#include <maxscale/thread.h>
 #include <maxscale/users.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/secrets.h>
@@ -42,6 +46,23 @@
 /** MySQL 5.7 password column name */
 #define MYSQL57_PASSWORD "authentication_string"
 
+/** How long resolved client hostnames are cached, in seconds */
+#define MYSQLAUTH_DNS_TTL 300
+
+/** How long failed hostname lookups are cached, in seconds */
+#define MYSQLAUTH_DNS_NEGATIVE_TTL 30
+
+/** How many client addresses are cached */
+#define MYSQLAUTH_DNS_MAX_ENTRIES 10000
+
+/** The results of looking up the hostname of a client */
+enum dns_lookup
+{
+    DNS_LOOKUP_FOUND,  /**< The hostname is known */
+    DNS_LOOKUP_NONE,   /**< The address has no known hostname */
+    DNS_LOOKUP_PENDING /**< The address is being resolved for the first time */
+};
+
 #define NEW_LOAD_DBUSERS_QUERY "SELECT u.user, u.host, d.db, u.select_priv, u.%s \
     FROM mysql.user AS u LEFT JOIN mysql.db AS d \
     ON (u.user = d.user AND u.host = d.host) %s \
@@ -54,7 +75,7 @@ static int get_users(SERV_LISTENER *listener, bool skip_local);
 static MYSQL *gw_mysql_init(void);
 static int gw_mysql_set_timeouts(MYSQL* handle);
 static char *mysql_format_user_entry(void *data);
-static bool get_hostname(DCB *dcb, char *client_hostname, size_t size);
+static int get_hostname(DCB *dcb, char *client_hostname, size_t size);
 
 static char* get_new_users_query(const char *server_version, bool include_root)
 {
@@ -128,125 +149,428 @@ static bool check_password(const char *output, uint8_t *token, size_t token_len,
     return memcmp(final_step, stored_token, stored_token_len) == 0;
 }
 
-/** Callback for check_database() */
-static int database_cb(void *data, int columns, char** rows, char** row_names)
+static bool no_password_required(const char *result, size_t tok_len)
 {
-    bool *rval = (bool*)data;
-    *rval = true;
-    return 0;
+    return *result == '\0' && tok_len == 0;
 }
 
-static bool check_database(sqlite3 *handle, const char *database)
+static inline char ascii_lower(char c)
 {
-    bool rval = true;
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
 
-    if (*database)
+/**
+ * @brief Match a string against a pattern like the SQLite LIKE operator does
+ *
+ * The '%' character matches any sequence of characters and '_' matches one
+ * character. The ASCII characters are compared without case.
+ *
+ * @param pattern The pattern
+ * @param str     The string to match
+ *
+ * @return True if the string matches the pattern
+ */
+static bool like_match(const char *pattern, const char *str)
+{
+    while (*pattern)
     {
-        rval = false;
-        size_t len = sizeof(mysqlauth_validate_database_query) + strlen(database) + 1;
-        char sql[len];
+        if (*pattern == '%')
+        {
+            while (*pattern == '%')
+            {
+                pattern++;
+            }
 
-        sprintf(sql, mysqlauth_validate_database_query, database);
+            if (*pattern == '\0')
+            {
+                return true;
+            }
 
-        char *err;
+            for (; *str; str++)
+            {
+                if (like_match(pattern, str))
+                {
+                    return true;
+                }
+            }
 
-        if (sqlite3_exec(handle, sql, database_cb, &rval, &err) != SQLITE_OK)
+            return false;
+        }
+        else if (*pattern == '_')
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
-            rval = false;
+            if (*str == '\0')
+            {
+                return false;
+            }
+
+            /** Skip one UTF-8 character */
+            str++;
+            while ((*str & 0xc0) == 0x80)
+            {
+                str++;
+            }
+        }
+        else if (ascii_lower(*pattern) != ascii_lower(*str))
+        {
+            return false;
+        }
+        else
+        {
+            str++;
         }
+
+        pattern++;
     }
 
-    return rval;
+    return *str == '\0';
 }
 
-static bool no_password_required(const char *result, size_t tok_len)
+/**
+ * @brief Resolve how the host of a user entry is matched
+ *
+ * Hosts like 192.168.% and 10.%.%.% are converted into a network address and
+ * a netmask. Only hosts with four octets that are either numbers or wildcards
+ * are converted this way, the others are matched as LIKE patterns.
+ *
+ * @param entry The user entry
+ */
+static void compile_host(MYSQL_USER_ENTRY *entry)
 {
-    return *result == '\0' && tok_len == 0;
+    const char *host = entry->host;
+
+    if (strcmp(host, "%") == 0)
+    {
+        entry->match = MYSQL_HOST_ANY;
+        return;
+    }
+
+    entry->match = MYSQL_HOST_PATTERN;
+    uint32_t network = 0;
+    uint32_t netmask = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        network <<= 8;
+        netmask <<= 8;
+
+        if (*host == '%')
+        {
+            host++;
+        }
+        else if (isdigit(*host))
+        {
+            /** Only numbers without leading zeros match the addresses as strings */
+            int octet = 0;
+            const char *start = host;
+
+            while (isdigit(*host) && host - start < 3)
+            {
+                octet = octet * 10 + *host++ - '0';
+            }
+
+            if (octet > 255 || isdigit(*host) || (*start == '0' && host - start > 1))
+            {
+                return;
+            }
+
+            network |= octet;
+            netmask |= 0xff;
+        }
+        else
+        {
+            return;
+        }
+
+        if (*host != (i < 3 ? '.' : '\0'))
+        {
+            return;
+        }
+
+        host++;
+    }
+
+    entry->match = MYSQL_HOST_IPV4;
+    entry->network = network;
+    entry->netmask = netmask;
 }
 
-/** Used to detect empty result sets */
-struct user_query_result
+/**
+ * @brief Check if a client host matches the host of a user entry
+ *
+ * @param entry The user entry
+ * @param host  The client address or hostname
+ * @param addr  The client IPv4 address in host byte order
+ * @param ipv4  True if @c host is an IPv4 address
+ *
+ * @return True if the host matches
+ */
+static bool host_matches(MYSQL_USER_ENTRY *entry, const char *host, uint32_t addr, bool ipv4)
 {
-    bool ok;
-    char output[SHA_DIGEST_LENGTH * 2 + 1];
-};
+    switch (entry->match)
+    {
+    case MYSQL_HOST_ANY:
+        return true;
 
-/** @brief Callback for sqlite3_exec() */
-static int auth_cb(void *data, int columns, char** rows, char** row_names)
+    case MYSQL_HOST_IPV4:
+        if (ipv4)
+        {
+            return (addr & entry->netmask) == entry->network;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return like_match(entry->host, host);
+}
+
+/**
+ * @brief Find the password of the first user entry that matches the client
+ *
+ * @param index  The user index
+ * @param user   The username
+ * @param host   The client address or hostname
+ * @param db     The database the client connects to, empty if none
+ * @param output Buffer where the password is stored
+ * @param size   Size of @c output
+ *
+ * @return True if a matching entry was found
+ */
+static bool find_user(MYSQL_USER_INDEX *index, const char *user, const char *host,
+                      const char *db, char *output, size_t size)
 {
-    struct user_query_result *res = (struct user_query_result*)data;
-    strcpy(res->output, rows[0] ? rows[0] : "");
-    res->ok = true;
-    return 0;
+    struct in_addr in;
+    bool ipv4 = inet_pton(AF_INET, host, &in) == 1;
+    uint32_t addr = ipv4 ? ntohl(in.s_addr) : 0;
+
+    for (MYSQL_USER_ENTRY *entry = lfhash_fetch(index->users, (void*)user);
+         entry; entry = entry->next)
+    {
+        if (host_matches(entry, host, addr, ipv4) &&
+            (entry->anydb || *db == '\0' || (entry->db && like_match(entry->db, db))))
+        {
+            snprintf(output, size, "%s", entry->password);
+            return true;
+        }
+    }
+
+    return false;
 }
 
-int validate_mysql_user(sqlite3 *handle, DCB *dcb, MYSQL_session *session,
-                        uint8_t *scramble, size_t scramble_len)
+static bool check_database(MYSQL_USER_INDEX *index, const char *database)
 {
-    size_t len = sizeof(mysqlauth_validate_user_query) + strlen(session->user) * 2 +
-                 strlen(session->db) * 2 + MYSQL_HOST_MAXLEN + session->auth_token_len * 4 + 1;
-    char sql[len + 1];
-    int rval = MXS_AUTH_FAILED;
-    char *err;
+    return *database == '\0' || lfhash_fetch(index->databases, (void*)database) != NULL;
+}
+
+/** Get a reference to the current user index */
+static MYSQL_USER_INDEX* index_acquire(MYSQL_AUTH *instance)
+{
+    spinlock_acquire(&instance->lock);
+    MYSQL_USER_INDEX *index = instance->index;
+
+    if (index)
+    {
+        atomic_add(&index->refcount, 1);
+    }
 
-    sprintf(sql, mysqlauth_validate_user_query, session->user, dcb->remote,
-            dcb->remote, session->db, session->db);
+    spinlock_release(&instance->lock);
+    return index;
+}
 
-    struct user_query_result res = {};
+static void free_user_entries(void *data)
+{
+    MYSQL_USER_ENTRY *entry = (MYSQL_USER_ENTRY*)data;
 
-    if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+    while (entry)
     {
-        MXS_ERROR("Failed to execute auth query: %s", err);
-        sqlite3_free(err);
+        MYSQL_USER_ENTRY *next = entry->next;
+        MXS_FREE(entry->host);
+        MXS_FREE(entry->db);
+        MXS_FREE(entry->password);
+        MXS_FREE(entry);
+        entry = next;
     }
+}
 
-    /** Check for IPv6 mapped IPv4 address */
-    if (!res.ok && strchr(dcb->remote, ':') && strchr(dcb->remote, '.'))
+/** Release a reference to a user index, the last reference frees it */
+static void index_release(MYSQL_USER_INDEX *index)
+{
+    if (index && atomic_add(&index->refcount, -1) == 1)
     {
-        const char *ipv4 = strrchr(dcb->remote, ':') + 1;
-        sprintf(sql, mysqlauth_validate_user_query, session->user, ipv4, ipv4,
-                session->db, session->db);
+        lfhash_free(index->users);
+        lfhash_free(index->databases);
+        hashtable_free(index->cache);
+        MXS_FREE(index);
+    }
+}
+
+static HASHTABLE* auth_cache_alloc()
+{
+    HASHTABLE *cache = hashtable_alloc(1000, hashtable_item_strhash, hashtable_item_strcmp);
+
+    if (cache)
+    {
+        hashtable_memory_fns(cache, hashtable_item_strdup, NULL,
+                             hashtable_item_free, hashtable_item_free);
+    }
+
+    return cache;
+}
+
+/** The user name is prefixed with its length, which keeps the keys unique */
+static void auth_cache_key(char *dest, size_t size, MYSQL_session *session, const char *remote)
+{
+    snprintf(dest, size, "%lu:%s%s/%s", strlen(session->user), session->user, remote, session->db);
+}
 
-        if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+/**
+ * @brief Find a remembered authentication
+ *
+ * @param index  The user index
+ * @param key    The key of the authentication
+ * @param output Buffer where the password of the user entry is copied
+ *
+ * @return True if the authentication was found and it has not expired
+ */
+static bool auth_cache_get(MYSQL_USER_INDEX *index, const char *key, char *output)
+{
+    bool rval = false;
+
+    spinlock_acquire(&index->cache_lock);
+    MYSQL_AUTH_CACHE_ENTRY *entry = hashtable_fetch(index->cache, (void*)key);
+
+    if (entry)
+    {
+        if (entry->expires > hkheartbeat)
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
+            strcpy(output, entry->password);
+            rval = true;
         }
+        else
+        {
+            hashtable_delete(index->cache, (void*)key);
+        }
+    }
+
+    spinlock_release(&index->cache_lock);
+
+    return rval;
+}
+
+/**
+ * @brief Remember a successful authentication
+ *
+ * @param index    The user index
+ * @param key      The key of the authentication
+ * @param password The password of the user entry that matched
+ */
+static void auth_cache_put(MYSQL_USER_INDEX *index, const char *key, const char *password)
+{
+    MYSQL_AUTH_CACHE_ENTRY *entry = MXS_MALLOC(sizeof(MYSQL_AUTH_CACHE_ENTRY));
+
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    snprintf(entry->password, sizeof(entry->password), "%s", password);
+    entry->expires = hkheartbeat + MYSQLAUTH_CACHE_TTL * 10;
+
+    spinlock_acquire(&index->cache_lock);
+
+    /** Start over when the cache is full, most of the entries have usually expired */
+    if (index->cache && hashtable_size(index->cache) >= MYSQLAUTH_CACHE_MAX_ENTRIES)
+    {
+        hashtable_free(index->cache);
+        index->cache = auth_cache_alloc();
     }
 
-    if (!res.ok)
+    if (index->cache)
+    {
+        hashtable_delete(index->cache, (void*)key);
+
+        if (!hashtable_add(index->cache, (void*)key, entry))
+        {
+            MXS_FREE(entry);
+        }
+    }
+    else
+    {
+        MXS_FREE(entry);
+    }
+
+    spinlock_release(&index->cache_lock);
+}
+
+int validate_mysql_user(MYSQL_AUTH *instance, DCB *dcb, MYSQL_session *session,
+                        uint8_t *scramble, size_t scramble_len)
+{
+    MYSQL_USER_INDEX *index = index_acquire(instance);
+    int rval = MXS_AUTH_FAILED;
+
+    if (index == NULL)
+    {
+        return rval;
+    }
+
+    char output[SHA_DIGEST_LENGTH * 2 + 1] = "";
+    char key[strlen(session->user) + strlen(dcb->remote) + strlen(session->db) + 32];
+    auth_cache_key(key, sizeof(key), session, dcb->remote);
+
+    /** A client that recently authenticated with the same user, address and
+     * database matches the same user entry and the database exists */
+    bool cached = auth_cache_get(index, key, output);
+    bool found = cached || find_user(index, session->user, dcb->remote, session->db,
+                                     output, sizeof(output));
+
+    /** Check for IPv6 mapped IPv4 address */
+    if (!found && strchr(dcb->remote, ':') && strchr(dcb->remote, '.'))
+    {
+        const char *ipv4 = strrchr(dcb->remote, ':') + 1;
+        found = find_user(index, session->user, ipv4, session->db, output, sizeof(output));
+    }
+
+    if (!found)
     {
         /**
          * Try authentication with the hostname instead of the IP. We do this only
-         * as a last resort so we avoid the high cost of the DNS lookup.
+         * as a last resort so we avoid the cost of the DNS lookup. The hostname
+         * is resolved in the background the first time the client connects.
          */
-        char client_hostname[MYSQL_HOST_MAXLEN];
-        get_hostname(dcb, client_hostname, sizeof(client_hostname) - 1);
-
-        sprintf(sql, mysqlauth_validate_user_query, session->user, client_hostname,
-                client_hostname, session->db, session->db);
+        char client_hostname[MYSQL_HOST_MAXLEN] = "";
+        int lookup = get_hostname(dcb, client_hostname, sizeof(client_hostname) - 1);
 
-        if (sqlite3_exec(handle, sql, auth_cb, &res, &err) != SQLITE_OK)
+        if (lookup == DNS_LOOKUP_FOUND)
         {
-            MXS_ERROR("Failed to execute auth query: %s", err);
-            sqlite3_free(err);
+            found = find_user(index, session->user, client_hostname, session->db,
+                              output, sizeof(output));
+        }
+        else if (lookup == DNS_LOOKUP_PENDING)
+        {
+            /** Authenticated again once the address has been resolved */
+            index_release(index);
+            return MXS_AUTH_INCOMPLETE;
         }
     }
 
-    if (res.ok)
+    if (found)
     {
         /** Found a matching row */
 
-        if (no_password_required(res.output, session->auth_token_len) ||
-            check_password(res.output, session->auth_token, session->auth_token_len,
+        if (no_password_required(output, session->auth_token_len) ||
+            check_password(output, session->auth_token, session->auth_token_len,
                            scramble, scramble_len, session->client_sha1))
         {
             /** Password is OK, check that the database exists */
-            if (check_database(handle, session->db))
+            if (cached || check_database(index, session->db))
             {
                 rval = MXS_AUTH_SUCCEEDED;
+
+                if (!cached)
+                {
+                    auth_cache_put(index, key, output);
+                }
             }
             else
             {
@@ -255,9 +579,110 @@ int validate_mysql_user(sqlite3 *handle, DCB *dcb, MYSQL_session *session,
         }
     }
 
+    index_release(index);
+
     return rval;
 }
 
+/** Callback for adding the stored users to a new index */
+static int index_user_cb(void *data, int columns, char** rows, char** row_names)
+{
+    MYSQL_USER_INDEX *index = (MYSQL_USER_INDEX*)data;
+    MYSQL_USER_ENTRY *entry = MXS_CALLOC(1, sizeof(MYSQL_USER_ENTRY));
+    const char *user = rows[0] ? rows[0] : "";
+
+    if (entry == NULL ||
+        (entry->host = MXS_STRDUP(rows[1] ? rows[1] : "")) == NULL ||
+        (rows[2] && (entry->db = MXS_STRDUP(rows[2])) == NULL) ||
+        (entry->password = MXS_STRDUP(rows[4] ? rows[4] : "")) == NULL)
+    {
+        free_user_entries(entry);
+        return 1;
+    }
+
+    entry->anydb = rows[3] && strcmp(rows[3], "1") == 0;
+    compile_host(entry);
+
+    MYSQL_USER_ENTRY *head = lfhash_fetch(index->users, (void*)user);
+
+    if (head)
+    {
+        while (head->next)
+        {
+            head = head->next;
+        }
+        head->next = entry;
+    }
+    else if (!lfhash_add(index->users, (void*)user, entry))
+    {
+        free_user_entries(entry);
+        return 1;
+    }
+
+    return 0;
+}
+
+/** Callback for adding the stored databases to a new index */
+static int index_database_cb(void *data, int columns, char** rows, char** row_names)
+{
+    MYSQL_USER_INDEX *index = (MYSQL_USER_INDEX*)data;
+
+    if (rows[0] && lfhash_fetch(index->databases, rows[0]) == NULL &&
+        !lfhash_add(index->databases, rows[0], ""))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+bool mysql_users_index_rebuild(MYSQL_AUTH *instance)
+{
+    MYSQL_USER_INDEX *index = MXS_CALLOC(1, sizeof(MYSQL_USER_INDEX));
+
+    if (index == NULL)
+    {
+        return false;
+    }
+
+    index->refcount = 1;
+    index->users = lfhash_alloc(1000, hashtable_item_strhash, hashtable_item_strcmp);
+    index->databases = lfhash_alloc(100, hashtable_item_strhash, hashtable_item_strcmp);
+    index->cache = auth_cache_alloc();
+    spinlock_init(&index->cache_lock);
+
+    if (index->users == NULL || index->databases == NULL || index->cache == NULL)
+    {
+        index_release(index);
+        return false;
+    }
+
+    lfhash_memory_fns(index->users, hashtable_item_strdup, NULL,
+                      hashtable_item_free, free_user_entries);
+    lfhash_memory_fns(index->databases, hashtable_item_strdup, NULL,
+                      hashtable_item_free, NULL);
+
+    char *err;
+
+    if (sqlite3_exec(instance->handle, dump_users_query, index_user_cb, index, &err) != SQLITE_OK ||
+        sqlite3_exec(instance->handle, dump_databases_query, index_database_cb, index, &err) != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to index the users: %s", err);
+        sqlite3_free(err);
+        index_release(index);
+        return false;
+    }
+
+    spinlock_acquire(&instance->lock);
+    MYSQL_USER_INDEX *old = instance->index;
+    instance->index = index;
+    spinlock_release(&instance->lock);
+
+    index_release(old);
+
+    return true;
+}
+
 /**
  * @brief Delete all users
  *
@@ -657,31 +1082,32 @@ bool check_service_permissions(SERVICE* service)
 }
 
 /**
- * @brief Get client hostname
+ * @brief Resolve the hostname of an address
  *
- * Queries the DNS server for the client's hostname.
+ * Queries the DNS server for the client's hostname. This blocks the calling
+ * thread so it is only done by the resolver thread.
  *
  * @param ip_address      Client IP address
  * @param client_hostname Output buffer for hostname
+ * @param size            Size of @c client_hostname
  *
  * @return True if the hostname query was successful
  */
-static bool get_hostname(DCB *dcb, char *client_hostname, size_t size)
+static bool resolve_hostname(const char *ip_address, char *client_hostname, size_t size)
 {
     struct addrinfo *ai = NULL, hint = {};
     hint.ai_flags = AI_ALL;
     int rc;
 
-    if ((rc = getaddrinfo(dcb->remote, NULL, &hint, &ai)) != 0)
+    if ((rc = getaddrinfo(ip_address, NULL, &hint, &ai)) != 0)
     {
         MXS_ERROR("Failed to obtain address for host %s, %s",
-                  dcb->remote, gai_strerror(rc));
+                  ip_address, gai_strerror(rc));
         return false;
     }
 
     /* Try to lookup the domain name of the given IP-address. This is a slow
-     * i/o-operation, which will stall the entire thread. TODO: cache results
-     * if this feature is used often. */
+     * i/o-operation, which will stall the entire thread. */
     int lookup_result = getnameinfo(ai->ai_addr, ai->ai_addrlen,
                                     client_hostname, size,
                                     NULL, 0, // No need for the port
@@ -701,6 +1127,216 @@ static bool get_hostname(DCB *dcb, char *client_hostname, size_t size)
     return lookup_result == 0;
 }
 
+/** A cached hostname of a client address */
+typedef struct dns_entry
+{
+    char hostname[MYSQL_HOST_MAXLEN]; /**< The hostname, empty if it was not found */
+    bool pending;                     /**< The address is waiting to be resolved */
+    long expires;                     /**< hkheartbeat when the entry expires, 0 if the
+                                       *   address has not been resolved yet */
+} DNS_ENTRY;
+
+/** An address that is waiting to be resolved */
+typedef struct dns_request
+{
+    char *address;
+    struct dns_request *next;
+} DNS_REQUEST;
+
+/**
+ * The hostnames of the client addresses are resolved by a background thread
+ * and shared by all listeners. The worker threads only look the hostnames up
+ * from the cache and queue the addresses that are not in it. An expired
+ * hostname is used until the address has been resolved again.
+ */
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    THREAD          thread;
+    bool            started;
+    HASHTABLE       *hosts;  /**< Address to DNS_ENTRY */
+    DNS_REQUEST     *head;
+    DNS_REQUEST     *tail;
+} dns_cache = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+/** Allocate the table of hostnames, the caller must hold the lock */
+static bool dns_cache_init_hosts()
+{
+    if (dns_cache.hosts == NULL &&
+        (dns_cache.hosts = hashtable_alloc(1000, hashtable_item_strhash, hashtable_item_strcmp)))
+    {
+        hashtable_memory_fns(dns_cache.hosts, hashtable_item_strdup, NULL,
+                             hashtable_item_free, hashtable_item_free);
+    }
+
+    return dns_cache.hosts != NULL;
+}
+
+/**
+ * @brief The main loop of the resolver thread
+ *
+ * @param data Unused
+ */
+static void dns_cache_main(void *data)
+{
+    pthread_mutex_lock(&dns_cache.lock);
+
+    while (true)
+    {
+        while (dns_cache.head == NULL)
+        {
+            pthread_cond_wait(&dns_cache.cond, &dns_cache.lock);
+        }
+
+        DNS_REQUEST *req = dns_cache.head;
+        dns_cache.head = req->next;
+
+        if (dns_cache.head == NULL)
+        {
+            dns_cache.tail = NULL;
+        }
+
+        pthread_mutex_unlock(&dns_cache.lock);
+
+        char hostname[MYSQL_HOST_MAXLEN] = "";
+        bool ok = resolve_hostname(req->address, hostname, sizeof(hostname) - 1);
+
+        pthread_mutex_lock(&dns_cache.lock);
+
+        DNS_ENTRY *entry = dns_cache_init_hosts() ?
+                           hashtable_fetch(dns_cache.hosts, req->address) : NULL;
+
+        if (entry)
+        {
+            strcpy(entry->hostname, ok ? hostname : "");
+            entry->pending = false;
+            entry->expires = hkheartbeat + (ok ? MYSQLAUTH_DNS_TTL : MYSQLAUTH_DNS_NEGATIVE_TTL) * 10;
+        }
+
+        MXS_FREE(req->address);
+        MXS_FREE(req);
+    }
+}
+
+/**
+ * @brief Queue an address for the resolver thread, the caller must hold the lock
+ *
+ * @param address The client address
+ * @return True if the address was queued
+ */
+static bool dns_cache_queue(const char *address)
+{
+    if (!dns_cache.started)
+    {
+        dns_cache.started = thread_start(&dns_cache.thread, dns_cache_main, NULL) != NULL;
+
+        if (!dns_cache.started)
+        {
+            MXS_ERROR("Failed to start the thread that resolves client hostnames.");
+            return false;
+        }
+    }
+
+    DNS_REQUEST *req = MXS_CALLOC(1, sizeof(DNS_REQUEST));
+
+    if (req == NULL || (req->address = MXS_STRDUP(address)) == NULL)
+    {
+        MXS_FREE(req);
+        return false;
+    }
+
+    if (dns_cache.tail)
+    {
+        dns_cache.tail->next = req;
+    }
+    else
+    {
+        dns_cache.head = req;
+    }
+
+    dns_cache.tail = req;
+    pthread_cond_signal(&dns_cache.cond);
+    return true;
+}
+
+/**
+ * @brief Add an address that has not been resolved, the caller must hold the lock
+ *
+ * @param address The client address
+ * @return The new entry or NULL on error
+ */
+static DNS_ENTRY *dns_cache_add(const char *address)
+{
+    /** Start over when the cache is full, most of the entries have usually expired */
+    if (dns_cache.hosts && hashtable_size(dns_cache.hosts) >= MYSQLAUTH_DNS_MAX_ENTRIES)
+    {
+        hashtable_free(dns_cache.hosts);
+        dns_cache.hosts = NULL;
+    }
+
+    DNS_ENTRY *entry = MXS_CALLOC(1, sizeof(DNS_ENTRY));
+
+    if (entry == NULL || !dns_cache_init_hosts() ||
+        !hashtable_add(dns_cache.hosts, (void*)address, entry))
+    {
+        MXS_FREE(entry);
+        return NULL;
+    }
+
+    return entry;
+}
+
+/**
+ * @brief Get client hostname
+ *
+ * The hostname is looked up from the cache of resolved addresses. An address
+ * that is not in the cache is queued for the resolver thread. An expired
+ * entry is queued too but its hostname is used until the new one is known.
+ *
+ * @param dcb             Client DCB
+ * @param client_hostname Output buffer for hostname
+ * @param size            Size of @c client_hostname
+ *
+ * @return DNS_LOOKUP_FOUND if the hostname of the client is known,
+ *         DNS_LOOKUP_PENDING if the address is being resolved for the first
+ *         time and DNS_LOOKUP_NONE otherwise
+ */
+static int get_hostname(DCB *dcb, char *client_hostname, size_t size)
+{
+    int rval = DNS_LOOKUP_NONE;
+
+    pthread_mutex_lock(&dns_cache.lock);
+
+    DNS_ENTRY *entry = dns_cache.hosts ? hashtable_fetch(dns_cache.hosts, dcb->remote) : NULL;
+
+    if (entry == NULL)
+    {
+        if ((entry = dns_cache_add(dcb->remote)))
+        {
+            entry->pending = dns_cache_queue(dcb->remote);
+        }
+    }
+    else if (!entry->pending && entry->expires <= hkheartbeat)
+    {
+        entry->pending = dns_cache_queue(dcb->remote);
+    }
+
+    if (entry && *entry->hostname)
+    {
+        snprintf(client_hostname, size, "%s", entry->hostname);
+        rval = DNS_LOOKUP_FOUND;
+    }
+    else if (entry && entry->pending && entry->expires == 0)
+    {
+        rval = DNS_LOOKUP_PENDING;
+    }
+
+    pthread_mutex_unlock(&dns_cache.lock);
+
+    return rval;
+}
+
 void start_sqlite_transaction(sqlite3 *handle)
 {
     char *err;
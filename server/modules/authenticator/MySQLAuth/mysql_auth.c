@@ -30,10 +30,13 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/authenticator.h>
 #include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
 #include <maxscale/poll.h>
 #include <maxscale/paths.h>
 #include <maxscale/secrets.h>
+#include <maxscale/thread.h>
 #include <maxscale/utils.h>
+#include <pthread.h>
 
 static void* mysql_auth_init(char **options);
 static int mysql_auth_set_protocol_data(DCB *dcb, GWBUF *buf);
@@ -150,23 +153,6 @@ static bool open_instance_database(const char *path, sqlite3 **handle)
     return true;
 }
 
-static bool open_client_database(const char *path, sqlite3 **handle)
-{
-    bool rval = false;
-
-    if (sqlite3_open_v2(path, handle, db_flags, NULL) == SQLITE_OK)
-    {
-        sqlite3_busy_timeout(*handle, MXS_SQLITE_BUSY_TIMEOUT);
-        rval = true;
-    }
-    else
-    {
-        MXS_ERROR("Failed to open SQLite3 handle.");
-    }
-
-    return rval;
-}
-
 /**
  * @brief Initialize the authenticator instance
  *
@@ -183,7 +169,14 @@ static void* mysql_auth_init(char **options)
         instance->cache_dir = NULL;
         instance->inject_service_user = true;
         instance->skip_auth = false;
+        instance->warm_start = false;
+        instance->warm_refresh = false;
         instance->handle = NULL;
+        instance->index = NULL;
+        spinlock_init(&instance->lock);
+        instance->port = NULL;
+        instance->reload_pending = false;
+        instance->next_reload = NULL;
 
         for (int i = 0; options[i]; i++)
         {
@@ -209,6 +202,10 @@ static void* mysql_auth_init(char **options)
                 {
                     instance->skip_auth = config_truth_value(value);
                 }
+                else if (strcmp(options[i], "warm_start") == 0)
+                {
+                    instance->warm_start = config_truth_value(value);
+                }
                 else
                 {
                     MXS_ERROR("Unknown authenticator option: %s", options[i]);
@@ -233,13 +230,72 @@ static void* mysql_auth_init(char **options)
     return instance;
 }
 
+/**
+ * @brief Process the handshake response of a client again
+ *
+ * Called by the timer of the client DCB in the thread that owns it.
+ *
+ * @param timer The timer
+ * @param data  The authenticator data of the client DCB
+ */
+static void mysql_auth_replay_cb(MXS_TIMER *timer, void *data)
+{
+    mysql_auth_t *auth = (mysql_auth_t*)data;
+    GWBUF *packet = auth->packet;
+    auth->packet = NULL;
+
+    if (packet && auth->dcb->state == DCB_STATE_POLLING)
+    {
+        poll_add_epollin_event_to_dcb(auth->dcb, packet);
+    }
+    else
+    {
+        gwbuf_free(packet);
+    }
+}
+
+/**
+ * @brief Hold the authentication of a client until its hostname is known
+ *
+ * The handshake response is processed again after a while, until the
+ * address of the client has been resolved or MYSQLAUTH_DNS_WAIT seconds
+ * have passed.
+ *
+ * @param dcb Client DCB
+ * @return True if the authentication is held, false if it has waited for too long
+ */
+static bool mysql_auth_wait_hostname(DCB *dcb)
+{
+    mysql_auth_t *auth = (mysql_auth_t*)dcb->authenticator_data;
+
+    if (auth == NULL || auth->packet == NULL)
+    {
+        return false;
+    }
+
+    if (auth->hostname_deadline == 0)
+    {
+        auth->hostname_deadline = hkheartbeat + MYSQLAUTH_DNS_WAIT * 10;
+    }
+    else if (hkheartbeat >= auth->hostname_deadline)
+    {
+        MXS_WARNING("The hostname of client %s was not resolved in %d seconds.",
+                    dcb->remote, MYSQLAUTH_DNS_WAIT);
+        return false;
+    }
+
+    auth->dcb = dcb;
+    mxs_timer_add(&auth->timer, 1);
+    return true;
+}
+
 static void* mysql_auth_create(void *instance)
 {
-    mysql_auth_t *rval = MXS_MALLOC(sizeof(*rval));
+    mysql_auth_t *rval = MXS_CALLOC(1, sizeof(*rval));
 
     if (rval)
     {
-        rval->handle = NULL;
+        mxs_timer_init(&rval->timer, mysql_auth_replay_cb, rval);
     }
 
     return rval;
@@ -250,11 +306,121 @@ static void mysql_auth_destroy(void *data)
     mysql_auth_t *auth = (mysql_auth_t*)data;
     if (auth)
     {
+        mxs_timer_cancel(&auth->timer);
+        gwbuf_free(auth->packet);
         sqlite3_close_v2(auth->handle);
         MXS_FREE(auth);
     }
 }
 
+/**
+ * The users are reloaded after failed authentications by a background thread
+ * so that the worker threads don't wait for the backend servers. The requests
+ * of an instance are coalesced until its reload is done and the service limits
+ * how often the users are loaded. With warm_start, the same thread replaces
+ * the persisted users of a listener after it has started.
+ */
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    THREAD          thread;
+    bool            started;
+    MYSQL_AUTH      *head;
+    MYSQL_AUTH      *tail;
+} reload_queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+/**
+ * @brief The main loop of the reload thread
+ *
+ * @param data Unused
+ */
+static void reload_main(void *data)
+{
+    pthread_mutex_lock(&reload_queue.lock);
+
+    while (true)
+    {
+        while (reload_queue.head == NULL)
+        {
+            pthread_cond_wait(&reload_queue.cond, &reload_queue.lock);
+        }
+
+        MYSQL_AUTH *instance = reload_queue.head;
+        reload_queue.head = instance->next_reload;
+
+        if (reload_queue.head == NULL)
+        {
+            reload_queue.tail = NULL;
+        }
+
+        instance->next_reload = NULL;
+        bool warm_refresh = instance->warm_refresh;
+        instance->warm_refresh = false;
+        pthread_mutex_unlock(&reload_queue.lock);
+
+        SERVICE *service = instance->port->service;
+
+        if (!service->svc_do_shutdown && warm_refresh)
+        {
+            /** Only this listener is loaded, the others may still be starting */
+            mysql_auth_load_users(instance->port);
+        }
+        else if (!service->svc_do_shutdown && service_refresh_users(service) == 0)
+        {
+            MXS_INFO("[%s] Reloaded users after a failed authentication.", service->name);
+        }
+
+        pthread_mutex_lock(&reload_queue.lock);
+        instance->reload_pending = false;
+    }
+}
+
+/**
+ * @brief Request the users of a listener to be reloaded in the background
+ *
+ * Nothing is done if a reload is already queued or running for the listener.
+ *
+ * @param instance Authenticator instance
+ * @param port     The listener
+ * @param warm     Replace the persisted users of only this listener
+ */
+static void request_reload(MYSQL_AUTH *instance, SERV_LISTENER *port, bool warm)
+{
+    pthread_mutex_lock(&reload_queue.lock);
+
+    if (!reload_queue.started)
+    {
+        reload_queue.started = thread_start(&reload_queue.thread, reload_main, NULL) != NULL;
+
+        if (!reload_queue.started)
+        {
+            MXS_ERROR("Failed to start the thread that reloads the users.");
+        }
+    }
+
+    if (reload_queue.started && !instance->reload_pending)
+    {
+        instance->reload_pending = true;
+        instance->warm_refresh = warm;
+        instance->port = port;
+
+        if (reload_queue.tail)
+        {
+            reload_queue.tail->next_reload = instance;
+        }
+        else
+        {
+            reload_queue.head = instance;
+        }
+
+        reload_queue.tail = instance;
+        pthread_cond_signal(&reload_queue.cond);
+    }
+
+    pthread_mutex_unlock(&reload_queue.lock);
+}
+
 static bool is_localhost_address(struct sockaddr_storage *addr)
 {
     bool rval = false;
@@ -329,15 +495,27 @@ mysql_auth_authenticate(DCB *dcb)
 
         MYSQL_AUTH *instance = (MYSQL_AUTH*)dcb->listener->auth_instance;
 
-        auth_ret = validate_mysql_user(instance->handle, dcb, client_data,
+        auth_ret = validate_mysql_user(instance, dcb, client_data,
                                        protocol->scramble, sizeof(protocol->scramble));
 
-        if (auth_ret != MXS_AUTH_SUCCEEDED &&
-            !instance->skip_auth &&
-            service_refresh_users(dcb->service) == 0)
+        if (auth_ret == MXS_AUTH_INCOMPLETE)
+        {
+            if (!instance->skip_auth && mysql_auth_wait_hostname(dcb))
+            {
+                /** The client is authenticated once its address has been resolved */
+                MXS_FREE(client_data->auth_token);
+                client_data->auth_token = NULL;
+                return MXS_AUTH_INCOMPLETE;
+            }
+
+            auth_ret = MXS_AUTH_FAILED;
+        }
+
+        if (auth_ret != MXS_AUTH_SUCCEEDED && !instance->skip_auth)
         {
-            auth_ret = validate_mysql_user(instance->handle, dcb, client_data,
-                                           protocol->scramble, sizeof(protocol->scramble));
+            /** The user may have been added after the users were loaded. The
+             * client can connect again once they have been reloaded. */
+            request_reload(instance, dcb->listener, false);
         }
 
         /* on successful authentication, set user into dcb field */
@@ -394,18 +572,6 @@ mysql_auth_set_protocol_data(DCB *dcb, GWBUF *buf)
     MySQLProtocol *protocol = NULL;
     MYSQL_session *client_data = NULL;
     int client_auth_packet_size = 0;
-    mysql_auth_t *auth_ses = (mysql_auth_t*)dcb->authenticator_data;
-
-    if (auth_ses->handle == NULL)
-    {
-        char path[PATH_MAX];
-        get_database_path(dcb->listener, path, sizeof(path));
-
-        if (!open_client_database(path, &auth_ses->handle))
-        {
-            return MXS_AUTH_FAILED;
-        }
-    }
 
     protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
     CHK_PROTOCOL(protocol);
@@ -434,6 +600,15 @@ mysql_auth_set_protocol_data(DCB *dcb, GWBUF *buf)
         return MXS_AUTH_FAILED;
     }
 
+    mysql_auth_t *auth = (mysql_auth_t*)dcb->authenticator_data;
+
+    if (auth)
+    {
+        /** Kept in case the authentication waits for the hostname of the client */
+        gwbuf_free(auth->packet);
+        auth->packet = gwbuf_clone(buf);
+    }
+
     return mysql_auth_set_client_data(client_data, protocol, buf);
 }
 
@@ -593,10 +768,37 @@ static bool add_service_user(SERV_LISTENER *port)
     return rval;
 }
 
+/**
+ * @brief Start with the users that were persisted by the previous run
+ *
+ * The users of the listener are replaced in the background with the ones
+ * on the backend servers.
+ *
+ * @param port Listener definition
+ * @return True if the persisted users are used
+ */
+static bool warm_start_users(SERV_LISTENER *port)
+{
+    MYSQL_AUTH *instance = (MYSQL_AUTH*)port->auth_instance;
+
+    if (!mysql_users_index_rebuild(instance) || lfhash_size(instance->index->users) == 0)
+    {
+        return false;
+    }
+
+    MXS_NOTICE("[%s] Using %d persisted users for listener %s, the users are "
+               "refreshed in the background.", port->service->name,
+               lfhash_size(instance->index->users), port->name);
+    request_reload(instance, port, true);
+    return true;
+}
+
 /**
  * @brief Load MySQL authentication users
  *
- * This function loads MySQL users from the backend database.
+ * This function loads MySQL users from the backend database. With warm_start,
+ * the first load uses the users that were persisted by the previous run and
+ * later loads keep them if no server can be read.
  *
  * @param port Listener definition
  * @return MXS_AUTH_LOADUSERS_OK on success, MXS_AUTH_LOADUSERS_ERROR and
@@ -619,15 +821,35 @@ static int mysql_auth_load_users(SERV_LISTENER *port)
         {
             return MXS_AUTH_LOADUSERS_FATAL;
         }
+
+        if (instance->warm_start && warm_start_users(port))
+        {
+            return rc;
+        }
     }
 
+    /** The persisted users are only replaced if the new ones could be read */
+    bool transaction = instance->warm_start &&
+                       sqlite3_exec(instance->handle, "BEGIN", NULL, NULL, NULL) == SQLITE_OK;
+
     int loaded = replace_mysql_users(port, skip_local);
 
+    if (transaction)
+    {
+        sqlite3_exec(instance->handle, loaded < 0 ? "ROLLBACK" : "COMMIT", NULL, NULL, NULL);
+    }
+
     if (loaded < 0)
     {
         MXS_ERROR("[%s] Unable to load users for listener %s listening at [%s]:%d.", service->name,
                   port->name, port->address ? port->address : "::", port->port);
 
+        if (transaction)
+        {
+            MXS_NOTICE("[%s] Using the previously loaded users of listener %s.",
+                       service->name, port->name);
+        }
+
         if (instance->inject_service_user)
         {
             /** Inject the service user as a 'backup' user that's available
@@ -639,6 +861,12 @@ static int mysql_auth_load_users(SERV_LISTENER *port)
         }
     }
 
+    if (!mysql_users_index_rebuild(instance))
+    {
+        MXS_ERROR("[%s] Failed to index the users of listener %s, the previously "
+                  "loaded users are used.", service->name, port->name);
+    }
+
     if (loaded == 0 && !skip_local)
     {
         MXS_WARNING("[%s]: failed to load any user information. Authentication"
@@ -667,7 +895,7 @@ int mysql_auth_reauthenticate(DCB *dcb, const char *user,
     temp.auth_token_len = token_len;
 
     MYSQL_AUTH *instance = (MYSQL_AUTH*)dcb->listener->auth_instance;
-    int rc = validate_mysql_user(instance->handle, dcb, &temp, scramble, scramble_len);
+    int rc = validate_mysql_user(instance, dcb, &temp, scramble, scramble_len);
 
     if (rc == MXS_AUTH_SUCCEEDED)
     {
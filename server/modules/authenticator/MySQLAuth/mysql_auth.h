@@ -32,8 +32,12 @@
 #include <maxscale/authenticator.h>
 #include <maxscale/dcb.h>
 #include <maxscale/buffer.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/lfhash.h>
 #include <maxscale/service.h>
+#include <maxscale/spinlock.h>
 #include <maxscale/sqlite3.h>
+#include <maxscale/timer.h>
 #include <maxscale/protocol/mysql.h>
 
 MXS_BEGIN_DECLS
@@ -60,16 +64,6 @@ static const char databases_create_sql[] =
 /** PRAGMA configuration options for SQLite */
 static const char pragma_sql[] = "PRAGMA JOURNAL_MODE=MEMORY";
 
-/** Query that checks if there's a grant for the user being authenticated */
-static const char mysqlauth_validate_user_query[] =
-    "SELECT password FROM " MYSQLAUTH_USERS_TABLE_NAME
-    " WHERE user = '%s' AND ( '%s' = host OR '%s' LIKE host) AND (anydb = '1' OR '%s' = '' OR '%s' LIKE db)"
-    " LIMIT 1";
-
-/** Query that checks that the database exists */
-static const char mysqlauth_validate_database_query[] =
-    "SELECT * FROM " MYSQLAUTH_DATABASES_TABLE_NAME " WHERE db = '%s' LIMIT 1";
-
 /** Delete query used to clean up the database before loading new users */
 static const char delete_users_query[] = "DELETE FROM " MYSQLAUTH_USERS_TABLE_NAME;
 
@@ -98,18 +92,86 @@ static int db_flags = SQLITE_OPEN_READWRITE |
                       SQLITE_OPEN_CREATE |
                       SQLITE_OPEN_SHAREDCACHE;
 
+/** How the host of a user entry is matched */
+enum mysql_host_match
+{
+    MYSQL_HOST_ANY,     /**< The host is '%' and matches all clients */
+    MYSQL_HOST_IPV4,    /**< An IPv4 address where whole octets can be wildcards */
+    MYSQL_HOST_PATTERN  /**< Any other host, matched like the SQL LIKE operator */
+};
+
+/** A user entry in the in-memory index of the users */
+typedef struct mysql_user_entry
+{
+    char *host;                    /**< The host of the grant */
+    enum mysql_host_match match;   /**< How the host is matched */
+    uint32_t network;              /**< Network address of IPv4 hosts, in host byte order */
+    uint32_t netmask;              /**< Netmask of IPv4 hosts, in host byte order */
+    char *db;                      /**< Database pattern of the grant or NULL */
+    bool anydb;                    /**< Global access to databases */
+    char *password;                /**< Hexadecimal password hash, empty if none */
+    struct mysql_user_entry *next; /**< The next entry of the same user */
+} MYSQL_USER_ENTRY;
+
+/** How long a successful authentication is remembered, in seconds */
+#define MYSQLAUTH_CACHE_TTL 10
+
+/** How many successful authentications are remembered per listener */
+#define MYSQLAUTH_CACHE_MAX_ENTRIES 10000
+
+/** How long a client whose address is resolved for the first time waits for
+ * its hostname, in seconds */
+#define MYSQLAUTH_DNS_WAIT 5
+
+/** A remembered successful authentication */
+typedef struct mysql_auth_cache_entry
+{
+    char password[SHA_DIGEST_LENGTH * 2 + 1]; /**< Password of the matching user entry */
+    long expires;                             /**< hkheartbeat when the entry expires */
+} MYSQL_AUTH_CACHE_ENTRY;
+
+/**
+ * The in-memory index of the users that the clients are authenticated against.
+ * The index is built from the SQLite database whenever the users are loaded
+ * and it is not modified afterwards, which is why the worker threads look
+ * the users and databases up from tables with lock-free reads. The entries of
+ * a user are in the order they were loaded in and the first matching one is
+ * used. The cache of the successful authentications is dropped with the index
+ * when users are reloaded.
+ */
+typedef struct mysql_user_index
+{
+    LFHASH    *users;     /**< User name to a list of MYSQL_USER_ENTRY */
+    LFHASH    *databases; /**< Names of the databases */
+    HASHTABLE *cache;     /**< User, client address and database of successful
+                           * authentications to a MYSQL_AUTH_CACHE_ENTRY */
+    SPINLOCK cache_lock;  /**< Protects the cache */
+    int refcount;         /**< Number of references to the index */
+} MYSQL_USER_INDEX;
+
 typedef struct mysql_auth
 {
     sqlite3 *handle;          /**< SQLite3 database handle */
+    SPINLOCK lock;            /**< Protects the index pointer */
+    MYSQL_USER_INDEX *index;  /**< The in-memory index of the users */
     char *cache_dir;          /**< Custom cache directory location */
     bool inject_service_user; /**< Inject the service user into the list of users */
     bool skip_auth;           /**< Authentication will always be successful */
+    bool warm_start;          /**< Start with the persisted users and refresh them later */
+    bool warm_refresh;        /**< The queued reload replaces the persisted users */
+    SERV_LISTENER *port;      /**< The listener that a background reload is done for */
+    bool reload_pending;      /**< A background reload of the users is queued or running */
+    struct mysql_auth *next_reload; /**< The next instance in the reload queue */
 } MYSQL_AUTH;
 
 /** Common structure for both backend and client authenticators */
 typedef struct gssapi_auth
 {
     sqlite3 *handle;              /**< SQLite3 database handle */
+    DCB *dcb;                     /**< The client DCB that waits for its hostname */
+    GWBUF *packet;                /**< The handshake response, replayed when the hostname is known */
+    long hostname_deadline;       /**< hkheartbeat when the hostname is no longer waited for */
+    MXS_TIMER timer;              /**< Replays the handshake response */
 } mysql_auth_t;
 
 /**
@@ -178,18 +240,33 @@ bool dbusers_save(sqlite3 *src, const char *filename);
  */
 int replace_mysql_users(SERV_LISTENER *listener, bool skip_local);
 
+/**
+ * @brief Rebuild the in-memory index of the users
+ *
+ * The index is built from the users and databases that are stored in the
+ * SQLite database and it then replaces the current index. The clients that
+ * are being authenticated keep using the old index until they are done.
+ *
+ * @param instance Authenticator instance
+ *
+ * @return True if the index was replaced, false if it could not be built
+ */
+bool mysql_users_index_rebuild(MYSQL_AUTH *instance);
+
 /**
  * @brief Verify the user has access to the database
  *
- * @param handle       SQLite handle to MySQLAuth user database
+ * @param instance     Authenticator instance
  * @param dcb          Client DCB
  * @param session      Shared MySQL session
  * @param scramble     The scramble sent to the client in the initial handshake
  * @param scramble_len Length of @c scramble
  *
- * @return MXS_AUTH_SUCCEEDED if the user has access to the database
+ * @return MXS_AUTH_SUCCEEDED if the user has access to the database or
+ *         MXS_AUTH_INCOMPLETE if the user can only be found once the hostname
+ *         of the client has been resolved
  */
-int validate_mysql_user(sqlite3 *handle, DCB *dcb, MYSQL_session *session,
+int validate_mysql_user(MYSQL_AUTH *instance, DCB *dcb, MYSQL_session *session,
                          uint8_t *scramble, size_t scramble_len);
 
 MXS_END_DECLS
@@ -16,9 +16,9 @@
 #include <new>
 #include <set>
 #include <string>
-#include <zlib.h>
 #include <maxscale/alloc.h>
 #include <maxscale/buffer.h>
+#include <maxscale/digest.h>
 #include <maxscale/modutil.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/paths.h>
@@ -36,6 +36,10 @@ Cache::Cache(const std::string&  name,
     , m_sRules(sRules)
     , m_sFactory(sFactory)
 {
+    if (m_config.statistics)
+    {
+        m_sStats.reset(new CacheStats);
+    }
 }
 
 Cache::~Cache()
@@ -82,6 +86,18 @@ bool Cache::Create(const CACHE_CONFIG& config,
     return pFactory != NULL;
 }
 
+bool Cache::save_snapshot(const char* zPath)
+{
+    MXS_WARNING("The cache '%s' cannot save snapshots.", m_name.c_str());
+    return false;
+}
+
+bool Cache::load_snapshot(const char* zPath)
+{
+    MXS_WARNING("The cache '%s' cannot load snapshots.", m_name.c_str());
+    return false;
+}
+
 void Cache::show(DCB* pDcb) const
 {
     bool showed = false;
@@ -110,18 +126,42 @@ void Cache::show(DCB* pDcb) const
     }
 }
 
-cache_result_t Cache::get_key(const char* zDefault_db,
+cache_result_t Cache::get_key(const char* zUser,
+                              const char* zHost,
+                              const char* zState,
+                              const char* zDefault_db,
                               const GWBUF* pQuery,
                               CACHE_KEY* pKey) const
 {
-    // TODO: Take config into account.
-    return get_default_key(zDefault_db, pQuery, pKey);
+    MXS_DIGEST hash = { 0, 0 };
+
+    if (m_config.users == CACHE_USERS_ISOLATED)
+    {
+        // The results of a user are not shared with other users.
+        hash_string(zUser, &hash);
+        hash_string(zHost, &hash);
+    }
+
+    return create_key(hash, zState, zDefault_db, pQuery, pKey);
 }
 
 //static
-cache_result_t Cache::get_default_key(const char* zDefault_db,
+cache_result_t Cache::get_default_key(const char* zState,
+                                      const char* zDefault_db,
                                       const GWBUF* pQuery,
                                       CACHE_KEY* pKey)
+{
+    MXS_DIGEST hash = { 0, 0 };
+
+    return create_key(hash, zState, zDefault_db, pQuery, pKey);
+}
+
+//static
+cache_result_t Cache::create_key(MXS_DIGEST hash,
+                                 const char* zState,
+                                 const char* zDefault_db,
+                                 const GWBUF* pQuery,
+                                 CACHE_KEY* pKey)
 {
     ss_dassert(GWBUF_IS_CONTIGUOUS(pQuery));
 
@@ -130,24 +170,27 @@ cache_result_t Cache::get_default_key(const char* zDefault_db,
 
     modutil_extract_SQL(const_cast<GWBUF*>(pQuery), &pSql, &length);
 
-    uint64_t crc1 = crc32(0, Z_NULL, 0);
+    // Every part is hashed, even if missing, so that a part can not be
+    // mistaken for another.
+    hash_string(zState, &hash);
+    hash_string(zDefault_db, &hash);
 
-    const Bytef* pData;
+    // The exact statement is hashed and not its digest, as statements that
+    // differ only by their literals have different results.
+    mxs_digest_hash(pSql, length, hash.hi ^ hash.lo, &hash);
 
-    if (zDefault_db)
-    {
-        pData = reinterpret_cast<const Bytef*>(zDefault_db);
-        crc1 = crc32(crc1, pData, strlen(zDefault_db));
-    }
+    pKey->hi = hash.hi;
+    pKey->lo = hash.lo;
 
-    pData = reinterpret_cast<const Bytef*>(pSql);
-
-    crc1 = crc32(crc1, pData, length);
-    uint64_t crc2 = crc32(crc1, pData, length);
+    return CACHE_RESULT_OK;
+}
 
-    pKey->data = (crc1 << 32 | crc2);
+//static
+void Cache::hash_string(const char* z, MXS_DIGEST* pHash)
+{
+    z = z ? z : "";
 
-    return CACHE_RESULT_OK;
+    mxs_digest_hash(z, strlen(z), pHash->hi ^ pHash->lo, pHash);
 }
 
 bool Cache::should_store(const char* zDefaultDb, const GWBUF* pQuery)
@@ -172,6 +215,16 @@ json_t* Cache::do_get_info(uint32_t what) const
 
             json_object_set(pInfo, "rules", pRules); // Increases ref-count of pRules, we ignore failure.
         }
+
+        if ((what & INFO_STATISTICS) && m_sStats.get())
+        {
+            json_t* pStatistics = m_sStats->get_info();
+
+            if (pStatistics)
+            {
+                json_object_set_new(pInfo, "statistics", pStatistics);
+            }
+        }
     }
 
     return pInfo;
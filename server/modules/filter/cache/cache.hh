@@ -15,10 +15,14 @@
 #include <maxscale/cppdefs.hh>
 #include <tr1/functional>
 #include <tr1/memory>
+#include <memory>
 #include <string>
+#include <vector>
 #include <maxscale/buffer.h>
+#include <maxscale/digest.h>
 #include <maxscale/session.h>
 #include "cachefilter.h"
+#include "cachestats.hh"
 #include "cache_storage_api.h"
 
 class CacheFilterSession;
@@ -29,10 +33,11 @@ class Cache
 public:
     enum what_info_t
     {
-        INFO_RULES   = 0x01, /*< Include information about the rules. */
-        INFO_PENDING = 0x02, /*< Include information about any pending items. */
-        INFO_STORAGE = 0x04, /*< Include information about the storage. */
-        INFO_ALL     = (INFO_RULES | INFO_PENDING | INFO_STORAGE)
+        INFO_RULES      = 0x01, /*< Include information about the rules. */
+        INFO_PENDING    = 0x02, /*< Include information about any pending items. */
+        INFO_STORAGE    = 0x04, /*< Include information about the storage. */
+        INFO_STATISTICS = 0x08, /*< Include the per table statistics. */
+        INFO_ALL        = (INFO_RULES | INFO_PENDING | INFO_STORAGE | INFO_STATISTICS)
     };
 
     typedef std::tr1::shared_ptr<CacheRules> SCacheRules;
@@ -47,6 +52,16 @@ public:
         return m_config;
     }
 
+    /**
+     * Returns the statistics of the cache.
+     *
+     * @return The statistics, or NULL if statistics are not collected.
+     */
+    CacheStats* stats()
+    {
+        return m_sStats.get();
+    }
+
     virtual json_t* get_info(uint32_t what = INFO_ALL) const = 0;
 
     /**
@@ -89,13 +104,19 @@ public:
     /**
      * Returns a key for the statement. Takes the current config into account.
      *
+     * @param zUser        The user of the session.
+     * @param zHost        The host of the user.
+     * @param zState       The session state the result depends upon, can be NULL.
      * @param zDefault_db  The default database, can be NULL.
      * @param pQuery       A statement.
      * @param pKey         On output a key.
      *
      * @return CACHE_RESULT_OK if a key could be created.
      */
-    cache_result_t get_key(const char* zDefault_db,
+    cache_result_t get_key(const char* zUser,
+                           const char* zHost,
+                           const char* zState,
+                           const char* zDefault_db,
                            const GWBUF* pQuery,
                            CACHE_KEY* pKey) const;
 
@@ -103,13 +124,15 @@ public:
      * Returns a key for the statement. Does not take the current config
      * into account.
      *
+     * @param zState       The session state the result depends upon, can be NULL.
      * @param zDefault_db  The default database, can be NULL.
      * @param pQuery       A statement.
      * @param pKey         On output a key.
      *
      * @return CACHE_RESULT_OK if a key could be created.
      */
-    static cache_result_t get_default_key(const char* zDefault_db,
+    static cache_result_t get_default_key(const char* zState,
+                                          const char* zDefault_db,
                                           const GWBUF* pQuery,
                                           CACHE_KEY* pKey);
 
@@ -123,13 +146,42 @@ public:
     /**
      * See @Storage::put_value
      */
-    virtual cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue) = 0;
+    virtual cache_result_t put_value(const CACHE_KEY& key,
+                                     const std::vector<std::string>& invalidation_words,
+                                     const GWBUF* pValue) = 0;
 
     /**
      * See @Storage::del_value
      */
     virtual cache_result_t del_value(const CACHE_KEY& key) = 0;
 
+    /**
+     * See @Storage::invalidate
+     */
+    virtual cache_result_t invalidate(const std::vector<std::string>& words) = 0;
+
+    /**
+     * Save the cached values to a snapshot. The default implementation
+     * logs a warning and returns false.
+     *
+     * @param zPath  The path of the snapshot.
+     *
+     * @return True, if the snapshot could be saved.
+     */
+    virtual bool save_snapshot(const char* zPath);
+
+    /**
+     * Load the cached values from a snapshot. A cache may load the snapshot
+     * asynchronously, in which case the return value only tells whether the
+     * loading could be started. The default implementation logs a warning
+     * and returns false.
+     *
+     * @param zPath  The path of the snapshot.
+     *
+     * @return True, if the snapshot could be loaded.
+     */
+    virtual bool load_snapshot(const char* zPath);
+
 protected:
     Cache(const std::string&  name,
           const CACHE_CONFIG* pConfig,
@@ -146,9 +198,18 @@ private:
     Cache(const Cache&);
     Cache& operator = (const Cache&);
 
+    static cache_result_t create_key(MXS_DIGEST hash,
+                                     const char* zState,
+                                     const char* zDefault_db,
+                                     const GWBUF* pQuery,
+                                     CACHE_KEY* pKey);
+
+    static void hash_string(const char* z, MXS_DIGEST* pHash);
+
 protected:
-    const std::string   m_name;     // The name of the instance; the section name in the config.
-    const CACHE_CONFIG& m_config;   // The configuration of the cache instance.
-    SCacheRules         m_sRules;   // The rules of the cache instance.
-    SStorageFactory     m_sFactory; // The storage factory.
+    const std::string         m_name;     // The name of the instance; the section name in the config.
+    const CACHE_CONFIG&       m_config;   // The configuration of the cache instance.
+    SCacheRules               m_sRules;   // The rules of the cache instance.
+    SStorageFactory           m_sFactory; // The storage factory.
+    std::auto_ptr<CacheStats> m_sStats;   // The statistics, if collected.
 };
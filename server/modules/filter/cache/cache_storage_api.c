@@ -17,9 +17,9 @@
 size_t cache_key_hash(const CACHE_KEY* key)
 {
     ss_dassert(key);
-    ss_dassert(sizeof(key->data) == sizeof(size_t));
 
-    return key->data;
+    // The bits of the key are already well mixed.
+    return key->hi ^ key->lo;
 }
 
 bool cache_key_equal_to(const CACHE_KEY* lhs, const CACHE_KEY* rhs)
@@ -27,7 +27,7 @@ bool cache_key_equal_to(const CACHE_KEY* lhs, const CACHE_KEY* rhs)
     ss_dassert(lhs);
     ss_dassert(rhs);
 
-    return lhs->data == rhs->data;
+    return (lhs->hi == rhs->hi) && (lhs->lo == rhs->lo);
 }
 
 
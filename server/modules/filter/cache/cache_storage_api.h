@@ -58,11 +58,25 @@ typedef enum cache_thread_model
     CACHE_THREAD_MODEL_MT
 } cache_thread_model_t;
 
+typedef enum cache_invalidate
+{
+    CACHE_INVALIDATE_NEVER,
+    CACHE_INVALIDATE_CURRENT,
+    CACHE_INVALIDATE_BINLOG
+} cache_invalidate_t;
+
+typedef enum cache_eviction
+{
+    CACHE_EVICTION_LRU,    /*< Every value is stored, the least recently used is evicted. */
+    CACHE_EVICTION_TINYLFU /*< A new value is only stored if it is used more often than the evicted. */
+} cache_eviction_t;
+
 typedef void* CACHE_STORAGE;
 
 typedef struct cache_key
 {
-    uint64_t data;
+    uint64_t hi; /*< The upper 64 bits of the 128-bit key. */
+    uint64_t lo; /*< The lower 64 bits of the 128-bit key. */
 } CACHE_KEY;
 
 /**
@@ -138,8 +152,50 @@ typedef struct cache_storage_config_t
      * specify 0, unless CACHE_STORAGE_CAP_MAX_SIZE is returned at initialization.
      */
     uint64_t max_size;
+
+    /**
+     * Specifies whether items should be invalidated when the tables they
+     * were read from are modified. The invalidation is performed by the cache
+     * and a storage need not do anything about it.
+     */
+    cache_invalidate_t invalidate;
+
+    /**
+     * The maximum percentage by which the time-to-live of a value is shortened.
+     * The time-to-live of each value is shortened by an amount that depends on
+     * the key of the value, so that values stored at the same time do not all
+     * expire at the same time. A value of 0 means that there is no jitter.
+     */
+    uint32_t ttl_jitter;
+
+    /**
+     * How values are admitted when the storage is full. The admission is
+     * performed by the LRU storage with which the cache wraps the storage,
+     * and a storage need not do anything about it.
+     */
+    cache_eviction_t eviction;
 } CACHE_STORAGE_CONFIG;
 
+/**
+ * Returns the time-to-live of a particular value, that is, the specified
+ * time-to-live shortened by the jitter of the value.
+ *
+ * @param pConfig  The configuration of the storage.
+ * @param pKey     The key of the value.
+ * @param ttl      The hard or soft time-to-live of the configuration.
+ *
+ * @return The time-to-live of the value. The same fraction is cut from the
+ *         hard and the soft time-to-live, so the soft never exceeds the hard.
+ */
+static inline uint32_t cache_storage_ttl(const CACHE_STORAGE_CONFIG* pConfig,
+                                         const CACHE_KEY* pKey,
+                                         uint32_t ttl)
+{
+    uint64_t cut = (uint64_t)ttl * pConfig->ttl_jitter * (pKey->lo % 1024) / (100 * 1024);
+
+    return ttl - (uint32_t)cut;
+}
+
 typedef struct cache_storage_api
 {
     /**
@@ -208,7 +264,9 @@ typedef struct cache_storage_api
      * @param key        A key generated with get_key.
      * @param flags      Mask of cache_flags_t values.
      * @param result     Pointer to variable that after a successful return will
-     *                   point to a GWBUF.
+     *                   point to a GWBUF. The data of the buffer may be shared
+     *                   with the storage; use gwbuf_make_writable() before
+     *                   modifying it.
      *
      * @return CACHE_RESULT_OK if item was found, CACHE_RESULT_NOT_FOUND if
      *         item was not found or some other error code. In the OK an NOT_FOUND
@@ -49,9 +49,28 @@ struct hash<CACHE_KEY>
 
 std::string cache_key_to_string(const CACHE_KEY& key);
 
+/**
+ * Set an integer value of a JSON object, as the statistics of the cache
+ * and of the storages are reported.
+ *
+ * @param pObject  The object.
+ * @param zName    The name of the value.
+ * @param value    The value.
+ */
+inline void cache_set_json_integer(json_t* pObject, const char* zName, uint64_t value)
+{
+    json_t* pValue = json_integer(value);
+
+    if (pValue)
+    {
+        json_object_set(pObject, zName, pValue);
+        json_decref(pValue);
+    }
+}
+
 inline bool operator == (const CACHE_KEY& lhs, const CACHE_KEY& rhs)
 {
-    return lhs.data == rhs.data;
+    return (lhs.hi == rhs.hi) && (lhs.lo == rhs.lo);
 }
 
 inline bool operator != (const CACHE_KEY& lhs, const CACHE_KEY& rhs)
@@ -64,7 +83,8 @@ class CacheKey : public CACHE_KEY
 public:
     CacheKey()
     {
-        data = 0;
+        hi = 0;
+        lo = 0;
     }
 };
 
@@ -75,13 +95,19 @@ public:
                        uint32_t hard_ttl = 0,
                        uint32_t soft_ttl = 0,
                        uint32_t max_count = 0,
-                       uint64_t max_size = 0)
+                       uint64_t max_size = 0,
+                       cache_invalidate_t invalidate = CACHE_INVALIDATE_NEVER,
+                       uint32_t ttl_jitter = 0,
+                       cache_eviction_t eviction = CACHE_EVICTION_LRU)
     {
         this->thread_model = thread_model;
         this->hard_ttl = hard_ttl;
         this->soft_ttl = soft_ttl;
         this->max_count = max_count;
         this->max_size = max_size;
+        this->invalidate = invalidate;
+        this->ttl_jitter = ttl_jitter;
+        this->eviction = eviction;
     }
 
     CacheStorageConfig()
@@ -91,6 +117,9 @@ public:
         soft_ttl = 0;
         max_count = 0;
         max_size = 0;
+        invalidate = CACHE_INVALIDATE_NEVER;
+        ttl_jitter = 0;
+        eviction = CACHE_EVICTION_LRU;
     }
 
     CacheStorageConfig(const CACHE_STORAGE_CONFIG& config)
@@ -100,5 +129,8 @@ public:
         soft_ttl = config.soft_ttl;
         max_count = config.max_count;
         max_size = config.max_size;
+        invalidate = config.invalidate;
+        ttl_jitter = config.ttl_jitter;
+        eviction = config.eviction;
     }
 };
@@ -13,14 +13,21 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachefilter.hh"
+#include <algorithm>
+#include <vector>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
 #include <maxscale/modulecmd.h>
+#include <maxscale/spinlock.hh>
+#include <maxscale/tablefeed.h>
 #include "cachemt.hh"
 #include "cachept.hh"
+#include "compressedstorage.hh"
 
+using maxscale::SpinLockGuard;
 using std::auto_ptr;
 using std::string;
+using std::vector;
 
 namespace
 {
@@ -38,6 +45,10 @@ void cache_config_finish(CACHE_CONFIG& config)
     MXS_FREE(config.storage);
     MXS_FREE(config.storage_options);
     MXS_FREE(config.storage_argv); // The items need not be freed, they point into storage_options.
+    MXS_FREE(config.warm_storage);
+    MXS_FREE(config.warm_storage_options);
+    MXS_FREE(config.warm_storage_argv);
+    MXS_FREE(config.snapshot);
 
     config.max_resultset_rows = 0;
     config.max_resultset_size = 0;
@@ -48,9 +59,29 @@ void cache_config_finish(CACHE_CONFIG& config)
     config.storage_argv = NULL;
     config.hard_ttl = 0;
     config.soft_ttl = 0;
+    config.ttl_jitter = 0;
+    config.soft_ttl_refresh = CACHE_REFRESH_FOREGROUND;
     config.debug = 0;
     config.thread_model = CACHE_THREAD_MODEL_MT;
     config.selects = CACHE_SELECTS_VERIFY_CACHEABLE;
+    config.invalidate = CACHE_INVALIDATE_NEVER;
+    config.coalesce_misses = false;
+    config.coalesce_timeout = 0;
+    config.users = CACHE_USERS_MIXED;
+    config.shards = 0;
+    config.compression = CACHE_COMPRESSION_NONE;
+    config.compression_threshold = 0;
+    config.warm_storage = NULL;
+    config.warm_storage_options = NULL;
+    config.warm_storage_argc = 0;
+    config.warm_storage_argv = NULL;
+    config.warm_max_count = 0;
+    config.warm_max_size = 0;
+    config.snapshot = NULL;
+    config.statistics = false;
+    config.eviction = CACHE_EVICTION_LRU;
+    config.thread_max_count = 0;
+    config.thread_max_size = 0;
 }
 
 /**
@@ -102,6 +133,43 @@ bool cache_command_show(const MODULECMD_ARG* pArgs)
     return true;
 }
 
+/**
+ * Implement "call command cache snapshot ..."
+ *
+ * @param pArgs  The arguments of the command.
+ *
+ * @return True, if the snapshot could be saved.
+ */
+bool cache_command_snapshot(const MODULECMD_ARG* pArgs)
+{
+    ss_dassert(pArgs->argc == 1);
+    ss_dassert(MODULECMD_GET_TYPE(&pArgs->argv[0].type) == MODULECMD_ARG_FILTER);
+
+    const MXS_FILTER_DEF* pFilterDef = pArgs->argv[0].value.filter;
+    ss_dassert(pFilterDef);
+    CacheFilter* pFilter = reinterpret_cast<CacheFilter*>(filter_def_get_instance(pFilterDef));
+
+    bool rv = false;
+    const char* zSnapshot = pFilter->cache().config().snapshot;
+
+    if (zSnapshot)
+    {
+        MXS_EXCEPTION_GUARD(rv = pFilter->cache().save_snapshot(zSnapshot));
+
+        if (!rv)
+        {
+            modulecmd_set_error("Could not save the snapshot '%s', see the log for details.", zSnapshot);
+        }
+    }
+    else
+    {
+        modulecmd_set_error("No snapshot has been configured for the filter '%s'.",
+                            filter_def_get_name(pFilterDef));
+    }
+
+    return rv;
+}
+
 int cache_process_init()
 {
     uint32_t jit_available;
@@ -116,6 +184,11 @@ int cache_process_init()
     return 0;
 }
 
+void cache_process_finish()
+{
+    CacheFilter::save_snapshots();
+}
+
 }
 
 //
@@ -138,6 +211,47 @@ static const MXS_ENUM_VALUE parameter_selects_values[] =
     {NULL}
 };
 
+// Enumeration values for `invalidate`
+static const MXS_ENUM_VALUE parameter_invalidate_values[] =
+{
+    {"never",   CACHE_INVALIDATE_NEVER},
+    {"current", CACHE_INVALIDATE_CURRENT},
+    {"binlog",  CACHE_INVALIDATE_BINLOG},
+    {NULL}
+};
+
+// Enumeration values for `compression`
+static const MXS_ENUM_VALUE parameter_compression_values[] =
+{
+    {"none", CACHE_COMPRESSION_NONE},
+    {"lz4",  CACHE_COMPRESSION_LZ4},
+    {NULL}
+};
+
+// Enumeration values for `eviction`
+static const MXS_ENUM_VALUE parameter_eviction_values[] =
+{
+    {"lru",     CACHE_EVICTION_LRU},
+    {"tinylfu", CACHE_EVICTION_TINYLFU},
+    {NULL}
+};
+
+// Enumeration values for `soft_ttl_refresh`
+static const MXS_ENUM_VALUE parameter_soft_ttl_refresh_values[] =
+{
+    {"foreground", CACHE_REFRESH_FOREGROUND},
+    {"background", CACHE_REFRESH_BACKGROUND},
+    {NULL}
+};
+
+// Enumeration values for `users`
+static const MXS_ENUM_VALUE parameter_users_values[] =
+{
+    {"mixed",    CACHE_USERS_MIXED},
+    {"isolated", CACHE_USERS_ISOLATED},
+    {NULL}
+};
+
 extern "C" MXS_MODULE* MXS_CREATE_MODULE()
 {
     static modulecmd_arg_type_t show_argv[] =
@@ -149,6 +263,14 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
     modulecmd_register_command(MXS_MODULE_NAME, "show", cache_command_show,
                                MXS_ARRAY_NELEMS(show_argv), show_argv);
 
+    static modulecmd_arg_type_t snapshot_argv[] =
+    {
+        { MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Cache name" }
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "snapshot", cache_command_snapshot,
+                               MXS_ARRAY_NELEMS(snapshot_argv), snapshot_argv);
+
     MXS_NOTICE("Initialized cache module %s.\n", VERSION_STRING);
 
     static MXS_MODULE info =
@@ -160,7 +282,7 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
         VERSION_STRING,
         &CacheFilter::s_object,
         cache_process_init, /* Process init. */
-        NULL, /* Process finish. */
+        cache_process_finish, /* Process finish. */
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         {
@@ -183,6 +305,18 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_PARAM_COUNT,
                 CACHE_DEFAULT_SOFT_TTL
             },
+            {
+                "ttl_jitter",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_TTL_JITTER
+            },
+            {
+                "soft_ttl_refresh",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_SOFT_TTL_REFRESH,
+                MXS_MODULE_OPT_NONE,
+                parameter_soft_ttl_refresh_values
+            },
             {
                 "max_resultset_rows",
                 MXS_MODULE_PARAM_COUNT,
@@ -226,6 +360,91 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 parameter_selects_values
             },
+            {
+                "invalidate",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_INVALIDATE,
+                MXS_MODULE_OPT_NONE,
+                parameter_invalidate_values
+            },
+            {
+                "coalesce_misses",
+                MXS_MODULE_PARAM_BOOL,
+                CACHE_DEFAULT_COALESCE_MISSES
+            },
+            {
+                "coalesce_timeout",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_COALESCE_TIMEOUT
+            },
+            {
+                "users",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_USERS,
+                MXS_MODULE_OPT_NONE,
+                parameter_users_values
+            },
+            {
+                "shards",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_SHARDS
+            },
+            {
+                "compression",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_COMPRESSION,
+                MXS_MODULE_OPT_NONE,
+                parameter_compression_values
+            },
+            {
+                "compression_threshold",
+                MXS_MODULE_PARAM_SIZE,
+                CACHE_DEFAULT_COMPRESSION_THRESHOLD
+            },
+            {
+                "warm_storage",
+                MXS_MODULE_PARAM_STRING
+            },
+            {
+                "warm_storage_options",
+                MXS_MODULE_PARAM_STRING
+            },
+            {
+                "warm_max_count",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_WARM_MAX_COUNT
+            },
+            {
+                "warm_max_size",
+                MXS_MODULE_PARAM_SIZE,
+                CACHE_DEFAULT_WARM_MAX_SIZE
+            },
+            {
+                "snapshot",
+                MXS_MODULE_PARAM_STRING
+            },
+            {
+                "statistics",
+                MXS_MODULE_PARAM_BOOL,
+                CACHE_DEFAULT_STATISTICS
+            },
+            {
+                "eviction",
+                MXS_MODULE_PARAM_ENUM,
+                CACHE_DEFAULT_EVICTION,
+                MXS_MODULE_OPT_NONE,
+                parameter_eviction_values
+            },
+            {
+                "thread_max_count",
+                MXS_MODULE_PARAM_COUNT,
+                CACHE_DEFAULT_THREAD_MAX_COUNT
+            },
+            {
+                "thread_max_size",
+                MXS_MODULE_PARAM_SIZE,
+                CACHE_DEFAULT_THREAD_MAX_SIZE
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -237,6 +456,11 @@ extern "C" MXS_MODULE* MXS_CREATE_MODULE()
 // CacheFilter
 //
 
+// static
+SPINLOCK CacheFilter::s_snapshot_lock = SPINLOCK_INIT;
+// static
+vector<CacheFilter*> CacheFilter::s_snapshot_filters;
+
 CacheFilter::CacheFilter()
 {
     cache_config_reset(m_config);
@@ -244,6 +468,25 @@ CacheFilter::CacheFilter()
 
 CacheFilter::~CacheFilter()
 {
+    if (m_config.snapshot)
+    {
+        SpinLockGuard guard(s_snapshot_lock);
+
+        vector<CacheFilter*>::iterator i = std::find(s_snapshot_filters.begin(),
+                                                     s_snapshot_filters.end(),
+                                                     this);
+
+        if (i != s_snapshot_filters.end())
+        {
+            s_snapshot_filters.erase(i);
+        }
+    }
+
+    if (m_config.invalidate == CACHE_INVALIDATE_BINLOG)
+    {
+        mxs_table_feed_unsubscribe(table_modified, this);
+    }
+
     cache_config_finish(m_config);
 }
 
@@ -278,6 +521,30 @@ CacheFilter* CacheFilter::create(const char* zName, char** pzOptions, MXS_CONFIG
         if (pCache)
         {
             pFilter->m_sCache = auto_ptr<Cache>(pCache);
+
+            if ((pFilter->m_config.invalidate == CACHE_INVALIDATE_BINLOG) &&
+                !mxs_table_feed_subscribe(table_modified, pFilter))
+            {
+                MXS_ERROR("Could not subscribe to modified tables, tables modified "
+                          "in the binary log will not be invalidated.");
+                pFilter->m_config.invalidate = CACHE_INVALIDATE_CURRENT;
+            }
+
+            if (pFilter->m_config.snapshot)
+            {
+                pCache->load_snapshot(pFilter->m_config.snapshot);
+
+                try
+                {
+                    SpinLockGuard guard(s_snapshot_lock);
+                    s_snapshot_filters.push_back(pFilter);
+                }
+                catch (const std::exception& x)
+                {
+                    MXS_ERROR("Could not register the cache for saving its snapshot "
+                              "'%s' at shutdown.", pFilter->m_config.snapshot);
+                }
+            }
         }
         else
         {
@@ -306,6 +573,131 @@ uint64_t CacheFilter::getCapabilities()
     return RCAP_TYPE_TRANSACTION_TRACKING;
 }
 
+/**
+ * Saves the snapshots of all caches that have one. Called at shutdown,
+ * when no sessions any more are using the caches.
+ */
+// static
+void CacheFilter::save_snapshots()
+{
+    vector<CacheFilter*> filters;
+
+    {
+        SpinLockGuard guard(s_snapshot_lock);
+        filters = s_snapshot_filters;
+    }
+
+    for (vector<CacheFilter*>::iterator i = filters.begin(); i != filters.end(); ++i)
+    {
+        CacheFilter* pFilter = *i;
+
+        MXS_EXCEPTION_GUARD(pFilter->m_sCache->save_snapshot(pFilter->m_config.snapshot));
+    }
+}
+
+/**
+ * Called for each table that the binlog router sees being modified in the
+ * replication stream. The call is made in the thread that handles the
+ * replication stream.
+ *
+ * @param zDb     The database of the table.
+ * @param zTable  The name of the table.
+ * @param pData   The cache filter.
+ */
+// static
+void CacheFilter::table_modified(const char* zDb, const char* zTable, void* pData)
+{
+    CacheFilter* pFilter = static_cast<CacheFilter*>(pData);
+
+    try
+    {
+        string name(zDb);
+        name += '.';
+        name += zTable;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        std::vector<std::string> words(1, name);
+
+        cache_result_t result = pFilter->m_sCache->invalidate(words);
+
+        if (!CACHE_RESULT_IS_OK(result))
+        {
+            MXS_ERROR("Could not invalidate cached results of '%s'.", name.c_str());
+        }
+    }
+    catch (const std::exception& x)
+    {
+        MXS_ERROR("Could not invalidate cached results of '%s.%s': %s", zDb, zTable, x.what());
+    }
+}
+
+/**
+ * Split the comma separated options of a storage module into arguments.
+ *
+ * @param pParam     The parameter with the options, may be NULL.
+ * @param pzOptions  On return, the options, pointed into by the arguments.
+ * @param pppArgv    On return, the arguments.
+ * @param pArgc      On return, the number of arguments.
+ *
+ * @return False, if memory could not be allocated.
+ */
+static bool cook_storage_options(const MXS_CONFIG_PARAMETER* pParam,
+                                 char** pzOptions,
+                                 char*** pppArgv,
+                                 int* pArgc)
+{
+    bool rv = true;
+
+    if (pParam)
+    {
+        char* zOptions = MXS_STRDUP(pParam->value);
+
+        if (zOptions)
+        {
+            int argc = 1;
+            char *arg = zOptions;
+
+            while ((arg = strchr(arg, ',')))
+            {
+                arg = arg + 1;
+                ++argc;
+            }
+
+            char** argv = (char**) MXS_MALLOC((argc + 1) * sizeof(char*));
+
+            if (argv)
+            {
+                int i = 0;
+                arg = zOptions;
+                argv[i++] = arg;
+
+                while ((arg = strchr(zOptions, ',')))
+                {
+                    *arg = 0;
+                    ++arg;
+                    argv[i++] = arg;
+                }
+
+                argv[i] = NULL;
+
+                *pzOptions = zOptions;
+                *pppArgv = argv;
+                *pArgc = argc;
+            }
+            else
+            {
+                MXS_FREE(zOptions);
+            }
+        }
+        else
+        {
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
 // static
 bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParams, CACHE_CONFIG& config)
 {
@@ -314,6 +706,10 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
     config.debug = config_get_integer(ppParams, "debug");
     config.hard_ttl = config_get_integer(ppParams, "hard_ttl");
     config.soft_ttl = config_get_integer(ppParams, "soft_ttl");
+    config.ttl_jitter = config_get_integer(ppParams, "ttl_jitter");
+    config.soft_ttl_refresh = static_cast<cache_refresh_t>(config_get_enum(ppParams,
+                                                                           "soft_ttl_refresh",
+                                                                           parameter_soft_ttl_refresh_values));
     config.max_size = config_get_size(ppParams, "max_size");
     config.max_count = config_get_integer(ppParams, "max_count");
     config.storage = MXS_STRDUP(config_get_string(ppParams, "storage"));
@@ -325,12 +721,48 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
     config.selects = static_cast<cache_selects_t>(config_get_enum(ppParams,
                                                                   "selects",
                                                                   parameter_selects_values));
+    config.invalidate = static_cast<cache_invalidate_t>(config_get_enum(ppParams,
+                                                                        "invalidate",
+                                                                        parameter_invalidate_values));
+    config.coalesce_misses = config_get_bool(ppParams, "coalesce_misses");
+    config.coalesce_timeout = config_get_integer(ppParams, "coalesce_timeout");
+    config.users = static_cast<cache_users_t>(config_get_enum(ppParams,
+                                                              "users",
+                                                              parameter_users_values));
+    config.shards = config_get_integer(ppParams, "shards");
+    config.compression = static_cast<cache_compression_t>(config_get_enum(ppParams,
+                                                                          "compression",
+                                                                          parameter_compression_values));
+    config.compression_threshold = config_get_size(ppParams, "compression_threshold");
+    config.warm_storage = config_copy_string(ppParams, "warm_storage");
+    config.warm_max_count = config_get_integer(ppParams, "warm_max_count");
+    config.warm_max_size = config_get_size(ppParams, "warm_max_size");
+    config.snapshot = config_copy_string(ppParams, "snapshot");
+    config.statistics = config_get_bool(ppParams, "statistics");
+    config.eviction = static_cast<cache_eviction_t>(config_get_enum(ppParams,
+                                                                    "eviction",
+                                                                    parameter_eviction_values));
+    config.thread_max_count = config_get_integer(ppParams, "thread_max_count");
+    config.thread_max_size = config_get_size(ppParams, "thread_max_size");
 
     if (!config.storage)
     {
         error = true;
     }
 
+    if (config.warm_storage && (config.max_count == 0) && (config.max_size == 0))
+    {
+        MXS_WARNING("Neither 'max_count' nor 'max_size' has been specified, so the "
+                    "hot tier '%s' will hold everything the warm tier '%s' does.",
+                    config.storage, config.warm_storage);
+    }
+
+    if ((config.eviction != CACHE_EVICTION_LRU) && (config.max_count == 0) && (config.max_size == 0))
+    {
+        MXS_WARNING("Neither 'max_count' nor 'max_size' has been specified, so the "
+                    "cache never becomes full and 'eviction' has no effect.");
+    }
+
     if ((config.debug < CACHE_DEBUG_MIN) || (config.debug > CACHE_DEBUG_MAX))
     {
         MXS_ERROR("The value of the configuration entry 'debug' must "
@@ -339,51 +771,72 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
         error = true;
     }
 
-    config.rules = config_copy_string(ppParams, "rules");
-
-    const MXS_CONFIG_PARAMETER *pParam = config_get_param(ppParams, "storage_options");
-
-    if (pParam)
+    if ((config.shards < 1) || (config.shards > CACHE_SHARDS_MAX))
+    {
+        MXS_ERROR("The value of the configuration entry 'shards' must "
+                  "be between 1 and %d, inclusive.", CACHE_SHARDS_MAX);
+        error = true;
+    }
+    else if ((config.shards > 1) && (config.thread_model != CACHE_THREAD_MODEL_MT) &&
+             !cache_config_has_shared_tier(&config))
     {
-        config.storage_options = MXS_STRDUP(pParam->value);
+        MXS_WARNING("The value of the configuration entry 'shards' is ignored, "
+                    "as the cached data is thread specific.");
+    }
 
-        if (config.storage_options)
+    if ((config.thread_max_count != 0) || (config.thread_max_size != 0))
+    {
+        if (config.thread_model != CACHE_THREAD_MODEL_ST)
         {
-            int argc = 1;
-            char *arg = config.storage_options;
+            MXS_WARNING("The configuration entries 'thread_max_count' and 'thread_max_size' "
+                        "are ignored, as the cached data is shared.");
+        }
+        else if (config.warm_storage)
+        {
+            MXS_ERROR("The configuration entries 'thread_max_count' and 'thread_max_size' "
+                      "can not be used together with 'warm_storage'.");
+            error = true;
+        }
+    }
 
-            while ((arg = strchr(arg, ',')))
-            {
-                arg = arg + 1;
-                ++argc;
-            }
+    if ((config.compression != CACHE_COMPRESSION_NONE) && !CompressedStorage::is_available())
+    {
+        MXS_ERROR("The configuration entry 'compression' can not be used, "
+                  "as MaxScale has been built without LZ4.");
+        error = true;
+    }
 
-            config.storage_argv = (char**) MXS_MALLOC((argc + 1) * sizeof(char*));
+    if (config.snapshot && (config.thread_model != CACHE_THREAD_MODEL_MT))
+    {
+        MXS_WARNING("The configuration entry 'snapshot' is ignored, as the cached "
+                    "data is thread specific.");
+        MXS_FREE(config.snapshot);
+        config.snapshot = NULL;
+    }
 
-            if (config.storage_argv)
-            {
-                config.storage_argc = argc;
+    if (config.compression_threshold > UINT32_MAX)
+    {
+        MXS_ERROR("The value of the configuration entry 'compression_threshold' "
+                  "must be less than 4GiB.");
+        error = true;
+    }
 
-                int i = 0;
-                arg = config.storage_options;
-                config.storage_argv[i++] = arg;
+    config.rules = config_copy_string(ppParams, "rules");
 
-                while ((arg = strchr(config.storage_options, ',')))
-                {
-                    *arg = 0;
-                    ++arg;
-                    config.storage_argv[i++] = arg;
-                }
+    if (!cook_storage_options(config_get_param(ppParams, "storage_options"),
+                              &config.storage_options,
+                              &config.storage_argv,
+                              &config.storage_argc))
+    {
+        error = true;
+    }
 
-                config.storage_argv[i] = NULL;
-            }
-            else
-            {
-                MXS_FREE(config.storage_options);
-                config.storage_options = NULL;
-            }
-        }
-        else
+    if (config.warm_storage)
+    {
+        if (!cook_storage_options(config_get_param(ppParams, "warm_storage_options"),
+                                  &config.warm_storage_options,
+                                  &config.warm_storage_argv,
+                                  &config.warm_storage_argc))
         {
             error = true;
         }
@@ -398,6 +851,13 @@ bool CacheFilter::process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParam
             config.soft_ttl = config.hard_ttl;
         }
 
+        if (config.ttl_jitter > 100)
+        {
+            MXS_WARNING("The value of 'ttl_jitter' is a percentage and must be at most 100. "
+                        "Setting 'ttl_jitter' to 100.");
+            config.ttl_jitter = 100;
+        }
+
         if (config.max_resultset_size == 0)
         {
             if (config.max_size != 0)
@@ -46,6 +46,10 @@
 #define CACHE_DEFAULT_HARD_TTL           "0"
 // Seconds
 #define CACHE_DEFAULT_SOFT_TTL           "0"
+// Percentage
+#define CACHE_DEFAULT_TTL_JITTER         "0"
+// Refresh of stale items
+#define CACHE_DEFAULT_SOFT_TTL_REFRESH   "foreground"
 // Integer value
 #define CACHE_DEFAULT_DEBUG              "0"
 // Positive integer
@@ -56,8 +60,36 @@
 #define CACHE_DEFAULT_THREAD_MODEL       "shared"
 // Cacheable selects
 #define CACHE_DEFAULT_SELECTS            "verify_cacheable"
+// Invalidation
+#define CACHE_DEFAULT_INVALIDATE         "never"
+// Miss coalescing
+#define CACHE_DEFAULT_COALESCE_MISSES    "false"
+// Miss coalescing timeout
+#define CACHE_DEFAULT_COALESCE_TIMEOUT   "1000"
+// Users
+#define CACHE_DEFAULT_USERS              "mixed"
+// Number of storage shards
+#define CACHE_DEFAULT_SHARDS             "1"
+// Compression
+#define CACHE_DEFAULT_COMPRESSION        "none"
+// Bytes
+#define CACHE_DEFAULT_COMPRESSION_THRESHOLD "1024"
 // Storage
 #define CACHE_DEFAULT_STORAGE            "storage_inmemory"
+// Positive integer
+#define CACHE_DEFAULT_WARM_MAX_COUNT     "0"
+// Positive integer
+#define CACHE_DEFAULT_WARM_MAX_SIZE      "0"
+// Per table statistics
+#define CACHE_DEFAULT_STATISTICS         "false"
+// Every value is admitted
+#define CACHE_DEFAULT_EVICTION           "lru"
+// Positive integer
+#define CACHE_DEFAULT_THREAD_MAX_COUNT   "0"
+// Positive integer
+#define CACHE_DEFAULT_THREAD_MAX_SIZE    "0"
+
+#define CACHE_SHARDS_MAX 256
 
 typedef enum cache_selects
 {
@@ -65,6 +97,24 @@ typedef enum cache_selects
     CACHE_SELECTS_VERIFY_CACHEABLE,
 } cache_selects_t;
 
+typedef enum cache_refresh
+{
+    CACHE_REFRESH_FOREGROUND, /**< A stale item is refreshed before it is returned. */
+    CACHE_REFRESH_BACKGROUND, /**< A stale item is returned and refreshed meanwhile. */
+} cache_refresh_t;
+
+typedef enum cache_compression
+{
+    CACHE_COMPRESSION_NONE, /**< The values are stored as they are. */
+    CACHE_COMPRESSION_LZ4,  /**< The values are compressed using LZ4. */
+} cache_compression_t;
+
+typedef enum cache_users
+{
+    CACHE_USERS_MIXED,    /**< The users share the cached results. */
+    CACHE_USERS_ISOLATED, /**< Each user has its own cached results. */
+} cache_users_t;
+
 typedef struct cache_config
 {
     uint64_t max_resultset_rows;       /**< The maximum number of rows of a resultset for it to be cached. */
@@ -76,9 +126,43 @@ typedef struct cache_config
     int storage_argc;                  /**< Number of cooked options. */
     uint32_t hard_ttl;                 /**< Hard time to live. */
     uint32_t soft_ttl;                 /**< Soft time to live. */
+    uint32_t ttl_jitter;               /**< Maximum percentage the time to live is shortened. */
+    cache_refresh_t soft_ttl_refresh;  /**< How stale items are refreshed. */
     uint64_t max_count;                /**< Maximum number of entries in the cache.*/
     uint64_t max_size;                 /**< Maximum size of the cache.*/
     uint32_t debug;                    /**< Debug settings. */
     cache_thread_model_t thread_model; /**< Thread model. */
     cache_selects_t selects;           /**< Assume/verify that selects are cacheable. */
+    cache_invalidate_t invalidate;     /**< Whether modifications invalidate cached items. */
+    bool coalesce_misses;              /**< Whether sessions wait for a result being fetched. */
+    uint32_t coalesce_timeout;         /**< How long, in milliseconds, a session may wait. */
+    cache_users_t users;               /**< Whether the users share the cached results. */
+    uint32_t shards;                   /**< The number of shards of a shared cache. */
+    cache_compression_t compression;   /**< How the values are compressed. */
+    uint64_t compression_threshold;    /**< The minimum size of a value to compress. */
+    char* warm_storage;                /**< Name of storage module of the warm tier, or NULL. */
+    char* warm_storage_options;        /**< Raw options for warm storage module. */
+    char** warm_storage_argv;          /**< Cooked options for warm storage module. */
+    int warm_storage_argc;             /**< Number of cooked options. */
+    uint64_t warm_max_count;           /**< Maximum number of entries in the warm tier. */
+    uint64_t warm_max_size;            /**< Maximum size of the warm tier. */
+    char* snapshot;                    /**< Path of the snapshot, or NULL. */
+    bool statistics;                   /**< Whether per table statistics are collected. */
+    cache_eviction_t eviction;         /**< How values are admitted when the cache is full. */
+    uint64_t thread_max_count;         /**< Maximum number of entries in a thread specific cache. */
+    uint64_t thread_max_size;          /**< Maximum size of a thread specific cache. */
 } CACHE_CONFIG;
+
+/**
+ * Returns whether the thread specific caches share a cache behind them.
+ *
+ * @param pConfig  The configuration of the cache.
+ *
+ * @return True, if the thread specific caches are limited separately from
+ *         a cache that all threads share.
+ */
+static inline bool cache_config_has_shared_tier(const CACHE_CONFIG* pConfig)
+{
+    return (pConfig->thread_model == CACHE_THREAD_MODEL_ST) &&
+           ((pConfig->thread_max_count != 0) || (pConfig->thread_max_size != 0));
+}
@@ -13,7 +13,9 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <vector>
 #include <maxscale/filter.hh>
+#include <maxscale/spinlock.h>
 #include "cachefilter.h"
 #include "cachefiltersession.hh"
 
@@ -41,6 +43,8 @@ public:
 
     uint64_t getCapabilities();
 
+    static void save_snapshots();
+
 private:
     CacheFilter();
 
@@ -49,7 +53,12 @@ private:
 
     static bool process_params(char **pzOptions, MXS_CONFIG_PARAMETER *ppParams, CACHE_CONFIG& config);
 
+    static void table_modified(const char* zDb, const char* zTable, void* pData);
+
 private:
     CACHE_CONFIG         m_config;
     std::auto_ptr<Cache> m_sCache;
+
+    static SPINLOCK                  s_snapshot_lock;    // Protects s_snapshot_filters.
+    static std::vector<CacheFilter*> s_snapshot_filters; // The filters having a snapshot.
 };
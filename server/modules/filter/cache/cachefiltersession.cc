@@ -13,11 +13,16 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachefiltersession.hh"
+#include <time.h>
+#include <algorithm>
 #include <new>
 #include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
 #include <maxscale/modutil.h>
 #include <maxscale/mysql_utils.h>
+#include <maxscale/poll.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/protocol/mysql.h>
 #include "storage.hh"
 
 namespace
@@ -33,6 +38,14 @@ inline bool cache_max_resultset_size_exceeded(const CACHE_CONFIG& config, uint64
     return config.max_resultset_size == 0 ? false : size > config.max_resultset_size;
 }
 
+inline uint64_t time_in_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 }
 
 namespace
@@ -177,6 +190,118 @@ bool is_select_statement(GWBUF* pStmt)
 
 }
 
+namespace
+{
+
+/**
+ * Get the names of the tables a statement accesses. A name that is not
+ * qualified is qualified with the default database, and all names are
+ * in lower case, so that the names of a SELECT and of a later modification
+ * of the same table are the same.
+ *
+ * @param pStmt       A COM_QUERY packet.
+ * @param zDefaultDb  The default database, may be NULL.
+ * @param pNames      The vector the names are added to.
+ *
+ * @return True, if all names could be added.
+ */
+bool get_table_names(GWBUF* pStmt, const char* zDefaultDb, std::vector<std::string>* pNames)
+{
+    bool rv = true;
+
+    int n_names = 0;
+    char** pzNames = qc_get_table_names(pStmt, &n_names, true);
+
+    for (int i = 0; i < n_names; ++i)
+    {
+        if (rv)
+        {
+            try
+            {
+                std::string name;
+
+                if (zDefaultDb && !strchr(pzNames[i], '.'))
+                {
+                    name += zDefaultDb;
+                    name += '.';
+                }
+
+                name += pzNames[i];
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+                pNames->push_back(name);
+            }
+            catch (const std::exception& x)
+            {
+                rv = false;
+            }
+        }
+
+        MXS_FREE(pzNames[i]);
+    }
+
+    MXS_FREE(pzNames);
+
+    return rv;
+}
+
+/**
+ * Whether a statement modifies the tables it accesses.
+ *
+ * @param pStmt  A COM_QUERY packet.
+ *
+ * @return True, if results read from the tables may no longer be valid
+ *         after the statement has been executed.
+ */
+bool is_modification(GWBUF* pStmt)
+{
+    const uint32_t MODIFYING_OPS = QUERY_OP_UPDATE | QUERY_OP_INSERT | QUERY_OP_DELETE |
+                                   QUERY_OP_TRUNCATE | QUERY_OP_ALTER | QUERY_OP_DROP |
+                                   QUERY_OP_LOAD;
+
+    return (qc_get_operation(pStmt) & MODIFYING_OPS) != 0;
+}
+
+/**
+ * The session variables that affect the results of a SELECT, as they
+ * appear in a SET statement.
+ */
+const char* STATE_VARIABLES[] =
+{
+    "character set",
+    "character_set_",
+    "collation_",
+    "div_precision_increment",
+    "lc_time_names",
+    "names",
+    "sql_mode",
+    "time_zone",
+};
+
+const size_t N_STATE_VARIABLES = sizeof(STATE_VARIABLES) / sizeof(STATE_VARIABLES[0]);
+
+/**
+ * Is the statement a SET statement.
+ *
+ * @param pSql  The statement.
+ * @param len   The length of the statement.
+ *
+ * @return True, if the statement starts with SET.
+ */
+bool is_set_statement(const char* pSql, int len)
+{
+    const char* pEnd = pSql + len;
+
+    while ((pSql < pEnd) && isspace(*pSql))
+    {
+        ++pSql;
+    }
+
+    return (pEnd - pSql > 3) && (strncasecmp(pSql, "set", 3) == 0) && isspace(pSql[3]);
+}
+
+}
+
 CacheFilterSession::CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, char* zDefaultDb)
     : maxscale::FilterSession(pSession)
     , m_state(CACHE_EXPECTING_NOTHING)
@@ -184,15 +309,32 @@ CacheFilterSession::CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, cha
     , m_zDefaultDb(zDefaultDb)
     , m_zUseDb(NULL)
     , m_refreshing(false)
+    , m_in_background(false)
     , m_is_read_only(true)
+    , m_pWaiting(NULL)
+    , m_wait_start(0)
+    , m_pTimerSession(NULL)
+    , m_timer_thread(-1)
+    , m_fetch_start(0)
 {
-    m_key.data = 0;
+    m_key.hi = 0;
+    m_key.lo = 0;
+    mxs_timer_init(&m_timer, timer_expired, this);
+    update_session_state();
 
     reset_response_state();
 }
 
 CacheFilterSession::~CacheFilterSession()
 {
+    ss_dassert(!m_pTimerSession);
+    gwbuf_free(m_pWaiting);
+
+    for (std::deque<GWBUF*>::iterator i = m_queued.begin(); i != m_queued.end(); ++i)
+    {
+        gwbuf_free(*i);
+    }
+
     MXS_FREE(m_zUseDb);
     MXS_FREE(m_zDefaultDb);
 }
@@ -228,6 +370,26 @@ CacheFilterSession* CacheFilterSession::Create(Cache* pCache, MXS_SESSION* pSess
 
 void CacheFilterSession::close()
 {
+    // If the timer is active, it will notice that nothing is waiting.
+    gwbuf_free(m_pWaiting);
+    m_pWaiting = NULL;
+
+    for (std::deque<GWBUF*>::iterator i = m_queued.begin(); i != m_queued.end(); ++i)
+    {
+        gwbuf_free(*i);
+    }
+
+    m_queued.clear();
+    m_in_background = false;
+
+    done_refreshing();
+
+    if (!m_invalidation_words.empty() && !session_trx_is_active(m_pSession))
+    {
+        // The response to a modification was not received, but it may
+        // nonetheless have been executed.
+        invalidate();
+    }
 }
 
 int CacheFilterSession::routeQuery(GWBUF* pPacket)
@@ -239,7 +401,29 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
     ss_dassert(GWBUF_LENGTH(pPacket) >= MYSQL_HEADER_LEN + 1);
     ss_dassert(MYSQL_GET_PAYLOAD_LEN(pData) + MYSQL_HEADER_LEN == GWBUF_LENGTH(pPacket));
 
+    if (m_in_background)
+    {
+        // The response to a background refresh has not been received yet. The
+        // statement is routed once it has, so that the responses are not mixed.
+        try
+        {
+            m_queued.push_back(pPacket);
+            return 1;
+        }
+        catch (const std::bad_alloc&)
+        {
+            MXS_OOM();
+            gwbuf_free(pPacket);
+            return 0;
+        }
+    }
+
     bool fetch_from_server = true;
+    bool waiting = false;
+
+    // If the response to the previous SELECT was not stored, the item
+    // is no longer being refreshed.
+    done_refreshing();
 
     reset_response_state();
     m_state = CACHE_IGNORING_RESPONSE;
@@ -287,6 +471,13 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
         break;
 
     case MYSQL_COM_QUERY:
+        record_session_state(pPacket);
+
+        if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+        {
+            record_invalidation_words(pPacket);
+        }
+
         if (should_consult_cache(pPacket))
         {
             if (m_pCache->should_store(m_zDefaultDb, pPacket))
@@ -296,6 +487,8 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
                     GWBUF* pResponse;
                     cache_result_t result = get_cached_response(pPacket, &pResponse);
 
+                    record_lookup(pPacket, result);
+
                     if (CACHE_RESULT_IS_OK(result))
                     {
                         if (CACHE_RESULT_IS_STALE(result))
@@ -307,13 +500,28 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
                             {
                                 // We were the first ones who hit the stale item. It's
                                 // our responsibility now to fetch it.
-                                if (log_decisions())
+                                if (m_pCache->config().soft_ttl_refresh == CACHE_REFRESH_BACKGROUND)
                                 {
-                                    MXS_NOTICE("Cache data is stale, fetching fresh from server.");
+                                    // The stale value is returned right away and the fresh
+                                    // one is stored when it arrives.
+                                    if (log_decisions())
+                                    {
+                                        MXS_NOTICE("Cache data is stale, returning it and fetching "
+                                                   "fresh from server in the background.");
+                                    }
+
+                                    m_in_background = true;
                                 }
+                                else
+                                {
+                                    if (log_decisions())
+                                    {
+                                        MXS_NOTICE("Cache data is stale, fetching fresh from server.");
+                                    }
 
-                                // As we don't use the response it must be freed.
-                                gwbuf_free(pResponse);
+                                    // As we don't use the response it must be freed.
+                                    gwbuf_free(pResponse);
+                                }
 
                                 m_refreshing = true;
                                 fetch_from_server = true;
@@ -339,14 +547,70 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
                             fetch_from_server = false;
                         }
                     }
+                    else if (m_pCache->config().coalesce_misses)
+                    {
+                        // The value was not found. If somebody else is already
+                        // fetching it, we wait for it instead of hitting the server too.
+                        if (m_pCache->must_refresh(m_key, this))
+                        {
+                            m_refreshing = true;
+                            fetch_from_server = true;
+                        }
+                        else if (wait_for_fetch(pPacket))
+                        {
+                            waiting = true;
+                            fetch_from_server = false;
+                        }
+                        else
+                        {
+                            fetch_from_server = true;
+                        }
+                    }
                     else
                     {
                         fetch_from_server = true;
                     }
 
-                    if (fetch_from_server)
+                    if (waiting)
+                    {
+                        m_state = CACHE_EXPECTING_NOTHING;
+                        rv = 1;
+                    }
+                    else if (fetch_from_server)
                     {
+                        if (m_in_background)
+                        {
+                            DCB *dcb = m_pSession->client_dcb;
+                            dcb->func.write(dcb, pResponse);
+                        }
+
                         m_state = CACHE_EXPECTING_RESPONSE;
+                        m_fetch_start = time_in_us();
+
+                        if (m_pCache->config().invalidate != CACHE_INVALIDATE_NEVER)
+                        {
+                            m_tables.clear();
+
+                            if (!get_table_names(pPacket, m_zDefaultDb, &m_tables))
+                            {
+                                // A result that could not be invalidated must not be stored.
+                                MXS_ERROR("Could not get the tables of a SELECT, "
+                                          "the result will not be cached.");
+                                m_state = CACHE_IGNORING_RESPONSE;
+                                done_refreshing();
+
+                                if (m_in_background)
+                                {
+                                    // The client already has the stale result, so the
+                                    // SELECT need not be routed at all.
+                                    m_in_background = false;
+                                    m_state = CACHE_EXPECTING_NOTHING;
+                                    gwbuf_free(pPacket);
+                                    fetch_from_server = false;
+                                    rv = 1;
+                                }
+                            }
+                        }
                     }
                     else
                     {
@@ -371,6 +635,11 @@ int CacheFilterSession::routeQuery(GWBUF* pPacket)
         break;
     }
 
+    if (!waiting)
+    {
+        m_wait_start = 0;
+    }
+
     if (fetch_from_server)
     {
         rv = m_down.routeQuery(pPacket);
@@ -383,6 +652,13 @@ int CacheFilterSession::clientReply(GWBUF* pData)
 {
     int rv;
 
+    if (!m_invalidation_words.empty() && !session_trx_is_active(m_pSession))
+    {
+        // A modification outside a transaction or the end of a transaction
+        // in which tables were modified.
+        invalidate();
+    }
+
     if (m_res.pData)
     {
         gwbuf_append(m_res.pData, pData);
@@ -394,7 +670,7 @@ int CacheFilterSession::clientReply(GWBUF* pData)
         m_res.length = gwbuf_length(pData);
     }
 
-    if (m_state != CACHE_IGNORING_RESPONSE)
+    if ((m_state != CACHE_IGNORING_RESPONSE) && !m_res.discard)
     {
         if (cache_max_resultset_size_exceeded(m_pCache->config(), m_res.length))
         {
@@ -406,7 +682,16 @@ int CacheFilterSession::clientReply(GWBUF* pData)
                            m_pCache->config().max_resultset_size / 1024);
             }
 
-            m_state = CACHE_IGNORING_RESPONSE;
+            if (m_in_background)
+            {
+                // The end of the response must still be found, so that the
+                // client will get the responses to its later statements.
+                m_res.discard = true;
+            }
+            else
+            {
+                m_state = CACHE_IGNORING_RESPONSE;
+            }
         }
     }
 
@@ -444,6 +729,28 @@ int CacheFilterSession::clientReply(GWBUF* pData)
         m_state = CACHE_IGNORING_RESPONSE;
     }
 
+    if (m_res.discard && m_res.pData &&
+        ((m_state == CACHE_EXPECTING_FIELDS) || (m_state == CACHE_EXPECTING_ROWS)))
+    {
+        // What has been traversed is not needed.
+        m_res.pData = gwbuf_consume(m_res.pData, m_res.offset);
+        m_res.length -= m_res.offset;
+        m_res.offset = 0;
+    }
+
+    if ((m_state == CACHE_IGNORING_RESPONSE) || (m_state == CACHE_EXPECTING_NOTHING))
+    {
+        // The result will not be stored, so others need not wait for it.
+        done_refreshing();
+
+        if (m_in_background)
+        {
+            // The response to the background refresh has been received.
+            m_in_background = false;
+            route_queued();
+        }
+    }
+
     return rv;
 }
 
@@ -634,12 +941,20 @@ int CacheFilterSession::handle_expecting_rows()
                 m_res.offset += packetlen;
                 ++m_res.nRows;
 
-                if (cache_max_resultset_rows_exceeded(m_pCache->config(), m_res.nRows))
+                if (!m_res.discard && cache_max_resultset_rows_exceeded(m_pCache->config(), m_res.nRows))
                 {
                     if (log_decisions())
                     {
                         MXS_NOTICE("Max rows %lu reached, not caching result.", m_res.nRows);
                     }
+
+                    if (m_in_background)
+                    {
+                        // The end of the response must still be found.
+                        m_res.discard = true;
+                        continue;
+                    }
+
                     rv = send_upstream();
                     m_res.offset = buflen; // To abort the loop.
                     m_state = CACHE_IGNORING_RESPONSE;
@@ -727,7 +1042,18 @@ int CacheFilterSession::send_upstream()
 {
     ss_dassert(m_res.pData != NULL);
 
-    int rv = m_up.clientReply(m_res.pData);
+    int rv = 1;
+
+    if (m_in_background)
+    {
+        // The client already got the stale result.
+        gwbuf_free(m_res.pData);
+    }
+    else
+    {
+        rv = m_up.clientReply(m_res.pData);
+    }
+
     m_res.pData = NULL;
 
     return rv;
@@ -744,6 +1070,7 @@ void CacheFilterSession::reset_response_state()
     m_res.nFields = 0;
     m_res.nRows = 0;
     m_res.offset = 0;
+    m_res.discard = false;
 }
 
 /**
@@ -755,7 +1082,12 @@ void CacheFilterSession::reset_response_state()
  */
 cache_result_t CacheFilterSession::get_cached_response(const GWBUF *pQuery, GWBUF **ppResponse)
 {
-    cache_result_t result = m_pCache->get_key(m_zDefaultDb, pQuery, &m_key);
+    cache_result_t result = m_pCache->get_key(session_get_user(m_pSession),
+                                              session_get_remote(m_pSession),
+                                              m_session_state.c_str(),
+                                              m_zDefaultDb,
+                                              pQuery,
+                                              &m_key);
 
     if (CACHE_RESULT_IS_OK(result))
     {
@@ -771,6 +1103,27 @@ cache_result_t CacheFilterSession::get_cached_response(const GWBUF *pQuery, GWBU
     return result;
 }
 
+/**
+ * Record a lookup in the statistics of the cache, if they are collected.
+ *
+ * @param pPacket  The SELECT whose result was looked up.
+ * @param result   What the lookup returned.
+ */
+void CacheFilterSession::record_lookup(GWBUF* pPacket, cache_result_t result)
+{
+    CacheStats* pStats = m_pCache->stats();
+
+    if (pStats)
+    {
+        m_stats_tables.clear();
+
+        // If not all names can be had, the statistics of the others are still recorded.
+        get_table_names(pPacket, m_zDefaultDb, &m_stats_tables);
+
+        pStats->lookup(m_stats_tables, result);
+    }
+}
+
 /**
  * Store the data.
  *
@@ -780,15 +1133,25 @@ void CacheFilterSession::store_result()
 {
     ss_dassert(m_res.pData);
 
-    GWBUF *pData = gwbuf_make_contiguous(m_res.pData);
+    // A discarded response is incomplete.
+    GWBUF *pData = m_res.discard ? NULL : gwbuf_make_contiguous(m_res.pData);
 
     if (pData)
     {
         m_res.pData = pData;
 
-        cache_result_t result = m_pCache->put_value(m_key, m_res.pData);
+        cache_result_t result = m_pCache->put_value(m_key, m_tables, m_res.pData);
 
-        if (!CACHE_RESULT_IS_OK(result))
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            CacheStats* pStats = m_pCache->stats();
+
+            if (pStats)
+            {
+                pStats->store(m_stats_tables, GWBUF_LENGTH(m_res.pData), time_in_us() - m_fetch_start);
+            }
+        }
+        else
         {
             MXS_ERROR("Could not store cache item, deleting it.");
 
@@ -801,6 +1164,74 @@ void CacheFilterSession::store_result()
         }
     }
 
+    done_refreshing();
+}
+
+/**
+ * Record the statement if it sets a session variable that affects the
+ * results of a SELECT. A result is only used by sessions whose state is
+ * the same as the state of the session that stored it.
+ *
+ * @param pPacket  A COM_QUERY packet.
+ */
+void CacheFilterSession::record_session_state(GWBUF* pPacket)
+{
+    char* pSql;
+    int len;
+
+    if (modutil_extract_SQL(pPacket, &pSql, &len) && is_set_statement(pSql, len))
+    {
+        std::string sql(pSql, len);
+        std::string lower(sql);
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+        bool changed = false;
+
+        for (size_t i = 0; i < N_STATE_VARIABLES; ++i)
+        {
+            if (lower.find(STATE_VARIABLES[i]) != std::string::npos)
+            {
+                // Only the last statement setting a variable matters.
+                m_state_stmts[STATE_VARIABLES[i]] = sql;
+                changed = true;
+            }
+        }
+
+        if (changed)
+        {
+            update_session_state();
+        }
+    }
+}
+
+/**
+ * Update the session state from the character set of the connection and
+ * the recorded statements.
+ */
+void CacheFilterSession::update_session_state()
+{
+    MySQLProtocol* pProtocol = static_cast<MySQLProtocol*>(m_pSession->client_dcb->protocol);
+
+    char charset[32];
+    sprintf(charset, "%u\n", pProtocol ? pProtocol->charset : 0);
+
+    m_session_state = charset;
+
+    for (std::map<std::string, std::string>::const_iterator i = m_state_stmts.begin();
+         i != m_state_stmts.end();
+         ++i)
+    {
+        m_session_state += i->second;
+        m_session_state += '\n';
+    }
+}
+
+/**
+ * Tell the cache that the item being refreshed, if any, is no longer
+ * being refreshed by this session.
+ */
+void CacheFilterSession::done_refreshing()
+{
     if (m_refreshing)
     {
         m_pCache->refreshed(m_key, this);
@@ -808,6 +1239,148 @@ void CacheFilterSession::store_result()
     }
 }
 
+/**
+ * Route the statements that were received while the response to a
+ * background refresh was expected.
+ */
+void CacheFilterSession::route_queued()
+{
+    while (!m_in_background && !m_queued.empty())
+    {
+        GWBUF* pPacket = m_queued.front();
+        m_queued.pop_front();
+
+        if (routeQuery(pPacket) == 0)
+        {
+            poll_fake_hangup_event(m_pSession->client_dcb);
+            break;
+        }
+    }
+}
+
+/**
+ * Wait for another session to fetch the result of a SELECT. The SELECT is
+ * tried again on the next heartbeat, until the result is in the cache or
+ * nobody is fetching it or the coalesce_timeout has passed.
+ *
+ * @param pPacket  The SELECT.
+ *
+ * @return True, if the session waits and owns the packet, false if the SELECT
+ *         should be routed to the server.
+ */
+bool CacheFilterSession::wait_for_fetch(GWBUF* pPacket)
+{
+    if (m_wait_start == 0)
+    {
+        m_wait_start = hkheartbeat;
+    }
+
+    int64_t max_ticks = (m_pCache->config().coalesce_timeout + 99) / 100;
+    bool waiting = hkheartbeat - m_wait_start < max_ticks;
+
+    if (waiting)
+    {
+        if (log_decisions())
+        {
+            MXS_NOTICE("Cache data is being fetched by another session, waiting for it.");
+        }
+
+        m_pWaiting = pPacket;
+
+        if (!m_pTimerSession)
+        {
+            // The reference keeps the session alive until the timer has expired,
+            // even if the session is closed in the meantime.
+            m_pTimerSession = session_get_ref(m_pSession);
+            m_timer_thread = m_pSession->client_dcb->thread.id;
+            mxs_timer_add(&m_timer, 1);
+        }
+    }
+    else if (log_decisions())
+    {
+        MXS_NOTICE("Waited %u milliseconds for cache data being fetched by another "
+                   "session, fetching it from the server.", m_pCache->config().coalesce_timeout);
+    }
+
+    return waiting;
+}
+
+/**
+ * Called when the timer of a waiting session expires.
+ */
+void CacheFilterSession::wait_expired()
+{
+    MXS_SESSION* pSession = m_pTimerSession;
+    int thread_id = m_pSession->client_dcb->thread.id;
+
+    if (m_pWaiting && (thread_id != m_timer_thread))
+    {
+        // The session was moved to another thread, the SELECT is tried in that thread.
+        m_timer_thread = thread_id;
+        mxs_timer_add_to(m_timer_thread, &m_timer, 1);
+        return;
+    }
+
+    m_pTimerSession = NULL;
+
+    if (m_pWaiting)
+    {
+        GWBUF* pPacket = m_pWaiting;
+        m_pWaiting = NULL;
+
+        if (routeQuery(pPacket) == 0)
+        {
+            poll_fake_hangup_event(m_pSession->client_dcb);
+        }
+    }
+
+    session_put_ref(pSession);
+}
+
+//static
+void CacheFilterSession::timer_expired(MXS_TIMER* pTimer, void* pData)
+{
+    static_cast<CacheFilterSession*>(pData)->wait_expired();
+}
+
+/**
+ * Record the tables a statement modifies, so that their data can be
+ * invalidated once the modification has been made.
+ *
+ * @param pPacket  A COM_QUERY packet.
+ */
+void CacheFilterSession::record_invalidation_words(GWBUF* pPacket)
+{
+    if (is_modification(pPacket))
+    {
+        if (!get_table_names(pPacket, m_zDefaultDb, &m_invalidation_words))
+        {
+            MXS_ERROR("Could not record the tables of a modification, "
+                      "cached results will not be invalidated.");
+        }
+    }
+}
+
+/**
+ * Invalidate the cached results of the modified tables.
+ */
+void CacheFilterSession::invalidate()
+{
+    if (log_decisions())
+    {
+        MXS_NOTICE("Invalidating cached results of %lu table(s).", m_invalidation_words.size());
+    }
+
+    cache_result_t result = m_pCache->invalidate(m_invalidation_words);
+
+    if (!CACHE_RESULT_IS_OK(result))
+    {
+        MXS_ERROR("Could not invalidate cached results.");
+    }
+
+    m_invalidation_words.clear();
+}
+
 /**
  * Whether the cache should be consulted.
  *
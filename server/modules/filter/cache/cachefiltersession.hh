@@ -13,8 +13,13 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
 #include <maxscale/buffer.h>
 #include <maxscale/filter.hh>
+#include <maxscale/timer.h>
 #include "cache.hh"
 #include "cachefilter.h"
 #include "cache_storage_api.h"
@@ -40,6 +45,7 @@ public:
         size_t nFields;      /**< How many fields we have received, <= n_totalfields. */
         size_t nRows;        /**< How many rows we have received. */
         size_t offset;       /**< Where we are in the response buffer. */
+        bool discard;        /**< Whether the response is only traversed, not stored. */
     };
 
     /**
@@ -104,10 +110,30 @@ private:
         return m_pCache->config().debug & CACHE_DEBUG_DECISIONS ? true : false;
     }
 
+    void record_lookup(GWBUF* pPacket, cache_result_t result);
+
     void store_result();
 
     bool should_consult_cache(GWBUF* pPacket);
 
+    void record_invalidation_words(GWBUF* pPacket);
+
+    void invalidate();
+
+    void record_session_state(GWBUF* pPacket);
+
+    void update_session_state();
+
+    void done_refreshing();
+
+    void route_queued();
+
+    bool wait_for_fetch(GWBUF* pPacket);
+
+    void wait_expired();
+
+    static void timer_expired(MXS_TIMER* pTimer, void* pData);
+
 private:
     CacheFilterSession(MXS_SESSION* pSession, Cache* pCache, char* zDefaultDb);
 
@@ -122,6 +148,19 @@ private:
     char*                 m_zDefaultDb;  /**< The default database. */
     char*                 m_zUseDb;      /**< Pending default database. Needs server response. */
     bool                  m_refreshing;  /**< Whether the session is updating a stale cache entry. */
+    bool                  m_in_background; /**< Whether the expected response is a background refresh. */
     bool                  m_is_read_only;/**< Whether the current trx has been read-only in pratice. */
+    std::vector<std::string> m_tables;   /**< The tables of the SELECT whose result is expected. */
+    std::vector<std::string> m_invalidation_words; /**< The tables modified but not yet invalidated. */
+    GWBUF*                m_pWaiting;    /**< The SELECT waiting for another session to fetch its result. */
+    int64_t               m_wait_start;  /**< When the waiting started, in heartbeats, 0 if not waiting. */
+    MXS_TIMER             m_timer;       /**< The timer with which the SELECT is tried again. */
+    MXS_SESSION*          m_pTimerSession; /**< The reference the active timer holds, or NULL. */
+    int                   m_timer_thread;  /**< The thread the timer was added to. */
+    std::map<std::string, std::string> m_state_stmts; /**< The last statement setting each state variable. */
+    std::string           m_session_state; /**< The session state the results depend upon. */
+    std::deque<GWBUF*>    m_queued;      /**< Statements received during a background refresh. */
+    std::vector<std::string> m_stats_tables; /**< The tables of the SELECT, for the statistics. */
+    uint64_t              m_fetch_start; /**< When the SELECT was sent to the backend, in microseconds. */
 };
 
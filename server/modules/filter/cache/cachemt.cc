@@ -25,6 +25,7 @@ CacheMT::CacheMT(const std::string&  name,
                  SStorageFactory     sFactory,
                  Storage*            pStorage)
     : CacheSimple(name, pConfig, sRules, sFactory, pStorage)
+    , m_loading(false)
 {
     spinlock_init(&m_lock_pending);
 
@@ -33,6 +34,7 @@ CacheMT::CacheMT(const std::string&  name,
 
 CacheMT::~CacheMT()
 {
+    wait_for_loader();
 }
 
 CacheMT* CacheMT::Create(const std::string& name, const CACHE_CONFIG* pConfig)
@@ -76,6 +78,51 @@ void CacheMT::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSessio
     do_refreshed(key, pSession);
 }
 
+bool CacheMT::save_snapshot(const char* zPath)
+{
+    wait_for_loader();
+
+    return CacheSimple::save_snapshot(zPath);
+}
+
+bool CacheMT::load_snapshot(const char* zPath)
+{
+    bool rv = false;
+
+    wait_for_loader();
+
+    m_snapshot = zPath;
+
+    if (thread_start(&m_loader, load_snapshot_thread, this))
+    {
+        m_loading = true;
+        rv = true;
+    }
+    else
+    {
+        MXS_ERROR("Could not start a thread for loading the snapshot '%s'.", zPath);
+    }
+
+    return rv;
+}
+
+void CacheMT::wait_for_loader()
+{
+    if (m_loading)
+    {
+        thread_wait(m_loader);
+        m_loading = false;
+    }
+}
+
+// static
+void CacheMT::load_snapshot_thread(void* pData)
+{
+    CacheMT* pThis = static_cast<CacheMT*>(pData);
+
+    MXS_EXCEPTION_GUARD(pThis->CacheSimple::load_snapshot(pThis->m_snapshot.c_str()));
+}
+
 // static
 CacheMT* CacheMT::Create(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -88,12 +135,20 @@ CacheMT* CacheMT::Create(const std::string&  name,
                                       pConfig->hard_ttl,
                                       pConfig->soft_ttl,
                                       pConfig->max_count,
-                                      pConfig->max_size);
+                                      pConfig->max_size,
+                                      pConfig->invalidate,
+                                      pConfig->ttl_jitter,
+                                      pConfig->eviction);
 
     int argc = pConfig->storage_argc;
     char** argv = pConfig->storage_argv;
 
-    Storage* pStorage = sFactory->createStorage(name.c_str(), storage_config, argc, argv);
+    Storage* pStorage = sFactory->createShardedStorage(name.c_str(),
+                                                       storage_config,
+                                                       pConfig->shards,
+                                                       argc,
+                                                       argv);
+    pStorage = decorate_storage(name, *pConfig, storage_config, pStorage);
 
     if (pStorage)
     {
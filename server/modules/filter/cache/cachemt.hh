@@ -14,6 +14,7 @@
 
 #include <maxscale/cppdefs.hh>
 #include <maxscale/spinlock.hh>
+#include <maxscale/thread.h>
 #include "cachesimple.hh"
 
 class CacheMT : public CacheSimple
@@ -29,6 +30,17 @@ public:
 
     void refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSession);
 
+    /**
+     * Waits for a snapshot that is being loaded, before saving.
+     */
+    bool save_snapshot(const char* zPath);
+
+    /**
+     * Loads the snapshot in a thread of its own, so that the cache can
+     * be used while the values are being restored.
+     */
+    bool load_snapshot(const char* zPath);
+
 private:
     CacheMT(const std::string&  name,
             const CACHE_CONFIG* pConfig,
@@ -45,6 +57,13 @@ private:
     CacheMT(const CacheMT&);
     CacheMT& operator = (const CacheMT&);
 
+    void wait_for_loader();
+
+    static void load_snapshot_thread(void* pData);
+
 private:
     mutable SPINLOCK m_lock_pending; // Lock used for protecting 'pending'.
+    std::string      m_snapshot;     // The snapshot being loaded.
+    bool             m_loading;      // Whether m_loader has been started.
+    THREAD           m_loader;       // The thread loading the snapshot.
 };
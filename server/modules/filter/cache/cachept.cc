@@ -13,11 +13,15 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachept.hh"
+#include <algorithm>
 #include <maxscale/atomic.h>
 #include <maxscale/platform.h>
+#include <maxscale/spinlock.hh>
 #include "cachest.hh"
+#include "storage.hh"
 #include "storagefactory.hh"
 
+using maxscale::SpinLockGuard;
 using std::tr1::shared_ptr;
 using std::string;
 
@@ -53,6 +57,11 @@ CachePT::CachePT(const std::string&  name,
     : Cache(name, pConfig, sRules, sFactory)
     , m_caches(caches)
 {
+    for (size_t i = 0; i < m_caches.size(); ++i)
+    {
+        m_invalidations.push_back(SInvalidations(new Invalidations));
+    }
+
     MXS_NOTICE("Created cache per thread.");
 }
 
@@ -99,7 +108,9 @@ json_t* CachePT::get_info(uint32_t what) const
     {
         if (what & (INFO_PENDING | INFO_STORAGE))
         {
-            what &= ~INFO_RULES; // The rules are the same, we don't want them duplicated.
+            // The rules are the same, we don't want them duplicated, and the
+            // statistics are collected by this cache and not by the thread caches.
+            what &= ~(INFO_RULES | INFO_STATISTICS);
 
             for (size_t i = 0; i < m_caches.size(); ++i)
             {
@@ -122,19 +133,30 @@ json_t* CachePT::get_info(uint32_t what) const
     return pInfo;
 }
 
-cache_result_t CachePT::get_key(const char* zDefault_db, const GWBUF* pQuery, CACHE_KEY* pKey) const
+cache_result_t CachePT::get_key(const char* zUser,
+                                const char* zHost,
+                                const char* zState,
+                                const char* zDefault_db,
+                                const GWBUF* pQuery,
+                                CACHE_KEY* pKey) const
 {
-    return thread_cache().get_key(zDefault_db, pQuery, pKey);
+    return thread_cache().get_key(zUser, zHost, zState, zDefault_db, pQuery, pKey);
 }
 
 cache_result_t CachePT::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const
 {
+    apply_invalidations();
+
     return thread_cache().get_value(key, flags, ppValue);
 }
 
-cache_result_t CachePT::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+cache_result_t CachePT::put_value(const CACHE_KEY& key,
+                                  const std::vector<std::string>& invalidation_words,
+                                  const GWBUF* pValue)
 {
-    return thread_cache().put_value(key, pValue);
+    apply_invalidations();
+
+    return thread_cache().put_value(key, invalidation_words, pValue);
 }
 
 cache_result_t CachePT::del_value(const CACHE_KEY& key)
@@ -142,6 +164,44 @@ cache_result_t CachePT::del_value(const CACHE_KEY& key)
     return thread_cache().del_value(key);
 }
 
+cache_result_t CachePT::invalidate(const std::vector<std::string>& words)
+{
+    cache_result_t result = thread_cache().invalidate(words);
+
+    int current = thread_index();
+
+    // The caches of the other threads are single threaded, so the words are
+    // only queued and the threads apply them themselves.
+    for (int i = 0; i < (int)m_invalidations.size(); ++i)
+    {
+        if (i != current)
+        {
+            Invalidations& invalidations = *m_invalidations[i].get();
+            SpinLockGuard guard(invalidations.lock);
+
+            try
+            {
+                for (std::vector<std::string>::const_iterator j = words.begin(); j != words.end(); ++j)
+                {
+                    if (std::find(invalidations.words.begin(), invalidations.words.end(), *j) ==
+                        invalidations.words.end())
+                    {
+                        invalidations.words.push_back(*j);
+                    }
+                }
+            }
+            catch (const std::exception& x)
+            {
+                result = CACHE_RESULT_OUT_OF_RESOURCES;
+            }
+
+            atomic_store_int32(&invalidations.pending, 1);
+        }
+    }
+
+    return result;
+}
+
 // static
 CachePT* CachePT::Create(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -159,6 +219,37 @@ CachePT* CachePT::Create(const std::string&  name,
         bool error = false;
         int i = 0;
 
+        CacheST::SStorage sShared;
+
+        if (cache_config_has_shared_tier(pConfig))
+        {
+            CacheStorageConfig storage_config(CACHE_THREAD_MODEL_MT,
+                                              pConfig->hard_ttl,
+                                              pConfig->soft_ttl,
+                                              pConfig->max_count,
+                                              pConfig->max_size,
+                                              pConfig->invalidate,
+                                              pConfig->ttl_jitter,
+                                              pConfig->eviction);
+
+            string name_shared(name + "-shared");
+
+            Storage* pShared = sFactory->createShardedStorage(name_shared.c_str(),
+                                                              storage_config,
+                                                              pConfig->shards,
+                                                              pConfig->storage_argc,
+                                                              pConfig->storage_argv);
+
+            if (pShared)
+            {
+                sShared = CacheST::SStorage(pShared);
+            }
+            else
+            {
+                error = true;
+            }
+        }
+
         while (!error && (i < n_threads))
         {
             char suffix[6]; // Enough for 99999 threads
@@ -168,7 +259,7 @@ CachePT* CachePT::Create(const std::string&  name,
 
             CacheST* pCacheST = 0;
 
-            MXS_EXCEPTION_GUARD(pCacheST = CacheST::Create(namest, sRules, sFactory, pConfig));
+            MXS_EXCEPTION_GUARD(pCacheST = CacheST::Create(namest, sRules, sFactory, pConfig, sShared));
 
             if (pCacheST)
             {
@@ -196,6 +287,31 @@ CachePT* CachePT::Create(const std::string&  name,
     return pCache;
 }
 
+/**
+ * Apply the invalidations other threads have queued for the cache of
+ * the current thread.
+ */
+void CachePT::apply_invalidations() const
+{
+    int i = thread_index();
+    ss_dassert(i < (int)m_invalidations.size());
+
+    Invalidations& invalidations = *m_invalidations[i].get();
+
+    if (atomic_load_int32(&invalidations.pending))
+    {
+        std::vector<std::string> words;
+
+        {
+            SpinLockGuard guard(invalidations.lock);
+            words.swap(invalidations.words);
+            invalidations.pending = 0;
+        }
+
+        m_caches[i]->invalidate(words);
+    }
+}
+
 Cache& CachePT::thread_cache()
 {
     int i = thread_index();
@@ -15,6 +15,7 @@
 #include <maxscale/cppdefs.hh>
 #include <tr1/memory>
 #include <vector>
+#include <maxscale/spinlock.h>
 #include "cache.hh"
 
 class CachePT : public Cache
@@ -30,18 +31,52 @@ public:
 
     json_t* get_info(uint32_t what) const;
 
-    cache_result_t get_key(const char* zDefault_db, const GWBUF* pQuery, CACHE_KEY* pKey) const;
+    cache_result_t get_key(const char* zUser,
+                           const char* zHost,
+                           const char* zState,
+                           const char* zDefault_db,
+                           const GWBUF* pQuery,
+                           CACHE_KEY* pKey) const;
 
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const;
 
-    cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue);
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& invalidation_words,
+                             const GWBUF* pValue);
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    /**
+     * Invalidates the items of the cache of the current thread immediately,
+     * and the items of the caches of the other threads the next time those
+     * threads access their cache.
+     *
+     * See @Storage::invalidate
+     */
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
 private:
     typedef std::tr1::shared_ptr<Cache> SCache;
     typedef std::vector<SCache>         Caches;
 
+    /**
+     * Invalidation words that a thread has not yet applied to its cache.
+     */
+    struct Invalidations
+    {
+        Invalidations()
+            : pending(0)
+        {
+            spinlock_init(&lock);
+        }
+
+        SPINLOCK                 lock;    /*< Protects words. */
+        int                      pending; /*< Non-zero if there are words; read without the lock. */
+        std::vector<std::string> words;   /*< The words to invalidate with. */
+    };
+
+    typedef std::tr1::shared_ptr<Invalidations> SInvalidations;
+
     CachePT(const std::string&  name,
             const CACHE_CONFIG* pConfig,
             SCacheRules         sRules,
@@ -55,6 +90,8 @@ private:
 
     Cache& thread_cache();
 
+    void apply_invalidations() const;
+
     const Cache& thread_cache() const
     {
         return const_cast<CachePT*>(this)->thread_cache();
@@ -65,5 +102,6 @@ private:
     CachePT& operator = (const CachePT&);
 
 private:
-    Caches m_caches;
+    Caches                      m_caches;
+    std::vector<SInvalidations> m_invalidations; // Pending invalidations, one per thread.
 };
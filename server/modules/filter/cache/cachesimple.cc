@@ -13,8 +13,76 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "cachesimple.hh"
+#include "compressedstorage.hh"
+#include "snapshot.hh"
 #include "storage.hh"
 #include "storagefactory.hh"
+#include "tieredstorage.hh"
+
+namespace
+{
+
+/**
+ * Put a storage in front of the warm tier the configuration asks for.
+ *
+ * @param name            The name of the cache.
+ * @param config          The configuration of the cache.
+ * @param storage_config  The configuration the hot tier was created with.
+ * @param pHot            The hot tier, deleted if the warm tier cannot be
+ *                        created.
+ *
+ * @return The tiered storage, NULL if it could not be created.
+ */
+Storage* create_tiered_storage(const std::string&          name,
+                               const CACHE_CONFIG&         config,
+                               const CACHE_STORAGE_CONFIG& storage_config,
+                               Storage*                    pHot)
+{
+    Storage* pStorage = NULL;
+    StorageFactory* pWarm_factory = StorageFactory::Open(config.warm_storage);
+
+    if (pWarm_factory)
+    {
+        TieredStorage::SStorageFactory sWarm_factory(pWarm_factory);
+
+        CacheStorageConfig warm_config(storage_config);
+        warm_config.max_count = config.warm_max_count;
+        warm_config.max_size = config.warm_max_size;
+
+        uint32_t nShards = (storage_config.thread_model == CACHE_THREAD_MODEL_MT) ? config.shards : 1;
+
+        // A persistent storage uses the name for its files, so the warm
+        // tier must not use the same name as the hot tier.
+        std::string warm_name = name + "-warm";
+
+        Storage* pWarm = sWarm_factory->createShardedStorage(warm_name.c_str(),
+                                                             warm_config,
+                                                             nShards,
+                                                             config.warm_storage_argc,
+                                                             config.warm_storage_argv);
+
+        if (pWarm)
+        {
+            pStorage = TieredStorage::create(storage_config, pHot, pWarm, sWarm_factory);
+
+            if (!pStorage)
+            {
+                delete pWarm;
+            }
+        }
+    }
+
+    if (!pStorage)
+    {
+        MXS_ERROR("Could not create the warm tier '%s' of the cache '%s'.",
+                  config.warm_storage, name.c_str());
+        delete pHot;
+    }
+
+    return pStorage;
+}
+
+}
 
 CacheSimple::CacheSimple(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
@@ -50,6 +118,43 @@ bool CacheSimple::Create(const CACHE_CONFIG& config,
     return pRules != NULL;
 }
 
+/**
+ * Decorate a storage with what the configuration asks for.
+ *
+ * @param name            The name of the cache.
+ * @param config          The configuration of the cache.
+ * @param storage_config  The configuration the storage was created with.
+ * @param pStorage        The storage created by the storage factory, deleted
+ *                        if it cannot be decorated.
+ *
+ * @return The storage to use, NULL if it could not be decorated.
+ */
+// static
+Storage* CacheSimple::decorate_storage(const std::string&          name,
+                                       const CACHE_CONFIG&         config,
+                                       const CACHE_STORAGE_CONFIG& storage_config,
+                                       Storage*                    pStorage)
+{
+    if (pStorage && config.warm_storage)
+    {
+        pStorage = create_tiered_storage(name, config, storage_config, pStorage);
+    }
+
+    if (pStorage && (config.compression != CACHE_COMPRESSION_NONE))
+    {
+        Storage* pCompressed_storage = CompressedStorage::create(pStorage, config.compression_threshold);
+
+        if (!pCompressed_storage)
+        {
+            delete pStorage;
+        }
+
+        pStorage = pCompressed_storage;
+    }
+
+    return pStorage;
+}
+
 cache_result_t CacheSimple::get_value(const CACHE_KEY& key,
                                       uint32_t flags,
                                       GWBUF** ppValue) const
@@ -58,9 +163,10 @@ cache_result_t CacheSimple::get_value(const CACHE_KEY& key,
 }
 
 cache_result_t CacheSimple::put_value(const CACHE_KEY& key,
+                                      const std::vector<std::string>& invalidation_words,
                                       const GWBUF* pValue)
 {
-    return m_pStorage->put_value(key, pValue);
+    return m_pStorage->put_value(key, invalidation_words, pValue);
 }
 
 cache_result_t CacheSimple::del_value(const CACHE_KEY& key)
@@ -68,6 +174,21 @@ cache_result_t CacheSimple::del_value(const CACHE_KEY& key)
     return m_pStorage->del_value(key);
 }
 
+cache_result_t CacheSimple::invalidate(const std::vector<std::string>& words)
+{
+    return m_pStorage->invalidate(words);
+}
+
+bool CacheSimple::save_snapshot(const char* zPath)
+{
+    return Snapshot::save(*m_pStorage, zPath);
+}
+
+bool CacheSimple::load_snapshot(const char* zPath)
+{
+    return Snapshot::load(*m_pStorage, zPath);
+}
+
 // protected:
 json_t* CacheSimple::do_get_info(uint32_t what) const
 {
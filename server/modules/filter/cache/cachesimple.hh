@@ -27,10 +27,18 @@ public:
 
     cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppValue) const;
 
-    cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue);
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& invalidation_words,
+                             const GWBUF* pValue);
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
+    bool save_snapshot(const char* zPath);
+
+    bool load_snapshot(const char* zPath);
+
 protected:
     CacheSimple(const std::string&  name,
                 const CACHE_CONFIG* pConfig,
@@ -42,6 +50,10 @@ protected:
                        CacheRules**        ppRules,
                        StorageFactory**    ppFactory);
 
+    static Storage* decorate_storage(const std::string&          name,
+                                     const CACHE_CONFIG&         config,
+                                     const CACHE_STORAGE_CONFIG& storage_config,
+                                     Storage*                    pStorage);
 
     json_t* do_get_info(uint32_t what) const;
 
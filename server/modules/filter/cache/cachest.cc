@@ -15,6 +15,7 @@
 #include "cachest.hh"
 #include "storage.hh"
 #include "storagefactory.hh"
+#include "tieredstorage.hh"
 
 using std::tr1::shared_ptr;
 
@@ -56,13 +57,14 @@ CacheST* CacheST::Create(const std::string& name, const CACHE_CONFIG* pConfig)
 CacheST* CacheST::Create(const std::string&  name,
                          SCacheRules         sRules,
                          SStorageFactory     sFactory,
-                         const CACHE_CONFIG* pConfig)
+                         const CACHE_CONFIG* pConfig,
+                         SStorage            sShared)
 {
     ss_dassert(sRules.get());
     ss_dassert(sFactory.get());
     ss_dassert(pConfig);
 
-    return Create(name, pConfig, sRules, sFactory);
+    return Create(name, pConfig, sRules, sFactory, sShared);
 }
 
 json_t* CacheST::get_info(uint32_t flags) const
@@ -84,7 +86,8 @@ void CacheST::refreshed(const CACHE_KEY& key,  const CacheFilterSession* pSessio
 CacheST* CacheST::Create(const std::string&  name,
                          const CACHE_CONFIG* pConfig,
                          SCacheRules         sRules,
-                         SStorageFactory     sFactory)
+                         SStorageFactory     sFactory,
+                         SStorage            sShared)
 {
     CacheST* pCache = NULL;
 
@@ -92,13 +95,38 @@ CacheST* CacheST::Create(const std::string&  name,
                                       pConfig->hard_ttl,
                                       pConfig->soft_ttl,
                                       pConfig->max_count,
-                                      pConfig->max_size);
+                                      pConfig->max_size,
+                                      pConfig->invalidate,
+                                      pConfig->ttl_jitter,
+                                      pConfig->eviction);
+
+    if (sShared.get())
+    {
+        storage_config.max_count = pConfig->thread_max_count;
+        storage_config.max_size = pConfig->thread_max_size;
+    }
 
     int argc = pConfig->storage_argc;
     char** argv = pConfig->storage_argv;
 
     Storage* pStorage = sFactory->createStorage(name.c_str(), storage_config, argc, argv);
 
+    if (pStorage && sShared.get())
+    {
+        // The items this thread uses the most are found without locking,
+        // the rest are found in the storage shared by all threads.
+        Storage* pTiered_storage = TieredStorage::create(storage_config, pStorage, sShared, sFactory);
+
+        if (!pTiered_storage)
+        {
+            delete pStorage;
+        }
+
+        pStorage = pTiered_storage;
+    }
+
+    pStorage = decorate_storage(name, *pConfig, storage_config, pStorage);
+
     if (pStorage)
     {
         MXS_EXCEPTION_GUARD(pCache = new CacheST(name,
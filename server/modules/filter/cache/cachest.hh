@@ -18,13 +18,31 @@
 class CacheST : public CacheSimple
 {
 public:
+    typedef std::tr1::shared_ptr<Storage> SStorage;
+
     ~CacheST();
 
     static CacheST* Create(const std::string& name, const CACHE_CONFIG* pConfig);
+
+    /**
+     * Create a cache for a thread.
+     *
+     * @param name      The name of the cache.
+     * @param sRules    The rules of the cache.
+     * @param sFactory  The storage factory of the cache.
+     * @param pConfig   The configuration of the cache.
+     * @param sShared   A multi threaded storage shared by the caches of all
+     *                  threads or empty. If provided, the storage of this cache
+     *                  is limited by @c thread_max_count and @c thread_max_size
+     *                  and is the hot tier in front of the shared storage.
+     *
+     * @return A new cache or NULL if one could not be created.
+     */
     static CacheST* Create(const std::string& name,
                            SCacheRules sRules,
                            SStorageFactory sFactory,
-                           const CACHE_CONFIG* pConfig);
+                           const CACHE_CONFIG* pConfig,
+                           SStorage sShared = SStorage());
 
     json_t* get_info(uint32_t what) const;
 
@@ -42,7 +60,8 @@ private:
     static CacheST* Create(const std::string&  name,
                            const CACHE_CONFIG* pConfig,
                            SCacheRules         sRules,
-                           SStorageFactory     sFactory);
+                           SStorageFactory     sFactory,
+                           SStorage            sShared = SStorage());
 private:
     CacheST(const CacheST&);
     CacheST& operator = (const CacheST&);
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "cachestats.hh"
+#include "cache_storage_api.hh"
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/platform.h>
+#include <maxscale/spinlock.hh>
+
+using maxscale::SpinLockGuard;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+int next_thread_index = 0;
+thread_local int current_thread_index = -1;
+
+inline int get_current_thread_index()
+{
+    if (current_thread_index == -1)
+    {
+        current_thread_index = atomic_add(&next_thread_index, 1);
+    }
+
+    return current_thread_index;
+}
+
+}
+
+void CacheStats::Counters::add(const Counters& other)
+{
+    lookups += other.lookups;
+    hits += other.hits;
+    misses += other.misses;
+    stale_hits += other.stale_hits;
+    stores += other.stores;
+    stored_bytes += other.stored_bytes;
+    fetch_time += other.fetch_time;
+}
+
+CacheStats::CacheStats()
+{
+    int n_threads = config_threadcount();
+
+    if (n_threads < 1)
+    {
+        n_threads = 1;
+    }
+
+    for (int i = 0; i < n_threads; ++i)
+    {
+        m_threads.push_back(new ThreadStats);
+    }
+}
+
+CacheStats::~CacheStats()
+{
+    for (vector<ThreadStats*>::iterator i = m_threads.begin(); i != m_threads.end(); ++i)
+    {
+        delete *i;
+    }
+}
+
+void CacheStats::lookup(const vector<string>& tables, cache_result_t result)
+{
+    ThreadStats& ts = thread_stats();
+    SpinLockGuard guard(ts.lock);
+
+    for (vector<string>::const_iterator i = tables.begin(); i != tables.end(); ++i)
+    {
+        Counters& counters = ts.tables[*i];
+
+        ++counters.lookups;
+
+        if (!CACHE_RESULT_IS_OK(result))
+        {
+            ++counters.misses;
+        }
+        else if (CACHE_RESULT_IS_STALE(result))
+        {
+            ++counters.stale_hits;
+        }
+        else
+        {
+            ++counters.hits;
+        }
+    }
+}
+
+void CacheStats::store(const vector<string>& tables, size_t size, uint64_t fetch_time)
+{
+    ThreadStats& ts = thread_stats();
+    SpinLockGuard guard(ts.lock);
+
+    for (vector<string>::const_iterator i = tables.begin(); i != tables.end(); ++i)
+    {
+        Counters& counters = ts.tables[*i];
+
+        ++counters.stores;
+        counters.stored_bytes += size;
+        counters.fetch_time += fetch_time;
+    }
+}
+
+json_t* CacheStats::get_info() const
+{
+    CountersByTable tables;
+
+    for (vector<ThreadStats*>::const_iterator i = m_threads.begin(); i != m_threads.end(); ++i)
+    {
+        ThreadStats& ts = **i;
+        SpinLockGuard guard(ts.lock);
+
+        for (CountersByTable::const_iterator j = ts.tables.begin(); j != ts.tables.end(); ++j)
+        {
+            tables[j->first].add(j->second);
+        }
+    }
+
+    json_t* pInfo = json_object();
+
+    if (pInfo)
+    {
+        for (CountersByTable::const_iterator i = tables.begin(); i != tables.end(); ++i)
+        {
+            const Counters& counters = i->second;
+            json_t* pTable = json_object();
+
+            if (pTable)
+            {
+                // The latency saved by a hit is estimated as the average time
+                // it took to fetch the results that were stored.
+                uint64_t avg_fetch_time = counters.stores ? counters.fetch_time / counters.stores : 0;
+
+                cache_set_json_integer(pTable, "lookups", counters.lookups);
+                cache_set_json_integer(pTable, "hits", counters.hits);
+                cache_set_json_integer(pTable, "misses", counters.misses);
+                cache_set_json_integer(pTable, "stale_hits", counters.stale_hits);
+                cache_set_json_integer(pTable, "stores", counters.stores);
+                cache_set_json_integer(pTable, "stored_bytes", counters.stored_bytes);
+                cache_set_json_integer(pTable, "avg_fetch_time_us", avg_fetch_time);
+                cache_set_json_integer(pTable, "saved_time_us", avg_fetch_time * counters.hits);
+
+                json_object_set_new(pInfo, i->first.c_str(), pTable);
+            }
+        }
+    }
+
+    return pInfo;
+}
+
+CacheStats::ThreadStats& CacheStats::thread_stats()
+{
+    ss_dassert(!m_threads.empty());
+
+    // Should some other thread than a worker use the cache, it will share
+    // the counters of some worker.
+    return *m_threads[get_current_thread_index() % m_threads.size()];
+}
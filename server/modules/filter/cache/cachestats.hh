@@ -0,0 +1,105 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <tr1/unordered_map>
+#include <string>
+#include <vector>
+#include <maxscale/spinlock.h>
+#include "cache_storage_api.h"
+
+/**
+ * CacheStats collects per table statistics of how the cache is used.
+ *
+ * The counters are kept per thread, so a session only ever locks the
+ * counters of its own thread, which nobody else locks except when the
+ * statistics are asked for. The counters of the threads are added
+ * together only then.
+ */
+class CacheStats
+{
+public:
+    CacheStats();
+    ~CacheStats();
+
+    /**
+     * Record a lookup of the result of a SELECT.
+     *
+     * @param tables  The tables the SELECT accesses.
+     * @param result  What the lookup returned.
+     */
+    void lookup(const std::vector<std::string>& tables, cache_result_t result);
+
+    /**
+     * Record the storing of a result fetched from a backend.
+     *
+     * @param tables      The tables the SELECT accesses.
+     * @param size        The size of the result.
+     * @param fetch_time  How long it took to fetch the result, in microseconds.
+     */
+    void store(const std::vector<std::string>& tables, size_t size, uint64_t fetch_time);
+
+    /**
+     * Returns the statistics of all threads added together.
+     *
+     * @return A json object, with an object per table, or NULL if memory
+     *         could not be allocated.
+     */
+    json_t* get_info() const;
+
+private:
+    CacheStats(const CacheStats&);
+    CacheStats& operator = (const CacheStats&);
+
+    struct Counters
+    {
+        Counters()
+            : lookups(0)
+            , hits(0)
+            , misses(0)
+            , stale_hits(0)
+            , stores(0)
+            , stored_bytes(0)
+            , fetch_time(0)
+        {}
+
+        void add(const Counters& other);
+
+        uint64_t lookups;      /*< How many times a result was looked for. */
+        uint64_t hits;         /*< How many times a fresh result was found. */
+        uint64_t misses;       /*< How many times no result was found. */
+        uint64_t stale_hits;   /*< How many times a stale result was found. */
+        uint64_t stores;       /*< How many results have been stored. */
+        uint64_t stored_bytes; /*< The total size of the stored results. */
+        uint64_t fetch_time;   /*< The total time fetching the stored results took, in microseconds. */
+    };
+
+    typedef std::tr1::unordered_map<std::string, Counters> CountersByTable;
+
+    struct ThreadStats
+    {
+        ThreadStats()
+        {
+            spinlock_init(&lock);
+        }
+
+        SPINLOCK        lock;   /*< Protects the counters. */
+        CountersByTable tables; /*< The counters of each table. */
+    };
+
+    ThreadStats& thread_stats();
+
+private:
+    std::vector<ThreadStats*> m_threads; /*< The statistics of each thread. */
+};
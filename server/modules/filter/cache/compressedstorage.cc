@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "compressedstorage.hh"
+#include "cache_storage_api.hh"
+#include <maxscale/atomic.h>
+#include <maxscale/buffer.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace
+{
+
+/**
+ * A stored value starts with a byte telling how the rest of it is encoded.
+ * A compressed value has the length of the original value after that byte,
+ * as a 4-byte little endian integer.
+ */
+enum
+{
+    VALUE_RAW = 0,
+    VALUE_LZ4 = 1
+};
+
+const size_t LZ4_HEADER_LEN = 1 + 4;
+
+}
+
+CompressedStorage::CompressedStorage(Storage* pStorage, uint32_t threshold)
+    : m_pStorage(pStorage)
+    , m_threshold(threshold)
+{
+    MXS_NOTICE("Created compressing storage, values of at least %u bytes are compressed.",
+               m_threshold);
+}
+
+CompressedStorage::~CompressedStorage()
+{
+    delete m_pStorage;
+}
+
+CompressedStorage* CompressedStorage::create(Storage* pStorage, uint32_t threshold)
+{
+    CompressedStorage* pCompressed_storage = NULL;
+
+    MXS_EXCEPTION_GUARD(pCompressed_storage = new CompressedStorage(pStorage, threshold));
+
+    return pCompressed_storage;
+}
+
+//static
+bool CompressedStorage::is_available()
+{
+#ifdef HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CompressedStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    m_pStorage->get_config(pConfig);
+}
+
+cache_result_t CompressedStorage::get_info(uint32_t what,
+                                           json_t** ppInfo) const
+{
+    *ppInfo = json_object();
+
+    if (*ppInfo)
+    {
+        json_t* pCompression = json_object();
+
+        if (pCompression)
+        {
+            cache_set_json_integer(pCompression, "compressed", atomic_load_uint64(&m_stats.compressed));
+            cache_set_json_integer(pCompression, "uncompressed", atomic_load_uint64(&m_stats.uncompressed));
+            cache_set_json_integer(pCompression, "saved", atomic_load_uint64(&m_stats.saved));
+
+            json_object_set(*ppInfo, "compression", pCompression);
+            json_decref(pCompression);
+        }
+
+        json_t* pStorage_info;
+
+        if (CACHE_RESULT_IS_OK(m_pStorage->get_info(what, &pStorage_info)))
+        {
+            json_object_set(*ppInfo, "storage", pStorage_info);
+            json_decref(pStorage_info);
+        }
+    }
+
+    return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t CompressedStorage::get_value(const CACHE_KEY& key,
+                                            uint32_t flags,
+                                            GWBUF** ppValue) const
+{
+    GWBUF* pStored = NULL;
+    cache_result_t result = m_pStorage->get_value(key, flags, &pStored);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        *ppValue = pStored;
+        result = decompress_result(result, ppValue);
+    }
+
+    return result;
+}
+
+cache_result_t CompressedStorage::put_value(const CACHE_KEY& key,
+                                            const std::vector<std::string>& invalidation_words,
+                                            const GWBUF* pValue)
+{
+    ss_dassert(GWBUF_IS_CONTIGUOUS(pValue));
+
+    cache_result_t result = CACHE_RESULT_OUT_OF_RESOURCES;
+
+    // The compression is done here, outside any lock of the storage.
+    GWBUF* pStored = compress(pValue);
+
+    if (pStored)
+    {
+        result = m_pStorage->put_value(key, invalidation_words, pStored);
+        gwbuf_free(pStored);
+    }
+
+    return result;
+}
+
+cache_result_t CompressedStorage::del_value(const CACHE_KEY& key)
+{
+    return m_pStorage->del_value(key);
+}
+
+cache_result_t CompressedStorage::invalidate(const std::vector<std::string>& words)
+{
+    return m_pStorage->invalidate(words);
+}
+
+cache_result_t CompressedStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    cache_result_t result = m_pStorage->get_head(pKey, ppHead);
+
+    return CACHE_RESULT_IS_OK(result) ? decompress_result(result, ppHead) : result;
+}
+
+cache_result_t CompressedStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppTail) const
+{
+    cache_result_t result = m_pStorage->get_tail(pKey, ppTail);
+
+    return CACHE_RESULT_IS_OK(result) ? decompress_result(result, ppTail) : result;
+}
+
+cache_result_t CompressedStorage::get_size(uint64_t* pSize) const
+{
+    return m_pStorage->get_size(pSize);
+}
+
+cache_result_t CompressedStorage::get_items(uint64_t* pItems) const
+{
+    return m_pStorage->get_items(pItems);
+}
+
+cache_result_t CompressedStorage::save(Writer& writer) const
+{
+    return m_pStorage->save(writer);
+}
+
+cache_result_t CompressedStorage::restore_value(const CACHE_KEY& key,
+                                                uint32_t time,
+                                                const std::vector<std::string>& invalidation_words,
+                                                const GWBUF* pValue)
+{
+    return m_pStorage->restore_value(key, time, invalidation_words, pValue);
+}
+
+/**
+ * Encode a value for storing.
+ *
+ * @param pValue  A contiguous value.
+ *
+ * @return The value to store, NULL if memory could not be allocated.
+ */
+GWBUF* CompressedStorage::compress(const GWBUF* pValue)
+{
+    size_t len = GWBUF_LENGTH(pValue);
+    const char* pData = reinterpret_cast<const char*>(GWBUF_DATA(pValue));
+
+#ifdef HAVE_LZ4
+    if ((len >= m_threshold) && (len <= LZ4_MAX_INPUT_SIZE))
+    {
+        GWBUF* pStored = gwbuf_alloc(LZ4_HEADER_LEN + LZ4_compressBound(len));
+
+        if (pStored)
+        {
+            uint8_t* pHeader = GWBUF_DATA(pStored);
+            char* pDest = reinterpret_cast<char*>(pHeader + LZ4_HEADER_LEN);
+            int capacity = GWBUF_LENGTH(pStored) - LZ4_HEADER_LEN;
+            int compressed_len = LZ4_compress_default(pData, pDest, len, capacity);
+
+            if ((compressed_len > 0) && (LZ4_HEADER_LEN + compressed_len < len + 1))
+            {
+                pHeader[0] = VALUE_LZ4;
+                pHeader[1] = len;
+                pHeader[2] = len >> 8;
+                pHeader[3] = len >> 16;
+                pHeader[4] = len >> 24;
+
+                atomic_add_uint64(&m_stats.compressed, 1);
+                atomic_add_uint64(&m_stats.saved, len + 1 - (LZ4_HEADER_LEN + compressed_len));
+
+                // Only the compressed bytes are stored and accounted for.
+                return gwbuf_rtrim(pStored, capacity - compressed_len);
+            }
+
+            gwbuf_free(pStored);
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+#endif
+
+    GWBUF* pStored = gwbuf_alloc(1 + len);
+
+    if (pStored)
+    {
+        uint8_t* pHeader = GWBUF_DATA(pStored);
+        pHeader[0] = VALUE_RAW;
+        memcpy(pHeader + 1, pData, len);
+
+        atomic_add_uint64(&m_stats.uncompressed, 1);
+    }
+
+    return pStored;
+}
+
+/**
+ * Decode a stored value.
+ *
+ * @param pStored  A value stored by @c compress.
+ *
+ * @return The original value, NULL if the stored value could not be decoded
+ *         or memory could not be allocated.
+ */
+GWBUF* CompressedStorage::decompress(const GWBUF* pStored) const
+{
+    GWBUF* pValue = NULL;
+    size_t len = GWBUF_LENGTH(pStored);
+    const uint8_t* pHeader = GWBUF_DATA(pStored);
+
+    if ((len >= 1) && (pHeader[0] == VALUE_RAW))
+    {
+        pValue = gwbuf_alloc_and_load(len - 1, pHeader + 1);
+    }
+#ifdef HAVE_LZ4
+    else if ((len >= LZ4_HEADER_LEN) && (pHeader[0] == VALUE_LZ4))
+    {
+        uint32_t original_len = pHeader[1] | (pHeader[2] << 8) | (pHeader[3] << 16) |
+                                ((uint32_t)pHeader[4] << 24);
+
+        pValue = gwbuf_alloc(original_len);
+
+        if (pValue)
+        {
+            const char* pSource = reinterpret_cast<const char*>(pHeader + LZ4_HEADER_LEN);
+            char* pDest = reinterpret_cast<char*>(GWBUF_DATA(pValue));
+
+            if (LZ4_decompress_safe(pSource, pDest, len - LZ4_HEADER_LEN, original_len) !=
+                (int)original_len)
+            {
+                MXS_ERROR("Could not decompress cached value.");
+                gwbuf_free(pValue);
+                pValue = NULL;
+            }
+        }
+    }
+#endif
+    else
+    {
+        MXS_ERROR("Cached value is of unknown format.");
+    }
+
+    return pValue;
+}
+
+/**
+ * Replace a fetched value with the decoded one.
+ *
+ * @param result   The result of fetching the value.
+ * @param ppValue  The fetched value, on return the decoded one.
+ *
+ * @return The result to return.
+ */
+cache_result_t CompressedStorage::decompress_result(cache_result_t result, GWBUF** ppValue) const
+{
+    GWBUF* pValue = decompress(*ppValue);
+    gwbuf_free(*ppValue);
+    *ppValue = pValue;
+
+    if (!pValue)
+    {
+        // The session will fetch the value from the server and store it anew.
+        result = CACHE_RESULT_NOT_FOUND;
+    }
+
+    return result;
+}
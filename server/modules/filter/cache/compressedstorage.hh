@@ -0,0 +1,116 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include "storage.hh"
+
+/**
+ * CompressedStorage compresses the values before they are put to the
+ * storage it decorates and decompresses them when they are fetched. As
+ * it is on top of the storage that enforces max_size, the compressed
+ * size of the values is what counts. Values smaller than the threshold,
+ * and values that do not become smaller, are stored as they are.
+ */
+class CompressedStorage : public Storage
+{
+public:
+    ~CompressedStorage();
+
+    /**
+     * Create a compressing storage.
+     *
+     * @param pStorage   The storage to decorate, on successful return owned
+     *                   by the created instance.
+     * @param threshold  The minimum size of a value for it to be compressed.
+     *
+     * @return A new instance or NULL if one could not be created.
+     */
+    static CompressedStorage* create(Storage* pStorage, uint32_t threshold);
+
+    /**
+     * Whether compression is available in this build.
+     *
+     * @return True, if values can be compressed.
+     */
+    static bool is_available();
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+
+    cache_result_t get_info(uint32_t what,
+                            json_t** ppInfo) const;
+
+    cache_result_t get_value(const CACHE_KEY& key,
+                             uint32_t flags,
+                             GWBUF** ppValue) const;
+
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& invalidation_words,
+                             const GWBUF* pValue);
+
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
+    cache_result_t get_head(CACHE_KEY* pKey,
+                            GWBUF** ppHead) const;
+
+    cache_result_t get_tail(CACHE_KEY* pKey,
+                            GWBUF** ppTail) const;
+
+    cache_result_t get_size(uint64_t* pSize) const;
+
+    cache_result_t get_items(uint64_t* pItems) const;
+
+    /**
+     * The values are written as they are stored, that is, compressed.
+     */
+    cache_result_t save(Writer& writer) const;
+
+    /**
+     * The value is expected to be as it was written, that is, compressed.
+     */
+    cache_result_t restore_value(const CACHE_KEY& key,
+                                 uint32_t time,
+                                 const std::vector<std::string>& invalidation_words,
+                                 const GWBUF* pValue);
+
+private:
+    CompressedStorage(Storage* pStorage, uint32_t threshold);
+
+    CompressedStorage(const CompressedStorage&);
+    CompressedStorage& operator = (const CompressedStorage&);
+
+    GWBUF* compress(const GWBUF* pValue);
+    GWBUF* decompress(const GWBUF* pStored) const;
+
+    cache_result_t decompress_result(cache_result_t result, GWBUF** ppValue) const;
+
+private:
+    struct Stats
+    {
+        Stats()
+            : compressed(0)
+            , uncompressed(0)
+            , saved(0)
+        {}
+
+        uint64_t compressed;   /*< How many values have been stored compressed. */
+        uint64_t uncompressed; /*< How many values have been stored as they are. */
+        uint64_t saved;        /*< How many bytes compression has saved in total. */
+    };
+
+    Storage*       m_pStorage;  /*< The decorated storage. */
+    const uint32_t m_threshold; /*< The minimum size of a value to compress. */
+    Stats          m_stats;     /*< Compression statistics, updated atomically. */
+};
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "frequencysketch.hh"
+
+namespace
+{
+
+const size_t MIN_WIDTH = 64;
+const size_t MAX_WIDTH = 1 << 22;
+
+// A row has this many counters per key, so that few keys share all counters.
+const size_t COUNTERS_PER_KEY = 4;
+
+// The width used when the capacity is not known.
+const size_t DEFAULT_WIDTH = 1 << 16;
+
+size_t sketch_width(uint64_t capacity)
+{
+    size_t width = MIN_WIDTH;
+
+    if (capacity == 0)
+    {
+        width = DEFAULT_WIDTH;
+    }
+
+    while ((width < COUNTERS_PER_KEY * capacity) && (width < MAX_WIDTH))
+    {
+        width <<= 1;
+    }
+
+    return width;
+}
+
+}
+
+FrequencySketch::FrequencySketch(uint64_t capacity)
+    : m_counters(DEPTH * sketch_width(capacity))
+    , m_mask(m_counters.size() / DEPTH - 1)
+    , m_additions(0)
+    , m_sample_size(10 * (m_mask + 1))
+    , m_resets(0)
+{
+}
+
+void FrequencySketch::increment(const CACHE_KEY& key)
+{
+    uint32_t frequency = MAX_FREQUENCY;
+    size_t indexes[DEPTH];
+
+    for (size_t row = 0; row < DEPTH; ++row)
+    {
+        indexes[row] = index(key, row);
+
+        if (m_counters[indexes[row]] < frequency)
+        {
+            frequency = m_counters[indexes[row]];
+        }
+    }
+
+    if (frequency < MAX_FREQUENCY)
+    {
+        // Only the smallest counters are incremented, so that keys sharing
+        // a counter with a frequent key are overestimated as little as possible.
+        for (size_t row = 0; row < DEPTH; ++row)
+        {
+            if (m_counters[indexes[row]] == frequency)
+            {
+                ++m_counters[indexes[row]];
+            }
+        }
+    }
+
+    if (++m_additions == m_sample_size)
+    {
+        reset();
+    }
+}
+
+uint32_t FrequencySketch::frequency(const CACHE_KEY& key) const
+{
+    uint32_t frequency = MAX_FREQUENCY;
+
+    for (size_t row = 0; row < DEPTH; ++row)
+    {
+        uint32_t count = m_counters[index(key, row)];
+
+        if (count < frequency)
+        {
+            frequency = count;
+        }
+    }
+
+    return frequency;
+}
+
+/**
+ * Return the index of the counter of a key in a row.
+ *
+ * @param key  The key.
+ * @param row  The row.
+ *
+ * @return The index in @c m_counters.
+ */
+size_t FrequencySketch::index(const CACHE_KEY& key, size_t row) const
+{
+    // Each row mixes the key with a different constant (splitmix64).
+    uint64_t h = key.hi ^ (key.lo * UINT64_C(0x9e3779b97f4a7c15));
+    h += (row + 1) * UINT64_C(0xbf58476d1ce4e5b9);
+    h ^= h >> 31;
+    h *= UINT64_C(0x94d049bb133111eb);
+    h ^= h >> 29;
+
+    return row * (m_mask + 1) + (h & m_mask);
+}
+
+/**
+ * Halve all counters.
+ */
+void FrequencySketch::reset()
+{
+    for (std::vector<uint8_t>::iterator i = m_counters.begin(); i != m_counters.end(); ++i)
+    {
+        *i >>= 1;
+    }
+
+    m_additions /= 2;
+    ++m_resets;
+}
@@ -0,0 +1,87 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <vector>
+#include "cache_storage_api.h"
+
+/**
+ * FrequencySketch estimates how often keys have been used recently.
+ *
+ * It is a count-min sketch: each key has a small saturating counter in
+ * each of a few rows, and the estimate is the smallest of them. Keys may
+ * share counters, so the estimate may be too large but never too small.
+ * Once the counters have been incremented ten times the width of the
+ * sketch, all counters are halved, so that what was used often long ago
+ * does not remain frequent forever.
+ *
+ * The sketch does no locking.
+ */
+class FrequencySketch
+{
+public:
+    enum
+    {
+        MAX_FREQUENCY = 15 /*< The largest value a counter reaches. */
+    };
+
+    /**
+     * Constructor
+     *
+     * @param capacity  The number of keys whose frequencies should be told
+     *                  apart, e.g. the maximum number of items in a cache.
+     *
+     * @throws std::bad_alloc  If memory could not be allocated.
+     */
+    FrequencySketch(uint64_t capacity);
+
+    /**
+     * Record a use of a key.
+     *
+     * @param key  The key.
+     */
+    void increment(const CACHE_KEY& key);
+
+    /**
+     * Estimate how often a key has been used.
+     *
+     * @param key  The key.
+     *
+     * @return A number between 0 and @c MAX_FREQUENCY.
+     */
+    uint32_t frequency(const CACHE_KEY& key) const;
+
+    /**
+     * @return How many times the counters have been halved.
+     */
+    uint64_t resets() const
+    {
+        return m_resets;
+    }
+
+private:
+    enum
+    {
+        DEPTH = 4 /*< The number of rows. */
+    };
+
+    size_t index(const CACHE_KEY& key, size_t row) const;
+    void reset();
+
+    std::vector<uint8_t> m_counters;    /*< The rows, one after the other. */
+    size_t               m_mask;        /*< The width of a row less one, the width is a power of 2. */
+    uint64_t             m_additions;   /*< Increments since the counters were halved. */
+    uint64_t             m_sample_size; /*< Increments after which the counters are halved. */
+    uint64_t             m_resets;      /*< How many times the counters have been halved. */
+};
@@ -21,6 +21,7 @@ LRUStorage::LRUStorage(const CACHE_STORAGE_CONFIG& config, Storage* pStorage)
     , m_max_size(config.max_size != 0 ? config.max_size : UINT64_MAX)
     , m_pHead(NULL)
     , m_pTail(NULL)
+    , m_pSketch(config.eviction == CACHE_EVICTION_TINYLFU ? new FrequencySketch(config.max_count) : NULL)
 {
 }
 
@@ -34,6 +35,7 @@ LRUStorage::~LRUStorage()
     }
 
     delete m_pStorage;
+    delete m_pSketch;
 }
 
 void LRUStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
@@ -79,7 +81,42 @@ cache_result_t LRUStorage::do_get_value(const CACHE_KEY& key,
     return access_value(APPROACH_GET, key, flags, ppValue);
 }
 
-cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalue)
+cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key,
+                                        const std::vector<std::string>& invalidation_words,
+                                        const GWBUF* pvalue)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    if (!m_pSketch || admit(key, GWBUF_LENGTH(pvalue)))
+    {
+        result = put_node(key, invalidation_words, pvalue, time(NULL), true);
+    }
+    else
+    {
+        // Not caching a value is not an error.
+        ++m_stats.rejections;
+    }
+
+    return result;
+}
+
+/**
+ * Put a value and update its node.
+ *
+ * @param key                 The key of the value.
+ * @param invalidation_words  The words the value can be invalidated with.
+ * @param pvalue              The value.
+ * @param time                When the value is regarded to have been put.
+ * @param store               Whether the value should be put to the actual storage,
+ *                            false if the actual storage already has it.
+ *
+ * @return CACHE_RESULT_OK if the value was put.
+ */
+cache_result_t LRUStorage::put_node(const CACHE_KEY& key,
+                                    const std::vector<std::string>& invalidation_words,
+                                    const GWBUF* pvalue,
+                                    uint32_t time,
+                                    bool store)
 {
     cache_result_t result = CACHE_RESULT_ERROR;
 
@@ -103,7 +140,7 @@ cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalu
     {
         ss_dassert(pNode);
 
-        result = m_pStorage->put_value(key, pvalue);
+        result = store ? m_pStorage->put_value(key, invalidation_words, pvalue) : CACHE_RESULT_OK;
 
         if (CACHE_RESULT_IS_OK(result))
         {
@@ -118,10 +155,23 @@ cache_result_t LRUStorage::do_put_value(const CACHE_KEY& key, const GWBUF* pvalu
                 ++m_stats.items;
             }
 
-            pNode->reset(&i->first, value_size);
+            remove_invalidation_words(pNode);
+            pNode->reset(&i->first, value_size, time);
             m_stats.size += pNode->size();
 
             move_to_head(pNode);
+
+            try
+            {
+                add_invalidation_words(pNode, invalidation_words);
+            }
+            catch (const std::exception& x)
+            {
+                // An item that cannot be invalidated must not be left in the cache.
+                MXS_ERROR("Could not record the invalidation words of an item, removing it.");
+                do_del_value(key);
+                result = CACHE_RESULT_OUT_OF_RESOURCES;
+            }
         }
         else if (!existed)
         {
@@ -162,6 +212,48 @@ cache_result_t LRUStorage::do_del_value(const CACHE_KEY& key)
     return result;
 }
 
+cache_result_t LRUStorage::do_invalidate(const std::vector<std::string>& words)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    for (std::vector<std::string>::const_iterator i = words.begin();
+         CACHE_RESULT_IS_OK(result) && (i != words.end());
+         ++i)
+    {
+        KeysByWord::iterator j = m_keys_by_word.find(*i);
+
+        if (j != m_keys_by_word.end())
+        {
+            try
+            {
+                // Deleting a value removes its key from the mapping, so the
+                // keys must be copied before they are deleted.
+                std::vector<CACHE_KEY> keys(j->second.begin(), j->second.end());
+
+                for (std::vector<CACHE_KEY>::iterator k = keys.begin(); k != keys.end(); ++k)
+                {
+                    cache_result_t rv = do_del_value(*k);
+
+                    if (CACHE_RESULT_IS_OK(rv))
+                    {
+                        ++m_stats.invalidations;
+                    }
+                    else if (!CACHE_RESULT_IS_NOT_FOUND(rv))
+                    {
+                        result = rv;
+                    }
+                }
+            }
+            catch (const std::exception& x)
+            {
+                result = CACHE_RESULT_OUT_OF_RESOURCES;
+            }
+        }
+    }
+
+    return result;
+}
+
 cache_result_t LRUStorage::do_get_head(CACHE_KEY* pKey, GWBUF** ppValue) const
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
@@ -213,6 +305,65 @@ cache_result_t LRUStorage::do_get_items(uint64_t* pItems) const
     return CACHE_RESULT_OK;
 }
 
+cache_result_t LRUStorage::do_save(Writer& writer) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // From the tail to the head, so that when restored in the same order,
+    // the most recently used value again is at the head.
+    Node* pNode = m_pTail;
+
+    while (CACHE_RESULT_IS_OK(result) && pNode)
+    {
+        const CACHE_KEY* pKey = pNode->key();
+        ss_dassert(pKey);
+
+        GWBUF* pValue = NULL;
+
+        if (CACHE_RESULT_IS_OK(m_pStorage->get_value(*pKey, CACHE_FLAGS_INCLUDE_STALE, &pValue)))
+        {
+            if (!writer.write(*pKey, pNode->time(), pNode->invalidation_words(), *pValue))
+            {
+                result = CACHE_RESULT_OUT_OF_RESOURCES;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        pNode = pNode->prev();
+    }
+
+    return result;
+}
+
+cache_result_t LRUStorage::do_restore_value(const CACHE_KEY& key,
+                                            uint32_t time,
+                                            const std::vector<std::string>& invalidation_words,
+                                            const GWBUF* pValue)
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    uint32_t hard_ttl = cache_storage_ttl(&m_config, &key, m_config.hard_ttl);
+    bool expired = (hard_ttl != 0) && (::time(NULL) - time > hard_ttl);
+
+    if (!expired && (m_nodes_by_key.find(key) == m_nodes_by_key.end()))
+    {
+        GWBUF* pStored = NULL;
+
+        if (CACHE_RESULT_IS_OK(m_pStorage->get_value(key, CACHE_FLAGS_INCLUDE_STALE, &pStored)))
+        {
+            result = put_node(key, invalidation_words, pStored, time, false);
+            gwbuf_free(pStored);
+        }
+        else
+        {
+            result = put_node(key, invalidation_words, pValue, time, true);
+        }
+    }
+
+    return result;
+}
+
 cache_result_t LRUStorage::access_value(access_approach_t approach,
                                         const CACHE_KEY& key,
                                         uint32_t flags,
@@ -220,12 +371,49 @@ cache_result_t LRUStorage::access_value(access_approach_t approach,
 {
     cache_result_t result = CACHE_RESULT_NOT_FOUND;
 
+    if (m_pSketch && (approach == APPROACH_GET))
+    {
+        // Misses are counted as well, as a value is put after it was missed.
+        m_pSketch->increment(key);
+    }
+
     NodesByKey::iterator i = m_nodes_by_key.find(key);
     bool existed = (i != m_nodes_by_key.end());
 
     if (existed)
     {
-        result = m_pStorage->get_value(key, flags, ppValue);
+        result = m_pStorage->get_value(key, flags | CACHE_FLAGS_INCLUDE_STALE, ppValue);
+
+        if (CACHE_RESULT_IS_OK(result))
+        {
+            // A restored value is older than the actual storage thinks it is,
+            // so the time to live is enforced here as well.
+            uint32_t age = time(NULL) - i->second->time();
+            uint32_t hard_ttl = cache_storage_ttl(&m_config, &key, m_config.hard_ttl);
+            uint32_t soft_ttl = cache_storage_ttl(&m_config, &key, m_config.soft_ttl);
+
+            if ((hard_ttl != 0) && (age > hard_ttl))
+            {
+                gwbuf_free(*ppValue);
+                *ppValue = NULL;
+                m_pStorage->del_value(key);
+                result = CACHE_RESULT_NOT_FOUND;
+            }
+            else
+            {
+                if ((soft_ttl != 0) && (age > soft_ttl))
+                {
+                    result |= CACHE_RESULT_STALE;
+                }
+
+                if (CACHE_RESULT_IS_STALE(result) && !(flags & CACHE_FLAGS_INCLUDE_STALE))
+                {
+                    gwbuf_free(*ppValue);
+                    *ppValue = NULL;
+                    result = (CACHE_RESULT_NOT_FOUND | CACHE_RESULT_STALE);
+                }
+            }
+        }
 
         if (CACHE_RESULT_IS_OK(result))
         {
@@ -353,6 +541,8 @@ bool LRUStorage::free_node_data(Node* pNode)
             MXS_ERROR("Item in LRU list was not found in storage.");
         }
 
+        remove_invalidation_words(pNode);
+
         if (i != m_nodes_by_key.end())
         {
             m_nodes_by_key.erase(i);
@@ -397,6 +587,7 @@ void LRUStorage::free_node(Node* pNode) const
  */
 void LRUStorage::free_node(NodesByKey::iterator& i) const
 {
+    remove_invalidation_words(i->second);
     free_node(i->second); // A Node
     m_nodes_by_key.erase(i);
 }
@@ -456,6 +647,106 @@ void LRUStorage::move_to_head(Node* pNode) const
     ss_dassert(m_pTail->next() == NULL);
 }
 
+/**
+ * Record the invalidation words of a node.
+ *
+ * @param pNode  The node, whose key must be set.
+ * @param words  The invalidation words of the item.
+ *
+ * @throws std::bad_alloc  If memory could not be allocated.
+ */
+void LRUStorage::add_invalidation_words(Node* pNode, const std::vector<std::string>& words)
+{
+    ss_dassert(pNode->key());
+    ss_dassert(pNode->invalidation_words().empty());
+
+    pNode->invalidation_words() = words;
+
+    for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        m_keys_by_word[*i].insert(*pNode->key());
+    }
+}
+
+/**
+ * Remove the invalidation words of a node from the mapping of words to keys.
+ *
+ * @param pNode  The node.
+ */
+void LRUStorage::remove_invalidation_words(Node* pNode) const
+{
+    std::vector<std::string>& words = pNode->invalidation_words();
+
+    for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        KeysByWord::iterator j = m_keys_by_word.find(*i);
+
+        if (j != m_keys_by_word.end())
+        {
+            j->second.erase(*pNode->key());
+
+            if (j->second.empty())
+            {
+                m_keys_by_word.erase(j);
+            }
+        }
+    }
+
+    words.clear();
+}
+
+/**
+ * Decide whether a value may be put. A new value is only put to a full
+ * storage if its key has been used more often than the keys of each of the
+ * values that would be evicted, so that values used only once, e.g. by a
+ * scan, do not evict values that are used all the time.
+ *
+ * @param key         The key of the value.
+ * @param value_size  The size of the value.
+ *
+ * @return True, if the value should be put.
+ */
+bool LRUStorage::admit(const CACHE_KEY& key, size_t value_size) const
+{
+    ss_dassert(m_pSketch);
+
+    bool admitted = true;
+
+    if (m_nodes_by_key.find(key) == m_nodes_by_key.end())
+    {
+        size_t needed_space = 0;
+
+        // The same decisions as in get_new_node().
+        if (m_stats.size + value_size > m_max_size)
+        {
+            needed_space = value_size;
+        }
+        else if (m_stats.items == m_max_count)
+        {
+            needed_space = 1;
+        }
+
+        uint32_t frequency = needed_space ? m_pSketch->frequency(key) : 0;
+        size_t freed_space = 0;
+        Node* pVictim = m_pTail;
+
+        while (admitted && pVictim && (freed_space < needed_space))
+        {
+            ss_dassert(pVictim->key());
+
+            if (frequency <= m_pSketch->frequency(*pVictim->key()))
+            {
+                admitted = false;
+            }
+
+            freed_space += pVictim->size();
+            pVictim = pVictim->prev();
+        }
+    }
+
+    return admitted;
+}
+
 cache_result_t LRUStorage::get_existing_node(NodesByKey::iterator& i, const GWBUF* pValue, Node** ppNode)
 {
     cache_result_t result = CACHE_RESULT_OK;
@@ -579,24 +870,15 @@ cache_result_t LRUStorage::get_new_node(const CACHE_KEY& key,
     return result;
 }
 
-static void set_integer(json_t* pObject, const char* zName, size_t value)
-{
-    json_t* pValue = json_integer(value);
-
-    if (pValue)
-    {
-        json_object_set(pObject, zName, pValue);
-        json_decref(pValue);
-    }
-}
-
 void LRUStorage::Stats::fill(json_t* pObject) const
 {
-    set_integer(pObject, "size", size);
-    set_integer(pObject, "items", items);
-    set_integer(pObject, "hits", hits);
-    set_integer(pObject, "misses", misses);
-    set_integer(pObject, "updates", updates);
-    set_integer(pObject, "deletes", deletes);
-    set_integer(pObject, "evictions", evictions);
+    cache_set_json_integer(pObject, "size", size);
+    cache_set_json_integer(pObject, "items", items);
+    cache_set_json_integer(pObject, "hits", hits);
+    cache_set_json_integer(pObject, "misses", misses);
+    cache_set_json_integer(pObject, "updates", updates);
+    cache_set_json_integer(pObject, "deletes", deletes);
+    cache_set_json_integer(pObject, "evictions", evictions);
+    cache_set_json_integer(pObject, "invalidations", invalidations);
+    cache_set_json_integer(pObject, "rejections", rejections);
 }
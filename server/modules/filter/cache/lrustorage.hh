@@ -13,9 +13,13 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
 #include <tr1/unordered_map>
+#include <tr1/unordered_set>
 #include "cachefilter.h"
 #include "cache_storage_api.hh"
+#include "frequencysketch.hh"
 #include "storage.hh"
 
 class LRUStorage : public Storage
@@ -47,6 +51,7 @@ protected:
      * @see Storage::put_value
      */
     cache_result_t do_put_value(const CACHE_KEY& key,
+                                const std::vector<std::string>& invalidation_words,
                                 const GWBUF* pValue);
 
     /**
@@ -54,6 +59,11 @@ protected:
      */
     cache_result_t do_del_value(const CACHE_KEY& key);
 
+    /**
+     * @see Storage::invalidate
+     */
+    cache_result_t do_invalidate(const std::vector<std::string>& words);
+
     /**
      * @see Storage::get_head
      */
@@ -76,6 +86,22 @@ protected:
      */
     cache_result_t do_get_items(uint64_t* pItems) const;
 
+    /**
+     * @see Storage::save
+     */
+    cache_result_t do_save(Writer& writer) const;
+
+    /**
+     * @see Storage::restore_value
+     *
+     * If the actual storage already has the value, e.g. because it is
+     * persistent, the value is not put again but only its node is created.
+     */
+    cache_result_t do_restore_value(const CACHE_KEY& key,
+                                    uint32_t time,
+                                    const std::vector<std::string>& invalidation_words,
+                                    const GWBUF* pValue);
+
 private:
     LRUStorage(const LRUStorage&);
     LRUStorage& operator = (const LRUStorage&);
@@ -107,6 +133,7 @@ private:
         Node()
             : m_pKey(NULL)
             , m_size(0)
+            , m_time(0)
             , m_pNext(NULL)
             , m_pPrev(NULL)
         {}
@@ -123,6 +150,10 @@ private:
         {
             return m_size;
         }
+        uint32_t time() const
+        {
+            return m_time;
+        }
         Node* next() const
         {
             return m_pNext;
@@ -131,6 +162,14 @@ private:
         {
             return m_pPrev;
         }
+        const std::vector<std::string>& invalidation_words() const
+        {
+            return m_invalidation_words;
+        }
+        std::vector<std::string>& invalidation_words()
+        {
+            return m_invalidation_words;
+        }
 
         /**
          * Move the node before the node provided as argument.
@@ -191,20 +230,25 @@ private:
             return pNode;
         }
 
-        void reset(const CACHE_KEY* pkey = NULL, size_t size = 0)
+        void reset(const CACHE_KEY* pkey = NULL, size_t size = 0, uint32_t time = 0)
         {
             m_pKey = pkey;
             m_size = size;
+            m_time = time;
         }
 
     private:
-        const CACHE_KEY* m_pKey;  /*< Points at the key stored in nodes_by_key_ below. */
-        size_t           m_size;  /*< The size of the data referred to by m_pKey. */
-        Node*            m_pNext; /*< The next node in the LRU list. */
-        Node*            m_pPrev; /*< The previous node in the LRU list. */
+        const CACHE_KEY*         m_pKey;               /*< Points at the key stored in nodes_by_key_ below. */
+        size_t                   m_size;               /*< The size of the data referred to by m_pKey. */
+        uint32_t                 m_time;               /*< When the data was put. */
+        Node*                    m_pNext;              /*< The next node in the LRU list. */
+        Node*                    m_pPrev;              /*< The previous node in the LRU list. */
+        std::vector<std::string> m_invalidation_words; /*< The words the item can be invalidated with. */
     };
 
     typedef std::tr1::unordered_map<CACHE_KEY, Node*> NodesByKey;
+    typedef std::tr1::unordered_set<CACHE_KEY> Keys;
+    typedef std::tr1::unordered_map<std::string, Keys> KeysByWord;
 
     Node* vacate_lru();
     Node* vacate_lru(size_t space);
@@ -213,6 +257,15 @@ private:
     void free_node(NodesByKey::iterator& i) const;
     void remove_node(Node* pNode) const;
     void move_to_head(Node* pNode) const;
+    void add_invalidation_words(Node* pNode, const std::vector<std::string>& words);
+    void remove_invalidation_words(Node* pNode) const;
+    bool admit(const CACHE_KEY& key, size_t value_size) const;
+
+    cache_result_t put_node(const CACHE_KEY& key,
+                            const std::vector<std::string>& invalidation_words,
+                            const GWBUF* pValue,
+                            uint32_t time,
+                            bool store);
 
     cache_result_t get_existing_node(NodesByKey::iterator& i, const GWBUF* pvalue, Node** ppNode);
     cache_result_t get_new_node(const CACHE_KEY& key,
@@ -231,6 +284,8 @@ private:
             , updates(0)
             , deletes(0)
             , evictions(0)
+            , invalidations(0)
+            , rejections(0)
         {}
 
         void fill(json_t* pObject) const;
@@ -242,6 +297,8 @@ private:
         uint64_t updates;    /*< How many times an existing key in the cache was updated. */
         uint64_t deletes;    /*< How many times an existing key in the cache was deleted. */
         uint64_t evictions;  /*< How many times an item has been evicted from the cache. */
+        uint64_t invalidations; /*< How many items have been invalidated. */
+        uint64_t rejections; /*< How many new items were not admitted to a full cache. */
     };
 
     const CACHE_STORAGE_CONFIG m_config;       /*< The configuration. */
@@ -250,6 +307,8 @@ private:
     const uint64_t             m_max_size;     /*< The maximum size of all cached items. */
     mutable Stats              m_stats;        /*< Cache statistics. */
     mutable NodesByKey         m_nodes_by_key; /*< Mapping from cache keys to corresponding Node. */
+    mutable KeysByWord         m_keys_by_word; /*< Mapping from invalidation words to cache keys. */
     mutable Node*              m_pHead;        /*< The node at the LRU list. */
     mutable Node*              m_pTail;        /*< The node at bottom of the LRU list.*/
+    FrequencySketch*           m_pSketch;      /*< The frequencies of the keys, NULL if all are admitted. */
 };
@@ -46,9 +46,11 @@ cache_result_t LRUStorageST::get_value(const CACHE_KEY& key,
     return LRUStorage::do_get_value(key, flags, ppValue);
 }
 
-cache_result_t LRUStorageST::put_value(const CACHE_KEY& key, const GWBUF* pValue)
+cache_result_t LRUStorageST::put_value(const CACHE_KEY& key,
+                                       const std::vector<std::string>& invalidation_words,
+                                       const GWBUF* pValue)
 {
-    return LRUStorage::do_put_value(key, pValue);
+    return LRUStorage::do_put_value(key, invalidation_words, pValue);
 }
 
 cache_result_t LRUStorageST::del_value(const CACHE_KEY& key)
@@ -56,6 +58,11 @@ cache_result_t LRUStorageST::del_value(const CACHE_KEY& key)
     return LRUStorage::do_del_value(key);
 }
 
+cache_result_t LRUStorageST::invalidate(const std::vector<std::string>& words)
+{
+    return LRUStorage::do_invalidate(words);
+}
+
 cache_result_t LRUStorageST::get_head(CACHE_KEY* pKey, GWBUF** ppValue) const
 {
     return LRUStorage::do_get_head(pKey, ppValue);
@@ -75,3 +82,16 @@ cache_result_t LRUStorageST::get_items(uint64_t* pItems) const
 {
     return LRUStorage::do_get_items(pItems);
 }
+
+cache_result_t LRUStorageST::save(Writer& writer) const
+{
+    return LRUStorage::do_save(writer);
+}
+
+cache_result_t LRUStorageST::restore_value(const CACHE_KEY& key,
+                                           uint32_t time,
+                                           const std::vector<std::string>& invalidation_words,
+                                           const GWBUF* pValue)
+{
+    return LRUStorage::do_restore_value(key, time, invalidation_words, pValue);
+}
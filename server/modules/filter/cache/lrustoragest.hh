@@ -30,10 +30,13 @@ public:
                              GWBUF** ppValue) const;
 
     cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& invalidation_words,
                              const GWBUF* pValue);
 
     cache_result_t del_value(const CACHE_KEY& key);
 
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
     cache_result_t get_head(CACHE_KEY* pKey,
                             GWBUF** ppValue) const;
 
@@ -44,6 +47,13 @@ public:
 
     cache_result_t get_items(uint64_t* pItems) const;
 
+    cache_result_t save(Writer& writer) const;
+
+    cache_result_t restore_value(const CACHE_KEY& key,
+                                 uint32_t time,
+                                 const std::vector<std::string>& invalidation_words,
+                                 const GWBUF* pValue);
+
 private:
     LRUStorageST(const CACHE_STORAGE_CONFIG& config, Storage* pstorage);
 
@@ -13,9 +13,13 @@
 
 #define MXS_MODULE_NAME "cache"
 #include "rules.h"
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <new>
+#include <string>
+#include <vector>
+#include <tr1/unordered_set>
 #include <maxscale/alloc.h>
 #include <maxscale/modutil.h>
 #include <maxscale/mysql_utils.h>
@@ -161,6 +165,31 @@ static bool cache_rules_parse_use_element(CACHE_RULES *self, json_t *object, siz
 static pcre2_match_data** alloc_match_datas(int count, pcre2_code* code);
 static void free_match_datas(int count, pcre2_match_data** datas);
 
+/**
+ * The rules compiled for evaluation. The exact matches of tables, databases
+ * and accounts, which are the common case, are looked up from hash sets, so
+ * that their evaluation does not depend upon the number of rules. The other
+ * rules are evaluated one by one, as they are in the lists of the rules.
+ */
+struct cache_rules_index
+{
+    typedef std::tr1::unordered_set<std::string> Names;
+
+    Names                    store_tables;           // Lower case names of tables, without a database.
+    Names                    store_qualified_tables; // Lower case names of tables, with a database.
+    Names                    store_databases;        // Names of databases.
+    std::vector<CACHE_RULE*> store_rules;            // The other store rules.
+    Names                    use_accounts;           // Accounts, as "user@host".
+    std::vector<CACHE_RULE*> use_rules;              // The other use rules.
+};
+
+static cache_rules_index* cache_rules_index_create(const CACHE_RULES *self);
+static bool cache_rules_index_should_store(const cache_rules_index *index,
+                                           int thread_id,
+                                           const char *default_db,
+                                           const GWBUF* query);
+static bool cache_rules_index_should_use(const cache_rules_index *index, int thread_id, const char *account);
+
 /*
  * API begin
  */
@@ -297,6 +326,7 @@ void cache_rules_free(CACHE_RULES *rules)
             json_decref(rules->root);
         }
 
+        delete rules->index;
         cache_rule_free(rules->store_rules);
         cache_rule_free(rules->use_rules);
         MXS_FREE(rules);
@@ -328,7 +358,11 @@ bool cache_rules_should_store(CACHE_RULES *self, int thread_id, const char *defa
 
     CACHE_RULE *rule = self->store_rules;
 
-    if (rule)
+    if (rule && self->index)
+    {
+        should_store = cache_rules_index_should_store(self->index, thread_id, default_db, query);
+    }
+    else if (rule)
     {
         while (rule && !should_store)
         {
@@ -367,7 +401,12 @@ bool cache_rules_should_use(CACHE_RULES *self, int thread_id, const MXS_SESSION
         char account[strlen(user) + 1 + strlen(host) + 1];
         sprintf(account, "%s@%s", user, host);
 
-        while (rule && !should_use)
+        if (self->index)
+        {
+            should_use = cache_rules_index_should_use(self->index, thread_id, account);
+        }
+
+        while (!self->index && rule && !should_use)
         {
             should_use = cache_rule_matches_user(rule, thread_id, account);
             rule = rule->next;
@@ -1894,6 +1933,12 @@ static CACHE_RULES* cache_rules_create_from_json(json_t* root, uint32_t debug)
         if (cache_rules_parse_json(rules, root))
         {
             rules->root = root;
+
+            // If the matching of rules is logged, each rule is evaluated separately.
+            if (!(debug & CACHE_DEBUG_RULES))
+            {
+                rules->index = cache_rules_index_create(rules);
+            }
         }
         else
         {
@@ -2150,3 +2195,193 @@ static void free_match_datas(int count, pcre2_match_data** datas)
 
     MXS_FREE(datas);
 }
+
+/**
+ * Converts a name to lower case.
+ *
+ * @param zName  A name.
+ *
+ * @return The name in lower case.
+ */
+static std::string cache_rules_lower(const char *zName)
+{
+    std::string name(zName);
+
+    for (std::string::iterator i = name.begin(); i != name.end(); ++i)
+    {
+        *i = tolower(*i);
+    }
+
+    return name;
+}
+
+/**
+ * Compiles the rules for evaluation.
+ *
+ * @param self  The rules.
+ *
+ * @return The compiled rules, or NULL if memory allocation failed, in which
+ *         case the rules are evaluated one by one.
+ */
+static cache_rules_index* cache_rules_index_create(const CACHE_RULES *self)
+{
+    cache_rules_index *index = NULL;
+
+    try
+    {
+        index = new cache_rules_index;
+
+        for (CACHE_RULE *rule = self->store_rules; rule; rule = rule->next)
+        {
+            if ((rule->op == CACHE_OP_EQ) && (rule->attribute == CACHE_ATTRIBUTE_TABLE))
+            {
+                if (rule->simple.database)
+                {
+                    std::string name = cache_rules_lower(rule->simple.database);
+                    name += ".";
+                    name += cache_rules_lower(rule->simple.table);
+
+                    index->store_qualified_tables.insert(name);
+                }
+                else
+                {
+                    index->store_tables.insert(cache_rules_lower(rule->simple.table));
+                }
+            }
+            else if ((rule->op == CACHE_OP_EQ) && (rule->attribute == CACHE_ATTRIBUTE_DATABASE))
+            {
+                index->store_databases.insert(rule->simple.database);
+            }
+            else
+            {
+                index->store_rules.push_back(rule);
+            }
+        }
+
+        for (CACHE_RULE *rule = self->use_rules; rule; rule = rule->next)
+        {
+            if (rule->op == CACHE_OP_EQ)
+            {
+                index->use_accounts.insert(rule->value);
+            }
+            else
+            {
+                index->use_rules.push_back(rule);
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        MXS_WARNING("Could not compile the cache rules, they will be evaluated one by one.");
+        delete index;
+        index = NULL;
+    }
+
+    return index;
+}
+
+/**
+ * Returns boolean indicating whether the result of the query should be stored.
+ *
+ * @param index      The compiled rules.
+ * @param thread_id  The thread id of current thread.
+ * @param default_db The current default database, NULL if there is none.
+ * @param query      The query, expected to contain a COM_QUERY.
+ *
+ * @return True, if the results should be stored.
+ */
+static bool cache_rules_index_should_store(const cache_rules_index *index,
+                                           int thread_id,
+                                           const char *default_db,
+                                           const GWBUF* query)
+{
+    bool should_store = false;
+
+    if (!index->store_tables.empty() ||
+        !index->store_qualified_tables.empty() ||
+        !index->store_databases.empty())
+    {
+        // The names are extracted only once, whatever the number of rules.
+        bool fullnames = true;
+        int n;
+        char **names = qc_get_table_names((GWBUF*)query, &n, fullnames); // TODO: Make qc const-correct.
+
+        if (names)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                char *name = names[i];
+
+                if (!should_store)
+                {
+                    char *dot = strchr(name, '.');
+                    const char *database = default_db;
+                    const char *table = name;
+
+                    if (dot)
+                    {
+                        *dot = 0;
+                        database = name;
+                        table = dot + 1;
+                    }
+
+                    std::string lower_table = cache_rules_lower(table);
+
+                    should_store = (index->store_tables.count(lower_table) != 0);
+
+                    if (!should_store && database)
+                    {
+                        should_store = (index->store_databases.count(database) != 0);
+
+                        if (!should_store && !index->store_qualified_tables.empty())
+                        {
+                            std::string qualified_table = cache_rules_lower(database);
+                            qualified_table += ".";
+                            qualified_table += lower_table;
+
+                            should_store = (index->store_qualified_tables.count(qualified_table) != 0);
+                        }
+                    }
+                }
+
+                MXS_FREE(name);
+            }
+
+            MXS_FREE(names);
+        }
+    }
+
+    std::vector<CACHE_RULE*>::const_iterator i = index->store_rules.begin();
+
+    while (!should_store && (i != index->store_rules.end()))
+    {
+        should_store = cache_rule_matches(*i, thread_id, default_db, query);
+        ++i;
+    }
+
+    return should_store;
+}
+
+/**
+ * Returns boolean indicating whether the cache should be used, that is consulted.
+ *
+ * @param index      The compiled rules.
+ * @param thread_id  The thread id of current thread.
+ * @param account    The account of the current session, as "user@host".
+ *
+ * @return True, if the cache should be used.
+ */
+static bool cache_rules_index_should_use(const cache_rules_index *index, int thread_id, const char *account)
+{
+    bool should_use = (index->use_accounts.count(account) != 0);
+
+    std::vector<CACHE_RULE*>::const_iterator i = index->use_rules.begin();
+
+    while (!should_use && (i != index->use_rules.end()))
+    {
+        should_use = cache_rule_matches_user(*i, thread_id, account);
+        ++i;
+    }
+
+    return should_use;
+}
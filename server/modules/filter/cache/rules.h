@@ -61,12 +61,15 @@ typedef struct cache_rule
     struct cache_rule     *next;
 } CACHE_RULE;
 
+struct cache_rules_index;
+
 typedef struct cache_rules
 {
     json_t     *root;         // The JSON root object.
     uint32_t    debug;        // The debug level.
     CACHE_RULE *store_rules;  // The rules for when to store data to the cache.
     CACHE_RULE *use_rules;    // The rules for when to use data from the cache.
+    struct cache_rules_index *index; // The rules compiled for evaluation, NULL if not compiled.
 } CACHE_RULES;
 
 /**
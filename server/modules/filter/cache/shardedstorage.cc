@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "shardedstorage.hh"
+
+ShardedStorage::ShardedStorage(const CACHE_STORAGE_CONFIG& config, const Shards& shards)
+    : m_config(config)
+    , m_shards(shards)
+{
+    ss_dassert(!m_shards.empty());
+
+    MXS_NOTICE("Created sharded storage with %lu shards.", m_shards.size());
+}
+
+ShardedStorage::~ShardedStorage()
+{
+    for (Shards::iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        delete *i;
+    }
+}
+
+ShardedStorage* ShardedStorage::create(const CACHE_STORAGE_CONFIG& config, const Shards& shards)
+{
+    ShardedStorage* pStorage = NULL;
+
+    MXS_EXCEPTION_GUARD(pStorage = new ShardedStorage(config, shards));
+
+    return pStorage;
+}
+
+void ShardedStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
+cache_result_t ShardedStorage::get_info(uint32_t what,
+                                        json_t** ppInfo) const
+{
+    *ppInfo = json_object();
+
+    if (*ppInfo)
+    {
+        json_t* pShards = json_array();
+
+        if (pShards)
+        {
+            for (Shards::const_iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+            {
+                json_t* pShard_info;
+
+                if (CACHE_RESULT_IS_OK((*i)->get_info(what, &pShard_info)))
+                {
+                    json_array_append_new(pShards, pShard_info);
+                }
+            }
+
+            json_object_set(*ppInfo, "shards", pShards);
+            json_decref(pShards);
+        }
+    }
+
+    return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t ShardedStorage::get_value(const CACHE_KEY& key,
+                                         uint32_t flags,
+                                         GWBUF** ppValue) const
+{
+    return shard_of(key).get_value(key, flags, ppValue);
+}
+
+cache_result_t ShardedStorage::put_value(const CACHE_KEY& key,
+                                         const std::vector<std::string>& invalidation_words,
+                                         const GWBUF* pValue)
+{
+    return shard_of(key).put_value(key, invalidation_words, pValue);
+}
+
+cache_result_t ShardedStorage::del_value(const CACHE_KEY& key)
+{
+    return shard_of(key).del_value(key);
+}
+
+cache_result_t ShardedStorage::invalidate(const std::vector<std::string>& words)
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    // The values of a table may be in any shard.
+    for (Shards::iterator i = m_shards.begin(); i != m_shards.end(); ++i)
+    {
+        cache_result_t shard_result = (*i)->invalidate(words);
+
+        if (!CACHE_RESULT_IS_OK(shard_result))
+        {
+            result = shard_result;
+        }
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         CACHE_RESULT_IS_NOT_FOUND(result) && (i != m_shards.end());
+         ++i)
+    {
+        result = (*i)->get_head(pKey, ppHead);
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppTail) const
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         CACHE_RESULT_IS_NOT_FOUND(result) && (i != m_shards.end());
+         ++i)
+    {
+        result = (*i)->get_tail(pKey, ppTail);
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_size(uint64_t* pSize) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+    *pSize = 0;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         CACHE_RESULT_IS_OK(result) && (i != m_shards.end());
+         ++i)
+    {
+        uint64_t size;
+        result = (*i)->get_size(&size);
+        *pSize += size;
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::get_items(uint64_t* pItems) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+    *pItems = 0;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         CACHE_RESULT_IS_OK(result) && (i != m_shards.end());
+         ++i)
+    {
+        uint64_t items;
+        result = (*i)->get_items(&items);
+        *pItems += items;
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::save(Writer& writer) const
+{
+    cache_result_t result = CACHE_RESULT_OK;
+
+    for (Shards::const_iterator i = m_shards.begin();
+         CACHE_RESULT_IS_OK(result) && (i != m_shards.end());
+         ++i)
+    {
+        result = (*i)->save(writer);
+    }
+
+    return result;
+}
+
+cache_result_t ShardedStorage::restore_value(const CACHE_KEY& key,
+                                             uint32_t time,
+                                             const std::vector<std::string>& invalidation_words,
+                                             const GWBUF* pValue)
+{
+    return shard_of(key).restore_value(key, time, invalidation_words, pValue);
+}
@@ -0,0 +1,100 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <vector>
+#include "storage.hh"
+
+/**
+ * ShardedStorage partitions the keys across a number of storages, each of
+ * which does its own locking and eviction. That way threads accessing
+ * different keys seldom contend for the same lock. The maximum count and
+ * size are divided evenly between the shards, so they are enforced
+ * approximately.
+ */
+class ShardedStorage : public Storage
+{
+public:
+    typedef std::vector<Storage*> Shards;
+
+    ~ShardedStorage();
+
+    /**
+     * Create a sharded storage.
+     *
+     * @param config   The configuration of the storage as a whole.
+     * @param shards   The shards, on successful return owned by the storage.
+     *
+     * @return A new instance or NULL if one could not be created.
+     */
+    static ShardedStorage* create(const CACHE_STORAGE_CONFIG& config, const Shards& shards);
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+
+    cache_result_t get_info(uint32_t what,
+                            json_t** ppInfo) const;
+
+    cache_result_t get_value(const CACHE_KEY& key,
+                             uint32_t flags,
+                             GWBUF** ppValue) const;
+
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& invalidation_words,
+                             const GWBUF* pValue);
+
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
+    /**
+     * The head of the first shard that is not empty.
+     */
+    cache_result_t get_head(CACHE_KEY* pKey,
+                            GWBUF** ppHead) const;
+
+    /**
+     * The tail of the first shard that is not empty.
+     */
+    cache_result_t get_tail(CACHE_KEY* pKey,
+                            GWBUF** ppTail) const;
+
+    cache_result_t get_size(uint64_t* pSize) const;
+
+    cache_result_t get_items(uint64_t* pItems) const;
+
+    /**
+     * The values of the shards are written one shard after another.
+     */
+    cache_result_t save(Writer& writer) const;
+
+    cache_result_t restore_value(const CACHE_KEY& key,
+                                 uint32_t time,
+                                 const std::vector<std::string>& invalidation_words,
+                                 const GWBUF* pValue);
+
+private:
+    ShardedStorage(const CACHE_STORAGE_CONFIG& config, const Shards& shards);
+
+    ShardedStorage(const ShardedStorage&);
+    ShardedStorage& operator = (const ShardedStorage&);
+
+    Storage& shard_of(const CACHE_KEY& key) const
+    {
+        return *m_shards[key.hi % m_shards.size()];
+    }
+
+private:
+    const CACHE_STORAGE_CONFIG m_config; /*< The configuration. */
+    Shards                     m_shards; /*< The shards. */
+};
@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "snapshot.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <maxscale/alloc.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+const char SNAPSHOT_MAGIC[] = "MXSCACHE";
+const uint32_t SNAPSHOT_VERSION = 1;
+
+/**
+ * The layout of the file is
+ *
+ *     magic     : 8 bytes, "MXSCACHE"
+ *     version   : uint32_t
+ *
+ * followed by the entries, each
+ *
+ *     key.hi    : uint64_t
+ *     key.lo    : uint64_t
+ *     time      : uint32_t
+ *     n_words   : uint32_t
+ *     n_words * { len : uint32_t, bytes : len }
+ *     len       : uint32_t
+ *     value     : len bytes
+ */
+
+struct Entry
+{
+    CACHE_KEY      key;
+    uint32_t       time;
+    vector<string> invalidation_words;
+    string         value;
+};
+
+/**
+ * Copies the values of a storage.
+ */
+class Collector : public Storage::Writer
+{
+public:
+    Collector(vector<Entry>& entries)
+        : m_entries(entries)
+    {
+    }
+
+    bool write(const CACHE_KEY& key,
+               uint32_t time,
+               const vector<string>& invalidation_words,
+               const GWBUF& value)
+    {
+        bool rv = true;
+
+        try
+        {
+            m_entries.push_back(Entry());
+            Entry& entry = m_entries.back();
+
+            entry.key = key;
+            entry.time = time;
+            entry.invalidation_words = invalidation_words;
+            entry.value.resize(gwbuf_length(&value));
+
+            if (!entry.value.empty())
+            {
+                gwbuf_copy_data(&value, 0, entry.value.size(), (uint8_t*)&entry.value[0]);
+            }
+        }
+        catch (const std::exception& x)
+        {
+            MXS_ERROR("Could not copy a value of the cache: %s", x.what());
+            rv = false;
+        }
+
+        return rv;
+    }
+
+private:
+    vector<Entry>& m_entries;
+};
+
+inline bool write_data(FILE* pFile, const void* pData, size_t len)
+{
+    return (len == 0) || (fwrite(pData, len, 1, pFile) == 1);
+}
+
+inline bool write_string(FILE* pFile, const string& s)
+{
+    uint32_t len = s.length();
+
+    return write_data(pFile, &len, sizeof(len)) && write_data(pFile, s.data(), len);
+}
+
+bool write_entry(FILE* pFile, const Entry& entry)
+{
+    bool rv = write_data(pFile, &entry.key.hi, sizeof(entry.key.hi)) &&
+              write_data(pFile, &entry.key.lo, sizeof(entry.key.lo)) &&
+              write_data(pFile, &entry.time, sizeof(entry.time));
+
+    uint32_t n_words = entry.invalidation_words.size();
+
+    rv = rv && write_data(pFile, &n_words, sizeof(n_words));
+
+    for (vector<string>::const_iterator i = entry.invalidation_words.begin();
+         rv && (i != entry.invalidation_words.end());
+         ++i)
+    {
+        rv = write_string(pFile, *i);
+    }
+
+    return rv && write_string(pFile, entry.value);
+}
+
+/**
+ * Reads from the memory mapped snapshot, without ever reading past its end.
+ */
+class Reader
+{
+public:
+    Reader(const uint8_t* pData, size_t len)
+        : m_pPos(pData)
+        , m_pEnd(pData + len)
+    {
+    }
+
+    bool at_end() const
+    {
+        return m_pPos == m_pEnd;
+    }
+
+    bool read(void* pData, size_t len)
+    {
+        bool rv = false;
+
+        if (len <= (size_t)(m_pEnd - m_pPos))
+        {
+            memcpy(pData, m_pPos, len);
+            m_pPos += len;
+            rv = true;
+        }
+
+        return rv;
+    }
+
+    bool read_string(const uint8_t** ppData, uint32_t* pLen)
+    {
+        bool rv = false;
+
+        if (read(pLen, sizeof(*pLen)) && (*pLen <= (size_t)(m_pEnd - m_pPos)))
+        {
+            *ppData = m_pPos;
+            m_pPos += *pLen;
+            rv = true;
+        }
+
+        return rv;
+    }
+
+private:
+    const uint8_t* m_pPos;
+    const uint8_t* m_pEnd;
+};
+
+bool read_entry(Reader& reader,
+                CACHE_KEY* pKey,
+                uint32_t* pTime,
+                vector<string>* pInvalidation_words,
+                const uint8_t** ppValue,
+                uint32_t* pValue_len)
+{
+    uint32_t n_words;
+
+    bool rv = reader.read(&pKey->hi, sizeof(pKey->hi)) &&
+              reader.read(&pKey->lo, sizeof(pKey->lo)) &&
+              reader.read(pTime, sizeof(*pTime)) &&
+              reader.read(&n_words, sizeof(n_words));
+
+    pInvalidation_words->clear();
+
+    for (uint32_t i = 0; rv && (i < n_words); ++i)
+    {
+        const uint8_t* pWord;
+        uint32_t len;
+
+        rv = reader.read_string(&pWord, &len);
+
+        if (rv)
+        {
+            pInvalidation_words->push_back(string((const char*)pWord, len));
+        }
+    }
+
+    return rv && reader.read_string(ppValue, pValue_len);
+}
+
+}
+
+// static
+bool Snapshot::save(const Storage& storage, const char* zPath)
+{
+    bool rv = false;
+
+    vector<Entry> entries;
+    Collector collector(entries);
+
+    if (storage.save(collector) == CACHE_RESULT_OK)
+    {
+        string tmp_path(zPath);
+        tmp_path += ".tmp";
+
+        FILE* pFile = fopen(tmp_path.c_str(), "wb");
+
+        if (pFile)
+        {
+            rv = write_data(pFile, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1) &&
+                 write_data(pFile, &SNAPSHOT_VERSION, sizeof(SNAPSHOT_VERSION));
+
+            for (vector<Entry>::const_iterator i = entries.begin(); rv && (i != entries.end()); ++i)
+            {
+                rv = write_entry(pFile, *i);
+            }
+
+            if (fclose(pFile) != 0)
+            {
+                rv = false;
+            }
+
+            if (rv && (rename(tmp_path.c_str(), zPath) != 0))
+            {
+                rv = false;
+            }
+
+            if (rv)
+            {
+                MXS_NOTICE("Saved %lu cached values to the snapshot '%s'.", entries.size(), zPath);
+            }
+            else
+            {
+                MXS_ERROR("Could not write the snapshot '%s': %d, %s",
+                          zPath, errno, mxs_strerror(errno));
+                unlink(tmp_path.c_str());
+            }
+        }
+        else
+        {
+            MXS_ERROR("Could not open '%s' for writing: %d, %s",
+                      tmp_path.c_str(), errno, mxs_strerror(errno));
+        }
+    }
+    else
+    {
+        MXS_ERROR("Could not save the cached values to the snapshot '%s'; "
+                  "either the storage is not capable of it or memory could "
+                  "not be allocated.", zPath);
+    }
+
+    return rv;
+}
+
+// static
+bool Snapshot::load(Storage& storage, const char* zPath)
+{
+    bool rv = false;
+
+    int fd = open(zPath, O_RDONLY);
+
+    if (fd != -1)
+    {
+        struct stat st;
+
+        if (fstat(fd, &st) == 0)
+        {
+            size_t len = st.st_size;
+            void* pMap = (len != 0) ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+            if (pMap != MAP_FAILED)
+            {
+                Reader reader(static_cast<const uint8_t*>(pMap), len);
+
+                char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+                uint32_t version;
+
+                if (reader.read(magic, sizeof(magic)) &&
+                    (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0) &&
+                    reader.read(&version, sizeof(version)) &&
+                    (version == SNAPSHOT_VERSION))
+                {
+                    size_t n_restored = 0;
+                    size_t n_ignored = 0;
+
+                    rv = true;
+
+                    CACHE_KEY key;
+                    uint32_t time;
+                    vector<string> invalidation_words;
+                    const uint8_t* pData;
+                    uint32_t data_len;
+
+                    while (rv && !reader.at_end())
+                    {
+                        if (read_entry(reader, &key, &time, &invalidation_words, &pData, &data_len))
+                        {
+                            GWBUF* pValue = gwbuf_alloc_and_load(data_len, pData);
+
+                            if (pValue &&
+                                (storage.restore_value(key, time, invalidation_words, pValue) == CACHE_RESULT_OK))
+                            {
+                                ++n_restored;
+                            }
+                            else
+                            {
+                                ++n_ignored;
+                            }
+
+                            gwbuf_free(pValue);
+                        }
+                        else
+                        {
+                            MXS_ERROR("The snapshot '%s' is truncated or corrupt, "
+                                      "values after the first %lu were not restored.",
+                                      zPath, n_restored + n_ignored);
+                            rv = false;
+                        }
+                    }
+
+                    MXS_NOTICE("Restored %lu cached values from the snapshot '%s', "
+                               "%lu were expired or could not be restored.",
+                               n_restored, zPath, n_ignored);
+                }
+                else
+                {
+                    MXS_ERROR("'%s' is not a cache snapshot of a supported version.", zPath);
+                }
+
+                munmap(pMap, len);
+            }
+            else
+            {
+                MXS_ERROR("Could not memory map the snapshot '%s': %d, %s",
+                          zPath, errno, mxs_strerror(errno));
+            }
+        }
+        else
+        {
+            MXS_ERROR("Could not stat the snapshot '%s': %d, %s",
+                      zPath, errno, mxs_strerror(errno));
+        }
+
+        close(fd);
+    }
+    else if (errno == ENOENT)
+    {
+        MXS_NOTICE("The snapshot '%s' does not exist, the cache is started empty.", zPath);
+    }
+    else
+    {
+        MXS_ERROR("Could not open the snapshot '%s': %d, %s",
+                  zPath, errno, mxs_strerror(errno));
+    }
+
+    return rv;
+}
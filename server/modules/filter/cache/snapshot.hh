@@ -0,0 +1,57 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include "storage.hh"
+
+/**
+ * A snapshot is a file containing the values of a storage, together with
+ * their keys, invalidation words and the time they were put, so that the
+ * storage can be filled with them after a restart.
+ *
+ * The file is written in the byte order of the host, and is memory mapped
+ * when it is loaded.
+ */
+class Snapshot
+{
+public:
+    /**
+     * Save the values of a storage. The values are first copied and only
+     * then written, so that the storage is not locked while the file is
+     * written. The file is written under a temporary name and renamed
+     * once complete, so that a crash will not leave a partial snapshot.
+     *
+     * @param storage  The storage whose values should be saved.
+     * @param zPath    The path of the snapshot.
+     *
+     * @return True, if the snapshot could be saved.
+     */
+    static bool save(const Storage& storage, const char* zPath);
+
+    /**
+     * Load a snapshot into a storage. Values whose time to live has
+     * passed since the snapshot was saved are ignored.
+     *
+     * @param storage  The storage the values should be restored to.
+     * @param zPath    The path of the snapshot.
+     *
+     * @return True, if the snapshot could be loaded.
+     */
+    static bool load(Storage& storage, const char* zPath);
+
+private:
+    Snapshot();
+    Snapshot(const Snapshot&);
+    Snapshot& operator = (const Snapshot&);
+};
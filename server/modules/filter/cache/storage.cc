@@ -22,3 +22,16 @@ Storage::Storage()
 Storage::~Storage()
 {
 }
+
+cache_result_t Storage::save(Writer& writer) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t Storage::restore_value(const CACHE_KEY& key,
+                                      uint32_t time,
+                                      const std::vector<std::string>& invalidation_words,
+                                      const GWBUF* pValue)
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
@@ -13,6 +13,8 @@
  */
 
 #include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
 #include "cache_storage_api.h"
 
 class Storage
@@ -64,14 +66,19 @@ public:
     /**
      * Put a value to the cache.
      *
-     * @param key     A key generated with get_key.
-     * @param pValue  Pointer to GWBUF containing the value to be stored.
-     *                Must be one contiguous buffer.
+     * @param key                 A key generated with get_key.
+     * @param invalidation_words  Words, typically the names of the tables the
+     *                            value was read from, using which the value
+     *                            later can be invalidated.
+     * @param pValue              Pointer to GWBUF containing the value to be stored.
+     *                            Must be one contiguous buffer.
      * @return CACHE_RESULT_OK if item was successfully put,
      *         CACHE_RESULT_OUT_OF_RESOURCES if item could not be put, due to
      *         some resource having become exhausted, or some other error code.
      */
-    virtual cache_result_t put_value(const CACHE_KEY& key, const GWBUF* pValue) = 0;
+    virtual cache_result_t put_value(const CACHE_KEY& key,
+                                     const std::vector<std::string>& invalidation_words,
+                                     const GWBUF* pValue) = 0;
 
     /**
      * Delete a value from the cache.
@@ -84,6 +91,18 @@ public:
      */
     virtual cache_result_t del_value(const CACHE_KEY& key) = 0;
 
+    /**
+     * Delete all values that were put with any of the provided invalidation words.
+     *
+     * @param words  The invalidation words, typically the names of modified tables.
+     *
+     * @return CACHE_RESULT_OK if the values were deleted,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         invalidation, and
+     *         CACHE_RESULT_ERROR otherwise.
+     */
+    virtual cache_result_t invalidate(const std::vector<std::string>& words) = 0;
+
     /**
      * Get the head item from the storage. This is only intended for testing and
      * debugging purposes and if the storage is being used by different threads
@@ -154,6 +173,64 @@ public:
      */
     virtual cache_result_t get_items(uint64_t* pItems) const = 0;
 
+    /**
+     * Receives the values of a storage that is being saved.
+     */
+    class Writer
+    {
+    public:
+        virtual ~Writer() {}
+
+        /**
+         * Write a value.
+         *
+         * @param key                 The key of the value.
+         * @param time                When the value was put, in seconds since the epoch.
+         * @param invalidation_words  The words the value can be invalidated with.
+         * @param value               The value.
+         *
+         * @return True, if the value could be written.
+         */
+        virtual bool write(const CACHE_KEY& key,
+                           uint32_t time,
+                           const std::vector<std::string>& invalidation_words,
+                           const GWBUF& value) = 0;
+    };
+
+    /**
+     * Write all values of the storage, the least recently used first. The
+     * default implementation returns CACHE_RESULT_OUT_OF_RESOURCES.
+     *
+     * @param writer  The writer the values are written to.
+     *
+     * @return CACHE_RESULT_OK if all values were written, and
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         writing its values or if the writer failed.
+     */
+    virtual cache_result_t save(Writer& writer) const;
+
+    /**
+     * Put a value that earlier was written by @c save. Unlike a value put
+     * with @c put_value, the value keeps the time it originally was put, so
+     * its time to live is not restarted. The default implementation returns
+     * CACHE_RESULT_OUT_OF_RESOURCES.
+     *
+     * @param key                 The key of the value.
+     * @param time                When the value was originally put.
+     * @param invalidation_words  The words the value can be invalidated with.
+     * @param pValue              The value, one contiguous buffer.
+     *
+     * @return CACHE_RESULT_OK if the value was restored,
+     *         CACHE_RESULT_NOT_FOUND if the value was not restored because
+     *         it already has expired or because a value already is present,
+     *         CACHE_RESULT_OUT_OF_RESOURCES if the storage is incapable of
+     *         restoring values, and some other error code otherwise.
+     */
+    virtual cache_result_t restore_value(const CACHE_KEY& key,
+                                         uint32_t time,
+                                         const std::vector<std::string>& invalidation_words,
+                                         const GWBUF* pValue);
+
 protected:
     Storage();
 
@@ -42,6 +42,10 @@ InMemoryStorage::InMemoryStorage(const string& name, const CACHE_STORAGE_CONFIG&
 
 InMemoryStorage::~InMemoryStorage()
 {
+    for (Entries::iterator i = m_entries.begin(); i != m_entries.end(); ++i)
+    {
+        gwbuf_free(i->second.pValue);
+    }
 }
 
 bool InMemoryStorage::Initialize(uint32_t* pCapabilities)
@@ -142,24 +146,26 @@ cache_result_t InMemoryStorage::do_get_value(const CACHE_KEY& key, uint32_t flag
 
         uint32_t now = time(NULL);
 
-        bool is_hard_stale = m_config.hard_ttl == 0 ? false : (now - entry.time > m_config.hard_ttl);
-        bool is_soft_stale = m_config.soft_ttl == 0 ? false : (now - entry.time > m_config.soft_ttl);
+        uint32_t hard_ttl = cache_storage_ttl(&m_config, &key, m_config.hard_ttl);
+        uint32_t soft_ttl = cache_storage_ttl(&m_config, &key, m_config.soft_ttl);
+
+        bool is_hard_stale = hard_ttl == 0 ? false : (now - entry.time > hard_ttl);
+        bool is_soft_stale = soft_ttl == 0 ? false : (now - entry.time > soft_ttl);
         bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
 
         if (is_hard_stale)
         {
-            m_entries.erase(i);
+            m_stats.size -= GWBUF_LENGTH(entry.pValue);
+            m_stats.items -= 1;
+            erase(i);
         }
         else if (!is_soft_stale || include_stale)
         {
-            size_t length = entry.value.size();
-
-            *ppResult = gwbuf_alloc(length);
+            // The value is never modified, so the data can be shared instead of copied.
+            *ppResult = gwbuf_clone(entry.pValue);
 
             if (*ppResult)
             {
-                memcpy(GWBUF_DATA(*ppResult), entry.value.data(), length);
-
                 result = CACHE_RESULT_OK;
 
                 if (is_soft_stale)
@@ -192,6 +198,15 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
 
     size_t size = GWBUF_LENGTH(&value);
 
+    // The value is copied, as the buffer of the caller may have space to
+    // spare or be modified later.
+    GWBUF* pValue = gwbuf_alloc_and_load(size, GWBUF_DATA(&value));
+
+    if (!pValue)
+    {
+        return CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
     Entries::iterator i = m_entries.find(key);
     Entry* pEntry;
 
@@ -200,7 +215,6 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
         m_stats.items += 1;
 
         pEntry = &m_entries[key];
-        pEntry->value.resize(size);
     }
     else
     {
@@ -208,26 +222,14 @@ cache_result_t InMemoryStorage::do_put_value(const CACHE_KEY& key, const GWBUF&
 
         pEntry = &i->second;
 
-        m_stats.size -= pEntry->value.size();
-
-        if (size < pEntry->value.capacity())
-        {
-            // If the needed value is less than what is currently stored,
-            // we shrink the buffer so as not to waste space.
-            Value entry_value(size);
-            pEntry->value.swap(entry_value);
-        }
-        else
-        {
-            pEntry->value.resize(size);
-        }
+        // Clones of the old value that have been handed out keep it alive.
+        m_stats.size -= GWBUF_LENGTH(pEntry->pValue);
+        gwbuf_free(pEntry->pValue);
     }
 
     m_stats.size += size;
 
-    const uint8_t* pData = GWBUF_DATA(&value);
-
-    copy(pData, pData + size, pEntry->value.begin());
+    pEntry->pValue = pValue;
     pEntry->time = time(NULL);
 
     return CACHE_RESULT_OK;
@@ -239,36 +241,33 @@ cache_result_t InMemoryStorage::do_del_value(const CACHE_KEY& key)
 
     if (i != m_entries.end())
     {
-        ss_dassert(m_stats.size >= i->second.value.size());
+        ss_dassert(m_stats.size >= (size_t)GWBUF_LENGTH(i->second.pValue));
         ss_dassert(m_stats.items > 0);
 
-        m_stats.size -= i->second.value.size();
+        m_stats.size -= GWBUF_LENGTH(i->second.pValue);
         m_stats.items -= 1;
         m_stats.deletes += 1;
 
-        m_entries.erase(i);
+        erase(i);
+
+        return CACHE_RESULT_OK;
     }
 
-    return i != m_entries.end() ? CACHE_RESULT_OK : CACHE_RESULT_NOT_FOUND;
+    return CACHE_RESULT_NOT_FOUND;
 }
 
-static void set_integer(json_t* pObject, const char* zName, size_t value)
+void InMemoryStorage::erase(Entries::iterator i)
 {
-    json_t* pValue = json_integer(value);
-
-    if (pValue)
-    {
-        json_object_set(pObject, zName, pValue);
-        json_decref(pValue);
-    }
+    gwbuf_free(i->second.pValue);
+    m_entries.erase(i);
 }
 
 void InMemoryStorage::Stats::fill(json_t* pObject) const
 {
-    set_integer(pObject, "size", size);
-    set_integer(pObject, "items", items);
-    set_integer(pObject, "hits", hits);
-    set_integer(pObject, "misses", misses);
-    set_integer(pObject, "updates", updates);
-    set_integer(pObject, "deletes", deletes);
+    cache_set_json_integer(pObject, "size", size);
+    cache_set_json_integer(pObject, "items", items);
+    cache_set_json_integer(pObject, "hits", hits);
+    cache_set_json_integer(pObject, "misses", misses);
+    cache_set_json_integer(pObject, "updates", updates);
+    cache_set_json_integer(pObject, "deletes", deletes);
 }
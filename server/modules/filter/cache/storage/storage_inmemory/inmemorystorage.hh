@@ -55,16 +55,15 @@ private:
     InMemoryStorage& operator = (const InMemoryStorage&);
 
 private:
-    typedef std::vector<uint8_t> Value;
-
     struct Entry
     {
         Entry()
             : time(0)
+            , pValue(NULL)
         {}
 
         uint32_t time;
-        Value    value;
+        GWBUF*   pValue; /*< Owned by the storage, only clones are handed out. */
     };
 
     struct Stats
@@ -90,6 +89,8 @@ private:
 
     typedef std::tr1::unordered_map<CACHE_KEY, Entry> Entries;
 
+    void erase(Entries::iterator i);
+
     std::string                m_name;
     const CACHE_STORAGE_CONFIG m_config;
     Entries                    m_entries;
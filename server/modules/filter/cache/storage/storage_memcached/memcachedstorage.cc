@@ -0,0 +1,786 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "storage_memcached"
+#include "memcachedstorage.hh"
+#include "../../cache_storage_api.hh"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/buffer.h>
+#include <maxscale/utils.h>
+
+using maxscale::SpinLockGuard;
+using std::string;
+
+namespace
+{
+
+const char DEFAULT_PORT[] = "11211";
+
+// In milliseconds.
+const uint32_t DEFAULT_TIMEOUT = 100;
+
+// In seconds; a server that could not be connected to is not tried again
+// for this long, so that every operation need not wait for the timeout.
+const time_t DOWN_INTERVAL = 1;
+
+// The idle connections kept per server.
+const size_t MAX_IDLE = 128;
+
+// The longest reply line that is accepted.
+const size_t MAX_LINE_LEN = 1024;
+
+// memcached treats an expiration time longer than 30 days as an absolute
+// Unix time.
+const uint32_t MAX_RELATIVE_EXPTIME = 60 * 60 * 24 * 30;
+
+// A stored value starts with the time it was put, as a 4-byte little endian
+// integer, so that the soft ttl can be enforced. The hard ttl is enforced
+// by the server.
+const size_t TIME_LEN = 4;
+
+uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Wait until a socket becomes readable or writable.
+ *
+ * @param fd        The socket.
+ * @param events    POLLIN or POLLOUT.
+ * @param deadline  The deadline, as returned by @c now_ms.
+ *
+ * @return True, if the socket became ready before the deadline.
+ */
+bool wait_for(int fd, short events, uint64_t deadline)
+{
+    int rv;
+
+    do
+    {
+        uint64_t now = now_ms();
+
+        if (now >= deadline)
+        {
+            return false;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+
+        rv = poll(&pfd, 1, deadline - now);
+    }
+    while ((rv == -1) && (errno == EINTR));
+
+    return rv == 1;
+}
+
+}
+
+MemcachedStorage::Connection::~Connection()
+{
+    close(m_fd);
+}
+
+bool MemcachedStorage::Connection::write(const void* pData, size_t len, bool more, uint64_t deadline)
+{
+    const char* p = static_cast<const char*>(pData);
+    int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+
+    while (len != 0)
+    {
+        ssize_t n = send(m_fd, p, len, flags);
+
+        if (n > 0)
+        {
+            p += n;
+            len -= n;
+        }
+        else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            if (!wait_for(m_fd, POLLOUT, deadline))
+            {
+                return false;
+            }
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MemcachedStorage::Connection::read_line(string* pLine, uint64_t deadline)
+{
+    size_t i;
+
+    while ((i = m_buffer.find("\r\n")) == string::npos)
+    {
+        if ((m_buffer.length() > MAX_LINE_LEN) || !fill(deadline))
+        {
+            return false;
+        }
+    }
+
+    pLine->assign(m_buffer, 0, i);
+    m_buffer.erase(0, i + 2);
+
+    return true;
+}
+
+bool MemcachedStorage::Connection::read(void* pData, size_t len, uint64_t deadline)
+{
+    char* p = static_cast<char*>(pData);
+
+    // What is already buffered is used first, the rest is read directly
+    // to the destination.
+    size_t buffered = std::min(len, m_buffer.length());
+    memcpy(p, m_buffer.data(), buffered);
+    m_buffer.erase(0, buffered);
+    p += buffered;
+    len -= buffered;
+
+    while (len != 0)
+    {
+        ssize_t n = recv(m_fd, p, len, 0);
+
+        if (n > 0)
+        {
+            p += n;
+            len -= n;
+        }
+        else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            if (!wait_for(m_fd, POLLIN, deadline))
+            {
+                return false;
+            }
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MemcachedStorage::Connection::fill(uint64_t deadline)
+{
+    char buffer[MAX_LINE_LEN];
+
+    while (true)
+    {
+        ssize_t n = recv(m_fd, buffer, sizeof(buffer), 0);
+
+        if (n > 0)
+        {
+            m_buffer.append(buffer, n);
+            return true;
+        }
+        else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            if (!wait_for(m_fd, POLLIN, deadline))
+            {
+                return false;
+            }
+        }
+        else if ((n == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+MemcachedStorage::MemcachedStorage(const string& name,
+                                   const CACHE_STORAGE_CONFIG& config,
+                                   const Servers& servers,
+                                   const string& key_prefix,
+                                   uint32_t timeout)
+    : m_name(name)
+    , m_config(config)
+    , m_servers(servers)
+    , m_key_prefix(key_prefix)
+    , m_timeout(timeout)
+{
+}
+
+MemcachedStorage::~MemcachedStorage()
+{
+    for (Servers::iterator i = m_servers.begin(); i != m_servers.end(); ++i)
+    {
+        Server* pServer = *i;
+
+        for (std::vector<Connection*>::iterator j = pServer->idle.begin(); j != pServer->idle.end(); ++j)
+        {
+            delete *j;
+        }
+
+        delete pServer;
+    }
+}
+
+//static
+bool MemcachedStorage::Initialize(uint32_t* pCapabilities)
+{
+    // The servers evict values themselves, so the cache must not put an LRU
+    // storage that only knows about the values stored by this instance in
+    // front of this storage.
+    *pCapabilities = (CACHE_STORAGE_CAP_ST | CACHE_STORAGE_CAP_MT |
+                      CACHE_STORAGE_CAP_MAX_COUNT | CACHE_STORAGE_CAP_MAX_SIZE);
+
+    return true;
+}
+
+//static
+MemcachedStorage* MemcachedStorage::Create_instance(const char* zName,
+                                                    const CACHE_STORAGE_CONFIG& config,
+                                                    int argc, char* argv[])
+{
+    ss_dassert(zName);
+
+    bool error = false;
+    Servers servers;
+    string key_prefix;
+    uint32_t timeout = DEFAULT_TIMEOUT;
+
+    for (int i = 0; i < argc; ++i)
+    {
+        size_t len = strlen(argv[i]);
+        char arg[len + 1];
+        strcpy(arg, argv[i]);
+
+        const char* zValue = NULL;
+        char *zEq = strchr(arg, '=');
+
+        if (zEq)
+        {
+            *zEq = 0;
+            zValue = trim(zEq + 1);
+        }
+
+        const char* zKey = trim(arg);
+
+        if (strcmp(zKey, "server") == 0)
+        {
+            if (!zValue || !add_server(&servers, zValue))
+            {
+                error = true;
+            }
+        }
+        else if (strcmp(zKey, "timeout") == 0)
+        {
+            char* zEnd;
+            long value = zValue ? strtol(zValue, &zEnd, 10) : 0;
+
+            if (zValue && (*zEnd == 0) && (value > 0) && (value <= UINT32_MAX))
+            {
+                timeout = value;
+            }
+            else
+            {
+                MXS_ERROR("The value of '%s' must be a positive number of milliseconds.", zKey);
+                error = true;
+            }
+        }
+        else if (strcmp(zKey, "key_prefix") == 0)
+        {
+            if (zValue)
+            {
+                key_prefix = zValue;
+            }
+        }
+        else
+        {
+            MXS_WARNING("Unknown argument '%s'.", zKey);
+        }
+    }
+
+    if (!error && servers.empty())
+    {
+        MXS_ERROR("At least one memcached server must be specified with 'server'.");
+        error = true;
+    }
+
+    if (!error && (config.invalidate != CACHE_INVALIDATE_NEVER))
+    {
+        // The mapping from tables to keys would only know about the values
+        // stored by this instance, and would hide the values stored by other
+        // instances.
+        MXS_ERROR("The storage %s cannot be used together with invalidation.", MXS_MODULE_NAME);
+        error = true;
+    }
+
+    if (!error && ((config.max_count != 0) || (config.max_size != 0)))
+    {
+        MXS_WARNING("'max_count' and 'max_size' are ignored, the memcached servers "
+                    "evict values according to their own memory limit.");
+    }
+
+    MemcachedStorage* pStorage = NULL;
+
+    if (!error)
+    {
+        pStorage = new MemcachedStorage(zName, config, servers, key_prefix, timeout);
+    }
+    else
+    {
+        for (Servers::iterator i = servers.begin(); i != servers.end(); ++i)
+        {
+            delete *i;
+        }
+    }
+
+    return pStorage;
+}
+
+void MemcachedStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
+cache_result_t MemcachedStorage::get_info(uint32_t what, json_t** ppInfo) const
+{
+    *ppInfo = json_object();
+
+    if (*ppInfo)
+    {
+        cache_set_json_integer(*ppInfo, "hits", atomic_load_uint64(&m_stats.hits));
+        cache_set_json_integer(*ppInfo, "misses", atomic_load_uint64(&m_stats.misses));
+        cache_set_json_integer(*ppInfo, "puts", atomic_load_uint64(&m_stats.puts));
+        cache_set_json_integer(*ppInfo, "deletes", atomic_load_uint64(&m_stats.deletes));
+        cache_set_json_integer(*ppInfo, "errors", atomic_load_uint64(&m_stats.errors));
+
+        json_t* pServers = json_array();
+
+        if (pServers)
+        {
+            for (Servers::const_iterator i = m_servers.begin(); i != m_servers.end(); ++i)
+            {
+                json_array_append_new(pServers, json_string((*i)->name.c_str()));
+            }
+
+            json_object_set(*ppInfo, "servers", pServers);
+            json_decref(pServers);
+        }
+    }
+
+    return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult)
+{
+    cache_result_t result = CACHE_RESULT_NOT_FOUND;
+
+    uint64_t end = deadline();
+    Server& server = server_of(key);
+    Connection* pConnection = acquire(server, end);
+
+    if (pConnection)
+    {
+        string request = "get " + key_of(key) + "\r\n";
+        string line;
+        bool ok = pConnection->write(request.data(), request.length(), false, end) &&
+                  pConnection->read_line(&line, end);
+
+        unsigned long len;
+        GWBUF* pValue = NULL;
+
+        if (ok && (sscanf(line.c_str(), "VALUE %*s %*u %lu", &len) == 1))
+        {
+            ok = false;
+
+            if ((len > TIME_LEN) && (pValue = gwbuf_alloc(len)))
+            {
+                ok = pConnection->read(GWBUF_DATA(pValue), len, end) &&
+                     pConnection->read_line(&line, end) && line.empty() &&
+                     pConnection->read_line(&line, end);
+            }
+        }
+
+        ok = ok && (line == "END");
+
+        release(server, pConnection, ok);
+
+        if (!ok)
+        {
+            gwbuf_free(pValue);
+            pValue = NULL;
+        }
+
+        if (pValue)
+        {
+            const uint8_t* pData = GWBUF_DATA(pValue);
+            uint32_t put_time = pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t)pData[3] << 24);
+            uint32_t now = time(NULL);
+
+            uint32_t soft_ttl = cache_storage_ttl(&m_config, &key, m_config.soft_ttl);
+
+            bool is_soft_stale = soft_ttl == 0 ? false : (now - put_time > soft_ttl);
+            bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
+
+            if (!is_soft_stale || include_stale)
+            {
+                *ppResult = gwbuf_consume(pValue, TIME_LEN);
+                result = CACHE_RESULT_OK;
+            }
+            else
+            {
+                gwbuf_free(pValue);
+            }
+
+            if (is_soft_stale)
+            {
+                result |= CACHE_RESULT_STALE;
+            }
+        }
+
+        if (!ok)
+        {
+            MXS_INFO("Could not get value from memcached server %s.", server.name.c_str());
+            atomic_add_uint64(&m_stats.errors, 1);
+        }
+    }
+
+    // A server that cannot be reached is treated as one without the value,
+    // the result will then be fetched from the database server.
+    atomic_add_uint64(CACHE_RESULT_IS_OK(result) ? &m_stats.hits : &m_stats.misses, 1);
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::put_value(const CACHE_KEY& key, const GWBUF& value)
+{
+    ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
+
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    uint64_t end = deadline();
+    Server& server = server_of(key);
+    Connection* pConnection = acquire(server, end);
+
+    if (pConnection)
+    {
+        uint32_t now = time(NULL);
+        uint32_t exptime = cache_storage_ttl(&m_config, &key, m_config.hard_ttl);
+
+        if (exptime > MAX_RELATIVE_EXPTIME)
+        {
+            exptime += now;
+        }
+
+        size_t len = GWBUF_LENGTH(&value);
+        char header[MAX_LINE_LEN];
+        int n = snprintf(header, sizeof(header), "set %s 0 %u %lu\r\n",
+                         key_of(key).c_str(), exptime, (unsigned long)(TIME_LEN + len));
+
+        uint8_t put_time[TIME_LEN];
+        put_time[0] = now;
+        put_time[1] = now >> 8;
+        put_time[2] = now >> 16;
+        put_time[3] = now >> 24;
+
+        string line;
+        bool ok = (n > 0) && ((size_t)n < sizeof(header)) &&
+                  pConnection->write(header, n, true, end) &&
+                  pConnection->write(put_time, TIME_LEN, true, end) &&
+                  pConnection->write(GWBUF_DATA(&value), len, true, end) &&
+                  pConnection->write("\r\n", 2, false, end) &&
+                  pConnection->read_line(&line, end);
+
+        release(server, pConnection, ok);
+
+        if (ok && (line == "STORED"))
+        {
+            atomic_add_uint64(&m_stats.puts, 1);
+            result = CACHE_RESULT_OK;
+        }
+        else
+        {
+            if (ok)
+            {
+                // E.g. "SERVER_ERROR object too large for cache".
+                MXS_INFO("Could not put value to memcached server %s: %s",
+                         server.name.c_str(), line.c_str());
+                result = CACHE_RESULT_OUT_OF_RESOURCES;
+            }
+            else
+            {
+                MXS_INFO("Could not put value to memcached server %s.", server.name.c_str());
+            }
+
+            atomic_add_uint64(&m_stats.errors, 1);
+        }
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::del_value(const CACHE_KEY& key)
+{
+    cache_result_t result = CACHE_RESULT_ERROR;
+
+    uint64_t end = deadline();
+    Server& server = server_of(key);
+    Connection* pConnection = acquire(server, end);
+
+    if (pConnection)
+    {
+        string request = "delete " + key_of(key) + "\r\n";
+        string line;
+        bool ok = pConnection->write(request.data(), request.length(), false, end) &&
+                  pConnection->read_line(&line, end);
+
+        release(server, pConnection, ok);
+
+        if (ok && (line == "DELETED"))
+        {
+            atomic_add_uint64(&m_stats.deletes, 1);
+            result = CACHE_RESULT_OK;
+        }
+        else if (ok && (line == "NOT_FOUND"))
+        {
+            result = CACHE_RESULT_NOT_FOUND;
+        }
+        else
+        {
+            atomic_add_uint64(&m_stats.errors, 1);
+        }
+    }
+
+    return result;
+}
+
+cache_result_t MemcachedStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_size(uint64_t* pSize) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t MemcachedStorage::get_items(uint64_t* pItems) const
+{
+    return CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+/**
+ * Add a server to the servers of the storage.
+ *
+ * @param pServers  The servers.
+ * @param zServer   The server as host[:port].
+ *
+ * @return True, if the address of the server could be resolved.
+ */
+//static
+bool MemcachedStorage::add_server(Servers* pServers, const char* zServer)
+{
+    string host(zServer);
+    string port(DEFAULT_PORT);
+    size_t i = host.rfind(':');
+
+    if (i != string::npos)
+    {
+        port = host.substr(i + 1);
+        host.erase(i);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // The address is resolved only once, so that no name lookups are
+    // made when values are accessed.
+    struct addrinfo* pAi = NULL;
+    int rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &pAi);
+
+    if (rv != 0)
+    {
+        MXS_ERROR("Could not resolve memcached server '%s': %s", zServer, gai_strerror(rv));
+        return false;
+    }
+
+    Server* pServer = new Server;
+    pServer->name = host + ":" + port;
+    memcpy(&pServer->address, pAi->ai_addr, pAi->ai_addrlen);
+    pServer->address_len = pAi->ai_addrlen;
+
+    freeaddrinfo(pAi);
+
+    try
+    {
+        pServers->push_back(pServer);
+    }
+    catch (const std::exception& x)
+    {
+        delete pServer;
+        throw;
+    }
+
+    return true;
+}
+
+string MemcachedStorage::key_of(const CACHE_KEY& key) const
+{
+    char z[2 * 16 + 1];
+    sprintf(z, "%016" PRIx64 "%016" PRIx64, key.hi, key.lo);
+
+    return m_key_prefix + z;
+}
+
+uint64_t MemcachedStorage::deadline() const
+{
+    return now_ms() + m_timeout;
+}
+
+/**
+ * Get a connection to a server, an idle one if there is one.
+ *
+ * @param server    The server.
+ * @param deadline  Until when a new connection may be waited for.
+ *
+ * @return A connection, NULL if the server could not be connected to.
+ */
+MemcachedStorage::Connection* MemcachedStorage::acquire(Server& server, uint64_t deadline) const
+{
+    {
+        SpinLockGuard guard(server.lock);
+
+        if (!server.idle.empty())
+        {
+            Connection* pConnection = server.idle.back();
+            server.idle.pop_back();
+            return pConnection;
+        }
+
+        if (time(NULL) < server.down_until)
+        {
+            atomic_add_uint64(&m_stats.errors, 1);
+            return NULL;
+        }
+    }
+
+    int fd = socket(server.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool connected = false;
+
+    if (fd != -1)
+    {
+        // The requests are written in several parts.
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(fd, (struct sockaddr*)&server.address, server.address_len) == 0)
+        {
+            connected = true;
+        }
+        else if ((errno == EINPROGRESS) && wait_for(fd, POLLOUT, deadline))
+        {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            connected = (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0) && (error == 0);
+        }
+    }
+
+    Connection* pConnection = NULL;
+
+    if (connected)
+    {
+        pConnection = new (std::nothrow) Connection(fd);
+    }
+
+    if (!pConnection)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+
+        MXS_ERROR("Could not connect to memcached server %s.", server.name.c_str());
+        atomic_add_uint64(&m_stats.errors, 1);
+
+        SpinLockGuard guard(server.lock);
+        server.down_until = time(NULL) + DOWN_INTERVAL;
+    }
+
+    return pConnection;
+}
+
+/**
+ * Give back a connection obtained with @c acquire.
+ *
+ * @param server       The server of the connection.
+ * @param pConnection  The connection.
+ * @param reusable     False, if the connection is not in sync with the server,
+ *                     e.g. because a reply was not waited for, and must be
+ *                     closed.
+ */
+void MemcachedStorage::release(Server& server, Connection* pConnection, bool reusable) const
+{
+    if (reusable)
+    {
+        SpinLockGuard guard(server.lock);
+
+        if (server.idle.size() < MAX_IDLE)
+        {
+            try
+            {
+                server.idle.push_back(pConnection);
+                pConnection = NULL;
+            }
+            catch (const std::exception& x)
+            {
+            }
+        }
+    }
+
+    delete pConnection;
+}
@@ -0,0 +1,150 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include <maxscale/spinlock.hh>
+#include "../../cache_storage_api.h"
+
+/**
+ * MemcachedStorage stores the values in memcached servers that are shared
+ * by several MaxScale instances. The keys are partitioned across the
+ * servers, and the servers themselves evict values when they run out of
+ * memory.
+ *
+ * The storage API is synchronous, so an operation waits for the reply of
+ * the server. The sockets are non-blocking and an operation never waits
+ * longer than the configured timeout. A get that times out is a miss.
+ */
+class MemcachedStorage
+{
+public:
+    ~MemcachedStorage();
+
+    static bool Initialize(uint32_t* pCapabilities);
+
+    static MemcachedStorage* Create_instance(const char* zName,
+                                             const CACHE_STORAGE_CONFIG& config,
+                                             int argc, char* argv[]);
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+    cache_result_t get_info(uint32_t what, json_t** ppInfo) const;
+    cache_result_t get_value(const CACHE_KEY& key, uint32_t flags, GWBUF** ppResult);
+    cache_result_t put_value(const CACHE_KEY& key, const GWBUF& value);
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    cache_result_t get_head(CACHE_KEY* pKey, GWBUF** ppHead) const;
+    cache_result_t get_tail(CACHE_KEY* pKey, GWBUF** ppHead) const;
+    cache_result_t get_size(uint64_t* pSize) const;
+    cache_result_t get_items(uint64_t* pItems) const;
+
+private:
+    /**
+     * A connection to a server, with the bytes that have been read
+     * from it but not yet consumed.
+     */
+    class Connection
+    {
+    public:
+        Connection(int fd)
+            : m_fd(fd)
+        {}
+        ~Connection();
+
+        bool write(const void* pData, size_t len, bool more, uint64_t deadline);
+        bool read_line(std::string* pLine, uint64_t deadline);
+        bool read(void* pData, size_t len, uint64_t deadline);
+
+    private:
+        Connection(const Connection&);
+        Connection& operator = (const Connection&);
+
+        bool fill(uint64_t deadline);
+
+        int         m_fd;     /*< The socket. */
+        std::string m_buffer; /*< Read but not consumed bytes. */
+    };
+
+    /**
+     * A server and its idle connections.
+     */
+    struct Server
+    {
+        Server()
+            : address_len(0)
+            , down_until(0)
+        {
+            spinlock_init(&lock);
+        }
+
+        std::string              name;        /*< host:port, for logging. */
+        sockaddr_storage         address;     /*< The resolved address. */
+        socklen_t                address_len; /*< The length of the address. */
+        SPINLOCK                 lock;        /*< Protects the members below. */
+        std::vector<Connection*> idle;        /*< Connections not in use. */
+        time_t                   down_until;  /*< Connecting is not tried before this. */
+    };
+
+    typedef std::vector<Server*> Servers;
+
+    struct Stats
+    {
+        Stats()
+            : hits(0)
+            , misses(0)
+            , puts(0)
+            , deletes(0)
+            , errors(0)
+        {}
+
+        uint64_t hits;    /*< How many times a key was found. */
+        uint64_t misses;  /*< How many times a key was not found. */
+        uint64_t puts;    /*< How many values have been stored. */
+        uint64_t deletes; /*< How many values have been deleted. */
+        uint64_t errors;  /*< How many operations failed or timed out. */
+    };
+
+    MemcachedStorage(const std::string& name,
+                     const CACHE_STORAGE_CONFIG& config,
+                     const Servers& servers,
+                     const std::string& key_prefix,
+                     uint32_t timeout);
+
+    MemcachedStorage(const MemcachedStorage&);
+    MemcachedStorage& operator = (const MemcachedStorage&);
+
+    static bool add_server(Servers* pServers, const char* zServer);
+
+    std::string key_of(const CACHE_KEY& key) const;
+
+    Server& server_of(const CACHE_KEY& key) const
+    {
+        return *m_servers[key.hi % m_servers.size()];
+    }
+
+    uint64_t deadline() const;
+
+    Connection* acquire(Server& server, uint64_t deadline) const;
+    void release(Server& server, Connection* pConnection, bool reusable) const;
+
+private:
+    std::string                m_name;       /*< The name of the storage. */
+    const CACHE_STORAGE_CONFIG m_config;     /*< The configuration. */
+    Servers                    m_servers;    /*< The servers, owned by the storage. */
+    std::string                m_key_prefix; /*< Prepended to every key. */
+    uint32_t                   m_timeout;    /*< The timeout of an operation in milliseconds. */
+    mutable Stats              m_stats;      /*< Statistics, updated atomically. */
+};
@@ -189,6 +189,7 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
 
     string storageDirectory = get_cachedir();
     bool collectStatistics = false;
+    bool persistent = false;
 
     for (int i = 0; i < argc; ++i)
     {
@@ -226,6 +227,13 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
                 collectStatistics = config_truth_value(zValue);
             }
         }
+        else if (strcmp(zKey, "persistent") == 0)
+        {
+            if (zValue)
+            {
+                persistent = config_truth_value(zValue);
+            }
+        }
         else
         {
             MXS_WARNING("Unknown argument '%s'.", zKey);
@@ -234,13 +242,14 @@ RocksDBStorage* RocksDBStorage::Create_instance(const char* zName,
 
     storageDirectory += "/storage_rocksdb";
 
-    return Create(zName, config, storageDirectory, collectStatistics);
+    return Create(zName, config, storageDirectory, collectStatistics, persistent);
 }
 
 RocksDBStorage* RocksDBStorage::Create(const char* zName,
                                        const CACHE_STORAGE_CONFIG& config,
                                        const string& storageDirectory,
-                                       bool collectStatistics)
+                                       bool collectStatistics,
+                                       bool persistent)
 {
     unique_ptr<RocksDBStorage> sStorage;
 
@@ -263,7 +272,9 @@ RocksDBStorage* RocksDBStorage::Create(const char* zName,
     {
         string path(storageDirectory + "/" + zName);
 
-        if (deletePath(path))
+        // A persistent database is kept over restarts, so that the values
+        // of a cache snapshot need not be written again.
+        if (persistent || deletePath(path))
         {
             rocksdb::Options options;
             options.env = rocksdb::Env::Default();
@@ -271,7 +282,7 @@ RocksDBStorage* RocksDBStorage::Create(const char* zName,
             options.max_background_flushes = ROCKSDB_N_HIGH_THREADS;
 
             options.create_if_missing = true;
-            options.error_if_exists = true;
+            options.error_if_exists = !persistent;
 
             if (collectStatistics)
             {
@@ -344,7 +355,7 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
 {
     // Use the root DB so that we get the value *with* the timestamp at the end.
     rocksdb::DB* pDb = m_sDb->GetRootDB();
-    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
+    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key), sizeof(key));
     string value;
 
     rocksdb::Status status = pDb->Get(rocksdb::ReadOptions(), rocksdb_key, &value);
@@ -367,8 +378,11 @@ cache_result_t RocksDBStorage::get_value(const CACHE_KEY& key, uint32_t flags, G
 
             int32_t timestamp = RocksDBInternals::extract_timestamp(value);
 
-            bool is_hard_stale = m_config.hard_ttl == 0 ? false : (now - timestamp > m_config.hard_ttl);
-            bool is_soft_stale = m_config.soft_ttl == 0 ? false : (now - timestamp > m_config.soft_ttl);
+            uint32_t hard_ttl = cache_storage_ttl(&m_config, &key, m_config.hard_ttl);
+            uint32_t soft_ttl = cache_storage_ttl(&m_config, &key, m_config.soft_ttl);
+
+            bool is_hard_stale = hard_ttl == 0 ? false : (now - timestamp > hard_ttl);
+            bool is_soft_stale = soft_ttl == 0 ? false : (now - timestamp > soft_ttl);
             bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
 
             if (is_hard_stale)
@@ -431,7 +445,7 @@ cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key, const GWBUF& valu
 {
     ss_dassert(GWBUF_IS_CONTIGUOUS(&value));
 
-    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
+    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key), sizeof(key));
     rocksdb::Slice rocksdb_value((char*)GWBUF_DATA(&value), GWBUF_LENGTH(&value));
 
     rocksdb::Status status = m_sDb->Put(Write_options(), rocksdb_key, rocksdb_value);
@@ -441,7 +455,7 @@ cache_result_t RocksDBStorage::put_value(const CACHE_KEY& key, const GWBUF& valu
 
 cache_result_t RocksDBStorage::del_value(const CACHE_KEY& key)
 {
-    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key.data), sizeof(key.data));
+    rocksdb::Slice rocksdb_key(reinterpret_cast<const char*>(&key), sizeof(key));
 
     rocksdb::Status status = m_sDb->Delete(Write_options(), rocksdb_key);
 
@@ -53,7 +53,8 @@ private:
     static RocksDBStorage* Create(const char* zName,
                                   const CACHE_STORAGE_CONFIG& config,
                                   const std::string& storage_directory,
-                                  bool collect_statistics);
+                                  bool collect_statistics,
+                                  bool persistent);
 
     static const rocksdb::WriteOptions& Write_options()
     {
@@ -15,13 +15,16 @@
 #include "storagefactory.hh"
 #include <dlfcn.h>
 #include <sys/param.h>
+#include <algorithm>
 #include <new>
+#include <sstream>
 #include <maxscale/alloc.h>
 #include <maxscale/paths.h>
 #include <maxscale/log_manager.h>
 #include "cachefilter.h"
 #include "lrustoragest.hh"
 #include "lrustoragemt.hh"
+#include "shardedstorage.hh"
 #include "storagereal.hh"
 
 
@@ -157,7 +160,14 @@ Storage* StorageFactory::createStorage(const char* zName,
 
     uint32_t mask = CACHE_STORAGE_CAP_MAX_COUNT | CACHE_STORAGE_CAP_MAX_SIZE;
 
-    if (!cache_storage_has_cap(m_storage_caps, mask))
+    // The mapping from tables to items, needed for invalidation, and the
+    // admission of values are maintained by LRUStorage, so it must be used
+    // if either is enabled.
+    bool use_lru = !cache_storage_has_cap(m_storage_caps, mask) ||
+                   (config.invalidate != CACHE_INVALIDATE_NEVER) ||
+                   (config.eviction != CACHE_EVICTION_LRU);
+
+    if (use_lru)
     {
         // Since we will wrap the native storage with a LRUStorage, according
         // to the used threading model, the storage itself may be single
@@ -171,10 +181,10 @@ Storage* StorageFactory::createStorage(const char* zName,
 
     if (pStorage)
     {
-        if (!cache_storage_has_cap(m_storage_caps, mask))
+        if (use_lru)
         {
-            // Ok, so the cache cannot handle eviction. Let's decorate the
-            // real storage with a storage than can.
+            // Ok, so the cache cannot handle eviction or invalidation. Let's
+            // decorate the real storage with a storage than can.
 
             LRUStorage *pLruStorage = NULL;
 
@@ -204,6 +214,72 @@ Storage* StorageFactory::createStorage(const char* zName,
     return pStorage;
 }
 
+Storage* StorageFactory::createShardedStorage(const char* zName,
+                                              const CACHE_STORAGE_CONFIG& config,
+                                              uint32_t nShards,
+                                              int argc, char* argv[])
+{
+    if (nShards <= 1)
+    {
+        return createStorage(zName, config, argc, argv);
+    }
+
+    ss_dassert(config.thread_model == CACHE_THREAD_MODEL_MT);
+
+    CacheStorageConfig shard_config(config);
+
+    if (config.max_count != 0)
+    {
+        shard_config.max_count = std::max(config.max_count / nShards, (uint32_t)1);
+    }
+
+    if (config.max_size != 0)
+    {
+        shard_config.max_size = std::max(config.max_size / nShards, (uint64_t)1);
+    }
+
+    ShardedStorage::Shards shards;
+    MXS_EXCEPTION_GUARD(shards.reserve(nShards));
+
+    // With the space reserved, adding a shard cannot fail.
+    bool ok = (shards.capacity() >= nShards);
+
+    for (uint32_t i = 0; ok && (i < nShards); ++i)
+    {
+        // Each shard needs a name of its own, as a persistent storage
+        // uses the name for its files.
+        std::stringstream ss;
+        ss << zName << "-" << i;
+
+        Storage* pShard = createStorage(ss.str().c_str(), shard_config, argc, argv);
+
+        if (pShard)
+        {
+            shards.push_back(pShard);
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+
+    Storage* pStorage = NULL;
+
+    if (ok)
+    {
+        pStorage = ShardedStorage::create(config, shards);
+    }
+
+    if (!pStorage)
+    {
+        for (ShardedStorage::Shards::iterator i = shards.begin(); i != shards.end(); ++i)
+        {
+            delete *i;
+        }
+    }
+
+    return pStorage;
+}
 
 Storage* StorageFactory::createRawStorage(const char* zName,
                                           const CACHE_STORAGE_CONFIG& config,
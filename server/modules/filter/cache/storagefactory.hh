@@ -66,6 +66,27 @@ public:
                            const CACHE_STORAGE_CONFIG& config,
                            int argc = 0, char* argv[] = NULL);
 
+    /**
+     * Create sharded storage instance.
+     *
+     * The keys are partitioned across @c nShards storages created using
+     * @c createStorage, each of which gets an equal share of max_count
+     * and max_size. Only meaningful for multi threaded storages.
+     *
+     * @param zName      The name of the storage.
+     * @param config     The storage configuration.
+     * @param nShards    The number of shards, if 1 or less, a storage
+     *                   created using @c createStorage is returned.
+     * @argc             Number of items in argv.
+     * @argv             Storage specific arguments.
+     *
+     * @return A storage instance or NULL in case of errors.
+     */
+    Storage* createShardedStorage(const char* zName,
+                                  const CACHE_STORAGE_CONFIG& config,
+                                  uint32_t nShards,
+                                  int argc = 0, char* argv[] = NULL);
+
     /**
      * Create raw storage instance.
      *
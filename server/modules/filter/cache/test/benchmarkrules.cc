@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "rules.h"
+#include <maxscale/alloc.h>
+#include <maxscale/paths.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/query_classifier.h>
+#include <maxscale/protocol/mysql.h>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace
+{
+
+const size_t DEFAULT_RULES = 100;
+const size_t DEFAULT_ROUNDS = 100000;
+
+GWBUF* create_gwbuf(const string& s)
+{
+    size_t len = s.length();
+    size_t payload_len = len + 1;
+    size_t gwbuf_len = MYSQL_HEADER_LEN + payload_len;
+
+    GWBUF* gwbuf = gwbuf_alloc(gwbuf_len);
+
+    if (gwbuf)
+    {
+        *((unsigned char*)((char*)GWBUF_DATA(gwbuf))) = payload_len;
+        *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 1)) = (payload_len >> 8);
+        *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 2)) = (payload_len >> 16);
+        *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 3)) = 0x00;
+        *((unsigned char*)((char*)GWBUF_DATA(gwbuf) + 4)) = 0x03;
+        memcpy((char*)GWBUF_DATA(gwbuf) + MYSQL_HEADER_LEN + 1, s.c_str(), len);
+    }
+
+    return gwbuf;
+}
+
+inline uint64_t now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Create store rules that match the tables tbl0 ... tbl<n - 1>, half of them
+ * qualified with a database, and one rule matching a column.
+ */
+string create_rules(size_t n)
+{
+    stringstream ss;
+
+    ss << "{ \"store\": [ ";
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        ss << "{ \"attribute\": \"table\", \"op\": \"=\", \"value\": \"";
+
+        if (i % 2)
+        {
+            ss << "db.";
+        }
+
+        ss << "tbl" << i << "\" }, ";
+    }
+
+    ss << "{ \"attribute\": \"column\", \"op\": \"=\", \"value\": \"nosuchcolumn\" } ] }";
+
+    return ss.str();
+}
+
+/**
+ * Evaluate the store rules against the statements.
+ *
+ * @return The number of nanoseconds an evaluation took on the average.
+ */
+uint64_t run(CACHE_RULES* pRules, const vector<GWBUF*>& statements, size_t rounds, size_t* pMatches)
+{
+    size_t matches = 0;
+
+    uint64_t start = now();
+
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        for (vector<GWBUF*>::const_iterator j = statements.begin(); j != statements.end(); ++j)
+        {
+            if (cache_rules_should_store(pRules, 0, "db", *j))
+            {
+                ++matches;
+            }
+        }
+    }
+
+    uint64_t end = now();
+
+    *pMatches = matches;
+
+    return (end - start) / (rounds * statements.size());
+}
+
+int benchmark(size_t n_rules, size_t rounds)
+{
+    int rv = EXIT_FAILURE;
+
+    CACHE_RULES* pRules = cache_rules_parse(create_rules(n_rules).c_str(), 0);
+
+    if (pRules)
+    {
+        vector<GWBUF*> statements;
+
+        // The first table rule, the last table rule and no rule matches.
+        stringstream ss;
+        ss << "SELECT a FROM tbl0";
+        statements.push_back(create_gwbuf(ss.str()));
+        ss.str("");
+        ss << "SELECT a FROM db.tbl" << (n_rules - 1);
+        statements.push_back(create_gwbuf(ss.str()));
+        statements.push_back(create_gwbuf("SELECT a FROM nosuchtable"));
+
+        // Classify the statements once, so that the parsing is not measured.
+        size_t matches;
+        run(pRules, statements, 1, &matches);
+
+        size_t compiled_matches;
+        uint64_t compiled = run(pRules, statements, rounds, &compiled_matches);
+
+        cache_rules_index* pIndex = pRules->index;
+        pRules->index = NULL;
+        size_t listed_matches;
+        uint64_t listed = run(pRules, statements, rounds, &listed_matches);
+        pRules->index = pIndex;
+
+        cout << "Rules      : " << n_rules + 1 << endl;
+        cout << "Statements : " << rounds * statements.size() << endl;
+        cout << "Compiled   : " << compiled << "ns per statement" << endl;
+        cout << "One by one : " << listed << "ns per statement" << endl;
+
+        if (!pIndex)
+        {
+            cerr << "error: The rules were not compiled." << endl;
+        }
+        else if (compiled_matches != listed_matches)
+        {
+            cerr << "error: The compiled rules matched " << compiled_matches
+                 << " statements, the rules one by one " << listed_matches << "." << endl;
+        }
+        else
+        {
+            rv = EXIT_SUCCESS;
+        }
+
+        for (vector<GWBUF*>::iterator i = statements.begin(); i != statements.end(); ++i)
+        {
+            gwbuf_free(*i);
+        }
+
+        cache_rules_free(pRules);
+    }
+    else
+    {
+        cerr << "error: Could not parse the rules." << endl;
+    }
+
+    return rv;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rv = EXIT_FAILURE;
+
+    size_t n_rules = (argc >= 2) ? atoi(argv[1]) : DEFAULT_RULES;
+    size_t rounds = (argc >= 3) ? atoi(argv[2]) : DEFAULT_ROUNDS;
+
+    if ((argc <= 3) && (n_rules != 0) && (rounds != 0))
+    {
+        if (mxs_log_init(NULL, ".", MXS_LOG_TARGET_DEFAULT))
+        {
+            MXS_CONFIG* pConfig = config_get_global_options();
+            pConfig->n_threads = 1;
+
+            set_libdir(MXS_STRDUP_A("../../../../../query_classifier/qc_sqlite/"));
+
+            if (qc_setup("qc_sqlite", "") && qc_process_init(QC_INIT_BOTH))
+            {
+                rv = benchmark(n_rules, rounds);
+
+                qc_process_end(QC_INIT_BOTH);
+            }
+            else
+            {
+                cerr << "error: Could not initialize query classifier." << endl;
+            }
+
+            mxs_log_finish();
+        }
+        else
+        {
+            cerr << "error: Could not initialize log." << endl;
+        }
+    }
+    else
+    {
+        cerr << "usage: benchmarkrules [rules [rounds]]" << endl;
+    }
+
+    return rv;
+}
@@ -12,8 +12,10 @@
  */
 
 #include "testerlrustorage.hh"
+#include "compressedstorage.hh"
 #include "storage.hh"
 #include "storagefactory.hh"
+#include "tieredstorage.hh"
 
 using namespace std;
 using namespace maxscale;
@@ -41,8 +43,21 @@ int TesterLRUStorage::execute(size_t n_threads, size_t n_seconds, const CacheIte
     int rv4 = test_max_size(n_threads, n_seconds, cache_items, size);
     out() << endl;
     int rv5 = test_max_count_and_size(n_threads, n_seconds, cache_items, size);
+    out() << endl;
+    int rv6 = test_invalidate(cache_items);
+    out() << endl;
+    int rv7 = test_sharded(n_threads, n_seconds, cache_items);
+    out() << endl;
+    int rv8 = test_compressed(cache_items);
+    out() << endl;
+    int rv9 = test_tiered(cache_items);
+    out() << endl;
+    int rv10 = test_tinylfu(cache_items);
+    out() << endl;
+    int rv11 = test_tiered_shared(cache_items);
 
-    return combine_rvs(rv1, rv2, rv3, rv4, rv5);
+    return combine_rvs(rv1, rv2, rv3, combine_rvs(rv4, rv5),
+                       combine_rvs(rv6, rv7, combine_rvs(rv8, rv9, rv10, rv11)));
 }
 
 Storage* TesterLRUStorage::get_storage(const CACHE_STORAGE_CONFIG& config) const
@@ -71,7 +86,7 @@ int TesterLRUStorage::test_lru(const CacheItems& cache_items, uint64_t size)
         {
             const CacheItems::value_type& cache_item = cache_items[i];
 
-            result = pStorage->put_value(cache_item.first, cache_item.second);
+            result = pStorage->put_value(cache_item.first, vector<string>(), cache_item.second);
 
             if (result == CACHE_RESULT_OK)
             {
@@ -144,6 +159,438 @@ int TesterLRUStorage::test_lru(const CacheItems& cache_items, uint64_t size)
     return rv;
 }
 
+int TesterLRUStorage::test_invalidate(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+    out() << "LRU invalidate\n" << endl;
+
+    size_t items = cache_items.size() > 100 ? 100 : cache_items.size();
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    config.invalidate = CACHE_INVALIDATE_CURRENT;
+
+    Storage* pStorage = get_storage(config);
+
+    if (pStorage)
+    {
+        rv = EXIT_SUCCESS;
+
+        vector<string> even(1, "test.even");
+        vector<string> odd(1, "test.odd");
+
+        for (size_t i = 0; i < items; ++i)
+        {
+            const CacheItems::value_type& cache_item = cache_items[i];
+
+            cache_result_t result = pStorage->put_value(cache_item.first,
+                                                        i % 2 == 0 ? even : odd,
+                                                        cache_item.second);
+
+            if (!CACHE_RESULT_IS_OK(result))
+            {
+                out() << "Could not put item." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        if (!CACHE_RESULT_IS_OK(pStorage->invalidate(even)))
+        {
+            out() << "Could not invalidate items." << endl;
+            rv = EXIT_FAILURE;
+        }
+
+        for (size_t i = 0; i < items; ++i)
+        {
+            GWBUF* pValue = NULL;
+            cache_result_t result = pStorage->get_value(cache_items[i].first, 0, &pValue);
+
+            if (i % 2 == 0)
+            {
+                if (!CACHE_RESULT_IS_NOT_FOUND(result))
+                {
+                    out() << "Invalidated item was found." << endl;
+                    rv = EXIT_FAILURE;
+                }
+            }
+            else if (!CACHE_RESULT_IS_OK(result))
+            {
+                out() << "Item that was not invalidated was not found." << endl;
+                rv = EXIT_FAILURE;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        delete pStorage;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_sharded(size_t n_threads, size_t n_seconds,
+                                   const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    const uint32_t n_shards = 4;
+    size_t max_count = cache_items.size() / 4;
+
+    out() << "LRU sharded: " << n_shards << " shards, max-count: " << max_count << "\n" << endl;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    config.max_count = max_count;
+
+    Storage* pStorage = m_factory.createShardedStorage("unspecified", config, n_shards);
+
+    if (pStorage)
+    {
+        rv = execute_tasks(n_threads, n_seconds, cache_items, *pStorage);
+
+        uint64_t items;
+        cache_result_t result = pStorage->get_items(&items);
+        ss_dassert(result == CACHE_RESULT_OK);
+
+        out() << "Max count: " << max_count << ", count: " << items << "." << endl;
+
+        // Each shard gets an equal share of the maximum count.
+        if (items > max_count)
+        {
+            rv = EXIT_FAILURE;
+        }
+
+        delete pStorage;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_compressed(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+    out() << "LRU compressed\n" << endl;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+
+    Storage* pStorage = get_storage(config);
+    Storage* pCompressed_storage = pStorage ? CompressedStorage::create(pStorage, 0) : NULL;
+
+    if (pCompressed_storage)
+    {
+        rv = EXIT_SUCCESS;
+
+        for (CacheItems::const_iterator i = cache_items.begin(); i != cache_items.end(); ++i)
+        {
+            GWBUF* pValue = NULL;
+
+            if (!CACHE_RESULT_IS_OK(pCompressed_storage->put_value(i->first, vector<string>(), i->second)) ||
+                !CACHE_RESULT_IS_OK(pCompressed_storage->get_value(i->first, 0, &pValue)))
+            {
+                out() << "Could not put or get item." << endl;
+                rv = EXIT_FAILURE;
+            }
+            else if (gwbuf_compare(pValue, i->second) != 0)
+            {
+                out() << "Item read was not the item written." << endl;
+                rv = EXIT_FAILURE;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        delete pCompressed_storage;
+    }
+    else
+    {
+        delete pStorage;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_tinylfu(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    size_t max_count = cache_items.size() > 4 ? cache_items.size() / 4 : 1;
+
+    out() << "LRU tinylfu: max-count: " << max_count << "\n" << endl;
+
+    CacheStorageConfig config(CACHE_THREAD_MODEL_MT);
+    config.max_count = max_count;
+    config.eviction = CACHE_EVICTION_TINYLFU;
+
+    Storage* pStorage = get_storage(config);
+
+    if (pStorage)
+    {
+        rv = EXIT_SUCCESS;
+
+        // The first items are put and then used a few times, ...
+        for (size_t i = 0; i < max_count; ++i)
+        {
+            const CacheItems::value_type& cache_item = cache_items[i];
+
+            cache_result_t result = pStorage->put_value(cache_item.first, vector<string>(), cache_item.second);
+
+            if (!CACHE_RESULT_IS_OK(result))
+            {
+                out() << "Could not put item." << endl;
+                rv = EXIT_FAILURE;
+            }
+
+            for (int j = 0; j < 3; ++j)
+            {
+                GWBUF* pValue = NULL;
+                pStorage->get_value(cache_item.first, 0, &pValue);
+                gwbuf_free(pValue);
+            }
+        }
+
+        // ... and the rest are looked up and put once, as by a scan.
+        for (size_t i = max_count; i < cache_items.size(); ++i)
+        {
+            const CacheItems::value_type& cache_item = cache_items[i];
+
+            GWBUF* pValue = NULL;
+            pStorage->get_value(cache_item.first, 0, &pValue);
+            gwbuf_free(pValue);
+
+            cache_result_t result = pStorage->put_value(cache_item.first, vector<string>(), cache_item.second);
+
+            if (!CACHE_RESULT_IS_OK(result))
+            {
+                out() << "Could not put item." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        // The frequencies are estimates, so a scanned item may occasionally
+        // be taken to be frequent, but nearly all of the first items must remain.
+        size_t remaining = 0;
+
+        for (size_t i = 0; i < max_count; ++i)
+        {
+            GWBUF* pValue = NULL;
+
+            if (CACHE_RESULT_IS_OK(pStorage->get_value(cache_items[i].first, 0, &pValue)))
+            {
+                ++remaining;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        out() << "Frequently used items remaining: " << remaining << "/" << max_count << "." << endl;
+
+        if (remaining < max_count - max_count / 10)
+        {
+            out() << "Frequently used items were evicted by items used once." << endl;
+            rv = EXIT_FAILURE;
+        }
+
+        delete pStorage;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_tiered(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    size_t max_count = cache_items.size() > 4 ? cache_items.size() / 4 : 1;
+
+    out() << "LRU tiered: hot max-count: " << max_count << "\n" << endl;
+
+    CacheStorageConfig hot_config(CACHE_THREAD_MODEL_MT);
+    hot_config.max_count = max_count;
+    hot_config.invalidate = CACHE_INVALIDATE_CURRENT;
+
+    CacheStorageConfig warm_config(CACHE_THREAD_MODEL_MT);
+    warm_config.invalidate = CACHE_INVALIDATE_CURRENT;
+
+    Storage* pHot = get_storage(hot_config);
+    Storage* pWarm = get_storage(warm_config);
+    Storage* pTiered_storage = NULL;
+
+    if (pHot && pWarm)
+    {
+        pTiered_storage = TieredStorage::create(hot_config, pHot, pWarm, TieredStorage::SStorageFactory());
+    }
+
+    if (pTiered_storage)
+    {
+        rv = EXIT_SUCCESS;
+
+        vector<string> words(1, "test.tiered");
+
+        for (CacheItems::const_iterator i = cache_items.begin(); i != cache_items.end(); ++i)
+        {
+            if (!CACHE_RESULT_IS_OK(pTiered_storage->put_value(i->first, words, i->second)))
+            {
+                out() << "Could not put item." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        // The items put first have been evicted from the hot tier, so they
+        // are fetched from the warm tier and promoted.
+        for (CacheItems::const_iterator i = cache_items.begin(); i != cache_items.end(); ++i)
+        {
+            GWBUF* pValue = NULL;
+
+            if (!CACHE_RESULT_IS_OK(pTiered_storage->get_value(i->first, 0, &pValue)))
+            {
+                out() << "Could not get item." << endl;
+                rv = EXIT_FAILURE;
+            }
+            else if (gwbuf_compare(pValue, i->second) != 0)
+            {
+                out() << "Item read was not the item written." << endl;
+                rv = EXIT_FAILURE;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        uint64_t hot_items;
+        uint64_t items;
+
+        if (!CACHE_RESULT_IS_OK(pHot->get_items(&hot_items)) ||
+            !CACHE_RESULT_IS_OK(pTiered_storage->get_items(&items)))
+        {
+            out() << "Could not get the number of items." << endl;
+            rv = EXIT_FAILURE;
+        }
+        else
+        {
+            out() << "Hot count: " << hot_items << ", count: " << items << "." << endl;
+
+            if ((hot_items > max_count) || (items != cache_items.size()))
+            {
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        // Promoted items must be invalidated as well.
+        if (!CACHE_RESULT_IS_OK(pTiered_storage->invalidate(words)))
+        {
+            out() << "Could not invalidate items." << endl;
+            rv = EXIT_FAILURE;
+        }
+
+        for (CacheItems::const_iterator i = cache_items.begin(); i != cache_items.end(); ++i)
+        {
+            GWBUF* pValue = NULL;
+
+            if (!CACHE_RESULT_IS_NOT_FOUND(pTiered_storage->get_value(i->first, 0, &pValue)))
+            {
+                out() << "Invalidated item was found." << endl;
+                rv = EXIT_FAILURE;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        delete pTiered_storage;
+    }
+    else
+    {
+        delete pHot;
+        delete pWarm;
+    }
+
+    return rv;
+}
+
+int TesterLRUStorage::test_tiered_shared(const CacheItems& cache_items)
+{
+    int rv = EXIT_FAILURE;
+
+    size_t max_count = cache_items.size() > 4 ? cache_items.size() / 4 : 1;
+
+    out() << "LRU tiered shared: hot max-count: " << max_count << "\n" << endl;
+
+    CacheStorageConfig hot_config(CACHE_THREAD_MODEL_ST);
+    hot_config.max_count = max_count;
+
+    CacheStorageConfig warm_config(CACHE_THREAD_MODEL_MT);
+
+    Storage* pWarm = get_storage(warm_config);
+    TieredStorage::SStorage sWarm(pWarm);
+
+    // As the private caches of two threads.
+    Storage* pTiered1 = NULL;
+    Storage* pTiered2 = NULL;
+
+    if (pWarm)
+    {
+        TieredStorage::SStorageFactory sNo_factory;
+
+        Storage* pHot = get_storage(hot_config);
+        pTiered1 = pHot ? TieredStorage::create(hot_config, pHot, sWarm, sNo_factory) : NULL;
+
+        if (pHot && !pTiered1)
+        {
+            delete pHot;
+        }
+
+        pHot = get_storage(hot_config);
+        pTiered2 = pHot ? TieredStorage::create(hot_config, pHot, sWarm, sNo_factory) : NULL;
+
+        if (pHot && !pTiered2)
+        {
+            delete pHot;
+        }
+    }
+
+    if (pTiered1 && pTiered2)
+    {
+        rv = EXIT_SUCCESS;
+
+        for (CacheItems::const_iterator i = cache_items.begin(); i != cache_items.end(); ++i)
+        {
+            if (!CACHE_RESULT_IS_OK(pTiered1->put_value(i->first, vector<string>(), i->second)))
+            {
+                out() << "Could not put item." << endl;
+                rv = EXIT_FAILURE;
+            }
+        }
+
+        // What one put, the other finds in the shared warm tier.
+        for (CacheItems::const_iterator i = cache_items.begin(); i != cache_items.end(); ++i)
+        {
+            GWBUF* pValue = NULL;
+
+            if (!CACHE_RESULT_IS_OK(pTiered2->get_value(i->first, 0, &pValue)))
+            {
+                out() << "Item put by the other storage was not found." << endl;
+                rv = EXIT_FAILURE;
+            }
+            else if (gwbuf_compare(pValue, i->second) != 0)
+            {
+                out() << "Item read was not the item written." << endl;
+                rv = EXIT_FAILURE;
+            }
+
+            gwbuf_free(pValue);
+        }
+
+        uint64_t items;
+
+        if (!CACHE_RESULT_IS_OK(pWarm->get_items(&items)) || (items != cache_items.size()))
+        {
+            out() << "The shared tier does not hold every item once." << endl;
+            rv = EXIT_FAILURE;
+        }
+    }
+
+    delete pTiered1;
+    delete pTiered2;
+
+    return rv;
+}
+
 int TesterLRUStorage::test_max_count(size_t n_threads, size_t n_seconds,
                                      const CacheItems& cache_items, uint64_t size)
 {
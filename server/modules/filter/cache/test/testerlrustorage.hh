@@ -40,6 +40,12 @@ public:
 
 private:
     int test_lru(const CacheItems& cache_items, uint64_t size);
+    int test_invalidate(const CacheItems& cache_items);
+    int test_sharded(size_t n_threads, size_t n_seconds, const CacheItems& cache_items);
+    int test_compressed(const CacheItems& cache_items);
+    int test_tiered(const CacheItems& cache_items);
+    int test_tiered_shared(const CacheItems& cache_items);
+    int test_tinylfu(const CacheItems& cache_items);
     int test_max_count(size_t n_threads, size_t n_seconds,
                        const CacheItems& cache_items, uint64_t size);
     int test_max_size(size_t n_threads, size_t n_seconds,
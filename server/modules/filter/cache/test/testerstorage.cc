@@ -58,7 +58,7 @@ int TesterStorage::HitTask::run()
         {
         case STORAGE_PUT:
             {
-                cache_result_t result = m_storage.put_value(cache_item.first, cache_item.second);
+                cache_result_t result = m_storage.put_value(cache_item.first, vector<string>(), cache_item.second);
                 if (CACHE_RESULT_IS_OK(result))
                 {
                     ++m_puts;
@@ -178,7 +178,7 @@ int TesterStorage::run(size_t n_threads,
 
         CacheKey key;
 
-        key.data = i;
+        key.lo = i;
 
         vector<uint8_t> value(size, static_cast<uint8_t>(i));
 
@@ -331,7 +331,7 @@ int TesterStorage::test_ttl(const CacheItems& cache_items, Storage& storage)
 
         const CacheItems::value_type& cache_item = cache_items[0];
 
-        cache_result_t result = storage.put_value(cache_item.first, cache_item.second);
+        cache_result_t result = storage.put_value(cache_item.first, vector<string>(), cache_item.second);
 
         if (!CACHE_RESULT_IS_OK(result))
         {
@@ -61,7 +61,7 @@ int test(StorageFactory& factory, istream& in)
             if (pQuery)
             {
                 CACHE_KEY key;
-                cache_result_t result = Cache::get_default_key(NULL, pQuery, &key);
+                cache_result_t result = Cache::get_default_key(NULL, NULL, pQuery, &key);
 
                 if (result == CACHE_RESULT_OK)
                 {
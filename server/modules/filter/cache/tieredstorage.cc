@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#define MXS_MODULE_NAME "cache"
+#include "tieredstorage.hh"
+#include "cache_storage_api.hh"
+#include <time.h>
+#include <maxscale/buffer.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+/**
+ * A stored value starts with the time it was put, as a 4-byte little endian
+ * integer, followed by the number of its invalidation words, as a 2-byte
+ * little endian integer. Each word is stored as its length, as a 2-byte
+ * little endian integer, followed by its characters.
+ */
+const size_t TIME_LEN = 4;
+const size_t COUNT_LEN = 2;
+const size_t WORD_LEN_LEN = 2;
+const size_t MAX_WORDS = 0xffff;
+const size_t MAX_WORD_LEN = 0xffff;
+
+void set_tier_info(json_t* pObject,
+                   const char* zName,
+                   const Storage* pTier,
+                   uint32_t what,
+                   uint64_t hits,
+                   uint64_t lookups)
+{
+    json_t* pTier_info;
+
+    if (CACHE_RESULT_IS_OK(pTier->get_info(what, &pTier_info)))
+    {
+        cache_set_json_integer(pTier_info, "hits", hits);
+
+        // Of the lookups that reached the tier, how many were hits.
+        json_t* pHit_rate = json_real(lookups != 0 ? (double)hits / lookups : 0.0);
+
+        if (pHit_rate)
+        {
+            json_object_set(pTier_info, "hit_rate", pHit_rate);
+            json_decref(pHit_rate);
+        }
+
+        json_object_set(pObject, zName, pTier_info);
+        json_decref(pTier_info);
+    }
+}
+
+}
+
+TieredStorage::TieredStorage(const CACHE_STORAGE_CONFIG& config,
+                             Storage* pHot,
+                             Storage* pWarm,
+                             SStorage sShared_warm,
+                             SStorageFactory sWarm_factory)
+    : m_config(config)
+    , m_pHot(pHot)
+    , m_pWarm(pWarm)
+    , m_sShared_warm(sShared_warm)
+    , m_sWarm_factory(sWarm_factory)
+    , m_generation(0)
+    , m_modifying(0)
+{
+    MXS_NOTICE("Created tiered storage.");
+}
+
+TieredStorage::~TieredStorage()
+{
+    delete m_pHot;
+    // The warm tier must be deleted before its factory is.
+    if (!m_sShared_warm.get())
+    {
+        delete m_pWarm;
+    }
+
+    m_sShared_warm.reset();
+}
+
+TieredStorage* TieredStorage::create(const CACHE_STORAGE_CONFIG& config,
+                                     Storage* pHot,
+                                     Storage* pWarm,
+                                     SStorageFactory sWarm_factory)
+{
+    TieredStorage* pTiered_storage = NULL;
+
+    MXS_EXCEPTION_GUARD(pTiered_storage = new TieredStorage(config, pHot, pWarm, SStorage(), sWarm_factory));
+
+    return pTiered_storage;
+}
+
+TieredStorage* TieredStorage::create(const CACHE_STORAGE_CONFIG& config,
+                                     Storage* pHot,
+                                     SStorage sWarm,
+                                     SStorageFactory sWarm_factory)
+{
+    ss_dassert(sWarm.get());
+
+    TieredStorage* pTiered_storage = NULL;
+
+    MXS_EXCEPTION_GUARD(pTiered_storage = new TieredStorage(config, pHot, sWarm.get(), sWarm, sWarm_factory));
+
+    return pTiered_storage;
+}
+
+void TieredStorage::get_config(CACHE_STORAGE_CONFIG* pConfig)
+{
+    *pConfig = m_config;
+}
+
+cache_result_t TieredStorage::get_info(uint32_t what,
+                                       json_t** ppInfo) const
+{
+    *ppInfo = json_object();
+
+    if (*ppInfo)
+    {
+        uint64_t hot_hits = atomic_load_uint64(&m_stats.hot_hits);
+        uint64_t warm_hits = atomic_load_uint64(&m_stats.warm_hits);
+        uint64_t misses = atomic_load_uint64(&m_stats.misses);
+
+        cache_set_json_integer(*ppInfo, "misses", misses);
+        cache_set_json_integer(*ppInfo, "promotions", atomic_load_uint64(&m_stats.promotions));
+
+        // Every lookup reaches the hot tier, only the misses of the hot tier
+        // reach the warm tier.
+        set_tier_info(*ppInfo, "hot", m_pHot, what, hot_hits, hot_hits + warm_hits + misses);
+        set_tier_info(*ppInfo, "warm", m_pWarm, what, warm_hits, warm_hits + misses);
+    }
+
+    return *ppInfo ? CACHE_RESULT_OK : CACHE_RESULT_OUT_OF_RESOURCES;
+}
+
+cache_result_t TieredStorage::get_value(const CACHE_KEY& key,
+                                        uint32_t flags,
+                                        GWBUF** ppValue) const
+{
+    // Read before the warm tier is, so that a modification that happens
+    // meanwhile is noticed when the value is promoted.
+    uint64_t generation = atomic_load_uint64(&m_generation);
+
+    // The staleness is decided here, as a promoted value is younger
+    // in the hot tier than it actually is.
+    GWBUF* pStored = NULL;
+    bool from_warm = false;
+    cache_result_t result = m_pHot->get_value(key, CACHE_FLAGS_INCLUDE_STALE, &pStored);
+
+    if (!CACHE_RESULT_IS_OK(result))
+    {
+        result = m_pWarm->get_value(key, CACHE_FLAGS_INCLUDE_STALE, &pStored);
+        from_warm = CACHE_RESULT_IS_OK(result);
+    }
+
+    if (!CACHE_RESULT_IS_OK(result))
+    {
+        atomic_add_uint64(&m_stats.misses, 1);
+        return result;
+    }
+
+    atomic_add_uint64(from_warm ? &m_stats.warm_hits : &m_stats.hot_hits, 1);
+
+    uint32_t put_time;
+    vector<string> words;
+    size_t header_len;
+
+    if (!parse(pStored, &put_time, from_warm ? &words : NULL, &header_len))
+    {
+        MXS_ERROR("Cached value is of unknown format.");
+        gwbuf_free(pStored);
+        // The session will fetch the value from the server and store it anew.
+        return CACHE_RESULT_NOT_FOUND;
+    }
+
+    uint32_t now = time(NULL);
+
+    uint32_t hard_ttl = cache_storage_ttl(&m_config, &key, m_config.hard_ttl);
+    uint32_t soft_ttl = cache_storage_ttl(&m_config, &key, m_config.soft_ttl);
+
+    bool is_hard_stale = hard_ttl == 0 ? false : (now - put_time > hard_ttl);
+    bool is_soft_stale = soft_ttl == 0 ? false : (now - put_time > soft_ttl);
+    bool include_stale = ((flags & CACHE_FLAGS_INCLUDE_STALE) != 0);
+
+    if (is_hard_stale)
+    {
+        gwbuf_free(pStored);
+
+        if (!from_warm)
+        {
+            // A promoted value outlives its time to live in the hot tier.
+            m_pHot->del_value(key);
+        }
+
+        result = CACHE_RESULT_NOT_FOUND;
+    }
+    else
+    {
+        if (from_warm)
+        {
+            promote(key, generation, words, pStored);
+        }
+
+        if (!is_soft_stale || include_stale)
+        {
+            *ppValue = gwbuf_consume(pStored, header_len);
+            result = *ppValue ? CACHE_RESULT_OK : CACHE_RESULT_NOT_FOUND;
+
+            if (is_soft_stale)
+            {
+                result |= CACHE_RESULT_STALE;
+            }
+        }
+        else
+        {
+            gwbuf_free(pStored);
+            result = CACHE_RESULT_NOT_FOUND | CACHE_RESULT_STALE;
+        }
+    }
+
+    return result;
+}
+
+cache_result_t TieredStorage::put_value(const CACHE_KEY& key,
+                                        const vector<string>& invalidation_words,
+                                        const GWBUF* pValue)
+{
+    ss_dassert(GWBUF_IS_CONTIGUOUS(pValue));
+
+    GWBUF* pStored = wrap(time(NULL), invalidation_words, pValue);
+
+    if (!pStored)
+    {
+        return CACHE_RESULT_OUT_OF_RESOURCES;
+    }
+
+    begin_modification();
+
+    cache_result_t warm_result = m_pWarm->put_value(key, invalidation_words, pStored);
+
+    if (!CACHE_RESULT_IS_OK(warm_result))
+    {
+        // An earlier value must not be found once this one has been put.
+        m_pWarm->del_value(key);
+    }
+
+    cache_result_t hot_result = m_pHot->put_value(key, invalidation_words, pStored);
+
+    if (!CACHE_RESULT_IS_OK(hot_result))
+    {
+        m_pHot->del_value(key);
+    }
+
+    end_modification();
+
+    gwbuf_free(pStored);
+
+    return CACHE_RESULT_IS_OK(warm_result) ? warm_result : hot_result;
+}
+
+cache_result_t TieredStorage::del_value(const CACHE_KEY& key)
+{
+    begin_modification();
+    cache_result_t hot_result = m_pHot->del_value(key);
+    cache_result_t warm_result = m_pWarm->del_value(key);
+    end_modification();
+
+    if (CACHE_RESULT_IS_OK(hot_result) || CACHE_RESULT_IS_NOT_FOUND(hot_result))
+    {
+        hot_result = warm_result;
+    }
+
+    return hot_result;
+}
+
+cache_result_t TieredStorage::invalidate(const vector<string>& words)
+{
+    begin_modification();
+    cache_result_t hot_result = m_pHot->invalidate(words);
+    cache_result_t warm_result = m_pWarm->invalidate(words);
+    end_modification();
+
+    return CACHE_RESULT_IS_OK(hot_result) ? warm_result : hot_result;
+}
+
+cache_result_t TieredStorage::get_head(CACHE_KEY* pKey, GWBUF** ppHead) const
+{
+    cache_result_t result = m_pHot->get_head(pKey, ppHead);
+
+    return CACHE_RESULT_IS_OK(result) ? unwrap_result(result, ppHead) : result;
+}
+
+cache_result_t TieredStorage::get_tail(CACHE_KEY* pKey, GWBUF** ppTail) const
+{
+    cache_result_t result = m_pWarm->get_tail(pKey, ppTail);
+
+    return CACHE_RESULT_IS_OK(result) ? unwrap_result(result, ppTail) : result;
+}
+
+cache_result_t TieredStorage::get_size(uint64_t* pSize) const
+{
+    return m_pWarm->get_size(pSize);
+}
+
+cache_result_t TieredStorage::get_items(uint64_t* pItems) const
+{
+    return m_pWarm->get_items(pItems);
+}
+
+cache_result_t TieredStorage::save(Writer& writer) const
+{
+    // The written values include the header, so that they can be restored as such.
+    return m_pWarm->save(writer);
+}
+
+cache_result_t TieredStorage::restore_value(const CACHE_KEY& key,
+                                            uint32_t time,
+                                            const vector<string>& invalidation_words,
+                                            const GWBUF* pValue)
+{
+    begin_modification();
+
+    cache_result_t result = m_pWarm->restore_value(key, time, invalidation_words, pValue);
+
+    if (CACHE_RESULT_IS_OK(result))
+    {
+        m_pHot->restore_value(key, time, invalidation_words, pValue);
+    }
+
+    end_modification();
+
+    return result;
+}
+
+/**
+ * Encode a value for storing.
+ *
+ * @param time    The time the value is put.
+ * @param words   The invalidation words of the value.
+ * @param pValue  A contiguous value.
+ *
+ * @return The value to store, NULL if there are too many or too long words,
+ *         or memory could not be allocated.
+ */
+//static
+GWBUF* TieredStorage::wrap(uint32_t time, const vector<string>& words, const GWBUF* pValue)
+{
+    if (words.size() > MAX_WORDS)
+    {
+        return NULL;
+    }
+
+    size_t header_len = TIME_LEN + COUNT_LEN;
+
+    for (vector<string>::const_iterator i = words.begin(); i != words.end(); ++i)
+    {
+        if (i->length() > MAX_WORD_LEN)
+        {
+            return NULL;
+        }
+
+        header_len += WORD_LEN_LEN + i->length();
+    }
+
+    size_t len = GWBUF_LENGTH(pValue);
+    GWBUF* pStored = gwbuf_alloc(header_len + len);
+
+    if (pStored)
+    {
+        uint8_t* pData = GWBUF_DATA(pStored);
+
+        pData[0] = time;
+        pData[1] = time >> 8;
+        pData[2] = time >> 16;
+        pData[3] = time >> 24;
+        pData[4] = words.size();
+        pData[5] = words.size() >> 8;
+        pData += TIME_LEN + COUNT_LEN;
+
+        for (vector<string>::const_iterator i = words.begin(); i != words.end(); ++i)
+        {
+            pData[0] = i->length();
+            pData[1] = i->length() >> 8;
+            memcpy(pData + WORD_LEN_LEN, i->data(), i->length());
+            pData += WORD_LEN_LEN + i->length();
+        }
+
+        memcpy(pData, GWBUF_DATA(pValue), len);
+    }
+
+    return pStored;
+}
+
+/**
+ * Decode the header of a stored value.
+ *
+ * @param pStored      A value stored by @c put_value.
+ * @param pTime        On successful return, the time the value was put.
+ * @param pWords       If not NULL, on successful return the invalidation
+ *                     words of the value.
+ * @param pHeader_len  On successful return, the length of the header.
+ *
+ * @return True, if the header could be decoded.
+ */
+//static
+bool TieredStorage::parse(const GWBUF* pStored,
+                          uint32_t* pTime,
+                          vector<string>* pWords,
+                          size_t* pHeader_len)
+{
+    size_t len = GWBUF_LENGTH(pStored);
+    const uint8_t* pData = GWBUF_DATA(pStored);
+
+    if (len < TIME_LEN + COUNT_LEN)
+    {
+        return false;
+    }
+
+    *pTime = pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t)pData[3] << 24);
+    size_t n_words = pData[4] | (pData[5] << 8);
+    size_t offset = TIME_LEN + COUNT_LEN;
+
+    for (size_t i = 0; i < n_words; ++i)
+    {
+        if (len < offset + WORD_LEN_LEN)
+        {
+            return false;
+        }
+
+        size_t word_len = pData[offset] | (pData[offset + 1] << 8);
+        offset += WORD_LEN_LEN;
+
+        if (len < offset + word_len)
+        {
+            return false;
+        }
+
+        if (pWords)
+        {
+            try
+            {
+                pWords->push_back(string(reinterpret_cast<const char*>(pData + offset), word_len));
+            }
+            catch (const std::exception& x)
+            {
+                return false;
+            }
+        }
+
+        offset += word_len;
+    }
+
+    *pHeader_len = offset;
+
+    return true;
+}
+
+/**
+ * Replace a fetched value with the value without the header.
+ *
+ * @param result   The result of fetching the value.
+ * @param ppValue  The fetched value, on return the value without the header.
+ *
+ * @return The result to return.
+ */
+cache_result_t TieredStorage::unwrap_result(cache_result_t result, GWBUF** ppValue) const
+{
+    uint32_t put_time;
+    size_t header_len;
+
+    if (parse(*ppValue, &put_time, NULL, &header_len))
+    {
+        *ppValue = gwbuf_consume(*ppValue, header_len);
+    }
+    else
+    {
+        MXS_ERROR("Cached value is of unknown format.");
+        gwbuf_free(*ppValue);
+        *ppValue = NULL;
+    }
+
+    return *ppValue ? result : CACHE_RESULT_NOT_FOUND;
+}
+
+/**
+ * Put a value found in the warm tier to the hot tier.
+ *
+ * @param key         The key of the value.
+ * @param generation  The generation before the value was fetched.
+ * @param words       The invalidation words of the value.
+ * @param pStored     The value as stored in the warm tier.
+ */
+void TieredStorage::promote(const CACHE_KEY& key,
+                            uint64_t generation,
+                            const vector<string>& words,
+                            const GWBUF* pStored) const
+{
+    if (CACHE_RESULT_IS_OK(m_pHot->put_value(key, words, pStored)))
+    {
+        if ((atomic_load_uint64(&m_modifying) != 0) ||
+            (atomic_load_uint64(&m_generation) != generation))
+        {
+            // The value may have been replaced, deleted or invalidated after
+            // it was fetched, so the promoted value may be outdated.
+            m_pHot->del_value(key);
+        }
+        else
+        {
+            atomic_add_uint64(&m_stats.promotions, 1);
+        }
+    }
+}
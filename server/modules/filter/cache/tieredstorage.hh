@@ -0,0 +1,197 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cppdefs.hh>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+#include <maxscale/atomic.h>
+#include "storage.hh"
+#include "storagefactory.hh"
+
+/**
+ * TieredStorage keeps the most recently used values in a small and fast
+ * hot tier, typically in memory, in front of a large warm tier, typically
+ * on disk. Every value is written to both tiers, so a value evicted from
+ * the hot tier is still found in the warm tier, from where it is promoted
+ * back to the hot tier when it is fetched.
+ *
+ * The stored values are prefixed with the time they were put and with their
+ * invalidation words, so that a promoted value keeps its original age and
+ * can still be invalidated.
+ */
+class TieredStorage : public Storage
+{
+public:
+    typedef std::tr1::shared_ptr<StorageFactory> SStorageFactory;
+    typedef std::tr1::shared_ptr<Storage>        SStorage;
+
+    ~TieredStorage();
+
+    /**
+     * Create a tiered storage.
+     *
+     * @param config         The configuration of the storage, its time to live
+     *                       is enforced for promoted values.
+     * @param pHot           The hot tier, on successful return owned by the
+     *                       created instance.
+     * @param pWarm          The warm tier, on successful return owned by the
+     *                       created instance.
+     * @param sWarm_factory  The factory the warm tier was created with, kept
+     *                       alive as long as the warm tier is.
+     *
+     * @return A new instance or NULL if one could not be created.
+     */
+    static TieredStorage* create(const CACHE_STORAGE_CONFIG& config,
+                                 Storage* pHot,
+                                 Storage* pWarm,
+                                 SStorageFactory sWarm_factory);
+
+    /**
+     * Create a tiered storage whose warm tier is shared with other tiered
+     * storages. Every value put to the warm tier by one of them is found by
+     * all of them, but the hot tiers of the others are not updated.
+     *
+     * @param config         The configuration of the storage.
+     * @param pHot           The hot tier, on successful return owned by the
+     *                       created instance.
+     * @param sWarm          The shared warm tier, which must be multi threaded
+     *                       if the tiered storages are used by different threads.
+     * @param sWarm_factory  The factory the warm tier was created with.
+     *
+     * @return A new instance or NULL if one could not be created.
+     */
+    static TieredStorage* create(const CACHE_STORAGE_CONFIG& config,
+                                 Storage* pHot,
+                                 SStorage sWarm,
+                                 SStorageFactory sWarm_factory);
+
+    void get_config(CACHE_STORAGE_CONFIG* pConfig);
+
+    cache_result_t get_info(uint32_t what,
+                            json_t** ppInfo) const;
+
+    cache_result_t get_value(const CACHE_KEY& key,
+                             uint32_t flags,
+                             GWBUF** ppValue) const;
+
+    cache_result_t put_value(const CACHE_KEY& key,
+                             const std::vector<std::string>& invalidation_words,
+                             const GWBUF* pValue);
+
+    cache_result_t del_value(const CACHE_KEY& key);
+
+    cache_result_t invalidate(const std::vector<std::string>& words);
+
+    /**
+     * The head of the hot tier.
+     */
+    cache_result_t get_head(CACHE_KEY* pKey,
+                            GWBUF** ppHead) const;
+
+    /**
+     * The tail of the warm tier.
+     */
+    cache_result_t get_tail(CACHE_KEY* pKey,
+                            GWBUF** ppTail) const;
+
+    /**
+     * The size of the warm tier, which holds all values.
+     */
+    cache_result_t get_size(uint64_t* pSize) const;
+
+    /**
+     * The number of items of the warm tier, which holds all values.
+     */
+    cache_result_t get_items(uint64_t* pItems) const;
+
+    /**
+     * The values of the warm tier, which holds all values, are written.
+     */
+    cache_result_t save(Writer& writer) const;
+
+    /**
+     * The value is restored to both tiers.
+     */
+    cache_result_t restore_value(const CACHE_KEY& key,
+                                 uint32_t time,
+                                 const std::vector<std::string>& invalidation_words,
+                                 const GWBUF* pValue);
+
+private:
+    TieredStorage(const CACHE_STORAGE_CONFIG& config,
+                  Storage* pHot,
+                  Storage* pWarm,
+                  SStorage sShared_warm,
+                  SStorageFactory sWarm_factory);
+
+    TieredStorage(const TieredStorage&);
+    TieredStorage& operator = (const TieredStorage&);
+
+    static GWBUF* wrap(uint32_t time,
+                       const std::vector<std::string>& words,
+                       const GWBUF* pValue);
+    static bool parse(const GWBUF* pStored,
+                      uint32_t* pTime,
+                      std::vector<std::string>* pWords,
+                      size_t* pHeader_len);
+
+    cache_result_t unwrap_result(cache_result_t result, GWBUF** ppValue) const;
+
+    void promote(const CACHE_KEY& key,
+                 uint64_t generation,
+                 const std::vector<std::string>& words,
+                 const GWBUF* pStored) const;
+
+    /**
+     * A promotion that overlaps a modification may put an outdated value to
+     * the hot tier, so the promoted value is removed if a modification has
+     * started or ended since the promotion started.
+     */
+    void begin_modification()
+    {
+        atomic_add_uint64(&m_modifying, 1);
+    }
+
+    void end_modification()
+    {
+        atomic_add_uint64(&m_generation, 1);
+        atomic_add_uint64(&m_modifying, -1);
+    }
+
+private:
+    struct Stats
+    {
+        Stats()
+            : hot_hits(0)
+            , warm_hits(0)
+            , misses(0)
+            , promotions(0)
+        {}
+
+        uint64_t hot_hits;   /*< How many times a value was found in the hot tier. */
+        uint64_t warm_hits;  /*< How many times a value was found only in the warm tier. */
+        uint64_t misses;     /*< How many times a value was found in neither tier. */
+        uint64_t promotions; /*< How many values have been promoted to the hot tier. */
+    };
+
+    const CACHE_STORAGE_CONFIG m_config;        /*< The configuration. */
+    Storage*                   m_pHot;          /*< The hot tier. */
+    Storage*                   m_pWarm;         /*< The warm tier. */
+    SStorage                   m_sShared_warm;  /*< The warm tier if it is shared, else empty. */
+    SStorageFactory            m_sWarm_factory; /*< The factory of the warm tier. */
+    uint64_t                   m_generation;    /*< Bumped whenever a modification ends. */
+    uint64_t                   m_modifying;     /*< The number of ongoing modifications. */
+    mutable Stats              m_stats;         /*< Statistics, updated atomically. */
+};
@@ -13,14 +13,18 @@
 
 #define MXS_MODULE_NAME "ccrfilter"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <maxscale/filter.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/log_manager.h>
 #include <string.h>
+#include <maxscale/hashtable.h>
 #include <maxscale/hint.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/spinlock.h>
+#include <maxscale/stmtinfo.h>
 #include <regex.h>
 #include <maxscale/alloc.h>
 
@@ -38,6 +42,9 @@
  *      time=<time period>          Seconds to wait before queries are routed to slaves.
  *      match=<regex>               Regex for matching
  *      ignore=<regex>              Regex for ignoring
+ *      table_scope=<bool>          Only route reads of modified tables to master
+ *      window_scope=<session|user> Share the time window between the sessions
+ *                                  of a user
  *
  * The filter also has two options:
  *     @c case, which makes the regex case-sensitive, and
@@ -60,6 +67,23 @@ static uint64_t getCapabilities(MXS_FILTER* instance);
 
 #define CCR_DEFAULT_TIME "60"
 
+/** Size of the hashtables of modified tables and shared windows */
+#define CCR_TABLE_BUCKETS 64
+#define CCR_USER_BUCKETS  64
+
+typedef enum
+{
+    CCR_WINDOW_SESSION,
+    CCR_WINDOW_USER
+} ccr_window_scope_t;
+
+static const MXS_ENUM_VALUE window_scope_values[] =
+{
+    {"session", CCR_WINDOW_SESSION},
+    {"user",    CCR_WINDOW_USER},
+    {NULL}
+};
+
 typedef struct lagstats
 {
     int n_add_count;  /*< No. of statements diverted based on count */
@@ -67,6 +91,22 @@ typedef struct lagstats
     int n_modified;   /*< No. of statements not diverted */
 } LAGSTATS;
 
+/**
+ * The time window during which reads are routed to the master
+ *
+ * A window is either private to a session or shared by all sessions of
+ * a user. The tables are only recorded when table_scope is enabled.
+ */
+typedef struct
+{
+    SPINLOCK   lock;              /*< Protects the window */
+    time_t     last_modification; /*< Time of the last data modifying operation */
+    time_t     last_untabled;     /*< Time of the last data modifying operation
+                                   *  whose tables are not known */
+    time_t     last_prune;        /*< Time when expired tables were last removed */
+    HASHTABLE *tables;            /*< Table name to time of last modification */
+} CCR_WINDOW;
+
 /**
  * Instance structure
  */
@@ -82,6 +122,10 @@ typedef struct
     LAGSTATS stats;
     regex_t re;      /* Compiled regex text of match */
     regex_t nore;    /* Compiled regex text of ignore */
+    bool table_scope;                /*< Only route reads of modified tables */
+    ccr_window_scope_t window_scope; /*< Whether windows are shared by users */
+    SPINLOCK lock;                   /*< Protects user_windows */
+    HASHTABLE *user_windows;         /*< User name to shared CCR_WINDOW */
 } CCR_INSTANCE;
 
 /**
@@ -91,7 +135,8 @@ typedef struct
 {
     MXS_DOWNSTREAM down;              /*< The downstream filter */
     int            hints_left;        /*< Number of hints left to add to queries*/
-    time_t         last_modification; /*< Time of the last data modifying operation */
+    CCR_WINDOW    *window;            /*< The time window of this session */
+    bool           shared;            /*< Whether the window is shared */
 } CCR_SESSION;
 
 static const MXS_ENUM_VALUE option_values[] =
@@ -151,6 +196,14 @@ MXS_MODULE* MXS_CREATE_MODULE()
              MXS_MODULE_OPT_NONE,
              option_values
             },
+            {"table_scope", MXS_MODULE_PARAM_BOOL, "false"},
+            {
+             "window_scope",
+             MXS_MODULE_PARAM_ENUM,
+             "session",
+             MXS_MODULE_OPT_ENUM_UNIQUE,
+             window_scope_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -158,6 +211,246 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+/**
+ * Allocate a new time window
+ *
+ * @param table_scope Whether the modified tables are recorded
+ * @return New window or NULL on memory allocation failure
+ */
+static CCR_WINDOW* window_alloc(bool table_scope)
+{
+    CCR_WINDOW *window = MXS_CALLOC(1, sizeof(CCR_WINDOW));
+
+    if (window)
+    {
+        spinlock_init(&window->lock);
+
+        if (table_scope)
+        {
+            if ((window->tables = hashtable_alloc(CCR_TABLE_BUCKETS, hashtable_item_strhash,
+                                                  hashtable_item_strcmp)))
+            {
+                hashtable_memory_fns(window->tables, NULL, NULL,
+                                     hashtable_item_free, hashtable_item_free);
+            }
+            else
+            {
+                MXS_FREE(window);
+                window = NULL;
+            }
+        }
+    }
+
+    return window;
+}
+
+/**
+ * Free a time window
+ *
+ * @param data The window to free
+ */
+static void window_free(void *data)
+{
+    CCR_WINDOW *window = (CCR_WINDOW*)data;
+
+    if (window)
+    {
+        hashtable_free(window->tables);
+        MXS_FREE(window);
+    }
+}
+
+/**
+ * Convert a table name to lower case
+ *
+ * Table names are compared case-insensitively. If the server compares them
+ * case-sensitively, this only causes more reads to be routed to the master.
+ *
+ * @param name The name to convert
+ */
+static void table_name_to_lower(char *name)
+{
+    for (char *ptr = name; *ptr; ptr++)
+    {
+        *ptr = tolower(*ptr);
+    }
+}
+
+/**
+ * Remove the tables whose time window has passed
+ *
+ * @param window The window, the caller must hold the lock of the window
+ * @param now    The current time
+ * @param time   Length of the time window in seconds
+ */
+static void window_prune(CCR_WINDOW *window, time_t now, int time)
+{
+    int size = hashtable_size(window->tables);
+    char **expired = size > 0 ? MXS_MALLOC(size * sizeof(char*)) : NULL;
+
+    if (expired)
+    {
+        HASHITERATOR *iter = hashtable_iterator(window->tables);
+        int n_expired = 0;
+
+        if (iter)
+        {
+            char *name;
+
+            while (n_expired < size && (name = hashtable_next(iter)))
+            {
+                time_t *modified = hashtable_fetch(window->tables, name);
+
+                if (modified && difftime(now, *modified) >= time)
+                {
+                    expired[n_expired++] = name;
+                }
+            }
+
+            hashtable_iterator_free(iter);
+        }
+
+        for (int i = 0; i < n_expired; i++)
+        {
+            hashtable_delete(window->tables, expired[i]);
+        }
+
+        MXS_FREE(expired);
+    }
+
+    window->last_prune = now;
+}
+
+/**
+ * Record a data modifying operation in a time window
+ *
+ * @param instance The filter instance
+ * @param window   The window of the session
+ * @param queue    The data modifying statement
+ * @param now      The current time
+ */
+static void window_record_write(CCR_INSTANCE *instance, CCR_WINDOW *window,
+                                GWBUF *queue, time_t now)
+{
+    int n_tables = 0;
+    char **tables = instance->table_scope ? qc_get_table_names(queue, &n_tables, false) : NULL;
+
+    spinlock_acquire(&window->lock);
+    window->last_modification = now;
+
+    if (instance->table_scope)
+    {
+        if (n_tables == 0)
+        {
+            /** The tables are not known, all reads must be routed to the master */
+            window->last_untabled = now;
+        }
+
+        for (int i = 0; i < n_tables; i++)
+        {
+            table_name_to_lower(tables[i]);
+            time_t *modified = hashtable_fetch(window->tables, tables[i]);
+
+            if (modified)
+            {
+                *modified = now;
+            }
+            else if ((modified = MXS_MALLOC(sizeof(time_t))))
+            {
+                *modified = now;
+
+                if (hashtable_add(window->tables, tables[i], modified))
+                {
+                    /** The hashtable owns the name now */
+                    tables[i] = NULL;
+                }
+                else
+                {
+                    MXS_FREE(modified);
+                    window->last_untabled = now;
+                }
+            }
+            else
+            {
+                window->last_untabled = now;
+            }
+        }
+
+        if (difftime(now, window->last_prune) >= instance->time)
+        {
+            window_prune(window, now, instance->time);
+        }
+    }
+
+    spinlock_release(&window->lock);
+
+    for (int i = 0; i < n_tables; i++)
+    {
+        MXS_FREE(tables[i]);
+    }
+    MXS_FREE(tables);
+}
+
+/**
+ * Check if a read must be routed to the master because of the time window
+ *
+ * When table_scope is enabled, only reads of tables that were modified during
+ * the window are routed to the master. Reads of no tables and all reads after
+ * a modification of unknown tables are routed to the master during the window.
+ *
+ * @param instance The filter instance
+ * @param window   The window of the session
+ * @param queue    The statement to route
+ * @param now      The current time
+ * @return True if the statement should be routed to the master
+ */
+static bool window_is_active(CCR_INSTANCE *instance, CCR_WINDOW *window,
+                             GWBUF *queue, time_t now)
+{
+    spinlock_acquire(&window->lock);
+    time_t last_modification = window->last_modification;
+    time_t last_untabled = window->last_untabled;
+    spinlock_release(&window->lock);
+
+    if (difftime(now, last_modification) >= instance->time)
+    {
+        /** Nothing has been modified during the window */
+        return false;
+    }
+
+    if (!instance->table_scope || difftime(now, last_untabled) < instance->time)
+    {
+        return true;
+    }
+
+    int n_tables = 0;
+    char **tables = qc_get_table_names(queue, &n_tables, false);
+    bool rval = n_tables == 0;
+
+    spinlock_acquire(&window->lock);
+
+    for (int i = 0; i < n_tables && !rval; i++)
+    {
+        table_name_to_lower(tables[i]);
+        time_t *modified = hashtable_fetch(window->tables, tables[i]);
+
+        if (modified && difftime(now, *modified) < instance->time)
+        {
+            rval = true;
+        }
+    }
+
+    spinlock_release(&window->lock);
+
+    for (int i = 0; i < n_tables; i++)
+    {
+        MXS_FREE(tables[i]);
+    }
+    MXS_FREE(tables);
+
+    return rval;
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -180,6 +473,22 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->stats.n_add_count = 0;
         my_instance->stats.n_add_time = 0;
         my_instance->stats.n_modified = 0;
+        my_instance->table_scope = config_get_bool(params, "table_scope");
+        my_instance->window_scope = config_get_enum(params, "window_scope", window_scope_values);
+        spinlock_init(&my_instance->lock);
+
+        if (my_instance->window_scope == CCR_WINDOW_USER)
+        {
+            if ((my_instance->user_windows = hashtable_alloc(CCR_USER_BUCKETS, hashtable_item_strhash,
+                                                             hashtable_item_strcmp)) == NULL)
+            {
+                MXS_FREE(my_instance);
+                return NULL;
+            }
+
+            hashtable_memory_fns(my_instance->user_windows, hashtable_item_strdup, NULL,
+                                 hashtable_item_free, window_free);
+        }
 
         int cflags = config_get_enum(params, "options", option_values);
 
@@ -214,12 +523,41 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 static MXS_FILTER_SESSION *
 newSession(MXS_FILTER *instance, MXS_SESSION *session)
 {
+    CCR_INSTANCE *my_instance = (CCR_INSTANCE *)instance;
     CCR_SESSION  *my_session = MXS_MALLOC(sizeof(CCR_SESSION));
 
     if (my_session)
     {
+        const char *user = session_get_user(session);
         my_session->hints_left = 0;
-        my_session->last_modification = 0;
+        my_session->window = NULL;
+        my_session->shared = false;
+
+        if (my_instance->window_scope == CCR_WINDOW_USER && user)
+        {
+            spinlock_acquire(&my_instance->lock);
+
+            if ((my_session->window = hashtable_fetch(my_instance->user_windows, (void*)user)) == NULL &&
+                (my_session->window = window_alloc(my_instance->table_scope)) &&
+                hashtable_add(my_instance->user_windows, (void*)user, my_session->window) == 0)
+            {
+                window_free(my_session->window);
+                my_session->window = NULL;
+            }
+
+            spinlock_release(&my_instance->lock);
+            my_session->shared = my_session->window != NULL;
+        }
+        else
+        {
+            my_session->window = window_alloc(my_instance->table_scope);
+        }
+
+        if (my_session->window == NULL)
+        {
+            MXS_FREE(my_session);
+            my_session = NULL;
+        }
     }
 
     return (MXS_FILTER_SESSION*)my_session;
@@ -246,7 +584,14 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 static void
 freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
-    MXS_FREE(session);
+    CCR_SESSION *my_session = (CCR_SESSION *)session;
+
+    if (!my_session->shared)
+    {
+        window_free(my_session->window);
+    }
+
+    MXS_FREE(my_session);
 }
 
 /**
@@ -283,40 +628,40 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
     CCR_INSTANCE *my_instance = (CCR_INSTANCE *)instance;
     CCR_SESSION  *my_session = (CCR_SESSION *)session;
-    char *sql;
+    const MXS_STMT_INFO *info;
     regmatch_t limits[] = {{0, 0}};
     time_t now = time(NULL);
 
-    if (modutil_is_SQL(queue))
+    if (modutil_is_SQL(queue) && (info = mxs_stmt_info_get(queue, MXS_STMT_INFO_TYPE)))
     {
         /**
          * Not a simple SELECT statement, possibly modifies data. If we're processing a statement
          * with unknown query type, the safest thing to do is to treat it as a data modifying statement.
          */
-        if (qc_query_is_type(qc_get_type_mask(queue), QUERY_TYPE_WRITE))
+        if (qc_query_is_type(info->type_mask, QUERY_TYPE_WRITE))
         {
-            if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
+            const char *sql = info->sql;
+            limits[0].rm_eo = info->sql_len;
+
+            if (my_instance->nomatch == NULL ||
+                (my_instance->nomatch && regexec(&my_instance->nore, sql, 0, limits, REG_STARTEND) != 0))
             {
-                if (my_instance->nomatch == NULL ||
-                    (my_instance->nomatch && regexec(&my_instance->nore, sql, 0, limits, REG_STARTEND) != 0))
+                if (my_instance->match == NULL ||
+                    (my_instance->match && regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0))
                 {
-                    if (my_instance->match == NULL ||
-                        (my_instance->match && regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0))
+                    if (my_instance->count)
+                    {
+                        my_session->hints_left = my_instance->count;
+                        MXS_INFO("Write operation detected, next %d queries routed to master", my_instance->count);
+                    }
+
+                    if (my_instance->time)
                     {
-                        if (my_instance->count)
-                        {
-                            my_session->hints_left = my_instance->count;
-                            MXS_INFO("Write operation detected, next %d queries routed to master", my_instance->count);
-                        }
-
-                        if (my_instance->time)
-                        {
-                            my_session->last_modification = now;
-                            MXS_INFO("Write operation detected, queries routed to master for %d seconds", my_instance->time);
-                        }
-
-                        my_instance->stats.n_modified++;
+                        window_record_write(my_instance, my_session->window, queue, now);
+                        MXS_INFO("Write operation detected, queries routed to master for %d seconds", my_instance->time);
                     }
+
+                    my_instance->stats.n_modified++;
                 }
             }
         }
@@ -327,16 +672,12 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
             my_instance->stats.n_add_count++;
             MXS_INFO("%d queries left", my_instance->time);
         }
-        else if (my_instance->time)
+        else if (my_instance->time &&
+                 window_is_active(my_instance, my_session->window, queue, now))
         {
-            double dt = difftime(now, my_session->last_modification);
-
-            if (dt < my_instance->time)
-            {
-                queue->hint = hint_create_route(queue->hint, HINT_ROUTE_TO_MASTER, NULL);
-                my_instance->stats.n_add_time++;
-                MXS_INFO("%.0f seconds left", dt);
-            }
+            queue->hint = hint_create_route(queue->hint, HINT_ROUTE_TO_MASTER, NULL);
+            my_instance->stats.n_add_time++;
+            MXS_INFO("Read routed to master during the time window");
         }
     }
 
@@ -363,6 +704,9 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
 
     dcb_printf(dcb, "Configuration:\n\tCount: %d\n", my_instance->count);
     dcb_printf(dcb, "\tTime: %d seconds\n", my_instance->time);
+    dcb_printf(dcb, "\tTable scope: %s\n", my_instance->table_scope ? "true" : "false");
+    dcb_printf(dcb, "\tWindow scope: %s\n",
+               my_instance->window_scope == CCR_WINDOW_USER ? "user" : "session");
 
     if (my_instance->match)
     {
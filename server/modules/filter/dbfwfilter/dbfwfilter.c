@@ -63,6 +63,7 @@
 #define MXS_MODULE_NAME "dbfwfilter"
 #include <maxscale/cdefs.h>
 
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -71,6 +72,8 @@
 #include <stdlib.h>
 
 #include <maxscale/filter.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/lfhash.h>
 #include <maxscale/atomic.h>
 #include <maxscale/modulecmd.h>
 #include <maxscale/modutil.h>
@@ -129,6 +132,15 @@ enum fw_actions
     FW_ACTION_IGNORE
 };
 
+/**
+ * Whose queries the limit_queries rules count
+ */
+enum fw_limit_scope
+{
+    FW_LIMIT_SESSION,
+    FW_LIMIT_USER
+};
+
 /**
  * Logging options for matched queries
  */
@@ -186,6 +198,23 @@ typedef struct queryspeed_t
     bool                 active; /*< If the rule has been triggered */
 } QUERYSPEED;
 
+/**
+ * Query counts of a limit_queries rule that are shared by all sessions of a user
+ *
+ * The queries are counted in windows of the length of the rule's time period.
+ * The number of queries during the last period is estimated from the counts of
+ * the current and the previous window, weighting the previous one by how much
+ * of it is still inside the last period.
+ */
+typedef struct querylimit_t
+{
+    SPINLOCK lock;          /*< Protects the counts */
+    long     window_start;  /*< Start of the current window in heartbeats */
+    int      count;         /*< Queries in the current window */
+    int      prev_count;    /*< Queries in the previous window */
+    long     blocked_until; /*< Heartbeat when the queries are allowed again */
+} QUERYLIMIT;
+
 /**
  * A structure used to identify individual rules and to store their contents
  *
@@ -200,6 +229,7 @@ typedef struct rule_t
     qc_query_op_t  on_queries;  /*< Types of queries to inspect */
     int            times_matched; /*< Number of times this rule has been matched */
     TIMERANGE*     active;      /*< List of times when this rule is active */
+    HASHTABLE*     names;       /*< Set of the column or function names of the rule */
     struct rule_t *next;
 } RULE;
 
@@ -212,9 +242,9 @@ typedef struct rulebook_t
     struct rulebook_t* next;    /*< The next rule in the book */
 } RULE_BOOK;
 
-thread_local int        thr_rule_version = 0;
-thread_local RULE      *thr_rules = NULL;
-thread_local HASHTABLE *thr_users = NULL;
+static int next_thread_id = 0;
+thread_local int thr_id = -1;
+thread_local pcre2_match_data *thr_mdata = NULL;
 
 /**
  * A temporary template structure used in the creation of actual users.
@@ -243,6 +273,23 @@ typedef struct user_t
                                    * fails. This is only for rules paired with 'match strict_all'. */
 } DBFW_USER;
 
+/**
+ * The rules of one worker thread
+ *
+ * Each thread has its own copy of the rules and users so that nothing that is
+ * used when queries are matched is shared between the threads. When the rules
+ * are reloaded, a new copy is published for each thread and the thread takes
+ * it into use when it notices that the version of the rules has changed.
+ */
+typedef struct
+{
+    RULE      *rules;         /*< Rules used by the thread */
+    HASHTABLE *users;         /*< Users used by the thread */
+    int        version;       /*< Version of the rules used by the thread */
+    RULE      *new_rules;     /*< Published rules, protected by the instance lock */
+    HASHTABLE *new_users;     /*< Published users, protected by the instance lock */
+} DBFW_THREAD_RULES;
+
 /**
  * The Firewall filter instance.
  */
@@ -254,6 +301,10 @@ typedef struct
     int             idgen;      /*< UID generator */
     char           *rulefile;   /*< Path to the rule file */
     int             rule_version; /*< Latest rule file version, incremented on reload */
+    int             n_threads;  /*< Number of worker threads */
+    DBFW_THREAD_RULES *thread_rules; /*< The rules of each worker thread */
+    enum fw_limit_scope limit_scope; /*< Whose queries limit_queries counts */
+    LFHASH         *query_limits; /*< Shared QUERYLIMITs by rule and user name */
 } FW_INSTANCE;
 
 /**
@@ -272,7 +323,8 @@ bool parse_at_times(const char** tok, char** saveptr, RULE* ruledef);
 bool parse_limit_queries(FW_INSTANCE* instance, RULE* ruledef, const char* rule, char** saveptr);
 static void rule_free_all(RULE* rule);
 static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **users);
-bool replace_rules(FW_INSTANCE* instance);
+static bool publish_rules(FW_INSTANCE* instance, const char* filename);
+static DBFW_THREAD_RULES* get_thread_rules(FW_INSTANCE* instance);
 
 static void print_rule(RULE *rules, char *dest)
 {
@@ -387,26 +439,6 @@ static RULE_BOOK* rulebook_push(RULE_BOOK *head, RULE *rule)
     return rval;
 }
 
-static void* rulebook_clone(void* fval)
-{
-
-    RULE_BOOK *rule = NULL,
-               *ptr = (RULE_BOOK*) fval;
-
-
-    while (ptr)
-    {
-        RULE_BOOK* tmp = (RULE_BOOK*) MXS_MALLOC(sizeof(RULE_BOOK));
-        MXS_ABORT_IF_NULL(tmp);
-        tmp->next = rule;
-        tmp->rule = ptr->rule;
-        rule = tmp;
-        ptr = ptr->next;
-    }
-
-    return (void*) rule;
-}
-
 static void* rulebook_free(void* fval)
 {
     RULE_BOOK *ptr = (RULE_BOOK*) fval;
@@ -715,14 +747,10 @@ bool dbfw_reload_rules(const MODULECMD_ARG *argv)
     strcpy(filename, inst->rulefile);
     spinlock_release(&inst->lock);
 
-    RULE *rules = NULL;
-    HASHTABLE *users = NULL;
-
     if (rval && access(filename, R_OK) == 0)
     {
-        if (process_rule_file(filename, &rules, &users))
+        if (publish_rules(inst, filename))
         {
-            atomic_add(&inst->rule_version, 1);
             MXS_NOTICE("Reloaded rules from: %s", filename);
         }
         else
@@ -740,9 +768,6 @@ bool dbfw_reload_rules(const MODULECMD_ARG *argv)
         rval = false;
     }
 
-    rule_free_all(rules);
-    hashtable_free(users);
-
     return rval;
 }
 
@@ -754,15 +779,14 @@ bool dbfw_show_rules(const MODULECMD_ARG *argv)
 
     dcb_printf(dcb, "Rule, Type, Times Matched\n");
 
-    if (!thr_rules || !thr_users)
+    DBFW_THREAD_RULES *thread_rules = get_thread_rules(inst);
+
+    if (thread_rules == NULL)
     {
-        if (!replace_rules(inst))
-        {
-            return 0;
-        }
+        return false;
     }
 
-    for (RULE *rule = thr_rules; rule; rule = rule->next)
+    for (RULE *rule = thread_rules->rules; rule; rule = rule->next)
     {
         char buf[strlen(rule->name) + 200]; // Some extra space
         print_rule(rule, buf);
@@ -780,6 +804,13 @@ static const MXS_ENUM_VALUE action_values[] =
     {NULL}
 };
 
+static const MXS_ENUM_VALUE limit_scope_values[] =
+{
+    {"session", FW_LIMIT_SESSION},
+    {"user",    FW_LIMIT_USER},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -857,6 +888,13 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_ENUM_UNIQUE,
                 action_values
             },
+            {
+                "limit_queries_scope",
+                MXS_MODULE_PARAM_ENUM,
+                "session",
+                MXS_MODULE_OPT_ENUM_UNIQUE,
+                limit_scope_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -1013,6 +1051,7 @@ bool create_rule(void* scanner, const char* name)
             ruledef->active = NULL;
             ruledef->times_matched = 0;
             ruledef->data = NULL;
+            ruledef->names = NULL;
             rstack->rule = ruledef;
             rval = true;
         }
@@ -1047,6 +1086,7 @@ static void rule_free_all(RULE* rule)
         {
         case RT_COLUMN:
         case RT_FUNCTION:
+            hashtable_free(rule->names);
             strlink_free((STRLINK*) rule->data);
             break;
 
@@ -1323,6 +1363,9 @@ bool define_regex_rule(void* scanner, char* pattern)
     if ((re = pcre2_compile(start, PCRE2_ZERO_TERMINATED,
                             0, &err, &offset, NULL)))
     {
+        /** If JIT is not available, the pattern is interpreted */
+        pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
+
         struct parser_stack* rstack = dbfw_yyget_extra((yyscan_t) scanner);
         ss_dassert(rstack);
         rstack->rule->type = RT_REGEX;
@@ -1430,6 +1473,66 @@ static bool process_user_templates(HASHTABLE *users, user_template_t *templates,
     return rval;
 }
 
+/**
+ * Case-insensitive hash of a column or function name
+ *
+ * @param key Name to hash
+ * @return Hash of the name
+ */
+static int name_hash(const void *key)
+{
+    const char *ptr = (const char*)key;
+    int hash = 0;
+    int c;
+
+    while ((c = *ptr++))
+    {
+        hash = tolower(c) + (hash << 6) + (hash << 16) - hash;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Prepare the rules for matching
+ *
+ * The names of the column and function rules are stored in a case-insensitive
+ * hashtable so that each field of a query is matched against all names of a
+ * rule with one lookup. The values of the hashtable point to the names in the
+ * list of the rule.
+ *
+ * @param rules List of all rules
+ * @return True on success, false if memory allocation failed
+ */
+static bool compile_rules(RULE *rules)
+{
+    for (RULE *rule = rules; rule; rule = rule->next)
+    {
+        if (rule->type == RT_COLUMN || rule->type == RT_FUNCTION)
+        {
+            int size = 0;
+
+            for (STRLINK *s = rule->data; s; s = s->next)
+            {
+                size++;
+            }
+
+            if ((rule->names = hashtable_alloc(size * 2 + 1, name_hash,
+                                               hashtable_item_strcasecmp)) == NULL)
+            {
+                return false;
+            }
+
+            for (STRLINK *s = rule->data; s; s = s->next)
+            {
+                hashtable_add(rule->names, s->value, s->value);
+            }
+        }
+    }
+
+    return true;
+}
+
 /**
  * Read a rule file from disk and process it into rule and user definitions
  * @param filename Name of the file
@@ -1464,7 +1567,8 @@ static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **us
         fclose(file);
         HASHTABLE *new_users = dbfw_userlist_create();
 
-        if (rc == 0 && new_users && process_user_templates(new_users, pstack.templates, pstack.rule))
+        if (rc == 0 && new_users && compile_rules(pstack.rule) &&
+            process_user_templates(new_users, pstack.templates, pstack.rule))
         {
             *rules = pstack.rule;
             *users = new_users;
@@ -1493,47 +1597,110 @@ static bool process_rule_file(const char* filename, RULE** rules, HASHTABLE **us
 }
 
 /**
- * @brief Replace the rule file used by this thread
+ * @brief Publish new rules for all worker threads
  *
- * This function replaces or initializes the thread local list of rules and users.
+ * The rule file is processed once for each thread here so that the threads
+ * only need to swap the rules they use when they notice the new version. The
+ * old rules are used if the file cannot be processed.
  *
  * @param instance Filter instance
- * @return True if the session can continue, false on fatal error.
+ * @param filename The rule file
+ * @return True if the rules were published
  */
-bool replace_rules(FW_INSTANCE* instance)
+static bool publish_rules(FW_INSTANCE* instance, const char* filename)
 {
-    bool rval = true;
-    spinlock_acquire(&instance->lock);
+    RULE *rules[instance->n_threads];
+    HASHTABLE *users[instance->n_threads];
+    int n = 0;
 
-    size_t len = strlen(instance->rulefile);
-    char filename[len + 1];
-    strcpy(filename, instance->rulefile);
+    while (n < instance->n_threads && process_rule_file(filename, &rules[n], &users[n]))
+    {
+        n++;
+    }
 
-    spinlock_release(&instance->lock);
+    bool rval = n == instance->n_threads;
 
-    RULE *rules;
-    HASHTABLE *users;
+    if (rval)
+    {
+        spinlock_acquire(&instance->lock);
 
-    if (process_rule_file(filename, &rules, &users))
+        for (int i = 0; i < n; i++)
+        {
+            DBFW_THREAD_RULES *thread_rules = &instance->thread_rules[i];
+            RULE *old_rules = thread_rules->new_rules;
+            HASHTABLE *old_users = thread_rules->new_users;
+
+            /** Swap the rules so that the ones the thread never took are freed */
+            thread_rules->new_rules = rules[i];
+            thread_rules->new_users = users[i];
+            rules[i] = old_rules;
+            users[i] = old_users;
+        }
+
+        atomic_add(&instance->rule_version, 1);
+        spinlock_release(&instance->lock);
+    }
+
+    for (int i = 0; i < n; i++)
     {
-        rule_free_all(thr_rules);
-        hashtable_free(thr_users);
-        thr_rules = rules;
-        thr_users = users;
-        rval = true;
+        rule_free_all(rules[i]);
+        hashtable_free(users[i]);
     }
-    else if (thr_rules && thr_users)
+
+    return rval;
+}
+
+/**
+ * @brief Get the rules of the current thread
+ *
+ * If new rules have been published since the last call, the thread takes them
+ * into use and frees the old ones. Otherwise this only compares the versions.
+ *
+ * @param instance Filter instance
+ * @return The rules of the thread or NULL if the thread has no rules
+ */
+static DBFW_THREAD_RULES* get_thread_rules(FW_INSTANCE* instance)
+{
+    if (thr_id == -1)
     {
-        MXS_ERROR("Failed to parse rules at '%s'. Old rules are still used.", filename);
+        thr_id = atomic_add(&next_thread_id, 1);
     }
-    else
+
+    if (thr_id >= instance->n_threads)
     {
-        MXS_ERROR("Failed to parse rules at '%s'. No previous rules available, "
-                  "closing session.", filename);
-        rval = false;
+        ss_dassert(!true);
+        MXS_ERROR("Thread %d has no firewall rules, only %d threads are configured.",
+                  thr_id, instance->n_threads);
+        return NULL;
     }
 
-    return rval;
+    DBFW_THREAD_RULES *thread_rules = &instance->thread_rules[thr_id];
+
+    if (thread_rules->version != atomic_load_int32(&instance->rule_version))
+    {
+        RULE *rules = NULL;
+        HASHTABLE *users = NULL;
+
+        spinlock_acquire(&instance->lock);
+
+        if (thread_rules->new_rules)
+        {
+            rules = thread_rules->rules;
+            users = thread_rules->users;
+            thread_rules->rules = thread_rules->new_rules;
+            thread_rules->users = thread_rules->new_users;
+            thread_rules->new_rules = NULL;
+            thread_rules->new_users = NULL;
+        }
+
+        thread_rules->version = instance->rule_version;
+        spinlock_release(&instance->lock);
+
+        rule_free_all(rules);
+        hashtable_free(users);
+    }
+
+    return thread_rules;
 }
 
 /**
@@ -1559,6 +1726,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
     spinlock_init(&my_instance->lock);
     my_instance->action = config_get_enum(params, "action", action_values);
+    my_instance->limit_scope = config_get_enum(params, "limit_queries_scope", limit_scope_values);
     my_instance->log_match = FW_LOG_NONE;
 
     if (config_get_bool(params, "log_match"))
@@ -1571,23 +1739,27 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->log_match |= FW_LOG_NO_MATCH;
     }
 
-    RULE *rules = NULL;
-    HASHTABLE *users = NULL;
     my_instance->rulefile = MXS_STRDUP(config_get_string(params, "rules"));
+    my_instance->n_threads = config_threadcount();
+    my_instance->thread_rules = MXS_CALLOC(my_instance->n_threads, sizeof(DBFW_THREAD_RULES));
 
-    if (!my_instance->rulefile || !process_rule_file(my_instance->rulefile, &rules, &users))
+    if ((my_instance->query_limits = lfhash_alloc(100, hashtable_item_strhash,
+                                                  hashtable_item_strcmp)))
     {
-        MXS_FREE(my_instance);
-        my_instance = NULL;
+        lfhash_memory_fns(my_instance->query_limits, hashtable_item_strdup, NULL,
+                          hashtable_item_free, hashtable_item_free);
     }
-    else
+
+    if (!my_instance->rulefile || !my_instance->thread_rules || !my_instance->query_limits ||
+        !publish_rules(my_instance, my_instance->rulefile))
     {
-        atomic_add(&my_instance->rule_version, 1);
+        lfhash_free(my_instance->query_limits);
+        MXS_FREE(my_instance->thread_rules);
+        MXS_FREE(my_instance->rulefile);
+        MXS_FREE(my_instance);
+        my_instance = NULL;
     }
 
-    rule_free_all(rules);
-    hashtable_free(users);
-
     return (MXS_FILTER *) my_instance;
 }
 
@@ -1886,23 +2058,148 @@ bool match_throttle(FW_SESSION* my_session, RULE_BOOK *rulebook, char **msg)
     return matches;
 }
 
-void match_regex(RULE_BOOK *rulebook, const char *query, bool *matches, char **msg)
+/**
+ * @brief Get the shared query counts of a user for a limit_queries rule
+ *
+ * The counts are created when the user first executes a query the rule
+ * inspects. They are identified by the names of the rule and the user so
+ * that they survive the reloading of the rules.
+ *
+ * @param my_instance Fwfilter instance
+ * @param rule The limit_queries rule
+ * @param user The name of the client user
+ * @return The counts or NULL if memory allocation failed
+ */
+static QUERYLIMIT* get_query_limit(FW_INSTANCE *my_instance, RULE *rule, const char *user)
+{
+    /** Rule names can't contain spaces so the key is unique */
+    char key[strlen(rule->name) + strlen(user) + 2];
+    sprintf(key, "%s %s", rule->name, user);
+
+    QUERYLIMIT *limit = lfhash_fetch(my_instance->query_limits, key);
+
+    if (limit == NULL && (limit = MXS_CALLOC(1, sizeof(QUERYLIMIT))))
+    {
+        spinlock_init(&limit->lock);
+
+        if (!lfhash_add(my_instance->query_limits, key, limit))
+        {
+            /** Another session of the user added it first */
+            MXS_FREE(limit);
+            limit = lfhash_fetch(my_instance->query_limits, key);
+        }
+    }
+
+    return limit;
+}
+
+/**
+ * @brief Match a limit_queries rule against all sessions of the user
+ *
+ * The user's queries are counted over a sliding window of the rule's time
+ * period. When the limit is exceeded the queries of all sessions of the user
+ * are denied for the holdoff time of the rule.
+ *
+ * @param my_instance Fwfilter instance
+ * @param my_session Fwfilter session
+ * @param rulebook The rule to check
+ * @param msg Error message is stored here if the query is denied
+ * @return True if the query is denied
+ */
+static bool match_shared_throttle(FW_INSTANCE *my_instance, FW_SESSION *my_session,
+                                  RULE_BOOK *rulebook, char **msg)
 {
+    QUERYSPEED *rule_qs = (QUERYSPEED*)rulebook->rule->data;
+    const char *user = my_session->session->client_dcb->user;
+    QUERYLIMIT *limit = get_query_limit(my_instance, rulebook->rule, user ? user : "");
+
+    if (limit == NULL)
+    {
+        return false;
+    }
+
+    bool matches = false;
+    bool triggered = false;
+    long blocked_for = 0;
+    long period = MXS_MAX(rule_qs->period * 10, 1);
+    long now = hkheartbeat;
 
-    pcre2_match_data *mdata = pcre2_match_data_create_from_pattern(rulebook->rule->data, NULL);
+    spinlock_acquire(&limit->lock);
 
-    if (mdata)
+    if (now < limit->blocked_until)
+    {
+        blocked_for = limit->blocked_until - now;
+        matches = true;
+    }
+    else
+    {
+        long elapsed = now - limit->window_start;
+
+        if (elapsed >= period)
+        {
+            limit->prev_count = elapsed < 2 * period ? limit->count : 0;
+            limit->window_start = now - elapsed % period;
+            limit->count = 0;
+            elapsed %= period;
+        }
+
+        int estimate = limit->count + limit->prev_count * (period - elapsed) / period;
+
+        if (estimate >= rule_qs->limit)
+        {
+            blocked_for = rule_qs->cooldown * 10;
+            limit->blocked_until = now + blocked_for;
+            limit->window_start = limit->blocked_until;
+            limit->count = 0;
+            limit->prev_count = 0;
+            matches = true;
+            triggered = true;
+        }
+        else
+        {
+            limit->count++;
+        }
+    }
+
+    spinlock_release(&limit->lock);
+
+    if (triggered)
+    {
+        MXS_INFO("rule '%s': query limit triggered (%d queries in %d seconds), "
+                 "denying queries from user '%s' for %d seconds.", rulebook->rule->name,
+                 rule_qs->limit, rule_qs->period, user, rule_qs->cooldown);
+    }
+    else if (matches)
+    {
+        MXS_INFO("rule '%s': user '%s' denied for %.1f seconds",
+                 rulebook->rule->name, user, blocked_for / 10.0);
+    }
+
+    if (matches)
+    {
+        char emsg[512];
+        sprintf(emsg, "Queries denied for %f seconds", blocked_for / 10.0);
+        *msg = MXS_STRDUP_A(emsg);
+    }
+
+    return matches;
+}
+
+void match_regex(RULE_BOOK *rulebook, const char *query, bool *matches, char **msg)
+{
+    /** Only the fact that the pattern matched is needed, so one match data
+     * with room for the whole match is shared by all rules of the thread.
+     * A return value of zero means that the captured substrings didn't fit. */
+    if (thr_mdata || (thr_mdata = pcre2_match_data_create(1, NULL)))
     {
         if (pcre2_match((pcre2_code*)rulebook->rule->data,
                         (PCRE2_SPTR)query, PCRE2_ZERO_TERMINATED,
-                        0, 0, mdata, NULL) > 0)
+                        0, 0, thr_mdata, NULL) >= 0)
         {
             MXS_NOTICE("rule '%s': regex matched on query", rulebook->rule->name);
             *matches = true;
             *msg = MXS_STRDUP_A("Permission denied, query matched regular expression.");
         }
-
-        pcre2_match_data_free(mdata);
     }
     else
     {
@@ -1919,22 +2216,17 @@ void match_column(RULE_BOOK *rulebook, GWBUF *queue, bool *matches, char **msg)
 
     for (size_t i = 0; i < n_infos; ++i)
     {
-        const char* tok = infos[i].column;
+        const char* value = hashtable_fetch(rulebook->rule->names, (void*)infos[i].column);
 
-        STRLINK* strln = (STRLINK*)rulebook->rule->data;
-        while (strln)
+        if (value)
         {
-            if (strcasecmp(tok, strln->value) == 0)
-            {
-                char emsg[strlen(strln->value) + 100];
-                sprintf(emsg, "Permission denied to column '%s'.", strln->value);
-                MXS_NOTICE("rule '%s': query targets forbidden column: %s",
-                           rulebook->rule->name, strln->value);
-                *msg = MXS_STRDUP_A(emsg);
-                *matches = true;
-                break;
-            }
-            strln = strln->next;
+            char emsg[strlen(value) + 100];
+            sprintf(emsg, "Permission denied to column '%s'.", value);
+            MXS_NOTICE("rule '%s': query targets forbidden column: %s",
+                       rulebook->rule->name, value);
+            MXS_FREE(*msg);
+            *msg = MXS_STRDUP_A(emsg);
+            *matches = true;
         }
     }
 }
@@ -1947,22 +2239,17 @@ void match_function(RULE_BOOK *rulebook, GWBUF *queue, bool *matches, char **msg
 
     for (size_t i = 0; i < n_infos; ++i)
     {
-        const char* tok = infos[i].name;
+        const char* value = hashtable_fetch(rulebook->rule->names, (void*)infos[i].name);
 
-        STRLINK* strln = (STRLINK*)rulebook->rule->data;
-        while (strln)
+        if (value)
         {
-            if (strcasecmp(tok, strln->value) == 0)
-            {
-                char emsg[strlen(strln->value) + 100];
-                sprintf(emsg, "Permission denied to function '%s'.", strln->value);
-                MXS_NOTICE("rule '%s': query uses forbidden function: %s",
-                           rulebook->rule->name, strln->value);
-                *msg = MXS_STRDUP_A(emsg);
-                *matches = true;
-                break;
-            }
-            strln = strln->next;
+            char emsg[strlen(value) + 100];
+            sprintf(emsg, "Permission denied to function '%s'.", value);
+            MXS_NOTICE("rule '%s': query uses forbidden function: %s",
+                       rulebook->rule->name, value);
+            MXS_FREE(*msg);
+            *msg = MXS_STRDUP_A(emsg);
+            *matches = true;
         }
     }
 }
@@ -2007,7 +2294,7 @@ bool rule_matches(FW_INSTANCE* my_instance,
 
     if (is_sql)
     {
-        qc_parse_result_t parse_result = qc_parse(queue, QC_COLLECT_ALL);
+        qc_parse_result_t parse_result = qc_parse(queue, QC_COLLECT_ESSENTIALS);
 
         if (parse_result == QC_QUERY_INVALID)
         {
@@ -2088,7 +2375,14 @@ bool rule_matches(FW_INSTANCE* my_instance,
             break;
 
         case RT_THROTTLE:
-            matches = match_throttle(my_session, rulebook, &msg);
+            if (my_instance->limit_scope == FW_LIMIT_USER)
+            {
+                matches = match_shared_throttle(my_instance, my_session, rulebook, &msg);
+            }
+            else
+            {
+                matches = match_throttle(my_session, rulebook, &msg);
+            }
             break;
 
         case RT_CLAUSE:
@@ -2340,25 +2634,22 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     DCB *dcb = my_session->session->client_dcb;
     int rval = 0;
     ss_dassert(dcb && dcb->session);
-    int rule_version = my_instance->rule_version;
+    DBFW_THREAD_RULES *thread_rules = get_thread_rules(my_instance);
 
-    if (thr_rule_version < rule_version)
+    if (thread_rules == NULL)
     {
-        if (!replace_rules(my_instance))
-        {
-            return 0;
-        }
-        thr_rule_version = rule_version;
+        return 0;
     }
 
     uint32_t type = 0;
+    size_t n_statements = 0;
 
     if (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue))
     {
-        type = qc_get_type_mask(queue);
+        type = qc_parse_batch(queue, NULL, &n_statements);
     }
 
-    if (modutil_is_SQL(queue) && modutil_count_statements(queue) > 1)
+    if (n_statements > 1)
     {
         GWBUF* err = gen_dummy_error(my_session, "This filter does not support "
                                      "multi-statements.");
@@ -2383,7 +2674,7 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
             ss_dassert(analyzed_queue);
         }
 
-        DBFW_USER *user = find_user_data(thr_users, dcb->user, dcb->remote);
+        DBFW_USER *user = find_user_data(thread_rules->users, dcb->user, dcb->remote);
         bool query_ok = command_is_mandatory(queue);
 
         if (user)
@@ -2489,10 +2780,12 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
 {
     FW_INSTANCE *my_instance = (FW_INSTANCE *) instance;
 
+    DBFW_THREAD_RULES *thread_rules = get_thread_rules(my_instance);
+
     dcb_printf(dcb, "Firewall Filter\n");
     dcb_printf(dcb, "Rule, Type, Times Matched\n");
 
-    for (RULE *rule = thr_rules; rule; rule = rule->next)
+    for (RULE *rule = thread_rules ? thread_rules->rules : NULL; rule; rule = rule->next)
     {
         char buf[strlen(rule->name) + 200];
         print_rule(rule, buf);
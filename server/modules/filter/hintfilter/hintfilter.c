@@ -120,6 +120,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         my_session->query_len = 0;
         my_session->request = NULL;
         my_session->stack = NULL;
+        my_session->free_stack = NULL;
         my_session->named_hints = NULL;
     }
 
@@ -154,6 +155,11 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
     /** Free stacked hints */
     hint_stack = my_session->stack;
 
+    while ((hint_stack = free_hint_stack(hint_stack)) != NULL)
+        ;
+    /** Free the unused stack entries */
+    hint_stack = my_session->free_stack;
+
     while ((hint_stack = free_hint_stack(hint_stack)) != NULL)
         ;
 }
@@ -69,28 +69,18 @@ HINT_TOKEN kwords[] = {
 };
  */
 
-static HINT_TOKEN *hint_next_token(GWBUF **buf, char **ptr);
+static HINT_TOKEN *hint_next_token(GWBUF **buf, char **ptr, HINT_TOKEN *tok);
 static void hint_pop(HINT_SESSION *);
 static HINT *lookup_named_hint(HINT_SESSION *, char *);
-static void create_named_hint(HINT_SESSION *, char *, HINT *);
-static void hint_push(HINT_SESSION *, HINT *);
+static HINT *create_named_hint(HINT_SESSION *, char *, HINT *);
+static void hint_push(HINT_SESSION *, HINT *, bool);
 static const char* token_get_keyword(HINT_TOKEN* token);
-static void token_free(HINT_TOKEN* token);
 
 typedef enum
 {
     HM_EXECUTE, HM_START, HM_PREPARE
 } HINT_MODE;
 
-void token_free(HINT_TOKEN* token)
-{
-    if (token->value != NULL)
-    {
-        MXS_FREE(token->value);
-    }
-    MXS_FREE(token);
-}
-
 static const char* token_get_keyword(
     HINT_TOKEN* token)
 {
@@ -131,6 +121,86 @@ static const char* token_get_keyword(
     }
 }
 
+/** The tag that all hints start with */
+#define HINT_TAG     "maxscale"
+#define HINT_TAG_LEN 8
+
+/**
+ * Check if the text after a comment start is the hint tag
+ *
+ * @param ptr Start of the comment text
+ * @param end End of the SQL
+ * @return True if the comment starts with the hint tag
+ */
+static bool
+is_hint_comment(const char *ptr, const char *end)
+{
+    while (ptr < end && isspace(*ptr))
+    {
+        ptr++;
+    }
+
+    return end - ptr >= HINT_TAG_LEN && strncasecmp(ptr, HINT_TAG, HINT_TAG_LEN) == 0;
+}
+
+/**
+ * Search for a comment that starts with the hint tag
+ *
+ * @param ptr   Start of the SQL
+ * @param end   End of the SQL
+ * @param first The first character of the comment start
+ * @param second The second character of the comment start or '\0' if the
+ *               comment start is only one character
+ * @return True if a comment with the hint tag was found
+ */
+static bool
+find_hint_comment(const char *ptr, const char *end, char first, char second)
+{
+    while (ptr < end && (ptr = memchr(ptr, first, end - ptr)) != NULL)
+    {
+        ptr++;
+
+        if (second == '\0' || (ptr < end && *ptr++ == second))
+        {
+            if (is_hint_comment(ptr, end))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Check if the statement can contain hints
+ *
+ * This is a quick scan done with memchr before the statement is tokenized.
+ * Almost all statements have no comments that start with the hint tag and
+ * for them the parsing is skipped. Statements that do not fit in one buffer
+ * are always parsed.
+ *
+ * @param request The MySQL request buffer
+ * @return True if the statement needs to be parsed for hints
+ */
+static bool
+hint_prescan(GWBUF *request)
+{
+    char *sql;
+    int len, residual;
+
+    if (request->next || !modutil_MySQL_Query(request, &sql, &len, &residual))
+    {
+        return true;
+    }
+
+    const char *end = sql + len;
+
+    return find_hint_comment(sql, end, '/', '*') ||
+           find_hint_comment(sql, end, '-', '-') ||
+           find_hint_comment(sql, end, '#', '\0');
+}
+
 /**
  * Parse the hint comments in the MySQL statement passed in request.
  * Add any hints to the buffer for later processing.
@@ -149,9 +219,15 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
     HINT *rval = NULL;
     char *pname, *lvalue, *hintname = NULL;
     GWBUF *buf;
-    HINT_TOKEN *tok;
+    HINT_TOKEN token, *tok;
     HINT_MODE mode = HM_EXECUTE;
     bool multiline_comment = false;
+
+    if (!hint_prescan(request))
+    {
+        goto retblock;
+    }
+
     /* First look for any comment in the SQL */
     modutil_MySQL_Query(request, &ptr, &len, &residual);
     buf = request;
@@ -261,7 +337,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
         }
     }
 
-    tok = hint_next_token(&buf, &ptr);
+    tok = hint_next_token(&buf, &ptr, &token);
 
     if (tok == NULL)
     {
@@ -271,14 +347,12 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
     /** This is not MaxScale hint because it doesn't start with 'maxscale' */
     if (tok->token != TOK_MAXSCALE)
     {
-        token_free(tok);
         goto retblock;
     }
-    token_free(tok);
 
     state = HS_INIT;
 
-    while (((tok = hint_next_token(&buf, &ptr)) != NULL) &&
+    while (((tok = hint_next_token(&buf, &ptr, &token)) != NULL) &&
            (tok->token != TOK_END))
     {
         if (tok->token == TOK_LINEBRK)
@@ -286,7 +360,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
             if (multiline_comment)
             {
                 // Skip token
-                token_free(tok);
                 continue;
             }
             else
@@ -324,7 +397,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'route', 'stop' or hint name instead of "
                           "'%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -335,7 +407,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                 MXS_ERROR("Syntax error in hint. Expected "
                           "'to' instead of '%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             state = HS_ROUTE1;
@@ -361,7 +432,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "of '%s'. Hint ignored.",
                           token_get_keyword(tok));
 
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -378,7 +448,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "server name instead of '%s'. Hint "
                           "ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -406,7 +475,6 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'=', 'prepare', or 'start' instead of "
                           "'%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
@@ -427,7 +495,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                 break;
             case TOK_STRING:
                 state = HS_NAME;
-                lvalue = tok->value;
+                lvalue = MXS_STRDUP_A(tok->value);
                 break;
             default:
                 /* Error, token tok->value not expected */
@@ -435,19 +503,12 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                           "'route' or hint name instead of "
                           "'%s'. Hint ignored.",
                           token_get_keyword(tok));
-                token_free(tok);
                 goto retblock;
             }
             break;
         }
-        token_free(tok);
     } /*< while */
 
-    if (tok && tok->token == TOK_END)
-    {
-        token_free(tok);
-    }
-
     switch (mode)
     {
     case HM_START:
@@ -459,7 +520,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
         if (hintname == NULL && rval != NULL)
         {
             /* We are starting an anonymous block of hints */
-            hint_push(session, rval);
+            hint_push(session, rval, false);
             rval = NULL;
         }
         else if (hintname && rval)
@@ -471,15 +532,19 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
             }
             else
             {
-                create_named_hint(session, hintname, rval);
-                hint_push(session, hint_dup(rval));
+                HINT *hints = create_named_hint(session, hintname, rval);
+
+                if (hints)
+                {
+                    hint_push(session, hints, true);
+                }
             }
         }
         else if (hintname && rval == NULL)
         {
             /* We starting an already define set of named hints */
             rval = lookup_named_hint(session, hintname);
-            hint_push(session, hint_dup(rval));
+            hint_push(session, rval, true);
             MXS_FREE(hintname);
             rval = NULL;
         }
@@ -534,23 +599,19 @@ retblock:
  * @param buf   A pointer to the buffer point, will be updated if a
  *      new buffer is used.
  * @param ptr   The pointer within the buffer we are processing
- * @return A HINT token
+ * @param tok   The token is stored here, the value of a string token is
+ *      only valid until the next token is read
+ * @return The HINT token
  */
 static HINT_TOKEN *
-hint_next_token(GWBUF **buf, char **ptr)
+hint_next_token(GWBUF **buf, char **ptr, HINT_TOKEN *tok)
 {
-    char word[100], *dest;
+    char *word = tok->value, *dest;
     int inword = 0;
     int endtag = 0;
     char inquote = '\0';
     int i, found;
-    HINT_TOKEN *tok;
 
-    if ((tok = (HINT_TOKEN *)MXS_MALLOC(sizeof(HINT_TOKEN))) == NULL)
-    {
-        return NULL;
-    }
-    tok->value = NULL;
     dest = word;
     while (*ptr < (char *)((*buf)->end) || (*buf)->next)
     {
@@ -603,7 +664,7 @@ hint_next_token(GWBUF **buf, char **ptr)
             *ptr = (*buf)->start;
         }
 
-        if (dest - word > 98)
+        if (dest - word > HINT_TOKEN_LEN - 2)
         {
             break;
         }
@@ -636,7 +697,6 @@ hint_next_token(GWBUF **buf, char **ptr)
     if (found == 0)
     {
         tok->token = TOK_STRING;
-        tok->value = MXS_STRDUP_A(word);
     }
 
     return tok;
@@ -656,13 +716,16 @@ hint_pop(HINT_SESSION *session)
     if ((ptr = session->stack) != NULL)
     {
         session->stack = ptr->next;
-        while (ptr->hint)
+        while (!ptr->shared && ptr->hint)
         {
             hint = ptr->hint;
             ptr->hint = hint->next;
             hint_free(hint);
         }
-        MXS_FREE(ptr);
+        /** Keep the entry for the next push */
+        ptr->hint = NULL;
+        ptr->next = session->free_stack;
+        session->free_stack = ptr;
     }
 }
 
@@ -670,19 +733,30 @@ hint_pop(HINT_SESSION *session)
  * Push a hint onto the stack of actie hints
  *
  * @param session   The filter session
- * @param hint      The hint to push, the hint ownership is retained
- *          by the stack and should not be freed by the caller
+ * @param hint      The hint to push
+ * @param shared    If false, the hint ownership is retained by the stack and
+ *          should not be freed by the caller. If true, the hint belongs to a
+ *          named hint block of the session and is only referenced.
  */
 static void
-hint_push(HINT_SESSION *session, HINT *hint)
+hint_push(HINT_SESSION *session, HINT *hint, bool shared)
 {
     HINTSTACK *item;
 
-    if ((item = (HINTSTACK *)MXS_MALLOC(sizeof(HINTSTACK))) == NULL)
+    if ((item = session->free_stack) != NULL)
+    {
+        session->free_stack = item->next;
+    }
+    else if ((item = (HINTSTACK *)MXS_MALLOC(sizeof(HINTSTACK))) == NULL)
     {
+        if (!shared)
+        {
+            hint_free(hint);
+        }
         return;
     }
     item->hint = hint;
+    item->shared = shared;
     item->next = session->stack;
     session->stack = item;
 }
@@ -690,6 +764,9 @@ hint_push(HINT_SESSION *session, HINT *hint)
 /**
  * Search for a hint block that already exists with this name
  *
+ * The block that is found is moved to the front of the list so that
+ * a session that keeps starting the same blocks finds them quickly.
+ *
  * @param session   The filter session
  * @param name      The name to lookup
  * @return the HINT or NULL if the name was not found.
@@ -697,15 +774,19 @@ hint_push(HINT_SESSION *session, HINT *hint)
 static HINT *
 lookup_named_hint(HINT_SESSION *session, char *name)
 {
-    NAMEDHINTS *ptr = session->named_hints;
+    NAMEDHINTS **prev = &session->named_hints;
+    NAMEDHINTS *ptr;
 
-    while (ptr)
+    while ((ptr = *prev) != NULL)
     {
         if (strcmp(ptr->name, name) == 0)
         {
+            *prev = ptr->next;
+            ptr->next = session->named_hints;
+            session->named_hints = ptr;
             return ptr->hints;
         }
-        ptr = ptr->next;
+        prev = &ptr->next;
     }
     return NULL;
 }
@@ -716,21 +797,24 @@ lookup_named_hint(HINT_SESSION *session, char *name)
  * @param session   The filter session
  * @param name      The name of the block to ceate
  * @param hint      The hints themselves
+ * @return The hints of the new block or NULL on error
  */
-static void
+static HINT *
 create_named_hint(HINT_SESSION *session, char *name, HINT *hint)
 {
     NAMEDHINTS *block;
 
     if ((block = (NAMEDHINTS *)MXS_MALLOC(sizeof(NAMEDHINTS))) == NULL)
     {
-        return;
+        MXS_FREE(name);
+        return NULL;
     }
 
     block->name = name;
     block->hints = hint_dup(hint);
     block->next = session->named_hints;
     session->named_hints = block;
+    return block->hints;
 }
 
 /**
@@ -785,7 +869,7 @@ HINTSTACK* free_hint_stack(
 
         next = hint_stack->next;
 
-        while (hint_stack->hint != NULL)
+        while (!hint_stack->shared && hint_stack->hint != NULL)
         {
             hint = hint_stack->hint->next;
             hint_free(hint_stack->hint);
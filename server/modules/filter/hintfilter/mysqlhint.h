@@ -22,6 +22,7 @@
  */
 
 #include <maxscale/cdefs.h>
+#include <stdbool.h>
 #include <maxscale/hint.h>
 
 MXS_BEGIN_DECLS
@@ -44,11 +45,14 @@ typedef enum
     TOK_END
 } TOKEN_VALUE;
 
+/* The longest token, including the terminating null */
+#define HINT_TOKEN_LEN 100
+
 /* The tokenising return type */
 typedef struct
 {
-    TOKEN_VALUE token;      // The token itself
-    char        *value;     // The string version of the token
+    TOKEN_VALUE token;                 // The token itself
+    char        value[HINT_TOKEN_LEN]; // The string version of the token
 } HINT_TOKEN;
 
 /**
@@ -74,6 +78,7 @@ typedef struct namedhints
 typedef struct hintstack
 {
     HINT        *hint;
+    bool         shared;  /*< The hints belong to a named hint block */
     struct hintstack
         *next;
 } HINTSTACK;
@@ -95,6 +100,7 @@ typedef struct
     GWBUF          *request;
     int             query_len;
     HINTSTACK      *stack;
+    HINTSTACK      *free_stack;    /* Unused stack entries kept for reuse */
     NAMEDHINTS     *named_hints;   /* The named hints defined in this session */
 } HINT_SESSION;
 
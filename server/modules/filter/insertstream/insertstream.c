@@ -16,6 +16,7 @@
 #include <maxscale/cdefs.h>
 
 #include <strings.h>
+#include <time.h>
 #include <maxscale/alloc.h>
 #include <maxscale/buffer.h>
 #include <maxscale/filter.h>
@@ -28,6 +29,10 @@
 
 /**
  * @file datastream.c - Streaming of bulk inserts
+ *
+ * Outside transactions, single-row INSERTs can also be batched into multi-row
+ * INSERTs. The client gets an OK for each batched INSERT before the batch is
+ * sent to the backend.
  */
 
 static MXS_FILTER *createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER*params);
@@ -43,6 +48,7 @@ static int32_t clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GW
 static bool extract_insert_target(GWBUF *buffer, char* target, int len);
 static GWBUF* create_load_data_command(const char *target);
 static GWBUF* convert_to_stream(GWBUF* buffer, uint8_t packet_num);
+static bool get_single_row_insert(GWBUF *buffer, size_t *prefix, size_t *len);
 
 /**
  * Instance structure
@@ -51,8 +57,13 @@ typedef struct
 {
     char *source; /**< Source address to restrict matches */
     char *user;   /**< User name to restrict matches */
+    int batch_size;   /**< Maximum number of INSERTs in a batch, 0 for no batching */
+    int batch_window; /**< Maximum age of a batch in milliseconds */
 } DS_INSTANCE;
 
+/** Maximum length of the SQL of a batch */
+#define DS_BATCH_MAX_LEN (1024 * 1024)
+
 enum ds_state
 {
     DS_STREAM_CLOSED,    /**< Initial state */
@@ -75,6 +86,13 @@ typedef struct
     DCB* client_dcb;     /**< Client DCB */
     enum ds_state state; /**< The current state of the stream */
     char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1]; /**< Current target table */
+    char *batch;          /**< SQL of the batched INSERTs as one multi-row INSERT */
+    size_t batch_len;     /**< Length of the SQL in batch */
+    size_t batch_alloc;   /**< Allocated size of batch */
+    size_t batch_prefix;  /**< Length of the INSERT INTO ... VALUES part of batch */
+    int batch_rows;       /**< Number of INSERTs in batch */
+    uint64_t batch_start; /**< When the first INSERT was batched, in milliseconds */
+    int batches_pending;  /**< Batches sent to the backend but not yet replied to */
 } DS_SESSION;
 
 /**
@@ -118,6 +136,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         {
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"batch_size", MXS_MODULE_PARAM_COUNT, "0"},
+            {"batch_window", MXS_MODULE_PARAM_COUNT, "100"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -163,6 +183,8 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     {
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
+        my_instance->batch_size = config_get_integer(params, "batch_size");
+        my_instance->batch_window = config_get_integer(params, "batch_window");
     }
 
     return (MXS_FILTER *) my_instance;
@@ -225,6 +247,16 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 static void
 freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
+    DS_SESSION *my_session = (DS_SESSION*) session;
+
+    if (my_session->batch_rows)
+    {
+        MXS_WARNING("Session closed with %d batched INSERTs that were not sent to the backend.",
+                    my_session->batch_rows);
+    }
+
+    gwbuf_free(my_session->queue);
+    MXS_FREE(my_session->batch);
     MXS_FREE(session);
 }
 
@@ -254,6 +286,193 @@ static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_U
     my_session->up = *upstream;
 }
 
+/**
+ * Get a monotonic timestamp in milliseconds
+ */
+static uint64_t time_in_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Send the batched INSERTs to the backend as one multi-row INSERT
+ *
+ * The reply to the batch is discarded in clientReply.
+ *
+ * @param my_session Filter session
+ *
+ * @return 1 on success, 0 on error
+ */
+static int flush_batch(DS_SESSION *my_session)
+{
+    uint32_t payload = my_session->batch_len + 1;
+    GWBUF *buffer = gwbuf_alloc(payload + MYSQL_HEADER_LEN);
+    int rc = 0;
+
+    if (buffer)
+    {
+        uint8_t *ptr = GWBUF_DATA(buffer);
+        *ptr++ = payload;
+        *ptr++ = payload >> 8;
+        *ptr++ = payload >> 16;
+        *ptr++ = 0;
+        *ptr++ = 0x03;
+        memcpy(ptr, my_session->batch, my_session->batch_len);
+
+        my_session->batches_pending++;
+        rc = my_session->down.routeQuery(my_session->down.instance,
+                                         my_session->down.session, buffer);
+    }
+
+    my_session->batch_rows = 0;
+    my_session->batch_len = 0;
+
+    return rc;
+}
+
+/**
+ * @brief Add an INSERT to the batch of the session
+ *
+ * @param my_session Filter session
+ * @param sql        The INSERT statement
+ * @param prefix     Length of the INSERT INTO ... VALUES part of the statement
+ * @param len        Length of the statement
+ *
+ * @return True if the INSERT was added, false if memory allocation failed
+ */
+static bool add_to_batch(DS_SESSION *my_session, const char *sql, size_t prefix, size_t len)
+{
+    /** The first INSERT is copied as is, the others add a comma and their values */
+    size_t needed = my_session->batch_len + len + 1;
+
+    if (needed > my_session->batch_alloc)
+    {
+        size_t size = my_session->batch_alloc ? my_session->batch_alloc : 1024;
+
+        while (size < needed)
+        {
+            size *= 2;
+        }
+
+        char *batch = MXS_REALLOC(my_session->batch, size);
+
+        if (batch == NULL)
+        {
+            return false;
+        }
+
+        my_session->batch = batch;
+        my_session->batch_alloc = size;
+    }
+
+    if (my_session->batch_rows == 0)
+    {
+        memcpy(my_session->batch, sql, len);
+        my_session->batch_len = len;
+        my_session->batch_prefix = prefix;
+        my_session->batch_start = time_in_ms();
+    }
+    else
+    {
+        my_session->batch[my_session->batch_len++] = ',';
+        memcpy(my_session->batch + my_session->batch_len, sql + prefix, len - prefix);
+        my_session->batch_len += len - prefix;
+    }
+
+    my_session->batch_rows++;
+    return true;
+}
+
+/**
+ * @brief Batch single-row INSERTs done outside transactions
+ *
+ * Single-row INSERTs with the same INSERT INTO ... VALUES part are combined.
+ * Other statements are held until all batches have been sent and replied to
+ * so that they see the inserted rows.
+ *
+ * @param my_instance Filter instance
+ * @param my_session  Filter session
+ * @param queue       The query data
+ * @param rc          The return value of routeQuery is stored here
+ *
+ * @return True if the query was handled, false if it should be routed normally
+ */
+static bool batch_query(DS_INSTANCE *my_instance, DS_SESSION *my_session, GWBUF *queue, int *rc)
+{
+    char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1];
+    size_t prefix;
+    size_t len;
+
+    if (my_session->active && my_session->queue == NULL &&
+        !session_trx_is_active(my_session->client_dcb->session) &&
+        MYSQL_GET_COMMAND(GWBUF_DATA(queue)) == MYSQL_COM_QUERY &&
+        get_single_row_insert(queue, &prefix, &len) &&
+        extract_insert_target(queue, target, sizeof(target)))
+    {
+        const char *sql = (char*)GWBUF_DATA(queue) + MYSQL_HEADER_LEN + 1;
+        *rc = 1;
+
+        if (my_session->batch_rows &&
+            (prefix != my_session->batch_prefix ||
+             memcmp(sql, my_session->batch, prefix) != 0))
+        {
+            /** Different table or type of INSERT, start a new batch */
+            *rc = flush_batch(my_session);
+        }
+
+        if (!add_to_batch(my_session, sql, prefix, len))
+        {
+            /** Send the batch and then the INSERT as it is */
+            if (my_session->batch_rows)
+            {
+                *rc = flush_batch(my_session);
+            }
+
+            if (my_session->batches_pending == 0)
+            {
+                return false;
+            }
+
+            my_session->queue = queue;
+            return true;
+        }
+
+        gwbuf_free(queue);
+
+        if (my_session->batch_rows >= my_instance->batch_size ||
+            my_session->batch_len >= DS_BATCH_MAX_LEN ||
+            (my_instance->batch_window &&
+             time_in_ms() - my_session->batch_start >= (uint64_t)my_instance->batch_window))
+        {
+            *rc = flush_batch(my_session) && *rc;
+        }
+
+        if (*rc)
+        {
+            *rc = mxs_mysql_send_ok(my_session->client_dcb, 1, 1, NULL);
+        }
+
+        return true;
+    }
+    else if (my_session->batch_rows || my_session->batches_pending)
+    {
+        *rc = 1;
+
+        if (my_session->batch_rows)
+        {
+            *rc = flush_batch(my_session);
+        }
+
+        /** Routed when the last batch has been replied to */
+        my_session->queue = queue;
+        return true;
+    }
+
+    return false;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -268,6 +487,7 @@ static void setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_U
  */
 static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 {
+    DS_INSTANCE *my_instance = (DS_INSTANCE *) instance;
     DS_SESSION *my_session = (DS_SESSION *) session;
     char target[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 1];
     bool send_ok = false;
@@ -275,6 +495,12 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
     int rc = 0;
     ss_dassert(GWBUF_IS_CONTIGUOUS(queue));
 
+    if (my_instance->batch_size && my_session->state == DS_STREAM_CLOSED &&
+        batch_query(my_instance, my_session, queue, &rc))
+    {
+        return rc;
+    }
+
     if (session_trx_is_active(my_session->client_dcb->session) &&
         extract_insert_target(queue, target, sizeof(target)))
     {
@@ -456,7 +682,29 @@ static int32_t clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GW
     DS_SESSION *my_session = (DS_SESSION*) session;
     int rc = 1;
 
-    if (my_session->state == DS_CLOSING_STREAM ||
+    if (my_session->batches_pending)
+    {
+        /** The client already got an OK for each INSERT of the batch */
+        uint8_t *data = GWBUF_DATA(reply);
+
+        if (MYSQL_IS_ERROR_PACKET(data))
+        {
+            /** The message follows the error code and the SQL state */
+            int len = MYSQL_GET_PAYLOAD_LEN(data) - 9;
+            MXS_ERROR("Batched INSERT failed: %.*s", len > 0 ? len : 0,
+                      len > 0 ? (char*)data + MYSQL_HEADER_LEN + 9 : "");
+        }
+
+        gwbuf_free(reply);
+
+        if (--my_session->batches_pending == 0 && my_session->queue)
+        {
+            GWBUF* queue = my_session->queue;
+            my_session->queue = NULL;
+            poll_add_epollin_event_to_dcb(my_session->client_dcb, queue);
+        }
+    }
+    else if (my_session->state == DS_CLOSING_STREAM ||
         (my_session->state == DS_REQUEST_SENT &&
          !MYSQL_IS_ERROR_PACKET((uint8_t*)GWBUF_DATA(reply))))
     {
@@ -510,6 +758,11 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
     {
         dcb_printf(dcb, "\t\tReplacement limit to user           %s\n", my_instance->user);
     }
+    if (my_instance->batch_size)
+    {
+        dcb_printf(dcb, "\t\tINSERTs batched in groups of at most %d within %d ms\n",
+                   my_instance->batch_size, my_instance->batch_window);
+    }
 }
 
 /**
@@ -562,6 +815,46 @@ static bool only_implicit_values(GWBUF *buffer)
     return rval;
 }
 
+/**
+ * @brief Check if the buffer contains an INSERT with exactly one row of values
+ *
+ * @param buffer Buffer to check
+ * @param prefix Length of the SQL before the values
+ * @param len    Length of the SQL without any trailing whitespace or semicolon
+ *
+ * @return True if the statement has only one parenthesized row after which
+ * the statement ends
+ */
+static bool get_single_row_insert(GWBUF *buffer, size_t *prefix, size_t *len)
+{
+    char *sql = (char*)GWBUF_DATA(buffer) + MYSQL_HEADER_LEN + 1;
+    char *end = (char*)buffer->end;
+    char *start = strnchr_esc_mysql(sql, '(', end - sql);
+    char *ptr;
+
+    if (start == NULL || (ptr = strnchr_esc_mysql(start, ')', end - start)) == NULL)
+    {
+        return false;
+    }
+
+    char *values_end = ++ptr;
+
+    while (ptr < end && (isspace(*ptr) || *ptr == ';'))
+    {
+        ptr++;
+    }
+
+    if (ptr < end)
+    {
+        /** More rows or something else after the values */
+        return false;
+    }
+
+    *prefix = start - sql;
+    *len = values_end - sql;
+    return true;
+}
+
 /**
  * @brief Extract insert target
  *
@@ -34,6 +34,11 @@
  * is defined and valid, the matching entry point function in Lua will be called.
  * The same holds true for session script apart from no calls to createInstance
  * or diagnostic being made for the session script.
+ *
+ * By default all sessions share one Lua state for the global script. With
+ * global_state=thread each worker thread runs the global script in a Lua state
+ * of its own. The scripts can share data between the threads and the sessions
+ * with the shared_get, shared_set and shared_add functions.
  */
 
 #define MXS_MODULE_NAME "luafilter"
@@ -44,14 +49,28 @@
 #include <lualib.h>
 #include <string.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
 #include <maxscale/debug.h>
 #include <maxscale/filter.h>
+#include <maxscale/hashtable.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/modutil.h>
+#include <maxscale/poll.h>
 #include <maxscale/query_classifier.h>
 #include <maxscale/session.h>
 #include <maxscale/spinlock.h>
 
+/** Number of separately locked parts of the shared data */
+#define LUA_SHARED_STRIPES 16
+
+/** How the global script is run */
+enum lua_global_mode
+{
+    LUA_GLOBAL_SHARED, /* One Lua state for all threads */
+    LUA_GLOBAL_THREAD  /* One Lua state for each worker thread */
+};
+
 /*
  * The filter entry points
  */
@@ -66,6 +85,13 @@ static int32_t clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, G
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER *instance);
 
+static const MXS_ENUM_VALUE global_state_values[] =
+{
+    {"shared", LUA_GLOBAL_SHARED},
+    {"thread", LUA_GLOBAL_THREAD},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -106,6 +132,13 @@ MXS_MODULE* MXS_CREATE_MODULE()
         {
             {"global_script", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
             {"session_script", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
+            {
+                "global_state",
+                MXS_MODULE_PARAM_ENUM,
+                "shared",
+                MXS_MODULE_OPT_ENUM_UNIQUE,
+                global_state_values
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -114,7 +147,6 @@ MXS_MODULE* MXS_CREATE_MODULE()
 }
 
 static int id_pool = 0;
-static GWBUF *current_global_query = NULL;
 
 /**
  * Push an unique integer to the Lua state's stack
@@ -166,17 +198,328 @@ static int lua_qc_get_operation(lua_State* state)
     return 1;
 }
 
+/**
+ * A value stored with shared_set
+ */
+typedef struct
+{
+    int type;      /* LUA_TNUMBER, LUA_TBOOLEAN or LUA_TSTRING */
+    lua_Number number;
+    char *string;
+    size_t len;
+} LUA_SHARED_VALUE;
+
+/**
+ * The data shared by all Lua states of an instance. The keys are divided
+ * between several hashtables so that the threads seldom wait for each other.
+ */
+typedef struct
+{
+    SPINLOCK lock;
+    HASHTABLE *values;
+} LUA_SHARED_STRIPE;
+
+/**
+ * A Lua state of the global script.
+ */
+typedef struct
+{
+    lua_State* state;
+    GWBUF* current_query; /* The query being routed, for the query classifier API */
+    SPINLOCK lock;
+} LUA_GLOBAL;
+
 /**
  * The Lua filter instance.
  */
 typedef struct
 {
-    lua_State* global_lua_state;
     char* global_script;
     char* session_script;
-    SPINLOCK lock;
+    int n_globals; /* Number of global Lua states */
+    LUA_GLOBAL* globals; /* The global Lua states, one for each thread or only one */
+    LUA_SHARED_STRIPE shared[LUA_SHARED_STRIPES];
 } LUA_INSTANCE;
 
+static void shared_value_free(void *data)
+{
+    LUA_SHARED_VALUE *value = (LUA_SHARED_VALUE*)data;
+
+    if (value)
+    {
+        MXS_FREE(value->string);
+        MXS_FREE(value);
+    }
+}
+
+static LUA_SHARED_STRIPE* shared_stripe(lua_State* state, const char *key)
+{
+    LUA_INSTANCE *instance = (LUA_INSTANCE*)lua_touserdata(state, lua_upvalueindex(1));
+    return &instance->shared[(unsigned int)hashtable_item_strhash(key) % LUA_SHARED_STRIPES];
+}
+
+static void push_shared_value(lua_State* state, LUA_SHARED_VALUE *value)
+{
+    if (value == NULL)
+    {
+        lua_pushnil(state);
+    }
+    else if (value->type == LUA_TNUMBER)
+    {
+        lua_pushnumber(state, value->number);
+    }
+    else if (value->type == LUA_TBOOLEAN)
+    {
+        lua_pushboolean(state, value->number != 0);
+    }
+    else
+    {
+        lua_pushlstring(state, value->string, value->len);
+    }
+}
+
+/**
+ * shared_get(key) - Get a value stored with shared_set or shared_add
+ *
+ * @param state Lua state
+ * @return Always 1, the value or nil is pushed to the stack
+ */
+static int lua_shared_get(lua_State* state)
+{
+    const char *key = luaL_checkstring(state, 1);
+    LUA_SHARED_STRIPE *stripe = shared_stripe(state, key);
+
+    spinlock_acquire(&stripe->lock);
+    push_shared_value(state, hashtable_fetch(stripe->values, (void*)key));
+    spinlock_release(&stripe->lock);
+
+    return 1;
+}
+
+/**
+ * shared_set(key, value) - Store a number, a boolean or a string, nil
+ * removes the key
+ *
+ * @param state Lua state
+ * @return Always 0
+ */
+static int lua_shared_set(lua_State* state)
+{
+    const char *key = luaL_checkstring(state, 1);
+    int type = lua_type(state, 2);
+    LUA_SHARED_VALUE *value = NULL;
+
+    if (type == LUA_TNUMBER || type == LUA_TBOOLEAN || type == LUA_TSTRING)
+    {
+        if ((value = MXS_CALLOC(1, sizeof(LUA_SHARED_VALUE))) == NULL)
+        {
+            return 0;
+        }
+
+        value->type = type;
+
+        if (type == LUA_TNUMBER)
+        {
+            value->number = lua_tonumber(state, 2);
+        }
+        else if (type == LUA_TBOOLEAN)
+        {
+            value->number = lua_toboolean(state, 2);
+        }
+        else
+        {
+            const char *str = lua_tolstring(state, 2, &value->len);
+
+            if ((value->string = MXS_MALLOC(value->len + 1)) == NULL)
+            {
+                MXS_FREE(value);
+                return 0;
+            }
+
+            memcpy(value->string, str, value->len + 1);
+        }
+    }
+    else if (type != LUA_TNIL && type != LUA_TNONE)
+    {
+        return luaL_error(state, "shared_set: only numbers, booleans and strings can be stored");
+    }
+
+    LUA_SHARED_STRIPE *stripe = shared_stripe(state, key);
+
+    spinlock_acquire(&stripe->lock);
+    hashtable_delete(stripe->values, (void*)key);
+
+    if (value && !hashtable_add(stripe->values, (void*)key, value))
+    {
+        shared_value_free(value);
+    }
+    spinlock_release(&stripe->lock);
+
+    return 0;
+}
+
+/**
+ * shared_add(key, number) - Atomically add to a number, a missing key
+ * counts as zero
+ *
+ * @param state Lua state
+ * @return Always 1, the new value is pushed to the stack
+ */
+static int lua_shared_add(lua_State* state)
+{
+    const char *key = luaL_checkstring(state, 1);
+    lua_Number amount = luaL_optnumber(state, 2, 1);
+    LUA_SHARED_STRIPE *stripe = shared_stripe(state, key);
+    lua_Number result = amount;
+
+    spinlock_acquire(&stripe->lock);
+
+    LUA_SHARED_VALUE *value = hashtable_fetch(stripe->values, (void*)key);
+
+    if (value && value->type == LUA_TNUMBER)
+    {
+        value->number += amount;
+        result = value->number;
+    }
+    else
+    {
+        hashtable_delete(stripe->values, (void*)key);
+
+        if ((value = MXS_CALLOC(1, sizeof(LUA_SHARED_VALUE))))
+        {
+            value->type = LUA_TNUMBER;
+            value->number = amount;
+
+            if (!hashtable_add(stripe->values, (void*)key, value))
+            {
+                shared_value_free(value);
+            }
+        }
+    }
+
+    spinlock_release(&stripe->lock);
+
+    lua_pushnumber(state, result);
+    return 1;
+}
+
+/**
+ * Expose the C functions of the filter to a Lua state
+ *
+ * @param instance      The filter instance
+ * @param state         The Lua state
+ * @param current_query Where the query being routed is stored
+ */
+static void expose_functions(LUA_INSTANCE *instance, lua_State* state, GWBUF** current_query)
+{
+    /** Expose a part of the query classifier API */
+    lua_pushlightuserdata(state, current_query);
+    lua_pushcclosure(state, lua_qc_get_type_mask, 1);
+    lua_setglobal(state, "lua_qc_get_type_mask");
+
+    lua_pushlightuserdata(state, current_query);
+    lua_pushcclosure(state, lua_qc_get_operation, 1);
+    lua_setglobal(state, "lua_qc_get_operation");
+
+    /** Expose the data shared by all states */
+    lua_pushlightuserdata(state, instance);
+    lua_pushcclosure(state, lua_shared_get, 1);
+    lua_setglobal(state, "shared_get");
+
+    lua_pushlightuserdata(state, instance);
+    lua_pushcclosure(state, lua_shared_set, 1);
+    lua_setglobal(state, "shared_set");
+
+    lua_pushlightuserdata(state, instance);
+    lua_pushcclosure(state, lua_shared_add, 1);
+    lua_setglobal(state, "shared_add");
+}
+
+/**
+ * Get the global Lua state of the current thread
+ *
+ * @param instance The filter instance
+ * @return The global Lua state or NULL if there is no global script
+ */
+static LUA_GLOBAL* get_global(LUA_INSTANCE *instance)
+{
+    if (instance->n_globals <= 1)
+    {
+        return instance->globals;
+    }
+
+    /** Threads other than the workers use the first state, it is locked anyway */
+    int thread_id = poll_current_worker();
+    int i = thread_id != -1 && thread_id < instance->n_globals ? thread_id : 0;
+
+    return &instance->globals[i];
+}
+
+static void free_instance(LUA_INSTANCE *instance)
+{
+    if (instance->globals)
+    {
+        for (int i = 0; i < instance->n_globals; i++)
+        {
+            if (instance->globals[i].state)
+            {
+                lua_close(instance->globals[i].state);
+            }
+        }
+
+        MXS_FREE(instance->globals);
+    }
+
+    for (int i = 0; i < LUA_SHARED_STRIPES; i++)
+    {
+        hashtable_free(instance->shared[i].values);
+    }
+
+    MXS_FREE(instance->global_script);
+    MXS_FREE(instance->session_script);
+    MXS_FREE(instance);
+}
+
+/**
+ * Load the global script into a new Lua state and call its createInstance
+ *
+ * @param instance The filter instance
+ * @param global   The state to initialize
+ * @return True if the script was loaded
+ */
+static bool init_global(LUA_INSTANCE *instance, LUA_GLOBAL *global)
+{
+    spinlock_init(&global->lock);
+
+    if ((global->state = luaL_newstate()) == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        return false;
+    }
+
+    luaL_openlibs(global->state);
+    expose_functions(instance, global->state, &global->current_query);
+
+    if (luaL_dofile(global->state, instance->global_script))
+    {
+        MXS_ERROR("Failed to execute global script at '%s':%s.",
+                  instance->global_script, lua_tostring(global->state, -1));
+        return false;
+    }
+
+    lua_getglobal(global->state, "createInstance");
+
+    if (lua_pcall(global->state, 0, 0, 0))
+    {
+        MXS_WARNING("Failed to get global variable 'createInstance':  %s."
+                    " The createInstance entry point will not be called for the global script.",
+                    lua_tostring(global->state, -1));
+        lua_pop(global->state, -1); // Pop the error off the stack
+    }
+
+    return true;
+}
+
 /**
  * The session structure for Lua filter.
  */
@@ -209,54 +552,42 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         return NULL;
     }
 
-    spinlock_init(&my_instance->lock);
-
     my_instance->global_script = config_copy_string(params, "global_script");
     my_instance->session_script = config_copy_string(params, "session_script");
 
-    if (my_instance->global_script)
+    for (int i = 0; i < LUA_SHARED_STRIPES; i++)
     {
-        if ((my_instance->global_lua_state = luaL_newstate()))
-        {
-            luaL_openlibs(my_instance->global_lua_state);
-
-            if (luaL_dofile(my_instance->global_lua_state, my_instance->global_script))
-            {
-                MXS_ERROR("Failed to execute global script at '%s':%s.",
-                          my_instance->global_script, lua_tostring(my_instance->global_lua_state, -1));
-                MXS_FREE(my_instance->global_script);
-                MXS_FREE(my_instance->session_script);
-                MXS_FREE(my_instance);
-                my_instance = NULL;
-            }
-            else if (my_instance->global_lua_state)
-            {
-                lua_getglobal(my_instance->global_lua_state, "createInstance");
+        spinlock_init(&my_instance->shared[i].lock);
 
-                if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
-                {
-                    MXS_WARNING("Failed to get global variable 'createInstance':  %s."
-                                " The createInstance entry point will not be called for the global script.",
-                                lua_tostring(my_instance->global_lua_state, -1));
-                    lua_pop(my_instance->global_lua_state, -1); // Pop the error off the stack
-                }
+        if ((my_instance->shared[i].values = hashtable_alloc(100, hashtable_item_strhash,
+                                                             hashtable_item_strcmp)) == NULL)
+        {
+            free_instance(my_instance);
+            return NULL;
+        }
 
-                /** Expose a part of the query classifier API */
-                lua_pushlightuserdata(my_instance->global_lua_state, &current_global_query);
-                lua_pushcclosure(my_instance->global_lua_state, lua_qc_get_type_mask, 1);
-                lua_setglobal(my_instance->global_lua_state, "lua_qc_get_type_mask");
+        hashtable_memory_fns(my_instance->shared[i].values, hashtable_item_strdup, NULL,
+                             hashtable_item_free, shared_value_free);
+    }
 
-                lua_pushlightuserdata(my_instance->global_lua_state, &current_global_query);
-                lua_pushcclosure(my_instance->global_lua_state, lua_qc_get_operation, 1);
-                lua_setglobal(my_instance->global_lua_state, "lua_qc_get_operation");
+    if (my_instance->global_script)
+    {
+        my_instance->n_globals = config_get_enum(params, "global_state", global_state_values) ==
+                                 LUA_GLOBAL_THREAD ? config_threadcount() : 1;
 
-            }
+        if ((my_instance->globals = MXS_CALLOC(my_instance->n_globals, sizeof(LUA_GLOBAL))) == NULL)
+        {
+            free_instance(my_instance);
+            return NULL;
         }
-        else
+
+        for (int i = 0; i < my_instance->n_globals; i++)
         {
-            MXS_ERROR("Unable to initialize new Lua state.");
-            MXS_FREE(my_instance);
-            my_instance = NULL;
+            if (!init_global(my_instance, &my_instance->globals[i]))
+            {
+                free_instance(my_instance);
+                return NULL;
+            }
         }
     }
 
@@ -312,14 +643,7 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
             lua_pushcfunction(my_session->lua_state, id_gen);
             lua_setglobal(my_session->lua_state, "id_gen");
 
-            /** Expose a part of the query classifier API */
-            lua_pushlightuserdata(my_session->lua_state, &my_session->current_query);
-            lua_pushcclosure(my_session->lua_state, lua_qc_get_type_mask, 1);
-            lua_setglobal(my_session->lua_state, "lua_qc_get_type_mask");
-
-            lua_pushlightuserdata(my_session->lua_state, &my_session->current_query);
-            lua_pushcclosure(my_session->lua_state, lua_qc_get_operation, 1);
-            lua_setglobal(my_session->lua_state, "lua_qc_get_operation");
+            expose_functions(my_instance, my_session->lua_state, &my_session->current_query);
 
             /** Call the newSession entry point */
             lua_getglobal(my_session->lua_state, "newSession");
@@ -336,23 +660,25 @@ static MXS_FILTER_SESSION *newSession(MXS_FILTER *instance, MXS_SESSION *session
         }
     }
 
-    if (my_session && my_instance->global_lua_state)
+    LUA_GLOBAL *global = get_global(my_instance);
+
+    if (my_session && global)
     {
-        spinlock_acquire(&my_instance->lock);
+        spinlock_acquire(&global->lock);
 
-        lua_getglobal(my_instance->global_lua_state, "newSession");
-        lua_pushstring(my_instance->global_lua_state, session->client_dcb->user);
-        lua_pushstring(my_instance->global_lua_state, session->client_dcb->remote);
+        lua_getglobal(global->state, "newSession");
+        lua_pushstring(global->state, session->client_dcb->user);
+        lua_pushstring(global->state, session->client_dcb->remote);
 
-        if (lua_pcall(my_instance->global_lua_state, 2, 0, 0))
+        if (lua_pcall(global->state, 2, 0, 0))
         {
             MXS_WARNING("Failed to get global variable 'newSession': '%s'."
                         " The newSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1); // Pop the error off the stack
+                        lua_tostring(global->state, -1));
+            lua_pop(global->state, -1); // Pop the error off the stack
         }
 
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 
     return (MXS_FILTER_SESSION*)my_session;
@@ -388,20 +714,22 @@ static void closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
         spinlock_release(&my_session->lock);
     }
 
-    if (my_instance->global_lua_state)
+    LUA_GLOBAL *global = get_global(my_instance);
+
+    if (global)
     {
-        spinlock_acquire(&my_instance->lock);
+        spinlock_acquire(&global->lock);
 
-        lua_getglobal(my_instance->global_lua_state, "closeSession");
+        lua_getglobal(global->state, "closeSession");
 
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_pcall(global->state, 0, 0, 0))
         {
             MXS_WARNING("Failed to get global variable 'closeSession': '%s'."
                         " The closeSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1);
+                        lua_tostring(global->state, -1));
+            lua_pop(global->state, -1);
         }
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 }
 
@@ -478,20 +806,22 @@ static int32_t clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GW
 
         spinlock_release(&my_session->lock);
     }
-    if (my_instance->global_lua_state)
+    LUA_GLOBAL *global = get_global(my_instance);
+
+    if (global)
     {
-        spinlock_acquire(&my_instance->lock);
+        spinlock_acquire(&global->lock);
 
-        lua_getglobal(my_instance->global_lua_state, "clientReply");
+        lua_getglobal(global->state, "clientReply");
 
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        if (lua_pcall(global->state, 0, 0, 0))
         {
             MXS_ERROR("Global scope call to 'clientReply' failed: '%s'.",
                       lua_tostring(my_session->lua_state, -1));
-            lua_pop(my_instance->global_lua_state, -1);
+            lua_pop(global->state, -1);
         }
 
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 
     return my_session->up.clientReply(my_session->up.instance,
@@ -564,36 +894,38 @@ static int32_t routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWB
             spinlock_release(&my_session->lock);
         }
 
-        if (my_instance->global_lua_state)
+        LUA_GLOBAL *global = get_global(my_instance);
+
+        if (global)
         {
-            spinlock_acquire(&my_instance->lock);
-            current_global_query = queue;
+            spinlock_acquire(&global->lock);
+            global->current_query = queue;
 
-            lua_getglobal(my_instance->global_lua_state, "routeQuery");
+            lua_getglobal(global->state, "routeQuery");
 
-            lua_pushlstring(my_instance->global_lua_state, fullquery, strlen(fullquery));
+            lua_pushlstring(global->state, fullquery, strlen(fullquery));
 
-            if (lua_pcall(my_instance->global_lua_state, 1, 0, 0))
+            if (lua_pcall(global->state, 1, 0, 0))
             {
                 MXS_ERROR("Global scope call to 'routeQuery' failed: '%s'.",
-                          lua_tostring(my_instance->global_lua_state, -1));
-                lua_pop(my_instance->global_lua_state, -1);
+                          lua_tostring(global->state, -1));
+                lua_pop(global->state, -1);
             }
-            else if (lua_gettop(my_instance->global_lua_state))
+            else if (lua_gettop(global->state))
             {
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                if (lua_isstring(global->state, -1))
                 {
                     gwbuf_free(forward);
-                    forward = modutil_create_query(lua_tostring(my_instance->global_lua_state, -1));
+                    forward = modutil_create_query(lua_tostring(global->state, -1));
                 }
-                else if (lua_isboolean(my_instance->global_lua_state, -1))
+                else if (lua_isboolean(global->state, -1))
                 {
-                    route = lua_toboolean(my_instance->global_lua_state, -1);
+                    route = lua_toboolean(global->state, -1);
                 }
             }
 
-            current_global_query = NULL;
-            spinlock_release(&my_instance->lock);
+            global->current_query = NULL;
+            spinlock_release(&global->lock);
         }
 
         MXS_FREE(fullquery);
@@ -629,28 +961,35 @@ static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *
 
     if (my_instance)
     {
-        if (my_instance->global_lua_state)
+        for (int i = 0; i < my_instance->n_globals; i++)
         {
-            spinlock_acquire(&my_instance->lock);
+            LUA_GLOBAL *global = &my_instance->globals[i];
+
+            if (my_instance->n_globals > 1)
+            {
+                dcb_printf(dcb, "Global state of thread %d:\n", i);
+            }
+
+            spinlock_acquire(&global->lock);
 
-            lua_getglobal(my_instance->global_lua_state, "diagnostic");
+            lua_getglobal(global->state, "diagnostic");
 
-            if (lua_pcall(my_instance->global_lua_state, 0, 1, 0) == 0)
+            if (lua_pcall(global->state, 0, 1, 0) == 0)
             {
-                lua_gettop(my_instance->global_lua_state);
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                lua_gettop(global->state);
+                if (lua_isstring(global->state, -1))
                 {
-                    dcb_printf(dcb, "%s", lua_tostring(my_instance->global_lua_state, -1));
+                    dcb_printf(dcb, "%s", lua_tostring(global->state, -1));
                     dcb_printf(dcb, "\n");
                 }
             }
             else
             {
                 dcb_printf(dcb, "Global scope call to 'diagnostic' failed: '%s'.\n",
-                           lua_tostring(my_instance->global_lua_state, -1));
-                lua_pop(my_instance->global_lua_state, -1);
+                           lua_tostring(global->state, -1));
             }
-            spinlock_release(&my_instance->lock);
+            lua_pop(global->state, -1);
+            spinlock_release(&global->lock);
         }
         if (my_instance->global_script)
         {
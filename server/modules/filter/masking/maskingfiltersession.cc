@@ -69,7 +69,12 @@ int MaskingFilterSession::clientReply(GWBUF* pPacket)
 
     ComResponse response(pPacket);
 
-    if (response.is_err())
+    if (m_state == SKIPPING_ROW)
+    {
+        // The packet continues a large row, so it may look like anything.
+        skip_row(pPacket);
+    }
+    else if (response.is_err())
     {
         // If we get an error response, we just abort what we were doing.
         m_state = EXPECTING_NOTHING;
@@ -100,6 +105,7 @@ int MaskingFilterSession::clientReply(GWBUF* pPacket)
             handle_eof(pPacket);
             break;
 
+        case SKIPPING_ROW:
         case SUPPRESSING_RESPONSE:
             break;
         }
@@ -165,7 +171,7 @@ void MaskingFilterSession::handle_field(GWBUF* pPacket)
             zHost = "";
         }
 
-        const MaskingRules::Rule* pRule = m_res.rules()->get_rule_for(column_def, zUser, zHost);
+        const MaskingRules::Rule* pRule = get_rule_for(column_def, zUser, zHost);
 
         if (m_res.append_type_and_rule(column_def.type(), pRule))
         {
@@ -175,6 +181,31 @@ void MaskingFilterSession::handle_field(GWBUF* pPacket)
     }
 }
 
+const MaskingRules::Rule* MaskingFilterSession::get_rule_for(const ComQueryResponse::ColumnDef& column_def,
+                                                             const char* zUser,
+                                                             const char* zHost)
+{
+    m_cache.prepare(m_res.rules(), zUser, zHost);
+
+    // A NUL can not appear in an identifier, so the key is unambiguous.
+    string key = column_def.schema().to_string();
+    key += '\0';
+    key += column_def.org_table().to_string();
+    key += '\0';
+    key += column_def.org_name().to_string();
+
+    RuleCache::Rules& rules = m_cache.rules();
+    RuleCache::Rules::iterator i = rules.find(key);
+
+    if (i == rules.end())
+    {
+        const MaskingRules::Rule* pRule = m_res.rules()->get_rule_for(column_def, zUser, zHost);
+        i = rules.insert(std::make_pair(key, pRule)).first;
+    }
+
+    return i->second;
+}
+
 void MaskingFilterSession::handle_eof(GWBUF* pPacket)
 {
     ComResponse response(pPacket);
@@ -234,19 +265,46 @@ void MaskingFilterSession::handle_row(GWBUF* pPacket)
             m_state = EXPECTING_NOTHING;
         }
     }
-    else
+    else if (response.payload_len() >= ComPacket::MAX_PAYLOAD_LEN)
     {
+        // The row continues in the following packets.
         if (m_res.some_rule_matches())
         {
-            if (response.payload_len() >= ComPacket::MAX_PAYLOAD_LEN)
-            {
-                handle_large_payload();
-            }
-            else
-            {
-                mask_values(response);
-            }
+            handle_large_row();
         }
+        else
+        {
+            m_state = SKIPPING_ROW;
+        }
+    }
+    else if (m_res.some_rule_matches())
+    {
+        mask_values(response);
+    }
+}
+
+void MaskingFilterSession::handle_large_row()
+{
+    if (m_filter.config().large_payload() == Config::LARGE_ABORT)
+    {
+        handle_large_payload();
+    }
+    else
+    {
+        // Only this row is left unmasked, the rows after it are masked as usual.
+        MXS_WARNING("Payload > 16MB, no masking is performed for the row.");
+        m_state = SKIPPING_ROW;
+    }
+}
+
+void MaskingFilterSession::skip_row(GWBUF* pPacket)
+{
+    ComPacket packet(pPacket);
+
+    if (packet.payload_len() < ComPacket::MAX_PAYLOAD_LEN)
+    {
+        // The last packet of the row.
+        m_state = EXPECTING_ROW;
     }
 }
 
@@ -274,9 +332,9 @@ void MaskingFilterSession::mask_values(ComPacket& response)
             ComQueryResponse::TextResultsetRow row(response, m_res.types());
 
             ComQueryResponse::TextResultsetRow::iterator i = row.begin();
-            while (i != row.end())
+            for (size_t j = 0; j < m_res.masked_fields(); ++j)
             {
-                const MaskingRules::Rule* pRule = m_res.get_rule();
+                const MaskingRules::Rule* pRule = m_res.get_rule(j);
 
                 if (pRule)
                 {
@@ -302,9 +360,9 @@ void MaskingFilterSession::mask_values(ComPacket& response)
             ComQueryResponse::BinaryResultsetRow row(response, m_res.types());
 
             ComQueryResponse::BinaryResultsetRow::iterator i = row.begin();
-            while (i != row.end())
+            for (size_t j = 0; j < m_res.masked_fields(); ++j)
             {
-                const MaskingRules::Rule* pRule = m_res.get_rule();
+                const MaskingRules::Rule* pRule = m_res.get_rule(j);
 
                 if (pRule)
                 {
@@ -15,6 +15,7 @@
 #include <maxscale/cppdefs.hh>
 #include <memory>
 #include <tr1/memory>
+#include <tr1/unordered_map>
 #include <maxscale/buffer.hh>
 #include <maxscale/filter.hh>
 #include "maskingrules.hh"
@@ -49,6 +50,7 @@ private:
         EXPECTING_FIELD_EOF,
         EXPECTING_ROW,
         EXPECTING_ROW_EOF,
+        SKIPPING_ROW,
         IGNORING_RESPONSE,
         SUPPRESSING_RESPONSE
     };
@@ -58,19 +60,67 @@ private:
     void handle_row(GWBUF* pPacket);
     void handle_eof(GWBUF* pPacket);
     void handle_large_payload();
+    void handle_large_row();
+    void skip_row(GWBUF* pPacket);
 
     void mask_values(ComPacket& response);
 
+    const MaskingRules::Rule* get_rule_for(const ComQueryResponse::ColumnDef& column_def,
+                                           const char* zUser,
+                                           const char* zHost);
+
 private:
     typedef std::tr1::shared_ptr<MaskingRules> SMaskingRules;
 
+    /**
+     * The rules that match the columns the session has seen, keyed by the
+     * database, table and column name. The cache is valid for one set of
+     * rules and one user and it is cleared when either changes.
+     */
+    class RuleCache
+    {
+    public:
+        enum
+        {
+            MAX_ENTRIES = 10000 /*<! The cache is cleared when this is exceeded. */
+        };
+
+        typedef std::tr1::unordered_map<std::string, const MaskingRules::Rule*> Rules;
+
+        void prepare(const SMaskingRules& sRules, const char* zUser, const char* zHost)
+        {
+            if ((sRules != m_sRules) || (m_user != zUser) || (m_host != zHost))
+            {
+                m_rules.clear();
+                m_sRules = sRules;
+                m_user = zUser;
+                m_host = zHost;
+            }
+            else if (m_rules.size() >= MAX_ENTRIES)
+            {
+                m_rules.clear();
+            }
+        }
+
+        Rules& rules()
+        {
+            return m_rules;
+        }
+
+    private:
+        SMaskingRules m_sRules; /*<! The rules the cache is valid for. */
+        std::string   m_user;   /*<! The user the cache is valid for. */
+        std::string   m_host;   /*<! The host the cache is valid for. */
+        Rules         m_rules;  /*<! The cached rules, NULL if no rule matches. */
+    };
+
     class ResponseState
     {
     public:
         ResponseState()
             : m_command(0)
             , m_nTotal_fields(0)
-            , m_index(0)
+            , m_nMasked_fields(0)
             , m_multi_result(false)
             , m_some_rule_matches(false)
         {}
@@ -88,9 +138,9 @@ private:
         void reset_multi()
         {
             m_nTotal_fields = 0;
+            m_nMasked_fields = 0;
             m_types.clear();
             m_rules.clear();
-            m_index = 0;
             m_multi_result = true;
         }
 
@@ -132,6 +182,7 @@ private:
             if (pRule)
             {
                 m_some_rule_matches = true;
+                m_nMasked_fields = m_rules.size();
             }
 
             return m_rules.size() == m_nTotal_fields;
@@ -142,15 +193,22 @@ private:
             return m_types;
         }
 
-        const MaskingRules::Rule* get_rule()
+        /**
+         * The number of leading columns of a row that need to be looked at.
+         * The columns after the last one a rule matches are left as they are.
+         *
+         * @return The index of the last masked column plus one.
+         */
+        size_t masked_fields() const
+        {
+            return m_nMasked_fields;
+        }
+
+        const MaskingRules::Rule* get_rule(size_t i) const
         {
             ss_dassert(m_nTotal_fields == m_rules.size());
-            ss_dassert(m_index < m_rules.size());
-            const MaskingRules::Rule* pRule = m_rules[m_index++];
-            // The rules will be used repeatedly for each row. Hence, once we hit
-            // the end, we need to continue from the start.
-            m_index = m_index % m_rules.size();
-            return pRule;
+            ss_dassert(i < m_rules.size());
+            return m_rules[i];
         }
 
     private:
@@ -159,7 +217,7 @@ private:
         uint32_t                               m_nTotal_fields;     /*<! The total number of fields. */
         std::vector<enum_field_types>          m_types;             /*<! The column types. */
         std::vector<const MaskingRules::Rule*> m_rules;             /*<! The rules applied for columns. */
-        size_t                                 m_index;             /*<! Index to the current rule.*/
+        size_t                                 m_nMasked_fields;    /*<! Index of last masked column + 1. */
         bool                                   m_multi_result;      /*<! Are we processing multi-results. */
         bool                                   m_some_rule_matches; /*<! At least one rule matches. */
     };
@@ -167,4 +225,5 @@ private:
     const MaskingFilter& m_filter;
     state_t              m_state;
     ResponseState        m_res;
+    RuleCache            m_cache;
 };
@@ -27,6 +27,10 @@
  * 20/12/2016   Massimiliano Pinto    csdata->res.n_rows counter works with MULTI_RESULT
  *                                    and large packets (> 16MB)
  *
+ * With the stream parameter the rows are sent to the client as they arrive.
+ * When a limit is hit the result set is terminated with an EOF or an ERR packet
+ * and the rest of the response is discarded.
+ *
  * @endverbatim
  */
 
@@ -146,6 +150,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_ENUM_UNIQUE,
                 return_option_values
             },
+            {
+                "stream",
+                MXS_MODULE_PARAM_BOOL,
+                "false"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -161,6 +170,7 @@ typedef struct maxrows_config
     uint32_t        max_resultset_size;
     uint32_t                     debug;
     enum maxrows_return_mode  m_return;
+    bool                        stream;
 } MAXROWS_CONFIG;
 
 typedef struct maxrows_instance
@@ -202,6 +212,7 @@ typedef struct maxrows_session_data
     bool                    large_packet;      /**< Large packet (> 16MB)) indicator */
     bool                    discard_resultset; /**< Discard resultset indicator */
     GWBUF                   *input_sql;        /**< Input query */
+    size_t                  streamed;          /**< Bytes of the response sent in streaming mode */
 } MAXROWS_SESSION_DATA;
 
 static MAXROWS_SESSION_DATA *maxrows_session_data_create(MAXROWS_INSTANCE *instance,
@@ -221,6 +232,10 @@ static int send_upstream(MAXROWS_SESSION_DATA *csdata);
 static int send_eof_upstream(MAXROWS_SESSION_DATA *csdata);
 static int send_error_upstream(MAXROWS_SESSION_DATA *csdata);
 static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata);
+static GWBUF *create_error_packet(MAXROWS_SESSION_DATA *csdata, uint8_t seq);
+static bool stream_limit_reached(MAXROWS_SESSION_DATA *csdata, size_t packetlen);
+static int stream_forward(MAXROWS_SESSION_DATA *csdata);
+static int stream_truncate(MAXROWS_SESSION_DATA *csdata, uint8_t seq);
 
 /* API BEGIN */
 
@@ -251,6 +266,7 @@ static MXS_FILTER *createInstance(const char *name,
                                                      "max_resultset_return",
                                                      return_option_values);
         cinstance->config.debug = config_get_integer(params, "debug");
+        cinstance->config.stream = config_get_bool(params, "stream");
     }
 
     return (MXS_FILTER*)cinstance;
@@ -354,6 +370,7 @@ static int routeQuery(MXS_FILTER *instance,
     csdata->state = MAXROWS_IGNORING_RESPONSE;
     csdata->large_packet = false;
     csdata->discard_resultset = false;
+    csdata->streamed = 0;
     // Set buffer size to 0
     csdata->res.length = 0;
 
@@ -424,7 +441,8 @@ static int clientReply(MXS_FILTER *instance,
         csdata->res.length = gwbuf_length(data);
     }
 
-    if (csdata->state != MAXROWS_IGNORING_RESPONSE)
+    /* In streaming mode the size is checked for each row in handle_rows() */
+    if (csdata->state != MAXROWS_IGNORING_RESPONSE && !csdata->instance->config.stream)
     {
         if (!csdata->discard_resultset)
         {
@@ -474,6 +492,12 @@ static int clientReply(MXS_FILTER *instance,
         csdata->state = MAXROWS_IGNORING_RESPONSE;
     }
 
+    if (csdata->instance->config.stream && rv)
+    {
+        /* Send or discard the packets that have been processed */
+        rv = stream_forward(csdata);
+    }
+
     return rv;
 }
 
@@ -609,6 +633,8 @@ static int handle_expecting_fields(MAXROWS_SESSION_DATA *csdata)
 
                 csdata->state = MAXROWS_EXPECTING_ROWS;
                 rv = handle_rows(csdata);
+                // All complete packets have been processed by handle_rows()
+                insufficient = true;
                 break;
 
             default: // Field information.
@@ -814,6 +840,12 @@ static int handle_rows(MAXROWS_SESSION_DATA *csdata)
              */
             if (packetlen == (MYSQL_PACKET_LENGTH_MAX + MYSQL_HEADER_LEN))
             {
+                if (!pending_large_data && stream_limit_reached(csdata, packetlen))
+                {
+                    rv = stream_truncate(csdata, header[3]);
+                    buflen = csdata->res.length;
+                }
+
                 // Mark the beginning of a large packet receiving
                 csdata->large_packet = true;
                 // Just update offset and break
@@ -831,6 +863,17 @@ static int handle_rows(MAXROWS_SESSION_DATA *csdata)
             // We have at least one complete packet and we can process the command byte.
             int command = (int)MYSQL_GET_COMMAND(header);
 
+            /*
+             * In streaming mode the limits are checked when a row starts: the rows
+             * before it have been or will be sent and the result set is cut here.
+             */
+            if (!pending_large_data && command != 0xff && command != 0xfe &&
+                stream_limit_reached(csdata, packetlen))
+            {
+                rv = stream_truncate(csdata, header[3]);
+                buflen = csdata->res.length;
+            }
+
             switch (command)
             {
             case 0xff: // ERR packet after the rows.
@@ -1134,6 +1177,46 @@ static int send_ok_upstream(MAXROWS_SESSION_DATA *csdata)
  * @return            Non-Zero if successful, 0 on errors
  */
 static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
+{
+    ss_dassert(csdata->res.data != NULL);
+
+    GWBUF *err_pkt = create_error_packet(csdata, 1);
+
+    if (err_pkt == NULL)
+    {
+        /* Abort client connection */
+        poll_fake_hangup_event(csdata->session->client_dcb);
+        gwbuf_free(csdata->res.data);
+        gwbuf_free(csdata->input_sql);
+        csdata->res.data = NULL;
+        csdata->input_sql = NULL;
+
+        return 0;
+    }
+
+    int rv = csdata->up.clientReply(csdata->up.instance,
+                                    csdata->up.session,
+                                    err_pkt);
+
+    /* Free server result buffer */
+    gwbuf_free(csdata->res.data);
+    /* Free input_sql buffer */
+    gwbuf_free(csdata->input_sql);
+
+    csdata->res.data = NULL;
+    csdata->input_sql = NULL;
+
+    return rv;
+}
+
+/**
+ * Create the ERR packet that is sent when the maxrows limit/size is hit.
+ *
+ * @param   csdata    Session data with the input SQL
+ * @param   seq       Sequence number of the packet
+ * @return            The packet or NULL on errors
+ */
+static GWBUF *create_error_packet(MAXROWS_SESSION_DATA *csdata, uint8_t seq)
 {
     GWBUF *err_pkt;
     uint8_t hdr_err[MYSQL_ERR_PACKET_MIN_LEN];
@@ -1151,8 +1234,6 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
               MAXROWS_INPUT_SQL_MAX_LEN : sql_len;
     uint8_t sql[sql_len];
 
-    ss_dassert(csdata->res.data != NULL);
-
     pkt_len += sql_len;
 
     bytes_copied = gwbuf_copy_data(csdata->input_sql,
@@ -1163,14 +1244,7 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
     if (!bytes_copied ||
         (err_pkt = gwbuf_alloc(MYSQL_HEADER_LEN + pkt_len)) == NULL)
     {
-        /* Abort client connection */
-        poll_fake_hangup_event(csdata->session->client_dcb);
-        gwbuf_free(csdata->res.data);
-        gwbuf_free(csdata->input_sql);
-        csdata->res.data = NULL;
-        csdata->input_sql = NULL;
-
-        return 0;
+        return NULL;
     }
 
     uint8_t *ptr = GWBUF_DATA(err_pkt);
@@ -1180,8 +1254,7 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
 
     /* Set the payload length of the whole error message */
     gw_mysql_set_byte3(&ptr[0], pkt_len);
-    /* Note: sequence id is always 01 (4th byte) */
-    ptr[3] = 1;
+    ptr[3] = seq;
     /* Error indicator */
     ptr[4] = 0xff;
     /* MySQL error code: 2 bytes */
@@ -1193,19 +1266,7 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
     /* Copy SQL input */
     memcpy(&ptr[13 +  err_prefix_len], sql, sql_len);
 
-    int rv = csdata->up.clientReply(csdata->up.instance,
-                                    csdata->up.session,
-                                    err_pkt);
-
-    /* Free server result buffer */
-    gwbuf_free(csdata->res.data);
-    /* Free input_sql buffer */
-    gwbuf_free(csdata->input_sql);
-
-    csdata->res.data = NULL;
-    csdata->input_sql = NULL;
-
-    return rv;
+    return err_pkt;
 }
 
 /**
@@ -1217,6 +1278,19 @@ static int send_error_upstream(MAXROWS_SESSION_DATA *csdata)
  */
 static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata)
 {
+    if (csdata->instance->config.stream)
+    {
+        if (!csdata->discard_resultset)
+        {
+            return send_upstream(csdata);
+        }
+
+        /* The client already got the terminating packet: drop the rest */
+        gwbuf_free(csdata->res.data);
+        csdata->res.data = NULL;
+        return 1;
+    }
+
     switch(csdata->instance->config.m_return)
     {
         case MAXROWS_RETURN_EMPTY:
@@ -1235,3 +1309,126 @@ static int send_maxrows_reply_limit(MAXROWS_SESSION_DATA *csdata)
             break;
     }
 }
+
+/**
+ * Check whether a row starting at the current offset would exceed the limits
+ * of a streamed result set.
+ *
+ * @param   csdata    Session data
+ * @param   packetlen Length of the first packet of the row
+ * @return            True if the result set must be terminated before the row
+ */
+static bool stream_limit_reached(MAXROWS_SESSION_DATA *csdata, size_t packetlen)
+{
+    if (!csdata->instance->config.stream || csdata->discard_resultset)
+    {
+        return false;
+    }
+
+    size_t size = csdata->streamed + csdata->res.offset + packetlen;
+    bool rval = csdata->res.n_rows >= csdata->instance->config.max_resultset_rows ||
+                size > csdata->instance->config.max_resultset_size;
+
+    if (rval && (csdata->instance->config.debug & MAXROWS_DEBUG_DISCARDING))
+    {
+        MXS_NOTICE("Limit reached with %lu rows and %luB, terminating the streamed resultset.",
+                   csdata->res.n_rows, size);
+    }
+
+    return rval;
+}
+
+/**
+ * Send the processed part of the response to the client in streaming mode.
+ *
+ * The packets before the current offset are sent upstream, or freed if the
+ * result set was already terminated, and only the incomplete packet at the
+ * end of the buffer is kept.
+ *
+ * @param   csdata    Session data
+ * @return            Non-Zero if successful, 0 on errors
+ */
+static int stream_forward(MAXROWS_SESSION_DATA *csdata)
+{
+    int rv = 1;
+    size_t len = csdata->res.offset;
+
+    if (csdata->res.data && len > 0)
+    {
+        if (csdata->discard_resultset)
+        {
+            csdata->res.data = gwbuf_consume(csdata->res.data, len);
+        }
+        else
+        {
+            GWBUF *head = gwbuf_split(&csdata->res.data, len);
+
+            if (head == NULL)
+            {
+                /* Abort client connection */
+                poll_fake_hangup_event(csdata->session->client_dcb);
+                return 0;
+            }
+
+            csdata->streamed += len;
+            rv = csdata->up.clientReply(csdata->up.instance,
+                                        csdata->up.session,
+                                        head);
+        }
+
+        csdata->res.length -= len;
+        csdata->res.offset = 0;
+        csdata->res.rows_offset = 0;
+    }
+
+    return rv;
+}
+
+/**
+ * Terminate a streamed result set when a limit is hit.
+ *
+ * The rows before the current offset are sent and they are followed by an
+ * EOF packet, or an ERR packet if max_resultset_return is error. The rest of
+ * the response is discarded when it arrives.
+ *
+ * @param   csdata    Session data
+ * @param   seq       Sequence number of the first packet that is not sent
+ * @return            Non-Zero if successful, 0 on errors
+ */
+static int stream_truncate(MAXROWS_SESSION_DATA *csdata, uint8_t seq)
+{
+    int rv = stream_forward(csdata);
+
+    if (rv)
+    {
+        GWBUF *packet;
+
+        if (csdata->instance->config.m_return == MAXROWS_RETURN_ERR)
+        {
+            packet = create_error_packet(csdata, seq);
+        }
+        else
+        {
+            uint8_t eof[MYSQL_EOF_PACKET_LEN] = {05, 00, 00, 00, 0xfe, 00, 00, 02, 00};
+            eof[3] = seq;
+            packet = gwbuf_alloc_and_load(MYSQL_EOF_PACKET_LEN, eof);
+        }
+
+        if (packet)
+        {
+            rv = csdata->up.clientReply(csdata->up.instance,
+                                        csdata->up.session,
+                                        packet);
+        }
+        else
+        {
+            /* Abort client connection */
+            poll_fake_hangup_event(csdata->session->client_dcb);
+            rv = 0;
+        }
+    }
+
+    csdata->discard_resultset = true;
+
+    return rv;
+}
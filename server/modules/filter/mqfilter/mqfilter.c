@@ -27,6 +27,11 @@
  * To use a SSL connection the CA certificate, the client certificate and the client public
  * key must be provided.
  * By default this filter uses a TCP connection.
+ *
+ * The worker threads only queue the messages. A publisher thread sends them to the
+ * server in batches and handles the reconnections, so a slow or unavailable server
+ * does not delay the clients. When the queue of a worker thread is full, new messages
+ * are dropped.
  *@verbatim
  * The options for this filter are:
  *
@@ -46,6 +51,7 @@
  *      ssl_CA_cert     Path to the CA certificate in PEM format
  *      ssl_client_cert Path to the client cerificate in PEM format
  *      ssl_client_key  Path to the client public key in PEM format
+ *      confirm         Wait for the server to confirm each batch of messages
  *
  * The logging trigger levels are:
  *      all     Log everything
@@ -61,6 +67,8 @@
 
 #include <stdio.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <maxscale/config.h>
 #include <maxscale/filter.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
@@ -77,11 +85,23 @@
 #include <maxscale/query_classifier.h>
 #include <maxscale/spinlock.h>
 #include <maxscale/session.h>
-#include <maxscale/housekeeper.h>
 #include <maxscale/alloc.h>
+#include <maxscale/poll.h>
+#include <maxscale/thread.h>
+
+/** Number of messages each worker thread can have waiting for the publisher */
+#define MQ_QUEUE_SIZE 4096
+
+/** How many messages the publisher sends before waiting for the confirmations */
+#define MQ_PUBLISH_BATCH 256
+
+/** How long the publisher sleeps when there is nothing to send, in microseconds */
+#define MQ_PUBLISHER_IDLE_SLEEP 10000
+
+/** How long the publisher waits for the confirmations of a batch, in seconds */
+#define MQ_CONFIRM_TIMEOUT 5
 
 static int uid_gen;
-static int hktask_id = 0;
 /*
  * The filter entry points
  */
@@ -106,6 +126,19 @@ typedef struct mqmessage_t
     struct mqmessage_t *next;
 } mqmessage;
 
+/**
+ * The messages of one worker thread. Only the worker adds messages and only
+ * the publisher thread removes them, so the queue needs no locking. The
+ * threads that are not workers share one more queue and take turns adding
+ * messages to it.
+ */
+typedef struct
+{
+    int head;  /**Next message the publisher takes, changed by the publisher*/
+    int tail;  /**Next free slot, changed by the worker*/
+    mqmessage messages[MQ_QUEUE_SIZE];
+} MQ_QUEUE;
+
 /**
  *Logging trigger levels
  */
@@ -173,6 +206,8 @@ typedef struct mqstats_t
     int n_msg; /*< Total number of messages */
     int n_sent; /*< Number of sent messages */
     int n_queued; /*< Number of unsent messages */
+    int n_dropped; /*< Number of messages dropped because a queue was full */
+    int n_rejected; /*< Number of messages the server did not confirm */
 } MQSTATS;
 
 /**
@@ -209,8 +244,12 @@ typedef struct
     int rconn_intv; /**delay for reconnects, in seconds*/
     time_t last_rconn; /**last reconnect attempt*/
     SPINLOCK rconn_lock;
-    SPINLOCK msg_lock;
-    mqmessage* messages;
+    bool confirm; /**Whether publisher confirms are used*/
+    uint64_t delivery_tag; /**Tag of the last message published on the channel*/
+    THREAD publisher; /**The thread that publishes the messages*/
+    int n_queues; /**Number of worker threads plus the shared queue*/
+    MQ_QUEUE* queues; /**The messages of each worker thread, the last queue is shared*/
+    SPINLOCK shared_lock; /**Serializes adding to the shared queue*/
     enum log_trigger_t trgtype;
     SRC_TRIG* src_trg;
     SHM_TRIG* shm_trg;
@@ -237,7 +276,7 @@ typedef struct
     bool was_query; /**True if the previous routeQuery call had valid content*/
 } MQ_SESSION;
 
-void sendMessage(void* data);
+static void publisher_main(void* data);
 
 static const MXS_ENUM_VALUE trigger_values[] =
 {
@@ -305,6 +344,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"logging_object", MXS_MODULE_PARAM_STRING},
             {"logging_log_all", MXS_MODULE_PARAM_BOOL, "false"},
             {"logging_strict", MXS_MODULE_PARAM_BOOL, "true"},
+            {"confirm", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -384,6 +424,20 @@ init_conn(MQ_INSTANCE *my_instance)
         goto cleanup;
     }
 
+    /** The delivery tags of the confirmations start from one on each channel */
+    my_instance->delivery_tag = 0;
+
+    if (my_instance->confirm)
+    {
+        amqp_confirm_select(my_instance->conn, my_instance->channel);
+        reply = amqp_get_rpc_reply(my_instance->conn);
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+        {
+            MXS_ERROR("Failed to enable publisher confirms.");
+            goto cleanup;
+        }
+    }
+
     amqp_exchange_declare(my_instance->conn, my_instance->channel,
                           amqp_cstring_bytes(my_instance->exchange),
                           amqp_cstring_bytes(my_instance->exchange_type),
@@ -525,11 +579,19 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
     if (my_instance)
     {
         spinlock_init(&my_instance->rconn_lock);
-        spinlock_init(&my_instance->msg_lock);
         uid_gen = 0;
+        spinlock_init(&my_instance->shared_lock);
+        my_instance->n_queues = config_threadcount() + 1;
+
+        if ((my_instance->queues = MXS_CALLOC(my_instance->n_queues, sizeof(MQ_QUEUE))) == NULL)
+        {
+            MXS_FREE(my_instance);
+            return NULL;
+        }
 
         if ((my_instance->conn = amqp_new_connection()) == NULL)
         {
+            MXS_FREE(my_instance->queues);
             MXS_FREE(my_instance);
             return NULL;
         }
@@ -543,6 +605,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->trgtype = config_get_enum(params, "logging_trigger", trigger_values);
         my_instance->log_all = config_get_bool(params, "logging_log_all");
         my_instance->strict_logging = config_get_bool(params, "logging_strict");
+        my_instance->confirm = config_get_bool(params, "confirm");
         my_instance->hostname = MXS_STRDUP_A(config_get_string(params, "hostname"));
         my_instance->username = MXS_STRDUP_A(config_get_string(params, "username"));
         my_instance->password = MXS_STRDUP_A(config_get_string(params, "password"));
@@ -612,11 +675,19 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         }
 
         /**Connect to the server*/
-        init_conn(my_instance);
+        if (!init_conn(my_instance))
+        {
+            my_instance->conn_stat = AMQP_STATUS_SOCKET_ERROR;
+        }
 
-        char taskname[512];
-        snprintf(taskname, 511, "mqtask%d", atomic_add(&hktask_id, 1));
-        hktask_add(taskname, sendMessage, (void*)my_instance, 5);
+        if (thread_start(&my_instance->publisher, publisher_main, my_instance) == NULL)
+        {
+            MXS_ERROR("Failed to start the message publisher thread.");
+            amqp_destroy_connection(my_instance->conn);
+            MXS_FREE(my_instance->queues);
+            MXS_FREE(my_instance);
+            return NULL;
+        }
     }
 
     return (MXS_FILTER *)my_instance;
@@ -665,131 +736,301 @@ int declareQueue(MQ_INSTANCE *my_instance, MQ_SESSION* my_session, char* qname)
 }
 
 /**
- * Broadcasts a message on the message stack to the RabbitMQ server
- * and frees the allocated memory if successful. This function is only called by
- * the housekeeper thread.
- * @param data MQfilter instance
+ * Take the oldest message from a queue
+ *
+ * @param queue The queue
+ * @param msg   The message is stored here
+ * @return True if a message was taken, false if the queue was empty
  */
-void sendMessage(void* data)
+static bool queue_pop(MQ_QUEUE *queue, mqmessage *msg)
 {
-    MQ_INSTANCE *instance = (MQ_INSTANCE*) data;
-    mqmessage *tmp;
-    int err_num = AMQP_STATUS_OK;
+    int head = queue->head;
 
-    spinlock_acquire(&instance->rconn_lock);
-    if (instance->conn_stat != AMQP_STATUS_OK)
+    if (head == atomic_load_int32(&queue->tail))
     {
-        if (difftime(time(NULL), instance->last_rconn) > instance->rconn_intv)
+        return false;
+    }
+
+    *msg = queue->messages[head];
+    atomic_store_int32(&queue->head, (head + 1) % MQ_QUEUE_SIZE);
+    return true;
+}
+
+static void free_message(mqmessage *msg)
+{
+    MXS_FREE(msg->prop);
+    MXS_FREE(msg->msg);
+}
+
+/**
+ * Reconnect to the server if the connection has failed. The delay between
+ * the attempts grows while the server cannot be reached.
+ *
+ * @param instance MQfilter instance
+ * @return True if the connection is usable
+ */
+static bool check_connection(MQ_INSTANCE *instance)
+{
+    if (instance->conn_stat != AMQP_STATUS_OK &&
+        difftime(time(NULL), instance->last_rconn) > instance->rconn_intv)
+    {
+        instance->last_rconn = time(NULL);
+
+        if (init_conn(instance))
+        {
+            instance->rconn_intv = 1.0;
+            instance->conn_stat = AMQP_STATUS_OK;
+        }
+        else
+        {
+            instance->rconn_intv += 5.0;
+            MXS_ERROR("Failed to reconnect to the MQRabbit server ");
+        }
+    }
+
+    return instance->conn_stat == AMQP_STATUS_OK;
+}
+
+/**
+ * Wait until the server has confirmed the published messages
+ *
+ * @param instance MQfilter instance
+ * @param first    Delivery tag of the first message of the batch
+ * @param n        Number of messages in the batch
+ * @return Number of messages the server rejected or -1 if the confirmations
+ *         were not received
+ */
+static int wait_confirms(MQ_INSTANCE *instance, uint64_t first, int n)
+{
+    bool done[MQ_PUBLISH_BATCH] = {false};
+    int n_done = 0;
+    int n_nack = 0;
+
+    while (n_done < n)
+    {
+        amqp_frame_t frame;
+        struct timeval tv = {MQ_CONFIRM_TIMEOUT, 0};
+        int rc = amqp_simple_wait_frame_noblock(instance->conn, &frame, &tv);
+
+        if (rc != AMQP_STATUS_OK)
         {
-            instance->last_rconn = time(NULL);
+            MXS_ERROR("Failed to receive publisher confirms: %s", amqp_error_string2(rc));
+            instance->conn_stat = rc;
+            return -1;
+        }
 
-            if (init_conn(instance))
-            {
-                instance->rconn_intv = 1.0;
-                instance->conn_stat = AMQP_STATUS_OK;
-            }
-            else
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+        {
+            continue;
+        }
+
+        uint64_t tag;
+        bool multiple;
+        bool nack = false;
+
+        switch (frame.payload.method.id)
+        {
+        case AMQP_BASIC_ACK_METHOD:
+            tag = ((amqp_basic_ack_t*)frame.payload.method.decoded)->delivery_tag;
+            multiple = ((amqp_basic_ack_t*)frame.payload.method.decoded)->multiple;
+            break;
+
+        case AMQP_BASIC_NACK_METHOD:
+            tag = ((amqp_basic_nack_t*)frame.payload.method.decoded)->delivery_tag;
+            multiple = ((amqp_basic_nack_t*)frame.payload.method.decoded)->multiple;
+            nack = true;
+            break;
+
+        case AMQP_CHANNEL_CLOSE_METHOD:
+        case AMQP_CONNECTION_CLOSE_METHOD:
+            MXS_ERROR("The server closed the connection while confirming messages.");
+            instance->conn_stat = AMQP_STATUS_CONNECTION_CLOSED;
+            return -1;
+
+        default:
+            continue;
+        }
+
+        if (tag < first || tag >= first + n)
+        {
+            continue;
+        }
+
+        for (uint64_t i = multiple ? 0 : tag - first; i <= tag - first; i++)
+        {
+            if (!done[i])
             {
-                instance->rconn_intv += 5.0;
-                MXS_ERROR("Failed to reconnect to the MQRabbit server ");
+                done[i] = true;
+                n_done++;
+                n_nack += nack;
             }
         }
-        err_num = instance->conn_stat;
     }
-    spinlock_release(&instance->rconn_lock);
 
-    if (err_num != AMQP_STATUS_OK)
+    return n_nack;
+}
+
+/**
+ * Publish a batch of messages
+ *
+ * @param instance MQfilter instance
+ * @param batch    The messages
+ * @param n        Number of messages
+ * @return Number of messages that were published, the unpublished ones are
+ *         left at the start of the batch
+ */
+static int publish_batch(MQ_INSTANCE *instance, mqmessage *batch, int n)
+{
+    uint64_t first = instance->delivery_tag + 1;
+    int n_published = 0;
+
+    spinlock_acquire(&instance->rconn_lock);
+
+    while (n_published < n)
     {
-        /** No connection to the broker */
-        return;
+        int err_num = amqp_basic_publish(instance->conn, instance->channel,
+                                         amqp_cstring_bytes(instance->exchange),
+                                         amqp_cstring_bytes(instance->key),
+                                         0, 0, batch[n_published].prop,
+                                         amqp_cstring_bytes(batch[n_published].msg));
+
+        if (err_num != AMQP_STATUS_OK)
+        {
+            instance->conn_stat = err_num;
+            break;
+        }
+
+        instance->delivery_tag++;
+        n_published++;
     }
 
-    spinlock_acquire(&instance->msg_lock);
-    tmp = instance->messages;
+    int n_rejected = 0;
 
-    if (tmp == NULL)
+    if (instance->confirm && n_published > 0 &&
+        (n_rejected = wait_confirms(instance, first, n_published)) == -1)
     {
-        spinlock_release(&instance->msg_lock);
-        return;
+        /** Without the confirmations the whole batch is sent again */
+        n_published = 0;
+        n_rejected = 0;
     }
 
-    instance->messages = instance->messages->next;
-    spinlock_release(&instance->msg_lock);
+    amqp_maybe_release_buffers(instance->conn);
+    spinlock_release(&instance->rconn_lock);
 
-    while (tmp)
+    if (n_rejected > 0)
     {
-        err_num = amqp_basic_publish(instance->conn, instance->channel,
-                                     amqp_cstring_bytes(instance->exchange),
-                                     amqp_cstring_bytes(instance->key),
-                                     0, 0, tmp->prop, amqp_cstring_bytes(tmp->msg));
+        MXS_ERROR("The server rejected %d messages.", n_rejected);
+        atomic_add(&instance->stats.n_rejected, n_rejected);
+    }
 
-        spinlock_acquire(&instance->rconn_lock);
-        instance->conn_stat = err_num;
-        spinlock_release(&instance->rconn_lock);
+    for (int i = 0; i < n_published; i++)
+    {
+        free_message(&batch[i]);
+    }
 
-        if (err_num == AMQP_STATUS_OK)
-        {
-            /**Message was sent successfully*/
-            MXS_FREE(tmp->prop);
-            MXS_FREE(tmp->msg);
-            MXS_FREE(tmp);
+    memmove(batch, batch + n_published, (n - n_published) * sizeof(mqmessage));
+
+    atomic_add(&instance->stats.n_sent, n_published - n_rejected);
+    atomic_add(&instance->stats.n_queued, -n_published);
 
-            atomic_add(&instance->stats.n_sent, 1);
-            atomic_add(&instance->stats.n_queued, -1);
-            spinlock_acquire(&instance->msg_lock);
-            tmp = instance->messages;
+    return n_published;
+}
 
-            if (tmp == NULL)
+/**
+ * The publisher thread. The messages are taken from the queues of the worker
+ * threads in their original order and published in batches.
+ *
+ * @param data MQfilter instance
+ */
+static void publisher_main(void* data)
+{
+    MQ_INSTANCE *instance = (MQ_INSTANCE*) data;
+    mqmessage batch[MQ_PUBLISH_BATCH];
+    int n = 0;
+
+    while (true)
+    {
+        bool idle = true;
+
+        if (check_connection(instance))
+        {
+            for (int i = 0; i < instance->n_queues; i++)
             {
-                spinlock_release(&instance->msg_lock);
-                return;
-            }
+                while (n < MQ_PUBLISH_BATCH && queue_pop(&instance->queues[i], &batch[n]))
+                {
+                    n++;
+                }
 
-            instance->messages = instance->messages->next;
-            spinlock_release(&instance->msg_lock);
+                if (n == MQ_PUBLISH_BATCH || (i == instance->n_queues - 1 && n > 0))
+                {
+                    int n_published = publish_batch(instance, batch, n);
+                    idle = idle && n_published == 0;
+                    n -= n_published;
+
+                    if (n_published == 0)
+                    {
+                        /** The connection failed, wait for the reconnection */
+                        break;
+                    }
+                }
+            }
         }
-        else
+
+        if (idle)
         {
-            spinlock_acquire(&instance->msg_lock);
-            tmp->next = instance->messages;
-            instance->messages = tmp;
-            spinlock_release(&instance->msg_lock);
-            return;
+            usleep(MQ_PUBLISHER_IDLE_SLEEP);
         }
     }
 }
 
 /**
- * Push a new message on the stack to be broadcasted later.
+ * Queue a new message to be published by the publisher thread.
  * The message assumes ownership of the memory allocated to the message content and properties.
+ * If the queue of the thread is full, the message is dropped.
  * @param prop Message properties
  * @param msg Message content
  */
 void pushMessage(MQ_INSTANCE *instance, amqp_basic_properties_t* prop, char* msg)
 {
+    int thread_id = poll_current_worker();
+    bool shared = thread_id == -1 || thread_id >= instance->n_queues - 1;
+    MQ_QUEUE *queue = &instance->queues[shared ? instance->n_queues - 1 : thread_id];
+    bool queued = false;
 
-    mqmessage* newmsg = MXS_CALLOC(1, sizeof(mqmessage));
-    if (newmsg)
+    atomic_add(&instance->stats.n_msg, 1);
+
+    if (shared)
+    {
+        spinlock_acquire(&instance->shared_lock);
+    }
+
+    int tail = queue->tail;
+    int next = (tail + 1) % MQ_QUEUE_SIZE;
+
+    if (next != atomic_load_int32(&queue->head))
+    {
+        queue->messages[tail].prop = prop;
+        queue->messages[tail].msg = msg;
+        queue->messages[tail].next = NULL;
+        atomic_store_int32(&queue->tail, next);
+        queued = true;
+    }
+
+    if (shared)
     {
-        newmsg->msg = msg;
-        newmsg->prop = prop;
+        spinlock_release(&instance->shared_lock);
+    }
+
+    if (queued)
+    {
+        atomic_add(&instance->stats.n_queued, 1);
     }
     else
     {
+        atomic_add(&instance->stats.n_dropped, 1);
         MXS_FREE(prop);
         MXS_FREE(msg);
-        return;
     }
-
-    spinlock_acquire(&instance->msg_lock);
-
-    newmsg->next = instance->messages;
-    instance->messages = newmsg;
-
-    spinlock_release(&instance->msg_lock);
-
-    atomic_add(&instance->stats.n_msg, 1);
-    atomic_add(&instance->stats.n_queued, 1);
 }
 
 /**
@@ -1495,12 +1736,14 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
                    my_instance->vhost, my_instance->exchange,
                    my_instance->key, my_instance->queue
                   );
-        dcb_printf(dcb, "%-16s%-16s%-16s\n",
-                   "Messages", "Queued", "Sent");
-        dcb_printf(dcb, "%-16d%-16d%-16d\n",
+        dcb_printf(dcb, "%-16s%-16s%-16s%-16s%-16s\n",
+                   "Messages", "Queued", "Sent", "Dropped", "Rejected");
+        dcb_printf(dcb, "%-16d%-16d%-16d%-16d%-16d\n",
                    my_instance->stats.n_msg,
                    my_instance->stats.n_queued,
-                   my_instance->stats.n_sent);
+                   my_instance->stats.n_sent,
+                   my_instance->stats.n_dropped,
+                   my_instance->stats.n_rejected);
     }
 }
 
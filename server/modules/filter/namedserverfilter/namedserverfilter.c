@@ -14,7 +14,9 @@
 #define MXS_MODULE_NAME "namedserverfilter"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <maxscale/alloc.h>
+#include <maxscale/config.h>
 #include <maxscale/filter.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
@@ -24,6 +26,8 @@
 #include <maxscale/hint.h>
 #include <maxscale/alloc.h>
 #include <maxscale/utils.h>
+#include <maxscale/pcre2.h>
+#include <maxscale/poll.h>
 #include <netdb.h>
 
 /**
@@ -39,6 +43,10 @@
  *      source=<source address to limit filter>
  *      user=<username to limit filter>
  *
+ * Up to REGEXHINT_MAX_RULES further PCRE2 patterns and their servers can be
+ * defined with the matchXX and targetXX parameters. They are compiled into one
+ * pattern so that a query is matched against all of them at once.
+ *
  * Date         Who             Description
  * 22/01/2015   Mark Riddoch    Written as example based on regex filter
  * @endverbatim
@@ -53,6 +61,9 @@ static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
+/** Maximum number of matchXX and targetXX parameter pairs */
+#define REGEXHINT_MAX_RULES 25
+
 typedef struct source_host
 {
     char *address;
@@ -70,6 +81,14 @@ typedef struct
     char *match; /* Regular expression to match */
     char *server; /* Server to route to */
     regex_t re; /* Compiled regex text */
+    int n_rules; /* Number of matchXX and targetXX pairs */
+    char *rule_match[REGEXHINT_MAX_RULES]; /* The patterns of the pairs */
+    char *rule_target[REGEXHINT_MAX_RULES]; /* The servers of the pairs */
+    pcre2_code *rules; /* All patterns of the pairs compiled into one */
+    int n_threads; /* Number of worker threads */
+    pcre2_match_data **match_data; /* Matching data of each worker thread */
+    pcre2_match_data *shared_match_data; /* Matching data of the other threads */
+    SPINLOCK shared_lock; /* Protects shared_match_data */
 } REGEXHINT_INSTANCE;
 
 static bool validate_ip_address(const char *);
@@ -98,6 +117,10 @@ static const MXS_ENUM_VALUE option_values[] =
     {NULL}
 };
 
+#define REGEXHINT_RULE_PARAMS(n) \
+    {"match" #n, MXS_MODULE_PARAM_STRING}, \
+    {"target" #n, MXS_MODULE_PARAM_SERVER}
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -136,8 +159,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         {
-            {"match", MXS_MODULE_PARAM_STRING, NULL, MXS_MODULE_OPT_REQUIRED},
-            {"server", MXS_MODULE_PARAM_SERVER, NULL, MXS_MODULE_OPT_REQUIRED},
+            {"match", MXS_MODULE_PARAM_STRING},
+            {"server", MXS_MODULE_PARAM_SERVER},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
             {
@@ -147,6 +170,15 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 option_values
             },
+            REGEXHINT_RULE_PARAMS(01), REGEXHINT_RULE_PARAMS(02), REGEXHINT_RULE_PARAMS(03),
+            REGEXHINT_RULE_PARAMS(04), REGEXHINT_RULE_PARAMS(05), REGEXHINT_RULE_PARAMS(06),
+            REGEXHINT_RULE_PARAMS(07), REGEXHINT_RULE_PARAMS(08), REGEXHINT_RULE_PARAMS(09),
+            REGEXHINT_RULE_PARAMS(10), REGEXHINT_RULE_PARAMS(11), REGEXHINT_RULE_PARAMS(12),
+            REGEXHINT_RULE_PARAMS(13), REGEXHINT_RULE_PARAMS(14), REGEXHINT_RULE_PARAMS(15),
+            REGEXHINT_RULE_PARAMS(16), REGEXHINT_RULE_PARAMS(17), REGEXHINT_RULE_PARAMS(18),
+            REGEXHINT_RULE_PARAMS(19), REGEXHINT_RULE_PARAMS(20), REGEXHINT_RULE_PARAMS(21),
+            REGEXHINT_RULE_PARAMS(22), REGEXHINT_RULE_PARAMS(23), REGEXHINT_RULE_PARAMS(24),
+            REGEXHINT_RULE_PARAMS(25),
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -154,6 +186,190 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+/**
+ * Read the matchXX and targetXX parameters and compile the patterns into one
+ *
+ * Each pattern is an alternative of the combined pattern and marks the number of
+ * its pair with (*MARK), which tells the pair that matched.
+ *
+ * @param instance The filter instance
+ * @param params   The configuration parameters
+ * @param caseless Whether the matching ignores case
+ * @return True if the parameters were valid
+ */
+static bool compile_rules(REGEXHINT_INSTANCE *instance, MXS_CONFIG_PARAMETER *params, bool caseless)
+{
+    size_t len = 1;
+    int errcode;
+    PCRE2_SIZE erroffset;
+
+    for (int i = 0; i < REGEXHINT_MAX_RULES; i++)
+    {
+        char match[sizeof("match00")];
+        char target[sizeof("target00")];
+        snprintf(match, sizeof(match), "match%02d", i + 1);
+        snprintf(target, sizeof(target), "target%02d", i + 1);
+
+        const char *pattern = config_get_string(params, match);
+        const char *server = config_get_string(params, target);
+
+        if (*pattern == '\0' && *server == '\0')
+        {
+            continue;
+        }
+        else if (*pattern == '\0' || *server == '\0')
+        {
+            MXS_ERROR("Both '%s' and '%s' must be defined.", match, target);
+            return false;
+        }
+
+        /** Check the pattern alone so that its errors are reported clearly */
+        pcre2_code *code = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED,
+                                         caseless ? PCRE2_CASELESS : 0,
+                                         &errcode, &erroffset, NULL);
+
+        if (code == NULL)
+        {
+            PCRE2_UCHAR errorbuf[120];
+            pcre2_get_error_message(errcode, errorbuf, sizeof(errorbuf));
+            MXS_ERROR("Invalid regular expression '%s' in '%s' at offset %lu: %s",
+                      pattern, match, (unsigned long)erroffset, errorbuf);
+            return false;
+        }
+
+        pcre2_code_free(code);
+
+        instance->rule_match[instance->n_rules] = MXS_STRDUP_A(pattern);
+        instance->rule_target[instance->n_rules] = MXS_STRDUP_A(server);
+        instance->n_rules++;
+        len += strlen(pattern) + sizeof("|(?:)(*MARK:00)");
+    }
+
+    if (instance->n_rules == 0)
+    {
+        return true;
+    }
+
+    char combined[len];
+    char *ptr = combined;
+
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        ptr += sprintf(ptr, "%s(?:%s)(*MARK:%d)", i ? "|" : "", instance->rule_match[i], i);
+    }
+
+    instance->rules = pcre2_compile((PCRE2_SPTR)combined, PCRE2_ZERO_TERMINATED,
+                                    caseless ? PCRE2_CASELESS : 0,
+                                    &errcode, &erroffset, NULL);
+
+    if (instance->rules == NULL)
+    {
+        PCRE2_UCHAR errorbuf[120];
+        pcre2_get_error_message(errcode, errorbuf, sizeof(errorbuf));
+        MXS_ERROR("Failed to combine the matchXX patterns: %s", errorbuf);
+        return false;
+    }
+
+    /** The interpreter is used if JIT is not available */
+    pcre2_jit_compile(instance->rules, PCRE2_JIT_COMPLETE);
+
+    spinlock_init(&instance->shared_lock);
+    instance->n_threads = config_threadcount();
+    instance->match_data = MXS_CALLOC(instance->n_threads, sizeof(pcre2_match_data*));
+    instance->shared_match_data = pcre2_match_data_create_from_pattern(instance->rules, NULL);
+
+    return instance->match_data != NULL && instance->shared_match_data != NULL;
+}
+
+/**
+ * Get the matching data of the current worker thread
+ *
+ * @param instance The filter instance
+ * @return The matching data or NULL if the caller is not a worker thread or
+ *         the data could not be allocated
+ */
+static pcre2_match_data* get_match_data(REGEXHINT_INSTANCE *instance)
+{
+    int thread_id = poll_current_worker();
+
+    if (thread_id == -1 || thread_id >= instance->n_threads)
+    {
+        return NULL;
+    }
+
+    pcre2_match_data *data = instance->match_data[thread_id];
+
+    if (data == NULL)
+    {
+        data = pcre2_match_data_create_from_pattern(instance->rules, NULL);
+        instance->match_data[thread_id] = data;
+    }
+
+    return data;
+}
+
+/**
+ * Find the server of the pattern that matched
+ *
+ * @param instance   The filter instance
+ * @param sql        The SQL of the query
+ * @param len        Length of the SQL
+ * @param match_data The matching data to use
+ * @return The server or NULL if no pattern matched
+ */
+static const char* match_rules_with(REGEXHINT_INSTANCE *instance, const char *sql, int len,
+                                    pcre2_match_data *match_data)
+{
+    if (pcre2_match(instance->rules, (PCRE2_SPTR)sql, len, 0, 0, match_data, NULL) > 0)
+    {
+        PCRE2_SPTR mark = pcre2_get_mark(match_data);
+
+        if (mark)
+        {
+            int i = atoi((const char*)mark);
+            ss_dassert(i >= 0 && i < instance->n_rules);
+            return instance->rule_target[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Find the server of the matchXX pattern that matches the query
+ *
+ * The matching data of the current worker is used. Other threads, and
+ * workers whose matching data could not be allocated, take turns using the
+ * shared matching data.
+ *
+ * @param instance The filter instance
+ * @param sql      The SQL of the query
+ * @param len      Length of the SQL
+ * @return The server or NULL if no pattern matched
+ */
+static const char* match_rules(REGEXHINT_INSTANCE *instance, const char *sql, int len)
+{
+    const char *rval = NULL;
+
+    if (instance->rules)
+    {
+        pcre2_match_data *match_data = get_match_data(instance);
+
+        if (match_data)
+        {
+            rval = match_rules_with(instance, sql, len, match_data);
+        }
+        else
+        {
+            spinlock_acquire(&instance->shared_lock);
+            rval = match_rules_with(instance, sql, len, instance->shared_match_data);
+            spinlock_release(&instance->shared_lock);
+        }
+    }
+
+    return rval;
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -186,13 +402,20 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             }
         }
 
-        my_instance->match = MXS_STRDUP_A(config_get_string(params, "match"));
-        my_instance->server = MXS_STRDUP_A(config_get_string(params, "server"));
+        my_instance->match = config_copy_string(params, "match");
+        my_instance->server = config_copy_string(params, "server");
         my_instance->user = config_copy_string(params, "user");
         bool error = false;
         int cflags = config_get_enum(params, "options", option_values);
 
-        if (regcomp(&my_instance->re, my_instance->match, cflags))
+        if ((my_instance->match == NULL) != (my_instance->server == NULL))
+        {
+            MXS_ERROR("Both 'match' and 'server' must be defined.");
+            MXS_FREE(my_instance->match);
+            my_instance->match = NULL;
+            error = true;
+        }
+        else if (my_instance->match && regcomp(&my_instance->re, my_instance->match, cflags))
         {
             MXS_ERROR("Invalid regular expression '%s'.", my_instance->match);
             MXS_FREE(my_instance->match);
@@ -200,6 +423,17 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             error = true;
         }
 
+        if (!error && !compile_rules(my_instance, params, cflags & REG_ICASE))
+        {
+            error = true;
+        }
+
+        if (!error && my_instance->match == NULL && my_instance->n_rules == 0)
+        {
+            MXS_ERROR("No 'match' and 'server' or 'match01' and 'target01' parameters.");
+            error = true;
+        }
+
         if (error)
         {
             free_instance(my_instance);
@@ -310,17 +544,31 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     REGEXHINT_INSTANCE *my_instance = (REGEXHINT_INSTANCE *) instance;
     REGEXHINT_SESSION *my_session = (REGEXHINT_SESSION *) session;
     char *sql;
+    int len;
     regmatch_t limits[] = {{0, 0}};
 
     if (modutil_is_SQL(queue) && my_session->active)
     {
-        if (modutil_extract_SQL(queue, &sql, &limits[0].rm_eo))
+        if (modutil_extract_SQL(queue, &sql, &len))
         {
-            if (regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0)
+            const char *target = NULL;
+            limits[0].rm_eo = len;
+
+            if (my_instance->match &&
+                regexec(&my_instance->re, sql, 0, limits, REG_STARTEND) == 0)
+            {
+                target = my_instance->server;
+            }
+            else
+            {
+                target = match_rules(my_instance, sql, len);
+            }
+
+            if (target)
             {
                 queue->hint = hint_create_route(queue->hint,
                                                 HINT_ROUTE_TO_NAMED_SERVER,
-                                                my_instance->server);
+                                                (char*)target);
                 my_session->n_diverted++;
             }
             else
@@ -350,8 +598,16 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     REGEXHINT_INSTANCE *my_instance = (REGEXHINT_INSTANCE *) instance;
     REGEXHINT_SESSION *my_session = (REGEXHINT_SESSION *) fsession;
 
-    dcb_printf(dcb, "\t\tMatch and route:           /%s/ -> %s\n",
-               my_instance->match, my_instance->server);
+    if (my_instance->match)
+    {
+        dcb_printf(dcb, "\t\tMatch and route:           /%s/ -> %s\n",
+                   my_instance->match, my_instance->server);
+    }
+    for (int i = 0; i < my_instance->n_rules; i++)
+    {
+        dcb_printf(dcb, "\t\tMatch and route:           /%s/ -> %s\n",
+                   my_instance->rule_match[i], my_instance->rule_target[i]);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of queries diverted by filter: %d\n",
@@ -603,6 +859,35 @@ static void free_instance(REGEXHINT_INSTANCE *instance)
         MXS_FREE(instance->match);
     }
 
+    for (int i = 0; i < instance->n_rules; i++)
+    {
+        MXS_FREE(instance->rule_match[i]);
+        MXS_FREE(instance->rule_target[i]);
+    }
+
+    if (instance->match_data)
+    {
+        for (int i = 0; i < instance->n_threads; i++)
+        {
+            if (instance->match_data[i])
+            {
+                pcre2_match_data_free(instance->match_data[i]);
+            }
+        }
+
+        MXS_FREE(instance->match_data);
+    }
+
+    if (instance->shared_match_data)
+    {
+        pcre2_match_data_free(instance->shared_match_data);
+    }
+
+    if (instance->rules)
+    {
+        pcre2_code_free(instance->rules);
+    }
+
     MXS_FREE(instance->server);
     MXS_FREE(instance->source);
     MXS_FREE(instance->user);
@@ -0,0 +1,161 @@
+#pragma once
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qlabinary.h - The binary log format of the QLA filter
+ *
+ * A binary log file is a sequence of records. Each record starts with a type
+ * byte. Integers are stored as unsigned LEB128 varints and strings as a varint
+ * length followed by the bytes of the string.
+ *
+ * Header record, written every time the file is opened:
+ *
+ *     'Q' 'L' 'A' 'B'  version  base_time  data_flags
+ *
+ * The base time is in microseconds since the epoch and the data flags are the
+ * values of the log_data parameter that were used for the file.
+ *
+ * Session record, written before the first query of a session:
+ *
+ *     QLA_BIN_SESSION  session_id  service  user  remote
+ *
+ * Query record:
+ *
+ *     QLA_BIN_QUERY  session_id  time  digest  sql
+ *
+ * The time is in microseconds since the base time of the last header and the
+ * digest is the 16 byte statement digest, the high and low halves in little
+ * endian order, or zeros if the statement has none.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QLA_BIN_MAGIC      "QLAB"
+#define QLA_BIN_MAGIC_LEN  4
+#define QLA_BIN_VERSION    1
+
+#define QLA_BIN_HEADER     'Q'
+#define QLA_BIN_SESSION    1
+#define QLA_BIN_QUERY      2
+
+/** The longest encoded varint */
+#define QLA_BIN_VARINT_MAX 10
+
+/** Length of an encoded digest */
+#define QLA_BIN_DIGEST_LEN 16
+
+/**
+ * Encode an integer into a buffer
+ *
+ * @param dest  Buffer with room for at least QLA_BIN_VARINT_MAX bytes
+ * @param value The value
+ * @return Pointer to the byte after the encoded value
+ */
+static inline uint8_t* qla_bin_put_int(uint8_t *dest, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *dest++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    *dest++ = value;
+    return dest;
+}
+
+/**
+ * Encode a string into a buffer
+ *
+ * @param dest Buffer with room for QLA_BIN_VARINT_MAX + len bytes
+ * @param str  The string
+ * @param len  Length of the string
+ * @return Pointer to the byte after the encoded string
+ */
+static inline uint8_t* qla_bin_put_str(uint8_t *dest, const char *str, size_t len)
+{
+    dest = qla_bin_put_int(dest, len);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        *dest++ = str[i];
+    }
+
+    return dest;
+}
+
+/**
+ * Encode a 64-bit integer in little endian order
+ *
+ * @param dest  Buffer with room for 8 bytes
+ * @param value The value
+ * @return Pointer to the byte after the value
+ */
+static inline uint8_t* qla_bin_put_uint64(uint8_t *dest, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        *dest++ = value >> (i * 8);
+    }
+
+    return dest;
+}
+
+/**
+ * Decode an integer from a buffer
+ *
+ * @param src   Pointer to the encoded value, advanced past it on success
+ * @param end   End of the buffer
+ * @param value The value is stored here
+ * @return True if a complete value was decoded
+ */
+static inline bool qla_bin_get_int(const uint8_t **src, const uint8_t *end, uint64_t *value)
+{
+    const uint8_t *ptr = *src;
+    uint64_t rval = 0;
+
+    for (int shift = 0; ptr < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *ptr++;
+        rval |= (uint64_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0)
+        {
+            *value = rval;
+            *src = ptr;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Decode a 64-bit integer stored in little endian order
+ *
+ * @param src Pointer to 8 bytes
+ * @return The value
+ */
+static inline uint64_t qla_bin_get_uint64(const uint8_t *src)
+{
+    uint64_t rval = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        rval |= (uint64_t)src[i] << (i * 8);
+    }
+
+    return rval;
+}
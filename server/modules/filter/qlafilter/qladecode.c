@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file qladecode.c - Convert binary QLA filter logs into the text format
+ *
+ * The binary logs are read and their entries are printed to the standard
+ * output in the same format that the filter uses for text logs.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "qlabinary.h"
+
+/** The values of the log_data parameter of the filter */
+#define LOG_DATA_SERVICE (1 << 0)
+#define LOG_DATA_SESSION (1 << 1)
+#define LOG_DATA_DATE    (1 << 2)
+#define LOG_DATA_USER    (1 << 3)
+#define LOG_DATA_QUERY   (1 << 4)
+
+#define SESSION_BUCKETS 4096
+
+/** A string stored in the log */
+typedef struct
+{
+    const char *str;
+    size_t      len;
+} LOG_STRING;
+
+/** A session described by a session record */
+typedef struct session_info
+{
+    uint64_t             id;
+    LOG_STRING           service;
+    LOG_STRING           user;
+    LOG_STRING           remote;
+    struct session_info *next;
+} SESSION_INFO;
+
+/** The state of the file being decoded */
+typedef struct
+{
+    const char    *filename;
+    const uint8_t *start;
+    const uint8_t *ptr;
+    const uint8_t *end;
+    uint64_t       base;       /* Base time of the current header */
+    uint32_t       data_flags; /* Data flags of the current header */
+    bool           header_printed;
+    SESSION_INFO  *sessions[SESSION_BUCKETS];
+} DECODER;
+
+static bool print_digest = false;
+
+static void clear_sessions(DECODER *decoder)
+{
+    for (int i = 0; i < SESSION_BUCKETS; i++)
+    {
+        SESSION_INFO *info = decoder->sessions[i];
+
+        while (info)
+        {
+            SESSION_INFO *next = info->next;
+            free(info);
+            info = next;
+        }
+
+        decoder->sessions[i] = NULL;
+    }
+}
+
+static SESSION_INFO* find_session(DECODER *decoder, uint64_t id)
+{
+    SESSION_INFO *info = decoder->sessions[id % SESSION_BUCKETS];
+
+    while (info && info->id != id)
+    {
+        info = info->next;
+    }
+
+    return info;
+}
+
+static bool read_int(DECODER *decoder, uint64_t *value)
+{
+    return qla_bin_get_int(&decoder->ptr, decoder->end, value);
+}
+
+static bool read_str(DECODER *decoder, LOG_STRING *str)
+{
+    uint64_t len;
+
+    if (read_int(decoder, &len) && len <= (uint64_t)(decoder->end - decoder->ptr))
+    {
+        str->str = (const char*)decoder->ptr;
+        str->len = len;
+        decoder->ptr += len;
+        return true;
+    }
+
+    return false;
+}
+
+static bool read_header(DECODER *decoder)
+{
+    uint64_t flags;
+
+    if (decoder->end - decoder->ptr < QLA_BIN_MAGIC_LEN + 1 ||
+        memcmp(decoder->ptr, QLA_BIN_MAGIC, QLA_BIN_MAGIC_LEN) != 0)
+    {
+        return false;
+    }
+
+    decoder->ptr += QLA_BIN_MAGIC_LEN;
+
+    if (*decoder->ptr++ != QLA_BIN_VERSION)
+    {
+        fprintf(stderr, "Unsupported version of the binary log format in '%s'.\n",
+                decoder->filename);
+        return false;
+    }
+
+    if (!read_int(decoder, &decoder->base) || !read_int(decoder, &flags))
+    {
+        return false;
+    }
+
+    decoder->data_flags = flags;
+
+    /** The session identifiers of the previous header are no longer valid */
+    clear_sessions(decoder);
+
+    if (!decoder->header_printed)
+    {
+        const char *sep = "";
+
+        if (decoder->data_flags & LOG_DATA_SERVICE)
+        {
+            printf("%sService", sep);
+            sep = ",";
+        }
+        if (decoder->data_flags & LOG_DATA_SESSION)
+        {
+            printf("%sSession", sep);
+            sep = ",";
+        }
+        if (decoder->data_flags & LOG_DATA_DATE)
+        {
+            printf("%sDate", sep);
+            sep = ",";
+        }
+        if (decoder->data_flags & LOG_DATA_USER)
+        {
+            printf("%sUser@Host", sep);
+            sep = ",";
+        }
+        if (print_digest)
+        {
+            printf("%sDigest", sep);
+            sep = ",";
+        }
+        if (decoder->data_flags & LOG_DATA_QUERY)
+        {
+            printf("%sQuery", sep);
+            sep = ",";
+        }
+        if (*sep)
+        {
+            printf("\n");
+        }
+
+        decoder->header_printed = true;
+    }
+
+    return true;
+}
+
+static bool read_session(DECODER *decoder)
+{
+    SESSION_INFO *info = calloc(1, sizeof(SESSION_INFO));
+
+    if (info == NULL || !read_int(decoder, &info->id) || !read_str(decoder, &info->service) ||
+        !read_str(decoder, &info->user) || !read_str(decoder, &info->remote))
+    {
+        free(info);
+        return false;
+    }
+
+    SESSION_INFO **bucket = &decoder->sessions[info->id % SESSION_BUCKETS];
+    info->next = *bucket;
+    *bucket = info;
+    return true;
+}
+
+static bool read_query(DECODER *decoder)
+{
+    uint64_t id;
+    uint64_t time;
+    LOG_STRING sql;
+
+    if (!read_int(decoder, &id) || !read_int(decoder, &time) ||
+        decoder->end - decoder->ptr < QLA_BIN_DIGEST_LEN)
+    {
+        return false;
+    }
+
+    uint64_t hi = qla_bin_get_uint64(decoder->ptr);
+    uint64_t lo = qla_bin_get_uint64(decoder->ptr + 8);
+    decoder->ptr += QLA_BIN_DIGEST_LEN;
+
+    if (!read_str(decoder, &sql))
+    {
+        return false;
+    }
+
+    SESSION_INFO *info = find_session(decoder, id);
+
+    if (info == NULL)
+    {
+        fprintf(stderr, "Query of unknown session %" PRIu64 " at offset %ld of '%s'.\n",
+                id, (long)(decoder->ptr - decoder->start), decoder->filename);
+        return false;
+    }
+
+    const char *sep = "";
+
+    if (decoder->data_flags & LOG_DATA_SERVICE)
+    {
+        printf("%s%.*s", sep, (int)info->service.len, info->service.str);
+        sep = ",";
+    }
+    if (decoder->data_flags & LOG_DATA_SESSION)
+    {
+        printf("%s%" PRIu64, sep, id);
+        sep = ",";
+    }
+    if (decoder->data_flags & LOG_DATA_DATE)
+    {
+        char buffer[20];
+        struct tm t;
+        time_t secs = (decoder->base + time) / 1000000;
+        localtime_r(&secs, &t);
+        strftime(buffer, sizeof(buffer), "%F %T", &t);
+        printf("%s%s", sep, buffer);
+        sep = ",";
+    }
+    if (decoder->data_flags & LOG_DATA_USER)
+    {
+        printf("%s%.*s@%.*s", sep, (int)info->user.len, info->user.str,
+               (int)info->remote.len, info->remote.str);
+        sep = ",";
+    }
+    if (print_digest)
+    {
+        printf("%s%016" PRIx64 "%016" PRIx64, sep, hi, lo);
+        sep = ",";
+    }
+    if (decoder->data_flags & LOG_DATA_QUERY)
+    {
+        printf("%s", sep);
+        fwrite(sql.str, 1, sql.len, stdout);
+        sep = ",";
+    }
+    if (*sep)
+    {
+        printf("\n");
+    }
+
+    return true;
+}
+
+/**
+ * Decode one binary log file
+ *
+ * @param decoder  Decoder state, the header of the first file is printed
+ * @param filename The file to decode
+ * @return True if the whole file was decoded
+ */
+static bool decode_file(DECODER *decoder, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "Failed to open '%s': %d, %s\n", filename, errno, strerror(errno));
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map '%s': %d, %s\n", filename, errno, strerror(errno));
+        return false;
+    }
+
+    decoder->filename = filename;
+    decoder->start = map;
+    decoder->ptr = map;
+    decoder->end = decoder->start + st.st_size;
+
+    bool ok = decoder->ptr < decoder->end && *decoder->ptr++ == QLA_BIN_HEADER && read_header(decoder);
+
+    while (ok && decoder->ptr < decoder->end)
+    {
+        switch (*decoder->ptr++)
+        {
+        case QLA_BIN_HEADER:
+            ok = read_header(decoder);
+            break;
+
+        case QLA_BIN_SESSION:
+            ok = read_session(decoder);
+            break;
+
+        case QLA_BIN_QUERY:
+            ok = read_query(decoder);
+            break;
+
+        default:
+            ok = false;
+            break;
+        }
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "'%s' is not a valid binary QLA filter log, decoding stopped "
+                "at offset %ld.\n", filename, (long)(decoder->ptr - decoder->start));
+    }
+
+    clear_sessions(decoder);
+    munmap(map, st.st_size);
+    return ok;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-d] FILE...\n\n"
+            "Convert binary QLA filter logs into the text format and print them "
+            "to the standard output.\n\n"
+            "  -d  Print the digest of each query before the query\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "dh")) != -1)
+    {
+        switch (c)
+        {
+        case 'd':
+            print_digest = true;
+            break;
+
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    DECODER decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    int rval = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (!decode_file(&decoder, argv[i]))
+        {
+            rval = 1;
+        }
+    }
+
+    return rval;
+}
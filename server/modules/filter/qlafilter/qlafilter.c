@@ -50,7 +50,12 @@
 #include <string.h>
 #include <maxscale/atomic.h>
 #include <maxscale/alloc.h>
+#include <maxscale/digest.h>
+#include <maxscale/poll.h>
 #include <maxscale/service.h>
+#include <maxscale/thread.h>
+#include <unistd.h>
+#include "qlabinary.h"
 
 /** Date string buffer size */
 #define QLA_DATE_BUFFER_SIZE 20
@@ -72,6 +77,25 @@ enum log_options
 /** Default values for logged data */
 #define LOG_DATA_DEFAULT "date,user,query"
 
+/** The format of the log files */
+enum log_format
+{
+    QLA_FORMAT_TEXT,
+    QLA_FORMAT_BINARY
+};
+
+/** Number of log records each worker thread can have waiting for the writer */
+#define QLA_QUEUE_SIZE 4096
+
+/** How long the writer sleeps when there is nothing to write, in microseconds */
+#define QLA_WRITER_IDLE_SLEEP 10000
+
+/** How many records the writer takes from one queue at a time */
+#define QLA_WRITER_BATCH 1024
+
+/** Size of the stdio buffer of the log files that the writer writes to */
+#define QLA_WRITE_BUFFER_SIZE (64 * 1024)
+
 /*
  * The filter entry points
  */
@@ -84,6 +108,57 @@ static int routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBUF
 static void diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 
+/**
+ * A log record waiting for the writer thread. A record without data closes
+ * the file.
+ */
+typedef struct
+{
+    FILE   *fp;   /* The file to write to */
+    char   *data; /* The formatted log entry, owned by the record */
+    size_t  len;  /* Length of the entry */
+} QLA_RECORD;
+
+/**
+ * The log records of one worker thread. Only the worker adds records and only
+ * the writer thread removes them, so the queue needs no locking. The threads
+ * that are not workers share one more queue and take turns adding records to
+ * it.
+ */
+typedef struct
+{
+    int        head;     /* Next record the writer takes, changed by the writer */
+    int        tail;     /* Next free slot, changed by the worker */
+    uint64_t   n_popped; /* Number of records taken, changed by the writer */
+    QLA_RECORD records[QLA_QUEUE_SIZE];
+} QLA_QUEUE;
+
+/**
+ * A log file waiting to be closed. A session can move to another worker
+ * thread, so its earlier entries can still be in the queues of other threads
+ * when the writer takes the close record. The file is closed once the writer
+ * has taken all records that were in the queues at that moment.
+ */
+typedef struct
+{
+    FILE     *fp;       /* The file to close */
+    uint64_t *wait_for; /* The value of n_popped of each queue to wait for */
+} QLA_CLOSE;
+
+/**
+ * The writer thread that writes the log records of all worker threads
+ */
+typedef struct
+{
+    THREAD     thread;    /* The writer thread */
+    int        n_queues;  /* Number of worker threads plus the shared queue */
+    QLA_QUEUE *queues;    /* One queue for each worker thread, the last one is shared */
+    SPINLOCK   shared_lock; /* Serializes adding to the shared queue */
+    uint64_t   written;   /* Number of records written */
+    uint64_t   dropped;   /* Number of records dropped because a queue was full */
+    uint64_t   errors;    /* Number of records that could not be written */
+} QLA_WRITER;
+
 /**
  * A instance structure, the assumption is that the option passed
  * to the filter is simply a base for the filename to which the queries
@@ -105,11 +180,14 @@ typedef struct
     regex_t nore; /* Compiled regex nomatch text */
     uint32_t log_mode_flags; /* Log file mode settings */
     uint32_t log_file_data_flags; /* What data is saved to the files */
+    enum log_format log_format; /* The format of the log files */
     FILE *unified_fp; /* Unified log file. The pointer needs to be shared here
                        * to avoid garbled printing. */
+    uint64_t unified_base; /* Base time of a binary unified file */
     bool flush_writes; /* Flush log file after every write? */
     bool append;    /* Open files in append-mode? */
     bool write_warning_given; /* To make sure some warning are only given once */
+    QLA_WRITER *writer; /* The writer thread, NULL if the files are written directly */
 } QLA_INSTANCE;
 
 /**
@@ -126,15 +204,20 @@ typedef struct
     MXS_DOWNSTREAM down;
     char *filename;   /* The session-specific log file name */
     FILE *fp;         /* The session-specific log file */
+    uint64_t base;    /* Base time of a binary session file */
+    uint32_t described; /* The binary files that have the session record, as
+                         * CONFIG_FILE_SESSION and CONFIG_FILE_UNIFIED flags */
     const char *remote;
     char *service;    /* The service name this filter is attached to. Not owned. */
     size_t ses_id;    /* The session this filter serves */
     const char *user; /* The client */
 } QLA_SESSION;
 
-static FILE* open_log_file(uint32_t, QLA_INSTANCE *, const char *);
+static FILE* open_log_file(uint32_t, QLA_INSTANCE *, const char *, uint64_t *);
 static int write_log_entry(uint32_t, FILE*, QLA_INSTANCE*, QLA_SESSION*, const char*,
                            const char*, size_t);
+static bool write_binary_query(QLA_INSTANCE*, QLA_SESSION*, GWBUF*, const struct timeval*,
+                               const char*, size_t);
 
 static const MXS_ENUM_VALUE option_values[] =
 {
@@ -161,6 +244,13 @@ static const MXS_ENUM_VALUE log_data_values[] =
     {NULL}
 };
 
+static const MXS_ENUM_VALUE log_format_values[] =
+{
+    {"text",   QLA_FORMAT_TEXT},
+    {"binary", QLA_FORMAT_BINARY},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -242,6 +332,13 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 log_data_values
             },
+            {
+                "log_format",
+                MXS_MODULE_PARAM_ENUM,
+                "text",
+                MXS_MODULE_OPT_ENUM_UNIQUE,
+                log_format_values
+            },
             {
                 "flush",
                 MXS_MODULE_PARAM_BOOL,
@@ -252,6 +349,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_PARAM_BOOL,
                 "false"
             },
+            {
+                "async",
+                MXS_MODULE_PARAM_BOOL,
+                "false"
+            },
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -259,6 +361,330 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+/**
+ * Add a record to a queue
+ *
+ * @param queue  The queue of the current thread
+ * @param record The record to add
+ * @return True if the record was added, false if the queue was full
+ */
+static bool queue_push(QLA_QUEUE *queue, const QLA_RECORD *record)
+{
+    int tail = queue->tail;
+    int next = (tail + 1) % QLA_QUEUE_SIZE;
+
+    if (next == atomic_load_int32(&queue->head))
+    {
+        return false;
+    }
+
+    queue->records[tail] = *record;
+    atomic_store_int32(&queue->tail, next);
+    return true;
+}
+
+/**
+ * Add a record to the queue of the current thread
+ *
+ * Each worker adds to its own queue. The threads that are not workers take
+ * turns adding to the shared queue.
+ *
+ * @param writer The writer
+ * @param record The record to add
+ * @return True if the record was added, false if the queue was full
+ */
+static bool writer_push(QLA_WRITER *writer, const QLA_RECORD *record)
+{
+    int thread_id = poll_current_worker();
+    bool rval;
+
+    if (thread_id != -1 && thread_id < writer->n_queues - 1)
+    {
+        rval = queue_push(&writer->queues[thread_id], record);
+    }
+    else
+    {
+        spinlock_acquire(&writer->shared_lock);
+        rval = queue_push(&writer->queues[writer->n_queues - 1], record);
+        spinlock_release(&writer->shared_lock);
+    }
+
+    return rval;
+}
+
+/**
+ * Take the oldest record from a queue
+ *
+ * @param queue  The queue
+ * @param record The record is stored here
+ * @return True if a record was taken, false if the queue was empty
+ */
+static bool queue_pop(QLA_QUEUE *queue, QLA_RECORD *record)
+{
+    int head = queue->head;
+
+    if (head == atomic_load_int32(&queue->tail))
+    {
+        return false;
+    }
+
+    *record = queue->records[head];
+    atomic_store_int32(&queue->head, (head + 1) % QLA_QUEUE_SIZE);
+    queue->n_popped++;
+    return true;
+}
+
+/**
+ * Get the number of records that the writer has not yet taken from a queue
+ *
+ * @param queue The queue
+ * @return Number of records in the queue
+ */
+static int queue_length(QLA_QUEUE *queue)
+{
+    int head = queue->head;
+    int tail = atomic_load_int32(&queue->tail);
+
+    return (tail - head + QLA_QUEUE_SIZE) % QLA_QUEUE_SIZE;
+}
+
+/**
+ * Queue the closing of a file until the records now in the queues are written
+ *
+ * @param writer   The writer
+ * @param closes   The files waiting to be closed
+ * @param n_closes Number of files waiting to be closed
+ * @param fp       The file to close
+ * @return The new array of files waiting to be closed
+ */
+static QLA_CLOSE* writer_defer_close(QLA_WRITER *writer, QLA_CLOSE *closes, int *n_closes, FILE *fp)
+{
+    QLA_CLOSE *new_closes = MXS_REALLOC(closes, (*n_closes + 1) * sizeof(QLA_CLOSE));
+    uint64_t *wait_for = MXS_MALLOC(writer->n_queues * sizeof(uint64_t));
+
+    while (new_closes == NULL || wait_for == NULL)
+    {
+        /** The file must not be left open, wait until memory is available */
+        usleep(QLA_WRITER_IDLE_SLEEP);
+
+        if (new_closes == NULL)
+        {
+            new_closes = MXS_REALLOC(closes, (*n_closes + 1) * sizeof(QLA_CLOSE));
+        }
+
+        if (wait_for == NULL)
+        {
+            wait_for = MXS_MALLOC(writer->n_queues * sizeof(uint64_t));
+        }
+    }
+
+    for (int i = 0; i < writer->n_queues; i++)
+    {
+        wait_for[i] = writer->queues[i].n_popped + queue_length(&writer->queues[i]);
+    }
+
+    new_closes[*n_closes].fp = fp;
+    new_closes[*n_closes].wait_for = wait_for;
+    (*n_closes)++;
+
+    return new_closes;
+}
+
+/**
+ * Close the files whose earlier records the writer has taken from all queues
+ *
+ * @param writer   The writer
+ * @param closes   The files waiting to be closed
+ * @param n_closes Number of files waiting to be closed
+ */
+static void writer_run_closes(QLA_WRITER *writer, QLA_CLOSE *closes, int *n_closes)
+{
+    int i = 0;
+
+    while (i < *n_closes)
+    {
+        int j = 0;
+
+        while (j < writer->n_queues && writer->queues[j].n_popped >= closes[i].wait_for[j])
+        {
+            j++;
+        }
+
+        if (j == writer->n_queues)
+        {
+            fclose(closes[i].fp);
+            MXS_FREE(closes[i].wait_for);
+            closes[i] = closes[--(*n_closes)];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/**
+ * Write the log records of all worker threads
+ *
+ * The records are written through the stdio buffers of the files and the
+ * files written to are flushed after each round over the queues. This turns
+ * the entries into a few large writes.
+ *
+ * @param data The QLA_WRITER
+ */
+static void writer_main(void *data)
+{
+    QLA_WRITER *writer = (QLA_WRITER*)data;
+    FILE *touched[QLA_WRITER_BATCH];
+    QLA_CLOSE *closes = NULL;
+    int n_closes = 0;
+
+    while (true)
+    {
+        int n_touched = 0;
+        bool idle = true;
+
+        for (int i = 0; i < writer->n_queues; i++)
+        {
+            QLA_RECORD record;
+            int n = 0;
+
+            while (n++ < QLA_WRITER_BATCH && queue_pop(&writer->queues[i], &record))
+            {
+                idle = false;
+
+                if (record.data)
+                {
+                    if (fwrite(record.data, 1, record.len, record.fp) == record.len)
+                    {
+                        writer->written++;
+                    }
+                    else
+                    {
+                        writer->errors++;
+                    }
+
+                    MXS_FREE(record.data);
+
+                    int j = 0;
+                    while (j < n_touched && touched[j] != record.fp)
+                    {
+                        j++;
+                    }
+
+                    if (j == n_touched)
+                    {
+                        if (n_touched < QLA_WRITER_BATCH)
+                        {
+                            touched[n_touched++] = record.fp;
+                        }
+                        else
+                        {
+                            fflush(record.fp);
+                        }
+                    }
+                }
+                else
+                {
+                    /**
+                     * The session has closed. Entries it added before moving
+                     * to this thread can still be in the other queues.
+                     */
+                    closes = writer_defer_close(writer, closes, &n_closes, record.fp);
+                }
+            }
+        }
+
+        for (int i = 0; i < n_touched; i++)
+        {
+            fflush(touched[i]);
+        }
+
+        writer_run_closes(writer, closes, &n_closes);
+
+        if (idle)
+        {
+            usleep(QLA_WRITER_IDLE_SLEEP);
+        }
+    }
+}
+
+/**
+ * Start the writer thread
+ *
+ * @param instance The filter instance
+ * @return The writer or NULL on error
+ */
+static QLA_WRITER* writer_start(QLA_INSTANCE *instance)
+{
+    QLA_WRITER *writer = MXS_CALLOC(1, sizeof(QLA_WRITER));
+
+    if (writer)
+    {
+        spinlock_init(&writer->shared_lock);
+        writer->n_queues = config_threadcount() + 1;
+
+        if ((writer->queues = MXS_CALLOC(writer->n_queues, sizeof(QLA_QUEUE))) == NULL ||
+            thread_start(&writer->thread, writer_main, writer) == NULL)
+        {
+            MXS_ERROR("qla-filter '%s': Failed to start the log writer thread.", instance->name);
+            MXS_FREE(writer->queues);
+            MXS_FREE(writer);
+            writer = NULL;
+        }
+    }
+
+    return writer;
+}
+
+/**
+ * Hand a log entry to the writer thread
+ *
+ * If the queue of the thread is full, the entry is dropped.
+ *
+ * @param instance The filter instance
+ * @param fp       The file to write to
+ * @param data     The entry, the writer takes the ownership of it
+ * @param len      Length of the entry
+ * @return The length of the entry, zero if it was dropped or a negative value
+ *         if it could not be written
+ */
+static int writer_submit(QLA_INSTANCE *instance, FILE *fp, char *data, size_t len)
+{
+    QLA_RECORD record = {fp, data, len};
+    int rval = len;
+
+    if (!writer_push(instance->writer, &record))
+    {
+        atomic_add_uint64(&instance->writer->dropped, 1);
+        MXS_FREE(data);
+        rval = 0;
+    }
+
+    return rval;
+}
+
+/**
+ * Close a log file after the writer has written its entries
+ *
+ * The session may have added entries to the queues of other threads before it
+ * was moved to this one. The writer closes the file only after it has taken
+ * everything that was in the queues when it took the close record.
+ *
+ * @param instance The filter instance
+ * @param fp       The file to close
+ */
+static void writer_close(QLA_INSTANCE *instance, FILE *fp)
+{
+    QLA_RECORD record = {fp, NULL, 0};
+
+    /** The file must not be left open, wait until the writer makes room */
+    while (!writer_push(instance->writer, &record))
+    {
+        usleep(QLA_WRITER_IDLE_SLEEP);
+    }
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -289,6 +715,9 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->user_name = config_copy_string(params, "user");
         my_instance->log_file_data_flags = config_get_enum(params, "log_data", log_data_values);
         my_instance->log_mode_flags = config_get_enum(params, "log_type", log_type_values);
+        my_instance->log_format = config_get_enum(params, "log_format", log_format_values);
+        my_instance->unified_base = 0;
+        my_instance->writer = NULL;
         bool error = false;
 
         int cflags = config_get_enum(params, "options", option_values);
@@ -311,6 +740,12 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             error = true;
         }
 
+        if (!error && config_get_bool(params, "async") &&
+            (my_instance->writer = writer_start(my_instance)) == NULL)
+        {
+            error = true;
+        }
+
         // Try to open the unified log file
         if (!error && (my_instance->log_mode_flags & CONFIG_FILE_UNIFIED))
         {
@@ -323,7 +758,8 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
                 snprintf(filename, namelen, "%s.unified", my_instance->filebase);
                 // Open the file. It is only closed at program exit
                 my_instance->unified_fp = open_log_file(my_instance->log_file_data_flags,
-                                                        my_instance, filename);
+                                                        my_instance, filename,
+                                                        &my_instance->unified_base);
 
                 if (my_instance->unified_fp == NULL)
                 {
@@ -423,7 +859,8 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         {
             uint32_t data_flags = (my_instance->log_file_data_flags &
                                    ~LOG_DATA_SESSION); // No point printing "Session"
-            my_session->fp = open_log_file(data_flags, my_instance, my_session->filename);
+            my_session->fp = open_log_file(data_flags, my_instance, my_session->filename,
+                                           &my_session->base);
 
             if (my_session->fp == NULL)
             {
@@ -454,9 +891,18 @@ closeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
 {
     QLA_SESSION *my_session = (QLA_SESSION *) session;
 
+    QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
+
     if (my_session->active && my_session->fp)
     {
-        fclose(my_session->fp);
+        if (my_instance->writer)
+        {
+            writer_close(my_instance, my_session->fp);
+        }
+        else
+        {
+            fclose(my_session->fp);
+        }
     }
 }
 
@@ -521,37 +967,47 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                 (my_instance->nomatch == NULL ||
                  regexec(&my_instance->nore, sql, 0, limits, REG_STARTEND) != 0))
             {
-                char buffer[QLA_DATE_BUFFER_SIZE];
-                gettimeofday(&tv, NULL);
-                localtime_r(&tv.tv_sec, &t);
-                strftime(buffer, sizeof(buffer), "%F %T", &t);
-
                 /**
                  * Loop over all the possible log file modes and write to
                  * the enabled files.
                  */
                 int length = limits[0].rm_eo;
                 bool write_error = false;
-                if (my_instance->log_mode_flags & CONFIG_FILE_SESSION)
+                gettimeofday(&tv, NULL);
+
+                if (my_instance->log_format == QLA_FORMAT_BINARY)
                 {
-                    // In this case there is no need to write the session
-                    // number into the files.
-                    uint32_t data_flags = (my_instance->log_file_data_flags &
-                                           ~LOG_DATA_SESSION);
+                    // The binary records always contain all of the data
+                    write_error = !write_binary_query(my_instance, my_session, queue,
+                                                      &tv, sql, length);
+                }
+                else
+                {
+                    char buffer[QLA_DATE_BUFFER_SIZE];
+                    localtime_r(&tv.tv_sec, &t);
+                    strftime(buffer, sizeof(buffer), "%F %T", &t);
 
-                    if (write_log_entry(data_flags, my_session->fp,
-                                        my_instance, my_session, buffer, sql, length) < 0)
+                    if (my_instance->log_mode_flags & CONFIG_FILE_SESSION)
                     {
-                        write_error = true;
+                        // In this case there is no need to write the session
+                        // number into the files.
+                        uint32_t data_flags = (my_instance->log_file_data_flags &
+                                               ~LOG_DATA_SESSION);
+
+                        if (write_log_entry(data_flags, my_session->fp,
+                                            my_instance, my_session, buffer, sql, length) < 0)
+                        {
+                            write_error = true;
+                        }
                     }
-                }
-                if (my_instance->log_mode_flags & CONFIG_FILE_UNIFIED)
-                {
-                    uint32_t data_flags = my_instance->log_file_data_flags;
-                    if (write_log_entry(data_flags, my_instance->unified_fp,
-                                        my_instance, my_session, buffer, sql, length) < 0)
+                    if (my_instance->log_mode_flags & CONFIG_FILE_UNIFIED)
                     {
-                        write_error = true;
+                        uint32_t data_flags = my_instance->log_file_data_flags;
+                        if (write_log_entry(data_flags, my_instance->unified_fp,
+                                            my_instance, my_session, buffer, sql, length) < 0)
+                        {
+                            write_error = true;
+                        }
                     }
                 }
                 if (write_error && !my_instance->write_warning_given)
@@ -611,6 +1067,15 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->writer)
+    {
+        dcb_printf(dcb, "\t\tEntries written              %lu\n",
+                   atomic_load_uint64(&my_instance->writer->written));
+        dcb_printf(dcb, "\t\tEntries dropped              %lu\n",
+                   atomic_load_uint64(&my_instance->writer->dropped));
+        dcb_printf(dcb, "\t\tFailed writes                %lu\n",
+                   atomic_load_uint64(&my_instance->writer->errors));
+    }
 }
 
 /**
@@ -622,21 +1087,74 @@ static uint64_t getCapabilities(MXS_FILTER* instance)
 {
     return RCAP_TYPE_CONTIGUOUS_INPUT;
 }
+/**
+ * Give a newly opened log file a large buffer if the writer thread writes to it.
+ * The writer then turns the entries into a few large writes.
+ *
+ * @param instance The filter instance
+ * @param fp       The file, nothing must have been done with it yet
+ */
+static void set_write_buffer(QLA_INSTANCE *instance, FILE *fp)
+{
+    if (instance->writer)
+    {
+        setvbuf(fp, NULL, _IOFBF, QLA_WRITE_BUFFER_SIZE);
+    }
+}
+
+/**
+ * Write the header of a binary log file. A header is written every time the
+ * file is opened, also when the file is appended to.
+ *
+ * @param   data_flags  Data save settings flags
+ * @param   instance    The filter instance
+ * @param   fp          The file
+ * @param   base        The base time of the file is stored here
+ * @return  True if the header was written
+ */
+static bool write_binary_header(uint32_t data_flags, QLA_INSTANCE *instance, FILE *fp,
+                                uint64_t *base)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    *base = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    uint8_t header[2 + QLA_BIN_MAGIC_LEN + 2 * QLA_BIN_VARINT_MAX];
+    uint8_t *ptr = header;
+
+    *ptr++ = QLA_BIN_HEADER;
+    memcpy(ptr, QLA_BIN_MAGIC, QLA_BIN_MAGIC_LEN);
+    ptr += QLA_BIN_MAGIC_LEN;
+    *ptr++ = QLA_BIN_VERSION;
+    ptr = qla_bin_put_int(ptr, *base);
+    ptr = qla_bin_put_int(ptr, data_flags);
+
+    size_t len = ptr - header;
+
+    return fwrite(header, 1, len, fp) == len &&
+           (!instance->flush_writes || fflush(fp) == 0);
+}
+
 /**
  * Open the log file and print a header if appropriate.
  * @param   data_flags  Data save settings flags
  * @param   instance    The filter instance
  * @param   filename    Target file path
+ * @param   base        The base time of a binary file is stored here
  * @return  A valid file on success, null otherwise.
  */
-static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const char *filename)
+static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const char *filename,
+                           uint64_t *base)
 {
     bool file_existed = false;
     FILE *fp = NULL;
     if (instance->append == false)
     {
         // Just open the file (possibly overwriting) and then print header.
-        fp = fopen(filename, "w");
+        if ((fp = fopen(filename, "w")) != NULL)
+        {
+            set_write_buffer(instance, fp);
+        }
     }
     else
     {
@@ -646,6 +1164,8 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
         // changes later (e.g. rewinding).
         if ((fp = fopen(filename, "a+")) != NULL)
         {
+            set_write_buffer(instance, fp);
+
             // Check to see if file already has contents
             fseek(fp, 0, SEEK_END);
             if (ftell(fp) > 0) // Any errors in ftell cause overwriting
@@ -654,7 +1174,16 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
             }
         }
     }
-    if (fp && !file_existed)
+    if (fp && instance->log_format == QLA_FORMAT_BINARY)
+    {
+        if (!write_binary_header(data_flags, instance, fp, base))
+        {
+            fclose(fp);
+            MXS_ERROR("Failed to print header to file %s.", filename);
+            return NULL;
+        }
+    }
+    else if (fp && !file_existed)
     {
         // Print a header. Luckily, we know the header has limited length
         const char SERVICE[] = "Service,";
@@ -721,6 +1250,41 @@ static FILE* open_log_file(uint32_t data_flags, QLA_INSTANCE *instance, const ch
     return fp;
 }
 
+/**
+ * Write a formatted entry to the log file.
+ * @param   instance    Filter instance
+ * @param   logfile     Target file
+ * @param   data        The entry, freed by this function
+ * @param   len         Length of the entry
+ * @return  The number of characters written, or a negative value on failure
+ */
+static int write_entry(QLA_INSTANCE *instance, FILE *logfile, char *data, size_t len)
+{
+    if (instance->writer)
+    {
+        // The writer thread flushes the file after writing the entries
+        return writer_submit(instance, logfile, data, len);
+    }
+
+    int written = fwrite(data, 1, len, logfile) == len ? (int)len : -1;
+    MXS_FREE(data);
+
+    if ((!instance->flush_writes) || (written <= 0))
+    {
+        return written;
+    }
+    else
+    {
+        // Try flushing. If successful, still return the characters written.
+        int rval = fflush(logfile);
+        if (rval >= 0)
+        {
+            return written;
+        }
+        return rval;
+    }
+}
+
 /**
  * Write an entry to the log file.
  * @param   data_flags    Controls what to write
@@ -845,21 +1409,124 @@ static int write_log_entry(uint32_t data_flags, FILE *logfile, QLA_INSTANCE *ins
     }
 
     // Finally, write the log event.
-    int written = fprintf(logfile, "%s", print_str);
-    MXS_FREE(print_str);
+    return write_entry(instance, logfile, print_str, current_pos - print_str);
+}
 
-    if ((!instance->flush_writes) || (written <= 0))
+/**
+ * Write a query record to a binary log file. The first record of a session
+ * in each file is preceded by the session record which holds the service,
+ * the user and the host of the session.
+ *
+ * @param   file        CONFIG_FILE_SESSION or CONFIG_FILE_UNIFIED
+ * @param   logfile     Target file
+ * @param   instance    Filter instance
+ * @param   session     Filter session
+ * @param   time        Microseconds since the base time of the file
+ * @param   digest      Digest of the statement
+ * @param   sql_string  SQL-query, not NULL terminated!
+ * @param   sql_str_len Length of SQL-string
+ * @return  The number of bytes written, or a negative value on failure
+ */
+static int write_binary_entry(uint32_t file, FILE *logfile, QLA_INSTANCE *instance,
+                              QLA_SESSION *session, uint64_t time, const MXS_DIGEST *digest,
+                              const char *sql_string, size_t sql_str_len)
+{
+    ss_dassert(logfile != NULL);
+    bool describe = (session->described & file) == 0;
+    size_t service_len = strlen(session->service);
+    size_t user_len = strlen(session->user);
+    size_t remote_len = strlen(session->remote);
+
+    // The session record and the query are written at once, so that
+    // the records of other sessions cannot come between them.
+    size_t size = 1 + 3 * QLA_BIN_VARINT_MAX + QLA_BIN_DIGEST_LEN + sql_str_len;
+
+    if (describe)
     {
-        return written;
+        size += 1 + 4 * QLA_BIN_VARINT_MAX + service_len + user_len + remote_len;
     }
-    else
+
+    uint8_t *data = MXS_MALLOC(size);
+
+    if (data == NULL)
     {
-        // Try flushing. If successful, still return the characters written.
-        int rval = fflush(logfile);
-        if (rval >= 0)
+        return -1;
+    }
+
+    uint8_t *ptr = data;
+
+    if (describe)
+    {
+        *ptr++ = QLA_BIN_SESSION;
+        ptr = qla_bin_put_int(ptr, session->ses_id);
+        ptr = qla_bin_put_str(ptr, session->service, service_len);
+        ptr = qla_bin_put_str(ptr, session->user, user_len);
+        ptr = qla_bin_put_str(ptr, session->remote, remote_len);
+    }
+
+    *ptr++ = QLA_BIN_QUERY;
+    ptr = qla_bin_put_int(ptr, session->ses_id);
+    ptr = qla_bin_put_int(ptr, time);
+    ptr = qla_bin_put_uint64(ptr, digest->hi);
+    ptr = qla_bin_put_uint64(ptr, digest->lo);
+    ptr = qla_bin_put_str(ptr, sql_string, sql_str_len);
+
+    int rval = write_entry(instance, logfile, (char*)data, ptr - data);
+
+    if (rval > 0)
+    {
+        session->described |= file;
+    }
+
+    return rval;
+}
+
+/**
+ * Write a query to the binary log files of the session.
+ *
+ * @param   instance    Filter instance
+ * @param   session     Filter session
+ * @param   queue       The query
+ * @param   tv          The time of the query
+ * @param   sql_string  SQL-query, not NULL terminated!
+ * @param   sql_str_len Length of SQL-string
+ * @return  True if the query was written to all files
+ */
+static bool write_binary_query(QLA_INSTANCE *instance, QLA_SESSION *session, GWBUF *queue,
+                               const struct timeval *tv, const char *sql_string,
+                               size_t sql_str_len)
+{
+    uint64_t now = (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    MXS_DIGEST digest;
+    bool rval = true;
+
+    if (!mxs_digest_get(queue, &digest))
+    {
+        digest.hi = 0;
+        digest.lo = 0;
+    }
+
+    if (instance->log_mode_flags & CONFIG_FILE_SESSION)
+    {
+        // If the clock has been turned back, the time is stored as zero
+        uint64_t time = now > session->base ? now - session->base : 0;
+
+        if (write_binary_entry(CONFIG_FILE_SESSION, session->fp, instance, session,
+                               time, &digest, sql_string, sql_str_len) < 0)
         {
-            return written;
+            rval = false;
+        }
+    }
+    if (instance->log_mode_flags & CONFIG_FILE_UNIFIED)
+    {
+        uint64_t time = now > instance->unified_base ? now - instance->unified_base : 0;
+
+        if (write_binary_entry(CONFIG_FILE_UNIFIED, instance->unified_fp, instance, session,
+                               time, &digest, sql_string, sql_str_len) < 0)
+        {
+            rval = false;
         }
-        return rval;
     }
+
+    return rval;
 }
@@ -24,6 +24,7 @@
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/pcre2.h>
+#include <maxscale/poll.h>
 
 /**
  * @file regexfilter.c - a very simple regular expression rewrite filter.
@@ -54,6 +55,9 @@ static uint64_t getCapabilities(MXS_FILTER* instance);
 static char *regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *study,
                            const char *replace);
 
+/** The longest literal prefix that is used to skip the regular expression */
+#define REGEX_PREFIX_MAX 64
+
 /**
  * Instance structure
  */
@@ -64,7 +68,12 @@ typedef struct
     char *match; /*< Regular expression to match */
     char *replace; /*< Replacement text */
     pcre2_code *re; /*< Compiled regex text */
-    pcre2_match_data *match_data; /*< Matching data used by the compiled regex */
+    int n_threads; /*< Number of worker threads */
+    pcre2_match_data **match_data; /*< Matching data of each worker thread */
+    pcre2_match_data *shared_match_data; /*< Matching data of the other threads */
+    SPINLOCK shared_lock; /*< Protects shared_match_data */
+    char prefix[REGEX_PREFIX_MAX + 1]; /*< Literal text that every match contains */
+    bool prefix_caseless; /*< Whether the prefix is searched ignoring case */
     FILE* logfile; /*< Log file */
     bool log_trace; /*< Whether messages should be printed to tracelog */
 } REGEX_INSTANCE;
@@ -158,7 +167,20 @@ void free_instance(REGEX_INSTANCE *instance)
 
         if (instance->match_data)
         {
-            pcre2_match_data_free(instance->match_data);
+            for (int i = 0; i < instance->n_threads; i++)
+            {
+                if (instance->match_data[i])
+                {
+                    pcre2_match_data_free(instance->match_data[i]);
+                }
+            }
+
+            MXS_FREE(instance->match_data);
+        }
+
+        if (instance->shared_match_data)
+        {
+            pcre2_match_data_free(instance->shared_match_data);
         }
 
         MXS_FREE(instance->match);
@@ -169,6 +191,102 @@ void free_instance(REGEX_INSTANCE *instance)
     }
 }
 
+/**
+ * Find the literal text that the pattern starts with. Every match of the
+ * pattern contains the text, so a query that does not contain it cannot match.
+ *
+ * @param pattern The regular expression
+ * @param dest    Buffer of REGEX_PREFIX_MAX + 1 bytes where the text is stored,
+ *                an empty string if there is no usable prefix
+ */
+static void find_literal_prefix(const char *pattern, char *dest)
+{
+    size_t len = 0;
+
+    /** With alternatives the prefix of the first one would not be enough */
+    if (strchr(pattern, '|') == NULL)
+    {
+        if (*pattern == '^')
+        {
+            pattern++;
+        }
+
+        while (len < REGEX_PREFIX_MAX && pattern[len] &&
+               (unsigned char)pattern[len] < 0x80 &&
+               strchr("\\^$.[]|()?*+{}", pattern[len]) == NULL)
+        {
+            len++;
+        }
+
+        /** A quantifier makes the last character optional */
+        if (len > 0 && pattern[len] && strchr("?*{", pattern[len]))
+        {
+            len--;
+        }
+
+        memcpy(dest, pattern, len);
+    }
+
+    dest[len] = '\0';
+}
+
+/**
+ * Get the matching data of the current worker thread
+ *
+ * @param instance The filter instance
+ * @return The matching data or NULL if the caller is not a worker thread or
+ *         the data could not be allocated
+ */
+static pcre2_match_data* get_match_data(REGEX_INSTANCE *instance)
+{
+    int thread_id = poll_current_worker();
+
+    if (thread_id == -1 || thread_id >= instance->n_threads)
+    {
+        return NULL;
+    }
+
+    pcre2_match_data *data = instance->match_data[thread_id];
+
+    if (data == NULL)
+    {
+        data = pcre2_match_data_create_from_pattern(instance->re, NULL);
+        instance->match_data[thread_id] = data;
+    }
+
+    return data;
+}
+
+/**
+ * Replace the matches of the pattern in a query
+ *
+ * The matching data of the current worker is used. Other threads, and
+ * workers whose matching data could not be allocated, take turns using the
+ * shared matching data.
+ *
+ * @param instance The filter instance
+ * @param sql      The query
+ * @return The rewritten query or NULL if the pattern did not match
+ */
+static char* replace_query(REGEX_INSTANCE *instance, const char *sql)
+{
+    pcre2_match_data *match_data = get_match_data(instance);
+    char *rval;
+
+    if (match_data)
+    {
+        rval = regex_replace(sql, instance->re, match_data, instance->replace);
+    }
+    else
+    {
+        spinlock_acquire(&instance->shared_lock);
+        rval = regex_replace(sql, instance->re, instance->shared_match_data, instance->replace);
+        spinlock_release(&instance->shared_lock);
+    }
+
+    return rval;
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -226,11 +344,22 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             return NULL;
         }
 
-        if ((my_instance->match_data =
+        /** If JIT compilation fails, the interpreter is used */
+        pcre2_jit_compile(my_instance->re, PCRE2_JIT_COMPLETE);
+
+        find_literal_prefix(my_instance->match, my_instance->prefix);
+        my_instance->prefix_caseless = cflags & PCRE2_CASELESS;
+
+        /** Each worker thread creates its own matching data when it first needs it */
+        my_instance->n_threads = config_threadcount();
+
+        spinlock_init(&my_instance->shared_lock);
+
+        if ((my_instance->match_data = MXS_CALLOC(my_instance->n_threads,
+                                                  sizeof(pcre2_match_data*))) == NULL ||
+            (my_instance->shared_match_data =
                  pcre2_match_data_create_from_pattern(my_instance->re, NULL)) == NULL)
         {
-            MXS_ERROR("Failure to create PCRE2 matching data. "
-                      "This is most likely caused by a lack of available memory.");
             free_instance(my_instance);
             return NULL;
         }
@@ -337,10 +466,15 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     {
         if ((sql = modutil_get_SQL(queue)) != NULL)
         {
-            newsql = regex_replace(sql,
-                                   my_instance->re,
-                                   my_instance->match_data,
-                                   my_instance->replace);
+            newsql = NULL;
+
+            if (*my_instance->prefix == '\0' ||
+                (my_instance->prefix_caseless ? strcasestr(sql, my_instance->prefix) :
+                 strstr(sql, my_instance->prefix)))
+            {
+                newsql = replace_query(my_instance, sql);
+            }
+
             if (newsql)
             {
                 queue = modutil_replace_SQL(queue, newsql);
@@ -434,7 +568,7 @@ regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, con
                                 (PCRE2_SPTR) replace, PCRE2_ZERO_TERMINATED,
                                 (PCRE2_UCHAR*) result, (PCRE2_SIZE*) & result_size_tmp) == PCRE2_ERROR_NOMEMORY)
         {
-            result_size_tmp = 1.5 * result_size;
+            result_size_tmp = 2 * result_size;
             char *tmp;
             if ((tmp = MXS_REALLOC(result, result_size_tmp)) == NULL)
             {
@@ -29,6 +29,9 @@
  *          of the request (optional)
  * user     A user name to match against. If present only requests that
  *          originate from this user will be duplciated (optional)
+ * async    Queue the duplicates and send them to the branch one at a time
+ *          without ever delaying the main session (optional)
+ * queue_size The maximum number of queued duplicates in async mode (optional)
  *
  * Revision History
  * ================
@@ -77,6 +80,9 @@
 #define PARENT                          0
 #define CHILD                           1
 
+/** Default number of statements a session can have waiting for the branch */
+#define TEE_QUEUE_SIZE_DEFAULT          "1000"
+
 #ifdef SS_DEBUG
 static int debug_seq = 0;
 #endif
@@ -122,6 +128,9 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
     regex_t nore; /* Compiled regex nomatch text */
+    bool async; /* Queue the statements for the branch */
+    int queue_size; /* Maximum number of queued statements per session */
+    int n_overflow; /* Number of statements dropped by all sessions */
 } TEE_INSTANCE;
 
 /**
@@ -156,6 +165,13 @@ typedef struct
     GWBUF* queue;
     SPINLOCK tee_lock;
     DCB* client_dcb;
+    GWBUF* branch_queue; /* Statements waiting for the branch in async mode */
+    int n_queued; /* Number of statements in branch_queue */
+    int n_overflow; /* Number of statements dropped because the queue was full */
+    bool branch_waiting; /* The branch has not replied to the last statement */
+    bool branch_flushing; /* A thread is sending the queued statements */
+    bool branch_large; /* The last statement sent to the branch continues */
+    uint8_t branch_command; /* The command of the statement being sent */
 
 #ifdef SS_DEBUG
     long d_id;
@@ -187,6 +203,9 @@ int route_single_query(TEE_INSTANCE* my_instance,
                        GWBUF* clone);
 int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer);
 void create_orphan(MXS_SESSION* ses);
+static int route_async_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session,
+                             GWBUF* buffer, GWBUF* clone);
+static void flush_branch_queue(TEE_SESSION* my_session);
 
 static void
 orphan_free(void* data)
@@ -344,6 +363,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 MXS_MODULE_OPT_NONE,
                 option_values
             },
+            {"async", MXS_MODULE_PARAM_BOOL, "false"},
+            {"queue_size", MXS_MODULE_PARAM_COUNT, TEE_QUEUE_SIZE_DEFAULT},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -373,6 +394,8 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->userName = config_copy_string(params, "user");
         my_instance->match = config_copy_string(params, "match");
         my_instance->nomatch = config_copy_string(params, "exclude");
+        my_instance->async = config_get_bool(params, "async");
+        my_instance->queue_size = config_get_integer(params, "queue_size");
 
         int cflags = config_get_enum(params, "options", option_values);
 
@@ -453,6 +476,7 @@ newSession(MXS_FILTER *instance, MXS_SESSION *session)
         my_session->instance = my_instance;
         my_session->client_multistatement = false;
         my_session->queue = NULL;
+        my_session->branch_queue = NULL;
         spinlock_init(&my_session->tee_lock);
         if (my_instance->source &&
             (remote = session_get_remote(session)) != NULL)
@@ -614,6 +638,7 @@ freeSession(MXS_FILTER *instance, MXS_FILTER_SESSION *session)
     {
         gwbuf_free(my_session->tee_replybuf);
     }
+    gwbuf_free(my_session->branch_queue);
     MXS_FREE(session);
 
     orphan_free(NULL);
@@ -676,6 +701,11 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
     TEE_SESSION *my_session = (TEE_SESSION *) session;
     GWBUF *clone = clone_query(my_instance, my_session, queue);
 
+    if (my_instance->async)
+    {
+        return route_async_query(my_instance, my_session, queue, clone);
+    }
+
     return route_single_query(my_instance, my_session, queue, clone);
 }
 
@@ -695,6 +725,12 @@ clientReply(MXS_FILTER* instance, MXS_FILTER_SESSION *session, GWBUF *reply)
     int rc = 1, branch, eof;
     TEE_SESSION *my_session = (TEE_SESSION *) session;
 
+    if (my_session->instance->async)
+    {
+        /** The branch may have replied while the main session waited */
+        flush_branch_queue(my_session);
+    }
+
     return my_session->up.clientReply(my_session->up.instance,
                                       my_session->up.session,
                                       reply);
@@ -739,12 +775,27 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match		%s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->async)
+    {
+        dcb_printf(dcb, "\t\tStatements queued per session		%d\n",
+                   my_instance->queue_size);
+        dcb_printf(dcb, "\t\tNo. of statements dropped:		%d\n",
+                   atomic_load_int32(&my_instance->n_overflow));
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of statements duplicated:	%d.\n",
                    my_session->n_duped);
         dcb_printf(dcb, "\t\tNo. of statements rejected:	%d.\n",
                    my_session->n_rejected);
+
+        if (my_instance->async)
+        {
+            dcb_printf(dcb, "\t\tNo. of statements queued:	%d.\n",
+                       my_session->n_queued);
+            dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                       my_session->n_overflow);
+        }
     }
 }
 
@@ -960,3 +1011,147 @@ void create_orphan(MXS_SESSION* ses)
         spinlock_release(&orphanLock);
     }
 }
+
+/**
+ * Check whether the branch will reply to a packet that is sent to it. Packets
+ * that continue in the next packet and the commands without a response get no
+ * reply.
+ *
+ * @param my_session Tee session
+ * @param packet     The packet about to be sent to the branch
+ * @return True if the branch will reply to the packet
+ */
+static bool branch_expects_reply(TEE_SESSION* my_session, GWBUF* packet)
+{
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (gwbuf_copy_data(packet, 0, sizeof(header), header) != sizeof(header))
+    {
+        return false;
+    }
+
+    if (!my_session->branch_large)
+    {
+        my_session->branch_command = header[MYSQL_HEADER_LEN];
+    }
+
+    my_session->branch_large = MYSQL_GET_PAYLOAD_LEN(header) == GW_MYSQL_MAX_PACKET_LEN;
+
+    return !my_session->branch_large &&
+           my_session->branch_command != MYSQL_COM_QUIT &&
+           my_session->branch_command != MYSQL_COM_STMT_SEND_LONG_DATA &&
+           my_session->branch_command != MYSQL_COM_STMT_CLOSE;
+}
+
+/**
+ * Send the queued statements to the branch session. A statement is sent only
+ * after the branch has replied to the previous one, so a slow branch never
+ * collects more statements than fit into the queue. The replies themselves are
+ * discarded by the cloned client DCB of the branch.
+ *
+ * @param my_session Tee session
+ */
+static void flush_branch_queue(TEE_SESSION* my_session)
+{
+    spinlock_acquire(&my_session->tee_lock);
+
+    if (my_session->branch_flushing)
+    {
+        spinlock_release(&my_session->tee_lock);
+        return;
+    }
+
+    my_session->branch_flushing = true;
+
+    while (my_session->branch_queue &&
+           (!my_session->branch_waiting || DCB_REPLIED(my_session->branch_dcb)))
+    {
+        GWBUF* packet = modutil_get_next_MySQL_packet(&my_session->branch_queue);
+
+        if (packet == NULL)
+        {
+            /** Only complete packets are queued */
+            gwbuf_free(my_session->branch_queue);
+            my_session->branch_queue = NULL;
+            my_session->n_queued = 0;
+            break;
+        }
+
+        my_session->n_queued--;
+        my_session->branch_waiting = branch_expects_reply(my_session, packet);
+        my_session->branch_dcb->flags &= ~DCBF_REPLIED;
+        spinlock_release(&my_session->tee_lock);
+
+        if (my_session->branch_session->state == SESSION_STATE_ROUTER_READY)
+        {
+            MXS_SESSION_ROUTE_QUERY(my_session->branch_session, packet);
+        }
+        else
+        {
+            gwbuf_free(packet);
+        }
+
+        spinlock_acquire(&my_session->tee_lock);
+    }
+
+    my_session->branch_flushing = false;
+    spinlock_release(&my_session->tee_lock);
+}
+
+/**
+ * Route the main query downstream and queue the clone for the branch session.
+ * The main query is routed whatever the state of the branch is. If the queue
+ * of the session is full, the clone is dropped.
+ *
+ * @param my_instance Tee instance
+ * @param my_session Tee session
+ * @param buffer Main buffer
+ * @param clone Cloned buffer, may be NULL
+ * @return The return value of the downstream component
+ */
+static int route_async_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session,
+                             GWBUF* buffer, GWBUF* clone)
+{
+    if (clone)
+    {
+        if (!my_session->active || my_session->branch_session == NULL ||
+            my_session->branch_session->state != SESSION_STATE_ROUTER_READY)
+        {
+            gwbuf_free(clone);
+        }
+        else
+        {
+            bool queued = false;
+
+            spinlock_acquire(&my_session->tee_lock);
+
+            if (my_session->n_queued < my_instance->queue_size)
+            {
+                my_session->branch_queue = gwbuf_append(my_session->branch_queue, clone);
+                my_session->n_queued++;
+                my_session->n_duped++;
+                queued = true;
+            }
+            else
+            {
+                my_session->n_overflow++;
+            }
+
+            spinlock_release(&my_session->tee_lock);
+
+            if (queued)
+            {
+                flush_branch_queue(my_session);
+            }
+            else
+            {
+                atomic_add(&my_instance->n_overflow, 1);
+                gwbuf_free(clone);
+            }
+        }
+    }
+
+    return my_session->down.routeQuery(my_session->down.instance,
+                                       my_session->down.session,
+                                       buffer);
+}
@@ -46,6 +46,22 @@
 #include <regex.h>
 #include <maxscale/atomic.h>
 #include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/digest.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/poll.h>
+#include <maxscale/spinlock.h>
+
+/** How much of the canonical form of a query shape is stored */
+#define TOPN_SHAPE_LEN 256
+
+/** The orders in which the query shapes are summarized */
+enum topn_order
+{
+    TOPN_BY_COUNT, /* Most frequently executed */
+    TOPN_BY_TIME,  /* Most total execution time */
+    TOPN_N_ORDERS
+};
 
 /*
  * The filter entry points
@@ -80,6 +96,10 @@ typedef struct
     regex_t re; /* Compiled regex text */
     char *exclude; /* Optional text to match against for exclusion */
     regex_t exre; /* Compiled regex nomatch text */
+    int summary_size; /* Number of query shapes each thread summarizes */
+    int n_summaries; /* Number of summary sets, one for each worker thread
+                      * and one shared by the other threads */
+    struct topn_summary *summaries; /* TOPN_N_ORDERS summaries for each set */
 } TOPN_INSTANCE;
 
 /**
@@ -91,6 +111,36 @@ typedef struct topnq
     char *sql;
 } TOPNQ;
 
+/**
+ * The statistics of one query shape
+ */
+typedef struct topn_shape
+{
+    MXS_DIGEST digest;   /* The digest of the queries */
+    uint64_t weight;     /* The value the shapes are ordered by */
+    uint64_t count;      /* Number of executions */
+    uint64_t total_us;   /* Total execution time in microseconds */
+    uint64_t max_us;     /* Longest execution time in microseconds */
+    int heap_pos;        /* Position in the heap of the summary */
+    char sql[TOPN_SHAPE_LEN]; /* The canonical form of the first query */
+} TOPN_SHAPE;
+
+/**
+ * A space-saving summary of the query shapes of one worker thread. The shapes
+ * form a min-heap by weight. When the summary is full, a new shape replaces the
+ * lightest one and inherits its weight, so that the heaviest shapes are never
+ * lost. Only the owning thread updates the summary, the lock is there for the
+ * diagnostics, which read all of them.
+ */
+typedef struct topn_summary
+{
+    SPINLOCK lock;
+    int size;            /* Number of shapes in use */
+    TOPN_SHAPE *shapes;  /* The shapes */
+    TOPN_SHAPE **heap;   /* The shapes ordered as a min-heap by weight */
+    HASHTABLE *index;    /* The shapes by digest */
+} TOPN_SUMMARY;
+
 /**
  * The session structure for this TOPN filter.
  * This stores the downstream filter information, such that the
@@ -115,6 +165,8 @@ typedef struct
     struct timeval total;
     struct timeval connect;
     struct timeval disconnect;
+    MXS_DIGEST digest; /* The digest of the current query */
+    bool has_digest; /* Whether the current query has a digest */
 } TOPN_SESSION;
 
 static const MXS_ENUM_VALUE option_values[] =
@@ -169,6 +221,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"exclude", MXS_MODULE_PARAM_STRING},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"summary_size", MXS_MODULE_PARAM_COUNT, "0"},
             {
                 "options",
                 MXS_MODULE_PARAM_ENUM,
@@ -182,6 +235,289 @@ MXS_MODULE* MXS_CREATE_MODULE()
 
     return &info;
 }
+
+static int digest_hash(const void *key)
+{
+    const MXS_DIGEST *digest = (const MXS_DIGEST*)key;
+    return digest->lo & 0x7fffffff;
+}
+
+static int digest_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(MXS_DIGEST));
+}
+
+static void heap_swap(TOPN_SUMMARY *summary, int a, int b)
+{
+    TOPN_SHAPE *tmp = summary->heap[a];
+    summary->heap[a] = summary->heap[b];
+    summary->heap[b] = tmp;
+    summary->heap[a]->heap_pos = a;
+    summary->heap[b]->heap_pos = b;
+}
+
+static void heap_up(TOPN_SUMMARY *summary, int pos)
+{
+    while (pos > 0 && summary->heap[(pos - 1) / 2]->weight > summary->heap[pos]->weight)
+    {
+        heap_swap(summary, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void heap_down(TOPN_SUMMARY *summary, int pos)
+{
+    while (true)
+    {
+        int smallest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+
+        if (left < summary->size && summary->heap[left]->weight < summary->heap[smallest]->weight)
+        {
+            smallest = left;
+        }
+        if (right < summary->size && summary->heap[right]->weight < summary->heap[smallest]->weight)
+        {
+            smallest = right;
+        }
+        if (smallest == pos)
+        {
+            break;
+        }
+
+        heap_swap(summary, pos, smallest);
+        pos = smallest;
+    }
+}
+
+/**
+ * Allocate the summaries of all threads
+ *
+ * @param instance The filter instance
+ * @return True on success
+ */
+static bool alloc_summaries(TOPN_INSTANCE *instance)
+{
+    int n = instance->n_summaries * TOPN_N_ORDERS;
+
+    if ((instance->summaries = MXS_CALLOC(n, sizeof(TOPN_SUMMARY))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        TOPN_SUMMARY *summary = &instance->summaries[i];
+        spinlock_init(&summary->lock);
+
+        if ((summary->shapes = MXS_CALLOC(instance->summary_size, sizeof(TOPN_SHAPE))) == NULL ||
+            (summary->heap = MXS_CALLOC(instance->summary_size, sizeof(TOPN_SHAPE*))) == NULL ||
+            (summary->index = hashtable_alloc(instance->summary_size * 2,
+                                              digest_hash, digest_cmp)) == NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void free_summaries(TOPN_INSTANCE *instance)
+{
+    if (instance->summaries)
+    {
+        for (int i = 0; i < instance->n_summaries * TOPN_N_ORDERS; i++)
+        {
+            MXS_FREE(instance->summaries[i].shapes);
+            MXS_FREE(instance->summaries[i].heap);
+            hashtable_free(instance->summaries[i].index);
+        }
+
+        MXS_FREE(instance->summaries);
+    }
+}
+
+/**
+ * Add an execution of a query to a summary
+ *
+ * @param summary  The summary
+ * @param size     Capacity of the summary
+ * @param digest   Digest of the query
+ * @param sql      The query, used if the shape is new
+ * @param duration Execution time in microseconds
+ * @param weight   How much the execution adds to the weight of the shape
+ */
+static void summary_add(TOPN_SUMMARY *summary, int size, const MXS_DIGEST *digest,
+                        const char *sql, uint64_t duration, uint64_t weight)
+{
+    spinlock_acquire(&summary->lock);
+
+    TOPN_SHAPE *shape = hashtable_fetch(summary->index, (void*)digest);
+
+    if (shape == NULL)
+    {
+        if (summary->size < size)
+        {
+            shape = &summary->shapes[summary->size];
+            shape->heap_pos = summary->size;
+            shape->weight = 0;
+            summary->heap[summary->size++] = shape;
+            heap_up(summary, shape->heap_pos);
+        }
+        else
+        {
+            /** Replace the lightest shape, the new one inherits its weight */
+            shape = summary->heap[0];
+            hashtable_delete(summary->index, &shape->digest);
+        }
+
+        shape->digest = *digest;
+        shape->count = 0;
+        shape->total_us = 0;
+        shape->max_us = 0;
+
+        /** Only the beginning of the query is stored, no need to look further */
+        size_t len = strnlen(sql, TOPN_SHAPE_LEN * 4);
+        char canonical[len + 1];
+        len = mxs_digest_canonicalize(sql, len, canonical);
+
+        if (len >= sizeof(shape->sql))
+        {
+            len = sizeof(shape->sql) - 1;
+        }
+
+        memcpy(shape->sql, canonical, len);
+        shape->sql[len] = '\0';
+        hashtable_add(summary->index, &shape->digest, shape);
+    }
+
+    shape->weight += weight;
+    shape->count++;
+    shape->total_us += duration;
+
+    if (duration > shape->max_us)
+    {
+        shape->max_us = duration;
+    }
+
+    heap_down(summary, shape->heap_pos);
+
+    spinlock_release(&summary->lock);
+}
+
+/**
+ * Add an execution of a query to the summaries of the current thread
+ *
+ * @param instance The filter instance
+ * @param digest   Digest of the query
+ * @param sql      The query
+ * @param duration Execution time
+ */
+static void add_to_summaries(TOPN_INSTANCE *instance, const MXS_DIGEST *digest,
+                             const char *sql, const struct timeval *duration)
+{
+    /** The threads that are not workers share the last set, the summaries are locked anyway */
+    int thread_id = poll_current_worker();
+    int set = thread_id != -1 && thread_id < instance->n_summaries - 1 ?
+              thread_id : instance->n_summaries - 1;
+    TOPN_SUMMARY *summaries = &instance->summaries[set * TOPN_N_ORDERS];
+    uint64_t us = duration->tv_sec * 1000000 + duration->tv_usec;
+
+    summary_add(&summaries[TOPN_BY_COUNT], instance->summary_size, digest, sql, us, 1);
+    summary_add(&summaries[TOPN_BY_TIME], instance->summary_size, digest, sql, us, us);
+}
+
+static int cmp_shape_digest(const void *va, const void *vb)
+{
+    const TOPN_SHAPE *a = (const TOPN_SHAPE*)va;
+    const TOPN_SHAPE *b = (const TOPN_SHAPE*)vb;
+    return memcmp(&a->digest, &b->digest, sizeof(MXS_DIGEST));
+}
+
+static int cmp_shape_weight(const void *va, const void *vb)
+{
+    const TOPN_SHAPE *a = (const TOPN_SHAPE*)va;
+    const TOPN_SHAPE *b = (const TOPN_SHAPE*)vb;
+    return a->weight < b->weight ? 1 : (a->weight > b->weight ? -1 : 0);
+}
+
+/**
+ * Merge the summaries of all threads and print the heaviest shapes
+ *
+ * @param instance The filter instance
+ * @param order    Which summaries to merge
+ * @param dcb      The DCB to print to
+ */
+static void print_global_top(TOPN_INSTANCE *instance, enum topn_order order, DCB *dcb)
+{
+    TOPN_SHAPE *shapes = MXS_MALLOC(instance->n_summaries * instance->summary_size *
+                                    sizeof(TOPN_SHAPE));
+    int n = 0;
+
+    if (shapes == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < instance->n_summaries; i++)
+    {
+        TOPN_SUMMARY *summary = &instance->summaries[i * TOPN_N_ORDERS + order];
+        spinlock_acquire(&summary->lock);
+        memcpy(shapes + n, summary->shapes, summary->size * sizeof(TOPN_SHAPE));
+        n += summary->size;
+        spinlock_release(&summary->lock);
+    }
+
+    /** Combine the shapes that more than one thread has seen */
+    qsort(shapes, n, sizeof(TOPN_SHAPE), cmp_shape_digest);
+    int merged = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (merged > 0 && memcmp(&shapes[merged - 1].digest, &shapes[i].digest,
+                                 sizeof(MXS_DIGEST)) == 0)
+        {
+            TOPN_SHAPE *shape = &shapes[merged - 1];
+            shape->weight += shapes[i].weight;
+            shape->count += shapes[i].count;
+            shape->total_us += shapes[i].total_us;
+
+            if (shapes[i].max_us > shape->max_us)
+            {
+                shape->max_us = shapes[i].max_us;
+            }
+        }
+        else
+        {
+            shapes[merged++] = shapes[i];
+        }
+    }
+
+    qsort(shapes, merged, sizeof(TOPN_SHAPE), cmp_shape_weight);
+
+    dcb_printf(dcb, "\t\tGlobal top %d %s:\n", instance->topN,
+               order == TOPN_BY_COUNT ? "most frequent queries" : "queries by total time");
+
+    for (int i = 0; i < merged && i < instance->topN; i++)
+    {
+        TOPN_SHAPE *shape = &shapes[i];
+        char digest[MXS_DIGEST_STR_LEN];
+        mxs_digest_to_string(&shape->digest, digest);
+
+        dcb_printf(dcb, "\t\t%d place:\n", i + 1);
+        dcb_printf(dcb, "\t\t\tDigest: %s\n", digest);
+        dcb_printf(dcb, "\t\t\tExecutions: %lu\n", shape->count);
+        dcb_printf(dcb, "\t\t\tTotal time: %.3f seconds\n", shape->total_us / 1000000.0);
+        dcb_printf(dcb, "\t\t\tAverage time: %.3f seconds\n",
+                   shape->total_us / 1000000.0 / shape->count);
+        dcb_printf(dcb, "\t\t\tLongest time: %.3f seconds\n", shape->max_us / 1000000.0);
+        dcb_printf(dcb, "\t\t\tSQL: %s\n", shape->sql);
+    }
+
+    MXS_FREE(shapes);
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -206,6 +542,9 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
         my_instance->filebase = MXS_STRDUP_A(config_get_string(params, "filebase"));
+        my_instance->summary_size = config_get_integer(params, "summary_size");
+        my_instance->n_summaries = config_threadcount() + 1;
+        my_instance->summaries = NULL;
 
         int cflags = config_get_enum(params, "options", option_values);
         bool error = false;
@@ -233,8 +572,14 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
             error = true;
         }
 
+        if (!error && my_instance->summary_size > 0 && !alloc_summaries(my_instance))
+        {
+            error = true;
+        }
+
         if (error)
         {
+            free_summaries(my_instance);
             if (my_instance->exclude)
             {
                 regfree(&my_instance->exre);
@@ -484,6 +829,8 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                 }
                 gettimeofday(&my_session->start, NULL);
                 my_session->current = ptr;
+                my_session->has_digest = my_instance->summaries &&
+                                         mxs_digest_get(queue, &my_session->digest);
             }
             else
             {
@@ -496,17 +843,10 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
                                        my_session->down.session, queue);
 }
 
-static int
-cmp_topn(const void *va, const void *vb)
+static bool
+is_longer(const struct timeval *a, const struct timeval *b)
 {
-    TOPNQ **a = (TOPNQ **) va;
-    TOPNQ **b = (TOPNQ **) vb;
-
-    if ((*b)->duration.tv_sec == (*a)->duration.tv_sec)
-    {
-        return (*b)->duration.tv_usec - (*a)->duration.tv_usec;
-    }
-    return (*b)->duration.tv_sec - (*a)->duration.tv_sec;
+    return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_usec > b->tv_usec);
 }
 
 static int
@@ -515,7 +855,7 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
     TOPN_INSTANCE *my_instance = (TOPN_INSTANCE *) instance;
     TOPN_SESSION *my_session = (TOPN_SESSION *) session;
     struct timeval tv, diff;
-    int i, inserted;
+    int i;
 
     if (my_session->current)
     {
@@ -524,32 +864,36 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
 
         timeradd(&(my_session->total), &diff, &(my_session->total));
 
-        inserted = 0;
-        for (i = 0; i < my_instance->topN; i++)
+        if (my_session->has_digest)
         {
-            if (my_session->top[i]->sql == NULL)
-            {
-                my_session->top[i]->sql = my_session->current;
-                my_session->top[i]->duration = diff;
-                inserted = 1;
-                break;
-            }
+            add_to_summaries(my_instance, &my_session->digest, my_session->current, &diff);
         }
 
-        if (inserted == 0 && ((diff.tv_sec > my_session->top[my_instance->topN - 1]->duration.tv_sec) ||
-                              (diff.tv_sec == my_session->top[my_instance->topN - 1]->duration.tv_sec &&
-                               diff.tv_usec > my_session->top[my_instance->topN - 1]->duration.tv_usec)))
-        {
-            MXS_FREE(my_session->top[my_instance->topN - 1]->sql);
-            my_session->top[my_instance->topN - 1]->sql = my_session->current;
-            my_session->top[my_instance->topN - 1]->duration = diff;
-            inserted = 1;
-        }
+        /**
+         * The list is kept sorted by moving the shorter queries down one
+         * place. An empty slot counts as the shortest query.
+         */
+        TOPNQ *last = my_session->top[my_instance->topN - 1];
 
-        if (inserted)
+        if (last->sql == NULL || is_longer(&diff, &last->duration))
         {
-            qsort(my_session->top, my_instance->topN,
-                  sizeof(TOPNQ *), cmp_topn);
+            MXS_FREE(last->sql);
+
+            for (i = my_instance->topN - 1; i > 0; i--)
+            {
+                TOPNQ *prev = my_session->top[i - 1];
+
+                if (prev->sql && !is_longer(&diff, &prev->duration))
+                {
+                    break;
+                }
+
+                my_session->top[i] = prev;
+            }
+
+            last->sql = my_session->current;
+            last->duration = diff;
+            my_session->top[i] = last;
         }
         else
         {
@@ -603,6 +947,11 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->exclude);
     }
+    if (my_instance->summaries && my_session == NULL)
+    {
+        print_global_top(my_instance, TOPN_BY_COUNT, dcb);
+        print_global_top(my_instance, TOPN_BY_TIME, dcb);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tLogging to file %s.\n",
@@ -32,6 +32,9 @@
  *  query_delimiter=<delimiter for query statements in a transaction (default='@@@')>
  *  source=<source address to limit filter>
  *  user=<username to limit filter>
+ *  mode=<log|aggregate (default=log)>
+ *  log_threshold=<log aggregated transactions slower than this many milliseconds>
+ *  max_transactions=<transaction shapes tracked by each thread (default=256)>
  *
  * Date         Who             Description
  * 06/12/2015   Dong Young Yoon Initial implementation
@@ -62,7 +65,13 @@
 #include <maxscale/thread.h>
 #include <maxscale/server.h>
 #include <maxscale/atomic.h>
+#include <maxscale/hashtable.h>
+#include <maxscale/modulecmd.h>
+#include <maxscale/poll.h>
 #include <maxscale/query_classifier.h>
+#include <maxscale/spinlock.h>
+#include <maxscale/stmtinfo.h>
+#include <maxscale/utils.h>
 
 /* The maximum size for query statements in a transaction (64MB) */
 static size_t sql_size_limit = 64 * 1024 * 1024;
@@ -73,6 +82,61 @@ static const int default_sql_size = 4 * 1024;
 #define DEFAULT_LOG_DELIMITER   ":::"
 #define DEFAULT_FILE_NAME       "tpm.log"
 #define DEFAULT_NAMED_PIPE       "/tmp/tpmfilter"
+#define DEFAULT_MAX_TRANSACTIONS "256"
+
+/** Length of the canonical statements stored for a transaction shape */
+#define TPM_SHAPE_SQL_LEN 256
+
+/**
+ * The latency histograms have 2^TPM_HIST_SUB_BITS exact buckets for the
+ * smallest values and then half as many buckets for each power of two,
+ * which keeps the error of each value below 1/16. Latencies are in
+ * microseconds and anything above 2^TPM_HIST_MAX_BITS is put in the last
+ * bucket.
+ */
+#define TPM_HIST_SUB_BITS  5
+#define TPM_HIST_SUB_COUNT (1 << TPM_HIST_SUB_BITS)
+#define TPM_HIST_HALF      (TPM_HIST_SUB_COUNT / 2)
+#define TPM_HIST_MAX_BITS  38
+#define TPM_HIST_BUCKETS   (TPM_HIST_SUB_COUNT + (TPM_HIST_MAX_BITS - TPM_HIST_SUB_BITS) * TPM_HIST_HALF)
+
+typedef enum
+{
+    TPM_MODE_LOG,
+    TPM_MODE_AGGREGATE
+} tpm_mode_t;
+
+static const MXS_ENUM_VALUE mode_values[] =
+{
+    {"log",       TPM_MODE_LOG},
+    {"aggregate", TPM_MODE_AGGREGATE},
+    {NULL}
+};
+
+/**
+ * The aggregated latencies of transactions with the same sequence of
+ * statement digests
+ */
+typedef struct
+{
+    MXS_DIGEST digest;                   /* Digest of the statement digests */
+    uint64_t   count;                    /* Number of transactions */
+    uint64_t   total_us;                 /* Total latency */
+    uint64_t   min_us;                   /* Lowest latency */
+    uint64_t   max_us;                   /* Highest latency */
+    uint64_t   hist[TPM_HIST_BUCKETS];   /* Latency histogram */
+    char       sql[TPM_SHAPE_SQL_LEN];   /* Canonical statements, truncated */
+} TPM_SHAPE;
+
+/** The transaction shapes of one worker thread */
+typedef struct
+{
+    SPINLOCK   lock;        /* Protects the table */
+    HASHTABLE *index;       /* The shapes by digest */
+    TPM_SHAPE *shapes;      /* max_transactions shapes */
+    int        size;        /* Shapes in use */
+    uint64_t   n_untracked; /* Transactions whose shape did not fit */
+} TPM_TABLE;
 
 /*
  * The filter entry points
@@ -88,6 +152,7 @@ static  int clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, GWBU
 static  void    diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb);
 static uint64_t getCapabilities(MXS_FILTER* instance);
 static  void checkNamedPipe(void *args);
+static bool tpm_show_transactions(const MODULECMD_ARG *argv);
 
 /**
  * A instance structure, every instance will write to a same file.
@@ -106,6 +171,13 @@ typedef struct
 
     int query_delimiter_size; /* the length of the query delimiter */
     FILE* fp;
+
+    tpm_mode_t mode;           /* Log or aggregate the transactions */
+    int log_threshold;         /* Log aggregated transactions slower than this, in ms */
+    int max_transactions;      /* Shapes tracked by each thread */
+    int n_tables;              /* Number of tables, one for each worker thread
+                                * and one shared by the other threads */
+    TPM_TABLE *tables;         /* The shapes of each thread */
 } TPM_INSTANCE;
 
 /**
@@ -133,8 +205,198 @@ typedef struct
     char    *buf;
     int sql_index;
     size_t      max_sql_size;
+    int         trx_statements;  /* Statements in the aggregated transaction */
+    MXS_DIGEST  trx_digest;      /* Digest of the statements so far */
+    char        trx_sql[TPM_SHAPE_SQL_LEN]; /* Canonical statements so far */
+    size_t      trx_sql_len;
 } TPM_SESSION;
 
+/**
+ * Get the histogram bucket of a latency
+ *
+ * @param value The latency in microseconds
+ * @return The index of the bucket
+ */
+static int hist_bucket(uint64_t value)
+{
+    if (value < TPM_HIST_SUB_COUNT)
+    {
+        return value;
+    }
+
+    if (value >= (uint64_t)1 << TPM_HIST_MAX_BITS)
+    {
+        return TPM_HIST_BUCKETS - 1;
+    }
+
+    int shift = (63 - __builtin_clzll(value)) - (TPM_HIST_SUB_BITS - 1);
+    int sub = value >> shift;
+
+    return TPM_HIST_SUB_COUNT + (shift - 1) * TPM_HIST_HALF + (sub - TPM_HIST_HALF);
+}
+
+/**
+ * Get the highest latency that goes in a histogram bucket
+ *
+ * @param bucket The index of the bucket
+ * @return The highest latency of the bucket in microseconds
+ */
+static uint64_t hist_bucket_value(int bucket)
+{
+    if (bucket < TPM_HIST_SUB_COUNT)
+    {
+        return bucket;
+    }
+
+    int shift = (bucket - TPM_HIST_SUB_COUNT) / TPM_HIST_HALF + 1;
+    uint64_t sub = (bucket - TPM_HIST_SUB_COUNT) % TPM_HIST_HALF + TPM_HIST_HALF;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Get a percentile of the latencies of a shape
+ *
+ * @param shape      The transaction shape
+ * @param percentile The percentile between 0 and 1
+ * @return The percentile in microseconds
+ */
+static uint64_t shape_percentile(const TPM_SHAPE *shape, double percentile)
+{
+    uint64_t target = (uint64_t)(shape->count * percentile + 0.5);
+    uint64_t seen = 0;
+
+    if (target == 0)
+    {
+        target = 1;
+    }
+
+    for (int i = 0; i < TPM_HIST_BUCKETS; i++)
+    {
+        seen += shape->hist[i];
+
+        if (seen >= target)
+        {
+            uint64_t value = hist_bucket_value(i);
+            return value < shape->max_us ? value : shape->max_us;
+        }
+    }
+
+    return shape->max_us;
+}
+
+static int digest_hash(const void *key)
+{
+    return ((const MXS_DIGEST*)key)->lo & 0x7fffffff;
+}
+
+static int digest_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(MXS_DIGEST));
+}
+
+/**
+ * Add a finished transaction to the table of the current thread
+ *
+ * @param instance The filter instance
+ * @param session  The session whose transaction finished
+ * @param latency  The latency of the transaction in microseconds
+ */
+static void record_transaction(TPM_INSTANCE *instance, TPM_SESSION *session, uint64_t latency)
+{
+    /** The threads that are not workers share the last table, the tables are locked anyway */
+    int thread_id = poll_current_worker();
+    int i = thread_id != -1 && thread_id < instance->n_tables - 1 ? thread_id : instance->n_tables - 1;
+    TPM_TABLE *table = &instance->tables[i];
+
+    spinlock_acquire(&table->lock);
+
+    TPM_SHAPE *shape = (TPM_SHAPE*)hashtable_fetch(table->index, &session->trx_digest);
+
+    if (shape == NULL && table->size < instance->max_transactions)
+    {
+        shape = &table->shapes[table->size];
+        memset(shape, 0, sizeof(*shape));
+        shape->digest = session->trx_digest;
+        shape->min_us = latency;
+        memcpy(shape->sql, session->trx_sql, session->trx_sql_len);
+        shape->sql[session->trx_sql_len] = '\0';
+
+        if (hashtable_add(table->index, &shape->digest, shape))
+        {
+            table->size++;
+        }
+        else
+        {
+            shape = NULL;
+        }
+    }
+
+    if (shape)
+    {
+        shape->count++;
+        shape->total_us += latency;
+        shape->min_us = latency < shape->min_us ? latency : shape->min_us;
+        shape->max_us = latency > shape->max_us ? latency : shape->max_us;
+        shape->hist[hist_bucket(latency)]++;
+    }
+    else
+    {
+        table->n_untracked++;
+    }
+
+    spinlock_release(&table->lock);
+}
+
+/**
+ * Allocate the per-thread tables of the aggregation mode
+ *
+ * @param instance The filter instance
+ * @return True on success
+ */
+static bool alloc_tables(TPM_INSTANCE *instance)
+{
+    instance->n_tables = config_threadcount() + 1;
+    instance->tables = MXS_CALLOC(instance->n_tables, sizeof(TPM_TABLE));
+
+    if (instance->tables == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < instance->n_tables; i++)
+    {
+        TPM_TABLE *table = &instance->tables[i];
+        spinlock_init(&table->lock);
+        table->shapes = MXS_MALLOC(instance->max_transactions * sizeof(TPM_SHAPE));
+        /** The keys and values point into the shapes */
+        table->index = hashtable_alloc(instance->max_transactions, digest_hash, digest_cmp);
+
+        if (table->shapes == NULL || table->index == NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void free_tables(TPM_INSTANCE *instance)
+{
+    if (instance->tables)
+    {
+        for (int i = 0; i < instance->n_tables; i++)
+        {
+            if (instance->tables[i].index)
+            {
+                hashtable_free(instance->tables[i].index);
+            }
+            MXS_FREE(instance->tables[i].shapes);
+        }
+        MXS_FREE(instance->tables);
+    }
+}
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -145,6 +407,15 @@ typedef struct
  */
 MXS_MODULE* MXS_CREATE_MODULE()
 {
+    static modulecmd_arg_type_t transactions_argv[] =
+    {
+        {MODULECMD_ARG_OUTPUT, "DCB where result is written"},
+        {MODULECMD_ARG_FILTER | MODULECMD_ARG_NAME_MATCHES_DOMAIN, "Filter to inspect"}
+    };
+
+    modulecmd_register_command(MXS_MODULE_NAME, "transactions", tpm_show_transactions,
+                               MXS_ARRAY_NELEMS(transactions_argv), transactions_argv);
+
     static MXS_FILTER_OBJECT MyObject =
     {
         createInstance,
@@ -179,6 +450,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"query_delimiter", MXS_MODULE_PARAM_STRING, DEFAULT_QUERY_DELIMITER},
             {"source", MXS_MODULE_PARAM_STRING},
             {"user", MXS_MODULE_PARAM_STRING},
+            {"mode", MXS_MODULE_PARAM_ENUM, "log", MXS_MODULE_OPT_ENUM_UNIQUE, mode_values},
+            {"log_threshold", MXS_MODULE_PARAM_COUNT, "0"},
+            {"max_transactions", MXS_MODULE_PARAM_COUNT, DEFAULT_MAX_TRANSACTIONS},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -211,9 +485,18 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
         my_instance->named_pipe = MXS_STRDUP_A(config_get_string(params, "named_pipe"));
         my_instance->source = config_copy_string(params, "source");
         my_instance->user = config_copy_string(params, "user");
+        my_instance->mode = config_get_enum(params, "mode", mode_values);
+        my_instance->log_threshold = config_get_integer(params, "log_threshold");
+        my_instance->max_transactions = config_get_integer(params, "max_transactions");
 
         bool error = false;
 
+        if (my_instance->mode == TPM_MODE_AGGREGATE && !alloc_tables(my_instance))
+        {
+            MXS_ERROR("Failed to allocate the transaction tables.");
+            error = true;
+        }
+
         // check if the file exists first.
         if (access(my_instance->named_pipe, F_OK) == 0)
         {
@@ -269,6 +552,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
 
         if (error)
         {
+            free_tables(my_instance);
             MXS_FREE(my_instance->delimiter);
             MXS_FREE(my_instance->filename);
             MXS_FREE(my_instance->named_pipe);
@@ -280,6 +564,7 @@ createInstance(const char *name, char **options, MXS_CONFIG_PARAMETER *params)
                 fclose(my_instance->fp);
             }
             MXS_FREE(my_instance);
+            my_instance = NULL;
         }
     }
 
@@ -417,6 +702,113 @@ setUpstream(MXS_FILTER *instance, MXS_FILTER_SESSION *session, MXS_UPSTREAM *ups
     my_session->up = *upstream;
 }
 
+/**
+ * Add a statement to the transaction being aggregated
+ *
+ * The digest of the transaction is the digest of the statement digests in
+ * the order they were executed.
+ *
+ * @param instance The filter instance
+ * @param session  The filter session
+ * @param queue    The statement
+ */
+static void aggregate_statement(TPM_INSTANCE *instance, TPM_SESSION *session, GWBUF *queue)
+{
+    uint32_t parts = MXS_STMT_INFO_DIGEST | MXS_STMT_INFO_CANONICAL | MXS_STMT_INFO_TYPE;
+    const MXS_STMT_INFO *info = mxs_stmt_info_get(queue, parts);
+
+    session->query_end = false;
+
+    if (info == NULL || (info->parts & parts) != parts)
+    {
+        return;
+    }
+
+    if (info->type_mask & QUERY_TYPE_COMMIT)
+    {
+        session->query_end = true;
+    }
+    else if (info->type_mask & QUERY_TYPE_ROLLBACK)
+    {
+        session->query_end = true;
+        session->trx_statements = 0;
+    }
+    else
+    {
+        MXS_DIGEST chain[2];
+
+        if (session->trx_statements == 0)
+        {
+            gettimeofday(&session->current_start, NULL);
+            memset(&chain[0], 0, sizeof(chain[0]));
+            session->trx_sql_len = 0;
+        }
+        else
+        {
+            chain[0] = session->trx_digest;
+        }
+
+        chain[1] = info->digest;
+        mxs_digest_hash(chain, sizeof(chain), 0, &session->trx_digest);
+        session->trx_statements++;
+
+        /** The stored statements are truncated, the digest covers all of them */
+        size_t space = sizeof(session->trx_sql) - 1 - session->trx_sql_len;
+
+        if (session->trx_sql_len > 0 && space > 0)
+        {
+            size_t len = MXS_MIN((size_t)instance->query_delimiter_size, space);
+            memcpy(session->trx_sql + session->trx_sql_len, instance->query_delimiter, len);
+            session->trx_sql_len += len;
+            space -= len;
+        }
+
+        size_t len = MXS_MIN(info->canonical_len, space);
+        memcpy(session->trx_sql + session->trx_sql_len, info->canonical, len);
+        session->trx_sql_len += len;
+    }
+}
+
+/**
+ * Finish the transaction being aggregated
+ *
+ * @param instance The filter instance
+ * @param session  The filter session
+ * @param reply    The reply to the COMMIT
+ */
+static void aggregate_transaction(TPM_INSTANCE *instance, TPM_SESSION *session, GWBUF *reply)
+{
+    struct timeval tv, diff;
+    gettimeofday(&tv, NULL);
+    timersub(&tv, &session->current_start, &diff);
+
+    uint64_t micros = diff.tv_sec * (uint64_t)1000000 + diff.tv_usec;
+    record_transaction(instance, session, micros);
+
+    if (instance->log_threshold > 0 && micros / 1000 >= (uint64_t)instance->log_threshold)
+    {
+        char digest[MXS_DIGEST_STR_LEN];
+        mxs_digest_to_string(&session->trx_digest, digest);
+        session->trx_sql[session->trx_sql_len] = '\0';
+
+        /* this prints "timestamp | server_name | user_name | latency | digest | sql_statements" */
+        fprintf(instance->fp, "%ld%s%s%s%s%s%lu%s%s%s%s\n",
+                (long)tv.tv_sec,
+                instance->delimiter,
+                reply->server ? reply->server->unique_name : "",
+                instance->delimiter,
+                session->userName ? session->userName : "",
+                instance->delimiter,
+                (unsigned long)(micros / 1000),
+                instance->delimiter,
+                digest,
+                instance->delimiter,
+                session->trx_sql);
+    }
+
+    session->trx_statements = 0;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -437,7 +829,11 @@ routeQuery(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *queue)
 
     if (my_session->active)
     {
-        if ((ptr = modutil_get_SQL(queue)) != NULL)
+        if (my_instance->mode == TPM_MODE_AGGREGATE)
+        {
+            aggregate_statement(my_instance, my_session, queue);
+        }
+        else if ((ptr = modutil_get_SQL(queue)) != NULL)
         {
             uint32_t query_type = qc_get_type_mask(queue);
             int query_len = strlen(ptr);
@@ -525,8 +921,15 @@ clientReply(MXS_FILTER *instance, MXS_FILTER_SESSION *session, GWBUF *reply)
     struct      timeval     tv, diff;
     int     i, inserted;
 
+    if (my_instance->mode == TPM_MODE_AGGREGATE)
+    {
+        if (my_session->query_end && my_session->trx_statements > 0)
+        {
+            aggregate_transaction(my_instance, my_session, reply);
+        }
+    }
     /* found 'commit' and sql statements exist. */
-    if (my_session->query_end && my_session->sql_index > 0)
+    else if (my_session->query_end && my_session->sql_index > 0)
     {
         gettimeofday(&tv, NULL);
         timersub(&tv, &(my_session->current_start), &diff);
@@ -595,6 +998,178 @@ diagnostic(MXS_FILTER *instance, MXS_FILTER_SESSION *fsession, DCB *dcb)
     if (my_instance->query_delimiter)
         dcb_printf(dcb, "\t\tLogging with query delimiter %s.\n",
                    my_instance->query_delimiter);
+    if (my_instance->mode == TPM_MODE_AGGREGATE)
+    {
+        int shapes = 0;
+        uint64_t untracked = 0;
+
+        for (int i = 0; i < my_instance->n_tables; i++)
+        {
+            spinlock_acquire(&my_instance->tables[i].lock);
+            shapes += my_instance->tables[i].size;
+            untracked += my_instance->tables[i].n_untracked;
+            spinlock_release(&my_instance->tables[i].lock);
+        }
+
+        dcb_printf(dcb, "\t\tAggregating transactions, %d shapes tracked in %d tables, "
+                   "%lu not tracked.\n", shapes, my_instance->n_tables, (unsigned long)untracked);
+        if (my_instance->log_threshold > 0)
+            dcb_printf(dcb, "\t\tLogging transactions slower than %d ms.\n",
+                       my_instance->log_threshold);
+    }
+}
+
+static int shape_cmp(const void *a, const void *b)
+{
+    return digest_cmp(&((const TPM_SHAPE*)a)->digest, &((const TPM_SHAPE*)b)->digest);
+}
+
+/**
+ * Print a string as a JSON string
+ */
+static void json_print_string(DCB *dcb, const char *str)
+{
+    dcb_printf(dcb, "\"");
+
+    for (const char *ptr = str; *ptr; ptr++)
+    {
+        unsigned char c = *ptr;
+
+        if (c == '"' || c == '\\')
+        {
+            dcb_printf(dcb, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            dcb_printf(dcb, "\\u%04x", c);
+        }
+        else
+        {
+            dcb_printf(dcb, "%c", c);
+        }
+    }
+
+    dcb_printf(dcb, "\"");
+}
+
+static void json_print_shape(DCB *dcb, const TPM_SHAPE *shape)
+{
+    char digest[MXS_DIGEST_STR_LEN];
+    mxs_digest_to_string(&shape->digest, digest);
+
+    dcb_printf(dcb, "{\"digest\":\"%s\",\"statements\":", digest);
+    json_print_string(dcb, shape->sql);
+    dcb_printf(dcb, ",\"count\":%lu,\"total_us\":%lu,\"min_us\":%lu,\"max_us\":%lu,"
+               "\"mean_us\":%lu,\"p50_us\":%lu,\"p90_us\":%lu,\"p99_us\":%lu,\"p999_us\":%lu,"
+               "\"histogram\":[",
+               (unsigned long)shape->count, (unsigned long)shape->total_us,
+               (unsigned long)shape->min_us, (unsigned long)shape->max_us,
+               (unsigned long)(shape->total_us / shape->count),
+               (unsigned long)shape_percentile(shape, 0.5),
+               (unsigned long)shape_percentile(shape, 0.9),
+               (unsigned long)shape_percentile(shape, 0.99),
+               (unsigned long)shape_percentile(shape, 0.999));
+
+    const char *sep = "";
+
+    for (int i = 0; i < TPM_HIST_BUCKETS; i++)
+    {
+        if (shape->hist[i])
+        {
+            dcb_printf(dcb, "%s[%lu,%lu]", sep, (unsigned long)hist_bucket_value(i),
+                       (unsigned long)shape->hist[i]);
+            sep = ",";
+        }
+    }
+
+    dcb_printf(dcb, "]}");
+}
+
+/**
+ * Print the aggregated transactions of all threads as JSON
+ *
+ * Each entry has the digest of the transaction, its canonical statements,
+ * the latency statistics in microseconds and the non-empty histogram buckets
+ * as pairs of the highest latency of the bucket and the number of
+ * transactions in it.
+ */
+static bool tpm_show_transactions(const MODULECMD_ARG *argv)
+{
+    DCB *dcb = argv->argv[0].value.dcb;
+    TPM_INSTANCE *instance = (TPM_INSTANCE*)filter_def_get_instance(argv->argv[1].value.filter);
+
+    if (instance->mode != TPM_MODE_AGGREGATE)
+    {
+        modulecmd_set_error("Filter '%s' is not in aggregate mode.",
+                            filter_def_get_name(argv->argv[1].value.filter));
+        return false;
+    }
+
+    TPM_SHAPE *shapes = MXS_MALLOC(instance->n_tables * instance->max_transactions * sizeof(TPM_SHAPE));
+
+    if (shapes == NULL)
+    {
+        return false;
+    }
+
+    int n_shapes = 0;
+    uint64_t untracked = 0;
+
+    for (int i = 0; i < instance->n_tables; i++)
+    {
+        TPM_TABLE *table = &instance->tables[i];
+        spinlock_acquire(&table->lock);
+        memcpy(shapes + n_shapes, table->shapes, table->size * sizeof(TPM_SHAPE));
+        n_shapes += table->size;
+        untracked += table->n_untracked;
+        spinlock_release(&table->lock);
+    }
+
+    /** Merge the shapes that more than one thread has seen */
+    qsort(shapes, n_shapes, sizeof(TPM_SHAPE), shape_cmp);
+
+    int n_merged = 0;
+
+    for (int i = 0; i < n_shapes; i++)
+    {
+        if (n_merged > 0 && shape_cmp(&shapes[n_merged - 1], &shapes[i]) == 0)
+        {
+            TPM_SHAPE *dest = &shapes[n_merged - 1];
+            dest->count += shapes[i].count;
+            dest->total_us += shapes[i].total_us;
+            dest->min_us = MXS_MIN(dest->min_us, shapes[i].min_us);
+            dest->max_us = MXS_MAX(dest->max_us, shapes[i].max_us);
+
+            for (int j = 0; j < TPM_HIST_BUCKETS; j++)
+            {
+                dest->hist[j] += shapes[i].hist[j];
+            }
+        }
+        else
+        {
+            if (n_merged != i)
+            {
+                shapes[n_merged] = shapes[i];
+            }
+            n_merged++;
+        }
+    }
+
+    dcb_printf(dcb, "{\"transactions\":[");
+
+    for (int i = 0; i < n_merged; i++)
+    {
+        if (i > 0)
+        {
+            dcb_printf(dcb, ",");
+        }
+        json_print_shape(dcb, &shapes[i]);
+    }
+
+    dcb_printf(dcb, "],\"untracked\":%lu}\n", (unsigned long)untracked);
+
+    MXS_FREE(shapes);
+    return true;
 }
 
 /**
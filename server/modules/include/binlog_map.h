@@ -0,0 +1,41 @@
+#pragma once
+#ifndef _BINLOG_MAP_H
+#define _BINLOG_MAP_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdint.h>
+
+MXS_BEGIN_DECLS
+
+/**
+ * A memory mapped segment of a binlog file
+ */
+typedef struct binlog_map
+{
+    int         fd;     /*< The binlog file */
+    uint8_t     *data;  /*< The mapped segment, NULL if nothing is mapped */
+    uint64_t    start;  /*< The file position of the segment */
+    uint64_t    len;    /*< The length of the segment */
+} BINLOG_MAP;
+
+void binlog_map_init(BINLOG_MAP *map, int fd);
+void binlog_map_close(BINLOG_MAP *map);
+const uint8_t* binlog_map_get(BINLOG_MAP *map, uint64_t pos, uint64_t len,
+                              uint64_t limit, uint64_t *avail);
+int binlog_map_pread(BINLOG_MAP *map, void *buf, uint32_t len, uint64_t pos, uint64_t limit);
+
+MXS_END_DECLS
+
+#endif /* _BINLOG_MAP_H */
@@ -0,0 +1,52 @@
+#pragma once
+#ifndef _BINLOG_ZFILE_H
+#define _BINLOG_ZFILE_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <maxscale/cdefs.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <maxscale/spinlock.h>
+
+MXS_BEGIN_DECLS
+
+/** The uncompressed size of the blocks of a compressed binlog file */
+#define BINLOG_ZFILE_BLOCK_SIZE (64 * 1024)
+
+/**
+ * A compressed binlog file opened for reading
+ */
+typedef struct binlog_zfile
+{
+    int         fd;             /*< The compressed file */
+    uint32_t    block_size;     /*< The uncompressed size of the blocks */
+    uint64_t    size;           /*< The uncompressed size of the file */
+    uint32_t    n_blocks;       /*< The number of blocks */
+    uint64_t    *offsets;       /*< The file offsets of the blocks, and of the end */
+    SPINLOCK    lock;           /*< Protects the cached block */
+    uint8_t     *block;         /*< The cached uncompressed block */
+    int64_t     block_index;    /*< The index of the cached block, -1 if none */
+    uint8_t     *zbuf;          /*< The compressed bytes of a block */
+} BINLOG_ZFILE;
+
+bool binlog_zfile_is_compressed(int fd);
+BINLOG_ZFILE* binlog_zfile_open(int fd);
+void binlog_zfile_close(BINLOG_ZFILE *zfile);
+uint64_t binlog_zfile_size(BINLOG_ZFILE *zfile);
+int binlog_zfile_pread(BINLOG_ZFILE *zfile, void *buf, uint32_t len, uint64_t pos);
+bool binlog_zfile_compress(const char *path, const char *tmp_path);
+
+MXS_END_DECLS
+
+#endif /* _BINLOG_ZFILE_H */
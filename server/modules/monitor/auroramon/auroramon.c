@@ -125,10 +125,10 @@ monitorMain(void *arg)
         lock_monitor_servers(monitor);
         servers_status_pending_to_current(monitor);
 
+        mon_probe_servers(monitor, update_server_status);
+
         for (MXS_MONITOR_SERVERS *ptr = monitor->databases; ptr; ptr = ptr->next)
         {
-            update_server_status(monitor, ptr);
-
             if (SERVER_IS_DOWN(ptr->server))
             {
                 /** Hang up all DCBs connected to the failed server */
@@ -109,6 +109,8 @@ MXS_MODULE* MXS_CREATE_MODULE()
                 mxs_monitor_event_enum_values
             },
             {"set_donor_nodes", MXS_MODULE_PARAM_BOOL, "false"},
+            {"flow_control_weighting", MXS_MODULE_PARAM_BOOL, "false"},
+            {"weighting_queue_length", MXS_MODULE_PARAM_COUNT, "16"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -116,6 +118,42 @@ MXS_MODULE* MXS_CREATE_MODULE()
     return &info;
 }
 
+static void* node_info_copy(const void *val)
+{
+    GALERA_NODE_INFO *info = MXS_MALLOC(sizeof(GALERA_NODE_INFO));
+
+    if (info)
+    {
+        *info = *(const GALERA_NODE_INFO*)val;
+    }
+
+    return info;
+}
+
+/**
+ * @brief Reset the flow control state of the monitored nodes
+ *
+ * @param handle Galera monitor handle
+ * @param database List of monitored databases
+ * @return True on success, false if memory allocation failed
+ */
+static bool init_node_info(GALERA_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+{
+    GALERA_NODE_INFO info = {0};
+
+    for (; database; database = database->next)
+    {
+        hashtable_delete(handle->node_info, database->server->unique_name);
+
+        if (!hashtable_add(handle->node_info, database->server->unique_name, &info))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /**
  * Start the instance of the monitor, returning a handle on the monitor.
  *
@@ -134,10 +172,18 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
     }
     else
     {
-        if ((handle = (GALERA_MONITOR *) MXS_MALLOC(sizeof(GALERA_MONITOR))) == NULL)
+        HASHTABLE *node_info = hashtable_alloc(MAX_NUM_SLAVES, hashtable_item_strhash, hashtable_item_strcmp);
+
+        if ((handle = (GALERA_MONITOR *) MXS_MALLOC(sizeof(GALERA_MONITOR))) == NULL ||
+            node_info == NULL)
         {
+            MXS_FREE(handle);
+            hashtable_free(node_info);
             return NULL;
         }
+        hashtable_memory_fns(node_info, hashtable_item_strdup, node_info_copy,
+                             hashtable_item_free, hashtable_item_free);
+        handle->node_info = node_info;
         handle->shutdown = 0;
         handle->id = MXS_MONITOR_DEFAULT_ID;
         handle->master = NULL;
@@ -152,11 +198,20 @@ startMonitor(MXS_MONITOR *mon, const MXS_CONFIG_PARAMETER *params)
     handle->script = config_copy_string(params, "script");
     handle->events = config_get_enum(params, "events", mxs_monitor_event_enum_values);
     handle->set_donor_nodes = config_get_bool(params, "set_donor_nodes");
+    handle->flow_control_weighting = config_get_bool(params, "flow_control_weighting");
+    handle->weighting_queue_length = config_get_integer(params, "weighting_queue_length");
+
+    if (handle->weighting_queue_length <= 0)
+    {
+        handle->weighting_queue_length = 1;
+    }
 
     /** SHOW STATUS doesn't require any special permissions */
-    if (!check_monitor_permissions(mon, "SHOW STATUS LIKE 'wsrep_local_state'"))
+    if (!check_monitor_permissions(mon, "SHOW STATUS LIKE 'wsrep_local_state'") ||
+        !init_node_info(handle, mon->databases))
     {
         MXS_ERROR("Failed to start monitor. See earlier errors for more information.");
+        hashtable_free(handle->node_info);
         MXS_FREE(handle->script);
         MXS_FREE(handle);
         return NULL;
@@ -200,6 +255,86 @@ diagnostics(DCB *dcb, const MXS_MONITOR *mon)
     dcb_printf(dcb, "Master Role Setting Disabled:\t%s\n",
                handle->disableMasterRoleSetting ? "on" : "off");
     dcb_printf(dcb, "Set wsrep_sst_donor node list:\t%s\n", (handle->set_donor_nodes == 1) ? "on" : "off");
+    dcb_printf(dcb, "Flow control weighting:\t%s\n", handle->flow_control_weighting ? "on" : "off");
+
+    if (handle->flow_control_weighting)
+    {
+        for (MXS_MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+        {
+            GALERA_NODE_INFO *info = hashtable_fetch(handle->node_info, db->server->unique_name);
+
+            if (info)
+            {
+                dcb_printf(dcb, "\nServer: %s\n", db->server->unique_name);
+                dcb_printf(dcb, "Flow control paused:\t%.3f\n", info->flow_control_paused);
+                dcb_printf(dcb, "Receive queue:\t\t%ld\n", info->recv_queue);
+                dcb_printf(dcb, "Send queue:\t\t%ld\n", info->send_queue);
+                dcb_printf(dcb, "Load weight:\t\t%d%%\n", db->server->load_weight);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Update the load weight of a node from its write set queues
+ *
+ * A node that cannot apply the replicated write sets as fast as they arrive
+ * grows its receive queue and eventually pauses the whole cluster with flow
+ * control. A node whose send queue grows is waiting for the cluster. The
+ * weight of the node is halved when @c weighting_queue_length write sets are
+ * queued, and it keeps going down as the queues grow, so that the routers move
+ * the load away from the node before it throttles the cluster.
+ *
+ * @param handle   The Galera monitor
+ * @param database The node to update
+ */
+static void update_node_load(GALERA_MONITOR *handle, MXS_MONITOR_SERVERS *database)
+{
+    GALERA_NODE_INFO *info = hashtable_fetch(handle->node_info, database->server->unique_name);
+    MYSQL_RES *result;
+
+    if (info == NULL)
+    {
+        return;
+    }
+
+    if (mysql_query(database->con, "SHOW STATUS WHERE Variable_name IN "
+                    "('wsrep_flow_control_paused', 'wsrep_local_recv_queue', "
+                    "'wsrep_local_send_queue')") == 0
+        && (result = mysql_store_result(database->con)) != NULL)
+    {
+        if (mysql_field_count(database->con) >= 2)
+        {
+            MYSQL_ROW row;
+
+            while ((row = mysql_fetch_row(result)))
+            {
+                if (strcasecmp(row[0], "wsrep_flow_control_paused") == 0)
+                {
+                    info->flow_control_paused = strtod(row[1], NULL);
+                }
+                else if (strcasecmp(row[0], "wsrep_local_recv_queue") == 0)
+                {
+                    info->recv_queue = strtol(row[1], NULL, 10);
+                }
+                else if (strcasecmp(row[0], "wsrep_local_send_queue") == 0)
+                {
+                    info->send_queue = strtol(row[1], NULL, 10);
+                }
+            }
+        }
+        mysql_free_result(result);
+
+        long queue = MXS_MAX(info->recv_queue, 0) + MXS_MAX(info->send_queue, 0);
+        database->server->load_weight = MXS_MAX(100 * handle->weighting_queue_length /
+                                                (handle->weighting_queue_length + queue), 1);
+    }
+    else
+    {
+        MXS_ERROR("Failed to read the write set queues of server '%s': %s",
+                  database->server->unique_name, mysql_error(database->con));
+        database->server->load_weight = 100;
+    }
 }
 
 /**
@@ -351,10 +486,20 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
             mysql_free_result(result);
         }
 
+        if (handle->flow_control_weighting)
+        {
+            update_node_load(handle, database);
+        }
+        else
+        {
+            database->server->load_weight = 100;
+        }
+
         server_set_status_nolock(&temp_server, SERVER_JOINED);
     }
     else
     {
+        database->server->load_weight = 100;
         server_clear_status_nolock(&temp_server, SERVER_JOINED);
     }
 
@@ -442,9 +587,14 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
+            ptr = ptr->next;
+        }
 
-            monitorDatabase(mon, ptr);
+        mon_probe_servers(mon, monitorDatabase);
 
+        ptr = mon->databases;
+        while (ptr)
+        {
             /* Log server status change */
             if (mon_status_changed(ptr))
             {
@@ -39,9 +39,18 @@
 #include <maxscale/dcb.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/config.h>
+#include <maxscale/hashtable.h>
 
 MXS_BEGIN_DECLS
 
+/** The flow control state of a node */
+typedef struct galera_node_info
+{
+    double flow_control_paused; /**< Value of wsrep_flow_control_paused */
+    long   recv_queue;          /**< Value of wsrep_local_recv_queue */
+    long   send_queue;          /**< Value of wsrep_local_send_queue */
+} GALERA_NODE_INFO;
+
 /**
  * The handle for an instance of a Galera Monitor module
  */
@@ -63,6 +72,9 @@ typedef struct
     uint64_t events; /*< enabled events */
     bool set_donor_nodes; /**< set the wrep_sst_donor variable with an
                            * ordered list of nodes */
+    bool flow_control_weighting; /**< Weight the nodes by their write set queues */
+    long weighting_queue_length; /**< Queue length that halves the weight of a node */
+    HASHTABLE *node_info; /**< GALERA_NODE_INFO of each node */
 } GALERA_MONITOR;
 
 MXS_END_DECLS
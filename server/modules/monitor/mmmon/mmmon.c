@@ -531,10 +531,16 @@ monitorMain(void *arg)
         {
             /* copy server status into monitor pending_status */
             ptr->pending_status = ptr->server->status;
+            ptr = ptr->next;
+        }
+
+        /* monitor all nodes */
+        mon_probe_servers(mon, monitorDatabase);
 
-            /* monitor current node */
-            monitorDatabase(mon, ptr);
+        ptr = mon->databases;
 
+        while (ptr)
+        {
             if (mon_status_changed(ptr) ||
                 mon_print_fail_status(ptr))
             {
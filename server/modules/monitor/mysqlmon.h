@@ -52,6 +52,17 @@
 
 MXS_BEGIN_DECLS
 
+/**
+ * A server in the replication topology index
+ */
+typedef struct mysql_topology_node
+{
+    MXS_MONITOR_SERVERS *db;        /**< The monitored server */
+    int                  pos;       /**< Position of the server in the list of servers */
+    long                 node_id;   /**< The server_id of the server */
+    long                 master_id; /**< The server_id of its master */
+} MYSQL_TOPOLOGY_NODE;
+
 /**
  * The handle for an instance of a MySQL Monitor module
  */
@@ -79,6 +90,14 @@ typedef struct
                                    down before failover is initiated */
     bool allow_cluster_recovery; /**< Allow failed servers to rejoin the cluster */
     bool warn_failover; /**< Log a warning when failover happens */
+    int fast_probe_interval; /**< Milliseconds between the fast probes, 0 if disabled */
+    int fast_probe_failures; /**< Servers that failed the last fast probe */
+    bool heartbeat_us; /**< Whether the heartbeat table has the microsecond timestamps */
+    MYSQL_TOPOLOGY_NODE *topology; /**< The servers in the order they are monitored */
+    MYSQL_TOPOLOGY_NODE *servers_by_id; /**< The servers sorted by server_id */
+    MYSQL_TOPOLOGY_NODE *slaves_by_master; /**< The servers sorted by the server_id of the master */
+    int topology_size; /**< Number of servers in the topology index */
+    bool topology_valid; /**< Whether the topology index can be used */
 } MYSQL_MONITOR;
 
 MXS_END_DECLS
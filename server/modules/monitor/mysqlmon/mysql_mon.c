@@ -48,9 +48,12 @@
 #define MXS_MODULE_NAME "mysqlmon"
 
 #include "../mysqlmon.h"
+#include <errmsg.h>
+#include <sys/time.h>
 #include <maxscale/dcb.h>
 #include <maxscale/modutil.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
 #include <maxscale/debug.h>
 
 /** Column positions for SHOW SLAVE STATUS */
@@ -77,8 +80,9 @@ static void monitorMain(void *);
 static void *startMonitor(MXS_MONITOR *, const MXS_CONFIG_PARAMETER*);
 static void stopMonitor(MXS_MONITOR *);
 static void diagnostics(DCB *, const MXS_MONITOR *);
-static MXS_MONITOR_SERVERS *getServerByNodeId(MXS_MONITOR_SERVERS *, long);
-static MXS_MONITOR_SERVERS *getSlaveOfNodeId(MXS_MONITOR_SERVERS *, long);
+static MXS_MONITOR_SERVERS *getServerByNodeId(MYSQL_MONITOR *, MXS_MONITOR_SERVERS *, long);
+static MXS_MONITOR_SERVERS *getSlaveOfNodeId(MYSQL_MONITOR *, MXS_MONITOR_SERVERS *, long);
+static void update_topology(MYSQL_MONITOR *, MXS_MONITOR_SERVERS *);
 static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *, int);
 static void set_master_heartbeat(MYSQL_MONITOR *, MXS_MONITOR_SERVERS *);
 static void set_slave_heartbeat(MXS_MONITOR *, MXS_MONITOR_SERVERS *);
@@ -128,6 +132,7 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"detect_standalone_master", MXS_MODULE_PARAM_BOOL, "false"},
             {"failcount", MXS_MODULE_PARAM_COUNT, "5"},
             {"allow_cluster_recovery", MXS_MODULE_PARAM_BOOL, "true"},
+            {"fast_probe_interval", MXS_MODULE_PARAM_COUNT, "0"},
             {
                 "script",
                 MXS_MODULE_PARAM_PATH,
@@ -151,6 +156,21 @@ MXS_MODULE* MXS_CREATE_MODULE()
 /**
  * Monitor specific information about a server
  */
+/** Number of buckets in the replication lag histogram */
+#define MYSQLMON_LAG_BUCKETS 6
+
+/** Upper limits of the replication lag histogram buckets in microseconds,
+ * the last bucket has no limit */
+static const int64_t lag_bucket_limits[MYSQLMON_LAG_BUCKETS - 1] =
+{
+    1000, 10000, 100000, 1000000, 10000000
+};
+
+static const char *lag_bucket_names[MYSQLMON_LAG_BUCKETS] =
+{
+    "<1ms", "<10ms", "<100ms", "<1s", "<10s", ">=10s"
+};
+
 typedef struct mysql_server_info
 {
     int              server_id; /**< Value of @@server_id */
@@ -163,6 +183,8 @@ typedef struct mysql_server_info
     bool             slave_sql; /**< If Slave SQL thread is running */
     uint64_t         binlog_pos; /**< Binlog position from SHOW SLAVE STATUS */
     char            *binlog_name; /**< Binlog name from SHOW SLAVE STATUS */
+    unsigned long    batch_connection; /**< ID of the connection that allows multiple statements */
+    uint64_t         lag_histogram[MYSQLMON_LAG_BUCKETS]; /**< Measured replication lags */
 } MYSQL_SERVER_INFO;
 
 /** Other values are implicitly zero initialized */
@@ -269,6 +291,11 @@ startMonitor(MXS_MONITOR *monitor, const MXS_CONFIG_PARAMETER* params)
         handle->shutdown = 0;
         handle->id = config_get_global_options()->id;
         handle->warn_failover = true;
+        handle->topology = NULL;
+        handle->servers_by_id = NULL;
+        handle->slaves_by_master = NULL;
+        handle->topology_size = 0;
+        handle->topology_valid = false;
         spinlock_init(&handle->lock);
     }
 
@@ -283,6 +310,7 @@ startMonitor(MXS_MONITOR *monitor, const MXS_CONFIG_PARAMETER* params)
     handle->failcount = config_get_integer(params, "failcount");
     handle->allow_cluster_recovery = config_get_bool(params, "allow_cluster_recovery");
     handle->mysql51_replication = config_get_bool(params, "mysql51_replication");
+    handle->fast_probe_interval = config_get_integer(params, "fast_probe_interval");
     handle->script = config_copy_string(params, "script");
     handle->events = config_get_enum(params, "events", mxs_monitor_event_enum_values);
 
@@ -341,6 +369,10 @@ static void diagnostics(DCB *dcb, const MXS_MONITOR *mon)
     dcb_printf(dcb, "MaxScale MonitorId:\t%lu\n", handle->id);
     dcb_printf(dcb, "Replication lag:\t%s\n", (handle->replicationHeartbeat == 1) ? "enabled" : "disabled");
     dcb_printf(dcb, "Detect Stale Master:\t%s\n", (handle->detectStaleMaster == 1) ? "enabled" : "disabled");
+    if (handle->fast_probe_interval)
+    {
+        dcb_printf(dcb, "Fast probe interval:\t%d ms\n", handle->fast_probe_interval);
+    }
     dcb_printf(dcb, "Server information\n\n");
 
     for (MXS_MONITOR_SERVERS *db = mon->databases; db; db = db->next)
@@ -361,6 +393,18 @@ static void diagnostics(DCB *dcb, const MXS_MONITOR *mon)
             dcb_printf(dcb, "Master group: %d\n", serv_info->group);
         }
 
+        if (handle->replicationHeartbeat && handle->heartbeat_us)
+        {
+            dcb_printf(dcb, "Replication lag histogram:");
+
+            for (int i = 0; i < MYSQLMON_LAG_BUCKETS; i++)
+            {
+                dcb_printf(dcb, " %s: %lu", lag_bucket_names[i], serv_info->lag_histogram[i]);
+            }
+
+            dcb_printf(dcb, "\n");
+        }
+
         dcb_printf(dcb, "\n");
     }
 }
@@ -372,8 +416,17 @@ enum mysql_server_version
     MYSQL_SERVER_VERSION_51
 };
 
+/**
+ * @brief Update the replication status of a server
+ *
+ * @param database      The server
+ * @param serv_info     The server information
+ * @param server_version The version of the server
+ * @param result        The result of the slave status query or NULL if it failed,
+ *                      the caller frees it
+ */
 static inline void monitor_mysql_db(MXS_MONITOR_SERVERS* database, MYSQL_SERVER_INFO *serv_info,
-                                    enum mysql_server_version server_version)
+                                    enum mysql_server_version server_version, MYSQL_RES *result)
 {
     int columns, i_io_thread, i_sql_thread, i_binlog_pos, i_master_id, i_binlog_name;
     const char *query;
@@ -403,14 +456,10 @@ static inline void monitor_mysql_db(MXS_MONITOR_SERVERS* database, MYSQL_SERVER_
     monitor_clear_pending_status(database, SERVER_SLAVE | SERVER_MASTER | SERVER_RELAY_MASTER |
                                  SERVER_STALE_STATUS | SERVER_SLAVE_OF_EXTERNAL_MASTER);
 
-    MYSQL_RES* result;
-
-    if (mysql_query(database->con, query) == 0
-        && (result = mysql_store_result(database->con)) != NULL)
+    if (result)
     {
-        if (mysql_field_count(database->con) < columns)
+        if (mysql_num_fields(result) < columns)
         {
-            mysql_free_result(result);
             MXS_ERROR("\"%s\" returned less than the expected amount of columns. "
                       "Expected %d columns.", query, columns);
             return;
@@ -489,8 +538,6 @@ static inline void monitor_mysql_db(MXS_MONITOR_SERVERS* database, MYSQL_SERVER_
         /** Store master_id of current node. For MySQL 5.1 it will be set at a later point. */
         database->server->master_id = master_id;
         serv_info->master_id = master_id;
-
-        mysql_free_result(result);
     }
 }
 
@@ -600,9 +647,141 @@ static MXS_MONITOR_SERVERS *build_mysql51_replication_tree(MXS_MONITOR *mon)
     return rval;
 }
 
+/** The query for the server ID and the read-only state */
+static const char server_vars_query[] = "SELECT @@server_id, @@read_only";
+
+/**
+ * @brief Get the query for the replication status of a server
+ *
+ * @param con                 Connection to the server
+ * @param mysql51_replication Whether MySQL 5.1 replication is monitored
+ * @param version             The version of the server is stored here
+ * @return The query or NULL if the replication status is not queried
+ */
+static const char* slave_status_query(MYSQL *con, bool mysql51_replication,
+                                      enum mysql_server_version *version)
+{
+    unsigned long server_version = mysql_get_server_version(con);
+
+    /* Check first for MariaDB 10.x.x and get status for multi-master replication */
+    if (server_version >= 100000)
+    {
+        *version = MYSQL_SERVER_VERSION_100;
+        return "SHOW ALL SLAVES STATUS";
+    }
+    else if (server_version >= 5 * 10000 + 5 * 100)
+    {
+        *version = MYSQL_SERVER_VERSION_55;
+        return "SHOW SLAVE STATUS";
+    }
+    else if (mysql51_replication)
+    {
+        *version = MYSQL_SERVER_VERSION_51;
+        return "SHOW SLAVE STATUS";
+    }
+
+    if (report_version_err)
+    {
+        report_version_err = false;
+        MXS_ERROR("MySQL version is lower than 5.5 and 'mysql51_replication' option is "
+                  "not enabled, replication tree cannot be resolved. To enable MySQL 5.1 replication "
+                  "detection, add 'mysql51_replication=true' to the monitor section.");
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Allow the status queries to be sent in one batch
+ *
+ * This is done once for each new connection. The connection is remembered
+ * by its connection ID.
+ *
+ * @param database  The server
+ * @param serv_info The server information
+ */
+static void enable_status_batch(MXS_MONITOR_SERVERS *database, MYSQL_SERVER_INFO *serv_info)
+{
+    if (mysql_set_server_option(database->con, MYSQL_OPTION_MULTI_STATEMENTS_ON) == 0)
+    {
+        serv_info->batch_connection = mysql_thread_id(database->con);
+    }
+    else
+    {
+        serv_info->batch_connection = 0;
+        MXS_WARNING("Failed to enable multiple statements for the monitor connection to "
+                    "'%s', the status queries are sent one at a time: %s",
+                    database->server->unique_name, mysql_error(database->con));
+    }
+}
+
+/**
+ * @brief Query the status of a server
+ *
+ * If the connection allows multiple statements, all queries are sent in one
+ * round trip.
+ *
+ * @param con          Connection to the server
+ * @param batch        Whether the queries are sent in one batch
+ * @param slave_query  The replication status query or NULL
+ * @param vars         The result of the variable query is stored here
+ * @param slave_status The result of the replication status query is stored here
+ * @return True if the first query succeeded
+ */
+static bool query_server_status(MYSQL *con, bool batch, const char *slave_query,
+                                MYSQL_RES **vars, MYSQL_RES **slave_status)
+{
+    char query[sizeof(server_vars_query) + 64];
+
+    *vars = NULL;
+    *slave_status = NULL;
+
+    if (batch && slave_query)
+    {
+        snprintf(query, sizeof(query), "%s; %s", server_vars_query, slave_query);
+    }
+    else
+    {
+        strcpy(query, server_vars_query);
+    }
+
+    if (mysql_query(con, query) != 0)
+    {
+        return false;
+    }
+
+    *vars = mysql_store_result(con);
+
+    if (slave_query)
+    {
+        if (batch)
+        {
+            if (mysql_next_result(con) == 0)
+            {
+                *slave_status = mysql_store_result(con);
+            }
+        }
+        else if (mysql_query(con, slave_query) == 0)
+        {
+            *slave_status = mysql_store_result(con);
+        }
+    }
+
+    /** Read any remaining results so the connection can be used again */
+    while (mysql_more_results(con) && mysql_next_result(con) == 0)
+    {
+        mysql_free_result(mysql_store_result(con));
+    }
+
+    return true;
+}
+
 /**
  * Monitor an individual server
  *
+ * A connection that worked in the previous round is not pinged. The status
+ * queries are sent to it right away and they show whether it still works.
+ *
  * @param handle        The MySQL Monitor object
  * @param database  The database to probe
  */
@@ -612,7 +791,9 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
     MYSQL_MONITOR* handle = mon->handle;
     MYSQL_ROW row;
     MYSQL_RES *result;
-    unsigned long int server_version = 0;
+    MYSQL_RES *slave_status;
+    enum mysql_server_version version = MYSQL_SERVER_VERSION_51;
+    const char *slave_query = NULL;
     char *server_string;
 
     /* Don't probe servers in maintenance mode */
@@ -624,7 +805,20 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
     /** Store previous status */
     database->mon_prev_status = database->server->status;
 
-    if (database->con == NULL || mysql_ping(database->con) != 0)
+    MYSQL_SERVER_INFO *serv_info = hashtable_fetch(handle->server_info, database->server->unique_name);
+    ss_dassert(serv_info);
+
+    bool batch = database->con && serv_info->batch_connection == mysql_thread_id(database->con);
+    bool queried = false;
+
+    if (batch)
+    {
+        slave_query = slave_status_query(database->con, handle->mysql51_replication, &version);
+        queried = query_server_status(database->con, true, slave_query, &result, &slave_status);
+    }
+
+    if (!batch || (!queried && (mysql_errno(database->con) == CR_SERVER_GONE_ERROR ||
+                                mysql_errno(database->con) == CR_SERVER_LOST)))
     {
         mxs_connect_result_t rval;
         if ((rval = mon_connect_to_db(mon, database)) == MONITOR_CONN_OK)
@@ -671,14 +865,21 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
 
             return;
         }
+
+        if (serv_info->batch_connection != mysql_thread_id(database->con))
+        {
+            enable_status_batch(database, serv_info);
+        }
+
+        batch = serv_info->batch_connection == mysql_thread_id(database->con);
+        slave_query = slave_status_query(database->con, handle->mysql51_replication, &version);
+        queried = query_server_status(database->con, batch, slave_query, &result, &slave_status);
     }
+
     /* Store current status in both server and monitor server pending struct */
     server_set_status_nolock(database->server, SERVER_RUNNING);
     monitor_set_pending_status(database, SERVER_RUNNING);
 
-    /* get server version from current server */
-    server_version = mysql_get_server_version(database->con);
-
     /* get server version string */
     server_string = (char *) mysql_get_server_info(database->con);
     if (server_string)
@@ -686,20 +887,17 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         server_set_version_string(database->server, server_string);
     }
 
-    MYSQL_SERVER_INFO *serv_info = hashtable_fetch(handle->server_info, database->server->unique_name);
-    ss_dassert(serv_info);
-
     /* Get server_id and read_only from current node */
-    if (mysql_query(database->con, "SELECT @@server_id, @@read_only") == 0
-        && (result = mysql_store_result(database->con)) != NULL)
+    if (queried && result)
     {
         long server_id = -1;
 
-        if (mysql_field_count(database->con) != 2)
+        if (mysql_num_fields(result) != 2)
         {
             mysql_free_result(result);
-            MXS_ERROR("Unexpected result for 'SELECT @@server_id, @@read_only'. Expected 2 columns."
-                      " MySQL Version: %s", server_string);
+            mysql_free_result(slave_status);
+            MXS_ERROR("Unexpected result for '%s'. Expected 2 columns."
+                      " MySQL Version: %s", server_vars_query, server_string);
             return;
         }
 
@@ -719,30 +917,15 @@ monitorDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
         mysql_free_result(result);
     }
 
-    /* Check first for MariaDB 10.x.x and get status for multi-master replication */
-    if (server_version >= 100000)
+    if (slave_query)
     {
-        monitor_mysql_db(database, serv_info, MYSQL_SERVER_VERSION_100);
-    }
-    else if (server_version >= 5 * 10000 + 5 * 100)
-    {
-        monitor_mysql_db(database, serv_info, MYSQL_SERVER_VERSION_55);
-    }
-    else
-    {
-        if (handle->mysql51_replication)
-        {
-            monitor_mysql_db(database, serv_info, MYSQL_SERVER_VERSION_51);
-        }
-        else if (report_version_err)
+        monitor_mysql_db(database, serv_info, version, queried ? slave_status : NULL);
+
+        if (queried)
         {
-            report_version_err = false;
-            MXS_ERROR("MySQL version is lower than 5.5 and 'mysql51_replication' option is "
-                      "not enabled, replication tree cannot be resolved. To enable MySQL 5.1 replication "
-                      "detection, add 'mysql51_replication=true' to the monitor section.");
+            mysql_free_result(slave_status);
         }
     }
-
 }
 
 /**
@@ -852,6 +1035,144 @@ static void visit_node(struct graph_node *node, struct graph_node **stack,
     }
 }
 
+static int compare_topology_id(const void *a, const void *b)
+{
+    const MYSQL_TOPOLOGY_NODE *n1 = (const MYSQL_TOPOLOGY_NODE*)a;
+    const MYSQL_TOPOLOGY_NODE *n2 = (const MYSQL_TOPOLOGY_NODE*)b;
+
+    if (n1->node_id != n2->node_id)
+    {
+        return n1->node_id < n2->node_id ? -1 : 1;
+    }
+
+    return n1->pos - n2->pos;
+}
+
+static int compare_topology_master(const void *a, const void *b)
+{
+    const MYSQL_TOPOLOGY_NODE *n1 = (const MYSQL_TOPOLOGY_NODE*)a;
+    const MYSQL_TOPOLOGY_NODE *n2 = (const MYSQL_TOPOLOGY_NODE*)b;
+
+    if (n1->master_id != n2->master_id)
+    {
+        return n1->master_id < n2->master_id ? -1 : 1;
+    }
+
+    return n1->pos - n2->pos;
+}
+
+/**
+ * @brief Find the first server with an ID from a sorted topology index
+ *
+ * @param nodes  The index, sorted by the ID and then by the position
+ * @param n      Number of servers in the index
+ * @param id     The ID to find
+ * @param master Whether the index is sorted by the master_id
+ *
+ * @return The server that comes first in the list of servers or NULL
+ */
+static const MYSQL_TOPOLOGY_NODE* topology_find(const MYSQL_TOPOLOGY_NODE *nodes, int n,
+                                                long id, bool master)
+{
+    int low = 0;
+    int high = n;
+
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if ((master ? nodes[mid].master_id : nodes[mid].node_id) < id)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low < n && (master ? nodes[low].master_id : nodes[low].node_id) == id)
+    {
+        return &nodes[low];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Update the replication topology index
+ *
+ * The sorted indexes of the servers are only rebuilt when a server is added
+ * or removed or when the server_id or the master_id of a server changes. If
+ * the index cannot be allocated, the servers are searched from the list.
+ *
+ * @param handle    The monitor handle
+ * @param databases The monitored servers
+ */
+static void update_topology(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *databases)
+{
+    bool changed = !handle->topology_valid;
+    int n = 0;
+
+    for (MXS_MONITOR_SERVERS *db = databases; db; db = db->next)
+    {
+        if (n >= handle->topology_size || handle->topology[n].db != db ||
+            handle->topology[n].node_id != db->server->node_id ||
+            handle->topology[n].master_id != db->server->master_id)
+        {
+            changed = true;
+        }
+        n++;
+    }
+
+    if (!changed && n == handle->topology_size)
+    {
+        return;
+    }
+
+    if (n > handle->topology_size || !handle->topology_valid)
+    {
+        size_t size = MXS_MAX(n, 1) * sizeof(MYSQL_TOPOLOGY_NODE);
+        MXS_FREE(handle->topology);
+        MXS_FREE(handle->servers_by_id);
+        MXS_FREE(handle->slaves_by_master);
+        handle->topology = MXS_MALLOC(size);
+        handle->servers_by_id = MXS_MALLOC(size);
+        handle->slaves_by_master = MXS_MALLOC(size);
+
+        if (!handle->topology || !handle->servers_by_id || !handle->slaves_by_master)
+        {
+            MXS_FREE(handle->topology);
+            MXS_FREE(handle->servers_by_id);
+            MXS_FREE(handle->slaves_by_master);
+            handle->topology = NULL;
+            handle->servers_by_id = NULL;
+            handle->slaves_by_master = NULL;
+            handle->topology_size = 0;
+            handle->topology_valid = false;
+            return;
+        }
+    }
+
+    n = 0;
+
+    for (MXS_MONITOR_SERVERS *db = databases; db; db = db->next)
+    {
+        handle->topology[n].db = db;
+        handle->topology[n].pos = n;
+        handle->topology[n].node_id = db->server->node_id;
+        handle->topology[n].master_id = db->server->master_id;
+        n++;
+    }
+
+    memcpy(handle->servers_by_id, handle->topology, n * sizeof(MYSQL_TOPOLOGY_NODE));
+    memcpy(handle->slaves_by_master, handle->topology, n * sizeof(MYSQL_TOPOLOGY_NODE));
+    qsort(handle->servers_by_id, n, sizeof(MYSQL_TOPOLOGY_NODE), compare_topology_id);
+    qsort(handle->slaves_by_master, n, sizeof(MYSQL_TOPOLOGY_NODE), compare_topology_master);
+    handle->topology_size = n;
+    handle->topology_valid = true;
+}
+
 /**
  * @brief Find the strongly connected components in the replication tree graph
  *
@@ -873,6 +1194,7 @@ void find_graph_cycles(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *database, int
 {
     struct graph_node graph[nservers];
     struct graph_node *stack[nservers];
+    MYSQL_TOPOLOGY_NODE by_id[nservers];
     int nodes = 0;
 
     for (MXS_MONITOR_SERVERS *db = database; db; db = db->next)
@@ -884,22 +1206,26 @@ void find_graph_cycles(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *database, int
         graph[nodes].cycle = 0;
         graph[nodes].active = false;
         graph[nodes].parent = NULL;
+        by_id[nodes].db = db;
+        by_id[nodes].pos = nodes;
+        by_id[nodes].node_id = graph[nodes].info->server_id;
+        by_id[nodes].master_id = graph[nodes].info->master_id;
         nodes++;
     }
 
+    qsort(by_id, nodes, sizeof(by_id[0]), compare_topology_id);
+
     /** Build the graph */
     for (int i = 0; i < nservers; i++)
     {
         if (graph[i].info->master_id > 0)
         {
             /** Found a connected node */
-            for (int k = 0; k < nservers; k++)
+            const MYSQL_TOPOLOGY_NODE *master = topology_find(by_id, nodes, graph[i].info->master_id, false);
+
+            if (master)
             {
-                if (graph[k].info->server_id == graph[i].info->master_id)
-                {
-                    graph[i].parent = &graph[k];
-                    break;
-                }
+                graph[i].parent = &graph[master->pos];
             }
         }
     }
@@ -1043,6 +1369,46 @@ void do_failover(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *db)
     }
 }
 
+/**
+ * Check that a running server still answers
+ *
+ * Only the connection of the monitor is pinged, the status of the server is
+ * not changed.
+ *
+ * @param mon      The monitor
+ * @param database The server to check
+ */
+static void
+fast_probe_database(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
+{
+    MYSQL_MONITOR *handle = mon->handle;
+
+    if (!SERVER_IN_MAINT(database->server) && SERVER_IS_RUNNING(database->server) &&
+        (database->con == NULL || mysql_ping(database->con) != 0))
+    {
+        atomic_add(&handle->fast_probe_failures, 1);
+    }
+}
+
+/**
+ * Check that all running servers still answer
+ *
+ * @param mon The monitor
+ * @return True if a server did not answer
+ */
+static bool
+fast_probe_servers(MXS_MONITOR *mon)
+{
+    MYSQL_MONITOR *handle = mon->handle;
+    handle->fast_probe_failures = 0;
+
+    lock_monitor_servers(mon);
+    mon_probe_servers(mon, fast_probe_database);
+    release_monitor_servers(mon);
+
+    return handle->fast_probe_failures > 0;
+}
+
 /**
  * The entry point for the monitoring module thread
  *
@@ -1103,8 +1469,19 @@ monitorMain(void *arg)
             (((nrounds * MXS_MON_BASE_INTERVAL_MS) % mon->interval) >=
              MXS_MON_BASE_INTERVAL_MS) && (!mon->server_pending_changes))
         {
-            nrounds += 1;
-            continue;
+            /** Between the full rounds, only check that the running servers
+             * still answer and do a full round right away if one doesn't */
+            bool fast_probe = handle->fast_probe_interval > 0 &&
+                              ((nrounds * MXS_MON_BASE_INTERVAL_MS) % handle->fast_probe_interval) <
+                              MXS_MON_BASE_INTERVAL_MS;
+
+            if (!fast_probe || !fast_probe_servers(mon))
+            {
+                nrounds += 1;
+                continue;
+            }
+
+            MXS_INFO("A server failed the fast probe, checking all servers.");
         }
         nrounds += 1;
         /* reset num_servers */
@@ -1122,10 +1499,16 @@ monitorMain(void *arg)
 
             /* copy server status into monitor pending_status */
             ptr->pending_status = ptr->server->status;
+            ptr = ptr->next;
+        }
 
-            /* monitor current node */
-            monitorDatabase(mon, ptr);
+        /* monitor all nodes */
+        mon_probe_servers(mon, monitorDatabase);
 
+        ptr = mon->databases;
+
+        while (ptr)
+        {
             /* reset the slave list of current node */
             memset(&ptr->server->slaves, 0, sizeof(ptr->server->slaves));
 
@@ -1198,6 +1581,7 @@ monitorMain(void *arg)
             }
             else
             {
+                update_topology(handle, mon->databases);
                 root_master = get_replication_tree(mon, num_servers);
             }
 
@@ -1211,6 +1595,8 @@ monitorMain(void *arg)
             find_graph_cycles(handle, mon->databases, num_servers);
         }
 
+        update_topology(handle, mon->databases);
+
         ptr = mon->databases;
         while (ptr)
         {
@@ -1218,8 +1604,8 @@ monitorMain(void *arg)
             ss_dassert(serv_info);
 
             if (ptr->server->node_id > 0 && ptr->server->master_id > 0 &&
-                getSlaveOfNodeId(mon->databases, ptr->server->node_id) &&
-                getServerByNodeId(mon->databases, ptr->server->master_id) &&
+                getSlaveOfNodeId(handle, mon->databases, ptr->server->node_id) &&
+                getServerByNodeId(handle, mon->databases, ptr->server->master_id) &&
                 (!handle->multimaster || serv_info->group == 0))
             {
                 /** This server is both a slave and a master i.e. a relay master */
@@ -1397,13 +1783,23 @@ monitorMain(void *arg)
 /**
  * Fetch a MySQL node by node_id
  *
+ * The topology index is used if update_topology() has built it.
+ *
+ * @param handle        The monitor handle
  * @param ptr           The list of servers to monitor
  * @param node_id   The MySQL server_id to fetch
  * @return      The server with the required server_id
  */
 static MXS_MONITOR_SERVERS *
-getServerByNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
+getServerByNodeId(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *ptr, long node_id)
 {
+    if (handle->topology_valid)
+    {
+        const MYSQL_TOPOLOGY_NODE *node = topology_find(handle->servers_by_id, handle->topology_size,
+                                                        node_id, false);
+        return node ? node->db : NULL;
+    }
+
     SERVER *current;
     while (ptr)
     {
@@ -1420,13 +1816,23 @@ getServerByNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
 /**
  * Fetch a MySQL slave node from a node_id
  *
+ * The topology index is used if update_topology() has built it.
+ *
+ * @param handle        The monitor handle
  * @param ptr           The list of servers to monitor
  * @param node_id   The MySQL server_id to fetch
  * @return      The slave server of this node_id
  */
 static MXS_MONITOR_SERVERS *
-getSlaveOfNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
+getSlaveOfNodeId(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *ptr, long node_id)
 {
+    if (handle->topology_valid)
+    {
+        const MYSQL_TOPOLOGY_NODE *node = topology_find(handle->slaves_by_master, handle->topology_size,
+                                                        node_id, true);
+        return node ? node->db : NULL;
+    }
+
     SERVER *current;
     while (ptr)
     {
@@ -1440,6 +1846,42 @@ getSlaveOfNodeId(MXS_MONITOR_SERVERS *ptr, long node_id)
     return NULL;
 }
 
+/**
+ * @brief The current time in microseconds for the replication heartbeat
+ *
+ * @return Microseconds since the epoch
+ */
+static uint64_t heartbeat_now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * @brief Add a measured replication lag to the histogram of a slave
+ *
+ * @param handle   The monitor handle
+ * @param database The slave
+ * @param lag_us   The replication lag in microseconds
+ */
+static void add_lag_to_histogram(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *database, int64_t lag_us)
+{
+    MYSQL_SERVER_INFO *serv_info = hashtable_fetch(handle->server_info, database->server->unique_name);
+
+    if (serv_info)
+    {
+        int i = 0;
+
+        while (i < MYSQLMON_LAG_BUCKETS - 1 && lag_us >= lag_bucket_limits[i])
+        {
+            i++;
+        }
+
+        serv_info->lag_histogram[i]++;
+    }
+}
+
 /*******
  * This function sets the replication heartbeat
  * into the maxscale_schema.replication_heartbeat table in the current master.
@@ -1465,12 +1907,14 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
     }
 
     /* check if the maxscale_schema database and replication_heartbeat table exist */
-    if (mysql_query(database->con, "SELECT table_name FROM information_schema.tables "
-                    "WHERE table_schema = 'maxscale_schema' AND table_name = 'replication_heartbeat'"))
+    if (mysql_query(database->con, "SELECT column_name FROM information_schema.columns "
+                    "WHERE table_schema = 'maxscale_schema' AND table_name = 'replication_heartbeat' "
+                    "AND column_name IN ('master_timestamp', 'master_timestamp_us')"))
     {
         MXS_ERROR( "Error checking for replication_heartbeat in Master server"
                    ": %s", mysql_error(database->con));
         database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        database->server->rlag_us = -1;
     }
 
     result = mysql_store_result(database->con);
@@ -1493,6 +1937,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
                         "(maxscale_id INT NOT NULL, "
                         "master_server_id INT NOT NULL, "
                         "master_timestamp INT UNSIGNED NOT NULL, "
+                        "master_timestamp_us BIGINT UNSIGNED NOT NULL DEFAULT 0, "
                         "PRIMARY KEY ( master_server_id, maxscale_id ) ) "
                         "ENGINE=MYISAM DEFAULT CHARSET=latin1"))
         {
@@ -1500,7 +1945,27 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
                       "table in Master server: %s", mysql_error(database->con));
 
             database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+            database->server->rlag_us = -1;
         }
+
+        handle->heartbeat_us = true;
+    }
+    else if (1 == returned_rows)
+    {
+        /* the table was created by an older version, add the microsecond timestamps */
+        handle->heartbeat_us = mysql_query(database->con, "ALTER TABLE maxscale_schema.replication_heartbeat "
+                                           "ADD COLUMN master_timestamp_us BIGINT UNSIGNED NOT NULL DEFAULT 0") == 0;
+
+        if (!handle->heartbeat_us)
+        {
+            MXS_ERROR("Error adding the microsecond timestamps to the "
+                      "maxscale_schema.replication_heartbeat table in Master server, "
+                      "the replication lag is measured in seconds: %s", mysql_error(database->con));
+        }
+    }
+    else
+    {
+        handle->heartbeat_us = true;
     }
 
     /* auto purge old values after 48 hours*/
@@ -1517,20 +1982,32 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
                   mysql_error(database->con));
     }
 
-    heartbeat = time(0);
+    uint64_t heartbeat_us = heartbeat_now_us();
+    heartbeat = heartbeat_us / 1000000;
 
     /* set node_ts for master as time(0) */
     database->server->node_ts = heartbeat;
 
-    sprintf(heartbeat_insert_query,
-            "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu WHERE master_server_id = %li AND maxscale_id = %lu",
-            heartbeat, handle->master->server->node_id, id);
+    if (handle->heartbeat_us)
+    {
+        sprintf(heartbeat_insert_query,
+                "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu, master_timestamp_us = %lu "
+                "WHERE master_server_id = %li AND maxscale_id = %lu",
+                heartbeat, heartbeat_us, handle->master->server->node_id, id);
+    }
+    else
+    {
+        sprintf(heartbeat_insert_query,
+                "UPDATE maxscale_schema.replication_heartbeat SET master_timestamp = %lu WHERE master_server_id = %li AND maxscale_id = %lu",
+                heartbeat, handle->master->server->node_id, id);
+    }
 
     /* Try to insert MaxScale timestamp into master */
     if (mysql_query(database->con, heartbeat_insert_query))
     {
 
         database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        database->server->rlag_us = -1;
 
         MXS_ERROR("Error updating maxscale_schema.replication_heartbeat table: [%s], %s",
                   heartbeat_insert_query,
@@ -1540,15 +2017,25 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
     {
         if (mysql_affected_rows(database->con) == 0)
         {
-            heartbeat = time(0);
-            sprintf(heartbeat_insert_query,
-                    "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, master_timestamp ) VALUES ( %li, %lu, %lu)",
-                    handle->master->server->node_id, id, heartbeat);
+            if (handle->heartbeat_us)
+            {
+                sprintf(heartbeat_insert_query,
+                        "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, "
+                        "master_timestamp, master_timestamp_us ) VALUES ( %li, %lu, %lu, %lu)",
+                        handle->master->server->node_id, id, heartbeat, heartbeat_us);
+            }
+            else
+            {
+                sprintf(heartbeat_insert_query,
+                        "REPLACE INTO maxscale_schema.replication_heartbeat (master_server_id, maxscale_id, master_timestamp ) VALUES ( %li, %lu, %lu)",
+                        handle->master->server->node_id, id, heartbeat);
+            }
 
             if (mysql_query(database->con, heartbeat_insert_query))
             {
 
                 database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+                database->server->rlag_us = -1;
 
                 MXS_ERROR("Error inserting into "
                           "maxscale_schema.replication_heartbeat table: [%s], %s",
@@ -1559,6 +2046,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
             {
                 /* Set replication lag to 0 for the master */
                 database->server->rlag = 0;
+                database->server->rlag_us = 0;
 
                 MXS_DEBUG("heartbeat table inserted data for %s:%i",
                           database->server->name, database->server->port);
@@ -1568,6 +2056,7 @@ static void set_master_heartbeat(MYSQL_MONITOR *handle, MXS_MONITOR_SERVERS *dat
         {
             /* Set replication lag as 0 for the master */
             database->server->rlag = 0;
+            database->server->rlag_us = 0;
 
             MXS_DEBUG("heartbeat table updated for Master %s:%i",
                       database->server->name, database->server->port);
@@ -1600,9 +2089,10 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
 
     /* Get the master_timestamp value from maxscale_schema.replication_heartbeat table */
 
-    sprintf(select_heartbeat_query, "SELECT master_timestamp "
+    sprintf(select_heartbeat_query, "SELECT master_timestamp%s "
             "FROM maxscale_schema.replication_heartbeat "
             "WHERE maxscale_id = %lu AND master_server_id = %li",
+            handle->heartbeat_us ? ", master_timestamp_us" : "",
             id, handle->master->server->node_id);
 
     /* if there is a master then send the query to the slave with master_id */
@@ -1618,7 +2108,8 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
 
             rows_found = 1;
 
-            heartbeat = time(0);
+            uint64_t heartbeat_us = heartbeat_now_us();
+            heartbeat = heartbeat_us / 1000000;
             slave_read = strtoul(row[0], NULL, 10);
 
             if ((errno == ERANGE && (slave_read == LONG_MAX || slave_read == LONG_MIN)) || (errno != 0 &&
@@ -1644,6 +2135,22 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
             else
             {
                 database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+                database->server->rlag_us = -1;
+            }
+
+            /* the lag in microseconds is measured with the clock of MaxScale that
+             * wrote the timestamp to the master so the clocks of the servers don't
+             * affect it */
+            uint64_t slave_read_us = handle->heartbeat_us && row[1] ? strtoull(row[1], NULL, 10) : 0;
+
+            if (slave_read_us)
+            {
+                database->server->rlag_us = heartbeat_us > slave_read_us ? heartbeat_us - slave_read_us : 0;
+                add_lag_to_histogram(handle, database, database->server->rlag_us);
+            }
+            else
+            {
+                database->server->rlag_us = -1;
             }
 
             MXS_DEBUG("Slave %s:%i has %i seconds lag",
@@ -1654,6 +2161,7 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
         if (!rows_found)
         {
             database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+            database->server->rlag_us = -1;
             database->server->node_ts = 0;
         }
 
@@ -1662,6 +2170,7 @@ static void set_slave_heartbeat(MXS_MONITOR* mon, MXS_MONITOR_SERVERS *database)
     else
     {
         database->server->rlag = MAX_RLAG_NOT_AVAILABLE;
+        database->server->rlag_us = -1;
         database->server->node_ts = 0;
 
         if (handle->master->server->node_id < 0)
@@ -1725,7 +2234,7 @@ static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *mon, int num_serve
         if (node_id < 1)
         {
             MXS_MONITOR_SERVERS *find_slave;
-            find_slave = getSlaveOfNodeId(mon->databases, current->node_id);
+            find_slave = getSlaveOfNodeId(handle, mon->databases, current->node_id);
 
             if (find_slave == NULL)
             {
@@ -1752,7 +2261,7 @@ static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *mon, int num_serve
                 root_level = current->depth;
                 handle->master = ptr;
             }
-            backend = getServerByNodeId(mon->databases, node_id);
+            backend = getServerByNodeId(handle, mon->databases, node_id);
 
             if (backend)
             {
@@ -1774,7 +2283,7 @@ static MXS_MONITOR_SERVERS *get_replication_tree(MXS_MONITOR *mon, int num_serve
                 MXS_MONITOR_SERVERS *master;
                 current->depth = depth;
 
-                master = getServerByNodeId(mon->databases, current->master_id);
+                master = getServerByNodeId(handle, mon->databases, current->master_id);
                 if (master && master->server && master->server->node_id > 0)
                 {
                     add_slave_to_master(master->server->slaves, sizeof(master->server->slaves),
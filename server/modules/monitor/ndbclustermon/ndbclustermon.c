@@ -285,6 +285,18 @@ monitorDatabase(MXS_MONITOR_SERVERS *database, char *defaultUser, char *defaultP
     }
 }
 
+/**
+ * Probe an individual server with the credentials of the monitor
+ *
+ * @param mon       The monitor
+ * @param database  The database to probe
+ */
+static void
+probeDatabase(MXS_MONITOR *mon, MXS_MONITOR_SERVERS *database)
+{
+    monitorDatabase(database, mon->user, mon->password, mon);
+}
+
 /**
  * The entry point for the monitoring module thread
  *
@@ -343,8 +355,14 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
-            monitorDatabase(ptr, mon->user, mon->password, mon);
+            ptr = ptr->next;
+        }
+
+        mon_probe_servers(mon, probeDatabase);
 
+        ptr = mon->databases;
+        while (ptr)
+        {
             if (ptr->server->status != ptr->mon_prev_status ||
                 SERVER_IS_DOWN(ptr->server))
             {
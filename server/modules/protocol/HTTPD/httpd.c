@@ -40,6 +40,7 @@
 #include <maxscale/protocol.h>
 #include <maxscale/modinfo.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/metrics.h>
 #include <maxscale/resultset.h>
 
 #define ISspace(x) isspace((int)(x))
@@ -53,8 +54,8 @@ static int httpd_hangup(DCB *dcb);
 static int httpd_accept(DCB *dcb);
 static int httpd_close(DCB *dcb);
 static int httpd_listen(DCB *dcb, char *config);
-static int httpd_get_line(int sock, char *buf, int size);
-static void httpd_send_headers(DCB *dcb, int final, bool auth_ok);
+static void httpd_send_response(DCB *dcb, const char *status, const char *content_type,
+                                GWBUF *body, bool keep_alive);
 static char *httpd_default_auth();
 
 /**
@@ -118,184 +119,331 @@ static char *httpd_default_auth()
 }
 
 /**
- * Read event for EPOLLIN on the httpd protocol module.
- *
- * @param dcb   The descriptor control block
- * @return
+ * A parsed request
  */
-static int httpd_read_event(DCB* dcb)
+typedef struct httpd_request
 {
-    MXS_SESSION *session = dcb->session;
+    char        method[HTTPD_METHOD_MAXLEN]; /*< The method */
+    char        url[HTTPD_SMALL_BUFFER];     /*< The path of the URL */
+    const char *query;                       /*< The query string of the URL, NULL if there is none */
+    const char *authorization;               /*< The Authorization header, NULL if there is none */
+    size_t      content_length;              /*< Length of the body */
+    bool        keep_alive;                  /*< Whether the connection is kept open after the reply */
+} HTTPD_REQUEST;
 
-    int numchars = 1;
-    char buf[HTTPD_REQUESTLINE_MAXLEN - 1] = "";
-    char *query_string = NULL;
-    char method[HTTPD_METHOD_MAXLEN - 1] = "";
-    char url[HTTPD_SMALL_BUFFER] = "";
-    size_t i, j;
-    int headers_read = 0;
-    HTTPD_session *client_data = NULL;
-    GWBUF *uri;
+/**
+ * Find the end of the headers of the first request in the read data
+ *
+ * @param data Start of the request
+ * @param len  Length of the data
+ *
+ * @return Length of the request line and the headers with the empty line that
+ *         ends them, 0 if they have not all been read
+ */
+static size_t httpd_headers_length(const char *data, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        if (data[i] == '\n')
+        {
+            if (data[i + 1] == '\n')
+            {
+                return i + 2;
+            }
+            else if (data[i + 1] == '\r' && i + 2 < len && data[i + 2] == '\n')
+            {
+                return i + 3;
+            }
+        }
+    }
 
-    client_data = dcb->data;
+    return 0;
+}
 
-    /**
-     * get the request line
-     * METHOD URL HTTP_VER\r\n
-     */
+/**
+ * Remove the spaces and the carriage return around a header value
+ */
+static char* httpd_trim(char *value)
+{
+    while (ISspace(*value))
+    {
+        value++;
+    }
 
-    numchars = httpd_get_line(dcb->fd, buf, sizeof(buf));
+    char *end = value + strlen(value);
 
-    i = 0;
-    j = 0;
-    while (!ISspace(buf[j]) && (i < sizeof(method) - 1))
+    while (end > value && ISspace(end[-1]))
     {
-        method[i] = buf[j];
-        i++;
-        j++;
+        *--end = '\0';
     }
-    method[i] = '\0';
 
-    strcpy(client_data->method, method);
+    return value;
+}
 
-    /* check allowed http methods */
-    if (strcasecmp(method, "GET") && strcasecmp(method, "POST"))
+/**
+ * Parse the request line and the headers of a request
+ *
+ * @param dcb     The client DCB
+ * @param headers The request line and the headers, modified by the parsing
+ * @param req     The parsed request is stored here
+ *
+ * @return False if the request is malformed
+ */
+static bool httpd_parse_request(DCB *dcb, char *headers, HTTPD_REQUEST *req)
+{
+    HTTPD_session *client_data = dcb->data;
+    char *saveptr, *lineptr;
+    char *line = strtok_r(headers, "\n", &saveptr);
+    char *method = line ? strtok_r(line, " \t\r", &lineptr) : NULL;
+    char *url = method ? strtok_r(NULL, " \t\r", &lineptr) : NULL;
+    char *version = url ? strtok_r(NULL, " \t\r", &lineptr) : NULL;
+
+    if (url == NULL || strlen(method) >= sizeof(req->method) || strlen(url) >= sizeof(req->url))
     {
-        //httpd_unimplemented(dcb->fd);
-        return 0;
+        return false;
     }
 
-    i = 0;
+    strcpy(req->method, method);
+    strcpy(req->url, url);
+    req->query = NULL;
+    req->authorization = NULL;
+    req->content_length = 0;
 
-    while ( (j < sizeof(buf)) && ISspace(buf[j]))
+    /** HTTP/1.1 connections are kept open unless the client asks otherwise */
+    req->keep_alive = version && strcmp(version, "HTTP/1.1") == 0;
+
+    char *query = strchr(req->url, '?');
+
+    if (query)
     {
-        j++;
+        *query++ = '\0';
+        req->query = query;
     }
 
-    while ((j < sizeof(buf) - 1) && !ISspace(buf[j]) && (i < sizeof(url) - 1))
+    while ((line = strtok_r(NULL, "\n", &saveptr)))
     {
-        url[i] = buf[j];
-        i++;
-        j++;
-    }
+        char *value = strchr(line, ':');
 
-    url[i] = '\0';
+        if (value == NULL)
+        {
+            continue;
+        }
 
-    /**
-     * Get the query string if availble
-     */
+        *value++ = '\0';
+        value = httpd_trim(value);
 
-    if (strcasecmp(method, "GET") == 0)
-    {
-        query_string = url;
-        while ((*query_string != '?') && (*query_string != '\0'))
+        if (strcasecmp(line, "Connection") == 0)
+        {
+            if (strcasecmp(value, "close") == 0)
+            {
+                req->keep_alive = false;
+            }
+            else if (strcasecmp(value, "keep-alive") == 0)
+            {
+                req->keep_alive = true;
+            }
+        }
+        else if (strcasecmp(line, "Content-Length") == 0)
+        {
+            char *end;
+            unsigned long length = strtoul(value, &end, 10);
+
+            if (*value == '\0' || *end != '\0' || length > HTTPD_BODY_MAXLEN)
+            {
+                return false;
+            }
+
+            req->content_length = length;
+        }
+        else if (strcasecmp(line, "Transfer-Encoding") == 0)
+        {
+            /** Chunked bodies are not supported */
+            return false;
+        }
+        else if (strcasecmp(line, "Host") == 0)
+        {
+            snprintf(client_data->hostname, sizeof(client_data->hostname), "%s", value);
+        }
+        else if (strcasecmp(line, "User-Agent") == 0)
         {
-            query_string++;
+            snprintf(client_data->useragent, sizeof(client_data->useragent), "%s", value);
         }
-        if (*query_string == '?')
+        else if (strcasecmp(line, "Authorization") == 0)
         {
-            *query_string = '\0';
+            req->authorization = value;
         }
     }
 
+    return true;
+}
+
+/**
+ * Answer a request
+ *
+ * The response of the router or of the metrics is collected from the writes
+ * to the DCB, so that it can be sent with its length and the connection can
+ * be kept open.
+ *
+ * @param dcb The client DCB
+ * @param req The request
+ */
+static void httpd_handle_request(DCB *dcb, HTTPD_REQUEST *req)
+{
+    HTTPD_session *client_data = dcb->data;
+    MXS_SESSION *session = dcb->session;
+    GWBUF *uri;
+
+    strcpy(client_data->method, req->method);
+
+    /* check allowed http methods */
+    if (strcasecmp(req->method, "GET") && strcasecmp(req->method, "POST"))
+    {
+        httpd_send_response(dcb, "501 Not Implemented", "text/plain", NULL, req->keep_alive);
+        return;
+    }
+
     /** If listener->authenticator is the default authenticator, it means that
      * we don't need to check the user credentials. All other authenticators
      * cause a 401 Unauthorized to be returned on the first try. */
     bool auth_ok = strcmp(httpd_default_auth(), dcb->listener->authenticator) == 0;
 
-    /**
-     * Get the request headers
-     */
-
-    while ((numchars > 0) && strcmp("\n", buf))
+    if (req->authorization)
     {
-        char *value = NULL;
-        char *end = NULL;
-        numchars = httpd_get_line(dcb->fd, buf, sizeof(buf));
-        if ((value = strchr(buf, ':')))
-        {
-            *value = '\0';
-            value++;
-            end = &value[strlen(value) - 1];
-            *end = '\0';
-
-            if (strncasecmp(buf, "Hostname", 6) == 0)
-            {
-                strcpy(client_data->hostname, value);
-            }
-            if (strncasecmp(buf, "useragent", 9) == 0)
-            {
-                strcpy(client_data->useragent, value);
-            }
+        GWBUF *auth_data = gwbuf_alloc_and_load(strlen(req->authorization), req->authorization);
+        MXS_OOM_IFNULL(auth_data);
 
-            if (strcmp(buf, "Authorization") == 0)
-            {
-                GWBUF *auth_data = gwbuf_alloc_and_load(strlen(value), value);
-                MXS_OOM_IFNULL(auth_data);
-
-                if (auth_data)
-                {
-                    /** The freeing entry point is called automatically when
-                     * the client DCB is closed */
-                    dcb->authfunc.extract(dcb, auth_data);
-                    auth_ok = dcb->authfunc.authenticate(dcb) == MXS_AUTH_SUCCEEDED;
-                    gwbuf_free(auth_data);
-                }
-            }
+        if (auth_data)
+        {
+            /** The freeing entry point is called automatically when
+             * the client DCB is closed */
+            dcb->authfunc.extract(dcb, auth_data);
+            auth_ok = dcb->authfunc.authenticate(dcb) == MXS_AUTH_SUCCEEDED;
+            gwbuf_free(auth_data);
         }
     }
 
-    if (numchars)
+    if (!auth_ok)
     {
-        headers_read = 1;
-        memcpy(&client_data->headers_received, &headers_read, sizeof(int));
+        httpd_send_response(dcb, "401 Unauthorized", "application/json", NULL, req->keep_alive);
+        return;
     }
 
-    /**
-     * Now begins the server reply
-     */
+    client_data->response = NULL;
+    client_data->collect = true;
 
-    /* send all the basic headers and close with \r\n */
-    httpd_send_headers(dcb, 1, auth_ok);
+    /** The metrics are written by the protocol without routing the request */
+    bool metrics = strcmp(req->url, "/metrics") == 0;
 
-#if 0
-    /**
-     * ToDO: launch proper content handling based on the requested URI, later REST interface
-     *
-     */
-    if (strcmp(url, "/show") == 0)
+    if (metrics)
+    {
+        mxs_metrics_write(dcb);
+    }
+    else if ((uri = gwbuf_alloc(strlen(req->url) + (req->query ? strlen(req->query) + 1 : 0) + 1)) != NULL)
     {
-        if (query_string && strlen(query_string))
+        /** The query string is passed to the router after the path */
+        sprintf((char *)GWBUF_DATA(uri), "%s%s%s", req->url, req->query ? "?" : "",
+                req->query ? req->query : "");
+        gwbuf_set_type(uri, GWBUF_TYPE_HTTP);
+        MXS_SESSION_ROUTE_QUERY(session, uri);
+    }
+
+    client_data->collect = false;
+    httpd_send_response(dcb, "200 OK", metrics ? "text/plain; version=0.0.4" : "application/json",
+                        client_data->response, req->keep_alive);
+    client_data->response = NULL;
+}
+
+/**
+ * Read event for EPOLLIN on the httpd protocol module.
+ *
+ * The requests are parsed from the data read so far, so a request may arrive
+ * in any number of reads and a read may hold several pipelined requests. The
+ * incomplete request is kept in the read queue of the DCB. At most
+ * HTTPD_MAX_PIPELINED requests are answered in one event, so that a client
+ * does not hold up the other connections of the thread.
+ *
+ * @param dcb   The descriptor control block
+ * @return
+ */
+static int httpd_read_event(DCB* dcb)
+{
+    GWBUF *queue = NULL;
+
+    if (dcb_read(dcb, &queue, 0) < 0)
+    {
+        gwbuf_free(queue);
+        dcb_close(dcb);
+        return 0;
+    }
+
+    char headers[HTTPD_HEADERS_MAXLEN + 1];
+    bool keep_alive = true;
+    int n_requests = 0;
+
+    while (queue && keep_alive && n_requests < HTTPD_MAX_PIPELINED)
+    {
+        size_t len = gwbuf_copy_data(queue, 0, HTTPD_HEADERS_MAXLEN, (uint8_t*)headers);
+        size_t skip = 0;
+
+        /** Empty lines between the requests are ignored */
+        while (skip < len && (headers[skip] == '\r' || headers[skip] == '\n'))
         {
-            if (strcmp(query_string, "dcb") == 0)
-            {
-                dprintAllDCBs(dcb);
-            }
-            if (strcmp(query_string, "session") == 0)
+            skip++;
+        }
+
+        size_t headers_len = httpd_headers_length(headers + skip, len - skip);
+        HTTPD_REQUEST req;
+
+        if (headers_len == 0)
+        {
+            queue = gwbuf_consume(queue, skip);
+
+            if (len == HTTPD_HEADERS_MAXLEN)
             {
-                dprintAllSessions(dcb);
+                httpd_send_response(dcb, "431 Request Header Fields Too Large", "text/plain", NULL, false);
+                keep_alive = false;
             }
+            break;
         }
-    }
-    if (strcmp(url, "/services") == 0)
-    {
-        RESULTSET *set, *seviceGetList();
-        if ((set = serviceGetList()) != NULL)
+
+        headers[skip + headers_len] = '\0';
+
+        if (!httpd_parse_request(dcb, headers + skip, &req))
+        {
+            httpd_send_response(dcb, "400 Bad Request", "text/plain", NULL, false);
+            keep_alive = false;
+            break;
+        }
+
+        size_t request_len = skip + headers_len + req.content_length;
+
+        if (gwbuf_length(queue) < request_len)
         {
-            resultset_stream_json(set, dcb);
-            resultset_free(set);
+            /** The body has not been read yet */
+            break;
         }
+
+        /** The body of a POST is not used */
+        queue = gwbuf_consume(queue, request_len);
+        httpd_handle_request(dcb, &req);
+        keep_alive = req.keep_alive;
+        n_requests++;
     }
-#endif
-    if (auth_ok && (uri = gwbuf_alloc(strlen(url) + 1)) != NULL)
+
+    if (!keep_alive)
     {
-        strcpy((char *)GWBUF_DATA(uri), url);
-        gwbuf_set_type(uri, GWBUF_TYPE_HTTP);
-        MXS_SESSION_ROUTE_QUERY(session, uri);
+        gwbuf_free(queue);
+        dcb_close(dcb);
     }
+    else if (queue)
+    {
+        dcb->dcb_readqueue = queue;
 
-    /* force the client connecton close */
-    dcb_close(dcb);
+        if (n_requests == HTTPD_MAX_PIPELINED)
+        {
+            poll_fake_read_event(dcb);
+        }
+    }
 
     return 0;
 }
@@ -322,9 +470,15 @@ static int httpd_write_event(DCB *dcb)
  */
 static int httpd_write(DCB *dcb, GWBUF *queue)
 {
-    int rc;
-    rc = dcb_write(dcb, queue);
-    return rc;
+    HTTPD_session *client_data = dcb->data;
+
+    if (client_data && client_data->collect)
+    {
+        client_data->response = gwbuf_append(client_data->response, queue);
+        return 1;
+    }
+
+    return dcb_write(dcb, queue);
 }
 
 /**
@@ -408,75 +562,39 @@ static int httpd_listen(DCB *listener, char *config)
 }
 
 /**
- * HTTPD get line from client
- */
-static int httpd_get_line(int sock, char *buf, int size)
-{
-    int i = 0;
-    char c = '\0';
-    int n;
-
-    while ((i < size - 1) && (c != '\n'))
-    {
-        n = recv(sock, &c, 1, 0);
-        /* DEBUG printf("%02X\n", c); */
-        if (n > 0)
-        {
-            if (c == '\r')
-            {
-                n = recv(sock, &c, 1, MSG_PEEK);
-                /* DEBUG printf("%02X\n", c); */
-                if ((n > 0) && (c == '\n'))
-                {
-                    if (recv(sock, &c, 1, 0) < 0)
-                    {
-                        c = '\n';
-                    }
-                }
-                else
-                {
-                    c = '\n';
-                }
-            }
-            buf[i] = c;
-            i++;
-        }
-        else
-        {
-            c = '\n';
-        }
-    }
-
-    buf[i] = '\0';
-
-    return i;
-}
-
-/**
- * HTTPD send basic headers with 200 OK
+ * HTTPD send a response
+ *
+ * @param dcb          The client DCB
+ * @param status       The status code and its reason phrase
+ * @param content_type Content type of the response
+ * @param body         The body of the response, NULL for an empty body
+ * @param keep_alive   Whether the connection is kept open
  */
-static void httpd_send_headers(DCB *dcb, int final, bool auth_ok)
+static void httpd_send_response(DCB *dcb, const char *status, const char *content_type,
+                                GWBUF *body, bool keep_alive)
 {
     char date[64] = "";
     const char *fmt = "%a, %d %b %Y %H:%M:%S GMT";
     time_t httpd_current_time = time(NULL);
 
     struct tm tm;
-    localtime_r(&httpd_current_time, &tm);
+    gmtime_r(&httpd_current_time, &tm);
     strftime(date, sizeof(date), fmt, &tm);
-    const char *response = auth_ok ? "200 OK" : "401 Unauthorized";
     dcb_printf(dcb,
                "HTTP/1.1 %s\r\n"
                "Date: %s\r\n"
                "Server: %s\r\n"
-               "Connection: close\r\n"
-               "WWW-Authenticate: Basic realm=\"MaxInfo\"\r\n"
-               "Content-Type: application/json\r\n",
-               response, date, HTTP_SERVER_STRING);
-
-    /* close the headers */
-    if (final)
+               "Connection: %s\r\n"
+               "%s"
+               "Content-Type: %s\r\n"
+               "Content-Length: %u\r\n"
+               "\r\n",
+               status, date, HTTP_SERVER_STRING, keep_alive ? "keep-alive" : "close",
+               strncmp(status, "401", 3) == 0 ? "WWW-Authenticate: Basic realm=\"MaxInfo\"\r\n" : "",
+               content_type, body ? gwbuf_length(body) : 0);
+
+    if (body)
     {
-        dcb_printf(dcb, "\r\n");
+        dcb->func.write(dcb, body);
     }
 }
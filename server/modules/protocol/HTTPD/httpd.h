@@ -47,6 +47,9 @@ MXS_BEGIN_DECLS
 #define HTTPD_USERAGENT_MAXLEN 1024
 #define HTTPD_FIELD_MAXLEN 8192
 #define HTTPD_REQUESTLINE_MAXLEN 8192
+#define HTTPD_HEADERS_MAXLEN 8192     /*< Longest request line and headers */
+#define HTTPD_BODY_MAXLEN 65536       /*< Longest request body */
+#define HTTPD_MAX_PIPELINED 16        /*< Requests answered in one read event */
 
 /**
  * HTTPD session specific data
@@ -62,7 +65,8 @@ typedef struct httpd_session
     char *url;                  /*< the URL in the request */
     char *path_info;                /*< the Pathinfo, starts with /, is the extra path segments after the document name */
     char *query_string;             /*< the Query string, starts with ?, after path_info and document name */
-    int headers_received;               /*< All the headers has been received, if 1 */
+    GWBUF *response;                /*< The response being collected */
+    bool collect;                   /*< Whether the writes are collected to @c response */
 } HTTPD_session;
 
 MXS_END_DECLS
@@ -14,6 +14,8 @@
 #define MXS_MODULE_NAME "MySQLBackend"
 
 #include <maxscale/protocol/mysql.h>
+#include <ctype.h>
+#include <strings.h>
 #include <maxscale/limits.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/modutil.h>
@@ -63,6 +65,9 @@ static int backend_write_delayqueue(DCB *dcb, GWBUF *buffer);
 static void backend_set_delayqueue(DCB *dcb, GWBUF *queue);
 static int gw_change_user(DCB *backend_dcb, SERVER *server, MXS_SESSION *in_session, GWBUF *queue);
 static char *gw_backend_default_auth();
+static int gw_backend_ping(DCB *dcb);
+static int gw_backend_idle(DCB *dcb);
+static bool read_ping_reply(DCB *dcb);
 static GWBUF* process_response_data(DCB* dcb, GWBUF** readbuf, int nbytes_to_process);
 extern char* create_auth_failed_msg(GWBUF* readbuf, char* hostaddr, uint8_t* sha1);
 static bool sescmd_response_complete(DCB* dcb);
@@ -102,7 +107,9 @@ MXS_MODULE* MXS_CREATE_MODULE()
         gw_change_user,             /* Authentication                */
         NULL,                       /* Session                       */
         gw_backend_default_auth,    /* Default authenticator         */
-        NULL                        /* Connection limit reached      */
+        NULL,                       /* Connection limit reached      */
+        gw_backend_ping,            /* Ping a pooled connection      */
+        gw_backend_idle             /* No reply is outstanding       */
     };
 
     static MXS_MODULE info =
@@ -136,6 +143,91 @@ static char *gw_backend_default_auth()
 {
     return "MySQLBackendAuth";
 }
+
+/**
+ * Send a COM_PING to a pooled connection
+ *
+ * @param dcb The pooled backend DCB
+ * @return 1 on success, 0 on failure
+ */
+static int gw_backend_ping(DCB *dcb)
+{
+    GWBUF *buf = gwbuf_alloc(MYSQL_HEADER_LEN + 1);
+
+    if (buf == NULL)
+    {
+        return 0;
+    }
+
+    uint8_t *data = GWBUF_DATA(buf);
+    gw_mysql_set_byte3(data, 1);
+    data[3] = 0;
+    data[4] = MYSQL_COM_PING;
+
+    return mxs_mysql_write(dcb, buf) ? 1 : 0;
+}
+
+/**
+ * Check that the connection waits for no replies
+ *
+ * The replies to session commands, to the COM_CHANGE_USER of a connection
+ * taken from the pool and to a cached COM_STMT_PREPARE are tracked here. The
+ * router is asked about the replies to the other commands.
+ *
+ * @param dcb The backend DCB
+ * @return 1 if no reply is outstanding, 0 otherwise
+ */
+static int gw_backend_idle(DCB *dcb)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    return proto->protocol_auth_state == MXS_AUTH_STATE_COMPLETE &&
+           !proto->ignore_reply && proto->stored_query == NULL &&
+           proto->ps_pending == NULL &&
+           proto->reply_state == MYSQL_REPLY_STATE_START &&
+           protocol_get_srv_command(proto, false) == MYSQL_COM_UNDEFINED ? 1 : 0;
+}
+
+/**
+ * Read the reply to a ping sent to a pooled connection
+ *
+ * @param dcb The pooled backend DCB
+ * @return False if the reading failed or the reply was not an OK packet
+ */
+static bool read_ping_reply(DCB *dcb)
+{
+    GWBUF *readbuf = NULL;
+
+    if (mxs_mysql_read(dcb, &readbuf, 0) < 0)
+    {
+        gwbuf_free(readbuf);
+        return false;
+    }
+
+    GWBUF *packet = modutil_get_next_MySQL_packet(&readbuf);
+
+    if (packet == NULL)
+    {
+        /** Wait for the rest of the reply */
+        dcb->dcb_readqueue = gwbuf_append(dcb->dcb_readqueue, readbuf);
+        return true;
+    }
+
+    uint8_t cmd = 0xff;
+    gwbuf_copy_data(packet, MYSQL_HEADER_LEN, 1, &cmd);
+    bool ok = cmd == MYSQL_REPLY_OK && readbuf == NULL;
+
+    gwbuf_free(packet);
+    gwbuf_free(readbuf);
+
+    if (ok)
+    {
+        dcb->persistping = 0;
+        dcb->persistalive = time(NULL);
+    }
+
+    return ok;
+}
 /*lint +e14 */
 
 /*******************************************************************************
@@ -201,7 +293,15 @@ static int gw_create_backend_connection(DCB *backend_dcb,
 
     /*< if succeed, fd > 0, -1 otherwise */
     /* TODO: Better if function returned a protocol auth state */
-    rv = gw_do_connect_to_backend(server->name, server->port, &fd);
+    if (server->fake_backend)
+    {
+        fd = mxs_mysql_loopback_connect();
+        rv = fd == -1 ? -1 : 0;
+    }
+    else
+    {
+        rv = gw_do_connect_to_backend(server->name, server->port, &fd);
+    }
     /*< Assign protocol with backend_dcb */
     backend_dcb->protocol = protocol;
 
@@ -427,8 +527,11 @@ gw_read_backend_event(DCB *dcb)
     if (dcb->persistentstart)
     {
         /** If a DCB gets a read event when it's in the persistent pool, it is
-         * treated as if it were an error. */
-        dcb->dcb_errhandle_called = true;
+         * treated as if it were an error unless it is the reply to a ping. */
+        if (!dcb->persistping || !read_ping_reply(dcb))
+        {
+            dcb->dcb_errhandle_called = true;
+        }
         return 0;
     }
 
@@ -614,6 +717,86 @@ static inline bool expecting_resultset(MySQLProtocol *proto)
            proto->current_command == MYSQL_COM_STMT_FETCH;
 }
 
+/**
+ * @brief Track the reply to the current command one packet at a time
+ *
+ * Only result sets are tracked, any other reply is considered to be complete
+ * after its first packet.
+ *
+ * @param proto  Backend protocol
+ * @param packet A complete packet of the reply
+ * @return True if more packets of the same reply will follow
+ */
+static bool reply_continues(MySQLProtocol *proto, GWBUF *packet)
+{
+    uint8_t header[MYSQL_EOF_PACKET_LEN];
+    size_t len = gwbuf_copy_data(packet, 0, sizeof(header), header);
+    bool is_eof = len == MYSQL_EOF_PACKET_LEN && MYSQL_GET_COMMAND(header) == MYSQL_REPLY_EOF;
+    bool is_err = len > MYSQL_HEADER_LEN && MYSQL_GET_COMMAND(header) == MYSQL_REPLY_ERR;
+
+    switch (proto->reply_state)
+    {
+    case MYSQL_REPLY_STATE_START:
+        if (expecting_resultset(proto) && len > MYSQL_HEADER_LEN && !is_err &&
+            MYSQL_GET_COMMAND(header) != MYSQL_REPLY_OK &&
+            MYSQL_GET_COMMAND(header) != MYSQL_REPLY_LOCAL_INFILE)
+        {
+            proto->reply_state = MYSQL_REPLY_STATE_COLDEF;
+        }
+        break;
+
+    case MYSQL_REPLY_STATE_COLDEF:
+        if (is_err)
+        {
+            proto->reply_state = MYSQL_REPLY_STATE_START;
+        }
+        else if (is_eof)
+        {
+            proto->reply_state = MYSQL_REPLY_STATE_ROWS;
+        }
+        break;
+
+    case MYSQL_REPLY_STATE_ROWS:
+        if (is_err || is_eof)
+        {
+            proto->reply_state = MYSQL_REPLY_STATE_START;
+            /** The status flags of the EOF tell if another result set follows */
+            return is_eof && (gw_mysql_get_byte2(header + 7) & SERVER_MORE_RESULTS_EXIST);
+        }
+        break;
+    }
+
+    return proto->reply_state != MYSQL_REPLY_STATE_START;
+}
+
+/**
+ * @brief Check if the reply can be spliced directly to the client
+ *
+ * This is possible when neither the router nor any filters need to see the
+ * reply, neither connection is encrypted or compressed and no data is
+ * waiting to be processed.
+ *
+ * @param dcb Backend DCB
+ * @return True if the reply can be moved with dcb_splice
+ */
+static bool reply_passthrough_ok(DCB *dcb)
+{
+    MXS_SESSION *session = dcb->session;
+    MySQLProtocol *proto = (MySQLProtocol *)dcb->protocol;
+    uint64_t capabilities = service_get_capabilities(session->service);
+
+    return rcap_type_required(capabilities, RCAP_TYPE_REPLY_PASSTHROUGH) &&
+           !rcap_type_required(capabilities, RCAP_TYPE_STMT_OUTPUT) &&
+           session->service->n_filters == 0 &&
+           session_ok_to_route(dcb) &&
+           session->client_dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER &&
+           dcb->ssl == NULL && session->client_dcb->ssl == NULL &&
+           !proto->compress && !((MySQLProtocol*)session->client_dcb->protocol)->compress &&
+           dcb->dcb_readqueue == NULL && dcb->dcb_fakequeue == NULL &&
+           !proto->ignore_reply &&
+           protocol_get_srv_command(proto, false) == MYSQL_COM_UNDEFINED;
+}
+
 /**
  * @brief With authentication completed, read new data and write to backend
  *
@@ -630,9 +813,23 @@ gw_read_and_write(DCB *dcb)
     int return_code = 0;
 
     CHK_SESSION(session);
+    MXS_SESSION_TRACE(session, SESSION_TRACE_RESPONSE, dcb->server->unique_name);
 
-    /* read available backend data */
-    return_code = dcb_read(dcb, &read_buffer, 0);
+    if (reply_passthrough_ok(dcb))
+    {
+        /** Move the reply to the client without reading it into buffers */
+        return_code = dcb_splice(dcb, session->client_dcb);
+
+        if (return_code >= 0)
+        {
+            return return_code > 0 ? 1 : 0;
+        }
+    }
+    else
+    {
+        /* read available backend data */
+        return_code = mxs_mysql_read(dcb, &read_buffer, 0);
+    }
 
     if (return_code < 0)
     {
@@ -748,14 +945,27 @@ gw_read_and_write(DCB *dcb)
         return rval;
     }
 
+    DCB *client_dcb = NULL;
+    bool more = false;
+
+    if (session_ok_to_route(dcb) && session->client_dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER)
+    {
+        /** Send all packets of this read with as few writes as possible */
+        client_dcb = session->client_dcb;
+        dcb_cork(client_dcb);
+    }
+
     do
     {
         GWBUF *stmt = NULL;
+        more = false;
         /**
          * If protocol has session command set, concatenate whole
          * response into one buffer.
          */
-        if (protocol_get_srv_command((MySQLProtocol *)dcb->protocol, false) != MYSQL_COM_UNDEFINED)
+        mysql_server_cmd_t srvcmd = protocol_get_srv_command(proto, false);
+
+        if (srvcmd != MYSQL_COM_UNDEFINED)
         {
             stmt = process_response_data(dcb, &read_buffer, gwbuf_length(read_buffer));
             /**
@@ -766,7 +976,8 @@ gw_read_and_write(DCB *dcb)
             {
                 stmt = gwbuf_append(stmt, read_buffer);
                 dcb->dcb_readqueue = gwbuf_append(stmt, dcb->dcb_readqueue);
-                return 0;
+                return_code = 0;
+                break;
             }
 
             if (!stmt)
@@ -775,13 +986,20 @@ gw_read_and_write(DCB *dcb)
                           "Read buffer unexpectedly null, even though response "
                           "not marked as complete. User: %s",
                           pthread_self(), dcb->session->client_dcb->user);
-                return 0;
+                return_code = 0;
+                break;
+            }
+
+            if (srvcmd == MYSQL_COM_STMT_PREPARE && proto->ps_pending)
+            {
+                mxs_mysql_ps_cache_store(dcb, stmt);
             }
         }
         else if (rcap_type_required(capabilities, RCAP_TYPE_STMT_OUTPUT) &&
                  !rcap_type_required(capabilities, RCAP_TYPE_RESULTSET_OUTPUT))
         {
             stmt = modutil_get_next_MySQL_packet(&read_buffer);
+            more = reply_continues(proto, stmt);
         }
         else
         {
@@ -804,6 +1022,12 @@ gw_read_and_write(DCB *dcb)
     }
     while (read_buffer);
 
+    if (client_dcb)
+    {
+        /** The kernel may hold back the last segment if the result set continues */
+        dcb_uncork(client_dcb, more);
+    }
+
     return return_code;
 }
 
@@ -869,6 +1093,102 @@ static int gw_write_backend_event(DCB *dcb)
     return rc;
 }
 
+/** The statement ID that refers to the last prepared statement */
+#define PS_LAST_ID 0xffffffff
+
+/**
+ * Check if a COM_QUERY starts with USE and may change the default database
+ */
+static bool is_use_query(GWBUF *queue)
+{
+    char sql[16];
+    size_t len = gwbuf_copy_data(queue, MYSQL_HEADER_LEN + 1, sizeof(sql) - 1, (uint8_t*)sql);
+    sql[len] = '\0';
+
+    char *ptr = sql;
+
+    while (isspace((unsigned char)*ptr))
+    {
+        ptr++;
+    }
+
+    return strncasecmp(ptr, "USE", 3) == 0 && (isspace((unsigned char)ptr[3]) || ptr[3] == '`');
+}
+
+/**
+ * @brief Apply the prepared statement cache of a connection to a command
+ *
+ * A COM_STMT_CLOSE of a cached statement is not sent. The statement ID that
+ * refers to the last prepared statement is replaced with the ID of the cached
+ * statement if the last COM_STMT_PREPARE was not sent to the server. The
+ * statements are forgotten when the default database changes.
+ *
+ * @param dcb   Backend DCB
+ * @param queue The command, may be replaced with a copy
+ * @param cmd   The command byte
+ *
+ * @return False if the command was freed and must not be written
+ */
+static bool prepare_cache_write(DCB *dcb, GWBUF **queue, mysql_server_cmd_t cmd)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    uint8_t header[MYSQL_HEADER_LEN + 5];
+    uint32_t id = 0;
+
+    switch (cmd)
+    {
+    case MYSQL_COM_STMT_CLOSE:
+    case MYSQL_COM_STMT_EXECUTE:
+    case MYSQL_COM_STMT_SEND_LONG_DATA:
+    case MYSQL_COM_STMT_RESET:
+    case MYSQL_COM_STMT_FETCH:
+        if (gwbuf_copy_data(*queue, 0, sizeof(header), header) == sizeof(header))
+        {
+            id = gw_mysql_get_byte4(header + MYSQL_HEADER_LEN + 1);
+
+            if (id == PS_LAST_ID && proto->ps_last_cached &&
+                mxs_mysql_set_ps_id(queue, proto->ps_last_id))
+            {
+                id = proto->ps_last_id;
+            }
+
+            if (cmd == MYSQL_COM_STMT_CLOSE && mxs_mysql_ps_cache_close(dcb, id))
+            {
+                /** The statement is kept open for the next client */
+                gwbuf_free(*queue);
+                return false;
+            }
+        }
+        break;
+
+    case MYSQL_COM_STMT_PREPARE:
+        /** The statement is prepared on the server, it is the last one */
+        proto->ps_last_cached = false;
+        break;
+
+    case MYSQL_COM_QUERY:
+        if (is_use_query(*queue))
+        {
+            mxs_mysql_ps_cache_clear(proto, true);
+        }
+        break;
+
+    case MYSQL_COM_INIT_DB:
+        mxs_mysql_ps_cache_clear(proto, true);
+        break;
+
+    case MYSQL_COM_CHANGE_USER:
+        /** The server closes the prepared statements of the connection */
+        mxs_mysql_ps_cache_clear(proto, false);
+        break;
+
+    default:
+        break;
+    }
+
+    return true;
+}
+
 /*
  * Write function for backend DCB. Store command to protocol.
  *
@@ -882,6 +1202,21 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
     int rc = 0;
 
     CHK_DCB(dcb);
+    MXS_SESSION_TRACE(dcb->session, SESSION_TRACE_BACKEND_WRITE, dcb->server->unique_name);
+
+    DCB *client_dcb = dcb->session ? dcb->session->client_dcb : NULL;
+
+    if (dcb->was_persistent && dcb->state == DCB_STATE_POLLING &&
+        dcb->server->persistreuse && client_dcb && client_dcb->persistkey &&
+        dcb->persistkey && strcmp(dcb->persistkey, client_dcb->persistkey) == 0)
+    {
+        /**
+         * The pooled connection has the same user, default database and
+         * character set as the client, it can be used as-is.
+         */
+        dcb->was_persistent = false;
+        mxs_mysql_ps_cache_release(backend_protocol);
+    }
 
     if (dcb->was_persistent && dcb->state == DCB_STATE_POLLING)
     {
@@ -901,12 +1236,20 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
         backend_protocol->ignore_reply = true;
         backend_protocol->stored_query = queue;
 
+        /** The server closes the prepared statements of the connection */
+        mxs_mysql_ps_cache_clear(backend_protocol, false);
+
+        /** The user change resets the connection to the state of the client */
+        MXS_FREE(dcb->persistkey);
+        dcb->persistkey = client_dcb && client_dcb->persistkey ?
+                          MXS_STRDUP(client_dcb->persistkey) : NULL;
+
         GWBUF *buf = gw_create_change_user_packet(dcb->session->client_dcb->data, dcb->protocol);
-        return dcb_write(dcb, buf) ? 1 : 0;
+        return mxs_mysql_write(dcb, buf) ? 1 : 0;
     }
     else if (backend_protocol->ignore_reply)
     {
-        if (MYSQL_IS_COM_QUIT((uint8_t*)GWBUF_DATA(queue)))
+        if (!GWBUF_IS_TYPE_CONTINUATION(queue) && MYSQL_IS_COM_QUIT((uint8_t*)GWBUF_DATA(queue)))
         {
             gwbuf_free(queue);
         }
@@ -947,6 +1290,12 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
         break;
 
     case MXS_AUTH_STATE_COMPLETE:
+        if (GWBUF_IS_TYPE_CONTINUATION(queue))
+        {
+            /** The rest of a large command, it does not start a new command */
+            rc = mxs_mysql_write(dcb, queue);
+        }
+        else
         {
             uint8_t* ptr = GWBUF_DATA(queue);
             mysql_server_cmd_t cmd = MYSQL_GET_COMMAND(ptr);
@@ -956,6 +1305,7 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
             {
                 MySQLProtocol *client_proto = (MySQLProtocol*)dcb->session->client_dcb->protocol;
                 backend_protocol->current_command = client_proto->current_command;
+                backend_protocol->reply_state = MYSQL_REPLY_STATE_START;
             }
 
             MXS_DEBUG("%lu [gw_MySQLWrite_backend] write to dcb %p "
@@ -976,10 +1326,49 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
             if (GWBUF_IS_TYPE_SINGLE_STMT(queue) &&
                 GWBUF_IS_TYPE_SESCMD(queue))
             {
+                if (cmd == MYSQL_COM_STMT_PREPARE && dcb->server->ps_cache_size > 0 &&
+                    GWBUF_IS_TYPE_NO_PENDING(queue) &&
+                    protocol_get_srv_command(backend_protocol, false) == MYSQL_COM_UNDEFINED)
+                {
+                    /** No other replies are expected, the next one is the reply to this */
+                    GWBUF *reply = mxs_mysql_ps_cache_get(dcb, queue);
+
+                    if (reply)
+                    {
+                        /** The statement is still open on the server */
+                        protocol_add_srv_command(backend_protocol, cmd);
+                        poll_add_epollin_event_to_dcb(dcb, reply);
+                        gwbuf_free(queue);
+                        rc = 1;
+                        break;
+                    }
+
+                    mxs_mysql_ps_cache_expect(dcb, queue);
+                }
+
                 /** Record the command to backend's protocol */
                 protocol_add_srv_command(backend_protocol, cmd);
             }
 
+            if (backend_protocol->ps_cache && !prepare_cache_write(dcb, &queue, cmd))
+            {
+                rc = 1;
+                break;
+            }
+
+            if (cmd == MYSQL_COM_INIT_DB || cmd == MYSQL_COM_CHANGE_USER)
+            {
+                /** The connection no longer matches the key it was opened with */
+                MXS_FREE(dcb->persistkey);
+                dcb->persistkey = NULL;
+
+                if (client_dcb)
+                {
+                    MXS_FREE(client_dcb->persistkey);
+                    client_dcb->persistkey = NULL;
+                }
+            }
+
             if (cmd == MYSQL_COM_QUIT && dcb->server->persistpoolmax)
             {
                 /** We need to keep the pooled connections alive so we just ignore the COM_QUIT packet */
@@ -989,7 +1378,7 @@ static int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
             else
             {
                 /** Write to backend */
-                rc = dcb_write(dcb, queue);
+                rc = mxs_mysql_write(dcb, queue);
             }
         }
         break;
@@ -1319,7 +1708,7 @@ static int backend_write_delayqueue(DCB *dcb, GWBUF *buffer)
     }
     else
     {
-        rc = dcb_write(dcb, buffer);
+        rc = mxs_mysql_write(dcb, buffer);
     }
 
     if (rc == 0)
@@ -1541,6 +1930,8 @@ static int gw_change_user(DCB *backend,
         strcpy(current_session->user, username);
         strcpy(current_session->db, database);
         memcpy(current_session->client_sha1, client_sha1, sizeof(current_session->client_sha1));
+        /** The server closes the prepared statements of the connection */
+        mxs_mysql_ps_cache_clear(backend_protocol, false);
         rv = gw_send_change_user_to_backend(database, username, client_sha1, backend_protocol);
     }
 
@@ -52,6 +52,7 @@
 #include <maxscale/alloc.h>
 #include <maxscale/log_manager.h>
 #include <maxscale/protocol/mysql.h>
+#include <maxscale/listener.h>
 #include <maxscale/ssl.h>
 #include <maxscale/poll.h>
 #include <maxscale/modinfo.h>
@@ -61,6 +62,8 @@
 #include <maxscale/query_classifier.h>
 #include <maxscale/authenticator.h>
 #include <maxscale/session.h>
+#include <maxscale/utils.h>
+#include <maxscale/platform.h>
 
 static int process_init(void);
 static void process_finish(void);
@@ -78,12 +81,16 @@ static int gw_client_hangup_event(DCB *dcb);
 static char *gw_default_auth();
 static int gw_connection_limit(DCB *dcb, int limit);
 static int MySQLSendHandshake(DCB* dcb);
+static void free_handshake_templates();
 static int route_by_statement(MXS_SESSION *, uint64_t, GWBUF **);
 static void mysql_client_auth_error_handling(DCB *dcb, int auth_val, int packet_number);
 static int gw_read_do_authentication(DCB *dcb, GWBUF *read_buffer, int nbytes_read);
 static int gw_read_normal_data(DCB *dcb, GWBUF *read_buffer, int nbytes_read);
 static int gw_read_finish_processing(DCB *dcb, GWBUF *read_buffer, uint64_t capabilities);
 static bool ensure_complete_packet(DCB *dcb, GWBUF **read_buffer, int nbytes_read);
+static bool has_complete_packet(GWBUF *buffer);
+static bool stream_continuation(DCB *dcb, uint64_t capabilities);
+static GWBUF* get_continuation(MySQLProtocol *proto, GWBUF **buffer);
 static void gw_process_one_new_client(DCB *client_dcb);
 
 /*
@@ -187,6 +194,8 @@ static int thread_init(void)
  */
 static void thread_finish(void)
 {
+    free_handshake_templates();
+    mxs_mysql_compress_thread_finish();
     mysql_thread_end();
 }
 
@@ -200,69 +209,49 @@ static char *gw_default_auth()
     return "MySQLAuth";
 }
 
+/** Number of initial handshake templates kept by each thread */
+#define HANDSHAKE_TEMPLATES 4
+
 /**
- * MySQLSendHandshake
+ * The initial handshake packet of the connections that get the same server
+ * version, character set and capabilities. Only the thread ID and the
+ * scramble differ between the connections.
+ */
+typedef struct handshake_template
+{
+    uint8_t *data;                /*< The packet, NULL if the template is not used */
+    size_t   len;                 /*< Length of the packet */
+    size_t   version_len;         /*< Length of the server version string */
+    uint8_t  language;            /*< Character set of the server */
+    uint8_t  capabilities_one[2]; /*< The lower bytes of the capabilities */
+    bool     is_maria;            /*< Whether the extended capabilities are sent */
+    size_t   thread_id_offset;    /*< Offset of the thread ID, followed by the scramble buffer */
+    size_t   plugin_data_offset;  /*< Offset of the rest of the scramble */
+} HANDSHAKE_TEMPLATE;
+
+static thread_local HANDSHAKE_TEMPLATE handshake_templates[HANDSHAKE_TEMPLATES];
+static thread_local int next_handshake_template = 0;
+
+/**
+ * @brief Build the initial handshake packet without the thread ID and the scramble
  *
- * @param dcb The descriptor control block to use for sending the handshake request
- * @return      The packet length sent
+ * @param tmpl           Template to fill, the old packet is freed
+ * @param version_string Server version
+ * @param language       Character set of the server
+ * @param caps_one       The lower bytes of the capabilities
+ * @param is_maria       Whether the MariaDB 10.2 capabilities are sent
+ *
+ * @return True if the packet was built
  */
-int MySQLSendHandshake(DCB* dcb)
+static bool create_handshake_template(HANDSHAKE_TEMPLATE *tmpl, const char *version_string,
+                                      uint8_t language, const uint8_t *caps_one, bool is_maria)
 {
-    uint8_t *outbuf = NULL;
-    uint32_t mysql_payload_size = 0;
-    uint8_t mysql_packet_header[4];
-    uint8_t mysql_packet_id = 0;
-    /* uint8_t mysql_filler = GW_MYSQL_HANDSHAKE_FILLER; not needed*/
     uint8_t mysql_protocol_version = GW_MYSQL_PROTOCOL_VERSION;
-    uint8_t *mysql_handshake_payload = NULL;
-    uint8_t mysql_thread_id_num[4];
-    uint8_t mysql_scramble_buf[9] = "";
-    uint8_t mysql_plugin_data[13] = "";
-    uint8_t mysql_server_capabilities_one[2];
     uint8_t mysql_server_capabilities_two[2];
-    uint8_t mysql_server_language = 8;
     uint8_t mysql_server_status[2];
     uint8_t mysql_scramble_len = 21;
     uint8_t mysql_filler_ten[10] = {};
-    /* uint8_t mysql_last_byte = 0x00; not needed */
-    char server_scramble[GW_MYSQL_SCRAMBLE_SIZE + 1] = "";
-    char *version_string;
-    int len_version_string = 0;
-    int id_num;
-
-    bool is_maria = false;
-
-    if (dcb->service->dbref)
-    {
-        mysql_server_language = dcb->service->dbref->server->charset;
-
-        if (dcb->service->dbref->server->server_string &&
-            strstr(dcb->service->dbref->server->server_string, "10.2."))
-        {
-            /** The backend servers support the extended capabilities */
-            is_maria = true;
-        }
-    }
-
-    MySQLProtocol *protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
-    GWBUF *buf;
-
-    /* get the version string from service property if available*/
-    if (dcb->service->version_string != NULL)
-    {
-        version_string = dcb->service->version_string;
-        len_version_string = strlen(version_string);
-    }
-    else
-    {
-        version_string = GW_MYSQL_VERSION;
-        len_version_string = strlen(GW_MYSQL_VERSION);
-    }
-
-    gw_generate_random_str(server_scramble, GW_MYSQL_SCRAMBLE_SIZE);
-
-    // copy back to the caller
-    memcpy(protocol->scramble, server_scramble, GW_MYSQL_SCRAMBLE_SIZE);
+    size_t len_version_string = strlen(version_string);
 
     if (is_maria)
     {
@@ -274,14 +263,6 @@ int MySQLSendHandshake(DCB* dcb)
         memcpy(mysql_filler_ten + 6, &new_flags, sizeof(new_flags));
     }
 
-    // thread id, now put thePID
-    id_num = getpid() + dcb->fd;
-    gw_mysql_set_byte4(mysql_thread_id_num, id_num);
-
-    memcpy(mysql_scramble_buf, server_scramble, 8);
-
-    memcpy(mysql_plugin_data, server_scramble + 8, 12);
-
     /**
      * Use the default authentication plugin name in the initial handshake. If the
      * authenticator needs to change the authentication method, it should send
@@ -290,54 +271,202 @@ int MySQLSendHandshake(DCB* dcb)
     const char* plugin_name = DEFAULT_MYSQL_AUTH_PLUGIN;
     int plugin_name_len = strlen(plugin_name);
 
-    mysql_payload_size =
-        sizeof(mysql_protocol_version) + (len_version_string + 1) + sizeof(mysql_thread_id_num) + 8 +
-        sizeof(/* mysql_filler */ uint8_t) + sizeof(mysql_server_capabilities_one) + sizeof(mysql_server_language) +
+    uint32_t mysql_payload_size =
+        sizeof(mysql_protocol_version) + (len_version_string + 1) + 4 + 8 +
+        sizeof(/* mysql_filler */ uint8_t) + 2 + sizeof(language) +
         sizeof(mysql_server_status) + sizeof(mysql_server_capabilities_two) + sizeof(mysql_scramble_len) +
         sizeof(mysql_filler_ten) + 12 + sizeof(/* mysql_last_byte */ uint8_t) + plugin_name_len +
         sizeof(/* mysql_last_byte */ uint8_t);
 
-    // allocate memory for packet header + payload
-    if ((buf = gwbuf_alloc(sizeof(mysql_packet_header) + mysql_payload_size)) == NULL)
+    uint8_t *outbuf = MXS_MALLOC(MYSQL_HEADER_LEN + mysql_payload_size);
+
+    if (outbuf == NULL)
     {
-        ss_dassert(buf != NULL);
-        return 0;
+        return false;
     }
-    outbuf = GWBUF_DATA(buf);
 
-    // write packet header with mysql_payload_size
-    gw_mysql_set_byte3(mysql_packet_header, mysql_payload_size);
+    MXS_FREE(tmpl->data);
+    tmpl->data = outbuf;
+    tmpl->len = MYSQL_HEADER_LEN + mysql_payload_size;
+    tmpl->version_len = len_version_string;
+    tmpl->language = language;
+    memcpy(tmpl->capabilities_one, caps_one, sizeof(tmpl->capabilities_one));
+    tmpl->is_maria = is_maria;
 
-    // write packet number, now is 0
-    mysql_packet_header[3] = mysql_packet_id;
-    memcpy(outbuf, mysql_packet_header, sizeof(mysql_packet_header));
+    // write packet header with mysql_payload_size, the packet number is 0
+    gw_mysql_set_byte3(outbuf, mysql_payload_size);
+    outbuf[3] = 0;
 
     // current buffer pointer
-    mysql_handshake_payload = outbuf + sizeof(mysql_packet_header);
+    uint8_t *mysql_handshake_payload = outbuf + MYSQL_HEADER_LEN;
 
     // write protocol version
-    memcpy(mysql_handshake_payload, &mysql_protocol_version, sizeof(mysql_protocol_version));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_protocol_version);
+    *mysql_handshake_payload++ = mysql_protocol_version;
 
     // write server version plus 0 filler
-    strcpy((char *)mysql_handshake_payload, version_string);
-    mysql_handshake_payload = mysql_handshake_payload + len_version_string;
+    memcpy(mysql_handshake_payload, version_string, len_version_string + 1);
+    mysql_handshake_payload += len_version_string + 1;
+
+    // the thread id and the scramble buf are written for each connection
+    tmpl->thread_id_offset = mysql_handshake_payload - outbuf;
+    memset(mysql_handshake_payload, 0, 4 + 8);
+    mysql_handshake_payload += 4 + 8;
+    *mysql_handshake_payload++ = GW_MYSQL_HANDSHAKE_FILLER;
+
+    // write server capabilities part one
+    memcpy(mysql_handshake_payload, caps_one, 2);
+    mysql_handshake_payload += 2;
+
+    // write server language
+    *mysql_handshake_payload++ = language;
+
+    //write server status
+    mysql_server_status[0] = 2;
+    mysql_server_status[1] = 0;
+    memcpy(mysql_handshake_payload, mysql_server_status, sizeof(mysql_server_status));
+    mysql_handshake_payload += sizeof(mysql_server_status);
 
+    //write server capabilities part two
+    mysql_server_capabilities_two[0] = (uint8_t)(GW_MYSQL_CAPABILITIES_SERVER >> 16);
+    mysql_server_capabilities_two[1] = (uint8_t)(GW_MYSQL_CAPABILITIES_SERVER >> 24);
+
+    // Check that we match the old values
+    ss_dassert(mysql_server_capabilities_two[0] == 15);
+    /** NOTE: pre-2.1 versions sent the fourth byte of the capabilities as
+     the value 128 even though there's no such capability. */
+
+    memcpy(mysql_handshake_payload, mysql_server_capabilities_two, sizeof(mysql_server_capabilities_two));
+    mysql_handshake_payload += sizeof(mysql_server_capabilities_two);
+
+    // write scramble_len
+    *mysql_handshake_payload++ = mysql_scramble_len;
+
+    //write 10 filler
+    memcpy(mysql_handshake_payload, mysql_filler_ten, sizeof(mysql_filler_ten));
+    mysql_handshake_payload += sizeof(mysql_filler_ten);
+
+    // the plugin data is written for each connection
+    tmpl->plugin_data_offset = mysql_handshake_payload - outbuf;
+    memset(mysql_handshake_payload, 0, 12);
+    mysql_handshake_payload += 12;
+
+    //write last byte, 0
+    *mysql_handshake_payload++ = 0x00;
+
+    // write the name of the authentication plugin
+    memcpy(mysql_handshake_payload, plugin_name, plugin_name_len);
+    mysql_handshake_payload += plugin_name_len;
+
+    //write last byte, 0
     *mysql_handshake_payload = 0x00;
 
-    mysql_handshake_payload++;
+    return true;
+}
 
-    // write thread id
-    memcpy(mysql_handshake_payload, mysql_thread_id_num, sizeof(mysql_thread_id_num));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_thread_id_num);
+/**
+ * @brief Find the initial handshake template of a connection
+ *
+ * The templates are kept per thread so that no locking is needed. If none of
+ * them matches, the least recently created one is replaced.
+ *
+ * @return The template or NULL if memory allocation failed
+ */
+static HANDSHAKE_TEMPLATE* get_handshake_template(const char *version_string, uint8_t language,
+                                                  const uint8_t *caps_one, bool is_maria)
+{
+    size_t len_version_string = strlen(version_string);
 
-    // write scramble buf
-    memcpy(mysql_handshake_payload, mysql_scramble_buf, 8);
-    mysql_handshake_payload = mysql_handshake_payload + 8;
-    *mysql_handshake_payload = GW_MYSQL_HANDSHAKE_FILLER;
-    mysql_handshake_payload++;
+    for (int i = 0; i < HANDSHAKE_TEMPLATES; i++)
+    {
+        HANDSHAKE_TEMPLATE *tmpl = &handshake_templates[i];
 
-    // write server capabilities part one
+        if (tmpl->data && tmpl->language == language && tmpl->is_maria == is_maria &&
+            memcmp(tmpl->capabilities_one, caps_one, sizeof(tmpl->capabilities_one)) == 0 &&
+            tmpl->version_len == len_version_string &&
+            memcmp(tmpl->data + MYSQL_HEADER_LEN + 1, version_string, len_version_string) == 0)
+        {
+            return tmpl;
+        }
+    }
+
+    HANDSHAKE_TEMPLATE *tmpl = &handshake_templates[next_handshake_template];
+    next_handshake_template = (next_handshake_template + 1) % HANDSHAKE_TEMPLATES;
+
+    return create_handshake_template(tmpl, version_string, language, caps_one, is_maria) ? tmpl : NULL;
+}
+
+/**
+ * @brief Free the initial handshake templates of the thread
+ */
+static void free_handshake_templates()
+{
+    for (int i = 0; i < HANDSHAKE_TEMPLATES; i++)
+    {
+        MXS_FREE(handshake_templates[i].data);
+        handshake_templates[i].data = NULL;
+    }
+}
+
+/**
+ * @brief Check whether the clients of a connection may compress the packets
+ *
+ * Compression is enabled in the listener or in the service. The service only
+ * enables it between the clients and MaxScale.
+ *
+ * @param dcb The client DCB
+ * @return True if the compression capability is sent to the client
+ */
+static inline bool client_compression_enabled(DCB *dcb)
+{
+    return (dcb->listener && dcb->listener->compression) ||
+           (dcb->service && dcb->service->client_compression);
+}
+
+/**
+ * MySQLSendHandshake
+ *
+ * The packet is copied from a template of the thread and only the thread ID
+ * and the scramble are written for each connection.
+ *
+ * @param dcb The descriptor control block to use for sending the handshake request
+ * @return      The packet length sent
+ */
+int MySQLSendHandshake(DCB* dcb)
+{
+    uint8_t mysql_thread_id_num[4];
+    uint8_t mysql_server_capabilities_one[2];
+    uint8_t mysql_server_language = 8;
+    char server_scramble[GW_MYSQL_SCRAMBLE_SIZE + 1] = "";
+    const char *version_string;
+    int id_num;
+
+    bool is_maria = false;
+
+    if (dcb->service->dbref)
+    {
+        mysql_server_language = dcb->service->dbref->server->charset;
+
+        if (dcb->service->dbref->server->server_string &&
+            strstr(dcb->service->dbref->server->server_string, "10.2."))
+        {
+            /** The backend servers support the extended capabilities */
+            is_maria = true;
+        }
+    }
+
+    MySQLProtocol *protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
+
+    /* get the version string from service property if available*/
+    if (dcb->service->version_string != NULL)
+    {
+        version_string = dcb->service->version_string;
+    }
+    else
+    {
+        version_string = GW_MYSQL_VERSION;
+    }
+
+    // server capabilities part one
     mysql_server_capabilities_one[0] = (uint8_t)GW_MYSQL_CAPABILITIES_SERVER;
     mysql_server_capabilities_one[1] = (uint8_t)(GW_MYSQL_CAPABILITIES_SERVER >> 8);
 
@@ -357,58 +486,49 @@ int MySQLSendHandshake(DCB* dcb)
         mysql_server_capabilities_one[1] |= (int)GW_MYSQL_CAPABILITIES_SSL >> 8;
     }
 
-    memcpy(mysql_handshake_payload, mysql_server_capabilities_one, sizeof(mysql_server_capabilities_one));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_capabilities_one);
+    if (client_compression_enabled(dcb))
+    {
+        mysql_server_capabilities_one[0] |= (uint8_t)GW_MYSQL_CAPABILITIES_COMPRESS;
+    }
+    else
+    {
+        mysql_server_capabilities_one[0] &= ~(uint8_t)GW_MYSQL_CAPABILITIES_COMPRESS;
+    }
 
-    // write server language
-    memcpy(mysql_handshake_payload, &mysql_server_language, sizeof(mysql_server_language));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_language);
+    HANDSHAKE_TEMPLATE *tmpl = get_handshake_template(version_string, mysql_server_language,
+                                                      mysql_server_capabilities_one, is_maria);
+    GWBUF *buf;
 
-    //write server status
-    mysql_server_status[0] = 2;
-    mysql_server_status[1] = 0;
-    memcpy(mysql_handshake_payload, mysql_server_status, sizeof(mysql_server_status));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_status);
+    if (tmpl == NULL || (buf = gwbuf_alloc_and_load(tmpl->len, tmpl->data)) == NULL)
+    {
+        ss_dassert(false);
+        return 0;
+    }
 
-    //write server capabilities part two
-    mysql_server_capabilities_two[0] = (uint8_t)(GW_MYSQL_CAPABILITIES_SERVER >> 16);
-    mysql_server_capabilities_two[1] = (uint8_t)(GW_MYSQL_CAPABILITIES_SERVER >> 24);
+    gw_generate_random_str(server_scramble, GW_MYSQL_SCRAMBLE_SIZE);
 
-    // Check that we match the old values
-    ss_dassert(mysql_server_capabilities_two[0] == 15);
-    /** NOTE: pre-2.1 versions sent the fourth byte of the capabilities as
-     the value 128 even though there's no such capability. */
+    // copy back to the caller
+    memcpy(protocol->scramble, server_scramble, GW_MYSQL_SCRAMBLE_SIZE);
 
-    memcpy(mysql_handshake_payload, mysql_server_capabilities_two, sizeof(mysql_server_capabilities_two));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_server_capabilities_two);
+    // thread id, now put thePID
+    id_num = getpid() + dcb->fd;
+    gw_mysql_set_byte4(mysql_thread_id_num, id_num);
 
-    // write scramble_len
-    memcpy(mysql_handshake_payload, &mysql_scramble_len, sizeof(mysql_scramble_len));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_scramble_len);
+    uint8_t *outbuf = GWBUF_DATA(buf);
 
-    //write 10 filler
-    memcpy(mysql_handshake_payload, mysql_filler_ten, sizeof(mysql_filler_ten));
-    mysql_handshake_payload = mysql_handshake_payload + sizeof(mysql_filler_ten);
+    // write thread id and scramble buf
+    memcpy(outbuf + tmpl->thread_id_offset, mysql_thread_id_num, sizeof(mysql_thread_id_num));
+    memcpy(outbuf + tmpl->thread_id_offset + sizeof(mysql_thread_id_num), server_scramble, 8);
 
     // write plugin data
-    memcpy(mysql_handshake_payload, mysql_plugin_data, 12);
-    mysql_handshake_payload = mysql_handshake_payload + 12;
+    memcpy(outbuf + tmpl->plugin_data_offset, server_scramble + 8, 12);
 
-    //write last byte, 0
-    *mysql_handshake_payload = 0x00;
-    mysql_handshake_payload++;
-
-    // to be understanded ????
-    memcpy(mysql_handshake_payload, plugin_name, plugin_name_len);
-    mysql_handshake_payload = mysql_handshake_payload + plugin_name_len;
-
-    //write last byte, 0
-    *mysql_handshake_payload = 0x00;
+    int len = tmpl->len;
 
     // writing data in the Client buffer queue
     dcb->func.write(dcb, buf);
 
-    return sizeof(mysql_packet_header) + mysql_payload_size;
+    return len;
 }
 
 /**
@@ -419,7 +539,8 @@ int MySQLSendHandshake(DCB* dcb)
  */
 int gw_MySQLWrite_client(DCB *dcb, GWBUF *queue)
 {
-    return dcb_write(dcb, queue);
+    MXS_SESSION_TRACE(dcb->session, SESSION_TRACE_CLIENT_WRITE, NULL);
+    return mxs_mysql_write(dcb, queue);
 }
 
 /**
@@ -474,7 +595,7 @@ int gw_read_client_event(DCB* dcb)
     {
         max_bytes = 36;
     }
-    return_code = dcb_read(dcb, &read_buffer, max_bytes);
+    return_code = mxs_mysql_read(dcb, &read_buffer, max_bytes);
     if (return_code < 0)
     {
         dcb_close(dcb);
@@ -697,6 +818,17 @@ gw_read_do_authentication(DCB *dcb, GWBUF *read_buffer, int nbytes_read)
             }
         }
 
+        if (dcb->persistkey == NULL)
+        {
+            /** The backend connections are opened with the default database
+             * and the character set of the client, pooled connections that
+             * match them can be reused without changing the user */
+            MYSQL_session *ses = dcb->data;
+            char key[sizeof(ses->db) + 32];
+            snprintf(key, sizeof(key), "db=%s,charset=%u", ses->db, protocol->charset);
+            dcb->persistkey = MXS_STRDUP(key);
+        }
+
         protocol->protocol_auth_state = MXS_AUTH_STATE_RESPONSE_SENT;
         /**
          * Create session, and a router session for it.
@@ -714,6 +846,13 @@ gw_read_do_authentication(DCB *dcb, GWBUF *read_buffer, int nbytes_read)
                        session->state != SESSION_STATE_DUMMY);
             protocol->protocol_auth_state = MXS_AUTH_STATE_COMPLETE;
             mxs_mysql_send_ok(dcb, next_sequence, 0, NULL);
+
+            if (client_compression_enabled(dcb) &&
+                (protocol->client_capabilities & GW_MYSQL_CAPABILITIES_COMPRESS))
+            {
+                /** The packets that follow the OK packet are compressed */
+                protocol->compress = true;
+            }
         }
         else
         {
@@ -921,6 +1060,8 @@ gw_read_normal_data(DCB *dcb, GWBUF *read_buffer, int nbytes_read)
         return 1;
     }
 
+    MXS_SESSION_TRACE(session, SESSION_TRACE_READ, NULL);
+
     /** Ask what type of input the router/filter chain expects */
     capabilities = service_get_capabilities(session->service);
 
@@ -934,8 +1075,9 @@ gw_read_normal_data(DCB *dcb, GWBUF *read_buffer, int nbytes_read)
      * we need to make sure that a complete SQL packet is read before continuing */
     if (rcap_type_required(capabilities, RCAP_TYPE_STMT_INPUT))
     {
-        if (nbytes_read < 3 || nbytes_read <
-            (MYSQL_GET_PAYLOAD_LEN((uint8_t *) GWBUF_DATA(read_buffer)) + 4))
+        if (!stream_continuation(dcb, capabilities) &&
+            (nbytes_read < 3 || nbytes_read <
+             (MYSQL_GET_PAYLOAD_LEN((uint8_t *) GWBUF_DATA(read_buffer)) + 4)))
         {
 
             dcb->dcb_readqueue = read_buffer;
@@ -1462,10 +1604,25 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
         tmpbuf = tmpbuf->next;
     }
 #endif
+    MySQLProtocol *proto = (MySQLProtocol*)session->client_dcb->protocol;
+
     do
     {
         ss_dassert(GWBUF_IS_TYPE_MYSQL((*p_readbuf)));
 
+        if (stream_continuation(session->client_dcb, capabilities))
+        {
+            /** The rest of a large command is routed as it arrives */
+            if ((packetbuf = get_continuation(proto, p_readbuf)) == NULL)
+            {
+                rc = 1;
+                goto return_rc;
+            }
+
+            rc = MXS_SESSION_ROUTE_QUERY(session, packetbuf);
+            continue;
+        }
+
         /**
          * Collect incoming bytes to a buffer until complete packet has
          * arrived and then return the buffer.
@@ -1477,6 +1634,15 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
         {
             CHK_GWBUF(packetbuf);
             ss_dassert(GWBUF_IS_TYPE_MYSQL(packetbuf));
+
+            if (proto->large_query)
+            {
+                /** The packet is a part of the previous command */
+                gwbuf_set_type(packetbuf, GWBUF_TYPE_CONTINUATION);
+            }
+
+            /** A packet with the maximum length is followed by more of the command */
+            proto->large_query = MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(packetbuf)) == GW_MYSQL_MAX_PACKET_LEN;
             /**
              * This means that buffer includes exactly one MySQL
              * statement.
@@ -1491,6 +1657,12 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
              */
             gwbuf_set_type(packetbuf, GWBUF_TYPE_SINGLE_STMT);
 
+            if (*p_readbuf && has_complete_packet(*p_readbuf))
+            {
+                /** The client sent the next statement without waiting for a reply */
+                gwbuf_set_type(packetbuf, GWBUF_TYPE_PIPELINED);
+            }
+
             if (rcap_type_required(capabilities, RCAP_TYPE_CONTIGUOUS_INPUT))
             {
                 if (!GWBUF_IS_CONTIGUOUS(packetbuf))
@@ -1512,7 +1684,8 @@ static int route_by_statement(MXS_SESSION* session, uint64_t capabilities, GWBUF
                     }
                 }
 
-                if (rcap_type_required(capabilities, RCAP_TYPE_TRANSACTION_TRACKING))
+                if (rcap_type_required(capabilities, RCAP_TYPE_TRANSACTION_TRACKING) &&
+                    !GWBUF_IS_TYPE_CONTINUATION(packetbuf))
                 {
                     uint8_t *data = GWBUF_DATA(packetbuf);
 
@@ -1581,6 +1754,96 @@ return_rc:
     return rc;
 }
 
+/**
+ * @brief Check if the data continues a large command that is streamed
+ *
+ * Once the first packet of a command that does not fit in one packet has been
+ * routed, the rest of the command is routed in parts as it is read instead of
+ * collecting each packet completely. This is done only if the router does not
+ * need to see the rest of the command and there are no filters that could.
+ *
+ * @param dcb          Client DCB
+ * @param capabilities The capabilities of the service
+ *
+ * @return True if the data that is read next is a part of a streamed command
+ */
+static bool stream_continuation(DCB *dcb, uint64_t capabilities)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    return proto->large_query &&
+           rcap_type_required(capabilities, RCAP_TYPE_PACKET_STREAMING) &&
+           dcb->session->service->n_filters == 0;
+}
+
+/**
+ * @brief Take the part of a large command that is available
+ *
+ * The data up to the end of the command, or all of it if the command does not
+ * end in it, is taken from @c buffer. The packet headers are followed so that
+ * the end of the command is known.
+ *
+ * @param proto  Client protocol
+ * @param buffer Data read from the client, the rest of the data on return
+ *
+ * @return The part of the command or NULL if only a part of the next packet
+ *         header is available
+ */
+static GWBUF* get_continuation(MySQLProtocol *proto, GWBUF **buffer)
+{
+    size_t len = gwbuf_length(*buffer);
+    size_t offset = 0;
+
+    while (proto->large_query && offset < len)
+    {
+        if (proto->stream_left == 0)
+        {
+            uint8_t header[MYSQL_HEADER_LEN];
+
+            if (gwbuf_copy_data(*buffer, offset, MYSQL_HEADER_LEN, header) != MYSQL_HEADER_LEN)
+            {
+                break;
+            }
+
+            proto->stream_left = MYSQL_GET_PAYLOAD_LEN(header) + MYSQL_HEADER_LEN;
+            proto->stream_last = MYSQL_GET_PAYLOAD_LEN(header) < GW_MYSQL_MAX_PACKET_LEN;
+        }
+
+        size_t n = MXS_MIN(proto->stream_left, len - offset);
+        proto->stream_left -= n;
+        offset += n;
+
+        if (proto->stream_left == 0 && proto->stream_last)
+        {
+            proto->large_query = false;
+        }
+    }
+
+    GWBUF *rval = NULL;
+
+    if (offset > 0)
+    {
+        rval = gwbuf_split(buffer, offset);
+        gwbuf_set_type(rval, GWBUF_TYPE_MYSQL | GWBUF_TYPE_CONTINUATION);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check if a buffer starts with a complete packet
+ *
+ * @param buffer Buffer to check
+ * @return True if the first packet in the buffer is complete
+ */
+static bool has_complete_packet(GWBUF *buffer)
+{
+    uint8_t header[MYSQL_HEADER_LEN];
+
+    return gwbuf_copy_data(buffer, 0, MYSQL_HEADER_LEN, header) == MYSQL_HEADER_LEN &&
+           gwbuf_length(buffer) >= MYSQL_GET_PAYLOAD_LEN(header) + MYSQL_HEADER_LEN;
+}
+
 /**
  * if read queue existed appent read to it. if length of read buffer is less
  * than 3 or less than mysql packet then return.  else copy mysql packets to
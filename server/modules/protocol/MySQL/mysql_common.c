@@ -46,11 +46,18 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/pool.h>
 #include <netinet/tcp.h>
 #include <maxscale/modutil.h>
 
 uint8_t null_client_sha1[MYSQL_SCRAMBLE_LEN] = "";
 
+/** The maximum number of free protocol objects each thread keeps for reuse */
+#define MYSQL_PROTOCOL_POOL_MAX_FREE 512
+
+static MXS_POOL protocol_pool = MXS_POOL_INIT("MySQLProtocol", sizeof(MySQLProtocol),
+                                              MYSQL_PROTOCOL_POOL_MAX_FREE);
+
 static server_command_t* server_command_init(server_command_t* srvcmd, mysql_server_cmd_t cmd);
 
 /**
@@ -89,13 +96,15 @@ MySQLProtocol* mysql_protocol_init(DCB* dcb, int fd)
 {
     MySQLProtocol* p;
 
-    p = (MySQLProtocol *) MXS_CALLOC(1, sizeof(MySQLProtocol));
+    p = (MySQLProtocol *) mxs_pool_calloc(&protocol_pool);
     ss_dassert(p != NULL);
 
     if (p == NULL)
     {
         goto return_p;
     }
+    /** The DCB releases the protocol back to the pool when it is freed */
+    dcb->flags |= DCBF_POOLED_PROTOCOL;
     p->protocol_state = MYSQL_PROTOCOL_ALLOC;
     p->protocol_auth_state = MXS_AUTH_STATE_INIT;
     p->current_command = MYSQL_COM_UNDEFINED;
@@ -103,6 +112,7 @@ MySQLProtocol* mysql_protocol_init(DCB* dcb, int fd)
     p->protocol_command.scom_nresponse_packets = 0;
     p->protocol_command.scom_nbytes_to_read = 0;
     p->stored_query = NULL;
+    p->reply_state = MYSQL_REPLY_STATE_START;
     p->extra_capabilities = 0;
 #if defined(SS_DEBUG)
     p->protocol_chk_top = CHK_NUM_PROTOCOL;
@@ -145,6 +155,8 @@ void mysql_protocol_done(DCB* dcb)
         }
 
         gwbuf_free(p->stored_query);
+        gwbuf_free(p->compress_readqueue);
+        mxs_mysql_ps_cache_clear(p, false);
 
         p->protocol_state = MYSQL_PROTOCOL_DONE;
     }
@@ -1061,9 +1073,23 @@ bool gw_get_shared_session_auth_info(DCB* dcb, MYSQL_session* session)
     return rval;
 }
 
+/** An OK packet with no affected rows, insert ID or warnings and autocommit enabled */
+static const uint8_t ok_packet_template[] =
+{
+    0x07, 0x00, 0x00, // Payload length
+    0x00,             // Sequence number
+    0x00,             // OK header
+    0x00,             // Affected rows
+    0x00,             // Last insert ID
+    0x02, 0x00,       // Server status, autocommit
+    0x00, 0x00        // Warning count
+};
+
 /**
  * @brief Send a MySQL protocol OK message to the dcb (client)
  *
+ * The packet is copied from a template and only the varying fields are written.
+ *
  * @param dcb DCB where packet is written
  * @param sequence Packet sequence number
  * @param affected_rows Number of affected rows
@@ -1073,71 +1099,26 @@ bool gw_get_shared_session_auth_info(DCB* dcb, MYSQL_session* session)
  */
 int mxs_mysql_send_ok(DCB *dcb, int sequence, uint8_t affected_rows, const char* message)
 {
-    uint8_t *outbuf = NULL;
-    uint32_t mysql_payload_size = 0;
-    uint8_t mysql_packet_header[4];
-    uint8_t *mysql_payload = NULL;
-    uint8_t field_count = 0;
-    uint8_t insert_id = 0;
-    uint8_t mysql_server_status[2];
-    uint8_t mysql_warning_counter[2];
-    GWBUF *buf;
-
+    size_t message_len = message ? strlen(message) : 0;
+    GWBUF *buf = gwbuf_alloc(sizeof(ok_packet_template) + message_len);
 
-    mysql_payload_size =
-        sizeof(field_count) +
-        sizeof(affected_rows) +
-        sizeof(insert_id) +
-        sizeof(mysql_server_status) +
-        sizeof(mysql_warning_counter);
-
-    if (message != NULL)
-    {
-        mysql_payload_size += strlen(message);
-    }
-
-    // allocate memory for packet header + payload
-    if ((buf = gwbuf_alloc(sizeof(mysql_packet_header) + mysql_payload_size)) == NULL)
+    if (buf == NULL)
     {
         return 0;
     }
-    outbuf = GWBUF_DATA(buf);
 
-    // write packet header with packet number
-    gw_mysql_set_byte3(mysql_packet_header, mysql_payload_size);
-    mysql_packet_header[3] = sequence;
-
-    // write header
-    memcpy(outbuf, mysql_packet_header, sizeof(mysql_packet_header));
-
-    mysql_payload = outbuf + sizeof(mysql_packet_header);
-
-    mysql_server_status[0] = 2;
-    mysql_server_status[1] = 0;
-    mysql_warning_counter[0] = 0;
-    mysql_warning_counter[1] = 0;
-
-    // write data
-    memcpy(mysql_payload, &field_count, sizeof(field_count));
-    mysql_payload = mysql_payload + sizeof(field_count);
-
-    memcpy(mysql_payload, &affected_rows, sizeof(affected_rows));
-    mysql_payload = mysql_payload + sizeof(affected_rows);
+    uint8_t *outbuf = GWBUF_DATA(buf);
+    memcpy(outbuf, ok_packet_template, sizeof(ok_packet_template));
 
-    memcpy(mysql_payload, &insert_id, sizeof(insert_id));
-    mysql_payload = mysql_payload + sizeof(insert_id);
-
-    memcpy(mysql_payload, mysql_server_status, sizeof(mysql_server_status));
-    mysql_payload = mysql_payload + sizeof(mysql_server_status);
-
-    memcpy(mysql_payload, mysql_warning_counter, sizeof(mysql_warning_counter));
-    mysql_payload = mysql_payload + sizeof(mysql_warning_counter);
-
-    if (message != NULL)
+    if (message)
     {
-        memcpy(mysql_payload, message, strlen(message));
+        memcpy(outbuf + sizeof(ok_packet_template), message, message_len);
     }
 
+    gw_mysql_set_byte3(outbuf, sizeof(ok_packet_template) - MYSQL_HEADER_LEN + message_len);
+    outbuf[3] = sequence;
+    outbuf[MYSQL_HEADER_LEN + 1] = affected_rows;
+
     // writing data in the Client buffer queue
     return dcb->func.write(dcb, buf);
 }
@@ -1253,7 +1234,7 @@ load_hashed_password(uint8_t *scramble, uint8_t *payload, uint8_t *passwd)
  *
  * @param conn  The MySQLProtocol structure for the connection
  * @param db_specified Whether the connection request specified a database
- * @param compress Whether compression is requested - NOT SUPPORTED
+ * @param compress Whether compression is requested
  * @return Bit mask (32 bits)
  * @note Capability bits are defined in maxscale/protocol/mysql.h
  */
@@ -1273,7 +1254,6 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
         /* final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_SSL_VERIFY_SERVER_CERT; */
     }
 
-    /* Compression is not currently supported */
     if (compress)
     {
         final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_COMPRESS;
@@ -1281,6 +1261,10 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
         fprintf(stderr, ">>>> Backend Connection with compression\n");
 #endif
     }
+    else
+    {
+        final_capabilities &= ~(uint32_t)GW_MYSQL_CAPABILITIES_COMPRESS;
+    }
 
     if (db_specified)
     {
@@ -1295,6 +1279,15 @@ create_capabilities(MySQLProtocol *conn, bool db_specified, bool compress)
 
     final_capabilities |= (int)GW_MYSQL_CAPABILITIES_PLUGIN_AUTH;
 
+    if (rcap_type_required(service_get_capabilities(conn->owner_dcb->session->service),
+                           RCAP_TYPE_SESSION_STATE_TRACKING))
+    {
+        /** The router reads the state changes and may prefix the queries
+         * with statements of its own */
+        final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_SESSION_TRACK;
+        final_capabilities |= (uint32_t)GW_MYSQL_CAPABILITIES_MULTI_STATEMENTS;
+    }
+
     return final_capabilities;
 }
 
@@ -1326,7 +1319,9 @@ mxs_auth_state_t gw_send_backend_auth(DCB *dcb)
     }
 
     MySQLProtocol *conn = (MySQLProtocol*)dcb->protocol;
-    uint32_t capabilities = create_capabilities(conn, (local_session.db && strlen(local_session.db)), false);
+    bool compress = dcb->server->compression &&
+                    (conn->server_capabilities & GW_MYSQL_CAPABILITIES_COMPRESS);
+    uint32_t capabilities = create_capabilities(conn, (local_session.db && strlen(local_session.db)), compress);
     gw_mysql_set_byte4(client_capabilities, capabilities);
 
     /**
@@ -1407,6 +1402,9 @@ mxs_auth_state_t gw_send_backend_auth(DCB *dcb)
 
     memcpy(payload, auth_plugin_name, strlen(auth_plugin_name));
 
+    /** The packets that are exchanged after the authentication are compressed */
+    conn->compress = compress;
+
     return dcb_write(dcb, buffer) ? MXS_AUTH_STATE_RESPONSE_SENT : MXS_AUTH_STATE_FAILED;
 }
 
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mysql_compress.c Compressed MySQL protocol
+ *
+ * When both ends of a connection set the CLIENT_COMPRESS capability, all
+ * packets after the authentication are sent inside compressed packets. A
+ * compressed packet has a seven byte header: the length of the payload, a
+ * sequence number and the length of the payload after decompression. If the
+ * last one is zero, the payload is sent as-is. Otherwise the payload is a zlib
+ * stream. The payload contains any number of packets or parts of packets.
+ *
+ * The sequence number of the compressed packets starts at zero with each
+ * command and it is incremented for every compressed packet regardless of the
+ * direction, the same way the sequence number of the normal packets is.
+ *
+ * The packets to the clients are compressed with the compression level and
+ * threshold of the service and counted in the statistics of the service. The
+ * packets to the servers use the zlib defaults.
+ */
+
+#include <maxscale/protocol/mysql.h>
+#include <string.h>
+#include <zlib.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/platform.h>
+#include <maxscale/service.h>
+#include <maxscale/statistics.h>
+#include <maxscale/utils.h>
+
+/** The zlib streams of a thread, reused for all packets */
+typedef struct mysql_compress_ctx
+{
+    z_stream deflate;
+    z_stream inflate;
+    bool     deflate_ok;
+    bool     inflate_ok;
+    int      deflate_level; /**< The compression level of the deflate stream */
+} MYSQL_COMPRESS_CTX;
+
+static thread_local MYSQL_COMPRESS_CTX compress_ctx;
+
+static z_stream* get_deflate_stream(int level)
+{
+    z_stream *strm = &compress_ctx.deflate;
+
+    if (compress_ctx.deflate_ok)
+    {
+        deflateReset(strm);
+
+        /** Nothing has been compressed after the reset, so the change takes effect at once */
+        if (compress_ctx.deflate_level != level && deflateParams(strm, level, Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            compress_ctx.deflate_level = level;
+        }
+    }
+    else
+    {
+        memset(strm, 0, sizeof(*strm));
+
+        if (deflateInit(strm, level) != Z_OK)
+        {
+            MXS_ERROR("Failed to initialize compression: %s", strm->msg ? strm->msg : "");
+            return NULL;
+        }
+
+        compress_ctx.deflate_ok = true;
+        compress_ctx.deflate_level = level;
+    }
+
+    return strm;
+}
+
+static z_stream* get_inflate_stream()
+{
+    z_stream *strm = &compress_ctx.inflate;
+
+    if (compress_ctx.inflate_ok)
+    {
+        inflateReset(strm);
+    }
+    else
+    {
+        memset(strm, 0, sizeof(*strm));
+
+        if (inflateInit(strm) != Z_OK)
+        {
+            MXS_ERROR("Failed to initialize decompression: %s", strm->msg ? strm->msg : "");
+            return NULL;
+        }
+
+        compress_ctx.inflate_ok = true;
+    }
+
+    return strm;
+}
+
+void mxs_mysql_compress_thread_finish(void)
+{
+    if (compress_ctx.deflate_ok)
+    {
+        deflateEnd(&compress_ctx.deflate);
+        compress_ctx.deflate_ok = false;
+    }
+
+    if (compress_ctx.inflate_ok)
+    {
+        inflateEnd(&compress_ctx.inflate);
+        compress_ctx.inflate_ok = false;
+    }
+}
+
+static inline void set_compressed_header(uint8_t *header, uint32_t len, uint8_t seq, uint32_t plain_len)
+{
+    gw_mysql_set_byte3(header, len);
+    header[3] = seq;
+    gw_mysql_set_byte3(header + 4, plain_len);
+}
+
+/**
+ * @brief Create one compressed packet
+ *
+ * The payload is sent as-is if it is shorter than the threshold or if it
+ * does not get shorter when compressed.
+ *
+ * @param seq       Sequence number of the compressed packet
+ * @param payload   The payload, at most GW_MYSQL_MAX_PACKET_LEN bytes, freed by the function
+ * @param level     The zlib compression level
+ * @param threshold The length of the shortest payload that is compressed
+ *
+ * @return The compressed packet or NULL if memory allocation failed
+ */
+static GWBUF* create_compressed_packet(uint8_t seq, GWBUF *payload, int level, size_t threshold)
+{
+    size_t len = gwbuf_length(payload);
+    z_stream *strm;
+
+    if (len >= threshold && (strm = get_deflate_stream(level)))
+    {
+        uLong bound = deflateBound(strm, len);
+        GWBUF *rval = gwbuf_alloc(MYSQL_COMPRESSED_HEADER_LEN + bound);
+
+        if (rval)
+        {
+            int rc = Z_OK;
+            strm->next_out = (Bytef*)GWBUF_DATA(rval) + MYSQL_COMPRESSED_HEADER_LEN;
+            strm->avail_out = bound;
+
+            for (GWBUF *buf = payload; buf && rc == Z_OK; buf = buf->next)
+            {
+                if (GWBUF_LENGTH(buf) > 0 || buf->next == NULL)
+                {
+                    strm->next_in = (Bytef*)GWBUF_DATA(buf);
+                    strm->avail_in = GWBUF_LENGTH(buf);
+                    rc = deflate(strm, buf->next ? Z_NO_FLUSH : Z_FINISH);
+                }
+            }
+
+            size_t compressed_len = bound - strm->avail_out;
+
+            if (rc == Z_STREAM_END && compressed_len < len)
+            {
+                rval = gwbuf_rtrim(rval, strm->avail_out);
+                set_compressed_header(GWBUF_DATA(rval), compressed_len, seq, len);
+                gwbuf_free(payload);
+                return rval;
+            }
+
+            gwbuf_free(rval);
+        }
+    }
+
+    GWBUF *header = gwbuf_alloc(MYSQL_COMPRESSED_HEADER_LEN);
+
+    if (header == NULL)
+    {
+        gwbuf_free(payload);
+        return NULL;
+    }
+
+    set_compressed_header(GWBUF_DATA(header), len, seq, 0);
+    return gwbuf_append(header, payload);
+}
+
+/**
+ * @brief Find the length of the data that belongs to one command
+ *
+ * Only used for connections to the servers. Each command that is written
+ * starts a new sequence of compressed packets. A command is recognized by the
+ * sequence number zero of its first packet. The packets of a write may
+ * continue the packet of the previous write.
+ *
+ * @param proto    Backend protocol
+ * @param queue    Data being written
+ * @param is_start Set to true if @c queue starts with a new command
+ *
+ * @return Number of bytes before the next command in @c queue
+ */
+static size_t command_length(MySQLProtocol *proto, GWBUF *queue, bool *is_start)
+{
+    size_t len = gwbuf_length(queue);
+    size_t offset = 0;
+    *is_start = false;
+
+    while (offset < len)
+    {
+        if (proto->compress_left == 0)
+        {
+            uint8_t header[MYSQL_HEADER_LEN];
+
+            if (gwbuf_copy_data(queue, offset, MYSQL_HEADER_LEN, header) < MYSQL_HEADER_LEN)
+            {
+                /** The header continues in the next write. This only affects
+                 * the sequence numbers of the compressed packets. */
+                break;
+            }
+
+            if (MYSQL_GET_PACKET_NO(header) == 0)
+            {
+                if (offset > 0)
+                {
+                    return offset;
+                }
+
+                *is_start = true;
+            }
+
+            proto->compress_left = MYSQL_HEADER_LEN + MYSQL_GET_PAYLOAD_LEN(header);
+        }
+
+        size_t n = MXS_MIN(proto->compress_left, len - offset);
+        proto->compress_left -= n;
+        offset += n;
+    }
+
+    return len;
+}
+
+int mxs_mysql_write(DCB *dcb, GWBUF *queue)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    if (!proto->compress || queue == NULL)
+    {
+        return dcb_write(dcb, queue);
+    }
+
+    size_t plain_len = gwbuf_length(queue);
+    GWBUF *output = NULL;
+    SERVICE *service = dcb->dcb_role == DCB_ROLE_CLIENT_HANDLER ? dcb->service : NULL;
+    int level = service ? service->client_compression_level : Z_DEFAULT_COMPRESSION;
+    size_t threshold = service ? service->client_compression_threshold : MYSQL_COMPRESS_MIN_LEN;
+
+    while (queue)
+    {
+        bool is_start = false;
+        size_t len = dcb->dcb_role == DCB_ROLE_BACKEND_HANDLER ?
+                     command_length(proto, queue, &is_start) : gwbuf_length(queue);
+
+        if (len == 0)
+        {
+            gwbuf_free(queue);
+            break;
+        }
+
+        if (is_start)
+        {
+            proto->compress_seq = 0;
+        }
+
+        GWBUF *command = gwbuf_split(&queue, len);
+
+        while (command)
+        {
+            GWBUF *payload = gwbuf_split(&command, MXS_MIN(gwbuf_length(command),
+                                                           GW_MYSQL_MAX_PACKET_LEN));
+            GWBUF *packet = create_compressed_packet(proto->compress_seq++, payload, level, threshold);
+
+            if (packet == NULL)
+            {
+                gwbuf_free(command);
+                gwbuf_free(queue);
+                gwbuf_free(output);
+                return 0;
+            }
+
+            output = gwbuf_append(output, packet);
+        }
+    }
+
+    size_t compressed_len = gwbuf_length(output);
+    dcb->stats.n_plain_out += plain_len;
+    dcb->stats.n_compressed_out += compressed_len;
+
+    if (service)
+    {
+        ts_stats_add(service->stats.n_plain_out, plain_len);
+        ts_stats_add(service->stats.n_compressed_out, compressed_len);
+    }
+
+    return dcb_write(dcb, output);
+}
+
+/**
+ * @brief Decompress the payload of a compressed packet
+ *
+ * @param payload   The zlib stream, freed by the function
+ * @param plain_len Length of the payload after decompression
+ *
+ * @return The decompressed data or NULL if the payload is not valid
+ */
+static GWBUF* decompress_payload(GWBUF *payload, size_t plain_len)
+{
+    z_stream *strm = get_inflate_stream();
+    GWBUF *rval = strm ? gwbuf_alloc(plain_len) : NULL;
+
+    if (rval)
+    {
+        int rc = Z_OK;
+        strm->next_out = (Bytef*)GWBUF_DATA(rval);
+        strm->avail_out = plain_len;
+
+        for (GWBUF *buf = payload; buf && rc == Z_OK; buf = buf->next)
+        {
+            if (GWBUF_LENGTH(buf) > 0)
+            {
+                strm->next_in = (Bytef*)GWBUF_DATA(buf);
+                strm->avail_in = GWBUF_LENGTH(buf);
+                rc = inflate(strm, Z_NO_FLUSH);
+            }
+        }
+
+        if (rc != Z_STREAM_END || strm->avail_out != 0 || strm->avail_in != 0)
+        {
+            MXS_ERROR("Failed to decompress a packet: %s",
+                      rc == Z_STREAM_END ? "Wrong length" : strm->msg ? strm->msg : "Truncated data");
+            gwbuf_free(rval);
+            rval = NULL;
+        }
+    }
+
+    gwbuf_free(payload);
+    return rval;
+}
+
+int mxs_mysql_read(DCB *dcb, GWBUF **head, int maxbytes)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    if (!proto->compress)
+    {
+        return dcb_read(dcb, head, maxbytes);
+    }
+
+    /** The read queues contain decompressed data that was not yet processed,
+     * the compressed data is stored in the protocol */
+    GWBUF *plain = dcb->dcb_readqueue;
+    plain = gwbuf_append(plain, dcb->dcb_fakequeue);
+    dcb->dcb_readqueue = NULL;
+    dcb->dcb_fakequeue = NULL;
+
+    GWBUF *raw = proto->compress_readqueue;
+    proto->compress_readqueue = NULL;
+
+    int rc = dcb_read(dcb, &raw, maxbytes);
+
+    if (rc < 0)
+    {
+        proto->compress_readqueue = raw;
+        dcb->dcb_readqueue = plain;
+        return rc;
+    }
+
+    size_t raw_len = gwbuf_length(raw);
+
+    while (raw_len >= MYSQL_COMPRESSED_HEADER_LEN)
+    {
+        uint8_t header[MYSQL_COMPRESSED_HEADER_LEN];
+        gwbuf_copy_data(raw, 0, MYSQL_COMPRESSED_HEADER_LEN, header);
+        size_t len = gw_mysql_get_byte3(header);
+        size_t plain_len = gw_mysql_get_byte3(header + 4);
+
+        if (raw_len < MYSQL_COMPRESSED_HEADER_LEN + len)
+        {
+            break;
+        }
+
+        raw = gwbuf_consume(raw, MYSQL_COMPRESSED_HEADER_LEN);
+        raw_len -= MYSQL_COMPRESSED_HEADER_LEN + len;
+
+        if (len > 0)
+        {
+            GWBUF *payload = gwbuf_split(&raw, len);
+
+            if (plain_len > 0 && (payload = decompress_payload(payload, plain_len)) == NULL)
+            {
+                gwbuf_free(raw);
+                dcb->dcb_readqueue = plain;
+                return -1;
+            }
+
+            dcb->stats.n_plain_in += gwbuf_length(payload);
+            plain = gwbuf_append(plain, payload);
+        }
+
+        dcb->stats.n_compressed_in += MYSQL_COMPRESSED_HEADER_LEN + len;
+        proto->compress_seq = header[3] + 1;
+    }
+
+    proto->compress_readqueue = raw;
+    *head = gwbuf_append(*head, plain);
+
+    return rc;
+}
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mysql_loopback.c A fake backend for measuring the overhead of MaxScale
+ *
+ * The connections to a server with fake_backend=true are socket pairs. The
+ * other end of each pair is served by a thread of the fake backend that
+ * answers with canned replies as soon as a packet arrives: the authentication
+ * with an OK packet, a SELECT or a SHOW with a result set of one row and most
+ * other commands with an OK packet. Prepared statements are not supported.
+ * Everything MaxScale does, from the client protocol to the routers, filters
+ * and the backend protocol, is done as with a real server but without the
+ * latency of the network or the database.
+ *
+ * The fake backend has as many threads as MaxScale has worker threads and the
+ * connections are spread over them round robin.
+ */
+
+#include <maxscale/protocol/mysql.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/config.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/thread.h>
+
+/** The maximum number of events handled by one call to epoll_wait */
+#define LOOPBACK_MAX_EVENTS 64
+
+/** Error number of ER_NOT_SUPPORTED_YET */
+#define LOOPBACK_ERR_NOT_SUPPORTED 1235
+
+/** The status of the fake server, autocommit is on */
+#define LOOPBACK_SERVER_STATUS 0x0002
+
+/** Character set of the column definitions, utf8_general_ci */
+#define LOOPBACK_CHARSET 0x21
+
+typedef struct loopback_conn
+{
+    int      fd;
+    bool     authenticated; /**< The handshake response was answered */
+    bool     continued;     /**< The next packet continues a packet of 16MB */
+    uint8_t  *in;           /**< Data that does not form a complete packet yet */
+    size_t   in_len;
+    size_t   in_size;
+    uint8_t  *out;          /**< Replies that the socket did not accept yet */
+    size_t   out_len;
+    size_t   out_size;
+} LOOPBACK_CONN;
+
+static int *loopback_epoll_fds;
+static int n_loopback_threads;
+static int next_loopback_thread;
+static pthread_once_t loopback_once = PTHREAD_ONCE_INIT;
+
+static bool buffer_reserve(uint8_t **buf, size_t *size, size_t needed)
+{
+    if (needed > *size)
+    {
+        size_t new_size = *size ? *size : 1024;
+
+        while (new_size < needed)
+        {
+            new_size *= 2;
+        }
+
+        uint8_t *tmp = MXS_REALLOC(*buf, new_size);
+
+        if (tmp == NULL)
+        {
+            return false;
+        }
+
+        *buf = tmp;
+        *size = new_size;
+    }
+
+    return true;
+}
+
+static void append_packet(LOOPBACK_CONN *conn, uint8_t seq, const uint8_t *payload, size_t len)
+{
+    if (buffer_reserve(&conn->out, &conn->out_size, conn->out_len + MYSQL_HEADER_LEN + len))
+    {
+        uint8_t *ptr = conn->out + conn->out_len;
+        gw_mysql_set_byte3(ptr, len);
+        ptr[3] = seq;
+        memcpy(ptr + MYSQL_HEADER_LEN, payload, len);
+        conn->out_len += MYSQL_HEADER_LEN + len;
+    }
+}
+
+static void append_handshake(LOOPBACK_CONN *conn)
+{
+    const char version[] = "10.1.99-fake-backend";
+    const char plugin[] = "mysql_native_password";
+    uint32_t caps = GW_MYSQL_CAPABILITIES_SERVER & ~GW_MYSQL_CAPABILITIES_COMPRESS;
+    uint8_t payload[128];
+    uint8_t *ptr = payload;
+
+    *ptr++ = GW_MYSQL_PROTOCOL_VERSION;
+    memcpy(ptr, version, sizeof(version));
+    ptr += sizeof(version);
+    gw_mysql_set_byte4(ptr, conn->fd);
+    ptr += 4;
+    memset(ptr, 'a', 8);
+    ptr += 8;
+    *ptr++ = 0;
+    gw_mysql_set_byte2(ptr, caps & 0xffff);
+    ptr += 2;
+    *ptr++ = LOOPBACK_CHARSET;
+    gw_mysql_set_byte2(ptr, LOOPBACK_SERVER_STATUS);
+    ptr += 2;
+    gw_mysql_set_byte2(ptr, caps >> 16);
+    ptr += 2;
+    *ptr++ = GW_MYSQL_SCRAMBLE_SIZE + 1;
+    memset(ptr, 0, 10);
+    ptr += 10;
+    memset(ptr, 'b', GW_MYSQL_SCRAMBLE_SIZE - 8);
+    ptr += GW_MYSQL_SCRAMBLE_SIZE - 8;
+    *ptr++ = 0;
+    memcpy(ptr, plugin, sizeof(plugin));
+    ptr += sizeof(plugin);
+
+    append_packet(conn, 0, payload, ptr - payload);
+}
+
+static void append_ok(LOOPBACK_CONN *conn, uint8_t seq)
+{
+    uint8_t payload[] = {MYSQL_REPLY_OK, 0, 0, LOOPBACK_SERVER_STATUS, 0, 0, 0};
+    append_packet(conn, seq, payload, sizeof(payload));
+}
+
+static void append_eof(LOOPBACK_CONN *conn, uint8_t seq)
+{
+    uint8_t payload[] = {MYSQL_REPLY_EOF, 0, 0, LOOPBACK_SERVER_STATUS, 0};
+    append_packet(conn, seq, payload, sizeof(payload));
+}
+
+static void append_error(LOOPBACK_CONN *conn, uint8_t seq, const char *msg)
+{
+    size_t len = strlen(msg);
+    uint8_t payload[9 + len];
+
+    payload[0] = MYSQL_REPLY_ERR;
+    gw_mysql_set_byte2(payload + 1, LOOPBACK_ERR_NOT_SUPPORTED);
+    memcpy(payload + 3, "#42000", 6);
+    memcpy(payload + 9, msg, len);
+    append_packet(conn, seq, payload, sizeof(payload));
+}
+
+/** A result set with one column named "1" and one row with the value 1 */
+static void append_result_set(LOOPBACK_CONN *conn, uint8_t seq)
+{
+    uint8_t count[] = {1};
+    uint8_t column[] =
+    {
+        3, 'd', 'e', 'f',         /**< Catalog */
+        0, 0, 0,                  /**< Schema, table and original table */
+        1, '1',                   /**< Name */
+        0,                        /**< Original name */
+        0x0c,                     /**< Length of the fixed fields */
+        LOOPBACK_CHARSET, 0,
+        1, 0, 0, 0,               /**< Column length */
+        0xfd,                     /**< MYSQL_TYPE_VAR_STRING */
+        0, 0,                     /**< Flags */
+        0,                        /**< Decimals */
+        0, 0                      /**< Filler */
+    };
+    uint8_t row[] = {1, '1'};
+
+    append_packet(conn, seq++, count, sizeof(count));
+    append_packet(conn, seq++, column, sizeof(column));
+    append_eof(conn, seq++);
+    append_packet(conn, seq++, row, sizeof(row));
+    append_eof(conn, seq);
+}
+
+static bool is_read(const uint8_t *sql, size_t len)
+{
+    while (len > 0 && isspace(*sql))
+    {
+        sql++;
+        len--;
+    }
+
+    return (len >= 6 && strncasecmp((const char*)sql, "select", 6) == 0) ||
+           (len >= 4 && strncasecmp((const char*)sql, "show", 4) == 0);
+}
+
+/** Answer one packet from MaxScale */
+static void handle_packet(LOOPBACK_CONN *conn, uint8_t seq, const uint8_t *payload, size_t len)
+{
+    if (!conn->authenticated)
+    {
+        /** The password is not checked */
+        conn->authenticated = true;
+        append_ok(conn, seq + 1);
+        return;
+    }
+
+    switch (len > 0 ? payload[0] : MYSQL_COM_SLEEP)
+    {
+    case MYSQL_COM_QUIT:
+    case MYSQL_COM_STMT_CLOSE:
+    case MYSQL_COM_STMT_SEND_LONG_DATA:
+        /** These have no reply */
+        break;
+
+    case MYSQL_COM_QUERY:
+        if (is_read(payload + 1, len - 1))
+        {
+            append_result_set(conn, seq + 1);
+        }
+        else
+        {
+            append_ok(conn, seq + 1);
+        }
+        break;
+
+    case MYSQL_COM_FIELD_LIST:
+        append_eof(conn, seq + 1);
+        break;
+
+    case MYSQL_COM_STMT_PREPARE:
+    case MYSQL_COM_STMT_EXECUTE:
+    case MYSQL_COM_STMT_FETCH:
+        append_error(conn, seq + 1, "Prepared statements are not supported by the fake backend");
+        break;
+
+    default:
+        append_ok(conn, seq + 1);
+        break;
+    }
+}
+
+static void handle_input(LOOPBACK_CONN *conn)
+{
+    size_t offset = 0;
+
+    while (conn->in_len - offset >= MYSQL_HEADER_LEN)
+    {
+        uint8_t *ptr = conn->in + offset;
+        size_t len = gw_mysql_get_byte3(ptr);
+
+        if (conn->in_len - offset < MYSQL_HEADER_LEN + len)
+        {
+            break;
+        }
+
+        if (!conn->continued)
+        {
+            handle_packet(conn, ptr[3], ptr + MYSQL_HEADER_LEN, len);
+        }
+
+        conn->continued = len == GW_MYSQL_MAX_PACKET_LEN;
+        offset += MYSQL_HEADER_LEN + len;
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+}
+
+/**
+ * Write the pending replies
+ *
+ * @return False if the connection was closed
+ */
+static bool flush_output(LOOPBACK_CONN *conn)
+{
+    size_t offset = 0;
+
+    while (offset < conn->out_len)
+    {
+        ssize_t n = write(conn->fd, conn->out + offset, conn->out_len - offset);
+
+        if (n <= 0)
+        {
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+
+            return false;
+        }
+
+        offset += n;
+    }
+
+    memmove(conn->out, conn->out + offset, conn->out_len - offset);
+    conn->out_len -= offset;
+
+    return true;
+}
+
+/**
+ * Read and answer the packets from MaxScale
+ *
+ * @return False if the connection was closed
+ */
+static bool read_input(LOOPBACK_CONN *conn)
+{
+    while (buffer_reserve(&conn->in, &conn->in_size, conn->in_len + 16 * 1024))
+    {
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len);
+
+        if (n <= 0)
+        {
+            return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+
+        conn->in_len += n;
+        handle_input(conn);
+    }
+
+    return false;
+}
+
+static void close_conn(int epoll_fd, LOOPBACK_CONN *conn)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    MXS_FREE(conn->in);
+    MXS_FREE(conn->out);
+    MXS_FREE(conn);
+}
+
+static void loopback_main(void *arg)
+{
+    int epoll_fd = (intptr_t)arg;
+    struct epoll_event events[LOOPBACK_MAX_EVENTS];
+
+    while (true)
+    {
+        int n = epoll_wait(epoll_fd, events, LOOPBACK_MAX_EVENTS, -1);
+
+        for (int i = 0; i < n; i++)
+        {
+            LOOPBACK_CONN *conn = (LOOPBACK_CONN*)events[i].data.ptr;
+            bool ok = !(events[i].events & (EPOLLERR | EPOLLHUP)) || (events[i].events & EPOLLIN);
+
+            if (ok && (events[i].events & EPOLLIN))
+            {
+                ok = read_input(conn);
+            }
+
+            if (ok)
+            {
+                bool pending = conn->out_len > 0;
+                ok = flush_output(conn);
+
+                if (ok && pending != (conn->out_len > 0))
+                {
+                    /** Wait for room in the socket only while there are replies to write */
+                    struct epoll_event ev = {.events = EPOLLIN | (conn->out_len ? EPOLLOUT : 0),
+                                             .data.ptr = conn};
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+                }
+            }
+
+            if (!ok)
+            {
+                close_conn(epoll_fd, conn);
+            }
+        }
+    }
+}
+
+static void loopback_init()
+{
+    int n = config_threadcount();
+
+    if ((loopback_epoll_fds = MXS_CALLOC(n, sizeof(int))))
+    {
+        for (int i = 0; i < n; i++)
+        {
+            THREAD thr;
+            int fd = epoll_create(LOOPBACK_MAX_EVENTS);
+
+            if (fd == -1 || thread_start(&thr, loopback_main, (void*)(intptr_t)fd) == NULL)
+            {
+                MXS_ERROR("Failed to start a thread of the fake backend: %d, %s",
+                          errno, mxs_strerror(errno));
+
+                if (fd != -1)
+                {
+                    close(fd);
+                }
+                break;
+            }
+
+            loopback_epoll_fds[n_loopback_threads++] = fd;
+        }
+
+        MXS_NOTICE("Started the fake backend with %d threads.", n_loopback_threads);
+    }
+}
+
+int mxs_mysql_loopback_connect(void)
+{
+    pthread_once(&loopback_once, loopback_init);
+
+    if (n_loopback_threads == 0)
+    {
+        return -1;
+    }
+
+    int fds[2];
+    LOOPBACK_CONN *conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+        MXS_ERROR("Failed to connect to the fake backend: %d, %s", errno, mxs_strerror(errno));
+        return -1;
+    }
+
+    if ((conn = MXS_CALLOC(1, sizeof(LOOPBACK_CONN))) == NULL)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    conn->fd = fds[1];
+    append_handshake(conn);
+
+    /** The connection is not seen by the thread before it is added */
+    int epoll_fd = loopback_epoll_fds[atomic_add(&next_loopback_thread, 1) % n_loopback_threads];
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+
+    if (!flush_output(conn) ||
+        (conn->out_len && (ev.events |= EPOLLOUT) == 0) ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) != 0)
+    {
+        MXS_ERROR("Failed to connect to the fake backend: %d, %s", errno, mxs_strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        MXS_FREE(conn->out);
+        MXS_FREE(conn);
+        return -1;
+    }
+
+    return fds[0];
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file mysql_ps_cache.c Prepared statements kept open on server connections
+ *
+ * Applications that use connection pools or short sessions prepare the same
+ * statements over and over again. When a server has ps_cache_size set, the
+ * statements that the clients close are left open on the server connections
+ * and the next COM_STMT_PREPARE of the same SQL on the same connection is
+ * answered with the reply the server gave the first time. The connection
+ * keeps its statements when it is moved to the persistent pool and reused
+ * as-is by the next session.
+ *
+ * A statement is used by one client at a time. The connection forgets its
+ * statements when the server closes them or when the default database
+ * changes, as the tables of a statement are resolved when it is prepared.
+ */
+
+#include <maxscale/protocol/mysql.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+
+/** Length of the OK packet that starts the reply to a COM_STMT_PREPARE */
+#define PS_PREPARE_OK_LEN (MYSQL_HEADER_LEN + 12)
+
+/** Offset of the statement ID in the binary protocol commands and the reply */
+#define PS_ID_OFFSET (MYSQL_HEADER_LEN + 1)
+
+/** Length of a COM_STMT_CLOSE */
+#define PS_CLOSE_LEN (MYSQL_HEADER_LEN + 5)
+
+static long ps_cache_size(DCB *dcb)
+{
+    return dcb->server ? dcb->server->ps_cache_size : 0;
+}
+
+/**
+ * @brief Copy the SQL of a COM_STMT_PREPARE
+ *
+ * @param prepare The COM_STMT_PREPARE
+ * @param len     Set to the length of the SQL
+ *
+ * @return The SQL, not null terminated, or NULL on error
+ */
+static char* get_sql(GWBUF *prepare, size_t *len)
+{
+    size_t buflen = gwbuf_length(prepare);
+    char *sql = NULL;
+
+    if (buflen > MYSQL_HEADER_LEN + 1)
+    {
+        *len = buflen - MYSQL_HEADER_LEN - 1;
+
+        if ((sql = MXS_MALLOC(*len)))
+        {
+            gwbuf_copy_data(prepare, MYSQL_HEADER_LEN + 1, *len, (uint8_t*)sql);
+        }
+    }
+
+    return sql;
+}
+
+static mysql_ps_cache_entry_t* find_sql(MySQLProtocol *proto, const char *sql, size_t len)
+{
+    for (mysql_ps_cache_entry_t *e = proto->ps_cache; e; e = e->next)
+    {
+        if (e->len == len && memcmp(e->sql, sql, len) == 0)
+        {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void free_entry(mysql_ps_cache_entry_t *entry)
+{
+    MXS_FREE(entry->sql);
+    gwbuf_free(entry->reply);
+    MXS_FREE(entry);
+}
+
+/**
+ * @brief Close a statement on the server
+ *
+ * A COM_STMT_CLOSE has no reply, it does not affect the replies that are
+ * expected from the server.
+ */
+static void close_statement(DCB *dcb, uint32_t id)
+{
+    GWBUF *buf = gwbuf_alloc(PS_CLOSE_LEN);
+
+    if (buf)
+    {
+        uint8_t *data = GWBUF_DATA(buf);
+        gw_mysql_set_byte3(data, PS_CLOSE_LEN - MYSQL_HEADER_LEN);
+        data[3] = 0;
+        data[4] = MYSQL_COM_STMT_CLOSE;
+        gw_mysql_set_byte4(data + PS_ID_OFFSET, id);
+        mxs_mysql_write(dcb, buf);
+    }
+}
+
+/**
+ * @brief Remove the oldest statement that is not in use
+ *
+ * @return True if a statement was removed
+ */
+static bool evict_statement(DCB *dcb, MySQLProtocol *proto)
+{
+    for (mysql_ps_cache_entry_t **prev = &proto->ps_cache; *prev; prev = &(*prev)->next)
+    {
+        mysql_ps_cache_entry_t *e = *prev;
+
+        if (!e->in_use)
+        {
+            *prev = e->next;
+            close_statement(dcb, e->id);
+            free_entry(e);
+            proto->ps_cache_count--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+GWBUF* mxs_mysql_ps_cache_get(DCB *dcb, GWBUF *prepare)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    GWBUF *rval = NULL;
+    size_t len;
+    char *sql;
+
+    if (proto->ps_cache && (sql = get_sql(prepare, &len)))
+    {
+        mysql_ps_cache_entry_t *entry = find_sql(proto, sql, len);
+
+        if (entry && !entry->in_use && (rval = gwbuf_clone(entry->reply)))
+        {
+            entry->in_use = true;
+            proto->ps_last_id = entry->id;
+            proto->ps_last_cached = true;
+            ts_stats_add(dcb->server->stats.n_ps_cache_hits, 1);
+            MXS_DEBUG("Statement %u prepared again on server '%s'.",
+                      entry->id, dcb->server->unique_name);
+        }
+
+        MXS_FREE(sql);
+    }
+
+    return rval;
+}
+
+void mxs_mysql_ps_cache_expect(DCB *dcb, GWBUF *prepare)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    proto->ps_last_cached = false;
+    gwbuf_free(proto->ps_pending);
+    proto->ps_pending = ps_cache_size(dcb) > 0 ? gwbuf_clone(prepare) : NULL;
+}
+
+void mxs_mysql_ps_cache_store(DCB *dcb, GWBUF *reply)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+    GWBUF *prepare = proto->ps_pending;
+    proto->ps_pending = NULL;
+
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+    size_t len;
+    char *sql;
+
+    if (prepare == NULL ||
+        gwbuf_copy_data(reply, 0, sizeof(header), header) != sizeof(header) ||
+        MYSQL_GET_PAYLOAD_LEN(header) + MYSQL_HEADER_LEN != PS_PREPARE_OK_LEN ||
+        header[MYSQL_HEADER_LEN] != MYSQL_REPLY_OK ||
+        (sql = get_sql(prepare, &len)) == NULL)
+    {
+        gwbuf_free(prepare);
+        return;
+    }
+
+    gwbuf_free(prepare);
+
+    if (find_sql(proto, sql, len) ||
+        (proto->ps_cache_count >= ps_cache_size(dcb) && !evict_statement(dcb, proto)))
+    {
+        /** The statement is closed on the server when the client closes it */
+        MXS_FREE(sql);
+        return;
+    }
+
+    mysql_ps_cache_entry_t *entry = MXS_MALLOC(sizeof(*entry));
+    size_t reply_len = gwbuf_length(reply);
+    GWBUF *copy = gwbuf_alloc(reply_len);
+
+    if (entry && copy)
+    {
+        /** The replies are modified by the routers, the entry has its own copy */
+        gwbuf_copy_data(reply, 0, reply_len, GWBUF_DATA(copy));
+        entry->sql = sql;
+        entry->len = len;
+        entry->id = gw_mysql_get_byte4(GWBUF_DATA(copy) + PS_ID_OFFSET);
+        entry->reply = copy;
+        entry->in_use = true;
+        entry->next = NULL;
+
+        mysql_ps_cache_entry_t **last = &proto->ps_cache;
+
+        while (*last)
+        {
+            last = &(*last)->next;
+        }
+
+        *last = entry;
+        proto->ps_cache_count++;
+    }
+    else
+    {
+        MXS_FREE(entry);
+        gwbuf_free(copy);
+        MXS_FREE(sql);
+    }
+}
+
+bool mxs_mysql_ps_cache_close(DCB *dcb, uint32_t id)
+{
+    MySQLProtocol *proto = (MySQLProtocol*)dcb->protocol;
+
+    for (mysql_ps_cache_entry_t *e = proto->ps_cache; e; e = e->next)
+    {
+        if (e->id == id && e->in_use)
+        {
+            e->in_use = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void mxs_mysql_ps_cache_release(MySQLProtocol *proto)
+{
+    for (mysql_ps_cache_entry_t *e = proto->ps_cache; e; e = e->next)
+    {
+        e->in_use = false;
+    }
+
+    proto->ps_last_cached = false;
+}
+
+void mxs_mysql_ps_cache_clear(MySQLProtocol *proto, bool close)
+{
+    mysql_ps_cache_entry_t *e = proto->ps_cache;
+
+    while (e)
+    {
+        mysql_ps_cache_entry_t *next = e->next;
+
+        if (close && !e->in_use)
+        {
+            close_statement(proto->owner_dcb, e->id);
+        }
+
+        free_entry(e);
+        e = next;
+    }
+
+    proto->ps_cache = NULL;
+    proto->ps_cache_count = 0;
+    proto->ps_last_cached = false;
+    gwbuf_free(proto->ps_pending);
+    proto->ps_pending = NULL;
+}
+
+bool mxs_mysql_set_ps_id(GWBUF **buf, uint32_t id)
+{
+    GWBUF *rval = GWBUF_LENGTH(*buf) < PS_ID_OFFSET + 4 ?
+                  gwbuf_make_contiguous(*buf) : gwbuf_make_writable(*buf);
+
+    if (rval == NULL || GWBUF_LENGTH(rval) < PS_ID_OFFSET + 4)
+    {
+        if (rval)
+        {
+            *buf = rval;
+        }
+
+        return false;
+    }
+
+    gw_mysql_set_byte4(GWBUF_DATA(rval) + PS_ID_OFFSET, id);
+    *buf = rval;
+    return true;
+}
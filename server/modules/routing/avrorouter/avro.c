@@ -62,6 +62,7 @@
 
 static const char* avro_task_name = "binlog_to_avro";
 static const char* index_task_name = "avro_indexing";
+static const char batch_task_name[] = "avro_batches";
 static const char* avro_index_name = "avro.index";
 
 /** For detection of CREATE/ALTER TABLE statements */
@@ -93,6 +94,7 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata);
 static bool ensure_dir_ok(const char* path, int mode);
 bool avro_save_conversion_state(AVRO_INSTANCE *router);
 static void stats_func(void *);
+static void batch_func(void *);
 void avro_index_file(AVRO_INSTANCE *router, const char* path);
 void avro_update_index(AVRO_INSTANCE* router);
 static bool conversion_task_ctl(AVRO_INSTANCE *inst, bool start);
@@ -185,6 +187,13 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"group_trx", MXS_MODULE_PARAM_COUNT, "1"},
             {"start_index", MXS_MODULE_PARAM_COUNT, "1"},
             {"block_size", MXS_MODULE_PARAM_COUNT, "0"},
+            {"conversion_threads", MXS_MODULE_PARAM_COUNT, "0"},
+            {"flush_latency", MXS_MODULE_PARAM_COUNT, "0"},
+            {"block_cache_size", MXS_MODULE_PARAM_SIZE, "0"},
+            {"direct_json", MXS_MODULE_PARAM_BOOL, "true"},
+            {"kafka_brokers", MXS_MODULE_PARAM_STRING},
+            {"kafka_topic_prefix", MXS_MODULE_PARAM_STRING, ""},
+            {"kafka_linger", MXS_MODULE_PARAM_COUNT, "10"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -216,6 +225,18 @@ bool create_tables(sqlite3* handle)
         return false;
     }
 
+    /** Covers the lookup of the position of a GTID in a file */
+    rc = sqlite3_exec(handle, "CREATE INDEX IF NOT EXISTS "GTID_TABLE_NAME"_file_index ON "
+                      GTID_TABLE_NAME"(avrofile, domain, server_id, sequence, position);",
+                      NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to create index on GTID index table '"GTID_TABLE_NAME"': %s",
+                  sqlite3_errmsg(handle));
+        sqlite3_free(errmsg);
+        return false;
+    }
+
     rc = sqlite3_exec(handle, "CREATE TABLE IF NOT EXISTS "
                       USED_TABLES_TABLE_NAME"(domain int, server_id int, "
                       "sequence bigint, binlog_timestamp bigint, "
@@ -240,6 +261,17 @@ bool create_tables(sqlite3* handle)
         return false;
     }
 
+    rc = sqlite3_exec(handle, "CREATE INDEX IF NOT EXISTS "INDEX_TABLE_NAME"_file_index ON "
+                      INDEX_TABLE_NAME"(filename, position);",
+                      NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to create index on indexing progress table '"INDEX_TABLE_NAME"': %s",
+                  sqlite3_errmsg(handle));
+        sqlite3_free(errmsg);
+        return false;
+    }
+
     rc = sqlite3_exec(handle, "ATTACH DATABASE ':memory:' AS "MEMORY_DATABASE_NAME,
                       NULL, NULL, &errmsg);
     if (rc != SQLITE_OK)
@@ -388,6 +420,9 @@ createInstance(SERVICE *service, char **options)
     spinlock_init(&inst->fileslock);
     inst->service = service;
     inst->binlog_fd = -1;
+    binlog_map_init(&inst->binlog_map, -1);
+    inst->binlog_mapped = false;
+    inst->binlog_zfile = NULL;
     inst->current_pos = 4;
     inst->binlog_position = 4;
     inst->clients = NULL;
@@ -398,6 +433,11 @@ createInstance(SERVICE *service, char **options)
     inst->row_count = 0;
     inst->trx_count = 0;
     inst->binlogdir = NULL;
+    inst->converters = NULL;
+    inst->pending_row_jobs = 0;
+    inst->last_row_job = NULL;
+    pthread_mutex_init(&inst->conversion_lock, NULL);
+    pthread_cond_init(&inst->conversion_cond, NULL);
 
     MXS_CONFIG_PARAMETER *params = service->svc_config_param;
 
@@ -407,6 +447,11 @@ createInstance(SERVICE *service, char **options)
     inst->trx_target = config_get_integer(params, "group_trx");
     int first_file = config_get_integer(params, "start_index");
     inst->block_size = config_get_integer(params, "block_size");
+    inst->conversion_threads = config_get_integer(params, "conversion_threads");
+    inst->flush_latency = config_get_integer(params, "flush_latency");
+    uint64_t block_cache_size = config_get_size(params, "block_cache_size");
+    inst->direct_json = config_get_bool(params, "direct_json");
+    const char *kafka_brokers = config_get_string(params, "kafka_brokers");
 
     MXS_CONFIG_PARAMETER *param = config_get_param(params, "source");
     inst->gtid.domain = 0;
@@ -491,6 +536,22 @@ createInstance(SERVICE *service, char **options)
                 {
                     inst->block_size = atoi(value);
                 }
+                else if (strcmp(options[i], "conversion_threads") == 0)
+                {
+                    inst->conversion_threads = atoi(value);
+                }
+                else if (strcmp(options[i], "flush_latency") == 0)
+                {
+                    inst->flush_latency = atoi(value);
+                }
+                else if (strcmp(options[i], "block_cache_size") == 0)
+                {
+                    block_cache_size = strtoull(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "direct_json") == 0)
+                {
+                    inst->direct_json = config_truth_value(value);
+                }
                 else
                 {
                     MXS_WARNING("Unknown router option: '%s'", options[i]);
@@ -538,6 +599,19 @@ createInstance(SERVICE *service, char **options)
         err = true;
     }
 
+    if (block_cache_size > 0 && (inst->block_cache = avro_block_cache_alloc(block_cache_size)) == NULL)
+    {
+        err = true;
+    }
+
+    if (*kafka_brokers &&
+        (inst->kafka = avro_kafka_alloc(service->name, kafka_brokers,
+                                        config_get_string(params, "kafka_topic_prefix"),
+                                        config_get_integer(params, "kafka_linger"))) == NULL)
+    {
+        err = true;
+    }
+
     int pcreerr;
     size_t erroff;
     pcre2_code *create_re = pcre2_compile((PCRE2_SPTR) create_table_regex,
@@ -580,6 +654,7 @@ createInstance(SERVICE *service, char **options)
     if (err)
     {
         sqlite3_close_v2(inst->sqlite_handle);
+        avro_kafka_free(inst->kafka);
         hashtable_free(inst->table_maps);
         hashtable_free(inst->open_tables);
         hashtable_free(inst->created_tables);
@@ -611,6 +686,17 @@ createInstance(SERVICE *service, char **options)
     hktask_add(task_name, stats_func, inst, AVRO_STATS_FREQ);
      */
 
+    /** Sends the partial batches of the clients that wait for data */
+    char batch_task[strlen(service->name) + sizeof(batch_task_name) + 1];
+    snprintf(batch_task, sizeof(batch_task), "%s-%s", service->name, batch_task_name);
+    hktask_add(batch_task, batch_func, inst, 1);
+
+    if (inst->conversion_threads > 0 && !avro_converter_start(inst))
+    {
+        MXS_WARNING("[%s] Converting rows with %d conversion threads.",
+                    service->name, inst->conversion_threads);
+    }
+
     /* Start the scan, read, convert AVRO task */
     conversion_task_ctl(inst, true);
 
@@ -714,6 +800,8 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
 
     free(client->uuid);
     maxavro_file_close(client->file_handle);
+    maxavro_json_buffer_free(&client->json_buffer);
+    sqlite3_finalize(client->gtid_pos_stmt);
     sqlite3_close_v2(client->sqlite_handle);
 
     /*
@@ -741,6 +829,7 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
     }
     spinlock_release(&router->lock);
 
+    gwbuf_free(client->batch);
     MXS_FREE(client);
 }
 
@@ -829,6 +918,43 @@ spin_reporter(void *dcb, char *desc, int value)
     dcb_printf((DCB *) dcb, "\t\t%-35s  %d\n", desc, value);
 }
 
+/**
+ * Display the conversion statistics of the open tables
+ *
+ * @param router    Router instance
+ * @param dcb       DCB to send diagnostics to
+ */
+static void table_diagnostics(AVRO_INSTANCE *router, DCB *dcb)
+{
+    spinlock_acquire(&router->lock);
+    HASHITERATOR *iter = hashtable_iterator(router->open_tables);
+
+    if (iter)
+    {
+        char *key;
+
+        while ((key = (char*)hashtable_next(iter)))
+        {
+            AVRO_TABLE *table = hashtable_fetch(router->open_tables, key);
+
+            if (table)
+            {
+                dcb_printf(dcb, "\t\tTable:                       %s\n", key);
+                dcb_printf(dcb, "\t\tRecords written:             %lu\n", table->rows);
+                dcb_printf(dcb, "\t\tRecords per second:          %.1f\n", table->rows_per_sec);
+                dcb_printf(dcb, "\t\tLast flush latency:          %ld ms\n",
+                           table->flush_latency * 100);
+                dcb_printf(dcb, "\t\tMaximum flush latency:       %ld ms\n",
+                           table->max_flush_latency * 100);
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+
+    spinlock_release(&router->lock);
+}
+
 /**
  * Display router diagnostics
  *
@@ -879,6 +1005,20 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
     avro_get_used_tables(router_inst, dcb);
     dcb_printf(dcb, "\n");
 
+    dcb_printf(dcb, "\tTables:\n");
+    table_diagnostics(router_inst, dcb);
+    avro_kafka_diagnostics(router_inst->kafka, dcb);
+
+    if (router_inst->block_cache)
+    {
+        AVRO_BLOCK_CACHE *cache = router_inst->block_cache;
+        spinlock_acquire(&cache->lock);
+        dcb_printf(dcb, "\tBlock cache size:                    %lu\n", cache->size);
+        dcb_printf(dcb, "\tBlock cache hits:                    %lu\n", cache->hits);
+        dcb_printf(dcb, "\tBlock cache misses:                  %lu\n", cache->misses);
+        spinlock_release(&cache->lock);
+    }
+
     dcb_printf(dcb, "\tNumber of AVRO clients:              %u\n",
                router_inst->stats.n_clients);
 
@@ -925,6 +1065,12 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                        session->gtid.domain, session->gtid.server_id,
                        session->gtid.seq);
 
+            if (session->batch_records > 0)
+            {
+                dcb_printf(dcb, "\t\tBatches sent:                %lu\n", session->batch_seq);
+                dcb_printf(dcb, "\t\tBatches acknowledged:        %lu\n", session->batch_acked);
+            }
+
             // TODO: Add real value for this
             //dcb_printf(dcb, "\t\tAvro Transaction ID:         %u\n", 0);
             // TODO: Add real value for this
@@ -1011,6 +1157,37 @@ static uint64_t getCapabilities(MXS_ROUTER* instance)
     return RCAP_TYPE_NO_RSESSION;
 }
 
+/**
+ * @brief Wake up the clients whose partial batches have waited long enough
+ *
+ * A client that has sent all available data waits for new data with the
+ * records of a partial batch. This sends the batch when no new data arrives.
+ *
+ * @param inst The router instance
+ */
+static void
+batch_func(void *inst)
+{
+    AVRO_INSTANCE *router = (AVRO_INSTANCE *) inst;
+
+    spinlock_acquire(&router->lock);
+
+    for (AVRO_CLIENT *client = router->clients; client; client = client->next)
+    {
+        spinlock_acquire(&client->catch_lock);
+
+        if (client->state == AVRO_CLIENT_REQUEST_DATA &&
+            (client->cstate & AVRO_WAIT_DATA) && avro_client_batch_is_due(client))
+        {
+            avro_notify_client(client);
+        }
+
+        spinlock_release(&client->catch_lock);
+    }
+
+    spinlock_release(&router->lock);
+}
+
 /**
  * The stats gathering function called from the housekeeper so that we
  * can get timed averages of binlog records shippped
@@ -1066,8 +1243,26 @@ void converter_func(void* data)
 
         if (avro_open_binlog(router->binlogdir, router->binlog_name, &router->binlog_fd))
         {
+            /**
+             * A binlog file that is still being written may be truncated, which
+             * must not happen to a mapped file. Only the files that are followed
+             * by another one are complete and can be mapped.
+             */
+            binlog_map_init(&router->binlog_map, router->binlog_fd);
+            router->binlog_mapped = binlog_next_file_exists(router->binlogdir, router->binlog_name);
+
+            /** The binlogrouter may have compressed a complete file */
+            if (binlog_zfile_is_compressed(router->binlog_fd))
+            {
+                router->binlog_zfile = binlog_zfile_open(router->binlog_fd);
+                router->binlog_mapped = false;
+            }
+
             binlog_end = avro_read_all_events(router);
 
+            /** The rows must be in the Avro files before they are indexed */
+            avro_converter_wait(router);
+
             if (router->current_pos != start_pos || strcmp(binlog_name, router->binlog_name) != 0)
             {
                 /** We processed some data, reset the conversion task delay */
@@ -1077,6 +1272,9 @@ void converter_func(void* data)
                 avro_update_index(router);
             }
 
+            binlog_zfile_close(router->binlog_zfile);
+            router->binlog_zfile = NULL;
+            binlog_map_close(&router->binlog_map);
             avro_close_binlog(router->binlog_fd);
         }
         else
@@ -1089,6 +1287,8 @@ void converter_func(void* data)
     if (router->task_delay == 1)
     {
         avro_flush_all_tables(router, AVROROUTER_FLUSH);
+        /** The saved position covers rows that have reached Kafka */
+        avro_kafka_flush(router->kafka);
         avro_save_conversion_state(router);
     }
 
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_cache.c - Avro data blocks shared by the clients
+ *
+ * When several clients stream the same table, they are usually positioned
+ * near each other in the same Avro file. The first client that reaches a
+ * data block reads and decodes it and stores the result in the cache, and
+ * the others send it from there. The cached buffers are reference counted,
+ * so sending a block to a client only clones the buffer of the block.
+ *
+ * A block is identified by the format it is sent in, the Avro file and the
+ * offset of the block in the file. The least recently used blocks are
+ * removed once the cached blocks take more than the configured size.
+ */
+
+#include "avrorouter.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/hashtable.h>
+
+/**
+ * @brief Allocate a block cache
+ *
+ * @param max_size The maximum size of the cached blocks in bytes
+ * @return The cache or NULL if memory could not be allocated
+ */
+AVRO_BLOCK_CACHE* avro_block_cache_alloc(uint64_t max_size)
+{
+    AVRO_BLOCK_CACHE *cache = MXS_CALLOC(1, sizeof(AVRO_BLOCK_CACHE));
+
+    if (cache)
+    {
+        if ((cache->blocks = hashtable_alloc(1000, hashtable_item_strhash, hashtable_item_strcmp)))
+        {
+            spinlock_init(&cache->lock);
+            cache->max_size = max_size;
+        }
+        else
+        {
+            MXS_FREE(cache);
+            cache = NULL;
+        }
+    }
+
+    return cache;
+}
+
+static void make_key(char *dest, size_t size, enum avro_data_format format,
+                     const char *filename, long pos)
+{
+    snprintf(dest, size, "%d:%ld:%s", (int)format, pos, filename);
+}
+
+/** Remove a block from the list of blocks, the caller must hold the lock */
+static void unlink_block(AVRO_BLOCK_CACHE *cache, AVRO_CACHED_BLOCK *block)
+{
+    if (block->prev)
+    {
+        block->prev->next = block->next;
+    }
+    else
+    {
+        cache->head = block->next;
+    }
+
+    if (block->next)
+    {
+        block->next->prev = block->prev;
+    }
+    else
+    {
+        cache->tail = block->prev;
+    }
+
+    block->prev = NULL;
+    block->next = NULL;
+}
+
+/** Add a block as the most recently used one, the caller must hold the lock */
+static void link_block(AVRO_BLOCK_CACHE *cache, AVRO_CACHED_BLOCK *block)
+{
+    block->next = cache->head;
+
+    if (cache->head)
+    {
+        cache->head->prev = block;
+    }
+    else
+    {
+        cache->tail = block;
+    }
+
+    cache->head = block;
+}
+
+static size_t block_size(AVRO_CACHED_BLOCK *block)
+{
+    return gwbuf_length(block->data) + strlen(block->key) + sizeof(*block);
+}
+
+/** Remove the least recently used block, the caller must hold the lock */
+static void evict_block(AVRO_BLOCK_CACHE *cache)
+{
+    AVRO_CACHED_BLOCK *block = cache->tail;
+
+    unlink_block(cache, block);
+    hashtable_delete(cache->blocks, block->key);
+    cache->size -= block_size(block);
+
+    gwbuf_free(block->data);
+    MXS_FREE(block->key);
+    MXS_FREE(block);
+}
+
+/**
+ * @brief Get a block from the cache
+ *
+ * @param cache    The cache
+ * @param format   The format the block is sent in
+ * @param filename The Avro file
+ * @param pos      The offset of the block in the file
+ * @param gtid     If not NULL, the GTID of the last record of the block is
+ *                 copied here
+ * @return A clone of the cached block that the caller must free, or NULL if
+ *         the block is not in the cache
+ */
+GWBUF* avro_block_cache_get(AVRO_BLOCK_CACHE *cache, enum avro_data_format format,
+                            const char *filename, long pos, gtid_pos_t *gtid)
+{
+    char key[strlen(filename) + 64];
+    GWBUF *rval = NULL;
+
+    make_key(key, sizeof(key), format, filename, pos);
+
+    spinlock_acquire(&cache->lock);
+
+    AVRO_CACHED_BLOCK *block = hashtable_fetch(cache->blocks, key);
+
+    if (block && (rval = gwbuf_clone(block->data)))
+    {
+        unlink_block(cache, block);
+        link_block(cache, block);
+
+        if (gtid)
+        {
+            *gtid = block->gtid;
+        }
+
+        cache->hits++;
+    }
+    else
+    {
+        cache->misses++;
+    }
+
+    spinlock_release(&cache->lock);
+
+    return rval;
+}
+
+/**
+ * @brief Add a block to the cache
+ *
+ * The cache stores a clone of the buffer, the caller still owns @c data.
+ * Blocks that are larger than the whole cache are not stored.
+ *
+ * @param cache    The cache
+ * @param format   The format the block is sent in
+ * @param filename The Avro file
+ * @param pos      The offset of the block in the file
+ * @param data     The complete block in the format it is sent in
+ * @param gtid     The GTID of the last record of the block, may be NULL
+ */
+void avro_block_cache_put(AVRO_BLOCK_CACHE *cache, enum avro_data_format format,
+                          const char *filename, long pos, GWBUF *data, gtid_pos_t *gtid)
+{
+    char key[strlen(filename) + 64];
+    make_key(key, sizeof(key), format, filename, pos);
+
+    AVRO_CACHED_BLOCK *block = MXS_CALLOC(1, sizeof(AVRO_CACHED_BLOCK));
+
+    if (block == NULL || (block->key = MXS_STRDUP(key)) == NULL ||
+        (block->data = gwbuf_clone(data)) == NULL)
+    {
+        if (block)
+        {
+            MXS_FREE(block->key);
+            MXS_FREE(block);
+        }
+        return;
+    }
+
+    if (gtid)
+    {
+        block->gtid = *gtid;
+    }
+
+    size_t size = block_size(block);
+
+    spinlock_acquire(&cache->lock);
+
+    /** Two clients may have read the same block at the same time */
+    if (size <= cache->max_size && hashtable_fetch(cache->blocks, key) == NULL &&
+        hashtable_add(cache->blocks, block->key, block))
+    {
+        link_block(cache, block);
+        cache->size += size;
+
+        while (cache->size > cache->max_size)
+        {
+            evict_block(cache);
+        }
+
+        block = NULL;
+    }
+
+    spinlock_release(&cache->lock);
+
+    if (block)
+    {
+        gwbuf_free(block->data);
+        MXS_FREE(block->key);
+        MXS_FREE(block);
+    }
+}
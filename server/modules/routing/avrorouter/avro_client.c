@@ -41,6 +41,7 @@
 #include <maxscale/version.h>
 #include <maxavro.h>
 #include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
 
 extern char *blr_extract_column(GWBUF *buf, int col);
 extern uint32_t extract_field(uint8_t *src, int bits);
@@ -52,6 +53,7 @@ static void avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *clie
 static bool avro_client_stream_data(AVRO_CLIENT *client);
 void avro_notify_client(AVRO_CLIENT *client);
 void poll_fake_write_event(DCB *dcb);
+static void avro_client_ack(AVRO_CLIENT *client, uint64_t seq);
 GWBUF* read_avro_json_schema(const char *avrofile, const char* dir);
 GWBUF* read_avro_binary_schema(const char *avrofile, const char* dir);
 const char* get_avrofile_name(const char *file_ptr, int data_len, char *dest);
@@ -117,6 +119,52 @@ avro_client_handle_request(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *qu
     return rval;
 }
 
+/**
+ * Read an optional numeric registration option
+ *
+ * @param request The registration request
+ * @param name    Name of the option, including the equals sign
+ * @param value   Where the value is stored if the option is present
+ */
+static void read_registration_option(const char *request, const char *name, uint32_t *value)
+{
+    const char *ptr = strstr(request, name);
+
+    if (ptr)
+    {
+        *value = strtoul(ptr + strlen(name), NULL, 10);
+    }
+}
+
+/**
+ * Read the batch options of the registration
+ *
+ * With BATCH=N the data is sent in framed batches of at least N records.
+ * BATCH_TIME=T sends a partial batch once its first record has waited T
+ * milliseconds and WINDOW=W stops sending after W unacknowledged batches.
+ *
+ * @param client Client that registered
+ * @param data   The registration request
+ */
+static void read_batch_options(AVRO_CLIENT *client, GWBUF *data)
+{
+    size_t len = gwbuf_length(data);
+    char request[len + 1];
+    gwbuf_copy_data(data, 0, len, (uint8_t*)request);
+    request[len] = '\0';
+
+    read_registration_option(request, "BATCH=", &client->batch_records);
+    read_registration_option(request, "BATCH_TIME=", &client->batch_time);
+    read_registration_option(request, "WINDOW=", &client->batch_window);
+
+    if (client->batch_records > 0)
+    {
+        MXS_INFO("%s: Client [%s] uses batches of %u records, %u ms and a window of %u batches",
+                 client->dcb->service->name, client->dcb->remote ? client->dcb->remote : "",
+                 client->batch_records, client->batch_time, client->batch_window);
+    }
+}
+
 /**
  * Handle the REGISTRATION command
  *
@@ -187,6 +235,11 @@ avro_client_do_registration(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *d
                 {
                     fprintf(stderr, "Registration TYPE not supported, only AVRO\n");
                 }
+
+                if (ret)
+                {
+                    read_batch_options(client, data);
+                }
             }
             else
             {
@@ -446,6 +499,7 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
     const char req_data[] = "REQUEST-DATA";
     const char req_last_gtid[] = "QUERY-LAST-TRANSACTION";
     const char req_gtid[] = "QUERY-TRANSACTION";
+    const char req_ack[] = "ACK ";
     const size_t req_data_len = sizeof(req_data) - 1;
     size_t buflen = gwbuf_length(queue);
     uint8_t data[buflen + 1];
@@ -500,6 +554,11 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
                              GWBUF_LENGTH(queue) - sizeof(req_gtid));
         send_gtid_info(router, &gtid, client->dcb);
     }
+    /** Acknowledge batches */
+    else if (strncmp((char *)data, req_ack, sizeof(req_ack) - 1) == 0)
+    {
+        avro_client_ack(client, strtoull((char *)data + sizeof(req_ack) - 1, NULL, 10));
+    }
     else
     {
         GWBUF *reply = gwbuf_alloc(5);
@@ -554,27 +613,134 @@ const char* get_avrofile_name(const char *file_ptr, int data_len, char *dest)
     return rval;
 }
 
-static int send_row(DCB *dcb, json_t* row)
+/**
+ * @brief Send the batch being collected
+ *
+ * The batch is prefixed with a header that holds the length of the payload,
+ * the number of records in it and the sequence number of the batch, all in
+ * network byte order.
+ *
+ * @param client Client to send to
+ * @return The return value of the write, 1 if there was nothing to send
+ */
+static int flush_batch(AVRO_CLIENT *client)
 {
-    char *json = json_dumps(row, JSON_PRESERVE_ORDER);
-    size_t len = strlen(json);
-    GWBUF *buf = gwbuf_alloc(len + 1);
-    int rc = 0;
+    int rc = 1;
 
-    if (json && buf)
+    if (client->batch)
     {
-        uint8_t *data = GWBUF_DATA(buf);
-        memcpy(data, json, len);
-        data[len] = '\n';
-        rc = dcb->func.write(dcb, buf);
+        GWBUF *header = gwbuf_alloc(AVRO_BATCH_HEADER_LEN);
+
+        if (header)
+        {
+            uint8_t *ptr = GWBUF_DATA(header);
+            uint32_t len = gwbuf_length(client->batch);
+            uint64_t seq = ++client->batch_seq;
+
+            for (int i = 0; i < 4; i++)
+            {
+                ptr[i] = len >> (24 - i * 8);
+                ptr[4 + i] = client->batch_pending >> (24 - i * 8);
+            }
+
+            for (int i = 0; i < 8; i++)
+            {
+                ptr[8 + i] = seq >> (56 - i * 8);
+            }
+
+            rc = client->dcb->func.write(client->dcb, gwbuf_append(header, client->batch));
+        }
+        else
+        {
+            gwbuf_free(client->batch);
+            rc = 0;
+        }
+
+        client->batch = NULL;
+        client->batch_pending = 0;
     }
-    else
+
+    return rc;
+}
+
+/**
+ * @brief Send data to a client
+ *
+ * If the client uses batches, the data is added to the current batch and the
+ * batch is sent once it holds enough records.
+ *
+ * @param client  Client to send to
+ * @param buffer  The data
+ * @param records The number of records in the data
+ * @return The return value of the write
+ */
+static int client_write(AVRO_CLIENT *client, GWBUF *buffer, uint32_t records)
+{
+    if (client->batch_records == 0)
     {
-        MXS_ERROR("Failed to dump JSON value.");
-        rc = 0;
+        return client->dcb->func.write(client->dcb, buffer);
     }
-    MXS_FREE(json);
-    return rc;
+
+    if (client->batch == NULL)
+    {
+        client->batch_start = hkheartbeat;
+    }
+
+    client->batch = gwbuf_append(client->batch, buffer);
+    client->batch_pending += records;
+
+    return client->batch_pending >= client->batch_records ? flush_batch(client) : 1;
+}
+
+/**
+ * @brief Check whether a partial batch has waited long enough to be sent
+ *
+ * @param client Client to check
+ * @return True if the batch being collected should be sent now
+ */
+bool avro_client_batch_is_due(AVRO_CLIENT *client)
+{
+    /** The heartbeat is incremented every 100 milliseconds */
+    return client->batch &&
+           hkheartbeat - client->batch_start >= (client->batch_time + 99) / 100;
+}
+
+/**
+ * @brief Check whether the client has all its batches unacknowledged
+ *
+ * @param client Client to check
+ * @return True if no more batches can be sent before an ACK
+ */
+static bool window_is_full(AVRO_CLIENT *client)
+{
+    return client->batch_records > 0 && client->batch_window > 0 &&
+           client->batch_seq - client->batch_acked >= client->batch_window;
+}
+
+/**
+ * @brief Handle the acknowledgement of the batches up to a sequence number
+ *
+ * If the client stopped sending because of the window, sending continues.
+ *
+ * @param client Client that acknowledged
+ * @param seq    The sequence number of the last batch it has processed
+ */
+static void avro_client_ack(AVRO_CLIENT *client, uint64_t seq)
+{
+    spinlock_acquire(&client->catch_lock);
+
+    if (seq > client->batch_acked && seq <= client->batch_seq)
+    {
+        client->batch_acked = seq;
+    }
+
+    if ((client->cstate & AVRO_WAIT_ACK) && !window_is_full(client))
+    {
+        client->cstate &= ~AVRO_WAIT_ACK;
+        avro_notify_client(client);
+    }
+
+    spinlock_release(&client->catch_lock);
 }
 
 static void set_current_gtid(AVRO_CLIENT *client, json_t *row)
@@ -592,6 +758,194 @@ static void set_current_gtid(AVRO_CLIENT *client, json_t *row)
     client->gtid.domain = json_integer_value(obj);
 }
 
+/**
+ * @brief Convert a JSON row into a newline terminated buffer
+ *
+ * @param row Row to convert
+ * @return The buffer or NULL on error
+ */
+static GWBUF* row_to_buffer(json_t *row)
+{
+    char *json = json_dumps(row, JSON_PRESERVE_ORDER);
+    GWBUF *buf = NULL;
+
+    if (json && (buf = gwbuf_alloc(strlen(json) + 1)))
+    {
+        size_t len = strlen(json);
+        uint8_t *data = GWBUF_DATA(buf);
+        memcpy(data, json, len);
+        data[len] = '\n';
+    }
+    else
+    {
+        MXS_ERROR("Failed to dump JSON value.");
+    }
+
+    MXS_FREE(json);
+    return buf;
+}
+
+static int send_row(AVRO_CLIENT *client, json_t* row)
+{
+    GWBUF *buf = row_to_buffer(row);
+    return buf ? client_write(client, buf, 1) : 0;
+}
+
+/**
+ * @brief Find a field of the schema of a file
+ *
+ * @param file File to search
+ * @param name Name of the field
+ * @return Index of the field or -1 if the schema has no such field
+ */
+static int find_field(MAXAVRO_FILE *file, const char *name)
+{
+    for (size_t i = 0; i < file->schema->num_fields; i++)
+    {
+        if (strcmp(file->schema->fields[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Read the unread records of the current data block into JSON objects
+ *
+ * Each record is converted into a JSON object and the object into text.
+ *
+ * @param client   Client to read for
+ * @param complete Set to true if all records of the block were read
+ * @param records  The number of records read is stored here
+ * @return The records or NULL if no records were read
+ */
+static GWBUF* read_json_objects(AVRO_CLIENT *client, bool *complete, uint32_t *records)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    GWBUF *block = NULL;
+    uint32_t found = 0;
+    bool converted = true;
+    json_t *row;
+
+    while ((row = maxavro_record_read_json(file)))
+    {
+        GWBUF *buf = row_to_buffer(row);
+        converted = converted && buf;
+        block = gwbuf_append(block, buf);
+        set_current_gtid(client, row);
+        json_decref(row);
+        found++;
+    }
+
+    *records = found;
+    *complete = converted && file->records_read_from_block == file->records_in_block;
+
+    if (block && (block = gwbuf_make_contiguous(block)) == NULL)
+    {
+        *complete = false;
+    }
+
+    return block;
+}
+
+/**
+ * @brief Read the unread records of the current data block in JSON format
+ *
+ * With direct_json, the records are written as text straight from the file
+ * into the JSON buffer of the client, which is reused for all blocks, and the
+ * text is then copied into a single buffer. Otherwise the records are
+ * converted with jansson.
+ *
+ * @param client   Client to read for
+ * @param complete Set to true if all records of the block were read
+ * @param records  The number of records read is stored here
+ * @return The records or NULL if no records were read
+ */
+static GWBUF* read_json_records(AVRO_CLIENT *client, bool *complete, uint32_t *records)
+{
+    if (!client->router->direct_json)
+    {
+        return read_json_objects(client, complete, records);
+    }
+
+    MAXAVRO_FILE *file = client->file_handle;
+    MAXAVRO_JSON_BUFFER *buf = &client->json_buffer;
+    int seq = find_field(file, avro_sequence);
+    int server_id = find_field(file, avro_server_id);
+    int domain = find_field(file, avro_domain);
+    uint64_t values[file->schema->num_fields + 1];
+    uint32_t found = 0;
+
+    ss_dassert(seq >= 0 && server_id >= 0 && domain >= 0);
+    buf->length = 0;
+
+    while (maxavro_record_write_json(file, buf, values))
+    {
+        found++;
+    }
+
+    *records = found;
+
+    if (found > 0 && seq >= 0 && server_id >= 0 && domain >= 0)
+    {
+        client->gtid.seq = values[seq];
+        client->gtid.server_id = values[server_id];
+        client->gtid.domain = values[domain];
+    }
+
+    *complete = file->records_read_from_block == file->records_in_block;
+
+    GWBUF *rval = NULL;
+
+    if (buf->length > 0 && (rval = gwbuf_alloc_and_load(buf->length, buf->data)) == NULL)
+    {
+        *complete = false;
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Stream a complete data block in JSON format through the block cache
+ *
+ * If another client has already sent the block, it is sent from the cache.
+ * Otherwise the records are read and the block is added to the cache.
+ *
+ * @param client Client to stream to, positioned at the start of a block
+ * @param cache  The block cache
+ */
+static void stream_json_block(AVRO_CLIENT *client, AVRO_BLOCK_CACHE *cache)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    long pos = file->block_start_pos;
+    gtid_pos_t gtid;
+    GWBUF *block = avro_block_cache_get(cache, AVRO_FORMAT_JSON, file->filename, pos, &gtid);
+    uint32_t records = file->records_in_block;
+    bool complete;
+
+    if (block)
+    {
+        client->gtid.seq = gtid.seq;
+        client->gtid.server_id = gtid.server_id;
+        client->gtid.domain = gtid.domain;
+        maxavro_record_skip_block(file);
+        client_write(client, block, records);
+    }
+    else if ((block = read_json_records(client, &complete, &records)))
+    {
+        /** A block that could not be read completely is not cached */
+        if (complete)
+        {
+            avro_block_cache_put(cache, AVRO_FORMAT_JSON, file->filename, pos,
+                                 block, &client->gtid);
+        }
+
+        client_write(client, block, records);
+    }
+}
+
 /**
  * @brief Stream Avro data in JSON format
  *
@@ -603,25 +957,67 @@ static bool stream_json(AVRO_CLIENT *client)
 {
     int bytes = 0;
     MAXAVRO_FILE *file = client->file_handle;
-    DCB *dcb = client->dcb;
+    AVRO_BLOCK_CACHE *cache = client->router->block_cache;
 
     do
     {
-        json_t *row;
-        int rc = 1;
-        while (rc > 0 && (row = maxavro_record_read_json(file)))
+        if (cache && (file->metadata_read || maxavro_read_datablock_start(file)) &&
+            file->records_read_from_block == 0 && file->records_in_block > 0)
         {
-            rc = send_row(dcb, row);
-            set_current_gtid(client, row);
-            json_decref(row);
+            stream_json_block(client, cache);
+        }
+        else
+        {
+            bool complete;
+            uint32_t records;
+            GWBUF *buffer = read_json_records(client, &complete, &records);
+
+            if (buffer)
+            {
+                client_write(client, buffer, records);
+            }
         }
         bytes += file->block_size;
     }
-    while (maxavro_next_block(file) && bytes < AVRO_DATA_BURST_SIZE);
+    while (!window_is_full(client) && maxavro_next_block(file) && bytes < AVRO_DATA_BURST_SIZE);
 
     return bytes >= AVRO_DATA_BURST_SIZE;
 }
 
+/**
+ * @brief Read a data block in native Avro format, through the block cache if
+ * it is enabled
+ *
+ * @param client  Client to read for
+ * @param records The number of records in the block is stored here
+ * @return The block or NULL if no block could be read
+ */
+static GWBUF* read_binary_block(AVRO_CLIENT *client, uint32_t *records)
+{
+    MAXAVRO_FILE *file = client->file_handle;
+    AVRO_BLOCK_CACHE *cache = client->router->block_cache;
+    GWBUF *block = NULL;
+
+    if (file->metadata_read || maxavro_read_datablock_start(file))
+    {
+        long pos = file->block_start_pos;
+        *records = file->records_in_block;
+
+        if (cache && (block = avro_block_cache_get(cache, AVRO_FORMAT_AVRO,
+                                                   file->filename, pos, NULL)))
+        {
+            maxavro_record_skip_block(file);
+            maxavro_next_block(file);
+        }
+        else if ((block = maxavro_record_read_binary(file)) && cache)
+        {
+            avro_block_cache_put(cache, AVRO_FORMAT_AVRO, file->filename, pos, block, NULL);
+        }
+    }
+
+    return block;
+}
+
 /**
  * @brief Stream Avro data in native Avro format
  *
@@ -635,14 +1031,14 @@ static bool stream_binary(AVRO_CLIENT *client)
     uint64_t bytes = 0;
     int rc = 1;
     MAXAVRO_FILE *file = client->file_handle;
-    DCB *dcb = client->dcb;
 
-    while (rc > 0 && bytes < AVRO_DATA_BURST_SIZE)
+    while (rc > 0 && bytes < AVRO_DATA_BURST_SIZE && !window_is_full(client))
     {
+        uint32_t records;
         bytes += file->block_size;
-        if ((buffer = maxavro_record_read_binary(file)))
+        if ((buffer = read_binary_block(client, &records)))
         {
-            rc = dcb->func.write(dcb, buffer);
+            rc = client_write(client, buffer, records);
         }
         else
         {
@@ -653,21 +1049,10 @@ static bool stream_binary(AVRO_CLIENT *client)
     return bytes >= AVRO_DATA_BURST_SIZE;
 }
 
-static int sqlite_cb(void* data, int rows, char** values, char** names)
-{
-    for (int i = 0; i < rows; i++)
-    {
-        if (values[i])
-        {
-            *((long*)data) = strtol(values[i], NULL, 10);
-            return 0;
-        }
-    }
-    return 0;
-}
-
-static const char select_template[] = "SELECT max(position) FROM gtid WHERE domain=%lu "
-                                      "AND server_id=%lu AND sequence <= %lu AND avrofile=\"%s\";";
+/** The covering index on the file and the GTID makes this a single lookup */
+static const char gtid_pos_sql[] = "SELECT position FROM "GTID_TABLE_NAME" WHERE avrofile = ? "
+                                   "AND domain = ? AND server_id = ? AND sequence <= ? "
+                                   "ORDER BY sequence DESC, position DESC LIMIT 1;";
 
 static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 {
@@ -675,28 +1060,38 @@ static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
     ss_dassert(name);
     name++;
 
-    char sql[sizeof(select_template) + NAME_MAX + 80];
-    snprintf(sql, sizeof(sql), select_template, client->gtid.domain,
-             client->gtid.server_id, client->gtid.seq, name);
-
-    long offset = -1;
-    char *errmsg = NULL;
     bool rval = false;
 
-    if (sqlite3_exec(client->sqlite_handle, sql, sqlite_cb, &offset, &errmsg) == SQLITE_OK)
+    if (avro_prepare_stmt(client->sqlite_handle, &client->gtid_pos_stmt, gtid_pos_sql))
     {
-        rval = true;
-        if (offset > 0 && !maxavro_record_set_pos(file, offset))
+        sqlite3_stmt *stmt = client->gtid_pos_stmt;
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, client->gtid.domain);
+        sqlite3_bind_int64(stmt, 3, client->gtid.server_id);
+        sqlite3_bind_int64(stmt, 4, client->gtid.seq);
+
+        int rc = sqlite3_step(stmt);
+
+        if (rc == SQLITE_ROW || rc == SQLITE_DONE)
         {
-            rval = false;
+            long offset = rc == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+            rval = true;
+
+            if (offset > 0 && !maxavro_record_set_pos(file, offset))
+            {
+                rval = false;
+            }
         }
+        else
+        {
+            MXS_ERROR("Failed to query index position for GTID %lu-%lu-%lu: %s",
+                      client->gtid.domain, client->gtid.server_id, client->gtid.seq,
+                      sqlite3_errmsg(client->sqlite_handle));
+        }
+
+        sqlite3_reset(stmt);
     }
-    else
-    {
-        MXS_ERROR("Failed to query index position for GTID %lu-%lu-%lu: %s",
-                  client->gtid.domain, client->gtid.server_id, client->gtid.seq, errmsg);
-    }
-    sqlite3_free(errmsg);
+
     return rval;
 }
 
@@ -745,7 +1140,7 @@ static bool seek_to_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file)
              * read the row into memory */
             if (!seeking)
             {
-                send_row(client->dcb, row);
+                send_row(client, row);
             }
 
             json_decref(row);
@@ -987,58 +1382,78 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
         client->cstate |= AVRO_CS_BUSY;
         spinlock_release(&client->catch_lock);
 
-        if (client->last_sent_pos == 0)
-        {
-            /** Send the schema of the current file */
-            GWBUF *schema = NULL;
+        bool read_more = false;
+        bool next_file = false;
 
-            switch (client->format)
+        /** Nothing is sent until the client acknowledges some of the batches */
+        if (!window_is_full(client))
+        {
+            if (client->last_sent_pos == 0)
             {
-            case AVRO_FORMAT_JSON:
-                schema = read_avro_json_schema(client->avro_binfile, client->router->avrodir);
-                break;
+                /** Send the schema of the current file */
+                GWBUF *schema = NULL;
 
-            case AVRO_FORMAT_AVRO:
-                schema = read_avro_binary_schema(client->avro_binfile, client->router->avrodir);
-                break;
+                switch (client->format)
+                {
+                case AVRO_FORMAT_JSON:
+                    schema = read_avro_json_schema(client->avro_binfile, client->router->avrodir);
+                    break;
 
-            default:
-                MXS_ERROR("Unknown client format: %d", client->format);
-            }
+                case AVRO_FORMAT_AVRO:
+                    schema = read_avro_binary_schema(client->avro_binfile, client->router->avrodir);
+                    break;
 
-            if (schema)
-            {
-                client->dcb->func.write(client->dcb, schema);
+                default:
+                    MXS_ERROR("Unknown client format: %d", client->format);
+                }
+
+                if (schema)
+                {
+                    client_write(client, schema, 0);
+                }
             }
-        }
 
-        /** Stream the data to the client */
-        bool read_more = avro_client_stream_data(client);
+            /** Stream the data to the client */
+            read_more = avro_client_stream_data(client);
 
-        char filename[PATH_MAX + 1];
-        print_next_filename(client->avro_binfile, client->router->avrodir,
-                            filename, sizeof(filename));
+            char filename[PATH_MAX + 1];
+            print_next_filename(client->avro_binfile, client->router->avrodir,
+                                filename, sizeof(filename));
 
-        bool next_file;
-        /** If the next file is available, send it to the client */
-        if ((next_file = (access(filename, R_OK) == 0)))
-        {
-            rotate_avro_file(client, filename);
+            /** If the next file is available, send it to the client */
+            if ((next_file = (access(filename, R_OK) == 0)))
+            {
+                rotate_avro_file(client, filename);
+            }
+
+            /** At the end of the data, a partial batch is sent once it has waited long enough */
+            if (!next_file && !read_more && avro_client_batch_is_due(client))
+            {
+                flush_batch(client);
+            }
         }
 
         spinlock_acquire(&client->catch_lock);
         client->cstate &= ~AVRO_CS_BUSY;
-        client->cstate |= AVRO_WAIT_DATA;
 
-        if (next_file || read_more)
+        if (window_is_full(client))
         {
-#ifdef SS_DEBUG
-            if (read_more)
+            client->cstate |= AVRO_WAIT_ACK;
+        }
+        else
+        {
+            client->cstate |= AVRO_WAIT_DATA;
+
+            if (next_file || read_more)
             {
-                MXS_DEBUG("Burst limit hit, need to read more data.");
-            }
+#ifdef SS_DEBUG
+                if (read_more)
+                {
+                    MXS_DEBUG("Burst limit hit, need to read more data.");
+                }
 #endif
-            avro_notify_client(client);
+                avro_notify_client(client);
+            }
         }
         spinlock_release(&client->catch_lock);
     }
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_converter.c - Parallel conversion of row events
+ *
+ * The binlog is read and the events are decoded by the conversion task. When
+ * conversion threads are configured, the rows of the row events are converted
+ * and written to the Avro files by the threads instead. Each table is assigned
+ * to one thread by its name, so the rows of a table are written in the order
+ * they were read while different tables are converted in parallel.
+ *
+ * The reading waits for the threads to finish before anything that the
+ * threads use is changed, that is, before a table map replaces a table,
+ * before a DDL statement changes a table and before the Avro files are
+ * flushed or the conversion state is saved.
+ */
+
+#include "avrorouter.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/hashtable.h>
+
+/**
+ * @brief The main loop of a conversion thread
+ *
+ * @param data The AVRO_CONVERTER of the thread
+ */
+static void converter_main(void *data)
+{
+    AVRO_CONVERTER *conv = (AVRO_CONVERTER*)data;
+    AVRO_INSTANCE *router = conv->router;
+
+    pthread_mutex_lock(&router->conversion_lock);
+
+    while (true)
+    {
+        while (conv->head == NULL)
+        {
+            pthread_cond_wait(&conv->cond, &router->conversion_lock);
+        }
+
+        AVRO_ROW_JOB *job = conv->head;
+        conv->head = job->next;
+
+        if (conv->head == NULL)
+        {
+            conv->tail = NULL;
+        }
+
+        /** The previous row event of the transaction was queued earlier,
+         * so it never waits for this one */
+        while (job->prev && !job->prev->numbered)
+        {
+            pthread_cond_wait(&router->conversion_cond, &router->conversion_lock);
+        }
+
+        pthread_mutex_unlock(&router->conversion_lock);
+
+        if (job->prev)
+        {
+            job->gtid.event_num = job->prev->gtid.event_num;
+            avro_row_job_release(job->prev);
+            job->prev = NULL;
+        }
+
+        avro_row_job_convert(job);
+
+        pthread_mutex_lock(&router->conversion_lock);
+        job->numbered = true;
+        router->pending_row_jobs--;
+        pthread_cond_broadcast(&router->conversion_cond);
+        avro_row_job_release(job);
+    }
+}
+
+/**
+ * @brief Start the conversion threads
+ *
+ * If not all threads can be started, the rows are converted by those that
+ * were started, or when they are read if none were.
+ *
+ * @param router Avro router instance
+ * @return True if all threads were started
+ */
+bool avro_converter_start(AVRO_INSTANCE *router)
+{
+    int started = 0;
+
+    router->converters = MXS_CALLOC(router->conversion_threads, sizeof(AVRO_CONVERTER));
+
+    while (router->converters && started < router->conversion_threads)
+    {
+        AVRO_CONVERTER *conv = &router->converters[started];
+        conv->router = router;
+        pthread_cond_init(&conv->cond, NULL);
+
+        if (thread_start(&conv->thread, converter_main, conv) == NULL)
+        {
+            MXS_ERROR("[%s] Failed to start conversion thread %d.",
+                      router->service->name, started);
+            pthread_cond_destroy(&conv->cond);
+            break;
+        }
+
+        started++;
+    }
+
+    bool rval = started == router->conversion_threads;
+    router->conversion_threads = started;
+
+    if (started == 0)
+    {
+        MXS_FREE(router->converters);
+        router->converters = NULL;
+    }
+    else
+    {
+        MXS_NOTICE("[%s] Started %d conversion threads.", router->service->name, started);
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Queue a row event for the conversion thread of its table
+ *
+ * The rows are numbered from where the previous row event of the transaction
+ * ends. If the event is the first one of the transaction, or the previous
+ * ones have already been waited for, the numbering is known.
+ *
+ * @param router Avro router instance
+ * @param table_ident The table the rows belong to
+ * @param job The copied row event
+ */
+void avro_converter_submit(AVRO_INSTANCE *router, const char *table_ident, AVRO_ROW_JOB *job)
+{
+    AVRO_CONVERTER *conv = &router->converters[(unsigned int)hashtable_item_strhash(table_ident) %
+                                               router->conversion_threads];
+
+    /** One reference for the queue and one for the next event of the
+     * transaction, which takes over the one the router now holds */
+    job->refcount = 2;
+    job->prev = router->last_row_job;
+
+    if (job->prev == NULL)
+    {
+        job->gtid.event_num = router->gtid.event_num;
+    }
+
+    router->last_row_job = job;
+
+    pthread_mutex_lock(&router->conversion_lock);
+
+    while (router->pending_row_jobs >= AVRO_MAX_PENDING_ROW_JOBS)
+    {
+        pthread_cond_wait(&router->conversion_cond, &router->conversion_lock);
+    }
+
+    if (conv->tail)
+    {
+        conv->tail->next = job;
+    }
+    else
+    {
+        conv->head = job;
+    }
+
+    conv->tail = job;
+    router->pending_row_jobs++;
+    pthread_cond_signal(&conv->cond);
+    pthread_mutex_unlock(&router->conversion_lock);
+}
+
+/**
+ * @brief Wait until all queued row events have been converted
+ *
+ * After this the Avro files and the GTID of the router are as if the
+ * rows had been converted when they were read.
+ *
+ * @param router Avro router instance
+ */
+void avro_converter_wait(AVRO_INSTANCE *router)
+{
+    pthread_mutex_lock(&router->conversion_lock);
+
+    while (router->pending_row_jobs > 0)
+    {
+        pthread_cond_wait(&router->conversion_cond, &router->conversion_lock);
+    }
+
+    pthread_mutex_unlock(&router->conversion_lock);
+
+    if (router->last_row_job)
+    {
+        router->gtid.event_num = router->last_row_job->gtid.event_num;
+        avro_row_job_release(router->last_row_job);
+        router->last_row_job = NULL;
+    }
+}
+
+/**
+ * @brief Start the numbering of rows from the beginning for a new transaction
+ *
+ * @param router Avro router instance
+ */
+void avro_converter_end_trx(AVRO_INSTANCE *router)
+{
+    if (router->last_row_job)
+    {
+        avro_row_job_release(router->last_row_job);
+        router->last_row_job = NULL;
+    }
+}
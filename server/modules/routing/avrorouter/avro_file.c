@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <glob.h>
 #include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
 
 static const char *statefile_section = "avro-conversion";
 static const char *ddl_list_name = "table-ddl.list";
@@ -150,6 +151,7 @@ AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema, size
 
         table->json_schema = MXS_STRDUP_A(json_schema);
         table->filename = MXS_STRDUP_A(filepath);
+        table->rate_start = hkheartbeat;
     }
     return table;
 }
@@ -322,6 +324,7 @@ void avro_table_free(AVRO_TABLE *table)
         avro_file_writer_close(table->avro_file);
         avro_value_iface_decref(table->avro_writer_iface);
         avro_schema_decref(table->avro_schema);
+        avro_kafka_topic_free(table->kafka_topic);
         MXS_FREE(table->json_schema);
         MXS_FREE(table->filename);
     }
@@ -401,6 +404,34 @@ static void rotate_to_file(AVRO_INSTANCE* router, uint64_t pos, const char *next
     router->current_pos = 4;
 }
 
+/**
+ * @brief Read from the binlog file being converted
+ *
+ * Complete binlog files are read from a memory mapping of the file, the
+ * one being written is read with pread. Compressed files are decompressed
+ * a block at a time.
+ *
+ * @param router Avro router instance
+ * @param buf Where the bytes are copied to
+ * @param len How many bytes to read
+ * @param pos Position in the binlog file
+ * @return The number of bytes read, or -1 on error
+ */
+static int read_binlog(AVRO_INSTANCE *router, void *buf, uint32_t len, uint64_t pos)
+{
+    if (router->binlog_zfile)
+    {
+        return binlog_zfile_pread(router->binlog_zfile, buf, len, pos);
+    }
+
+    if (router->binlog_mapped)
+    {
+        return binlog_map_pread(&router->binlog_map, buf, len, pos, 0);
+    }
+
+    return pread(router->binlog_fd, buf, len, pos);
+}
+
 /**
  * @brief Read the replication event payload
  *
@@ -416,8 +447,8 @@ static GWBUF* read_event_data(AVRO_INSTANCE *router, REP_HEADER* hdr, uint64_t p
     if ((result = gwbuf_alloc(hdr->event_size - BINLOG_EVENT_HDR_LEN + 1)))
     {
         uint8_t *data = GWBUF_DATA(result);
-        int n = pread(router->binlog_fd, data, hdr->event_size - BINLOG_EVENT_HDR_LEN,
-                      pos + BINLOG_EVENT_HDR_LEN);
+        int n = read_binlog(router, data, hdr->event_size - BINLOG_EVENT_HDR_LEN,
+                            pos + BINLOG_EVENT_HDR_LEN);
         /** NULL-terminate for QUERY_EVENT processing */
         data[hdr->event_size - BINLOG_EVENT_HDR_LEN] = '\0';
 
@@ -478,8 +509,10 @@ void notify_all_clients(AVRO_INSTANCE *router)
 
 void do_checkpoint(AVRO_INSTANCE *router, uint64_t *total_rows, uint64_t *total_commits)
 {
+    avro_converter_wait(router);
     update_used_tables(router);
     avro_flush_all_tables(router, AVROROUTER_FLUSH);
+    router->last_checkpoint = hkheartbeat;
     avro_save_conversion_state(router);
     notify_all_clients(router);
     *total_rows += router->row_count;
@@ -487,6 +520,30 @@ void do_checkpoint(AVRO_INSTANCE *router, uint64_t *total_rows, uint64_t *total_
     router->row_count = router->trx_count = 0;
 }
 
+/**
+ * @brief Check whether the converted rows should be flushed
+ *
+ * With flush_latency, the rows are flushed once the oldest ones have waited
+ * for that long. Under a high load the blocks then grow as large as the
+ * block size allows, and under a low load few rows are flushed at a time
+ * so that the clients see them soon. Otherwise the rows are flushed after
+ * group_trx transactions or group_rows row events.
+ *
+ * @param router Avro router instance
+ * @return True if a checkpoint should be done
+ */
+static bool checkpoint_is_due(AVRO_INSTANCE *router)
+{
+    if (router->flush_latency > 0)
+    {
+        long latency = (router->flush_latency + 99) / 100;
+        return router->row_count > 0 && hkheartbeat - router->last_checkpoint >= latency;
+    }
+
+    return router->row_count >= router->row_target ||
+           router->trx_count >= router->trx_target;
+}
+
 /**
  * @brief Read all replication events from a binlog file.
  *
@@ -522,7 +579,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
     {
         int n;
         /* Read the header information from the file */
-        if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if ((n = read_binlog(router, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
         {
             switch (n)
             {
@@ -724,6 +781,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             router->gtid.seq = n_sequence;
             router->gtid.event_num = 0;
             router->gtid.timestamp = hdr.timestamp;
+            avro_converter_end_trx(router);
 
             /* GTID event flags check, for 10.0 and 10.1 */
             if ((flags & (MARIADB_FL_DDL | MARIADB_FL_STANDALONE)) == 0)
@@ -753,8 +811,7 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
             router->trx_count++;
             pending_transaction = 0;
 
-            if (router->row_count >= router->row_target ||
-                router->trx_count >= router->trx_target)
+            if (checkpoint_is_due(router))
             {
                 do_checkpoint(router, &total_rows, &total_commits);
             }
@@ -861,6 +918,29 @@ void avro_load_metadata_from_schemas(AVRO_INSTANCE *router)
     globfree(&files);
 }
 
+/**
+ * @brief Update the statistics of a table after it has been flushed
+ *
+ * @param table The flushed table
+ */
+static void table_flushed(AVRO_TABLE *table)
+{
+    long now = hkheartbeat;
+
+    table->flush_latency = now - table->first_unflushed;
+    table->max_flush_latency = MXS_MAX(table->max_flush_latency, table->flush_latency);
+    table->rate_rows += table->unflushed_rows;
+    table->unflushed_rows = 0;
+
+    /** The rate is sampled over at least a second */
+    if (now - table->rate_start >= 10)
+    {
+        table->rows_per_sec = table->rate_rows * 10.0 / (now - table->rate_start);
+        table->rate_rows = 0;
+        table->rate_start = now;
+    }
+}
+
 /**
  * @brief Flush all Avro records to disk
  * @param router Avro router instance
@@ -880,7 +960,12 @@ void avro_flush_all_tables(AVRO_INSTANCE *router, enum avrorouter_file_op flush)
             {
                 if (flush == AVROROUTER_FLUSH)
                 {
-                    avro_file_writer_flush(table->avro_file);
+                    /** Tables without new records have nothing to flush */
+                    if (table->unflushed_rows > 0)
+                    {
+                        avro_file_writer_flush(table->avro_file);
+                        table_flushed(table);
+                    }
                 }
                 else
                 {
@@ -891,6 +976,9 @@ void avro_flush_all_tables(AVRO_INSTANCE *router, enum avrorouter_file_op flush)
         }
         hashtable_iterator_free(iter);
     }
+
+    /** Serve the delivery reports of the published records */
+    avro_kafka_poll(router->kafka);
 }
 
 /**
@@ -1030,7 +1118,16 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
     sql = tmp;
     len = tmpsz;
 
-    if (is_create_table_statement(router, sql, len))
+    bool is_create = is_create_table_statement(router, sql, len);
+    bool is_alter = !is_create && is_alter_table_statement(router, sql, len);
+
+    if (is_create || is_alter)
+    {
+        /** The conversion threads use the table creations */
+        avro_converter_wait(router);
+    }
+
+    if (is_create)
     {
         TABLE_CREATE *created = NULL;
 
@@ -1048,7 +1145,7 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
             MXS_ERROR("Failed to save statement to disk: %.*s", len, sql);
         }
     }
-    else if (is_alter_table_statement(router, sql, len))
+    else if (is_alter)
     {
         char ident[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 2];
         read_alter_identifier(sql, sql + len, ident, sizeof(ident));
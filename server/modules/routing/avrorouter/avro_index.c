@@ -39,8 +39,14 @@
 
 void* safe_key_free(void *data);
 
-static const char insert_template[] = "INSERT INTO gtid(domain, server_id, "
-                                      "sequence, avrofile, position) values (%lu, %lu, %lu, \"%s\", %ld);";
+static const char gtid_insert_sql[] = "INSERT INTO "GTID_TABLE_NAME"(domain, server_id, "
+                                      "sequence, avrofile, position) VALUES (?, ?, ?, ?, ?);";
+
+static const char progress_select_sql[] = "SELECT max(position) FROM "INDEX_TABLE_NAME
+                                          " WHERE filename = ?;";
+
+static const char progress_update_sql[] = "INSERT OR REPLACE INTO "INDEX_TABLE_NAME
+                                          " VALUES (?, ?);";
 
 static void set_gtid(gtid_pos_t *gtid, json_t *row)
 {
@@ -57,19 +63,81 @@ static void set_gtid(gtid_pos_t *gtid, json_t *row)
     gtid->domain = json_integer_value(obj);
 }
 
-int index_query_cb(void *data, int rows, char** values, char** names)
+/**
+ * @brief Get a prepared statement, preparing it on first use
+ *
+ * The statement is kept by the caller and reused, so the SQL is parsed only
+ * once per database handle. A statement that was used before is reset and
+ * its parameters are cleared.
+ *
+ * @param handle SQLite handle
+ * @param stmt   Where the statement is kept
+ * @param sql    The SQL of the statement
+ * @return True if the statement is ready to be bound and executed
+ */
+bool avro_prepare_stmt(sqlite3 *handle, sqlite3_stmt **stmt, const char *sql)
+{
+    if (*stmt)
+    {
+        sqlite3_reset(*stmt);
+        sqlite3_clear_bindings(*stmt);
+    }
+    else if (sqlite3_prepare_v2(handle, sql, -1, stmt, NULL) != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to prepare statement '%s': %s", sql, sqlite3_errmsg(handle));
+        sqlite3_finalize(*stmt);
+        *stmt = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read the position up to which a file has been indexed
+ *
+ * @param router Avro router instance
+ * @param name   Name of the file
+ * @param pos    The position is stored here, -1 if the file has not been indexed
+ * @return True if the position was read
+ */
+static bool get_indexed_pos(AVRO_INSTANCE *router, const char *name, long *pos)
 {
-    for (int i = 0; i < rows; i++)
+    sqlite3_stmt *stmt;
+    bool rval = false;
+
+    if (avro_prepare_stmt(router->sqlite_handle, &router->progress_select_stmt, progress_select_sql))
     {
-        if (values[i])
+        stmt = router->progress_select_stmt;
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        int rc = sqlite3_step(stmt);
+
+        if (rc == SQLITE_ROW || rc == SQLITE_DONE)
+        {
+            *pos = rc == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL ?
+                   sqlite3_column_int64(stmt, 0) : -1;
+            rval = true;
+        }
+        else
         {
-            *((long*)data) = strtol(values[i], NULL, 10);
-            return 0;
+            MXS_ERROR("Failed to read last indexed position of file '%s': %s",
+                      name, sqlite3_errmsg(router->sqlite_handle));
         }
+
+        sqlite3_reset(stmt);
     }
-    return 0;
+
+    return rval;
 }
 
+/**
+ * @brief Index the GTIDs of one file
+ *
+ * The caller is responsible for the transaction the rows are inserted in.
+ *
+ * @param router   Avro router instance
+ * @param filename Path to the file
+ */
 void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 {
     MAXAVRO_FILE *file = maxavro_file_open(filename);
@@ -81,19 +149,11 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 
         if (name)
         {
-            char sql[AVRO_SQL_BUFFER_SIZE];
-            char *errmsg;
             long pos = -1;
             name++;
 
-            snprintf(sql, sizeof(sql), "SELECT position FROM "INDEX_TABLE_NAME
-                     " WHERE filename=\"%s\";", name);
-
-            if (sqlite3_exec(router->sqlite_handle, sql, index_query_cb, &pos, &errmsg) != SQLITE_OK)
+            if (!get_indexed_pos(router, name, &pos))
             {
-                MXS_ERROR("Failed to read last indexed position of file '%s': %s",
-                          name, errmsg);
-                sqlite3_free(errmsg);
                 maxavro_file_close(file);
                 return;
             }
@@ -107,12 +167,6 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 
             gtid_pos_t prev_gtid = {0, 0, 0, 0, 0};
 
-            if (sqlite3_exec(router->sqlite_handle, "BEGIN", NULL, NULL, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to start transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
-
             do
             {
                 json_t *row = maxavro_record_read_json(file);
@@ -122,22 +176,28 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
                     gtid_pos_t gtid;
                     set_gtid(&gtid, row);
 
-                    if (prev_gtid.domain != gtid.domain ||
-                        prev_gtid.server_id != gtid.server_id ||
-                        prev_gtid.seq != gtid.seq)
+                    if ((prev_gtid.domain != gtid.domain ||
+                         prev_gtid.server_id != gtid.server_id ||
+                         prev_gtid.seq != gtid.seq) &&
+                        avro_prepare_stmt(router->sqlite_handle, &router->gtid_insert_stmt,
+                                          gtid_insert_sql))
                     {
-                        snprintf(sql, sizeof(sql), insert_template, gtid.domain,
-                                 gtid.server_id, gtid.seq, name, file->block_start_pos);
-                        if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                                         &errmsg) != SQLITE_OK)
+                        sqlite3_stmt *stmt = router->gtid_insert_stmt;
+                        sqlite3_bind_int64(stmt, 1, gtid.domain);
+                        sqlite3_bind_int64(stmt, 2, gtid.server_id);
+                        sqlite3_bind_int64(stmt, 3, gtid.seq);
+                        sqlite3_bind_text(stmt, 4, name, -1, SQLITE_STATIC);
+                        sqlite3_bind_int64(stmt, 5, file->block_start_pos);
+
+                        if (sqlite3_step(stmt) != SQLITE_DONE)
                         {
                             MXS_ERROR("Failed to insert GTID %lu-%lu-%lu for %s "
                                       "into index database: %s", gtid.domain,
-                                      gtid.server_id, gtid.seq, name, errmsg);
-
+                                      gtid.server_id, gtid.seq, name,
+                                      sqlite3_errmsg(router->sqlite_handle));
                         }
-                        sqlite3_free(errmsg);
-                        errmsg = NULL;
+
+                        sqlite3_reset(stmt);
                         prev_gtid = gtid;
                     }
                     json_decref(row);
@@ -149,21 +209,21 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
             }
             while (maxavro_next_block(file));
 
-            if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
+            if (avro_prepare_stmt(router->sqlite_handle, &router->progress_update_stmt,
+                                  progress_update_sql))
             {
-                MXS_ERROR("Failed to commit transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
+                sqlite3_stmt *stmt = router->progress_update_stmt;
+                sqlite3_bind_int64(stmt, 1, file->block_start_pos);
+                sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
 
-            snprintf(sql, sizeof(sql), "INSERT OR REPLACE INTO "INDEX_TABLE_NAME
-                     " values (%lu, \"%s\");", file->block_start_pos, name);
-            if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                             &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to update indexing progress: %s", errmsg);
+                if (sqlite3_step(stmt) != SQLITE_DONE)
+                {
+                    MXS_ERROR("Failed to update indexing progress: %s",
+                              sqlite3_errmsg(router->sqlite_handle));
+                }
+
+                sqlite3_reset(stmt);
             }
-            sqlite3_free(errmsg);
-            errmsg = NULL;
         }
         else
         {
@@ -183,7 +243,7 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
  *
  * Builds an index of filenames, GTIDs and positions in the Avro file.
  * This allows all tables that contain a GTID to be fetched in an effiecent
- * manner.
+ * manner. All files are indexed in one transaction.
  * @param data The router instance
  */
 void avro_update_index(AVRO_INSTANCE* router)
@@ -194,10 +254,25 @@ void avro_update_index(AVRO_INSTANCE* router)
 
     if (glob(path, 0, NULL, &files) != GLOB_NOMATCH)
     {
+        char *errmsg = NULL;
+
+        if (sqlite3_exec(router->sqlite_handle, "BEGIN", NULL, NULL, &errmsg) != SQLITE_OK)
+        {
+            MXS_ERROR("Failed to start transaction: %s", errmsg);
+        }
+        sqlite3_free(errmsg);
+        errmsg = NULL;
+
         for (int i = 0; i < files.gl_pathc; i++)
         {
             avro_index_file(router, files.gl_pathv[i]);
         }
+
+        if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
+        {
+            MXS_ERROR("Failed to commit transaction: %s", errmsg);
+        }
+        sqlite3_free(errmsg);
     }
 
     globfree(&files);
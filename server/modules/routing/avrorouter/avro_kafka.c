@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_kafka.c - Publishing of the converted rows to Kafka
+ *
+ * Each row that is written to the Avro file of a table is also published as
+ * a JSON object to the Kafka topic of the table. The JSON is the same that the
+ * CDC protocol sends to the clients. The key of a message is the GTID of its
+ * transaction, so that the rows of a transaction go to the same partition.
+ *
+ * The messages are batched and delivered asynchronously by librdkafka. When its
+ * queue is full, the conversion waits until there is room in it. The delivery
+ * reports are served whenever the tables are flushed and the rows that are not
+ * yet delivered are waited for before the conversion pauses at the end of the
+ * binlogs.
+ */
+
+#include "avrorouter.h"
+
+#include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/log_manager.h>
+#include <jansson.h>
+
+#ifdef HAVE_RDKAFKA
+#include <librdkafka/rdkafka.h>
+#endif
+
+/** How long a full queue is polled at a time, in milliseconds */
+#define AVRO_KAFKA_POLL_MS     100
+
+/** How long the undelivered rows are waited for, in milliseconds */
+#define AVRO_KAFKA_FLUSH_MS    10000
+
+struct avro_kafka
+{
+#ifdef HAVE_RDKAFKA
+    rd_kafka_t *rk;             /*< The producer */
+#endif
+    char       *service;        /*< Name of the service, for logging */
+    char       *topic_prefix;   /*< Prefix of the topic names */
+    uint64_t    n_produced;     /*< Rows handed to the producer */
+    uint64_t    n_delivered;    /*< Rows delivered to the brokers */
+    uint64_t    n_failed;       /*< Rows that could not be delivered */
+};
+
+struct avro_kafka_topic
+{
+    AVRO_KAFKA *kafka;          /*< The producer of the topic */
+#ifdef HAVE_RDKAFKA
+    rd_kafka_topic_t *rkt;      /*< The topic */
+#endif
+};
+
+#ifdef HAVE_RDKAFKA
+
+/**
+ * @brief Convert a record to the JSON sent to CDC clients
+ *
+ * @param record The record
+ * @return The JSON object or NULL if memory allocation failed
+ */
+static json_t* record_to_json(avro_value_t *record)
+{
+    json_t *obj = json_object();
+    size_t n_fields = 0;
+
+    if (obj == NULL)
+    {
+        return NULL;
+    }
+
+    avro_value_get_size(record, &n_fields);
+
+    for (size_t i = 0; i < n_fields; i++)
+    {
+        avro_value_t field;
+        const char *name;
+        json_t *value = NULL;
+
+        avro_value_get_by_index(record, i, &field, &name);
+
+        switch (avro_value_get_type(&field))
+        {
+        case AVRO_INT:
+            {
+                int32_t v;
+                avro_value_get_int(&field, &v);
+                value = json_integer(v);
+            }
+            break;
+
+        case AVRO_LONG:
+            {
+                int64_t v;
+                avro_value_get_long(&field, &v);
+                value = json_integer(v);
+            }
+            break;
+
+        case AVRO_FLOAT:
+            {
+                float v;
+                avro_value_get_float(&field, &v);
+                value = json_real(v);
+            }
+            break;
+
+        case AVRO_DOUBLE:
+            {
+                double v;
+                avro_value_get_double(&field, &v);
+                value = json_real(v);
+            }
+            break;
+
+        case AVRO_BOOLEAN:
+            {
+                int v;
+                avro_value_get_boolean(&field, &v);
+                value = json_boolean(v);
+            }
+            break;
+
+        case AVRO_STRING:
+            {
+                const char *v;
+                size_t size;
+                avro_value_get_string(&field, &v, &size);
+                value = json_string(v);
+            }
+            break;
+
+        case AVRO_BYTES:
+            {
+                const void *v;
+                size_t size;
+                avro_value_get_bytes(&field, &v, &size);
+                value = json_stringn((const char*)v, size);
+            }
+            break;
+
+        case AVRO_ENUM:
+            {
+                int v;
+                avro_value_get_enum(&field, &v);
+                value = json_string(avro_schema_enum_get(avro_value_get_schema(&field), v));
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        json_object_set_new(obj, name, value ? value : json_null());
+    }
+
+    return obj;
+}
+
+/**
+ * @brief The delivery report callback of librdkafka
+ */
+static void delivery_cb(rd_kafka_t *rk, const rd_kafka_message_t *msg, void *opaque)
+{
+    AVRO_KAFKA *kafka = (AVRO_KAFKA*)opaque;
+
+    if (msg->err)
+    {
+        if (atomic_add_uint64(&kafka->n_failed, 1) == 0)
+        {
+            /** Only the first failure is logged, the rest are counted */
+            MXS_ERROR("[%s] Failed to publish a row to Kafka topic '%s': %s",
+                      kafka->service, rd_kafka_topic_name(msg->rkt), rd_kafka_err2str(msg->err));
+        }
+    }
+    else
+    {
+        atomic_add_uint64(&kafka->n_delivered, 1);
+    }
+}
+
+/**
+ * @brief Set a configuration value of the producer
+ */
+static bool set_conf(AVRO_KAFKA *kafka, rd_kafka_conf_t *conf, const char *name, const char *value)
+{
+    char errstr[512];
+
+    if (rd_kafka_conf_set(conf, name, value, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)
+    {
+        MXS_ERROR("[%s] Failed to set Kafka parameter '%s' to '%s': %s",
+                  kafka->service, name, value, errstr);
+        return false;
+    }
+
+    return true;
+}
+
+AVRO_KAFKA* avro_kafka_alloc(const char *service, const char *brokers, const char *topic_prefix,
+                             int linger_ms)
+{
+    AVRO_KAFKA *kafka = MXS_CALLOC(1, sizeof(AVRO_KAFKA));
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    char linger[32];
+    char errstr[512];
+
+    if (kafka == NULL || conf == NULL ||
+        (kafka->service = MXS_STRDUP(service)) == NULL ||
+        (kafka->topic_prefix = MXS_STRDUP(topic_prefix)) == NULL)
+    {
+        goto error;
+    }
+
+    snprintf(linger, sizeof(linger), "%d", linger_ms);
+
+    if (!set_conf(kafka, conf, "bootstrap.servers", brokers) ||
+        !set_conf(kafka, conf, "queue.buffering.max.ms", linger))
+    {
+        goto error;
+    }
+
+    rd_kafka_conf_set_dr_msg_cb(conf, delivery_cb);
+    rd_kafka_conf_set_opaque(conf, kafka);
+
+    /** The producer owns the configuration once it has been created */
+    if ((kafka->rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr))) == NULL)
+    {
+        MXS_ERROR("[%s] Failed to create Kafka producer: %s", service, errstr);
+        goto error;
+    }
+
+    MXS_NOTICE("[%s] Publishing the rows to Kafka at %s.", service, brokers);
+    return kafka;
+
+error:
+    if (conf)
+    {
+        rd_kafka_conf_destroy(conf);
+    }
+
+    if (kafka)
+    {
+        MXS_FREE(kafka->service);
+        MXS_FREE(kafka->topic_prefix);
+        MXS_FREE(kafka);
+    }
+
+    return NULL;
+}
+
+void avro_kafka_free(AVRO_KAFKA *kafka)
+{
+    if (kafka)
+    {
+        avro_kafka_flush(kafka);
+        rd_kafka_destroy(kafka->rk);
+        MXS_FREE(kafka->service);
+        MXS_FREE(kafka->topic_prefix);
+        MXS_FREE(kafka);
+    }
+}
+
+AVRO_KAFKA_TOPIC* avro_kafka_topic_alloc(AVRO_KAFKA *kafka, const char *table)
+{
+    AVRO_KAFKA_TOPIC *topic = NULL;
+
+    if (kafka && (topic = MXS_MALLOC(sizeof(AVRO_KAFKA_TOPIC))))
+    {
+        char name[strlen(kafka->topic_prefix) + strlen(table) + 1];
+        sprintf(name, "%s%s", kafka->topic_prefix, table);
+
+        topic->kafka = kafka;
+
+        if ((topic->rkt = rd_kafka_topic_new(kafka->rk, name, NULL)) == NULL)
+        {
+            MXS_ERROR("[%s] Failed to create Kafka topic '%s': %s", kafka->service, name,
+                      rd_kafka_err2str(rd_kafka_last_error()));
+            MXS_FREE(topic);
+            topic = NULL;
+        }
+    }
+
+    return topic;
+}
+
+void avro_kafka_topic_free(AVRO_KAFKA_TOPIC *topic)
+{
+    if (topic)
+    {
+        rd_kafka_topic_destroy(topic->rkt);
+        MXS_FREE(topic);
+    }
+}
+
+void avro_kafka_produce(AVRO_KAFKA_TOPIC *topic, avro_value_t *record, const gtid_pos_t *gtid)
+{
+    AVRO_KAFKA *kafka = topic->kafka;
+    json_t *obj = record_to_json(record);
+    char *json = obj ? json_dumps(obj, JSON_PRESERVE_ORDER) : NULL;
+    json_decref(obj);
+
+    if (json == NULL)
+    {
+        MXS_ERROR("[%s] Failed to convert a row to JSON.", kafka->service);
+        atomic_add_uint64(&kafka->n_failed, 1);
+        return;
+    }
+
+    char key[64];
+    int keylen = snprintf(key, sizeof(key), "%lu-%lu-%lu", gtid->domain, gtid->server_id, gtid->seq);
+
+    /** The producer frees the JSON once the row has been delivered */
+    while (rd_kafka_produce(topic->rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_FREE,
+                            json, strlen(json), key, keylen, NULL) == -1)
+    {
+        rd_kafka_resp_err_t err = rd_kafka_last_error();
+
+        if (err != RD_KAFKA_RESP_ERR__QUEUE_FULL)
+        {
+            MXS_ERROR("[%s] Failed to publish a row to Kafka topic '%s': %s",
+                      kafka->service, rd_kafka_topic_name(topic->rkt), rd_kafka_err2str(err));
+            atomic_add_uint64(&kafka->n_failed, 1);
+            free(json);
+            return;
+        }
+
+        /** The conversion waits for the deliveries to catch up */
+        rd_kafka_poll(kafka->rk, AVRO_KAFKA_POLL_MS);
+    }
+
+    atomic_add_uint64(&kafka->n_produced, 1);
+}
+
+void avro_kafka_poll(AVRO_KAFKA *kafka)
+{
+    if (kafka)
+    {
+        rd_kafka_poll(kafka->rk, 0);
+    }
+}
+
+void avro_kafka_flush(AVRO_KAFKA *kafka)
+{
+    if (kafka && rd_kafka_flush(kafka->rk, AVRO_KAFKA_FLUSH_MS) != RD_KAFKA_RESP_ERR_NO_ERROR)
+    {
+        MXS_WARNING("[%s] %d rows were not delivered to Kafka in %d seconds.",
+                    kafka->service, rd_kafka_outq_len(kafka->rk), AVRO_KAFKA_FLUSH_MS / 1000);
+    }
+}
+
+#else
+
+AVRO_KAFKA* avro_kafka_alloc(const char *service, const char *brokers, const char *topic_prefix,
+                             int linger_ms)
+{
+    MXS_ERROR("[%s] Cannot publish the rows to Kafka, avrorouter was built without librdkafka.",
+              service);
+    return NULL;
+}
+
+void avro_kafka_free(AVRO_KAFKA *kafka)
+{
+}
+
+AVRO_KAFKA_TOPIC* avro_kafka_topic_alloc(AVRO_KAFKA *kafka, const char *table)
+{
+    return NULL;
+}
+
+void avro_kafka_topic_free(AVRO_KAFKA_TOPIC *topic)
+{
+}
+
+void avro_kafka_produce(AVRO_KAFKA_TOPIC *topic, avro_value_t *record, const gtid_pos_t *gtid)
+{
+}
+
+void avro_kafka_poll(AVRO_KAFKA *kafka)
+{
+}
+
+void avro_kafka_flush(AVRO_KAFKA *kafka)
+{
+}
+
+#endif
+
+void avro_kafka_diagnostics(AVRO_KAFKA *kafka, DCB *dcb)
+{
+    if (kafka)
+    {
+        dcb_printf(dcb, "\tKafka rows published:                %lu\n",
+                   atomic_load_uint64(&kafka->n_produced));
+        dcb_printf(dcb, "\tKafka rows delivered:                %lu\n",
+                   atomic_load_uint64(&kafka->n_delivered));
+        dcb_printf(dcb, "\tKafka rows failed:                   %lu\n",
+                   atomic_load_uint64(&kafka->n_failed));
+    }
+}
@@ -16,6 +16,8 @@
 #include <maxscale/mysql_utils.h>
 #include <jansson.h>
 #include <maxscale/alloc.h>
+#include <maxscale/atomic.h>
+#include <maxscale/hk_heartbeat.h>
 #include <strings.h>
 
 #define WRITE_EVENT         0
@@ -91,6 +93,9 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
 
         if (old == NULL || old->version != create->version)
         {
+            /** The conversion threads use the table that is replaced */
+            avro_converter_wait(router);
+
             TABLE_MAP *map = table_map_alloc(ptr, ev_len, create);
 
             if (map)
@@ -103,13 +108,17 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
                     snprintf(filepath, sizeof(filepath), "%s/%s.%06d.avro",
                              router->avrodir, table_ident, map->version);
 
-                    /** Close the file and open a new one */
+                    /** Close the file and open a new one. The lock keeps the
+                     * diagnostics from reading the table that is closed. */
+                    spinlock_acquire(&router->lock);
                     hashtable_delete(router->open_tables, table_ident);
+                    spinlock_release(&router->lock);
                     AVRO_TABLE *avro_table = avro_table_alloc(filepath, json_schema, router->block_size);
 
                     if (avro_table)
                     {
                         bool notify = old != NULL;
+                        avro_table->kafka_topic = avro_kafka_topic_alloc(router->kafka, table_ident);
 
                         if (old)
                         {
@@ -117,7 +126,9 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
                         }
                         hashtable_delete(router->table_maps, table_ident);
                         hashtable_add(router->table_maps, (void*) table_ident, map);
+                        spinlock_acquire(&router->lock);
                         hashtable_add(router->open_tables, table_ident, avro_table);
+                        spinlock_release(&router->lock);
                         save_avro_schema(router->avrodir, json_schema, map);
                         router->active_maps[map->id % MAX_MAPPED_TABLES] = map;
                         MXS_DEBUG("Table %s mapped to %lu", table_ident, map->id);
@@ -175,27 +186,27 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
  * This sets the domain, server ID, sequence and event position fields of
  * the GTID. It also sets the event timestamp and event type fields.
  *
- * @param router Avro router instance
+ * @param gtid GTID of the event, the subsequence counter is increased
  * @param hdr Replication header
  * @param event_type Event type
  * @param record Record to prepare
  */
-static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
+static void prepare_record(gtid_pos_t *gtid, REP_HEADER *hdr,
                            int event_type, avro_value_t *record)
 {
     avro_value_t field;
     avro_value_get_by_name(record, avro_domain, &field, NULL);
-    avro_value_set_int(&field, router->gtid.domain);
+    avro_value_set_int(&field, gtid->domain);
 
     avro_value_get_by_name(record, avro_server_id, &field, NULL);
-    avro_value_set_int(&field, router->gtid.server_id);
+    avro_value_set_int(&field, gtid->server_id);
 
     avro_value_get_by_name(record, avro_sequence, &field, NULL);
-    avro_value_set_int(&field, router->gtid.seq);
+    avro_value_set_int(&field, gtid->seq);
 
-    router->gtid.event_num++;
+    gtid->event_num++;
     avro_value_get_by_name(record, avro_event_number, &field, NULL);
-    avro_value_set_int(&field, router->gtid.event_num);
+    avro_value_set_int(&field, gtid->event_num);
 
     avro_value_get_by_name(record, avro_timestamp, &field, NULL);
     avro_value_set_int(&field, hdr->timestamp);
@@ -204,6 +215,147 @@ static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
     avro_value_set_enum(&field, event_type);
 }
 
+/**
+ * @brief Write the rows of a row event into the Avro file of the table
+ *
+ * @param table The table the rows are written to
+ * @param map Table map of the event
+ * @param create Table creation of the table
+ * @param gtid GTID of the event, the subsequence counter is increased per record
+ * @param hdr Replication header
+ * @param start Pointer to the start of the event
+ * @param ptr Pointer to the first row
+ * @param col_present The bitfield holding the columns that are present
+ * @param pos Binlog position of the event
+ */
+static void write_rows(AVRO_TABLE *table, TABLE_MAP *map, TABLE_CREATE *create,
+                       gtid_pos_t *gtid, REP_HEADER *hdr, uint8_t *start, uint8_t *ptr,
+                       uint8_t *col_present, uint64_t pos)
+{
+    uint64_t records = 0;
+    avro_value_t record;
+    avro_generic_value_new(table->avro_writer_iface, &record);
+
+    /** Each event has one or more rows in it. The number of rows is not known
+     * beforehand so we must continue processing them until we reach the end
+     * of the event. */
+    MXS_INFO("Row Event for '%s.%s' at %lu", map->database, map->table, pos);
+
+    while (ptr - start < hdr->event_size - BINLOG_EVENT_HDR_LEN)
+    {
+        static uint64_t total_row_count = 1;
+        MXS_INFO("Row %lu", total_row_count++);
+
+        /** Add the current GTID and timestamp */
+        uint8_t *end = ptr + hdr->event_size - BINLOG_EVENT_HDR_LEN;
+        int event_type = get_event_type(hdr->event_type);
+        prepare_record(gtid, hdr, event_type, &record);
+        ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
+        if (avro_file_writer_append_value(table->avro_file, &record))
+        {
+            MXS_ERROR("Failed to write value at position %ld: %s",
+                      pos, avro_strerror());
+        }
+        else if (table->kafka_topic)
+        {
+            avro_kafka_produce(table->kafka_topic, &record, gtid);
+        }
+        records++;
+
+        /** Update rows events have the before and after images of the
+         * affected rows so we'll process them as another record with
+         * a different type */
+        if (event_type == UPDATE_EVENT)
+        {
+            prepare_record(gtid, hdr, UPDATE_EVENT_AFTER, &record);
+            ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
+            if (avro_file_writer_append_value(table->avro_file, &record))
+            {
+                MXS_ERROR("Failed to write value at position %ld: %s",
+                          pos, avro_strerror());
+            }
+            else if (table->kafka_topic)
+            {
+                avro_kafka_produce(table->kafka_topic, &record, gtid);
+            }
+            records++;
+        }
+    }
+
+    if (table->unflushed_rows == 0)
+    {
+        table->first_unflushed = hkheartbeat;
+    }
+
+    table->unflushed_rows += records;
+    table->rows += records;
+    avro_value_decref(&record);
+}
+
+/**
+ * @brief Copy a row event for a conversion thread
+ *
+ * @param router Avro router instance
+ * @param hdr Replication header
+ * @param start Pointer to the start of the event
+ * @param ptr Pointer to the first row
+ * @param col_present The bitfield holding the columns that are present
+ * @param coldata_size Size of the bitfield
+ * @param table The table the rows are written to
+ * @param map Table map of the event
+ * @param create Table creation of the table
+ * @return The copied event
+ */
+static AVRO_ROW_JOB* row_job_alloc(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *start,
+                                   uint8_t *ptr, uint8_t *col_present, int coldata_size,
+                                   AVRO_TABLE *table, TABLE_MAP *map, TABLE_CREATE *create)
+{
+    size_t len = hdr->event_size - BINLOG_EVENT_HDR_LEN;
+    AVRO_ROW_JOB *job = MXS_CALLOC(1, sizeof(AVRO_ROW_JOB));
+    MXS_ABORT_IF_NULL(job);
+    job->data = MXS_MALLOC(len + coldata_size);
+    MXS_ABORT_IF_NULL(job->data);
+
+    memcpy(job->data, start, len);
+    job->col_present = job->data + len;
+    memcpy(job->col_present, col_present, coldata_size);
+    job->rows_offset = ptr - start;
+    job->table = table;
+    job->map = map;
+    job->create = create;
+    job->hdr = *hdr;
+    job->gtid = router->gtid;
+    job->pos = router->current_pos;
+
+    return job;
+}
+
+/**
+ * @brief Convert a row event copied for a conversion thread
+ *
+ * @param job The row event, job->gtid.event_num must be that of the
+ * last row of the previous row event of the transaction
+ */
+void avro_row_job_convert(AVRO_ROW_JOB *job)
+{
+    write_rows(job->table, job->map, job->create, &job->gtid, &job->hdr, job->data,
+               job->data + job->rows_offset, job->col_present, job->pos);
+}
+
+/**
+ * @brief Release a reference to a copied row event
+ *
+ * @param job The row event, freed when the last reference is released
+ */
+void avro_row_job_release(AVRO_ROW_JOB *job)
+{
+    if (atomic_add(&job->refcount, -1) == 1)
+    {
+        MXS_FREE(job->data);
+        MXS_FREE(job);
+    }
+}
+
 /**
  * @brief Handle a single RBR row event
  *
@@ -286,50 +438,19 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
 
         if (table && create && ncolumns == map->columns)
         {
-            avro_value_t record;
-            avro_generic_value_new(table->avro_writer_iface, &record);
-
-            /** Each event has one or more rows in it. The number of rows is not known
-             * beforehand so we must continue processing them until we reach the end
-             * of the event. */
-            int rows = 0;
-            MXS_INFO("Row Event for '%s' at %lu", table_ident, router->current_pos);
-
-            while (ptr - start < hdr->event_size - BINLOG_EVENT_HDR_LEN)
+            if (router->conversion_threads > 0)
             {
-                static uint64_t total_row_count = 1;
-                MXS_INFO("Row %lu", total_row_count++);
-
-                /** Add the current GTID and timestamp */
-                uint8_t *end = ptr + hdr->event_size - BINLOG_EVENT_HDR_LEN;
-                int event_type = get_event_type(hdr->event_type);
-                prepare_record(router, hdr, event_type, &record);
-                ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
-                if (avro_file_writer_append_value(table->avro_file, &record))
-                {
-                    MXS_ERROR("Failed to write value at position %ld: %s",
-                              router->current_pos, avro_strerror());
-                }
-
-                /** Update rows events have the before and after images of the
-                 * affected rows so we'll process them as another record with
-                 * a different type */
-                if (event_type == UPDATE_EVENT)
-                {
-                    prepare_record(router, hdr, UPDATE_EVENT_AFTER, &record);
-                    ptr = process_row_event_data(map, create, &record, ptr, col_present, end);
-                    if (avro_file_writer_append_value(table->avro_file, &record))
-                    {
-                        MXS_ERROR("Failed to write value at position %ld: %s",
-                                  router->current_pos, avro_strerror());
-                    }
-                }
-
-                rows++;
+                AVRO_ROW_JOB *job = row_job_alloc(router, hdr, start, ptr, col_present,
+                                                  coldata_size, table, map, create);
+                avro_converter_submit(router, table_ident, job);
+            }
+            else
+            {
+                write_rows(table, map, create, &router->gtid, hdr, start, ptr,
+                           col_present, router->current_pos);
             }
 
             add_used_table(router, table_ident);
-            avro_value_decref(&record);
             rval = true;
         }
         else if (table == NULL)
@@ -486,6 +607,270 @@ int get_metadata_len(uint8_t type)
     }
 }
 
+static uint8_t* decode_enum(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    uint8_t val[dec->metadata[1]];
+    uint64_t bytes = unpack_enum(ptr, dec->metadata, val);
+    char strval[32];
+
+    /** Right now only ENUMs/SETs with less than 256 values
+     * are printed correctly */
+    snprintf(strval, sizeof(strval), "%hhu", val[0]);
+    if (bytes > 1 && warn_large_enumset)
+    {
+        warn_large_enumset = true;
+        MXS_WARNING("ENUM/SET values larger than 255 values aren't supported.");
+    }
+    avro_value_set_string(field, strval);
+    MXS_INFO("[%lu] ENUM: %lu bytes", dec->column, bytes);
+    return ptr + bytes;
+}
+
+static uint8_t* decode_char(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    /**
+     * The first byte in the metadata stores the real type of
+     * the string (ENUM and SET types are also stored as fixed
+     * length strings).
+     *
+     * The first two bits of the second byte contain the XOR'ed
+     * field length but as that information is not relevant for
+     * us, we just use this information to know whether to read
+     * one or two bytes for string length.
+     */
+    uint16_t meta = dec->metadata[1] + (dec->metadata[0] << 8);
+    int bytes = 0;
+    uint16_t extra_length = (((meta >> 4) & 0x300) ^ 0x300);
+    uint16_t field_length = (meta & 0xff) + extra_length;
+
+    if (field_length > 255)
+    {
+        bytes = ptr[0] + (ptr[1] << 8);
+        ptr += 2;
+    }
+    else
+    {
+        bytes = *ptr++;
+    }
+
+    MXS_INFO("[%lu] CHAR: field: %d bytes, data: %d bytes", dec->column, field_length, bytes);
+    ss_dassert(bytes || *ptr == '\0');
+    char str[bytes + 1];
+    memcpy(str, ptr, bytes);
+    str[bytes] = '\0';
+    avro_value_set_string(field, str);
+    return ptr + bytes;
+}
+
+static uint8_t* decode_bit(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    uint64_t value = 0;
+    int width = dec->metadata[0] + dec->metadata[1] * 8;
+    int bits_in_nullmap = MXS_MIN(width, *extra_bits);
+    *extra_bits -= bits_in_nullmap;
+    width -= bits_in_nullmap;
+    size_t bytes = width / 8;
+
+    // TODO: extract the bytes
+    if (!warn_bit)
+    {
+        warn_bit = true;
+        MXS_WARNING("BIT is not currently supported, values are stored as 0.");
+    }
+    avro_value_set_int(field, value);
+    MXS_INFO("[%lu] BIT", dec->column);
+    return ptr + bytes;
+}
+
+static uint8_t* decode_decimal(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    double f_value = 0.0;
+    ptr += unpack_decimal_field(ptr, dec->metadata, &f_value);
+    avro_value_set_double(field, f_value);
+    MXS_INFO("[%lu] DOUBLE", dec->column);
+    return ptr;
+}
+
+static uint8_t* decode_varchar(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    size_t sz;
+    int bytes = dec->metadata[0] | dec->metadata[1] << 8;
+    if (bytes > 255)
+    {
+        sz = gw_mysql_get_byte2(ptr);
+        ptr += 2;
+    }
+    else
+    {
+        sz = *ptr;
+        ptr++;
+    }
+
+    MXS_INFO("[%lu] VARCHAR: field: %d bytes, data: %lu bytes", dec->column, bytes, sz);
+    char buf[sz + 1];
+    memcpy(buf, ptr, sz);
+    buf[sz] = '\0';
+    avro_value_set_string(field, buf);
+    return ptr + sz;
+}
+
+static uint8_t* decode_blob(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    uint8_t bytes = dec->metadata[0];
+    uint64_t len = 0;
+    memcpy(&len, ptr, bytes);
+    ptr += bytes;
+    MXS_INFO("[%lu] BLOB: field: %d bytes, data: %lu bytes", dec->column, bytes, len);
+    if (len)
+    {
+        avro_value_set_bytes(field, ptr, len);
+        ptr += len;
+    }
+    else
+    {
+        uint8_t nullvalue = 0;
+        avro_value_set_bytes(field, &nullvalue, 1);
+    }
+    return ptr;
+}
+
+static uint8_t* decode_temporal(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    char buf[80];
+    struct tm tm;
+    ptr += unpack_temporal_value(dec->type, ptr, dec->metadata, dec->length, &tm);
+    format_temporal_value(buf, sizeof(buf), dec->type, &tm);
+    avro_value_set_string(field, buf);
+    MXS_INFO("[%lu] TEMPORAL: %s", dec->column, buf);
+    return ptr;
+}
+
+/** Fixed size numeric types, the size of the value is resolved beforehand */
+static uint8_t* decode_fixed_numeric(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    uint8_t lval[16];
+    memset(lval, 0, sizeof(lval));
+    memcpy(lval, ptr, dec->fixed_size);
+    set_numeric_field_value(field, dec->type, dec->metadata, lval);
+    return ptr + dec->fixed_size;
+}
+
+/** Any other types, they are handled like numeric types */
+static uint8_t* decode_numeric(COLUMN_DECODER *dec, avro_value_t *field, uint8_t *ptr, int *extra_bits)
+{
+    uint8_t lval[16];
+    memset(lval, 0, sizeof(lval));
+    ptr += unpack_numeric_field(ptr, dec->type, dec->metadata, lval);
+    set_numeric_field_value(field, dec->type, dec->metadata, lval);
+    return ptr;
+}
+
+static size_t fixed_numeric_size(uint8_t type)
+{
+    switch (type)
+    {
+    case TABLE_COL_TYPE_TINY:
+        return 1;
+
+    case TABLE_COL_TYPE_SHORT:
+        return 2;
+
+    case TABLE_COL_TYPE_INT24:
+        return 3;
+
+    case TABLE_COL_TYPE_LONG:
+    case TABLE_COL_TYPE_FLOAT:
+        return 4;
+
+    case TABLE_COL_TYPE_LONGLONG:
+    case TABLE_COL_TYPE_DOUBLE:
+        return 8;
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Resolve how the columns of a table map are decoded
+ *
+ * The decoding function, the metadata and the Avro field of each column are
+ * the same for all rows of the table, so they are resolved once when the table
+ * is mapped instead of for each value of each row.
+ *
+ * @param map Table map with the column types and metadata
+ * @return True if the decoders were built, false if memory allocation failed
+ */
+bool table_map_build_decoders(TABLE_MAP *map)
+{
+    TABLE_CREATE *create = map->table_create;
+    uint64_t columns = MXS_MIN(map->columns, create->columns);
+    size_t metadata_offset = 0;
+
+    /** Allocate at least one decoder */
+    map->decoders = MXS_CALLOC(columns + 1, sizeof(COLUMN_DECODER));
+    map->num_decoders = 0;
+
+    if (map->decoders == NULL)
+    {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < columns; i++)
+    {
+        COLUMN_DECODER *dec = &map->decoders[i];
+        uint8_t type = map->column_types[i];
+
+        dec->type = type;
+        dec->metadata = &map->column_metadata[metadata_offset];
+        dec->column = i;
+        dec->field = AVRO_GENERATED_FIELDS + i;
+        dec->length = create->column_lengths[i];
+        dec->null_is_bytes = column_is_blob(type);
+
+        if (column_is_fixed_string(type))
+        {
+            /** ENUM and SET are stored as STRING types with the type stored
+             * in the metadata. */
+            dec->decode = fixed_string_is_enum(dec->metadata[0]) ? decode_enum : decode_char;
+        }
+        else if (column_is_bit(type))
+        {
+            dec->decode = decode_bit;
+        }
+        else if (column_is_decimal(type))
+        {
+            dec->decode = decode_decimal;
+        }
+        else if (column_is_variable_string(type))
+        {
+            dec->decode = decode_varchar;
+        }
+        else if (column_is_blob(type))
+        {
+            dec->decode = decode_blob;
+        }
+        else if (column_is_temporal(type))
+        {
+            dec->decode = decode_temporal;
+        }
+        else if ((dec->fixed_size = fixed_numeric_size(type)))
+        {
+            dec->decode = decode_fixed_numeric;
+        }
+        else
+        {
+            dec->decode = decode_numeric;
+        }
+
+        metadata_offset += get_metadata_len(type);
+        ss_dassert(metadata_offset <= map->column_metadata_size);
+    }
+
+    map->num_decoders = columns;
+    return true;
+}
+
 /**
  * @brief Extract the values from a single row  in a row event
  *
@@ -503,8 +888,6 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
     int npresent = 0;
     avro_value_t field;
     long ncolumns = map->columns;
-    uint8_t *metadata = map->column_metadata;
-    size_t metadata_offset = 0;
 
     /** BIT type values use the extra bits in the row event header */
     int extra_bits = (((ncolumns + 7) / 8) * 8) - ncolumns;
@@ -515,9 +898,10 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
     ptr += (ncolumns + 7) / 8;
     ss_dassert(ptr < end);
 
-    for (long i = 0; i < map->columns && i < create->columns && npresent < ncolumns; i++)
+    for (long i = 0; i < (long)map->num_decoders && i < (long)create->columns && npresent < ncolumns; i++)
     {
-        ss_debug(int rc = )avro_value_get_by_name(record, create->column_names[i], &field, NULL);
+        COLUMN_DECODER *dec = &map->decoders[i];
+        ss_debug(int rc = )avro_value_get_by_index(record, dec->field, &field, NULL);
         ss_dassert(rc == 0);
 
         if (bit_is_set(columns_present, ncolumns, i))
@@ -526,7 +910,7 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
             if (bit_is_set(null_bitmap, ncolumns, i))
             {
                 MXS_INFO("[%ld] NULL", i);
-                if (column_is_blob(map->column_types[i]))
+                if (dec->null_is_bytes)
                 {
                     uint8_t nullvalue = 0;
                     avro_value_set_bytes(&field, &nullvalue, 1);
@@ -536,161 +920,11 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                     avro_value_set_null(&field);
                 }
             }
-            else if (column_is_fixed_string(map->column_types[i]))
-            {
-                /** ENUM and SET are stored as STRING types with the type stored
-                 * in the metadata. */
-                if (fixed_string_is_enum(metadata[metadata_offset]))
-                {
-                    uint8_t val[metadata[metadata_offset + 1]];
-                    uint64_t bytes = unpack_enum(ptr, &metadata[metadata_offset], val);
-                    char strval[32];
-
-                    /** Right now only ENUMs/SETs with less than 256 values
-                     * are printed correctly */
-                    snprintf(strval, sizeof(strval), "%hhu", val[0]);
-                    if (bytes > 1 && warn_large_enumset)
-                    {
-                        warn_large_enumset = true;
-                        MXS_WARNING("ENUM/SET values larger than 255 values aren't supported.");
-                    }
-                    avro_value_set_string(&field, strval);
-                    MXS_INFO("[%ld] ENUM: %lu bytes", i, bytes);
-                    ptr += bytes;
-                    ss_dassert(ptr < end);
-                }
-                else
-                {
-                    /**
-                     * The first byte in the metadata stores the real type of
-                     * the string (ENUM and SET types are also stored as fixed
-                     * length strings).
-                     *
-                     * The first two bits of the second byte contain the XOR'ed
-                     * field length but as that information is not relevant for
-                     * us, we just use this information to know whether to read
-                     * one or two bytes for string length.
-                     */
-
-                    uint16_t meta = metadata[metadata_offset + 1] + (metadata[metadata_offset] << 8);
-                    int bytes = 0;
-                    uint16_t extra_length = (((meta >> 4) & 0x300) ^ 0x300);
-                    uint16_t field_length = (meta & 0xff) + extra_length;
-
-                    if (field_length > 255)
-                    {
-                        bytes = ptr[0] + (ptr[1] << 8);
-                        ptr += 2;
-                    }
-                    else
-                    {
-                        bytes = *ptr++;
-                    }
-
-                    MXS_INFO("[%ld] CHAR: field: %d bytes, data: %d bytes", i, field_length, bytes);
-                    ss_dassert(bytes || *ptr == '\0');
-                    char str[bytes + 1];
-                    memcpy(str, ptr, bytes);
-                    str[bytes] = '\0';
-                    avro_value_set_string(&field, str);
-                    ptr += bytes;
-                    ss_dassert(ptr < end);
-                }
-            }
-            else if (column_is_bit(map->column_types[i]))
-            {
-                uint64_t value = 0;
-                int width = metadata[metadata_offset] + metadata[metadata_offset + 1] * 8;
-                int bits_in_nullmap = MXS_MIN(width, extra_bits);
-                extra_bits -= bits_in_nullmap;
-                width -= bits_in_nullmap;
-                size_t bytes = width / 8;
-
-                // TODO: extract the bytes
-                if (!warn_bit)
-                {
-                    warn_bit = true;
-                    MXS_WARNING("BIT is not currently supported, values are stored as 0.");
-                }
-                avro_value_set_int(&field, value);
-                MXS_INFO("[%ld] BIT", i);
-                ptr += bytes;
-                ss_dassert(ptr < end);
-            }
-            else if (column_is_decimal(map->column_types[i]))
-            {
-                double f_value = 0.0;
-                ptr += unpack_decimal_field(ptr, metadata + metadata_offset, &f_value);
-                avro_value_set_double(&field, f_value);
-                MXS_INFO("[%ld] DOUBLE", i);
-                ss_dassert(ptr < end);
-            }
-            else if (column_is_variable_string(map->column_types[i]))
-            {
-                size_t sz;
-                int bytes = metadata[metadata_offset] | metadata[metadata_offset + 1] << 8;
-                if (bytes > 255)
-                {
-                    sz = gw_mysql_get_byte2(ptr);
-                    ptr += 2;
-                }
-                else
-                {
-                    sz = *ptr;
-                    ptr++;
-                }
-
-                MXS_INFO("[%ld] VARCHAR: field: %d bytes, data: %lu bytes", i, bytes, sz);
-                char buf[sz + 1];
-                memcpy(buf, ptr, sz);
-                buf[sz] = '\0';
-                ptr += sz;
-                avro_value_set_string(&field, buf);
-                ss_dassert(ptr < end);
-            }
-            else if (column_is_blob(map->column_types[i]))
-            {
-                uint8_t bytes = metadata[metadata_offset];
-                uint64_t len = 0;
-                memcpy(&len, ptr, bytes);
-                ptr += bytes;
-                MXS_INFO("[%ld] BLOB: field: %d bytes, data: %lu bytes", i, bytes, len);
-                if (len)
-                {
-                    avro_value_set_bytes(&field, ptr, len);
-                    ptr += len;
-                }
-                else
-                {
-                    uint8_t nullvalue = 0;
-                    avro_value_set_bytes(&field, &nullvalue, 1);
-                }
-                ss_dassert(ptr < end);
-            }
-            else if (column_is_temporal(map->column_types[i]))
-            {
-                char buf[80];
-                struct tm tm;
-                ptr += unpack_temporal_value(map->column_types[i], ptr,
-                                             &metadata[metadata_offset],
-                                             create->column_lengths[i], &tm);
-                format_temporal_value(buf, sizeof(buf), map->column_types[i], &tm);
-                avro_value_set_string(&field, buf);
-                MXS_INFO("[%ld] TEMPORAL: %s", i, buf);
-                ss_dassert(ptr < end);
-            }
-            /** All numeric types (INT, LONG, FLOAT etc.) */
             else
             {
-                uint8_t lval[16];
-                memset(lval, 0, sizeof(lval));
-                ptr += unpack_numeric_field(ptr, map->column_types[i],
-                                            &metadata[metadata_offset], lval);
-                set_numeric_field_value(&field, map->column_types[i], &metadata[metadata_offset], lval);
+                ptr = dec->decode(dec, &field, ptr, &extra_bits);
                 ss_dassert(ptr < end);
             }
-            ss_dassert(metadata_offset <= map->column_metadata_size);
-            metadata_offset += get_metadata_len(map->column_types[i]);
         }
     }
 
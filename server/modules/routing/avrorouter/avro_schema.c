@@ -1357,14 +1357,20 @@ TABLE_MAP *table_map_alloc(uint8_t *ptr, uint8_t hdr_len, TABLE_CREATE* create)
         map->database = MXS_STRDUP(schema_name);
         map->table = MXS_STRDUP(table_name);
         map->table_create = create;
+        map->decoders = NULL;
+        map->num_decoders = 0;
+        bool ok = false;
+
         if (map->column_types && map->database && map->table &&
             map->column_metadata && map->null_bitmap)
         {
             memcpy(map->column_types, column_types, column_count);
             memcpy(map->null_bitmap, nullmap, nullmap_size);
             memcpy(map->column_metadata, metadata, metadata_size);
+            ok = table_map_build_decoders(map);
         }
-        else
+
+        if (!ok)
         {
             MXS_FREE(map->null_bitmap);
             MXS_FREE(map->column_metadata);
@@ -1387,6 +1393,9 @@ void table_map_free(TABLE_MAP *map)
 {
     if (map)
     {
+        MXS_FREE(map->decoders);
+        MXS_FREE(map->null_bitmap);
+        MXS_FREE(map->column_metadata);
         MXS_FREE(map->column_types);
         MXS_FREE(map->database);
         MXS_FREE(map->table);
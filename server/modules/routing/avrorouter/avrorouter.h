@@ -28,6 +28,7 @@
 #include <maxscale/dcb.h>
 #include <maxscale/service.h>
 #include <maxscale/spinlock.h>
+#include <maxscale/thread.h>
 #include <maxscale/mysql_binlog.h>
 #include <maxscale/users.h>
 #include <avro.h>
@@ -35,6 +36,8 @@
 #include <maxscale/pcre2.h>
 #include <maxavro.h>
 #include <binlog_common.h>
+#include <binlog_map.h>
+#include <binlog_zfile.h>
 #include <maxscale/sqlite3.h>
 #include <maxscale/protocol/mysql.h>
 
@@ -54,6 +57,12 @@ MXS_BEGIN_DECLS
 
 #define MAX_MAPPED_TABLES 1024
 
+/**
+ * How many row events may wait for the conversion threads before the
+ * reading of the binlog waits for them
+ */
+#define AVRO_MAX_PENDING_ROW_JOBS 1024
+
 #define GTID_TABLE_NAME        "gtid"
 #define USED_TABLES_TABLE_NAME "used_tables"
 #define MEMORY_DATABASE_NAME   "memory"
@@ -136,6 +145,30 @@ typedef struct table_create
     bool was_used; /**< Has this schema been persisted to disk */
 } TABLE_CREATE;
 
+/** The fields that the avrorouter adds before the columns of each record */
+#define AVRO_GENERATED_FIELDS 6
+
+struct column_decoder;
+
+/** Decodes a non-NULL column value into an Avro field and returns a pointer to
+ * the first byte after the value. The BIT columns use @c extra_bits. */
+typedef uint8_t* (*column_decode_fn)(struct column_decoder *dec, avro_value_t *field,
+                                     uint8_t *ptr, int *extra_bits);
+
+/** How the values of a column are decoded from the row events, resolved once
+ * when the table is mapped */
+typedef struct column_decoder
+{
+    column_decode_fn decode;   /*< Decoding function for the column type */
+    uint8_t  type;             /*< Column type */
+    uint8_t  *metadata;        /*< The metadata of the column */
+    size_t   column;           /*< Index of the column in the table */
+    size_t   field;            /*< Index of the column in the Avro record */
+    size_t   fixed_size;       /*< Size of fixed size numeric values */
+    int      length;           /*< Length of the column in the table definition */
+    bool     null_is_bytes;    /*< NULL values are stored as an empty byte value */
+} COLUMN_DECODER;
+
 /** A representation of a table map event read from a binary log. A table map
  * maps a table to a unique ID which can be used to match row events to table map
  * events. The table map event tells us how the table is laid out and gives us
@@ -150,6 +183,8 @@ typedef struct table_map
     uint8_t *column_metadata;
     size_t column_metadata_size;
     TABLE_CREATE *table_create; /*< The definition of the table */
+    COLUMN_DECODER *decoders;   /*< The decoders of the columns */
+    uint64_t num_decoders;      /*< Number of columns that are decoded */
     int version;
     char version_string[TABLE_MAP_VERSION_DIGITS + 1];
     char *table;
@@ -188,6 +223,10 @@ typedef struct
     int             minavgs[AVRO_NSTATS_MINUTES];
 } AVRO_CLIENT_STATS;
 
+/** The Kafka producer of a router and the topic of a table, see avro_kafka.c */
+typedef struct avro_kafka AVRO_KAFKA;
+typedef struct avro_kafka_topic AVRO_KAFKA_TOPIC;
+
 typedef struct avro_table_t
 {
     char* filename; /*< Absolute filename */
@@ -195,6 +234,15 @@ typedef struct avro_table_t
     avro_file_writer_t avro_file; /*< Current Avro data file */
     avro_value_iface_t *avro_writer_iface; /*< Avro C API writer interface */
     avro_schema_t avro_schema; /*< Native Avro schema of the table */
+    uint64_t rows; /*< Records written since the file was opened */
+    uint64_t unflushed_rows; /*< Records written since the last flush */
+    long first_unflushed; /*< When the oldest unflushed record was written, in heartbeats */
+    uint64_t rate_rows; /*< Records flushed since rate_start */
+    long rate_start; /*< Start of the current rows per second sample, in heartbeats */
+    double rows_per_sec; /*< Records per second in the last sample */
+    long flush_latency; /*< Age of the oldest record at the last flush, in heartbeats */
+    long max_flush_latency; /*< Largest flush_latency seen */
+    AVRO_KAFKA_TOPIC *kafka_topic; /*< Kafka topic the records are published to, NULL if none */
 } AVRO_TABLE;
 
 /** Data format used when streaming data to the clients */
@@ -217,6 +265,72 @@ typedef struct gtid_pos
                          * rebuild GTID events in the correct order. */
 } gtid_pos_t;
 
+/**
+ * A row event converted by a conversion thread. The rows of an event are
+ * numbered from where the previous row event of the transaction ended,
+ * so the event waits until the previous one has been numbered.
+ */
+typedef struct avro_row_job
+{
+    struct avro_row_job *next;      /*< The next event of the same conversion thread */
+    struct avro_row_job *prev;      /*< The previous row event of the transaction */
+    AVRO_TABLE      *table;         /*< The table the rows are written to */
+    TABLE_MAP       *map;           /*< Table map of the event */
+    TABLE_CREATE    *create;        /*< Table creation of the table */
+    REP_HEADER      hdr;            /*< Replication header of the event */
+    gtid_pos_t      gtid;           /*< GTID of the event, event_num is that of the
+                                     * last row once the event is numbered */
+    uint64_t        pos;            /*< Binlog position of the event */
+    uint8_t         *data;          /*< Copy of the event payload */
+    size_t          rows_offset;    /*< Offset of the first row in the payload */
+    uint8_t         *col_present;   /*< The bitfield of the present columns */
+    bool            numbered;       /*< Whether the rows are numbered */
+    int             refcount;       /*< References to the event */
+} AVRO_ROW_JOB;
+
+/**
+ * A thread that converts the row events of the tables assigned to it. Tables
+ * are assigned by their name, so the rows of a table are written in order.
+ */
+typedef struct avro_converter
+{
+    THREAD          thread;         /*< The conversion thread */
+    struct avro_instance *router;   /*< The router instance */
+    AVRO_ROW_JOB    *head;          /*< The first queued event */
+    AVRO_ROW_JOB    *tail;          /*< The last queued event */
+    pthread_cond_t  cond;           /*< Signaled when an event is queued */
+} AVRO_CONVERTER;
+
+/**
+ * A data block of an Avro file, kept in memory in the format in which it is
+ * sent to the clients
+ */
+typedef struct avro_cached_block
+{
+    char            *key;           /*< The format, the file and the position of the block */
+    GWBUF           *data;          /*< The block as it is sent to the clients */
+    gtid_pos_t      gtid;           /*< GTID of the last record of the block */
+    struct avro_cached_block *prev; /*< The more recently used block */
+    struct avro_cached_block *next; /*< The less recently used block */
+} AVRO_CACHED_BLOCK;
+
+/**
+ * The data blocks most recently sent to the clients. The blocks of a file
+ * do not change once they are written, so a block that is read and decoded
+ * for one client is sent from memory to the other clients of the same table.
+ */
+typedef struct avro_block_cache
+{
+    SPINLOCK        lock;           /*< Protects the cache */
+    HASHTABLE       *blocks;        /*< The blocks by their keys */
+    AVRO_CACHED_BLOCK *head;        /*< The most recently used block */
+    AVRO_CACHED_BLOCK *tail;        /*< The least recently used block */
+    uint64_t        size;           /*< The bytes held by the blocks */
+    uint64_t        max_size;       /*< The maximum of size */
+    uint64_t        hits;           /*< Blocks sent from the cache */
+    uint64_t        misses;         /*< Blocks read from the files */
+} AVRO_BLOCK_CACHE;
+
 /**
  * The client structure used within this router.
  * This represents the clients that are requesting AVRO files from MaxScale.
@@ -239,12 +353,22 @@ typedef struct avro_client
     AVRO_CLIENT_STATS  stats;       /*< Slave statistics */
     time_t          connect_time;   /*< Connect time of slave */
     MAXAVRO_FILE    avro_file;     /*< Avro file struct */
+    MAXAVRO_JSON_BUFFER json_buffer; /*< Records converted to JSON, reused for every block */
     char avro_binfile[AVRO_MAX_FILENAME_LEN + 1];
     bool            requested_gtid; /*< If the client requested */
     gtid_pos_t      gtid; /*< Current/requested GTID */
     gtid_pos_t      gtid_start; /*< First sent GTID */
     unsigned int    cstate;         /*< Catch up state */
     sqlite3       *sqlite_handle;
+    sqlite3_stmt  *gtid_pos_stmt;   /*< Prepared query for the index position of a GTID */
+    uint32_t        batch_records;  /*< Records per batch, 0 if batches are not used */
+    uint32_t        batch_time;     /*< Milliseconds a partial batch may wait */
+    uint32_t        batch_window;   /*< Batches sent before an ACK is needed, 0 for no limit */
+    GWBUF           *batch;         /*< The batch being collected */
+    uint32_t        batch_pending;  /*< Records in the batch being collected */
+    long            batch_start;    /*< When the batch was started, in heartbeats */
+    uint64_t        batch_seq;      /*< Sequence number of the last batch sent */
+    uint64_t        batch_acked;    /*< Sequence number of the last acknowledged batch */
 #if defined(SS_DEBUG)
     skygw_chk_t     rses_chk_tail;
 #endif
@@ -272,6 +396,9 @@ typedef struct avro_instance
     uint64_t                current_pos;
     /*< Current binlog position */
     int                     binlog_fd;      /*< File descriptor of the binlog file being read */
+    BINLOG_MAP              binlog_map;     /*< Mapping of the binlog file being read */
+    bool                    binlog_mapped;  /*< Whether the binlog file is read from the mapping */
+    BINLOG_ZFILE            *binlog_zfile;  /*< The binlog file being read, if it is compressed */
     pcre2_code              *create_table_re;
     pcre2_code              *alter_table_re;
     uint8_t event_types;
@@ -282,6 +409,9 @@ typedef struct avro_instance
     HASHTABLE     *open_tables;
     HASHTABLE     *created_tables;
     sqlite3       *sqlite_handle;
+    sqlite3_stmt  *gtid_insert_stmt; /*< Prepared insert of a GTID into the index */
+    sqlite3_stmt  *progress_select_stmt; /*< Prepared query for the indexed position of a file */
+    sqlite3_stmt  *progress_update_stmt; /*< Prepared update of the indexed position of a file */
     char              prevbinlog[BINLOG_FNAMELEN + 1];
     int               rotating;     /*< Rotation in progress flag */
     SPINLOCK          fileslock;    /*< Lock for the files queue above */
@@ -294,6 +424,19 @@ typedef struct avro_instance
     uint64_t        row_target; /*< Minimum about of row events that will trigger
                                  * a flush of all tables */
     uint64_t        block_size; /**< Avro datablock size */
+    uint64_t        flush_latency; /*< Max milliseconds between flushes, 0 to flush
+                                    * by group_trx and group_rows */
+    long            last_checkpoint; /*< When the tables were last flushed, in heartbeats */
+    int             conversion_threads; /*< Number of row conversion threads,
+                                         * 0 converts the rows when they are read */
+    AVRO_CONVERTER  *converters;    /*< The conversion threads */
+    pthread_mutex_t conversion_lock; /*< Protects the queues of the conversion threads */
+    pthread_cond_t  conversion_cond; /*< Signaled when a row event has been converted */
+    int             pending_row_jobs; /*< Row events queued or being converted */
+    AVRO_ROW_JOB    *last_row_job;  /*< The last row event of the current transaction */
+    AVRO_BLOCK_CACHE *block_cache;  /*< Blocks shared by the clients, NULL if disabled */
+    bool            direct_json;    /*< Convert records straight into JSON text */
+    AVRO_KAFKA      *kafka;         /*< Publishes the records to Kafka, NULL if disabled */
     struct avro_instance  *next;
 } AVRO_INSTANCE;
 
@@ -301,6 +444,7 @@ extern void read_table_info(uint8_t *ptr, uint8_t post_header_len, uint64_t *tab
                             char* dest, size_t len);
 extern TABLE_MAP *table_map_alloc(uint8_t *ptr, uint8_t hdr_len, TABLE_CREATE* create);
 extern void table_map_free(TABLE_MAP *map);
+extern bool table_map_build_decoders(TABLE_MAP *map);
 extern TABLE_CREATE* table_create_alloc(const char* sql, int len, const char* db);
 extern TABLE_CREATE* table_create_copy(AVRO_INSTANCE *router, const char* sql, size_t len, const char* db);
 extern void table_create_free(TABLE_CREATE* value);
@@ -319,6 +463,28 @@ extern void save_avro_schema(const char *path, const char* schema, TABLE_MAP *ma
 extern bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
 extern bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
 extern void table_map_remap(uint8_t *ptr, uint8_t hdr_len, TABLE_MAP *map);
+extern void avro_row_job_convert(AVRO_ROW_JOB *job);
+extern void avro_row_job_release(AVRO_ROW_JOB *job);
+extern bool avro_converter_start(AVRO_INSTANCE *router);
+extern void avro_converter_submit(AVRO_INSTANCE *router, const char *table_ident, AVRO_ROW_JOB *job);
+extern void avro_converter_wait(AVRO_INSTANCE *router);
+extern void avro_converter_end_trx(AVRO_INSTANCE *router);
+extern bool avro_client_batch_is_due(AVRO_CLIENT *client);
+extern bool avro_prepare_stmt(sqlite3 *handle, sqlite3_stmt **stmt, const char *sql);
+extern AVRO_BLOCK_CACHE* avro_block_cache_alloc(uint64_t max_size);
+extern GWBUF* avro_block_cache_get(AVRO_BLOCK_CACHE *cache, enum avro_data_format format,
+                                   const char *filename, long pos, gtid_pos_t *gtid);
+extern void avro_block_cache_put(AVRO_BLOCK_CACHE *cache, enum avro_data_format format,
+                                 const char *filename, long pos, GWBUF *data, gtid_pos_t *gtid);
+extern AVRO_KAFKA* avro_kafka_alloc(const char *service, const char *brokers,
+                                    const char *topic_prefix, int linger_ms);
+extern void avro_kafka_free(AVRO_KAFKA *kafka);
+extern AVRO_KAFKA_TOPIC* avro_kafka_topic_alloc(AVRO_KAFKA *kafka, const char *table);
+extern void avro_kafka_topic_free(AVRO_KAFKA_TOPIC *topic);
+extern void avro_kafka_produce(AVRO_KAFKA_TOPIC *topic, avro_value_t *record, const gtid_pos_t *gtid);
+extern void avro_kafka_poll(AVRO_KAFKA *kafka);
+extern void avro_kafka_flush(AVRO_KAFKA *kafka);
+extern void avro_kafka_diagnostics(AVRO_KAFKA *kafka, DCB *dcb);
 
 enum avrorouter_file_op
 {
@@ -345,6 +511,10 @@ extern void avro_flush_all_tables(AVRO_INSTANCE *router, enum avrorouter_file_op
  */
 #define AVRO_CS_BUSY             0x0001
 #define AVRO_WAIT_DATA           0x0002
+#define AVRO_WAIT_ACK            0x0004
+
+/** The length of the header of a batch: payload length, records and sequence number */
+#define AVRO_BATCH_HEADER_LEN    16
 
 MXS_END_DECLS
 
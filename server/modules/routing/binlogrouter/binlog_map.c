@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file binlog_map.c - Memory mapped reading of binlog files
+ *
+ * This file is shared between the binlogrouter and the avrorouter. A binlog
+ * file is mapped one segment at a time and the events are read directly from
+ * the mapping, so that reading an event does not need any system calls except
+ * when the next segment is mapped.
+ *
+ * Touching a mapped page that is past the end of the file raises SIGBUS, so
+ * the part of a file that is mapped must not be truncated while it is mapped.
+ * A binlog file is only ever truncated past its last complete transaction,
+ * so it is enough to not map a file being written past that position.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <binlog_map.h>
+#include <maxscale/log_manager.h>
+
+/** How much of a binlog file is mapped at a time */
+#define BINLOG_MAP_SEGMENT_SIZE (16 * 1024 * 1024)
+
+/**
+ * Initialize a binlog file mapping. Nothing is mapped until the file is read.
+ *
+ * @param map The mapping to initialize
+ * @param fd  The open binlog file
+ */
+void binlog_map_init(BINLOG_MAP *map, int fd)
+{
+    map->fd = fd;
+    map->data = NULL;
+    map->start = 0;
+    map->len = 0;
+}
+
+/**
+ * Unmap the mapped segment of a binlog file. The file is not closed.
+ *
+ * @param map The mapping
+ */
+void binlog_map_close(BINLOG_MAP *map)
+{
+    if (map->data)
+    {
+        munmap(map->data, map->len);
+        map->data = NULL;
+        map->start = 0;
+        map->len = 0;
+    }
+}
+
+/**
+ * Get a pointer to the bytes of a mapped binlog file
+ *
+ * If the bytes are not in the mapped segment, a new segment starting at the
+ * page that contains @c pos is mapped. The pointer is valid until the next
+ * call with the same mapping.
+ *
+ * @param map   The mapping
+ * @param pos   Position in the file
+ * @param len   How many bytes are wanted
+ * @param limit The position up to which the file may be mapped, or 0 if the
+ *              file may be mapped up to its end
+ * @param avail Set to the number of bytes available at the returned pointer,
+ *              which is less than @c len only at the end of the file
+ * @return Pointer to the bytes at @c pos, or NULL if there are no bytes
+ *         at @c pos or an error occurred, in which case errno is set
+ */
+const uint8_t* binlog_map_get(BINLOG_MAP *map, uint64_t pos, uint64_t len,
+                              uint64_t limit, uint64_t *avail)
+{
+    *avail = 0;
+
+    if (map->data == NULL || pos < map->start || pos + len > map->start + map->len)
+    {
+        struct stat st;
+
+        if (fstat(map->fd, &st) == -1)
+        {
+            return NULL;
+        }
+
+        uint64_t end = st.st_size;
+
+        if (limit > 0 && limit < end)
+        {
+            end = limit;
+        }
+
+        if (pos >= end)
+        {
+            errno = 0;
+            return NULL;
+        }
+
+        uint64_t page_size = sysconf(_SC_PAGESIZE);
+        uint64_t start = pos - pos % page_size;
+        uint64_t size = MXS_MAX(BINLOG_MAP_SEGMENT_SIZE, pos - start + len);
+
+        if (start + size > end)
+        {
+            size = end - start;
+        }
+
+        binlog_map_close(map);
+
+        void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, map->fd, start);
+
+        if (data == MAP_FAILED)
+        {
+            char err[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("Failed to map %lu bytes of binlog file at %lu: %d, %s",
+                      size, start, errno, strerror_r(errno, err, sizeof(err)));
+            return NULL;
+        }
+
+        /** The file is read from the start to the end, let the kernel read ahead */
+        madvise(data, size, MADV_SEQUENTIAL);
+
+        map->data = data;
+        map->start = start;
+        map->len = size;
+    }
+
+    *avail = map->start + map->len - pos;
+
+    return map->data + (pos - map->start);
+}
+
+/**
+ * Read from a mapped binlog file, like pread would read from the file
+ *
+ * @param map   The mapping
+ * @param buf   Where the bytes are copied to
+ * @param len   How many bytes to read
+ * @param pos   Position in the file
+ * @param limit The position up to which the file may be mapped, or 0 for no limit
+ * @return The number of bytes read, 0 at the end of the file, or -1 on error
+ */
+int binlog_map_pread(BINLOG_MAP *map, void *buf, uint32_t len, uint64_t pos, uint64_t limit)
+{
+    uint64_t avail;
+    const uint8_t *data = binlog_map_get(map, pos, len, limit, &avail);
+
+    if (data == NULL)
+    {
+        return errno == 0 ? 0 : -1;
+    }
+
+    if (avail < len)
+    {
+        len = avail;
+    }
+
+    memcpy(buf, data, len);
+
+    return len;
+}
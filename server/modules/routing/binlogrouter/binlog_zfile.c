@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file binlog_zfile.c - Compressed binlog files
+ *
+ * This file is shared between the binlogrouter and the avrorouter. A binlog
+ * file that is no longer written to can be replaced with a compressed file,
+ * in which the binlog is split into blocks that are compressed with zlib
+ * independently of each other, so that any position can be read by
+ * decompressing only the block that holds it. The layout of the file is
+ *
+ *     magic      : 4 bytes, 0xfe 'b' 'l' 'z'
+ *     block_size : uint32_t, the uncompressed size of all but the last block
+ *     size       : uint64_t, the uncompressed size of the binlog
+ *     n_blocks   : uint32_t
+ *     reserved   : uint32_t
+ *     offsets    : (n_blocks + 1) * uint64_t, the file offsets of the
+ *                  compressed blocks and of the end of the last one
+ *
+ * followed by the compressed blocks. The numbers are in the byte order of
+ * the host. The magic differs from that of a binlog file, so a compressed
+ * file can be told apart from a binlog file by its first bytes.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <binlog_zfile.h>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+
+static const uint8_t ZFILE_MAGIC[] = { 0xfe, 'b', 'l', 'z' };
+
+/** The length of the fixed part of the header */
+#define ZFILE_HEADER_LEN 24
+
+/** Blocks larger than this are not accepted when a file is opened */
+#define ZFILE_MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+/**
+ * Check whether a file is a compressed binlog file
+ *
+ * @param fd The open file
+ * @return True, if the file starts with the magic of a compressed binlog file
+ */
+bool binlog_zfile_is_compressed(int fd)
+{
+    uint8_t magic[sizeof(ZFILE_MAGIC)];
+
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+           memcmp(magic, ZFILE_MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+ * Open a compressed binlog file for reading
+ *
+ * The header and the offsets of the blocks are read and checked. The file
+ * descriptor remains owned by the caller.
+ *
+ * @param fd The open compressed file
+ * @return The opened file, or NULL if the file is not a valid compressed
+ *         binlog file or memory could not be allocated
+ */
+BINLOG_ZFILE* binlog_zfile_open(int fd)
+{
+    uint8_t header[ZFILE_HEADER_LEN];
+    struct stat st;
+
+    if (pread(fd, header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header, ZFILE_MAGIC, sizeof(ZFILE_MAGIC)) != 0 ||
+        fstat(fd, &st) == -1)
+    {
+        MXS_ERROR("Failed to read the header of a compressed binlog file.");
+        return NULL;
+    }
+
+    BINLOG_ZFILE *zfile = MXS_CALLOC(1, sizeof(BINLOG_ZFILE));
+
+    if (zfile == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(&zfile->block_size, header + 4, sizeof(zfile->block_size));
+    memcpy(&zfile->size, header + 8, sizeof(zfile->size));
+    memcpy(&zfile->n_blocks, header + 16, sizeof(zfile->n_blocks));
+
+    bool ok = zfile->block_size > 0 && zfile->block_size <= ZFILE_MAX_BLOCK_SIZE &&
+              zfile->n_blocks == (zfile->size + zfile->block_size - 1) / zfile->block_size;
+
+    size_t offsets_len = (zfile->n_blocks + 1) * sizeof(uint64_t);
+    uint64_t max_len = 0;
+
+    if (ok && (zfile->offsets = MXS_MALLOC(offsets_len)) != NULL)
+    {
+        ok = pread(fd, zfile->offsets, offsets_len, ZFILE_HEADER_LEN) == (ssize_t)offsets_len &&
+             zfile->offsets[0] == ZFILE_HEADER_LEN + offsets_len &&
+             zfile->offsets[zfile->n_blocks] <= (uint64_t)st.st_size;
+
+        for (uint32_t i = 0; ok && i < zfile->n_blocks; i++)
+        {
+            if (zfile->offsets[i + 1] < zfile->offsets[i])
+            {
+                ok = false;
+            }
+            else if (zfile->offsets[i + 1] - zfile->offsets[i] > max_len)
+            {
+                max_len = zfile->offsets[i + 1] - zfile->offsets[i];
+            }
+        }
+
+        if (!ok)
+        {
+            MXS_ERROR("The header of a compressed binlog file is corrupt.");
+        }
+    }
+    else
+    {
+        ok = false;
+    }
+
+    if (ok)
+    {
+        zfile->block = MXS_MALLOC(zfile->block_size);
+        zfile->zbuf = MXS_MALLOC(max_len > 0 ? max_len : 1);
+        ok = zfile->block && zfile->zbuf;
+    }
+
+    if (!ok)
+    {
+        binlog_zfile_close(zfile);
+        return NULL;
+    }
+
+    zfile->fd = fd;
+    zfile->block_index = -1;
+    spinlock_init(&zfile->lock);
+
+    return zfile;
+}
+
+/**
+ * Free an opened compressed binlog file. The file is not closed.
+ *
+ * @param zfile The file, may be NULL
+ */
+void binlog_zfile_close(BINLOG_ZFILE *zfile)
+{
+    if (zfile)
+    {
+        MXS_FREE(zfile->offsets);
+        MXS_FREE(zfile->block);
+        MXS_FREE(zfile->zbuf);
+        MXS_FREE(zfile);
+    }
+}
+
+/**
+ * @return The size of the binlog file before it was compressed
+ */
+uint64_t binlog_zfile_size(BINLOG_ZFILE *zfile)
+{
+    return zfile->size;
+}
+
+/**
+ * Decompress a block into the cached block. The caller must hold the lock.
+ *
+ * @param zfile The file
+ * @param index The index of the block
+ * @return True, if the block could be read and decompressed
+ */
+static bool load_block(BINLOG_ZFILE *zfile, uint64_t index)
+{
+    uint64_t zlen = zfile->offsets[index + 1] - zfile->offsets[index];
+    uint64_t expected = MXS_MIN(zfile->block_size, zfile->size - index * zfile->block_size);
+    uLongf len = zfile->block_size;
+
+    zfile->block_index = -1;
+
+    if (pread(zfile->fd, zfile->zbuf, zlen, zfile->offsets[index]) != (ssize_t)zlen ||
+        uncompress(zfile->block, &len, zfile->zbuf, zlen) != Z_OK ||
+        len != expected)
+    {
+        MXS_ERROR("Failed to decompress block %lu of a compressed binlog file.",
+                  (unsigned long)index);
+        errno = EIO;
+        return false;
+    }
+
+    zfile->block_index = index;
+    return true;
+}
+
+/**
+ * Read from a compressed binlog file, like pread would read from the binlog
+ * file before it was compressed
+ *
+ * The last decompressed block is kept, so reading the events of a block one
+ * after another decompresses the block only once. The file may be read by
+ * several threads at the same time.
+ *
+ * @param zfile The file
+ * @param buf   Where the bytes are copied to
+ * @param len   How many bytes to read
+ * @param pos   Position in the binlog file
+ * @return The number of bytes read, 0 at the end of the file, or -1 on error
+ */
+int binlog_zfile_pread(BINLOG_ZFILE *zfile, void *buf, uint32_t len, uint64_t pos)
+{
+    uint8_t *dest = buf;
+    uint32_t done = 0;
+
+    if (pos >= zfile->size)
+    {
+        return 0;
+    }
+
+    if (pos + len > zfile->size)
+    {
+        len = zfile->size - pos;
+    }
+
+    spinlock_acquire(&zfile->lock);
+
+    while (done < len)
+    {
+        uint64_t index = (pos + done) / zfile->block_size;
+        uint64_t offset = (pos + done) - index * zfile->block_size;
+
+        if ((int64_t)index != zfile->block_index && !load_block(zfile, index))
+        {
+            spinlock_release(&zfile->lock);
+            return -1;
+        }
+
+        uint32_t n = MXS_MIN(len - done, zfile->block_size - offset);
+        memcpy(dest + done, zfile->block + offset, n);
+        done += n;
+    }
+
+    spinlock_release(&zfile->lock);
+
+    return len;
+}
+
+/**
+ * Replace a binlog file with a compressed file
+ *
+ * The compressed file is written under a temporary name and synced, and
+ * then renamed over the binlog file, so the binlog file is always either
+ * the original or a complete compressed file. Those that have the original
+ * file open can go on reading it. The file must not be written to while
+ * it is compressed. A file that is already compressed is left as it is.
+ *
+ * @param path     The binlog file
+ * @param tmp_path The temporary name, in the same directory
+ * @return True, if the file was compressed
+ */
+bool binlog_zfile_compress(const char *path, const char *tmp_path)
+{
+    bool rval = false;
+    struct stat st;
+    int in = open(path, O_RDONLY);
+
+    if (in == -1 || fstat(in, &st) == -1)
+    {
+        char err[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to open binlog file %s for compression: %d, %s",
+                  path, errno, strerror_r(errno, err, sizeof(err)));
+
+        if (in != -1)
+        {
+            close(in);
+        }
+
+        return false;
+    }
+
+    if (binlog_zfile_is_compressed(in))
+    {
+        close(in);
+        return true;
+    }
+
+    uint64_t size = st.st_size;
+    uint32_t n_blocks = (size + BINLOG_ZFILE_BLOCK_SIZE - 1) / BINLOG_ZFILE_BLOCK_SIZE;
+    size_t offsets_len = (n_blocks + 1) * sizeof(uint64_t);
+    uLong zbuf_len = compressBound(BINLOG_ZFILE_BLOCK_SIZE);
+    uint64_t *offsets = MXS_MALLOC(offsets_len);
+    uint8_t *block = MXS_MALLOC(BINLOG_ZFILE_BLOCK_SIZE);
+    uint8_t *zbuf = MXS_MALLOC(zbuf_len);
+    int out = -1;
+
+    if (offsets && block && zbuf && (out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) != -1)
+    {
+        uint64_t offset = ZFILE_HEADER_LEN + offsets_len;
+
+        rval = true;
+
+        for (uint32_t i = 0; rval && i < n_blocks; i++)
+        {
+            uint64_t pos = (uint64_t)i * BINLOG_ZFILE_BLOCK_SIZE;
+            size_t len = MXS_MIN(BINLOG_ZFILE_BLOCK_SIZE, size - pos);
+            uLongf zlen = zbuf_len;
+
+            rval = pread(in, block, len, pos) == (ssize_t)len &&
+                   compress2(zbuf, &zlen, block, len, Z_BEST_SPEED) == Z_OK &&
+                   pwrite(out, zbuf, zlen, offset) == (ssize_t)zlen;
+
+            offsets[i] = offset;
+            offset += zlen;
+        }
+
+        offsets[n_blocks] = offset;
+
+        uint8_t header[ZFILE_HEADER_LEN] = {};
+        uint32_t block_size = BINLOG_ZFILE_BLOCK_SIZE;
+
+        memcpy(header, ZFILE_MAGIC, sizeof(ZFILE_MAGIC));
+        memcpy(header + 4, &block_size, sizeof(block_size));
+        memcpy(header + 8, &size, sizeof(size));
+        memcpy(header + 16, &n_blocks, sizeof(n_blocks));
+
+        rval = rval &&
+               pwrite(out, offsets, offsets_len, ZFILE_HEADER_LEN) == (ssize_t)offsets_len &&
+               pwrite(out, header, sizeof(header), 0) == sizeof(header) &&
+               fsync(out) == 0;
+
+        if (close(out) != 0)
+        {
+            rval = false;
+        }
+
+        rval = rval && rename(tmp_path, path) == 0;
+
+        if (rval)
+        {
+            MXS_NOTICE("Compressed binlog file %s from %lu to %lu bytes.",
+                       path, (unsigned long)size, (unsigned long)offset);
+        }
+        else
+        {
+            unlink(tmp_path);
+        }
+    }
+
+    if (!rval)
+    {
+        char err[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("Failed to compress binlog file %s: %d, %s",
+                  path, errno, strerror_r(errno, err, sizeof(err)));
+    }
+
+    MXS_FREE(offsets);
+    MXS_FREE(block);
+    MXS_FREE(zbuf);
+    close(in);
+
+    return rval;
+}
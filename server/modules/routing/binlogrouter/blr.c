@@ -90,6 +90,7 @@
 /* The router entry points */
 static  MXS_ROUTER  *createInstance(SERVICE *service, char **options);
 static void free_instance(ROUTER_INSTANCE *instance);
+static unsigned long blr_parse_size(const char *value);
 static  MXS_ROUTER_SESSION *newSession(MXS_ROUTER *instance, MXS_SESSION *session);
 static  void closeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session);
 static  void freeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session);
@@ -189,6 +190,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"file", MXS_MODULE_PARAM_COUNT, "1"},
             {"transaction_safety", MXS_MODULE_PARAM_BOOL, "false"},
             {"semisync", MXS_MODULE_PARAM_BOOL, "false"},
+            {"binlog_sync_interval", MXS_MODULE_PARAM_COUNT, DEF_BINLOG_SYNC_INTERVAL},
+            {"binlog_sync_size", MXS_MODULE_PARAM_SIZE, DEF_BINLOG_SYNC_SIZE},
+            {"binlog_sync_thread", MXS_MODULE_PARAM_BOOL, DEF_BINLOG_SYNC_THREAD},
+            {"binlog_index_interval", MXS_MODULE_PARAM_SIZE, DEF_BINLOG_INDEX_INTERVAL},
+            {"compress_binlogs", MXS_MODULE_PARAM_BOOL, DEF_COMPRESS_BINLOGS},
             {"encrypt_binlog", MXS_MODULE_PARAM_BOOL, "false"},
             {"encryption_algorithm", MXS_MODULE_PARAM_ENUM, "aes_cbc", MXS_MODULE_OPT_NONE, enc_algo_values},
             {"encryption_key_file", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_R_OK},
@@ -197,6 +203,10 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"shortburst", MXS_MODULE_PARAM_COUNT, DEF_SHORT_BURST},
             {"longburst", MXS_MODULE_PARAM_COUNT, DEF_LONG_BURST},
             {"burstsize", MXS_MODULE_PARAM_SIZE, DEF_BURST_SIZE},
+            {"event_cache_size", MXS_MODULE_PARAM_SIZE, DEF_EVENT_CACHE_SIZE},
+            {"catchup_batch_size", MXS_MODULE_PARAM_SIZE, DEF_CATCHUP_BATCH_SIZE},
+            {"catchup_run_size", MXS_MODULE_PARAM_SIZE, DEF_CATCHUP_RUN_SIZE},
+            {"mmap_binlogs", MXS_MODULE_PARAM_BOOL, "false"},
             {"heartbeat", MXS_MODULE_PARAM_COUNT, BLR_HEARTBEAT_DEFAULT_INTERVAL},
             {"send_slave_heartbeat", MXS_MODULE_PARAM_BOOL, "false"},
             {"binlogdir", MXS_MODULE_PARAM_PATH, NULL, MXS_MODULE_OPT_PATH_W_OK},
@@ -278,7 +288,14 @@ createInstance(SERVICE *service, char **options)
     spinlock_init(&inst->fileslock);
     spinlock_init(&inst->binlog_lock);
 
+    if (!blr_init_waiting_slaves(inst))
+    {
+        MXS_FREE(inst);
+        return NULL;
+    }
+
     inst->binlog_fd = -1;
+    inst->index_fd = -1;
     inst->master_chksum = true;
 
     inst->master_state = BLRM_UNCONFIGURED;
@@ -327,6 +344,10 @@ createInstance(SERVICE *service, char **options)
     inst->short_burst = config_get_integer(params, "shortburst");
     inst->long_burst = config_get_integer(params, "longburst");
     inst->burst_size = config_get_size(params, "burstsize");
+    inst->event_cache_size = config_get_size(params, "event_cache_size");
+    inst->catchup_batch_size = config_get_size(params, "catchup_batch_size");
+    inst->catchup_run_size = config_get_size(params, "catchup_run_size");
+    inst->mmap_binlogs = config_get_bool(params, "mmap_binlogs");
     inst->binlogdir = config_copy_string(params, "binlogdir");
     inst->heartbeat = config_get_integer(params, "heartbeat");
     inst->ssl_cert_verification_depth = config_get_integer(params, "ssl_cert_verification_depth");
@@ -351,6 +372,11 @@ createInstance(SERVICE *service, char **options)
     /* Semi-Sync support */
     inst->request_semi_sync = config_get_bool(params, "semisync");
     inst->master_semi_sync = 0;
+    inst->binlog_sync_interval = config_get_integer(params, "binlog_sync_interval");
+    inst->binlog_sync_size = config_get_size(params, "binlog_sync_size");
+    inst->binlog_sync_thread = config_get_bool(params, "binlog_sync_thread");
+    inst->binlog_index_interval = config_get_size(params, "binlog_index_interval");
+    inst->compress_binlogs = config_get_bool(params, "compress_binlogs");
 
     /* Binlog encryption */
     inst->encryption.enabled = config_get_bool(params, "encrypt_binlog");
@@ -503,6 +529,26 @@ createInstance(SERVICE *service, char **options)
                 {
                     inst->request_semi_sync = config_truth_value(value);
                 }
+                else if (strcmp(options[i], "binlog_sync_interval") == 0)
+                {
+                    inst->binlog_sync_interval = atoi(value);
+                }
+                else if (strcmp(options[i], "binlog_sync_size") == 0)
+                {
+                    inst->binlog_sync_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "binlog_sync_thread") == 0)
+                {
+                    inst->binlog_sync_thread = config_truth_value(value);
+                }
+                else if (strcmp(options[i], "binlog_index_interval") == 0)
+                {
+                    inst->binlog_index_interval = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "compress_binlogs") == 0)
+                {
+                    inst->compress_binlogs = config_truth_value(value);
+                }
                 else if (strcmp(options[i], "encrypt_binlog") == 0)
                 {
                     inst->encryption.enabled = config_truth_value(value);
@@ -547,29 +593,23 @@ createInstance(SERVICE *service, char **options)
                 }
                 else if (strcmp(options[i], "burstsize") == 0)
                 {
-                    unsigned long size = atoi(value);
-                    char    *ptr = value;
-                    while (*ptr && isdigit(*ptr))
-                    {
-                        ptr++;
-                    }
-                    switch (*ptr)
-                    {
-                    case 'G':
-                    case 'g':
-                        size = size * 1024 * 1000 * 1000;
-                        break;
-                    case 'M':
-                    case 'm':
-                        size = size * 1024 * 1000;
-                        break;
-                    case 'K':
-                    case 'k':
-                        size = size * 1024;
-                        break;
-                    }
-                    inst->burst_size = size;
-
+                    inst->burst_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "event_cache_size") == 0)
+                {
+                    inst->event_cache_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "catchup_batch_size") == 0)
+                {
+                    inst->catchup_batch_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "catchup_run_size") == 0)
+                {
+                    inst->catchup_run_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "mmap_binlogs") == 0)
+                {
+                    inst->mmap_binlogs = config_truth_value(value);
                 }
                 else if (strcmp(options[i], "heartbeat") == 0)
                 {
@@ -860,6 +900,14 @@ createInstance(SERVICE *service, char **options)
     snprintf(task_name, BLRM_TASK_NAME_LEN, "%s stats", service->name);
     hktask_add(task_name, stats_func, inst, BLR_STATS_FREQ);
 
+    /* Start the thread that syncs the binlog files */
+    if (inst->binlog_sync_thread && !blr_sync_thread_start(inst))
+    {
+        MXS_ERROR("%s: Failed to start the binlog sync thread, the binlog files "
+                  "are synced by the master connection.", service->name);
+        inst->binlog_sync_thread = false;
+    }
+
     /* Log whether the transaction safety option value is on */
     if (inst->trx_safe)
     {
@@ -912,7 +960,7 @@ createInstance(SERVICE *service, char **options)
             inst->master_state = BLRM_SLAVE_STOPPED;
             /* Set mysql_errno and error message */
             inst->m_errno = BINLOG_FATAL_ERROR_READING;
-            inst->m_errmsg = mxs_strdup("HY000 Binlog encryption is Off but binlog file has "
+            inst->m_errmsg = MXS_STRDUP("HY000 Binlog encryption is Off but binlog file has "
                                         "the START_ENCRYPTION_EVENT");
 
             return (MXS_ROUTER *)inst;
@@ -946,9 +994,49 @@ free_instance(ROUTER_INSTANCE *instance)
     MXS_FREE(instance->ssl_key);
     MXS_FREE(instance->ssl_version);
 
+    blr_free_cache(instance);
+    blr_free_waiting_slaves(instance);
+
     MXS_FREE(instance);
 }
 
+/**
+ * Parse a size given in the router options, with an optional
+ * K, M or G suffix.
+ *
+ * @param value     The value of the option
+ * @return          The size in bytes
+ */
+static unsigned long
+blr_parse_size(const char *value)
+{
+    unsigned long size = atoi(value);
+    const char *ptr = value;
+
+    while (*ptr && isdigit(*ptr))
+    {
+        ptr++;
+    }
+
+    switch (*ptr)
+    {
+    case 'G':
+    case 'g':
+        size = size * 1024 * 1000 * 1000;
+        break;
+    case 'M':
+    case 'm':
+        size = size * 1024 * 1000;
+        break;
+    case 'K':
+    case 'k':
+        size = size * 1024;
+        break;
+    }
+
+    return size;
+}
+
 /**
  * Associate a new session with this instance of the router.
  *
@@ -1003,6 +1091,9 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
     slave->heartbeat = 0;
     slave->lastEventReceived = 0;
     slave->encryption_ctx = NULL;
+    slave->read_buffer = NULL;
+    slave->next_waiting = NULL;
+    slave->waiting_thread = -1;
 
     /**
      * Add this session to the list of active sessions.
@@ -1063,6 +1154,8 @@ static void freeSession(MXS_ROUTER* router_instance,
     }
     spinlock_release(&router->lock);
 
+    blr_remove_waiting_slave(router, slave);
+
     MXS_DEBUG("%lu [freeSession] Unlinked router_client_session %p from "
               "router %p. Connections : %d. ",
               pthread_self(),
@@ -1086,6 +1179,7 @@ static void freeSession(MXS_ROUTER* router_instance,
     {
         MXS_FREE(slave->encryption_ctx);
     }
+    blr_free_read_buffer(slave->read_buffer);
     MXS_FREE(slave);
 }
 
@@ -1390,6 +1484,16 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
                router_inst->stats.n_reads != 0 ?
                ((double)router_inst->stats.n_binlogs / router_inst->stats.n_reads) : 0);
 
+    if (router_inst->event_cache)
+    {
+        dcb_printf(dcb, "\tSize of the event cache:                     %lu\n",
+                   router_inst->event_cache_size);
+        dcb_printf(dcb, "\tNumber of events sent from the cache:        %lu\n",
+                   router_inst->stats.n_cachehits);
+        dcb_printf(dcb, "\tNumber of events read from binlog files:     %lu\n",
+                   router_inst->stats.n_cachemisses);
+    }
+
     spinlock_acquire(&router_inst->lock);
     if (router_inst->stats.lastReply)
     {
@@ -1760,7 +1864,7 @@ errorReply(MXS_ROUTER *instance,
                 {
                     free(router->m_errmsg);
                 }
-                router->m_errmsg = mxs_strdup("#28000 Authentication with master server failed");
+                router->m_errmsg = MXS_STRDUP("#28000 Authentication with master server failed");
                 /* set mysql_errno */
                 router->m_errno = 1045;
 
@@ -1843,6 +1947,7 @@ errorReply(MXS_ROUTER *instance,
         MXS_FREE(errmsg);
     }
     *succp = true;
+    blr_sync_set_master(router, NULL);
     dcb_close(backend_dcb);
     MXS_NOTICE("%s: Master %s disconnected after %ld seconds. "
                "%lu events read.",
@@ -2483,6 +2588,9 @@ destroyInstance(MXS_ROUTER *instance)
     }
 
     spinlock_release(&inst->lock);
+
+    /** The binlog is synced before the instance is gone */
+    blr_sync_thread_stop(inst);
 }
 
 /**
@@ -57,6 +57,8 @@
 #include <maxscale/thread.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/secrets.h>
+#include <binlog_map.h>
+#include <binlog_zfile.h>
 
 MXS_BEGIN_DECLS
 
@@ -191,6 +193,11 @@ enum blr_aes_mode
 #define DEF_LOW_WATER           "1000"
 #define DEF_HIGH_WATER          "10000"
 
+/**
+ * Default size of the event cache, 0 means no cache
+ */
+#define DEF_EVENT_CACHE_SIZE    "0"
+
 /**
  * Default burst sizes for slave catchup
  */
@@ -198,6 +205,32 @@ enum blr_aes_mode
 #define DEF_LONG_BURST          "500"
 #define DEF_BURST_SIZE          "1024000" /* 1 Mb */
 
+/**
+ * Default binlog sync interval in milliseconds and size, 0 for both means
+ * the binlog is synced after each read of events from the master
+ */
+#define DEF_BINLOG_SYNC_INTERVAL "0"
+#define DEF_BINLOG_SYNC_SIZE    "0"
+#define DEF_BINLOG_SYNC_THREAD  "false"
+
+/**
+ * Default number of bytes between the entries of the binlog position index,
+ * 0 means no index is written
+ */
+#define DEF_BINLOG_INDEX_INTERVAL "0"
+
+/**
+ * Default for compressing the binlog files that are no longer written to
+ */
+#define DEF_COMPRESS_BINLOGS    "false"
+
+/**
+ * Default size of the catchup batches, 0 means the events are read
+ * and sent one by one
+ */
+#define DEF_CATCHUP_BATCH_SIZE  "0"
+#define DEF_CATCHUP_RUN_SIZE    "0"
+
 /**
  * master reconnect backoff constants
  * BLR_MASTER_BACKOFF_TIME      The increments of the back off time (seconds)
@@ -323,26 +356,34 @@ typedef struct rep_header
 } REP_HEADER;
 
 /**
- * The binlog record structure. This contains the actual packet read from the binlog
- * file.
+ * An event in the event cache.
  */
 typedef struct
 {
-    unsigned long   position;       /*< binlog record position for this cache entry */
-    GWBUF           *pkt;           /*< The packet received from the master */
-    REP_HEADER      hdr;            /*< The packet header */
+    uint32_t        seq;            /*< Sequence number of the binlog file of the event */
+    uint64_t        pos;            /*< Position of the event in the binlog file */
+    uint64_t        offset;         /*< Where the event is, as a running count of cached bytes */
+    uint32_t        size;           /*< The size of the event */
 } BLCACHE_RECORD;
 
 /**
- * The binlog cache. A cache exists for each file that hold cached bin log records.
- * Caches will be used for all files being read by more than 1 slave.
+ * The event cache. It holds the most recent events written to the binlog
+ * files, in a ring buffer shared by all slaves, so that slaves that are
+ * only a little behind can be sent events without reading the binlog files.
  */
 typedef struct
 {
-    BLCACHE_RECORD  **records;      /*< The actual binlog records */
-    int             current;        /*< The next record that will be inserted */
-    int             cnt;            /*< The number of records in the cache */
     SPINLOCK        lock;           /*< The spinlock for the cache */
+    uint8_t         *data;          /*< The ring buffer of the events */
+    uint64_t        size;           /*< The size of the ring buffer */
+    uint64_t        written;        /*< How many bytes have been written to the ring buffer */
+    BLCACHE_RECORD  *records;       /*< Circular array of the cached events, oldest first */
+    uint32_t        max_records;    /*< The size of the records array */
+    uint32_t        first;          /*< The index of the oldest cached event */
+    uint32_t        cnt;            /*< The number of cached events */
+    uint32_t        seq;            /*< Sequence number of the current binlog file */
+    char            binlogname[BINLOG_FNAMELEN + 1];  /*< The current binlog file */
+    char            prevbinlog[BINLOG_FNAMELEN + 1];  /*< The previous binlog file */
 } BLCACHE;
 
 typedef struct blfile
@@ -350,11 +391,35 @@ typedef struct blfile
     char            binlogname[BINLOG_FNAMELEN + 1]; /*< Name of the binlog file */
     int             fd;                             /*< Actual file descriptor */
     int             refcnt;                         /*< Reference count for file */
-    BLCACHE         *cache;                         /*< Record cache for this file */
     SPINLOCK        lock;                           /*< The file lock */
+    BINLOG_ZFILE    *zfile;                         /*< The file, if it is compressed */
     struct blfile   *next;                          /*< Next file in list */
 } BLFILE;
 
+/**
+ * A part of a binlog file read at once, from which the events of a
+ * catchup are then taken. If the binlog files are memory mapped, the
+ * part is a mapped segment of the file and no data is allocated.
+ */
+typedef struct
+{
+    BINLOG_MAP      map;            /*< The mapped segment, if mapping */
+    uint8_t         *data;          /*< The bytes read from the file */
+    unsigned long   size;           /*< The size of the data buffer */
+    unsigned long   len;            /*< How many bytes the buffer holds */
+    unsigned long   pos;            /*< The file position of the first byte */
+    char            binlogname[BINLOG_FNAMELEN + 1]; /*< The file the bytes are from */
+} BLR_READ_BUFFER;
+
+/**
+ * The slaves of one thread that wait for new events from the master
+ */
+typedef struct
+{
+    SPINLOCK                lock;           /*< Protects the list */
+    struct router_slave     *slaves;        /*< The waiting slaves */
+} BLR_WAITING_SLAVES;
+
 /**
  * Slave statistics
  */
@@ -440,6 +505,9 @@ typedef struct router_slave
     char              lsi_binlog_name[BINLOG_FNAMELEN + 1]; /*< Which binlog file */
     uint32_t          lsi_binlog_pos; /*< What position */
     void              *encryption_ctx;      /*< Encryption context */
+    BLR_READ_BUFFER   *read_buffer;   /*< Read ahead buffer for catchup */
+    struct router_slave *next_waiting; /*< Next slave waiting for data in the same thread */
+    int               waiting_thread; /*< The thread in whose waiting list the slave is, or -1 */
 #if defined(SS_DEBUG)
     skygw_chk_t     rses_chk_tail;
 #endif
@@ -511,6 +579,30 @@ typedef struct binlog_encryption_setup
     uint8_t key_id;
 } BINLOG_ENCRYPTION_SETUP;
 
+/**
+ * The thread that syncs the binlog files of a router instance
+ *
+ * The master connection hands over a duplicate of the binlog file descriptor
+ * and the Semi-Sync ACK that waits for the sync. Requests that arrive while
+ * a sync is in progress are merged, so one sync covers all of them.
+ */
+typedef struct blr_sync_thread
+{
+    THREAD          thread;         /*< The thread */
+    bool            started;        /*< Whether the thread is running */
+    bool            stop;           /*< Set when the thread should stop */
+    pthread_mutex_t lock;           /*< Protects the rest of the members */
+    pthread_cond_t  cond;           /*< Signaled when there is something to sync */
+    int             fd;             /*< The file to sync, -1 if there is none */
+    bool            ack;            /*< Whether an ACK waits for the sync of fd */
+    uint64_t        ack_pos;        /*< The position of the ACK */
+    char            ack_file[BINLOG_FNAMELEN + 1]; /*< The file of the ACK */
+    DCB             *master;        /*< The master connection the ACKs are sent to */
+    bool            ready;          /*< A synced ACK waits to be sent */
+    uint64_t        ready_pos;      /*< The position of the synced ACK */
+    char            ready_file[BINLOG_FNAMELEN + 1]; /*< The file of the synced ACK */
+} BLR_SYNC_THREAD;
+
 /**
  * The per instance data for the router.
  */
@@ -518,6 +610,7 @@ typedef struct router_instance
 {
     SERVICE                 *service;       /*< Pointer to the service using this router */
     ROUTER_SLAVE            *slaves;        /*< Link list of all the slave connections  */
+    BLR_WAITING_SLAVES      *waiting;       /*< Slaves waiting for data, per thread */
     SPINLOCK                lock;           /*< Spinlock for the instance data */
     char                    *uuid;          /*< UUID for the router to use w/master */
     int                     masterid;       /*< Set ID of the master, sent to slaves */
@@ -566,6 +659,11 @@ typedef struct router_instance
     unsigned int      short_burst;  /*< Short burst for slave catchup */
     unsigned int      long_burst;   /*< Long burst for slave catchup */
     unsigned long     burst_size;   /*< Maximum size of burst to send */
+    unsigned long     catchup_batch_size; /*< Size of batches read and sent in catchup */
+    unsigned long     catchup_run_size; /*< Size of runs sent without copying the events */
+    bool              mmap_binlogs; /*< Memory map the binlogs in catchup */
+    unsigned long     event_cache_size; /*< Size of the event cache */
+    BLCACHE           *event_cache; /*< Recent events, NULL if not cached */
     unsigned long     heartbeat;    /*< Configured heartbeat value */
     ROUTER_STATS      stats;        /*< Statistics for this router */
     int               active_logs;
@@ -590,6 +688,19 @@ typedef struct router_instance
     char              *ssl_version;         /*< config TLS Version for Master SSL connection */
     bool              request_semi_sync;    /*< Request Semi-Sync replication to master */
     int               master_semi_sync;     /*< Semi-Sync replication status of master server */
+    unsigned int      binlog_sync_interval; /*< Max milliseconds between binlog syncs */
+    unsigned long     binlog_sync_size;     /*< Max bytes written between binlog syncs */
+    uint64_t          unsynced_bytes;       /*< Bytes written since the last sync */
+    uint64_t          last_sync;            /*< When the binlog was last synced, in milliseconds */
+    bool              semisync_ack_pending; /*< A Semi-Sync ACK waits for the next sync */
+    uint64_t          semisync_ack_pos;     /*< The position of the pending ACK */
+    char              semisync_ack_file[BINLOG_FNAMELEN + 1]; /*< The file of the pending ACK */
+    bool              binlog_sync_thread;   /*< Sync the binlog in a separate thread */
+    BLR_SYNC_THREAD   sync;                 /*< The binlog sync thread */
+    unsigned long     binlog_index_interval; /*< Min bytes between the entries of the position index */
+    int               index_fd;             /*< The position index of the current binlog file */
+    uint64_t          last_indexed_pos;     /*< The last position added to the index */
+    bool              compress_binlogs;     /*< Compress the binlog files after rotation */
     BINLOG_ENCRYPTION_SETUP encryption;     /*< Binlog encryption setup */
     void              *encryption_ctx;      /*< Encryption context */
     struct router_instance  *next;
@@ -751,16 +862,34 @@ extern int blr_master_connected(ROUTER_INSTANCE *);
 extern int blr_slave_request(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern void blr_slave_rotate(ROUTER_INSTANCE *, ROUTER_SLAVE *, uint8_t *);
 extern int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
+extern bool blr_init_waiting_slaves(ROUTER_INSTANCE *router);
+extern void blr_free_waiting_slaves(ROUTER_INSTANCE *router);
+extern void blr_add_waiting_slave(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
+extern void blr_remove_waiting_slave(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 extern void blr_init_cache(ROUTER_INSTANCE *);
+extern void blr_free_cache(ROUTER_INSTANCE *);
+extern void blr_cache_add_event(ROUTER_INSTANCE *, const char *, uint64_t, uint32_t, const uint8_t *);
+extern GWBUF *blr_cache_read_event(ROUTER_INSTANCE *, const char *, uint64_t, REP_HEADER *);
 
 extern int  blr_file_init(ROUTER_INSTANCE *);
 extern int  blr_write_binlog_record(ROUTER_INSTANCE *, REP_HEADER *, uint32_t pos, uint8_t *);
 extern int  blr_file_rotate(ROUTER_INSTANCE *, char *, uint64_t);
-extern void blr_file_flush(ROUTER_INSTANCE *);
+extern bool blr_file_flush(ROUTER_INSTANCE *, bool);
+extern bool blr_sync_thread_start(ROUTER_INSTANCE *);
+extern void blr_sync_thread_stop(ROUTER_INSTANCE *);
+extern void blr_sync_request(ROUTER_INSTANCE *);
+extern void blr_sync_set_master(ROUTER_INSTANCE *, DCB *);
+extern bool blr_sync_take_ack(ROUTER_INSTANCE *, char *, uint64_t *);
+extern void blr_index_add(ROUTER_INSTANCE *, uint64_t);
+extern bool blr_index_check_pos(ROUTER_INSTANCE *, const char *, uint64_t);
 extern BLFILE *blr_open_binlog(ROUTER_INSTANCE *, char *);
+extern unsigned long blr_file_read_limit(ROUTER_INSTANCE *, BLFILE *);
 extern GWBUF *blr_read_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, REP_HEADER *, char *,
-                              const SLAVE_ENCRYPTION_CTX *);
+                              const SLAVE_ENCRYPTION_CTX *, BLR_READ_BUFFER *);
 extern void blr_close_binlog(ROUTER_INSTANCE *, BLFILE *);
+extern BLR_READ_BUFFER *blr_alloc_read_buffer(unsigned long, bool);
+extern void blr_reset_read_buffer(BLR_READ_BUFFER *);
+extern void blr_free_read_buffer(BLR_READ_BUFFER *);
 extern unsigned long blr_file_size(BLFILE *);
 extern int blr_statistics(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern int blr_ping(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
@@ -782,6 +911,13 @@ extern bool blr_send_event(blr_thread_role_t role,
                            ROUTER_SLAVE *slave,
                            REP_HEADER *hdr,
                            uint8_t *buf);
+extern bool blr_queue_event(blr_thread_role_t role,
+                            const char* binlog_name,
+                            uint32_t binlog_pos,
+                            ROUTER_SLAVE *slave,
+                            REP_HEADER *hdr,
+                            uint8_t *buf,
+                            GWBUF **queue);
 
 extern const char *blr_get_encryption_algorithm(int);
 extern int blr_check_encryption_algorithm(char *);
@@ -46,16 +46,304 @@
 #include <maxscale/spinlock.h>
 
 #include <maxscale/log_manager.h>
+#include <maxscale/alloc.h>
 
 
+
+/**
+ * The events are expected to be at least this large on the average; the
+ * number of events the cache can hold is its size divided by this.
+ */
+#define BLR_CACHE_AVG_EVENT_SIZE 128
+
+static inline BLCACHE_RECORD *
+blr_cache_record(BLCACHE *cache, uint32_t i)
+{
+    return &cache->records[(cache->first + i) % cache->max_records];
+}
+
+/**
+ * Copy an event to the ring buffer, wrapping around at its end.
+ *
+ * @param cache     The event cache
+ * @param offset    Where the event should be copied, as a running count of bytes
+ * @param data      The event
+ * @param size      The size of the event
+ */
+static void
+blr_cache_copy_in(BLCACHE *cache, uint64_t offset, const uint8_t *data, uint32_t size)
+{
+    uint64_t start = offset % cache->size;
+    uint64_t n = MXS_MIN(size, cache->size - start);
+
+    memcpy(cache->data + start, data, n);
+    memcpy(cache->data, data + n, size - n);
+}
+
+/**
+ * Copy an event from the ring buffer, wrapping around at its end.
+ *
+ * @param cache     The event cache
+ * @param offset    Where the event is, as a running count of bytes
+ * @param data      Where the event should be copied
+ * @param size      The size of the event
+ */
+static void
+blr_cache_copy_out(BLCACHE *cache, uint64_t offset, uint8_t *data, uint32_t size)
+{
+    uint64_t start = offset % cache->size;
+    uint64_t n = MXS_MIN(size, cache->size - start);
+
+    memcpy(data, cache->data + start, n);
+    memcpy(data + n, cache->data, size - n);
+}
+
 /**
- * Initialise the cache for this instanceof the binlog router. As a side
- * effect also determine the binlog file to read and the position to read
- * from.
+ * Initialise the event cache for this instance of the binlog router.
+ * If the configured size is 0, no events are cached.
  *
  * @param   router      The router instance
  */
 void
 blr_init_cache(ROUTER_INSTANCE *router)
 {
+    BLCACHE *cache;
+
+    if (router->event_cache_size == 0)
+    {
+        return;
+    }
+
+    if ((cache = (BLCACHE *)MXS_CALLOC(1, sizeof(BLCACHE))) == NULL)
+    {
+        return;
+    }
+
+    cache->size = router->event_cache_size;
+    cache->max_records = cache->size / BLR_CACHE_AVG_EVENT_SIZE + 1;
+    cache->data = (uint8_t *)MXS_MALLOC(cache->size);
+    cache->records = (BLCACHE_RECORD *)MXS_MALLOC(cache->max_records * sizeof(BLCACHE_RECORD));
+
+    if (cache->data == NULL || cache->records == NULL)
+    {
+        MXS_ERROR("%s: Failed to allocate an event cache of %lu bytes, "
+                  "slaves will be sent events from the binlog files only.",
+                  router->service->name, router->event_cache_size);
+        MXS_FREE(cache->data);
+        MXS_FREE(cache->records);
+        MXS_FREE(cache);
+        return;
+    }
+
+    spinlock_init(&cache->lock);
+    router->event_cache = cache;
+
+    MXS_NOTICE("%s: The most recent %lu bytes of binlog events are cached "
+               "for the slaves.", router->service->name, router->event_cache_size);
+}
+
+/**
+ * Free the event cache of this instance of the binlog router.
+ *
+ * @param   router      The router instance
+ */
+void
+blr_free_cache(ROUTER_INSTANCE *router)
+{
+    BLCACHE *cache = router->event_cache;
+
+    if (cache)
+    {
+        router->event_cache = NULL;
+        MXS_FREE(cache->data);
+        MXS_FREE(cache->records);
+        MXS_FREE(cache);
+    }
+}
+
+/**
+ * Add an event, that has been written to a binlog file, to the event cache.
+ * When the cache is full, the oldest events are removed from it.
+ *
+ * @param router        The router instance
+ * @param binlogname    The binlog file the event was written to
+ * @param pos           The position the event was written to
+ * @param size          The size of the event
+ * @param buf           The event, as received from the master
+ */
+void
+blr_cache_add_event(ROUTER_INSTANCE *router,
+                    const char *binlogname,
+                    uint64_t pos,
+                    uint32_t size,
+                    const uint8_t *buf)
+{
+    BLCACHE *cache = router->event_cache;
+    BLCACHE_RECORD *record;
+
+    if (cache == NULL || size > cache->size)
+    {
+        return;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (strcmp(cache->binlogname, binlogname) != 0)
+    {
+        strcpy(cache->prevbinlog, cache->binlogname);
+        strcpy(cache->binlogname, binlogname);
+        cache->seq++;
+    }
+
+    /**
+     * If the binlog file has been truncated and is being written again,
+     * the events cached from the position onwards are no longer valid.
+     */
+    while (cache->cnt > 0)
+    {
+        record = blr_cache_record(cache, cache->cnt - 1);
+
+        if (record->seq != cache->seq || record->pos < pos)
+        {
+            break;
+        }
+
+        cache->cnt--;
+    }
+
+    /* Remove the events that will be overwritten */
+    while (cache->cnt > 0 &&
+           (cache->cnt == cache->max_records ||
+            blr_cache_record(cache, 0)->offset + cache->size < cache->written + size))
+    {
+        cache->first = (cache->first + 1) % cache->max_records;
+        cache->cnt--;
+    }
+
+    if (cache->cnt == 0)
+    {
+        cache->first = 0;
+    }
+
+    record = blr_cache_record(cache, cache->cnt);
+    record->seq = cache->seq;
+    record->pos = pos;
+    record->offset = cache->written;
+    record->size = size;
+
+    blr_cache_copy_in(cache, cache->written, buf, size);
+    cache->written += size;
+    cache->cnt++;
+
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * Read an event from the event cache.
+ *
+ * Only events that can safely be sent to the slaves are returned, that is,
+ * events that blr_read_binlog() would also return.
+ *
+ * @param router        The router instance
+ * @param binlogname    The binlog file of the event
+ * @param pos           The position of the event
+ * @param hdr           Binlog header to populate
+ * @return              The event wrapped in a GWBUF, or NULL if it is not cached
+ */
+GWBUF *
+blr_cache_read_event(ROUTER_INSTANCE *router,
+                     const char *binlogname,
+                     uint64_t pos,
+                     REP_HEADER *hdr)
+{
+    BLCACHE *cache = router->event_cache;
+    GWBUF *result = NULL;
+    bool safe;
+    uint32_t seq;
+    bool found_file = true;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&router->binlog_lock);
+    safe = strcmp(router->binlog_name, binlogname) != 0 || pos < router->binlog_position;
+    spinlock_release(&router->binlog_lock);
+
+    if (!safe)
+    {
+        return NULL;
+    }
+
+    spinlock_acquire(&cache->lock);
+
+    if (strcmp(cache->binlogname, binlogname) == 0)
+    {
+        seq = cache->seq;
+    }
+    else if (strcmp(cache->prevbinlog, binlogname) == 0)
+    {
+        seq = cache->seq - 1;
+    }
+    else
+    {
+        found_file = false;
+    }
+
+    if (found_file)
+    {
+        /* The events are ordered by file and position, oldest first */
+        uint32_t lo = 0;
+        uint32_t hi = cache->cnt;
+
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            BLCACHE_RECORD *record = blr_cache_record(cache, mid);
+
+            if (record->seq < seq || (record->seq == seq && record->pos < pos))
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        if (lo < cache->cnt)
+        {
+            BLCACHE_RECORD *record = blr_cache_record(cache, lo);
+
+            if (record->seq == seq && record->pos == pos &&
+                (result = gwbuf_alloc(record->size)) != NULL)
+            {
+                blr_cache_copy_out(cache, record->offset, GWBUF_DATA(result), record->size);
+            }
+        }
+    }
+
+    spinlock_release(&cache->lock);
+
+    if (result)
+    {
+        uint8_t *ptr = GWBUF_DATA(result);
+
+        hdr->timestamp = EXTRACT32(ptr);
+        hdr->event_type = ptr[4];
+        hdr->serverid = EXTRACT32(&ptr[5]);
+        hdr->event_size = extract_field(&ptr[9], 32);
+        hdr->next_pos = EXTRACT32(&ptr[13]);
+        hdr->flags = EXTRACT16(&ptr[17]);
+        hdr->ok = SLAVE_POS_READ_OK;
+
+        atomic_add_uint64(&router->stats.n_cachehits, 1);
+    }
+    else
+    {
+        atomic_add_uint64(&router->stats.n_cachemisses, 1);
+    }
+
+    return result;
 }
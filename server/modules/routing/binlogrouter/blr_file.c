@@ -73,6 +73,10 @@
 #include <inttypes.h>
 #include <maxscale/secrets.h>
 #include <maxscale/encryption.h>
+#include <maxscale/platform.h>
+#include <maxscale/crc32.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/poll.h>
 
 /**
  * AES_CTR handling
@@ -154,6 +158,30 @@ const EVP_CIPHER *(*ciphers[])(unsigned int) =
     aes_ecb
 };
 
+/**
+ * A cipher context kept initialised with a key, so that the key schedule
+ * is computed only when the key changes and not for every binlog event.
+ * For every event only the IV is set.
+ */
+typedef struct blr_cipher_ctx
+{
+    EVP_CIPHER_CTX *ctx;                  /*< The context, NULL until first used */
+    int algorithm;                        /*< The algorithm the context uses */
+    int action;                           /*< Encryption or decryption */
+    unsigned int key_len;                 /*< The length of the key, 0 if not initialised */
+    uint8_t key[BINLOG_AES_MAX_KEY_LEN];  /*< The key the context was initialised with */
+} BLR_CIPHER_CTX;
+
+/**
+ * The cipher contexts of a thread: decryption, encryption and the AES_ECB
+ * encryption of the tail of AES_CBC. The events are encrypted by the thread
+ * of the master connection and decrypted by the threads of the slaves, so
+ * the contexts are per thread and never locked. They are kept as long as
+ * the thread lives.
+ */
+#define BLR_CIPHER_CTX_ECB 2
+static thread_local BLR_CIPHER_CTX blr_cipher_ctxs[BLR_CIPHER_CTX_ECB + 1];
+
 #if OPENSSL_VERSION_NUMBER > 0x10000000L
 static const char *blr_encryption_algorithm_names[BINLOG_MAX_CRYPTO_SCHEME] = {"aes_cbc", "aes_ctr"};
 static const char blr_encryption_algorithm_list_names[] = "aes_cbc, aes_ctr";
@@ -163,6 +191,8 @@ static const char blr_encryption_algorithm_list_names[] = "aes_cbc";
 #endif
 
 static int  blr_file_create(ROUTER_INSTANCE *router, char *file);
+static void blr_index_open(ROUTER_INSTANCE *router, const char *file, bool create);
+static uint64_t blr_index_lookup(ROUTER_INSTANCE *router, const char *file, uint64_t pos);
 static void blr_log_header(int priority, char *msg, uint8_t *ptr);
 void blr_cache_read_master_data(ROUTER_INSTANCE *router);
 int blr_file_get_next_binlogname(ROUTER_INSTANCE *router);
@@ -202,6 +232,11 @@ static GWBUF *blr_prepare_encrypted_event(ROUTER_INSTANCE *router,
                                           uint32_t pos,
                                           const uint8_t *nonce,
                                           int action);
+static EVP_CIPHER_CTX *blr_get_cipher_ctx(int algorithm,
+                                          const uint8_t *key,
+                                          unsigned int key_len,
+                                          const uint8_t *iv,
+                                          int action);
 static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
                             uint8_t *event,
                             uint32_t event_size,
@@ -220,6 +255,12 @@ static int blr_binlog_event_check(ROUTER_INSTANCE *router,
                                   char *errmsg);
 
 static void blr_report_checksum(REP_HEADER hdr, const uint8_t *buffer, char *output);
+static int blr_read_buffered(BLFILE *file,
+                             uint8_t *buf,
+                             unsigned int len,
+                             unsigned long pos,
+                             unsigned long limit,
+                             BLR_READ_BUFFER *rbuf);
 
 /** MaxScale generated events */
 typedef enum
@@ -362,10 +403,81 @@ blr_file_init(ROUTER_INSTANCE *router)
     return 1;
 }
 
+/**
+ * A binlog file to compress in the housekeeper thread
+ */
+typedef struct
+{
+    char path[PATH_MAX + 1];        /*< The binlog file */
+    char tmp_path[PATH_MAX + 1];    /*< The compressed file before it is renamed */
+} BLR_COMPRESS_TASK;
+
+/**
+ * Compress a binlog file that is no longer written to. Run by the housekeeper.
+ *
+ * @param data The BLR_COMPRESS_TASK, freed here
+ */
+static void
+blr_compress_task(void *data)
+{
+    BLR_COMPRESS_TASK *task = (BLR_COMPRESS_TASK *)data;
+
+    binlog_zfile_compress(task->path, task->tmp_path);
+    MXS_FREE(task);
+}
+
+/**
+ * Schedule the compression of a binlog file
+ *
+ * @param router    The router instance
+ * @param file      The binlog file name
+ */
+static void
+blr_file_schedule_compress(ROUTER_INSTANCE *router, const char *file)
+{
+    BLR_COMPRESS_TASK *task = MXS_MALLOC(sizeof(BLR_COMPRESS_TASK));
+    char *name = MXS_MALLOC(strlen(router->service->name) + strlen(" compress ") + strlen(file) + 1);
+
+    if (task && name &&
+        snprintf(task->path, sizeof(task->path), "%s/%s",
+                 router->binlogdir, file) < (int)sizeof(task->path) &&
+        snprintf(task->tmp_path, sizeof(task->tmp_path), "%s/.%s.tmp",
+                 router->binlogdir, file) < (int)sizeof(task->tmp_path))
+    {
+        sprintf(name, "%s compress %s", router->service->name, file);
+
+        if (hktask_oneshot(name, blr_compress_task, task, 0))
+        {
+            task = NULL;
+        }
+    }
+
+    MXS_FREE(task);
+    MXS_FREE(name);
+}
+
 int
 blr_file_rotate(ROUTER_INSTANCE *router, char *file, uint64_t pos)
 {
-    return blr_file_create(router, file);
+    char prev[BINLOG_FNAMELEN + 1];
+    bool compress = router->compress_binlogs && router->binlog_fd != -1 &&
+                    !router->encryption.enabled && !router->pending_transaction;
+
+    strcpy(prev, router->binlog_name);
+
+    int rval = blr_file_create(router, file);
+
+    /*
+     * The previous file is no longer written to. Encrypted files are not
+     * compressed as the events would not get any smaller, and a file with
+     * a pending transaction may still be truncated.
+     */
+    if (rval && compress && strcmp(prev, file) != 0)
+    {
+        blr_file_schedule_compress(router, prev);
+    }
+
+    return rval;
 }
 
 
@@ -419,6 +531,11 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
     {
         if (blr_file_add_magic(fd))
         {
+            /* A pending Semi-Sync ACK may be for the previous file */
+            if (router->binlog_fd != -1)
+            {
+                blr_file_flush(router, true);
+            }
             close(router->binlog_fd);
             spinlock_acquire(&router->binlog_lock);
             strcpy(router->binlog_name, file);
@@ -429,6 +546,8 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
             router->last_written = BINLOG_MAGIC_SIZE;
             spinlock_release(&router->binlog_lock);
 
+            blr_index_open(router, file, true);
+
             created = 1;
         }
         else
@@ -509,6 +628,261 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
     }
     router->binlog_fd = fd;
     spinlock_release(&router->binlog_lock);
+
+    blr_index_open(router, file, false);
+}
+
+/** The directory of the position indexes, under router->binlogdir */
+static const char BLR_INDEX_DIR[] = "/index";
+
+/**
+ * Get the path of the position index of a binlog file
+ *
+ * @param router    The router instance
+ * @param file      The binlog file name
+ * @param path      Buffer of PATH_MAX + 1 bytes for the path
+ * @return          True if the path is not too long
+ */
+static bool
+blr_index_path(ROUTER_INSTANCE *router, const char *file, char *path)
+{
+    static const char SUFFIX[] = ".idx";
+    size_t len = strlen(router->binlogdir) + (sizeof(BLR_INDEX_DIR) - 1) + 1 +
+                 strlen(file) + (sizeof(SUFFIX) - 1);
+
+    if (len > PATH_MAX)
+    {
+        MXS_ERROR("The index path %s%s/%s%s is longer than the maximum allowed length %d.",
+                  router->binlogdir, BLR_INDEX_DIR, file, SUFFIX, PATH_MAX);
+        return false;
+    }
+
+    sprintf(path, "%s%s/%s%s", router->binlogdir, BLR_INDEX_DIR, file, SUFFIX);
+    return true;
+}
+
+/**
+ * Open the position index of the binlog file the router writes to.
+ *
+ * The index is a sequence of 64-bit positions in the byte order of the
+ * host. Each is the start of an event where no transaction is open, and
+ * they are at least binlog_index_interval bytes apart. Entries past the
+ * end of an existing binlog file, e.g. after the file was truncated, are
+ * removed.
+ *
+ * @param router    The router instance
+ * @param file      The binlog file name
+ * @param create    Whether the binlog file was just created
+ */
+static void
+blr_index_open(ROUTER_INSTANCE *router, const char *file, bool create)
+{
+    char path[PATH_MAX + 1] = "";
+
+    if (router->binlog_index_interval == 0)
+    {
+        return;
+    }
+
+    if (router->index_fd != -1)
+    {
+        close(router->index_fd);
+        router->index_fd = -1;
+    }
+
+    router->last_indexed_pos = BINLOG_MAGIC_SIZE;
+
+    if (!blr_index_path(router, file, path))
+    {
+        return;
+    }
+
+    /* Create the index directory if needed */
+    char *dir_end = strrchr(path, '/');
+    *dir_end = '\0';
+
+    if (access(path, R_OK) == -1)
+    {
+        mkdir(path, 0700);
+    }
+
+    *dir_end = '/';
+
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | (create ? O_TRUNC : 0), 0666);
+
+    if (fd == -1)
+    {
+        char err[MXS_STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to open the binlog index %s, %s.",
+                  router->service->name, path, strerror_r(errno, err, sizeof(err)));
+        return;
+    }
+
+    if (!create)
+    {
+        struct stat statb;
+        uint64_t n_entries = fstat(fd, &statb) == 0 ? statb.st_size / sizeof(uint64_t) : 0;
+        uint64_t entry = 0;
+
+        while (n_entries > 0 &&
+               (pread(fd, &entry, sizeof(entry), (n_entries - 1) * sizeof(entry)) != sizeof(entry) ||
+                entry > router->current_pos))
+        {
+            n_entries--;
+        }
+
+        if (ftruncate(fd, n_entries * sizeof(entry)) != 0)
+        {
+            char err[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to truncate the binlog index %s, %s.",
+                      router->service->name, path, strerror_r(errno, err, sizeof(err)));
+            close(fd);
+            return;
+        }
+
+        if (n_entries > 0)
+        {
+            router->last_indexed_pos = entry;
+        }
+    }
+
+    router->index_fd = fd;
+}
+
+/**
+ * Add a position of the current binlog file to its index, unless the
+ * previous entry is less than binlog_index_interval bytes before it.
+ *
+ * Called by the master thread at the start of each event when no
+ * transaction is open.
+ *
+ * @param router    The router instance
+ * @param pos       The position
+ */
+void
+blr_index_add(ROUTER_INSTANCE *router, uint64_t pos)
+{
+    if (router->index_fd != -1 && pos >= router->last_indexed_pos + router->binlog_index_interval)
+    {
+        if (write(router->index_fd, &pos, sizeof(pos)) == sizeof(pos))
+        {
+            router->last_indexed_pos = pos;
+        }
+        else
+        {
+            char err[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to write the index of binlog %s, no more positions "
+                      "of it are indexed: %s.", router->service->name, router->binlog_name,
+                      strerror_r(errno, err, sizeof(err)));
+            close(router->index_fd);
+            router->index_fd = -1;
+        }
+    }
+}
+
+/**
+ * Find the last indexed position of a binlog file that is not after a
+ * position, with a binary search of the index.
+ *
+ * @param router    The router instance
+ * @param file      The binlog file name
+ * @param pos       The position
+ * @return          The indexed position or 0 if there is none
+ */
+static uint64_t
+blr_index_lookup(ROUTER_INSTANCE *router, const char *file, uint64_t pos)
+{
+    char path[PATH_MAX + 1] = "";
+    uint64_t found = 0;
+    int fd;
+
+    if (router->binlog_index_interval &&
+        blr_index_path(router, file, path) &&
+        (fd = open(path, O_RDONLY)) != -1)
+    {
+        struct stat statb;
+
+        if (fstat(fd, &statb) == 0)
+        {
+            uint64_t low = 0;
+            uint64_t high = statb.st_size / sizeof(uint64_t);
+
+            while (low < high)
+            {
+                uint64_t mid = low + (high - low) / 2;
+                uint64_t entry;
+
+                if (pread(fd, &entry, sizeof(entry), mid * sizeof(entry)) != sizeof(entry))
+                {
+                    break;
+                }
+
+                if (entry <= pos)
+                {
+                    found = entry;
+                    low = mid + 1;
+                }
+                else
+                {
+                    high = mid;
+                }
+            }
+        }
+
+        close(fd);
+    }
+
+    return found;
+}
+
+/**
+ * Check whether a position of a binlog file is the start of an event.
+ *
+ * The event headers are walked from the last indexed position before it,
+ * so only the events of about binlog_index_interval bytes are looked at.
+ * If the file has no index, or the walk ends before the position, it
+ * can not be told.
+ *
+ * @param router    The router instance
+ * @param file      The binlog file name
+ * @param pos       The position
+ * @return          False if the position is known to be inside an event
+ */
+bool
+blr_index_check_pos(ROUTER_INSTANCE *router, const char *file, uint64_t pos)
+{
+    uint64_t event_pos = blr_index_lookup(router, file, pos);
+    char path[PATH_MAX + 1] = "";
+    int fd;
+
+    if (event_pos != 0 && event_pos < pos &&
+        snprintf(path, sizeof(path), "%s/%s", router->binlogdir, file) < (int)sizeof(path) &&
+        (fd = open(path, O_RDONLY)) != -1)
+    {
+        uint8_t size_buf[4];
+        BINLOG_ZFILE *zfile = binlog_zfile_is_compressed(fd) ? binlog_zfile_open(fd) : NULL;
+
+        /* The event size is in clear also in encrypted binlog files */
+        while (event_pos < pos &&
+               (zfile ?
+                binlog_zfile_pread(zfile, size_buf, sizeof(size_buf), event_pos + BINLOG_EVENT_LEN_OFFSET) :
+                pread(fd, size_buf, sizeof(size_buf), event_pos + BINLOG_EVENT_LEN_OFFSET)) == sizeof(size_buf))
+        {
+            uint32_t event_size = EXTRACT32(size_buf);
+
+            if (event_size < BINLOG_EVENT_HDR_LEN)
+            {
+                break;
+            }
+
+            event_pos += event_size;
+        }
+
+        binlog_zfile_close(zfile);
+        close(fd);
+    }
+
+    return event_pos <= pos;
 }
 
 /**
@@ -525,6 +899,7 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     int n = 0;
     bool write_start_encryption_event = false;
     uint64_t file_offset = router->current_pos;
+    uint64_t event_pos;
     uint32_t event_size[4];
 
     /* Track whether FORMAT_DESCRIPTION_EVENT has been received */
@@ -548,6 +923,8 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
         n = hole_size;
     }
 
+    event_pos = router->last_written;
+
     if (router->encryption.enabled && router->encryption_ctx != NULL)
     {
         GWBUF *encrypted;
@@ -602,6 +979,11 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     router->last_event_pos = hdr->next_pos - hdr->event_size;
     spinlock_release(&router->binlog_lock);
 
+    router->unsynced_bytes += size;
+
+    /* The unencrypted event is cached, as that is what is sent to the slaves */
+    blr_cache_add_event(router, router->binlog_name, event_pos, size, buf);
+
     /* Check whether adding the Start Encryption event into current binlog */
     if (router->encryption.enabled && write_start_encryption_event)
     {
@@ -626,15 +1008,310 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     return n;
 }
 
+/**
+ * @return The monotonic time in milliseconds
+ */
+static uint64_t blr_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Check whether the binlog file should be synced according to
+ * binlog_sync_interval and binlog_sync_size
+ *
+ * @param   router  The binlog router
+ * @param   force   Sync even if it is not yet time
+ * @param   now     The current time in milliseconds
+ * @return          True if the file should be synced
+ */
+static bool
+blr_file_sync_due(ROUTER_INSTANCE *router, bool force, uint64_t now)
+{
+    return force ||
+           (router->binlog_sync_interval == 0 && router->binlog_sync_size == 0) ||
+           (router->binlog_sync_size && router->unsynced_bytes >= router->binlog_sync_size) ||
+           (router->binlog_sync_interval && now - router->last_sync >= router->binlog_sync_interval);
+}
+
 /**
  * Flush the content of the binlog file to disk.
  *
+ * If binlog_sync_interval or binlog_sync_size is set, the file is synced
+ * with fdatasync only once that much time has passed or that much data has
+ * been written since the previous sync, so that many reads of events from
+ * the master share one sync. Otherwise the file is synced every time.
+ *
+ * @param   router  The binlog router
+ * @param   force   Sync whatever has been written even if it is not yet time
+ * @return          True if everything written to the file is on disk
+ */
+bool
+blr_file_flush(ROUTER_INSTANCE *router, bool force)
+{
+    if (router->binlog_sync_interval == 0 && router->binlog_sync_size == 0)
+    {
+        fsync(router->binlog_fd);
+        router->unsynced_bytes = 0;
+        return true;
+    }
+
+    if (router->unsynced_bytes == 0)
+    {
+        return true;
+    }
+
+    uint64_t now = blr_clock_ms();
+
+    if (blr_file_sync_due(router, force, now))
+    {
+        if (fdatasync(router->binlog_fd) == 0)
+        {
+            router->unsynced_bytes = 0;
+            router->last_sync = now;
+        }
+        else
+        {
+            char err_msg[MXS_STRERROR_BUFLEN];
+            MXS_ERROR("%s: Failed to sync binlog file %s, %s.",
+                      router->service->name, router->binlog_name,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+    }
+
+    return router->unsynced_bytes == 0;
+}
+
+/**
+ * The binlog sync thread
+ *
+ * Syncs the files handed over by blr_sync_request and passes the ACKs that
+ * waited for the syncs to the thread that owns the master connection. The
+ * requests that are pending when the thread is stopped are completed first.
+ *
+ * @param data  The router instance
+ */
+static void
+blr_sync_thread_main(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)data;
+    BLR_SYNC_THREAD *sync = &router->sync;
+    char ack_file[BINLOG_FNAMELEN + 1];
+
+    pthread_mutex_lock(&sync->lock);
+
+    while (!sync->stop || sync->fd != -1 || sync->ack)
+    {
+        if (sync->fd == -1 && !sync->ack)
+        {
+            pthread_cond_wait(&sync->cond, &sync->lock);
+            continue;
+        }
+
+        int fd = sync->fd;
+        bool ack = sync->ack;
+        uint64_t ack_pos = sync->ack_pos;
+        strcpy(ack_file, sync->ack_file);
+        sync->fd = -1;
+        sync->ack = false;
+
+        pthread_mutex_unlock(&sync->lock);
+
+        bool synced = true;
+
+        if (fd != -1)
+        {
+            if (fdatasync(fd) != 0)
+            {
+                char err_msg[MXS_STRERROR_BUFLEN];
+                MXS_ERROR("%s: Failed to sync binlog file, %s.", router->service->name,
+                          strerror_r(errno, err_msg, sizeof(err_msg)));
+                synced = false;
+            }
+
+            close(fd);
+        }
+
+        pthread_mutex_lock(&sync->lock);
+
+        /**
+         * An ACK for data that could not be synced is not sent, the master
+         * stops waiting for it once its Semi-Sync timeout expires.
+         */
+        if (ack && synced && sync->master)
+        {
+            sync->ready = true;
+            sync->ready_pos = ack_pos;
+            strcpy(sync->ready_file, ack_file);
+            /** Only the thread that owns the master connection may write to it */
+            poll_fake_write_event(sync->master);
+        }
+    }
+
+    pthread_mutex_unlock(&sync->lock);
+}
+
+/**
+ * Start the binlog sync thread of a router instance
+ *
+ * @param   router  The binlog router
+ * @return          True if the thread was started
+ */
+bool
+blr_sync_thread_start(ROUTER_INSTANCE *router)
+{
+    BLR_SYNC_THREAD *sync = &router->sync;
+
+    pthread_mutex_init(&sync->lock, NULL);
+    pthread_cond_init(&sync->cond, NULL);
+    sync->stop = false;
+    sync->fd = -1;
+    sync->ack = false;
+    sync->ready = false;
+    sync->master = NULL;
+    sync->started = thread_start(&sync->thread, blr_sync_thread_main, router) != NULL;
+
+    return sync->started;
+}
+
+/**
+ * Stop the binlog sync thread of a router instance
+ *
+ * The files handed over to the thread are synced before it stops.
+ *
  * @param   router  The binlog router
  */
 void
-blr_file_flush(ROUTER_INSTANCE *router)
+blr_sync_thread_stop(ROUTER_INSTANCE *router)
 {
-    fsync(router->binlog_fd);
+    BLR_SYNC_THREAD *sync = &router->sync;
+
+    if (sync->started)
+    {
+        pthread_mutex_lock(&sync->lock);
+        sync->stop = true;
+        sync->master = NULL;
+        sync->ready = false;
+        pthread_cond_signal(&sync->cond);
+        pthread_mutex_unlock(&sync->lock);
+
+        thread_wait(sync->thread);
+        sync->started = false;
+    }
+}
+
+/**
+ * Hand over what has been written to the binlog file to the sync thread
+ *
+ * Called by the master connection once the events it has read have been
+ * written. The file is handed over as a duplicate of its descriptor, so the
+ * binlog can be rotated while the sync is in progress. A request that the
+ * thread has not yet started is replaced: one sync covers all the writes and
+ * the Semi-Sync ACK of the latest event is sent once it completes.
+ *
+ * @param   router  The binlog router
+ */
+void
+blr_sync_request(ROUTER_INSTANCE *router)
+{
+    BLR_SYNC_THREAD *sync = &router->sync;
+    uint64_t now = blr_clock_ms();
+    int fd = -1;
+
+    if (router->unsynced_bytes && blr_file_sync_due(router, router->semisync_ack_pending, now))
+    {
+        if ((fd = dup(router->binlog_fd)) == -1)
+        {
+            char err_msg[MXS_STRERROR_BUFLEN];
+            MXS_WARNING("%s: Failed to duplicate binlog file descriptor, syncing the file "
+                        "in the master connection, %s.", router->service->name,
+                        strerror_r(errno, err_msg, sizeof(err_msg)));
+            fsync(router->binlog_fd);
+        }
+
+        router->unsynced_bytes = 0;
+        router->last_sync = now;
+    }
+
+    if (fd != -1 || router->semisync_ack_pending)
+    {
+        pthread_mutex_lock(&sync->lock);
+
+        if (fd != -1)
+        {
+            if (sync->fd != -1)
+            {
+                close(sync->fd);
+            }
+
+            sync->fd = fd;
+        }
+
+        if (router->semisync_ack_pending)
+        {
+            sync->ack = true;
+            sync->ack_pos = router->semisync_ack_pos;
+            strcpy(sync->ack_file, router->semisync_ack_file);
+            router->semisync_ack_pending = false;
+        }
+
+        pthread_cond_signal(&sync->cond);
+        pthread_mutex_unlock(&sync->lock);
+    }
+}
+
+/**
+ * Set the master connection the synced ACKs are sent to
+ *
+ * An ACK that waits to be sent to the previous connection is discarded.
+ *
+ * @param   router  The binlog router
+ * @param   master  The master connection or NULL when it is closed
+ */
+void
+blr_sync_set_master(ROUTER_INSTANCE *router, DCB *master)
+{
+    BLR_SYNC_THREAD *sync = &router->sync;
+
+    if (sync->started)
+    {
+        pthread_mutex_lock(&sync->lock);
+        sync->master = master;
+        sync->ready = false;
+        sync->ack = false;
+        pthread_mutex_unlock(&sync->lock);
+    }
+}
+
+/**
+ * Take the Semi-Sync ACK that the sync thread has completed
+ *
+ * @param   router  The binlog router
+ * @param   file    Buffer of BINLOG_FNAMELEN + 1 bytes for the file of the ACK
+ * @param   pos     The position of the ACK
+ * @return          True if there was an ACK to send
+ */
+bool
+blr_sync_take_ack(ROUTER_INSTANCE *router, char *file, uint64_t *pos)
+{
+    BLR_SYNC_THREAD *sync = &router->sync;
+    bool rval = false;
+
+    pthread_mutex_lock(&sync->lock);
+
+    if (sync->ready)
+    {
+        strcpy(file, sync->ready_file);
+        *pos = sync->ready_pos;
+        sync->ready = false;
+        rval = true;
+    }
+
+    pthread_mutex_unlock(&sync->lock);
+
+    return rval;
 }
 
 /**
@@ -687,7 +1364,6 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
     }
     strcpy(file->binlogname, binlog);
     file->refcnt = 1;
-    file->cache = 0;
     spinlock_init(&file->lock);
 
     strcpy(path, router->binlogdir);
@@ -702,6 +1378,16 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
         return NULL;
     }
 
+    if (binlog_zfile_is_compressed(file->fd) &&
+        (file->zfile = binlog_zfile_open(file->fd)) == NULL)
+    {
+        MXS_ERROR("Failed to open compressed binlog file %s", path);
+        close(file->fd);
+        MXS_FREE(file);
+        spinlock_release(&router->fileslock);
+        return NULL;
+    }
+
     file->next = router->files;
     router->files = file;
     spinlock_release(&router->fileslock);
@@ -709,6 +1395,44 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
     return file;
 }
 
+/**
+ * Get how far a binlog file may be read
+ *
+ * Nothing past the safe position of the file being written may be read, as
+ * it may still be truncated and written again.
+ *
+ * @param router    The router instance
+ * @param file      The binlog file
+ * @return          The position up to which the file may be read
+ */
+unsigned long
+blr_file_read_limit(ROUTER_INSTANCE *router, BLFILE *file)
+{
+    unsigned long limit = 0;
+    struct stat statb;
+
+    spinlock_acquire(&router->binlog_lock);
+    spinlock_acquire(&file->lock);
+
+    if (strcmp(router->binlog_name, file->binlogname) == 0)
+    {
+        limit = router->binlog_position;
+    }
+    else if (file->zfile)
+    {
+        limit = binlog_zfile_size(file->zfile);
+    }
+    else if (fstat(file->fd, &statb) == 0)
+    {
+        limit = statb.st_size;
+    }
+
+    spinlock_release(&file->lock);
+    spinlock_release(&router->binlog_lock);
+
+    return limit;
+}
+
 /**
  * Read a replication event into a GWBUF structure.
  *
@@ -718,6 +1442,8 @@ blr_open_binlog(ROUTER_INSTANCE *router, char *binlog)
  * @param hdr       Binlog header to populate
  * @param errmsg    Allocated BINLOG_ERROR_MSG_LEN bytes message error buffer
  * @param enc_ctx   Encryption context for binlog file being read
+ * @param rbuf      Read ahead buffer the event is taken from, or NULL
+ *                  if the event should be read directly from the file
  * @return          The binlog record wrapped in a GWBUF structure
  */
 GWBUF *
@@ -726,13 +1452,15 @@ blr_read_binlog(ROUTER_INSTANCE *router,
                 unsigned long pos,
                 REP_HEADER *hdr,
                 char *errmsg,
-                const SLAVE_ENCRYPTION_CTX *enc_ctx)
+                const SLAVE_ENCRYPTION_CTX *enc_ctx,
+                BLR_READ_BUFFER *rbuf)
 {
     uint8_t hdbuf[BINLOG_EVENT_HDR_LEN];
     GWBUF *result;
     unsigned char *data;
     int n;
     unsigned long filelen = 0;
+    unsigned long limit;
     struct stat statb;
 
     memset(hdbuf, '\0', BINLOG_EVENT_HDR_LEN);
@@ -747,8 +1475,18 @@ blr_read_binlog(ROUTER_INSTANCE *router,
         return NULL;
     }
 
+    /* A recent event can be sent without reading the file */
+    if ((result = blr_cache_read_event(router, file->binlogname, pos, hdr)) != NULL)
+    {
+        return result;
+    }
+
     spinlock_acquire(&file->lock);
-    if (fstat(file->fd, &statb) == 0)
+    if (file->zfile)
+    {
+        filelen = binlog_zfile_size(file->zfile);
+    }
+    else if (fstat(file->fd, &statb) == 0)
     {
         filelen = statb.st_size;
     }
@@ -819,11 +1557,17 @@ blr_read_binlog(ROUTER_INSTANCE *router,
         return NULL;
     }
 
+    /**
+     * Nothing past the safe position of the file being written may be read
+     * ahead, as it may still be truncated and written again.
+     */
+    limit = strcmp(router->binlog_name, file->binlogname) == 0 ? router->binlog_position : filelen;
+
     spinlock_release(&file->lock);
     spinlock_release(&router->binlog_lock);
 
     /* Read the header information from the file */
-    if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+    if ((n = blr_read_buffered(file, hdbuf, BINLOG_EVENT_HDR_LEN, pos, limit, rbuf)) != BINLOG_EVENT_HDR_LEN)
     {
         switch (n)
         {
@@ -887,7 +1631,7 @@ blr_read_binlog(ROUTER_INSTANCE *router,
                       pos, file->binlogname, filelen, router->binlog_position,
                       router->binlog_name);
 
-            if ((n = pread(file->fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+            if ((n = blr_read_buffered(file, hdbuf, BINLOG_EVENT_HDR_LEN, pos, filelen, NULL)) != BINLOG_EVENT_HDR_LEN)
             {
                 switch (n)
                 {
@@ -967,8 +1711,8 @@ blr_read_binlog(ROUTER_INSTANCE *router,
 
     memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);  // Copy the header in the buffer
 
-    if ((n = pread(file->fd, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
-                   pos + BINLOG_EVENT_HDR_LEN))
+    if ((n = blr_read_buffered(file, &data[BINLOG_EVENT_HDR_LEN], hdr->event_size - BINLOG_EVENT_HDR_LEN,
+                               pos + BINLOG_EVENT_HDR_LEN, limit, rbuf))
         != hdr->event_size - BINLOG_EVENT_HDR_LEN)  // Read the balance
     {
         if (n ==  0)
@@ -1068,6 +1812,152 @@ blr_read_binlog(ROUTER_INSTANCE *router,
     return result;
 }
 
+/**
+ * Read from a binlog file through a read ahead buffer
+ *
+ * If the requested bytes are not in the buffer, the buffer is filled with
+ * as much of the file as fits in it, starting at the requested position,
+ * so that the events that follow can be taken from the buffer without
+ * reading the file again. Requests that are larger than the buffer are
+ * read directly from the file. If the buffer is a mapping, the bytes are
+ * copied from the mapped file.
+ *
+ * @param file      The binlog file
+ * @param buf       Where the bytes are copied to
+ * @param len       How many bytes to read
+ * @param pos       The position of the bytes in the file
+ * @param limit     The position up to which the file may be read ahead
+ * @param rbuf      The read ahead buffer, or NULL if the file should be read directly
+ * @return          The number of bytes read, or -1 on error as with pread
+ */
+static int
+blr_read_buffered(BLFILE *file,
+                  uint8_t *buf,
+                  unsigned int len,
+                  unsigned long pos,
+                  unsigned long limit,
+                  BLR_READ_BUFFER *rbuf)
+{
+    /* A compressed file keeps its own decompressed block */
+    if (file->zfile)
+    {
+        return binlog_zfile_pread(file->zfile, buf, len, pos);
+    }
+
+    if (rbuf && rbuf->data == NULL)
+    {
+        if (strcmp(rbuf->binlogname, file->binlogname) != 0)
+        {
+            binlog_map_close(&rbuf->map);
+            binlog_map_init(&rbuf->map, file->fd);
+            strcpy(rbuf->binlogname, file->binlogname);
+        }
+
+        return binlog_map_pread(&rbuf->map, buf, len, pos, limit);
+    }
+
+    if (rbuf == NULL || len > rbuf->size)
+    {
+        return pread(file->fd, buf, len, pos);
+    }
+
+    if (strcmp(rbuf->binlogname, file->binlogname) != 0 ||
+        pos < rbuf->pos || pos + len > rbuf->pos + rbuf->len)
+    {
+        unsigned long size = rbuf->size;
+        ssize_t n;
+
+        if (limit < pos + size)
+        {
+            size = limit > pos + len ? limit - pos : len;
+        }
+
+        if ((n = pread(file->fd, rbuf->data, size, pos)) == -1)
+        {
+            rbuf->len = 0;
+            return -1;
+        }
+
+        strcpy(rbuf->binlogname, file->binlogname);
+        rbuf->pos = pos;
+        rbuf->len = n;
+
+        if (rbuf->len < len)
+        {
+            len = rbuf->len;
+        }
+    }
+
+    memcpy(buf, rbuf->data + (pos - rbuf->pos), len);
+
+    return len;
+}
+
+/**
+ * Allocate a read ahead buffer for reading binlog files
+ *
+ * @param size      The size of the buffer
+ * @param mapped    Whether the binlog files should be memory mapped instead
+ * @return          The buffer, or NULL if memory could not be allocated
+ */
+BLR_READ_BUFFER *
+blr_alloc_read_buffer(unsigned long size, bool mapped)
+{
+    BLR_READ_BUFFER *rbuf = MXS_CALLOC(1, sizeof(BLR_READ_BUFFER));
+
+    if (rbuf)
+    {
+        binlog_map_init(&rbuf->map, -1);
+
+        if (mapped)
+        {
+            return rbuf;
+        }
+
+        if ((rbuf->data = MXS_MALLOC(size)) == NULL)
+        {
+            MXS_FREE(rbuf);
+            return NULL;
+        }
+
+        rbuf->size = size;
+    }
+
+    return rbuf;
+}
+
+/**
+ * Empty a read ahead buffer
+ *
+ * This must be done whenever the binlog file may have been closed or
+ * written since the buffer was last used.
+ *
+ * @param rbuf      The buffer to empty
+ */
+void
+blr_reset_read_buffer(BLR_READ_BUFFER *rbuf)
+{
+    binlog_map_close(&rbuf->map);
+    rbuf->binlogname[0] = '\0';
+    rbuf->len = 0;
+}
+
+/**
+ * Free a read ahead buffer
+ *
+ * @param rbuf      The buffer to free, may be NULL
+ */
+void
+blr_free_read_buffer(BLR_READ_BUFFER *rbuf)
+{
+    if (rbuf)
+    {
+        binlog_map_close(&rbuf->map);
+        MXS_FREE(rbuf->data);
+        MXS_FREE(rbuf);
+    }
+}
+
 /**
  * Close a binlog file that has been opened to read binlog records
  *
@@ -1109,6 +1999,7 @@ blr_close_binlog(ROUTER_INSTANCE *router, BLFILE *file)
 
     if (file)
     {
+        binlog_zfile_close(file->zfile);
         close(file->fd);
         file->fd = -1;
         MXS_FREE(file);
@@ -1148,6 +2039,10 @@ blr_file_size(BLFILE *file)
 {
     struct stat statb;
 
+    if (file->zfile)
+    {
+        return binlog_zfile_size(file->zfile);
+    }
     if (fstat(file->fd, &statb) == 0)
     {
         return statb.st_size;
@@ -1294,17 +2189,20 @@ blr_file_next_exists(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
 }
 
 /**
- * Read all replication events from a binlog file.
+ * Read the replication events from a binlog file.
  *
  * Routine detects errors and pending transactions
  *
- * @param router  The router instance
- * @param fix     Whether to fix or not errors
- * @param debug   Whether to enable or not the debug for events
- * @return        0 on success, >0 on failure
+ * @param router      The router instance
+ * @param fix         Whether to fix or not errors
+ * @param debug       Whether to enable or not the debug for events
+ * @param resume_pos  If not 0, a position where no transaction is open:
+ *                    the events between the ones at the start of the
+ *                    file and it are skipped
+ * @return            0 on success, >0 on failure
  */
-int
-blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
+static int
+blr_read_events(ROUTER_INSTANCE *router, int fix, int debug, uint64_t resume_pos)
 {
     unsigned long filelen = 0;
     struct stat statb;
@@ -2215,6 +3113,19 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
             }
 
             pos = hdr.next_pos;
+
+            /**
+             * Once the FDE and the possible START_ENCRYPTION_EVENT after it
+             * are read, continue from the indexed position
+             */
+            if (resume_pos > pos && resume_pos <= filelen &&
+                pending_transaction == 0 && hdr.event_type != FORMAT_DESCRIPTION_EVENT)
+            {
+                MXS_NOTICE("Validating binlog file '%s' from the indexed position %lu.",
+                           router->binlog_name, (unsigned long)resume_pos);
+                pos = resume_pos;
+                resume_pos = 0;
+            }
         }
         else
         {
@@ -2253,6 +3164,43 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
     }
 }
 
+/**
+ * Read all replication events from a binlog file.
+ *
+ * Routine detects errors and pending transactions. When only checking the
+ * file, the events before the last position in the index of the file are
+ * skipped. Should the check fail from there, the whole file is checked.
+ *
+ * @param router  The router instance
+ * @param fix     Whether to fix or not errors
+ * @param debug   Whether to enable or not the debug for events
+ * @return        0 on success, >0 on failure
+ */
+int
+blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
+{
+    uint64_t resume_pos = 0;
+
+    if (!fix && !debug)
+    {
+        resume_pos = blr_index_lookup(router, router->binlog_name, UINT64_MAX);
+    }
+
+    unsigned long m_errno = router->m_errno;
+    int rval = blr_read_events(router, fix, debug, resume_pos);
+
+    if (rval != 0 && resume_pos)
+    {
+        MXS_WARNING("Binlog file '%s' could not be validated from the indexed "
+                    "position %lu, validating the whole file.",
+                    router->binlog_name, (unsigned long)resume_pos);
+        router->m_errno = m_errno;
+        rval = blr_read_events(router, fix, debug, 0);
+    }
+
+    return rval;
+}
+
 /**
  * Format a number to G, M, k, or B size
  *
@@ -2552,8 +3500,7 @@ blr_create_ignorable_event(uint32_t event_size,
          * and then the checksum of the real event: 4 byte less than event_size
          */
         uint32_t chksum;
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
+        chksum = mxs_crc32(0, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
 
         // checksum is stored after current event data using 4 bytes
         encode_value(new_event + event_size - BINLOG_EVENT_CRC_SIZE, chksum, 32);
@@ -2751,8 +3698,7 @@ blr_create_start_encryption_event(ROUTER_INSTANCE *router, uint32_t event_pos, b
          * and then the checksum of the event.
          */
         uint32_t chksum;
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
+        chksum = mxs_crc32(0, new_event, event_size - BINLOG_EVENT_CRC_SIZE);
 
         // checksum is stored at the end of current event data: 4 less bytes than event size
         encode_value(new_event + event_size - BINLOG_EVENT_CRC_SIZE, chksum, 32);
@@ -2819,25 +3765,20 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
 
     out_ptr = GWBUF_DATA(outbuf);
 
-    EVP_CIPHER_CTX *ctx = mxs_evp_cipher_ctx_alloc();
+    /* Get the context of the encryption algorithm, set with the IV of this event */
+    EVP_CIPHER_CTX *ctx = blr_get_cipher_ctx(router->encryption.encryption_algorithm,
+                                             key,
+                                             key_len,
+                                             iv,
+                                             action);
 
-    /* Set the encryption algorithm accordingly to key_len and encryption mode */
-    if (!EVP_CipherInit_ex(ctx,
-                           ciphers[router->encryption.encryption_algorithm](router->encryption.key_len),
-                           NULL,
-                           key,
-                           iv,
-                           action))
+    if (ctx == NULL)
     {
         MXS_ERROR("Error in EVP_CipherInit_ex for algo %d", router->encryption.encryption_algorithm);
-        mxs_evp_cipher_ctx_free(ctx);
-        MXS_FREE(outbuf);
+        gwbuf_free(outbuf);
         return NULL;
     }
 
-    /* Set no padding */
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
-
     /* Encryt/Decrypt the input data */
     if (!EVP_CipherUpdate(ctx,
                           out_ptr + 4,
@@ -2846,8 +3787,7 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
                           size))
     {
         MXS_ERROR("Error in EVP_CipherUpdate");
-        mxs_evp_cipher_ctx_free(ctx);
-        MXS_FREE(outbuf);
+        gwbuf_free(outbuf);
         return NULL;
     }
 
@@ -2888,15 +3828,77 @@ static GWBUF *blr_aes_crypt(ROUTER_INSTANCE *router,
 
     if (!finale_ret)
     {
-        MXS_FREE(outbuf);
+        gwbuf_free(outbuf);
         outbuf = NULL;
     }
 
-    mxs_evp_cipher_ctx_free(ctx);
-
     return outbuf;
 }
 
+/**
+ * Get the cipher context of the calling thread for an algorithm and action,
+ * set with the IV of an event. The key schedule is computed only if the
+ * context was not yet initialised with the same key.
+ *
+ * @param algorithm The encryption algorithm
+ * @param key       The encryption key
+ * @param key_len   The length of the key
+ * @param iv        The IV of the event, NULL for AES_ECB
+ * @param action    Crypt action: 1 encrypt, 0 decrypt
+ * @return          The context or NULL on error
+ */
+static EVP_CIPHER_CTX *blr_get_cipher_ctx(int algorithm,
+                                          const uint8_t *key,
+                                          unsigned int key_len,
+                                          const uint8_t *iv,
+                                          int action)
+{
+    BLR_CIPHER_CTX *cipher = &blr_cipher_ctxs[algorithm == BLR_AES_ECB ?
+                                              BLR_CIPHER_CTX_ECB :
+                                              (action == BINLOG_FLAG_ENCRYPT)];
+
+    if (cipher->ctx == NULL && (cipher->ctx = mxs_evp_cipher_ctx_alloc()) == NULL)
+    {
+        return NULL;
+    }
+
+    if (cipher->key_len == key_len &&
+        cipher->algorithm == algorithm &&
+        cipher->action == action &&
+        memcmp(cipher->key, key, key_len) == 0)
+    {
+        /* Same key, only reset the IV and the state of the previous event */
+        if (!EVP_CipherInit_ex(cipher->ctx, NULL, NULL, NULL, iv, action))
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        cipher->key_len = 0;
+
+        if (!EVP_CipherInit_ex(cipher->ctx,
+                               ciphers[algorithm](key_len),
+                               NULL,
+                               key,
+                               iv,
+                               action))
+        {
+            return NULL;
+        }
+
+        memcpy(cipher->key, key, key_len);
+        cipher->key_len = key_len;
+        cipher->algorithm = algorithm;
+        cipher->action = action;
+    }
+
+    /* Set no padding */
+    EVP_CIPHER_CTX_set_padding(cipher->ctx, 0);
+
+    return cipher->ctx;
+}
+
 /**
  * The routine prepares a binlg event for encryption and ecrypts it
  *
@@ -3073,24 +4075,19 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
     uint8_t mask[AES_BLOCK_SIZE];
     int mlen = 0;
 
-    EVP_CIPHER_CTX* t_ctx = mxs_evp_cipher_ctx_alloc();
-
     /* Initialise with AES_ECB and NULL iv */
-    if (!EVP_CipherInit_ex(t_ctx,
-                           ciphers[BLR_AES_ECB](key_len),
-                           NULL,
-                           key,
-                           NULL, /* NULL iv */
-                           BINLOG_FLAG_ENCRYPT))
+    EVP_CIPHER_CTX* t_ctx = blr_get_cipher_ctx(BLR_AES_ECB,
+                                               key,
+                                               key_len,
+                                               NULL, /* NULL iv */
+                                               BINLOG_FLAG_ENCRYPT);
+
+    if (t_ctx == NULL)
     {
         MXS_ERROR("Error in EVP_CipherInit_ex CBC for last block (ECB)");
-        mxs_evp_cipher_ctx_free(t_ctx);
         return 0;
     }
 
-    /* Set no padding */
-    EVP_CIPHER_CTX_set_padding(t_ctx, 0);
-
     /* Do the enc/dec of the IV (the one from previous stage) */
     if (!EVP_CipherUpdate(t_ctx,
                           mask,
@@ -3099,7 +4096,6 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
                           sizeof(mask)))
     {
         MXS_ERROR("Error in EVP_CipherUpdate ECB");
-        mxs_evp_cipher_ctx_free(t_ctx);
         return 0;
     }
 
@@ -3114,8 +4110,6 @@ static int blr_aes_create_tail_for_cbc(uint8_t *output,
         output[i] = input[i] ^ mask[i];
     }
 
-    mxs_evp_cipher_ctx_free(t_ctx);
-
     return 1;
 }
 
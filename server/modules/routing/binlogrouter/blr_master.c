@@ -81,6 +81,9 @@
 /* Temporary requirement for auth data */
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
+#include <maxscale/config.h>
+#include <maxscale/crc32.h>
+#include <maxscale/tablefeed.h>
 
 
 
@@ -102,10 +105,12 @@ static void blr_check_last_master_event(void *inst);
 extern int blr_check_heartbeat(ROUTER_INSTANCE *router);
 static void blr_log_identity(ROUTER_INSTANCE *router);
 static void blr_extract_header_semisync(uint8_t *pkt, REP_HEADER *hdr);
-static int blr_send_semisync_ack (ROUTER_INSTANCE *router, uint64_t pos);
+static int blr_send_semisync_ack (ROUTER_INSTANCE *router, const char *binlog_name, uint64_t pos);
+static int blr_master_sync_callback(DCB *dcb, DCB_REASON reason, void *data);
 static int blr_get_master_semisync(GWBUF *buf);
 
 static void blr_terminate_master_replication(ROUTER_INSTANCE *router, uint8_t* ptr, int len);
+static void blr_publish_table_map(uint8_t *event, uint32_t len);
 void blr_notify_all_slaves(ROUTER_INSTANCE *router);
 extern bool blr_notify_waiting_slave(ROUTER_SLAVE *slave);
 
@@ -203,6 +208,12 @@ blr_start_master(void* data)
     }
     router->master->remote = MXS_STRDUP_A(router->service->dbref->server->name);
 
+    if (router->binlog_sync_thread)
+    {
+        dcb_add_callback(router->master, DCB_REASON_DRAINED, blr_master_sync_callback, router);
+        blr_sync_set_master(router, router->master);
+    }
+
     MXS_NOTICE("%s: attempting to connect to master server [%s]:%d, binlog %s, pos %lu",
                router->service->name, router->service->dbref->server->name,
                router->service->dbref->server->port, router->binlog_name, router->current_pos);
@@ -317,11 +328,14 @@ blr_master_reconnect(ROUTER_INSTANCE *router)
 void
 blr_master_close(ROUTER_INSTANCE *router)
 {
+    blr_sync_set_master(router, NULL);
     dcb_close(router->master);
     router->master_state = BLRM_UNCONNECTED;
     router->master_event_state = BLR_EVENT_DONE;
     gwbuf_free(router->stored_event);
     router->stored_event = NULL;
+    /* The ACK was meant for the closed connection */
+    router->semisync_ack_pending = false;
 }
 
 /**
@@ -995,7 +1009,7 @@ static bool verify_checksum(ROUTER_INSTANCE *router, size_t len, uint8_t *ptr)
     uint32_t offset = MYSQL_HEADER_LEN + 1;
     uint32_t size = len - (offset + MYSQL_CHECKSUM_LEN);
 
-    uint32_t checksum = crc32(0L, ptr + offset, size);
+    uint32_t checksum = mxs_crc32(0, ptr + offset, size);
     uint32_t pktsum = EXTRACT32(ptr + offset + size);
 
     if (pktsum != checksum)
@@ -1290,15 +1304,25 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                  * won't be updated to router->current_pos
                  */
 
+                bool index_pos = false;
+
                 spinlock_acquire(&router->binlog_lock);
                 if (router->trx_safe == 0 || (router->trx_safe && router->pending_transaction == BLRM_NO_TRANSACTION))
                 {
                     /* no pending transaction: set current_pos to binlog_position */
                     router->binlog_position = router->current_pos;
                     router->current_safe_event = router->current_pos;
+
+                    /* Only with transaction safety is it known that no transaction is open */
+                    index_pos = router->trx_safe;
                 }
                 spinlock_release(&router->binlog_lock);
 
+                if (index_pos)
+                {
+                    blr_index_add(router, router->current_pos);
+                }
+
                 /**
                  * Detect transactions in events
                  * Only complete transactions should be sent to sleves
@@ -1419,6 +1443,12 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                     router->stats.events[hdr.event_type]++;
                 }
 
+                /** Tell the subscribers, e.g. caches, which tables are modified */
+                if (hdr.event_type == TABLE_MAP_EVENT && mxs_table_feed_has_subscribers())
+                {
+                    blr_publish_table_map(ptr + MYSQL_HEADER_LEN + 1, hdr.event_size);
+                }
+
                 if (hdr.event_type == FORMAT_DESCRIPTION_EVENT && hdr.next_pos == 0)
                 {
                     // Fake format description message
@@ -1518,8 +1548,21 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                       router->service->dbref->server->name,
                                       router->service->dbref->server->port);
 
-                            /* Send Semi-Sync ACK packet to master server */
-                            blr_send_semisync_ack(router, hdr.next_pos);
+                            if (router->binlog_sync_interval || router->binlog_sync_size)
+                            {
+                                /**
+                                 * The ACK is sent once the event is on disk. The master
+                                 * takes an ACK to cover all the earlier events too.
+                                 */
+                                router->semisync_ack_pending = true;
+                                router->semisync_ack_pos = hdr.next_pos;
+                                strcpy(router->semisync_ack_file, router->binlog_name);
+                            }
+                            else
+                            {
+                                /* Send Semi-Sync ACK packet to master server */
+                                blr_send_semisync_ack(router, router->binlog_name, hdr.next_pos);
+                            }
 
                             /* Reset ACK sending */
                             semi_sync_send_ack = 0;
@@ -1619,7 +1662,20 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
         }
     }
 
-    blr_file_flush(router);
+    /**
+     * All the events read so far are synced at once. A pending Semi-Sync
+     * ACK forces the sync, as the master waits for it. With the sync thread
+     * the master connection goes on reading while the sync is in progress.
+     */
+    if (router->binlog_sync_thread)
+    {
+        blr_sync_request(router);
+    }
+    else if (blr_file_flush(router, router->semisync_ack_pending) && router->semisync_ack_pending)
+    {
+        blr_send_semisync_ack(router, router->semisync_ack_file, router->semisync_ack_pos);
+        router->semisync_ack_pending = false;
+    }
 }
 
 /**
@@ -2280,9 +2336,11 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
  * @param buf Buffer containing the data
  * @param len Length of the data
  * @param first If this is the first packet of a multi-packet event
+ * @param queue If not NULL, the packet is appended to this chain instead
+ *              of being written to the slave
  * @return True on success, false when memory allocation fails
  */
-bool blr_send_packet(ROUTER_SLAVE *slave, uint8_t *buf, uint32_t len, bool first)
+bool blr_send_packet(ROUTER_SLAVE *slave, uint8_t *buf, uint32_t len, bool first, GWBUF **queue)
 {
     bool rval = true;
     unsigned int datalen = len + (first ? 1 : 0);
@@ -2305,7 +2363,15 @@ bool blr_send_packet(ROUTER_SLAVE *slave, uint8_t *buf, uint32_t len, bool first
         }
 
         slave->stats.n_bytes += GWBUF_LENGTH(buffer);
-        slave->dcb->func.write(slave->dcb, buffer);
+
+        if (queue)
+        {
+            *queue = gwbuf_append(*queue, buffer);
+        }
+        else
+        {
+            slave->dcb->func.write(slave->dcb, buffer);
+        }
     }
     else
     {
@@ -2336,6 +2402,34 @@ bool blr_send_event(blr_thread_role_t role,
                     ROUTER_SLAVE *slave,
                     REP_HEADER *hdr,
                     uint8_t *buf)
+{
+    return blr_queue_event(role, binlog_name, binlog_pos, slave, hdr, buf, NULL);
+}
+
+/**
+ * Queue a single replication event to be sent to a slave
+ *
+ * This is like blr_send_event except that the packets of the event are
+ * appended to a chain of buffers, so that many events can be written
+ * to the slave at once.
+ *
+ * @param role  What is the role of the caller, slave or master.
+ * @param binlog_name The name of the binlogfile.
+ * @param binlog_pos The position in the binlogfile.
+ * @param slave Slave where the event is sent to
+ * @param hdr   Replication header
+ * @param buf   Pointer to the replication event as it was read from the disk
+ * @param queue The chain the packets are appended to, or NULL if they
+ *              should be written to the slave right away
+ * @return True on success, false if memory allocation failed
+ */
+bool blr_queue_event(blr_thread_role_t role,
+                     const char* binlog_name,
+                     uint32_t binlog_pos,
+                     ROUTER_SLAVE *slave,
+                     REP_HEADER *hdr,
+                     uint8_t *buf,
+                     GWBUF **queue)
 {
     bool rval = true;
 
@@ -2363,7 +2457,7 @@ bool blr_send_event(blr_thread_role_t role,
     /** Check if the event and the OK byte fit into a single packet  */
     if (hdr->event_size + 1 < MYSQL_PACKET_LENGTH_MAX)
     {
-        rval = blr_send_packet(slave, buf, hdr->event_size, true);
+        rval = blr_send_packet(slave, buf, hdr->event_size, true, queue);
     }
     else
     {
@@ -2376,13 +2470,13 @@ bool blr_send_event(blr_thread_role_t role,
             uint64_t payload_len = first ? MYSQL_PACKET_LENGTH_MAX - 1 :
                                    MXS_MIN(MYSQL_PACKET_LENGTH_MAX, len);
 
-            if (blr_send_packet(slave, buf, payload_len, first))
+            if (blr_send_packet(slave, buf, payload_len, first, queue))
             {
                 /** The check for exactly 0x00ffffff bytes needs to be done
                  * here as well */
                 if (len == MYSQL_PACKET_LENGTH_MAX)
                 {
-                    blr_send_packet(slave, buf, 0, false);
+                    blr_send_packet(slave, buf, 0, false, queue);
                 }
 
                 /** Add the extra byte written by blr_send_packet */
@@ -2474,19 +2568,20 @@ blr_extract_header_semisync(register uint8_t *ptr, register REP_HEADER *hdr)
  * Send a MySQL Replication Semi-Sync ACK to the master server.
  *
  * @param router The router instance.
+ * @param binlog_name The binlog file for the ACK reply.
  * @param pos The binlog position for the ACK reply.
  * @return 1 if the packect is sent, 0 on errors
  */
 
 static int
-blr_send_semisync_ack(ROUTER_INSTANCE *router, uint64_t pos)
+blr_send_semisync_ack(ROUTER_INSTANCE *router, const char *binlog_name, uint64_t pos)
 {
     int seqno = 0;
     int semi_sync_flag = BLR_MASTER_SEMI_SYNC_INDICATOR;
     GWBUF   *buf;
     int     len;
     uint8_t *data;
-    int     binlog_file_len = strlen(router->binlog_name);
+    int     binlog_file_len = strlen(binlog_name);
 
     /* payload is: 1 byte semi-sync indicator + 8 bytes position + binlog name len */
     len = 1 + 8 + binlog_file_len;
@@ -2511,7 +2606,7 @@ blr_send_semisync_ack(ROUTER_INSTANCE *router, uint64_t pos)
     encode_value(&data[5], pos, 64);
 
     /* Binlog filename */
-    memcpy((char *)&data[13], router->binlog_name, binlog_file_len);
+    memcpy((char *)&data[13], binlog_name, binlog_file_len);
 
     router->master->func.write(router->master, buf);
 
@@ -2559,30 +2654,218 @@ blr_get_master_semisync(GWBUF *buf)
  * Notify all the registered slaves to read from binlog file
  * the new events just received
  *
+ * Only the slaves that wait for data are notified. They are kept in a list
+ * per thread, and the notifications of a thread are queued to it together,
+ * so the thread wakes up once and then serves all its slaves, most likely
+ * from the event cache. The walk over all the slaves is not done, and the
+ * router lock is not held while notifying.
+ *
  * @param   router      The router instance
  */
 void blr_notify_all_slaves(ROUTER_INSTANCE *router)
 {
-    ROUTER_SLAVE *slave;
     int notified = 0;
+    int n_threads = config_threadcount();
 
-    spinlock_acquire(&router->lock);
-    slave = router->slaves;
-    while (slave)
+    for (int i = 0; i < n_threads; i++)
     {
-        /* Notify a slave that has CS_WAIT_DATA bit set */
-        if (slave->state == BLRS_DUMPING &&
-            blr_notify_waiting_slave(slave))
+        BLR_WAITING_SLAVES *waiting = &router->waiting[i];
+
+        /** The list is read without the lock, the lock makes it exact */
+        if (atomic_load_ptr((void**)&waiting->slaves) == NULL)
         {
-            notified++;
+            continue;
         }
 
-        slave = slave->next;
+        spinlock_acquire(&waiting->lock);
+        ROUTER_SLAVE *slave = waiting->slaves;
+        waiting->slaves = NULL;
+
+        while (slave)
+        {
+            ROUTER_SLAVE *next = slave->next_waiting;
+            slave->next_waiting = NULL;
+            slave->waiting_thread = -1;
+
+            /* Notify a slave that has CS_WAIT_DATA bit set */
+            if (slave->state == BLRS_DUMPING &&
+                blr_notify_waiting_slave(slave))
+            {
+                notified++;
+            }
+
+            slave = next;
+        }
+        spinlock_release(&waiting->lock);
     }
-    spinlock_release(&router->lock);
 
     if (notified > 0)
     {
         MXS_DEBUG("Notified %d slaves about new data.", notified);
     }
 }
+
+/**
+ * Allocate the lists of slaves waiting for data
+ *
+ * @param   router      The router instance
+ * @return  True if the lists could be allocated
+ */
+bool blr_init_waiting_slaves(ROUTER_INSTANCE *router)
+{
+    int n_threads = config_threadcount();
+
+    if ((router->waiting = MXS_CALLOC(n_threads, sizeof(BLR_WAITING_SLAVES))) == NULL)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        spinlock_init(&router->waiting[i].lock);
+    }
+
+    return true;
+}
+
+/**
+ * Free the lists of slaves waiting for data
+ *
+ * @param   router      The router instance
+ */
+void blr_free_waiting_slaves(ROUTER_INSTANCE *router)
+{
+    MXS_FREE(router->waiting);
+    router->waiting = NULL;
+}
+
+/**
+ * Add a slave to the list of waiting slaves of its thread
+ *
+ * This must be called with the binlog lock held, after CS_WAIT_DATA has
+ * been set, so that a notification of new data cannot be missed.
+ *
+ * @param   router      The router instance
+ * @param   slave       The slave that waits for data
+ */
+void blr_add_waiting_slave(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    int thread_id = slave->dcb->thread.id;
+    BLR_WAITING_SLAVES *waiting = &router->waiting[thread_id];
+
+    spinlock_acquire(&waiting->lock);
+
+    if (slave->waiting_thread == -1)
+    {
+        slave->next_waiting = waiting->slaves;
+        waiting->slaves = slave;
+        slave->waiting_thread = thread_id;
+    }
+
+    spinlock_release(&waiting->lock);
+}
+
+/**
+ * Remove a slave from the list of waiting slaves of its thread
+ *
+ * @param   router      The router instance
+ * @param   slave       The slave being closed
+ */
+void blr_remove_waiting_slave(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    int thread_id = atomic_load_int32(&slave->waiting_thread);
+
+    if (thread_id == -1)
+    {
+        return;
+    }
+
+    BLR_WAITING_SLAVES *waiting = &router->waiting[thread_id];
+
+    spinlock_acquire(&waiting->lock);
+
+    /** The slave may have been notified meanwhile, and is then in no list */
+    if (slave->waiting_thread == thread_id)
+    {
+        ROUTER_SLAVE **ptr = &waiting->slaves;
+
+        while (*ptr && *ptr != slave)
+        {
+            ptr = &(*ptr)->next_waiting;
+        }
+
+        if (*ptr)
+        {
+            *ptr = slave->next_waiting;
+        }
+
+        slave->next_waiting = NULL;
+        slave->waiting_thread = -1;
+    }
+
+    spinlock_release(&waiting->lock);
+}
+
+/**
+ * Publish the table of a table map event to the feed of modified tables
+ *
+ * A table map event precedes the row events of each table that a transaction
+ * modifies, so publishing the table maps publishes all tables modified with
+ * row based replication.
+ *
+ * @param event The event, starting from the event header
+ * @param len   The length of the event
+ */
+static void blr_publish_table_map(uint8_t *event, uint32_t len)
+{
+    /** The post header is the table ID (6 bytes) and the flags (2 bytes) */
+    uint32_t db_offset = BINLOG_EVENT_HDR_LEN + 6 + 2;
+
+    if (db_offset < len)
+    {
+        uint8_t db_len = event[db_offset];
+        /** Both names are followed by a NUL byte */
+        uint32_t table_offset = db_offset + 1 + db_len + 1;
+
+        if (table_offset < len && table_offset + 1 + event[table_offset] < len)
+        {
+            uint8_t table_len = event[table_offset];
+            char db[db_len + 1];
+            char table[table_len + 1];
+
+            memcpy(db, event + db_offset + 1, db_len);
+            db[db_len] = '\0';
+            memcpy(table, event + table_offset + 1, table_len);
+            table[table_len] = '\0';
+
+            mxs_table_feed_publish(db, table);
+        }
+    }
+}
+
+/**
+ * The callback for the write events of the master connection
+ *
+ * The binlog sync thread fakes a write event once a sync that a Semi-Sync
+ * ACK waited for is done. The ACK is sent here, by the thread that owns the
+ * master connection.
+ *
+ * @param dcb       The master connection
+ * @param reason    The reason the callback was called
+ * @param data      The router instance
+ * @return          Always 0
+ */
+static int
+blr_master_sync_callback(DCB *dcb, DCB_REASON reason, void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)data;
+    char binlog_name[BINLOG_FNAMELEN + 1];
+    uint64_t pos;
+
+    if (dcb == router->master && blr_sync_take_ack(router, binlog_name, &pos))
+    {
+        blr_send_semisync_ack(router, binlog_name, pos);
+    }
+
+    return 0;
+}
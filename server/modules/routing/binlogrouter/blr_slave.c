@@ -87,6 +87,7 @@
 #include <maxscale/log_manager.h>
 #include <maxscale/version.h>
 #include <zlib.h>
+#include <maxscale/crc32.h>
 #include <maxscale/alloc.h>
 
 static char* get_next_token(char *str, const char* delim, char **saveptr);
@@ -166,6 +167,9 @@ static int blr_slave_send_heartbeat(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave
 static int blr_set_master_ssl(ROUTER_INSTANCE *router, CHANGE_MASTER_OPTIONS config, char *error_message);
 static int blr_slave_read_ste(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, uint32_t fde_end_pos);
 static GWBUF *blr_slave_read_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
+static void blr_slave_flush_batch(ROUTER_SLAVE *slave, GWBUF **batch);
+static int blr_slave_send_run(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE *file,
+                              int *burst, long *burst_size);
 
 void poll_fake_write_event(DCB *dcb);
 
@@ -2031,6 +2035,29 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
     memcpy(slave->binlogfile, (char *)ptr, binlognamelen);
     slave->binlogfile[binlognamelen] = 0;
 
+    /* With a position index, a position inside an event can be detected */
+    if (slave->binlog_pos != 4 &&
+        !blr_index_check_pos(router, slave->binlogfile, slave->binlog_pos))
+    {
+        char err_msg[] = "Client requested master to start replication from impossible position";
+
+        MXS_ERROR("%s: Slave %s:%i, server-id %d, binlog '%s', blr_slave_binlog_dump failure: "
+                  "Requested binlog position %lu is not the start of an event.",
+                  router->service->name,
+                  slave->dcb->remote,
+                  dcb_get_port(slave->dcb),
+                  slave->serverid,
+                  slave->binlogfile,
+                  (unsigned long)slave->binlog_pos);
+
+        /* Send error that stops slave replication */
+        blr_send_custom_error(slave->dcb, 1, 0, err_msg, "HY000", BINLOG_FATAL_ERROR_READING);
+
+        dcb_close(slave->dcb);
+
+        return 1;
+    }
+
     if (router->trx_safe)
     {
         /**
@@ -2116,8 +2143,7 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2238,6 +2264,140 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
     return ptr;
 }
 
+/**
+ * Write the events queued during a catchup to the slave
+ *
+ * @param slave The slave the events are sent to
+ * @param batch The queued events, set to NULL once they are written
+ */
+static void
+blr_slave_flush_batch(ROUTER_SLAVE *slave, GWBUF **batch)
+{
+    if (*batch)
+    {
+        slave->dcb->func.write(slave->dcb, *batch);
+        *batch = NULL;
+    }
+}
+
+/**
+ * Send a run of events of the binlog file to a slave without copying them
+ *
+ * A part of the file is read into one buffer and the events in it are sent as
+ * slices of that buffer, with only their packet headers allocated separately.
+ * The DCB gathers the headers and the events into writev calls. The run ends
+ * at the first event that must be handled on its own: a rotate, encryption or
+ * ignorable event, an event that does not fit into one packet or one that is
+ * not wholly in the buffer.
+ *
+ * @param router        The binlog router
+ * @param slave         The slave that is behind
+ * @param file          The binlog file the slave reads
+ * @param burst         The number of events that may still be sent
+ * @param burst_size    The number of bytes that may still be sent
+ * @return              The number of events sent, 0 if the events must be read one by one
+ */
+static int
+blr_slave_send_run(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE *file,
+                   int *burst, long *burst_size)
+{
+    unsigned long pos = slave->binlog_pos;
+
+    /** Close to the end of what can be read, the events are read one by one */
+    if (slave->encryption_ctx || file->zfile ||
+        blr_file_read_limit(router, file) < pos + router->catchup_run_size ||
+        (strcmp(slave->lsi_binlog_name, slave->binlogfile) == 0 && slave->lsi_binlog_pos == pos))
+    {
+        return 0;
+    }
+
+    GWBUF *run = gwbuf_alloc(router->catchup_run_size);
+    ssize_t len;
+
+    if (run == NULL)
+    {
+        return 0;
+    }
+
+    if ((len = pread(file->fd, GWBUF_DATA(run), router->catchup_run_size, pos)) < BINLOG_EVENT_HDR_LEN)
+    {
+        gwbuf_free(run);
+        return 0;
+    }
+
+    GWBUF *batch = NULL;
+    uint8_t *data = GWBUF_DATA(run);
+    unsigned long offset = 0;
+    unsigned long last_pos = pos;
+    int n_events = 0;
+
+    while (*burst > 0 && *burst_size > 0 && offset + BINLOG_EVENT_HDR_LEN <= (unsigned long)len)
+    {
+        uint8_t *event = data + offset;
+        uint8_t event_type = event[4];
+        uint32_t event_size = extract_field(&event[9], 32);
+        uint32_t next_pos = EXTRACT32(&event[13]);
+        uint16_t flags = EXTRACT16(&event[17]);
+
+        if (event_type == ROTATE_EVENT || event_type == MARIADB10_START_ENCRYPTION_EVENT ||
+            event_type == IGNORABLE_EVENT || (flags & LOG_EVENT_IGNORABLE_F) ||
+            event_size < BINLOG_EVENT_HDR_LEN || event_size + 1 >= MYSQL_PACKET_LENGTH_MAX ||
+            offset + event_size > (unsigned long)len || next_pos != pos + offset + event_size)
+        {
+            break;
+        }
+
+        GWBUF *header = gwbuf_alloc(MYSQL_HEADER_LEN + 1);
+        GWBUF *payload = header ? gwbuf_clone(run) : NULL;
+
+        if (payload == NULL)
+        {
+            gwbuf_free(header);
+            break;
+        }
+
+        uint8_t *ptr = GWBUF_DATA(header);
+        encode_value(ptr, event_size + 1, 24);
+        ptr[3] = slave->seqno++;
+        ptr[4] = 0; // OK byte
+
+        GWBUF_CONSUME(payload, offset);
+        GWBUF_RTRIM(payload, GWBUF_LENGTH(payload) - event_size);
+
+        batch = gwbuf_append(batch, header);
+        batch = gwbuf_append(batch, payload);
+
+        last_pos = pos + offset;
+        offset += event_size;
+        slave->stats.n_events++;
+        slave->stats.n_bytes += MYSQL_HEADER_LEN + 1 + event_size;
+        n_events++;
+        (*burst)--;
+        *burst_size -= event_size;
+    }
+
+    gwbuf_free(run);
+
+    if (n_events > 0)
+    {
+        slave->binlog_pos = pos + offset;
+        strcpy(slave->lsi_binlog_name, slave->binlogfile);
+        slave->lsi_binlog_pos = last_pos;
+        slave->lsi_sender_role = BLR_THREAD_ROLE_SLAVE;
+        slave->lsi_sender_tid = thread_self();
+
+        /* set lastReply for slave heartbeat check */
+        if (router->send_slave_heartbeat)
+        {
+            slave->lastReply = time(0);
+        }
+
+        blr_slave_flush_batch(slave, &batch);
+    }
+
+    return n_events;
+}
+
 /**
  * We have a registered slave that is behind the current leading edge of the
  * binlog. We must replay the log entries to bring this node up to speed.
@@ -2259,6 +2419,12 @@ blr_build_header(GWBUF  *pkt, REP_HEADER *hdr)
  * queue. This ensures that the slave callback for processing DCB write drain
  * will be called and future catchup requests will be handled on another thread.
  *
+ * If catchup_batch_size is set, the binlog file is read that much at a time
+ * and the events are written to the slave in batches of that size, instead
+ * of each event being read and written on its own. If mmap_binlogs is set,
+ * the events are read from a memory mapping of the binlog file. If
+ * catchup_run_size is set, runs of events are sent without copying them.
+ *
  * @param   router      The binlog router
  * @param   slave       The slave that is behind
  * @param   large       Send a long or short burst of events
@@ -2273,6 +2439,9 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
     int rotating = 0;
     long burst_size;
     char read_errmsg[BINLOG_ERROR_MSG_LEN + 1];
+    GWBUF *batch = NULL;
+    GWBUF **queue = NULL;
+    unsigned long batch_start = slave->stats.n_bytes;
 
     read_errmsg[BINLOG_ERROR_MSG_LEN] = '\0';
 
@@ -2363,8 +2532,42 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
 #endif
     int events_before = slave->stats.n_events;
 
+    if (router->catchup_batch_size > 0)
+    {
+        queue = &batch;
+    }
+
+    if (router->catchup_batch_size > 0 || router->mmap_binlogs)
+    {
+        if (slave->read_buffer == NULL)
+        {
+            slave->read_buffer = blr_alloc_read_buffer(router->catchup_batch_size,
+                                                       router->mmap_binlogs);
+        }
+
+        if (slave->read_buffer)
+        {
+            /** The file may have been reopened or written since the previous burst */
+            blr_reset_read_buffer(slave->read_buffer);
+        }
+    }
+
+    /**
+     * Whole runs of events are sent first, the event that ends a run and the
+     * events close to the end of the file are then read one by one.
+     */
+    if (router->catchup_run_size > 0)
+    {
+        while (burst > 0 && burst_size > 0 &&
+               blr_slave_send_run(router, slave, file, &burst, &burst_size) > 0)
+        {
+            ;
+        }
+    }
+
     while (burst-- && burst_size > 0 &&
-           (record = blr_read_binlog(router, file, slave->binlog_pos, &hdr, read_errmsg, slave->encryption_ctx)) != NULL)
+           (record = blr_read_binlog(router, file, slave->binlog_pos, &hdr, read_errmsg,
+                                     slave->encryption_ctx, slave->read_buffer)) != NULL)
     {
         char binlog_name[BINLOG_FNAMELEN + 1];
         uint32_t binlog_pos;
@@ -2432,6 +2635,10 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         if (hdr.event_type == ROTATE_EVENT)
         {
             unsigned long beat1 = hkheartbeat;
+
+            /** The events of the file must reach the slave before any error */
+            blr_slave_flush_batch(slave, &batch);
+
             blr_close_binlog(router, file);
             if (hkheartbeat - beat1 > 1)
             {
@@ -2488,8 +2695,8 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
             }
         }
 
-        if (blr_send_event(BLR_THREAD_ROLE_SLAVE, binlog_name, binlog_pos,
-                           slave, &hdr, (uint8_t*) record->start))
+        if (blr_queue_event(BLR_THREAD_ROLE_SLAVE, binlog_name, binlog_pos,
+                            slave, &hdr, (uint8_t*) record->start, queue))
         {
             if (hdr.event_type != ROTATE_EVENT)
             {
@@ -2497,9 +2704,17 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
             }
             slave->stats.n_events++;
             burst_size -= hdr.event_size;
+
+            if (queue && slave->stats.n_bytes - batch_start >= router->catchup_batch_size)
+            {
+                blr_slave_flush_batch(slave, &batch);
+                batch_start = slave->stats.n_bytes;
+            }
         }
         else
         {
+            blr_slave_flush_batch(slave, &batch);
+
             MXS_WARNING("Slave %s:%i, server-id %d, binlog '%s, position %u: "
                         "Slave-thread could not send event to slave, closing connection.",
                         slave->dcb->remote,
@@ -2525,6 +2740,8 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
         }
     }
 
+    blr_slave_flush_batch(slave, &batch);
+
     /**
      * End of while reading
      * Checking last buffer first
@@ -2652,6 +2869,10 @@ blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large)
             slave->cstate |= CS_WAIT_DATA;
 
             spinlock_release(&slave->catch_lock);
+
+            /* Added while the binlog lock is held, so no new event can be missed */
+            blr_add_waiting_slave(router, slave);
+
             spinlock_release(&router->binlog_lock);
         }
     }
@@ -2880,8 +3101,7 @@ blr_slave_fake_rotate(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE** fil
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2915,7 +3135,7 @@ blr_slave_read_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
         return NULL;
     }
     /* FDE is not encrypted, so we can pass NULL to last parameter */
-    if ((record = blr_read_binlog(router, file, 4, &hdr, err_msg, NULL)) == NULL)
+    if ((record = blr_read_binlog(router, file, 4, &hdr, err_msg, NULL, NULL)) == NULL)
     {
         if (hdr.ok != SLAVE_POS_READ_OK)
         {
@@ -2984,8 +3204,7 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *fde)
      * and write it into the header
      */
     ptr = GWBUF_DATA(fde) + event_size - BINLOG_EVENT_CRC_SIZE;
-    chksum = crc32(0L, NULL, 0);
-    chksum = crc32(chksum, GWBUF_DATA(fde), event_size - BINLOG_EVENT_CRC_SIZE);
+    chksum = mxs_crc32(0, GWBUF_DATA(fde), event_size - BINLOG_EVENT_CRC_SIZE);
     encode_value(ptr, chksum, 32);
 
     return slave->dcb->func.write(slave->dcb, head);
@@ -5659,8 +5878,7 @@ blr_slave_send_heartbeat(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     /* Add the CRC32 */
     if (!slave->nocrc)
     {
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -5876,7 +6094,7 @@ blr_slave_read_ste(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, uint32_t fde_en
         return 0;
     }
     /* Start Encryption Event is not encrypted, we can pass NULL to last parameter */
-    if ((record = blr_read_binlog(router, file, fde_end_pos, &hdr, err_msg, NULL)) == NULL)
+    if ((record = blr_read_binlog(router, file, fde_end_pos, &hdr, err_msg, NULL, NULL)) == NULL)
     {
         if (hdr.ok != SLAVE_POS_READ_OK)
         {
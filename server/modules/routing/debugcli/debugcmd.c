@@ -52,6 +52,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <telnetd.h>
 #include <sys/syslog.h>
 
@@ -73,12 +74,15 @@
 #include <maxscale/maxscale.h>
 #include <maxscale/version.h>
 #include <maxscale/log_manager.h>
+#include <maxscale/query_classifier.h>
 
+#include "../../../core/maxscale/alloc.h"
 #include "../../../core/maxscale/config_runtime.h"
 #include "../../../core/maxscale/maxscale.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/poll.h"
+#include "../../../core/maxscale/profiler.h"
 #include "../../../core/maxscale/session.h"
 
 #define MAXARGS 12
@@ -115,6 +119,8 @@ struct subcommand
 
 static void telnetdShowUsers(DCB *);
 static void show_log_throttling(DCB *);
+static void show_spinlocks(DCB *);
+static void show_qc_cache(DCB *);
 
 static void showVersion(DCB *dcb)
 {
@@ -157,6 +163,12 @@ struct subcommand showoptions[] =
         "Example : show authenticators my-service",
         {ARG_TYPE_SERVICE}
     },
+    {
+        "callbacks", 0, 0, dprintProfile,
+        "Show the module callbacks that took the most time",
+        "Usage: show callbacks",
+        {0}
+    },
     {
         "epoll", 0, 0, dprintPollStats,
         "Show the polling system statistics",
@@ -198,6 +210,12 @@ struct subcommand showoptions[] =
         "Usage: show log_throttling",
         {0}
     },
+    {
+        "memory", 0, 0, dprintMemory,
+        "Show the memory allocated by each module",
+        "Usage: show memory",
+        {0}
+    },
     {
         "modules", 0, 0, dprintAllModules,
         "Show all currently loaded modules",
@@ -232,6 +250,12 @@ struct subcommand showoptions[] =
         "Example: show persistent db-server-1",
         {ARG_TYPE_SERVER}
     },
+    {
+        "qc_cache", 0, 0, show_qc_cache,
+        "Show the statistics of the query classification cache",
+        "Usage: show qc_cache",
+        {0}
+    },
     {
         "server", 1, 1, dprintServer,
         "Show server details",
@@ -289,6 +313,12 @@ struct subcommand showoptions[] =
         "Usage: show sessions",
         {0}
     },
+    {
+        "spinlocks", 0, 0, show_spinlocks,
+        "Show the source lines where spinlocks were most often contended",
+        "Usage: show spinlocks",
+        {0}
+    },
     {
         "tasks", 0, 0, hkshow_tasks,
         "Show all active housekeeper tasks in MaxScale",
@@ -1480,6 +1510,33 @@ static void alterMonitor(DCB *dcb, MXS_MONITOR *monitor, char *v1, char *v2, cha
 
 }
 
+static void alterMaxScale(DCB *dcb, char *v1, char *v2, char *v3, char *v4, char *v5,
+                          char *v6, char *v7, char *v8, char *v9, char *v10, char *v11)
+{
+    char *values[11] = {v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11};
+    const int items = sizeof(values) / sizeof(values[0]);
+
+    for (int i = 0; i < items && values[i]; i++)
+    {
+        char *key = values[i];
+        char *value = strchr(key, '=');
+
+        if (value)
+        {
+            *value++ = '\0';
+
+            if (!runtime_alter_maxscale(key, value))
+            {
+                dcb_printf(dcb, "Error: Bad key-value parameter: %s=%s\n", key, value);
+            }
+        }
+        else
+        {
+            dcb_printf(dcb, "Error: not a key-value parameter: %s\n", values[i]);
+        }
+    }
+}
+
 struct subcommand alteroptions[] =
 {
     {
@@ -1530,6 +1587,9 @@ struct subcommand alteroptions[] =
         "backend_connect_timeout Server coneection timeout in seconds\n"
         "backend_write_timeout   Server write timeout in seconds\n"
         "backend_read_timeout    Server read timeout in seconds\n"
+        "script_timeout          Script execution timeout in seconds\n"
+        "collect_metrics         Sample the load of the servers (true or false)\n"
+        "warmup_time             Server warm-up time in seconds\n"
         "\n"
         "This will alter an existing parameter of a monitor. To remove parameters,\n"
         "pass an empty value for a key e.g. 'maxadmin alter monitor my-monitor my-key='\n"
@@ -1541,6 +1601,28 @@ struct subcommand alteroptions[] =
             ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING
         }
     },
+    {
+        "maxscale", 1, 11, alterMaxScale,
+        "Alter global parameters",
+        "Usage: alter maxscale KEY=VALUE ...\n"
+        "\n"
+        "Parameters:\n"
+        "KEY=VALUE List of `key=value` pairs separated by spaces\n"
+        "\n"
+        "The accepted values for KEY are:\n"
+        "\n"
+        "threads Number of active polling threads, at most the value of threads_max\n"
+        "\n"
+        "The changes are not persisted and need to be added to the configuration\n"
+        "file or set again after a restart.\n"
+        "\n"
+        "Example: alter maxscale threads=8",
+        {
+            ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING,
+            ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING,
+            ARG_TYPE_STRING, ARG_TYPE_STRING, ARG_TYPE_STRING
+        }
+    },
     {
         EMPTY_OPTION
     }
@@ -2206,6 +2288,54 @@ telnetdShowUsers(DCB *dcb)
  *
  * @param dcb The DCB to print the state to.
  */
+static void
+spinlock_site_reporter(void *dcb, const SPINLOCK_SITE *site)
+{
+    char location[50];
+    snprintf(location, sizeof(location), "%s:%d", site->file, site->line);
+    dcb_printf((DCB*)dcb, "%-50s | %-12" PRIu64 " | %-14" PRIu64 " | %" PRIu64 "\n",
+               location, site->contended, site->spins, site->sleeps);
+}
+
+/**
+ * Show the statistics of the query classification cache
+ *
+ * @param dcb   Client DCB
+ */
+static void
+show_qc_cache(DCB *dcb)
+{
+    QC_CACHE_STATS stats;
+
+    if (qc_get_cache_stats(&stats))
+    {
+        int64_t total = stats.hits + stats.misses;
+
+        dcb_printf(dcb, "Cached classifications:  %" PRId64 "\n", stats.size);
+        dcb_printf(dcb, "Cache hits:              %" PRId64 "\n", stats.hits);
+        dcb_printf(dcb, "Cache misses:            %" PRId64 "\n", stats.misses);
+        dcb_printf(dcb, "Hit ratio:               %.1f%%\n",
+                   total ? 100.0 * stats.hits / total : 0.0);
+    }
+    else
+    {
+        dcb_printf(dcb, "The query classifier does not cache classifications.\n");
+    }
+}
+
+/**
+ * Show the most contended spinlock acquisitions
+ *
+ * @param dcb   Client DCB
+ */
+static void
+show_spinlocks(DCB *dcb)
+{
+    dcb_printf(dcb, "%-50s | %-12s | %-14s | %s\n", "Location", "Contended", "Spins", "Sleeps");
+    dcb_printf(dcb, "---------------------------------------------------+--------------+----------------+-------\n");
+    spinlock_site_stats(20, spinlock_site_reporter, dcb);
+}
+
 static void
 show_log_throttling(DCB *dcb)
 {
@@ -50,10 +50,12 @@
 #include <maxscale/secrets.h>
 #include <maxscale/users.h>
 
+#include "../../../core/maxscale/alloc.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/session.h"
 #include "../../../core/maxscale/poll.h"
+#include "../../../core/maxscale/profiler.h"
 
 extern char *create_hex_sha1_sha1_passwd(char *passwd);
 
@@ -686,15 +688,49 @@ static struct uri_table
     { "/sessions", maxinfoSessionsAll },
     { "/clients", maxinfoClientSessions },
     { "/servers", serverGetList },
+    { "/servers/metrics", serverGetMetrics },
     { "/variables", maxinfo_variables },
     { "/status", maxinfo_status },
     { "/event/times", eventTimesGetList },
+    { "/callbacks", profilerGetList },
+    { "/memory", memoryGetList },
     { NULL, NULL }
 };
 
+/**
+ * Apply the offset and limit parameters of a query string to a result set
+ *
+ * @param set       The result set
+ * @param query     The query string, e.g. offset=100&limit=50
+ */
+static void
+set_page_from_query(RESULTSET *set, char *query)
+{
+    int offset = 0;
+    int limit = -1;
+    char *saveptr;
+
+    for (char *param = strtok_r(query, "&", &saveptr); param; param = strtok_r(NULL, "&", &saveptr))
+    {
+        if (strncmp(param, "offset=", 7) == 0)
+        {
+            offset = atoi(param + 7);
+        }
+        else if (strncmp(param, "limit=", 6) == 0)
+        {
+            limit = atoi(param + 6);
+        }
+    }
+
+    resultset_set_page(set, offset, limit);
+}
+
 /**
  * We have data from the client, this is a HTTP URL
  *
+ * The offset and limit parameters of the query string, as in
+ * /sessions?offset=1000&limit=100, select a page of the result set.
+ *
  * @param instance  The router instance
  * @param session   The router session returned from the newSession call
  * @param queue     The queue of data buffers to route
@@ -704,15 +740,26 @@ static  int
 handle_url(INFO_INSTANCE *instance, INFO_SESSION *session, GWBUF *queue)
 {
     char *uri;
+    char *query;
     int i;
     RESULTSET *set;
 
     uri = (char *)GWBUF_DATA(queue);
+
+    if ((query = strchr(uri, '?')))
+    {
+        *query++ = '\0';
+    }
+
     for (i = 0; supported_uri[i].uri; i++)
     {
-        if (strcmp(uri, supported_uri[i].uri) == 0)
+        if (strcmp(uri, supported_uri[i].uri) == 0 &&
+            (set = (*supported_uri[i].func)()) != NULL)
         {
-            set = (*supported_uri[i].func)();
+            if (query)
+            {
+                set_page_from_query(set, query);
+            }
             resultset_stream_json(set, session->dcb);
             resultset_free(set);
         }
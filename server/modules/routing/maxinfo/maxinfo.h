@@ -83,7 +83,8 @@ typedef enum
     MAXOP_SET,
     MAXOP_CLEAR,
     MAXOP_SHUTDOWN,
-    MAXOP_RESTART
+    MAXOP_RESTART,
+    MAXOP_LIMIT
 } MAXINFO_OPERATOR;
 
 /**
@@ -125,6 +126,8 @@ typedef struct maxinfo_tree
 #define LT_CLEAR        12
 #define LT_SHUTDOWN     13
 #define LT_RESTART      14
+#define LT_LIMIT        15
+#define LT_OFFSET       16
 
 
 /**
@@ -45,10 +45,14 @@
 #include <maxscale/spinlock.h>
 #include <maxscale/version.h>
 
+#include "../../../core/maxscale/alloc.h"
+#include "../../../core/maxscale/buffer.h"
 #include "../../../core/maxscale/maxscale.h"
 #include "../../../core/maxscale/modules.h"
 #include "../../../core/maxscale/monitor.h"
 #include "../../../core/maxscale/poll.h"
+#include "../../../core/maxscale/pool.h"
+#include "../../../core/maxscale/profiler.h"
 #include "../../../core/maxscale/session.h"
 
 static void exec_show(DCB *dcb, MAXINFO_TREE *tree);
@@ -107,11 +111,26 @@ maxinfo_execute(DCB *dcb, MAXINFO_TREE *tree)
     }
 }
 
+/**
+ * Apply the LIMIT clause of a show command to a result set
+ *
+ * @param set   The result set
+ * @param tree  Potential limit clause
+ */
+static void
+maxinfo_set_page(RESULTSET *set, MAXINFO_TREE *tree)
+{
+    if (tree && tree->op == MAXOP_LIMIT)
+    {
+        resultset_set_page(set, tree->right ? atoi(tree->right->value) : 0, atoi(tree->value));
+    }
+}
+
 /**
  * Fetch the list of services and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_services(DCB *dcb, MAXINFO_TREE *tree)
@@ -123,6 +142,7 @@ exec_show_services(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -131,7 +151,7 @@ exec_show_services(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the list of listeners and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_listeners(DCB *dcb, MAXINFO_TREE *tree)
@@ -143,6 +163,7 @@ exec_show_listeners(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -151,7 +172,7 @@ exec_show_listeners(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the list of sessions and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_sessions(DCB *dcb, MAXINFO_TREE *tree)
@@ -163,6 +184,7 @@ exec_show_sessions(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -171,7 +193,7 @@ exec_show_sessions(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the list of client sessions and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_clients(DCB *dcb, MAXINFO_TREE *tree)
@@ -183,6 +205,7 @@ exec_show_clients(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -191,7 +214,7 @@ exec_show_clients(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the list of servers and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_servers(DCB *dcb, MAXINFO_TREE *tree)
@@ -203,6 +226,28 @@ exec_show_servers(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
+/**
+ * Fetch the backend load samples of the servers and stream as a result set
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  Potential limit clause
+ */
+static void
+exec_show_metrics(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET *set;
+
+    if ((set = serverGetMetrics()) == NULL)
+    {
+        return;
+    }
+
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -211,7 +256,7 @@ exec_show_servers(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the list of modules and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_modules(DCB *dcb, MAXINFO_TREE *tree)
@@ -223,6 +268,7 @@ exec_show_modules(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -231,7 +277,7 @@ exec_show_modules(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the list of monitors and stream as a result set
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_monitors(DCB *dcb, MAXINFO_TREE *tree)
@@ -243,6 +289,7 @@ exec_show_monitors(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -251,7 +298,7 @@ exec_show_monitors(DCB *dcb, MAXINFO_TREE *tree)
  * Fetch the event times data
  *
  * @param dcb   DCB to which to stream result set
- * @param tree  Potential like clause (currently unused)
+ * @param tree  Potential limit clause
  */
 static void
 exec_show_eventTimes(DCB *dcb, MAXINFO_TREE *tree)
@@ -263,6 +310,49 @@ exec_show_eventTimes(DCB *dcb, MAXINFO_TREE *tree)
         return;
     }
 
+    maxinfo_set_page(set, tree);
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
+/**
+ * Fetch the profiled module callbacks, the slowest first
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  Potential limit clause
+ */
+static void
+exec_show_callbacks(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET *set;
+
+    if ((set = profilerGetList()) == NULL)
+    {
+        return;
+    }
+
+    maxinfo_set_page(set, tree);
+    resultset_stream_mysql(set, dcb);
+    resultset_free(set);
+}
+
+/**
+ * Fetch the memory allocated by each module
+ *
+ * @param dcb   DCB to which to stream result set
+ * @param tree  Potential limit clause
+ */
+static void
+exec_show_memory(DCB *dcb, MAXINFO_TREE *tree)
+{
+    RESULTSET *set;
+
+    if ((set = memoryGetList()) == NULL)
+    {
+        return;
+    }
+
+    maxinfo_set_page(set, tree);
     resultset_stream_mysql(set, dcb);
     resultset_free(set);
 }
@@ -283,9 +373,12 @@ static struct
     { "sessions", exec_show_sessions },
     { "clients", exec_show_clients },
     { "servers", exec_show_servers },
+    { "metrics", exec_show_metrics },
     { "modules", exec_show_modules },
     { "monitors", exec_show_monitors },
     { "eventTimes", exec_show_eventTimes },
+    { "callbacks", exec_show_callbacks },
+    { "memory", exec_show_memory },
     { NULL, NULL }
 };
 
@@ -893,7 +986,7 @@ exec_show_variables(DCB *dcb, MAXINFO_TREE *filter)
         return;
     }
 
-    if (filter)
+    if (filter && filter->op == MAXOP_LIKE)
     {
         context->like = filter->value;
     }
@@ -911,6 +1004,7 @@ exec_show_variables(DCB *dcb, MAXINFO_TREE *filter)
     }
     resultset_add_column(result, "Variable_name", 40, COL_TYPE_VARCHAR);
     resultset_add_column(result, "Value", 40, COL_TYPE_VARCHAR);
+    maxinfo_set_page(result, filter);
     resultset_stream_mysql(result, dcb);
     resultset_free(result);
 }
@@ -1077,6 +1171,87 @@ maxinfo_max_event_exec_time()
     return poll_get_stat(POLL_STAT_MAX_EXECTIME);
 }
 
+/**
+ * Interface to buffer cache stats for allocations served from the caches
+ */
+static int64_t
+maxinfo_buffer_cache_hits()
+{
+    return gwbuf_get_stat(GWBUF_STAT_CACHED);
+}
+
+/**
+ * Interface to buffer cache stats for allocations that missed the caches
+ */
+static int64_t
+maxinfo_buffer_cache_misses()
+{
+    return gwbuf_get_stat(GWBUF_STAT_MALLOC);
+}
+
+/**
+ * Interface to buffer cache stats for buffers too large to be cached
+ */
+static int64_t
+maxinfo_buffer_large_allocations()
+{
+    return gwbuf_get_stat(GWBUF_STAT_LARGE);
+}
+
+/**
+ * Interface to the object pool stats for allocations served from the pools
+ */
+static int64_t
+maxinfo_object_pool_hits()
+{
+    return mxs_pool_get_total_stat(MXS_POOL_STAT_HITS);
+}
+
+/**
+ * Interface to the object pool stats for allocations that missed the pools
+ */
+static int64_t
+maxinfo_object_pool_misses()
+{
+    return mxs_pool_get_total_stat(MXS_POOL_STAT_MISSES);
+}
+
+/**
+ * Interface to the median eventfd wakeup latency of the worker threads
+ */
+static int64_t
+maxinfo_wakeup_latency_p50()
+{
+    return poll_get_stat(POLL_STAT_WAKEUP_P50);
+}
+
+/**
+ * Interface to the 99th percentile of the eventfd wakeup latency
+ */
+static int64_t
+maxinfo_wakeup_latency_p99()
+{
+    return poll_get_stat(POLL_STAT_WAKEUP_P99);
+}
+
+/**
+ * Interface to the median delay from epoll_wait return to event dispatch
+ */
+static int64_t
+maxinfo_dispatch_delay_p50()
+{
+    return poll_get_stat(POLL_STAT_DISPATCH_P50);
+}
+
+/**
+ * Interface to the 99th percentile of the event dispatch delay
+ */
+static int64_t
+maxinfo_dispatch_delay_p99()
+{
+    return poll_get_stat(POLL_STAT_DISPATCH_P99);
+}
+
 /**
  * Variables that may be sent in a show status
  */
@@ -1108,6 +1283,15 @@ static struct
     { "Max_event_queue_length", VT_INT, (STATSFUNC)maxinfo_max_event_queue_length },
     { "Max_event_queue_time", VT_INT, (STATSFUNC)maxinfo_max_event_queue_time },
     { "Max_event_execution_time", VT_INT, (STATSFUNC)maxinfo_max_event_exec_time },
+    { "Poll_wakeup_latency_p50_us", VT_INT, (STATSFUNC)maxinfo_wakeup_latency_p50 },
+    { "Poll_wakeup_latency_p99_us", VT_INT, (STATSFUNC)maxinfo_wakeup_latency_p99 },
+    { "Poll_dispatch_delay_p50_us", VT_INT, (STATSFUNC)maxinfo_dispatch_delay_p50 },
+    { "Poll_dispatch_delay_p99_us", VT_INT, (STATSFUNC)maxinfo_dispatch_delay_p99 },
+    { "Buffer_cache_hits", VT_INT, (STATSFUNC)maxinfo_buffer_cache_hits },
+    { "Buffer_cache_misses", VT_INT, (STATSFUNC)maxinfo_buffer_cache_misses },
+    { "Buffer_large_allocations", VT_INT, (STATSFUNC)maxinfo_buffer_large_allocations },
+    { "Object_pool_hits", VT_INT, (STATSFUNC)maxinfo_object_pool_hits },
+    { "Object_pool_misses", VT_INT, (STATSFUNC)maxinfo_object_pool_misses },
     { NULL, 0,  NULL }
 };
 
@@ -1175,7 +1359,7 @@ exec_show_status(DCB *dcb, MAXINFO_TREE *filter)
         return;
     }
 
-    if (filter)
+    if (filter && filter->op == MAXOP_LIKE)
     {
         context->like = filter->value;
     }
@@ -1193,6 +1377,7 @@ exec_show_status(DCB *dcb, MAXINFO_TREE *filter)
     }
     resultset_add_column(result, "Variable_name", 40, COL_TYPE_VARCHAR);
     resultset_add_column(result, "Value", 40, COL_TYPE_VARCHAR);
+    maxinfo_set_page(result, filter);
     resultset_stream_mysql(result, dcb);
     resultset_free(result);
 }
@@ -47,6 +47,7 @@ void maxinfo_free_tree(MAXINFO_TREE *); // This function is needed by maxinfo.c
 static char *fetch_token(char *, int *, char **);
 static MAXINFO_TREE *parse_column_list(char **sql);
 static MAXINFO_TREE *parse_table_name(char **sql);
+static MAXINFO_TREE *parse_limit(char *ptr, PARSE_ERROR *parse_error);
 MAXINFO_TREE* maxinfo_parse_literals(MAXINFO_TREE *tree, int min_args, char *ptr,
                                      PARSE_ERROR *parse_error);
 
@@ -99,6 +100,16 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
                     return NULL;
                 }
             }
+            else if (token == LT_LIMIT)
+            {
+                MXS_FREE(text);
+                if ((tree->right = parse_limit(ptr, parse_error)) == NULL)
+                {
+                    maxinfo_free_tree(tree);
+                    return NULL;
+                }
+                return tree;
+            }
             // Malformed show
             MXS_FREE(text);
             maxinfo_free_tree(tree);
@@ -182,6 +193,60 @@ maxinfo_parse(char *sql, PARSE_ERROR *parse_error)
     return NULL;
 }
 
+/**
+ * Parse the LIMIT clause of a show command, LIMIT count [OFFSET offset]
+ *
+ * @param ptr           Pointer to the text after LIMIT
+ * @param parse_error   Pointer to parsing error to fill
+ * @return A MAXOP_LIMIT node with the offset as a literal on the right, or NULL
+ */
+static MAXINFO_TREE *
+parse_limit(char *ptr, PARSE_ERROR *parse_error)
+{
+    MAXINFO_TREE *tree;
+    int token;
+    char *text;
+
+    if ((ptr = fetch_token(ptr, &token, &text)) == NULL || token != LT_STRING)
+    {
+        MXS_FREE(text);
+        *parse_error = PARSE_MALFORMED_SHOW;
+        return NULL;
+    }
+
+    if ((tree = make_tree_node(MAXOP_LIMIT, text, NULL, NULL)) == NULL)
+    {
+        MXS_FREE(text);
+        *parse_error = PARSE_SYNTAX_ERROR;
+        return NULL;
+    }
+
+    if ((ptr = fetch_token(ptr, &token, &text)) == NULL)
+    {
+        return tree;
+    }
+
+    if (token == LT_OFFSET)
+    {
+        MXS_FREE(text);
+
+        if ((ptr = fetch_token(ptr, &token, &text)) != NULL && token == LT_STRING)
+        {
+            tree->right = make_tree_node(MAXOP_LITERAL, text, NULL, NULL);
+
+            if ((ptr = fetch_token(ptr, &token, &text)) == NULL)
+            {
+                return tree;
+            }
+        }
+    }
+
+    MXS_FREE(text);
+    maxinfo_free_tree(tree);
+    *parse_error = PARSE_MALFORMED_SHOW;
+    return NULL;
+}
+
 /**
  * Parse a column list, may be a * or a valid list of string name
  * separated by a comma
@@ -321,6 +386,8 @@ static struct
     { "clear",      LT_CLEAR},
     { "shutdown",   LT_SHUTDOWN},
     { "restart",    LT_RESTART},
+    { "limit",      LT_LIMIT},
+    { "offset",     LT_OFFSET},
     { NULL, 0}
 };
 
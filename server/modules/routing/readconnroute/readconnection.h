@@ -32,9 +32,27 @@
 #include <maxscale/cdefs.h>
 #include <maxscale/dcb.h>
 #include <maxscale/service.h>
+#include <maxscale/replyparser.h>
 
 MXS_BEGIN_DECLS
 
+/** The weight of the previous average in the average response time */
+#define RESPONSE_TIME_HISTORY_WEIGHT 7
+
+/** How the server of a new session is chosen */
+typedef enum
+{
+    BALANCE_CONNECTIONS, /*< The server with the fewest connections */
+    BALANCE_ADAPTIVE     /*< The faster of two random servers by response time and operations */
+} readconn_balancing_t;
+
+/** A connection that statement balancing can route the statements to */
+typedef struct readconn_backend
+{
+    SERVER_REF *ref; /*< The server */
+    DCB *dcb;        /*< The connection to the server */
+} READCONN_BACKEND;
+
 /**
  * The client session structure used within this router.
  */
@@ -49,6 +67,12 @@ typedef struct router_client_session
     SERVER_REF *backend; /*< Backend used by the client session */
     DCB *backend_dcb; /*< DCB Connection to the backend      */
     DCB *client_dcb; /**< Client DCB */
+    uint64_t query_start; /*< When the query whose reply is waited for was sent, 0 if none */
+    READCONN_BACKEND *backends; /*< Connections opened by statement balancing, NULL if not used */
+    int n_backends; /*< Number of connections in backends */
+    bool pinned; /*< The session stays on its current server */
+    int n_replies; /*< Replies that have not been received, with statement balancing */
+    MXS_REPLY_PARSER parser; /*< Finds the ends of the replies, with statement balancing */
     struct router_client_session *next;
 #if defined(SS_DEBUG)
     skygw_chk_t rses_chk_tail;
@@ -62,6 +86,8 @@ typedef struct
 {
     int n_sessions; /*< Number sessions created     */
     int n_queries; /*< Number of queries forwarded */
+    int n_moved; /*< Statements routed to another server than the previous statement */
+    int n_pinned; /*< Sessions that stopped moving between servers */
 } ROUTER_STATS;
 
 /**
@@ -73,6 +99,8 @@ typedef struct router_instance
     SPINLOCK lock; /*< Spinlock for the instance data           */
     unsigned int bitmask; /*< Bitmask to apply to server->status       */
     unsigned int bitvalue; /*< Required value of server->status         */
+    readconn_balancing_t balancing; /*< How the servers of new sessions are chosen */
+    bool statement_balancing; /*< Route each statement of a session to the best server */
     ROUTER_STATS stats; /*< Statistics for this router               */
     struct router_instance
         *next;
@@ -72,10 +72,14 @@
 
 #include "readconnection.h"
 
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <maxscale/alloc.h>
 #include <maxscale/server.h>
 #include <maxscale/router.h>
@@ -86,6 +90,7 @@
 #include <maxscale/log_manager.h>
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/modutil.h>
+#include <maxscale/random_jkiss.h>
 
 /* The router entry points */
 static MXS_ROUTER *createInstance(SERVICE *service, char **options);
@@ -104,6 +109,13 @@ static void rses_end_locked_router_action(ROUTER_CLIENT_SES* rses);
 static SERVER_REF *get_root_master(SERVER_REF *servers);
 static int handle_state_switch(DCB* dcb, DCB_REASON reason, void * routersession);
 
+static const MXS_ENUM_VALUE balancing_values[] =
+{
+    {"connections", BALANCE_CONNECTIONS},
+    {"adaptive",    BALANCE_ADAPTIVE},
+    {NULL}
+};
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -143,6 +155,14 @@ MXS_MODULE* MXS_CREATE_MODULE()
         NULL, /* Thread init. */
         NULL, /* Thread finish. */
         {
+            {
+                "balancing",
+                MXS_MODULE_PARAM_ENUM,
+                "connections",
+                MXS_MODULE_OPT_NONE,
+                balancing_values
+            },
+            {"statement_balancing", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -181,6 +201,8 @@ createInstance(SERVICE *service, char **options)
 
     inst->service = service;
     spinlock_init(&inst->lock);
+    inst->balancing = config_get_enum(service->svc_config_param, "balancing", balancing_values);
+    inst->statement_balancing = config_get_bool(service->svc_config_param, "statement_balancing");
 
     /*
      * Process the options
@@ -241,6 +263,13 @@ createInstance(SERVICE *service, char **options)
         inst->bitmask |= (SERVER_RUNNING);
         inst->bitvalue |= SERVER_RUNNING;
     }
+
+    if (inst->statement_balancing && (inst->bitvalue & SERVER_MASTER))
+    {
+        MXS_WARNING("Only the master is used with 'router_options=master', "
+                    "disabling 'statement_balancing' for service '%s'.", service->name);
+        inst->statement_balancing = false;
+    }
     /*
      * We have completed the creation of the instance data, so now
      * insert this router instance into the linked list of routers
@@ -250,6 +279,388 @@ createInstance(SERVICE *service, char **options)
     return (MXS_ROUTER *) inst;
 }
 
+/**
+ * @brief The current time of the monotonic clock in microseconds
+ */
+static uint64_t clock_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief The expected time it takes a server to respond to a new statement
+ *
+ * The average response time of the server is multiplied by the number of
+ * operations it has in progress and divided by the weight of the server.
+ *
+ * @param ref    Server reference
+ * @param weight Weight of the server, not zero
+ * @return The expected cost of the server
+ */
+static int64_t expected_cost(SERVER_REF *ref, int weight)
+{
+    int64_t ops = ts_stats_sum(ref->server->stats.n_current_ops);
+
+    return (((int64_t)ref->response_time + 1) * (ops + 1) * 1000) / weight;
+}
+
+/**
+ * @brief Choose the server of a new session with the power of two choices
+ *
+ * Two different servers are picked at random and the one with the lower
+ * expected cost is used. As the choice is random, sessions that start at the
+ * same time are spread over the servers instead of all going to the server
+ * that looked the least loaded when they started.
+ *
+ * @param candidates The eligible servers
+ * @param weights    Weights of the servers
+ * @param n          Number of servers
+ * @return The chosen server or NULL if there are none
+ */
+static SERVER_REF* choose_adaptive(SERVER_REF **candidates, int *weights, int n)
+{
+    if (n < 2)
+    {
+        return n == 1 ? candidates[0] : NULL;
+    }
+
+    int first = random_jkiss_range(n);
+    int second = random_jkiss_range(n - 1);
+
+    if (second >= first)
+    {
+        second++;
+    }
+
+    return expected_cost(candidates[second], weights[second]) <
+           expected_cost(candidates[first], weights[first]) ?
+           candidates[second] : candidates[first];
+}
+
+/**
+ * @brief Mark the reply of a query as received
+ *
+ * The time to the first packet of the reply updates the exponentially
+ * weighted moving average of the response time of the server. The sessions
+ * update it without locking, as a lost update only delays the average a little.
+ *
+ * @param rses Router client session
+ */
+static void reply_received(ROUTER_CLIENT_SES *rses)
+{
+    SERVER_REF *ref = rses->backend;
+    uint64_t elapsed = clock_us() - rses->query_start;
+    int sample = elapsed < INT_MAX ? (int)elapsed : INT_MAX;
+    int average = ref->response_time;
+
+    rses->query_start = 0;
+    ts_stats_add(ref->server->stats.n_current_ops, -1);
+
+    if (average == 0)
+    {
+        ref->response_time = sample > 0 ? sample : 1;
+    }
+    else
+    {
+        ref->response_time = (int)(((int64_t)average * RESPONSE_TIME_HISTORY_WEIGHT + sample) /
+                                   (RESPONSE_TIME_HISTORY_WEIGHT + 1));
+    }
+}
+
+/** The end of a reply is a LOCAL INFILE request, the client sends a file next */
+static bool reply_local_infile(void *data, const uint8_t *packet, size_t len)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES *) data;
+    rses->pinned = true;
+    return true;
+}
+
+/** With statement balancing, only the ends of the replies are needed */
+static const MXS_REPLY_CB statement_reply_cb =
+{
+    NULL,
+    NULL,
+    reply_local_infile
+};
+
+/** Where a statement can be routed with statement balancing */
+typedef enum
+{
+    STMT_MOVABLE, /*< Any server */
+    STMT_STAY,    /*< The server of the previous statement */
+    STMT_PIN      /*< The server of the previous statement and all statements after it */
+} stmt_route_t;
+
+/**
+ * @brief Check if a statement contains a word, ignoring case
+ */
+static bool stmt_contains(const char *sql, int len, const char *word)
+{
+    int wlen = strlen(word);
+
+    for (int i = 0; i + wlen <= len; i++)
+    {
+        if (strncasecmp(sql + i, word, wlen) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Find where a statement can be routed with statement balancing
+ *
+ * Only a SELECT that does not use or change the state of its connection can
+ * be moved to another server. A statement that depends on the previous
+ * statement, such as SHOW WARNINGS, stays on the server of the previous one.
+ * A statement that may change the state of the connection pins the session
+ * to its server. The check is done on the text of the statement and it errs
+ * on the side of pinning.
+ *
+ * @param queue A COM_QUERY packet
+ * @return Where the statement can be routed
+ */
+static stmt_route_t get_stmt_route(GWBUF *queue)
+{
+    char *sql;
+    int len;
+
+    if (!modutil_extract_SQL(queue, &sql, &len))
+    {
+        return STMT_PIN;
+    }
+
+    int i = 0;
+
+    while (i < len)
+    {
+        if (isspace((unsigned char)sql[i]))
+        {
+            i++;
+        }
+        else if (i + 2 < len && sql[i] == '/' && sql[i + 1] == '*' && sql[i + 2] != '!')
+        {
+            char *end = memmem(sql + i + 2, len - i - 2, "*/", 2);
+            i = end ? end - sql + 2 : len;
+        }
+        else if (sql[i] == '#' || (i + 2 < len && sql[i] == '-' && sql[i + 1] == '-' &&
+                                   isspace((unsigned char)sql[i + 2])))
+        {
+            char *end = memchr(sql + i, '\n', len - i);
+            i = end ? end - sql + 1 : len;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    sql += i;
+    len -= i;
+
+    if (len >= 6 && strncasecmp(sql, "SELECT", 6) == 0)
+    {
+        if (stmt_contains(sql, len, ":=") || stmt_contains(sql, len, "INTO") ||
+            stmt_contains(sql, len, "_LOCK"))
+        {
+            /** Changes a variable or takes a lock */
+            return STMT_PIN;
+        }
+        else if (stmt_contains(sql, len, "FOUND_ROWS") || stmt_contains(sql, len, "_COUNT") ||
+                 stmt_contains(sql, len, "LAST_INSERT_ID"))
+        {
+            /** Reads the results of the previous statement */
+            return STMT_STAY;
+        }
+
+        return STMT_MOVABLE;
+    }
+    else if ((len >= 4 && strncasecmp(sql, "SHOW", 4) == 0) ||
+             (len >= 5 && strncasecmp(sql, "BEGIN", 5) == 0) ||
+             (len >= 5 && strncasecmp(sql, "START", 5) == 0) ||
+             (len >= 6 && strncasecmp(sql, "COMMIT", 6) == 0) ||
+             (len >= 8 && strncasecmp(sql, "ROLLBACK", 8) == 0))
+    {
+        return STMT_STAY;
+    }
+
+    return STMT_PIN;
+}
+
+/**
+ * @brief Check if a server can be used for the statements of a session
+ *
+ * @param inst   Router instance
+ * @param ref    Server reference
+ * @param master The root master or NULL
+ * @return The weight of the server or 0 if it can't be used
+ */
+static int statement_target_weight(ROUTER_INSTANCE *inst, SERVER_REF *ref, SERVER_REF *master)
+{
+    SERVER_STATE state;
+    server_get_state(ref->server, &state);
+    int weight = server_ref_weight(ref);
+
+    if (!SERVER_REF_IS_ACTIVE(ref) || SERVER_IN_MAINT(&state) || !SERVER_IS_RUNNING(&state) ||
+        (state.status & inst->bitmask & inst->bitvalue) == 0 ||
+        (ref == master && (inst->bitvalue & SERVER_SLAVE)))
+    {
+        weight = 0;
+    }
+
+    return weight;
+}
+
+/**
+ * @brief Get a connection to a server for statement balancing
+ *
+ * The connections of a session are opened when they are first needed and
+ * kept until the session is closed. If the server has a persistent
+ * connection pool, the connection is taken from the pool of the thread.
+ *
+ * @param rses Router client session
+ * @param ref  The server
+ * @return The connection or NULL if connecting failed
+ */
+static DCB* get_backend_dcb(ROUTER_CLIENT_SES *rses, SERVER_REF *ref)
+{
+    for (int i = 0; i < rses->n_backends; i++)
+    {
+        if (rses->backends[i].ref == ref)
+        {
+            if (rses->backends[i].dcb == NULL)
+            {
+                /** The previous connection failed */
+                rses->backends[i].dcb = dcb_connect(ref->server, rses->client_dcb->session,
+                                                    ref->server->protocol);
+            }
+
+            return rses->backends[i].dcb;
+        }
+    }
+
+    READCONN_BACKEND *backends = MXS_REALLOC(rses->backends,
+                                             (rses->n_backends + 1) * sizeof(READCONN_BACKEND));
+    DCB *dcb = NULL;
+
+    if (backends)
+    {
+        rses->backends = backends;
+
+        if ((dcb = dcb_connect(ref->server, rses->client_dcb->session, ref->server->protocol)))
+        {
+            rses->backends[rses->n_backends].ref = ref;
+            rses->backends[rses->n_backends].dcb = dcb;
+            rses->n_backends++;
+            atomic_add(&ref->connections, 1);
+        }
+    }
+
+    return dcb;
+}
+
+/**
+ * @brief Remove a connection opened by statement balancing
+ *
+ * @param rses Router client session
+ * @param dcb  The connection
+ * @return True if the connection was one of the connections of the session
+ */
+static bool remove_backend_dcb(ROUTER_CLIENT_SES *rses, DCB *dcb)
+{
+    for (int i = 0; i < rses->n_backends; i++)
+    {
+        if (rses->backends[i].dcb == dcb)
+        {
+            /** The server stays so that freeSession decreases its connections */
+            rses->backends[i].dcb = NULL;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Choose the server of a statement with statement balancing
+ *
+ * This must be called with the router session locked.
+ *
+ * @param inst    Router instance
+ * @param rses    Router client session
+ * @param command The command
+ * @param queue   The statement
+ */
+static void balance_statement(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                              mysql_server_cmd_t command, GWBUF *queue)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+    stmt_route_t route = STMT_STAY;
+
+    if (command == MYSQL_COM_QUERY)
+    {
+        route = get_stmt_route(queue);
+    }
+    else if (command != MYSQL_COM_PING && command != MYSQL_COM_QUIT)
+    {
+        route = STMT_PIN;
+    }
+
+    if (route == STMT_PIN)
+    {
+        MXS_INFO("Statement may change the state of the connection, the session "
+                 "stays on server '%s'.", rses->backend->server->unique_name);
+        rses->pinned = true;
+        atomic_add(&inst->stats.n_pinned, 1);
+        return;
+    }
+
+    if (route == STMT_MOVABLE && rses->n_replies == 0 &&
+        session_is_autocommit(session) && !session_trx_is_active(session))
+    {
+        SERVER_REF *master = get_root_master(inst->service->dbref);
+        int n = 0;
+
+        for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
+        {
+            n++;
+        }
+
+        SERVER_REF *candidates[n + 1];
+        int weights[n + 1];
+        n = 0;
+
+        for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
+        {
+            if ((weights[n] = statement_target_weight(inst, ref, master)) > 0)
+            {
+                candidates[n++] = ref;
+            }
+        }
+
+        SERVER_REF *ref = choose_adaptive(candidates, weights, n);
+        DCB *dcb;
+
+        if (ref && ref != rses->backend && (dcb = get_backend_dcb(rses, ref)))
+        {
+            MXS_INFO("Moving statement from server '%s' to '%s'.",
+                     rses->backend->server->unique_name, ref->server->unique_name);
+            rses->backend = ref;
+            rses->backend_dcb = dcb;
+            atomic_add(&inst->stats.n_moved, 1);
+        }
+    }
+
+    if (command != MYSQL_COM_QUIT)
+    {
+        rses->n_replies++;
+    }
+}
+
 /**
  * Associate a new session with this instance of the router.
  *
@@ -308,9 +719,26 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
      * become the new candidate. This has the effect of spreading the
      * connections over different servers during periods of very low load.
      */
+    int candidate_weight = 0;
+    int64_t candidate_total = -1; /* Total connections of the candidate, read when needed */
+    int n_refs = 0;
+    int n_adaptive = 0;
+
     for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
     {
-        if (!SERVER_REF_IS_ACTIVE(ref) || SERVER_IN_MAINT(ref->server) || ref->weight == 0)
+        n_refs++;
+    }
+
+    SERVER_REF *adaptive[n_refs + 1];
+    int adaptive_weights[n_refs + 1];
+
+    for (SERVER_REF *ref = inst->service->dbref; ref; ref = ref->next)
+    {
+        SERVER_STATE state;
+        server_get_state(ref->server, &state);
+        int weight = server_ref_weight(ref);
+
+        if (!SERVER_REF_IS_ACTIVE(ref) || SERVER_IN_MAINT(&state) || weight == 0)
         {
             continue;
         }
@@ -327,8 +755,8 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
         }
 
         /* Check server status bits against bitvalue from router_options */
-        if (ref && SERVER_IS_RUNNING(ref->server) &&
-            (ref->server->status & inst->bitmask & inst->bitvalue))
+        if (ref && SERVER_IS_RUNNING(&state) &&
+            (state.status & inst->bitmask & inst->bitvalue))
         {
             if (master_host)
             {
@@ -363,29 +791,56 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
                 }
             }
 
+            if (inst->balancing == BALANCE_ADAPTIVE)
+            {
+                /* The server is chosen once all eligible servers are known */
+                adaptive[n_adaptive] = ref;
+                adaptive_weights[n_adaptive++] = weight;
+            }
             /* If no candidate set, set first running server as our initial candidate server */
-            if (candidate == NULL)
+            else if (candidate == NULL)
             {
                 candidate = ref;
+                candidate_weight = weight;
+                candidate_total = -1;
             }
-            else if (((ref->connections + 1) * 1000) / ref->weight <
-                     ((candidate->connections + 1) * 1000) / candidate->weight)
+            else if (((ref->connections + 1) * 1000) / weight <
+                     ((candidate->connections + 1) * 1000) / candidate_weight)
             {
                 /* This running server has fewer connections, set it as a new candidate */
                 candidate = ref;
+                candidate_weight = weight;
+                candidate_total = -1;
             }
-            else if (((ref->connections + 1) * 1000) / ref->weight ==
-                     ((candidate->connections + 1) * 1000) / candidate->weight &&
-                     ref->server->stats.n_connections < candidate->server->stats.n_connections)
+            else if (((ref->connections + 1) * 1000) / weight ==
+                     ((candidate->connections + 1) * 1000) / candidate_weight)
             {
-                /* This running server has the same number of connections currently as the candidate
-                but has had fewer connections over time than candidate, set this server to
-                candidate*/
-                candidate = ref;
+                /* The totals are summed over the threads, read each one only once */
+                int64_t total = ts_stats_sum(ref->server->stats.n_connections);
+
+                if (candidate_total < 0)
+                {
+                    candidate_total = ts_stats_sum(candidate->server->stats.n_connections);
+                }
+
+                if (total < candidate_total)
+                {
+                    /* This running server has the same number of connections currently as the candidate
+                    but has had fewer connections over time than candidate, set this server to
+                    candidate*/
+                    candidate = ref;
+                    candidate_weight = weight;
+                    candidate_total = total;
+                }
             }
         }
     }
 
+    if (inst->balancing == BALANCE_ADAPTIVE && candidate == NULL)
+    {
+        candidate = choose_adaptive(adaptive, adaptive_weights, n_adaptive);
+    }
+
     /* If we haven't found a proper candidate yet but a master server is available, we'll pick that
      * with the assumption that it is "better" than a slave.
      */
@@ -423,6 +878,21 @@ newSession(MXS_ROUTER *instance, MXS_SESSION *session)
 
     atomic_add(&candidate->connections, 1);
 
+    if (inst->statement_balancing)
+    {
+        if ((client_rses->backends = MXS_MALLOC(sizeof(READCONN_BACKEND))))
+        {
+            client_rses->backends[0].ref = candidate;
+            client_rses->backends[0].dcb = client_rses->backend_dcb;
+            client_rses->n_backends = 1;
+            mxs_reply_parser_init(&client_rses->parser, &statement_reply_cb, client_rses, false);
+        }
+        else
+        {
+            client_rses->pinned = true;
+        }
+    }
+
     // TODO: Remove this as it is never called
     dcb_add_callback(client_rses->backend_dcb,
                      DCB_REASON_NOT_RESPONDING,
@@ -460,8 +930,27 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
     ROUTER_INSTANCE* router = (ROUTER_INSTANCE *) router_instance;
     ROUTER_CLIENT_SES* router_cli_ses = (ROUTER_CLIENT_SES *) router_client_ses;
 
-    ss_debug(int prev_val = ) atomic_add(&router_cli_ses->backend->connections, -1);
-    ss_dassert(prev_val > 0);
+    if (router_cli_ses->backends)
+    {
+        for (int i = 0; i < router_cli_ses->n_backends; i++)
+        {
+            ss_debug(int prev_val = ) atomic_add(&router_cli_ses->backends[i].ref->connections, -1);
+            ss_dassert(prev_val > 0);
+        }
+
+        mxs_reply_parser_free(&router_cli_ses->parser);
+        MXS_FREE(router_cli_ses->backends);
+    }
+    else
+    {
+        ss_debug(int prev_val = ) atomic_add(&router_cli_ses->backend->connections, -1);
+        ss_dassert(prev_val > 0);
+    }
+
+    if (router_cli_ses->query_start)
+    {
+        ts_stats_add(router_cli_ses->backend->server->stats.n_current_ops, -1);
+    }
 
     MXS_FREE(router_cli_ses);
 }
@@ -493,6 +982,19 @@ closeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session)
         /** Unlock */
         rses_end_locked_router_action(router_cli_ses);
 
+        /** The other connections opened by statement balancing */
+        for (int i = 0; i < router_cli_ses->n_backends; i++)
+        {
+            DCB *dcb = router_cli_ses->backends[i].dcb;
+            router_cli_ses->backends[i].dcb = NULL;
+
+            if (dcb && dcb != backend_dcb)
+            {
+                CHK_DCB(dcb);
+                dcb_close(dcb);
+            }
+        }
+
         /**
          * Close the backend server connection
          */
@@ -569,6 +1071,12 @@ routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *queu
 
     if (!rses_is_closed)
     {
+        if (router_cli_ses->backends && !router_cli_ses->pinned &&
+            !GWBUF_IS_TYPE_CONTINUATION(queue))
+        {
+            balance_statement(inst, router_cli_ses, mysql_command, queue);
+        }
+
         backend_dcb = router_cli_ses->backend_dcb;
         /** unlock */
         rses_end_locked_router_action(router_cli_ses);
@@ -586,6 +1094,13 @@ routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *queu
 
     char* trc = NULL;
 
+    if (GWBUF_IS_TYPE_CONTINUATION(queue))
+    {
+        /** The rest of a large command goes where its start went */
+        rc = backend_dcb->func.write(backend_dcb, queue);
+        goto return_rc;
+    }
+
     switch (mysql_command)
     {
     case MYSQL_COM_CHANGE_USER:
@@ -598,6 +1113,15 @@ routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *queu
             trc = modutil_get_SQL(queue);
         }
     default:
+        if ((inst->balancing == BALANCE_ADAPTIVE || inst->statement_balancing) &&
+            router_cli_ses->query_start == 0 &&
+            mysql_command != MYSQL_COM_QUIT && mysql_command != MYSQL_COM_STMT_CLOSE &&
+            mysql_command != MYSQL_COM_STMT_SEND_LONG_DATA)
+        {
+            /** Queries that are sent before the previous reply are not measured */
+            router_cli_ses->query_start = clock_us();
+            ts_stats_add(router_cli_ses->backend->server->stats.n_current_ops, 1);
+        }
         rc = backend_dcb->func.write(backend_dcb, queue);
         break;
     }
@@ -628,10 +1152,29 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
 
     dcb_printf(dcb, "\tNumber of router sessions:   	%d\n",
                router_inst->stats.n_sessions);
-    dcb_printf(dcb, "\tCurrent no. of router sessions:	%d\n",
-               router_inst->service->stats.n_current);
+    dcb_printf(dcb, "\tCurrent no. of router sessions:	%" PRId64 "\n",
+               ts_stats_sum(router_inst->service->stats.n_current));
     dcb_printf(dcb, "\tNumber of queries forwarded:   	%d\n",
                router_inst->stats.n_queries);
+    if (router_inst->statement_balancing)
+    {
+        dcb_printf(dcb, "\tStatements moved to another server:	%d\n",
+                   router_inst->stats.n_moved);
+        dcb_printf(dcb, "\tSessions pinned to their server:	%d\n",
+                   router_inst->stats.n_pinned);
+    }
+    dcb_printf(dcb, "\tBalancing:                     	%s\n",
+               router_inst->balancing == BALANCE_ADAPTIVE ? "adaptive" : "connections");
+    if (router_inst->balancing == BALANCE_ADAPTIVE)
+    {
+        dcb_printf(dcb, "\t\tServer               Response time  Operations\n");
+        for (SERVER_REF *ref = router_inst->service->dbref; ref; ref = ref->next)
+        {
+            dcb_printf(dcb, "\t\t%-20s %8d us    %" PRId64 "\n",
+                       ref->server->unique_name, ref->response_time,
+                       ts_stats_sum(ref->server->stats.n_current_ops));
+        }
+    }
     if ((weightby = serviceGetWeightingParameter(router_inst->service))
         != NULL)
     {
@@ -663,7 +1206,43 @@ diagnostics(MXS_ROUTER *router, DCB *dcb)
 static void
 clientReply(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session, GWBUF *queue, DCB *backend_dcb)
 {
+    ROUTER_CLIENT_SES *router_cli_ses = (ROUTER_CLIENT_SES *) router_session;
     ss_dassert(backend_dcb->session->client_dcb != NULL);
+
+    if (router_cli_ses->query_start)
+    {
+        reply_received(router_cli_ses);
+    }
+
+    if (router_cli_ses->backends && !router_cli_ses->pinned)
+    {
+        size_t offset = 0;
+        size_t len = gwbuf_length(queue);
+
+        /** The session can be moved once all replies have been received */
+        while (router_cli_ses->n_replies > 0 && offset < len)
+        {
+            mxs_reply_state_t state = mxs_reply_parser_process(&router_cli_ses->parser, queue, &offset);
+
+            if (state == MXS_REPLY_DONE || state == MXS_REPLY_ERROR)
+            {
+                router_cli_ses->n_replies--;
+                mxs_reply_parser_reset(&router_cli_ses->parser);
+
+                if (state == MXS_REPLY_ERROR)
+                {
+                    MXS_ERROR("Malformed reply from server '%s', the session stays on it.",
+                              router_cli_ses->backend->server->unique_name);
+                    router_cli_ses->pinned = true;
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
     MXS_SESSION_ROUTE_REPLY(backend_dcb->session, queue);
 }
 
@@ -701,6 +1280,19 @@ static void handleError(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session
         problem_dcb->dcb_errhandle_called = true;
     }
 
+    if (router_cli_ses && router_cli_ses->backends &&
+        DCB_ROLE_BACKEND_HANDLER == problem_dcb->dcb_role &&
+        problem_dcb != router_cli_ses->backend_dcb &&
+        remove_backend_dcb(router_cli_ses, problem_dcb))
+    {
+        /** An idle connection of statement balancing failed, the session continues */
+        MXS_INFO("Connection to server '%s' failed, it is opened again when it is needed.",
+                 problem_dcb->server->unique_name);
+        dcb_close(problem_dcb);
+        *succp = true;
+        return;
+    }
+
     sesstate = session->state;
     client_dcb = session->client_dcb;
 
@@ -718,6 +1310,7 @@ static void handleError(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session
     else if (router_cli_ses && problem_dcb == router_cli_ses->backend_dcb)
     {
         router_cli_ses->backend_dcb = NULL;
+        remove_backend_dcb(router_cli_ses, problem_dcb);
         dcb_close(problem_dcb);
     }
 
@@ -787,7 +1380,16 @@ static void rses_end_locked_router_action(ROUTER_CLIENT_SES* rses)
 
 static uint64_t getCapabilities(MXS_ROUTER* instance)
 {
-    return RCAP_TYPE_NONE;
+    ROUTER_INSTANCE *inst = (ROUTER_INSTANCE *) instance;
+
+    if (inst->statement_balancing)
+    {
+        /** The ends of the replies are found from complete packets */
+        return RCAP_TYPE_TRANSACTION_TRACKING | RCAP_TYPE_STMT_OUTPUT | RCAP_TYPE_PACKET_STREAMING;
+    }
+
+    /** The response times are measured from the replies */
+    return inst->balancing == BALANCE_ADAPTIVE ? 0 : RCAP_TYPE_REPLY_PASSTHROUGH;
 }
 
 /********************************
@@ -808,16 +1410,22 @@ static SERVER_REF *get_root_master(SERVER_REF *servers)
     int i = 0;
     SERVER_REF *master_host = NULL;
 
+    int master_depth = 0;
+
     for (SERVER_REF *ref = servers; ref; ref = ref->next)
     {
-        if (ref->active && SERVER_IS_MASTER(ref->server))
+        SERVER_STATE state;
+        server_get_state(ref->server, &state);
+
+        if (ref->active && SERVER_IS_MASTER(&state))
         {
             if (master_host == NULL)
             {
                 master_host = ref;
+                master_depth = state.depth;
             }
-            else if (ref->server->depth < master_host->server->depth ||
-                     (ref->server->depth == master_host->server->depth &&
+            else if (state.depth < master_depth ||
+                     (state.depth == master_depth &&
                       ref->weight > master_host->weight))
             {
                 /**
@@ -825,6 +1433,7 @@ static SERVER_REF *get_root_master(SERVER_REF *servers)
                  * the depths are equal but this master has a higher weight
                  */
                 master_host = ref;
+                master_depth = state.depth;
             }
         }
     }
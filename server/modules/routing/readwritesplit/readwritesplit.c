@@ -30,6 +30,7 @@
 #include <maxscale/modinfo.h>
 #include <maxscale/modutil.h>
 #include <maxscale/alloc.h>
+#include <maxscale/mysql_utils.h>
 
 /**
  * @file readwritesplit.c   The entry points for the read/write query splitting
@@ -81,6 +82,7 @@ static void handleError(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session
                         GWBUF *errmsgbuf, DCB *backend_dcb,
                         mxs_error_action_t action, bool *succp);
 static uint64_t getCapabilities(MXS_ROUTER* instance);
+static bool isIdle(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session);
 
 /*
  * End of the API functions; now the module structure that links to them.
@@ -102,9 +104,13 @@ static void handle_error_reply_client(MXS_SESSION *ses, ROUTER_CLIENT_SES *rses,
 static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
                                         ROUTER_CLIENT_SES **rses,
                                         DCB *backend_dcb, GWBUF *errmsg);
+static void update_response_time(backend_ref_t *bref);
+static void update_causal_gtid(ROUTER_CLIENT_SES *rses, GWBUF *packet);
+static GWBUF *handle_causal_read_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                       backend_ref_t *bref, GWBUF *packet);
 static bool have_enough_servers(ROUTER_CLIENT_SES *rses, const int min_nsrv,
                                 int router_nsrv, ROUTER_INSTANCE *router);
-static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int* n_backend);
+static int create_backends(ROUTER_CLIENT_SES *rses, int n_backend);
 
 /**
  * Enum values for router parameters
@@ -122,6 +128,7 @@ static const MXS_ENUM_VALUE slave_selection_criteria_values[] =
     {"LEAST_ROUTER_CONNECTIONS", LEAST_ROUTER_CONNECTIONS},
     {"LEAST_BEHIND_MASTER",      LEAST_BEHIND_MASTER},
     {"LEAST_CURRENT_OPERATIONS", LEAST_CURRENT_OPERATIONS},
+    {"ADAPTIVE_ROUTING",         ADAPTIVE_ROUTING},
     {NULL}
 };
 
@@ -154,7 +161,8 @@ MXS_MODULE *MXS_CREATE_MODULE()
         clientReply,
         handleError,
         getCapabilities,
-        NULL
+        NULL,
+        isIdle
     };
 
     static MXS_MODULE info =
@@ -194,8 +202,24 @@ MXS_MODULE *MXS_CREATE_MODULE()
             {"retry_failed_reads", MXS_MODULE_PARAM_BOOL, "true"},
             {"disable_sescmd_history", MXS_MODULE_PARAM_BOOL, "true"},
             {"max_sescmd_history", MXS_MODULE_PARAM_COUNT, "0"},
+            {"compact_sescmd_history", MXS_MODULE_PARAM_BOOL, "true"},
+            {"async_sescmd", MXS_MODULE_PARAM_BOOL, "false"},
             {"strict_multi_stmt",  MXS_MODULE_PARAM_BOOL, "true"},
             {"master_accept_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"pipelining", MXS_MODULE_PARAM_BOOL, "false"},
+            {"lazy_connect", MXS_MODULE_PARAM_BOOL, "false"},
+            {"causal_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"causal_reads_timeout", MXS_MODULE_PARAM_COUNT, "10"},
+            {"route_memo", MXS_MODULE_PARAM_BOOL, "true"},
+            {"transaction_replay", MXS_MODULE_PARAM_BOOL, "false"},
+            {"transaction_replay_max_size", MXS_MODULE_PARAM_SIZE, "1Mi"},
+            {"transaction_replay_timeout", MXS_MODULE_PARAM_COUNT, "10"},
+            {"slave_multiplexing", MXS_MODULE_PARAM_BOOL, "false"},
+            {"hedged_reads", MXS_MODULE_PARAM_BOOL, "false"},
+            {"hedged_read_delay", MXS_MODULE_PARAM_COUNT, "0"},
+            {"max_backend_operations", MXS_MODULE_PARAM_COUNT, "0"},
+            {"queued_query_timeout", MXS_MODULE_PARAM_COUNT, "1000"},
+            {"query_coalescing", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -277,7 +301,46 @@ static MXS_ROUTER *createInstance(SERVICE *service, char **options)
     router->rwsplit_config.strict_multi_stmt = config_get_bool(params, "strict_multi_stmt");
     router->rwsplit_config.disable_sescmd_history = config_get_bool(params, "disable_sescmd_history");
     router->rwsplit_config.max_sescmd_history = config_get_integer(params, "max_sescmd_history");
+    router->rwsplit_config.compact_sescmd_history = config_get_bool(params, "compact_sescmd_history");
+    router->rwsplit_config.async_sescmd = config_get_bool(params, "async_sescmd");
     router->rwsplit_config.master_accept_reads = config_get_bool(params, "master_accept_reads");
+    router->rwsplit_config.pipelining = config_get_bool(params, "pipelining");
+    router->rwsplit_config.lazy_connect = config_get_bool(params, "lazy_connect");
+    router->rwsplit_config.causal_reads = config_get_bool(params, "causal_reads");
+    router->rwsplit_config.causal_reads_timeout = config_get_integer(params, "causal_reads_timeout");
+    router->rwsplit_config.route_memo = config_get_bool(params, "route_memo");
+    router->rwsplit_config.transaction_replay = config_get_bool(params, "transaction_replay");
+    router->rwsplit_config.transaction_replay_max_size = config_get_size(params,
+                                                                         "transaction_replay_max_size");
+    router->rwsplit_config.transaction_replay_timeout = config_get_integer(params,
+                                                                           "transaction_replay_timeout");
+    router->rwsplit_config.slave_multiplexing = config_get_bool(params, "slave_multiplexing");
+    router->rwsplit_config.hedged_reads = config_get_bool(params, "hedged_reads");
+    router->rwsplit_config.hedged_read_delay = config_get_integer(params, "hedged_read_delay");
+    router->rwsplit_config.max_backend_operations = config_get_integer(params, "max_backend_operations");
+    router->rwsplit_config.queued_query_timeout = config_get_integer(params, "queued_query_timeout");
+    router->rwsplit_config.query_coalescing = config_get_bool(params, "query_coalescing");
+
+    if ((router->stats.n_routed = ts_stats_alloc()) == NULL ||
+        (router->stats.n_memo_hits = ts_stats_alloc()) == NULL ||
+        (router->stats.classify_ns = ts_stats_alloc()) == NULL ||
+        (router->stats.route_ns = ts_stats_alloc()) == NULL ||
+        (router->stats.select_ns = ts_stats_alloc()) == NULL ||
+        (router->stats.n_trx_replays = ts_stats_alloc()) == NULL ||
+        (router->stats.n_trx_replay_failures = ts_stats_alloc()) == NULL ||
+        (router->stats.trx_replay_us = ts_stats_alloc()) == NULL ||
+        (router->stats.n_slave_releases = ts_stats_alloc()) == NULL ||
+        (router->stats.n_hedged_reads = ts_stats_alloc()) == NULL ||
+        (router->stats.n_hedge_wins = ts_stats_alloc()) == NULL ||
+        (router->stats.n_queued_stmts = ts_stats_alloc()) == NULL ||
+        (router->stats.n_queue_timeouts = ts_stats_alloc()) == NULL ||
+        (router->stats.queue_wait_us = ts_stats_alloc()) == NULL ||
+        (router->stats.n_coalesced = ts_stats_alloc()) == NULL ||
+        (router->stats.session_bytes = ts_stats_alloc()) == NULL)
+    {
+        free_rwsplit_instance(router);
+        return NULL;
+    }
 
     if (!handle_max_slaves(router, config_get_string(params, "max_slave_connections")) ||
         (options && !rwsplit_process_router_options(router, options)))
@@ -316,12 +379,28 @@ static MXS_ROUTER *createInstance(SERVICE *service, char **options)
 static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *session)
 {
     ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)router_inst;
-    ROUTER_CLIENT_SES *client_rses = (ROUTER_CLIENT_SES *)MXS_CALLOC(1, sizeof(ROUTER_CLIENT_SES));
+    int router_nservers = router->service->n_dbref;
+
+    /**
+     * The backend references and the routing decisions are in the same
+     * allocation as the session.
+     */
+    size_t memo_size = router->rwsplit_config.route_memo ?
+                       RWSPLIT_ROUTE_MEMO_SIZE * sizeof(rwsplit_route_memo_t) : 0;
+    size_t size = sizeof(ROUTER_CLIENT_SES) + router_nservers * sizeof(backend_ref_t) + memo_size;
+    ROUTER_CLIENT_SES *client_rses = (ROUTER_CLIENT_SES *)MXS_CALLOC(1, size);
 
     if (client_rses == NULL)
     {
         return NULL;
     }
+
+    client_rses->rses_mem_bytes = size;
+
+    if (memo_size)
+    {
+        client_rses->rses_route_memo = (rwsplit_route_memo_t*)&client_rses->rses_backends[router_nservers];
+    }
 #if defined(SS_DEBUG)
     client_rses->rses_chk_top = CHK_NUM_ROUTER_SES;
     client_rses->rses_chk_tail = CHK_NUM_ROUTER_SES;
@@ -329,11 +408,12 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
 
     client_rses->router = router;
     client_rses->client_dcb = session->client_dcb;
-    client_rses->have_tmp_tables = false;
     client_rses->forced_node = NULL;
     memcpy(&client_rses->rses_config, &router->rwsplit_config, sizeof(client_rses->rses_config));
+    trx_init(client_rses);
+    hedge_init(client_rses);
+    admission_init(client_rses);
 
-    int router_nservers = router->service->n_dbref;
     const int min_nservers = 1; /*< hard-coded for now */
 
     if (!have_enough_servers(client_rses, min_nservers, router_nservers, router))
@@ -345,13 +425,8 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
     /**
      * Create backend reference objects for this session.
      */
-    backend_ref_t *backend_ref;
-
-    if (!create_backends(client_rses, &backend_ref, &router_nservers))
-    {
-        MXS_FREE(client_rses);
-        return NULL;
-    }
+    router_nservers = create_backends(client_rses, router_nservers);
+    backend_ref_t *backend_ref = client_rses->rses_backends;
 
     int max_nslaves = rses_get_max_slavecount(client_rses, router_nservers);
     int max_slave_rlag = rses_get_max_replication_lag(client_rses);
@@ -360,23 +435,38 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
     client_rses->rses_nbackends = router_nservers; /*< # of backend servers */
 
     backend_ref_t *master_ref = NULL; /*< pointer to selected master */
-    if (!select_connect_backend_servers(&master_ref, backend_ref, router_nservers,
-                                        max_nslaves, max_slave_rlag,
-                                        client_rses->rses_config.slave_selection_criteria,
-                                        session, router, false))
+    bool lazy = (client_rses->rses_config.lazy_connect ||
+                 client_rses->rses_config.slave_multiplexing) && max_nslaves > 0;
+    bool connected = select_connect_backend_servers(&master_ref, backend_ref, router_nservers,
+                                                    lazy ? 0 : max_nslaves, max_slave_rlag,
+                                                    client_rses->rses_config.slave_selection_criteria,
+                                                    session, router, false);
+
+    if (connected && lazy && master_ref == NULL)
+    {
+        /** Without a master, the session needs the slaves from the start */
+        lazy = false;
+        connected = select_connect_backend_servers(&master_ref, backend_ref, router_nservers,
+                                                   max_nslaves, max_slave_rlag,
+                                                   client_rses->rses_config.slave_selection_criteria,
+                                                   session, router, false);
+    }
+
+    if (!connected)
     {
         /**
          * Master and at least <min_nslaves> slaves must be found if the router is
          * in the strict mode. If sessions without master are allowed, only
          * <min_nslaves> slaves must be found.
          */
-        MXS_FREE(client_rses->rses_backend_ref);
         MXS_FREE(client_rses);
         return NULL;
     }
 
     /** Copy backend pointers to router session. */
     client_rses->rses_master_ref = master_ref;
+    client_rses->rses_slaves_pending = lazy;
+    client_rses->rses_multiplex = lazy && client_rses->rses_config.slave_multiplexing;
 
     if (client_rses->rses_config.rw_max_slave_conn_percent)
     {
@@ -387,6 +477,7 @@ static MXS_ROUTER_SESSION *newSession(MXS_ROUTER *router_inst, MXS_SESSION *sess
     }
 
     router->stats.n_sessions += 1;
+    ts_stats_add(router->stats.session_bytes, client_rses->rses_mem_bytes);
 
     return (void *)client_rses;
 }
@@ -416,6 +507,9 @@ static void closeSession(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_sessio
          */
         router_cli_ses->rses_closed = true;
 
+        /** The sessions waiting for the reply to a shared read route it themselves */
+        coalesce_abort(router_cli_ses, NULL);
+
         for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
         {
             backend_ref_t *bref = &router_cli_ses->rses_backend_ref[i];
@@ -498,7 +592,20 @@ static void freeSession(MXS_ROUTER *router_instance, MXS_ROUTER_SESSION *router_
         }
     }
 
-    MXS_FREE(router_cli_ses->rses_backend_ref);
+    for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
+    {
+        gwbuf_free(router_cli_ses->rses_backend_ref[i].bref_causal_query);
+        ps_free_backend_ids(&router_cli_ses->rses_backend_ref[i]);
+    }
+
+    ps_finish(router_cli_ses);
+    trx_finish(router_cli_ses);
+    hedge_finish(router_cli_ses);
+    admission_finish(router_cli_ses);
+    coalesce_finish(router_cli_ses);
+    free_tmp_tables(router_cli_ses);
+    MXS_FREE(router_cli_ses->rses_causal_gtid);
+    ts_stats_add(router_cli_ses->router->stats.session_bytes, -(int64_t)router_cli_ses->rses_mem_bytes);
     MXS_FREE(router_cli_ses);
     return;
 }
@@ -519,6 +626,21 @@ void close_failed_bref(backend_ref_t *bref, bool fatal)
     bref_clear_state(bref, BREF_QUERY_ACTIVE);
     bref_clear_state(bref, BREF_IN_USE);
     bref_set_state(bref, BREF_CLOSED);
+    bref->bref_reply_count = 0;
+    bref->bref_reply_state = MYSQL_REPLY_STATE_START;
+    bref->bref_mux_replies = 0;
+    bref->bref_hedge_discard = HEDGE_DISCARD_NONE;
+
+    /** The reply to a shared read will not arrive */
+    coalesce_abort(bref->bref_sescmd_cur.scmd_cur_rses, bref);
+
+    /** The corked DCB is closed, it must not be uncorked later */
+    ROUTER_CLIENT_SES *rses = bref->bref_sescmd_cur.scmd_cur_rses;
+
+    if (rses && rses->rses_corked_dcb == bref->bref_dcb)
+    {
+        rses->rses_corked_dcb = NULL;
+    }
 
     if (fatal)
     {
@@ -530,11 +652,17 @@ void close_failed_bref(backend_ref_t *bref, bool fatal)
         sescmd_cursor_set_active(&bref->bref_sescmd_cur, false);
     }
 
+    bref->bref_sescmd_cur.scmd_cur_sent = 0;
+
     if (bref->bref_pending_cmd)
     {
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    gwbuf_free(bref->bref_causal_query);
+    bref->bref_causal_query = NULL;
+    bref->bref_causal_reply = false;
 }
 
 /**
@@ -543,7 +671,8 @@ void close_failed_bref(backend_ref_t *bref, bool fatal)
  * The routeQuery function will make the routing decision based on the contents
  * of the instance, session and the query itself. The query always represents
  * a complete MariaDB/MySQL packet because we define the RCAP_TYPE_STMT_INPUT in
- * getCapabilities().
+ * getCapabilities(). The only exception are the parts of a command that
+ * continue a maximum length packet, they are routed as they arrive.
  *
  * @param instance       Router instance
  * @param router_session Router session associated with the client
@@ -564,11 +693,57 @@ static int routeQuery(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session,
     }
     else
     {
+        bool pipelined = GWBUF_IS_TYPE_PIPELINED(querybuf);
+
         live_session_reply(&querybuf, rses);
-        if (route_single_stmt(inst, rses, querybuf))
+
+        if (!GWBUF_IS_TYPE_CONTINUATION(querybuf))
+        {
+            admission_set_priority(rses, querybuf);
+        }
+
+        if (rses->rses_trx.replaying)
+        {
+            /** The statement is routed once the transaction has been replayed */
+            if (trx_queue_stmt(rses, querybuf))
+            {
+                querybuf = NULL;
+                rval = 1;
+            }
+        }
+        else if (rses->rses_coalesce_wait)
+        {
+            /** The statement is routed once the reply of the other session is complete */
+            if (coalesce_queue_stmt(rses, querybuf))
+            {
+                querybuf = NULL;
+                rval = 1;
+            }
+        }
+        else if (admission_must_wait(rses, querybuf))
+        {
+            /** The statement is routed once a backend has room for it */
+            if (admission_queue_stmt(rses, querybuf))
+            {
+                querybuf = NULL;
+                rval = 1;
+            }
+        }
+        else if (GWBUF_IS_TYPE_CONTINUATION(querybuf))
+        {
+            /** The rest of a large command goes where its first packet went */
+            rval = route_continuation(rses, querybuf) ? 1 : 0;
+        }
+        else if (route_single_stmt(inst, rses, querybuf))
         {
             rval = 1;
         }
+
+        if (!pipelined)
+        {
+            /** This was the last statement the client sent */
+            uncork_pipelined_backend(rses);
+        }
     }
 
     if (querybuf != NULL)
@@ -610,8 +785,40 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
                router->rwsplit_config.disable_sescmd_history ? "true" : "false");
     dcb_printf(dcb, "\tmax_sescmd_history:        %d\n",
                router->rwsplit_config.max_sescmd_history);
+    dcb_printf(dcb, "\tcompact_sescmd_history:    %s\n",
+               router->rwsplit_config.compact_sescmd_history ? "true" : "false");
+    dcb_printf(dcb, "\tasync_sescmd:              %s\n",
+               router->rwsplit_config.async_sescmd ? "true" : "false");
     dcb_printf(dcb, "\tmaster_accept_reads:       %s\n",
                router->rwsplit_config.master_accept_reads ? "true" : "false");
+    dcb_printf(dcb, "\tpipelining:                %s\n",
+               router->rwsplit_config.pipelining ? "true" : "false");
+    dcb_printf(dcb, "\tlazy_connect:              %s\n",
+               router->rwsplit_config.lazy_connect ? "true" : "false");
+    dcb_printf(dcb, "\tcausal_reads:              %s\n",
+               router->rwsplit_config.causal_reads ? "true" : "false");
+    dcb_printf(dcb, "\tcausal_reads_timeout:      %d\n",
+               router->rwsplit_config.causal_reads_timeout);
+    dcb_printf(dcb, "\troute_memo:                %s\n",
+               router->rwsplit_config.route_memo ? "true" : "false");
+    dcb_printf(dcb, "\ttransaction_replay:        %s\n",
+               router->rwsplit_config.transaction_replay ? "true" : "false");
+    dcb_printf(dcb, "\ttransaction_replay_max_size: %" PRIu64 "\n",
+               router->rwsplit_config.transaction_replay_max_size);
+    dcb_printf(dcb, "\ttransaction_replay_timeout: %d\n",
+               router->rwsplit_config.transaction_replay_timeout);
+    dcb_printf(dcb, "\tslave_multiplexing:        %s\n",
+               router->rwsplit_config.slave_multiplexing ? "true" : "false");
+    dcb_printf(dcb, "\thedged_reads:              %s\n",
+               router->rwsplit_config.hedged_reads ? "true" : "false");
+    dcb_printf(dcb, "\thedged_read_delay:         %d\n",
+               router->rwsplit_config.hedged_read_delay);
+    dcb_printf(dcb, "\tmax_backend_operations:    %d\n",
+               router->rwsplit_config.max_backend_operations);
+    dcb_printf(dcb, "\tqueued_query_timeout:      %d\n",
+               router->rwsplit_config.queued_query_timeout);
+    dcb_printf(dcb, "\tquery_coalescing:          %s\n",
+               router->rwsplit_config.query_coalescing ? "true" : "false");
     dcb_printf(dcb, "\n");
 
     if (router->stats.n_queries > 0)
@@ -623,8 +830,12 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
 
     dcb_printf(dcb, "\tNumber of router sessions:           	%" PRIu64 "\n",
                router->stats.n_sessions);
-    dcb_printf(dcb, "\tCurrent no. of router sessions:      	%d\n",
-               router->service->stats.n_current);
+    int64_t n_current = ts_stats_sum(router->service->stats.n_current);
+    int64_t session_bytes = ts_stats_sum(router->stats.session_bytes);
+
+    dcb_printf(dcb, "\tCurrent no. of router sessions:      	%" PRId64 "\n", n_current);
+    dcb_printf(dcb, "\tMemory used by router sessions:      	%" PRId64 " bytes "
+               "(%" PRId64 " per session)\n", session_bytes, n_current > 0 ? session_bytes / n_current : 0);
     dcb_printf(dcb, "\tNumber of queries forwarded:          	%" PRIu64 "\n",
                router->stats.n_queries);
     dcb_printf(dcb, "\tNumber of queries forwarded to master:	%" PRIu64 " (%.2f%%)\n",
@@ -634,6 +845,71 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
     dcb_printf(dcb, "\tNumber of queries forwarded to all:   	%" PRIu64 " (%.2f%%)\n",
                router->stats.n_all, all_pct);
 
+    int64_t n_routed = ts_stats_sum(router->stats.n_routed);
+
+    if (n_routed > 0)
+    {
+        dcb_printf(dcb, "\tNumber of remembered routing decisions:	%" PRId64 " (%.2f%%)\n",
+                   ts_stats_sum(router->stats.n_memo_hits),
+                   ts_stats_sum(router->stats.n_memo_hits) * 100.0 / n_routed);
+        dcb_printf(dcb, "\tAverage classification time:          	%" PRId64 " ns\n",
+                   ts_stats_sum(router->stats.classify_ns) / n_routed);
+        dcb_printf(dcb, "\tAverage routing decision time:        	%" PRId64 " ns\n",
+                   ts_stats_sum(router->stats.route_ns) / n_routed);
+        dcb_printf(dcb, "\tAverage backend selection time:       	%" PRId64 " ns\n",
+                   ts_stats_sum(router->stats.select_ns) / n_routed);
+    }
+
+    if (router->rwsplit_config.transaction_replay)
+    {
+        int64_t n_replays = ts_stats_sum(router->stats.n_trx_replays);
+
+        dcb_printf(dcb, "\tNumber of replayed transactions:      	%" PRId64 "\n", n_replays);
+        dcb_printf(dcb, "\tNumber of failed transaction replays: 	%" PRId64 "\n",
+                   ts_stats_sum(router->stats.n_trx_replay_failures));
+
+        if (n_replays > 0)
+        {
+            dcb_printf(dcb, "\tAverage transaction replay time:      	%" PRId64 " us\n",
+                       ts_stats_sum(router->stats.trx_replay_us) / n_replays);
+        }
+    }
+
+    if (router->rwsplit_config.slave_multiplexing)
+    {
+        dcb_printf(dcb, "\tNumber of slave connections released: 	%" PRId64 "\n",
+                   ts_stats_sum(router->stats.n_slave_releases));
+    }
+
+    if (router->rwsplit_config.hedged_reads)
+    {
+        dcb_printf(dcb, "\tNumber of hedged reads:               	%" PRId64 "\n",
+                   ts_stats_sum(router->stats.n_hedged_reads));
+        dcb_printf(dcb, "\tNumber of hedged reads won by the copy:	%" PRId64 "\n",
+                   ts_stats_sum(router->stats.n_hedge_wins));
+    }
+
+    if (router->rwsplit_config.max_backend_operations > 0)
+    {
+        int64_t n_queued = ts_stats_sum(router->stats.n_queued_stmts);
+
+        dcb_printf(dcb, "\tNumber of queued statements:          	%" PRId64 "\n", n_queued);
+        dcb_printf(dcb, "\tNumber of queued statements timed out:	%" PRId64 "\n",
+                   ts_stats_sum(router->stats.n_queue_timeouts));
+
+        if (n_queued > 0)
+        {
+            dcb_printf(dcb, "\tAverage time in queue:                	%" PRId64 " us\n",
+                       ts_stats_sum(router->stats.queue_wait_us) / n_queued);
+        }
+    }
+
+    if (router->rwsplit_config.query_coalescing)
+    {
+        dcb_printf(dcb, "\tNumber of reads with a shared reply:  	%" PRId64 "\n",
+                   ts_stats_sum(router->stats.n_coalesced));
+    }
+
     if ((weightby = serviceGetWeightingParameter(router->service)) != NULL)
     {
         dcb_printf(dcb, "\tConnection distribution based on %s "
@@ -644,10 +920,20 @@ static void diagnostics(MXS_ROUTER *instance, DCB *dcb)
         dcb_printf(dcb, "\t\t                               Global  Router\n");
         for (SERVER_REF *ref = router->service->dbref; ref; ref = ref->next)
         {
-            dcb_printf(dcb, "\t\t%-20s %3.1f%%     %-6d  %-6d  %d\n",
+            dcb_printf(dcb, "\t\t%-20s %3.1f%%     %-6" PRId64 "  %-6d  %" PRId64 "\n",
                        ref->server->unique_name, (float)ref->weight / 10,
-                       ref->server->stats.n_current, ref->connections,
-                       ref->server->stats.n_current_ops);
+                       ts_stats_sum(ref->server->stats.n_current), ref->connections,
+                       ts_stats_sum(ref->server->stats.n_current_ops));
+        }
+    }
+
+    if (router->rwsplit_config.slave_selection_criteria == ADAPTIVE_ROUTING)
+    {
+        dcb_printf(dcb, "\tAverage response times:\n");
+
+        for (SERVER_REF *ref = router->service->dbref; ref; ref = ref->next)
+        {
+            dcb_printf(dcb, "\t\t%-20s %d us\n", ref->server->unique_name, ref->response_time);
         }
     }
 }
@@ -670,6 +956,7 @@ static void clientReply(MXS_ROUTER *instance,
     ROUTER_CLIENT_SES *router_cli_ses = (ROUTER_CLIENT_SES *)router_session;
     ROUTER_INSTANCE *router_inst = (ROUTER_INSTANCE *)instance;
     DCB *client_dcb = backend_dcb->session->client_dcb;
+    bool reply_pending = false;
 
     CHK_CLIENT_RSES(router_cli_ses);
 
@@ -700,11 +987,55 @@ static void clientReply(MXS_ROUTER *instance,
     /** Statement was successfully executed, free the stored statement */
     session_clear_stmt(backend_dcb->session);
 
+    if (router_cli_ses->rses_config.hedged_reads &&
+        (writebuf = hedge_process_reply(router_cli_ses, bref, writebuf)) == NULL)
+    {
+        /** The client already got the reply of the other slave */
+        return;
+    }
+
     /**
-     * Active cursor means that reply is from session command
-     * execution.
+     * Active cursor means that reply is from session command execution. With
+     * async_sescmd, a statement may follow the session commands in flight and
+     * its reply is the first that is not a reply to a session command.
      */
-    if (sescmd_cursor_is_active(scur))
+    bool sescmd_reply = sescmd_cursor_is_active(scur) &&
+                        (!router_cli_ses->rses_config.async_sescmd ||
+                         GWBUF_IS_TYPE_SESCMD_RESPONSE(writebuf));
+    bool causal_reply = bref->bref_causal_reply;
+
+    if ((bref->bref_causal_query || bref->bref_causal_reply) && !sescmd_reply &&
+        (writebuf = handle_causal_read_reply(router_inst, router_cli_ses, bref, writebuf)) == NULL)
+    {
+        /** The result of waiting for the GTID is not a part of the reply */
+        return;
+    }
+
+    bool trx_tracked = trx_is_tracked(router_cli_ses, bref) && !sescmd_reply;
+    bool trx_complete = false;
+
+    if (trx_tracked)
+    {
+        /** The reply is checksummed and the replies to replayed statements are consumed */
+        writebuf = trx_process_reply(router_cli_ses, bref, writebuf, &trx_complete);
+    }
+
+    /** The replies to the reads are followed so that the slaves can be released after them */
+    bool mux_tracked = bref->bref_mux_replies > 0 && !trx_tracked && !sescmd_reply;
+    bool mux_complete = false;
+
+    if (mux_tracked)
+    {
+        /** The end of the reply to a causal read has already been looked for */
+        mux_complete = causal_reply ? !bref->bref_causal_reply : reply_is_complete(bref, writebuf);
+
+        if (mux_complete)
+        {
+            bref->bref_mux_replies--;
+        }
+    }
+
+    if (sescmd_reply)
     {
         check_session_command_reply(writebuf, scur, bref);
 
@@ -746,19 +1077,64 @@ static void clientReply(MXS_ROUTER *instance,
      */
     else if (BREF_IS_QUERY_ACTIVE(bref))
     {
-        bref_clear_state(bref, BREF_QUERY_ACTIVE);
-        /** Set response status as replied */
-        bref_clear_state(bref, BREF_WAITING_RESULT);
+        if (writebuf && bref == router_cli_ses->rses_master_ref &&
+            router_cli_ses->rses_config.causal_reads)
+        {
+            update_causal_gtid(router_cli_ses, writebuf);
+        }
+
+        if (bref->bref_reply_count > 0)
+        {
+            /** Replies to pipelined queries are active until the last one ends */
+            bool complete = trx_tracked ? trx_complete :
+                            mux_tracked ? mux_complete : reply_is_complete(bref, writebuf);
+
+            if (complete)
+            {
+                bref->bref_reply_count--;
+            }
+
+            reply_pending = bref->bref_reply_count > 0;
+        }
+
+        if (!reply_pending)
+        {
+            if (bref->bref_query_start)
+            {
+                update_response_time(bref);
+            }
+
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            /** Set response status as replied */
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
     }
 
     if (writebuf != NULL && client_dcb != NULL)
     {
+        ps_store_reply(router_cli_ses, bref, writebuf);
+
+        if (router_cli_ses->rses_coalesce)
+        {
+            /** The sessions that sent the same read get the same reply */
+            coalesce_process_reply(router_cli_ses, bref, writebuf);
+        }
+
         /** Write reply to client DCB */
         MXS_SESSION_ROUTE_REPLY(backend_dcb->session, writebuf);
     }
 
+    if (reply_pending)
+    {
+        /** Nothing else can be sent before the pipelined queries have been answered */
+    }
+    else if (router_cli_ses->rses_config.async_sescmd && sescmd_cursor_is_active(scur) &&
+             (scur->scmd_cur_sent > 0 || BREF_IS_QUERY_ACTIVE(bref)))
+    {
+        /** The replies to the commands in flight must arrive before the next one is sent */
+    }
     /** There is one pending session command to be executed. */
-    if (sescmd_cursor_is_active(scur))
+    else if (sescmd_cursor_is_active(scur))
     {
         bool succp;
 
@@ -784,6 +1160,7 @@ static void clientReply(MXS_ROUTER *instance,
         {
             ROUTER_INSTANCE* inst = (ROUTER_INSTANCE *)instance;
             atomic_add_uint64(&inst->stats.n_queries, 1);
+            count_pipelined_queries(router_cli_ses, bref, bref->bref_pending_cmd);
             /**
              * Add one query response waiter to backend reference
              */
@@ -807,6 +1184,23 @@ static void clientReply(MXS_ROUTER *instance,
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
     }
+
+    if (router_cli_ses->rses_trx.replaying)
+    {
+        /** Send the next statement of the transaction to the new master */
+        trx_replay_continue(router_cli_ses);
+    }
+    else if (mux_complete && bref->bref_mux_replies == 0)
+    {
+        /** The session is idle if the other slaves have nothing going on */
+        release_idle_slaves(router_cli_ses);
+    }
+
+    if (router_cli_ses->rses_admission.queue && !reply_pending)
+    {
+        /** The backend that replied may now have room for the next statement */
+        admission_route_queued(router_cli_ses);
+    }
 }
 
 
@@ -821,7 +1215,71 @@ static void clientReply(MXS_ROUTER *instance,
  */
 static uint64_t getCapabilities(MXS_ROUTER* instance)
 {
-    return RCAP_TYPE_STMT_INPUT | RCAP_TYPE_TRANSACTION_TRACKING;
+    ROUTER_INSTANCE *inst = (ROUTER_INSTANCE *)instance;
+    uint64_t rval = RCAP_TYPE_STMT_INPUT | RCAP_TYPE_TRANSACTION_TRACKING | RCAP_TYPE_PACKET_STREAMING;
+
+    if (inst && (inst->rwsplit_config.pipelining || inst->rwsplit_config.hedged_reads ||
+                 inst->rwsplit_config.query_coalescing))
+    {
+        /** The replies to pipelined, hedged and coalesced queries are followed one packet at a time */
+        rval |= RCAP_TYPE_STMT_OUTPUT;
+    }
+
+    if (inst && inst->rwsplit_config.causal_reads)
+    {
+        /** The GTIDs are read from the OK packets and the result of waiting
+         * for a GTID is removed from the start of the reply */
+        rval |= RCAP_TYPE_CONTIGUOUS_OUTPUT | RCAP_TYPE_SESSION_STATE_TRACKING;
+    }
+
+    if (inst && inst->rwsplit_config.transaction_replay)
+    {
+        /** The replies of the master are checksummed one packet at a time */
+        rval |= RCAP_TYPE_CONTIGUOUS_OUTPUT;
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check whether a session can be moved to another thread
+ *
+ * The replies to the queries of the session must have arrived, as the
+ * shared reads and the timers of the session belong to its thread.
+ *
+ * @param instance       The router instance
+ * @param router_session The router session
+ * @return True if the session waits for no replies and has no timers
+ */
+static bool isIdle(MXS_ROUTER *instance, MXS_ROUTER_SESSION *router_session)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES *)router_session;
+
+    if (rses == NULL || rses->rses_closed || rses->rses_load_active || rses->rses_large_query ||
+        rses->rses_corked_dcb || rses->rses_ps_pending_active || rses->rses_coalesce ||
+        rses->rses_coalesce_wait || rses->rses_trx.replaying || rses->rses_trx.timer.session ||
+        rses->rses_hedge.query || rses->rses_hedge.timer.session ||
+        rses->rses_admission.queue || rses->rses_admission.timer.session)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) &&
+            (BREF_IS_QUERY_ACTIVE(bref) || BREF_IS_WAITING_RESULT(bref) ||
+             bref->bref_reply_count > 0 ||
+             bref->bref_pending_cmd || bref->bref_causal_query ||
+             bref->bref_hedge_discard != HEDGE_DISCARD_NONE ||
+             sescmd_cursor_is_active(&bref->bref_sescmd_cur)))
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 /*
@@ -854,7 +1312,6 @@ void bref_clear_state(backend_ref_t *bref, bref_state_t state)
     if ((state & BREF_WAITING_RESULT) && (bref->bref_state & BREF_WAITING_RESULT))
     {
         int prev1;
-        int prev2;
 
         /** Decrease waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, -1);
@@ -866,9 +1323,13 @@ void bref_clear_state(backend_ref_t *bref, bref_state_t state)
         else
         {
             /** Decrease global operation count */
-            prev2 = atomic_add(&bref->ref->server->stats.n_current_ops, -1);
-            ss_dassert(prev2 > 0);
-            if (prev2 <= 0)
+            ts_stats_add(bref->ref->server->stats.n_current_ops, -1);
+            /**
+             * The values of the threads are not read at one instant, so the
+             * sum can be briefly off when sessions move between threads.
+             */
+            int64_t ops = ts_stats_sum(bref->ref->server->stats.n_current_ops);
+            if (ops < 0)
             {
                 MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
                           __FUNCTION__, bref->ref->server->name,
@@ -903,7 +1364,6 @@ void bref_set_state(backend_ref_t *bref, bref_state_t state)
     if ((state & BREF_WAITING_RESULT) && (bref->bref_state & BREF_WAITING_RESULT) == 0)
     {
         int prev1;
-        int prev2;
 
         /** Increase waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, 1);
@@ -915,13 +1375,13 @@ void bref_set_state(backend_ref_t *bref, bref_state_t state)
                       bref->ref->server->name, bref->ref->server->port);
         }
         /** Increase global operation count */
-        prev2 = atomic_add(&bref->ref->server->stats.n_current_ops, 1);
-        ss_dassert(prev2 >= 0);
-        if (prev2 < 0)
+        int64_t ops = ts_stats_sum(bref->ref->server->stats.n_current_ops);
+        if (ops < 0)
         {
             MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
                       __FUNCTION__, bref->ref->server->name, bref->ref->server->port);
         }
+        ts_stats_add(bref->ref->server->stats.n_current_ops, 1);
     }
 
     bref->bref_state |= state;
@@ -943,16 +1403,19 @@ void rses_property_done(rses_property_t *prop)
     }
     CHK_RSES_PROP(prop);
 
+    if (prop->rses_prop_rsession)
+    {
+        ROUTER_CLIENT_SES *rses = prop->rses_prop_rsession;
+        rses->rses_mem_bytes -= prop->rses_prop_bytes;
+        ts_stats_add(rses->router->stats.session_bytes, -(int64_t)prop->rses_prop_bytes);
+    }
+
     switch (prop->rses_prop_type)
     {
     case RSES_PROP_TYPE_SESCMD:
         mysql_sescmd_done(&prop->rses_prop_data.sescmd);
         break;
 
-    case RSES_PROP_TYPE_TMPTABLES:
-        hashtable_free(prop->rses_prop_data.temp_tables);
-        break;
-
     default:
         MXS_DEBUG("%lu [rses_property_done] Unknown property type %d "
                   "in property %p", pthread_self(), prop->rses_prop_type, prop);
@@ -963,6 +1426,68 @@ void rses_property_done(rses_property_t *prop)
     MXS_FREE(prop);
 }
 
+/**
+ * @brief Initialize a session timer
+ *
+ * @param timer The timer
+ * @param cb    Called when the timer expires, with the router session as the data
+ * @param rses  Router session
+ */
+void rwsplit_session_timer_init(rwsplit_session_timer_t *timer, mxs_timer_cb_t cb,
+                                ROUTER_CLIENT_SES *rses)
+{
+    mxs_timer_init(&timer->timer, cb, rses);
+    timer->session = NULL;
+    timer->thread = 0;
+}
+
+/**
+ * @brief Arm a session timer unless it is already armed
+ *
+ * @param rses  Router session
+ * @param timer The timer
+ * @param ticks When the timer expires, in heartbeats
+ */
+void rwsplit_session_timer_arm(ROUTER_CLIENT_SES *rses, rwsplit_session_timer_t *timer, int64_t ticks)
+{
+    if (timer->session == NULL)
+    {
+        timer->session = session_get_ref(rses->client_dcb->session);
+        timer->thread = rses->client_dcb->thread.id;
+        mxs_timer_add_to(timer->thread, &timer->timer, ticks);
+    }
+}
+
+/**
+ * @brief Handle the expiry of a session timer
+ *
+ * This is called first by the callback of the timer. If the router session is
+ * open and it was moved to another thread or @c wait is true, the timer is
+ * armed again on the thread of the session. Otherwise the timer is disarmed
+ * and the caller must release the returned reference with session_put_ref()
+ * once it is done with the router session.
+ *
+ * @param rses  Router session
+ * @param timer The timer
+ * @param wait  Whether the timer must wait for longer
+ * @param ticks How much longer the timer waits if it is armed again
+ * @return The session reference the timer held or NULL if it was armed again
+ */
+MXS_SESSION* rwsplit_session_timer_fire(ROUTER_CLIENT_SES *rses, rwsplit_session_timer_t *timer,
+                                        bool wait, int64_t ticks)
+{
+    if (!rses->rses_closed && (wait || rses->client_dcb->thread.id != timer->thread))
+    {
+        timer->thread = rses->client_dcb->thread.id;
+        mxs_timer_add_to(timer->thread, &timer->timer, ticks);
+        return NULL;
+    }
+
+    MXS_SESSION *session = timer->session;
+    timer->session = NULL;
+    return session;
+}
+
 /**
  * @brief Get count of backend servers that are slaves.
  *
@@ -1155,14 +1680,15 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
                 c = GET_SELECT_CRITERIA(value);
                 ss_dassert(c == LEAST_GLOBAL_CONNECTIONS ||
                            c == LEAST_ROUTER_CONNECTIONS || c == LEAST_BEHIND_MASTER ||
-                           c == LEAST_CURRENT_OPERATIONS || c == UNDEFINED_CRITERIA);
+                           c == LEAST_CURRENT_OPERATIONS || c == ADAPTIVE_ROUTING ||
+                           c == UNDEFINED_CRITERIA);
 
                 if (c == UNDEFINED_CRITERIA)
                 {
                     MXS_ERROR("Unknown slave selection criteria \"%s\". "
                               "Allowed values are LEAST_GLOBAL_CONNECTIONS, "
-                              "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER,"
-                              "and LEAST_CURRENT_OPERATIONS.",
+                              "LEAST_ROUTER_CONNECTIONS, LEAST_BEHIND_MASTER, "
+                              "LEAST_CURRENT_OPERATIONS and ADAPTIVE_ROUTING.",
                               STRCRITERIA(router->rwsplit_config.slave_selection_criteria));
                     success = false;
                 }
@@ -1179,6 +1705,14 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             {
                 router->rwsplit_config.disable_sescmd_history = config_truth_value(value);
             }
+            else if (strcmp(options[i], "compact_sescmd_history") == 0)
+            {
+                router->rwsplit_config.compact_sescmd_history = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "async_sescmd") == 0)
+            {
+                router->rwsplit_config.async_sescmd = config_truth_value(value);
+            }
             else if (strcmp(options[i], "master_accept_reads") == 0)
             {
                 router->rwsplit_config.master_accept_reads = config_truth_value(value);
@@ -1187,6 +1721,62 @@ static bool rwsplit_process_router_options(ROUTER_INSTANCE *router,
             {
                 router->rwsplit_config.strict_multi_stmt = config_truth_value(value);
             }
+            else if (strcmp(options[i], "pipelining") == 0)
+            {
+                router->rwsplit_config.pipelining = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "lazy_connect") == 0)
+            {
+                router->rwsplit_config.lazy_connect = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads") == 0)
+            {
+                router->rwsplit_config.causal_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "causal_reads_timeout") == 0)
+            {
+                router->rwsplit_config.causal_reads_timeout = atoi(value);
+            }
+            else if (strcmp(options[i], "route_memo") == 0)
+            {
+                router->rwsplit_config.route_memo = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "transaction_replay") == 0)
+            {
+                router->rwsplit_config.transaction_replay = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "transaction_replay_max_size") == 0)
+            {
+                router->rwsplit_config.transaction_replay_max_size = strtoull(value, NULL, 10);
+            }
+            else if (strcmp(options[i], "transaction_replay_timeout") == 0)
+            {
+                router->rwsplit_config.transaction_replay_timeout = atoi(value);
+            }
+            else if (strcmp(options[i], "slave_multiplexing") == 0)
+            {
+                router->rwsplit_config.slave_multiplexing = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "hedged_reads") == 0)
+            {
+                router->rwsplit_config.hedged_reads = config_truth_value(value);
+            }
+            else if (strcmp(options[i], "hedged_read_delay") == 0)
+            {
+                router->rwsplit_config.hedged_read_delay = atoi(value);
+            }
+            else if (strcmp(options[i], "max_backend_operations") == 0)
+            {
+                router->rwsplit_config.max_backend_operations = atoi(value);
+            }
+            else if (strcmp(options[i], "queued_query_timeout") == 0)
+            {
+                router->rwsplit_config.queued_query_timeout = atoi(value);
+            }
+            else if (strcmp(options[i], "query_coalescing") == 0)
+            {
+                router->rwsplit_config.query_coalescing = config_truth_value(value);
+            }
             else if (strcmp(options[i], "retry_failed_reads") == 0)
             {
                 router->rwsplit_config.retry_failed_reads = config_truth_value(value);
@@ -1301,9 +1891,16 @@ static void handleError(MXS_ROUTER *instance,
                 {
                     SERVER *srv = rses->rses_master_ref->ref->server;
                     bool can_continue = false;
+                    bool replay = bref != NULL && trx_can_replay(rses);
 
-                    if (rses->rses_config.master_failure_mode != RW_FAIL_INSTANTLY &&
-                        (bref == NULL || !BREF_IS_WAITING_RESULT(bref)))
+                    if (replay)
+                    {
+                        /** The open transaction is replayed on the new master and
+                         * the client gets the replies it is waiting for from it */
+                        can_continue = true;
+                    }
+                    else if (rses->rses_config.master_failure_mode != RW_FAIL_INSTANTLY &&
+                             (bref == NULL || !BREF_IS_WAITING_RESULT(bref)))
                     {
                         /** The failure of a master is not considered a critical
                          * failure as partial functionality still remains. Reads
@@ -1333,6 +1930,11 @@ static void handleError(MXS_ROUTER *instance,
                         dcb_close(problem_dcb);
                         RW_CLOSE_BREF(bref);
                         close_failed_bref(bref, true);
+
+                        if (replay)
+                        {
+                            trx_start_replay(rses);
+                        }
                     }
                     else
                     {
@@ -1537,9 +2139,10 @@ static bool handle_error_new_connection(ROUTER_INSTANCE *inst,
     /**
      * If query was sent through the bref and it is waiting for reply from
      * the backend server it is necessary to send an error to the client
-     * because it is waiting for reply.
+     * because it is waiting for reply. A hedged read is not failed as long
+     * as the other slave can still reply to it.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    if (!hedge_handle_failure(myrses, bref) && BREF_IS_WAITING_RESULT(bref))
     {
         GWBUF *stored;
         const SERVER *target;
@@ -1659,6 +2262,22 @@ static void free_rwsplit_instance(ROUTER_INSTANCE *router)
 {
     if (router)
     {
+        ts_stats_free(router->stats.n_routed);
+        ts_stats_free(router->stats.n_memo_hits);
+        ts_stats_free(router->stats.classify_ns);
+        ts_stats_free(router->stats.route_ns);
+        ts_stats_free(router->stats.select_ns);
+        ts_stats_free(router->stats.n_trx_replays);
+        ts_stats_free(router->stats.n_trx_replay_failures);
+        ts_stats_free(router->stats.trx_replay_us);
+        ts_stats_free(router->stats.n_slave_releases);
+        ts_stats_free(router->stats.n_hedged_reads);
+        ts_stats_free(router->stats.n_hedge_wins);
+        ts_stats_free(router->stats.n_queued_stmts);
+        ts_stats_free(router->stats.n_queue_timeouts);
+        ts_stats_free(router->stats.queue_wait_us);
+        ts_stats_free(router->stats.n_coalesced);
+        ts_stats_free(router->stats.session_bytes);
         MXS_FREE(router);
     }
 }
@@ -1666,27 +2285,19 @@ static void free_rwsplit_instance(ROUTER_INSTANCE *router)
 /**
  * @brief Create backend server references
  *
- * This creates a new set of backend references for the client session. Currently
- * this is only used on startup but it could be used to dynamically change the
- * set of used servers.
+ * This initializes the backend references that are allocated with the client
+ * session.
  *
  * @param rses Client router session
- * @param dest Destination where the array of backens is stored
- * @param n_backend Number of items in the array
- * @return True on success, false on error
+ * @param n_backend Number of references allocated with the session
+ * @return Number of references that were initialized
  */
-static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int* n_backend)
+static int create_backends(ROUTER_CLIENT_SES *rses, int n_backend)
 {
-    backend_ref_t *backend_ref = (backend_ref_t *)MXS_CALLOC(1, *n_backend * sizeof(backend_ref_t));
-
-    if (backend_ref == NULL)
-    {
-        return false;
-    }
-
+    backend_ref_t *backend_ref = rses->rses_backends;
     int i = 0;
 
-    for (SERVER_REF *sref = rses->router->service->dbref; sref && i < *n_backend; sref = sref->next)
+    for (SERVER_REF *sref = rses->router->service->dbref; sref && i < n_backend; sref = sref->next)
     {
         if (sref->active)
         {
@@ -1701,6 +2312,7 @@ static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int*
             /** store pointers to sescmd list to both cursors */
             backend_ref[i].bref_sescmd_cur.scmd_cur_rses = rses;
             backend_ref[i].bref_sescmd_cur.scmd_cur_active = false;
+            backend_ref[i].bref_sescmd_cur.scmd_cur_sent = 0;
             backend_ref[i].bref_sescmd_cur.scmd_cur_ptr_property =
                 &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
             backend_ref[i].bref_sescmd_cur.scmd_cur_cmd = NULL;
@@ -1708,12 +2320,154 @@ static bool create_backends(ROUTER_CLIENT_SES *rses, backend_ref_t** dest, int*
         }
     }
 
-    if (i < *n_backend)
+    if (i < n_backend)
     {
-        MXS_INFO("The service reported %d servers but only took %d into use.", *n_backend, i);
-        *n_backend = i;
+        MXS_INFO("The service reported %d servers but only took %d into use.", n_backend, i);
     }
 
-    *dest = backend_ref;
-    return true;
+    return i;
+}
+
+/**
+ * @brief Update the average response time of a server
+ *
+ * The average is an exponentially weighted moving average that the
+ * ADAPTIVE_ROUTING slave selection criteria uses. The sessions update it
+ * without locking, as a lost update only delays the average a little.
+ *
+ * @param bref Backend reference whose query was completed
+ */
+static void update_response_time(backend_ref_t *bref)
+{
+    uint64_t elapsed = rwsplit_clock_us() - bref->bref_query_start;
+    int sample = elapsed < INT_MAX ? (int)elapsed : INT_MAX;
+    int average = bref->ref->response_time;
+
+    bref->bref_query_start = 0;
+
+    if (average == 0)
+    {
+        bref->ref->response_time = sample > 0 ? sample : 1;
+    }
+    else
+    {
+        bref->ref->response_time = (int)(((int64_t)average * RESPONSE_TIME_HISTORY_WEIGHT + sample) /
+                                         (RESPONSE_TIME_HISTORY_WEIGHT + 1));
+    }
+}
+
+/**
+ * @brief Store the GTID of a write
+ *
+ * The master reports the GTID of a write in the OK packet when the variable
+ * last_gtid is listed in its session_track_system_variables.
+ *
+ * @param rses   Router session
+ * @param packet A reply packet from the master
+ */
+static void update_causal_gtid(ROUTER_CLIENT_SES *rses, GWBUF *packet)
+{
+    if (GWBUF_IS_CONTIGUOUS(packet) && GWBUF_LENGTH(packet) > MYSQL_HEADER_LEN &&
+        MYSQL_GET_COMMAND(GWBUF_DATA(packet)) == MYSQL_REPLY_OK)
+    {
+        char *gtid = mxs_mysql_get_tracked_variable(GWBUF_DATA(packet), GWBUF_LENGTH(packet),
+                                                    "last_gtid");
+
+        /** The GTID is quoted in the queries, so it must look like one */
+        if (gtid && *gtid && gtid[strspn(gtid, "0123456789-,")] == '\0')
+        {
+            MXS_FREE(rses->rses_causal_gtid);
+            rses->rses_causal_gtid = gtid;
+        }
+        else
+        {
+            MXS_FREE(gtid);
+        }
+    }
+}
+
+/**
+ * @brief Handle the reply to a causal read
+ *
+ * The reply to a causal read starts with the result of waiting for the slave
+ * to reach the GTID of the last write. If the wait succeeded, the result is
+ * discarded and the sequence numbers of the rest of the reply are corrected
+ * to what the client expects. If the wait timed out, the server skips the
+ * read and the read is sent to the master.
+ *
+ * @param inst   Router instance
+ * @param rses   Router session
+ * @param bref   The slave of the causal read
+ * @param packet A complete packet of the reply
+ *
+ * @return The packet if it is a part of the reply, NULL if it was consumed
+ */
+static GWBUF *handle_causal_read_reply(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
+                                       backend_ref_t *bref, GWBUF *packet)
+{
+    uint8_t *data = GWBUF_DATA(packet);
+
+    if (bref->bref_causal_reply)
+    {
+        data[3]--;
+
+        if (reply_is_complete(bref, packet))
+        {
+            bref->bref_causal_reply = false;
+        }
+
+        return packet;
+    }
+
+    GWBUF *query = bref->bref_causal_query;
+    bref->bref_causal_query = NULL;
+
+    if (MYSQL_GET_COMMAND(data) == MYSQL_REPLY_OK)
+    {
+        bref->bref_reply_state = MYSQL_REPLY_STATE_START;
+        bref->bref_causal_reply = true;
+        gwbuf_free(query);
+        gwbuf_free(packet);
+        return NULL;
+    }
+    else if (MYSQL_GET_COMMAND(data) != MYSQL_REPLY_ERR)
+    {
+        /** Not a reply to the wait, pass it on as it is */
+        gwbuf_free(query);
+        return packet;
+    }
+
+    backend_ref_t *master = rses->rses_master_ref;
+
+    bref_clear_state(bref, BREF_QUERY_ACTIVE);
+    bref_clear_state(bref, BREF_WAITING_RESULT);
+    bref->bref_query_start = 0;
+
+    if (master && BREF_IS_IN_USE(master) &&
+        master->bref_dcb->func.write(master->bref_dcb, gwbuf_clone(query)) == 1)
+    {
+        MXS_INFO("Slave '%s' did not reach GTID '%s' in time, retrying the read on the master.",
+                 bref->ref->server->unique_name, rses->rses_causal_gtid);
+
+        if (bref->bref_mux_replies > 0)
+        {
+            /** The slave no longer waits for the reply to the read */
+            bref->bref_mux_replies--;
+        }
+
+        atomic_add_uint64(&inst->stats.n_master, 1);
+        bref_set_state(master, BREF_QUERY_ACTIVE);
+        bref_set_state(master, BREF_WAITING_RESULT);
+        count_pipelined_queries(rses, master, query);
+        gwbuf_free(query);
+        gwbuf_free(packet);
+        return NULL;
+    }
+
+    /** Without a master, the error of the wait is the reply to the read */
+    gwbuf_free(query);
+    MXS_ERROR("Slave '%s' did not reach GTID '%s' in time and the read could "
+              "not be retried on the master.", bref->ref->server->unique_name,
+              rses->rses_causal_gtid);
+    return packet;
 }
@@ -32,9 +32,13 @@
 #include <math.h>
 
 #include <maxscale/dcb.h>
+#include <maxscale/digest.h>
 #include <maxscale/hashtable.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/query_classifier.h>
 #include <maxscale/router.h>
 #include <maxscale/service.h>
+#include <maxscale/timer.h>
 
 MXS_BEGIN_DECLS
 
@@ -89,8 +93,7 @@ typedef enum rses_property_type_t
     RSES_PROP_TYPE_UNDEFINED = -1,
     RSES_PROP_TYPE_SESCMD    = 0,
     RSES_PROP_TYPE_FIRST     = RSES_PROP_TYPE_SESCMD,
-    RSES_PROP_TYPE_TMPTABLES,
-    RSES_PROP_TYPE_LAST      = RSES_PROP_TYPE_TMPTABLES,
+    RSES_PROP_TYPE_LAST      = RSES_PROP_TYPE_SESCMD,
     RSES_PROP_TYPE_COUNT     = RSES_PROP_TYPE_LAST + 1
 } rses_property_type_t;
 
@@ -106,8 +109,9 @@ typedef enum select_criteria
     LEAST_ROUTER_CONNECTIONS,   /*< connections established by this router */
     LEAST_BEHIND_MASTER,
     LEAST_CURRENT_OPERATIONS,
+    ADAPTIVE_ROUTING,           /*< lowest expected response time */
     DEFAULT_CRITERIA   = LEAST_CURRENT_OPERATIONS,
-    LAST_CRITERIA               /*< not used except for an index */
+    LAST_CRITERIA      = ADAPTIVE_ROUTING + 1 /*< not used except for an index */
 } select_criteria_t;
 
 static inline const char* select_criteria_to_str(select_criteria_t type)
@@ -126,6 +130,9 @@ static inline const char* select_criteria_to_str(select_criteria_t type)
     case LEAST_CURRENT_OPERATIONS:
         return "LEAST_CURRENT_OPERATIONS";
 
+    case ADAPTIVE_ROUTING:
+        return "ADAPTIVE_ROUTING";
+
     default:
         return "UNDEFINED_CRITERIA";
     }
@@ -173,7 +180,36 @@ static inline const char* failure_mode_to_str(enum failure_mode type)
         strncmp(s,"LEAST_ROUTER_CONNECTIONS", strlen("LEAST_ROUTER_CONNECTIONS")) == 0 ?        \
         LEAST_ROUTER_CONNECTIONS : (                                                            \
         strncmp(s,"LEAST_CURRENT_OPERATIONS", strlen("LEAST_CURRENT_OPERATIONS")) == 0 ?        \
-        LEAST_CURRENT_OPERATIONS : UNDEFINED_CRITERIA))))
+        LEAST_CURRENT_OPERATIONS : (                                                            \
+        strncmp(s,"ADAPTIVE_ROUTING", strlen("ADAPTIVE_ROUTING")) == 0 ?                        \
+        ADAPTIVE_ROUTING : UNDEFINED_CRITERIA)))))
+
+/**
+ * The weight of the previous average when the average response time of a
+ * server is updated. With 7, a new measurement moves the average by 1/8 of
+ * the difference.
+ */
+#define RESPONSE_TIME_HISTORY_WEIGHT 7
+
+/**
+ * The statement that a causal read is prefixed with. The subquery fails
+ * if the slave does not reach the GTID before the timeout in seconds.
+ */
+#define CAUSAL_READ_PREFIX "SET @maxscale_secret_variable=(SELECT CASE WHEN " \
+    "MASTER_GTID_WAIT('%s', %d) = 0 THEN 1 ELSE (SELECT 1 FROM INFORMATION_SCHEMA.ENGINES) END);"
+
+/**
+ * What a session command does to the state of the session. The history
+ * is compacted by removing the commands whose effect a later command
+ * has replaced.
+ */
+typedef enum sescmd_kind
+{
+    SESCMD_KIND_OTHER,      /*< Anything else, may depend on the state */
+    SESCMD_KIND_STATE,      /*< Sets a variable or the default database to a constant */
+    SESCMD_KIND_PREPARE,    /*< Prepares a statement */
+    SESCMD_KIND_DEALLOCATE  /*< Deallocates a text protocol prepared statement */
+} sescmd_kind_t;
 
 /**
  * Session variable command
@@ -191,11 +227,179 @@ typedef struct mysql_sescmd_st
                                    *  LOCAL_INFILE. Slave servers are compared to this
                                    *  when they return session command replies.*/
     int      position; /*< Position of this command */
+    sescmd_kind_t      kind; /*< What the command does to the session state */
+    char*              key;  /*< The variable, database or statement the command
+                              *  is about, NULL if there is no name */
+    uint32_t           ps_id; /*< The ID the client got for a COM_STMT_PREPARE */
+    bool               ps_closed; /*< Whether the client has closed the statement */
 #if defined(SS_DEBUG)
     skygw_chk_t        my_sescmd_chk_tail;
 #endif
 } mysql_sescmd_t;
 
+/** The number of routing decisions a session remembers, a power of two */
+#define RWSPLIT_ROUTE_MEMO_SIZE 32
+
+/**
+ * A remembered routing decision. The decision is reused for the statements
+ * with the same digest while the routing state of the session is the same.
+ */
+typedef struct rwsplit_route_memo
+{
+    MXS_DIGEST      digest; /*< Digest of the statement */
+    uint32_t        state;  /*< Routing state of the session, 0 if the entry is unused */
+    uint32_t        qtype;  /*< The type of the statement */
+    route_target_t  target; /*< Where the statement was routed */
+} rwsplit_route_memo_t;
+
+/**
+ * A timer of a router session. While the timer is armed, it holds a reference
+ * to the session so that the router session is not freed before the timer
+ * expires. If the session is moved to another thread, the timer follows it.
+ */
+typedef struct rwsplit_session_timer
+{
+    MXS_TIMER           timer;
+    MXS_SESSION*        session; /*< Session reference held while the timer is armed */
+    int                 thread;  /*< The thread of the timer */
+} rwsplit_session_timer_t;
+
+/**
+ * A statement of an open transaction and the checksum of its reply
+ */
+typedef struct rwsplit_trx_stmt
+{
+    GWBUF*                   stmt;     /*< The statement */
+    MXS_DIGEST               checksum; /*< Checksum of the reply */
+    bool                     replied;  /*< Whether the reply is complete */
+    struct rwsplit_trx_stmt* next;     /*< The next statement */
+} rwsplit_trx_stmt_t;
+
+/**
+ * The statements of the open transaction of a session. When the master fails,
+ * they are replayed on the new master and the checksums of the replies are
+ * compared to the ones the client got.
+ */
+typedef struct rwsplit_trx
+{
+    rwsplit_trx_stmt_t* stmts;       /*< The statements of the transaction */
+    rwsplit_trx_stmt_t* last;        /*< The last statement */
+    rwsplit_trx_stmt_t* reply;       /*< The statement whose reply is being read */
+    size_t              size;        /*< Total size of the statements */
+    bool                replayable;  /*< Whether the transaction can be replayed */
+    int                 reply_packets; /*< Packets of the reply sent to the client */
+    MXS_DIGEST          reply_sum;   /*< Checksum of the reply so far */
+    bool                replaying;   /*< The transaction is being replayed */
+    bool                replay_sent; /*< A replayed statement waits for its reply */
+    uint64_t            replay_start; /*< When the master failed, in microseconds */
+    int64_t             replay_deadline; /*< Heartbeat when the new master is no longer waited for */
+    rwsplit_trx_stmt_t* queue;       /*< Statements the client sent during the replay */
+    rwsplit_trx_stmt_t* queue_last;  /*< The last queued statement */
+    rwsplit_session_timer_t timer;   /*< Checks for a new master */
+} rwsplit_trx_t;
+
+/**
+ * How the reply of a slave to a hedged read is discarded
+ */
+typedef enum hedge_discard
+{
+    HEDGE_DISCARD_NONE, /*< The reply is not discarded */
+    HEDGE_DISCARD_READ, /*< The slave got the read, the client got the reply of the copy */
+    HEDGE_DISCARD_COPY  /*< The slave got the copy, the client got the reply to the read */
+} hedge_discard_t;
+
+/**
+ * A read that is also sent to a second slave if the first one is slow to reply
+ */
+typedef struct rwsplit_hedge
+{
+    GWBUF*              query;      /*< The read, NULL if no reply is waited for */
+    struct backend_ref_st* primary; /*< The slave the read was routed to */
+    struct backend_ref_st* secondary; /*< The slave the copy is sent to */
+    bool                sent;       /*< Whether the copy has been sent */
+    int64_t             send_at;    /*< Heartbeat when the copy is sent */
+    rwsplit_session_timer_t timer;  /*< Sends the copy after the delay */
+} rwsplit_hedge_t;
+
+/**
+ * A statement that waits for a backend to have room for it or, with query_coalescing,
+ * for the reply to a read of another session
+ */
+typedef struct rwsplit_queued_stmt
+{
+    GWBUF*                      stmt;      /*< The statement */
+    session_priority_t          priority;  /*< The priority class of the statement */
+    uint64_t                    queued_at; /*< When the statement was queued, in microseconds */
+    int64_t                     deadline;  /*< Heartbeat when the statement is no longer waited for */
+    struct rwsplit_queued_stmt* next;      /*< The next statement */
+} rwsplit_queued_stmt_t;
+
+/**
+ * The statements of a session that wait for a backend to execute fewer than
+ * max_backend_operations queries. They are routed in the order they arrived.
+ */
+typedef struct rwsplit_admission
+{
+    rwsplit_queued_stmt_t* queue;      /*< The first waiting statement */
+    rwsplit_queued_stmt_t* queue_last; /*< The last waiting statement */
+    rwsplit_session_timer_t timer;    /*< Checks the backends again */
+} rwsplit_admission_t;
+
+/**
+ * A session that waits for the reply to a read that another session executes
+ */
+typedef struct rwsplit_coalesce_follower
+{
+    struct router_client_session*     rses;    /*< The router session */
+    MXS_SESSION*                      session; /*< Reference to the session */
+    GWBUF*                            query;   /*< Its read, routed if the other session fails */
+    struct rwsplit_coalesce_follower* next;    /*< The next session */
+} rwsplit_coalesce_follower_t;
+
+/**
+ * A read that a session executes and whose reply also goes to the sessions
+ * of the same thread that sent the same read in the same state meanwhile
+ */
+typedef struct rwsplit_coalesce
+{
+    struct router_instance*       router;    /*< The router of the sessions */
+    struct router_client_session* leader;    /*< The session that executes the read */
+    struct backend_ref_st*        bref;      /*< The slave that executes it */
+    GWBUF*                        query;     /*< The read */
+    uint64_t                      hash;      /*< Hash of the read */
+    MXS_DIGEST                    sescmd_sum; /*< Checksum of the session commands of the sessions */
+    uint32_t                      capabilities; /*< Client capabilities of the sessions */
+    uint32_t                      extra_capabilities; /*< MariaDB capabilities of the sessions */
+    unsigned int                  charset;   /*< Character set of the sessions */
+    char                          user[MYSQL_USER_MAXLEN + 1]; /*< User of the sessions */
+    char                          host[INET6_ADDRSTRLEN + 1]; /*< Client host of the sessions */
+    char                          db[MYSQL_DATABASE_MAXLEN + 1]; /*< Default database of the sessions */
+    mysql_reply_state_t           reply_state; /*< State of the reply */
+    int                           reply_packets; /*< Packets of the reply forwarded so far */
+    rwsplit_coalesce_follower_t*  followers; /*< The sessions waiting for the reply */
+    struct rwsplit_coalesce*      next;      /*< The next read of the thread */
+} rwsplit_coalesce_t;
+
+/**
+ * A temporary table of a session
+ */
+typedef struct rwsplit_tmp_table
+{
+    char*    name; /*< Name of the table as "database.table", NULL for an empty slot */
+    uint32_t hash; /*< Hash of the name */
+} rwsplit_tmp_table_t;
+
+/**
+ * The temporary tables of a session as an open addressing hash set. The
+ * slots are allocated when the first temporary table is created.
+ */
+typedef struct rwsplit_tmp_tables
+{
+    rwsplit_tmp_table_t* slots;    /*< The slots, a power of two of them */
+    size_t               capacity; /*< Number of slots */
+    size_t               count;    /*< Number of tables */
+} rwsplit_tmp_tables_t;
+
 /**
  * Property structure
  */
@@ -207,11 +411,11 @@ struct rses_property_st
     ROUTER_CLIENT_SES*   rses_prop_rsession; /*< parent router session */
     int                  rses_prop_refcount;
     rses_property_type_t rses_prop_type;
+    size_t               rses_prop_bytes; /*< Memory accounted to the session */
 
     union rses_prop_data
     {
         mysql_sescmd_t   sescmd;
-        HASHTABLE*       temp_tables;
     } rses_prop_data;
     rses_property_t*     rses_prop_next; /*< next property of same type */
 #if defined(SS_DEBUG)
@@ -228,6 +432,7 @@ typedef struct sescmd_cursor_st
     rses_property_t**  scmd_cur_ptr_property; /*< address of pointer to owner property */
     mysql_sescmd_t*    scmd_cur_cmd;          /*< pointer to current session command */
     bool               scmd_cur_active;       /*< true if command is being executed */
+    int                scmd_cur_sent;         /*< Commands from the cursor on that are not replied */
     int                position; /*< Position of this cursor */
 #if defined(SS_DEBUG)
     skygw_chk_t        scmd_cur_chk_tail;
@@ -239,6 +444,15 @@ typedef struct sescmd_cursor_st
  *
  * Owned by router client session.
  */
+/**
+ * The ID that a server gave to a statement prepared by a session command
+ */
+typedef struct rwsplit_ps_map
+{
+    int      position; /*< Position of the COM_STMT_PREPARE in the history */
+    uint32_t id;       /*< ID of the statement on the server */
+} rwsplit_ps_map_t;
+
 typedef struct backend_ref_st
 {
 #if defined(SS_DEBUG)
@@ -252,6 +466,23 @@ typedef struct backend_ref_st
     GWBUF*          bref_pending_cmd; /**< For stmt which can't be routed due active sescmd execution */
     unsigned char   reply_cmd;  /**< The reply the backend server sent to a session command.
                                  * Used to detect slaves that fail to execute session command. */
+    int             bref_reply_count; /**< Replies to queries still expected when pipelining */
+    mysql_reply_state_t bref_reply_state; /**< State of the reply being received when pipelining */
+    uint64_t        bref_query_start; /**< When the active query was sent in microseconds,
+                                       * 0 if its response time is not measured */
+    GWBUF*          bref_causal_query; /**< The query of a causal read, the reply starts with
+                                        * the result of waiting for the GTID */
+    bool            bref_causal_reply; /**< The reply follows the result of waiting for the
+                                        * GTID and its sequence numbers are one too large */
+    int             bref_mux_replies; /**< Replies to reads still expected before the slave
+                                       * can be released, -1 if it can't be released */
+    hedge_discard_t bref_hedge_discard; /**< The reply to a hedged read is discarded */
+    rwsplit_ps_map_t* bref_ps_ids; /**< The IDs of the prepared statements on the server,
+                                    * they differ from the IDs the client has when the
+                                    * server reuses the statements of pooled connections */
+    int             bref_ps_ids_len; /**< Number of entries in bref_ps_ids */
+    int64_t         bref_n_current; /**< Connections to the server, read once per selection */
+    int64_t         bref_n_current_ops; /**< Operations on the server, read once per selection */
 #if defined(SS_DEBUG)
     skygw_chk_t     bref_chk_tail;
 #endif
@@ -269,12 +500,35 @@ typedef struct rwsplit_config_st
                                                 * to master or all nodes */
     int               max_sescmd_history; /**< Maximum amount of session commands to store */
     bool              disable_sescmd_history; /**< Disable session command history */
+    bool              compact_sescmd_history; /**< Remove replaced session commands */
+    bool              async_sescmd; /**< Do not wait for the slaves to reply to session commands */
     bool              master_accept_reads; /**< Use master for reads */
     bool              strict_multi_stmt; /**< Force non-multistatement queries to be routed
                                              * to the master after a multistatement query. */
     enum failure_mode master_failure_mode; /**< Master server failure handling mode.
                                                * @see enum failure_mode */
     bool              retry_failed_reads; /**< Retry failed reads on other servers */
+    bool              pipelining; /**< Send pipelined statements to a server in one write */
+    bool              lazy_connect; /**< Connect to the slaves on the first read */
+    bool              causal_reads; /**< Reads wait for the slaves to reach the last write */
+    bool              route_memo; /**< Remember the routing decisions of the statements */
+    int               causal_reads_timeout; /**< How long a slave is waited for, in seconds */
+    bool              transaction_replay; /**< Replay open transactions on a new master */
+    uint64_t          transaction_replay_max_size; /**< Largest transaction that is replayed */
+    int               transaction_replay_timeout; /**< How long a new master is waited for,
+                                                   * in seconds */
+    bool              slave_multiplexing; /**< Release the slaves of idle sessions to the
+                                           * persistent connection pool */
+    bool              hedged_reads; /**< Send hinted reads to a second slave if the first one
+                                     * is slow to reply */
+    int               hedged_read_delay; /**< How long the first slave is waited for,
+                                          * in milliseconds */
+    int               max_backend_operations; /**< Queries a backend executes before new
+                                               * statements are queued, 0 for no limit */
+    int               queued_query_timeout; /**< How long a queued statement waits, in
+                                             * milliseconds */
+    bool              query_coalescing; /**< Share the replies of identical reads of the
+                                         * sessions of a thread */
 } rwsplit_config_t;
 
 #if defined(PREP_STMT_CACHING)
@@ -299,6 +553,15 @@ typedef struct prep_stmt_st
 
 #endif /*< PREP_STMT_CACHING */
 
+/**
+ * The classification of a prepared statement
+ */
+typedef struct rwsplit_ps_info
+{
+    uint32_t      type; /*< The type mask of the preparable statement */
+    qc_query_op_t op;   /*< The operation of the preparable statement */
+} rwsplit_ps_info_t;
+
 /**
  * The client session structure used within this router.
  */
@@ -310,24 +573,46 @@ struct router_client_session
     bool             rses_closed;    /*< true when closeSession is called */
     rses_property_t* rses_properties[RSES_PROP_TYPE_COUNT]; /*< Properties listed by their type */
     backend_ref_t*   rses_master_ref;
-    backend_ref_t*   rses_backend_ref; /*< Pointer to backend reference array */
+    backend_ref_t*   rses_backend_ref; /*< Points to rses_backends */
     rwsplit_config_t rses_config;    /*< copied config info from router instance */
     int              rses_nbackends;
     int              rses_nsescmd;  /*< Number of executed session commands */
     bool             rses_load_active; /*< If LOAD DATA LOCAL INFILE is being currently executed */
-    bool             have_tmp_tables;
+    backend_ref_t*   rses_large_query; /*< Target of the command that continues in the next packet */
+    rwsplit_tmp_tables_t rses_tmp_tables; /*< The temporary tables of the session */
     uint64_t         rses_load_data_sent; /*< How much data has been sent */
     DCB*             client_dcb;
     int              pos_generator;
     backend_ref_t    *forced_node; /*< Current server where all queries should be sent */
+    DCB              *rses_corked_dcb; /*< Backend collecting pipelined statements */
+    bool             rses_slaves_pending; /*< The slaves are connected on the first read */
+    bool             rses_multiplex; /*< The slaves are released when the session is idle */
+    char*            rses_causal_gtid; /*< GTID of the last write, NULL if there is none */
 #if defined(PREP_STMT_CACHING)
     HASHTABLE*       rses_prep_stmt[2];
 #endif
+    HASHTABLE*       rses_ps_ids;    /*< Types of COM_STMT_PREPAREd statements by ID */
+    HASHTABLE*       rses_ps_names;  /*< Types of text protocol prepared statements by name */
+    rwsplit_ps_info_t rses_ps_pending; /*< The type of a COM_STMT_PREPARE waiting for its ID */
+    backend_ref_t*   rses_ps_pending_bref; /*< The backend whose reply has the ID, NULL if any */
+    bool             rses_ps_pending_active; /*< Whether rses_ps_pending is waiting for its ID */
+    rwsplit_route_memo_t* rses_route_memo; /*< Routing decisions by digest, NULL without route_memo */
+    rwsplit_trx_t    rses_trx;       /*< The open transaction for transaction_replay */
+    rwsplit_hedge_t  rses_hedge;     /*< The hedged read waiting for its first reply */
+    rwsplit_admission_t rses_admission; /*< Statements waiting for a backend with room */
+    rwsplit_coalesce_t* rses_coalesce; /*< The read the session executes for others too */
+    bool             rses_coalesce_wait; /*< Waits for the reply to the read of another session */
+    rwsplit_queued_stmt_t* rses_coalesce_queue; /*< Statements sent while the session waits */
+    rwsplit_queued_stmt_t* rses_coalesce_queue_last; /*< The last of them */
+    MXS_DIGEST       rses_sescmd_sum; /*< Checksum of the executed session commands */
     struct router_instance *router;   /*< The router instance */
     struct router_client_session *next;
+    size_t           rses_mem_bytes; /*< Memory used by the session state and its session commands */
 #if defined(SS_DEBUG)
     skygw_chk_t      rses_chk_tail;
 #endif
+    backend_ref_t    rses_backends[]; /*< The backend references, followed by the routing decisions.
+                                       * They are in the same allocation as the session. */
 } ;
 
 /**
@@ -340,6 +625,22 @@ typedef struct
     uint64_t n_master;   /*< Number of stmts sent to master */
     uint64_t n_slave;    /*< Number of stmts sent to slave */
     uint64_t n_all;      /*< Number of stmts sent to all */
+    ts_stats_t n_routed;    /*< Number of stmts whose target was decided */
+    ts_stats_t n_memo_hits; /*< Number of stmts routed with a remembered decision */
+    ts_stats_t classify_ns; /*< Time spent in classifying stmts, in nanoseconds */
+    ts_stats_t route_ns;    /*< Time spent in deciding the targets, in nanoseconds */
+    ts_stats_t select_ns;   /*< Time spent in selecting the backends, in nanoseconds */
+    ts_stats_t n_trx_replays;         /*< Number of replayed transactions */
+    ts_stats_t n_trx_replay_failures; /*< Number of transactions that could not be replayed */
+    ts_stats_t trx_replay_us;         /*< Time spent in replaying transactions, in microseconds */
+    ts_stats_t n_slave_releases;      /*< Number of slave connections released to the pool */
+    ts_stats_t n_hedged_reads;        /*< Number of reads sent to a second slave */
+    ts_stats_t n_hedge_wins;          /*< Number of hedged reads the second slave replied to first */
+    ts_stats_t n_queued_stmts;        /*< Number of stmts that waited for a backend */
+    ts_stats_t n_queue_timeouts;      /*< Number of queued stmts that were not routed in time */
+    ts_stats_t queue_wait_us;         /*< Time the routed stmts waited, in microseconds */
+    ts_stats_t n_coalesced;           /*< Number of reads answered with the reply of another session */
+    ts_stats_t session_bytes;         /*< Memory used by the router sessions, in bytes */
 } ROUTER_STATS;
 
 /**
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <strings.h>
+#include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/modutil.h>
+#include <maxscale/poll.h>
+#include <maxscale/session.h>
+
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_admission.c  Admission control
+ *
+ * With max_backend_operations, a statement is not routed while the backends
+ * it could be routed to already execute that many queries. The statement
+ * waits in the session until one of them has room for it or until
+ * queued_query_timeout milliseconds have passed, in which case the client
+ * gets an error. The waiting statements of a session are routed in the order
+ * they arrived. The statements of open transactions are never queued as the
+ * transactions hold locks that the other statements may be waiting for.
+ *
+ * The number of queries a backend executes is the n_current_ops statistic of
+ * the server, so the limit is shared by all services that use the server.
+ *
+ * The priority class of the session or the priority hint of the statement
+ * decides how full the backends can be: the statements of the high class are
+ * never queued and the statements of the low class are queued when the
+ * backends execute half of max_backend_operations queries.
+ */
+
+/** The name of the hint parameter that sets the priority class of a statement */
+#define PRIORITY_HINT "priority"
+
+/** The error the client gets for a statement that waited for too long, ER_STATEMENT_TIMEOUT */
+#define ADMISSION_TIMEOUT_ERRNO 1969
+
+static void admission_timer_cb(MXS_TIMER *timer, void *data);
+
+/**
+ * @brief Check whether a backend executes as many queries as it is allowed to
+ *
+ * @param bref  The backend
+ * @param limit The number of queries it is allowed to execute
+ * @return True if no more queries should be routed to the backend
+ */
+static inline bool bref_is_saturated(backend_ref_t *bref, int limit)
+{
+    return ts_stats_sum(bref->ref->server->stats.n_current_ops) >= limit;
+}
+
+/**
+ * @brief Check whether a statement must wait for a backend to have room for it
+ *
+ * The backends are looked at first so that the statement only needs to be
+ * classified when some of them are saturated.
+ *
+ * @param rses     Router session
+ * @param querybuf The statement
+ * @param priority The priority class of the statement
+ * @return True if the backends the statement can be routed to are saturated
+ */
+static bool admission_is_saturated(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                                   session_priority_t priority)
+{
+    int limit = rses->rses_config.max_backend_operations;
+
+    if (priority == SESSION_PRIORITY_HIGH)
+    {
+        return false;
+    }
+    else if (priority == SESSION_PRIORITY_LOW)
+    {
+        limit = MXS_MAX(limit / 2, 1);
+    }
+
+    backend_ref_t *master = rses->rses_master_ref;
+    bool master_full = master && BREF_IS_IN_USE(master) && bref_is_saturated(master, limit);
+    bool have_slaves = false;
+    bool slaves_full = true;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (bref != master && BREF_IS_IN_USE(bref))
+        {
+            have_slaves = true;
+
+            if (!bref_is_saturated(bref, limit))
+            {
+                slaves_full = false;
+            }
+        }
+    }
+
+    if (!master_full && (!have_slaves || !slaves_full))
+    {
+        return false;
+    }
+
+    bool non_empty_packet;
+    int packet_type = determine_packet_type(querybuf, &non_empty_packet);
+
+    if (!non_empty_packet)
+    {
+        /** The end of a LOAD DATA LOCAL INFILE */
+        return false;
+    }
+
+    qc_query_type_t qtype = determine_query_type(querybuf, packet_type, non_empty_packet);
+    route_target_t target = get_route_target(rses, qtype, querybuf->hint);
+
+    if (TARGET_IS_ALL(target))
+    {
+        /** Session commands go to all backends, one more query does not make a difference */
+        return false;
+    }
+    else if (TARGET_IS_SLAVE(target))
+    {
+        if (!have_slaves)
+        {
+            /** The slaves are connected on demand or the reads go to the master */
+            return master_full && !rses->rses_slaves_pending && !rses->rses_multiplex;
+        }
+
+        return slaves_full && (master_full || !rses->rses_config.master_accept_reads);
+    }
+
+    return master_full;
+}
+
+/**
+ * @brief Check the backends again after a while
+ *
+ * @param rses Router session
+ */
+static void admission_wait(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_session_timer_arm(rses, &rses->rses_admission.timer, 1);
+}
+
+static void admission_timer_cb(MXS_TIMER *timer, void *data)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES *)data;
+    MXS_SESSION *session = rwsplit_session_timer_fire(rses, &rses->rses_admission.timer, false, 1);
+
+    if (session)
+    {
+        if (!rses->rses_closed)
+        {
+            admission_route_queued(rses);
+        }
+
+        session_put_ref(session);
+    }
+}
+
+/**
+ * @brief Free a list of queued statements
+ *
+ * @param stmt The first statement
+ */
+static void admission_free_stmts(rwsplit_queued_stmt_t *stmt)
+{
+    while (stmt)
+    {
+        rwsplit_queued_stmt_t *next = stmt->next;
+        gwbuf_free(stmt->stmt);
+        MXS_FREE(stmt);
+        stmt = next;
+    }
+}
+
+/**
+ * @brief Remove the first statement from the queue
+ *
+ * @param adm The queue
+ * @return The statement, the caller must free it
+ */
+static rwsplit_queued_stmt_t *admission_pop(rwsplit_admission_t *adm)
+{
+    rwsplit_queued_stmt_t *stmt = adm->queue;
+    adm->queue = stmt->next;
+
+    if (adm->queue == NULL)
+    {
+        adm->queue_last = NULL;
+    }
+
+    stmt->next = NULL;
+    return stmt;
+}
+
+/**
+ * @brief Tell the client that a statement waited for too long
+ *
+ * The parts of the statement that continue in the following packets are
+ * discarded with it.
+ *
+ * @param rses Router session
+ */
+static void admission_timeout(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    admission_free_stmts(admission_pop(adm));
+
+    while (adm->queue && GWBUF_IS_TYPE_CONTINUATION(adm->queue->stmt))
+    {
+        admission_free_stmts(admission_pop(adm));
+    }
+
+    ts_stats_add(rses->router->stats.n_queue_timeouts, 1);
+    MXS_WARNING("A statement of session %lu waited for more than %d milliseconds for the backend "
+                "servers of service '%s' to execute fewer than %d queries.",
+                rses->client_dcb->session->ses_id, rses->rses_config.queued_query_timeout,
+                rses->router->service->name, rses->rses_config.max_backend_operations);
+
+    GWBUF *err = modutil_create_mysql_err_msg(1, 0, ADMISSION_TIMEOUT_ERRNO, "70100",
+                                              "Query was not executed, the backend servers "
+                                              "are too busy");
+
+    if (err == NULL || rses->client_dcb->func.write(rses->client_dcb, err) != 1)
+    {
+        poll_fake_hangup_event(rses->client_dcb);
+    }
+}
+
+void admission_init(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_session_timer_init(&rses->rses_admission.timer, admission_timer_cb, rses);
+}
+
+void admission_finish(ROUTER_CLIENT_SES *rses)
+{
+    ss_dassert(rses->rses_admission.timer.session == NULL);
+    admission_free_stmts(rses->rses_admission.queue);
+    rses->rses_admission.queue = NULL;
+    rses->rses_admission.queue_last = NULL;
+}
+
+/**
+ * @brief Check whether a statement must be queued instead of routed
+ *
+ * @param rses     Router session
+ * @param querybuf The statement
+ * @return True if the statement must wait with admission_queue_stmt
+ */
+bool admission_must_wait(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    if (rses->rses_config.max_backend_operations == 0)
+    {
+        return false;
+    }
+    else if (rses->rses_admission.queue)
+    {
+        /** The statements are routed in the order the client sent them */
+        return true;
+    }
+
+    MXS_SESSION *session = rses->client_dcb->session;
+
+    return !GWBUF_IS_TYPE_CONTINUATION(querybuf) &&
+           !session_trx_is_active(session) &&
+           !rses->rses_load_active &&
+           admission_is_saturated(rses, querybuf, session->priority);
+}
+
+/**
+ * @brief Set the priority class of the session for a statement
+ *
+ * The class is that of the priority hint of the statement or, if it has
+ * none, the class the session was given when it was created.
+ *
+ * @param rses     Router session
+ * @param querybuf The statement
+ */
+void admission_set_priority(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+    session_priority_t priority = session->base_priority;
+
+    for (HINT *hint = querybuf->hint; hint; hint = hint->next)
+    {
+        if (hint->type == HINT_PARAMETER && strcasecmp((char *)hint->data, PRIORITY_HINT) == 0 &&
+            !session_priority_from_string((char *)hint->value, &priority))
+        {
+            MXS_ERROR("Unknown priority class '%s' when high, normal or low was expected.",
+                      (char *)hint->value);
+        }
+    }
+
+    session_set_priority(session, priority);
+}
+
+/**
+ * @brief Queue a statement until a backend has room for it
+ *
+ * @param rses     Router session
+ * @param querybuf The statement, owned by the queue on success
+ * @return False if memory allocation failed
+ */
+bool admission_queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    rwsplit_queued_stmt_t *stmt = (rwsplit_queued_stmt_t *)MXS_CALLOC(1, sizeof(*stmt));
+
+    if (stmt == NULL)
+    {
+        return false;
+    }
+
+    stmt->stmt = querybuf;
+    stmt->priority = rses->client_dcb->session->priority;
+    stmt->queued_at = rwsplit_clock_us();
+    stmt->deadline = hkheartbeat + (rses->rses_config.queued_query_timeout + 99) / 100;
+
+    if (adm->queue_last)
+    {
+        adm->queue_last->next = stmt;
+    }
+    else
+    {
+        adm->queue = stmt;
+    }
+
+    adm->queue_last = stmt;
+
+    if (!GWBUF_IS_TYPE_CONTINUATION(querybuf))
+    {
+        ts_stats_add(rses->router->stats.n_queued_stmts, 1);
+        MXS_INFO("Backend servers are saturated, queuing the statement.");
+    }
+
+    admission_wait(rses);
+    return true;
+}
+
+/**
+ * @brief Route the queued statements that the backends have room for
+ *
+ * The statements that have waited too long are answered with an error. This
+ * is called when the timer expires and when the session gets a reply.
+ *
+ * @param rses Router session
+ */
+void admission_route_queued(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_admission_t *adm = &rses->rses_admission;
+    bool routed = false;
+
+    while (adm->queue && !rses->rses_closed && !rses->rses_trx.replaying)
+    {
+        rwsplit_queued_stmt_t *stmt = adm->queue;
+        bool continuation = GWBUF_IS_TYPE_CONTINUATION(stmt->stmt);
+
+        if (!continuation && !session_trx_is_active(rses->client_dcb->session) &&
+            admission_is_saturated(rses, stmt->stmt, stmt->priority))
+        {
+            if (hkheartbeat < stmt->deadline)
+            {
+                break;
+            }
+
+            admission_timeout(rses);
+            continue;
+        }
+
+        admission_pop(adm);
+
+        if (!continuation)
+        {
+            ts_stats_add(rses->router->stats.queue_wait_us, rwsplit_clock_us() - stmt->queued_at);
+            session_set_priority(rses->client_dcb->session, stmt->priority);
+        }
+
+        bool ok = continuation ?
+                  route_continuation(rses, stmt->stmt) :
+                  route_single_stmt(rses->router, rses, stmt->stmt);
+        admission_free_stmts(stmt);
+        routed = true;
+
+        if (!ok)
+        {
+            MXS_ERROR("Failed to route a statement that waited for the backend servers.");
+            poll_fake_hangup_event(rses->client_dcb);
+            break;
+        }
+    }
+
+    if (routed)
+    {
+        uncork_pipelined_backend(rses);
+    }
+
+    if (adm->queue && !rses->rses_closed)
+    {
+        admission_wait(rses);
+    }
+}
@@ -0,0 +1,594 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <maxscale/alloc.h>
+#include <maxscale/platform.h>
+#include <maxscale/poll.h>
+#include <maxscale/query_classifier.h>
+#include <maxscale/session.h>
+
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_coalesce.c  Query coalescing
+ *
+ * With query_coalescing, a read that is sent while a session of the same
+ * thread executes the same read is not routed. The session waits for the
+ * reply of the other session and the packets of the reply are cloned to it
+ * as they arrive. The sessions must use the same service as the same user
+ * from the same client host with the same default database, connection
+ * options and session commands. The grants belong to the user and host, so
+ * the same user name from another host can be a different account.
+ *
+ * The reads that are executed are kept in a hash table of each thread, so
+ * they are never looked up or modified by other threads. A session in a
+ * transaction, with temporary tables or waiting for the reply to a causal
+ * read does not take part. Neither do the reads that call functions whose
+ * result depends on the connection or differs between executions.
+ *
+ * The statements that the client of a waiting session sends are queued and
+ * routed once the reply is complete, so that their replies come after it.
+ *
+ * If the session that executes the read closes or its slave fails before the
+ * reply has started to arrive, the waiting sessions route the read
+ * themselves. Once some of the reply has been forwarded, the waiting
+ * sessions are closed as they can not get the rest of it.
+ */
+
+/** The number of hash buckets of the reads of a thread, a power of two */
+#define COALESCE_BUCKETS 64
+
+static thread_local rwsplit_coalesce_t *coalesce_reads[COALESCE_BUCKETS];
+
+/** The functions whose result can not be shared, in alphabetical order */
+static const char *coalesce_excluded_functions[] =
+{
+    "benchmark",
+    "connection_id",
+    "convert_tz",
+    "curdate",
+    "current_date",
+    "current_timestamp",
+    "current_user",
+    "curtime",
+    "encrypt",
+    "found_rows",
+    "get_lock",
+    "is_free_lock",
+    "is_used_lock",
+    "last_insert_id",
+    "load_file",
+    "localtime",
+    "localtimestamp",
+    "master_gtid_wait",
+    "master_pos_wait",
+    "now",
+    "rand",
+    "release_lock",
+    "row_count",
+    "session_user",
+    "sleep",
+    "sysdate",
+    "system_user",
+    "unix_timestamp",
+    "user",
+    "utc_date",
+    "utc_time",
+    "utc_timestamp",
+    "uuid",
+    "uuid_short"
+};
+
+#define COALESCE_N_EXCLUDED_FUNCTIONS \
+    (sizeof(coalesce_excluded_functions) / sizeof(coalesce_excluded_functions[0]))
+
+static int coalesce_compare_name(const void *name, const void *entry)
+{
+    return strcasecmp((const char*)name, *(const char**)entry);
+}
+
+/**
+ * @brief Check whether a read calls a function whose result can not be shared
+ *
+ * @param querybuf The read
+ * @return True if the read calls a session bound or non-deterministic function
+ */
+static bool coalesce_uses_excluded_function(GWBUF *querybuf)
+{
+    const QC_FUNCTION_INFO *infos;
+    size_t n_infos;
+
+    qc_get_function_info(querybuf, &infos, &n_infos);
+
+    for (size_t i = 0; i < n_infos; i++)
+    {
+        if (bsearch(infos[i].name, coalesce_excluded_functions, COALESCE_N_EXCLUDED_FUNCTIONS,
+                    sizeof(coalesce_excluded_functions[0]), coalesce_compare_name))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Get the hash bucket of a read
+ *
+ * @param hash Hash of the read
+ * @return The bucket
+ */
+static rwsplit_coalesce_t **coalesce_bucket(uint64_t hash)
+{
+    return &coalesce_reads[hash & (COALESCE_BUCKETS - 1)];
+}
+
+/**
+ * @brief Hash a read
+ *
+ * @param querybuf The read, a contiguous buffer
+ * @return Hash of the read
+ */
+static uint64_t coalesce_hash(GWBUF *querybuf)
+{
+    MXS_DIGEST digest;
+    mxs_digest_hash(GWBUF_DATA(querybuf), GWBUF_LENGTH(querybuf), 0, &digest);
+    return digest.lo;
+}
+
+/**
+ * @brief Check whether the reply to a read can be shared
+ *
+ * @param rses        Router session
+ * @param querybuf    The read
+ * @param packet_type Type of the packet
+ * @param qtype       Type of the statement
+ * @param target      The routing target of the statement
+ *
+ * @return True if the session can wait for the reply of another session or
+ *         share its reply with them
+ */
+bool coalesce_is_possible(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, int packet_type,
+                          uint32_t qtype, route_target_t target)
+{
+    return rses->rses_config.query_coalescing &&
+           packet_type == MYSQL_COM_QUERY && target == TARGET_SLAVE &&
+           qtype == QUERY_TYPE_READ && querybuf->hint == NULL &&
+           !rses->rses_config.pipelining && !rses->rses_coalesce_wait &&
+           rses->rses_causal_gtid == NULL && rses->rses_admission.queue == NULL &&
+           !session_trx_is_active(rses->client_dcb->session) &&
+           !rses_has_tmp_tables(rses) && !rses->rses_load_active &&
+           !DCB_IS_CLONE(rses->client_dcb) && rses->client_dcb->data != NULL &&
+           rses->client_dcb->remote != NULL &&
+           !coalesce_uses_excluded_function(querybuf);
+}
+
+/**
+ * @brief Check whether a session has nothing going on in its backends
+ *
+ * The reply of another session must be the next one that the client gets.
+ *
+ * @param rses Router session
+ * @return True if no reply is expected from the backends
+ */
+static bool coalesce_session_is_idle(ROUTER_CLIENT_SES *rses)
+{
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) &&
+            (BREF_IS_QUERY_ACTIVE(bref) || BREF_IS_WAITING_RESULT(bref) ||
+             bref->bref_pending_cmd || sescmd_cursor_is_active(&bref->bref_sescmd_cur)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check whether a session sent the same read in the same state
+ *
+ * @param read     The read being executed
+ * @param rses     Router session
+ * @param querybuf The read of the session
+ * @param hash     Hash of the read
+ *
+ * @return True if the session can get the reply to @c read
+ */
+static bool coalesce_matches(rwsplit_coalesce_t *read, ROUTER_CLIENT_SES *rses,
+                             GWBUF *querybuf, uint64_t hash)
+{
+    MySQLProtocol *proto = (MySQLProtocol *)rses->client_dcb->protocol;
+    MYSQL_session *data = (MYSQL_session *)rses->client_dcb->data;
+
+    return read->hash == hash && read->router == rses->router &&
+           GWBUF_LENGTH(read->query) == GWBUF_LENGTH(querybuf) &&
+           memcmp(GWBUF_DATA(read->query), GWBUF_DATA(querybuf), GWBUF_LENGTH(querybuf)) == 0 &&
+           memcmp(&read->sescmd_sum, &rses->rses_sescmd_sum, sizeof(read->sescmd_sum)) == 0 &&
+           read->capabilities == proto->client_capabilities &&
+           read->extra_capabilities == proto->extra_capabilities &&
+           read->charset == proto->charset &&
+           strcmp(read->user, data->user) == 0 &&
+           strcmp(read->host, rses->client_dcb->remote) == 0 &&
+           strcmp(read->db, data->db) == 0;
+}
+
+/**
+ * @brief Wait for the reply to a read that another session executes
+ *
+ * Only possible until the first packet of the reply has been forwarded.
+ *
+ * @param rses     Router session
+ * @param querybuf The read
+ *
+ * @return True if the session gets the reply of another session and the read
+ *         must not be routed
+ */
+bool coalesce_join(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    uint64_t hash = coalesce_hash(querybuf);
+    rwsplit_coalesce_t *read = *coalesce_bucket(hash);
+
+    while (read && (read->reply_packets > 0 || !coalesce_matches(read, rses, querybuf, hash)))
+    {
+        read = read->next;
+    }
+
+    if (read == NULL || !coalesce_session_is_idle(rses))
+    {
+        return false;
+    }
+
+    rwsplit_coalesce_follower_t *follower =
+        (rwsplit_coalesce_follower_t *)MXS_MALLOC(sizeof(*follower));
+
+    if (follower == NULL)
+    {
+        return false;
+    }
+
+    follower->rses = rses;
+    follower->session = session_get_ref(rses->client_dcb->session);
+    follower->query = gwbuf_clone(querybuf);
+    follower->next = read->followers;
+    read->followers = follower;
+    rses->rses_coalesce_wait = true;
+
+    MXS_INFO("Waiting for the reply to the same read of another session.");
+    ts_stats_add(rses->router->stats.n_coalesced, 1);
+    return true;
+}
+
+/**
+ * @brief Start sharing the reply to a read
+ *
+ * The read has been routed to @c bref, which had nothing else going on.
+ *
+ * @param rses     Router session
+ * @param bref     The slave the read was routed to
+ * @param querybuf The read
+ */
+void coalesce_start(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf)
+{
+    rwsplit_coalesce_t *read;
+
+    if (rses->rses_coalesce || (read = (rwsplit_coalesce_t *)MXS_CALLOC(1, sizeof(*read))) == NULL)
+    {
+        return;
+    }
+
+    MySQLProtocol *proto = (MySQLProtocol *)rses->client_dcb->protocol;
+    MYSQL_session *data = (MYSQL_session *)rses->client_dcb->data;
+
+    read->router = rses->router;
+    read->leader = rses;
+    read->bref = bref;
+    read->query = gwbuf_clone(querybuf);
+    read->hash = coalesce_hash(querybuf);
+    read->sescmd_sum = rses->rses_sescmd_sum;
+    read->capabilities = proto->client_capabilities;
+    read->extra_capabilities = proto->extra_capabilities;
+    read->charset = proto->charset;
+    strcpy(read->user, data->user);
+    snprintf(read->host, sizeof(read->host), "%s", rses->client_dcb->remote);
+    strcpy(read->db, data->db);
+    read->reply_state = MYSQL_REPLY_STATE_START;
+
+    rwsplit_coalesce_t **bucket = coalesce_bucket(read->hash);
+    read->next = *bucket;
+    *bucket = read;
+    rses->rses_coalesce = read;
+}
+
+/**
+ * @brief Remove a read from the hash table of the thread
+ *
+ * @param read The read
+ */
+static void coalesce_unlink(rwsplit_coalesce_t *read)
+{
+    rwsplit_coalesce_t **prev = coalesce_bucket(read->hash);
+
+    while (*prev != read)
+    {
+        prev = &(*prev)->next;
+    }
+
+    *prev = read->next;
+    read->leader->rses_coalesce = NULL;
+}
+
+/**
+ * @brief Free a session that waited for a reply
+ *
+ * The session may be freed when its reference is released. It may already
+ * wait for the reply to another read.
+ *
+ * @param follower The waiting session
+ */
+static void coalesce_follower_free(rwsplit_coalesce_follower_t *follower)
+{
+    gwbuf_free(follower->query);
+    session_put_ref(follower->session);
+    MXS_FREE(follower);
+}
+
+/**
+ * @brief Check whether a waiting session is still on this thread
+ *
+ * Sessions are moved to other threads only by the thread that owns them, so
+ * a session that is no longer on this thread has been moved while it waited.
+ *
+ * @param read     The read
+ * @param follower The waiting session
+ * @return True if the session is on the thread of the read
+ */
+static bool coalesce_follower_is_local(rwsplit_coalesce_t *read, rwsplit_coalesce_follower_t *follower)
+{
+    return follower->rses->client_dcb->thread.id == read->leader->client_dcb->thread.id;
+}
+
+/**
+ * @brief Route the statements that the client sent while the session waited
+ *
+ * The routing stops if one of the statements waits for the reply of another
+ * session, the rest of them are routed once that reply is complete.
+ *
+ * @param rses  Router session
+ * @param local Whether the session is on this thread, the statements of a
+ *              session on another thread are handed to it as fake events
+ */
+static void coalesce_route_queued(ROUTER_CLIENT_SES *rses, bool local)
+{
+    while (rses->rses_coalesce_queue && !rses->rses_coalesce_wait && !rses->rses_closed)
+    {
+        rwsplit_queued_stmt_t *stmt = rses->rses_coalesce_queue;
+        rses->rses_coalesce_queue = stmt->next;
+
+        if (rses->rses_coalesce_queue == NULL)
+        {
+            rses->rses_coalesce_queue_last = NULL;
+        }
+
+        GWBUF *querybuf = stmt->stmt;
+        MXS_FREE(stmt);
+
+        if (!local)
+        {
+            poll_add_epollin_event_to_dcb(rses->client_dcb, querybuf);
+            continue;
+        }
+
+        bool ok = GWBUF_IS_TYPE_CONTINUATION(querybuf) ?
+                  route_continuation(rses, querybuf) :
+                  route_single_stmt(rses->router, rses, querybuf);
+        gwbuf_free(querybuf);
+
+        if (!ok)
+        {
+            MXS_ERROR("Failed to route a statement that waited for the reply of another session.");
+            poll_fake_hangup_event(rses->client_dcb);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Let a waiting session get its reply itself
+ *
+ * @param read     The read that the session no longer waits for
+ * @param follower The waiting session, freed by this function
+ */
+static void coalesce_release(rwsplit_coalesce_t *read, rwsplit_coalesce_follower_t *follower)
+{
+    ROUTER_CLIENT_SES *rses = follower->rses;
+    rses->rses_coalesce_wait = false;
+
+    if (rses->rses_closed)
+    {
+        /** The client is no longer waiting */
+    }
+    else if (read->reply_packets > 0)
+    {
+        MXS_ERROR("The reply to a shared read was interrupted, closing a session that waited for it.");
+        poll_fake_hangup_event(rses->client_dcb);
+    }
+    else if (!coalesce_follower_is_local(read, follower))
+    {
+        /** The read is handed to the session as if the client sent it again */
+        poll_add_epollin_event_to_dcb(rses->client_dcb, follower->query);
+        follower->query = NULL;
+        coalesce_route_queued(rses, false);
+    }
+    else if (!route_single_stmt(rses->router, rses, follower->query))
+    {
+        MXS_ERROR("Failed to route a read that waited for the reply of another session.");
+        poll_fake_hangup_event(rses->client_dcb);
+    }
+    else
+    {
+        coalesce_route_queued(rses, true);
+    }
+
+    coalesce_follower_free(follower);
+}
+
+/**
+ * @brief Free a read
+ *
+ * @param read The read, already removed from the hash table
+ */
+static void coalesce_free(rwsplit_coalesce_t *read)
+{
+    ss_dassert(read->followers == NULL);
+    gwbuf_free(read->query);
+    MXS_FREE(read);
+}
+
+/**
+ * @brief Forward a packet of the reply to the waiting sessions
+ *
+ * @param rses   Router session
+ * @param bref   The backend that sent the packet
+ * @param packet A complete packet of the reply, as the client of @c rses gets it
+ */
+void coalesce_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *packet)
+{
+    rwsplit_coalesce_t *read = rses->rses_coalesce;
+
+    if (read == NULL || read->bref != bref)
+    {
+        return;
+    }
+
+    bool complete = reply_state_update(&read->reply_state, packet);
+    rwsplit_coalesce_follower_t **prev = &read->followers;
+
+    while (*prev)
+    {
+        rwsplit_coalesce_follower_t *follower = *prev;
+        MXS_SESSION *session = follower->rses->client_dcb->session;
+
+        if (!follower->rses->rses_closed && coalesce_follower_is_local(read, follower))
+        {
+            MXS_SESSION_ROUTE_REPLY(session, gwbuf_clone(packet));
+            prev = &follower->next;
+        }
+        else
+        {
+            /** The session closed or was moved to another thread */
+            *prev = follower->next;
+            coalesce_release(read, follower);
+        }
+    }
+
+    read->reply_packets++;
+
+    if (complete)
+    {
+        coalesce_unlink(read);
+
+        while (read->followers)
+        {
+            rwsplit_coalesce_follower_t *follower = read->followers;
+            read->followers = follower->next;
+            follower->rses->rses_coalesce_wait = false;
+            coalesce_route_queued(follower->rses, true);
+            coalesce_follower_free(follower);
+        }
+
+        coalesce_free(read);
+    }
+}
+
+/**
+ * @brief Stop executing a read for the other sessions
+ *
+ * Called when the session closes or its slave fails. The waiting sessions
+ * route the read themselves if none of the reply has been forwarded.
+ *
+ * @param rses Router session
+ * @param bref The backend that failed, NULL if the session closes
+ */
+void coalesce_abort(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    rwsplit_coalesce_t *read = rses->rses_coalesce;
+
+    if (read && (bref == NULL || bref == read->bref))
+    {
+        /** Removed first so that the waiting sessions do not wait for it again */
+        coalesce_unlink(read);
+
+        while (read->followers)
+        {
+            rwsplit_coalesce_follower_t *follower = read->followers;
+            read->followers = follower->next;
+            coalesce_release(read, follower);
+        }
+
+        coalesce_free(read);
+    }
+}
+
+/**
+ * @brief Queue a statement until the reply the session waits for is complete
+ *
+ * @param rses     Router session
+ * @param querybuf The statement, owned by the queue on success
+ * @return False if memory allocation failed
+ */
+bool coalesce_queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    rwsplit_queued_stmt_t *stmt = (rwsplit_queued_stmt_t *)MXS_CALLOC(1, sizeof(*stmt));
+
+    if (stmt == NULL)
+    {
+        return false;
+    }
+
+    stmt->stmt = querybuf;
+    stmt->priority = rses->client_dcb->session->priority;
+
+    if (rses->rses_coalesce_queue_last)
+    {
+        rses->rses_coalesce_queue_last->next = stmt;
+    }
+    else
+    {
+        rses->rses_coalesce_queue = stmt;
+    }
+
+    rses->rses_coalesce_queue_last = stmt;
+    return true;
+}
+
+void coalesce_finish(ROUTER_CLIENT_SES *rses)
+{
+    while (rses->rses_coalesce_queue)
+    {
+        rwsplit_queued_stmt_t *stmt = rses->rses_coalesce_queue;
+        rses->rses_coalesce_queue = stmt->next;
+        gwbuf_free(stmt->stmt);
+        MXS_FREE(stmt);
+    }
+
+    rses->rses_coalesce_queue_last = NULL;
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <strings.h>
+#include <maxscale/config.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/session.h>
+
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_hedge.c  Hedged reads
+ *
+ * With hedged_reads, a read with the hedged_read hint is also sent to a
+ * second slave if the first one has not replied within hedged_read_delay
+ * milliseconds. The client gets the reply of the slave that replies first
+ * and the reply of the other slave is discarded as it arrives.
+ */
+
+/** The name of the hint parameter that asks for a hedged read */
+#define HEDGED_READ_HINT "hedged_read"
+
+extern int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *);
+
+static void hedge_timer_cb(MXS_TIMER *timer, void *data);
+
+/**
+ * @brief Check whether a slave can take part in a hedged read
+ *
+ * The first reply of the slave must be the reply to the read.
+ *
+ * @param rses Router session
+ * @param bref Backend reference of the slave
+ * @return True if the slave has nothing going on
+ */
+bool hedge_slave_is_idle(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    return BREF_IS_IN_USE(bref) &&
+           bref != rses->rses_master_ref &&
+           !BREF_IS_QUERY_ACTIVE(bref) &&
+           !BREF_IS_WAITING_RESULT(bref) &&
+           !sescmd_cursor_is_active(&bref->bref_sescmd_cur) &&
+           bref->bref_pending_cmd == NULL &&
+           bref->bref_causal_query == NULL &&
+           !bref->bref_causal_reply &&
+           bref->bref_hedge_discard == HEDGE_DISCARD_NONE;
+}
+
+/**
+ * @brief Choose the slave that the copy of the read is sent to
+ *
+ * @param rses    Router session
+ * @param primary The slave the read was routed to
+ * @return The best idle slave other than @c primary, NULL if there is none
+ */
+static backend_ref_t *hedge_choose_secondary(ROUTER_CLIENT_SES *rses, backend_ref_t *primary)
+{
+    int (*cmpfun)(const void *, const void *) =
+        criteria_cmpfun[rses->rses_config.slave_selection_criteria];
+    backend_ref_t *candidate = NULL;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (bref != primary && hedge_slave_is_idle(rses, bref) &&
+            SERVER_IS_SLAVE(bref->ref->server))
+        {
+            bref_read_load(bref, rses->rses_config.slave_selection_criteria);
+
+            if (candidate == NULL || cmpfun(candidate, bref) > 0)
+            {
+                candidate = bref;
+            }
+        }
+    }
+
+    return candidate;
+}
+
+/**
+ * @brief Send the copy of the read to the second slave
+ *
+ * @param rses Router session
+ * @return True if the copy was sent
+ */
+static bool hedge_send_copy(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_hedge_t *hedge = &rses->rses_hedge;
+    backend_ref_t *bref = hedge->secondary;
+
+    if (bref == NULL || !BREF_IS_IN_USE(bref) ||
+        bref->bref_dcb->func.write(bref->bref_dcb, gwbuf_clone(hedge->query)) != 1)
+    {
+        hedge->secondary = NULL;
+        return false;
+    }
+
+    MXS_INFO("Hedged read sent to '%s'.", bref->ref->server->unique_name);
+    atomic_add_uint64(&rses->router->stats.n_queries, 1);
+    atomic_add_uint64(&rses->router->stats.n_slave, 1);
+    ts_stats_add(rses->router->stats.n_hedged_reads, 1);
+    hedge->sent = true;
+    return true;
+}
+
+/**
+ * @brief Stop waiting for the first reply to the read
+ *
+ * @param hedge The hedged read
+ */
+static void hedge_reset(rwsplit_hedge_t *hedge)
+{
+    gwbuf_free(hedge->query);
+    hedge->query = NULL;
+    hedge->primary = NULL;
+    hedge->secondary = NULL;
+    hedge->sent = false;
+}
+
+/**
+ * @brief Discard the reply of the slave that was not the first to reply
+ *
+ * @param bref The slave
+ * @param kind Whether the slave got the read or the copy of it
+ */
+static void hedge_discard(backend_ref_t *bref, hedge_discard_t kind)
+{
+    MXS_INFO("Discarding the reply of '%s' to a hedged read.", bref->ref->server->unique_name);
+    bref->bref_hedge_discard = kind;
+    bref->bref_reply_state = MYSQL_REPLY_STATE_START;
+}
+
+/**
+ * @brief Arm the timer that sends the copy
+ *
+ * If the timer is already armed for an earlier read, it is checked again
+ * when it expires.
+ *
+ * @param rses  Router session
+ * @param ticks When the copy is sent, in heartbeats
+ */
+static void hedge_wait(ROUTER_CLIENT_SES *rses, int64_t ticks)
+{
+    rwsplit_session_timer_arm(rses, &rses->rses_hedge.timer, ticks);
+}
+
+static void hedge_timer_cb(MXS_TIMER *timer, void *data)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES *)data;
+    rwsplit_hedge_t *hedge = &rses->rses_hedge;
+    bool waiting = !rses->rses_closed && hedge->query && !hedge->sent;
+
+    /** If the timer was armed for an earlier read, wait for the rest of the delay */
+    MXS_SESSION *session = rwsplit_session_timer_fire(rses, &hedge->timer,
+                                                      waiting && hkheartbeat < hedge->send_at,
+                                                      MXS_MAX(hedge->send_at - hkheartbeat, 1));
+
+    if (session)
+    {
+        if (waiting && !hedge_send_copy(rses))
+        {
+            hedge_reset(hedge);
+        }
+
+        session_put_ref(session);
+    }
+}
+
+void hedge_init(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_session_timer_init(&rses->rses_hedge.timer, hedge_timer_cb, rses);
+}
+
+void hedge_finish(ROUTER_CLIENT_SES *rses)
+{
+    ss_dassert(rses->rses_hedge.timer.session == NULL);
+    hedge_reset(&rses->rses_hedge);
+}
+
+/**
+ * @brief Check whether a read has the hedged_read hint
+ *
+ * @param querybuf The read
+ * @return True if the hint is set to a true value
+ */
+bool hedge_is_hinted(GWBUF *querybuf)
+{
+    for (HINT *hint = querybuf->hint; hint; hint = hint->next)
+    {
+        if (hint->type == HINT_PARAMETER &&
+            strcasecmp((char *)hint->data, HEDGED_READ_HINT) == 0)
+        {
+            return config_truth_value((char *)hint->value);
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Start a hedged read
+ *
+ * The read has been routed to @c primary. The copy of it is sent now or
+ * after the delay to the best of the other idle slaves.
+ *
+ * @param rses     Router session
+ * @param primary  The slave the read was routed to
+ * @param querybuf The read
+ */
+void hedge_start(ROUTER_CLIENT_SES *rses, backend_ref_t *primary, GWBUF *querybuf)
+{
+    rwsplit_hedge_t *hedge = &rses->rses_hedge;
+    backend_ref_t *secondary;
+
+    if (hedge->query || session_trx_is_active(rses->client_dcb->session) ||
+        (secondary = hedge_choose_secondary(rses, primary)) == NULL)
+    {
+        return;
+    }
+
+    hedge->query = gwbuf_clone(querybuf);
+    hedge->primary = primary;
+    hedge->secondary = secondary;
+    hedge->sent = false;
+
+    int64_t ticks = (rses->rses_config.hedged_read_delay + 99) / 100;
+
+    if (ticks == 0)
+    {
+        if (!hedge_send_copy(rses))
+        {
+            hedge_reset(hedge);
+        }
+    }
+    else
+    {
+        hedge->send_at = hkheartbeat + ticks;
+        hedge_wait(rses, ticks);
+    }
+}
+
+/**
+ * @brief Process a reply packet of a slave that takes part in a hedged read
+ *
+ * The first slave to reply to the read wins. The reply of the other slave
+ * is discarded one packet at a time until it is complete.
+ *
+ * @param rses   Router session
+ * @param bref   The slave that sent the packet
+ * @param packet A complete packet of the reply
+ *
+ * @return The packet if it goes on to the client, NULL if it was discarded
+ */
+GWBUF *hedge_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *packet)
+{
+    rwsplit_hedge_t *hedge = &rses->rses_hedge;
+
+    if (bref->bref_hedge_discard != HEDGE_DISCARD_NONE)
+    {
+        if (reply_is_complete(bref, packet))
+        {
+            hedge_discard_t kind = bref->bref_hedge_discard;
+            bref->bref_hedge_discard = HEDGE_DISCARD_NONE;
+
+            if (kind == HEDGE_DISCARD_READ)
+            {
+                /** The slave got the read from the client and was waited for */
+                bref_clear_state(bref, BREF_QUERY_ACTIVE);
+                bref_clear_state(bref, BREF_WAITING_RESULT);
+                bref->bref_query_start = 0;
+
+                if (bref->bref_reply_count > 0)
+                {
+                    bref->bref_reply_count--;
+                }
+
+                if (bref->bref_mux_replies > 0 && --bref->bref_mux_replies == 0)
+                {
+                    release_idle_slaves(rses);
+                }
+            }
+        }
+
+        gwbuf_free(packet);
+        return NULL;
+    }
+
+    if (hedge->query && !sescmd_cursor_is_active(&bref->bref_sescmd_cur) &&
+        (bref == hedge->primary || (bref == hedge->secondary && hedge->sent)))
+    {
+        if (bref == hedge->primary)
+        {
+            if (hedge->sent)
+            {
+                hedge_discard(hedge->secondary, HEDGE_DISCARD_COPY);
+            }
+        }
+        else
+        {
+            MXS_INFO("'%s' replied first to a hedged read.", bref->ref->server->unique_name);
+            ts_stats_add(rses->router->stats.n_hedge_wins, 1);
+
+            if (hedge->primary)
+            {
+                hedge_discard(hedge->primary, HEDGE_DISCARD_READ);
+            }
+
+            /** The reply is handled as if the read had been routed to this slave */
+            bref_set_state(bref, BREF_QUERY_ACTIVE);
+            bref_set_state(bref, BREF_WAITING_RESULT);
+        }
+
+        hedge_reset(hedge);
+    }
+
+    return packet;
+}
+
+/**
+ * @brief Handle the failure of a slave that takes part in a hedged read
+ *
+ * If the slave that the read was routed to fails before it replies, the
+ * copy is sent right away and the client gets the reply of the other
+ * slave.
+ *
+ * @param rses Router session
+ * @param bref The failed slave
+ *
+ * @return True if the client gets its reply from the other slave and must
+ * not be sent an error
+ */
+bool hedge_handle_failure(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    rwsplit_hedge_t *hedge = &rses->rses_hedge;
+
+    if (bref->bref_hedge_discard != HEDGE_DISCARD_NONE)
+    {
+        /** The client already got its reply */
+        bref->bref_hedge_discard = HEDGE_DISCARD_NONE;
+        return true;
+    }
+
+    if (hedge->query == NULL)
+    {
+        return false;
+    }
+
+    bool covered = false;
+
+    if (bref == hedge->secondary)
+    {
+        hedge->secondary = NULL;
+    }
+    else if (bref == hedge->primary)
+    {
+        hedge->primary = NULL;
+        covered = hedge->sent || hedge_send_copy(rses);
+    }
+
+    if (!covered && (hedge->primary == NULL || hedge->secondary == NULL))
+    {
+        /** Only one of the slaves can reply */
+        hedge_reset(hedge);
+    }
+
+    return covered;
+}
@@ -22,6 +22,7 @@
  */
 
 #include <maxscale/cdefs.h>
+#include <time.h>
 #include <maxscale/query_classifier.h>
 
 MXS_BEGIN_DECLS
@@ -41,6 +42,48 @@ do{ \
 
 #define RW_CLOSE_BREF(b) do{ if (b){ (b)->closed_at = __LINE__; } } while (false)
 
+/**
+ * @brief The current time of the monotonic clock in nanoseconds
+ */
+static inline uint64_t rwsplit_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief The current time of the monotonic clock in microseconds
+ */
+static inline uint64_t rwsplit_clock_us(void)
+{
+    return rwsplit_clock_ns() / 1000;
+}
+
+/**
+ * @brief Get the number of bytes in a length-encoded integer
+ *
+ * @param ptr The first byte of the integer
+ * @return The size of the integer in bytes
+ */
+static inline int leint_bytes(const uint8_t *ptr)
+{
+    return *ptr < 0xfb ? 1 : *ptr == 0xfc ? 3 : *ptr == 0xfd ? 4 : 9;
+}
+
+/**
+ * @brief Check whether a session has temporary tables
+ *
+ * The names of the tables of a read are only looked up if it does.
+ *
+ * @param rses Router session
+ * @return True if the session has created temporary tables that still exist
+ */
+static inline bool rses_has_tmp_tables(const ROUTER_CLIENT_SES *rses)
+{
+    return rses->rses_tmp_tables.count > 0;
+}
+
 /*
  * The following are implemented in rwsplit_mysql.c
  */
@@ -51,6 +94,8 @@ void live_session_reply(GWBUF **querybuf, ROUTER_CLIENT_SES *rses);
 void print_error_packet(ROUTER_CLIENT_SES *rses, GWBUF *buf, DCB *dcb);
 void check_session_command_reply(GWBUF *writebuf, sescmd_cursor_t *scur, backend_ref_t *bref);
 bool execute_sescmd_in_backend(backend_ref_t *backend_ref);
+bool bref_can_send_sescmd(backend_ref_t *bref, mysql_sescmd_t *sescmd);
+bool execute_sescmd_async(backend_ref_t *bref, mysql_sescmd_t *sescmd);
 bool handle_target_is_all(route_target_t route_target,
                           ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                           GWBUF *querybuf, int packet_type, qc_query_type_t qtype);
@@ -58,6 +103,9 @@ int determine_packet_type(GWBUF *querybuf, bool *non_empty_packet);
 void log_transaction_status(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, qc_query_type_t qtype);
 bool is_packet_a_one_way_message(int packet_type);
 sescmd_cursor_t *backend_ref_get_sescmd_cursor(backend_ref_t *bref);
+bool reply_is_complete(backend_ref_t *bref, GWBUF *packet);
+bool reply_state_update(mysql_reply_state_t *state, GWBUF *packet);
+void count_pipelined_queries(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *queries);
 bool is_packet_a_query(int packet_type);
 bool send_readonly_error(DCB *dcb);
 
@@ -71,6 +119,11 @@ backend_ref_t *get_bref_from_dcb(ROUTER_CLIENT_SES *rses, DCB *dcb);
 void rses_property_done(rses_property_t *prop);
 int rses_get_max_slavecount(ROUTER_CLIENT_SES *rses, int router_nservers);
 int rses_get_max_replication_lag(ROUTER_CLIENT_SES *rses);
+void rwsplit_session_timer_init(rwsplit_session_timer_t *timer, mxs_timer_cb_t cb,
+                                ROUTER_CLIENT_SES *rses);
+void rwsplit_session_timer_arm(ROUTER_CLIENT_SES *rses, rwsplit_session_timer_t *timer, int64_t ticks);
+MXS_SESSION* rwsplit_session_timer_fire(ROUTER_CLIENT_SES *rses, rwsplit_session_timer_t *timer,
+                                        bool wait, int64_t ticks);
 
 /*
  * The following are implemented in rwsplit_route_stmt.c
@@ -98,6 +151,8 @@ bool handle_master_is_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                              DCB **target_dcb);
 bool handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
                        GWBUF *querybuf, DCB *target_dcb, bool store);
+void uncork_pipelined_backend(ROUTER_CLIENT_SES *rses);
+bool route_continuation(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
 bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                          GWBUF *querybuf, ROUTER_INSTANCE *inst,
                          int packet_type,
@@ -116,7 +171,13 @@ mysql_sescmd_t *sescmd_cursor_get_command(sescmd_cursor_t *scur);
 bool sescmd_cursor_is_active(sescmd_cursor_t *sescmd_cursor);
 void sescmd_cursor_set_active(sescmd_cursor_t *sescmd_cursor,
                               bool value);
+int sescmd_cursor_unsent(sescmd_cursor_t *scur);
 bool execute_sescmd_history(backend_ref_t *bref);
+bool sescmd_is_executed(ROUTER_CLIENT_SES *rses, mysql_sescmd_t *sescmd);
+void compact_sescmd_history(ROUTER_CLIENT_SES *rses);
+void sescmd_close_prepared(ROUTER_CLIENT_SES *rses, uint32_t ps_id);
+bool sescmd_has_open_prepared(ROUTER_CLIENT_SES *rses);
+int sescmd_prepared_position(ROUTER_CLIENT_SES *rses, uint32_t ps_id);
 GWBUF *sescmd_cursor_clone_querybuf(sescmd_cursor_t *scur);
 GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
                                      backend_ref_t *bref,
@@ -133,10 +194,15 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
                                     MXS_SESSION *session,
                                     ROUTER_INSTANCE *router,
                                     bool active_session);
+void connect_pending_slaves(ROUTER_CLIENT_SES *rses);
+void bref_read_load(backend_ref_t *bref, select_criteria_t criteria);
+bool release_idle_slaves(ROUTER_CLIENT_SES *rses);
+backend_ref_t *connect_new_master(ROUTER_CLIENT_SES *rses);
 
 /*
  * The following are implemented in rwsplit_tmp_table_multi.c
  */
+void free_tmp_tables(ROUTER_CLIENT_SES *router_cli_ses);
 void check_drop_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
                           GWBUF *querybuf,
                           mysql_server_cmd_t packet_type);
@@ -149,6 +215,65 @@ bool check_for_multi_stmt(GWBUF *buf, void *protocol, mysql_server_cmd_t packet_
 qc_query_type_t determine_query_type(GWBUF *querybuf, int packet_type, bool non_empty_packet);
 void close_failed_bref(backend_ref_t *bref, bool fatal);
 
+/*
+ * The following are implemented in rwsplit_ps.c
+ */
+uint32_t ps_classify(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, int packet_type, uint32_t qtype);
+void ps_expect_id(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf, uint32_t qtype);
+void ps_store_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply);
+void ps_finish(ROUTER_CLIENT_SES *rses);
+uint32_t ps_get_id(GWBUF *buf);
+void ps_store_backend_id(backend_ref_t *bref, int position, uint32_t id);
+GWBUF* ps_clone_for_backend(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf);
+void ps_free_backend_ids(backend_ref_t *bref);
+bool ps_is_text_command(GWBUF *querybuf);
+
+/*
+ * The following are implemented in rwsplit_trx.c
+ */
+void trx_init(ROUTER_CLIENT_SES *rses);
+void trx_finish(ROUTER_CLIENT_SES *rses);
+void trx_record_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, backend_ref_t *bref);
+bool trx_is_tracked(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+GWBUF *trx_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *packet, bool *complete);
+bool trx_can_replay(ROUTER_CLIENT_SES *rses);
+void trx_start_replay(ROUTER_CLIENT_SES *rses);
+void trx_replay_continue(ROUTER_CLIENT_SES *rses);
+bool trx_queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+
+/*
+ * The following are implemented in rwsplit_hedge.c
+ */
+void hedge_init(ROUTER_CLIENT_SES *rses);
+void hedge_finish(ROUTER_CLIENT_SES *rses);
+bool hedge_is_hinted(GWBUF *querybuf);
+bool hedge_slave_is_idle(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+void hedge_start(ROUTER_CLIENT_SES *rses, backend_ref_t *primary, GWBUF *querybuf);
+GWBUF *hedge_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *packet);
+bool hedge_handle_failure(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+
+/*
+ * The following are implemented in rwsplit_admission.c
+ */
+void admission_init(ROUTER_CLIENT_SES *rses);
+void admission_finish(ROUTER_CLIENT_SES *rses);
+bool admission_must_wait(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+void admission_set_priority(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+bool admission_queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+void admission_route_queued(ROUTER_CLIENT_SES *rses);
+
+/*
+ * The following are implemented in rwsplit_coalesce.c
+ */
+bool coalesce_is_possible(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, int packet_type,
+                          uint32_t qtype, route_target_t target);
+bool coalesce_join(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+void coalesce_start(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf);
+void coalesce_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *packet);
+void coalesce_abort(ROUTER_CLIENT_SES *rses, backend_ref_t *bref);
+bool coalesce_queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf);
+void coalesce_finish(ROUTER_CLIENT_SES *rses);
+
 #ifdef __cplusplus
 }
 #endif
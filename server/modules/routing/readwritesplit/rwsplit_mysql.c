@@ -395,6 +395,30 @@ void check_session_command_reply(GWBUF *writebuf, sescmd_cursor_t *scur, backend
  * Uses MySQL specific values in the large switch statement, although it
  * may be possible to generalize them.
  */
+/**
+ * @brief Check that no replies to earlier statements are expected from a server
+ *
+ * The replies to the session commands are tracked by the backend protocol,
+ * this only checks the other statements.
+ *
+ * @param bref Backend reference
+ * @return True if the next reply is the reply to the next statement
+ */
+static bool bref_has_no_pending_replies(backend_ref_t *bref)
+{
+    DCB *dcb = bref->bref_dcb;
+
+    return !BREF_IS_QUERY_ACTIVE(bref) &&
+           bref->bref_reply_count == 0 &&
+           bref->bref_mux_replies <= 0 &&
+           bref->bref_pending_cmd == NULL &&
+           bref->bref_causal_query == NULL &&
+           !bref->bref_causal_reply &&
+           bref->bref_hedge_discard == HEDGE_DISCARD_NONE &&
+           dcb->writeq == NULL &&
+           dcb->dcb_readqueue == NULL;
+}
+
 bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 {
     DCB *dcb;
@@ -483,12 +507,21 @@ bool execute_sescmd_in_backend(backend_ref_t *backend_ref)
 
         gwbuf_set_type(scur->scmd_cur_cmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
         buf = sescmd_cursor_clone_querybuf(scur);
+
+        if (buf && scur->scmd_cur_cmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE &&
+            bref_has_no_pending_replies(backend_ref))
+        {
+            /** The server connection may answer with a statement it has open */
+            gwbuf_set_type(buf, GWBUF_TYPE_NO_PENDING);
+        }
+
         rc = dcb->func.write(dcb, buf);
         break;
     }
 
     if (rc == 1)
     {
+        scur->scmd_cur_sent++;
         succp = true;
     }
     else
@@ -499,6 +532,64 @@ return_succp:
     return succp;
 }
 
+/**
+ * @brief Check whether a session command can be sent before the earlier ones are replied
+ *
+ * The session commands are sent to a slave as soon as they arrive when
+ * @c async_sescmd is enabled. The replies of the backend protocol are matched
+ * to the session commands in the order they were written, so no other
+ * statement may be waiting for a reply and all earlier commands must have
+ * been sent.
+ *
+ * @param bref   Backend reference with an active session command cursor
+ * @param sescmd The session command, the last one in the history
+ *
+ * @return True if the command can be written immediately
+ */
+bool bref_can_send_sescmd(backend_ref_t *bref, mysql_sescmd_t *sescmd)
+{
+    sescmd_cursor_t *scur = &bref->bref_sescmd_cur;
+
+    return sescmd->my_sescmd_packet_type != MYSQL_COM_CHANGE_USER &&
+           sescmd_cursor_unsent(scur) == 1 &&
+           !BREF_IS_QUERY_ACTIVE(bref) &&
+           bref->bref_reply_count == 0 &&
+           bref->bref_mux_replies <= 0 &&
+           bref->bref_pending_cmd == NULL &&
+           bref->bref_causal_query == NULL &&
+           !bref->bref_causal_reply &&
+           bref->bref_hedge_discard == HEDGE_DISCARD_NONE;
+}
+
+/**
+ * @brief Send a session command without waiting for the earlier ones to be replied
+ *
+ * The reply is checked against the master's reply when the cursor of the
+ * backend reaches the command.
+ *
+ * @param bref   Backend reference for which @c bref_can_send_sescmd is true
+ * @param sescmd The session command
+ *
+ * @return True if the command was written
+ */
+bool execute_sescmd_async(backend_ref_t *bref, mysql_sescmd_t *sescmd)
+{
+    CHK_BACKEND_REF(bref);
+    ss_dassert(sescmd_cursor_is_active(&bref->bref_sescmd_cur));
+
+    /** Mark session command buffer, it triggers writing MySQL command to protocol */
+    gwbuf_set_type(sescmd->my_sescmd_buf, GWBUF_TYPE_SESCMD);
+    GWBUF *buf = gwbuf_clone(sescmd->my_sescmd_buf);
+
+    if (buf && bref->bref_dcb->func.write(bref->bref_dcb, buf) == 1)
+    {
+        bref->bref_sescmd_cur.scmd_cur_sent++;
+        return true;
+    }
+
+    return false;
+}
+
 /*
  * End of functions called from other router modules; start of functions that
  * are internal to this module
@@ -572,3 +663,114 @@ bool send_readonly_error(DCB *dcb)
 
     return succp;
 }
+
+/**
+ * @brief Check if a packet ends the reply to a query
+ *
+ * The replies are tracked one packet at a time which requires that the
+ * router receives complete packets. A reply that consists of multiple result
+ * sets ends when the last one of them ends.
+ *
+ * @param bref   Backend reference that sent the packet
+ * @param packet A complete reply packet
+ * @return True if the packet was the last one of the reply
+ */
+bool reply_is_complete(backend_ref_t *bref, GWBUF *packet)
+{
+    return reply_state_update(&bref->bref_reply_state, packet);
+}
+
+/**
+ * @brief Follow a reply one packet at a time
+ *
+ * @param state  State of the reply, updated with the packet
+ * @param packet A complete reply packet
+ * @return True if the packet was the last one of the reply
+ */
+bool reply_state_update(mysql_reply_state_t *state, GWBUF *packet)
+{
+    /** An OK packet has two length-encoded integers before the status */
+    uint8_t data[MYSQL_HEADER_LEN + 1 + 9 + 9 + 2];
+    size_t len = gwbuf_copy_data(packet, 0, sizeof(data), data);
+    uint8_t cmd = len > MYSQL_HEADER_LEN ? data[MYSQL_HEADER_LEN] : MYSQL_REPLY_OK;
+    bool is_eof = cmd == MYSQL_REPLY_EOF && MYSQL_GET_PAYLOAD_LEN(data) + MYSQL_HEADER_LEN == MYSQL_EOF_PACKET_LEN;
+    bool complete = false;
+
+    switch (*state)
+    {
+    case MYSQL_REPLY_STATE_START:
+        if (cmd == MYSQL_REPLY_OK)
+        {
+            uint8_t *ptr = data + MYSQL_HEADER_LEN + 1;
+            ptr += leint_bytes(ptr);
+            ptr += leint_bytes(ptr);
+            complete = ptr + 2 > data + len || (gw_mysql_get_byte2(ptr) & SERVER_MORE_RESULTS_EXIST) == 0;
+        }
+        else if (cmd == MYSQL_REPLY_ERR)
+        {
+            complete = true;
+        }
+        else if (cmd != MYSQL_REPLY_LOCAL_INFILE)
+        {
+            /** The reply to LOAD DATA LOCAL INFILE ends with the OK sent after the data */
+            *state = MYSQL_REPLY_STATE_COLDEF;
+        }
+        break;
+
+    case MYSQL_REPLY_STATE_COLDEF:
+        if (cmd == MYSQL_REPLY_ERR)
+        {
+            *state = MYSQL_REPLY_STATE_START;
+            complete = true;
+        }
+        else if (is_eof)
+        {
+            *state = MYSQL_REPLY_STATE_ROWS;
+        }
+        break;
+
+    case MYSQL_REPLY_STATE_ROWS:
+        if (cmd == MYSQL_REPLY_ERR)
+        {
+            *state = MYSQL_REPLY_STATE_START;
+            complete = true;
+        }
+        else if (is_eof)
+        {
+            *state = MYSQL_REPLY_STATE_START;
+            complete = (gw_mysql_get_byte2(data + 7) & SERVER_MORE_RESULTS_EXIST) == 0;
+        }
+        break;
+    }
+
+    return complete;
+}
+
+/**
+ * @brief Count the queries whose replies must be waited for
+ *
+ * Only used when pipelining is enabled. The replies to other commands are
+ * handled as if they consisted of one packet.
+ *
+ * @param rses    Router session
+ * @param bref    Backend reference the queries were written to
+ * @param queries One or more complete packets
+ */
+void count_pipelined_queries(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *queries)
+{
+    if (rses->rses_config.pipelining)
+    {
+        size_t offset = 0;
+        uint8_t header[MYSQL_HEADER_LEN + 1];
+
+        while (gwbuf_copy_data(queries, offset, sizeof(header), header) == sizeof(header))
+        {
+            if (MYSQL_GET_COMMAND(header) == MYSQL_COM_QUERY)
+            {
+                bref->bref_reply_count++;
+            }
+
+            offset += MYSQL_GET_PAYLOAD_LEN(header) + MYSQL_HEADER_LEN;
+        }
+    }
+}
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <strings.h>
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/modutil.h>
+
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_ps.c  The classification of prepared statements
+ *
+ * The preparable statement is classified when it is prepared and the result
+ * is stored in the router session, so that the executions of the statement
+ * can be classified without parsing anything. Statements prepared with a
+ * COM_STMT_PREPARE are identified by the ID the server returns in its reply
+ * and statements prepared with a text protocol PREPARE by their name.
+ */
+
+/** The size of the OK packet that starts a COM_STMT_PREPARE reply */
+#define PS_PREPARE_OK_LEN (MYSQL_HEADER_LEN + 12)
+
+/** The offset of the statement ID in COM_STMT_EXECUTE, COM_STMT_CLOSE and the reply */
+#define PS_ID_OFFSET (MYSQL_HEADER_LEN + 1)
+
+/** Enough for the decimal representation of a statement ID */
+#define PS_ID_KEY_LEN 11
+
+static void *ps_info_copy(const void *data)
+{
+    rwsplit_ps_info_t *info = (rwsplit_ps_info_t*)MXS_MALLOC(sizeof(rwsplit_ps_info_t));
+
+    if (info)
+    {
+        memcpy(info, data, sizeof(rwsplit_ps_info_t));
+    }
+
+    return info;
+}
+
+static void ps_info_free(void *data)
+{
+    MXS_FREE(data);
+}
+
+static HASHTABLE* ps_alloc_table()
+{
+    HASHTABLE *h = hashtable_alloc(7, rwsplit_hashkeyfun, rwsplit_hashcmpfun);
+
+    if (h)
+    {
+        hashtable_memory_fns(h, rwsplit_hstrdup, ps_info_copy, rwsplit_hfree, ps_info_free);
+    }
+    else
+    {
+        MXS_ERROR("Failed to allocate a new hashtable.");
+    }
+
+    return h;
+}
+
+static void ps_id_key(uint32_t id, char *key)
+{
+    snprintf(key, PS_ID_KEY_LEN, "%u", id);
+}
+
+/**
+ * Prepared statement names are case insensitive, the keys are in lower case.
+ */
+static void ps_name_key(char *name)
+{
+    for (char *c = name; *c; c++)
+    {
+        *c = tolower((unsigned char)*c);
+    }
+}
+
+static void ps_store(HASHTABLE **table, char *key, uint32_t type, qc_query_op_t op)
+{
+    if (*table == NULL)
+    {
+        *table = ps_alloc_table();
+    }
+
+    if (*table)
+    {
+        rwsplit_ps_info_t info = {type, op};
+
+        /** A statement with the same ID or name replaces the old one */
+        hashtable_delete(*table, key);
+
+        if (hashtable_add(*table, key, &info) == 0)
+        {
+            MXS_ERROR("Failed to store the type of prepared statement '%s'.", key);
+        }
+    }
+}
+
+static void ps_erase(HASHTABLE *table, char *key)
+{
+    if (table)
+    {
+        hashtable_delete(table, key);
+    }
+}
+
+static rwsplit_ps_info_t* ps_fetch(HASHTABLE *table, char *key)
+{
+    return table ? (rwsplit_ps_info_t*)hashtable_fetch(table, key) : NULL;
+}
+
+/**
+ * @brief Check whether a text protocol statement starts with a keyword
+ *
+ * @param querybuf A contiguous COM_QUERY
+ * @param keyword  The keyword in upper case
+ *
+ * @return True if the statement starts with the keyword
+ */
+static bool ps_starts_with(GWBUF *querybuf, const char *keyword)
+{
+    const char *sql = (const char*)GWBUF_DATA(querybuf) + MYSQL_HEADER_LEN + 1;
+    const char *end = (const char*)GWBUF_DATA(querybuf) + GWBUF_LENGTH(querybuf);
+    size_t len = strlen(keyword);
+
+    while (sql < end && isspace((unsigned char)*sql))
+    {
+        sql++;
+    }
+
+    return (size_t)(end - sql) > len &&
+           strncasecmp(sql, keyword, len) == 0 &&
+           isspace((unsigned char)sql[len]);
+}
+
+/**
+ * @brief Check whether a write may use a text protocol prepared statement
+ *
+ * EXECUTE, DEALLOCATE PREPARE and DROP PREPARE are classified as plain writes
+ * and ps_classify recognizes them by their first keyword.
+ *
+ * @param querybuf A contiguous COM_QUERY
+ *
+ * @return True if ps_classify handles the statement as a prepared statement
+ */
+bool ps_is_text_command(GWBUF *querybuf)
+{
+    return ps_starts_with(querybuf, "EXECUTE") ||
+           ps_starts_with(querybuf, "DEALLOCATE") ||
+           ps_starts_with(querybuf, "DROP");
+}
+
+/**
+ * @brief Get the statement ID of a COM_STMT_EXECUTE, a COM_STMT_CLOSE or
+ * of the reply to a COM_STMT_PREPARE
+ *
+ * @param buf The packet
+ *
+ * @return The statement ID
+ */
+uint32_t ps_get_id(GWBUF *buf)
+{
+    uint8_t id[4];
+    gwbuf_copy_data(buf, PS_ID_OFFSET, sizeof(id), id);
+    return gw_mysql_get_byte4(id);
+}
+
+/**
+ * @brief Store the type of a text protocol PREPARE
+ *
+ * @param rses     Router session
+ * @param querybuf The PREPARE statement
+ */
+static void ps_store_named(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    char *name = qc_get_prepare_name(querybuf);
+
+    if (name)
+    {
+        GWBUF *stmt = qc_get_preparable_stmt(querybuf);
+        ps_name_key(name);
+
+        if (stmt)
+        {
+            ps_store(&rses->rses_ps_names, name, qc_get_type_mask(stmt), qc_get_operation(stmt));
+        }
+        else
+        {
+            /** Prepared from a variable, the statement is not known */
+            ps_erase(rses->rses_ps_names, name);
+        }
+
+        MXS_FREE(name);
+    }
+}
+
+/**
+ * @brief Find the classification of an executed or closed text protocol statement
+ *
+ * @param rses     Router session
+ * @param querybuf An EXECUTE or DEALLOCATE PREPARE statement
+ * @param erase    Whether the statement is being closed
+ *
+ * @return The classification or NULL if the statement is not known
+ */
+static rwsplit_ps_info_t* ps_find_named(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, bool erase)
+{
+    rwsplit_ps_info_t *info = NULL;
+    char *name = qc_get_prepare_name(querybuf);
+
+    if (name)
+    {
+        ps_name_key(name);
+
+        if (erase)
+        {
+            ps_erase(rses->rses_ps_names, name);
+        }
+        else
+        {
+            info = ps_fetch(rses->rses_ps_names, name);
+        }
+
+        MXS_FREE(name);
+    }
+
+    return info;
+}
+
+static bool ps_replies_pending(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    if (bref)
+    {
+        return bref->bref_reply_count > 0;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        if (rses->rses_backend_ref[i].bref_reply_count > 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t ps_classify(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, int packet_type, uint32_t qtype)
+{
+    rwsplit_ps_info_t *info = NULL;
+    char key[PS_ID_KEY_LEN];
+
+    switch (packet_type)
+    {
+    case MYSQL_COM_STMT_EXECUTE:
+        ps_id_key(ps_get_id(querybuf), key);
+        info = ps_fetch(rses->rses_ps_ids, key);
+        break;
+
+    case MYSQL_COM_STMT_CLOSE:
+        ps_id_key(ps_get_id(querybuf), key);
+        ps_erase(rses->rses_ps_ids, key);
+        break;
+
+    case MYSQL_COM_CHANGE_USER:
+        /** The server closes all prepared statements of the connection */
+        ps_finish(rses);
+        break;
+
+    case MYSQL_COM_QUERY:
+        if (qc_query_is_type(qtype, QUERY_TYPE_PREPARE_NAMED_STMT))
+        {
+            ps_store_named(rses, querybuf);
+        }
+        else if (qtype == QUERY_TYPE_WRITE)
+        {
+            /** EXECUTE and DEALLOCATE PREPARE are classified as plain writes */
+            if (ps_starts_with(querybuf, "EXECUTE"))
+            {
+                if ((info = ps_find_named(rses, querybuf, false)))
+                {
+                    qtype |= QUERY_TYPE_EXEC_STMT;
+                }
+            }
+            else if (ps_starts_with(querybuf, "DEALLOCATE") || ps_starts_with(querybuf, "DROP"))
+            {
+                ps_find_named(rses, querybuf, true);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (info)
+    {
+        qtype |= info->type;
+
+        if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
+        {
+            char *typestr = qc_typemask_to_string(info->type);
+            MXS_INFO("Executing prepared statement of type %s, operation %s.",
+                     typestr ? typestr : "N/A", qc_op_to_string(info->op));
+            MXS_FREE(typestr);
+        }
+    }
+
+    return qtype;
+}
+
+void ps_expect_id(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf, uint32_t qtype)
+{
+    /**
+     * The ID can be taken from the next reply only if no replies to earlier
+     * pipelined statements are still to come.
+     */
+    if (!ps_replies_pending(rses, bref))
+    {
+        rses->rses_ps_pending.type = qtype & ~QUERY_TYPE_PREPARE_STMT;
+        rses->rses_ps_pending.op = qc_get_operation(querybuf);
+        rses->rses_ps_pending_bref = bref;
+        rses->rses_ps_pending_active = true;
+    }
+}
+
+void ps_store_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *reply)
+{
+    if (rses->rses_ps_pending_active &&
+        (rses->rses_ps_pending_bref == NULL || rses->rses_ps_pending_bref == bref))
+    {
+        uint8_t header[MYSQL_HEADER_LEN + 1];
+
+        if (gwbuf_copy_data(reply, 0, sizeof(header), header) == sizeof(header) &&
+            MYSQL_GET_PAYLOAD_LEN(header) + MYSQL_HEADER_LEN == PS_PREPARE_OK_LEN &&
+            header[MYSQL_HEADER_LEN] == MYSQL_REPLY_OK)
+        {
+            char key[PS_ID_KEY_LEN];
+            ps_id_key(ps_get_id(reply), key);
+            ps_store(&rses->rses_ps_ids, key,
+                     rses->rses_ps_pending.type, rses->rses_ps_pending.op);
+        }
+
+        rses->rses_ps_pending_active = false;
+        rses->rses_ps_pending_bref = NULL;
+    }
+}
+
+void ps_finish(ROUTER_CLIENT_SES *rses)
+{
+    hashtable_free(rses->rses_ps_ids);
+    hashtable_free(rses->rses_ps_names);
+    rses->rses_ps_ids = NULL;
+    rses->rses_ps_names = NULL;
+}
+
+/**
+ * @brief Store the ID a server gave to a statement prepared by a session command
+ *
+ * The statements are prepared again in the same positions when the session
+ * command history is executed on a new connection, the old ID is replaced.
+ *
+ * @param bref     Backend reference
+ * @param position Position of the COM_STMT_PREPARE in the history
+ * @param id       The ID in the reply of the server
+ */
+void ps_store_backend_id(backend_ref_t *bref, int position, uint32_t id)
+{
+    for (int i = 0; i < bref->bref_ps_ids_len; i++)
+    {
+        if (bref->bref_ps_ids[i].position == position)
+        {
+            bref->bref_ps_ids[i].id = id;
+            return;
+        }
+    }
+
+    rwsplit_ps_map_t *ids = MXS_REALLOC(bref->bref_ps_ids,
+                                        (bref->bref_ps_ids_len + 1) * sizeof(*ids));
+
+    if (ids)
+    {
+        ids[bref->bref_ps_ids_len].position = position;
+        ids[bref->bref_ps_ids_len].id = id;
+        bref->bref_ps_ids = ids;
+        bref->bref_ps_ids_len++;
+    }
+}
+
+/**
+ * @brief Clone a statement for a server
+ *
+ * A server that reuses the prepared statements of a pooled connection gives
+ * them other IDs than the server whose reply the client got. The binary
+ * protocol commands sent to such a server get the ID of the statement on it.
+ *
+ * @param rses     Router session
+ * @param bref     The server the statement is written to
+ * @param querybuf The statement
+ *
+ * @return A clone of @c querybuf, a copy of it with another statement ID or
+ *         NULL if memory allocation failed
+ */
+GWBUF* ps_clone_for_backend(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *querybuf)
+{
+    GWBUF *rval = gwbuf_clone(querybuf);
+    uint8_t header[MYSQL_HEADER_LEN + 1];
+
+    if (rval == NULL || bref->bref_ps_ids_len == 0 ||
+        gwbuf_length(querybuf) < PS_ID_OFFSET + 4 ||
+        gwbuf_copy_data(querybuf, 0, sizeof(header), header) != sizeof(header))
+    {
+        return rval;
+    }
+
+    switch (MYSQL_GET_COMMAND(header))
+    {
+    case MYSQL_COM_STMT_EXECUTE:
+    case MYSQL_COM_STMT_SEND_LONG_DATA:
+    case MYSQL_COM_STMT_CLOSE:
+    case MYSQL_COM_STMT_RESET:
+    case MYSQL_COM_STMT_FETCH:
+        break;
+
+    default:
+        return rval;
+    }
+
+    uint32_t id = ps_get_id(querybuf);
+    int position = sescmd_prepared_position(rses, id);
+
+    for (int i = 0; position >= 0 && i < bref->bref_ps_ids_len; i++)
+    {
+        if (bref->bref_ps_ids[i].position == position)
+        {
+            if (bref->bref_ps_ids[i].id != id)
+            {
+                GWBUF *copy = GWBUF_LENGTH(rval) < PS_ID_OFFSET + 4 ?
+                              gwbuf_make_contiguous(rval) : gwbuf_make_writable(rval);
+
+                if (copy)
+                {
+                    gw_mysql_set_byte4(GWBUF_DATA(copy) + PS_ID_OFFSET, bref->bref_ps_ids[i].id);
+                    rval = copy;
+                }
+                else
+                {
+                    gwbuf_free(rval);
+                    rval = NULL;
+                }
+            }
+            break;
+        }
+    }
+
+    return rval;
+}
+
+void ps_free_backend_ids(backend_ref_t *bref)
+{
+    MXS_FREE(bref->bref_ps_ids);
+    bref->bref_ps_ids = NULL;
+    bref->bref_ps_ids_len = 0;
+}
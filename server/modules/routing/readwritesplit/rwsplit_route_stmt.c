@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <maxscale/alloc.h>
+#include <maxscale/random_jkiss.h>
 
 #include <maxscale/router.h>
 #include "rwsplit_internal.h"
@@ -43,6 +44,12 @@ static backend_ref_t *check_candidate_bref(backend_ref_t *cand,
                                            backend_ref_t *new,
                                            select_criteria_t sc);
 static backend_ref_t *get_root_master_bref(ROUTER_CLIENT_SES *rses);
+static GWBUF *prepare_causal_read(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, DCB **target_dcb);
+static uint32_t route_memo_state(ROUTER_CLIENT_SES *rses);
+static rwsplit_route_memo_t *route_memo_slot(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                                             int packet_type, MXS_DIGEST *digest);
+static bool route_memo_is_reusable(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, uint32_t qtype,
+                                   route_target_t target, uint32_t state);
 
 /**
  * Routing function. Find out query type, backend type, and target DCB(s).
@@ -67,13 +74,37 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     ss_dassert(querybuf->next == NULL); // The buffer must be contiguous.
     ss_dassert(!GWBUF_IS_TYPE_UNDEFINED(querybuf));
 
+    /** Set when the statement is routed to one server */
+    rses->rses_large_query = NULL;
+
     /* packet_type is a problem as it is MySQL specific */
     packet_type = determine_packet_type(querybuf, &non_empty_packet);
-    qtype = determine_query_type(querybuf, packet_type, non_empty_packet);
 
-    if (non_empty_packet)
+    uint64_t start = rwsplit_clock_ns();
+    uint64_t classified;
+    uint32_t state = route_memo_state(rses);
+    MXS_DIGEST digest;
+    rwsplit_route_memo_t *memo = route_memo_slot(rses, querybuf, packet_type, &digest);
+
+    if (memo && memo->state == state && memcmp(&memo->digest, &digest, sizeof(digest)) == 0)
+    {
+        /** Nothing that the decision depends on has changed */
+        qtype = memo->qtype;
+        route_target = memo->target;
+        classified = start;
+        ts_stats_add(inst->stats.n_memo_hits, 1);
+
+        if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
+        {
+            log_transaction_status(rses, querybuf, qtype);
+        }
+    }
+    else if (non_empty_packet)
     {
+        qtype = determine_query_type(querybuf, packet_type, non_empty_packet);
+        qtype = ps_classify(rses, querybuf, packet_type, qtype);
         handle_multi_temp_and_load(rses, querybuf, packet_type, (int *)&qtype);
+        classified = rwsplit_clock_ns();
 
         if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
         {
@@ -97,18 +128,49 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
          *   eventually to master
          */
         route_target = get_route_target(rses, qtype, querybuf->hint);
+
+        if (memo && route_memo_is_reusable(rses, querybuf, qtype, route_target, state))
+        {
+            memo->digest = digest;
+            memo->state = state;
+            memo->qtype = qtype;
+            memo->target = route_target;
+        }
     }
     else
     {
+        qtype = determine_query_type(querybuf, packet_type, non_empty_packet);
+        classified = rwsplit_clock_ns();
         route_target = TARGET_MASTER;
         /** Empty packet signals end of LOAD DATA LOCAL INFILE, send it to master*/
         rses->rses_load_active = false;
         MXS_INFO("> LOAD DATA LOCAL INFILE finished: %lu bytes sent.",
                  rses->rses_load_data_sent + gwbuf_length(querybuf));
     }
+
+    uint64_t decided = rwsplit_clock_ns();
+    MXS_SESSION_TRACE(rses->client_dcb->session, SESSION_TRACE_CLASSIFY, NULL);
+    ts_stats_add(inst->stats.n_routed, 1);
+    ts_stats_add(inst->stats.classify_ns, classified - start);
+    ts_stats_add(inst->stats.route_ns, decided - classified);
+
+    bool coalesce = coalesce_is_possible(rses, querybuf, packet_type, qtype, route_target);
+
+    if (coalesce && coalesce_join(rses, querybuf))
+    {
+        /** The client gets the reply of the other session that sent the same read */
+        return true;
+    }
+
     if (TARGET_IS_ALL(route_target))
     {
         succp = handle_target_is_all(route_target, inst, rses, querybuf, packet_type, qtype);
+
+        if (succp && packet_type == MYSQL_COM_STMT_PREPARE)
+        {
+            /** The client gets the ID of the server that replies first */
+            ps_expect_id(rses, NULL, querybuf, qtype);
+        }
     }
     else
     {
@@ -119,6 +181,8 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
          * hint which sets maximum allowed replication lag for the
          * backend.
          */
+        uint64_t select_start = rwsplit_clock_ns();
+
         if (TARGET_IS_NAMED_SERVER(route_target) ||
             TARGET_IS_RLAG_MAX(route_target))
         {
@@ -141,16 +205,244 @@ bool route_single_stmt(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
             }
         }
 
+        ts_stats_add(inst->stats.select_ns, rwsplit_clock_ns() - select_start);
+
         if (target_dcb && succp) /*< Have DCB of the target backend */
         {
             ss_dassert(!store_stmt || TARGET_IS_SLAVE(route_target));
-            handle_got_target(inst, rses, querybuf, target_dcb, store_stmt);
+            GWBUF *causal_query = NULL;
+            bool routed = false;
+            bool hedge = false;
+
+            if (rses->rses_config.causal_reads && rses->rses_causal_gtid &&
+                packet_type == MYSQL_COM_QUERY)
+            {
+                /** The read must see the earlier writes of the session */
+                causal_query = prepare_causal_read(rses, querybuf, &target_dcb);
+            }
+
+            if (rses->rses_config.hedged_reads && causal_query == NULL &&
+                packet_type == MYSQL_COM_QUERY && route_target == TARGET_SLAVE &&
+                hedge_is_hinted(querybuf))
+            {
+                /** The first reply of the slave must be the reply to the read */
+                hedge = hedge_slave_is_idle(rses, get_bref_from_dcb(rses, target_dcb));
+            }
+
+            /** The first reply of the slave must also be the reply to a shared read */
+            coalesce = coalesce && causal_query == NULL && !hedge &&
+                       hedge_slave_is_idle(rses, get_bref_from_dcb(rses, target_dcb));
+
+            if (causal_query)
+            {
+                /** The read is retried on the master and not on another slave */
+                if ((routed = handle_got_target(inst, rses, causal_query, target_dcb, false)))
+                {
+                    /** The end of the reply is found when its sequence numbers are corrected */
+                    backend_ref_t *bref = get_bref_from_dcb(rses, target_dcb);
+                    bref->bref_causal_query = gwbuf_clone(querybuf);
+                    bref->bref_reply_count = 0;
+                }
+
+                gwbuf_free(causal_query);
+            }
+            else if ((routed = handle_got_target(inst, rses, querybuf, target_dcb, store_stmt)) &&
+                     packet_type == MYSQL_COM_STMT_PREPARE)
+            {
+                ps_expect_id(rses, get_bref_from_dcb(rses, target_dcb), querybuf, qtype);
+            }
+
+            backend_ref_t *bref = get_bref_from_dcb(rses, target_dcb);
+
+            if (routed && hedge)
+            {
+                /** A second slave gets the read if this one is slow to reply */
+                hedge_start(rses, bref, querybuf);
+            }
+            else if (routed && coalesce)
+            {
+                /** The sessions that send the same read meanwhile get its reply */
+                coalesce_start(rses, bref, querybuf);
+            }
+
+            if (routed && rses->rses_multiplex && bref != rses->rses_master_ref &&
+                bref->bref_mux_replies >= 0)
+            {
+                /**
+                 * The slave is released once the replies to the reads sent to it
+                 * are complete. The ends of the replies to other commands are not
+                 * looked for and a slave that gets one is no longer released.
+                 */
+                if (packet_type == MYSQL_COM_QUERY)
+                {
+                    bref->bref_mux_replies++;
+                }
+                else
+                {
+                    bref->bref_mux_replies = -1;
+                }
+            }
         }
     }
 
+    if (succp && rses->rses_config.transaction_replay)
+    {
+        /** The statements of the open transaction are replayed if the master fails */
+        trx_record_stmt(rses, querybuf, target_dcb ? get_bref_from_dcb(rses, target_dcb) : NULL);
+    }
+
     return succp;
 } /* route_single_stmt */
 
+/**
+ * @brief Get the routing state of a session
+ *
+ * The state consists of everything besides the statement itself that a
+ * remembered routing decision depends on. Hints, temporary tables and
+ * LOAD DATA LOCAL INFILE are not a part of it, as the decisions are not
+ * remembered when they are involved.
+ *
+ * @param rses Router session
+ *
+ * @return The routing state, never 0
+ */
+static uint32_t route_memo_state(ROUTER_CLIENT_SES *rses)
+{
+    uint32_t state = session_get_trx_state(rses->client_dcb->session) << 2 | 0x01;
+
+    if (rses->forced_node)
+    {
+        state |= rses->forced_node == rses->rses_master_ref ? 0x02 : 0x03;
+    }
+
+    return state;
+}
+
+/**
+ * @brief Find the memo slot of a statement
+ *
+ * @param rses        Router session
+ * @param querybuf    The statement
+ * @param packet_type Type of the packet
+ * @param digest      On return, the digest of the statement
+ *
+ * @return The slot of the statement or NULL if its routing decision is not
+ *         remembered
+ */
+static rwsplit_route_memo_t *route_memo_slot(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
+                                             int packet_type, MXS_DIGEST *digest)
+{
+    rwsplit_route_memo_t *rval = NULL;
+
+    if (rses->rses_config.route_memo && packet_type == MYSQL_COM_QUERY &&
+        querybuf->hint == NULL && !rses_has_tmp_tables(rses) && !rses->rses_load_active &&
+        !DCB_IS_CLONE(rses->client_dcb) && mxs_digest_get(querybuf, digest))
+    {
+        rval = &rses->rses_route_memo[digest->lo & (RWSPLIT_ROUTE_MEMO_SIZE - 1)];
+    }
+
+    return rval;
+}
+
+/**
+ * @brief Check whether a routing decision can be reused
+ *
+ * The decision is reused for the statements that have the same digest, that
+ * is, that differ only by their literals. The statements whose type depends
+ * on their literals, the ones that change the state of the session and the
+ * ones that are routed to all servers are always classified.
+ *
+ * @param rses     Router session
+ * @param querybuf The statement
+ * @param qtype    The type of the statement
+ * @param target   The routing target of the statement
+ * @param state    The routing state of the session before the statement
+ *
+ * @return True if the decision can be remembered
+ */
+static bool route_memo_is_reusable(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, uint32_t qtype,
+                                   route_target_t target, uint32_t state)
+{
+    const uint32_t session_types =
+        QUERY_TYPE_SESSION_WRITE |
+        QUERY_TYPE_USERVAR_WRITE |
+        QUERY_TYPE_GSYSVAR_WRITE |
+        QUERY_TYPE_ENABLE_AUTOCOMMIT |
+        QUERY_TYPE_DISABLE_AUTOCOMMIT |
+        QUERY_TYPE_BEGIN_TRX |
+        QUERY_TYPE_COMMIT |
+        QUERY_TYPE_ROLLBACK |
+        QUERY_TYPE_PREPARE_STMT |
+        QUERY_TYPE_PREPARE_NAMED_STMT |
+        QUERY_TYPE_EXEC_STMT |
+        QUERY_TYPE_CREATE_TMP_TABLE |
+        QUERY_TYPE_READ_TMP_TABLE;
+
+    return (target == TARGET_MASTER || target == TARGET_SLAVE) &&
+           qtype != QUERY_TYPE_UNKNOWN && (qtype & session_types) == 0 &&
+           !(qtype == QUERY_TYPE_WRITE && ps_is_text_command(querybuf)) &&
+           !rses_has_tmp_tables(rses) && !rses->rses_load_active &&
+           route_memo_state(rses) == state;
+}
+
+/**
+ * @brief Prefix a read with a wait for the GTID of the last write
+ *
+ * MASTER_GTID_WAIT returns -1 when it times out, and the subquery then returns
+ * several rows, which makes the prefix fail. The server does not execute the
+ * rest of the query after an error, so the read can be retried on the master.
+ *
+ * If the slave is busy, the result of the wait could not be told apart from
+ * the replies to the earlier statements and the read is sent to the master.
+ *
+ * @param rses       Router session
+ * @param querybuf   The read
+ * @param target_dcb The slave, changed to the master if the read is sent there
+ *
+ * @return The prefixed read or NULL if the read is sent as it is
+ */
+static GWBUF *prepare_causal_read(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, DCB **target_dcb)
+{
+    backend_ref_t *bref = get_bref_from_dcb(rses, *target_dcb);
+    backend_ref_t *master = rses->rses_master_ref;
+    GWBUF *rval = NULL;
+
+    if (bref == master || session_trx_is_active(rses->client_dcb->session))
+    {
+        /** A transaction is not moved to the master in the middle */
+        return NULL;
+    }
+
+    char prefix[sizeof(CAUSAL_READ_PREFIX) + strlen(rses->rses_causal_gtid) + 20];
+    size_t prefix_len = snprintf(prefix, sizeof(prefix), CAUSAL_READ_PREFIX,
+                                 rses->rses_causal_gtid, rses->rses_config.causal_reads_timeout);
+    size_t payload_len = MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(querybuf)) + prefix_len;
+
+    if (BREF_IS_QUERY_ACTIVE(bref) || bref->bref_causal_reply || bref->bref_pending_cmd ||
+        sescmd_cursor_is_active(&bref->bref_sescmd_cur) ||
+        GWBUF_IS_TYPE_PIPELINED(querybuf) || payload_len >= GW_MYSQL_MAX_PACKET_LEN)
+    {
+        if (master && BREF_IS_IN_USE(master))
+        {
+            *target_dcb = master->bref_dcb;
+        }
+    }
+    else if ((rval = gwbuf_alloc(MYSQL_HEADER_LEN + payload_len)))
+    {
+        uint8_t *data = GWBUF_DATA(rval);
+
+        gw_mysql_set_byte3(data, payload_len);
+        data[3] = 0;
+        data[4] = MYSQL_COM_QUERY;
+        memcpy(data + MYSQL_HEADER_LEN + 1, prefix, prefix_len);
+        memcpy(data + MYSQL_HEADER_LEN + 1 + prefix_len, GWBUF_DATA(querybuf) + MYSQL_HEADER_LEN + 1,
+               payload_len - prefix_len - 1);
+        rval->gwbuf_type = querybuf->gwbuf_type;
+    }
+
+    return rval;
+}
+
 /**
  * Execute in backends used by current router session.
  * Save session variable commands to router session property
@@ -202,6 +494,11 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
     {
         int rc;
 
+        if (packet_type == MYSQL_COM_STMT_CLOSE)
+        {
+            sescmd_close_prepared(router_cli_ses, ps_get_id(querybuf));
+        }
+
         for (i = 0; i < router_cli_ses->rses_nbackends; i++)
         {
             DCB *dcb = backend_ref[i].bref_dcb;
@@ -219,8 +516,9 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
 
             if (BREF_IS_IN_USE((&backend_ref[i])))
             {
+                GWBUF *buf = ps_clone_for_backend(router_cli_ses, &backend_ref[i], querybuf);
                 nbackends += 1;
-                if ((rc = dcb->func.write(dcb, gwbuf_clone(querybuf))) == 1)
+                if (buf && (rc = dcb->func.write(dcb, buf)) == 1)
                 {
                     nsucc += 1;
                 }
@@ -236,6 +534,19 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
         goto return_succp;
     }
 
+    /**
+     * Until a session that connects to the slaves lazily has connected
+     * them, the history is kept even if it is otherwise disabled. A session
+     * that releases its slaves needs it every time they are connected.
+     */
+    bool keep_history = router_cli_ses->rses_slaves_pending || router_cli_ses->rses_multiplex;
+
+    if ((!router_cli_ses->rses_config.disable_sescmd_history || keep_history) &&
+        router_cli_ses->rses_config.compact_sescmd_history)
+    {
+        compact_sescmd_history(router_cli_ses);
+    }
+
     if (router_cli_ses->rses_config.max_sescmd_history > 0 &&
         router_cli_ses->rses_nsescmd >=
         router_cli_ses->rses_config.max_sescmd_history)
@@ -246,35 +557,28 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
                     "for the duration of the session.");
         router_cli_ses->rses_config.disable_sescmd_history = true;
         router_cli_ses->rses_config.max_sescmd_history = 0;
+
+        if (router_cli_ses->rses_slaves_pending)
+        {
+            /** The slaves could not be brought to the state of the session */
+            MXS_WARNING("The slaves will not be connected and only the master "
+                        "is used for the duration of the session.");
+            router_cli_ses->rses_slaves_pending = false;
+        }
+
+        /** The slaves that are connected now are kept */
+        router_cli_ses->rses_multiplex = false;
+        keep_history = false;
     }
 
-    if (router_cli_ses->rses_config.disable_sescmd_history)
+    if (router_cli_ses->rses_config.disable_sescmd_history && !keep_history)
     {
-        rses_property_t *prop, *tmp;
-        backend_ref_t *bref;
-        bool conflict;
+        rses_property_t *tmp;
 
         prop = router_cli_ses->rses_properties[RSES_PROP_TYPE_SESCMD];
         while (prop)
         {
-            conflict = false;
-
-            for (i = 0; i < router_cli_ses->rses_nbackends; i++)
-            {
-                bref = &backend_ref[i];
-                if (BREF_IS_IN_USE(bref))
-                {
-
-                    if (bref->bref_sescmd_cur.position <=
-                        prop->rses_prop_data.sescmd.position + 1)
-                    {
-                        conflict = true;
-                        break;
-                    }
-                }
-            }
-
-            if (conflict)
+            if (!sescmd_is_executed(router_cli_ses, &prop->rses_prop_data.sescmd))
             {
                 break;
             }
@@ -306,6 +610,13 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
         return false;
     }
 
+    if (router_cli_ses->rses_config.query_coalescing)
+    {
+        /** Only sessions that have executed the same commands share the replies */
+        MXS_DIGEST *sum = &router_cli_ses->rses_sescmd_sum;
+        mxs_digest_hash(GWBUF_DATA(querybuf), GWBUF_LENGTH(querybuf), sum->hi ^ sum->lo, sum);
+    }
+
     for (i = 0; i < router_cli_ses->rses_nbackends; i++)
     {
         if (BREF_IS_IN_USE((&backend_ref[i])))
@@ -336,7 +647,23 @@ bool route_session_write(ROUTER_CLIENT_SES *router_cli_ses,
              * master server. Otherwise, cursor will execute pending commands
              * when it completes the previous command.
              */
-            if (sescmd_cursor_is_active(scur) && &backend_ref[i] != router_cli_ses->rses_master_ref)
+            if (sescmd_cursor_is_active(scur) && &backend_ref[i] != router_cli_ses->rses_master_ref &&
+                router_cli_ses->rses_config.async_sescmd &&
+                bref_can_send_sescmd(&backend_ref[i], &prop->rses_prop_data.sescmd))
+            {
+                /** The reply is checked when the cursor reaches the command */
+                if (execute_sescmd_async(&backend_ref[i], &prop->rses_prop_data.sescmd))
+                {
+                    nsucc += 1;
+                }
+                else
+                {
+                    MXS_ERROR("Failed to execute session command in [%s]:%d",
+                              backend_ref[i].ref->server->name,
+                              backend_ref[i].ref->server->port);
+                }
+            }
+            else if (sescmd_cursor_is_active(scur) && &backend_ref[i] != router_cli_ses->rses_master_ref)
             {
                 nsucc += 1;
                 MXS_INFO("Backend [%s]:%d already executing sescmd.",
@@ -438,6 +765,62 @@ void rwsplit_hfree(void *fval)
     MXS_FREE(fval);
 }
 
+/**
+ * @brief Choose a slave with the power of two choices
+ *
+ * Two of the usable servers are picked at random and the one with the lower
+ * expected response time is chosen. Always choosing the best server would
+ * send all reads to it until its average catches up with the load.
+ *
+ * @param rses        Router session
+ * @param master_bref The root master
+ * @param max_rlag    The maximum replication lag
+ *
+ * @return The chosen backend or NULL if no slave can be used
+ */
+static backend_ref_t *get_adaptive_slave(ROUTER_CLIENT_SES *rses, backend_ref_t *master_bref,
+                                         int max_rlag)
+{
+    backend_ref_t *candidates[rses->rses_nbackends];
+    int n = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+        SERVER_REF *b = bref->ref;
+        SERVER server;
+        server.status = b->server->status;
+
+        if (BREF_IS_IN_USE(bref) && SERVER_REF_IS_ACTIVE(b) &&
+            (SERVER_IS_SLAVE(&server) ||
+             (rses->rses_config.master_accept_reads && SERVER_IS_MASTER(&server) &&
+              bref == master_bref)) &&
+            (max_rlag == MAX_RLAG_UNDEFINED ||
+             (b->server->rlag != MAX_RLAG_NOT_AVAILABLE && b->server->rlag <= max_rlag)))
+        {
+            candidates[n++] = bref;
+        }
+    }
+
+    if (n < 2)
+    {
+        return n == 1 ? candidates[0] : NULL;
+    }
+
+    int first = random_jkiss_range(n);
+    int second = random_jkiss_range(n - 1);
+
+    if (second >= first)
+    {
+        second++;
+    }
+
+    bref_read_load(candidates[first], ADAPTIVE_ROUTING);
+    bref_read_load(candidates[second], ADAPTIVE_ROUTING);
+
+    return check_candidate_bref(candidates[first], candidates[second], ADAPTIVE_ROUTING);
+}
+
 /**
  * Provide the router with a pointer to a suitable backend dcb.
  *
@@ -483,6 +866,11 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
         goto return_succp;
     }
 
+    if (btype != BE_MASTER && rses->rses_slaves_pending)
+    {
+        connect_pending_slaves(rses);
+    }
+
     /** get root master from available servers */
     master_bref = get_root_master_bref(rses);
 
@@ -523,6 +911,18 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
         }
     }
 
+    if (btype == BE_SLAVE && rses->rses_config.slave_selection_criteria == ADAPTIVE_ROUTING)
+    {
+        backend_ref_t *adaptive_bref = get_adaptive_slave(rses, master_bref, max_rlag);
+
+        if (adaptive_bref)
+        {
+            *p_dcb = adaptive_bref->bref_dcb;
+            succp = true;
+            goto return_succp;
+        }
+    }
+
     if (btype == BE_SLAVE)
     {
         backend_ref_t *candidate_bref = NULL;
@@ -542,11 +942,14 @@ bool rwsplit_get_dcb(DCB **p_dcb, ROUTER_CLIENT_SES *rses, backend_type_t btype,
             {
                 continue;
             }
+
+            bref_read_load(&backend_ref[i], rses->rses_config.slave_selection_criteria);
+
             /**
              * If there are no candidates yet accept both master or
              * slave.
              */
-            else if (candidate_bref == NULL)
+            if (candidate_bref == NULL)
             {
                 /**
                  * Ensure that master has not changed dunring
@@ -698,9 +1101,11 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
         target = TARGET_MASTER;
     }
     /**
-     * These queries are not affected by hints
+     * These queries are not affected by hints. The executions of prepared
+     * statements are classified by the prepared statement, but they can only
+     * be executed by the server the statement ID was received from.
      */
-    else if (!load_active &&
+    else if (!load_active && !qc_query_is_type(qtype, QUERY_TYPE_EXEC_STMT) &&
              (qc_query_is_type(qtype, QUERY_TYPE_SESSION_WRITE) ||
               /** Configured to allow writing user variables to all nodes */
               (use_sql_variables_in == TYPE_ALL &&
@@ -747,6 +1152,7 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
     else if (!trx_active && !load_active &&
              !qc_query_is_type(qtype, QUERY_TYPE_MASTER_READ) &&
              !qc_query_is_type(qtype, QUERY_TYPE_WRITE) &&
+             !qc_query_is_type(qtype, QUERY_TYPE_EXEC_STMT) &&
              !qc_query_is_type(qtype, QUERY_TYPE_PREPARE_STMT) &&
              !qc_query_is_type(qtype, QUERY_TYPE_PREPARE_NAMED_STMT) &&
              (qc_query_is_type(qtype, QUERY_TYPE_READ) ||
@@ -849,11 +1255,16 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
             {
                 target |= TARGET_RLAG_MAX;
             }
+            else if (strcasecmp((char *)hint->data, "hedged_read") == 0 ||
+                     strcasecmp((char *)hint->data, "priority") == 0)
+            {
+                /** Handled when the statement is routed */
+            }
             else
             {
                 MXS_ERROR("Unknown hint parameter "
-                          "'%s' when 'max_slave_replication_lag' "
-                          "was expected.",
+                          "'%s' when 'max_slave_replication_lag', "
+                          "'hedged_read' or 'priority' was expected.",
                           (char *)hint->data);
             }
         }
@@ -870,6 +1281,26 @@ route_target_t get_route_target(ROUTER_CLIENT_SES *rses,
     return target;
 }
 
+/**
+ * @brief Check whether a multi-statement query can be routed as a read
+ *
+ * A multi-statement query consisting of nothing but reads of database data
+ * does not modify the session state, so future queries need not be routed
+ * to the master. As temporary tables are only detected in the first
+ * statement, sessions with temporary tables always use the master.
+ *
+ * @param rses  Router client session
+ * @param types The union of the types of the statements
+ *
+ * @return True if the query can be routed as a read
+ */
+static bool multi_stmt_is_read_only(ROUTER_CLIENT_SES *rses, uint32_t types)
+{
+    return !rses_has_tmp_tables(rses) &&
+           qc_query_is_type(types, QUERY_TYPE_READ) &&
+           (types & ~(QUERY_TYPE_READ | QUERY_TYPE_LOCAL_READ)) == 0;
+}
+
 /**
  * @brief Handle multi statement queries and load statements
  *
@@ -895,7 +1326,15 @@ handle_multi_temp_and_load(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
     if ((rses->forced_node == NULL || rses->forced_node != rses->rses_master_ref) &&
         check_for_multi_stmt(querybuf, rses->client_dcb->protocol, packet_type))
     {
-        if (rses->rses_master_ref)
+        /** All statements are classified, the query type is that of the first */
+        size_t n_stmts;
+        uint32_t types = qc_parse_batch(querybuf, NULL, &n_stmts);
+
+        if (multi_stmt_is_read_only(rses, types))
+        {
+            MXS_INFO("Multi-statement query of %lu reads, routing it as a read.", n_stmts);
+        }
+        else if (rses->rses_master_ref)
         {
             rses->forced_node = rses->rses_master_ref;
             MXS_INFO("Multi-statement query, routing all future queries to master.");
@@ -936,7 +1375,7 @@ handle_multi_temp_and_load(ROUTER_CLIENT_SES *rses, GWBUF *querybuf,
         /**
          * Check if the query has anything to do with temporary tables.
          */
-        if (rses->have_tmp_tables)
+        if (rses_has_tmp_tables(rses))
         {
             check_drop_tmp_table(rses, querybuf, packet_type);
             if (is_packet_a_query(packet_type) && is_read_tmp_table(rses, querybuf, *qtype))
@@ -1230,6 +1669,12 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
 
     ss_dassert(target_dcb != NULL);
 
+    if (MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(querybuf)) == GW_MYSQL_MAX_PACKET_LEN)
+    {
+        /** The packets that continue the command are sent to the same server */
+        rses->rses_large_query = bref;
+    }
+
     MXS_INFO("Route query to %s \t[%s]:%d <",
              (SERVER_IS_MASTER(bref->ref->server) ? "master"
               : "slave"), bref->ref->server->name, bref->ref->server->port);
@@ -1238,13 +1683,39 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
      * active. Since the master server's response is always used, we can safely
      * write session commands to the master even if it is already executing.
      */
-    if (sescmd_cursor_is_active(scur) && bref != rses->rses_master_ref)
+    GWBUF *buf = ps_clone_for_backend(rses, bref, querybuf);
+
+    if (buf == NULL)
     {
-        bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+        MXS_ERROR("Routing query failed.");
+        return false;
+    }
+
+    if (sescmd_cursor_is_active(scur) && bref != rses->rses_master_ref &&
+        (!rses->rses_config.async_sescmd || sescmd_cursor_unsent(scur) > 0 || bref->bref_pending_cmd))
+    {
+        /**
+         * With async_sescmd, the statement follows the session commands
+         * if all of them have been sent and their replies come first.
+         */
+        bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, buf);
         return true;
     }
 
-    if (target_dcb->func.write(target_dcb, gwbuf_clone(querybuf)) == 1)
+    if (rses->rses_corked_dcb != target_dcb)
+    {
+        /** The statements must reach the servers in the order they were sent */
+        uncork_pipelined_backend(rses);
+
+        if (rses->rses_config.pipelining && GWBUF_IS_TYPE_PIPELINED(querybuf))
+        {
+            /** Collect the statements that follow into the same write */
+            dcb_cork(target_dcb);
+            rses->rses_corked_dcb = target_dcb;
+        }
+    }
+
+    if (target_dcb->func.write(target_dcb, buf) == 1)
     {
         if (store && !session_store_stmt(rses->client_dcb->session, querybuf, target_dcb->server))
         {
@@ -1258,8 +1729,16 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
          * Add one query response waiter to backend reference
          */
         bref = get_bref_from_dcb(rses, target_dcb);
+
+        if (rses->rses_config.slave_selection_criteria == ADAPTIVE_ROUTING)
+        {
+            /** Statements that overlap, as pipelined ones do, are not measured */
+            bref->bref_query_start = BREF_IS_QUERY_ACTIVE(bref) ? 0 : rwsplit_clock_us();
+        }
+
         bref_set_state(bref, BREF_QUERY_ACTIVE);
         bref_set_state(bref, BREF_WAITING_RESULT);
+        count_pipelined_queries(rses, bref, querybuf);
 
         /**
          * If a READ ONLYtransaction is ending set forced_node to NULL
@@ -1280,6 +1759,59 @@ handle_got_target(ROUTER_INSTANCE *inst, ROUTER_CLIENT_SES *rses,
     }
 }
 
+/**
+ * @brief Route a part of a command that did not fit in one packet
+ *
+ * The part is sent to the server that got the first packet of the command
+ * without looking at it.
+ *
+ * @param rses     Router session
+ * @param querybuf The part of the command
+ *
+ * @return True if the part was routed
+ */
+bool route_continuation(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    backend_ref_t *bref = rses->rses_large_query;
+
+    if (bref == NULL || !BREF_IS_IN_USE(bref))
+    {
+        MXS_ERROR("The server that the first packet of a large command was sent to "
+                  "is no longer available. Large session commands are not supported.");
+        return false;
+    }
+
+    if (bref->bref_pending_cmd)
+    {
+        /** The first packet waits for a session command to complete */
+        bref->bref_pending_cmd = gwbuf_append(bref->bref_pending_cmd, gwbuf_clone(querybuf));
+        return true;
+    }
+
+    if (rses->rses_load_active)
+    {
+        rses->rses_load_data_sent += gwbuf_length(querybuf);
+    }
+
+    return bref->bref_dcb->func.write(bref->bref_dcb, gwbuf_clone(querybuf)) == 1;
+}
+
+/**
+ * @brief Send the pipelined statements collected by a backend
+ *
+ * @param rses Router session
+ */
+void uncork_pipelined_backend(ROUTER_CLIENT_SES *rses)
+{
+    DCB *dcb = rses->rses_corked_dcb;
+
+    if (dcb)
+    {
+        rses->rses_corked_dcb = NULL;
+        dcb_uncork(dcb, false);
+    }
+}
+
 /**
  * @brief Create a generic router session property structure.
  *
@@ -1340,6 +1872,12 @@ int rses_property_add(ROUTER_CLIENT_SES *rses, rses_property_t *prop)
     prop->rses_prop_rsession = rses;
     p = rses->rses_properties[prop->rses_prop_type];
 
+    /** The buffer of a session command is shared with the backends it is sent to */
+    prop->rses_prop_bytes = sizeof(rses_property_t) +
+                            gwbuf_length(prop->rses_prop_data.sescmd.my_sescmd_buf);
+    rses->rses_mem_bytes += prop->rses_prop_bytes;
+    ts_stats_add(rses->router->stats.session_bytes, prop->rses_prop_bytes);
+
     if (p == NULL)
     {
         rses->rses_properties[prop->rses_prop_type] = prop;
@@ -13,6 +13,7 @@
 
 #include "readwritesplit.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <strings.h>
 #include <string.h>
@@ -50,6 +51,8 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2);
 
 static int bref_cmp_current_load(const void *bref1, const void *bref2);
 
+static int bref_cmp_response_time(const void *bref1, const void *bref2);
+
 /**
  * The order of functions _must_ match with the order the select criteria are
  * listed in select_criteria_t definition in readwritesplit.h
@@ -60,7 +63,8 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
     bref_cmp_global_conn,
     bref_cmp_router_conn,
     bref_cmp_behind_master,
-    bref_cmp_current_load
+    bref_cmp_current_load,
+    bref_cmp_response_time
 };
 
 /**
@@ -71,7 +75,10 @@ int (*criteria_cmpfun[LAST_CRITERIA])(const void *, const void *) =
  */
 static bool bref_valid_for_connect(const backend_ref_t *bref)
 {
-    return !BREF_HAS_FAILED(bref) && SERVER_IS_RUNNING(bref->ref->server);
+    SERVER_STATE state;
+    server_get_state(bref->ref->server, &state);
+
+    return !BREF_HAS_FAILED(bref) && SERVER_IS_RUNNING(&state);
 }
 
 /**
@@ -84,11 +91,41 @@ static bool bref_valid_for_connect(const backend_ref_t *bref)
 static bool bref_valid_for_slave(const backend_ref_t *bref, const SERVER *master_host)
 {
     SERVER *server = bref->ref->server;
+    SERVER_STATE state;
+    server_get_state(server, &state);
 
-    return (SERVER_IS_SLAVE(server) || SERVER_IS_RELAY_SERVER(server)) &&
+    return (SERVER_IS_SLAVE(&state) || SERVER_IS_RELAY_SERVER(&state)) &&
            (master_host == NULL || (server != master_host));
 }
 
+/**
+ * @brief Read the load of a server before it is compared to others
+ *
+ * The counters of a server are kept per thread and summing them reads a cache
+ * line of each thread. They are read once for each backend that a selection
+ * considers and the comparison functions use the stored values.
+ *
+ * @param bref     Backend reference
+ * @param criteria The slave selection criteria used to compare the backends
+ */
+void bref_read_load(backend_ref_t *bref, select_criteria_t criteria)
+{
+    switch (criteria)
+    {
+    case LEAST_GLOBAL_CONNECTIONS:
+        bref->bref_n_current = ts_stats_sum(bref->ref->server->stats.n_current);
+        break;
+
+    case LEAST_CURRENT_OPERATIONS:
+    case ADAPTIVE_ROUTING:
+        bref->bref_n_current_ops = ts_stats_sum(bref->ref->server->stats.n_current_ops);
+        break;
+
+    default:
+        break;
+    }
+}
+
 /**
  * @brief Find the best slave candidate
  *
@@ -193,6 +230,11 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
 
     SERVER *old_master = *p_master_ref ? (*p_master_ref)->ref->server : NULL;
 
+    for (int i = 0; i < router_nservers; i++)
+    {
+        bref_read_load(&backend_ref[i], select_criteria);
+    }
+
     if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
     {
         log_server_connections(select_criteria, backend_ref, router_nservers);
@@ -313,51 +355,212 @@ bool select_connect_backend_servers(backend_ref_t **p_master_ref,
     return succp;
 }
 
+/**
+ * @brief Connect the slaves of a session that was started without them
+ *
+ * With lazy_connect, a session only connects to the master when it starts
+ * and the slaves are connected when the first statement is routed to them.
+ * The session command history, which is kept until then, is executed on
+ * the slaves as they are connected.
+ *
+ * @param rses Router session
+ */
+void connect_pending_slaves(ROUTER_CLIENT_SES *rses)
+{
+    ss_dassert(rses->rses_slaves_pending);
+    rses->rses_slaves_pending = false;
+
+    if (!select_connect_backend_servers(&rses->rses_master_ref, rses->rses_backend_ref,
+                                        rses->rses_nbackends,
+                                        rses_get_max_slavecount(rses, rses->rses_nbackends),
+                                        rses_get_max_replication_lag(rses),
+                                        rses->rses_config.slave_selection_criteria,
+                                        rses->client_dcb->session,
+                                        rses->router, true))
+    {
+        MXS_INFO("Could not connect to the slaves, the master is used for reads.");
+    }
+}
+
+/**
+ * @brief Check whether a slave has nothing going on
+ *
+ * @param bref Backend reference of the slave
+ * @return True if the slave can be released
+ */
+static bool slave_is_idle(backend_ref_t *bref)
+{
+    DCB *dcb = bref->bref_dcb;
+
+    return bref->bref_mux_replies == 0 &&
+           !BREF_IS_QUERY_ACTIVE(bref) &&
+           !BREF_IS_WAITING_RESULT(bref) &&
+           !sescmd_cursor_is_active(&bref->bref_sescmd_cur) &&
+           bref->bref_pending_cmd == NULL &&
+           bref->bref_reply_count == 0 &&
+           bref->bref_causal_query == NULL &&
+           !bref->bref_causal_reply &&
+           bref->bref_hedge_discard == HEDGE_DISCARD_NONE &&
+           dcb->state == DCB_STATE_POLLING &&
+           dcb->writeq == NULL &&
+           dcb->dcb_readqueue == NULL;
+}
+
+/**
+ * @brief Release the slaves of an idle session
+ *
+ * With slave_multiplexing, the slaves of a session are closed when the
+ * replies to its reads are complete and the session has nothing else going
+ * on. A closed connection goes to the persistent pool of its server on the
+ * thread of the session, where the next session that connects to the server
+ * can take it. The slaves are connected again on the next read and the
+ * session command history brings them to the state of the session.
+ *
+ * @param rses Router session
+ * @return True if the slaves were released
+ */
+bool release_idle_slaves(ROUTER_CLIENT_SES *rses)
+{
+    MXS_SESSION *session = rses->client_dcb->session;
+
+    if (!rses->rses_multiplex || rses->rses_slaves_pending || rses->rses_closed ||
+        session_trx_is_active(session) || rses->rses_load_active ||
+        rses->forced_node || rses->rses_corked_dcb || rses->rses_ps_pending_active ||
+        rses->rses_trx.replaying || rses->rses_hedge.query || sescmd_has_open_prepared(rses))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && bref != rses->rses_master_ref && !slave_is_idle(bref))
+        {
+            return false;
+        }
+    }
+
+    int n_released = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && bref != rses->rses_master_ref)
+        {
+            DCB *dcb = bref->bref_dcb;
+            bref_clear_state(bref, BREF_IN_USE);
+            bref_set_state(bref, BREF_CLOSED);
+            bref->bref_reply_state = MYSQL_REPLY_STATE_START;
+            bref->bref_dcb = NULL;
+
+            /** The connection goes to the pool when the DCB is processed as a zombie */
+            atomic_add(&bref->ref->connections, -1);
+            dcb_close(dcb);
+            RW_CLOSE_BREF(bref);
+            n_released++;
+        }
+    }
+
+    if (n_released > 0)
+    {
+        MXS_DEBUG("Released %d slave connections of an idle session.", n_released);
+        ts_stats_add(rses->router->stats.n_slave_releases, n_released);
+        rses->rses_slaves_pending = true;
+    }
+
+    return n_released > 0;
+}
+
+/**
+ * @brief Find the new master of a session whose master has failed
+ *
+ * A slave of the session that has been promoted is used as it is. If the
+ * session is not connected to the new master, a connection is created and
+ * the session command history is executed on it.
+ *
+ * @param rses Router session
+ * @return The backend reference of the new master or NULL if there is none
+ */
+backend_ref_t *connect_new_master(ROUTER_CLIENT_SES *rses)
+{
+    SERVER_REF *master = get_root_master(rses->rses_backend_ref, rses->rses_nbackends);
+
+    for (int i = 0; master && i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (bref->ref == master)
+        {
+            if (BREF_IS_IN_USE(bref) ||
+                (bref_valid_for_connect(bref) &&
+                 connect_server(bref, rses->client_dcb->session, true)))
+            {
+                return bref;
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
 /** Compare number of connections from this router in backend servers */
 static int bref_cmp_router_conn(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = server_ref_weight(b1);
+    int w2 = server_ref_weight(b2);
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
         return b1->connections - b2->connections;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
 
-    return ((1000 + 1000 * b1->connections) / b1->weight) -
-           ((1000 + 1000 * b2->connections) / b2->weight);
+    return ((1000 + 1000 * b1->connections) / w1) -
+           ((1000 + 1000 * b2->connections) / w2);
 }
 
 /** Compare number of global connections in backend servers */
 static int bref_cmp_global_conn(const void *bref1, const void *bref2)
 {
-    SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
-    SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
-
-    if (b1->weight == 0 && b2->weight == 0)
+    const backend_ref_t *r1 = (const backend_ref_t *)bref1;
+    const backend_ref_t *r2 = (const backend_ref_t *)bref2;
+    int w1 = server_ref_weight(r1->ref);
+    int w2 = server_ref_weight(r2->ref);
+    int64_t c1;
+    int64_t c2;
+
+    if (w1 == 0 && w2 == 0)
     {
-        return b1->server->stats.n_current -
-               b2->server->stats.n_current;
+        c1 = r1->bref_n_current;
+        c2 = r2->bref_n_current;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
+    else
+    {
+        c1 = (1000 + 1000 * r1->bref_n_current) / w1;
+        c2 = (1000 + 1000 * r2->bref_n_current) / w2;
+    }
 
-    return ((1000 + 1000 * b1->server->stats.n_current) / b1->weight) -
-           ((1000 + 1000 * b2->server->stats.n_current) / b2->weight);
+    return (c1 > c2) - (c1 < c2);
 }
 
 /** Compare replication lag between backend servers */
@@ -365,46 +568,114 @@ static int bref_cmp_behind_master(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = server_ref_weight(b1);
+    int w2 = server_ref_weight(b2);
+    SERVER_STATE s1, s2;
+    server_get_state(b1->server, &s1);
+    server_get_state(b2->server, &s2);
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
-        return b1->server->rlag -
-               b2->server->rlag;
+        return s1.rlag - s2.rlag;
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
 
-    return ((1000 + 1000 * b1->server->rlag) / b1->weight) -
-           ((1000 + 1000 * b2->server->rlag) / b2->weight);
+    return ((1000 + 1000 * s1.rlag) / w1) -
+           ((1000 + 1000 * s2.rlag) / w2);
 }
 
 /** Compare number of current operations in backend servers */
 static int bref_cmp_current_load(const void *bref1, const void *bref2)
+{
+    const backend_ref_t *r1 = (const backend_ref_t *)bref1;
+    const backend_ref_t *r2 = (const backend_ref_t *)bref2;
+    int w1 = server_ref_weight(r1->ref);
+    int w2 = server_ref_weight(r2->ref);
+    int64_t c1;
+    int64_t c2;
+
+    if (w1 == 0 && w2 == 0)
+    {
+        c1 = r1->bref_n_current_ops;
+        c2 = r2->bref_n_current_ops;
+    }
+    else if (w1 == 0)
+    {
+        return 1;
+    }
+    else if (w2 == 0)
+    {
+        return -1;
+    }
+    else
+    {
+        c1 = (1000 + 1000 * r1->bref_n_current_ops) / w1;
+        c2 = (1000 + 1000 * r2->bref_n_current_ops) / w2;
+    }
+
+    return (c1 > c2) - (c1 < c2);
+}
+
+/**
+ * @brief The expected time it takes a server to respond to a new statement
+ *
+ * The average response time of the server is multiplied by the number of
+ * operations it has to complete before the new one. The replication lag
+ * the monitor reports is added, as a lagging slave is usually overloaded.
+ * The lag in microseconds is used when the monitor measures it.
+ *
+ * @param bref Backend reference
+ *
+ * @return The expected time in microseconds
+ */
+static int64_t expected_response_time(const backend_ref_t *bref)
+{
+    SERVER_REF *b = bref->ref;
+    int64_t ops = bref->bref_n_current_ops;
+    SERVER_STATE state;
+    server_get_state(b->server, &state);
+    int64_t rlag_us = state.rlag_us >= 0 ? state.rlag_us : (state.rlag > 0 ? state.rlag * 1000000 : 0);
+
+    return ((int64_t)b->response_time + 1) * (ops + 1) + rlag_us;
+}
+
+/** Compare the expected response times of backend servers */
+static int bref_cmp_response_time(const void *bref1, const void *bref2)
 {
     SERVER_REF *b1 = ((backend_ref_t *)bref1)->ref;
     SERVER_REF *b2 = ((backend_ref_t *)bref2)->ref;
+    int w1 = server_ref_weight(b1);
+    int w2 = server_ref_weight(b2);
+    int64_t t1;
+    int64_t t2;
 
-    if (b1->weight == 0 && b2->weight == 0)
+    if (w1 == 0 && w2 == 0)
     {
-        return b1->server->stats.n_current_ops - b2->server->stats.n_current_ops;
+        t1 = expected_response_time((const backend_ref_t *)bref1);
+        t2 = expected_response_time((const backend_ref_t *)bref2);
     }
-    else if (b1->weight == 0)
+    else if (w1 == 0)
     {
         return 1;
     }
-    else if (b2->weight == 0)
+    else if (w2 == 0)
     {
         return -1;
     }
+    else
+    {
+        t1 = (1000 * expected_response_time((const backend_ref_t *)bref1)) / w1;
+        t2 = (1000 * expected_response_time((const backend_ref_t *)bref2)) / w2;
+    }
 
-    return ((1000 + 1000 * b1->server->stats.n_current_ops) / b1->weight) -
-           ((1000 + 1000 * b2->server->stats.n_current_ops) / b2->weight);
+    return (t1 > t2) - (t1 < t2);
 }
 
 /**
@@ -476,7 +747,8 @@ static void log_server_connections(select_criteria_t select_criteria,
     if (select_criteria == LEAST_GLOBAL_CONNECTIONS ||
         select_criteria == LEAST_ROUTER_CONNECTIONS ||
         select_criteria == LEAST_BEHIND_MASTER ||
-        select_criteria == LEAST_CURRENT_OPERATIONS)
+        select_criteria == LEAST_CURRENT_OPERATIONS ||
+        select_criteria == ADAPTIVE_ROUTING)
     {
         MXS_INFO("Servers and %s connection counts:",
                  select_criteria == LEAST_GLOBAL_CONNECTIONS ? "all MaxScale"
@@ -489,8 +761,8 @@ static void log_server_connections(select_criteria_t select_criteria,
             switch (select_criteria)
             {
             case LEAST_GLOBAL_CONNECTIONS:
-                MXS_INFO("MaxScale connections : %d in \t[%s]:%d %s",
-                         b->server->stats.n_current, b->server->name,
+                MXS_INFO("MaxScale connections : %" PRId64 " in \t[%s]:%d %s",
+                         backend_ref[i].bref_n_current, b->server->name,
                          b->server->port, STRSRVSTATUS(b->server));
                 break;
 
@@ -501,12 +773,18 @@ static void log_server_connections(select_criteria_t select_criteria,
                 break;
 
             case LEAST_CURRENT_OPERATIONS:
-                MXS_INFO("current operations : %d in \t[%s]:%d %s",
-                         b->server->stats.n_current_ops,
+                MXS_INFO("current operations : %" PRId64 " in \t[%s]:%d %s",
+                         backend_ref[i].bref_n_current_ops,
                          b->server->name, b->server->port,
                          STRSRVSTATUS(b->server));
                 break;
 
+            case ADAPTIVE_ROUTING:
+                MXS_INFO("average response time : %d us in \t[%s]:%d %s",
+                         b->response_time, b->server->name,
+                         b->server->port, STRSRVSTATUS(b->server));
+                break;
+
             case LEAST_BEHIND_MASTER:
                 MXS_INFO("replication lag : %d in \t[%s]:%d %s",
                          b->server->rlag, b->server->name,
@@ -535,6 +813,7 @@ static SERVER_REF *get_root_master(backend_ref_t *servers, int router_nservers)
 {
     int i = 0;
     SERVER_REF *master_host = NULL;
+    int master_depth = 0;
 
     for (i = 0; i < router_nservers; i++)
     {
@@ -546,13 +825,15 @@ static SERVER_REF *get_root_master(backend_ref_t *servers, int router_nservers)
         }
 
         SERVER_REF *b = servers[i].ref;
+        SERVER_STATE state;
+        server_get_state(b->server, &state);
 
-        if (SERVER_IS_MASTER(b->server))
+        if (SERVER_IS_MASTER(&state))
         {
-            if (master_host == NULL ||
-                (b->server->depth < master_host->server->depth))
+            if (master_host == NULL || state.depth < master_depth)
             {
                 master_host = b;
+                master_depth = state.depth;
             }
         }
     }
@@ -13,12 +13,14 @@
 
 #include "readwritesplit.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <strings.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <maxscale/alloc.h>
 #include <maxscale/router.h>
 #include "rwsplit_internal.h"
 
@@ -39,6 +41,9 @@ static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur);
 static void sescmd_cursor_reset(sescmd_cursor_t *scur);
 static bool sescmd_cursor_next(sescmd_cursor_t *scur);
 static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd);
+static void mysql_sescmd_classify(mysql_sescmd_t *sescmd);
+static bool sescmd_is_replaced(ROUTER_CLIENT_SES *rses, rses_property_t *prop,
+                               rses_property_t **also);
 
 /*
  * The following functions, all to do with the handling of session commands,
@@ -92,6 +97,7 @@ mysql_sescmd_t *mysql_sescmd_init(rses_property_t *rses_prop,
     sescmd->my_sescmd_buf = sescmd_buf;
     sescmd->my_sescmd_packet_type = packet_type;
     sescmd->position = atomic_add(&rses->pos_generator, 1);
+    mysql_sescmd_classify(sescmd);
 
     return sescmd;
 }
@@ -105,6 +111,7 @@ void mysql_sescmd_done(mysql_sescmd_t *sescmd)
     }
     CHK_RSES_PROP(sescmd->my_sescmd_prop);
     gwbuf_free(sescmd->my_sescmd_buf);
+    MXS_FREE(sescmd->key);
     memset(sescmd, 0, sizeof(mysql_sescmd_t));
 }
 
@@ -145,6 +152,13 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
     {
         bref->reply_cmd = *((unsigned char *)replybuf->start + 4);
         scur->position = scmd->position;
+
+        if (scmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE &&
+            bref->reply_cmd == MYSQL_REPLY_OK)
+        {
+            /** Each server has its own ID for the statement */
+            ps_store_backend_id(bref, scmd->position, ps_get_id(replybuf));
+        }
         /** Faster backend has already responded to client : discard */
         if (scmd->my_sescmd_is_replied)
         {
@@ -195,6 +209,13 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             scmd->my_sescmd_is_replied = true;
             scmd->reply_cmd = *((unsigned char *)replybuf->start + 4);
 
+            if (scmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE &&
+                scmd->reply_cmd == MYSQL_REPLY_OK)
+            {
+                /** The client closes the statement with the ID in this reply */
+                scmd->ps_id = ps_get_id(replybuf);
+            }
+
             MXS_INFO("Server '%s' responded to a session command, sending the response "
                      "to the client.", bref->ref->server->unique_name);
 
@@ -242,6 +263,12 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             replybuf = NULL;
         }
 
+        if (scur->scmd_cur_sent > 0)
+        {
+            /** This command is no longer in flight */
+            scur->scmd_cur_sent--;
+        }
+
         if (sescmd_cursor_next(scur))
         {
             scmd = sescmd_cursor_get_command(scur);
@@ -251,6 +278,7 @@ GWBUF *sescmd_cursor_process_replies(GWBUF *replybuf,
             scmd = NULL;
             /** All session commands are replied */
             scur->scmd_cur_active = false;
+            scur->scmd_cur_sent = 0;
         }
     }
     ss_dassert(replybuf == NULL || *scur->scmd_cur_ptr_property == NULL);
@@ -299,6 +327,28 @@ void sescmd_cursor_set_active(sescmd_cursor_t *sescmd_cursor,
     sescmd_cursor->scmd_cur_active = value;
 }
 
+/**
+ * @brief Count the session commands a cursor has yet to send
+ *
+ * Router session must be locked.
+ *
+ * @param scur Active session command cursor
+ *
+ * @return Number of commands from the cursor on that have not been written
+ */
+int sescmd_cursor_unsent(sescmd_cursor_t *scur)
+{
+    int n = 0;
+
+    for (rses_property_t *prop = *scur->scmd_cur_ptr_property; prop; prop = prop->rses_prop_next)
+    {
+        n++;
+    }
+
+    ss_dassert(n >= scur->scmd_cur_sent);
+    return n - scur->scmd_cur_sent;
+}
+
 /**
  * Clone session command's command buffer.
  * Router session must be locked
@@ -365,6 +415,173 @@ static bool sescmd_cursor_history_empty(sescmd_cursor_t *scur)
     return succp;
 }
 
+/**
+ * @brief Check whether all backends have executed a session command
+ *
+ * The command must not be removed from the history before the cursors of all
+ * backends in use have moved beyond it.
+ *
+ * Router session must be locked.
+ *
+ * @param rses   Router session
+ * @param sescmd The session command
+ *
+ * @return True if no cursor refers to the command
+ */
+bool sescmd_is_executed(ROUTER_CLIENT_SES *rses, mysql_sescmd_t *sescmd)
+{
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t *bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) &&
+            bref->bref_sescmd_cur.position <= sescmd->position + 1)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Remove the session commands whose effect has been replaced
+ *
+ * A command that sets a variable or the default database is removed when a
+ * later command has set the same value and no command in between depends on
+ * the state, and a prepared statement is removed when it has been closed or
+ * prepared again. Replaying the history on a new backend then takes one
+ * command per variable and prepared statement, however many times the client
+ * has set them.
+ *
+ * Router session must be locked.
+ *
+ * @param rses Router session
+ */
+void compact_sescmd_history(ROUTER_CLIENT_SES *rses)
+{
+    bool compacted;
+
+    do
+    {
+        rses_property_t **pp = &rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+        compacted = false;
+
+        while (*pp && sescmd_is_executed(rses, &(*pp)->rses_prop_data.sescmd))
+        {
+            rses_property_t *prop = *pp;
+            rses_property_t *also;
+
+            if (sescmd_is_replaced(rses, prop, &also))
+            {
+                if (also)
+                {
+                    /** A DEALLOCATE PREPARE goes with the statement it closed */
+                    rses_property_t **pa = &prop->rses_prop_next;
+
+                    while (*pa != also)
+                    {
+                        pa = &(*pa)->rses_prop_next;
+                    }
+
+                    *pa = also->rses_prop_next;
+                    rses_property_done(also);
+                    atomic_add(&rses->rses_nsescmd, -1);
+                }
+
+                *pp = prop->rses_prop_next;
+                rses_property_done(prop);
+                atomic_add(&rses->rses_nsescmd, -1);
+                compacted = true;
+            }
+            else
+            {
+                pp = &prop->rses_prop_next;
+            }
+        }
+    }
+    while (compacted);
+}
+
+/**
+ * @brief Mark a COM_STMT_PREPARE of the history closed
+ *
+ * Router session must be locked.
+ *
+ * @param rses  Router session
+ * @param ps_id The ID of the COM_STMT_CLOSE
+ */
+void sescmd_close_prepared(ROUTER_CLIENT_SES *rses, uint32_t ps_id)
+{
+    for (rses_property_t *prop = rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+         prop; prop = prop->rses_prop_next)
+    {
+        mysql_sescmd_t *sescmd = &prop->rses_prop_data.sescmd;
+
+        if (sescmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE &&
+            sescmd->my_sescmd_is_replied && sescmd->reply_cmd == MYSQL_REPLY_OK &&
+            sescmd->ps_id == ps_id && !sescmd->ps_closed)
+        {
+            sescmd->ps_closed = true;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Check whether the history has a COM_STMT_PREPARE that is not closed
+ *
+ * A statement prepared again on a new connection gets a new ID, which the
+ * client does not know about.
+ *
+ * @param rses Router session
+ * @return True if the client may still use a statement prepared with COM_STMT_PREPARE
+ */
+bool sescmd_has_open_prepared(ROUTER_CLIENT_SES *rses)
+{
+    for (rses_property_t *prop = rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+         prop; prop = prop->rses_prop_next)
+    {
+        mysql_sescmd_t *sescmd = &prop->rses_prop_data.sescmd;
+
+        if (sescmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE && !sescmd->ps_closed)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Find the COM_STMT_PREPARE of a statement in the history
+ *
+ * @param rses  Router session
+ * @param ps_id The ID the client has for the statement
+ *
+ * @return The position of the command or -1 if it is not in the history
+ */
+int sescmd_prepared_position(ROUTER_CLIENT_SES *rses, uint32_t ps_id)
+{
+    int position = -1;
+
+    for (rses_property_t *prop = rses->rses_properties[RSES_PROP_TYPE_SESCMD];
+         prop; prop = prop->rses_prop_next)
+    {
+        mysql_sescmd_t *sescmd = &prop->rses_prop_data.sescmd;
+
+        /** The ID of a closed statement may have been given to a later one */
+        if (sescmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE &&
+            sescmd->my_sescmd_is_replied && sescmd->reply_cmd == MYSQL_REPLY_OK &&
+            sescmd->ps_id == ps_id)
+        {
+            position = sescmd->position;
+        }
+    }
+
+    return position;
+}
+
 /*
  * End of functions called from other modules of the read write split router;
  * start of functions that are internal to this module.
@@ -386,6 +603,9 @@ static void sescmd_cursor_reset(sescmd_cursor_t *scur)
 
     CHK_RSES_PROP((*scur->scmd_cur_ptr_property));
     scur->scmd_cur_active = false;
+    scur->scmd_cur_sent = 0;
+    /** The history is not compacted beyond a cursor that starts over */
+    scur->position = 0;
     scur->scmd_cur_cmd = &(*scur->scmd_cur_ptr_property)->rses_prop_data.sescmd;
 }
 
@@ -465,3 +685,376 @@ static rses_property_t *mysql_sescmd_get_property(mysql_sescmd_t *scmd)
     CHK_MYSQL_SESCMD(scmd);
     return scmd->my_sescmd_prop;
 }
+
+/**
+ * Skip whitespace.
+ */
+static const char *sescmd_skip_space(const char *p, const char *end)
+{
+    while (p < end && isspace((unsigned char)*p))
+    {
+        p++;
+    }
+
+    return p;
+}
+
+static bool sescmd_is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+/**
+ * @brief Move past a keyword
+ *
+ * @param p       Pointer to the statement, moved past the keyword and the
+ *                whitespace after it if the keyword is there
+ * @param end     End of the statement
+ * @param keyword The keyword in upper case
+ *
+ * @return True if the statement continues with the keyword
+ */
+static bool sescmd_accept(const char **p, const char *end, const char *keyword)
+{
+    size_t len = strlen(keyword);
+
+    if ((size_t)(end - *p) >= len && strncasecmp(*p, keyword, len) == 0 &&
+        (*p + len == end || !sescmd_is_ident_char((*p)[len])))
+    {
+        *p = sescmd_skip_space(*p + len, end);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Read a name, which may be quoted with backticks
+ *
+ * @param p   Pointer to the statement, moved past the name and the
+ *            whitespace after it
+ * @param end End of the statement
+ * @param len On return, the length of the name
+ *
+ * @return The start of the name or NULL if there is no name
+ */
+static const char *sescmd_get_name(const char **p, const char *end, size_t *len)
+{
+    const char *start = *p;
+    const char *q = start;
+
+    if (q < end && *q == '`')
+    {
+        start = ++q;
+
+        while (q < end && *q != '`')
+        {
+            q++;
+        }
+
+        if (q == end)
+        {
+            return NULL;
+        }
+
+        *len = q - start;
+        q++;
+    }
+    else
+    {
+        while (q < end && sescmd_is_ident_char(*q))
+        {
+            q++;
+        }
+
+        *len = q - start;
+    }
+
+    *p = sescmd_skip_space(q, end);
+
+    return *len > 0 ? start : NULL;
+}
+
+/**
+ * @brief Check that the rest of a statement is a constant
+ *
+ * Numbers, words and quoted strings are constants. Anything that could read
+ * the session state, such as a variable or a function, is not.
+ *
+ * @param p   The rest of the statement
+ * @param end End of the statement
+ *
+ * @return True if the rest of the statement is a constant or empty
+ */
+static bool sescmd_is_constant(const char *p, const char *end)
+{
+    while (p < end)
+    {
+        char c = *p++;
+
+        if (c == '\'' || c == '"')
+        {
+            while (p < end && *p != c)
+            {
+                p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+            }
+
+            if (p >= end)
+            {
+                return false;
+            }
+
+            p++;
+        }
+        else if (c == ';')
+        {
+            return sescmd_skip_space(p, end) == end;
+        }
+        else if (!sescmd_is_ident_char(c) && !isspace((unsigned char)c) &&
+                 c != '.' && c != '-' && c != '+')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Find out what a session command does to the session state
+ *
+ * Only simple commands are recognized, everything else is of the kind
+ * SESCMD_KIND_OTHER and is kept in the history.
+ *
+ * @param sescmd The session command
+ */
+static void mysql_sescmd_classify(mysql_sescmd_t *sescmd)
+{
+    GWBUF *buf = sescmd->my_sescmd_buf;
+    const char *key = NULL;
+    size_t key_len = 0;
+    bool user_var = false;
+
+    sescmd->kind = SESCMD_KIND_OTHER;
+
+    if (sescmd->my_sescmd_packet_type == MYSQL_COM_INIT_DB)
+    {
+        /** No system variable has this name */
+        sescmd->kind = SESCMD_KIND_STATE;
+        key = "use";
+        key_len = 3;
+    }
+    else if (sescmd->my_sescmd_packet_type == MYSQL_COM_STMT_PREPARE)
+    {
+        sescmd->kind = SESCMD_KIND_PREPARE;
+    }
+    else if (sescmd->my_sescmd_packet_type == MYSQL_COM_QUERY &&
+             GWBUF_IS_CONTIGUOUS(buf) && GWBUF_LENGTH(buf) > MYSQL_HEADER_LEN + 1)
+    {
+        const char *end = (const char*)GWBUF_DATA(buf) + GWBUF_LENGTH(buf);
+        const char *p = sescmd_skip_space((const char*)GWBUF_DATA(buf) + MYSQL_HEADER_LEN + 1, end);
+
+        if (sescmd_accept(&p, end, "USE"))
+        {
+            if (sescmd_get_name(&p, end, &key_len) && sescmd_is_constant(p, end))
+            {
+                sescmd->kind = SESCMD_KIND_STATE;
+                key = "use";
+                key_len = 3;
+            }
+        }
+        else if (sescmd_accept(&p, end, "SET"))
+        {
+            if (sescmd_accept(&p, end, "NAMES"))
+            {
+                if (sescmd_is_constant(p, end))
+                {
+                    /** No system variable has this name either */
+                    sescmd->kind = SESCMD_KIND_STATE;
+                    key = "names";
+                    key_len = 5;
+                }
+            }
+            else if (!sescmd_accept(&p, end, "GLOBAL"))
+            {
+                /**
+                 * Only a single assignment is recognized. SET TRANSACTION
+                 * without SESSION applies to the next transaction only and
+                 * is kept, as is anything with the GLOBAL scope.
+                 */
+                if (!sescmd_accept(&p, end, "SESSION"))
+                {
+                    sescmd_accept(&p, end, "LOCAL");
+                }
+
+                if (end - p > 2 && p[0] == '@' && p[1] == '@')
+                {
+                    p += 2;
+
+                    if (end - p > 8 && strncasecmp(p, "session.", 8) == 0)
+                    {
+                        p += 8;
+                    }
+                    else if (end - p > 6 && strncasecmp(p, "local.", 6) == 0)
+                    {
+                        p += 6;
+                    }
+                }
+                else if (p < end && *p == '@')
+                {
+                    user_var = true;
+                    p++;
+                }
+
+                const char *name = sescmd_get_name(&p, end, &key_len);
+
+                if (name && (!user_var || name[-1] == '@') &&
+                    p < end && (*p == '=' || (*p == ':' && p + 1 < end && p[1] == '=')))
+                {
+                    p += (*p == '=') ? 1 : 2;
+                    p = sescmd_skip_space(p, end);
+
+                    if (p < end && *p != ';' && sescmd_is_constant(p, end))
+                    {
+                        sescmd->kind = SESCMD_KIND_STATE;
+                        key = user_var ? name - 1 : name;
+                        key_len += user_var ? 1 : 0;
+                    }
+                }
+            }
+        }
+        else if (sescmd_accept(&p, end, "PREPARE"))
+        {
+            if ((key = sescmd_get_name(&p, end, &key_len)) && sescmd_accept(&p, end, "FROM"))
+            {
+                sescmd->kind = SESCMD_KIND_PREPARE;
+            }
+        }
+        else if (sescmd_accept(&p, end, "DEALLOCATE") || sescmd_accept(&p, end, "DROP"))
+        {
+            if (sescmd_accept(&p, end, "PREPARE") &&
+                (key = sescmd_get_name(&p, end, &key_len)) && sescmd_is_constant(p, end))
+            {
+                sescmd->kind = SESCMD_KIND_DEALLOCATE;
+            }
+        }
+    }
+
+    if (sescmd->kind == SESCMD_KIND_OTHER)
+    {
+        key = NULL;
+    }
+
+    if (key && (sescmd->key = MXS_STRNDUP(key, key_len)))
+    {
+        /** Variable and statement names are case insensitive */
+        for (char *c = sescmd->key; *c; c++)
+        {
+            *c = tolower((unsigned char)*c);
+        }
+    }
+    else if (key)
+    {
+        /** Without the name, the command is kept as it is */
+        sescmd->kind = SESCMD_KIND_OTHER;
+    }
+}
+
+/**
+ * @brief Check whether a later session command has replaced a command
+ *
+ * Router session must be locked.
+ *
+ * @param rses Router session
+ * @param prop The session command, executed by all backends
+ * @param also On return, a later command that is to be removed together
+ *             with this one, or NULL
+ *
+ * @return True if the command is not needed in the history
+ */
+static bool sescmd_is_replaced(ROUTER_CLIENT_SES *rses, rses_property_t *prop,
+                               rses_property_t **also)
+{
+    mysql_sescmd_t *sescmd = &prop->rses_prop_data.sescmd;
+
+    *also = NULL;
+
+    if (!sescmd->my_sescmd_is_replied)
+    {
+        return false;
+    }
+
+    switch (sescmd->kind)
+    {
+    case SESCMD_KIND_STATE:
+        if (sescmd->reply_cmd != MYSQL_REPLY_OK)
+        {
+            /** A failed SET or USE did not change anything */
+            return true;
+        }
+
+        for (rses_property_t *p = prop->rses_prop_next; p; p = p->rses_prop_next)
+        {
+            mysql_sescmd_t *next = &p->rses_prop_data.sescmd;
+
+            if (!next->my_sescmd_is_replied)
+            {
+                break;
+            }
+            else if (next->kind == SESCMD_KIND_STATE)
+            {
+                if (next->reply_cmd == MYSQL_REPLY_OK && strcmp(next->key, sescmd->key) == 0)
+                {
+                    return true;
+                }
+            }
+            else if (next->kind != SESCMD_KIND_DEALLOCATE)
+            {
+                /** A prepared statement is parsed with the state at the time */
+                break;
+            }
+        }
+        break;
+
+    case SESCMD_KIND_PREPARE:
+        if (sescmd->key == NULL)
+        {
+            return sescmd->ps_closed;
+        }
+
+        for (rses_property_t *p = prop->rses_prop_next; p; p = p->rses_prop_next)
+        {
+            mysql_sescmd_t *next = &p->rses_prop_data.sescmd;
+
+            if (!next->my_sescmd_is_replied || next->kind == SESCMD_KIND_OTHER)
+            {
+                /** The statement may be executed by a command that is kept */
+                break;
+            }
+            else if (next->key && strcmp(next->key, sescmd->key) == 0)
+            {
+                if (next->kind == SESCMD_KIND_PREPARE)
+                {
+                    /** Preparing a statement again closes the old one, even if it fails */
+                    return true;
+                }
+                else if (next->kind == SESCMD_KIND_DEALLOCATE)
+                {
+                    if (next->reply_cmd == MYSQL_REPLY_OK && sescmd_is_executed(rses, next))
+                    {
+                        *also = p;
+                        return true;
+                    }
+
+                    break;
+                }
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return false;
+}
@@ -45,11 +45,173 @@
  * somewhere else, outside this router. Perhaps in the query classifier?
  */
 
+/** The number of slots in the temporary table set when the first table is added */
+#define TMP_TABLES_MIN_CAPACITY 8
+
+/**
+ * @brief Find the slot of a temporary table
+ *
+ * @param tables The temporary tables of a session
+ * @param name   Name of the table as "database.table"
+ * @param hash   Hash of the name
+ * @return The slot of the table or the empty slot where it would be added
+ */
+static rwsplit_tmp_table_t *tmp_table_slot(const rwsplit_tmp_tables_t *tables,
+                                           const char *name, uint32_t hash)
+{
+    size_t mask = tables->capacity - 1;
+    size_t i = hash & mask;
+
+    while (tables->slots[i].name &&
+           (tables->slots[i].hash != hash || strcmp(tables->slots[i].name, name) != 0))
+    {
+        i = (i + 1) & mask;
+    }
+
+    return &tables->slots[i];
+}
+
+/**
+ * @brief Check whether a table is a temporary table of the session
+ *
+ * @param tables The temporary tables of a session
+ * @param name   Name of the table as "database.table"
+ * @return True if the table is a temporary table
+ */
+static bool tmp_table_exists(const rwsplit_tmp_tables_t *tables, const char *name)
+{
+    return tables->count > 0 &&
+           tmp_table_slot(tables, name, rwsplit_hashkeyfun(name))->name != NULL;
+}
+
+/**
+ * @brief Add a temporary table to the session
+ *
+ * The set is grown when it becomes half full.
+ *
+ * @param tables The temporary tables of a session
+ * @param name   Name of the table as "database.table"
+ * @return True if the table was added, false if it already existed
+ */
+static bool tmp_table_add(rwsplit_tmp_tables_t *tables, const char *name)
+{
+    if ((tables->count + 1) * 2 > tables->capacity)
+    {
+        rwsplit_tmp_tables_t grown;
+        grown.count = tables->count;
+        grown.capacity = tables->capacity ? tables->capacity * 2 : TMP_TABLES_MIN_CAPACITY;
+        grown.slots = MXS_CALLOC(grown.capacity, sizeof(rwsplit_tmp_table_t));
+        MXS_ABORT_IF_NULL(grown.slots);
+
+        for (size_t i = 0; i < tables->capacity; i++)
+        {
+            if (tables->slots[i].name)
+            {
+                *tmp_table_slot(&grown, tables->slots[i].name, tables->slots[i].hash) = tables->slots[i];
+            }
+        }
+
+        MXS_FREE(tables->slots);
+        *tables = grown;
+    }
+
+    uint32_t hash = rwsplit_hashkeyfun(name);
+    rwsplit_tmp_table_t *slot = tmp_table_slot(tables, name, hash);
+
+    if (slot->name)
+    {
+        return false;
+    }
+
+    slot->name = MXS_STRDUP_A(name);
+    slot->hash = hash;
+    tables->count++;
+    return true;
+}
+
+/**
+ * @brief Remove a temporary table from the session
+ *
+ * The tables that follow the removed one in its probe sequence are moved
+ * back so that no slot between the home slot of a table and the table is
+ * left empty.
+ *
+ * @param tables The temporary tables of a session
+ * @param name   Name of the table as "database.table"
+ * @return True if the table was removed
+ */
+static bool tmp_table_remove(rwsplit_tmp_tables_t *tables, const char *name)
+{
+    if (tables->count == 0)
+    {
+        return false;
+    }
+
+    rwsplit_tmp_table_t *slot = tmp_table_slot(tables, name, rwsplit_hashkeyfun(name));
+
+    if (slot->name == NULL)
+    {
+        return false;
+    }
+
+    MXS_FREE(slot->name);
+    slot->name = NULL;
+    tables->count--;
+
+    size_t mask = tables->capacity - 1;
+    size_t hole = slot - tables->slots;
+
+    for (size_t i = (hole + 1) & mask; tables->slots[i].name; i = (i + 1) & mask)
+    {
+        size_t home = tables->slots[i].hash & mask;
+
+        /** The table can fill the hole if the hole is between its home slot and it */
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            tables->slots[hole] = tables->slots[i];
+            tables->slots[i].name = NULL;
+            hole = i;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Free the temporary tables of a session
+ *
+ * @param router_cli_ses Router client session
+ */
+void free_tmp_tables(ROUTER_CLIENT_SES *router_cli_ses)
+{
+    rwsplit_tmp_tables_t *tables = &router_cli_ses->rses_tmp_tables;
+
+    for (size_t i = 0; i < tables->capacity; i++)
+    {
+        MXS_FREE(tables->slots[i].name);
+    }
+
+    MXS_FREE(tables->slots);
+    memset(tables, 0, sizeof(*tables));
+}
+
+/**
+ * @brief Form the name of a table as it is stored in the temporary tables
+ *
+ * @param dst    Where the name is stored
+ * @param dbname The default database of the session
+ * @param table  Name of the table
+ */
+static void tmp_table_name(char *dst, const char *dbname, const char *table)
+{
+    snprintf(dst, MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 2, "%s.%s", dbname, table);
+}
+
 /**
  * @brief Check for dropping of temporary tables
  *
  * Check if the query is a DROP TABLE... query and
- * if it targets a temporary table, remove it from the hashtable.
+ * if it targets a temporary table, remove it from the temporary tables.
  * @param router_cli_ses Router client session
  * @param querybuf GWBUF containing the query
  * @param type The type of the query resolved so far
@@ -62,41 +224,26 @@ void check_drop_tmp_table(ROUTER_CLIENT_SES *router_cli_ses, GWBUF *querybuf,
         return;
     }
 
-    int tsize = 0, klen = 0, i;
+    int tsize = 0;
     char **tbl = NULL;
-    char *hkey, *dbname;
-    MYSQL_session *my_data;
-    rses_property_t *rses_prop_tmp;
+    char hkey[MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 2];
     MYSQL_session *data = (MYSQL_session *)router_cli_ses->client_dcb->data;
-
-    rses_prop_tmp = router_cli_ses->rses_properties[RSES_PROP_TYPE_TMPTABLES];
-    dbname = (char *)data->db;
+    char *dbname = (char *)data->db;
 
     if (qc_is_drop_table_query(querybuf))
     {
         tbl = qc_get_table_names(querybuf, &tsize, false);
         if (tbl != NULL)
         {
-            for (i = 0; i < tsize; i++)
+            for (int i = 0; i < tsize; i++)
             {
-                /* Not clear why the next six lines are outside the if block */
-                klen = strlen(dbname) + strlen(tbl[i]) + 2;
-                hkey = MXS_CALLOC(klen, sizeof(char));
-                MXS_ABORT_IF_NULL(hkey);
-                strcpy(hkey, dbname);
-                strcat(hkey, ".");
-                strcat(hkey, tbl[i]);
-
-                if (rses_prop_tmp && rses_prop_tmp->rses_prop_data.temp_tables)
+                tmp_table_name(hkey, dbname, tbl[i]);
+
+                if (tmp_table_remove(&router_cli_ses->rses_tmp_tables, hkey))
                 {
-                    if (hashtable_delete(rses_prop_tmp->rses_prop_data.temp_tables,
-                                         (void *)hkey))
-                    {
-                        MXS_INFO("Temporary table dropped: %s", hkey);
-                    }
+                    MXS_INFO("Temporary table dropped: %s", hkey);
                 }
                 MXS_FREE(tbl[i]);
-                MXS_FREE(hkey);
             }
 
             MXS_FREE(tbl);
@@ -106,6 +253,10 @@ void check_drop_tmp_table(ROUTER_CLIENT_SES *router_cli_ses, GWBUF *querybuf,
 
 /**
  * Check if the query targets a temporary table.
+ *
+ * The table names are extracted from the query only if the session has
+ * temporary tables.
+ *
  * @param router_cli_ses Router client session
  * @param querybuf GWBUF containing the query
  * @param type The type of the query resolved so far
@@ -115,15 +266,12 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
                        GWBUF *querybuf,
                        qc_query_type_t qtype)
 {
-
-    bool target_tmp_table = false;
-    int tsize = 0, klen = 0, i;
+    int tsize = 0, i;
     char **tbl = NULL;
     char *dbname;
     char hkey[MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 2];
     MYSQL_session *data;
     bool rval = false;
-    rses_property_t *rses_prop_tmp;
 
     if (router_cli_ses == NULL || querybuf == NULL)
     {
@@ -138,7 +286,11 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         return false;
     }
 
-    rses_prop_tmp = router_cli_ses->rses_properties[RSES_PROP_TYPE_TMPTABLES];
+    if (!rses_has_tmp_tables(router_cli_ses))
+    {
+        return false;
+    }
+
     data = (MYSQL_session *)router_cli_ses->client_dcb->data;
 
     if (data == NULL)
@@ -160,18 +312,16 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         if (tbl != NULL && tsize > 0)
         {
             /** Query targets at least one table */
-            for (i = 0; i < tsize && !target_tmp_table && tbl[i]; i++)
+            for (i = 0; i < tsize && tbl[i]; i++)
             {
-                sprintf(hkey, "%s.%s", dbname, tbl[i]);
-                if (rses_prop_tmp && rses_prop_tmp->rses_prop_data.temp_tables)
+                tmp_table_name(hkey, dbname, tbl[i]);
+
+                if (tmp_table_exists(&router_cli_ses->rses_tmp_tables, hkey))
                 {
-                    if (hashtable_fetch(rses_prop_tmp->rses_prop_data.temp_tables, hkey))
-                    {
-                        /**Query target is a temporary table*/
-                        rval = true;
-                        MXS_INFO("Query targets a temporary table: %s", hkey);
-                        break;
-                    }
+                    /**Query target is a temporary table*/
+                    rval = true;
+                    MXS_INFO("Query targets a temporary table: %s", hkey);
+                    break;
                 }
             }
         }
@@ -191,9 +341,8 @@ bool is_read_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
 
 /**
  * If query is of type QUERY_TYPE_CREATE_TMP_TABLE then find out
- * the database and table name, create a hashvalue and
- * add it to the router client session's property. If property
- * doesn't exist then create it first.
+ * the database and table name and add it to the temporary tables
+ * of the router client session.
  * @param router_cli_ses Router client session
  * @param querybuf GWBUF containing the query
  * @param type The type of the query resolved so far
@@ -206,11 +355,8 @@ void check_create_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         return;
     }
 
-    int klen = 0;
-    char *hkey, *dbname;
+    char hkey[MYSQL_DATABASE_MAXLEN + MYSQL_TABLE_MAXLEN + 2];
     MYSQL_session *data;
-    rses_property_t *rses_prop_tmp;
-    HASHTABLE *h;
 
     if (router_cli_ses == NULL || querybuf == NULL)
     {
@@ -225,8 +371,6 @@ void check_create_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         return;
     }
 
-    router_cli_ses->have_tmp_tables = true;
-    rses_prop_tmp = router_cli_ses->rses_properties[RSES_PROP_TYPE_TMPTABLES];
     data = (MYSQL_session *)router_cli_ses->client_dcb->data;
 
     if (data == NULL)
@@ -236,76 +380,22 @@ void check_create_tmp_table(ROUTER_CLIENT_SES *router_cli_ses,
         return;
     }
 
-    dbname = (char *)data->db;
-
-    bool is_temp = true;
-    char *tblname = NULL;
-
-    tblname = qc_get_created_table_name(querybuf);
+    char *tblname = qc_get_created_table_name(querybuf);
 
     if (tblname && strlen(tblname) > 0)
     {
-        klen = strlen(dbname) + strlen(tblname) + 2;
-        hkey = MXS_CALLOC(klen, sizeof(char));
-        MXS_ABORT_IF_NULL(hkey);
-        strcpy(hkey, dbname);
-        strcat(hkey, ".");
-        strcat(hkey, tblname);
-    }
-    else
-    {
-        hkey = NULL;
-    }
-
-    if (rses_prop_tmp == NULL)
-    {
-        if ((rses_prop_tmp = (rses_property_t *)MXS_CALLOC(1, sizeof(rses_property_t))))
-        {
-#if defined(SS_DEBUG)
-            rses_prop_tmp->rses_prop_chk_top = CHK_NUM_ROUTER_PROPERTY;
-            rses_prop_tmp->rses_prop_chk_tail = CHK_NUM_ROUTER_PROPERTY;
-#endif
-            rses_prop_tmp->rses_prop_rsession = router_cli_ses;
-            rses_prop_tmp->rses_prop_refcount = 1;
-            rses_prop_tmp->rses_prop_next = NULL;
-            rses_prop_tmp->rses_prop_type = RSES_PROP_TYPE_TMPTABLES;
-            router_cli_ses->rses_properties[RSES_PROP_TYPE_TMPTABLES] = rses_prop_tmp;
-        }
-    }
-    if (rses_prop_tmp)
-    {
-        if (rses_prop_tmp->rses_prop_data.temp_tables == NULL)
-        {
-            h = hashtable_alloc(7, rwsplit_hashkeyfun, rwsplit_hashcmpfun);
-            hashtable_memory_fns(h, rwsplit_hstrdup, NULL, rwsplit_hfree, NULL);
-            if (h != NULL)
-            {
-                rses_prop_tmp->rses_prop_data.temp_tables = h;
-            }
-            else
-            {
-                MXS_ERROR("Failed to allocate a new hashtable.");
-            }
-        }
+        tmp_table_name(hkey, (char *)data->db, tblname);
 
-        if (hkey && rses_prop_tmp->rses_prop_data.temp_tables &&
-            hashtable_add(rses_prop_tmp->rses_prop_data.temp_tables, (void *)hkey,
-                          (void *)is_temp) == 0) /*< Conflict in hash table */
+        if (tmp_table_add(&router_cli_ses->rses_tmp_tables, hkey))
         {
-            MXS_INFO("Temporary table conflict in hashtable: %s", hkey);
+            MXS_INFO("Temporary table added: %s", hkey);
         }
-#if defined(SS_DEBUG)
+        else
         {
-            bool retkey = hashtable_fetch(rses_prop_tmp->rses_prop_data.temp_tables, hkey);
-            if (retkey)
-            {
-                MXS_INFO("Temporary table added: %s", hkey);
-            }
+            MXS_INFO("Temporary table already exists: %s", hkey);
         }
-#endif
     }
 
-    MXS_FREE(hkey);
     MXS_FREE(tblname);
 }
 
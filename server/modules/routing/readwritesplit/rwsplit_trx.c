@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include "readwritesplit.h"
+
+#include <string.h>
+#include <maxscale/alloc.h>
+#include <maxscale/hk_heartbeat.h>
+#include <maxscale/poll.h>
+#include <maxscale/session.h>
+
+#include "rwsplit_internal.h"
+
+/**
+ * @file rwsplit_trx.c  The replay of open transactions on a new master
+ *
+ * With transaction_replay, the statements of the open transaction of a
+ * session are stored along with a checksum of their replies. When the master
+ * fails, the session waits for the monitor to promote a new master and the
+ * statements are executed on it. The transaction goes on as if nothing had
+ * happened if the replies are the same as the ones the client got from the
+ * old master, otherwise the session is closed.
+ *
+ * The replies are checksummed one packet at a time. The parts of the replies
+ * that can differ between servers without the data being different, that is,
+ * the status flags, the warning counts, the session state information and the
+ * error messages, are left out of the checksums.
+ */
+
+/** How often a new master is looked for, in heartbeats */
+#define TRX_REPLAY_RETRY_TICKS 1
+
+static void trx_replay_timer_cb(MXS_TIMER *timer, void *data);
+
+static void trx_free_stmts(rwsplit_trx_stmt_t *stmt)
+{
+    while (stmt)
+    {
+        rwsplit_trx_stmt_t *next = stmt->next;
+        gwbuf_free(stmt->stmt);
+        MXS_FREE(stmt);
+        stmt = next;
+    }
+}
+
+/**
+ * @brief Forget the statements of the transaction
+ *
+ * @param trx        The transaction
+ * @param replayable Whether the statements that follow can be replayed
+ */
+static void trx_reset(rwsplit_trx_t *trx, bool replayable)
+{
+    trx_free_stmts(trx->stmts);
+    trx->stmts = NULL;
+    trx->last = NULL;
+    trx->reply = NULL;
+    trx->size = 0;
+    trx->reply_packets = 0;
+    memset(&trx->reply_sum, 0, sizeof(trx->reply_sum));
+    trx->replayable = replayable;
+}
+
+/**
+ * @brief Add a packet of a reply to the checksum of the reply
+ *
+ * @param trx    The transaction
+ * @param state  The state of the reply before the packet
+ * @param packet A complete packet
+ */
+static void trx_checksum_packet(rwsplit_trx_t *trx, mysql_reply_state_t state, GWBUF *packet)
+{
+    const uint8_t *payload = GWBUF_DATA(packet) + MYSQL_HEADER_LEN;
+    size_t len = GWBUF_LENGTH(packet) > MYSQL_HEADER_LEN ? GWBUF_LENGTH(packet) - MYSQL_HEADER_LEN : 0;
+    uint8_t cmd = len > 0 ? payload[0] : MYSQL_REPLY_OK;
+
+    if (cmd == MYSQL_REPLY_ERR)
+    {
+        /** The error code, the message can contain the name of the server */
+        len = MXS_MIN(len, 3);
+    }
+    else if (cmd == MYSQL_REPLY_EOF && len + MYSQL_HEADER_LEN == MYSQL_EOF_PACKET_LEN)
+    {
+        /** Only the warnings and the status */
+        len = 0;
+    }
+    else if (cmd == MYSQL_REPLY_OK && state == MYSQL_REPLY_STATE_START)
+    {
+        /** The affected rows and the insert ID, the client may have used either */
+        const uint8_t *ptr = payload + 1;
+
+        for (int i = 0; i < 2 && ptr < payload + len; i++)
+        {
+            ptr += leint_bytes(ptr);
+        }
+
+        len = MXS_MIN((size_t)(ptr - payload), len);
+    }
+
+    if (len > 0)
+    {
+        mxs_digest_hash(payload, len, trx->reply_sum.hi ^ trx->reply_sum.lo, &trx->reply_sum);
+    }
+}
+
+/**
+ * @brief Give up the replay of a transaction and close the session
+ *
+ * @param rses   Router session
+ * @param reason Why the transaction could not be replayed
+ */
+static void trx_replay_failed(ROUTER_CLIENT_SES *rses, const char *reason)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+
+    MXS_ERROR("The transaction of session %lu could not be replayed: %s.",
+              rses->client_dcb->session->ses_id, reason);
+    ts_stats_add(rses->router->stats.n_trx_replay_failures, 1);
+
+    trx->replaying = false;
+    trx->replay_sent = false;
+    trx_reset(trx, false);
+    trx_free_stmts(trx->queue);
+    trx->queue = NULL;
+    trx->queue_last = NULL;
+
+    poll_fake_hangup_event(rses->client_dcb);
+}
+
+/**
+ * @brief Check for a new master again after a while
+ *
+ * @param rses Router session
+ */
+static void trx_replay_wait(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_session_timer_arm(rses, &rses->rses_trx.timer, TRX_REPLAY_RETRY_TICKS);
+}
+
+static void trx_replay_timer_cb(MXS_TIMER *timer, void *data)
+{
+    ROUTER_CLIENT_SES *rses = (ROUTER_CLIENT_SES *)data;
+    MXS_SESSION *session = rwsplit_session_timer_fire(rses, &rses->rses_trx.timer,
+                                                      false, TRX_REPLAY_RETRY_TICKS);
+
+    if (session)
+    {
+        if (!rses->rses_closed && rses->rses_trx.replaying)
+        {
+            trx_replay_continue(rses);
+        }
+
+        session_put_ref(session);
+    }
+}
+
+/**
+ * @brief Write a statement to the master
+ *
+ * @param rses   Router session
+ * @param master The master
+ * @param stmt   The statement
+ *
+ * @return True if the statement was written
+ */
+static bool trx_write_stmt(ROUTER_CLIENT_SES *rses, backend_ref_t *master, rwsplit_trx_stmt_t *stmt)
+{
+    if (master->bref_dcb->func.write(master->bref_dcb, gwbuf_clone(stmt->stmt)) != 1)
+    {
+        return false;
+    }
+
+    atomic_add_uint64(&rses->router->stats.n_queries, 1);
+    atomic_add_uint64(&rses->router->stats.n_master, 1);
+    bref_set_state(master, BREF_QUERY_ACTIVE);
+    bref_set_state(master, BREF_WAITING_RESULT);
+    count_pipelined_queries(rses, master, stmt->stmt);
+
+    return true;
+}
+
+/**
+ * @brief Route the statements that the client sent during the replay
+ *
+ * @param rses Router session
+ */
+static void trx_route_queued(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_trx_stmt_t *queued = rses->rses_trx.queue;
+    rses->rses_trx.queue = NULL;
+    rses->rses_trx.queue_last = NULL;
+
+    for (rwsplit_trx_stmt_t *stmt = queued; stmt && !rses->rses_closed; stmt = stmt->next)
+    {
+        bool routed = GWBUF_IS_TYPE_CONTINUATION(stmt->stmt) ?
+                      route_continuation(rses, stmt->stmt) :
+                      route_single_stmt(rses->router, rses, stmt->stmt);
+
+        if (!routed)
+        {
+            MXS_ERROR("Failed to route a statement that was received during the "
+                      "replay of a transaction.");
+            poll_fake_hangup_event(rses->client_dcb);
+            break;
+        }
+    }
+
+    uncork_pipelined_backend(rses);
+    trx_free_stmts(queued);
+}
+
+void trx_init(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_session_timer_init(&rses->rses_trx.timer, trx_replay_timer_cb, rses);
+    rses->rses_trx.replayable = true;
+}
+
+void trx_finish(ROUTER_CLIENT_SES *rses)
+{
+    ss_dassert(rses->rses_trx.timer.session == NULL);
+    trx_reset(&rses->rses_trx, false);
+    trx_free_stmts(rses->rses_trx.queue);
+    rses->rses_trx.queue = NULL;
+    rses->rses_trx.queue_last = NULL;
+}
+
+void trx_record_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf, backend_ref_t *bref)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+    MXS_SESSION *session = rses->client_dcb->session;
+
+    if (!session_trx_is_active(session) || session_trx_is_ending(session))
+    {
+        /** A COMMIT or a ROLLBACK is not stored, the outcome of a COMMIT that
+         * was sent to the failed master is not known */
+        if (trx->stmts || !trx->replayable)
+        {
+            trx_reset(trx, true);
+        }
+    }
+    else if (trx->replayable)
+    {
+        size_t len = gwbuf_length(querybuf);
+        rwsplit_trx_stmt_t *stmt = NULL;
+
+        if (bref && bref == rses->rses_master_ref && !rses->rses_load_active &&
+            len > MYSQL_HEADER_LEN && MYSQL_GET_COMMAND(GWBUF_DATA(querybuf)) == MYSQL_COM_QUERY &&
+            MYSQL_GET_PAYLOAD_LEN(GWBUF_DATA(querybuf)) < GW_MYSQL_MAX_PACKET_LEN &&
+            trx->size + len <= rses->rses_config.transaction_replay_max_size &&
+            (trx->reply || bref->bref_reply_count <= 1) &&
+            (stmt = (rwsplit_trx_stmt_t *)MXS_CALLOC(1, sizeof(*stmt))))
+        {
+            stmt->stmt = gwbuf_clone(querybuf);
+
+            if (trx->last)
+            {
+                trx->last->next = stmt;
+            }
+            else
+            {
+                trx->stmts = stmt;
+            }
+
+            trx->last = stmt;
+            trx->size += len;
+
+            if (trx->reply == NULL)
+            {
+                /** Without pipelining, the master has sent all of the earlier replies */
+                trx->reply = stmt;
+                bref->bref_reply_state = MYSQL_REPLY_STATE_START;
+            }
+        }
+        else
+        {
+            /** Statements routed elsewhere, session commands, LOAD DATA LOCAL INFILE,
+             * statements that do not fit in one packet and transactions that are
+             * too large are not replayed */
+            MXS_INFO("The transaction of session %lu will not be replayed if the master fails.",
+                     session->ses_id);
+            trx_reset(trx, false);
+        }
+    }
+}
+
+bool trx_is_tracked(ROUTER_CLIENT_SES *rses, backend_ref_t *bref)
+{
+    return rses->rses_trx.reply && bref == rses->rses_master_ref;
+}
+
+GWBUF *trx_process_reply(ROUTER_CLIENT_SES *rses, backend_ref_t *bref, GWBUF *packet, bool *complete)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+    rwsplit_trx_stmt_t *stmt = trx->reply;
+
+    trx_checksum_packet(trx, bref->bref_reply_state, packet);
+    *complete = reply_is_complete(bref, packet);
+
+    if (stmt->replied)
+    {
+        /** A reply to a replayed statement, the client already has it */
+        ss_dassert(trx->replaying);
+        gwbuf_free(packet);
+        packet = NULL;
+
+        if (*complete)
+        {
+            trx->replay_sent = false;
+
+            if (memcmp(&stmt->checksum, &trx->reply_sum, sizeof(trx->reply_sum)) != 0)
+            {
+                trx_replay_failed(rses, "the new master returned a different result");
+                return NULL;
+            }
+        }
+    }
+    else
+    {
+        trx->reply_packets++;
+
+        if (*complete)
+        {
+            stmt->checksum = trx->reply_sum;
+            stmt->replied = true;
+        }
+    }
+
+    if (*complete)
+    {
+        trx->reply = stmt->next;
+        trx->reply_packets = 0;
+        memset(&trx->reply_sum, 0, sizeof(trx->reply_sum));
+    }
+
+    return packet;
+}
+
+bool trx_can_replay(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+    MXS_SESSION *session = rses->client_dcb->session;
+
+    /** A reply that the client has partly received can't be replayed */
+    return rses->rses_config.transaction_replay && trx->replayable && trx->stmts &&
+           trx->reply_packets == 0 && session_trx_is_active(session) &&
+           !session_trx_is_ending(session);
+}
+
+void trx_start_replay(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+    ss_dassert(trx_can_replay(rses));
+
+    if (!trx->replaying)
+    {
+        trx->replaying = true;
+        trx->replay_start = rwsplit_clock_us();
+    }
+
+    MXS_INFO("The master of session %lu failed, its transaction is replayed on the new master.",
+             rses->client_dcb->session->ses_id);
+
+    trx->replay_deadline = hkheartbeat + rses->rses_config.transaction_replay_timeout * 10;
+    trx->reply = trx->stmts;
+    trx->reply_packets = 0;
+    memset(&trx->reply_sum, 0, sizeof(trx->reply_sum));
+    trx->replay_sent = false;
+
+    trx_replay_continue(rses);
+}
+
+void trx_replay_continue(ROUTER_CLIENT_SES *rses)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+    backend_ref_t *master = rses->rses_master_ref;
+
+    if (!trx->replaying || trx->replay_sent)
+    {
+        return;
+    }
+
+    if (master == NULL || !BREF_IS_IN_USE(master))
+    {
+        if ((master = connect_new_master(rses)))
+        {
+            MXS_INFO("Replaying the transaction of session %lu on '%s'.",
+                     rses->client_dcb->session->ses_id, master->ref->server->unique_name);
+            rses->rses_master_ref = master;
+            master->bref_reply_state = MYSQL_REPLY_STATE_START;
+        }
+    }
+
+    if (master == NULL || !BREF_IS_IN_USE(master) || BREF_IS_QUERY_ACTIVE(master) ||
+        sescmd_cursor_is_active(&master->bref_sescmd_cur))
+    {
+        /** No master yet or it is still executing the session command history */
+        if (hkheartbeat < trx->replay_deadline)
+        {
+            trx_replay_wait(rses);
+        }
+        else
+        {
+            trx_replay_failed(rses, "no new master was available in time");
+        }
+        return;
+    }
+
+    if (trx->reply && trx->reply->replied)
+    {
+        /** The statements whose replies the client has are replayed one at a time */
+        if (trx_write_stmt(rses, master, trx->reply))
+        {
+            trx->replay_sent = true;
+        }
+        else
+        {
+            trx_replay_failed(rses, "the statement could not be written to the new master");
+        }
+        return;
+    }
+
+    /** The client is still waiting for the replies to the rest of the statements */
+    for (rwsplit_trx_stmt_t *stmt = trx->reply; stmt; stmt = stmt->next)
+    {
+        if (!trx_write_stmt(rses, master, stmt))
+        {
+            trx_replay_failed(rses, "the statement could not be written to the new master");
+            return;
+        }
+    }
+
+    uint64_t elapsed = rwsplit_clock_us() - trx->replay_start;
+    trx->replaying = false;
+    ts_stats_add(rses->router->stats.n_trx_replays, 1);
+    ts_stats_add(rses->router->stats.trx_replay_us, elapsed);
+
+    MXS_NOTICE("Replayed the transaction of session %lu on '%s' in %.3f seconds.",
+               rses->client_dcb->session->ses_id, master->ref->server->unique_name,
+               elapsed / 1000000.0);
+
+    trx_route_queued(rses);
+}
+
+bool trx_queue_stmt(ROUTER_CLIENT_SES *rses, GWBUF *querybuf)
+{
+    rwsplit_trx_t *trx = &rses->rses_trx;
+    rwsplit_trx_stmt_t *stmt = (rwsplit_trx_stmt_t *)MXS_CALLOC(1, sizeof(*stmt));
+
+    if (stmt)
+    {
+        stmt->stmt = querybuf;
+
+        if (trx->queue_last)
+        {
+            trx->queue_last->next = stmt;
+        }
+        else
+        {
+            trx->queue = stmt;
+        }
+
+        trx->queue_last = stmt;
+    }
+
+    return stmt != NULL;
+}
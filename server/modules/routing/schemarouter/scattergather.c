@@ -0,0 +1,719 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file scattergather.c  Merging of the results of a query sent to all shards
+ */
+
+#include "scattergather.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <maxscale/alloc.h>
+#include <maxscale/log_manager.h>
+#include <maxscale/modutil.h>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/protocol/mysql.h>
+#include <maxscale/replyparser.h>
+
+/** The ORDER BY keys that are used in the merge */
+#define SG_MAX_KEYS 8
+
+/** Length of the name of an ORDER BY column */
+#define SG_KEY_NAME_LEN 65
+
+/** Values longer than this are never compared as numbers */
+#define SG_NUMBER_LEN 64
+
+#define SG_PACKET_LEN(ptr) (MYSQL_HEADER_LEN + gw_mysql_get_byte3(ptr))
+
+typedef struct sg_key
+{
+    char name[SG_KEY_NAME_LEN]; /*< Name of the column, empty if given by position */
+    int  column;                /*< Index of the column, -1 if not resolved */
+    bool desc;                  /*< Descending order */
+} SG_KEY;
+
+typedef struct sg_target
+{
+    int              id;       /*< Identifier of the server */
+    GWBUF           *reply;    /*< The reply received so far */
+    MXS_REPLY_PARSER parser;   /*< Finds the end of the reply */
+    size_t           offset;   /*< The first packet not parsed */
+    bool             done;     /*< The reply is complete */
+    bool             failed;   /*< The reply is an error generated by the router */
+    uint8_t         *row;      /*< The next row to merge */
+    uint8_t         *rows_end; /*< The packet that ends the rows */
+} SG_TARGET;
+
+struct scatter_gather
+{
+    SG_TARGET *targets;
+    int        n_targets;
+    int        n_pending;         /*< Targets whose reply is not complete */
+    SG_KEY     keys[SG_MAX_KEYS]; /*< The ORDER BY keys */
+    int        n_keys;
+    int64_t    limit;             /*< The LIMIT or -1 for no limit */
+};
+
+/** Only the end of the reply is needed */
+static const MXS_REPLY_CB sg_reply_cb = { NULL };
+
+static bool is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+static size_t skip_whitespace(const char* sql, size_t len, size_t pos)
+{
+    while (pos < len && isspace((unsigned char)sql[pos]))
+    {
+        pos++;
+    }
+
+    return pos;
+}
+
+/**
+ * Check if a keyword starts at a position
+ */
+static bool is_keyword_at(const char* sql, size_t len, size_t pos, const char* keyword)
+{
+    size_t kwlen = strlen(keyword);
+
+    return pos + kwlen <= len && strncasecmp(sql + pos, keyword, kwlen) == 0 &&
+           (pos == 0 || !is_ident_char(sql[pos - 1])) &&
+           (pos + kwlen == len || !is_ident_char(sql[pos + kwlen]));
+}
+
+/**
+ * Find the last keyword that is not in a subquery, a string or a quoted identifier
+ *
+ * @return The position of the keyword or -1 if it was not found
+ */
+static ssize_t find_last_keyword(const char* sql, size_t len, const char* keyword)
+{
+    ssize_t rval = -1;
+    int depth = 0;
+    char quote = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = sql[i];
+
+        if (quote)
+        {
+            if (c == '\\' && quote != '`')
+            {
+                i++;
+            }
+            else if (c == quote)
+            {
+                quote = 0;
+            }
+        }
+        else if (c == '\'' || c == '"' || c == '`')
+        {
+            quote = c;
+        }
+        else if (c == '(')
+        {
+            depth++;
+        }
+        else if (c == ')')
+        {
+            depth--;
+        }
+        else if (depth == 0 && is_keyword_at(sql, len, i, keyword))
+        {
+            rval = i;
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Parse the ORDER BY keys that are columns or column positions. The keys
+ * after the first expression are not used.
+ */
+static void parse_order_by(SCATTER_GATHER* sg, const char* sql, size_t len)
+{
+    ssize_t pos = find_last_keyword(sql, len, "ORDER");
+
+    if (pos < 0)
+    {
+        return;
+    }
+
+    size_t i = skip_whitespace(sql, len, pos + strlen("ORDER"));
+
+    if (!is_keyword_at(sql, len, i, "BY"))
+    {
+        return;
+    }
+
+    i += strlen("BY");
+
+    while (sg->n_keys < SG_MAX_KEYS)
+    {
+        SG_KEY* key = &sg->keys[sg->n_keys];
+        size_t name_len = 0;
+
+        i = skip_whitespace(sql, len, i);
+
+        while (i < len)
+        {
+            if (sql[i] == '`')
+            {
+                for (i++; i < len && sql[i] != '`'; i++)
+                {
+                    if (name_len < sizeof(key->name) - 1)
+                    {
+                        key->name[name_len++] = sql[i];
+                    }
+                }
+                i++;
+            }
+            else if (sql[i] == '.')
+            {
+                /** Only the column name is compared to the result */
+                name_len = 0;
+                i++;
+            }
+            else if (is_ident_char(sql[i]))
+            {
+                if (name_len < sizeof(key->name) - 1)
+                {
+                    key->name[name_len++] = sql[i];
+                }
+                i++;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        key->name[name_len] = '\0';
+        i = skip_whitespace(sql, len, i);
+        key->desc = false;
+
+        if (is_keyword_at(sql, len, i, "ASC"))
+        {
+            i = skip_whitespace(sql, len, i + strlen("ASC"));
+        }
+        else if (is_keyword_at(sql, len, i, "DESC"))
+        {
+            key->desc = true;
+            i = skip_whitespace(sql, len, i + strlen("DESC"));
+        }
+
+        bool last = i == len || sql[i] == ';' || is_keyword_at(sql, len, i, "LIMIT");
+
+        if (name_len == 0 || (!last && sql[i] != ','))
+        {
+            /** An expression */
+            break;
+        }
+
+        if (isdigit((unsigned char)key->name[0]))
+        {
+            key->column = atoi(key->name) - 1;
+            key->name[0] = '\0';
+        }
+        else
+        {
+            key->column = -1;
+        }
+
+        sg->n_keys++;
+
+        if (last)
+        {
+            break;
+        }
+
+        i++;
+    }
+}
+
+/**
+ * Parse a LIMIT without an offset. With an offset, each server has already
+ * skipped its own rows and the merged rows would not be correct, so the
+ * rows are not limited.
+ */
+static void parse_limit(SCATTER_GATHER* sg, const char* sql, size_t len)
+{
+    ssize_t pos = find_last_keyword(sql, len, "LIMIT");
+
+    if (pos < 0)
+    {
+        return;
+    }
+
+    size_t i = skip_whitespace(sql, len, pos + strlen("LIMIT"));
+    int64_t limit = 0;
+    size_t start = i;
+
+    while (i < len && isdigit((unsigned char)sql[i]))
+    {
+        limit = limit * 10 + sql[i] - '0';
+        i++;
+    }
+
+    i = skip_whitespace(sql, len, i);
+
+    if (i == start)
+    {
+        return;
+    }
+    else if (i < len && (sql[i] == ',' || is_keyword_at(sql, len, i, "OFFSET")))
+    {
+        MXS_INFO("LIMIT with an offset is applied by each server, the merged rows are not limited.");
+    }
+    else
+    {
+        sg->limit = limit;
+    }
+}
+
+SCATTER_GATHER* sg_create(const char* sql, size_t len, const int* targets, int n_targets)
+{
+    SCATTER_GATHER* sg = (SCATTER_GATHER*)MXS_CALLOC(1, sizeof(SCATTER_GATHER));
+
+    if (sg && (sg->targets = (SG_TARGET*)MXS_CALLOC(n_targets, sizeof(SG_TARGET))) == NULL)
+    {
+        MXS_FREE(sg);
+        sg = NULL;
+    }
+
+    if (sg)
+    {
+        sg->n_targets = n_targets;
+        sg->n_pending = n_targets;
+        sg->limit = -1;
+
+        for (int i = 0; i < n_targets; i++)
+        {
+            sg->targets[i].id = targets[i];
+            mxs_reply_parser_init(&sg->targets[i].parser, &sg_reply_cb, NULL, false);
+        }
+
+        parse_order_by(sg, sql, len);
+        parse_limit(sg, sql, len);
+    }
+
+    return sg;
+}
+
+void sg_free(SCATTER_GATHER* sg)
+{
+    if (sg)
+    {
+        for (int i = 0; i < sg->n_targets; i++)
+        {
+            gwbuf_free(sg->targets[i].reply);
+            mxs_reply_parser_free(&sg->targets[i].parser);
+        }
+
+        MXS_FREE(sg->targets);
+        MXS_FREE(sg);
+    }
+}
+
+static SG_TARGET* find_target(const SCATTER_GATHER* sg, int target)
+{
+    for (int i = 0; i < sg->n_targets; i++)
+    {
+        if (sg->targets[i].id == target)
+        {
+            return &sg->targets[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool sg_is_pending(const SCATTER_GATHER* sg, int target)
+{
+    SG_TARGET* t = find_target(sg, target);
+    return t && !t->done;
+}
+
+bool sg_add_reply(SCATTER_GATHER* sg, int target, GWBUF* reply)
+{
+    SG_TARGET* t = find_target(sg, target);
+
+    if (t == NULL || t->done)
+    {
+        gwbuf_free(reply);
+        return false;
+    }
+
+    t->reply = gwbuf_append(t->reply, reply);
+    mxs_reply_state_t state = mxs_reply_parser_process(&t->parser, t->reply, &t->offset);
+
+    if (state == MXS_REPLY_DONE || state == MXS_REPLY_ERROR)
+    {
+        t->done = true;
+        sg->n_pending--;
+    }
+
+    return t->done;
+}
+
+void sg_set_failed(SCATTER_GATHER* sg, int target, GWBUF* error)
+{
+    SG_TARGET* t = find_target(sg, target);
+
+    if (t)
+    {
+        gwbuf_free(t->reply);
+        t->reply = gwbuf_clone(error);
+        t->failed = true;
+
+        if (!t->done)
+        {
+            t->done = true;
+            sg->n_pending--;
+        }
+    }
+}
+
+bool sg_is_done(const SCATTER_GATHER* sg)
+{
+    return sg->n_pending == 0;
+}
+
+/**
+ * Get the name of a column from its definition
+ */
+static void field_name(const uint8_t* packet, char* name, size_t size)
+{
+    const uint8_t* ptr = packet + MYSQL_HEADER_LEN;
+    const uint8_t* end = packet + SG_PACKET_LEN(packet);
+
+    /** Skip the catalog, the schema, the table and the original table */
+    for (int i = 0; i < 4 && ptr < end; i++)
+    {
+        uint64_t len = mxs_leint_value(ptr);
+        ptr += mxs_leint_bytes(ptr) + len;
+    }
+
+    name[0] = '\0';
+
+    if (ptr < end)
+    {
+        uint64_t len = mxs_leint_value(ptr);
+        ptr += mxs_leint_bytes(ptr);
+
+        if (ptr + len <= end)
+        {
+            len = MXS_MIN(len, size - 1);
+            memcpy(name, ptr, len);
+            name[len] = '\0';
+        }
+    }
+}
+
+/**
+ * Get a value of a text protocol row
+ *
+ * @return False if the value is NULL
+ */
+static bool row_value(const uint8_t* packet, int column, const uint8_t** value, size_t* len)
+{
+    const uint8_t* ptr = packet + MYSQL_HEADER_LEN;
+    const uint8_t* end = packet + SG_PACKET_LEN(packet);
+
+    for (int i = 0; ptr < end; i++)
+    {
+        if (*ptr == 0xfb)
+        {
+            if (i == column)
+            {
+                return false;
+            }
+            ptr++;
+        }
+        else
+        {
+            uint64_t n = mxs_leint_value(ptr);
+            ptr += mxs_leint_bytes(ptr);
+
+            if (i == column)
+            {
+                *value = ptr;
+                *len = ptr + n <= end ? n : end - ptr;
+                return true;
+            }
+            ptr += n;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Compare two values as numbers if both are numbers and otherwise as
+ * case-insensitive strings
+ */
+static int compare_values(const uint8_t* a, size_t alen, const uint8_t* b, size_t blen)
+{
+    if (alen > 0 && blen > 0 && alen <= SG_NUMBER_LEN && blen <= SG_NUMBER_LEN)
+    {
+        char abuf[SG_NUMBER_LEN + 1];
+        char bbuf[SG_NUMBER_LEN + 1];
+        char *aend, *bend;
+
+        memcpy(abuf, a, alen);
+        abuf[alen] = '\0';
+        memcpy(bbuf, b, blen);
+        bbuf[blen] = '\0';
+
+        double da = strtod(abuf, &aend);
+        double db = strtod(bbuf, &bend);
+
+        if (*aend == '\0' && *bend == '\0')
+        {
+            return (da > db) - (da < db);
+        }
+    }
+
+    size_t len = MXS_MIN(alen, blen);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        int rc = tolower(a[i]) - tolower(b[i]);
+
+        if (rc)
+        {
+            return rc;
+        }
+    }
+
+    return (alen > blen) - (alen < blen);
+}
+
+/**
+ * Compare two rows by the ORDER BY keys, NULL is the smallest value
+ */
+static int compare_rows(const SCATTER_GATHER* sg, const uint8_t* a, const uint8_t* b)
+{
+    for (int i = 0; i < sg->n_keys; i++)
+    {
+        const uint8_t *va, *vb;
+        size_t alen, blen;
+        bool a_set = row_value(a, sg->keys[i].column, &va, &alen);
+        bool b_set = row_value(b, sg->keys[i].column, &vb, &blen);
+        int rc;
+
+        if (a_set && b_set)
+        {
+            rc = compare_values(va, alen, vb, blen);
+        }
+        else
+        {
+            rc = a_set - b_set;
+        }
+
+        if (rc)
+        {
+            return sg->keys[i].desc ? -rc : rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find the rows of a result set
+ *
+ * @param t         The target, its reply must be a complete result set
+ * @param n_columns Number of columns in the result set
+ * @return Pointer to the first row
+ */
+static uint8_t* find_rows(SG_TARGET* t, uint64_t* n_columns)
+{
+    uint8_t* ptr = GWBUF_DATA(t->reply);
+    uint8_t* end = ptr + GWBUF_LENGTH(t->reply);
+
+    *n_columns = mxs_leint_value(ptr + MYSQL_HEADER_LEN);
+
+    /** The column count, the definitions and the EOF */
+    for (uint64_t i = 0; i < *n_columns + 2 && ptr < end; i++)
+    {
+        ptr += SG_PACKET_LEN(ptr);
+    }
+
+    uint8_t* rows = ptr;
+
+    while (ptr < end && !(ptr[MYSQL_HEADER_LEN] == 0xfe &&
+                          gw_mysql_get_byte3(ptr) < MYSQL_EOF_PACKET_LEN))
+    {
+        ptr += SG_PACKET_LEN(ptr);
+    }
+
+    t->row = rows;
+    t->rows_end = ptr;
+    return rows;
+}
+
+/**
+ * Resolve the ORDER BY columns. The keys after the first one that is not in
+ * the result are not used.
+ */
+static void resolve_keys(SCATTER_GATHER* sg, const uint8_t* fields, uint64_t n_columns)
+{
+    for (int i = 0; i < sg->n_keys; i++)
+    {
+        if (sg->keys[i].column == -1)
+        {
+            const uint8_t* ptr = fields;
+
+            for (uint64_t j = 0; j < n_columns; j++)
+            {
+                char name[SG_KEY_NAME_LEN];
+                field_name(ptr, name, sizeof(name));
+
+                if (strcasecmp(name, sg->keys[i].name) == 0)
+                {
+                    sg->keys[i].column = j;
+                    break;
+                }
+                ptr += SG_PACKET_LEN(ptr);
+            }
+        }
+
+        if (sg->keys[i].column < 0 || sg->keys[i].column >= (int)n_columns)
+        {
+            MXS_INFO("ORDER BY key '%s' is not in the result, merging by %d keys.",
+                     sg->keys[i].name, i);
+            sg->n_keys = i;
+            break;
+        }
+    }
+}
+
+GWBUF* sg_merge(SCATTER_GATHER* sg)
+{
+    size_t total = 0;
+
+    for (int i = 0; i < sg->n_targets; i++)
+    {
+        SG_TARGET* t = &sg->targets[i];
+        ss_dassert(t->done);
+
+        if (t->reply == NULL || (!t->failed && t->parser.state != MXS_REPLY_DONE))
+        {
+            return modutil_create_mysql_err_msg(1, 0, SG_ERR, SG_ERRSTR,
+                                                "Malformed reply from a server.");
+        }
+
+        t->reply = gwbuf_make_contiguous(t->reply);
+
+        if (t->failed || MYSQL_IS_ERROR_PACKET(GWBUF_DATA(t->reply)))
+        {
+            return gwbuf_clone(t->reply);
+        }
+
+        total += GWBUF_LENGTH(t->reply);
+    }
+
+    for (int i = 0; i < sg->n_targets; i++)
+    {
+        uint8_t cmd = ((uint8_t*)GWBUF_DATA(sg->targets[i].reply))[MYSQL_HEADER_LEN];
+
+        if (cmd == 0x00 || cmd == 0xfb || sg->targets[i].parser.n_results > 1)
+        {
+            MXS_INFO("The replies are not single result sets, returning the first one.");
+            return gwbuf_clone(sg->targets[0].reply);
+        }
+    }
+
+    uint64_t n_columns;
+    uint8_t* header = GWBUF_DATA(sg->targets[0].reply);
+    uint8_t* rows = find_rows(&sg->targets[0], &n_columns);
+
+    for (int i = 1; i < sg->n_targets; i++)
+    {
+        uint64_t n;
+        find_rows(&sg->targets[i], &n);
+
+        if (n != n_columns)
+        {
+            return modutil_create_mysql_err_msg(1, 0, SG_ERR, SG_ERRSTR,
+                                                "The servers returned different columns.");
+        }
+    }
+
+    /** The definitions start after the column count */
+    resolve_keys(sg, header + SG_PACKET_LEN(header), n_columns);
+
+    GWBUF* rval = gwbuf_alloc(total);
+
+    if (rval == NULL)
+    {
+        return NULL;
+    }
+
+    uint8_t* ptr = GWBUF_DATA(rval);
+    memcpy(ptr, header, rows - header);
+    ptr += rows - header;
+
+    for (int64_t n = 0; sg->limit < 0 || n < sg->limit; n++)
+    {
+        SG_TARGET* next = NULL;
+
+        for (int i = 0; i < sg->n_targets; i++)
+        {
+            SG_TARGET* t = &sg->targets[i];
+
+            if (t->row < t->rows_end &&
+                (next == NULL || (sg->n_keys > 0 && compare_rows(sg, t->row, next->row) < 0)))
+            {
+                next = t;
+            }
+        }
+
+        if (next == NULL)
+        {
+            break;
+        }
+
+        size_t len = SG_PACKET_LEN(next->row);
+        memcpy(ptr, next->row, len);
+        ptr += len;
+        next->row += len;
+    }
+
+    /** The EOF of the first server ends the rows */
+    size_t eof_len = SG_PACKET_LEN(sg->targets[0].rows_end);
+    memcpy(ptr, sg->targets[0].rows_end, eof_len);
+    ptr += eof_len;
+
+    size_t used = ptr - (uint8_t*)GWBUF_DATA(rval);
+    rval = gwbuf_rtrim(rval, total - used);
+
+    /** Number the packets again */
+    uint8_t seq = 1;
+
+    for (ptr = GWBUF_DATA(rval); ptr < (uint8_t*)GWBUF_DATA(rval) + used; ptr += SG_PACKET_LEN(ptr))
+    {
+        ptr[3] = seq++;
+    }
+
+    return rval;
+}
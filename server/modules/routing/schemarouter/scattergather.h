@@ -0,0 +1,109 @@
+#pragma once
+#ifndef _SCATTERGATHER_H
+#define _SCATTERGATHER_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl11.
+ *
+ * Change Date: 2019-07-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file scattergather.h  Merging of the results of a query sent to all shards
+ *
+ * The query is sent to all servers at the same time and the replies are
+ * collected as they arrive. Once every server has replied, the result sets
+ * are merged into one. If the query has an ORDER BY, the rows of each server
+ * are already in that order and they are merged in order. A LIMIT is applied
+ * to the merged rows.
+ */
+
+#include <maxscale/cdefs.h>
+#include <maxscale/buffer.h>
+
+MXS_BEGIN_DECLS
+
+/** The error sent when the results can't be merged */
+#define SG_ERR 5002
+#define SG_ERRSTR "HY000"
+
+typedef struct scatter_gather SCATTER_GATHER;
+
+/**
+ * @brief Create the state of a query sent to several servers
+ *
+ * @param sql       The SQL of the query, used for the ORDER BY and LIMIT.
+ * @param len       Length of the SQL.
+ * @param targets   The identifiers of the servers the query is sent to.
+ * @param n_targets Number of servers.
+ *
+ * @return The new state or NULL if memory allocation failed.
+ */
+SCATTER_GATHER* sg_create(const char* sql, size_t len, const int* targets, int n_targets);
+
+/**
+ * @brief Free the state and the replies that have been collected
+ *
+ * @param sg The state, may be NULL.
+ */
+void sg_free(SCATTER_GATHER* sg);
+
+/**
+ * @brief Check if a reply from a server is expected
+ *
+ * @param sg     The state.
+ * @param target Identifier of the server.
+ *
+ * @return True if the server is one of the targets and its reply is not complete.
+ */
+bool sg_is_pending(const SCATTER_GATHER* sg, int target);
+
+/**
+ * @brief Add a part of the reply of a server
+ *
+ * @param sg     The state.
+ * @param target Identifier of the server.
+ * @param reply  The data, freed by the function.
+ *
+ * @return True if the reply of the server is now complete.
+ */
+bool sg_add_reply(SCATTER_GATHER* sg, int target, GWBUF* reply);
+
+/**
+ * @brief Mark the reply of a server as failed
+ *
+ * @param sg     The state.
+ * @param target Identifier of the server.
+ * @param error  The ERR packet that is sent to the client instead of the result.
+ */
+void sg_set_failed(SCATTER_GATHER* sg, int target, GWBUF* error);
+
+/**
+ * @brief Check if the replies of all servers are complete
+ *
+ * @param sg The state.
+ * @return True if all replies are complete.
+ */
+bool sg_is_done(const SCATTER_GATHER* sg);
+
+/**
+ * @brief Merge the replies
+ *
+ * If any server returned an error, the first error is returned. If the
+ * replies are not single result sets, the reply of the first server is
+ * returned.
+ *
+ * @param sg The state, all replies must be complete.
+ * @return The reply sent to the client or NULL if memory allocation failed.
+ */
+GWBUF* sg_merge(SCATTER_GATHER* sg);
+
+MXS_END_DECLS
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "schemarouter.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <strings.h>
 #include <string.h>
@@ -20,6 +21,7 @@
 #include <stdint.h>
 #include <maxscale/router.h>
 #include "sharding_common.h"
+#include "scattergather.h"
 #include <maxscale/secrets.h>
 #include <mysql.h>
 #include <maxscale/log_manager.h>
@@ -31,16 +33,41 @@
 #include <maxscale/protocol/mysql.h>
 #include <maxscale/alloc.h>
 #include <maxscale/poll.h>
+#include <maxscale/housekeeper.h>
+#include <maxscale/mysql_utils.h>
+#include <maxscale/atomic.h>
+#include <maxscale/paths.h>
+#include <maxscale/utils.h>
 #include <pcre.h>
 
 #define DEFAULT_REFRESH_INTERVAL "300"
 
+/** The query that maps the databases and, with table_sharding, the tables */
+#define SCHEMAROUTER_DATABASES_QUERY "SHOW DATABASES"
+#define SCHEMAROUTER_TABLES_QUERY "SELECT schema_name FROM information_schema.schemata " \
+    "UNION ALL SELECT CONCAT(table_schema, '.', table_name) FROM information_schema.tables " \
+    "WHERE table_schema NOT IN ('mysql', 'information_schema', 'performance_schema')"
+
+#define MAPPING_QUERY(router) ((router)->schemarouter_config.table_sharding ? \
+                               SCHEMAROUTER_TABLES_QUERY : SCHEMAROUTER_DATABASES_QUERY)
+
+/** Where the tables of a query are with table_sharding */
+typedef enum
+{
+    TABLE_TARGET_NONE,  /*< None of the tables are mapped */
+    TABLE_TARGET_ONE,   /*< The mapped tables are on one server */
+    TABLE_TARGET_CROSS  /*< The mapped tables are on more than one server */
+} table_target_t;
+
 /** Size of the hashtable used to store ignored databases */
 #define SCHEMAROUTER_HASHSIZE 100
 
 /** Hashtable size for the per user shard maps */
 #define SCHEMAROUTER_USERHASH_SIZE 10
 
+/** Name of the file in the cache directory of the service where the shard map is persisted */
+#define SHARD_MAP_FILE "shard_map"
+
 /**
  * @file schemarouter.c The entry points for the simple sharding
  * router module.
@@ -105,6 +132,8 @@ static void rses_property_add(ROUTER_CLIENT_SES* rses,
 static void rses_property_done(rses_property_t* prop);
 static mysql_sescmd_t* rses_property_get_sescmd(rses_property_t* prop);
 static bool execute_sescmd_history(backend_ref_t* bref);
+static bool connect_backend(backend_ref_t* bref, MXS_SESSION* session);
+static bool connect_one_backend(ROUTER_CLIENT_SES* rses, MXS_SESSION* session, const char* name);
 static bool execute_sescmd_in_backend(backend_ref_t* backend_ref);
 static void sescmd_cursor_reset(sescmd_cursor_t* scur);
 static bool sescmd_cursor_history_empty(sescmd_cursor_t* scur);
@@ -152,6 +181,7 @@ int inspect_backend_mapping_states(ROUTER_CLIENT_SES *router_cli_ses,
 bool handle_default_db(ROUTER_CLIENT_SES *router_cli_ses);
 void route_queued_query(ROUTER_CLIENT_SES *router_cli_ses);
 void synchronize_shard_map(ROUTER_CLIENT_SES *client);
+static void refresh_shared_shard_map(void *data);
 
 static int hashkeyfun(const void* key)
 {
@@ -199,6 +229,7 @@ shard_map_t* shard_map_alloc()
             spinlock_init(&rval->lock);
             rval->last_updated = 0;
             rval->state = SHMAP_UNINIT;
+            rval->refcount = 0;
         }
         else
         {
@@ -209,6 +240,392 @@ shard_map_t* shard_map_alloc()
     return rval;
 }
 
+static void shard_map_free(shard_map_t *map)
+{
+    hashtable_free(map->hash);
+    MXS_FREE(map);
+}
+
+/**
+ * Release a reference to a shared shard map snapshot
+ *
+ * @param map The snapshot, freed when its last user releases it
+ */
+static void shard_map_release(shard_map_t *map)
+{
+    if (atomic_add(&map->refcount, -1) == 1)
+    {
+        shard_map_free(map);
+    }
+}
+
+/**
+ * Get a reference to the latest shared shard map snapshot
+ *
+ * @param router Router instance
+ * @return The snapshot or NULL if none has been built yet
+ */
+static shard_map_t* shard_map_acquire_shared(ROUTER_INSTANCE *router)
+{
+    spinlock_acquire(&router->lock);
+    shard_map_t *map = router->shared_map;
+
+    if (map)
+    {
+        atomic_add(&map->refcount, 1);
+    }
+
+    spinlock_release(&router->lock);
+    return map;
+}
+
+/**
+ * Add the location of a database to a shard map
+ *
+ * If the database is already in the map and it is one of the ignored
+ * databases, the preferred server is used for it. With table_sharding, the
+ * tables are added as "db.table" and a database may be on more than one
+ * server, in which case only its tables must be unique.
+ *
+ * @param router     Router instance
+ * @param hash       The databases of the shard map
+ * @param db         Name of the database
+ * @param target     Unique name of the server where the database is
+ * @param match_data Match data for the ignore regex
+ * @return False if the database was found on more than one server
+ */
+static bool shard_map_add(ROUTER_INSTANCE *router, HASHTABLE *hash, const char *db,
+                          char *target, pcre2_match_data *match_data)
+{
+    if (hashtable_add(hash, (void*)db, target))
+    {
+        MXS_INFO("<%s, %s>", target, db);
+    }
+    else if (!((router->schemarouter_config.table_sharding && strchr(db, '.') == NULL) ||
+               hashtable_fetch(router->ignored_dbs, (void*)db) ||
+               (router->ignore_regex &&
+                pcre2_match(router->ignore_regex, (PCRE2_SPTR)db,
+                            PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL) >= 0)))
+    {
+        return false;
+    }
+    else if (router->preferred_server &&
+             strcmp(target, router->preferred_server->unique_name) == 0)
+    {
+        /** In conflict situations, use the preferred server */
+        MXS_INFO("Forcing location of '%s' from '%s' to ''%s",
+                 db, (char*)hashtable_fetch(hash, (void*)db), target);
+
+        hashtable_delete(hash, (void*)db);
+        hashtable_add(hash, (void*)db, target);
+    }
+
+    return true;
+}
+
+/**
+ * Ask for the shared shard map to be refreshed soon, for example after
+ * a database has been created or dropped. Only one request is pending at
+ * a time as the housekeeper task names are unique.
+ *
+ * @param router Router instance
+ */
+static void schedule_shard_map_refresh(ROUTER_INSTANCE *router)
+{
+    char name[strlen(router->service->name) + sizeof(" shard map update")];
+    sprintf(name, "%s shard map update", router->service->name);
+    hktask_oneshot(name, refresh_shared_shard_map, router, 1);
+}
+
+/**
+ * Add the databases of one server to a shard map
+ *
+ * @param router     Router instance
+ * @param map        The shard map being built
+ * @param server     The server to query
+ * @param user       The service user
+ * @param password   The decrypted password of the service user
+ * @param match_data Match data for the ignore regex
+ * @return True if the databases of the server were read
+ */
+static bool load_server_databases(ROUTER_INSTANCE *router, shard_map_t *map, SERVER *server,
+                                  const char *user, const char *password,
+                                  pcre2_match_data *match_data)
+{
+    bool rval = false;
+    MYSQL *mysql = mysql_init(NULL);
+
+    if (mysql == NULL)
+    {
+        MXS_ERROR("Failed to initialize the connection to '%s'.", server->unique_name);
+    }
+    else if (mxs_mysql_real_connect(mysql, server, user, password) == NULL)
+    {
+        MXS_ERROR("Failed to connect to '%s' to read its databases: %s",
+                  server->unique_name, mysql_error(mysql));
+    }
+    else if (mysql_query(mysql, MAPPING_QUERY(router)))
+    {
+        MXS_ERROR("Failed to read the databases of '%s': %s",
+                  server->unique_name, mysql_error(mysql));
+    }
+    else
+    {
+        MYSQL_RES *res = mysql_store_result(mysql);
+
+        if (res)
+        {
+            MYSQL_ROW row;
+
+            while ((row = mysql_fetch_row(res)))
+            {
+                if (row[0] && !shard_map_add(router, map->hash, row[0],
+                                             server->unique_name, match_data))
+                {
+                    /** The server that was read first keeps the database */
+                    MXS_ERROR("Database '%s' found on servers '%s' and '%s'.", row[0],
+                              server->unique_name, (char*)hashtable_fetch(map->hash, row[0]));
+                }
+            }
+
+            mysql_free_result(res);
+            rval = true;
+        }
+    }
+
+    if (mysql)
+    {
+        mysql_close(mysql);
+    }
+
+    return rval;
+}
+
+/**
+ * Get the path of the file where the shared shard map is persisted
+ *
+ * @param router Router instance
+ * @param dest   Buffer for the path
+ * @param size   Size of @c dest
+ * @return True if the directory of the file exists
+ */
+static bool get_shard_map_path(ROUTER_INSTANCE *router, char *dest, size_t size)
+{
+    snprintf(dest, size, "%s/%s/", get_cachedir(), router->service->name);
+
+    if (!mxs_mkdir_all(dest, S_IRWXU))
+    {
+        return false;
+    }
+
+    strncat(dest, SHARD_MAP_FILE, size - strlen(dest) - 1);
+    return true;
+}
+
+/**
+ * Persist a shared shard map snapshot for warm_start
+ *
+ * The map is written as one database and server per line to a temporary
+ * file that replaces the previous one, so a crash never leaves a partial map.
+ *
+ * @param router Router instance
+ * @param map    The published snapshot
+ */
+static void shard_map_save(ROUTER_INSTANCE *router, shard_map_t *map)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + sizeof(".tmp")];
+
+    if (!get_shard_map_path(router, path, sizeof(path)))
+    {
+        return;
+    }
+
+    sprintf(tmp, "%s.tmp", path);
+    FILE *file = fopen(tmp, "w");
+    HASHITERATOR *iter = file ? hashtable_iterator(map->hash) : NULL;
+
+    if (iter)
+    {
+        bool ok = true;
+        char *db;
+
+        while (ok && (db = hashtable_next(iter)))
+        {
+            ok = fprintf(file, "%s\t%s\n", db, (char*)hashtable_fetch(map->hash, db)) > 0;
+        }
+
+        hashtable_iterator_free(iter);
+
+        if (fclose(file) == 0 && ok && rename(tmp, path) == 0)
+        {
+            return;
+        }
+    }
+    else if (file)
+    {
+        fclose(file);
+    }
+
+    MXS_ERROR("Failed to persist the shard map of service '%s' to '%s': %d, %s",
+              router->service->name, path, errno, mxs_strerror(errno));
+    unlink(tmp);
+}
+
+/**
+ * Read the shard map that was persisted by the previous run
+ *
+ * The map is not used if it refers to a server that is no longer a part of
+ * the service.
+ *
+ * @param router Router instance
+ * @return The shard map or NULL if none was persisted or it is not valid
+ */
+static shard_map_t* shard_map_load(ROUTER_INSTANCE *router)
+{
+    char path[PATH_MAX];
+    FILE *file;
+
+    if (!get_shard_map_path(router, path, sizeof(path)) || (file = fopen(path, "r")) == NULL)
+    {
+        return NULL;
+    }
+
+    shard_map_t *map = shard_map_alloc();
+    char line[MYSQL_DATABASE_MAXLEN * 2 + MAX_SERVER_NAME_LEN + 3];
+    bool ok = map != NULL;
+
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        char *target = strchr(line, '\t');
+        char *end = strchr(line, '\n');
+        SERVER_REF *ref = NULL;
+
+        if (target && end)
+        {
+            *target++ = '\0';
+            *end = '\0';
+
+            for (ref = router->service->dbref; ref; ref = ref->next)
+            {
+                if (ref->active && strcmp(ref->server->unique_name, target) == 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        ok = ref && hashtable_add(map->hash, line, target);
+    }
+
+    fclose(file);
+
+    if (!ok || hashtable_size(map->hash) == 0)
+    {
+        MXS_WARNING("The persisted shard map of service '%s' in '%s' does not match "
+                    "the servers of the service, it is not used.", router->service->name, path);
+
+        if (map)
+        {
+            shard_map_free(map);
+        }
+
+        return NULL;
+    }
+
+    map->state = SHMAP_READY;
+    map->last_updated = time(NULL);
+    map->refcount = 1;
+    return map;
+}
+
+/**
+ * Build a new shared shard map snapshot and publish it
+ *
+ * The databases are read with the service user from all running servers.
+ * Sessions that already use the previous snapshot keep it until they
+ * close. If any of the servers cannot be read, the previous snapshot is
+ * kept.
+ *
+ * @param data Router instance
+ */
+static void refresh_shared_shard_map(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE*)data;
+    char *user, *password;
+
+    if (!serviceGetUser(router->service, &user, &password) ||
+        (password = decrypt_password(password)) == NULL)
+    {
+        MXS_ERROR("Failed to get the credentials of service '%s' for "
+                  "the shard map.", router->service->name);
+        atomic_add(&router->stats.shmap_refresh_failures, 1);
+        return;
+    }
+
+    shard_map_t *map = shard_map_alloc();
+    pcre2_match_data *match_data = NULL;
+    bool ok = map != NULL;
+
+    if (ok && router->ignore_regex)
+    {
+        /** The match data of the router is used by the worker threads */
+        match_data = pcre2_match_data_create_from_pattern(router->ignore_regex, NULL);
+        ok = match_data != NULL;
+    }
+
+    for (SERVER_REF *ref = router->service->dbref; ok && ref; ref = ref->next)
+    {
+        if (ref->active && SERVER_IS_RUNNING(ref->server))
+        {
+            ok = load_server_databases(router, map, ref->server, user, password, match_data);
+        }
+    }
+
+    if (ok)
+    {
+        map->state = SHMAP_READY;
+        map->last_updated = time(NULL);
+        map->refcount = 1;
+
+        spinlock_acquire(&router->lock);
+        shard_map_t *old = router->shared_map;
+        router->shared_map = map;
+        spinlock_release(&router->lock);
+
+        if (old)
+        {
+            shard_map_release(old);
+        }
+
+        atomic_add(&router->stats.shmap_refreshes, 1);
+        MXS_INFO("Refreshed the shard map of service '%s'.", router->service->name);
+
+        if (router->schemarouter_config.warm_start)
+        {
+            shard_map_save(router, map);
+        }
+    }
+    else
+    {
+        if (map)
+        {
+            shard_map_free(map);
+        }
+
+        atomic_add(&router->stats.shmap_refresh_failures, 1);
+        MXS_WARNING("Failed to refresh the shard map of service '%s', "
+                    "using the previous one.", router->service->name);
+    }
+
+    if (match_data)
+    {
+        pcre2_match_data_free(match_data);
+    }
+
+    MXS_FREE(password);
+}
+
 /**
  * Convert a length encoded string into a C string.
  * @param data Pointer to the first byte of the string
@@ -338,36 +755,15 @@ showdb_response_t parse_showdb_response(ROUTER_CLIENT_SES* rses, backend_ref_t*
 
         if (data)
         {
-            if (hashtable_add(rses->shardmap->hash, data, target))
+            if (!shard_map_add(rses->router, rses->shardmap->hash, data, target,
+                               rses->router->ignore_match_data))
             {
-                MXS_INFO("<%s, %s>", target, data);
-            }
-            else
-            {
-                if (!(hashtable_fetch(rses->router->ignored_dbs, data) ||
-                      (rses->router->ignore_regex &&
-                       pcre2_match(rses->router->ignore_regex, (PCRE2_SPTR)data,
-                                   PCRE2_ZERO_TERMINATED, 0, 0,
-                                   rses->router->ignore_match_data, NULL) >= 0)))
-                {
-                    duplicate_found = true;
-                    MXS_ERROR("Database '%s' found on servers '%s' and '%s' for user %s@%s.",
-                              data, target,
-                              (char*)hashtable_fetch(rses->shardmap->hash, data),
-                              rses->rses_client_dcb->user,
-                              rses->rses_client_dcb->remote);
-                }
-                else if (rses->router->preferred_server &&
-                         strcmp(target, rses->router->preferred_server->unique_name) == 0)
-                {
-                    /** In conflict situations, use the preferred server */
-                    MXS_INFO("Forcing location of '%s' from '%s' to ''%s",
-                             data, (char*)hashtable_fetch(rses->shardmap->hash,
-                                                          data), target);
-
-                    hashtable_delete(rses->shardmap->hash, data);
-                    hashtable_add(rses->shardmap->hash, data, target);
-                }
+                duplicate_found = true;
+                MXS_ERROR("Database '%s' found on servers '%s' and '%s' for user %s@%s.",
+                          data, target,
+                          (char*)hashtable_fetch(rses->shardmap->hash, data),
+                          rses->rses_client_dcb->user,
+                          rses->rses_client_dcb->remote);
             }
             MXS_FREE(data);
         }
@@ -413,7 +809,7 @@ showdb_response_t parse_showdb_response(ROUTER_CLIENT_SES* rses, backend_ref_t*
 int gen_databaselist(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES* session)
 {
     DCB* dcb;
-    const char* query = "SHOW DATABASES";
+    const char* query = MAPPING_QUERY(inst);
     GWBUF *buffer, *clone;
     int i, rval = 0;
     unsigned int len;
@@ -593,6 +989,61 @@ char* get_shard_target_name(ROUTER_INSTANCE* router,
     return rval;
 }
 
+/**
+ * Find the server of the tables of a query with table_sharding
+ *
+ * @param client Client router session
+ * @param buffer Query to inspect
+ * @param target The server of the tables or, on a conflict, the first server
+ * @param other  The second server on a conflict
+ * @return Where the mapped tables of the query are
+ */
+static table_target_t get_table_target(ROUTER_CLIENT_SES* client, GWBUF* buffer,
+                                       char** target, char** other)
+{
+    table_target_t rval = TABLE_TARGET_NONE;
+    int sz = 0;
+    char** tables = qc_get_table_names(buffer, &sz, true);
+
+    *target = NULL;
+
+    for (int i = 0; i < sz; i++)
+    {
+        char name[MYSQL_DATABASE_MAXLEN + strlen(tables[i]) + 2];
+
+        if (strchr(tables[i], '.'))
+        {
+            strcpy(name, tables[i]);
+        }
+        else
+        {
+            sprintf(name, "%s.%s", client->current_db, tables[i]);
+        }
+
+        char* server = (char*)hashtable_fetch(client->shardmap->hash, name);
+
+        if (server && rval != TABLE_TARGET_CROSS)
+        {
+            if (*target == NULL)
+            {
+                *target = server;
+                rval = TABLE_TARGET_ONE;
+                MXS_INFO("Query targets table '%s' on server '%s'", name, server);
+            }
+            else if (strcmp(*target, server) != 0)
+            {
+                *other = server;
+                rval = TABLE_TARGET_CROSS;
+            }
+        }
+
+        MXS_FREE(tables[i]);
+    }
+
+    MXS_FREE(tables);
+    return rval;
+}
+
 /**
  * Check if the backend is still running. If the backend is not running the
  * hashtable is updated with up-to-date values.
@@ -663,6 +1114,11 @@ MXS_MODULE* MXS_CREATE_MODULE()
             {"refresh_interval", MXS_MODULE_PARAM_COUNT, DEFAULT_REFRESH_INTERVAL},
             {"debug", MXS_MODULE_PARAM_BOOL, "false"},
             {"preferred_server", MXS_MODULE_PARAM_SERVER},
+            {"shared_shard_map", MXS_MODULE_PARAM_BOOL, "false"},
+            {"table_sharding", MXS_MODULE_PARAM_BOOL, "false"},
+            {"lazy_connect", MXS_MODULE_PARAM_BOOL, "false"},
+            {"scatter_gather", MXS_MODULE_PARAM_BOOL, "false"},
+            {"warm_start", MXS_MODULE_PARAM_BOOL, "false"},
             {MXS_END_MODULE_PARAMS}
         }
     };
@@ -731,6 +1187,11 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
     router->schemarouter_config.max_sescmd_hist = config_get_integer(conf, "max_sescmd_history");
     router->schemarouter_config.disable_sescmd_hist = config_get_bool(conf, "disable_sescmd_history");
     router->schemarouter_config.debug = config_get_bool(conf, "debug");
+    router->schemarouter_config.shared_shard_map = config_get_bool(conf, "shared_shard_map");
+    router->schemarouter_config.table_sharding = config_get_bool(conf, "table_sharding");
+    router->schemarouter_config.lazy_connect = config_get_bool(conf, "lazy_connect");
+    router->schemarouter_config.scatter_gather = config_get_bool(conf, "scatter_gather");
+    router->schemarouter_config.warm_start = config_get_bool(conf, "warm_start");
     router->preferred_server = config_get_server(conf, "preferred_server");
 
     if ((config_get_param(conf, "auth_all_servers")) == NULL)
@@ -840,11 +1301,36 @@ static MXS_ROUTER* createInstance(SERVICE *service, char **options)
         router->schemarouter_config.max_sescmd_hist = 0;
     }
 
+    if (router->schemarouter_config.lazy_connect && router->schemarouter_config.disable_sescmd_hist)
+    {
+        MXS_WARNING("The session command history is needed to connect to servers on "
+                    "first use. Disabling 'lazy_connect' for service '%s'.", service->name);
+        router->schemarouter_config.lazy_connect = false;
+    }
+
     if (failure)
     {
         MXS_FREE(router);
         router = NULL;
     }
+    else if (router->schemarouter_config.shared_shard_map)
+    {
+        int interval = router->schemarouter_config.refresh_min_interval;
+        char name[strlen(service->name) + sizeof(" shard map refresh")];
+        sprintf(name, "%s shard map refresh", service->name);
+        hktask_add(name, refresh_shared_shard_map, router, interval > 0 ? interval : 1);
+
+        if (router->schemarouter_config.warm_start &&
+            (router->shared_map = shard_map_load(router)))
+        {
+            MXS_NOTICE("Using the persisted shard map of service '%s' with %d databases, "
+                       "the map is refreshed in the background.", service->name,
+                       hashtable_size(router->shared_map->hash));
+        }
+
+        /** Build the first snapshot right away */
+        schedule_shard_map_refresh(router);
+    }
 
     return (MXS_ROUTER *)router;
 }
@@ -924,17 +1410,29 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
     client_rses->rses_mysql_session = (MYSQL_session*)session->client_dcb->data;
     client_rses->rses_client_dcb = (DCB*)session->client_dcb;
 
-    spinlock_acquire(&router->lock);
-
-    shard_map_t *map = hashtable_fetch(router->shard_maps, session->client_dcb->user);
-    enum shard_map_state state;
+    shard_map_t *map = NULL;
+    enum shard_map_state state = SHMAP_UNINIT;
 
-    if (map)
+    if (router->schemarouter_config.shared_shard_map &&
+        (map = shard_map_acquire_shared(router)))
     {
-        state = shard_map_update_state(map, router);
+        /** The snapshot is never modified so it is always ready */
+        client_rses->shardmap_shared = true;
+        state = SHMAP_READY;
     }
+    else
+    {
+        spinlock_acquire(&router->lock);
 
-    spinlock_release(&router->lock);
+        map = hashtable_fetch(router->shard_maps, session->client_dcb->user);
+
+        if (map)
+        {
+            state = shard_map_update_state(map, router);
+        }
+
+        spinlock_release(&router->lock);
+    }
 
     if (map == NULL || state != SHMAP_READY)
     {
@@ -1035,10 +1533,32 @@ static MXS_ROUTER_SESSION* newSession(MXS_ROUTER* router_inst, MXS_SESSION* sess
         MXS_FREE(client_rses);
         return NULL;
     }
-    /**
-     * Connect to all backend servers
-     */
-    succp = connect_backend_servers(backend_ref, router_nservers, session, router);
+    if (router->schemarouter_config.lazy_connect && client_rses->init == INIT_READY)
+    {
+        /**
+         * The databases are already mapped so only one server is needed to
+         * reply to the session commands. The rest are connected on first use.
+         */
+        char target[MYSQL_DATABASE_MAXLEN + 1] = "";
+
+        if (db[0])
+        {
+            /** Start with the server of the database the client connects to */
+            spinlock_acquire(&client_rses->shardmap->lock);
+            char* name = hashtable_fetch(client_rses->shardmap->hash, db);
+            snprintf(target, sizeof(target), "%s", name ? name : "");
+            spinlock_release(&client_rses->shardmap->lock);
+        }
+
+        succp = connect_one_backend(client_rses, session, target[0] ? target : NULL);
+    }
+    else
+    {
+        /**
+         * Connect to all backend servers
+         */
+        succp = connect_backend_servers(backend_ref, router_nservers, session, router);
+    }
 
     rses_end_locked_router_action(client_rses);
 
@@ -1196,6 +1716,12 @@ static void freeSession(MXS_ROUTER* router_instance, MXS_ROUTER_SESSION* router_
      * all the memory and other resources associated
      * to the client session.
      */
+    if (router_cli_ses->shardmap_shared)
+    {
+        shard_map_release(router_cli_ses->shardmap);
+    }
+
+    sg_free(router_cli_ses->sg);
     MXS_FREE(router_cli_ses->rses_backend_ref);
     MXS_FREE(router_cli_ses);
     return;
@@ -1241,14 +1767,26 @@ static bool get_shard_dcb(DCB**              p_dcb,
          * backend must be in use, name must match, and
          * the backend state must be RUNNING
          */
-        if (BREF_IS_IN_USE((&backend_ref[i])) &&
-            (strncasecmp(name, b->server->unique_name, PATH_MAX) == 0) &&
+        if (strncasecmp(name, b->server->unique_name, PATH_MAX) == 0 &&
             SERVER_IS_RUNNING(b->server))
         {
-            *p_dcb = backend_ref[i].bref_dcb;
-            succp = true;
-            ss_dassert(backend_ref[i].bref_dcb->state != DCB_STATE_ZOMBIE);
-            goto return_succp;
+            if (!BREF_IS_IN_USE((&backend_ref[i])) && rses->rses_config.lazy_connect)
+            {
+                /** First use of the server, connect and replay the session commands */
+                if (!connect_backend(&backend_ref[i], rses->rses_client_dcb->session))
+                {
+                    goto return_succp;
+                }
+                atomic_add(&rses->router->stats.n_lazy_connects, 1);
+            }
+
+            if (BREF_IS_IN_USE((&backend_ref[i])))
+            {
+                *p_dcb = backend_ref[i].bref_dcb;
+                succp = true;
+                ss_dassert(backend_ref[i].bref_dcb->state != DCB_STATE_ZOMBIE);
+                goto return_succp;
+            }
         }
     }
 
@@ -1599,6 +2137,11 @@ bool send_database_list(ROUTER_INSTANCE* router, ROUTER_CLIENT_SES* client)
             {
                 char *value = hashtable_fetch(client->shardmap->hash, key);
                 SERVER * server = server_find_by_unique_name(value);
+                if (router->schemarouter_config.table_sharding && strchr(key, '.'))
+                {
+                    /** A table, not a database */
+                    continue;
+                }
                 if (SERVER_IS_RUNNING(server))
                 {
                     strarray.array[i++] = key;
@@ -1621,6 +2164,167 @@ bool send_database_list(ROUTER_INSTANCE* router, ROUTER_CLIENT_SES* client)
     return rval;
 }
 
+/**
+ * Check if a query reads only information_schema and its result is the union
+ * of the results of all servers
+ *
+ * @param client Router client session
+ * @param buffer Query to inspect
+ * @param qtype  Type of the query
+ * @return True if the query is sent to all servers and the results are merged
+ */
+static bool is_scatter_gather_query(ROUTER_CLIENT_SES* client, GWBUF* buffer, qc_query_type_t qtype)
+{
+    if (client->sg || client->rses_transaction_active || !modutil_is_SQL(buffer) ||
+        !qc_query_is_type(qtype, QUERY_TYPE_READ))
+    {
+        return false;
+    }
+
+    int sz = 0;
+    char** tables = qc_get_table_names(buffer, &sz, true);
+    bool rval = sz > 0;
+
+    for (int i = 0; i < sz; i++)
+    {
+        bool qualified = strchr(tables[i], '.') != NULL;
+
+        if ((qualified && strncasecmp(tables[i], "information_schema.",
+                                      strlen("information_schema.")) != 0) ||
+            (!qualified && strcasecmp(client->current_db, "information_schema") != 0))
+        {
+            rval = false;
+        }
+
+        MXS_FREE(tables[i]);
+    }
+
+    MXS_FREE(tables);
+    return rval;
+}
+
+/**
+ * Send a query to all servers at the same time. The replies are merged in
+ * clientReply once every server has replied.
+ *
+ * @param inst     Router instance
+ * @param rses     Router client session
+ * @param querybuf The query
+ * @return True if the query was sent to at least one server
+ */
+static bool route_scatter_gather(ROUTER_INSTANCE* inst, ROUTER_CLIENT_SES* rses, GWBUF* querybuf)
+{
+    if (!rses_begin_locked_router_action(rses))
+    {
+        return false;
+    }
+
+    if (rses->rses_config.lazy_connect)
+    {
+        connect_backend_servers(rses->rses_backend_ref, rses->rses_nbackends,
+                                rses->rses_client_dcb->session, inst);
+    }
+
+    int targets[rses->rses_nbackends];
+    int n_targets = 0;
+
+    for (int i = 0; i < rses->rses_nbackends; i++)
+    {
+        backend_ref_t* bref = &rses->rses_backend_ref[i];
+
+        if (BREF_IS_IN_USE(bref) && !BREF_IS_CLOSED(bref) &&
+            SERVER_IS_RUNNING(bref->bref_backend->server))
+        {
+            targets[n_targets++] = i;
+        }
+    }
+
+    char* sql;
+    int len;
+    bool rval = false;
+
+    if (n_targets > 0 && modutil_extract_SQL(querybuf, &sql, &len) &&
+        (rses->sg = sg_create(sql, len, targets, n_targets)))
+    {
+        for (int i = 0; i < n_targets; i++)
+        {
+            backend_ref_t* bref = &rses->rses_backend_ref[targets[i]];
+
+            if (sescmd_cursor_is_active(&bref->bref_sescmd_cur))
+            {
+                /** Sent once the session commands are done */
+                ss_dassert(bref->bref_pending_cmd == NULL);
+                bref->bref_pending_cmd = gwbuf_clone(querybuf);
+                rval = true;
+            }
+            else if (bref->bref_dcb->func.write(bref->bref_dcb, gwbuf_clone(querybuf)) == 1)
+            {
+                bref_set_state(bref, BREF_QUERY_ACTIVE);
+                bref_set_state(bref, BREF_WAITING_RESULT);
+                rval = true;
+            }
+            else
+            {
+                GWBUF* err = modutil_create_mysql_err_msg(1, 0, SG_ERR, SG_ERRSTR,
+                                                          "Routing the query to a server failed.");
+                sg_set_failed(rses->sg, targets[i], err);
+                gwbuf_free(err);
+            }
+        }
+
+        if (rval)
+        {
+            MXS_INFO("Query sent to %d servers, merging the results.", n_targets);
+            atomic_add(&inst->stats.n_queries, 1);
+            atomic_add(&inst->stats.n_scatter_gather, 1);
+        }
+        else
+        {
+            sg_free(rses->sg);
+            rses->sg = NULL;
+        }
+    }
+
+    rses_end_locked_router_action(rses);
+    return rval;
+}
+
+/**
+ * Replace the result of a server with an error in the query sent to all servers
+ *
+ * This must be called with router lock.
+ *
+ * @param rses   Router client session
+ * @param bref   The server that failed
+ * @param errmsg The error, sent to the client instead of the merged result
+ * @return True if the server was one of the servers whose reply was expected
+ */
+static bool scatter_gather_failed(ROUTER_CLIENT_SES* rses, backend_ref_t* bref, GWBUF* errmsg)
+{
+    if (rses->sg == NULL || !sg_is_pending(rses->sg, bref - rses->rses_backend_ref))
+    {
+        return false;
+    }
+
+    sg_set_failed(rses->sg, bref - rses->rses_backend_ref, errmsg);
+    bref_clear_state(bref, BREF_QUERY_ACTIVE);
+    bref_clear_state(bref, BREF_WAITING_RESULT);
+
+    if (sg_is_done(rses->sg))
+    {
+        GWBUF* merged = sg_merge(rses->sg);
+        sg_free(rses->sg);
+        rses->sg = NULL;
+
+        if (merged)
+        {
+            rses->rses_client_dcb->func.write(rses->rses_client_dcb, merged);
+        }
+    }
+
+    return true;
+}
+
 /**
  * The main routing entry, this is called with every packet that is
  * received and has to be forwarded to the backend database.
@@ -1818,6 +2522,13 @@ static int routeQuery(MXS_ROUTER* instance,
         break;
     } /**< switch by packet type */
 
+    if (inst->schemarouter_config.shared_shard_map &&
+        (packet_type == MYSQL_COM_CREATE_DB || packet_type == MYSQL_COM_DROP_DB ||
+         (op & (QUERY_OP_CREATE | QUERY_OP_DROP))))
+    {
+        /** The statement may add or remove a database */
+        schedule_shard_map_refresh(inst);
+    }
 
     if (MXS_LOG_PRIORITY_IS_ENABLED(LOG_INFO))
     {
@@ -1859,9 +2570,19 @@ static int routeQuery(MXS_ROUTER* instance,
                 difftime(now, router_cli_ses->rses_config.last_refresh) >
                 router_cli_ses->rses_config.refresh_min_interval)
             {
-                spinlock_acquire(&router_cli_ses->shardmap->lock);
-                router_cli_ses->shardmap->state = SHMAP_STALE;
-                spinlock_release(&router_cli_ses->shardmap->lock);
+                if (router_cli_ses->shardmap_shared)
+                {
+                    /** The snapshot is not modified, this session maps the databases itself */
+                    shard_map_release(router_cli_ses->shardmap);
+                    router_cli_ses->shardmap_shared = false;
+                    schedule_shard_map_refresh(inst);
+                }
+                else
+                {
+                    spinlock_acquire(&router_cli_ses->shardmap->lock);
+                    router_cli_ses->shardmap->state = SHMAP_STALE;
+                    spinlock_release(&router_cli_ses->shardmap->lock);
+                }
 
                 rses_begin_locked_router_action(router_cli_ses);
 
@@ -1869,6 +2590,14 @@ static int routeQuery(MXS_ROUTER* instance,
                 router_cli_ses->queue = querybuf;
                 int rc_refresh = 1;
 
+                if (router_cli_ses->rses_config.lazy_connect)
+                {
+                    /** The mapping needs all the servers */
+                    connect_backend_servers(router_cli_ses->rses_backend_ref,
+                                            router_cli_ses->rses_nbackends,
+                                            router_cli_ses->rses_client_dcb->session, inst);
+                }
+
                 if ((router_cli_ses->shardmap = shard_map_alloc()))
                 {
                     gen_databaselist(inst, router_cli_ses);
@@ -1910,6 +2639,17 @@ static int routeQuery(MXS_ROUTER* instance,
         goto retblock;
     }
 
+    if (inst->schemarouter_config.scatter_gather &&
+        is_scatter_gather_query(router_cli_ses, querybuf, qtype))
+    {
+        if (route_scatter_gather(inst, router_cli_ses, querybuf))
+        {
+            ret = 1;
+            goto retblock;
+        }
+        MXS_INFO("Sending the query to all servers failed, routing it to one server.");
+    }
+
     route_target = get_shard_route_target(qtype,
                                           router_cli_ses->rses_transaction_active,
                                           querybuf->hint);
@@ -1943,7 +2683,30 @@ static int routeQuery(MXS_ROUTER* instance,
          * we just want the server to send an error back. */
 
         spinlock_acquire(&router_cli_ses->shardmap->lock);
-        if ((tname = get_shard_target_name(inst, router_cli_ses, querybuf, qtype)) != NULL)
+        table_target_t tables = TABLE_TARGET_NONE;
+        char* other = NULL;
+
+        if (inst->schemarouter_config.table_sharding)
+        {
+            tables = get_table_target(router_cli_ses, querybuf, &tname, &other);
+        }
+
+        if (tables == TABLE_TARGET_CROSS)
+        {
+            char msg[strlen(tname) + strlen(other) + 100];
+            sprintf(msg, "Query targets tables on servers '%s' and '%s'. "
+                    "Cross-shard queries are not supported.", tname, other);
+            spinlock_release(&router_cli_ses->shardmap->lock);
+
+            MXS_INFO("%s", msg);
+            write_error_to_client(router_cli_ses->rses_client_dcb, SCHEMA_ERR_CROSSSHARD,
+                                  SCHEMA_ERRSTR_CROSSSHARD, msg);
+            ret = 1;
+            goto retblock;
+        }
+
+        if (tables == TABLE_TARGET_ONE ||
+            (tname = get_shard_target_name(inst, router_cli_ses, querybuf, qtype)) != NULL)
         {
             bool shard_ok = check_shard_status(inst, tname);
 
@@ -2046,6 +2809,20 @@ static int routeQuery(MXS_ROUTER* instance,
     if (TARGET_IS_ANY(route_target))
     {
         for (int i = 0; i < router_cli_ses->rses_nbackends; i++)
+        {
+            SERVER *server = router_cli_ses->rses_backend_ref[i].bref_backend->server;
+            if (SERVER_IS_RUNNING(server) &&
+                (BREF_IS_IN_USE(&router_cli_ses->rses_backend_ref[i]) ||
+                 !router_cli_ses->rses_config.lazy_connect))
+            {
+                route_target = TARGET_NAMED_SERVER;
+                targetserver = MXS_STRDUP_A(server->unique_name);
+                break;
+            }
+        }
+
+        /** Without a connected server, any running server is connected */
+        for (int i = 0; TARGET_IS_ANY(route_target) && i < router_cli_ses->rses_nbackends; i++)
         {
             SERVER *server = router_cli_ses->rses_backend_ref[i].bref_backend->server;
             if (SERVER_IS_RUNNING(server))
@@ -2255,6 +3032,20 @@ static void diagnostic(MXS_ROUTER *instance, DCB *dcb)
     }
     dcb_printf(dcb, "Shard map cache hits: %d\n", router->stats.shmap_cache_hit);
     dcb_printf(dcb, "Shard map cache misses: %d\n", router->stats.shmap_cache_miss);
+    if (router->schemarouter_config.shared_shard_map)
+    {
+        dcb_printf(dcb, "Shared shard map refreshes: %d\n", router->stats.shmap_refreshes);
+        dcb_printf(dcb, "Failed shared shard map refreshes: %d\n",
+                   router->stats.shmap_refresh_failures);
+    }
+    if (router->schemarouter_config.lazy_connect)
+    {
+        dcb_printf(dcb, "Connections created on first use: %d\n", router->stats.n_lazy_connects);
+    }
+    if (router->schemarouter_config.scatter_gather)
+    {
+        dcb_printf(dcb, "Queries merged from all servers: %d\n", router->stats.n_scatter_gather);
+    }
     dcb_printf(dcb, "\n");
 }
 
@@ -2480,6 +3271,25 @@ static void clientReply(MXS_ROUTER* instance,
      * Clear BREF_QUERY_ACTIVE flag and decrease waiter counter.
      * This applies for queries  other than session commands.
      */
+    else if (router_cli_ses->sg &&
+             sg_is_pending(router_cli_ses->sg, bref - router_cli_ses->rses_backend_ref))
+    {
+        /** A part of a reply to a query sent to all servers */
+        if (sg_add_reply(router_cli_ses->sg, bref - router_cli_ses->rses_backend_ref, writebuf))
+        {
+            bref_clear_state(bref, BREF_QUERY_ACTIVE);
+            bref_clear_state(bref, BREF_WAITING_RESULT);
+        }
+
+        writebuf = NULL;
+
+        if (sg_is_done(router_cli_ses->sg))
+        {
+            writebuf = sg_merge(router_cli_ses->sg);
+            sg_free(router_cli_ses->sg);
+            router_cli_ses->sg = NULL;
+        }
+    }
     else if (BREF_IS_QUERY_ACTIVE(bref))
     {
         bref_clear_state(bref, BREF_QUERY_ACTIVE);
@@ -2549,6 +3359,14 @@ static void clientReply(MXS_ROUTER* instance,
             {
                 MXS_ERROR("Routing query failed.");
             }
+
+            if (router_cli_ses->sg)
+            {
+                GWBUF* err = modutil_create_mysql_err_msg(1, 0, SG_ERR, SG_ERRSTR,
+                                                          "Routing the query to a server failed.");
+                scatter_gather_failed(router_cli_ses, bref, err);
+                gwbuf_free(err);
+            }
         }
         gwbuf_free(bref->bref_pending_cmd);
         bref->bref_pending_cmd = NULL;
@@ -2575,8 +3393,10 @@ int bref_cmp_global_conn(const void* bref1, const void* bref2)
     SERVER_REF* b1 = ((backend_ref_t *)bref1)->bref_backend;
     SERVER_REF* b2 = ((backend_ref_t *)bref2)->bref_backend;
 
-    return ((1000 * b1->server->stats.n_current) / b1->weight)
-           - ((1000 * b2->server->stats.n_current) / b2->weight);
+    int64_t c1 = (1000 * ts_stats_sum(b1->server->stats.n_current)) / b1->weight;
+    int64_t c2 = (1000 * ts_stats_sum(b2->server->stats.n_current)) / b2->weight;
+
+    return (c1 > c2) - (c1 < c2);
 }
 
 
@@ -2595,8 +3415,10 @@ int bref_cmp_current_load(const void* bref1, const void* bref2)
     SERVER_REF* b1 = ((backend_ref_t *)bref1)->bref_backend;
     SERVER_REF* b2 = ((backend_ref_t *)bref2)->bref_backend;
 
-    return ((1000 * b1->server->stats.n_current_ops) - b1->weight)
-           - ((1000 * b2->server->stats.n_current_ops) - b2->weight);
+    int64_t c1 = (1000 * ts_stats_sum(b1->server->stats.n_current_ops)) - b1->weight;
+    int64_t c2 = (1000 * ts_stats_sum(b2->server->stats.n_current_ops)) - b2->weight;
+
+    return (c1 > c2) - (c1 < c2);
 }
 
 static void bref_clear_state(backend_ref_t* bref, bref_state_t state)
@@ -2613,7 +3435,6 @@ static void bref_clear_state(backend_ref_t* bref, bref_state_t state)
     else
     {
         int prev1;
-        int prev2;
 
         /** Decrease waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, -1);
@@ -2625,15 +3446,7 @@ static void bref_clear_state(backend_ref_t* bref, bref_state_t state)
         else
         {
             /** Decrease global operation count */
-            prev2 = atomic_add(&bref->bref_backend->server->stats.n_current_ops, -1);
-            ss_dassert(prev2 > 0);
-            if (prev2 <= 0)
-            {
-                MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
-                          __FUNCTION__,
-                          bref->bref_backend->server->name,
-                          bref->bref_backend->server->port);
-            }
+            ts_stats_add(bref->bref_backend->server->stats.n_current_ops, -1);
         }
     }
 }
@@ -2652,7 +3465,6 @@ static void bref_set_state(backend_ref_t* bref, bref_state_t state)
     else
     {
         int prev1;
-        int prev2;
 
         /** Increase waiter count */
         prev1 = atomic_add(&bref->bref_num_result_wait, 1);
@@ -2666,15 +3478,7 @@ static void bref_set_state(backend_ref_t* bref, bref_state_t state)
                       bref->bref_backend->server->port);
         }
         /** Increase global operation count */
-        prev2 = atomic_add(&bref->bref_backend->server->stats.n_current_ops, 1);
-        ss_dassert(prev2 >= 0);
-        if (prev2 < 0)
-        {
-            MXS_ERROR("[%s] Error: negative current operation count in backend %s:%u",
-                      __FUNCTION__,
-                      bref->bref_backend->server->name,
-                      bref->bref_backend->server->port);
-        }
+        ts_stats_add(bref->bref_backend->server->stats.n_current_ops, 1);
     }
 }
 
@@ -2745,9 +3549,9 @@ static bool connect_backend_servers(backend_ref_t*   backend_ref,
         {
             SERVER_REF* b = backend_ref[i].bref_backend;
 
-            MXS_INFO("MaxScale connections : %d (%d) in \t[%s]:%d %s",
+            MXS_INFO("MaxScale connections : %d (%" PRId64 ") in \t[%s]:%d %s",
                      b->connections,
-                     b->server->stats.n_current,
+                     ts_stats_sum(b->server->stats.n_current),
                      b->server->name,
                      b->server->port,
                      STRSRVSTATUS(b->server));
@@ -2773,49 +3577,13 @@ static bool connect_backend_servers(backend_ref_t*   backend_ref,
             /** New server connection */
             else
             {
-                backend_ref[i].bref_dcb = dcb_connect(b->server,
-                                                      session,
-                                                      b->server->protocol);
-
-                if (backend_ref[i].bref_dcb != NULL)
+                if (connect_backend(&backend_ref[i], session))
                 {
                     servers_connected += 1;
-                    /**
-                     * Start executing session command
-                     * history.
-                     */
-                    execute_sescmd_history(&backend_ref[i]);
-                    /**
-                     * When server fails, this callback
-                     * is called.
-                     * !!! Todo, routine which removes
-                     * corresponding entries from the hash
-                     * table.
-                     */
-
-                    backend_ref[i].bref_state = 0;
-                    bref_set_state(&backend_ref[i], BREF_IN_USE);
-                    /**
-                     * Increase backend connection counter.
-                     * Server's stats are _increased_ in
-                     * dcb.c:dcb_alloc !
-                     * But decreased in the calling function
-                     * of dcb_close.
-                     */
-                    atomic_add(&b->connections, 1);
-
-                    dcb_add_callback(backend_ref[i].bref_dcb,
-                                     DCB_REASON_NOT_RESPONDING,
-                                     &router_handle_state_switch,
-                                     (void *)&backend_ref[i]);
                 }
                 else
                 {
                     succp = false;
-                    MXS_ERROR("Unable to establish "
-                              "connection with slave [%s]:%d",
-                              b->server->name,
-                              b->server->port);
                     /* handle connect error */
                     break;
                 }
@@ -2865,6 +3633,84 @@ static bool connect_backend_servers(backend_ref_t*   backend_ref,
     return succp;
 }
 
+/**
+ * Connect to a server and replay the session command history on it
+ *
+ * Router session must be locked.
+ *
+ * @param bref    The backend reference of the server
+ * @param session The session of the client
+ * @return True if the connection was created
+ */
+static bool connect_backend(backend_ref_t* bref, MXS_SESSION* session)
+{
+    SERVER_REF* b = bref->bref_backend;
+
+    bref->bref_dcb = dcb_connect(b->server, session, b->server->protocol);
+
+    if (bref->bref_dcb == NULL)
+    {
+        MXS_ERROR("Unable to establish connection with server [%s]:%d",
+                  b->server->name, b->server->port);
+        return false;
+    }
+
+    /**
+     * The state is reset before the history is executed as it is not
+     * executed on closed references.
+     */
+    bref->bref_state = 0;
+    bref_set_state(bref, BREF_IN_USE);
+    execute_sescmd_history(bref);
+
+    /**
+     * Increase backend connection counter.
+     * Server's stats are _increased_ in
+     * dcb.c:dcb_alloc !
+     * But decreased in the calling function
+     * of dcb_close.
+     */
+    atomic_add(&b->connections, 1);
+
+    /** When server fails, this callback is called. */
+    dcb_add_callback(bref->bref_dcb,
+                     DCB_REASON_NOT_RESPONDING,
+                     &router_handle_state_switch,
+                     (void *)bref);
+    return true;
+}
+
+/**
+ * Connect to one running server, used with lazy_connect
+ *
+ * Router session must be locked.
+ *
+ * @param rses    Router client session
+ * @param session The session of the client
+ * @param name    The server to prefer or NULL for the first running server
+ * @return True if a server was connected
+ */
+static bool connect_one_backend(ROUTER_CLIENT_SES* rses, MXS_SESSION* session, const char* name)
+{
+    for (int pass = name ? 0 : 1; pass < 2; pass++)
+    {
+        for (int i = 0; i < rses->rses_nbackends; i++)
+        {
+            backend_ref_t* bref = &rses->rses_backend_ref[i];
+            SERVER* server = bref->bref_backend->server;
+
+            if (SERVER_IS_RUNNING(server) && !BREF_IS_IN_USE(bref) &&
+                (pass == 1 || strcmp(server->unique_name, name) == 0) &&
+                connect_backend(bref, session))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 /**
  * Create a generic router session property strcture.
  */
@@ -3761,9 +4607,10 @@ static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
     /**
      * If query was sent through the bref and it is waiting for reply from
      * the backend server it is necessary to send an error to the client
-     * because it is waiting for reply.
+     * because it is waiting for reply. If the query was sent to all servers,
+     * the error replaces the result of this server.
      */
-    if (BREF_IS_WAITING_RESULT(bref))
+    if (!scatter_gather_failed(rses, bref, errmsg) && BREF_IS_WAITING_RESULT(bref))
     {
         DCB* client_dcb;
         client_dcb = ses->client_dcb;
@@ -3793,14 +4640,22 @@ static bool handle_error_new_connection(ROUTER_INSTANCE*   inst,
                         &router_handle_state_switch,
                         (void *)bref);
 
-    /**
-     * Try to get replacement slave or at least the minimum
-     * number of slave connections for router session.
-     */
-    succp = connect_backend_servers(rses->rses_backend_ref,
-                                    rses->rses_nbackends,
-                                    ses,
-                                    inst);
+    if (rses->rses_config.lazy_connect)
+    {
+        /** The failed server is reconnected when it is used again */
+        succp = have_servers(rses) || connect_one_backend(rses, ses, NULL);
+    }
+    else
+    {
+        /**
+         * Try to get replacement slave or at least the minimum
+         * number of slave connections for router session.
+         */
+        succp = connect_backend_servers(rses->rses_backend_ref,
+                                        rses->rses_nbackends,
+                                        ses,
+                                        inst);
+    }
 
     if (!have_servers(rses))
     {
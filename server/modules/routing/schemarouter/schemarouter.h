@@ -64,7 +64,8 @@ enum shard_map_state
 };
 
 /**
- * A map of the shards tied to a single user.
+ * A map of the shards tied to a single user or, with shared_shard_map, a
+ * snapshot of the shards that all sessions of the router use.
  */
 typedef struct shard_map
 {
@@ -73,6 +74,8 @@ typedef struct shard_map
     SPINLOCK lock;
     time_t last_updated;
     enum shard_map_state state; /*< State of the shard map */
+    int refcount; /*< Number of users of a shared snapshot, never modified
+                   * once it is published */
 } shard_map_t;
 
 /**
@@ -98,6 +101,8 @@ typedef enum bref_state
 #define SCHEMA_ERRSTR_DUPLICATEDB "DUPDB"
 #define SCHEMA_ERR_DBNOTFOUND 1049
 #define SCHEMA_ERRSTR_DBNOTFOUND "42000"
+#define SCHEMA_ERR_CROSSSHARD 5001
+#define SCHEMA_ERRSTR_CROSSSHARD "HY000"
 /**
  * The type of the backend server
  */
@@ -290,6 +295,11 @@ typedef struct schemarouter_config_st
     double refresh_min_interval; /*< Minimum required interval between refreshes of databases */
     bool refresh_databases; /*< Are databases refreshed when they are not found in the hashtable */
     bool debug; /*< Enable verbose debug messages to clients */
+    bool shared_shard_map; /*< Use a shard map refreshed in the background */
+    bool table_sharding; /*< Map tables as well as databases to servers */
+    bool lazy_connect; /*< Connect to the servers when they are first used */
+    bool scatter_gather; /*< Send information_schema queries to all servers and merge the results */
+    bool warm_start; /*< Start with the shared shard map persisted by the previous run */
 } schemarouter_config_t;
 
 /**
@@ -308,6 +318,10 @@ typedef struct
     double          ses_average; /*< Average session length */
     int             shmap_cache_hit; /*< Shard map was found from the cache */
     int             shmap_cache_miss;/*< No shard map found from the cache */
+    int             shmap_refreshes; /*< Successful refreshes of the shared shard map */
+    int             shmap_refresh_failures; /*< Failed refreshes of the shared shard map */
+    int             n_lazy_connects; /*< Connections created on first use */
+    int             n_scatter_gather; /*< Queries sent to all servers and merged */
 } ROUTER_STATS;
 
 /**
@@ -335,10 +349,12 @@ struct router_client_session
     struct router_client_session* next; /*< List of router sessions */
     shard_map_t*
     shardmap; /*< Database hash containing names of the databases mapped to the servers that contain them */
+    bool            shardmap_shared; /*< The shard map is a reference to the shared snapshot */
     char            connect_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Database the user was trying to connect to */
     char            current_db[MYSQL_DATABASE_MAXLEN + 1]; /*< Current active database */
     init_mask_t    init; /*< Initialization state bitmask */
     GWBUF*          queue; /*< Query that was received before the session was ready */
+    struct scatter_gather* sg; /*< The query sent to all servers whose replies are merged */
     DCB*            dcb_route; /*< Internal DCB used to trigger re-routing of buffers */
     DCB*            dcb_reply; /*< Internal DCB used to send replies to the client */
     ROUTER_STATS    stats;     /*< Statistics for this router         */
@@ -356,6 +372,7 @@ struct router_client_session
 typedef struct router_instance
 {
     HASHTABLE*              shard_maps;  /*< Shard maps hashed by user name */
+    shard_map_t*            shared_map;  /*< The latest shared snapshot, protected by lock */
     SERVICE*                service;     /*< Pointer to service                 */
     ROUTER_CLIENT_SES*      connections; /*< List of client connections         */
     SPINLOCK                lock;        /*< Lock for the instance data         */